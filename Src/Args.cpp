@@ -8,6 +8,8 @@
 
 #include "Math/Math.h"
 
+#include "BVH/BVH.h"
+
 static int parse_arg_int(StringView str) {
 	return Parser(str).parse_int();
 }
@@ -16,6 +18,20 @@ static float parse_arg_float(StringView str) {
 	return Parser(str).parse_float();
 }
 
+// Comma separated list, for example: 1,2.5,4
+static Array<float> parse_arg_float_list(StringView str) {
+	Array<float> result;
+
+	Parser parser(str);
+	while (!parser.reached_end()) {
+		result.push_back(parser.parse_float());
+
+		if (!parser.match(',')) break;
+	}
+
+	return result;
+}
+
 static bool parse_arg_bool(StringView str) {
 	if (
 		str == "true" ||
@@ -49,23 +65,156 @@ struct Option {
 static void parse_args(const Array<StringView> & args, Allocator * allocator) {
 	Array<Option> options(allocator);
 
-	options.emplace_back("I"_sv, "integrator"_sv, "Choose the interagor type. Supported options: pathtracer, ao"_sv, 1, [](const Array<StringView> & args, size_t i) {
+	options.emplace_back("I"_sv, "integrator"_sv, "Choose the interagor type. Supported options: pathtracer, ao, megakernel, bake"_sv, 1, [](const Array<StringView> & args, size_t i) {
 		if (args[i + 1] == "pathtracer") {
 			cpu_config.integrator = IntegratorType::PATHTRACER;
 		} else if (args[i + 1] == "ao") {
 			cpu_config.integrator = IntegratorType::AO;
+		} else if (args[i + 1] == "megakernel") {
+			cpu_config.integrator = IntegratorType::MEGAKERNEL;
+		} else if (args[i + 1] == "bake") {
+			cpu_config.integrator = IntegratorType::BAKE;
 		} else {
-			IO::print("'{}' is not a recognized integrator type! Supported options: pathtracer, ao\n"_sv, args[i + 1]);
+			IO::print("'{}' is not a recognized integrator type! Supported options: pathtracer, ao, megakernel, bake\n"_sv, args[i + 1]);
 			IO::exit(1);
 		}
 	});
 
 	options.emplace_back("W"_sv, "width"_sv,   "Sets the width of the window"_sv,                          1, [](const Array<StringView> & args, size_t i) { cpu_config.initial_width       = parse_arg_int(args[i + 1]); });
 	options.emplace_back("H"_sv, "height"_sv,  "Sets the height of the window"_sv,                         1, [](const Array<StringView> & args, size_t i) { cpu_config.initial_height      = parse_arg_int(args[i + 1]); });
+	options.emplace_back(StringView { }, "max-width"_sv,  "Allocates the screen buffers for at least this width, resizing the window within the maximum size does not reallocate them"_sv,  1, [](const Array<StringView> & args, size_t i) { cpu_config.max_width  = Math::max(parse_arg_int(args[i + 1]), 0); });
+	options.emplace_back(StringView { }, "max-height"_sv, "Allocates the screen buffers for at least this height, resizing the window within the maximum size does not reallocate them"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.max_height = Math::max(parse_arg_int(args[i + 1]), 0); });
 	options.emplace_back("b"_sv, "bounce"_sv,  "Sets the number of pathtracing bounces"_sv,                1, [](const Array<StringView> & args, size_t i) { gpu_config.num_bounces         = Math::clamp(parse_arg_int(args[i + 1]), 0, MAX_BOUNCES - 1); });
 	options.emplace_back("N"_sv, "samples"_sv, "Sets a target number of samples to use"_sv,                1, [](const Array<StringView> & args, size_t i) { cpu_config.output_sample_index = parse_arg_int(args[i + 1]); });
 	options.emplace_back("o"_sv, "output"_sv,  "Sets path to output file. Supported formats: ppm, exr"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.output_filename     = args[i + 1]; });
 
+	options.emplace_back(StringView { }, "headless"_sv, "Renders without a window or OpenGL, the output is written to -o after -N samples"_sv, 0, [](const Array<StringView> & args, size_t i) { cpu_config.headless    = true; });
+	options.emplace_back(StringView { }, "threads"_sv, "Sets the number of ThreadPool workers, by default there is one per logical processor"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.thread_count = Math::max(parse_arg_int(args[i + 1]), 1); });
+	options.emplace_back(StringView { }, "thread-affinity"_sv, "Pins the ThreadPool workers, which keeps BVH builds and loading local to a socket on NUMA machines. Supported options: none, core, node"_sv, 1, [](const Array<StringView> & args, size_t i) {
+		if (args[i + 1] == "none") {
+			cpu_config.thread_affinity = ThreadAffinity::NONE;
+		} else if (args[i + 1] == "core") {
+			cpu_config.thread_affinity = ThreadAffinity::CORE;
+		} else if (args[i + 1] == "node") {
+			cpu_config.thread_affinity = ThreadAffinity::NODE;
+		} else {
+			IO::print("'{}' is not a recognized thread affinity! Supported options: none, core, node\n"_sv, args[i + 1]);
+			IO::exit(1);
+		}
+	});
+	options.emplace_back(StringView { }, "large-pages"_sv, "Backs the Triangle, BVH Node and index arrays of the loaders and builders with large pages, which reduces TLB misses on big scenes. Supported options: off, transparent, explicit"_sv, 1, [](const Array<StringView> & args, size_t i) {
+		if (args[i + 1] == "off") {
+			cpu_config.large_pages = LargePageMode::OFF;
+		} else if (args[i + 1] == "transparent") {
+			cpu_config.large_pages = LargePageMode::TRANSPARENT;
+		} else if (args[i + 1] == "explicit") {
+			cpu_config.large_pages = LargePageMode::EXPLICIT;
+		} else {
+			IO::print("'{}' is not a recognized large page mode! Supported options: off, transparent, explicit\n"_sv, args[i + 1]);
+			IO::exit(1);
+		}
+	});
+	options.emplace_back(StringView { }, "log-level"_sv, "Sets which messages are printed, messages are printed from a background thread. Supported options: errors, warnings, all"_sv, 1, [](const Array<StringView> & args, size_t i) {
+		if (args[i + 1] == "errors") {
+			cpu_config.log_level = IO::LogLevel::ERRORS;
+		} else if (args[i + 1] == "warnings") {
+			cpu_config.log_level = IO::LogLevel::WARNINGS;
+		} else if (args[i + 1] == "all") {
+			cpu_config.log_level = IO::LogLevel::ALL;
+		} else {
+			IO::print("'{}' is not a recognized log level! Supported options: errors, warnings, all\n"_sv, args[i + 1]);
+			IO::exit(1);
+		}
+	});
+	options.emplace_back("q"_sv, "quiet"_sv, "Only prints errors and warnings, same as --log-level warnings"_sv, 0, [](const Array<StringView> & args, size_t i) { cpu_config.log_level = IO::LogLevel::WARNINGS; });
+	options.emplace_back(StringView { }, "multi-gpu"_sv, "Distributes the samples of a headless render over all CUDA devices, results are combined at the end"_sv, 0, [](const Array<StringView> & args, size_t i) { cpu_config.enable_multi_gpu = true; });
+	options.emplace_back(StringView { }, "device"_sv,   "Sets the index of the CUDA device to render on, by default the most capable device is used"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.cuda_device = parse_arg_int(args[i + 1]); });
+
+	options.emplace_back(StringView { }, "sample-range"_sv, "Renders only the samples [first, first + count) of the image, overrides -N. Use with --dump to split a render over multiple machines"_sv, 2, [](const Array<StringView> & args, size_t i) {
+		cpu_config.sample_index_first  = Math::max(parse_arg_int(args[i + 1]), 0);
+		cpu_config.output_sample_index = Math::max(parse_arg_int(args[i + 2]), 1) - 1;
+	});
+	options.emplace_back(StringView { }, "samples-per-launch"_sv, "Renders this many samples per pixel per frame of a headless render, saves the fixed cost of a frame for every sample"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.samples_per_launch = Math::max(parse_arg_int(args[i + 1]), 1); });
+	options.emplace_back(StringView { }, "target-error"_sv, "Stops a headless render once the relative error of the image is below the given value, e.g. 0.01, -N becomes optional and acts as the maximum"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.convergence_target_error = parse_arg_float(args[i + 1]); });
+	options.emplace_back(StringView { }, "convergence-interval"_sv, "Sets how many samples pass between estimates of the error for --target-error, estimating it synchronizes with the GPU"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.convergence_interval = Math::max(parse_arg_int(args[i + 1]), 1); });
+	options.emplace_back(StringView { }, "time-budget"_sv, "Stops a headless render after the given number of seconds of rendering, -N becomes optional and acts as the maximum"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.time_budget = parse_arg_float(args[i + 1]); });
+	options.emplace_back(StringView { }, "dump"_sv,  "Writes the raw accumulators of a headless render together with its sample range to the given file"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.dump_filename = args[i + 1]; });
+	options.emplace_back(StringView { }, "checkpoint"_sv,          "Periodically saves the progress of a headless render to the given file, without stalling the render"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.checkpoint_filename = args[i + 1]; });
+	options.emplace_back(StringView { }, "checkpoint-interval"_sv, "Sets the number of samples between checkpoints (default 64)"_sv,                                             1, [](const Array<StringView> & args, size_t i) { cpu_config.checkpoint_interval = Math::max(parse_arg_int(args[i + 1]), 1); });
+	options.emplace_back(StringView { }, "resume"_sv,              "Continues a headless render from the file given by --checkpoint, if it exists"_sv,                        0, [](const Array<StringView> & args, size_t i) { cpu_config.enable_checkpoint_resume = true; });
+	options.emplace_back(StringView { }, "ray-stats"_sv, "Writes the ray throughput (Mrays/s) of a headless render per bounce to the given JSON file"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.ray_stats_filename = args[i + 1]; });
+	options.emplace_back(StringView { }, "sequence"_sv, "Renders every frame of the given sequence file headless, the outputs are numbered by frame"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.sequence_filename = args[i + 1]; });
+	options.emplace_back(StringView { }, "stream"_sv,   "Pipes the frames of --sequence as raw 8 bit RGB into the given encoder command instead of writing files, e.g. \"ffmpeg -f rawvideo -pix_fmt rgb24 -s 900x600 -i - out.mp4\""_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.stream_command = args[i + 1]; });
+	options.emplace_back(StringView { }, "server"_sv, "Keeps the Scene loaded and renders the jobs that local clients send to the given port, see RenderServer.h"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.server_port = parse_arg_int(args[i + 1]); });
+	options.emplace_back(StringView { }, "benchmark"_sv, "Runs the benchmarks defined in the given file headless and writes their timings to --benchmark-output"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.benchmark_filename = args[i + 1]; });
+	options.emplace_back(StringView { }, "benchmark-output"_sv, "Sets the JSON file the benchmark results are written to"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.benchmark_output_filename = args[i + 1]; });
+	options.emplace_back(StringView { }, "benchmark-baseline"_sv, "Compares the benchmark results against an earlier output, fails if any of them regressed"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.benchmark_baseline_filename = args[i + 1]; });
+	options.emplace_back(StringView { }, "benchmark-threshold"_sv, "Sets the regression threshold of --benchmark-baseline in percent"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.benchmark_threshold = Math::max(parse_arg_float(args[i + 1]), 0.0f); });
+	options.emplace_back(StringView { }, "traversal-benchmark"_sv, "Times only the BVH traversal kernels on fixed primary, diffuse, incoherent and shadow rays, fits the SAH node and leaf costs to the timings and writes the results to the given JSON file"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.traversal_benchmark_filename = args[i + 1]; });
+	options.emplace_back(StringView { }, "traversal-iterations"_sv, "Sets how many times every ray set is traced by --traversal-benchmark"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.traversal_benchmark_iteration_count = Math::max(parse_arg_int(args[i + 1]), 1); });
+	options.emplace_back(StringView { }, "packed-ray-buffers"_sv, "Stores the positions, directions and throughputs of the pathtracer ray buffers as float4 instead of separate x, y and z arrays"_sv, 0, [](const Array<StringView> & args, size_t i) { cpu_config.enable_packed_ray_buffers = true; });
+	options.emplace_back(StringView { }, "compact-ray-payloads"_sv, "Stores the directions, throughputs and shadow illumination of the pathtracer material and shadow ray buffers at reduced precision"_sv, 0, [](const Array<StringView> & args, size_t i) { cpu_config.enable_compact_ray_payloads = true; });
+	options.emplace_back(StringView { }, "bvh8-short-stack"_sv, "Traverses the BVH8 with a short stack that restarts from the root on overflow instead of the shared memory stack"_sv, 0, [](const Array<StringView> & args, size_t i) { cpu_config.enable_bvh8_short_stack = true; });
+	options.emplace_back(StringView { }, "shared-stack-size"_sv, "Sets the size of the shared memory part of the traversal stack used by --traversal-benchmark"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.traversal_benchmark_shared_stack_size = Math::clamp(parse_arg_int(args[i + 1]), 1, BVH_STACK_SIZE - 1); });
+	options.emplace_back(StringView { }, "bvh-report"_sv, "Builds the BVH of every OBJ/PLY scene file with the SAH and SBVH builders for every swept setting and writes build time, memory, node count, SAH cost and duplication to the given CSV file"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.bvh_report_filename = args[i + 1]; });
+	options.emplace_back(StringView { }, "bvh-report-sah-node"_sv,   "Comma separated SAH node costs swept by --bvh-report"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.bvh_report_sah_cost_node = parse_arg_float_list(args[i + 1]); });
+	options.emplace_back(StringView { }, "bvh-report-sah-leaf"_sv,   "Comma separated SAH leaf costs swept by --bvh-report"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.bvh_report_sah_cost_leaf = parse_arg_float_list(args[i + 1]); });
+	options.emplace_back(StringView { }, "bvh-report-sbvh-alpha"_sv, "Comma separated SBVH alphas swept by --bvh-report"_sv,     1, [](const Array<StringView> & args, size_t i) { cpu_config.bvh_report_sbvh_alpha    = parse_arg_float_list(args[i + 1]); });
+	options.emplace_back(StringView { }, "trace"_sv, "Writes the CPU and GPU timings of the given number of frames to a Chrome trace-event JSON file, which can be opened in Perfetto"_sv, 2, [](const Array<StringView> & args, size_t i) {
+		cpu_config.trace_filename    = args[i + 1];
+		cpu_config.trace_frame_count = Math::max(parse_arg_int(args[i + 2]), 1);
+	});
+	options.emplace_back(StringView { }, "startup-report"_sv, "Prints the wall and CPU time of every load phase, the slowest Assets and the critical path of the initialization. Combine with --trace to also get a trace of it"_sv, 0, [](const Array<StringView> & args, size_t i) { cpu_config.enable_startup_report = true; });
+	options.emplace_back(StringView { }, "merge"_sv, "Merges the given accumulator file (written by --dump) into -o instead of rendering, can be used multiple times"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.merge_filenames.push_back(args[i + 1]); });
+
+	options.emplace_back(StringView { }, "views"_sv, "Renders several Cameras derived from the Scene Camera in one wavefront, every view after the first is written to -o with _view<n> appended. Supported options: single, stereo, cubemap"_sv, 1, [](const Array<StringView> & args, size_t i) {
+		if (args[i + 1] == "single") {
+			cpu_config.view_layout = ViewLayout::SINGLE;
+		} else if (args[i + 1] == "stereo") {
+			cpu_config.view_layout = ViewLayout::STEREO;
+		} else if (args[i + 1] == "cubemap") {
+			cpu_config.view_layout = ViewLayout::CUBEMAP;
+		} else {
+			IO::print("'{}' is not a recognized view layout! Supported options: single, stereo, cubemap\n"_sv, args[i + 1]);
+			IO::exit(1);
+		}
+	});
+	options.emplace_back(StringView { }, "stereo-separation"_sv, "Sets the distance between the eyes of --views stereo"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.stereo_separation = parse_arg_float(args[i + 1]); });
+
+	options.emplace_back(StringView { }, "bake-resolution"_sv, "Sets the size in texels of the tile of every Mesh in the atlas of -I bake"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.bake_resolution = parse_arg_int(args[i + 1]); });
+	options.emplace_back(StringView { }, "bake-dilation"_sv,   "Sets the number of texels the UV islands of -I bake are grown by"_sv,     1, [](const Array<StringView> & args, size_t i) { cpu_config.bake_dilation   = parse_arg_int(args[i + 1]); });
+
+	options.emplace_back(StringView { }, "exr-compression"_sv, "Sets the compression of EXR output. Supported options: none, rle, zip, piz"_sv, 1, [](const Array<StringView> & args, size_t i) {
+		if (args[i + 1] == "none") {
+			cpu_config.exr_compression = EXRCompression::NONE;
+		} else if (args[i + 1] == "rle") {
+			cpu_config.exr_compression = EXRCompression::RLE;
+		} else if (args[i + 1] == "zip") {
+			cpu_config.exr_compression = EXRCompression::ZIP;
+		} else if (args[i + 1] == "piz") {
+			cpu_config.exr_compression = EXRCompression::PIZ;
+		} else {
+			IO::print("'{}' is not a recognized EXR compression! Supported options: none, rle, zip, piz\n"_sv, args[i + 1]);
+			IO::exit(1);
+		}
+	});
+	options.emplace_back(StringView { }, "exr-float"_sv,  "EXR output uses full precision floats instead of halfs"_sv,                    0, [](const Array<StringView> & args, size_t i) { cpu_config.exr_half_precision = false; });
+	options.emplace_back(StringView { }, "traversal-heatmap"_sv, "Records BVH traversal cost per pixel in an AOV (written to traversal.exr) and shows it as false colour. Supported options: nodes, triangles, shadow"_sv, 1, [](const Array<StringView> & args, size_t i) {
+		if (args[i + 1] == "nodes") {
+			gpu_config.traversal_heatmap = TraversalHeatmap::NODES;
+		} else if (args[i + 1] == "triangles") {
+			gpu_config.traversal_heatmap = TraversalHeatmap::TRIANGLES;
+		} else if (args[i + 1] == "shadow") {
+			gpu_config.traversal_heatmap = TraversalHeatmap::SHADOW;
+		} else {
+			IO::print("'{}' is not a recognized traversal heatmap! Supported options: nodes, triangles, shadow\n"_sv, args[i + 1]);
+			IO::exit(1);
+		}
+		gpu_config.aov_mask |= 1u << int(AOVType::TRAVERSAL_COST);
+	});
+	options.emplace_back(StringView { }, "denoise"_sv, "Denoises the output of headless renders (-N) with Open Image Denoise, using the Albedo and Normal AOVs (which are enabled and written to the output as well)"_sv, 0, [](const Array<StringView> & args, size_t i) { cpu_config.enable_denoiser = true; });
+	options.emplace_back(StringView { }, "exr-layers"_sv, "Enabled AOVs are written as layers of the EXR output instead of as separate files"_sv, 0, [](const Array<StringView> & args, size_t i) { cpu_config.exr_multilayer = true; });
+
 	options.emplace_back("s"_sv, "scene"_sv, "Sets path to scene file. Supported formats: Mitsuba XML, OBJ, and PLY"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.scene_filenames.push_back(args[i + 1]); });
 	options.emplace_back("S"_sv, "sky"_sv,   "Sets path to sky file. Supported formats: HDR"_sv,                         1, [](const Array<StringView> & args, size_t i) { cpu_config.sky_filename = args[i + 1]; });
 
@@ -84,20 +233,124 @@ static void parse_args(const Array<StringView> & args, Allocator * allocator) {
 		}
 	});
 
+	options.emplace_back(StringView { }, "traversal"_sv, "Sets the traversal backend of the wavefront trace Kernels. Supported options: software, optix"_sv, 1, [](const Array<StringView> & args, size_t i) {
+		if (args[i + 1] == "software") {
+			cpu_config.traversal_backend = TraversalBackend::SOFTWARE;
+		} else if (args[i + 1] == "optix") {
+			cpu_config.traversal_backend = TraversalBackend::OPTIX;
+		} else {
+			IO::print("'{}' is not a recognized traversal backend! Supported options: software, optix\n"_sv, args[i + 1]);
+			IO::exit(1);
+		}
+	});
+
 	options.emplace_back(StringView { }, "nee"_sv, "Enables or disables Next Event Estimation"_sv,        1, [](const Array<StringView> & args, size_t i) { gpu_config.enable_next_event_estimation        = parse_arg_bool(args[i + 1]); });
 	options.emplace_back(StringView { }, "mis"_sv, "Enables or disables Multiple Importance Sampling"_sv, 1, [](const Array<StringView> & args, size_t i) { gpu_config.enable_multiple_importance_sampling = parse_arg_bool(args[i + 1]); });
+	options.emplace_back(StringView { }, "light-bvh"_sv, "Enables or disables sampling lights using a Light BVH"_sv, 1, [](const Array<StringView> & args, size_t i) { gpu_config.enable_light_bvh = parse_arg_bool(args[i + 1]); });
+	options.emplace_back(StringView { }, "sky-sampling"_sv, "Enables or disables importance sampling the Sky during Next Event Estimation"_sv, 1, [](const Array<StringView> & args, size_t i) { gpu_config.enable_sky_sampling = parse_arg_bool(args[i + 1]); });
+	options.emplace_back(StringView { }, "shadow-cache"_sv, "Enables or disables testing the last occluder of a Pixel before traversing the BVH with a shadow Ray"_sv, 1, [](const Array<StringView> & args, size_t i) { gpu_config.enable_shadow_occluder_cache = parse_arg_bool(args[i + 1]); });
+	options.emplace_back(StringView { }, "restir"_sv, "Enables or disables ReSTIR resampling of the light Triangles on the primary hit, with temporal and spatial reuse"_sv, 1, [](const Array<StringView> & args, size_t i) { gpu_config.enable_restir = parse_arg_bool(args[i + 1]); });
+	options.emplace_back(StringView { }, "restir-candidates"_sv, "Sets the number of light candidates ReSTIR generates per Pixel per frame"_sv, 1, [](const Array<StringView> & args, size_t i) { gpu_config.restir_candidate_count = parse_arg_int(args[i + 1]); });
+	options.emplace_back(StringView { }, "path-guiding"_sv, "Enables or disables path guiding, Diffuse and Plastic bounces also sample a distribution of incident radiance learned while rendering"_sv, 1, [](const Array<StringView> & args, size_t i) { gpu_config.enable_path_guiding = parse_arg_bool(args[i + 1]); });
+	options.emplace_back(StringView { }, "radiance-cache"_sv, "Enables or disables terminating paths on Diffuse and Plastic bounces with the estimate of a world space radiance cache learned while rendering, which is biased"_sv, 1, [](const Array<StringView> & args, size_t i) { gpu_config.enable_radiance_cache = parse_arg_bool(args[i + 1]); });
+	options.emplace_back(StringView { }, "adjoint-roulette"_sv, "Enables or disables Russian roulette based on the expected contribution of a path to its Pixel, estimated with the radiance cache and the accumulated image (not with SVGF)"_sv, 1, [](const Array<StringView> & args, size_t i) { gpu_config.enable_adjoint_russian_roulette = parse_arg_bool(args[i + 1]); });
+	options.emplace_back(StringView { }, "radiance-cache-min-bounce"_sv, "Sets the first bounce at which paths may terminate into the radiance cache, higher values reduce the bias"_sv, 1, [](const Array<StringView> & args, size_t i) { gpu_config.radiance_cache_min_bounce = parse_arg_int(args[i + 1]); });
+	options.emplace_back(StringView { }, "sobol"_sv, "Enables or disables generating samples from an Owen scrambled Sobol sequence instead of the PMJ table, which is stratified for up to 4096 samples"_sv, 1, [](const Array<StringView> & args, size_t i) { gpu_config.enable_sobol_sampler = parse_arg_bool(args[i + 1]); });
+	options.emplace_back(StringView { }, "raster-primary"_sv, "Enables or disables rasterising the primary visibility instead of tracing the primary Rays, requires a window and a pinhole Camera"_sv, 1, [](const Array<StringView> & args, size_t i) { gpu_config.enable_raster_primary = parse_arg_bool(args[i + 1]); });
+	options.emplace_back(StringView { }, "motion-blur"_sv, "Enables or disables motion blur, moving Meshes are interpolated between their previous and current transform"_sv, 1, [](const Array<StringView> & args, size_t i) { gpu_config.enable_motion_blur = parse_arg_bool(args[i + 1]); });
+
+	options.emplace_back(StringView { }, "adaptive"_sv,           "Enables or disables adaptive sampling, Pixels that have converged stop receiving new samples"_sv, 1, [](const Array<StringView> & args, size_t i) { gpu_config.enable_adaptive_sampling    = parse_arg_bool (args[i + 1]); });
+	options.emplace_back(StringView { }, "variable-rate"_sv,      "Enables or disables variable rate sampling, Tiles away from the foveation centre are sampled on fewer frames"_sv, 1, [](const Array<StringView> & args, size_t i) { gpu_config.enable_variable_rate = parse_arg_bool(args[i + 1]); });
+	options.emplace_back(StringView { }, "variable-rate-mask"_sv, "Sets a greyscale image used as sampling rate map instead of foveation, white is full rate. Enables variable rate sampling"_sv, 1, [](const Array<StringView> & args, size_t i) {
+		cpu_config.variable_rate_mask_filename = args[i + 1];
+		gpu_config.enable_variable_rate        = true;
+	});
+	options.emplace_back(StringView { }, "fovea"_sv, "Sets the foveation centre (x, y relative to the screen) and the full rate radius (relative to the screen height) of variable rate sampling"_sv, 3, [](const Array<StringView> & args, size_t i) {
+		gpu_config.variable_rate_centre_x = parse_arg_float(args[i + 1]);
+		gpu_config.variable_rate_centre_y = parse_arg_float(args[i + 2]);
+		gpu_config.variable_rate_radius   = parse_arg_float(args[i + 3]);
+	});
+	options.emplace_back(StringView { }, "reprojection"_sv, "Enables or disables reprojecting the accumulated Pixels when the Camera moves instead of restarting the accumulation (without SVGF)"_sv, 1, [](const Array<StringView> & args, size_t i) { gpu_config.enable_reprojection = parse_arg_bool(args[i + 1]); });
+	options.emplace_back(StringView { }, "adaptive-threshold"_sv, "Sets the relative error below which adaptive sampling considers a Pixel converged"_sv,          1, [](const Array<StringView> & args, size_t i) { gpu_config.adaptive_sampling_threshold = parse_arg_float(args[i + 1]); });
+
+	options.emplace_back(StringView { }, "autotune"_sv, "Measures the fastest register limit and block sizes of the kernels on the current scene, the result is reused on later runs on the same device"_sv, 0, [](const Array<StringView> & args, size_t i) { cpu_config.enable_autotune = true; });
+	options.emplace_back(StringView { }, "max-registers"_sv, "Sets the register limit of the pathtracer kernels, overrides the tuned value"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.max_registers = parse_arg_int(args[i + 1]); });
+	options.emplace_back(StringView { }, "specialise"_sv, "Compiles the feature toggles (NEE, MIS, Russian Roulette, SVGF, motion blur, mipmapping, AOVs) into the kernels, changing them recompiles the kernels"_sv, 0, [](const Array<StringView> & args, size_t i) { cpu_config.enable_specialised_kernels = true; });
+	options.emplace_back(StringView { }, "async-ui"_sv, "Enables or disables running the GUI while the GPU is still rendering, frames are only submitted once the previous one has finished"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.enable_async_ui = parse_arg_bool(args[i + 1]); });
+	options.emplace_back(StringView { }, "graph"_sv, "Enables or disables submitting each frame as a single CUDA Graph"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.enable_cuda_graph = parse_arg_bool(args[i + 1]); });
+
+	options.emplace_back(StringView { }, "treelet-queues"_sv, "Enables or disables tracing the BVH8 by queueing the Rays per BLAS after traversing the TLAS"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.enable_treelet_queues = parse_arg_bool(args[i + 1]); });
+	options.emplace_back(StringView { }, "concurrent-materials"_sv, "Enables or disables launching the Material Kernels of a bounce concurrently on separate streams"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.enable_concurrent_materials = parse_arg_bool(args[i + 1]); });
+	options.emplace_back(StringView { }, "fused-taa"_sv, "Enables or disables resolving SVGF and TAA in a single Kernel instead of three passes over the frame"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.enable_fused_taa = parse_arg_bool(args[i + 1]); });
+	options.emplace_back(StringView { }, "shadow-overlap"_sv, "Enables or disables tracing the shadow Rays of a bounce concurrently with the extension Rays of the next bounce"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.enable_shadow_overlap = parse_arg_bool(args[i + 1]); });
+	options.emplace_back(StringView { }, "persistent"_sv, "Enables or disables persistent (occupancy sized) Grids for the Sort and Material Kernels"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.enable_persistent_queues = parse_arg_bool(args[i + 1]); });
+
+	options.emplace_back(StringView { }, "batch-size"_sv, "Sets the maximum number of pixels that are rendered in one batch, by default this is derived from available GPU memory"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.batch_size = parse_arg_int(args[i + 1]); });
+	options.emplace_back(StringView { }, "megakernel-threshold"_sv, "Renders frames with at most this many pixels with a single fused path tracing kernel instead of the wavefront kernels (requires bvh8)"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.megakernel_threshold = parse_arg_int(args[i + 1]); });
+	options.emplace_back(StringView { }, "megakernel-tail"_sv, "Finishes the remaining paths with a single fused path tracing kernel once at most this many are alive at the start of a bounce (requires bvh8)"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.megakernel_tail_threshold = parse_arg_int(args[i + 1]); });
+	options.emplace_back(StringView { }, "memory-budget"_sv, "Sets an upper bound in MB on the GPU memory the batch size is derived from, so that multiple processes can share a GPU"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.gpu_memory_budget = parse_arg_int(args[i + 1]); });
+	options.emplace_back(StringView { }, "render-scale"_sv, "Renders at this fraction (0.25 to 1) of the window resolution and upscales the result, temporally if SVGF and TAA are enabled"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.render_scale = Math::clamp(parse_arg_float(args[i + 1]), 0.25f, 1.0f); });
+	options.emplace_back(StringView { }, "samples-per-present"_sv, "Renders this many samples per presented frame while the camera is still, the Window and GUI update at a lower rate"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.samples_per_present = Math::max(parse_arg_int(args[i + 1]), 1); });
+	options.emplace_back(StringView { }, "frame-budget"_sv, "Sets a GPU frame time budget in milliseconds, while the camera moves the number of bounces is lowered to stay within it"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.frame_time_budget = parse_arg_float(args[i + 1]); });
+	options.emplace_back(StringView { }, "event-interval"_sv, "Records the GPU timing events only on every Nth frame (0 for never) unless timings are shown or profiled, saves the CPU and driver overhead of timing every Kernel"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.event_interval = Math::max(parse_arg_int(args[i + 1]), 0); });
+
+	options.emplace_back(StringView { }, "builder"_sv, "Sets the builder used for the binary BLAS BVH. Supported options: sah, lbvh, binned"_sv, 1, [](const Array<StringView> & args, size_t i) {
+		if (args[i + 1] == "sah") {
+			cpu_config.bvh_builder = BVHBuilderType::SAH;
+		} else if (args[i + 1] == "lbvh") {
+			cpu_config.bvh_builder = BVHBuilderType::LBVH;
+		} else if (args[i + 1] == "binned") {
+			cpu_config.bvh_builder = BVHBuilderType::BINNED;
+		} else {
+			IO::print("'{}' is not a recognized BVH builder! Supported options: sah, lbvh, binned\n"_sv, args[i + 1]);
+			IO::exit(1);
+		}
+	});
+	options.emplace_back(StringView { }, "bvh-policy"_sv, "Sets how the binary BVH of every BLAS is built, Meshes in Mitsuba scenes can override it. Supported options: global, auto, sah, sbvh, lbvh, binned"_sv, 1, [](const Array<StringView> & args, size_t i) {
+		if (!BVH::parse_build_policy(args[i + 1], cpu_config.bvh_build_policy)) {
+			IO::print("'{}' is not a recognized BVH build policy! Supported options: global, auto, sah, sbvh, lbvh, binned\n"_sv, args[i + 1]);
+			IO::exit(1);
+		}
+	});
+	options.emplace_back(StringView { }, "bvh-auto-sbvh-max"_sv, "Sets the Triangle count above which the auto BVH build policy never uses spatial splits"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.bvh_auto_sbvh_max_triangles = parse_arg_int(args[i + 1]); });
+	options.emplace_back(StringView { }, "bvh-auto-sbvh-overlap"_sv, "Sets the sibling overlap of the SAH BVH above which the auto BVH build policy rebuilds a Mesh with spatial splits"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.bvh_auto_sbvh_min_overlap = parse_arg_float(args[i + 1]); });
+	options.emplace_back(StringView { }, "tlas-builder"_sv, "Sets the builder used for the TLAS. Supported options: sah, binned"_sv, 1, [](const Array<StringView> & args, size_t i) {
+		if (args[i + 1] == "sah") {
+			cpu_config.tlas_builder = BVHBuilderType::SAH;
+		} else if (args[i + 1] == "binned") {
+			cpu_config.tlas_builder = BVHBuilderType::BINNED;
+		} else {
+			IO::print("'{}' is not a recognized TLAS builder! Supported options: sah, binned\n"_sv, args[i + 1]);
+			IO::exit(1);
+		}
+	});
+
+	options.emplace_back(StringView { }, "tlas-refit"_sv, "TLAS is refitted until its SAH cost exceeds this factor of the cost after the last rebuild, 0 disables refitting"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.tlas_refit_threshold = parse_arg_float(args[i + 1]); });
+	options.emplace_back(StringView { }, "async-tlas"_sv, "TLAS is built on a separate thread while the GPU renders, Scene updates become visible one frame later"_sv, 0, [](const Array<StringView> & args, size_t i) { cpu_config.enable_async_tlas = true; });
 
 	options.emplace_back(StringView { }, "force-rebuild"_sv, "BVH will not be loaded from disk but rebuild from scratch"_sv, 0, [](const Array<StringView> & args, size_t i) { cpu_config.bvh_force_rebuild = true; });
+	options.emplace_back(StringView { }, "bvh-compression"_sv, "Sets the deflate level (0-10) of BVH files, lower levels write faster but produce larger files"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.bvh_compression_level = Math::clamp(parse_arg_int(args[i + 1]), 0, 10); });
+	options.emplace_back(StringView { }, "bvh-cache"_sv, "Stores the final BVH uncompressed next to the Mesh, it is memory mapped on the next load"_sv, 0, [](const Array<StringView> & args, size_t i) { cpu_config.enable_bvh_cache = true; });
+	options.emplace_back(StringView { }, "release-host-data"_sv, "Frees the host copies of Meshes and Textures after uploading them, they are read back from the BVH and Texture files when needed again"_sv, 0, [](const Array<StringView> & args, size_t i) { cpu_config.enable_host_data_release = true; });
 
 	options.emplace_back("O"_sv,  "optimize"_sv,    "Enables or disables BVH optimzation post-processing step"_sv,               1, [](const Array<StringView> & args, size_t i) { cpu_config.enable_bvh_optimization       = parse_arg_bool(args[i + 1]); });
+	options.emplace_back(StringView { }, "restructure"_sv, "Enables or disables treelet restructuring of the BVH, a much faster optimization than -O that is run before it"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.enable_bvh_restructuring = parse_arg_bool(args[i + 1]); });
+	options.emplace_back(StringView { }, "restructure-passes"_sv, "Sets the maximum number of treelet restructuring passes"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.bvh_restructure_iterations = Math::max(parse_arg_int(args[i + 1]), 1); });
 	options.emplace_back("Ot"_sv, "opt-time"_sv,    "Sets time limit (in seconds) for BVH optimization"_sv,                      1, [](const Array<StringView> & args, size_t i) { cpu_config.bvh_optimizer_max_time        = parse_arg_int (args[i + 1]); });
 	options.emplace_back("Ob"_sv, "opt-batches"_sv, "Sets a limit on the maximum number of batches used in BVH optimization"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.bvh_optimizer_max_num_batches = parse_arg_int (args[i + 1]); });
+	options.emplace_back("Og"_sv, "opt-gain"_sv,    "Stops BVH optimization once the SAH cost improves by less than this fraction per second"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.bvh_optimizer_min_gain = parse_arg_float(args[i + 1]); });
 
 	options.emplace_back(StringView { }, "sah-node"_sv,   "Sets the SAH cost of an internal BVH node"_sv,                                                             1, [](const Array<StringView> & args, size_t i) { cpu_config.sah_cost_node = parse_arg_float(args[i + 1]); });
 	options.emplace_back(StringView { }, "sah-leaf"_sv,   "Sets the SAH cost of a leaf BVH node"_sv,                                                                  1, [](const Array<StringView> & args, size_t i) { cpu_config.sah_cost_leaf = parse_arg_float(args[i + 1]); });
 	options.emplace_back(StringView { }, "sbvh-alpha"_sv, "Sets the SBVH alpha constant. An alpha of 1 results in a regular BVH, alpha of 0 results in full SBVH"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.sbvh_alpha    = parse_arg_float(args[i + 1]); });
+	options.emplace_back(StringView { }, "bvh-presplit"_sv, "Splits large or elongated Triangles before BVH construction, the argument is the number of additional references as a fraction of the Triangle count (0 disables)"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.bvh_presplit_budget = Math::max(parse_arg_float(args[i + 1]), 0.0f); });
 
 	options.emplace_back(StringView { }, "mipmap"_sv,     "Enables or disables texture mipmapping"_sv,                                                     1, [](const Array<StringView> & args, size_t i) { gpu_config.enable_mipmapping = parse_arg_bool(args[i + 1]); });
+	options.emplace_back(StringView { }, "texture-streaming"_sv, "Streams texture mip levels into VRAM based on GPU feedback, the argument is the budget in MB"_sv, 1, [](const Array<StringView> & args, size_t i) {
+		cpu_config.enable_texture_streaming = true;
+		cpu_config.texture_streaming_budget = parse_arg_int(args[i + 1]);
+	});
+	options.emplace_back(StringView { }, "gpu-mipmap"_sv, "Generates the mipmaps of uncompressed textures on the GPU, only the top level is uploaded"_sv, 0, [](const Array<StringView> & args, size_t i) { cpu_config.enable_gpu_mipmapping = true; });
 	options.emplace_back(StringView { }, "mip-filter"_sv, "Sets the downsampling filter for creating mipmaps: Supported options: box, lanczos, kaiser"_sv, 1, [](const Array<StringView> & args, size_t i) {
 		if (args[i + 1] == "box") {
 			cpu_config.mipmap_filter = MipmapFilterType::BOX;
@@ -111,6 +364,35 @@ static void parse_args(const Array<StringView> & args, Allocator * allocator) {
 		}
 	});
 	options.emplace_back("c"_sv, "compress"_sv, "Enables or disables texture block compression"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.enable_block_compression = parse_arg_bool(args[i + 1]); });
+	options.emplace_back(StringView { }, "compress-quality"_sv, "Sets the texture block compression quality, options: (fast, high)"_sv, 1, [](const Array<StringView> & args, size_t i) {
+		if (args[i + 1] == "fast") {
+			cpu_config.block_compression_quality = BlockCompressionQuality::FAST;
+		} else if (args[i + 1] == "high") {
+			cpu_config.block_compression_quality = BlockCompressionQuality::HIGH;
+		} else {
+			IO::print("'{}' is not a recognized Block Compression quality!\n"_sv, args[i + 1]);
+			IO::exit(1);
+		}
+	});
+	options.emplace_back(StringView { }, "compress-format"_sv, "Sets the texture block compression format, options: (bc1, bc7)"_sv, 1, [](const Array<StringView> & args, size_t i) {
+		if (args[i + 1] == "bc1") {
+			cpu_config.block_compression_format = BlockCompressionFormat::BC1;
+		} else if (args[i + 1] == "bc7") {
+			cpu_config.block_compression_format = BlockCompressionFormat::BC7;
+		} else {
+			IO::print("'{}' is not a recognized Block Compression format!\n"_sv, args[i + 1]);
+			IO::exit(1);
+		}
+	});
+	options.emplace_back(StringView { }, "compress-sky"_sv, "Enables or disables BC6H block compression of the Sky"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.enable_sky_block_compression = parse_arg_bool(args[i + 1]); });
+	options.emplace_back(StringView { }, "srgb-textures"_sv, "Keeps 8 bit Textures and sRGB DDS Textures sRGB encoded, they are decoded by the texture units when sampled instead of on load"_sv, 0, [](const Array<StringView> & args, size_t i) { cpu_config.enable_srgb_textures = true; });
+	options.emplace_back(StringView { }, "gpu-jpeg"_sv, "Decodes JPEG Textures on the GPU with nvJPEG (requires a build with ENABLE_NVJPEG), other formats still use stb_image"_sv, 0, [](const Array<StringView> & args, size_t i) { cpu_config.enable_gpu_jpeg_decoding = true; });
+	options.emplace_back(StringView { }, "texture-cache"_sv, "Stores decoded Textures with their Mipmaps next to the image, they are loaded without decoding on the next run"_sv, 0, [](const Array<StringView> & args, size_t i) { cpu_config.enable_texture_cache = true; });
+	options.emplace_back(StringView { }, "mesh-lods"_sv, "Loads the simplified versions <file>.lod1 up to <file>.lod3 of every mesh file if they exist, distant Meshes are traced through them (BVH8 only)"_sv, 0, [](const Array<StringView> & args, size_t i) { cpu_config.enable_mesh_lods = true; gpu_config.enable_geometric_lod = true; });
+	options.emplace_back(StringView { }, "lod-bias"_sv, "Scales the Ray Cone footprint that picks the level of detail of a Mesh, higher values pick coarser levels"_sv, 1, [](const Array<StringView> & args, size_t i) { gpu_config.geometric_lod_bias = parse_arg_float(args[i + 1]); });
+	options.emplace_back(StringView { }, "analytic-spheres"_sv, "Intersects non emissive Mitsuba spheres exactly instead of tessellating them into Triangles (disables OptiX and the visibility buffer like Curves do)"_sv, 0, [](const Array<StringView> & args, size_t i) { cpu_config.enable_analytic_spheres = true; });
+	options.emplace_back(StringView { }, "out-of-core"_sv, "Allocates the Triangles and BVH Nodes in managed memory, so that a Scene that does not fit in VRAM renders from Host memory instead of failing"_sv, 0, [](const Array<StringView> & args, size_t i) { cpu_config.enable_out_of_core_geometry = true; });
+	options.emplace_back(StringView { }, "snapshot"_sv, "Stores the loaded Scene with its BVHs and decoded Textures in a single file, it is loaded without parsing the scene on the next run"_sv, 0, [](const Array<StringView> & args, size_t i) { cpu_config.enable_scene_snapshot = true; });
 
 	options.emplace_back("h"_sv, "help"_sv, "Displays this message"_sv, 0, [&options](const Array<StringView> & args, size_t i) {
 		for (int o = 0; o < options.size(); o++) {
@@ -182,3 +464,13 @@ void Args::parse(int num_args, char ** args) {
 	}
 	parse_args(arguments, &allocator);
 }
+
+void Args::parse(const Array<StringView> & args) {
+	StackAllocator<KILOBYTES(4)> allocator;
+	Array<StringView> arguments(&allocator);
+	arguments.push_back(StringView { }); // parse_args skips the program name
+	for (size_t i = 0; i < args.size(); i++) {
+		arguments.push_back(args[i]);
+	}
+	parse_args(arguments, &allocator);
+}
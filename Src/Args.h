@@ -1,5 +1,8 @@
 #pragma once
+#include "Core/Array.h"
+#include "Core/StringView.h"
 
 namespace Args {
 	void parse(int num_args, char ** args);
+	void parse(const Array<StringView> & args); // Options only, without the program name in front
 }
@@ -7,13 +7,14 @@
 
 #include "BVHLoader.h"
 #include "TextureLoader.h"
+#include "Mitsuba/SerializedLoader.h"
 
 #include "Util/Util.h"
 #include "Util/StringUtil.h"
 #include "Util/ThreadPool.h"
 #include "Util/Geometry.h"
 
-AssetManager::AssetManager(Allocator * allocator) : mesh_datas(allocator), materials(allocator), media(allocator), textures(allocator), mesh_data_cache(allocator), texture_cache(allocator) {
+AssetManager::AssetManager(Allocator * allocator) : mesh_datas(allocator), materials(allocator), media(allocator), textures(allocator), mesh_data_cache(allocator), texture_cache(allocator), mesh_data_content_cache(allocator) {
 	Material default_material = { };
 	default_material.name    = "Default";
 	default_material.diffuse = Vector3(1.0f, 0.0f, 1.0f);
@@ -22,11 +23,55 @@ AssetManager::AssetManager(Allocator * allocator) : mesh_datas(allocator), mater
 	Medium default_medium = { };
 	default_medium.name = "Default";
 	add_medium(std::move(default_medium));
+
+	load_timer.start();
 }
 
 // NOTE: Seemingly pointless desctructor needed here since ThreadPool is
 // forward declared, so its destructor is not available in the header file
-AssetManager::~AssetManager() = default;
+AssetManager::~AssetManager() {
+	// Only reached if wait_until_loaded was never called, there is no guarantee the ThreadPool is still alive here
+	for (size_t i = 0; i < bvh_saves_pending.size(); i++) {
+		bvh_saves_pending[i]();
+	}
+}
+
+template<typename BVHType>
+static OwnPtr<BVH> copy_bvh(const BVH & bvh) {
+	const BVHType & bvh_typed = static_cast<const BVHType &>(bvh);
+
+	OwnPtr<BVHType> copy = make_owned<BVHType>();
+	copy->indices = bvh_typed.indices;
+	copy->nodes   = bvh_typed.nodes;
+	return copy;
+}
+
+// Deep copy of the Triangles and final BVH, used to write BVH files after the MeshData has been handed out
+static MeshData copy_mesh_data(const MeshData & mesh_data) {
+	MeshData copy = { };
+	copy.triangles        = mesh_data.triangles;
+	copy.bvh_build_policy = mesh_data.bvh_build_policy;
+
+	switch (cpu_config.bvh_type) {
+		case BVHType::BVH:
+		case BVHType::SBVH: copy.bvh = copy_bvh<BVH2>(*mesh_data.bvh.get()); break;
+		case BVHType::BVH4: copy.bvh = copy_bvh<BVH4>(*mesh_data.bvh.get()); break;
+		case BVHType::BVH8: copy.bvh = copy_bvh<BVH8>(*mesh_data.bvh.get()); break;
+		default: ASSERT_UNREACHABLE();
+	}
+
+	return copy;
+}
+
+void AssetManager::defer_bvh_save(ThreadPool::Work && work) {
+	MutexLock lock(bvh_saves_mutex);
+
+	if (assets_loaded) {
+		ThreadPool::submit(std::move(work), ThreadPool::Priority::BACKGROUND);
+	} else {
+		bvh_saves_pending.push_back(std::move(work));
+	}
+}
 
 Handle<MeshData> AssetManager::new_mesh_data() {
 	MutexLock lock(mesh_datas_mutex);
@@ -42,27 +87,93 @@ Handle<Texture> AssetManager::new_texture() {
 	return texture_handle;
 }
 
-Handle<MeshData> AssetManager::add_mesh_data(String filename, FallbackLoader fallback_loader) {
+Handle<MeshData> AssetManager::add_mesh_data(String filename, FallbackLoader fallback_loader, BVHBuildPolicy bvh_build_policy) {
 	String bvh_filename = BVHLoader::get_bvh_filename(filename.view(), nullptr);
-	return add_mesh_data(std::move(filename), std::move(bvh_filename), std::move(fallback_loader));
+	return add_mesh_data(std::move(filename), std::move(bvh_filename), std::move(fallback_loader), bvh_build_policy);
 }
 
-Handle<MeshData> AssetManager::add_mesh_data(String filename, String bvh_filename, FallbackLoader fallback_loader) {
-	Handle<MeshData> & mesh_data_handle = mesh_data_cache[filename];
+Handle<MeshData> AssetManager::add_mesh_data(String filename, String bvh_filename, FallbackLoader fallback_loader, BVHBuildPolicy bvh_build_policy) {
+	Handle<MeshData> & mesh_data_handle = mesh_data_cache[Util::normalize_path(filename.view())];
 
 	if (mesh_data_handle.handle != INVALID) return mesh_data_handle;
 
 	mesh_data_handle = new_mesh_data();
 
-	ThreadPool::submit([this, filename = std::move(filename), bvh_filename = std::move(bvh_filename), fallback_loader = std::move(fallback_loader), mesh_data_handle]() mutable {
-		BVH2     bvh       = { };
+	// Levels of detail are optional files next to the mesh file, loaded by the same loader after the full resolution MeshData
+	Array<Handle<MeshData>> lods;
+	Array<String>           lod_filenames;
+
+	if (cpu_config.enable_mesh_lods) {
+		for (int level = 1; level <= MeshData::MAX_LODS; level++) {
+			String lod_filename = Format().format("{}.lod{}"_sv, filename, level);
+			if (!IO::file_exists(lod_filename.view())) break;
+
+			lods         .push_back(new_mesh_data());
+			lod_filenames.push_back(std::move(lod_filename));
+		}
+	}
+
+	ThreadPool::submit(mesh_data_load_group, [this, filename = std::move(filename), bvh_filename = std::move(bvh_filename), fallback_loader = std::move(fallback_loader), bvh_build_policy, mesh_data_handle, lods, lod_filenames = std::move(lod_filenames)]() mutable {
+		ProfileAssetScope asset(filename.view());
+		ProfileScope      scope("Mesh Load"_sv, "Assets"_sv);
+
+		Timer timer = { };
+		timer.start();
+
+		// NOTE: The levels of detail are not stored in BVH files or the BVH cache, they are always built on load
+		for (size_t i = 0; i < lods.size(); i++) {
+			MeshData lod = { };
+			{
+				ProfileScope scope("Mesh Parse"_sv, "Assets"_sv);
+				lod.triangles = IndexedTriangles::weld(fallback_loader(lod_filenames[i], nullptr));
+			}
+
+			BVH2 bvh = BVH::create_from_triangles(lod.triangles, bvh_build_policy);
+			if (cpu_config.bvh_type != BVHType::BVH8) {
+				BVHCollapser::collapse(bvh);
+			}
+			lod.bvh = BVH::create_from_bvh2(std::move(bvh));
+
+			lod.calc_aabb();
+			lod.calc_triangle_size();
+
+			MutexLock lock(mesh_datas_mutex);
+			get_mesh_data(lods[i]) = std::move(lod);
+		}
+
 		MeshData mesh_data = { };
+		mesh_data.lods             = lods;
+		mesh_data.bvh_build_policy = bvh_build_policy;
+		mesh_data.filename         = filename;
+		mesh_data.bvh_filename     = bvh_filename;
+
+		String cache_filename = BVHLoader::get_bvh_cache_filename(filename.view(), nullptr);
+
+		if (cpu_config.enable_bvh_cache && BVHLoader::try_to_load_cache(filename, cache_filename, &mesh_data)) {
+			// The cache contains the final BVH, no collapsing or conversion is needed
+			mesh_data.calc_aabb();
+			if (lods.size() > 0) mesh_data.calc_triangle_size();
+
+			{
+				MutexLock lock(mesh_datas_mutex);
+				get_mesh_data(mesh_data_handle) = std::move(mesh_data);
+			}
+
+			record_load_time(std::move(filename), timer.stop());
+			return;
+		}
+
+		BVH2 bvh = { };
 
 		bool bvh_loaded = BVHLoader::try_to_load(filename, bvh_filename, &mesh_data, &bvh);
 		if (!bvh_loaded) {
-			mesh_data.triangles = fallback_loader(filename, nullptr);
+			Array<Triangle> triangles;
+			{
+				ProfileScope scope("Mesh Parse"_sv, "Assets"_sv); // Reading the file is part of this, the loaders parse while they read
+				triangles = fallback_loader(filename, nullptr);
+			}
 
-			if (mesh_data.triangles.size() == 0) {
+			if (triangles.size() == 0) {
 				// FIXME: Right now empty MeshData is handled by inserting a dummy Triangle
 				Triangle triangle = Triangle(
 					Vector3(-1.0f, -1.0f, 0.0f),
@@ -75,43 +186,211 @@ Handle<MeshData> AssetManager::add_mesh_data(String filename, String bvh_filenam
 					Vector2(0.5f, 0.0f),
 					Vector2(1.0f, 1.0f)
 				);
-				mesh_data.triangles = { triangle };
+				triangles = { triangle };
 			}
 
-			bvh = BVH::create_from_triangles(mesh_data.triangles);
-			BVHLoader::save(bvh_filename, mesh_data, bvh);
+			// The loaders produce a Triangle per face, shared Vertices are merged before building so that only one copy is kept
+			mesh_data.triangles = IndexedTriangles::weld(triangles);
+			triangles = { };
+
+			bvh = BVH::create_from_triangles(mesh_data.triangles, bvh_build_policy);
 		}
 
+		bool save_bvh = false;
+		BVH2 bvh_uncollapsed;
+
+		if (!mesh_data.bvh) {
+			// Save after conversion, so that the BVH file also contains the wide BVH
+			save_bvh = !bvh_loaded || BVHLoader::bvh_type_is_wide();
+
+			if (save_bvh) {
+				bvh_uncollapsed = bvh; // NOTE: copy!
+			}
+
+			if (cpu_config.bvh_type != BVHType::BVH8) {
+				BVHCollapser::collapse(bvh);
+			}
+
+			mesh_data.bvh = BVH::create_from_bvh2(std::move(bvh));
+		}
+
+		// Writing (and compressing) the BVH files does not hold up the MeshData, it is done on a copy once all assets are loaded
+		if (save_bvh || cpu_config.enable_bvh_cache) {
+			defer_bvh_save([asset_name = String(filename.view()), mesh_data_copy = copy_mesh_data(mesh_data), save_bvh, bvh_filename = std::move(bvh_filename), cache_filename = std::move(cache_filename), bvh_uncollapsed = std::move(bvh_uncollapsed)]() {
+				ProfileAssetScope asset(asset_name.view());
+				ProfileScope      scope("BVH Save"_sv, "Assets"_sv);
+
+				if (save_bvh) {
+					BVHLoader::save(bvh_filename, mesh_data_copy, bvh_uncollapsed);
+				}
+				if (cpu_config.enable_bvh_cache) {
+					BVHLoader::save_cache(cache_filename, mesh_data_copy);
+				}
+			});
+		}
+
+		mesh_data.calc_aabb();
+		if (lods.size() > 0) mesh_data.calc_triangle_size();
+
+		{
+			MutexLock lock(mesh_datas_mutex);
+			get_mesh_data(mesh_data_handle) = std::move(mesh_data);
+		}
+
+		record_load_time(std::move(filename), timer.stop());
+	}, ThreadPool::Priority::INTERACTIVE);
+
+	return mesh_data_handle;
+}
+
+Handle<MeshData> AssetManager::add_mesh_data_curves(String filename, CurveLoader curve_loader) {
+	Handle<MeshData> & mesh_data_handle = mesh_data_cache[Util::normalize_path(filename.view())];
+
+	if (mesh_data_handle.handle != INVALID) return mesh_data_handle;
+
+	mesh_data_handle = new_mesh_data();
+
+	ThreadPool::submit(mesh_data_load_group, [this, filename = std::move(filename), curve_loader = std::move(curve_loader), mesh_data_handle]() mutable {
+		ProfileAssetScope asset(filename.view());
+		ProfileScope      scope("Mesh Load"_sv, "Assets"_sv);
+
+		Timer timer = { };
+		timer.start();
+
+		MeshData mesh_data = { };
+		{
+			ProfileScope scope("Mesh Parse"_sv, "Assets"_sv);
+			mesh_data.curves = curve_loader(filename, nullptr);
+		}
+
+		if (mesh_data.curves.size() == 0) {
+			// Same as for Triangles, empty MeshData gets a dummy Curve
+			mesh_data.curves = { Curve { Vector3(0.0f), 0.0f, Vector3(0.0f, 1.0f, 0.0f), 0.0f } };
+		}
+
+		BVH2 bvh = BVH::create_from_curves(mesh_data.curves);
+
 		if (cpu_config.bvh_type != BVHType::BVH8) {
 			BVHCollapser::collapse(bvh);
 		}
 
 		mesh_data.bvh = BVH::create_from_bvh2(std::move(bvh));
 
+		mesh_data.calc_aabb();
+
 		{
 			MutexLock lock(mesh_datas_mutex);
 			get_mesh_data(mesh_data_handle) = std::move(mesh_data);
 		}
-	});
+
+		record_load_time(std::move(filename), timer.stop());
+	}, ThreadPool::Priority::INTERACTIVE);
 
 	return mesh_data_handle;
 }
 
-Handle<MeshData> AssetManager::add_mesh_data(Array<Triangle> triangles) {
+// Hashes the Triangles together with the settings the BVH will be built with
+static size_t hash_mesh_data_content(const Array<Triangle> & triangles, BVHBuildPolicy bvh_build_policy) {
+	struct BVHSettings {
+		BVHType        bvh_type;
+		BVHBuildPolicy bvh_build_policy;
+		BVHBuilderType bvh_builder;
+		float          sah_cost_node;
+		float          sah_cost_leaf;
+		float          sbvh_alpha;
+		float          bvh_presplit_budget;
+	} settings = {
+		cpu_config.bvh_type,
+		bvh_build_policy,
+		cpu_config.bvh_builder,
+		cpu_config.sah_cost_node,
+		cpu_config.sah_cost_leaf,
+		cpu_config.sbvh_alpha,
+		cpu_config.bvh_presplit_budget
+	};
+
+	size_t hash = FNVHash::hash(reinterpret_cast<const char *>(triangles.data()), triangles.size() * sizeof(Triangle));
+	return hash ^ Hash<BVHSettings>()(settings);
+}
+
+Handle<MeshData> AssetManager::add_mesh_data(Array<Triangle> triangles, BVHBuildPolicy bvh_build_policy) {
+	size_t content_hash = hash_mesh_data_content(triangles, bvh_build_policy);
+
+	Array<MeshDataContent> & contents = mesh_data_content_cache[content_hash];
+	for (size_t i = 0; i < contents.size(); i++) {
+		const Array<Triangle> & other = contents[i].triangles;
+
+		if (other.size() == triangles.size() && memcmp(other.data(), triangles.data(), triangles.size() * sizeof(Triangle)) == 0) {
+			return contents[i].handle;
+		}
+	}
+
 	Handle<MeshData> mesh_data_handle = new_mesh_data();
 
-	ThreadPool::submit([this, triangles = std::move(triangles), mesh_data_handle]() mutable {
-		BVH2 bvh = BVH::create_from_triangles(triangles);
+	contents.emplace_back(triangles, mesh_data_handle); // NOTE: copy!
+
+	ThreadPool::submit(mesh_data_load_group, [this, triangles = std::move(triangles), bvh_build_policy, mesh_data_handle]() mutable {
+		Timer timer = { };
+		timer.start();
 
 		MeshData mesh_data = { };
-		mesh_data.triangles = std::move(triangles);
+		mesh_data.triangles        = IndexedTriangles::weld(triangles);
+		mesh_data.bvh_build_policy = bvh_build_policy;
+
+		BVH2 bvh = BVH::create_from_triangles(mesh_data.triangles, bvh_build_policy);
 		mesh_data.bvh = BVH::create_from_bvh2(std::move(bvh));
 
+		mesh_data.calc_aabb();
+
 		{
 			MutexLock mutex(mesh_datas_mutex);
 			get_mesh_data(mesh_data_handle) = std::move(mesh_data);
 		}
-	});
+
+		record_load_time("Generated MeshData"_sv, timer.stop());
+	}, ThreadPool::Priority::INTERACTIVE);
+
+	return mesh_data_handle;
+}
+
+Handle<MeshData> AssetManager::add_mesh_data(Array<Curve> curves) {
+	ASSERT(curves.size() > 0);
+
+	Handle<MeshData> mesh_data_handle = new_mesh_data();
+
+	ThreadPool::submit(mesh_data_load_group, [this, curves = std::move(curves), mesh_data_handle]() mutable {
+		Timer timer = { };
+		timer.start();
+
+		MeshData mesh_data = { };
+		mesh_data.curves = std::move(curves);
+
+		BVH2 bvh = BVH::create_from_curves(mesh_data.curves);
+
+		if (cpu_config.bvh_type != BVHType::BVH8) {
+			BVHCollapser::collapse(bvh);
+		}
+
+		mesh_data.bvh = BVH::create_from_bvh2(std::move(bvh));
+
+		mesh_data.calc_aabb();
+
+		{
+			MutexLock mutex(mesh_datas_mutex);
+			get_mesh_data(mesh_data_handle) = std::move(mesh_data);
+		}
+
+		record_load_time("Generated MeshData"_sv, timer.stop());
+	}, ThreadPool::Priority::INTERACTIVE);
+
+	return mesh_data_handle;
+}
+
+Handle<MeshData> AssetManager::add_mesh_data(MeshData mesh_data) {
+	Handle<MeshData> mesh_data_handle = new_mesh_data();
+
+	MutexLock lock(mesh_datas_mutex);
+	get_mesh_data(mesh_data_handle) = std::move(mesh_data);
 
 	return mesh_data_handle;
 }
@@ -130,6 +409,31 @@ Handle<Medium> AssetManager::add_medium(Medium medium) {
 	return medium_handle;
 }
 
+// Shared by add_texture and restore_host_data
+static bool load_texture(const String & filename, Texture * texture) {
+	StringView file_extension = Util::get_file_extension(filename.view());
+	if (file_extension.is_empty()) return false;
+
+	if (file_extension == "dds") {
+		return TextureLoader::load_dds(filename, texture); // DDS is loaded using custom code
+	}
+
+	if (cpu_config.enable_texture_cache) {
+		// Decoding, Mipmap filtering and Block Compression are skipped if the cache is up to date
+		String cache_filename = TextureLoader::get_texture_cache_filename(filename.view(), nullptr);
+
+		if (TextureLoader::try_to_load_cache(filename, cache_filename, texture)) return true;
+
+		bool success = TextureLoader::load_stb(filename, texture);
+		if (success) {
+			TextureLoader::save_cache(cache_filename, *texture);
+		}
+		return success;
+	}
+
+	return TextureLoader::load_stb(filename, texture); // other file formats use stb_image
+}
+
 Handle<Texture> AssetManager::add_texture(String filename, String name) {
 	Handle<Texture> & texture_handle = texture_cache[filename];
 
@@ -139,22 +443,20 @@ Handle<Texture> AssetManager::add_texture(String filename, String name) {
 	// Otherwise, create new Texture and load it from disk
 	texture_handle = new_texture();
 
-	ThreadPool::submit([this, filename = std::move(filename), name = std::move(name), texture_handle]() mutable {
-		Texture texture = { };
-		texture.name = std::move(name);
+	ThreadPool::submit(texture_load_group, [this, filename = std::move(filename), name = std::move(name), texture_handle]() mutable {
+		ProfileAssetScope asset(name.view()); // By name rather than filename, Integrator::texture_create only knows the name
+		ProfileScope      scope("Texture Load"_sv, "Assets"_sv);
 
-		bool success = false;
+		Timer timer = { };
+		timer.start();
 
-		StringView file_extension = Util::get_file_extension(filename.view());
-		if (!file_extension.is_empty()) {
-			if (file_extension == "dds") {
-				success = TextureLoader::load_dds(filename, &texture); // DDS is loaded using custom code
-			} else {
-				success = TextureLoader::load_stb(filename, &texture); // other file formats use stb_image
-			}
-		}
+		Texture texture = { };
+		texture.name = std::move(name);
 
-		if (!success) {
+		bool success = load_texture(filename, &texture);
+		if (success) {
+			texture.filename = filename;
+		} else {
 			IO::print("WARNING: Failed to load Texture '{}'!\n"_sv, filename);
 
 			// Use a default 1x1 pink Texture
@@ -168,22 +470,213 @@ Handle<Texture> AssetManager::add_texture(String filename, String name) {
 			texture.mip_offsets = { 0 };
 		}
 
-		{
-			MutexLock lock(textures_mutex);
-			get_texture(texture_handle) = std::move(texture);
-		}
-	});
+		set_texture_loaded(texture_handle, std::move(texture));
+
+		record_load_time(std::move(filename), timer.stop());
+	}, ThreadPool::Priority::INTERACTIVE);
+
+	return texture_handle;
+}
+
+Handle<Texture> AssetManager::add_texture(Texture texture) {
+	Handle<Texture> texture_handle = new_texture();
+	set_texture_loaded(texture_handle, std::move(texture));
 
 	return texture_handle;
 }
 
+void AssetManager::set_texture_loaded(Handle<Texture> texture_handle, Texture texture) {
+	MutexLock lock(textures_mutex); // Needed since new_texture may grow textures concurrently
+	get_texture(texture_handle) = std::move(texture);
+
+	if (!textures_loaded.try_push(texture_handle)) {
+		textures_loaded_overflow.push_back(texture_handle);
+		textures_loaded_overflowed = true;
+	}
+}
+
+void AssetManager::record_load_time(String name, size_t duration) {
+	size_t finished_at = load_timer.stop();
+
+	MutexLock lock(load_times_mutex);
+	load_times.emplace_back(std::move(name), duration, finished_at);
+}
+
+bool AssetManager::take_loaded_textures(Array<Handle<Texture>> & result) {
+	// NOTE: Checked before taking the handles, so that Textures that finish in between are not missed
+	bool all_loaded = texture_load_group.is_done();
+
+	size_t result_size = result.size();
+
+	Handle<Texture> texture_handle;
+	while (textures_loaded.try_pop(texture_handle)) {
+		result.push_back(texture_handle);
+	}
+
+	if (textures_loaded_overflowed) {
+		MutexLock lock(textures_mutex);
+
+		for (size_t i = 0; i < textures_loaded_overflow.size(); i++) {
+			result.push_back(textures_loaded_overflow[i]);
+		}
+		textures_loaded_overflow.clear();
+		textures_loaded_overflowed = false;
+	}
+
+	return !(all_loaded && result.size() == result_size);
+}
+
 void AssetManager::wait_until_loaded() {
 	if (assets_loaded) return; // Only necessary (and valid) to do this once
 
-	ThreadPool::sync();
+	ThreadPool::wait(mesh_data_load_group);
+	ThreadPool::wait(texture_load_group);
+
+	// Report the critical path, the asset that finished last gated startup
+	if (load_times.size() > 0) {
+		size_t last = 0;
+		size_t slowest = 0;
+
+		for (size_t i = 1; i < load_times.size(); i++) {
+			if (load_times[i].finished_at > load_times[last]   .finished_at) last    = i;
+			if (load_times[i].duration    > load_times[slowest].duration)    slowest = i;
+		}
+
+		IO::print("Loaded {} assets in {} ms, last to finish: '{}' ({} ms), slowest: '{}' ({} ms)\n"_sv,
+			load_times.size(),
+			load_times[last].finished_at / 1000,
+			load_times[last].name,    load_times[last]   .duration / 1000,
+			load_times[slowest].name, load_times[slowest].duration / 1000
+		);
+	}
+
+	mesh_data_cache        .clear();
+	mesh_data_content_cache.clear();
+	texture_cache          .clear();
+
+	SerializedLoader::free_cache();
+
+	{
+		MutexLock lock(bvh_saves_mutex);
+		assets_loaded = true;
+
+		// Saving BVH files is not needed to render, they are written in the background
+		// ThreadPool::free finishes them before exiting
+		for (size_t i = 0; i < bvh_saves_pending.size(); i++) {
+			ThreadPool::submit(std::move(bvh_saves_pending[i]), ThreadPool::Priority::BACKGROUND);
+		}
+		bvh_saves_pending.clear();
+	}
+}
+
+template<typename BVHType>
+static size_t release_bvh_nodes(BVH & bvh) {
+	BVHType & bvh_typed = static_cast<BVHType &>(bvh);
+
+	size_t num_bytes = bvh_typed.nodes.size() * sizeof(bvh_typed.nodes[0]);
+	bvh_typed.nodes = { };
+	return num_bytes;
+}
+
+size_t AssetManager::release_host_data(Handle<MeshData> mesh_data_handle) {
+	MeshData & mesh_data = get_mesh_data(mesh_data_handle);
+
+	// Curves and levels of detail are not stored in BVH files or the BVH cache
+	if (mesh_data.is_released || mesh_data.filename.is_empty() || mesh_data.has_curves() || cpu_config.bvh_force_rebuild) return 0;
+
+	String cache_filename = BVHLoader::get_bvh_cache_filename(mesh_data.filename.view(), nullptr);
+
+	bool can_restore =
+		(cpu_config.enable_bvh_cache && IO::file_exists(cache_filename.view())) ||
+		IO::file_exists(mesh_data.bvh_filename.view());
+	if (!can_restore) return 0;
+
+	size_t num_bytes =
+		mesh_data.triangles.vertices.size() * sizeof(Vertex) +
+		mesh_data.triangles.indices .size() * sizeof(int);
+
+	switch (cpu_config.bvh_type) {
+		case BVHType::BVH:
+		case BVHType::SBVH: num_bytes += release_bvh_nodes<BVH2>(*mesh_data.bvh.get()); break;
+		case BVHType::BVH4: num_bytes += release_bvh_nodes<BVH4>(*mesh_data.bvh.get()); break;
+		case BVHType::BVH8: num_bytes += release_bvh_nodes<BVH8>(*mesh_data.bvh.get()); break;
+		default: ASSERT_UNREACHABLE();
+	}
+
+	mesh_data.released_triangle_count = mesh_data.triangles.size();
+	mesh_data.triangles   = { };
+	mesh_data.is_released = true;
+
+	return num_bytes;
+}
+
+size_t AssetManager::release_host_data(Handle<Texture> texture_handle) {
+	Texture & texture = get_texture(texture_handle);
+
+	// Mapped Textures have no host copy to begin with
+	if (texture.is_released || texture.filename.is_empty() || texture.is_mapped()) return 0;
+
+	size_t num_bytes = texture.data.size();
+
+	texture.data        = { };
+	texture.is_released = true;
+
+	return num_bytes;
+}
+
+void AssetManager::restore_host_data(Handle<MeshData> mesh_data_handle) {
+	MeshData & mesh_data = get_mesh_data(mesh_data_handle);
+	if (!mesh_data.is_released) return;
+
+	ProfileAssetScope asset(mesh_data.filename.view());
+	ProfileScope      scope("Mesh Restore"_sv, "Assets"_sv);
+
+	// Read back the same way the MeshData was loaded, which gives the exact same Triangles and BVH that were uploaded
+	MeshData restored = { };
+	restored.bvh_build_policy = mesh_data.bvh_build_policy;
+
+	bool success = false;
+	if (cpu_config.enable_bvh_cache) {
+		String cache_filename = BVHLoader::get_bvh_cache_filename(mesh_data.filename.view(), nullptr);
+		success = BVHLoader::try_to_load_cache(mesh_data.filename, cache_filename, &restored);
+	}
+	if (!success) {
+		BVH2 bvh = { };
+		success = BVHLoader::try_to_load(mesh_data.filename, mesh_data.bvh_filename, &restored, &bvh);
+
+		if (success && !restored.bvh) {
+			if (cpu_config.bvh_type != BVHType::BVH8) {
+				BVHCollapser::collapse(bvh);
+			}
+			restored.bvh = BVH::create_from_bvh2(std::move(bvh));
+		}
+	}
+
+	if (!success || restored.triangles.size() != mesh_data.released_triangle_count || restored.bvh->indices.size() != mesh_data.bvh->indices.size()) {
+		IO::print("ERROR: Unable to read back MeshData '{}', its BVH file was removed or changed after it was released!\n"_sv, mesh_data.filename);
+		IO::exit(1);
+	}
+
+	mesh_data.triangles   = std::move(restored.triangles);
+	mesh_data.bvh         = std::move(restored.bvh);
+	mesh_data.is_released = false;
+}
+
+void AssetManager::restore_host_data(Handle<Texture> texture_handle) {
+	Texture & texture = get_texture(texture_handle);
+	if (!texture.is_released) return;
+
+	ProfileAssetScope asset(texture.name.view());
+	ProfileScope      scope("Texture Restore"_sv, "Assets"_sv);
+
+	Texture restored = { };
+	bool success = load_texture(texture.filename, &restored);
 
-	mesh_data_cache.clear();
-	texture_cache  .clear();
+	if (!success || restored.width != texture.width || restored.height != texture.height || restored.format != texture.format || restored.mip_offsets.size() != texture.mip_offsets.size()) {
+		IO::print("ERROR: Unable to read back Texture '{}', the file was removed or changed after it was released!\n"_sv, texture.filename);
+		IO::exit(1);
+	}
 
-	assets_loaded = true;
+	texture.data        = std::move(restored.data);
+	texture.is_released = false;
 }
@@ -1,10 +1,13 @@
 #pragma once
 #include "Core/Array.h"
 #include "Core/HashMap.h"
+#include "Core/SwissHashMap.h"
 #include "Core/String.h"
 #include "Core/Mutex.h"
+#include "Core/MPMCQueue.h"
 #include "Core/Function.h"
 #include "Core/OwnPtr.h"
+#include "Core/Timer.h"
 #include "Core/Allocators/Allocator.h"
 
 #include "Renderer/MeshData.h"
@@ -27,32 +30,90 @@ struct AssetManager {
 	~AssetManager();
 
 private:
-	HashMap<String, Handle<MeshData>> mesh_data_cache;
-	HashMap<String, Handle<Texture>>  texture_cache;
+	SwissHashMap<String, Handle<MeshData>> mesh_data_cache; // Keyed by normalized filename
+	SwissHashMap<String, Handle<Texture>>  texture_cache;
+
+	// Generated MeshData is deduplicated by content, so that repeated primitives become instances of the same BLAS
+	struct MeshDataContent {
+		Array<Triangle>  triangles; // NOTE: copy, used to rule out hash collisions
+		Handle<MeshData> handle;
+	};
+	HashMap<size_t, Array<MeshDataContent>> mesh_data_content_cache;
 
 	Mutex mesh_datas_mutex;
 	Mutex textures_mutex;
 
+	ThreadPool::TaskGroup mesh_data_load_group;
+	ThreadPool::TaskGroup texture_load_group;
+
+	// Textures that finished loading but have not been taken yet, polled by the uploading thread without taking textures_mutex
+	// Once the queue is full new handles go to textures_loaded_overflow, which is protected by textures_mutex
+	MPMCQueue<Handle<Texture>, 1024> textures_loaded;
+	Array<Handle<Texture>>           textures_loaded_overflow;
+	std::atomic<bool>                textures_loaded_overflowed = false;
+
+	// Used to report which asset gates startup
+	struct AssetLoadTime {
+		String name;
+		size_t duration;    // Time spent loading this asset (us)
+		size_t finished_at; // Time since the AssetManager was created (us)
+	};
+	Array<AssetLoadTime> load_times;
+	Mutex                load_times_mutex;
+	Timer                load_timer;
+
+	void record_load_time(String name, size_t duration);
+
+	// BVH files and BVH cache entries that are written once all assets are loaded, see defer_bvh_save
+	Array<ThreadPool::Work> bvh_saves_pending;
+	Mutex                   bvh_saves_mutex;
+
+	void defer_bvh_save(ThreadPool::Work && work); // Queues the Work until wait_until_loaded, afterwards submits it directly
+
 	bool assets_loaded = false;
 
 	Handle<MeshData> new_mesh_data();
 	Handle<Texture>  new_texture();
 
+	void set_texture_loaded(Handle<Texture> texture_handle, Texture texture); // Makes the Texture available to take_loaded_textures
+
 public:
 	using FallbackLoader = Function<Array<Triangle>(const String & filename, Allocator * allocator)>;
+	using CurveLoader    = Function<Array<Curve>   (const String & filename, Allocator * allocator)>;
+
+	Handle<MeshData> add_mesh_data(String filename,                      FallbackLoader fallback_loader, BVHBuildPolicy bvh_build_policy = cpu_config.bvh_build_policy);
+	Handle<MeshData> add_mesh_data(String filename, String bvh_filename, FallbackLoader fallback_loader, BVHBuildPolicy bvh_build_policy = cpu_config.bvh_build_policy);
+	Handle<MeshData> add_mesh_data(Array<Triangle> triangles,                                           BVHBuildPolicy bvh_build_policy = cpu_config.bvh_build_policy);
+	Handle<MeshData> add_mesh_data(Array<Curve>    curves);
+	Handle<MeshData> add_mesh_data(MeshData mesh_data); // Already contains its final BVH, used by SceneSnapshot
 
-	Handle<MeshData> add_mesh_data(String filename,                      FallbackLoader fallback_loader);
-	Handle<MeshData> add_mesh_data(String filename, String bvh_filename, FallbackLoader fallback_loader);
-	Handle<MeshData> add_mesh_data(Array<Triangle> triangles);
+	Handle<MeshData> add_mesh_data_curves(String filename, CurveLoader curve_loader); // Curves are not stored in BVH files or the BVH cache
 
 	Handle<Material> add_material(Material material);
 
 	Handle<Medium> add_medium(Medium medium);
 
 	Handle<Texture> add_texture(String filename, String name);
+	Handle<Texture> add_texture(Texture texture); // Already decoded, used by SceneSnapshot
 
 	void wait_until_loaded();
 
+	bool is_loaded() const { return assets_loaded; } // True once wait_until_loaded has completed
+
+	// Frees the host copy of the Triangles and BLAS Nodes of a MeshData, or the data of a Texture, returns the number of bytes freed
+	// Only assets that can be read back from disk are released: MeshData that was loaded from a file whose BVH file or BVH cache entry
+	// has been written (the saves run in the background, see defer_bvh_save), and Textures that were loaded from a file
+	size_t release_host_data(Handle<MeshData> mesh_data_handle);
+	size_t release_host_data(Handle<Texture>  texture_handle);
+
+	// Reads a released asset back from disk, does nothing if it was not released
+	void restore_host_data(Handle<MeshData> mesh_data_handle);
+	void restore_host_data(Handle<Texture>  texture_handle);
+
+	// Moves the handles of all Textures that finished loading since the last call into result
+	// Returns false once every Texture has been taken, this allows Textures to be uploaded while others are still loading
+	bool take_loaded_textures(Array<Handle<Texture>> & result);
+
 	MeshData & get_mesh_data(Handle<MeshData> handle) { return mesh_datas[handle.handle]; }
 	Material & get_material (Handle<Material> handle) { return materials [handle.handle]; }
 	Medium   & get_medium   (Handle<Medium>   handle) { return media     [handle.handle]; }
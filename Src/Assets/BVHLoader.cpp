@@ -3,6 +3,14 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <atomic>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
 #include <miniz/miniz.h>
 
 #include "Core/IO.h"
@@ -10,32 +18,99 @@
 #include "Core/Allocators/StackAllocator.h"
 
 #include "Util/Util.h"
+#include "Util/Profiler.h"
 #include "Util/StringUtil.h"
 
 String BVHLoader::get_bvh_filename(StringView filename, Allocator * allocator) {
 	return Util::combine_stringviews(filename, StringView::from_c_str(BVH_FILE_EXTENSION), allocator);
 }
 
+String BVHLoader::get_bvh_cache_filename(StringView filename, Allocator * allocator) {
+	return Util::combine_stringviews(filename, StringView::from_c_str(BVH_CACHE_FILE_EXTENSION), allocator);
+}
+
+// Files are written under a temporary name that is unique to the writer and renamed once complete, so that
+// other processes that share the directory (e.g. render farm jobs) never read a partially written file
+static String get_temp_filename(const String & filename) {
+	static std::atomic<int> temp_file_count = 0;
+#ifdef _WIN32
+	int process_id = _getpid();
+#else
+	int process_id = int(getpid());
+#endif
+	return Format().format("{}.{}.{}.tmp"_sv, filename, process_id, temp_file_count++);
+}
+
+static FILE * open_temp_file(const String & temp_filename) {
+	FILE * file = nullptr;
+#ifdef _WIN32
+	fopen_s(&file, temp_filename.data(), "wb");
+#else
+	file = fopen(temp_filename.data(), "wb");
+#endif
+	return file;
+}
+
+// Closes the temporary file and replaces the file by it if it was written successfully, otherwise it is deleted
+static bool close_temp_file(FILE * file, const String & temp_filename, const String & filename, bool success) {
+	success &= fclose(file) == 0;
+
+	if (success) {
+#ifdef _WIN32
+		remove(filename.data()); // rename does not replace existing files on Windows
+#endif
+		success = rename(temp_filename.data(), filename.data()) == 0;
+	}
+	if (!success) {
+		remove(temp_filename.data());
+	}
+	return success;
+}
+
 struct BVHFileHeader {
 	char filetype_identifier[4];
 	char filetype_version;
 
 	// Store settings with which the BVH was created
 	char underlying_bvh_type;
+	char bvh_build_policy;
+	char bvh_builder;
 	bool bvh_is_optimized;
+	bool bvh_is_restructured;
 	float sah_cost_node;
 	float sah_cost_leaf;
 
-	int num_triangles;
+	int num_vertices;
+	int num_triangles; // Three Vertex indices each, stored after the Vertices
 	int num_nodes;
 	int num_indices;
+
+	// Wide BVH converted from the BVH2, stored directly after the Triangles
+	char wide_bvh_type; // BVHType of the wide BVH, or INVALID if there is none
+	int  num_wide_nodes;
+	int  num_wide_indices;
 };
 
+static size_t wide_bvh_node_size(BVHType bvh_type) {
+	switch (bvh_type) {
+		case BVHType::BVH4: return sizeof(BVHNode4);
+		case BVHType::BVH8: return sizeof(BVHNode8);
+		default: ASSERT_UNREACHABLE();
+	}
+}
+
+template<typename WideBVH>
+static const void * wide_bvh_nodes(const BVH * bvh) {
+	return static_cast<const WideBVH *>(bvh)->nodes.data();
+}
+
 bool BVHLoader::try_to_load(const String & filename, const String & bvh_filename, MeshData * mesh_data, BVH2 * bvh) {
 	if (cpu_config.bvh_force_rebuild || !IO::file_exists(filename.view()) || !IO::file_exists(bvh_filename.view()) || IO::file_is_newer(bvh_filename.view(), filename.view())) {
 		return false;
 	}
 
+	ProfileScope scope("BVH Load"_sv, "Assets"_sv);
+
 	FILE * file = nullptr;
 	errno_t err;
 #ifdef _WIN32
@@ -177,7 +252,10 @@ bool BVHLoader::try_to_load(const String & filename, const String & bvh_filename
 
 	// Check if the settings used to create the BVH file are the same as the current settings
 	if (header.underlying_bvh_type != char(BVH::underlying_bvh_type()) ||
+		header.bvh_build_policy    != char(mesh_data->bvh_build_policy) ||
+		header.bvh_builder         != char(cpu_config.bvh_builder) ||
 		header.bvh_is_optimized    != cpu_config.enable_bvh_optimization ||
+		header.bvh_is_restructured != cpu_config.enable_bvh_restructuring ||
 		header.sah_cost_node       != cpu_config.sah_cost_node ||
 		header.sah_cost_leaf       != cpu_config.sah_cost_leaf
 	) {
@@ -185,14 +263,66 @@ bool BVHLoader::try_to_load(const String & filename, const String & bvh_filename
 		goto exit;
 	}
 
-	mesh_data->triangles.resize(header.num_triangles);
-	bvh->nodes          .resize(header.num_nodes);
-	bvh->indices        .resize(header.num_indices);
+	mesh_data->triangles.vertices.resize(header.num_vertices);
+	mesh_data->triangles.indices .resize(3 * header.num_triangles);
 
 	success =
-		decompress_into_buffer(Util::bit_cast<mz_uint8 *>(mesh_data->triangles.data()), mesh_data->triangles.size() * sizeof(Triangle)) &&
-		decompress_into_buffer(Util::bit_cast<mz_uint8 *>(bvh->nodes          .data()), bvh->nodes          .size() * sizeof(BVHNode2)) &&
-		decompress_into_buffer(Util::bit_cast<mz_uint8 *>(bvh->indices        .data()), bvh->indices        .size() * sizeof(int));
+		decompress_into_buffer(Util::bit_cast<mz_uint8 *>(mesh_data->triangles.vertices.data()), mesh_data->triangles.vertices.size() * sizeof(Vertex)) &&
+		decompress_into_buffer(Util::bit_cast<mz_uint8 *>(mesh_data->triangles.indices .data()), mesh_data->triangles.indices .size() * sizeof(int));
+	if (!success) goto exit;
+
+	if (header.wide_bvh_type != char(INVALID)) {
+		size_t num_bytes_wide_nodes   = header.num_wide_nodes   * wide_bvh_node_size(BVHType(header.wide_bvh_type));
+		size_t num_bytes_wide_indices = header.num_wide_indices * sizeof(int);
+
+		if (header.wide_bvh_type == char(cpu_config.bvh_type)) {
+			// The file contains the BVH we need, skip the BVH2 entirely
+			switch (cpu_config.bvh_type) {
+				case BVHType::BVH4: {
+					OwnPtr<BVH4> bvh4 = make_owned<BVH4>();
+					bvh4->nodes  .resize(header.num_wide_nodes);
+					bvh4->indices.resize(header.num_wide_indices);
+
+					success =
+						decompress_into_buffer(Util::bit_cast<mz_uint8 *>(bvh4->nodes  .data()), num_bytes_wide_nodes) &&
+						decompress_into_buffer(Util::bit_cast<mz_uint8 *>(bvh4->indices.data()), num_bytes_wide_indices);
+					mesh_data->bvh = std::move(bvh4);
+					break;
+				}
+				case BVHType::BVH8: {
+					OwnPtr<BVH8> bvh8 = make_owned<BVH8>();
+					bvh8->nodes  .resize(header.num_wide_nodes);
+					bvh8->indices.resize(header.num_wide_indices);
+
+					success =
+						decompress_into_buffer(Util::bit_cast<mz_uint8 *>(bvh8->nodes  .data()), num_bytes_wide_nodes) &&
+						decompress_into_buffer(Util::bit_cast<mz_uint8 *>(bvh8->indices.data()), num_bytes_wide_indices);
+					mesh_data->bvh = std::move(bvh8);
+					break;
+				}
+				default: ASSERT_UNREACHABLE();
+			}
+
+			if (success) {
+				IO::print("Loaded BVH '{}' from disk (converted)\n"_sv, bvh_filename);
+			} else {
+				mesh_data->bvh = nullptr;
+			}
+			goto exit;
+		}
+
+		// The wide BVH was converted for a different BVHType, skip over it
+		Array<mz_uint8> skipped(num_bytes_wide_nodes + num_bytes_wide_indices);
+		success = decompress_into_buffer(skipped.data(), skipped.size());
+		if (!success) goto exit;
+	}
+
+	bvh->nodes  .resize(header.num_nodes);
+	bvh->indices.resize(header.num_indices);
+
+	success =
+		decompress_into_buffer(Util::bit_cast<mz_uint8 *>(bvh->nodes  .data()), bvh->nodes  .size() * sizeof(BVHNode2)) &&
+		decompress_into_buffer(Util::bit_cast<mz_uint8 *>(bvh->indices.data()), bvh->indices.size() * sizeof(int));
 
 	if (success) {
 		IO::print("Loaded BVH '{}' from disk\n"_sv, bvh_filename);
@@ -205,17 +335,11 @@ exit:
 }
 
 bool BVHLoader::save(const String & bvh_filename, const MeshData & mesh_data, const BVH2 & bvh) {
-	FILE * file = nullptr;
-	errno_t err;
-#ifdef _WIN32
-	err = fopen_s(&file, bvh_filename.data(), "wb");
-#else
-	file = fopen(bvh_filename.data(), "wb");
-	err = errno;
-#endif
+	String temp_filename = get_temp_filename(bvh_filename);
 
+	FILE * file = open_temp_file(temp_filename);
 	if (!file) {
-		IO::print("WARNING: Failed to open BVH file '{}' for writing! ({})\n"_sv, bvh_filename, IO::get_error_message(err));
+		IO::print("WARNING: Failed to open BVH file '{}' for writing! ({})\n"_sv, temp_filename, IO::get_error_message(errno));
 		return false;
 	}
 
@@ -227,14 +351,32 @@ bool BVHLoader::save(const String & bvh_filename, const MeshData & mesh_data, co
 	header.filetype_version = BVH_FILETYPE_VERSION;
 
 	header.underlying_bvh_type = char(BVH::underlying_bvh_type());
+	header.bvh_build_policy    = char(mesh_data.bvh_build_policy);
+	header.bvh_builder         = char(cpu_config.bvh_builder);
 	header.bvh_is_optimized    = cpu_config.enable_bvh_optimization;
+	header.bvh_is_restructured = cpu_config.enable_bvh_restructuring;
 	header.sah_cost_node       = cpu_config.sah_cost_node;
 	header.sah_cost_leaf       = cpu_config.sah_cost_leaf;
 
+	header.num_vertices  = mesh_data.triangles.vertices.size();
 	header.num_triangles = mesh_data.triangles.size();
 	header.num_nodes     = bvh.nodes  .size();
 	header.num_indices   = bvh.indices.size();
 
+	const void * wide_nodes = nullptr;
+
+	if (bvh_type_is_wide() && mesh_data.bvh.get()) {
+		header.wide_bvh_type    = char(cpu_config.bvh_type);
+		header.num_wide_nodes   = mesh_data.bvh->node_count();
+		header.num_wide_indices = mesh_data.bvh->indices.size();
+
+		wide_nodes = cpu_config.bvh_type == BVHType::BVH4 ? wide_bvh_nodes<BVH4>(mesh_data.bvh.get()) : wide_bvh_nodes<BVH8>(mesh_data.bvh.get());
+	} else {
+		header.wide_bvh_type    = char(INVALID);
+		header.num_wide_nodes   = 0;
+		header.num_wide_indices = 0;
+	}
+
 	tdefl_compressor compressor = { };
 	bool success = false;
 	
@@ -243,7 +385,8 @@ bool BVHLoader::save(const String & bvh_filename, const MeshData & mesh_data, co
 		size_t bytes_written = fwrite(buf, sizeof(char), len, reinterpret_cast<FILE *>(user));
 		return bytes_written == len;
 	};
-	constexpr static int NUM_PROBES = 256;
+	// Raw deflate without a zlib header, which is what try_to_load expects. The default level 7 uses 256 probes
+	mz_uint flags = tdefl_create_comp_flags_from_zip_params(cpu_config.bvh_compression_level, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY);
 	tdefl_status status;
 
 	size_t header_written = fwrite(&header, sizeof(header), 1, file);
@@ -252,18 +395,32 @@ bool BVHLoader::save(const String & bvh_filename, const MeshData & mesh_data, co
 		goto exit;
 	}
 
-	status = tdefl_init(&compressor, file_append_compressed_data, file, NUM_PROBES);
+	status = tdefl_init(&compressor, file_append_compressed_data, file, int(flags));
 	if (status != TDEFL_STATUS_OKAY) {
 		IO::print("WARNING: Failed to initialize compressor for BVH file '{}'!\n"_sv, bvh_filename);
 		goto exit;
 	}
 
-	status = tdefl_compress_buffer(&compressor, mesh_data.triangles.data(), mesh_data.triangles.size() * sizeof(Triangle), TDEFL_NO_FLUSH);
+	status = tdefl_compress_buffer(&compressor, mesh_data.triangles.vertices.data(), mesh_data.triangles.vertices.size() * sizeof(Vertex), TDEFL_NO_FLUSH);
+	if (status == TDEFL_STATUS_OKAY) {
+		status = tdefl_compress_buffer(&compressor, mesh_data.triangles.indices.data(), mesh_data.triangles.indices.size() * sizeof(int), TDEFL_NO_FLUSH);
+	}
 	if (status != TDEFL_STATUS_OKAY) {
 		IO::print("WARNING: Failed to write compressed Triangles to BVH file '{}'!\n"_sv, bvh_filename);
 		goto exit;
 	}
 
+	if (wide_nodes) {
+		status = tdefl_compress_buffer(&compressor, wide_nodes, header.num_wide_nodes * wide_bvh_node_size(cpu_config.bvh_type), TDEFL_NO_FLUSH);
+		if (status == TDEFL_STATUS_OKAY) {
+			status = tdefl_compress_buffer(&compressor, mesh_data.bvh->indices.data(), header.num_wide_indices * sizeof(int), TDEFL_NO_FLUSH);
+		}
+		if (status != TDEFL_STATUS_OKAY) {
+			IO::print("WARNING: Failed to write compressed wide BVH to BVH file '{}'!\n"_sv, bvh_filename);
+			goto exit;
+		}
+	}
+
 	status = tdefl_compress_buffer(&compressor, bvh.nodes.data(), bvh.nodes.size() * sizeof(BVHNode2), TDEFL_NO_FLUSH);
 	if (status != TDEFL_STATUS_OKAY) {
 		IO::print("WARNING: Failed to write compressed BVH nodes to BVH file '{}'!\n"_sv, bvh_filename);
@@ -279,6 +436,188 @@ bool BVHLoader::save(const String & bvh_filename, const MeshData & mesh_data, co
 	success = true;
 
 exit:
-	fclose(file);
+	if (!close_temp_file(file, temp_filename, bvh_filename, success) && success) {
+		IO::print("WARNING: Failed to replace BVH file '{}'!\n"_sv, bvh_filename);
+		return false;
+	}
+	return success;
+}
+
+struct BVHCacheFileHeader {
+	char filetype_identifier[4];
+	int  filetype_version;
+
+	// Store settings with which the BVH was created
+	char  bvh_type;
+	char  bvh_build_policy;
+	char  bvh_builder;
+	bool  bvh_is_optimized;
+	bool  bvh_is_restructured;
+	float sah_cost_node;
+	float sah_cost_leaf;
+
+	int num_vertices;
+	int num_triangles;
+	int num_nodes;
+	int num_indices;
+
+	// Offsets in bytes from the start of the file, all page aligned
+	size_t offset_vertices;
+	size_t offset_triangles; // Three Vertex indices per Triangle
+	size_t offset_nodes;
+	size_t offset_indices;
+	size_t file_size;
+};
+
+static constexpr size_t BVH_CACHE_PAGE_SIZE = 4096;
+
+static size_t bvh_cache_align(size_t offset) {
+	return (offset + BVH_CACHE_PAGE_SIZE - 1) & ~(BVH_CACHE_PAGE_SIZE - 1);
+}
+
+static size_t bvh_cache_node_size() {
+	switch (cpu_config.bvh_type) {
+		case BVHType::BVH:
+		case BVHType::SBVH: return sizeof(BVHNode2);
+		case BVHType::BVH4: return sizeof(BVHNode4);
+		case BVHType::BVH8: return sizeof(BVHNode8);
+		default: ASSERT_UNREACHABLE();
+	}
+}
+
+template<typename BVHType, typename Node>
+static OwnPtr<BVH> bvh_cache_read_bvh(const IO::MappedFile & mapped_file, const BVHCacheFileHeader & header) {
+	OwnPtr<BVHType> bvh = make_owned<BVHType>();
+	bvh->nodes  .resize(header.num_nodes);
+	bvh->indices.resize(header.num_indices);
+
+	memcpy(bvh->nodes  .data(), mapped_file.data() + header.offset_nodes,   header.num_nodes   * sizeof(Node));
+	memcpy(bvh->indices.data(), mapped_file.data() + header.offset_indices, header.num_indices * sizeof(int));
+
+	return bvh;
+}
+
+bool BVHLoader::try_to_load_cache(const String & filename, const String & cache_filename, MeshData * mesh_data) {
+	if (cpu_config.bvh_force_rebuild || !IO::file_exists(filename.view()) || !IO::file_exists(cache_filename.view()) || IO::file_is_newer(cache_filename.view(), filename.view())) {
+		return false;
+	}
+
+	ProfileScope scope("BVH Cache Load"_sv, "Assets"_sv);
+
+	IO::MappedFile mapped_file;
+	if (!mapped_file.open(cache_filename)) {
+		IO::print("WARNING: Failed to map BVH cache file '{}'!\n"_sv, cache_filename);
+		return false;
+	}
+
+	if (mapped_file.size() < sizeof(BVHCacheFileHeader)) return false;
+
+	BVHCacheFileHeader header = { };
+	memcpy(&header, mapped_file.data(), sizeof(BVHCacheFileHeader));
+
+	if (memcmp(header.filetype_identifier, "BVHC", 4) != 0 || header.filetype_version != BVH_CACHE_FILETYPE_VERSION || header.file_size != mapped_file.size()) {
+		return false;
+	}
+
+	// Check if the settings used to create the BVH cache are the same as the current settings
+	if (header.bvh_type            != char(cpu_config.bvh_type) ||
+		header.bvh_build_policy    != char(mesh_data->bvh_build_policy) ||
+		header.bvh_builder         != char(cpu_config.bvh_builder) ||
+		header.bvh_is_optimized    != cpu_config.enable_bvh_optimization ||
+		header.bvh_is_restructured != cpu_config.enable_bvh_restructuring ||
+		header.sah_cost_node       != cpu_config.sah_cost_node ||
+		header.sah_cost_leaf       != cpu_config.sah_cost_leaf
+	) {
+		IO::print("BVH cache file '{}' was created with different settings, ignoring it.\n"_sv, cache_filename);
+		return false;
+	}
+
+	mesh_data->triangles.vertices.resize(header.num_vertices);
+	mesh_data->triangles.indices .resize(3 * header.num_triangles);
+	memcpy(mesh_data->triangles.vertices.data(), mapped_file.data() + header.offset_vertices,  header.num_vertices  * sizeof(Vertex));
+	memcpy(mesh_data->triangles.indices .data(), mapped_file.data() + header.offset_triangles, header.num_triangles * 3 * sizeof(int));
+
+	switch (cpu_config.bvh_type) {
+		case BVHType::BVH:
+		case BVHType::SBVH: mesh_data->bvh = bvh_cache_read_bvh<BVH2, BVHNode2>(mapped_file, header); break;
+		case BVHType::BVH4: mesh_data->bvh = bvh_cache_read_bvh<BVH4, BVHNode4>(mapped_file, header); break;
+		case BVHType::BVH8: mesh_data->bvh = bvh_cache_read_bvh<BVH8, BVHNode8>(mapped_file, header); break;
+		default: ASSERT_UNREACHABLE();
+	}
+
+	IO::print("Loaded BVH cache '{}' from disk\n"_sv, cache_filename);
+	return true;
+}
+
+bool BVHLoader::save_cache(const String & cache_filename, const MeshData & mesh_data) {
+	const void * nodes = nullptr;
+	switch (cpu_config.bvh_type) {
+		case BVHType::BVH:
+		case BVHType::SBVH: nodes = static_cast<const BVH2 *>(mesh_data.bvh.get())->nodes.data(); break;
+		case BVHType::BVH4: nodes = static_cast<const BVH4 *>(mesh_data.bvh.get())->nodes.data(); break;
+		case BVHType::BVH8: nodes = static_cast<const BVH8 *>(mesh_data.bvh.get())->nodes.data(); break;
+		default: ASSERT_UNREACHABLE();
+	}
+
+	BVHCacheFileHeader header = { };
+	memcpy(header.filetype_identifier, "BVHC", 4);
+	header.filetype_version = BVH_CACHE_FILETYPE_VERSION;
+
+	header.bvh_type            = char(cpu_config.bvh_type);
+	header.bvh_build_policy    = char(mesh_data.bvh_build_policy);
+	header.bvh_builder         = char(cpu_config.bvh_builder);
+	header.bvh_is_optimized    = cpu_config.enable_bvh_optimization;
+	header.bvh_is_restructured = cpu_config.enable_bvh_restructuring;
+	header.sah_cost_node       = cpu_config.sah_cost_node;
+	header.sah_cost_leaf       = cpu_config.sah_cost_leaf;
+
+	header.num_vertices  = mesh_data.triangles.vertices.size();
+	header.num_triangles = mesh_data.triangles.size();
+	header.num_nodes     = mesh_data.bvh->node_count();
+	header.num_indices   = mesh_data.bvh->indices.size();
+
+	header.offset_vertices  = bvh_cache_align(sizeof(BVHCacheFileHeader));
+	header.offset_triangles = bvh_cache_align(header.offset_vertices  + header.num_vertices  * sizeof(Vertex));
+	header.offset_nodes     = bvh_cache_align(header.offset_triangles + header.num_triangles * 3 * sizeof(int));
+	header.offset_indices   = bvh_cache_align(header.offset_nodes     + header.num_nodes     * bvh_cache_node_size());
+	header.file_size        =                 header.offset_indices   + header.num_indices   * sizeof(int);
+
+	String temp_filename = get_temp_filename(cache_filename);
+
+	FILE * file = open_temp_file(temp_filename);
+	if (!file) {
+		IO::print("WARNING: Failed to open BVH cache file '{}' for writing! ({})\n"_sv, temp_filename, IO::get_error_message(errno));
+		return false;
+	}
+
+	// Writes a section at the given offset, padding the gap since the previous section with zeroes
+	size_t offset = 0;
+	auto write_section = [file, &offset](size_t section_offset, const void * data, size_t num_bytes) -> bool {
+		static const char padding[BVH_CACHE_PAGE_SIZE] = { };
+
+		ASSERT(section_offset >= offset && section_offset - offset <= BVH_CACHE_PAGE_SIZE);
+
+		if (fwrite(padding, 1, section_offset - offset, file) != section_offset - offset) return false;
+		if (fwrite(data,    1, num_bytes,               file) != num_bytes)               return false;
+
+		offset = section_offset + num_bytes;
+		return true;
+	};
+
+	bool success =
+		write_section(0,                       &header,                               sizeof(BVHCacheFileHeader)) &&
+		write_section(header.offset_vertices,  mesh_data.triangles.vertices.data(),   header.num_vertices      * sizeof(Vertex)) &&
+		write_section(header.offset_triangles, mesh_data.triangles.indices .data(),   header.num_triangles * 3 * sizeof(int)) &&
+		write_section(header.offset_nodes,     nodes,                                 header.num_nodes         * bvh_cache_node_size()) &&
+		write_section(header.offset_indices,   mesh_data.bvh->indices.data(),         header.num_indices       * sizeof(int));
+
+	if (!success) {
+		IO::print("WARNING: Failed to write BVH cache file '{}'!\n"_sv, cache_filename);
+	}
+
+	if (!close_temp_file(file, temp_filename, cache_filename, success) && success) {
+		IO::print("WARNING: Failed to replace BVH cache file '{}'!\n"_sv, cache_filename);
+		return false;
+	}
 	return success;
 }
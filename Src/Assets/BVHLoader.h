@@ -11,10 +11,27 @@
 
 namespace BVHLoader {
 	inline constexpr const char * BVH_FILE_EXTENSION = ".bvh";
-	inline constexpr int          BVH_FILETYPE_VERSION = 7;
+	inline constexpr int          BVH_FILETYPE_VERSION = 14;
 
-	String get_bvh_filename(StringView filename, Allocator * allocator);
+	// Uncompressed cache of the final BVH (after collapsing and conversion to cpu_config.bvh_type)
+	// Every section is page aligned and the file is memory mapped on load, which skips both decompression and BVH conversion
+	inline constexpr const char * BVH_CACHE_FILE_EXTENSION   = ".bvhc";
+	inline constexpr int          BVH_CACHE_FILETYPE_VERSION = 6;
 
+	String get_bvh_filename      (StringView filename, Allocator * allocator);
+	String get_bvh_cache_filename(StringView filename, Allocator * allocator);
+
+	// Whether cpu_config.bvh_type is a wide BVH that is converted from the BVH2, the BVH file stores it alongside the BVH2
+	inline bool bvh_type_is_wide() {
+		return cpu_config.bvh_type == BVHType::BVH4 || cpu_config.bvh_type == BVHType::BVH8;
+	}
+
+	// If the file contains the wide BVH for cpu_config.bvh_type it is loaded into mesh_data->bvh directly and bvh is left empty
 	bool try_to_load(const String & filename, const String & bvh_filename, MeshData * mesh_data, BVH2 * bvh);
+
+	// Stores the (uncollapsed) BVH2, and mesh_data.bvh if it is a wide BVH
 	bool save(const String & bvh_filename, const MeshData & mesh_data, const BVH2 & bvh);
+
+	bool try_to_load_cache(const String & filename, const String & cache_filename, MeshData * mesh_data);
+	bool save_cache(const String & cache_filename, const MeshData & mesh_data);
 }
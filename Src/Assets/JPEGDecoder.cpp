@@ -0,0 +1,117 @@
+#include "JPEGDecoder.h"
+
+#include "Core/IO.h"
+#include "Core/Mutex.h"
+
+#include "Device/CUDAMemory.h"
+#include "Device/CUDAContext.h"
+
+#include "Util/ThreadPool.h"
+
+#ifdef TEXTURE_DECODER_NVJPEG
+#include <nvjpeg.h>
+
+// A single decoder state is shared by all Texture loading threads, the decode itself is short compared to reading and filtering the image
+static Mutex decoder_mutex;
+
+static nvjpegHandle_t    decoder_handle = nullptr;
+static nvjpegJpegState_t decoder_state  = nullptr;
+
+static bool decoder_failed = false; // Set if nvJPEG could not be initialized, every decode falls back to stb_image afterwards
+#endif
+
+bool JPEGDecoder::is_available() {
+#ifdef TEXTURE_DECODER_NVJPEG
+	return CUDAContext::get_context_count() > 0;
+#else
+	return false;
+#endif
+}
+
+bool JPEGDecoder::decode(const String & filename, Array<unsigned char> & data_rgba, int & width, int & height) {
+#ifdef TEXTURE_DECODER_NVJPEG
+	IO::MappedFile file = IO::file_map(filename);
+
+	const unsigned char * file_data = reinterpret_cast<const unsigned char *>(file.data());
+
+	Array<unsigned char> data_rgb;
+
+	// The lock is released before expanding to RGBA, since a thread waiting on the parallel_for may pick up another Texture load
+	{
+		MutexLock lock(decoder_mutex);
+
+		if (decoder_failed) return false;
+
+		// Texture loading threads do not have a current Context
+		CUDAContext::make_current(0);
+
+		if (decoder_handle == nullptr) {
+			if (nvjpegCreateSimple(&decoder_handle) != NVJPEG_STATUS_SUCCESS || nvjpegJpegStateCreate(decoder_handle, &decoder_state) != NVJPEG_STATUS_SUCCESS) {
+				IO::print("WARNING: Unable to initialize nvJPEG, JPEG Textures are decoded on the CPU!\n"_sv);
+				decoder_failed = true;
+				return false;
+			}
+		}
+
+		int                       components = 0;
+		nvjpegChromaSubsampling_t subsampling;
+		int                       widths [NVJPEG_MAX_COMPONENT] = { };
+		int                       heights[NVJPEG_MAX_COMPONENT] = { };
+
+		if (nvjpegGetImageInfo(decoder_handle, file_data, file.size(), &components, &subsampling, widths, heights) != NVJPEG_STATUS_SUCCESS) {
+			return false;
+		}
+
+		width  = widths [0];
+		height = heights[0];
+		if (width == 0 || height == 0) return false;
+
+		CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::TEXTURES);
+		CUDAMemory::Ptr<unsigned char> ptr_rgb = CUDAMemory::malloc<unsigned char>(3 * size_t(width) * size_t(height));
+
+		// Interleaved RGB, nvJPEG has no output format with an alpha channel
+		nvjpegImage_t image = { };
+		image.channel[0] = reinterpret_cast<unsigned char *>(ptr_rgb.ptr);
+		image.pitch  [0] = 3 * width;
+
+		bool success = nvjpegDecode(decoder_handle, decoder_state, file_data, file.size(), NVJPEG_OUTPUT_RGBI, &image, nullptr) == NVJPEG_STATUS_SUCCESS;
+
+		if (success) {
+			data_rgb.resize(3 * size_t(width) * size_t(height));
+			CUDAMemory::memcpy(data_rgb.data(), ptr_rgb, data_rgb.size());
+		}
+
+		CUDAMemory::free(ptr_rgb);
+
+		if (!success) return false;
+	}
+
+	size_t pixel_count = size_t(width) * size_t(height);
+
+	data_rgba.resize(4 * pixel_count);
+	ThreadPool::parallel_for(0, int(pixel_count), 16384, [&](int first, int last) {
+		for (int i = first; i < last; i++) {
+			data_rgba[4*i + 0] = data_rgb[3*i + 0];
+			data_rgba[4*i + 1] = data_rgb[3*i + 1];
+			data_rgba[4*i + 2] = data_rgb[3*i + 2];
+			data_rgba[4*i + 3] = 255;
+		}
+	});
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+void JPEGDecoder::free() {
+#ifdef TEXTURE_DECODER_NVJPEG
+	MutexLock lock(decoder_mutex);
+
+	if (decoder_state)  nvjpegJpegStateDestroy(decoder_state);
+	if (decoder_handle) nvjpegDestroy(decoder_handle);
+
+	decoder_state  = nullptr;
+	decoder_handle = nullptr;
+#endif
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include "Core/Array.h"
+#include "Core/String.h"
+
+// Decodes JPEG images on the GPU with nvJPEG, used by TextureLoader::load_stb instead of stb_image if cpu_config.enable_gpu_jpeg_decoding is set
+// The image is decoded on the Device of the first CUDA Context and read back as RGBA8, the Mipmaps and Block Compression follow the regular path
+// nvJPEG is an optional dependency, it is only compiled in if the build defines TEXTURE_DECODER_NVJPEG (ENABLE_NVJPEG in CMakeLists.txt)
+namespace JPEGDecoder {
+	bool is_available();
+
+	// Returns false if the file could not be decoded, the caller should fall back to stb_image then
+	bool decode(const String & filename, Array<unsigned char> & data_rgba, int & width, int & height);
+
+	void free();
+}
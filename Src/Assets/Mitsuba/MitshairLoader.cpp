@@ -1,14 +1,11 @@
 #include "MitshairLoader.h"
 
 #include "Core/Array.h"
-#include "Core/Random.h"
 
-#include "Math/Quaternion.h"
+#include "Renderer/Curve.h"
 
-#include "Renderer/Triangle.h"
-
-Array<Triangle> MitshairLoader::load(const String & filename, Allocator * allocator, SourceLocation location_in_mitsuba_file, float radius) {
-	String file = IO::file_read(filename, allocator);
+Array<Curve> MitshairLoader::load(const String & filename, Allocator * allocator, SourceLocation location_in_mitsuba_file, float radius) {
+	IO::MappedFile file = IO::file_map(filename);
 
 	Parser parser(file.view(), filename.view());
 
@@ -48,16 +45,7 @@ Array<Triangle> MitshairLoader::load(const String & filename, Allocator * alloca
 		}
 	}
 
-	RNG rng = RNG(Hash<String>()(filename));
-
-	Array<Triangle> triangles;
-
-	struct Segment {
-		Vector3 begin;
-		Vector3 end;
-	};
-	Segment prev_segment = { };
-	Segment curr_segment = { };
+	Array<Curve> curves;
 
 	size_t hair_index = 0;
 
@@ -72,52 +60,17 @@ Array<Triangle> MitshairLoader::load(const String & filename, Allocator * alloca
 			continue;
 		}
 
-		float angle = PI * rng.get_float();
-
-		Vector3 direction  = Vector3::normalize(strand[1] - strand[0]);
-		Vector3 orthogonal = Quaternion::axis_angle(direction, angle) * Math::orthogonal(direction);
-
-		prev_segment.begin = strand[0] + radius * orthogonal;
-		prev_segment.end   = strand[0] - radius * orthogonal;
-
+		// The radius tapers off linearly towards the tip of the strand
 		for (int v = 1; v < strand_size; v++) {
-			Vector3 direction = Vector3::normalize(strand[v] - strand[v-1]);
-			Vector3 orthogonal;
-			if (isnan(direction.x + direction.y + direction.z)) {
-				orthogonal = Vector3(1.0f, 0.0f, 0.0f);
-			} else {
-				orthogonal = Quaternion::axis_angle(direction, angle) * Math::orthogonal(direction);
-			}
+			if (Vector3::length_squared(strand[v] - strand[v-1]) == 0.0f) continue;
 
-			float r = Math::lerp(radius, 0.0f, float(v) / float(strand_size - 1));
-			curr_segment.begin = strand[v] + r * orthogonal;
-			curr_segment.end   = strand[v] - r * orthogonal;
-
-			triangles.emplace_back(
-				prev_segment.begin,
-				prev_segment.end,
-				curr_segment.begin,
-				Vector3(0.0f),
-				Vector3(0.0f),
-				Vector3(0.0f),
-				Vector2(0.0f, 0.0f),
-				Vector2(1.0f, 0.0f),
-				Vector2(0.0f, 1.0f)
-			);
-			triangles.emplace_back(
-				prev_segment.end,
-				curr_segment.end,
-				curr_segment.begin,
-				Vector3(0.0f),
-				Vector3(0.0f),
-				Vector3(0.0f),
-				Vector2(0.0f, 0.0f),
-				Vector2(1.0f, 0.0f),
-				Vector2(0.0f, 1.0f)
-			);
-			prev_segment = curr_segment;
+			Curve & curve = curves.emplace_back();
+			curve.position_0 = strand[v-1];
+			curve.radius_0   = Math::lerp(radius, 0.0f, float(v-1) / float(strand_size - 1));
+			curve.position_1 = strand[v];
+			curve.radius_1   = Math::lerp(radius, 0.0f, float(v)   / float(strand_size - 1));
 		}
 	}
 
-	return triangles;
+	return curves;
 }
@@ -2,8 +2,8 @@
 #include "Core/Array.h"
 #include "Core/Parser.h"
 
-struct Triangle;
+struct Curve;
 
 namespace MitshairLoader {
-	Array<Triangle> load(const String & filename, Allocator * allocator, SourceLocation location_in_mitsuba_file, float radius);
+	Array<Curve> load(const String & filename, Allocator * allocator, SourceLocation location_in_mitsuba_file, float radius);
 }
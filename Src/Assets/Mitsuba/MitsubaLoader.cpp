@@ -5,7 +5,7 @@
 #include <stdlib.h>
 
 #include "Core/Array.h"
-#include "Core/HashMap.h"
+#include "Core/SwissHashMap.h"
 #include "Core/Format.h"
 #include "Core/Parser.h"
 #include "Core/StringView.h"
@@ -13,6 +13,7 @@
 #include "Assets/BVHLoader.h"
 #include "Assets/OBJLoader.h"
 #include "Assets/PLYLoader.h"
+#include "Assets/VolumeLoader.h"
 
 #include "Renderer/Scene.h"
 #include "Renderer/MeshData.h"
@@ -24,14 +25,18 @@
 #include "MitshairLoader.h"
 #include "SerializedLoader.h"
 
+// Every instance of a ShapeGroup creates Meshes that refer to the same MeshData, so the TLAS references a single BLAS per shape
 struct ShapeGroup {
-	Handle<MeshData> mesh_data_handle;
-	Handle<Material> material_handle;
+	struct Shape {
+		Handle<MeshData> mesh_data_handle;
+		Handle<Material> material_handle;
+	};
+	Array<Shape> shapes;
 };
 
-using ShapeGroupMap = HashMap<String, ShapeGroup>;
-using MaterialMap   = HashMap<String, Handle<Material>>;
-using TextureMap    = HashMap<String, Handle<Texture>>;
+using ShapeGroupMap = SwissHashMap<String, ShapeGroup>;
+using MaterialMap   = SwissHashMap<String, Handle<Material>>;
+using TextureMap    = SwissHashMap<String, Handle<Texture>>;
 
 static Handle<Texture> parse_texture(const XMLNode * node, TextureMap & texture_map, StringView path, Scene & scene, Vector3 * rgb) {
 	StringView type = node->get_attribute_value("type");
@@ -102,6 +107,19 @@ static void parse_rgb_or_texture(const XMLNode * node, const char * name, Textur
 	}
 }
 
+// The roughness is either a float or a Texture, a Texture scales linear_roughness (1 unless the Texture has a scale)
+static void parse_roughness(const XMLNode * node, TextureMap & texture_map, StringView path, Scene & scene, Material & material) {
+	const XMLNode * alpha = node->get_child_by_name("alpha");
+	if (alpha && (alpha->tag == "texture" || alpha->tag == "ref")) {
+		Vector3 scale = Vector3(1.0f);
+		parse_rgb_or_texture(node, "alpha", texture_map, path, scene, &scale, &material.roughness_texture_handle);
+
+		material.linear_roughness = scale.x;
+	} else {
+		material.linear_roughness = node->get_child_value_optional("alpha", 0.5f);
+	}
+}
+
 static Matrix4 parse_transform_matrix(const XMLNode * node) {
 	Matrix4 world = { };
 
@@ -173,7 +191,7 @@ static Handle<Material> parse_material(const XMLNode * node, Scene & scene, cons
 		if (emitter) {
 			material.type = Material::Type::LIGHT;
 			material.name = "emitter";
-			material.emission = emitter->get_child_value<Vector3>("radiance");
+			parse_rgb_or_texture(emitter, "radiance", texture_map, path, scene, &material.emission, &material.emission_texture_handle);
 
 			return scene.asset_manager.add_material(std::move(material));
 		}
@@ -213,6 +231,15 @@ static Handle<Material> parse_material(const XMLNode * node, Scene & scene, cons
 		inner_bsdf_type == "bumpmap" ||
 		inner_bsdf_type == "coating"
 	) {
+		// Only a textured opacity can be used as an alpha mask, a constant opacity would make the whole surface either opaque or invisible
+		if (inner_bsdf_type == "mask") {
+			const XMLNode * opacity = inner_bsdf->get_child_by_name("opacity");
+			if (opacity && (opacity->tag == "texture" || opacity->tag == "ref")) {
+				Vector3 scale = Vector3(1.0f);
+				parse_rgb_or_texture(inner_bsdf, "opacity", texture_map, path, scene, &scale, &material.alpha_texture_handle);
+			}
+		}
+
 		const XMLNode * inner_bsdf_child = inner_bsdf->get_child_by_tag("bsdf");
 		if (inner_bsdf_child) {
 			inner_bsdf = inner_bsdf_child;
@@ -254,7 +281,7 @@ static Handle<Material> parse_material(const XMLNode * node, Scene & scene, cons
 		if (inner_bsdf_type == "conductor") {
 			material.linear_roughness = 0.0f;
 		} else {
-			material.linear_roughness = inner_bsdf->get_child_value_optional("alpha", 0.5f);
+			parse_roughness(inner_bsdf, texture_map, path, scene, material);
 		}
 
 		const XMLNode * material_str = inner_bsdf->get_child_by_name("material");
@@ -273,7 +300,7 @@ static Handle<Material> parse_material(const XMLNode * node, Scene & scene, cons
 		if (inner_bsdf_type == "plastic") {
 			material.linear_roughness = 0.0f;
 		} else {
-			material.linear_roughness = inner_bsdf->get_child_value_optional("alpha", 0.5f);
+			parse_roughness(inner_bsdf, texture_map, path, scene, material);
 		}
 	} else if (inner_bsdf_type == "phong") {
 		material.type = Material::Type::PLASTIC;
@@ -353,7 +380,7 @@ static Handle<Material> parse_material(const XMLNode * node, Scene & scene, cons
 		material.index_of_refraction = ext_ior == 0.0f ? int_ior : int_ior / ext_ior;
 
 		if (inner_bsdf_type == "roughdielectric") {
-			material.linear_roughness = inner_bsdf->get_child_value_optional("alpha", 0.5f);
+			parse_roughness(inner_bsdf, texture_map, path, scene, material);
 		} else {
 			material.linear_roughness = 0.0f;
 		}
@@ -370,7 +397,37 @@ static Handle<Material> parse_material(const XMLNode * node, Scene & scene, cons
 	return scene.asset_manager.add_material(std::move(material));
 }
 
-static Handle<Medium> parse_medium(const XMLNode * node, Scene & scene) {
+static void parse_phase_function(const XMLNode * xml_medium, Medium & medium) {
+	if (const XMLNode * phase = xml_medium->get_child_by_tag("phase")) {
+		StringView phase_type = phase->get_attribute_value("type");
+
+		if (phase_type == "isotropic") {
+			medium.g = 0.0f;
+		} else if (phase_type == "hg") {
+			medium.g = phase->get_child_value_optional("g", 0.0f);
+		} else {
+			WARNING(xml_medium->location, "WARNING: Phase function type '{}' not supported!\n", phase_type);
+		}
+	}
+}
+
+// Value of a constvolume, or of a plain spectrum/rgb/float child
+static Vector3 parse_constvolume(const XMLNode * node, Vector3 default_value) {
+	if (!node) return default_value;
+
+	if (node->tag == "volume") {
+		if (node->get_attribute_value("type") != "constvolume") {
+			WARNING(node->location, "WARNING: Only constvolume is supported here!\n");
+			return default_value;
+		}
+		node = node->get_child_by_name("value");
+		if (!node) return default_value;
+	}
+
+	return node->get_attribute_value<Vector3>("value");
+}
+
+static Handle<Medium> parse_medium(const XMLNode * node, Scene & scene, StringView path) {
 	const XMLNode * xml_medium = node->get_child_by_tag("medium");
 	if (!xml_medium) {
 		return Handle<Medium> { INVALID };
@@ -378,12 +435,13 @@ static Handle<Medium> parse_medium(const XMLNode * node, Scene & scene) {
 
 	StringView medium_type = xml_medium->get_attribute_value("type");
 
-	if (medium_type == "homogeneous") {
-		Medium medium = { };
+	Medium medium = { };
 
-		if (const XMLAttribute * name = xml_medium->get_attribute("name")) {
-			medium.name = String(name->value, scene.allocator);
-		}
+	if (const XMLAttribute * name = xml_medium->get_attribute("name")) {
+		medium.name = String(name->value, scene.allocator);
+	}
+
+	if (medium_type == "homogeneous") {
 
 		const XMLNode * xml_sigma_a = xml_medium->get_child_by_name("sigmaA");
 		const XMLNode * xml_sigma_s = xml_medium->get_child_by_name("sigmaS");
@@ -409,18 +467,44 @@ static Handle<Medium> parse_medium(const XMLNode * node, Scene & scene) {
 		float scale = xml_medium->get_child_value_optional("scale", 1.0f);
 		medium.from_sigmas(scale * sigma_a, scale * sigma_s);
 
-		if (const XMLNode * phase = xml_medium->get_child_by_tag("phase")) {
-			StringView phase_type = phase->get_attribute_value("type");
+		parse_phase_function(xml_medium, medium);
 
-			if (phase_type == "isotropic") {
-				medium.g = 0.0f;
-			} else if (phase_type == "hg") {
-				medium.g = phase->get_child_value_optional("g", 0.0f);
-			} else {
-				WARNING(xml_medium->location, "WARNING: Phase function type '{}' not supported!\n", phase_type);
+		return scene.asset_manager.add_medium(std::move(medium));
+	} else if (medium_type == "heterogeneous") {
+		// The density scales sigma_t = scale, the albedo is assumed to be constant
+		const XMLNode * xml_density = xml_medium->get_child_by_name("density");
+		if (!xml_density) {
+			WARNING(xml_medium->location, "WARNING: Heterogeneous Medium without density!\n");
+			return Handle<Medium> { INVALID };
+		}
+
+		StringView density_type = xml_density->get_attribute_value("type");
+
+		if (density_type == "gridvolume") {
+			String filename = Util::combine_stringviews(path, xml_density->get_child_value<StringView>("filename"), scene.allocator);
+
+			if (!VolumeLoader::load_vol(filename, medium.grid)) {
+				return Handle<Medium> { INVALID };
 			}
+		} else if (density_type == "constvolume") {
+			// A constant density is equivalent to a single voxel grid covering the Medium, whose bounds are not known here
+			WARNING(xml_density->location, "WARNING: Constant density volumes should be specified as a homogeneous Medium!\n");
+			return Handle<Medium> { INVALID };
+		} else {
+			WARNING(xml_density->location, "WARNING: Volume type '{}' not supported!\n", density_type);
+			return Handle<Medium> { INVALID };
 		}
 
+		Vector3 albedo = parse_constvolume(xml_medium->get_child_by_name("albedo"), Vector3(0.5f));
+		float   scale  = xml_medium->get_child_value_optional("scale", 1.0f);
+
+		Vector3 sigma_t = Vector3(scale);
+		Vector3 sigma_s = albedo  * sigma_t;
+		Vector3 sigma_a = sigma_t - sigma_s;
+
+		parse_phase_function(xml_medium, medium);
+		medium.from_sigmas(sigma_a, sigma_s);
+
 		return scene.asset_manager.add_medium(std::move(medium));
 	} else {
 		WARNING(xml_medium->location, "WARNING: Medium type '{}' not supported!\n", medium_type);
@@ -429,18 +513,34 @@ static Handle<Medium> parse_medium(const XMLNode * node, Scene & scene) {
 	return Handle<Medium> { INVALID };
 }
 
+// Shapes can override cpu_config.bvh_build_policy with <string name="bvh" value="..."/>, see BVHBuildPolicy
+static BVHBuildPolicy parse_bvh_build_policy(const XMLNode * node) {
+	BVHBuildPolicy policy = cpu_config.bvh_build_policy;
+
+	const XMLNode * xml_bvh = node->get_child_by_name("bvh");
+	if (xml_bvh) {
+		StringView value = xml_bvh->get_attribute_value<StringView>("value");
+		if (!BVH::parse_build_policy(value, policy)) {
+			WARNING(xml_bvh->location, "WARNING: BVH build policy '{}' not supported! Supported options: global, auto, sah, sbvh, lbvh, binned\n", value);
+		}
+	}
+	return policy;
+}
+
 static Handle<MeshData> parse_shape(const XMLNode * node, Allocator * allocator, Scene & scene, StringView path, String * name) {
 	StringView type = node->get_attribute_value<StringView>("type");
 
+	BVHBuildPolicy bvh_build_policy = parse_bvh_build_policy(node);
+
 	if (type == "obj" || type == "ply") {
 		String filename = Util::combine_stringviews(path, node->get_child_value<StringView>("filename"), scene.allocator);
 
 
 		Handle<MeshData> mesh_data_handle;
 		if (type == "obj") {
-			mesh_data_handle = scene.asset_manager.add_mesh_data(filename, OBJLoader::load);
+			mesh_data_handle = scene.asset_manager.add_mesh_data(filename, OBJLoader::load, bvh_build_policy);
 		} else {
-			mesh_data_handle = scene.asset_manager.add_mesh_data(filename, PLYLoader::load);
+			mesh_data_handle = scene.asset_manager.add_mesh_data(filename, PLYLoader::load, bvh_build_policy);
 		}
 
 		*name = String(Util::remove_directory(filename.view()), scene.allocator);
@@ -478,6 +578,31 @@ static Handle<MeshData> parse_shape(const XMLNode * node, Allocator * allocator,
 
 			transform = transform * Matrix4::create_translation(center) * Matrix4::create_scale(radius);
 
+			// Curves cannot be sampled as lights, so emissive spheres are always tessellated
+			// Likewise a non uniform scale or shear turns the sphere into an ellipsoid, which a Curve cannot represent
+			if (cpu_config.enable_analytic_spheres && !node->get_child_by_tag("emitter")) {
+				Vector3 axis_x = Matrix4::transform_direction(transform, Vector3(1.0f, 0.0f, 0.0f));
+				Vector3 axis_y = Matrix4::transform_direction(transform, Vector3(0.0f, 1.0f, 0.0f));
+				Vector3 axis_z = Matrix4::transform_direction(transform, Vector3(0.0f, 0.0f, 1.0f));
+
+				float scale = Vector3::length(axis_x);
+
+				bool is_similarity =
+					fabsf(Vector3::length(axis_y) - scale) <= 1e-4f * scale &&
+					fabsf(Vector3::length(axis_z) - scale) <= 1e-4f * scale &&
+					fabsf(Vector3::dot(axis_x, axis_y)) <= 1e-4f * scale * scale &&
+					fabsf(Vector3::dot(axis_y, axis_z)) <= 1e-4f * scale * scale &&
+					fabsf(Vector3::dot(axis_z, axis_x)) <= 1e-4f * scale * scale;
+
+				if (is_similarity && scale > 0.0f) {
+					Vector3 position = Matrix4::transform_position(transform, Vector3(0.0f));
+
+					*name = String(type, scene.allocator);
+
+					return scene.asset_manager.add_mesh_data(Array<Curve> { Curve { position, scale, position, scale } });
+				}
+			}
+
 			triangles = Geometry::sphere(transform);
 		} else {
 			ASSERT_UNREACHABLE();
@@ -485,7 +610,7 @@ static Handle<MeshData> parse_shape(const XMLNode * node, Allocator * allocator,
 
 		*name = String(type, scene.allocator);
 
-		return scene.asset_manager.add_mesh_data(std::move(triangles));
+		return scene.asset_manager.add_mesh_data(std::move(triangles), bvh_build_policy);
 	} else if (type == "serialized") {
 		StringView filename_rel = node->get_child_value<StringView>("filename");
 		String     filename_abs = Util::combine_stringviews(path, filename_rel);
@@ -499,7 +624,7 @@ static Handle<MeshData> parse_shape(const XMLNode * node, Allocator * allocator,
 		auto fallback_loader = [filename_abs = std::move(filename_abs), location = node->location, shape_index](const String & filename, Allocator * allocator) {
 			return SerializedLoader::load(filename_abs, allocator, location, shape_index);
 		};
-		return scene.asset_manager.add_mesh_data(bvh_filename, bvh_filename, fallback_loader);
+		return scene.asset_manager.add_mesh_data(bvh_filename, bvh_filename, fallback_loader, bvh_build_policy);
 	} else if (type == "hair") {
 		StringView filename_rel = node->get_child_value<StringView>("filename");
 		String     filename_abs = Util::combine_stringviews(path, filename_rel, scene.allocator);
@@ -508,16 +633,72 @@ static Handle<MeshData> parse_shape(const XMLNode * node, Allocator * allocator,
 
 		float radius = node->get_child_value_optional("radius", 0.0025f);
 
-		auto fallback_loader = [location = node->location, radius](const String & filename, Allocator * allocator) {
+		auto curve_loader = [location = node->location, radius](const String & filename, Allocator * allocator) {
 			return MitshairLoader::load(filename, allocator, location, radius);
 		};
-		return scene.asset_manager.add_mesh_data(filename_abs, fallback_loader);
+		return scene.asset_manager.add_mesh_data_curves(filename_abs, curve_loader);
 	} else {
 		WARNING(node->location, "WARNING: Shape type '{}' not supported!\n", type);
 		return Handle<MeshData> { INVALID };
 	}
 }
 
+static void add_shape_group_instance(Scene & scene, StringView id, const ShapeGroup & shape_group, const Matrix4 & world) {
+	for (size_t i = 0; i < shape_group.shapes.size(); i++) {
+		const ShapeGroup::Shape & shape = shape_group.shapes[i];
+
+		Mesh & mesh = scene.add_mesh(String(id, scene.allocator), shape.mesh_data_handle, shape.material_handle);
+		Matrix4::decompose(world, &mesh.position, &mesh.rotation, &mesh.scale, Vector3(0.0f, 0.0f, 1.0f));
+	}
+}
+
+// Non-standard extension to instance a shapegroup many times without an <instance> node per copy:
+//	<shape type="instancelist">
+//		<ref id="tree"/>
+//		<string name="filename" value="forest.bin"/>
+//		<transform name="toWorld"> ... </transform> (optional, applied after every transform in the file)
+//	</shape>
+// The file is a tightly packed array of row-major 3x4 float matrices (the implied last row is 0 0 0 1)
+static void parse_instance_list(const XMLNode * node, Scene & scene, const ShapeGroupMap & shape_group_map, StringView path) {
+	const XMLNode * ref = node->get_child_by_tag("ref");
+	if (!ref) {
+		WARNING(node->location, "Instance list without ref!\n");
+		return;
+	}
+	StringView id = ref->get_attribute_value<StringView>("id");
+
+	const ShapeGroup * shape_group = shape_group_map.try_get(id);
+	if (!shape_group) {
+		WARNING(ref->location, "Invalid shapegroup Ref '{}'!\n", id);
+		return;
+	}
+
+	StringView filename_rel = node->get_child_value<StringView>("filename");
+	String     filename_abs = Util::combine_stringviews(path, filename_rel);
+
+	IO::MappedFile file = IO::file_map(filename_abs);
+
+	constexpr size_t MATRIX_SIZE = 12 * sizeof(float);
+
+	if (file.size() % MATRIX_SIZE != 0) {
+		ERROR(node->location, "Instance list '{}' does not contain a whole number of 3x4 float matrices!\n", filename_abs);
+	}
+	size_t instance_count = file.size() / MATRIX_SIZE;
+
+	Matrix4 world = parse_transform_matrix(node);
+
+	scene.meshes.reserve(scene.meshes.size() + instance_count * shape_group->shapes.size());
+
+	for (size_t i = 0; i < instance_count; i++) {
+		Matrix4 transform;
+		memcpy(transform.cells, file.data() + i * MATRIX_SIZE, MATRIX_SIZE);
+
+		add_shape_group_instance(scene, id, *shape_group, world * transform);
+	}
+
+	IO::print("Loaded {} instances of '{}' from instance list '{}'\n"_sv, instance_count, id, filename_abs);
+}
+
 static void walk_xml_tree(const XMLNode * node, Allocator * allocator, Scene & scene, ShapeGroupMap & shape_group_map, MaterialMap & material_map, TextureMap & texture_map, StringView path) {
 	if (node->tag == "bsdf") {
 		Handle<Material> material_handle = parse_material(node, scene, material_map, texture_map, path);
@@ -531,18 +712,31 @@ static void walk_xml_tree(const XMLNode * node, Allocator * allocator, Scene & s
 		StringView type = node->get_attribute_value<StringView>("type");
 		if (type == "shapegroup") {
 			if (node->children.size() > 0) {
-				const XMLNode * shape = node->get_child_by_tag("shape");
-				if (!shape) {
-					ERROR(node->location, "Shapegroup needs a <shape> child!\n");
-				}
+				ShapeGroup shape_group = { };
+				bool       has_shape   = false;
+
+				for (size_t i = 0; i < node->children.size(); i++) {
+					const XMLNode * shape = &node->children[i];
+					if (shape->tag != "shape") continue;
+
+					has_shape = true;
 
-				String name = { };
+					String name = { };
 
-				Handle<MeshData> mesh_data_handle = parse_shape(shape, allocator, scene, path, &name);
-				Handle<Material> material_handle  = parse_material(shape, scene, material_map, texture_map, path);
+					Handle<MeshData> mesh_data_handle = parse_shape(shape, allocator, scene, path, &name);
+					Handle<Material> material_handle  = parse_material(shape, scene, material_map, texture_map, path);
+
+					if (mesh_data_handle.handle != INVALID) {
+						shape_group.shapes.push_back({ mesh_data_handle, material_handle });
+					}
+				}
+
+				if (!has_shape) {
+					ERROR(node->location, "Shapegroup needs a <shape> child!\n");
+				}
 
 				StringView id = node->get_attribute_value<StringView>("id");
-				shape_group_map[id] = { mesh_data_handle, material_handle };
+				shape_group_map[id] = std::move(shape_group);
 			}
 		} else if (type == "instance") {
 			const XMLNode * ref = node->get_child_by_tag("ref");
@@ -553,16 +747,17 @@ static void walk_xml_tree(const XMLNode * node, Allocator * allocator, Scene & s
 			StringView id = ref->get_attribute_value<StringView>("id");
 
 			const ShapeGroup * shape_group = shape_group_map.try_get(id);
-			if (shape_group && shape_group->mesh_data_handle.handle != INVALID) {
-				Mesh & mesh = scene.add_mesh(id, shape_group->mesh_data_handle, shape_group->material_handle);
-				parse_transform(node, &mesh.position, &mesh.rotation, &mesh.scale);
+			if (shape_group) {
+				add_shape_group_instance(scene, id, *shape_group, parse_transform_matrix(node));
 			}
+		} else if (type == "instancelist") {
+			parse_instance_list(node, scene, shape_group_map, path);
 		} else {
 			String name = { };
 
 			Handle<MeshData> mesh_data_handle = parse_shape(node, allocator, scene, path, &name);
 			Handle<Material> material_handle  = parse_material(node, scene, material_map, texture_map, path);
-			Handle<Medium>   medium_handle    = parse_medium(node, scene);
+			Handle<Medium>   medium_handle    = parse_medium(node, scene, path);
 
 			if (material_handle.handle != INVALID) {
 				Material & material = scene.asset_manager.get_material(material_handle);
@@ -627,7 +822,7 @@ static void walk_xml_tree(const XMLNode * node, Allocator * allocator, Scene & s
 				Material material = { };
 				material.type = Material::Type::LIGHT;
 				material.name = String(emitter_id, allocator);
-				material.emission = node->get_child_value<Vector3>("radiance");
+				parse_rgb_or_texture(node, "radiance", texture_map, path, scene, &material.emission, &material.emission_texture_handle);
 
 				material_map.insert(emitter_id, scene.asset_manager.add_material(std::move(material)));
 			} else {
@@ -673,7 +868,7 @@ static void walk_xml_tree(const XMLNode * node, Allocator * allocator, Scene & s
 }
 
 void MitsubaLoader::load(const String & filename, Allocator * allocator, Scene & scene) {
-	XMLParser xml_parser(filename, allocator);
+	XMLParser xml_parser(filename);
 
 	XMLNode root = xml_parser.parse_root();
 
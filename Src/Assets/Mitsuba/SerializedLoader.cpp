@@ -2,73 +2,192 @@
 
 #include <miniz/miniz.h>
 
+#include "Core/HashMap.h"
+#include "Core/Mutex.h"
+#include "Core/OwnPtr.h"
+
 #include "Renderer/Triangle.h"
 
 #include "XMLParser.h"
 
-Array<Triangle> SerializedLoader::load(const String & filename, Allocator * allocator, SourceLocation location_in_mitsuba_file, int shape_index) {
-	String serialized = IO::file_read(filename, allocator);
-	Parser serialized_parser(serialized.view(), filename.view());
+// A .serialized file usually contains many shapes that are loaded independently (and concurrently) by the AssetManager.
+// The file is mapped and its End-of-File Dictionary is parsed only once, the first time any of its shapes is loaded
+struct SerializedFile {
+	IO::MappedFile  data;
+	uint16_t        version;
+	Array<uint64_t> mesh_offsets; // Offset of every mesh, followed by the offset of the End-of-File Dictionary
+};
+
+static HashMap<String, OwnPtr<SerializedFile>> serialized_file_cache;
+static Mutex                                   serialized_file_cache_mutex;
+
+static const SerializedFile & get_serialized_file(const String & filename, SourceLocation location_in_mitsuba_file) {
+	MutexLock lock(serialized_file_cache_mutex);
+
+	OwnPtr<SerializedFile> * cached_file = serialized_file_cache.try_get(filename);
+	if (cached_file) {
+		return *cached_file->get();
+	}
+
+	OwnPtr<SerializedFile> file = make_owned<SerializedFile>();
+	file->data = IO::file_map(filename);
+
+	Parser serialized_parser(file->data.view(), filename.view());
 
 	uint16_t file_format_id = serialized_parser.parse_binary<uint16_t>();
 	if (file_format_id != 0x041c) {
 		ERROR(location_in_mitsuba_file, "ERROR: Serialized file '{}' does not start with format ID 0x041c!\n", filename);
 	}
 
-	uint16_t file_version = serialized_parser.parse_binary<uint16_t>();
+	file->version = serialized_parser.parse_binary<uint16_t>();
 
 	// Read the End-of-File Dictionary
-	serialized_parser.seek(serialized.size() - sizeof(uint32_t));
+	serialized_parser.seek(file->data.size() - sizeof(uint32_t));
 	uint32_t num_meshes = serialized_parser.parse_binary<uint32_t>();
-	uint64_t eof_dictionary_offset = 0;;
+	uint64_t eof_dictionary_offset = 0;
 
-	Array<uint64_t> mesh_offsets(num_meshes + 1, allocator);
+	file->mesh_offsets.resize(num_meshes + 1);
 
-	if (file_version <= 3) {
+	if (file->version <= 3) {
 		// Version 0.3.0 and earlier use 32 bit mesh offsets
-		eof_dictionary_offset = serialized.size() - sizeof(uint32_t) - num_meshes * sizeof(uint32_t);
+		eof_dictionary_offset = file->data.size() - sizeof(uint32_t) - num_meshes * sizeof(uint32_t);
 		serialized_parser.seek(eof_dictionary_offset);
 
 		for (uint32_t i = 0; i < num_meshes; i++) {
-			mesh_offsets[i] = serialized_parser.parse_binary<uint32_t>();
+			file->mesh_offsets[i] = serialized_parser.parse_binary<uint32_t>();
 		}
 	} else {
 		// Version 0.4.0 and later use 64 bit mesh offsets
-		eof_dictionary_offset = serialized.size() - sizeof(uint32_t) - num_meshes * sizeof(uint64_t);
+		eof_dictionary_offset = file->data.size() - sizeof(uint32_t) - num_meshes * sizeof(uint64_t);
 		serialized_parser.seek(eof_dictionary_offset);
 
 		for (uint32_t i = 0; i < num_meshes; i++) {
-			mesh_offsets[i] = serialized_parser.parse_binary<uint64_t>();
+			file->mesh_offsets[i] = serialized_parser.parse_binary<uint64_t>();
 		}
 	}
 
-	mesh_offsets[num_meshes] = eof_dictionary_offset;
-	ASSERT(mesh_offsets[0] == 0);
+	file->mesh_offsets[num_meshes] = eof_dictionary_offset;
+	ASSERT(file->mesh_offsets[0] == 0);
 
-	// Decompress stream for this Mesh
-	mz_ulong num_bytes = mesh_offsets[shape_index + 1] - mesh_offsets[shape_index] - 4;
+	return *serialized_file_cache.insert(filename, std::move(file)).get();
+}
 
-	mz_ulong deserialized_length = 3 * num_bytes;
-	String   deserialized = { };
+// Returns the size of the Mesh header (flags, name, vertex and triangle counts), or 0 if the header is not yet complete
+static size_t get_header_size(const Array<char> & data, size_t data_size, uint16_t file_version) {
+	size_t header_size = sizeof(uint32_t);
 
-	while (true) {
-		deserialized = String(deserialized_length);
+	if (file_version > 3) {
+		// Null terminated name
+		const char * name_end = header_size < data_size ? reinterpret_cast<const char *>(memchr(data.data() + header_size, '\0', data_size - header_size)) : nullptr;
+		if (!name_end) return 0;
 
-		int status = uncompress(
-			reinterpret_cast<      unsigned char *>(deserialized.data()), &deserialized_length,
-			reinterpret_cast<const unsigned char *>(serialized.data() + mesh_offsets[shape_index] + 4), num_bytes
-		);
+		header_size = name_end - data.data() + 1;
+	}
 
-		if (status == MZ_BUF_ERROR) {
-			deserialized_length *= 2;
-		} else if (status == MZ_OK) {
-			break;
-		} else {
-			ERROR(location_in_mitsuba_file, "ERROR: Failed to decompress serialized mesh #{} in file '{}'!\n{}\n", shape_index, filename, mz_error(status));
+	header_size += 2 * sizeof(uint64_t);
+
+	return header_size <= data_size ? header_size : 0;
+}
+
+void SerializedLoader::free_cache() {
+	MutexLock lock(serialized_file_cache_mutex);
+	serialized_file_cache.clear();
+}
+
+Array<Triangle> SerializedLoader::load(const String & filename, Allocator * allocator, SourceLocation location_in_mitsuba_file, int shape_index) {
+	const SerializedFile & serialized = get_serialized_file(filename, location_in_mitsuba_file);
+
+	uint16_t file_version = serialized.version;
+
+	if (shape_index < 0 || shape_index + 1 >= int(serialized.mesh_offsets.size())) {
+		ERROR(location_in_mitsuba_file, "ERROR: Serialized file '{}' does not contain a mesh #{}!\n", filename, shape_index);
+	}
+
+	// Stream decompress only this Mesh. The header is inflated first, it determines the exact size of the remaining data
+	uint64_t num_bytes = serialized.mesh_offsets[shape_index + 1] - serialized.mesh_offsets[shape_index] - 4;
+	ASSERT(num_bytes <= 0xffffffff);
+
+	mz_stream stream = { };
+	stream.next_in  = reinterpret_cast<const unsigned char *>(serialized.data.data() + serialized.mesh_offsets[shape_index] + 4);
+	stream.avail_in = unsigned(num_bytes);
+
+	int status = mz_inflateInit(&stream);
+
+	Array<char> deserialized;
+
+	// Inflates until either the stream ends or the first size bytes of the output are available
+	auto inflate_until = [&](size_t size) {
+		if (status != MZ_OK) return;
+
+		deserialized.resize(Math::max<size_t>(size, stream.total_out));
+
+		// NOTE: miniz produces at most its dictionary size worth of output per call
+		while (status == MZ_OK && stream.total_out < size) {
+			stream.next_out  = reinterpret_cast<unsigned char *>(deserialized.data() + stream.total_out);
+			stream.avail_out = unsigned(size - stream.total_out);
+
+			status = mz_inflate(&stream, MZ_SYNC_FLUSH);
 		}
+	};
+
+	size_t header_size = 0;
+	size_t header_size_inflated = 256;
+
+	while (status == MZ_OK) {
+		inflate_until(header_size_inflated);
+
+		header_size = get_header_size(deserialized, stream.total_out, file_version);
+		if (header_size > 0) break;
+
+		header_size_inflated *= 2;
+	}
+
+	if (header_size == 0 || (status != MZ_OK && status != MZ_STREAM_END)) {
+		mz_inflateEnd(&stream);
+		ERROR(location_in_mitsuba_file, "ERROR: Failed to decompress serialized mesh #{} in file '{}'!\n{}\n", shape_index, filename, mz_error(status));
+	}
+
+	uint32_t header_flags;
+	uint64_t header_num_vertices;
+	uint64_t header_num_triangles;
+	memcpy(&header_flags,         deserialized.data(), sizeof(uint32_t));
+	memcpy(&header_num_vertices,  deserialized.data() + header_size - 2 * sizeof(uint64_t), sizeof(uint64_t));
+	memcpy(&header_num_triangles, deserialized.data() + header_size -     sizeof(uint64_t), sizeof(uint64_t));
+
+	size_t header_element_size;
+	if (file_version <= 3 || (header_flags & 0x1000)) {
+		header_element_size = sizeof(float);
+	} else if (header_flags & 0x2000) {
+		header_element_size = sizeof(double);
+	} else {
+		ERROR(location_in_mitsuba_file, "ERROR: Neither single nor double precision specified!\n");
+	}
+	size_t header_index_size   = header_num_vertices <= 0xffffffff ? sizeof(uint32_t) : sizeof(uint64_t);
+
+	size_t num_floats_per_vertex = 3;
+	if (header_flags & 0x0001) num_floats_per_vertex += 3; // Normals
+	if (header_flags & 0x0002) num_floats_per_vertex += 2; // Texture coordinates
+	if (header_flags & 0x0008) num_floats_per_vertex += 3; // Colours
+
+	size_t deserialized_length = header_size +
+		header_num_vertices  * num_floats_per_vertex * header_element_size +
+		header_num_triangles * 3 * header_index_size;
+
+	inflate_until(deserialized_length);
+
+	if (status == MZ_OK) {
+		// All expected output is there, the stream should end here (this also verifies the checksum)
+		stream.avail_out = 0;
+		status = mz_inflate(&stream, MZ_SYNC_FLUSH);
+	}
+
+	mz_inflateEnd(&stream);
+
+	if (status != MZ_STREAM_END || stream.total_out != deserialized_length) {
+		ERROR(location_in_mitsuba_file, "ERROR: Failed to decompress serialized mesh #{} in file '{}'!\n{}\n", shape_index, filename, status == MZ_STREAM_END ? "Unexpected size" : mz_error(status));
 	}
 
-	Parser deserialized_parser(deserialized.view(), filename.view());
+	Parser deserialized_parser(StringView { deserialized.data(), deserialized.data() + deserialized.size() }, filename.view());
 
 	// Read flags field
 	uint32_t flags = deserialized_parser.parse_binary<uint32_t>();
@@ -7,4 +7,7 @@ struct Triangle;
 
 namespace SerializedLoader {
 	Array<Triangle> load(const String & filename, Allocator * allocator, SourceLocation location_in_mitsuba_file, int shape_index);
+
+	// Releases the files that were kept open to load their other shapes
+	void free_cache();
 }
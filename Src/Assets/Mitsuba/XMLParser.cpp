@@ -1,20 +1,39 @@
 #include "XMLParser.h"
 
 XMLNode XMLParser::parse_root() {
-	XMLNode root = XMLNode(allocator);
+	XMLNode root = { };
 	root.location = parser.location;
 
+	size_t stack_offset = node_stack.size();
+
 	while (!parser.reached_end()) {
 		parser_skip_xml_whitespace(parser);
-		root.children.push_back(parse_tag());
+		node_stack.push_back(parse_tag());
 		parser_skip_xml_whitespace(parser);
 	}
 
+	root.children.offset = node_pool.size();
+	root.children.count  = node_stack.size() - stack_offset;
+	node_pool.push_back(node_stack.data() + stack_offset, root.children.count);
+
+	// The pools no longer grow, turn all offsets into pointers
+	for (size_t i = 0; i < node_pool.size(); i++) {
+		resolve_ranges(node_pool[i]);
+	}
+	resolve_ranges(root);
+
+	node_stack = { };
+
 	return root;
 }
 
+void XMLParser::resolve_ranges(XMLNode & node) {
+	node.attributes.data = attribute_pool.data() + node.attributes.offset;
+	node.children  .data = node_pool     .data() + node.children  .offset;
+}
+
 XMLNode XMLParser::parse_tag() {
-	XMLNode node = XMLNode(allocator);
+	XMLNode node = { };
 	if (parser.reached_end()) {
 		return node;
 	}
@@ -37,13 +56,16 @@ XMLNode XMLParser::parse_tag() {
 
 	parser_skip_xml_whitespace(parser);
 
+	// Attributes are parsed before any child, so they can go into the pool directly
+	node.attributes.offset = attribute_pool.size();
+
 	// Parse attributes
 	while (!parser.reached_end() && !parser.match('>')) {
 		XMLAttribute attribute = { };
 
 		// Parse attribute name
 		attribute.name.start = parser.cur;
-		while (!parser.reached_end() && *parser.cur != '=') parser.advance();
+		parser.skip_until('=');
 		attribute.name.end = parser.cur;
 
 		parser.expect('=');
@@ -62,13 +84,18 @@ XMLNode XMLParser::parse_tag() {
 
 		// Parse attribute value
 		attribute.value.start = parser.cur;
-		while (!parser.reached_end() && *parser.cur != quote_type) parser.advance();
+		parser.skip_until(quote_type);
 		attribute.value.end = parser.cur;
 
 		parser.expect(quote_type);
 		parser_skip_xml_whitespace(parser);
 
-		node.attributes.push_back(attribute);
+		if (attribute.name == "name") {
+			node.name = attribute.value;
+		}
+
+		attribute_pool.push_back(attribute);
+		node.attributes.count++;
 
 		// Check if this is an inline tag (i.e. <tag/> or <?tag?>), if so return
 		if (parser.match('/') || (node.is_question_mark && parser.match('?'))) {
@@ -79,12 +106,22 @@ XMLNode XMLParser::parse_tag() {
 
 	parser_skip_xml_whitespace(parser);
 
-	// Parse children
+	// Parse children, these are collected on the stack since their own children are added to the pool first
+	size_t stack_offset = node_stack.size();
+
 	while (!parser.match("</")) {
-		node.children.push_back(parse_tag());
+		node_stack.push_back(parse_tag());
 		parser_skip_xml_whitespace(parser);
 	}
 
+	node.children.offset = node_pool.size();
+	node.children.count  = node_stack.size() - stack_offset;
+	node_pool.push_back(node_stack.data() + stack_offset, node.children.count);
+
+	while (node_stack.size() > stack_offset) {
+		node_stack.pop_back();
+	}
+
 	const char * closing_tag_start = parser.cur;
 	while (!parser.reached_end() && !parser.match('>')) {
 		parser.advance();
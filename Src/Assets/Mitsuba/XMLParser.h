@@ -4,7 +4,6 @@
 
 #include "Core/Array.h"
 #include "Core/Parser.h"
-#include "Core/Allocators/LinearAllocator.h"
 
 inline void parser_skip_xml_whitespace(Parser & parser) {
 	parser.skip_whitespace_or_newline();
@@ -90,26 +89,35 @@ inline Matrix4 XMLAttribute::get_value<Matrix4>() const {
 	return m;
 }
 
+// Contiguous range of XMLNodes or XMLAttributes, stored in the pools of the XMLParser
+template<typename T>
+struct XMLRange {
+	const T * data   = nullptr;
+	size_t    offset = 0; // Offset into the pool, only valid until the XMLParser has resolved data
+	size_t    count  = 0;
+
+	size_t size() const { return count; }
+
+	const T & operator[](size_t index) const {
+		ASSERT(index < count);
+		return data[index];
+	}
+};
+
 struct XMLNode {
 	StringView tag;
+	StringView name; // Value of the 'name' attribute (if any), cached since most lookups are by name
 
 	bool is_question_mark;
 
-	Array<XMLAttribute> attributes;
-	Array<XMLNode>      children;
+	XMLRange<XMLAttribute> attributes;
+	XMLRange<XMLNode>      children;
 
 	SourceLocation location;
 
-	XMLNode(Allocator * allocator) : attributes(allocator), children(allocator) { }
-
-	DEFAULT_MOVEABLE(XMLNode);
-	DEFAULT_COPYABLE(XMLNode);
-
-	~XMLNode() { }
-
 	template<typename Predicate>
 	const XMLAttribute * get_attribute(Predicate predicate) const {
-		for (int i = 0; i < attributes.size(); i++) {
+		for (size_t i = 0; i < attributes.size(); i++) {
 			if (predicate(attributes[i])) {
 				return &attributes[i];
 			}
@@ -123,7 +131,7 @@ struct XMLNode {
 
 	template<typename T>
 	T get_attribute_optional(const char * name, T default_value) const {
-		const XMLAttribute * attribute = get_attribute([name](const XMLAttribute & attribute) { return attribute.name == name; });
+		const XMLAttribute * attribute = get_attribute(name);
 		if (attribute) {
 			return attribute->get_value<T>();
 		} else {
@@ -143,7 +151,7 @@ struct XMLNode {
 
 	template<typename Predicate>
 	const XMLNode * get_child(Predicate predicate) const {
-		for (int i = 0; i < children.size(); i++) {
+		for (size_t i = 0; i < children.size(); i++) {
 			if (predicate(children[i])) {
 				return &children[i];
 			}
@@ -156,12 +164,8 @@ struct XMLNode {
 	}
 
 	const XMLNode * get_child_by_name(const char * name) const {
-		return get_child([name](const XMLNode & node) {
-			const XMLAttribute * attr = node.get_attribute("name");
-			if (attr == nullptr) return false;
-
-			return attr->value == name;
-		});
+		StringView name_view = StringView::from_c_str(name);
+		return get_child([name_view](const XMLNode & node) { return node.name == name_view; });
 	}
 
 	template<typename T = StringView>
@@ -185,16 +189,27 @@ struct XMLNode {
 	}
 };
 
+// Parses an XML file into a tree of XMLNodes
+// All XMLNodes and XMLAttributes are stored in two pools owned by the XMLParser, where the children and attributes
+// of a Node form a contiguous range. The tree refers into the mapped file, so it is only valid while the XMLParser is alive
 struct XMLParser {
-	Allocator * allocator = nullptr;
+	IO::MappedFile source;
+	Parser         parser;
 
-	String source;
-	Parser parser;
+	Array<XMLNode>      node_pool;
+	Array<XMLAttribute> attribute_pool;
 
-	XMLParser(const String & filename, Allocator * allocator) : allocator(allocator), source(IO::file_read(filename, allocator)), parser(source.view(), filename.view()) { }
+	XMLParser(const String & filename) : source(IO::file_map(filename)), parser(source.view(), filename.view()) { }
+
+	NON_COPYABLE(XMLParser);
+	NON_MOVEABLE(XMLParser);
 
 	XMLNode parse_root();
 
 private:
+	Array<XMLNode> node_stack; // Children of the Nodes that are currently open, moved to the pool once their parent closes
+
 	XMLNode parse_tag();
+
+	void resolve_ranges(XMLNode & node);
 };
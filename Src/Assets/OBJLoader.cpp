@@ -1,12 +1,23 @@
 #include "OBJLoader.h"
 
+#include <string.h>
+
 #include "Core/Array.h"
 #include "Core/Parser.h"
 #include "Core/String.h"
+#include "Core/Allocators/LargePageAllocator.h"
 
 #include "Math/Vector2.h"
 #include "Math/Vector3.h"
 
+#include "Util/ThreadPool.h"
+
+// The file is split into chunks of roughly this many bytes (at line boundaries) that are parsed in parallel
+static constexpr size_t OBJ_CHUNK_SIZE = 8 * 1024 * 1024;
+
+// Number of faces per job when converting faces into Triangles
+static constexpr int OBJ_FACES_PER_JOB = 16 * 1024;
+
 static float parse_float(Parser & parser) {
 	parser.skip_whitespace();
 	return parser.parse_float();
@@ -38,18 +49,53 @@ struct Face {
 	Index indices[3]; // Always a triangular face
 };
 
-static Index parse_index(Parser & parser) {
+struct OBJFile {
+	Array<Vector3> positions;
+	Array<Vector2> tex_coords;
+	Array<Vector3> normals;
+
+	Array<Face> faces;
+
+	OBJFile(Allocator * allocator = nullptr) : positions(allocator), tex_coords(allocator), normals(allocator), faces(allocator) { }
+
+	DEFAULT_COPYABLE(OBJFile);
+	DEFAULT_MOVEABLE(OBJFile);
+
+	~OBJFile() { }
+};
+
+// A range of lines of the file that is parsed independently of the others
+struct OBJChunk {
+	StringView data;
+	int        first_line;
+	int        line_count;
+
+	OBJFile obj;
+};
+
+// Negative indices are relative to the number of elements defined so far, but a chunk only knows how many it defined itself.
+// They are stored as the chunk local 0-based index minus the size of the chunk in bytes, which always exceeds the local count.
+// This keeps them negative (and distinguishable from absolute indices) until the offset of the chunk is known, see fixup_index
+static int parse_relative_index(Parser & parser, int count, int bias) {
+	int index = parse_int(parser);
+	if (index < 0) {
+		index = count + index - bias;
+	}
+	return index;
+}
+
+static Index parse_index(Parser & parser, const OBJFile & obj, int bias) {
 	Index index = { };
 
-	index.v = parse_int(parser);
+	index.v = parse_relative_index(parser, int(obj.positions.size()), bias);
 
 	if (parser.match('/')) {
 		if (parser.match('/')) {
-			index.n = parse_int(parser);
+			index.n = parse_relative_index(parser, int(obj.normals.size()), bias);
 		} else {
-			index.t = parse_int(parser);
+			index.t = parse_relative_index(parser, int(obj.tex_coords.size()), bias);
 			if (parser.match('/')) {
-				index.n = parse_int(parser);
+				index.n = parse_relative_index(parser, int(obj.normals.size()), bias);
 			}
 		}
 	}
@@ -57,6 +103,14 @@ static Index parse_index(Parser & parser) {
 	return index;
 }
 
+// Turns an index as stored by parse_relative_index into an absolute 1-based index, 0 remains 0 (not present)
+static int fixup_index(int index, int offset, int bias) {
+	if (index < 0) {
+		return offset + index + bias + 1;
+	}
+	return index;
+}
+
 static Vector3 parse_v(Parser & parser) {
 	Vector3 v = parse_vector3(parser);
 	parser.skip_whitespace();
@@ -83,11 +137,13 @@ static Vector3 parse_vn(Parser & parser) {
 	return parse_vector3(parser);
 }
 
-static void parse_face(Parser & parser, Array<Face> & faces) {
+static void parse_face(Parser & parser, OBJFile & obj, int bias) {
+	Array<Face> & faces = obj.faces;
+
 	// Parse first triangular face
-	Index index_0 = parse_index(parser);
-	Index index_1 = parse_index(parser);
-	Index index_2 = parse_index(parser);
+	Index index_0 = parse_index(parser, obj, bias);
+	Index index_1 = parse_index(parser, obj, bias);
+	Index index_2 = parse_index(parser, obj, bias);
 	faces.emplace_back(index_0, index_1, index_2);
 
 	// Triangulate any further vertices in the face
@@ -98,34 +154,23 @@ static void parse_face(Parser & parser, Array<Face> & faces) {
 
 		if (parser.reached_end() || !(*parser.cur == '-' || is_digit(*parser.cur))) break;
 
-		Index curr_index = parse_index(parser);
+		Index curr_index = parse_index(parser, obj, bias);
 		faces.emplace_back(index_0, prev_index, curr_index);
 
 		prev_index = curr_index;
 	}
 }
 
-struct OBJFile {
-	Array<Vector3> positions;
-	Array<Vector2> tex_coords;
-	Array<Vector3> normals;
+static void parse_obj_chunk(OBJChunk & chunk, StringView filename) {
+	OBJFile & obj = chunk.obj;
 
-	Array<Face> faces;
-
-	OBJFile(Allocator * allocator = nullptr) : positions(allocator), tex_coords(allocator), normals(allocator), faces(allocator) { }
+	int bias = int(chunk.data.size());
 
-	DEFAULT_COPYABLE(OBJFile);
-	DEFAULT_MOVEABLE(OBJFile);
+	Parser parser(chunk.data, SourceLocation { filename, chunk.first_line, 0 });
 
-	~OBJFile() { }
-};
-
-static OBJFile parse_obj(const String & filename, Allocator * allocator) {
-	String file = IO::file_read(filename, allocator);
-
-	OBJFile obj = OBJFile(allocator);
-
-	Parser parser(file.view(), filename.view());
+	// Most lines of an OBJ are either positions or faces, a quarter of the lines each avoids most of the regrowing without knowing the mix
+	obj.positions.reserve(chunk.line_count / 4);
+	obj.faces    .reserve(chunk.line_count / 4);
 
 	while (!parser.reached_end()) {
 		if (parser.match('#') || parser.match("o ")) {
@@ -136,7 +181,7 @@ static OBJFile parse_obj(const String & filename, Allocator * allocator) {
 		else if (parser.match("v "))  obj.positions .push_back(parse_v (parser));
 		else if (parser.match("vt ")) obj.tex_coords.push_back(parse_vt(parser));
 		else if (parser.match("vn ")) obj.normals   .push_back(parse_vn(parser));
-		else if (parser.match("f "))  parse_face(parser, obj.faces);
+		else if (parser.match("f "))  parse_face(parser, obj, bias);
 		else {
 			while (!parser.reached_end() && !is_newline(*parser.cur)) {
 				parser.advance();
@@ -147,73 +192,174 @@ static OBJFile parse_obj(const String & filename, Allocator * allocator) {
 		parser.match('\r');
 		parser.expect('\n');
 	}
-
-	return obj;
 }
 
-Array<Triangle> OBJLoader::load(const String & filename, Allocator * allocator) {
-	OBJFile obj = parse_obj(filename, allocator);
+static OBJFile parse_obj(const String & filename, Allocator * allocator) {
+	IO::MappedFile file = IO::file_map(filename);
 
-	Array<Triangle> triangles(obj.faces.size());
+	const char * data     = file.data();
+	const char * data_end = file.data() + file.size();
 
-	for (int f = 0; f < obj.faces.size(); f++) {
-		const Face & face = obj.faces[f];
+	Allocator * task_allocator = ThreadPool::task_allocator();
 
-		Vector3 positions [3] = { };
-		Vector2 tex_coords[3] = { };
-		Vector3 normals   [3] = { };
+	// Split the file into chunks, every chunk ends right after a newline (except possibly the last)
+	Array<OBJChunk> chunks(task_allocator);
 
-		for (int i = 0; i < 3; i++) {
-			int v = face.indices[i].v;
-			int t = face.indices[i].t;
-			int n = face.indices[i].n;
+	const char * chunk_start = data;
+	while (chunk_start < data_end) {
+		const char * chunk_end = data_end;
 
-			auto get_index = [](int array_size, int index) {
-				int result = INVALID;
-				if (array_size != 0) {
-					if (index > 0) {
-						result = index - 1;
-					} else if (index < 0) {
-						result = array_size + index; // Negative indices are relative to end
-					}
+		if (size_t(data_end - chunk_start) > OBJ_CHUNK_SIZE) {
+			const char * newline = reinterpret_cast<const char *>(memchr(chunk_start + OBJ_CHUNK_SIZE, '\n', data_end - chunk_start - OBJ_CHUNK_SIZE));
+			if (newline) {
+				chunk_end = newline + 1;
+			}
+		}
 
-					// Check if the index is valid given the Array size
-					if (result < 0 || result >= array_size) {
-						result = INVALID;
-					}
-				}
-				return result;
-			};
+		OBJChunk & chunk = chunks.emplace_back();
+		chunk.data = StringView { chunk_start, chunk_end };
 
-			int index_v = get_index(int(obj.positions .size()), v);
-			int index_t = get_index(int(obj.tex_coords.size()), t);
-			int index_n = get_index(int(obj.normals   .size()), n);
+		chunk_start = chunk_end;
+	}
 
-			if (index_v != INVALID) {
-				positions[i] = obj.positions[index_v];
-			}
-			if (index_t != INVALID) {
-				tex_coords[i] = obj.tex_coords[index_t];
-				tex_coords[i].y = 1.0f - tex_coords[i].y; // Flip uv along v
-			}
-			if (index_n != INVALID) {
-				normals[i] = obj.normals[index_n];
-			}
+	// Count lines per chunk, so that errors report the right line. The count also serves as a capacity hint
+	ThreadPool::parallel_for(int(chunks.size()), [&chunks](int c) {
+		const char * cur = chunks[c].data.start;
+		const char * end = chunks[c].data.end;
+
+		int line_count = 0;
+		while ((cur = reinterpret_cast<const char *>(memchr(cur, '\n', end - cur)))) {
+			line_count++;
+			cur++;
 		}
+		chunks[c].line_count = line_count;
+	});
+
+	int line = 1;
+	for (size_t c = 0; c < chunks.size(); c++) {
+		chunks[c].first_line = line;
+		line += chunks[c].line_count;
+	}
 
-		triangles[f] = Triangle(
-			positions[0],
-			positions[1],
-			positions[2],
-			normals[0],
-			normals[1],
-			normals[2],
-			tex_coords[0],
-			tex_coords[1],
-			tex_coords[2]
-		);
+	ThreadPool::parallel_for(int(chunks.size()), [&chunks, &filename](int c) {
+		parse_obj_chunk(chunks[c], filename.view());
+	});
+
+	// Prefix sum the element counts of the chunks, these are the offsets of the chunks in the final Arrays
+	struct ChunkOffsets {
+		size_t positions;
+		size_t tex_coords;
+		size_t normals;
+		size_t faces;
+	};
+	Array<ChunkOffsets> offsets(chunks.size() + 1, task_allocator);
+
+	for (size_t c = 0; c < chunks.size(); c++) {
+		offsets[c + 1].positions  = offsets[c].positions  + chunks[c].obj.positions .size();
+		offsets[c + 1].tex_coords = offsets[c].tex_coords + chunks[c].obj.tex_coords.size();
+		offsets[c + 1].normals    = offsets[c].normals    + chunks[c].obj.normals   .size();
+		offsets[c + 1].faces      = offsets[c].faces      + chunks[c].obj.faces     .size();
 	}
 
+	const ChunkOffsets & totals = offsets[chunks.size()];
+
+	OBJFile obj = OBJFile(allocator);
+	obj.positions .resize(totals.positions);
+	obj.tex_coords.resize(totals.tex_coords);
+	obj.normals   .resize(totals.normals);
+	obj.faces     .resize(totals.faces);
+
+	// Concatenate the chunks, making all indices absolute
+	ThreadPool::parallel_for(int(chunks.size()), [&](int c) {
+		const OBJFile      & chunk_obj    = chunks[c].obj;
+		const ChunkOffsets & chunk_offset = offsets[c];
+
+		int bias = int(chunks[c].data.size());
+
+		if (chunk_obj.positions .size() > 0) memcpy(obj.positions .data() + chunk_offset.positions,  chunk_obj.positions .data(), chunk_obj.positions .size() * sizeof(Vector3));
+		if (chunk_obj.tex_coords.size() > 0) memcpy(obj.tex_coords.data() + chunk_offset.tex_coords, chunk_obj.tex_coords.data(), chunk_obj.tex_coords.size() * sizeof(Vector2));
+		if (chunk_obj.normals   .size() > 0) memcpy(obj.normals   .data() + chunk_offset.normals,    chunk_obj.normals   .data(), chunk_obj.normals   .size() * sizeof(Vector3));
+
+		for (size_t f = 0; f < chunk_obj.faces.size(); f++) {
+			Face face = chunk_obj.faces[f];
+
+			for (int i = 0; i < 3; i++) {
+				face.indices[i].v = fixup_index(face.indices[i].v, int(chunk_offset.positions),  bias);
+				face.indices[i].t = fixup_index(face.indices[i].t, int(chunk_offset.tex_coords), bias);
+				face.indices[i].n = fixup_index(face.indices[i].n, int(chunk_offset.normals),    bias);
+			}
+
+			obj.faces[chunk_offset.faces + f] = face;
+		}
+	});
+
+	return obj;
+}
+
+Array<Triangle> OBJLoader::load(const String & filename, Allocator * allocator) {
+	OBJFile obj = parse_obj(filename, allocator);
+
+	Array<Triangle> triangles(LargePageAllocator::select(nullptr));
+	triangles.resize(obj.faces.size());
+
+	ThreadPool::parallel_for(0, int(obj.faces.size()), OBJ_FACES_PER_JOB, [&obj, &triangles](int first, int last) {
+		for (int f = first; f < last; f++) {
+			const Face & face = obj.faces[f];
+
+			Vector3 positions [3] = { };
+			Vector2 tex_coords[3] = { };
+			Vector3 normals   [3] = { };
+
+			for (int i = 0; i < 3; i++) {
+				int v = face.indices[i].v;
+				int t = face.indices[i].t;
+				int n = face.indices[i].n;
+
+				auto get_index = [](int array_size, int index) {
+					int result = INVALID;
+					if (array_size != 0) {
+						if (index > 0) {
+							result = index - 1; // Negative indices were already made absolute by parse_obj
+						}
+
+						// Check if the index is valid given the Array size
+						if (result < 0 || result >= array_size) {
+							result = INVALID;
+						}
+					}
+					return result;
+				};
+
+				int index_v = get_index(int(obj.positions .size()), v);
+				int index_t = get_index(int(obj.tex_coords.size()), t);
+				int index_n = get_index(int(obj.normals   .size()), n);
+
+				if (index_v != INVALID) {
+					positions[i] = obj.positions[index_v];
+				}
+				if (index_t != INVALID) {
+					tex_coords[i] = obj.tex_coords[index_t];
+					tex_coords[i].y = 1.0f - tex_coords[i].y; // Flip uv along v
+				}
+				if (index_n != INVALID) {
+					normals[i] = obj.normals[index_n];
+				}
+			}
+
+			triangles[f] = Triangle(
+				positions[0],
+				positions[1],
+				positions[2],
+				normals[0],
+				normals[1],
+				normals[2],
+				tex_coords[0],
+				tex_coords[1],
+				tex_coords[2]
+			);
+		}
+	});
+
 	IO::print("Loaded OBJ '{}' from disk ({} triangles)\n"_sv, filename, triangles.size());
 
 	return triangles;
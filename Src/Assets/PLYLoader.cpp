@@ -3,6 +3,12 @@
 #include "Core/Array.h"
 #include "Core/Parser.h"
 #include "Core/StringView.h"
+#include "Core/Allocators/LargePageAllocator.h"
+
+#include "Util/ThreadPool.h"
+
+// Number of faces per job in the binary fast path
+static constexpr int PLY_FACES_PER_JOB = 64 * 1024;
 
 enum struct PLYFormat {
 	ASCII,
@@ -148,114 +154,158 @@ static T parse_property_value(Parser & parser, Property::Type::Kind kind, PLYFor
 	}
 }
 
-Array<Triangle> PLYLoader::load(const String & filename, Allocator * allocator) {
-	String file = IO::file_read(filename, allocator);
+// Reads an optional float vertex attribute straight from the file data
+static float load_vertex_float(const char * vertex, int offset) {
+	float value = 0.0f;
+	if (offset != INVALID) {
+		memcpy(&value, vertex + offset, sizeof(float)); // NOTE: Assumes machine is little endian!
+	}
+	return value;
+}
 
-	Parser parser(file.view(), filename.view());
+// Fast path for the most common binary layout: a vertex element with only float properties, followed by a face element
+// with only a vertex index list of uchar sizes and (u)int indices. The vertex data is used directly from the file
+// and the faces are expanded into Triangles in parallel. Returns false if the layout does not match
+static bool try_load_binary_little_endian(Parser & parser, const Array<Element> & elements, Array<Triangle> & triangles) {
+	if (elements.size() != 2) return false;
 
-	parser.expect("ply");
-	parser.skip_whitespace();
-	parser.parse_newline();
-	parser.expect("format");
-	parser.skip_whitespace();
+	const Element & vertices = elements[0];
+	const Element & faces    = elements[1];
 
-	PLYFormat format;
+	if (vertices.type.kind != Element::Type::Kind::VERTEX || faces.type.kind != Element::Type::Kind::FACE) return false;
 
-	if (parser.match("ascii")) {
-		format = PLYFormat::ASCII;
-	} else if (parser.match("binary_little_endian")) {
-		format = PLYFormat::BINARY_LITTLE_ENDIAN;
-	} else if (parser.match("binary_big_endian")) {
-		format = PLYFormat::BINARY_BIG_ENDIAN;
-	} else {
-		ERROR(parser.location, "Invalid PLY format!\n");
+	// Byte offset of x, y, z, nx, ny, nz, u, v within a vertex
+	int offsets[int(Property::Kind::IGNORED)];
+	for (int i = 0; i < Util::array_count(offsets); i++) {
+		offsets[i] = INVALID;
 	}
-	parser.skip_whitespace();
 
-	int version_major = parser.parse_int();
-	parser.expect('.');
-	int version_minor = parser.parse_int();
-	parser.skip_whitespace_or_newline();
+	int vertex_stride = 0;
 
-	if (version_major != 1 || version_minor != 0) {
-		WARNING(parser.location, "PLY format version is not 1.0!\n");
+	for (int p = 0; p < vertices.property_count; p++) {
+		const Property & property = vertices.properties[p];
+
+		if (property.type.kind != Property::Type::Kind::FLOAT32 || property.kind == Property::Kind::VERTEX_INDEX) return false;
+
+		if (property.kind != Property::Kind::IGNORED) {
+			offsets[int(property.kind)] = vertex_stride;
+		}
+		vertex_stride += sizeof(float);
 	}
 
-	Array<Element> elements;
+	if (faces.property_count != 1) return false;
 
-	while (!parser.match("end_header")) {
-		if (parser.match("comment")) {
-			while (!is_newline(*parser.cur)) parser.advance();
-		} else if (parser.match("element")) {
-			parser.skip_whitespace();
+	const Property & index_property = faces.properties[0];
 
-			Element element = { };
+	if (index_property.kind != Property::Kind::VERTEX_INDEX || index_property.type.kind != Property::Type::Kind::LIST) return false;
+	if (index_property.type.list.size_type_kind != Property::Type::Kind::UINT8) return false;
+	if (index_property.type.list.list_type_kind != Property::Type::Kind::INT32 && index_property.type.list.list_type_kind != Property::Type::Kind::UINT32) return false;
 
-			if (parser.match("vertex ")) {
-				element.type.kind = Element::Type::Kind::VERTEX;
-			} else if (parser.match("face ")) {
-				element.type.kind = Element::Type::Kind::FACE;
-			} else {
-				StringView element_name = parser.parse_identifier();
-				ERROR(parser.location, "Unsupported element type '{}'!\n", element_name);
-			}
-			parser.skip_whitespace();
+	const char * vertex_data = parser.cur;
+	const char * face_data   = vertex_data + size_t(vertices.count) * size_t(vertex_stride);
 
-			element.count = parser.parse_int();
-			elements.push_back(element);
-		} else if (parser.match("property")) {
-			parser.skip_whitespace();
+	if (face_data > parser.end) {
+		ERROR(parser.location, "Unexpected end of file!\n");
+	}
 
-			if (elements.size() == 0) {
-				ERROR(parser.location, "Property defined without element!\n");
-			}
-			Element & element = elements.back();
+	// Faces have a variable size, find where every job starts reading and writing with a quick serial scan over the list sizes
+	struct FaceJob {
+		const char * data;
+		size_t       first_triangle;
+	};
+	int job_count = (faces.count + PLY_FACES_PER_JOB - 1) / PLY_FACES_PER_JOB;
 
-			if (element.property_count == Element::MAX_PROPERTIES) {
-				ERROR(parser.location, "Maximum number of properties ({}) exceeded!\n", Element::MAX_PROPERTIES);
-			}
-			Property & property = element.properties[element.property_count++];
+	Array<FaceJob> jobs(job_count);
 
-			property.type = parse_property_type(parser);
+	const char * cur = face_data;
+	size_t triangle_count = 0;
 
-			StringView name = parser.parse_identifier();
-			if (name == "x") {
-				property.kind = Property::Kind::X;
-			} else if (name == "y") {
-				property.kind = Property::Kind::Y;
-			} else if (name == "z") {
-				property.kind = Property::Kind::Z;
-			} else if (name == "nx") {
-				property.kind = Property::Kind::NX;
-			} else if (name == "ny") {
-				property.kind = Property::Kind::NY;
-			} else if (name == "nz") {
-				property.kind = Property::Kind::NZ;
-			} else if (name == "u" || name == "s") {
-				property.kind = Property::Kind::U;
-			} else if (name == "v" || name == "t") {
-				property.kind = Property::Kind::V;
-			} else if (name == "vertex_index" || name == "vertex_indices") {
-				property.kind = Property::Kind::VERTEX_INDEX;
-			} else {
-				property.kind = Property::Kind::IGNORED;
-				WARNING(parser.location, "Ignoring unsupported property '{}'!\n", name);
-			}
+	for (int f = 0; f < faces.count; f++) {
+		if (f % PLY_FACES_PER_JOB == 0) {
+			jobs[f / PLY_FACES_PER_JOB] = { cur, triangle_count };
 		}
 
-		parser.skip_whitespace();
-		parser.parse_newline();
+		if (cur >= parser.end) {
+			ERROR(parser.location, "Unexpected end of file!\n");
+		}
+
+		uint8_t size = uint8_t(*cur);
+		if (size <= 2) {
+			ERROR(parser.location, "A Triangle needs at least 3 indices!\n");
+		}
+
+		cur += 1 + size * sizeof(uint32_t);
+		triangle_count += size - 2;
 	}
 
-	parser.skip_whitespace();
-	parser.parse_newline();
+	if (cur > parser.end) {
+		ERROR(parser.location, "Unexpected end of file!\n");
+	}
+	parser.cur = cur;
+
+	triangles.resize(triangle_count);
+
+	int vertex_count = vertices.count;
+
+	ThreadPool::parallel_for(job_count, [&](int j) {
+		const char * cur = jobs[j].data;
+		Triangle   * dst = triangles.data() + jobs[j].first_triangle;
+
+		int face_first = j * PLY_FACES_PER_JOB;
+		int face_last  = Math::min(face_first + PLY_FACES_PER_JOB, faces.count);
 
+		auto load_vertex = [&](Vector3 & position, Vector3 & normal, Vector2 & tex_coord) {
+			uint32_t index;
+			memcpy(&index, cur, sizeof(uint32_t));
+			cur += sizeof(uint32_t);
+
+			if (index >= uint32_t(vertex_count)) {
+				ERROR(parser.location, "Vertex index {} out of bounds!\n", index);
+			}
+
+			const char * vertex = vertex_data + size_t(index) * size_t(vertex_stride);
+
+			position  = Vector3(load_vertex_float(vertex, offsets[0]), load_vertex_float(vertex, offsets[1]), load_vertex_float(vertex, offsets[2]));
+			normal    = Vector3(load_vertex_float(vertex, offsets[3]), load_vertex_float(vertex, offsets[4]), load_vertex_float(vertex, offsets[5]));
+			tex_coord = Vector2(load_vertex_float(vertex, offsets[6]), 1.0f - load_vertex_float(vertex, offsets[7]));
+		};
+
+		for (int f = face_first; f < face_last; f++) {
+			uint8_t size = uint8_t(*cur);
+			cur++;
+
+			Vector3 pos[3];
+			Vector3 nor[3];
+			Vector2 tex[3];
+
+			load_vertex(pos[0], nor[0], tex[0]);
+			load_vertex(pos[1], nor[1], tex[1]);
+
+			for (int i = 2; i < size; i++) {
+				load_vertex(pos[2], nor[2], tex[2]);
+
+				*dst++ = Triangle(
+					pos[0], pos[1], pos[2],
+					nor[0], nor[1], nor[2],
+					tex[0], tex[1], tex[2]
+				);
+
+				pos[1] = pos[2];
+				tex[1] = tex[2];
+				nor[1] = nor[2];
+			}
+		}
+	});
+
+	return true;
+}
+
+// Generic path, supports any layout and format
+static void load_elements(Parser & parser, const Array<Element> & elements, PLYFormat format, Array<Triangle> & triangles) {
 	Array<Vector3> positions;
 	Array<Vector2> tex_coords;
 	Array<Vector3> normals;
 
-	Array<Triangle> triangles;
-
 	for (int e = 0; e < elements.size(); e++) {
 		const Element & element = elements[e];
 
@@ -335,6 +385,116 @@ Array<Triangle> PLYLoader::load(const String & filename, Allocator * allocator)
 			default: ASSERT_UNREACHABLE();
 		}
 	}
+}
+
+Array<Triangle> PLYLoader::load(const String & filename, Allocator * allocator) {
+	IO::MappedFile file = IO::file_map(filename);
+
+	Parser parser(file.view(), filename.view());
+
+	parser.expect("ply");
+	parser.skip_whitespace();
+	parser.parse_newline();
+	parser.expect("format");
+	parser.skip_whitespace();
+
+	PLYFormat format;
+
+	if (parser.match("ascii")) {
+		format = PLYFormat::ASCII;
+	} else if (parser.match("binary_little_endian")) {
+		format = PLYFormat::BINARY_LITTLE_ENDIAN;
+	} else if (parser.match("binary_big_endian")) {
+		format = PLYFormat::BINARY_BIG_ENDIAN;
+	} else {
+		ERROR(parser.location, "Invalid PLY format!\n");
+	}
+	parser.skip_whitespace();
+
+	int version_major = parser.parse_int();
+	parser.expect('.');
+	int version_minor = parser.parse_int();
+	parser.skip_whitespace_or_newline();
+
+	if (version_major != 1 || version_minor != 0) {
+		WARNING(parser.location, "PLY format version is not 1.0!\n");
+	}
+
+	Array<Element> elements;
+
+	while (!parser.match("end_header")) {
+		if (parser.match("comment")) {
+			while (!is_newline(*parser.cur)) parser.advance();
+		} else if (parser.match("element")) {
+			parser.skip_whitespace();
+
+			Element element = { };
+
+			if (parser.match("vertex ")) {
+				element.type.kind = Element::Type::Kind::VERTEX;
+			} else if (parser.match("face ")) {
+				element.type.kind = Element::Type::Kind::FACE;
+			} else {
+				StringView element_name = parser.parse_identifier();
+				ERROR(parser.location, "Unsupported element type '{}'!\n", element_name);
+			}
+			parser.skip_whitespace();
+
+			element.count = parser.parse_int();
+			elements.push_back(element);
+		} else if (parser.match("property")) {
+			parser.skip_whitespace();
+
+			if (elements.size() == 0) {
+				ERROR(parser.location, "Property defined without element!\n");
+			}
+			Element & element = elements.back();
+
+			if (element.property_count == Element::MAX_PROPERTIES) {
+				ERROR(parser.location, "Maximum number of properties ({}) exceeded!\n", Element::MAX_PROPERTIES);
+			}
+			Property & property = element.properties[element.property_count++];
+
+			property.type = parse_property_type(parser);
+
+			StringView name = parser.parse_identifier();
+			if (name == "x") {
+				property.kind = Property::Kind::X;
+			} else if (name == "y") {
+				property.kind = Property::Kind::Y;
+			} else if (name == "z") {
+				property.kind = Property::Kind::Z;
+			} else if (name == "nx") {
+				property.kind = Property::Kind::NX;
+			} else if (name == "ny") {
+				property.kind = Property::Kind::NY;
+			} else if (name == "nz") {
+				property.kind = Property::Kind::NZ;
+			} else if (name == "u" || name == "s") {
+				property.kind = Property::Kind::U;
+			} else if (name == "v" || name == "t") {
+				property.kind = Property::Kind::V;
+			} else if (name == "vertex_index" || name == "vertex_indices") {
+				property.kind = Property::Kind::VERTEX_INDEX;
+			} else {
+				property.kind = Property::Kind::IGNORED;
+				WARNING(parser.location, "Ignoring unsupported property '{}'!\n", name);
+			}
+		}
+
+		parser.skip_whitespace();
+		parser.parse_newline();
+	}
+
+	parser.skip_whitespace();
+	parser.parse_newline();
+
+	Array<Triangle> triangles(LargePageAllocator::select(nullptr));
+
+	bool loaded = format == PLYFormat::BINARY_LITTLE_ENDIAN && try_load_binary_little_endian(parser, elements, triangles);
+	if (!loaded) {
+		load_elements(parser, elements, format, triangles);
+	}
 
 	parser.match('\r');
 	parser.match('\n');
@@ -0,0 +1,553 @@
+#include "SceneSnapshot.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "Config.h"
+
+#include "Core/IO.h"
+
+#include "Renderer/Scene.h"
+
+#include "Util/Util.h"
+#include "Util/StringUtil.h"
+
+String SceneSnapshot::get_snapshot_filename(StringView filename, Allocator * allocator) {
+	return Util::combine_stringviews(filename, StringView::from_c_str(SNAPSHOT_FILE_EXTENSION), allocator);
+}
+
+struct SceneSnapshotFileHeader {
+	char filetype_identifier[4];
+	int  filetype_version;
+
+	// Store settings with which the BVHs were created
+	char  bvh_type;
+	char  bvh_builder;
+	bool  bvh_is_optimized;
+	float sah_cost_node;
+	float sah_cost_leaf;
+	float sbvh_alpha;
+	float bvh_presplit_budget;
+
+	// Store settings with which the Textures were created
+	char mipmap_filter;
+	bool enable_mipmapping;
+	bool enable_block_compression;
+	char block_compression_quality;
+	char block_compression_format;
+	bool enable_gpu_mipmapping;
+
+	int    num_scene_filenames; // Stored directly after the header
+	size_t file_size;
+};
+
+static void snapshot_header_init(SceneSnapshotFileHeader & header) {
+	memcpy(header.filetype_identifier, "SNAP", 4);
+	header.filetype_version = SceneSnapshot::SNAPSHOT_FILETYPE_VERSION;
+
+	header.bvh_type            = char(cpu_config.bvh_type);
+	header.bvh_builder         = char(cpu_config.bvh_builder);
+	header.bvh_is_optimized    = cpu_config.enable_bvh_optimization;
+	header.sah_cost_node       = cpu_config.sah_cost_node;
+	header.sah_cost_leaf       = cpu_config.sah_cost_leaf;
+	header.sbvh_alpha          = cpu_config.sbvh_alpha;
+	header.bvh_presplit_budget = cpu_config.bvh_presplit_budget;
+
+	header.mipmap_filter             = char(cpu_config.mipmap_filter);
+	header.enable_mipmapping         = gpu_config.enable_mipmapping;
+	header.enable_block_compression  = cpu_config.enable_block_compression;
+	header.block_compression_quality = char(cpu_config.block_compression_quality);
+	header.block_compression_format  = char(cpu_config.block_compression_format);
+	header.enable_gpu_mipmapping     = cpu_config.enable_gpu_mipmapping;
+
+	header.num_scene_filenames = int(cpu_config.scene_filenames.size());
+}
+
+static bool snapshot_header_matches_settings(const SceneSnapshotFileHeader & header, const SceneSnapshotFileHeader & current) {
+	return
+		header.bvh_type                  == current.bvh_type &&
+		header.bvh_builder               == current.bvh_builder &&
+		header.bvh_is_optimized          == current.bvh_is_optimized &&
+		header.sah_cost_node             == current.sah_cost_node &&
+		header.sah_cost_leaf             == current.sah_cost_leaf &&
+		header.sbvh_alpha                == current.sbvh_alpha &&
+		header.bvh_presplit_budget       == current.bvh_presplit_budget &&
+		header.mipmap_filter             == current.mipmap_filter &&
+		header.enable_mipmapping         == current.enable_mipmapping &&
+		header.enable_block_compression  == current.enable_block_compression &&
+		header.block_compression_quality == current.block_compression_quality &&
+		header.block_compression_format  == current.block_compression_format &&
+		header.enable_gpu_mipmapping     == current.enable_gpu_mipmapping;
+}
+
+// Sequential reads from the mapped file, every read is bounds checked and once one fails all following reads fail as well
+struct SnapshotReader {
+	const char * cur;
+	const char * end;
+
+	bool failed = false;
+
+	bool read_bytes(void * dst, size_t num_bytes) {
+		if (failed || size_t(end - cur) < num_bytes) {
+			failed = true;
+			return false;
+		}
+		if (num_bytes > 0) {
+			memcpy(dst, cur, num_bytes);
+			cur += num_bytes;
+		}
+		return true;
+	}
+
+	template<typename T>
+	void read(T & value) {
+		read_bytes(&value, sizeof(T));
+	}
+
+	template<typename T>
+	void read_array(Array<T> & array) {
+		int size = 0;
+		read(size);
+
+		if (failed || size < 0 || size_t(end - cur) / sizeof(T) < size_t(size)) {
+			failed = true;
+			return;
+		}
+
+		array.resize(size);
+		read_bytes(array.data(), size * sizeof(T));
+	}
+
+	void read_string(String & str) {
+		int length = 0;
+		read(length);
+
+		if (failed || length < 0 || size_t(end - cur) < size_t(length)) {
+			failed = true;
+			return;
+		}
+
+		str = String(cur, length);
+		cur += length;
+	}
+};
+
+struct SnapshotWriter {
+	FILE * file;
+
+	size_t offset = 0;
+	bool   failed = false;
+
+	void write_bytes(const void * src, size_t num_bytes) {
+		if (failed || num_bytes == 0) return;
+
+		if (fwrite(src, 1, num_bytes, file) != num_bytes) {
+			failed = true;
+		}
+		offset += num_bytes;
+	}
+
+	template<typename T>
+	void write(const T & value) {
+		write_bytes(&value, sizeof(T));
+	}
+
+	template<typename T>
+	void write_array(const Array<T> & array) {
+		write(int(array.size()));
+		write_bytes(array.data(), array.size() * sizeof(T));
+	}
+
+	void write_string(const String & str) {
+		write(int(str.size()));
+		write_bytes(str.data(), str.size());
+	}
+};
+
+template<typename BVHType>
+static void snapshot_write_bvh(SnapshotWriter & writer, const BVH * bvh) {
+	writer.write_array(static_cast<const BVHType *>(bvh)->nodes);
+	writer.write_array(bvh->indices);
+}
+
+template<typename BVHType>
+static OwnPtr<BVH> snapshot_read_bvh(SnapshotReader & reader) {
+	OwnPtr<BVHType> bvh = make_owned<BVHType>();
+	reader.read_array(bvh->nodes);
+	reader.read_array(bvh->indices);
+
+	return bvh;
+}
+
+// Everything Meshes need that is not derived from their Transform
+struct SnapshotMesh {
+	String name;
+
+	Handle<MeshData> mesh_data_handle;
+	Handle<Material> material_handle;
+
+	Vector3    position;
+	Quaternion rotation;
+	float      scale;
+	Vector3    euler_angles;
+
+	unsigned visibility_mask;
+};
+
+bool SceneSnapshot::try_to_load(const String & snapshot_filename, Scene & scene) {
+	if (!IO::file_exists(snapshot_filename.view())) {
+		return false;
+	}
+
+	for (size_t i = 0; i < cpu_config.scene_filenames.size(); i++) {
+		const String & scene_filename = cpu_config.scene_filenames[i];
+
+		if (!IO::file_exists(scene_filename.view()) || IO::file_is_newer(snapshot_filename.view(), scene_filename.view())) {
+			IO::print("Scene snapshot '{}' is out of date, ignoring it.\n"_sv, snapshot_filename);
+			return false;
+		}
+	}
+
+	IO::MappedFile mapped_file;
+	if (!mapped_file.open(snapshot_filename)) {
+		IO::print("WARNING: Failed to map Scene snapshot file '{}'!\n"_sv, snapshot_filename);
+		return false;
+	}
+
+	if (mapped_file.size() < sizeof(SceneSnapshotFileHeader)) return false;
+
+	SceneSnapshotFileHeader header = { };
+	memcpy(&header, mapped_file.data(), sizeof(SceneSnapshotFileHeader));
+
+	if (memcmp(header.filetype_identifier, "SNAP", 4) != 0 || header.filetype_version != SNAPSHOT_FILETYPE_VERSION || header.file_size != mapped_file.size()) {
+		return false;
+	}
+
+	// Check if the settings used to create the snapshot are the same as the current settings
+	SceneSnapshotFileHeader current = { };
+	snapshot_header_init(current);
+
+	if (!snapshot_header_matches_settings(header, current)) {
+		IO::print("Scene snapshot '{}' was created with different settings, ignoring it.\n"_sv, snapshot_filename);
+		return false;
+	}
+
+	SnapshotReader reader = { mapped_file.data() + sizeof(SceneSnapshotFileHeader), mapped_file.data() + mapped_file.size() };
+
+	if (header.num_scene_filenames != current.num_scene_filenames) return false;
+
+	for (size_t i = 0; i < cpu_config.scene_filenames.size(); i++) {
+		String scene_filename;
+		reader.read_string(scene_filename);
+
+		if (reader.failed || scene_filename != cpu_config.scene_filenames[i]) return false;
+	}
+
+	// Everything is read into temporaries first, so that a damaged snapshot leaves the Scene untouched
+	Array<Material> materials;
+	int num_materials = 0;
+	reader.read(num_materials);
+
+	for (int i = 0; i < num_materials && !reader.failed; i++) {
+		Material & material = materials.emplace_back();
+		reader.read_string(material.name);
+		reader.read(material.type);
+		reader.read(material.emission);
+		reader.read(material.emission_texture_handle);
+		reader.read(material.diffuse);
+		reader.read(material.texture_handle);
+		reader.read(material.medium_handle);
+		reader.read(material.index_of_refraction);
+		reader.read(material.eta);
+		reader.read(material.k);
+		reader.read(material.linear_roughness);
+		reader.read(material.roughness_texture_handle);
+		reader.read(material.alpha_texture_handle);
+	}
+
+	Array<Medium> media;
+	int num_media = 0;
+	reader.read(num_media);
+
+	for (int i = 0; i < num_media && !reader.failed; i++) {
+		Medium & medium = media.emplace_back();
+		reader.read_string(medium.name);
+		reader.read(medium.grid.width);
+		reader.read(medium.grid.height);
+		reader.read(medium.grid.depth);
+		reader.read(medium.grid.bounds);
+		reader.read_array(medium.grid.density);
+		reader.read(medium.grid.majorant_width);
+		reader.read(medium.grid.majorant_height);
+		reader.read(medium.grid.majorant_depth);
+		reader.read_array(medium.grid.majorants);
+		reader.read(medium.C);
+		reader.read(medium.mfp);
+		reader.read(medium.g);
+	}
+
+	Array<Texture> textures;
+	int num_textures = 0;
+	reader.read(num_textures);
+
+	for (int i = 0; i < num_textures && !reader.failed; i++) {
+		Texture & texture = textures.emplace_back();
+		reader.read_string(texture.name);
+		reader.read_array(texture.data);
+		reader.read(texture.format);
+		reader.read(texture.channels);
+		reader.read(texture.width);
+		reader.read(texture.height);
+		reader.read_array(texture.mip_offsets);
+		reader.read(texture.mipmaps_on_gpu);
+		reader.read(texture.is_srgb);
+	}
+
+	Array<MeshData> mesh_datas;
+	int num_mesh_datas = 0;
+	reader.read(num_mesh_datas);
+
+	for (int i = 0; i < num_mesh_datas && !reader.failed; i++) {
+		MeshData & mesh_data = mesh_datas.emplace_back();
+		reader.read_array(mesh_data.triangles.vertices);
+		reader.read_array(mesh_data.triangles.indices);
+		reader.read_array(mesh_data.curves);
+		reader.read(mesh_data.aabb);
+		reader.read(mesh_data.aabb_parts);
+		reader.read(mesh_data.aabb_part_count);
+
+		switch (cpu_config.bvh_type) {
+			case BVHType::BVH:
+			case BVHType::SBVH: mesh_data.bvh = snapshot_read_bvh<BVH2>(reader); break;
+			case BVHType::BVH4: mesh_data.bvh = snapshot_read_bvh<BVH4>(reader); break;
+			case BVHType::BVH8: mesh_data.bvh = snapshot_read_bvh<BVH8>(reader); break;
+			default: ASSERT_UNREACHABLE();
+		}
+	}
+
+	Array<SnapshotMesh> meshes;
+	int num_meshes = 0;
+	reader.read(num_meshes);
+
+	for (int i = 0; i < num_meshes && !reader.failed; i++) {
+		SnapshotMesh & mesh = meshes.emplace_back();
+		reader.read_string(mesh.name);
+		reader.read(mesh.mesh_data_handle);
+		reader.read(mesh.material_handle);
+		reader.read(mesh.position);
+		reader.read(mesh.rotation);
+		reader.read(mesh.scale);
+		reader.read(mesh.euler_angles);
+		reader.read(mesh.visibility_mask);
+	}
+
+	Vector3    camera_position;
+	Quaternion camera_rotation;
+	float      camera_fov             = 0.0f;
+	float      camera_aperture_radius = 0.0f;
+	float      camera_focal_distance  = 0.0f;
+	reader.read(camera_position);
+	reader.read(camera_rotation);
+	reader.read(camera_fov);
+	reader.read(camera_aperture_radius);
+	reader.read(camera_focal_distance);
+
+	// Settings that the Mitsuba loader may have overridden
+	int    initial_width  = 0;
+	int    initial_height = 0;
+	int    num_bounces    = 0;
+	String sky_filename;
+	reader.read(initial_width);
+	reader.read(initial_height);
+	reader.read(num_bounces);
+	reader.read_string(sky_filename);
+
+	if (reader.failed || reader.cur != reader.end) {
+		IO::print("WARNING: Scene snapshot '{}' is damaged, ignoring it!\n"_sv, snapshot_filename);
+		return false;
+	}
+
+	// The default Material and Medium are part of the snapshot
+	scene.asset_manager.materials.clear();
+	scene.asset_manager.media    .clear();
+
+	for (size_t i = 0; i < materials.size(); i++) {
+		scene.asset_manager.add_material(std::move(materials[i]));
+	}
+	for (size_t i = 0; i < media.size(); i++) {
+		scene.asset_manager.add_medium(std::move(media[i]));
+	}
+	for (size_t i = 0; i < textures.size(); i++) {
+		scene.asset_manager.add_texture(std::move(textures[i]));
+	}
+	for (size_t i = 0; i < mesh_datas.size(); i++) {
+		scene.asset_manager.add_mesh_data(std::move(mesh_datas[i]));
+	}
+
+	for (size_t i = 0; i < meshes.size(); i++) {
+		SnapshotMesh & snapshot_mesh = meshes[i];
+
+		Mesh & mesh = scene.add_mesh(std::move(snapshot_mesh.name), snapshot_mesh.mesh_data_handle, snapshot_mesh.material_handle);
+		mesh.position        = snapshot_mesh.position;
+		mesh.rotation        = snapshot_mesh.rotation;
+		mesh.scale           = snapshot_mesh.scale;
+		mesh.euler_angles    = snapshot_mesh.euler_angles;
+		mesh.visibility_mask = snapshot_mesh.visibility_mask;
+	}
+
+	scene.camera.position        = camera_position;
+	scene.camera.rotation        = camera_rotation;
+	scene.camera.aperture_radius = camera_aperture_radius;
+	scene.camera.focal_distance  = camera_focal_distance;
+	scene.camera.set_fov(camera_fov);
+
+	cpu_config.initial_width  = initial_width;
+	cpu_config.initial_height = initial_height;
+	cpu_config.sky_filename   = std::move(sky_filename);
+	gpu_config.num_bounces    = num_bounces;
+
+	scene.camera.resize(cpu_config.initial_width, cpu_config.initial_height);
+
+	IO::print("Loaded Scene snapshot '{}' from disk\n"_sv, snapshot_filename);
+	return true;
+}
+
+bool SceneSnapshot::save(const String & snapshot_filename, const Scene & scene) {
+	const AssetManager & asset_manager = scene.asset_manager;
+	ASSERT(asset_manager.is_loaded());
+
+	FILE * file = nullptr;
+	errno_t err;
+#ifdef _WIN32
+	err = fopen_s(&file, snapshot_filename.data(), "wb");
+#else
+	file = fopen(snapshot_filename.data(), "wb");
+	err = errno;
+#endif
+
+	if (!file) {
+		IO::print("WARNING: Failed to open Scene snapshot file '{}' for writing! ({})\n"_sv, snapshot_filename, IO::get_error_message(err));
+		return false;
+	}
+
+	// The file size is only known at the end, the header is written again once everything else has been written
+	SceneSnapshotFileHeader header = { };
+	snapshot_header_init(header);
+
+	SnapshotWriter writer = { file };
+	writer.write(header);
+
+	for (size_t i = 0; i < cpu_config.scene_filenames.size(); i++) {
+		writer.write_string(cpu_config.scene_filenames[i]);
+	}
+
+	writer.write(int(asset_manager.materials.size()));
+	for (size_t i = 0; i < asset_manager.materials.size(); i++) {
+		const Material & material = asset_manager.materials[i];
+		writer.write_string(material.name);
+		writer.write(material.type);
+		writer.write(material.emission);
+		writer.write(material.emission_texture_handle);
+		writer.write(material.diffuse);
+		writer.write(material.texture_handle);
+		writer.write(material.medium_handle);
+		writer.write(material.index_of_refraction);
+		writer.write(material.eta);
+		writer.write(material.k);
+		writer.write(material.linear_roughness);
+		writer.write(material.roughness_texture_handle);
+		writer.write(material.alpha_texture_handle);
+	}
+
+	writer.write(int(asset_manager.media.size()));
+	for (size_t i = 0; i < asset_manager.media.size(); i++) {
+		const Medium & medium = asset_manager.media[i];
+		writer.write_string(medium.name);
+		writer.write(medium.grid.width);
+		writer.write(medium.grid.height);
+		writer.write(medium.grid.depth);
+		writer.write(medium.grid.bounds);
+		writer.write_array(medium.grid.density);
+		writer.write(medium.grid.majorant_width);
+		writer.write(medium.grid.majorant_height);
+		writer.write(medium.grid.majorant_depth);
+		writer.write_array(medium.grid.majorants);
+		writer.write(medium.C);
+		writer.write(medium.mfp);
+		writer.write(medium.g);
+	}
+
+	writer.write(int(asset_manager.textures.size()));
+	for (size_t i = 0; i < asset_manager.textures.size(); i++) {
+		const Texture & texture = asset_manager.textures[i];
+		writer.write_string(texture.name);
+		if (texture.is_mapped()) {
+			// The snapshot stores the data itself, so that it does not depend on the DDS file
+			IO::MappedFile mapping = IO::file_map(texture.mapped_filename);
+			writer.write(int(texture.mapped_size));
+			writer.write_bytes(mapping.data() + texture.mapped_offset, texture.mapped_size);
+		} else {
+			writer.write_array(texture.data);
+		}
+		writer.write(texture.format);
+		writer.write(texture.channels);
+		writer.write(texture.width);
+		writer.write(texture.height);
+		writer.write_array(texture.mip_offsets);
+		writer.write(texture.mipmaps_on_gpu);
+		writer.write(texture.is_srgb);
+	}
+
+	writer.write(int(asset_manager.mesh_datas.size()));
+	for (size_t i = 0; i < asset_manager.mesh_datas.size(); i++) {
+		const MeshData & mesh_data = asset_manager.mesh_datas[i];
+		writer.write_array(mesh_data.triangles.vertices);
+		writer.write_array(mesh_data.triangles.indices);
+		writer.write_array(mesh_data.curves);
+		writer.write(mesh_data.aabb);
+		writer.write(mesh_data.aabb_parts);
+		writer.write(mesh_data.aabb_part_count);
+
+		switch (cpu_config.bvh_type) {
+			case BVHType::BVH:
+			case BVHType::SBVH: snapshot_write_bvh<BVH2>(writer, mesh_data.bvh.get()); break;
+			case BVHType::BVH4: snapshot_write_bvh<BVH4>(writer, mesh_data.bvh.get()); break;
+			case BVHType::BVH8: snapshot_write_bvh<BVH8>(writer, mesh_data.bvh.get()); break;
+			default: ASSERT_UNREACHABLE();
+		}
+	}
+
+	writer.write(int(scene.meshes.size()));
+	for (size_t i = 0; i < scene.meshes.size(); i++) {
+		const Mesh & mesh = scene.meshes[i];
+		writer.write_string(mesh.name);
+		writer.write(mesh.mesh_data_handle);
+		writer.write(mesh.material_handle);
+		writer.write(mesh.position);
+		writer.write(mesh.rotation);
+		writer.write(mesh.scale);
+		writer.write(mesh.euler_angles);
+		writer.write(mesh.visibility_mask);
+	}
+
+	writer.write(scene.camera.position);
+	writer.write(scene.camera.rotation);
+	writer.write(scene.camera.fov);
+	writer.write(scene.camera.aperture_radius);
+	writer.write(scene.camera.focal_distance);
+
+	writer.write(cpu_config.initial_width);
+	writer.write(cpu_config.initial_height);
+	writer.write(gpu_config.num_bounces);
+	writer.write_string(cpu_config.sky_filename);
+
+	header.file_size = writer.offset;
+
+	bool success = !writer.failed && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+	if (!success) {
+		IO::print("WARNING: Failed to write Scene snapshot file '{}'!\n"_sv, snapshot_filename);
+	}
+
+	fclose(file);
+	return success;
+}
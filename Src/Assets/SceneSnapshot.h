@@ -0,0 +1,21 @@
+#pragma once
+#include "Core/String.h"
+#include "Core/StringView.h"
+
+struct Scene;
+
+// Binary snapshot of a fully loaded Scene: Materials, Media, decoded Textures, MeshData with their final BVH, Meshes and the Camera
+// Loading it skips parsing the scene files, decoding Textures and building or converting BVHs, the assets go straight to GPU upload
+// The snapshot is only valid for the scene files it was created from and is rejected if any of them is newer
+namespace SceneSnapshot {
+	inline constexpr const char * SNAPSHOT_FILE_EXTENSION   = ".snapshot";
+	inline constexpr int          SNAPSHOT_FILETYPE_VERSION = 7;
+
+	String get_snapshot_filename(StringView filename, Allocator * allocator);
+
+	// The Scene is only modified if the snapshot is valid and was read successfully
+	bool try_to_load(const String & snapshot_filename, Scene & scene);
+
+	// Requires all assets of the Scene to be loaded
+	bool save(const String & snapshot_filename, const Scene & scene);
+}
@@ -11,14 +11,24 @@
 #include "Config.h"
 
 #include "Core/Parser.h"
-#include "Core/Allocators/StackAllocator.h"
+
+#include "Assets/JPEGDecoder.h"
 
 #include "Math/Mipmap.h"
+#include "Math/BlockCompression.h"
 #include "Util/Util.h"
+#include "Util/StringUtil.h"
+#include "Util/Profiler.h"
+#include "Util/ThreadPool.h"
+
+static constexpr int BLOCK_COMPRESSION_BLOCKS_PER_JOB = 1024;
+
+String TextureLoader::get_texture_cache_filename(StringView filename, Allocator * allocator) {
+	return Util::combine_stringviews(filename, StringView::from_c_str(TEXTURE_CACHE_FILE_EXTENSION), allocator);
+}
 
 bool TextureLoader::load_dds(const String & filename, Texture * texture) {
-	StackAllocator<KILOBYTES(8)> allocator;
-	String file = IO::file_read(filename, &allocator);
+	IO::MappedFile file = IO::file_map(filename);
 	Parser parser(file.view(), filename.view());
 
 	// Based on: https://docs.microsoft.com/en-us/windows/win32/direct3ddds/dds-header
@@ -58,32 +68,58 @@ bool TextureLoader::load_dds(const String & filename, Texture * texture) {
 	texture->width  = Math::divide_round_up(header.width,  4u);
 	texture->height = Math::divide_round_up(header.height, 4u);
 
-	if (memcmp(header.spf.four_cc, "DXT", 3) != 0) return false;
-
 	// Get format
-	switch (header.spf.four_cc[3]) {
-		case '1': { // DXT1
-			texture->format = Texture::Format::BC1;
-			texture->channels = 2;
-			break;
-		}
-		case '3': { // DXT3
-			texture->format = Texture::Format::BC2;
-			texture->channels = 4;
-			break;
-		}
-		case '5': { // DXT5
-			texture->format = Texture::Format::BC3;
-			texture->channels = 4;
-			break;
+	if (memcmp(header.spf.four_cc, "DXT1", 4) == 0) {
+		texture->format = Texture::Format::BC1;
+	} else if (memcmp(header.spf.four_cc, "DXT3", 4) == 0) {
+		texture->format = Texture::Format::BC2;
+	} else if (memcmp(header.spf.four_cc, "DXT5", 4) == 0) {
+		texture->format = Texture::Format::BC3;
+	} else if (memcmp(header.spf.four_cc, "ATI1", 4) == 0 || memcmp(header.spf.four_cc, "BC4U", 4) == 0) {
+		texture->format = Texture::Format::BC4;
+	} else if (memcmp(header.spf.four_cc, "ATI2", 4) == 0 || memcmp(header.spf.four_cc, "BC5U", 4) == 0) {
+		texture->format = Texture::Format::BC5;
+	} else if (memcmp(header.spf.four_cc, "DX10", 4) == 0) {
+		// Based on: https://docs.microsoft.com/en-us/windows/win32/direct3ddds/dds-header-dxt10
+		struct DDSHeaderDX10 {
+			unsigned dxgi_format;
+			unsigned resource_dimension;
+			unsigned misc_flag;
+			unsigned array_size;
+			unsigned misc_flags_2;
+		};
+		static_assert(sizeof(DDSHeaderDX10) == 20);
+
+		DDSHeaderDX10 header_dx10 = parser.parse_binary<DDSHeaderDX10>();
+
+		// Values of DXGI_FORMAT, the sRGB variants are decoded the same way unless cpu_config.enable_srgb_textures is set
+		switch (header_dx10.dxgi_format) {
+			case 71: case 72: texture->format = Texture::Format::BC1;  break;
+			case 74: case 75: texture->format = Texture::Format::BC2;  break;
+			case 77: case 78: texture->format = Texture::Format::BC3;  break;
+			case 80:          texture->format = Texture::Format::BC4;  break;
+			case 83:          texture->format = Texture::Format::BC5;  break;
+			case 95:          texture->format = Texture::Format::BC6H; break;
+			case 98: case 99: texture->format = Texture::Format::BC7;  break;
+			default: return false;
 		}
-		default: return false;
+
+		bool format_is_srgb = header_dx10.dxgi_format == 72 || header_dx10.dxgi_format == 75 || header_dx10.dxgi_format == 78 || header_dx10.dxgi_format == 99;
+		texture->is_srgb = cpu_config.enable_srgb_textures && format_is_srgb;
+	} else {
+		return false;
 	}
 
-	size_t data_size = file.size() - sizeof(header);
+	bool has_8_byte_blocks = texture->format == Texture::Format::BC1 || texture->format == Texture::Format::BC4;
+	texture->channels = has_8_byte_blocks ? 2 : 4;
+
+	size_t data_offset = parser.cur - file.data();
+	size_t data_size   = file.size() - data_offset;
 
-	texture->data.resize(data_size);
-	parser.copy_into(texture->data.data(), data_size);
+	// The data stays in the file, it is mapped again when the Texture is uploaded
+	texture->mapped_filename = filename;
+	texture->mapped_offset   = data_offset;
+	texture->mapped_size     = data_size;
 
 	int block_size = texture->channels * 4;
 
@@ -126,87 +162,233 @@ static void mip_count(int width, int height, int & mip_levels, int & pixel_count
 	}
 }
 
+// Decoding through a table is much cheaper than Math::gamma_to_linear, encoding searches the linear values halfway between consecutive codes
+struct SRGBTable {
+	float to_linear [256];
+	float thresholds[255];
+
+	SRGBTable() {
+		for (int i = 0; i < 256; i++) {
+			to_linear[i] = Math::gamma_to_linear(float(i) / 255.0f);
+		}
+		for (int i = 0; i < 255; i++) {
+			thresholds[i] = 0.5f * (to_linear[i] + to_linear[i + 1]);
+		}
+	}
+
+	unsigned char encode(float linear) const {
+		int code = 0;
+		for (int step = 128; step > 0; step /= 2) {
+			if (code + step <= 255 && thresholds[code + step - 1] < linear) {
+				code += step;
+			}
+		}
+		return (unsigned char)code;
+	}
+};
+
+static const SRGBTable & srgb_table() {
+	static const SRGBTable table;
+	return table;
+}
+
+// Box filters a Mip level of sRGB encoded RGBA8 texels in linear space, the alpha channel is not sRGB encoded
+static void downsample_srgb(const SRGBTable & table, int width_src, int height_src, int width_dst, int height_dst, const unsigned char texture_src[], unsigned char texture_dst[]) {
+	ThreadPool::parallel_for(0, height_dst, Math::max(1, 16384 / width_dst), [&](int y_first, int y_last) {
+		for (int y = y_first; y < y_last; y++) {
+			int y_0 = y * height_src / height_dst;
+			int y_1 = Math::max(y_0 + 1, (y + 1) * height_src / height_dst);
+
+			for (int x = 0; x < width_dst; x++) {
+				int x_0 = x * width_src / width_dst;
+				int x_1 = Math::max(x_0 + 1, (x + 1) * width_src / width_dst);
+
+				float sum[4] = { };
+				for (int j = y_0; j < y_1; j++) {
+					for (int i = x_0; i < x_1; i++) {
+						const unsigned char * texel = texture_src + 4 * (i + j * width_src);
+						sum[0] += table.to_linear[texel[0]];
+						sum[1] += table.to_linear[texel[1]];
+						sum[2] += table.to_linear[texel[2]];
+						sum[3] += float(texel[3]);
+					}
+				}
+
+				float weight = 1.0f / float((x_1 - x_0) * (y_1 - y_0));
+
+				unsigned char * texel = texture_dst + 4 * (x + y * width_dst);
+				texel[0] = table.encode(sum[0] * weight);
+				texel[1] = table.encode(sum[1] * weight);
+				texel[2] = table.encode(sum[2] * weight);
+				texel[3] = (unsigned char)(sum[3] * weight + 0.5f);
+			}
+		}
+	});
+}
+
 bool TextureLoader::load_stb(const String & filename, Texture * texture) {
-	unsigned char * data = stbi_load(filename.data(), &texture->width, &texture->height, &texture->channels, STBI_rgb_alpha);
+	// JPEGs can be decoded on the GPU, stb_image remains the fallback for everything nvJPEG rejects
+	Array<unsigned char> data_gpu_decoded;
+
+	unsigned char * data = nullptr;
+
+	auto free_data = [&]() {
+		if (data != data_gpu_decoded.data()) {
+			stbi_image_free(data);
+		}
+	};
+
+	{
+		ProfileScope scope("Texture Decode"_sv, "Assets"_sv);
+
+		StringView file_extension = Util::get_file_extension(filename.view());
+		if (cpu_config.enable_gpu_jpeg_decoding && (file_extension == "jpg" || file_extension == "jpeg") && JPEGDecoder::is_available()) {
+			if (JPEGDecoder::decode(filename, data_gpu_decoded, texture->width, texture->height)) {
+				data = data_gpu_decoded.data();
+			}
+		}
+
+		if (data == nullptr) {
+			data = stbi_load(filename.data(), &texture->width, &texture->height, &texture->channels, STBI_rgb_alpha);
+		}
+	}
 
 	if (data == nullptr || texture->width == 0 || texture->height == 0) {
 		return false;
 	}
 
 	texture->channels = 4;
+	texture->is_srgb  = cpu_config.enable_srgb_textures;
+
+	bool block_compress = cpu_config.enable_block_compression && Math::is_power_of_two(texture->width) && Math::is_power_of_two(texture->height);
+
+	// Block Compressed data cannot be written by a Kernel, so those Textures are always filtered here
+	// The Kernel filters and writes linear values, so neither are sRGB Textures
+	texture->mipmaps_on_gpu = gpu_config.enable_mipmapping && cpu_config.enable_gpu_mipmapping && !block_compress && !texture->is_srgb;
 
-	int mip_levels  = 0;
-	int pixel_count = 0;
-	mip_count(texture->width, texture->height, mip_levels, pixel_count);
-
-	LinearAllocator<MEGABYTES(8)> allocator;
-	Array<Vector4> data_rgba(pixel_count, &allocator);
-
-	// Copy the data over into Mipmap level 0, and convert it to linear colour space
-	for (int i = 0; i < texture->width * texture->height; i++) {
-		data_rgba[i] = Vector4(
-			Math::gamma_to_linear(float(data[i * 4    ]) / 255.0f),
-			Math::gamma_to_linear(float(data[i * 4 + 1]) / 255.0f),
-			Math::gamma_to_linear(float(data[i * 4 + 2]) / 255.0f),
-			Math::gamma_to_linear(float(data[i * 4 + 3]) / 255.0f)
-		);
+	int mip_levels  = 1;
+	int pixel_count = texture->width * texture->height;
+	if (!texture->mipmaps_on_gpu) {
+		mip_count(texture->width, texture->height, mip_levels, pixel_count);
 	}
 
-	stbi_image_free(data);
+	Array<unsigned char> data_rgba_u8(pixel_count * 4);
 
-	texture->mip_offsets.push_back(0);
+	if (texture->is_srgb) {
+		// The texels stay sRGB encoded and are decoded when sampled, only the Mip levels are filtered in linear space
+		memcpy(data_rgba_u8.data(), data, texture->width * texture->height * 4);
+		free_data();
 
-	if (gpu_config.enable_mipmapping) {
-		int offset      = texture->width * texture->height;
-		int offset_prev = 0;
+		texture->mip_offsets.push_back(0);
 
-		int level_width_prev  = texture->width;
-		int level_height_prev = texture->height;
+		if (mip_levels > 1) {
+			ProfileScope scope("Mipmap Generation"_sv, "Assets"_sv);
 
-		int level_width  = texture->width  / 2;
-		int level_height = texture->height / 2;
+			const SRGBTable & table = srgb_table();
 
-		int level = 1;
+			int offset      = texture->width * texture->height;
+			int offset_prev = 0;
 
-		Array<Vector4> temp((texture->width / 2) * texture->height, &allocator); // Intermediate storage used when performing seperable filtering
+			int level_width_prev  = texture->width;
+			int level_height_prev = texture->height;
 
-		while (true) {
-			if (cpu_config.mipmap_filter == MipmapFilterType::BOX) {
-				// Box filter can downsample the previous Mip level
-				Mipmap::downsample(level_width_prev, level_height_prev, level_width, level_height, data_rgba.data() + offset_prev, data_rgba.data() + offset, temp.data());
-			} else {
-				// Other filters downsample the original Texture for better quality
-				Mipmap::downsample(texture->width, texture->height, level_width, level_height, data_rgba.data(), data_rgba.data() + offset, temp.data());
-			}
+			int level_width  = Math::max(texture->width  / 2, 1);
+			int level_height = Math::max(texture->height / 2, 1);
+
+			while (true) {
+				downsample_srgb(table, level_width_prev, level_height_prev, level_width, level_height, data_rgba_u8.data() + 4 * offset_prev, data_rgba_u8.data() + 4 * offset);
+
+				texture->mip_offsets.push_back(offset * sizeof(unsigned));
 
-			texture->mip_offsets.push_back(offset * sizeof(unsigned));
+				if (level_width == 1 && level_height == 1) break;
 
-			if (level_width == 1 && level_height == 1) break;
+				offset_prev = offset;
+				offset += level_width * level_height;
 
-			offset_prev = offset;
-			offset += level_width * level_height;
+				level_width_prev  = level_width;
+				level_height_prev = level_height;
 
-			level_width_prev  = level_width;
-			level_height_prev = level_height;
+				if (level_width  > 1) level_width  /= 2;
+				if (level_height > 1) level_height /= 2;
+			}
 
-			if (level_width  > 1) level_width  /= 2;
-			if (level_height > 1) level_height /= 2;
+			ASSERT(texture->mip_offsets.size() == mip_levels);
 		}
+	} else {
+		Allocator * allocator = ThreadPool::task_allocator();
+		Array<Vector4> data_rgba(pixel_count, allocator);
+
+		// Copy the data over into Mipmap level 0, and convert it to linear colour space
+		ThreadPool::parallel_for(0, texture->width * texture->height, 16384, [&](int first, int last) {
+			for (int i = first; i < last; i++) {
+				data_rgba[i] = Vector4(
+					Math::gamma_to_linear(float(data[i * 4    ]) / 255.0f),
+					Math::gamma_to_linear(float(data[i * 4 + 1]) / 255.0f),
+					Math::gamma_to_linear(float(data[i * 4 + 2]) / 255.0f),
+					Math::gamma_to_linear(float(data[i * 4 + 3]) / 255.0f)
+				);
+			}
+		});
 
-		ASSERT(texture->mip_offsets.size() == mip_levels);
-	}
+		free_data();
 
-	// Convert floating point pixels to unsigned bytes
-	Array<unsigned char> data_rgba_u8(pixel_count * 4);
-	for (int i = 0; i < pixel_count; i++) {
-		data_rgba_u8[4*i + 0] = (unsigned char)(Math::clamp(data_rgba[i].x * 255.0f, 0.0f, 255.0f));
-		data_rgba_u8[4*i + 1] = (unsigned char)(Math::clamp(data_rgba[i].y * 255.0f, 0.0f, 255.0f));
-		data_rgba_u8[4*i + 2] = (unsigned char)(Math::clamp(data_rgba[i].z * 255.0f, 0.0f, 255.0f));
-		data_rgba_u8[4*i + 3] = (unsigned char)(Math::clamp(data_rgba[i].w * 255.0f, 0.0f, 255.0f));
+		texture->mip_offsets.push_back(0);
+
+		if (gpu_config.enable_mipmapping && !texture->mipmaps_on_gpu) {
+			ProfileScope scope("Mipmap Generation"_sv, "Assets"_sv);
+
+			int offset      = texture->width * texture->height;
+			int offset_prev = 0;
+
+			int level_width_prev  = texture->width;
+			int level_height_prev = texture->height;
+
+			int level_width  = texture->width  / 2;
+			int level_height = texture->height / 2;
+
+			int level = 1;
+
+			Array<Vector4> temp((texture->width / 2) * texture->height, allocator); // Intermediate storage used when performing seperable filtering
+
+			while (true) {
+				if (cpu_config.mipmap_filter == MipmapFilterType::BOX) {
+					// Box filter can downsample the previous Mip level
+					Mipmap::downsample(level_width_prev, level_height_prev, level_width, level_height, data_rgba.data() + offset_prev, data_rgba.data() + offset, temp.data());
+				} else {
+					// Other filters downsample the original Texture for better quality
+					Mipmap::downsample(texture->width, texture->height, level_width, level_height, data_rgba.data(), data_rgba.data() + offset, temp.data());
+				}
+
+				texture->mip_offsets.push_back(offset * sizeof(unsigned));
+
+				if (level_width == 1 && level_height == 1) break;
+
+				offset_prev = offset;
+				offset += level_width * level_height;
+
+				level_width_prev  = level_width;
+				level_height_prev = level_height;
+
+				if (level_width  > 1) level_width  /= 2;
+				if (level_height > 1) level_height /= 2;
+			}
+
+			ASSERT(texture->mip_offsets.size() == mip_levels);
+		}
+
+		// Convert floating point pixels to unsigned bytes
+		ThreadPool::parallel_for(0, pixel_count, 16384, [&](int first, int last) {
+			for (int i = first; i < last; i++) {
+				data_rgba_u8[4*i + 0] = (unsigned char)(Math::clamp(data_rgba[i].x * 255.0f, 0.0f, 255.0f));
+				data_rgba_u8[4*i + 1] = (unsigned char)(Math::clamp(data_rgba[i].y * 255.0f, 0.0f, 255.0f));
+				data_rgba_u8[4*i + 2] = (unsigned char)(Math::clamp(data_rgba[i].z * 255.0f, 0.0f, 255.0f));
+				data_rgba_u8[4*i + 3] = (unsigned char)(Math::clamp(data_rgba[i].w * 255.0f, 0.0f, 255.0f));
+			}
+		});
 	}
 
-	if (cpu_config.enable_block_compression && Math::is_power_of_two(texture->width) && Math::is_power_of_two(texture->height)) {
-		// Block Compression
+	if (block_compress) {
+		ProfileScope scope("Block Compression"_sv, "Assets"_sv);
 		int new_width  = Math::divide_round_up(texture->width,  4);
 		int new_height = Math::divide_round_up(texture->height, 4);
 
@@ -217,15 +399,21 @@ bool TextureLoader::load_stb(const String & filename, Texture * texture) {
 		Array<int> new_mip_offsets;
 		new_mip_offsets.reserve(new_mip_levels);
 
-		constexpr int COMPRESSED_BLOCK_SIZE = 8;
+		bool use_bc7 = cpu_config.block_compression_format == BlockCompressionFormat::BC7;
+
+		int compressed_block_size = use_bc7 ? 16 : 8;
 
-		Array<unsigned char> compressed_data(new_pixel_count * COMPRESSED_BLOCK_SIZE);
+		Array<unsigned char> compressed_data(new_pixel_count * compressed_block_size);
 		int                  compressed_data_offset = 0;
 
+		// HIGHQUAL does an extra refinement pass over the endpoints, which is roughly twice as slow
+		bool high_quality     = cpu_config.block_compression_quality == BlockCompressionQuality::HIGH;
+		int  compression_mode = high_quality ? STB_DXT_HIGHQUAL : STB_DXT_NORMAL;
+
 		for (int l = 0; l < new_mip_levels; l++) {
 			new_mip_offsets.push_back(compressed_data_offset);
 
-			unsigned char * level_data = data_rgba_u8.data() + texture->mip_offsets[l];
+			const unsigned char * level_data = data_rgba_u8.data() + texture->mip_offsets[l];
 
 			int level_width  = Math::max(texture->width  >> l, 1);
 			int level_height = Math::max(texture->height >> l, 1);
@@ -233,43 +421,52 @@ bool TextureLoader::load_stb(const String & filename, Texture * texture) {
 			int new_level_width  = Math::max(new_width  >> l, 1);
 			int new_level_height = Math::max(new_height >> l, 1);
 
-			for (int y = 0; y < new_level_height; y++) {
-				for (int x = 0; x < new_level_width; x++) {
-					unsigned char block[4 * 4 * 4] = { };
-
-					for (int j = 0; j < 4; j++) {
-						int pixel_y = 4*y + j;
-						if (pixel_y < level_height) {
-							for (int i = 0; i < 4; i++) {
-								int pixel_x = 4*x + i;
-								if (pixel_x < level_width) {
-									int block_index = i + j * 4;
-									int pixel_index = pixel_x + pixel_y * level_width;
-
-									block[4*block_index + 0] = level_data[4*pixel_index + 0];
-									block[4*block_index + 1] = level_data[4*pixel_index + 1];
-									block[4*block_index + 2] = level_data[4*pixel_index + 2];
-									block[4*block_index + 3] = level_data[4*pixel_index + 3];
+			unsigned char * level_compressed_data = compressed_data.data() + compressed_data_offset;
+
+			// Every row of blocks is independent, small Mip levels end up in a single chunk and are compressed directly
+			int grain_size = Math::max(1, BLOCK_COMPRESSION_BLOCKS_PER_JOB / new_level_width);
+
+			ThreadPool::parallel_for(0, new_level_height, grain_size, [&](int y_first, int y_last) {
+				for (int y = y_first; y < y_last; y++) {
+					for (int x = 0; x < new_level_width; x++) {
+						unsigned char block[4 * 4 * 4] = { };
+
+						for (int j = 0; j < 4; j++) {
+							int pixel_y = 4*y + j;
+							if (pixel_y < level_height) {
+								for (int i = 0; i < 4; i++) {
+									int pixel_x = 4*x + i;
+									if (pixel_x < level_width) {
+										int block_index = i + j * 4;
+										int pixel_index = pixel_x + pixel_y * level_width;
+
+										block[4*block_index + 0] = level_data[4*pixel_index + 0];
+										block[4*block_index + 1] = level_data[4*pixel_index + 1];
+										block[4*block_index + 2] = level_data[4*pixel_index + 2];
+										block[4*block_index + 3] = level_data[4*pixel_index + 3];
+									}
 								}
 							}
 						}
-					}
 
-					unsigned char compressed_block[COMPRESSED_BLOCK_SIZE] = { };
-					stb_compress_dxt_block(compressed_block, block, false, STB_DXT_HIGHQUAL);
-
-					for (int i = 0; i < COMPRESSED_BLOCK_SIZE; i++) {
-						compressed_data[compressed_data_offset++] = compressed_block[i];
+						unsigned char * block_compressed = level_compressed_data + (x + y * new_level_width) * compressed_block_size;
+						if (use_bc7) {
+							BlockCompression::compress_bc7_block(block_compressed, block, high_quality);
+						} else {
+							stb_compress_dxt_block(block_compressed, block, false, compression_mode);
+						}
 					}
 				}
-			}
+			});
+
+			compressed_data_offset += new_level_width * new_level_height * compressed_block_size;
 		}
 
-		ASSERT(compressed_data_offset == new_pixel_count * COMPRESSED_BLOCK_SIZE);
+		ASSERT(compressed_data_offset == new_pixel_count * compressed_block_size);
 		data_rgba_u8 = std::move(compressed_data);
 
-		texture->format   = Texture::Format::BC1;
-		texture->channels = 2;
+		texture->format   = use_bc7 ? Texture::Format::BC7 : Texture::Format::BC1;
+		texture->channels = compressed_block_size / 4;
 		texture->width    = new_width;
 		texture->height   = new_height;
 
@@ -280,3 +477,143 @@ bool TextureLoader::load_stb(const String & filename, Texture * texture) {
 
 	return true;
 }
+
+struct TextureCacheFileHeader {
+	char filetype_identifier[4];
+	char filetype_version;
+
+	// Store settings with which the Texture was created
+	char mipmap_filter;
+	bool enable_mipmapping;
+	bool enable_block_compression;
+	char block_compression_quality;
+	char block_compression_format;
+	bool enable_gpu_mipmapping;
+	bool enable_srgb_textures;
+
+	char format;
+	bool mipmaps_on_gpu;
+	bool is_srgb;
+	int  channels;
+	int  width;
+	int  height;
+
+	int num_mip_levels;
+	int data_size;
+};
+
+bool TextureLoader::try_to_load_cache(const String & filename, const String & cache_filename, Texture * texture) {
+	if (!IO::file_exists(filename.view()) || !IO::file_exists(cache_filename.view()) || IO::file_is_newer(cache_filename.view(), filename.view())) {
+		return false;
+	}
+
+	ProfileScope scope("Texture Cache Load"_sv, "Assets"_sv);
+
+	FILE * file = nullptr;
+	errno_t err;
+#ifdef _WIN32
+	err = fopen_s(&file, cache_filename.data(), "rb");
+#else
+	file = fopen(cache_filename.data(), "rb");
+	err = errno;
+#endif
+
+	if (!file) {
+		IO::print("WARNING: Unable to open Texture cache file '{}'! ({})\n"_sv, cache_filename, IO::get_error_message(err));
+		return false;
+	}
+
+	bool success = false;
+
+	TextureCacheFileHeader header = { };
+	if (fread(&header, sizeof(header), 1, file) != 1) goto exit;
+
+	if (memcmp(header.filetype_identifier, "TEXC", 4) != 0 || header.filetype_version != TEXTURE_CACHE_FILETYPE_VERSION) goto exit;
+
+	// Check if the settings used to create the Texture cache are the same as the current settings
+	if (header.mipmap_filter             != char(cpu_config.mipmap_filter) ||
+		header.enable_mipmapping         != gpu_config.enable_mipmapping ||
+		header.enable_block_compression  != cpu_config.enable_block_compression ||
+		header.block_compression_quality != char(cpu_config.block_compression_quality) ||
+		header.block_compression_format  != char(cpu_config.block_compression_format) ||
+		header.enable_gpu_mipmapping     != cpu_config.enable_gpu_mipmapping ||
+		header.enable_srgb_textures      != cpu_config.enable_srgb_textures
+	) {
+		IO::print("Texture cache file '{}' was created with different settings, ignoring it.\n"_sv, cache_filename);
+		goto exit;
+	}
+
+	texture->format         = Texture::Format(header.format);
+	texture->channels       = header.channels;
+	texture->width          = header.width;
+	texture->height         = header.height;
+	texture->mipmaps_on_gpu = header.mipmaps_on_gpu;
+	texture->is_srgb        = header.is_srgb;
+
+	texture->mip_offsets.resize(header.num_mip_levels);
+	texture->data       .resize(header.data_size);
+
+	success =
+		fread(texture->mip_offsets.data(), sizeof(int), header.num_mip_levels, file) == header.num_mip_levels &&
+		fread(texture->data       .data(), 1,           header.data_size,      file) == header.data_size;
+
+	if (!success) {
+		IO::print("WARNING: Texture cache file '{}' is truncated!\n"_sv, cache_filename);
+	}
+
+exit:
+	fclose(file);
+	return success;
+}
+
+bool TextureLoader::save_cache(const String & cache_filename, const Texture & texture) {
+	ProfileScope scope("Texture Cache Save"_sv, "Assets"_sv);
+
+	TextureCacheFileHeader header = { };
+	memcpy(header.filetype_identifier, "TEXC", 4);
+	header.filetype_version = TEXTURE_CACHE_FILETYPE_VERSION;
+
+	header.mipmap_filter             = char(cpu_config.mipmap_filter);
+	header.enable_mipmapping         = gpu_config.enable_mipmapping;
+	header.enable_block_compression  = cpu_config.enable_block_compression;
+	header.block_compression_quality = char(cpu_config.block_compression_quality);
+	header.block_compression_format  = char(cpu_config.block_compression_format);
+	header.enable_gpu_mipmapping     = cpu_config.enable_gpu_mipmapping;
+	header.enable_srgb_textures      = cpu_config.enable_srgb_textures;
+
+	header.format         = char(texture.format);
+	header.channels       = texture.channels;
+	header.width          = texture.width;
+	header.height         = texture.height;
+	header.mipmaps_on_gpu = texture.mipmaps_on_gpu;
+	header.is_srgb        = texture.is_srgb;
+
+	header.num_mip_levels = texture.mip_offsets.size();
+	header.data_size      = texture.data.size();
+
+	FILE * file = nullptr;
+	errno_t err;
+#ifdef _WIN32
+	err = fopen_s(&file, cache_filename.data(), "wb");
+#else
+	file = fopen(cache_filename.data(), "wb");
+	err = errno;
+#endif
+
+	if (!file) {
+		IO::print("WARNING: Failed to open Texture cache file '{}' for writing! ({})\n"_sv, cache_filename, IO::get_error_message(err));
+		return false;
+	}
+
+	bool success =
+		fwrite(&header,                   sizeof(header), 1,                     file) == 1 &&
+		fwrite(texture.mip_offsets.data(), sizeof(int),    header.num_mip_levels, file) == header.num_mip_levels &&
+		fwrite(texture.data       .data(), 1,              header.data_size,      file) == header.data_size;
+
+	fclose(file);
+
+	if (!success) {
+		IO::print("WARNING: Failed to write Texture cache file '{}'!\n"_sv, cache_filename);
+	}
+	return success;
+}
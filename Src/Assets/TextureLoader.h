@@ -4,6 +4,15 @@
 #include "Renderer/Texture.h"
 
 namespace TextureLoader {
+	// Stores the result of load_stb (mip chain and block compression included) next to the source image
+	inline constexpr const char * TEXTURE_CACHE_FILE_EXTENSION   = ".texc";
+	inline constexpr int          TEXTURE_CACHE_FILETYPE_VERSION = 5;
+
+	String get_texture_cache_filename(StringView filename, Allocator * allocator);
+
 	bool load_dds(const String & filename, Texture * texture);
 	bool load_stb(const String & filename, Texture * texture);
+
+	bool try_to_load_cache(const String & filename, const String & cache_filename, Texture * texture);
+	bool save_cache(const String & cache_filename, const Texture & texture);
 }
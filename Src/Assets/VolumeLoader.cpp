@@ -0,0 +1,98 @@
+#include "VolumeLoader.h"
+
+#include "Core/IO.h"
+
+#include "Util/ThreadPool.h"
+
+enum struct VolEncoding {
+	FLOAT32 = 1,
+	FLOAT16 = 2,
+	UINT8   = 3
+};
+
+struct VolHeader {
+	char  magic[3];
+	char  version;
+	int   encoding;
+	int   x_res;
+	int   y_res;
+	int   z_res;
+	int   channels;
+	float bounds[6];
+};
+
+static_assert(sizeof(VolHeader) == 48);
+
+bool VolumeLoader::load_vol(const String & filename, MediumGrid & grid) {
+	IO::MappedFile file;
+	if (!file.open(filename)) {
+		IO::print("WARNING: Unable to open volume file '{}'!\n"_sv, filename);
+		return false;
+	}
+
+	if (file.size() < sizeof(VolHeader)) {
+		IO::print("WARNING: Volume file '{}' is truncated!\n"_sv, filename);
+		return false;
+	}
+
+	VolHeader header = { };
+	memcpy(&header, file.data(), sizeof(VolHeader));
+
+	if (memcmp(header.magic, "VOL", 3) != 0 || header.version != 3) {
+		IO::print("WARNING: '{}' is not a version 3 .vol file!\n"_sv, filename);
+		return false;
+	}
+
+	VolEncoding encoding = VolEncoding(header.encoding);
+
+	size_t bytes_per_value;
+	switch (encoding) {
+		case VolEncoding::FLOAT32: bytes_per_value = sizeof(float); break;
+		case VolEncoding::UINT8:   bytes_per_value = sizeof(unsigned char); break;
+		default: {
+			IO::print("WARNING: Volume file '{}' uses an unsupported encoding ({})!\n"_sv, filename, header.encoding);
+			return false;
+		}
+	}
+
+	if (header.x_res <= 0 || header.y_res <= 0 || header.z_res <= 0 || header.channels <= 0) {
+		IO::print("WARNING: Volume file '{}' has an invalid resolution!\n"_sv, filename);
+		return false;
+	}
+
+	size_t voxel_count = size_t(header.x_res) * size_t(header.y_res) * size_t(header.z_res);
+
+	if (file.size() < sizeof(VolHeader) + voxel_count * header.channels * bytes_per_value) {
+		IO::print("WARNING: Volume file '{}' is truncated!\n"_sv, filename);
+		return false;
+	}
+
+	grid.width  = header.x_res;
+	grid.height = header.y_res;
+	grid.depth  = header.z_res;
+	grid.bounds.min = Vector3(header.bounds[0], header.bounds[1], header.bounds[2]);
+	grid.bounds.max = Vector3(header.bounds[3], header.bounds[4], header.bounds[5]);
+
+	grid.density.resize(voxel_count);
+
+	const char * data     = file.data() + sizeof(VolHeader);
+	int          channels = header.channels;
+
+	// The .vol layout (x fastest, then y, then z) matches MediumGrid, apart from the interleaved channels
+	ThreadPool::parallel_for(0, int(voxel_count), 64 * 1024, [&](int first, int last) {
+		for (int i = first; i < last; i++) {
+			float value;
+			if (encoding == VolEncoding::FLOAT32) {
+				memcpy(&value, data + size_t(i) * channels * sizeof(float), sizeof(float));
+			} else {
+				value = float(reinterpret_cast<const unsigned char *>(data)[size_t(i) * channels]) / 255.0f;
+			}
+			grid.density[i] = Math::max(value, 0.0f);
+		}
+	});
+
+	grid.calc_majorants();
+
+	IO::print("Loaded volume '{}' ({}x{}x{})\n"_sv, filename, grid.width, grid.height, grid.depth);
+	return true;
+}
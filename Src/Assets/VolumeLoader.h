@@ -0,0 +1,10 @@
+#pragma once
+#include "Core/String.h"
+
+#include "Renderer/Medium.h"
+
+namespace VolumeLoader {
+	// Loads a dense grid in the Mitsuba .vol format, only the first channel is used as density
+	// See: https://www.mitsuba-renderer.org/releases/current/documentation.pdf (Grid-based volume data source)
+	bool load_vol(const String & filename, MediumGrid & grid);
+}
@@ -3,39 +3,222 @@
 #include "Core/IO.h"
 #include "Core/Timer.h"
 #include "Core/Allocators/AlignedAllocator.h"
+#include "Core/Allocators/LargePageAllocator.h"
 
 #include "BVH/Builders/SAHBuilder.h"
+#include "BVH/Builders/LBVHBuilder.h"
+#include "BVH/Builders/BinnedSAHBuilder.h"
 #include "BVH/Builders/SBVHBuilder.h"
+#include "BVH/Builders/TrianglePresplitter.h"
 #include "BVH/Converters/BVH4Converter.h"
 #include "BVH/Converters/BVH8Converter.h"
 
 #include "BVH/BVHOptimizer.h"
+#include "BVH/BVHRestructurer.h"
+
+// Builds a binary BVH over the primitives with the given builder
+template<typename Primitives>
+static void build_bvh2(BVH2 & bvh, const Primitives & primitives, BVHBuilderType builder = cpu_config.bvh_builder) {
+	switch (builder) {
+		case BVHBuilderType::SAH: {
+			ScopeTimer timer("BVH Construction"_sv);
+
+			SAHBuilder(bvh, primitives.size()).build(primitives);
+			break;
+		}
+		case BVHBuilderType::LBVH: {
+			ScopeTimer timer("LBVH Construction"_sv);
+
+			LBVHBuilder(bvh, primitives.size()).build(primitives);
+			break;
+		}
+		case BVHBuilderType::BINNED: {
+			ScopeTimer timer("Binned BVH Construction"_sv);
+
+			BinnedSAHBuilder(bvh, primitives.size()).build(primitives);
+			break;
+		}
+		default: ASSERT_UNREACHABLE();
+	}
+}
+
+static void build_sbvh(BVH2 & bvh, const IndexedTriangles & triangles) {
+	ScopeTimer timer("SBVH Construction"_sv);
+
+	SBVHBuilder(bvh, triangles.size()).build(triangles);
+}
+
+// Builds a binary BVH without spatial splits, the Triangles are presplit first if cpu_config.bvh_presplit_budget is set
+static void build_bvh2_triangles(BVH2 & bvh, const IndexedTriangles & triangles, BVHBuilderType builder) {
+	if (cpu_config.bvh_presplit_budget > 0.0f) {
+		Array<PrimitiveRef> primitive_refs;
+		{
+			ScopeTimer timer("BVH Presplit"_sv);
+			primitive_refs = TrianglePresplitter::presplit(triangles, cpu_config.bvh_presplit_budget);
+		}
+
+		build_bvh2(bvh, primitive_refs, builder);
+
+		// Map the references back to the Triangles they are part of, a leaf may contain the same Triangle more than once
+		for (size_t i = 0; i < bvh.indices.size(); i++) {
+			bvh.indices[i] = primitive_refs[bvh.indices[i]].index;
+		}
+	} else {
+		build_bvh2(bvh, triangles, builder);
+	}
+}
+
+// Spatial splits are expensive to build and only pay off where Triangles straddle the splits of a regular BVH,
+// which is typical for long Triangles in architectural Meshes and rare in dense scans. Meshes below the SBVH limit
+// get a regular SAH BVH first, which is kept unless its siblings overlap enough that spatial splits are likely to help
+static void build_auto(BVH2 & bvh, const IndexedTriangles & triangles) {
+	int triangle_count = int(triangles.size());
+
+	if (triangle_count >= cpu_config.bvh_auto_binned_min_triangles) {
+		build_bvh2_triangles(bvh, triangles, BVHBuilderType::BINNED);
+		return;
+	}
+
+	build_bvh2_triangles(bvh, triangles, BVHBuilderType::SAH);
+
+	if (triangle_count > cpu_config.bvh_auto_sbvh_max_triangles) return;
+
+	float overlap = bvh.sibling_overlap();
+	if (overlap >= cpu_config.bvh_auto_sbvh_min_overlap) {
+		bvh = BVH2(LargePageAllocator::select(AlignedAllocator<64>::instance()));
+		build_sbvh(bvh, triangles);
+	}
+}
+
+BVH2 BVH::create_from_triangles(const IndexedTriangles & triangles, BVHBuildPolicy policy) {
+	ProfileScope scope("BVH Build"_sv, "BVH"_sv);
 
-BVH2 BVH::create_from_triangles(const Array<Triangle> & triangles) {
 	IO::print("Constructing BVH...\r"_sv);
 
-	BVH2 bvh = BVH2(AlignedAllocator<64>::instance());
+	BVH2 bvh = BVH2(LargePageAllocator::select(AlignedAllocator<64>::instance()));
+
+	switch (policy) {
+		case BVHBuildPolicy::GLOBAL: {
+			// Only the SBVH uses SBVH as its starting point,
+			// all other BVH types use the standard BVH as their starting point
+			if (cpu_config.bvh_type == BVHType::SBVH) {
+				build_sbvh(bvh, triangles);
+			} else {
+				build_bvh2_triangles(bvh, triangles, cpu_config.bvh_builder);
+			}
+			break;
+		}
+		case BVHBuildPolicy::AUTO:   build_auto(bvh, triangles); break;
+		case BVHBuildPolicy::SAH:    build_bvh2_triangles(bvh, triangles, BVHBuilderType::SAH);    break;
+		case BVHBuildPolicy::SBVH:   build_sbvh          (bvh, triangles);                         break;
+		case BVHBuildPolicy::LBVH:   build_bvh2_triangles(bvh, triangles, BVHBuilderType::LBVH);   break;
+		case BVHBuildPolicy::BINNED: build_bvh2_triangles(bvh, triangles, BVHBuilderType::BINNED); break;
+		default: ASSERT_UNREACHABLE();
+	}
+
+	if (cpu_config.enable_bvh_restructuring) {
+		ProfileScope scope("BVH Restructure"_sv, "BVH"_sv);
+		BVHRestructurer::restructure(bvh);
+	}
+
+	if (cpu_config.enable_bvh_optimization) {
+		ProfileScope scope("BVH Optimize"_sv, "BVH"_sv);
+		BVHOptimizer::optimize(bvh);
+	}
+
+	return bvh;
+}
+
+BVH2 BVH::create_from_curves(const Array<Curve> & curves) {
+	ProfileScope scope("BVH Build"_sv, "BVH"_sv);
+
+	IO::print("Constructing BVH...\r"_sv);
 
-	// Only the SBVH uses SBVH as its starting point,
-	// all other BVH types use the standard BVH as their starting point
-	if (cpu_config.bvh_type == BVHType::SBVH) {
-		ScopeTimer timer("SBVH Construction"_sv);
+	BVH2 bvh = BVH2(LargePageAllocator::select(AlignedAllocator<64>::instance()));
 
-		SBVHBuilder(bvh, triangles.size()).build(triangles);
-	} else  {
-		ScopeTimer timer("BVH Construction"_sv);
+	build_bvh2(bvh, curves);
 
-		SAHBuilder(bvh, triangles.size()).build(triangles);
+	if (cpu_config.enable_bvh_restructuring) {
+		ProfileScope scope("BVH Restructure"_sv, "BVH"_sv);
+		BVHRestructurer::restructure(bvh);
 	}
 
 	if (cpu_config.enable_bvh_optimization) {
+		ProfileScope scope("BVH Optimize"_sv, "BVH"_sv);
 		BVHOptimizer::optimize(bvh);
 	}
 
 	return bvh;
 }
 
+// Calculates the SAH cost of the whole tree, relative to the surface area of the root
+float BVH2::sah_cost() const {
+	float sum_leaf = 0.0f;
+	float sum_node = 0.0f;
+
+	for (size_t i = 0; i < nodes.size(); i++) {
+		if (i == 1) continue;
+
+		const BVHNode2 & node = nodes[i];
+
+		if (node.is_leaf()) {
+			sum_leaf += node.aabb.surface_area() * node.count;
+		} else {
+			sum_node += node.aabb.surface_area();
+		}
+	}
+
+	return (
+		cpu_config.sah_cost_node * sum_node +
+		cpu_config.sah_cost_leaf * sum_leaf
+	) / nodes[0].aabb.surface_area();
+}
+
+bool BVH::parse_build_policy(StringView name, BVHBuildPolicy & policy) {
+	if (name == "global") {
+		policy = BVHBuildPolicy::GLOBAL;
+	} else if (name == "auto") {
+		policy = BVHBuildPolicy::AUTO;
+	} else if (name == "sah") {
+		policy = BVHBuildPolicy::SAH;
+	} else if (name == "sbvh") {
+		policy = BVHBuildPolicy::SBVH;
+	} else if (name == "lbvh") {
+		policy = BVHBuildPolicy::LBVH;
+	} else if (name == "binned") {
+		policy = BVHBuildPolicy::BINNED;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+// Surface area of the overlap of all pairs of siblings, relative to the summed surface area of all internal Nodes
+// Siblings overlap where Triangles straddle the splits, which is what spatial splits remove
+float BVH2::sibling_overlap() const {
+	float sum_overlap = 0.0f;
+	float sum_node    = 0.0f;
+
+	for (size_t i = 0; i < nodes.size(); i++) {
+		if (i == 1) continue;
+
+		const BVHNode2 & node = nodes[i];
+		if (node.is_leaf()) continue;
+
+		sum_node += node.aabb.surface_area();
+
+		AABB overlap = AABB::overlap(nodes[node.left].aabb, nodes[node.left + 1].aabb);
+		if (overlap.is_valid()) {
+			sum_overlap += overlap.surface_area();
+		}
+	}
+
+	return sum_node > 0.0f ? sum_overlap / sum_node : 0.0f;
+}
+
 OwnPtr<BVH> BVH::create_from_bvh2(BVH2 bvh) {
+	ProfileScope scope("BVH Convert"_sv, "BVH"_sv);
+
 	switch (cpu_config.bvh_type) {
 		case BVHType::BVH:
 		case BVHType::SBVH: {
@@ -57,3 +240,44 @@ OwnPtr<BVH> BVH::create_from_bvh2(BVH2 bvh) {
 	}
 	IO::exit(1);
 }
+
+void BVH8::refit(const IndexedTriangles & triangles) {
+	Array<AABB> node_aabbs(nodes.size()); // Unquantized AABB of every Node, read by its parent
+
+	for (size_t n = nodes.size() - 1; n < nodes.size(); n--) {
+		BVHNode8 & node = nodes[n];
+
+		AABB     aabb        = AABB::create_empty();
+		AABB     child_aabbs[8];
+		unsigned child_mask  = 0;
+
+		int child_node_offset = 0;
+
+		for (int i = 0; i < 8; i++) {
+			child_aabbs[i] = AABB::create_empty();
+
+			if (node.imask & (1 << i)) {
+				// Internal Nodes are stored consecutively, in the order of their slots
+				child_aabbs[i] = node_aabbs[node.base_index_child + child_node_offset++];
+			} else {
+				// Three highest bits contain unary representation of triangle count
+				int triangle_count = 0;
+				while (triangle_count < 3 && (node.meta[i] & (1 << (triangle_count + 5)))) {
+					triangle_count++;
+				}
+				if (triangle_count == 0) continue; // Empty slot
+
+				int triangle_offset = node.base_index_triangle + (node.meta[i] & 0b00011111);
+				for (int j = 0; j < triangle_count; j++) {
+					child_aabbs[i].expand(triangles[indices[triangle_offset + j]].get_aabb());
+				}
+			}
+
+			aabb.expand(child_aabbs[i]);
+			child_mask |= 1 << i;
+		}
+
+		node_aabbs[n] = aabb;
+		BVH8Converter::quantize(node, aabb, child_aabbs, child_mask);
+	}
+}
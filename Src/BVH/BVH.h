@@ -2,6 +2,7 @@
 #include "Config.h"
 
 #include "Renderer/Triangle.h"
+#include "Renderer/Curve.h"
 
 #include "Core/Array.h"
 #include "Core/OwnPtr.h"
@@ -22,23 +23,26 @@ struct BVHNode2 {
 	}
 };
 
+// Child AABBs are quantized to 8 bits on a grid relative to the origin p with power of two scale e, like BVHNode8
+// Children are stored contiguously starting at slot 0, the remaining slots have a count of INVALID
 struct BVHNode4 {
-	float aabb_min_x[4] = { 0.0f };
-	float aabb_min_y[4] = { 0.0f };
-	float aabb_min_z[4] = { 0.0f };
-	float aabb_max_x[4] = { 0.0f };
-	float aabb_max_y[4] = { 0.0f };
-	float aabb_max_z[4] = { 0.0f };
-
-	struct {
-		int index;
-		int count;
-	} index_and_count[4];
-
-	inline       int & get_index(int i)       { return index_and_count[i].index; }
-	inline const int & get_index(int i) const { return index_and_count[i].index; }
-	inline       int & get_count(int i)       { return index_and_count[i].count; }
-	inline const int & get_count(int i) const { return index_and_count[i].count; }
+	Vector3 p;
+	byte e[3];
+	byte child_count;
+
+	byte quantized_min_x[4] = { }, quantized_max_x[4] = { };
+	byte quantized_min_y[4] = { }, quantized_max_y[4] = { };
+	byte quantized_min_z[4] = { }, quantized_max_z[4] = { };
+
+	int   index[4] = { INVALID, INVALID, INVALID, INVALID };
+	short count[4] = { INVALID, INVALID, INVALID, INVALID }; // Primitive count for leaves, 0 for internal Nodes
+
+	static constexpr int MAX_LEAF_COUNT = 0x7fff;
+
+	inline       int   & get_index(int i)       { return index[i]; }
+	inline const int   & get_index(int i) const { return index[i]; }
+	inline       short & get_count(int i)       { return count[i]; }
+	inline const short & get_count(int i) const { return count[i]; }
 
 	inline bool is_leaf(int i) { return get_count(i) > 0; }
 
@@ -46,17 +50,16 @@ struct BVHNode4 {
 		int result = 0;
 
 		for (int i = 0; i < 4; i++) {
-			if (get_count(i) == -1) break;
+			if (get_count(i) == INVALID) break;
 
 			result++;
 		}
 
 		return result;
 	}
-
 };
 
-static_assert(sizeof(BVHNode4) == 128);
+static_assert(sizeof(BVHNode4) == 64);
 
 struct BVHNode8 {
 	Vector3 p;
@@ -88,10 +91,13 @@ struct BVH {
 
 	virtual size_t node_count() const = 0;
 
-	static BVH2 create_from_triangles(const Array<Triangle> & triangles);
+	static BVH2 create_from_triangles(const IndexedTriangles & triangles, BVHBuildPolicy policy = cpu_config.bvh_build_policy);
+	static BVH2 create_from_curves   (const Array<Curve>    & curves); // The SBVH does not split Curves, a regular SAH BVH is built instead
 
 	static OwnPtr<BVH> create_from_bvh2(BVH2 bvh);
 
+	static bool parse_build_policy(StringView name, BVHBuildPolicy & policy); // Accepts global, auto, sah, sbvh, lbvh and binned
+
 	static BVHType underlying_bvh_type() {
 		// All BVH use standard BVH as underlying type, only SBVH uses SBVH
 		if (cpu_config.bvh_type == BVHType::SBVH) {
@@ -111,6 +117,29 @@ struct BVH2 final : BVH {
 	DEFAULT_MOVEABLE(BVH2);
 
 	size_t node_count() const override { return nodes.size(); }
+
+	float sah_cost() const;
+	float sibling_overlap() const;
+
+	// Recomputes the AABBs of all Nodes bottom up from the given primitives, keeping the topology intact
+	// NOTE: Relies on child Nodes being stored after their parent, which holds for all builders
+	template<typename Primitives>
+	void refit(const Primitives & primitives) {
+		for (size_t i = nodes.size() - 1; i < nodes.size(); i--) {
+			if (i == 1) continue; // Dummy
+
+			BVHNode2 & node = nodes[i];
+
+			if (node.is_leaf()) {
+				node.aabb = AABB::create_empty();
+				for (unsigned j = 0; j < node.count; j++) {
+					node.aabb.expand(primitives[indices[node.first + j]].get_aabb());
+				}
+			} else {
+				node.aabb = AABB::unify(nodes[node.left].aabb, nodes[node.left + 1].aabb);
+			}
+		}
+	}
 };
 
 struct BVH4 final : BVH {
@@ -130,4 +159,8 @@ struct BVH8 final : BVH {
 	BVH8(Allocator * allocator = nullptr) : nodes(allocator) { }
 
 	size_t node_count() const override { return nodes.size(); }
+
+	// Recomputes the quantized child AABBs of all Nodes bottom up from the given Triangles, keeping the topology intact
+	// NOTE: Relies on child Nodes being stored after their parent, which holds for BVH8Converter
+	void refit(const IndexedTriangles & triangles);
 };
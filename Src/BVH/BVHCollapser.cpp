@@ -1,21 +1,43 @@
 #include "BVHCollapser.h"
 
-#include "Core/BitArray.h"
+#include "Util/Profiler.h"
+#include "Util/ThreadPool.h"
 
 struct CollapseCost {
 	int   primitive_count;
 	float sah;
 };
 
+// The subtrees at this depth are processed in parallel, the levels above them on the calling thread
+static constexpr int SUBTREE_DEPTH = 6;
+
+// Nodes at SUBTREE_DEPTH, or leaves above it, in depth first order
+static void gather_subtrees(const BVH2 & bvh, Array<int> & subtrees, int node_index = 0, int depth = 0) {
+	const BVHNode2 & node = bvh.nodes[node_index];
+
+	if (depth == SUBTREE_DEPTH || node.is_leaf()) {
+		subtrees.push_back(node_index);
+	} else {
+		gather_subtrees(bvh, subtrees, node.left,     depth + 1);
+		gather_subtrees(bvh, subtrees, node.left + 1, depth + 1);
+	}
+}
+
 // Bottom up calculation of the cost of collapsing multiple leaf nodes into one
-static CollapseCost calc_collapse_cost(const BVH2 & bvh, BitArray & collapse, int node_index = 0) {
+// If subtree_costs is given, the costs of the Nodes gathered by gather_subtrees are taken from it instead of recursing into them
+// Every Node writes only its own collapse decision, which is why this uses an Array<bool> rather than a BitArray
+static CollapseCost calc_collapse_cost(const BVH2 & bvh, Array<bool> & collapse, int node_index, int depth = 0, const CollapseCost * subtree_costs = nullptr, int * subtree_index = nullptr) {
 	const BVHNode2 & node = bvh.nodes[node_index];
 
+	if (subtree_costs && (depth == SUBTREE_DEPTH || node.is_leaf())) {
+		return subtree_costs[(*subtree_index)++];
+	}
+
 	if (node.is_leaf()) {
 		return { int(node.count), float(node.count) * cpu_config.sah_cost_leaf };
 	} else {
-		CollapseCost cost_left  = calc_collapse_cost(bvh, collapse, node.left);
-		CollapseCost cost_right = calc_collapse_cost(bvh, collapse, node.left + 1);
+		CollapseCost cost_left  = calc_collapse_cost(bvh, collapse, node.left,     depth + 1, subtree_costs, subtree_index);
+		CollapseCost cost_right = calc_collapse_cost(bvh, collapse, node.left + 1, depth + 1, subtree_costs, subtree_index);
 
 		int total_primtive_count = cost_left.primitive_count + cost_right.primitive_count;
 
@@ -54,10 +76,21 @@ static int collapse_subtree(const BVH2 & bvh, BVH & new_bvh, int node_index) {
 	}
 };
 
+struct CollapseSubtree {
+	int node_index; // In the original BVH
+	int new_index;  // In the collapsed BVH
+};
+
 // Collapse leaf nodes based on precalculated cost
-static void bvh_collapse(const BVH2 & bvh, BVH2 & new_bvh, int new_index, BitArray & collapse, int node_index = 0) {
+// If subtrees is given, internal Nodes at SUBTREE_DEPTH are not collapsed but recorded, so that they can be collapsed in parallel
+static void bvh_collapse(const BVH2 & bvh, BVH2 & new_bvh, int new_index, const Array<bool> & collapse, int node_index = 0, int depth = 0, Array<CollapseSubtree> * subtrees = nullptr) {
 	const BVHNode2 & node = bvh.nodes[node_index];
 
+	if (subtrees && depth == SUBTREE_DEPTH && !node.is_leaf()) {
+		subtrees->push_back({ node_index, new_index });
+		return;
+	}
+
 	BVHNode2 & new_node = new_bvh.nodes[new_index];
 	new_node.aabb  = node.aabb;
 	new_node.count = node.count;
@@ -85,17 +118,32 @@ static void bvh_collapse(const BVH2 & bvh, BVH2 & new_bvh, int new_index, BitArr
 
 			ASSERT(!new_node.is_leaf());
 
-			bvh_collapse(bvh, new_bvh, new_node.left,     collapse, node.left);
-			bvh_collapse(bvh, new_bvh, new_node.left + 1, collapse, node.left + 1);
+			bvh_collapse(bvh, new_bvh, new_node.left,     collapse, node.left,     depth + 1, subtrees);
+			bvh_collapse(bvh, new_bvh, new_node.left + 1, collapse, node.left + 1, depth + 1, subtrees);
 		}
 	}
 }
 
 void BVHCollapser::collapse(BVH2 & bvh) {
+	ProfileScope scope("BVH Collapse"_sv, "BVH"_sv);
+
 	// Calculate costs of collapse, and fill array with the decision to collapse, yes or no
-	BitArray collapse(bvh.nodes.size());
-	collapse.set_all(false);
-	calc_collapse_cost(bvh, collapse);
+	Array<bool> collapse(bvh.nodes.size());
+	memset(collapse.data(), false, collapse.size() * sizeof(bool));
+
+	// The subtrees below SUBTREE_DEPTH are independent, their costs are calculated in parallel before the levels above them
+	Array<int> subtrees;
+	gather_subtrees(bvh, subtrees);
+
+	Array<CollapseCost> subtree_costs(subtrees.size());
+
+	ThreadPool::parallel_for(subtrees.size(), [&](int i) {
+		subtree_costs[i] = calc_collapse_cost(bvh, collapse, subtrees[i]);
+	});
+
+	int subtree_index = 0;
+	calc_collapse_cost(bvh, collapse, 0, 0, subtree_costs.data(), &subtree_index);
+	ASSERT(subtree_index == subtrees.size());
 
 	// Collapse BVH using a copy
 	BVH2 collapsed_bvh = { };
@@ -105,7 +153,49 @@ void BVHCollapser::collapse(BVH2 & bvh) {
 	collapsed_bvh.nodes.emplace_back(); // Root
 	collapsed_bvh.nodes.emplace_back(); // Dummy
 
-	bvh_collapse(bvh, collapsed_bvh, 0, collapse);
+	Array<CollapseSubtree> collapse_subtrees;
+	bvh_collapse(bvh, collapsed_bvh, 0, collapse, 0, 0, &collapse_subtrees);
+
+	// Every subtree is collapsed into its own BVH2, whose Root replaces the placeholder Node of the subtree
+	Array<BVH2> subtree_bvhs(collapse_subtrees.size());
+
+	ThreadPool::parallel_for(collapse_subtrees.size(), [&](int i) {
+		BVH2 & subtree_bvh = subtree_bvhs[i];
+		subtree_bvh.nodes.emplace_back(); // Root
+		subtree_bvh.nodes.emplace_back(); // Dummy
+
+		bvh_collapse(bvh, subtree_bvh, 0, collapse, collapse_subtrees[i].node_index);
+	});
+
+	// Append subtrees in a fixed order so the resulting layout does not depend on scheduling
+	for (size_t i = 0; i < collapse_subtrees.size(); i++) {
+		const BVH2 & subtree_bvh = subtree_bvhs[i];
+
+		// Local Nodes 2 and up are appended without the Dummy, local Node 0 replaces the placeholder
+		int node_offset  = int(collapsed_bvh.nodes  .size()) - 2;
+		int index_offset = int(collapsed_bvh.indices.size());
+
+		for (size_t j = 0; j < subtree_bvh.nodes.size(); j++) {
+			if (j == 1) continue;
+
+			BVHNode2 node = subtree_bvh.nodes[j];
+			if (node.is_leaf()) {
+				node.first += index_offset;
+			} else {
+				node.left += node_offset;
+			}
+
+			if (j == 0) {
+				collapsed_bvh.nodes[collapse_subtrees[i].new_index] = node;
+			} else {
+				collapsed_bvh.nodes.push_back(node);
+			}
+		}
+
+		for (size_t j = 0; j < subtree_bvh.indices.size(); j++) {
+			collapsed_bvh.indices.push_back(subtree_bvh.indices[j]);
+		}
+	}
 
 	ASSERT(collapsed_bvh.indices.size() == bvh.indices.size());
 	ASSERT(collapsed_bvh.nodes  .size() <= bvh.nodes  .size());
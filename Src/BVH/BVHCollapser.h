@@ -5,5 +5,6 @@ namespace BVHCollapser {
 	// Collapses the given BVH based on the SAH cost
 	// For each internal node we check whether it is cheaper to collapse
 	// its entire subtree into a single leaf node based on the SAH cost
+	// Both the cost calculation and the rewrite of the BVH process the subtrees below the top levels in parallel
 	void collapse(BVH2 & bvh);
 }
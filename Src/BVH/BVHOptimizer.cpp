@@ -10,29 +10,7 @@
 #include "Core/Allocators/LinearAllocator.h"
 
 #include "Util/Util.h"
-
-// Calculates the SAH cost of a whole tree
-static float bvh_sah_cost(const BVH2 & bvh) {
-	float sum_leaf = 0.0f;
-	float sum_node = 0.0f;
-
-	for (size_t i = 0; i < bvh.nodes.size(); i++) {
-		if (i == 1) continue;
-
-		const BVHNode2 & node = bvh.nodes[i];
-
-		if (node.is_leaf()) {
-			sum_leaf += node.aabb.surface_area() * node.count;
-		} else {
-			sum_node += node.aabb.surface_area();
-		}
-	}
-
-	return (
-		cpu_config.sah_cost_node * sum_node +
-		cpu_config.sah_cost_leaf * sum_leaf
-	) / bvh.nodes[0].aabb.surface_area();
-}
+#include "Util/ThreadPool.h"
 
 // Initialize array of parent indices
 static Array<int> get_parent_indices(const BVH2 & bvh, Allocator * allocator) {
@@ -107,7 +85,9 @@ static void select_nodes_measure(const BVH2 & bvh, const Array<int> & parent_ind
 }
 
 // Finds the global minimum of where best to insert the reinsertion node by traversing the tree using Branch and Bound
-static void find_reinsertion(const BVH2 & bvh, const BVHNode2 & node_reinsert, Allocator * allocator, float & min_cost, int & min_index) {
+// If min_cost is finite on entry it is used as an upper bound, only strictly cheaper positions are returned
+// The subtree at node_excluded is ignored entirely, the Node at node_skipped is not considered but its children are
+static void find_reinsertion(const BVH2 & bvh, const BVHNode2 & node_reinsert, Allocator * allocator, float & min_cost, int & min_index, int node_excluded = INVALID, int node_skipped = INVALID) {
 	float node_reinsert_area = node_reinsert.aabb.surface_area();
 
 	struct Pair {
@@ -129,10 +109,12 @@ static void find_reinsertion(const BVH2 & bvh, const BVHNode2 & node_reinsert, A
 
 		if (induced_cost + node_reinsert_area >= min_cost) break; // Not possible to reduce min_cost, terminate
 
+		if (node_index == node_excluded) continue;
+
 		float direct_cost = AABB::unify(node.aabb, node_reinsert.aabb).surface_area();
 		float cost = induced_cost + direct_cost;
 
-		if (cost < min_cost) {
+		if (cost < min_cost && node_index != node_skipped) {
 			min_cost  = cost;
 			min_index = node_index;
 		}
@@ -148,6 +130,60 @@ static void find_reinsertion(const BVH2 & bvh, const BVHNode2 & node_reinsert, A
 	}
 }
 
+// Calculates the cost find_reinsertion would assign to reinserting a Node as sibling of the Node at node_index
+// Returns INFINITY if node_index is not reachable from the root (for example because it is part of a removed subtree)
+static float reinsertion_cost(const BVH2 & bvh, const Array<int> & parent_indices, const BVHNode2 & node_reinsert, int node_index) {
+	float cost = AABB::unify(bvh.nodes[node_index].aabb, node_reinsert.aabb).surface_area();
+
+	int child  = node_index;
+	int parent = parent_indices[node_index];
+
+	for (size_t depth = 0; child != 0; depth++) {
+		if (parent == INVALID || depth >= bvh.nodes.size()) return INFINITY;
+
+		const BVHNode2 & node = bvh.nodes[parent];
+		if (node.is_leaf() || node.left != (child & ~1)) return INFINITY; // Stale parent index, the child is not actually in the tree
+
+		cost += AABB::unify(node.aabb, node_reinsert.aabb).surface_area() - node.aabb.surface_area();
+
+		child  = parent;
+		parent = parent_indices[parent];
+	}
+
+	return cost;
+}
+
+// Finds a reinsertion candidate for both children of every Node in the batch, using the tree as it is at the start of the batch.
+// These searches are independent of each other and run on the ThreadPool. The candidates are only used as the initial upper bound
+// of the exact search done by find_reinsertion, so they determine how much of the tree can be pruned but never change the result
+static void find_reinsertion_candidates(const BVH2 & bvh, const Array<int> & batch_indices, int batch_size, Array<int> & candidates) {
+	constexpr int JOB_COUNT = 64;
+
+	ThreadPool::parallel_for(JOB_COUNT, [&](int job_index) {
+		LinearAllocator<MEGABYTES(1)> allocator;
+
+		for (int i = job_index; i < batch_size; i += JOB_COUNT) {
+			int node_index = batch_indices[i];
+
+			const BVHNode2 & node = bvh.nodes[node_index];
+			if (node.is_leaf()) continue;
+
+			for (int c = 0; c < 2; c++) {
+				int child_index = node.left + c;
+
+				allocator.reset();
+
+				// Approximate the removal of the Node by not reinserting at the Node itself or inside the child's own subtree
+				float min_cost  = INFINITY;
+				int   min_index = INVALID;
+				find_reinsertion(bvh, bvh.nodes[child_index], &allocator, min_cost, min_index, child_index, node_index);
+
+				candidates[child_index] = min_index;
+			}
+		}
+	});
+}
+
 // Update AABBs bottom up, until the root of the tree is reached
 static void update_aabbs_bottom_up(BVH2 & bvh, const Array<int> & parent_indices, int node_index) {
 	ASSERT(node_index >= 0);
@@ -228,7 +264,7 @@ void BVHOptimizer::optimize(BVH2 & bvh) {
 
 	ScopeTimer timer("BVH Optimization"_sv);
 
-	float cost_before = bvh_sah_cost(bvh);
+	float cost_before = bvh.sah_cost();
 
 	LinearAllocator<MEGABYTES(1)> init_allocator; // Memory used during the entire optimization process
 	LinearAllocator<MEGABYTES(1)> loop_allocator; // Memory reset every batch iteration
@@ -256,10 +292,17 @@ void BVHOptimizer::optimize(BVH2 & bvh) {
 
 	Array<int> originated  (bvh.nodes.size(), &init_allocator);
 	Array<int> displacement(bvh.nodes.size(), &init_allocator);
+	Array<int> candidates  (bvh.nodes.size(), &init_allocator);
 
 	RNG rng(time(nullptr));
 
-	clock_t start_time = clock();
+	// NOTE: Wall clock time, clock() would measure the combined CPU time of all threads
+	Timer timer_elapsed;
+	timer_elapsed.start();
+
+	// Progress is measured over windows of at least a second
+	size_t progress_time     = 0;
+	float  progress_sah_cost = cost_before;
 
 	while (true) {
 		loop_allocator.reset();
@@ -274,8 +317,11 @@ void BVHOptimizer::optimize(BVH2 & bvh) {
 		for (size_t i = 0; i < bvh.nodes.size(); i++) {
 			originated  [i] = i;
 			displacement[i] = i;
+			candidates  [i] = INVALID;
 		}
 
+		find_reinsertion_candidates(bvh, batch_indices, batch_size, candidates);
+
 		for (int i = 0; i < batch_size; i++) {
 			int node_index = displacement[batch_indices[i]];
 			if (node_index == INVALID) continue; // This Node was overwritten by another reinsertion and no longer exists
@@ -343,6 +389,17 @@ void BVHOptimizer::optimize(BVH2 & bvh) {
 				float min_cost  = INFINITY;
 				int   min_index = INVALID;
 
+				// Use the candidate found at the start of the batch as upper bound, if it is still part of the tree
+				int candidate = candidates[originated[reinsert.node_index]];
+				if (candidate != INVALID && displacement[candidate] != INVALID) {
+					min_index = displacement[candidate];
+					min_cost  = reinsertion_cost(bvh, parent_indices, reinsert.node, min_index);
+
+					if (min_cost == INFINITY) {
+						min_index = INVALID;
+					}
+				}
+
 				find_reinsertion(bvh, reinsert.node, &loop_allocator, min_cost, min_index);
 
 				// Bookkeeping updates to perform the reinsertion
@@ -379,7 +436,7 @@ void BVHOptimizer::optimize(BVH2 & bvh) {
 			}
 		}
 
-		float sah_cost = bvh_sah_cost(bvh);
+		float sah_cost = bvh.sah_cost();
 
 		if (sah_cost < sah_cost_best) {
 			sah_cost_best = sah_cost;
@@ -400,18 +457,31 @@ void BVHOptimizer::optimize(BVH2 & bvh) {
 			}
 		}
 
-		clock_t curr_time = clock();
-		size_t  duration  = (curr_time - start_time) * 1000 / CLOCKS_PER_SEC;
+		size_t duration = timer_elapsed.stop() / 1000;
 
 		if (duration >= cpu_config.bvh_optimizer_max_time || batch_count >= cpu_config.bvh_optimizer_max_num_batches) {
 			break;
 		}
 
+		// Report the SAH cost over time and stop early once the relative improvement per second levels off
+		if (duration - progress_time >= 1000) {
+			float gain = (progress_sah_cost - sah_cost_best) / progress_sah_cost * 1000.0f / float(duration - progress_time);
+
+			IO::print("{} ms: SAH={} gain={}% per second                    \n"_sv, duration, sah_cost_best, 100.0f * gain);
+
+			if (gain < cpu_config.bvh_optimizer_min_gain) {
+				break;
+			}
+
+			progress_time     = duration;
+			progress_sah_cost = sah_cost_best;
+		}
+
 		IO::print("{}: SAH={} best={} last_reduction={}     \r"_sv, batch_count, sah_cost, sah_cost_best, batches_since_last_cost_reduction);
 		batch_count++;
 	}
 
 	// Report the improvement of the SAH cost
-	float cost_after = bvh_sah_cost(bvh);
+	float cost_after = bvh.sah_cost();
 	IO::print("\ncost: {} -> {}\n"_sv, cost_before, cost_after);
 }
@@ -0,0 +1,282 @@
+#include "BVHRestructurer.h"
+
+#include "Config.h"
+
+#include "Core/IO.h"
+#include "Core/Timer.h"
+
+#include "Util/Util.h"
+#include "Util/ThreadPool.h"
+
+// The subtrees at this depth are processed in parallel, the levels above them on the calling thread, same as in BVHCollapser
+static constexpr int SUBTREE_DEPTH = 6;
+
+static constexpr int TREELET_SIZE         = 7; // Maximum number of leaves of a treelet
+static constexpr int TREELET_SUBSET_COUNT = 1 << TREELET_SIZE;
+
+// Nodes at SUBTREE_DEPTH, or leaves above it
+static void gather_subtrees(const BVH2 & bvh, Array<int> & subtrees, int node_index = 0, int depth = 0) {
+	const BVHNode2 & node = bvh.nodes[node_index];
+
+	if (depth == SUBTREE_DEPTH || node.is_leaf()) {
+		subtrees.push_back(node_index);
+	} else {
+		gather_subtrees(bvh, subtrees, node.left,     depth + 1);
+		gather_subtrees(bvh, subtrees, node.left + 1, depth + 1);
+	}
+}
+
+// Selects the split axis with the same distance heuristic as BVHOptimizer and swaps the children such that the left child comes first along it
+static void node_calc_axis(BVH2 & bvh, Array<float> & costs, BVHNode2 & node) {
+	const AABB & aabb_left  = bvh.nodes[node.left    ].aabb;
+	const AABB & aabb_right = bvh.nodes[node.left + 1].aabb;
+
+	int   max_axis = 0;
+	float max_dist = 0.0f;
+
+	for (int dim = 0; dim < 3; dim++) {
+		float dist =
+			fabsf(aabb_left.min[dim] - aabb_right.min[dim]) +
+			fabsf(aabb_left.max[dim] - aabb_right.max[dim]);
+
+		if (dist >= max_dist) {
+			max_dist = dist;
+			max_axis = dim;
+		}
+	}
+
+	if (aabb_left.get_center()[max_axis] > aabb_right.get_center()[max_axis]) {
+		Util::swap(bvh.nodes[node.left], bvh.nodes[node.left + 1]);
+		Util::swap(costs    [node.left], costs    [node.left + 1]);
+	}
+
+	node.axis = max_axis;
+}
+
+// SAH cost of a subtree in units of surface area, not normalized by the root
+static float leaf_cost(const BVHNode2 & node) {
+	return cpu_config.sah_cost_leaf * node.aabb.surface_area() * float(node.count);
+}
+
+static float node_cost(const BVH2 & bvh, const Array<float> & costs, const BVHNode2 & node) {
+	return cpu_config.sah_cost_node * node.aabb.surface_area() + costs[node.left] + costs[node.left + 1];
+}
+
+struct Treelet {
+	int leaves   [TREELET_SIZE];     // Roots of the subtrees below the treelet, these are kept intact
+	int internals[TREELET_SIZE - 1]; // Internal Nodes of the treelet, internals[0] is its root
+	int leaf_count;
+	int internal_count;
+};
+
+static void treelet_form(const BVH2 & bvh, int root_index, Treelet & treelet) {
+	const BVHNode2 & root = bvh.nodes[root_index];
+
+	treelet.leaves[0]      = root.left;
+	treelet.leaves[1]      = root.left + 1;
+	treelet.internals[0]   = root_index;
+	treelet.leaf_count     = 2;
+	treelet.internal_count = 1;
+
+	// Repeatedly expand the leaf with the largest surface area, which is where a better topology gains the most
+	while (treelet.leaf_count < TREELET_SIZE) {
+		int   max_index = INVALID;
+		float max_area  = -1.0f;
+
+		for (int i = 0; i < treelet.leaf_count; i++) {
+			const BVHNode2 & node = bvh.nodes[treelet.leaves[i]];
+			if (node.is_leaf()) continue;
+
+			float area = node.aabb.surface_area();
+			if (area > max_area) {
+				max_area  = area;
+				max_index = i;
+			}
+		}
+
+		if (max_index == INVALID) break;
+
+		int node_index = treelet.leaves[max_index];
+
+		treelet.internals[treelet.internal_count++] = node_index;
+		treelet.leaves[max_index]                   = bvh.nodes[node_index].left;
+		treelet.leaves[treelet.leaf_count++]        = bvh.nodes[node_index].left + 1;
+	}
+}
+
+struct TreeletSolution {
+	float cost     [TREELET_SUBSET_COUNT];
+	int   partition[TREELET_SUBSET_COUNT]; // Leaves of the left child of the optimal subtree over the subset
+	AABB  aabb     [TREELET_SUBSET_COUNT];
+};
+
+// Finds the optimal topology over every subset of the leaves, subsets are visited in increasing order so all their own subsets are done before them
+static void treelet_solve(const BVH2 & bvh, const Array<float> & costs, const Treelet & treelet, TreeletSolution & solution) {
+	int subset_full = (1 << treelet.leaf_count) - 1;
+
+	for (int i = 0; i < treelet.leaf_count; i++) {
+		solution.cost[1 << i] = costs[treelet.leaves[i]];
+		solution.aabb[1 << i] = bvh.nodes[treelet.leaves[i]].aabb;
+	}
+
+	for (int subset = 1; subset <= subset_full; subset++) {
+		int lowest_bit = subset & -subset;
+		if (subset == lowest_bit) continue; // Single leaf
+
+		solution.aabb[subset] = AABB::unify(solution.aabb[subset ^ lowest_bit], solution.aabb[lowest_bit]);
+
+		// Every partition is visited once by requiring the lowest bit to be on the left
+		float min_cost      = INFINITY;
+		int   min_partition = INVALID;
+
+		for (int partition = (subset - 1) & subset; partition > 0; partition = (partition - 1) & subset) {
+			if ((partition & lowest_bit) == 0) continue;
+
+			float cost = solution.cost[partition] + solution.cost[subset ^ partition];
+			if (cost < min_cost) {
+				min_cost      = cost;
+				min_partition = partition;
+			}
+		}
+
+		solution.cost     [subset] = cpu_config.sah_cost_node * solution.aabb[subset].surface_area() + min_cost;
+		solution.partition[subset] = min_partition;
+	}
+}
+
+struct TreeletRebuild {
+	BVHNode2 leaf_nodes[TREELET_SIZE];
+	float    leaf_costs[TREELET_SIZE];
+	int      pairs     [TREELET_SIZE - 1]; // Child pairs of the internal Nodes, reused for the new internal Nodes
+	int      pair_count;
+};
+
+// Writes the optimal subtree over the subset into the given Node slot
+static void treelet_emit(BVH2 & bvh, Array<float> & costs, const TreeletSolution & solution, TreeletRebuild & rebuild, int subset, int node_index) {
+	if ((subset & (subset - 1)) == 0) {
+		int leaf = 0;
+		while ((1 << leaf) != subset) leaf++;
+
+		bvh.nodes[node_index] = rebuild.leaf_nodes[leaf];
+		costs    [node_index] = rebuild.leaf_costs[leaf];
+		return;
+	}
+
+	int left      = rebuild.pairs[rebuild.pair_count++];
+	int partition = solution.partition[subset];
+
+	treelet_emit(bvh, costs, solution, rebuild, partition,          left);
+	treelet_emit(bvh, costs, solution, rebuild, subset ^ partition, left + 1);
+
+	BVHNode2 & node = bvh.nodes[node_index];
+	node.aabb  = solution.aabb[subset];
+	node.left  = left;
+	node.count = 0;
+	node_calc_axis(bvh, costs, node);
+
+	costs[node_index] = solution.cost[subset];
+}
+
+static void treelet_restructure(BVH2 & bvh, Array<float> & costs, int root_index) {
+	Treelet treelet;
+	treelet_form(bvh, root_index, treelet);
+
+	if (treelet.leaf_count < 3) return; // Only one topology
+
+	TreeletSolution solution;
+	treelet_solve(bvh, costs, treelet, solution);
+
+	int subset_full = (1 << treelet.leaf_count) - 1;
+
+	if (solution.cost[subset_full] >= costs[root_index] * (1.0f - 1e-6f)) return;
+
+	// The leaves are copied out first, the new topology overwrites their slots
+	TreeletRebuild rebuild;
+	for (int i = 0; i < treelet.leaf_count; i++) {
+		rebuild.leaf_nodes[i] = bvh.nodes[treelet.leaves[i]];
+		rebuild.leaf_costs[i] = costs    [treelet.leaves[i]];
+	}
+	for (int i = 0; i < treelet.internal_count; i++) {
+		rebuild.pairs[i] = bvh.nodes[treelet.internals[i]].left;
+	}
+	rebuild.pair_count = 0;
+
+	treelet_emit(bvh, costs, solution, rebuild, subset_full, root_index);
+	ASSERT(rebuild.pair_count == treelet.internal_count);
+}
+
+// Post order, so that every treelet is formed from subtrees that were already restructured
+// If stop_at_subtrees is set the Nodes at SUBTREE_DEPTH are assumed to be done already
+static void restructure_subtree(BVH2 & bvh, Array<float> & costs, int node_index, int depth, bool stop_at_subtrees) {
+	const BVHNode2 & node = bvh.nodes[node_index];
+
+	if (node.is_leaf()) {
+		costs[node_index] = leaf_cost(node);
+		return;
+	}
+	if (stop_at_subtrees && depth == SUBTREE_DEPTH) return;
+
+	restructure_subtree(bvh, costs, node.left,     depth + 1, stop_at_subtrees);
+	restructure_subtree(bvh, costs, node.left + 1, depth + 1, stop_at_subtrees);
+
+	costs[node_index] = node_cost(bvh, costs, node);
+
+	treelet_restructure(bvh, costs, node_index);
+}
+
+// Child pairs are reused by other treelets, which can place them before their parent
+// The Nodes are written again in depth first order, so that children come after their parent as the refit methods expect
+static void reorder_depth_first(const BVH2 & bvh, Array<BVHNode2> & nodes_ordered, int & node_count, int node_index, int node_index_ordered) {
+	const BVHNode2 & node = bvh.nodes[node_index];
+
+	nodes_ordered[node_index_ordered] = node;
+
+	if (!node.is_leaf()) {
+		int left = node_count;
+		node_count += 2;
+
+		nodes_ordered[node_index_ordered].left = left;
+
+		reorder_depth_first(bvh, nodes_ordered, node_count, node.left,     left);
+		reorder_depth_first(bvh, nodes_ordered, node_count, node.left + 1, left + 1);
+	}
+}
+
+void BVHRestructurer::restructure(BVH2 & bvh) {
+	if (bvh.nodes.size() < 2 * TREELET_SIZE || bvh.nodes[0].is_leaf()) return; // Too small to restructure
+
+	ScopeTimer timer("BVH Restructuring"_sv);
+
+	float cost_before = bvh.sah_cost();
+
+	Array<int>   subtrees;
+	Array<float> costs(bvh.nodes.size());
+
+	float cost_root_prev = INFINITY;
+
+	for (int iteration = 0; iteration < cpu_config.bvh_restructure_iterations; iteration++) {
+		// The treelets of the upper levels reach below SUBTREE_DEPTH, so the subtrees are different every iteration
+		// Reusing the old roots would let subtrees overlap, which would then be restructured by two threads at once
+		subtrees.clear();
+		gather_subtrees(bvh, subtrees);
+
+		ThreadPool::parallel_for(subtrees.size(), [&](int i) {
+			restructure_subtree(bvh, costs, subtrees[i], SUBTREE_DEPTH, false);
+		});
+		restructure_subtree(bvh, costs, 0, 0, true);
+
+		if (costs[0] >= cost_root_prev * (1.0f - 1e-3f)) break; // Converged
+		cost_root_prev = costs[0];
+	}
+
+	Array<BVHNode2> nodes_ordered(bvh.nodes.size());
+	nodes_ordered[1] = bvh.nodes[1]; // Dummy
+
+	int node_count = 2;
+	reorder_depth_first(bvh, nodes_ordered, node_count, 0, 0);
+	ASSERT(node_count == bvh.nodes.size());
+
+	memcpy(bvh.nodes.data(), nodes_ordered.data(), bvh.nodes.size() * sizeof(BVHNode2));
+
+	IO::print("BVH restructuring cost: {} -> {}\n"_sv, cost_before, bvh.sah_cost());
+}
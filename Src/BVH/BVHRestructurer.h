@@ -0,0 +1,10 @@
+#pragma once
+#include "BVH.h"
+
+namespace BVHRestructurer {
+	// Treelet restructuring (Karras and Aila, "Fast Parallel Construction of High-Quality Bounding Volume Hierarchies")
+	// Bottom up, every internal Node forms a treelet with the largest Nodes below it as leaves, the topology of the
+	// treelet is then replaced by the one with the lowest SAH cost, found by dynamic programming over all subsets of its leaves
+	// Much cheaper than BVHOptimizer, and the subtrees below the top levels are restructured in parallel
+	void restructure(BVH2 & bvh);
+}
@@ -0,0 +1,252 @@
+#include "BVHTraversal.h"
+
+#include <string.h>
+
+#include <emmintrin.h>
+
+#include "Util/ThreadPool.h"
+
+static constexpr int TRAVERSAL_STACK_SIZE = 128;
+static constexpr int TRAVERSAL_GRAIN_SIZE = 256;
+
+// Same as triangle_intersect in CUDA/Raytracing/Triangle.h
+static void triangle_intersect(const IndexedTriangles & triangles, int triangle_id, const BVHTraversal::Ray & ray, BVHTraversal::Hit & hit) {
+	const Vector3 & position_0 = triangles.vertices[triangles.indices[3 * triangle_id    ]].position;
+	const Vector3 & position_1 = triangles.vertices[triangles.indices[3 * triangle_id + 1]].position;
+	const Vector3 & position_2 = triangles.vertices[triangles.indices[3 * triangle_id + 2]].position;
+
+	Vector3 edge_1 = position_1 - position_0;
+	Vector3 edge_2 = position_2 - position_0;
+
+	Vector3 h = Vector3::cross(ray.direction, edge_2);
+	float   a = Vector3::dot(edge_1, h);
+
+	float   f = 1.0f / a;
+	Vector3 s = ray.origin - position_0;
+	float   u = f * Vector3::dot(s, h);
+
+	if (u >= 0.0f && u <= 1.0f) {
+		Vector3 q = Vector3::cross(s, edge_1);
+		float   v = f * Vector3::dot(ray.direction, q);
+
+		if (v >= 0.0f && u + v <= 1.0f) {
+			float t = f * Vector3::dot(edge_2, q);
+
+			if (t > 0.0f && t < hit.t) {
+				hit.t = t;
+				hit.u = u;
+				hit.v = v;
+				hit.triangle_id = triangle_id;
+			}
+		}
+	}
+
+	hit.num_triangle_tests++;
+}
+
+// Avoids 0 * inf = NaN in the slab tests for axis aligned Rays
+static Vector3 safe_inv_direction(const Vector3 & direction) {
+	constexpr float MIN_DIRECTION = 1e-12f;
+
+	return Vector3::apply(direction, [](float d) {
+		return 1.0f / (fabsf(d) > MIN_DIRECTION ? d : copysignf(MIN_DIRECTION, d));
+	});
+}
+
+struct StackEntry {
+	int   index;
+	int   count; // Primitive count for leaves, 0 for internal Nodes
+	float t_near;
+};
+
+BVHTraversal::Hit BVHTraversal::intersect(const BVH2 & bvh, const IndexedTriangles & triangles, const Ray & ray) {
+	Hit hit = { };
+	hit.t = ray.t_max;
+
+	Vector3 inv_direction = safe_inv_direction(ray.direction);
+
+	auto aabb_intersect = [&](const AABB & aabb, float & t_near) {
+		Vector3 t0 = (aabb.min - ray.origin) * inv_direction;
+		Vector3 t1 = (aabb.max - ray.origin) * inv_direction;
+
+		Vector3 t_min = Vector3::min(t0, t1);
+		Vector3 t_max = Vector3::max(t0, t1);
+
+		t_near      = fmaxf(fmaxf(t_min.x, t_min.y), fmaxf(t_min.z, 0.0f));
+		float t_far = fminf(fminf(t_max.x, t_max.y), fminf(t_max.z, hit.t));
+
+		hit.num_aabb_tests++;
+
+		return t_near <= t_far;
+	};
+
+	StackEntry stack[TRAVERSAL_STACK_SIZE];
+	int        stack_size = 0;
+
+	float t_root;
+	if (!aabb_intersect(bvh.nodes[0].aabb, t_root)) return hit;
+
+	stack[stack_size++] = { 0, 0, t_root };
+
+	while (stack_size > 0) {
+		StackEntry entry = stack[--stack_size];
+		if (entry.t_near > hit.t) continue; // A closer hit was found since this Node was pushed
+
+		const BVHNode2 & node = bvh.nodes[entry.index];
+
+		if (node.is_leaf()) {
+			for (unsigned i = 0; i < node.count; i++) {
+				triangle_intersect(triangles, bvh.indices[node.first + i], ray, hit);
+			}
+			continue;
+		}
+
+		float t_left;
+		float t_right;
+		bool  hit_left  = aabb_intersect(bvh.nodes[node.left    ].aabb, t_left);
+		bool  hit_right = aabb_intersect(bvh.nodes[node.left + 1].aabb, t_right);
+
+		ASSERT(stack_size + 2 <= TRAVERSAL_STACK_SIZE);
+
+		// Push the far child first, so that the near child is visited first
+		if (hit_left && hit_right) {
+			if (t_left < t_right) {
+				stack[stack_size++] = { node.left + 1, 0, t_right };
+				stack[stack_size++] = { node.left,     0, t_left };
+			} else {
+				stack[stack_size++] = { node.left,     0, t_left };
+				stack[stack_size++] = { node.left + 1, 0, t_right };
+			}
+		} else if (hit_left) {
+			stack[stack_size++] = { node.left, 0, t_left };
+		} else if (hit_right) {
+			stack[stack_size++] = { node.left + 1, 0, t_right };
+		}
+	}
+
+	return hit;
+}
+
+// Loads 4 quantized bytes and widens them to floats
+static __m128 load_quantized(const byte quantized[4]) {
+	int packed;
+	memcpy(&packed, quantized, sizeof(int));
+
+	__m128i zero  = _mm_setzero_si128();
+	__m128i bytes = _mm_cvtsi32_si128(packed);
+
+	return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero));
+}
+
+// Slab test of the Ray against the 4 child AABBs of the Node, writes the entry distances and returns a bit mask of the children that were hit
+static unsigned bvh4_node_intersect(const BVHNode4 & node, const __m128 origin[3], const __m128 inv_direction[3], float t_max, float t_near[4]) {
+	const byte * quantized_min[3] = { node.quantized_min_x, node.quantized_min_y, node.quantized_min_z };
+	const byte * quantized_max[3] = { node.quantized_max_x, node.quantized_max_y, node.quantized_max_z };
+
+	__m128 t_enter = _mm_setzero_ps();
+	__m128 t_exit  = _mm_set1_ps(t_max);
+
+	for (int dimension = 0; dimension < 3; dimension++) {
+		// The scale is a power of two of which only the exponent bits are stored
+		__m128 scale = _mm_set1_ps(Util::bit_cast<float>(unsigned(node.e[dimension]) << 23));
+		__m128 p     = _mm_set1_ps(node.p[dimension]);
+
+		__m128 aabb_min = _mm_add_ps(p, _mm_mul_ps(load_quantized(quantized_min[dimension]), scale));
+		__m128 aabb_max = _mm_add_ps(p, _mm_mul_ps(load_quantized(quantized_max[dimension]), scale));
+
+		__m128 t0 = _mm_mul_ps(_mm_sub_ps(aabb_min, origin[dimension]), inv_direction[dimension]);
+		__m128 t1 = _mm_mul_ps(_mm_sub_ps(aabb_max, origin[dimension]), inv_direction[dimension]);
+
+		t_enter = _mm_max_ps(t_enter, _mm_min_ps(t0, t1));
+		t_exit  = _mm_min_ps(t_exit,  _mm_max_ps(t0, t1));
+	}
+
+	_mm_storeu_ps(t_near, t_enter);
+
+	unsigned child_mask = (1u << node.child_count) - 1;
+	return unsigned(_mm_movemask_ps(_mm_cmple_ps(t_enter, t_exit))) & child_mask;
+}
+
+BVHTraversal::Hit BVHTraversal::intersect(const BVH4 & bvh, const IndexedTriangles & triangles, const Ray & ray) {
+	Hit hit = { };
+	hit.t = ray.t_max;
+
+	Vector3 inv_direction = safe_inv_direction(ray.direction);
+
+	__m128 origin_simd[3] = {
+		_mm_set1_ps(ray.origin.x),
+		_mm_set1_ps(ray.origin.y),
+		_mm_set1_ps(ray.origin.z)
+	};
+	__m128 inv_direction_simd[3] = {
+		_mm_set1_ps(inv_direction.x),
+		_mm_set1_ps(inv_direction.y),
+		_mm_set1_ps(inv_direction.z)
+	};
+
+	StackEntry stack[TRAVERSAL_STACK_SIZE];
+	int        stack_size = 0;
+
+	// Node 1 is a dummy whose only child is the root, like the GPU this also handles a root that is a leaf
+	stack[stack_size++] = { 1, 0, 0.0f };
+
+	while (stack_size > 0) {
+		StackEntry entry = stack[--stack_size];
+		if (entry.t_near > hit.t) continue;
+
+		if (entry.count > 0) {
+			for (int i = 0; i < entry.count; i++) {
+				triangle_intersect(triangles, bvh.indices[entry.index + i], ray, hit);
+			}
+			continue;
+		}
+
+		const BVHNode4 & node = bvh.nodes[entry.index];
+
+		float    t_near[4];
+		unsigned hit_mask = bvh4_node_intersect(node, origin_simd, inv_direction_simd, hit.t, t_near);
+
+		hit.num_aabb_tests += node.child_count;
+
+		// Sort the children that were hit from far to near, so that the nearest ends up on top of the stack
+		StackEntry children[4];
+		int        child_count = 0;
+
+		for (int i = 0; i < 4; i++) {
+			if ((hit_mask & (1u << i)) == 0) continue;
+
+			StackEntry child = { node.index[i], node.count[i], t_near[i] };
+
+			int j = child_count++;
+			while (j > 0 && children[j - 1].t_near < child.t_near) {
+				children[j] = children[j - 1];
+				j--;
+			}
+			children[j] = child;
+		}
+
+		ASSERT(stack_size + child_count <= TRAVERSAL_STACK_SIZE);
+
+		for (int i = 0; i < child_count; i++) {
+			stack[stack_size++] = children[i];
+		}
+	}
+
+	return hit;
+}
+
+void BVHTraversal::intersect(const BVH2 & bvh, const IndexedTriangles & triangles, const Ray rays[], Hit hits[], int count) {
+	ThreadPool::parallel_for(0, count, TRAVERSAL_GRAIN_SIZE, [&](int first, int last) {
+		for (int i = first; i < last; i++) {
+			hits[i] = intersect(bvh, triangles, rays[i]);
+		}
+	});
+}
+
+void BVHTraversal::intersect(const BVH4 & bvh, const IndexedTriangles & triangles, const Ray rays[], Hit hits[], int count) {
+	ThreadPool::parallel_for(0, count, TRAVERSAL_GRAIN_SIZE, [&](int first, int last) {
+		for (int i = first; i < last; i++) {
+			hits[i] = intersect(bvh, triangles, rays[i]);
+		}
+	});
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include "BVH.h"
+
+// CPU traversal of the BLAS of a single Mesh, follows the same Node layouts and Triangle test as the kernels in CUDA/Raytracing
+// Serves as a reference to validate changes to GPU traversal against and to measure the quality of a BVH on actual Rays
+namespace BVHTraversal {
+	struct Ray {
+		Vector3 origin;
+		Vector3 direction;
+		float   t_max = INFINITY;
+	};
+
+	struct Hit {
+		float t = INFINITY;
+		float u = 0.0f;
+		float v = 0.0f;
+
+		int triangle_id = INVALID; // Index into the IndexedTriangles, INVALID if nothing was hit
+
+		int num_aabb_tests     = 0; // Child AABBs that were tested
+		int num_triangle_tests = 0;
+	};
+
+	Hit intersect(const BVH2 & bvh, const IndexedTriangles & triangles, const Ray & ray);
+	Hit intersect(const BVH4 & bvh, const IndexedTriangles & triangles, const Ray & ray); // Tests all 4 children of a Node at once using SSE2
+
+	// Traces rays[0] ... rays[count - 1] on the ThreadPool
+	void intersect(const BVH2 & bvh, const IndexedTriangles & triangles, const Ray rays[], Hit hits[], int count);
+	void intersect(const BVH4 & bvh, const IndexedTriangles & triangles, const Ray rays[], Hit hits[], int count);
+}
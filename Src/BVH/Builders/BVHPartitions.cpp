@@ -2,6 +2,7 @@
 
 #include "Renderer/Mesh.h"
 #include "Renderer/Triangle.h"
+#include "Renderer/Curve.h"
 
 // Evaluates SAH for every object for every dimension to determine splitting candidate
 template<typename GetAABB>
@@ -50,13 +51,20 @@ ObjectSplit partition_sah_impl(GetAABB get_aabb, int first_index, int index_coun
 	return split;
 }
 
-ObjectSplit BVHPartitions::partition_sah(const Array<Triangle> & triangles, int * indices[3], int first_index, int index_count, float * sah) {
+ObjectSplit BVHPartitions::partition_sah(const IndexedTriangles & triangles, int * indices[3], int first_index, int index_count, float * sah) {
 	auto get_aabb = [&triangles, &indices](int dimension, int index) {
 		return triangles[indices[dimension][index]].get_aabb();
 	};
 	return partition_sah_impl(get_aabb, first_index, index_count, sah);
 }
 
+ObjectSplit BVHPartitions::partition_sah(const Array<Curve> & curves, int * indices[3], int first_index, int index_count, float * sah) {
+	auto get_aabb = [&curves, &indices](int dimension, int index) {
+		return curves[indices[dimension][index]].get_aabb();
+	};
+	return partition_sah_impl(get_aabb, first_index, index_count, sah);
+}
+
 ObjectSplit BVHPartitions::partition_sah(const Array<Mesh> & meshes, int * indices[3], int first_index, int index_count, float * sah) {
 	auto get_aabb = [&meshes, &indices](int dimension, int index) {
 		return meshes[indices[dimension][index]].aabb;
@@ -64,6 +72,13 @@ ObjectSplit BVHPartitions::partition_sah(const Array<Mesh> & meshes, int * indic
 	return partition_sah_impl(get_aabb, first_index, index_count, sah);
 }
 
+ObjectSplit BVHPartitions::partition_sah(const Array<PrimitiveRef> & primitive_refs, int * indices[3], int first_index, int index_count, float * sah) {
+	auto get_aabb = [&primitive_refs, &indices](int dimension, int index) {
+		return primitive_refs[indices[dimension][index]].aabb;
+	};
+	return partition_sah_impl(get_aabb, first_index, index_count, sah);
+}
+
 ObjectSplit BVHPartitions::partition_sah(Array<PrimitiveRef> primitive_refs[3], int first_index, int index_count, float * sah) {
 	auto get_aabb = [&primitive_refs](int dimension, int index) {
 		return primitive_refs[dimension][index].aabb;
@@ -71,6 +86,117 @@ ObjectSplit BVHPartitions::partition_sah(Array<PrimitiveRef> primitive_refs[3],
 	return partition_sah_impl(get_aabb, first_index, index_count, sah);
 }
 
+ObjectSplit BVHPartitions::partition_binned_sah(const AABB * primitive_aabbs, const Vector3 * primitive_centers, int * indices, int first_index, int index_count) {
+	ObjectSplit split = { };
+	split.cost = INFINITY;
+	split.index     = -1;
+	split.dimension = -1;
+	split.aabb_left  = AABB::create_empty();
+	split.aabb_right = AABB::create_empty();
+
+	AABB centroid_aabb = AABB::create_empty();
+	for (int i = first_index; i < first_index + index_count; i++) {
+		centroid_aabb.expand(primitive_centers[indices[i]]);
+	}
+
+	// Bin index of a centroid, the same expression has to be used for binning and partitioning
+	auto get_bin = [&centroid_aabb](const Vector3 & center, int dimension, float scale) {
+		return Math::min(int((center[dimension] - centroid_aabb.min[dimension]) * scale), BINNED_SAH_BIN_COUNT - 1);
+	};
+
+	struct Bin {
+		AABB aabb  = AABB::create_empty();
+		int  count = 0;
+	} bins[3][BINNED_SAH_BIN_COUNT];
+
+	float scales[3];
+	for (int dimension = 0; dimension < 3; dimension++) {
+		float extent = centroid_aabb.max[dimension] - centroid_aabb.min[dimension];
+		scales[dimension] = extent > 0.0f ? float(BINNED_SAH_BIN_COUNT) / extent : 0.0f;
+	}
+
+	// All three dimensions are binned in a single pass over the primitives
+	for (int i = first_index; i < first_index + index_count; i++) {
+		int index = indices[i];
+
+		const AABB    & aabb   = primitive_aabbs  [index];
+		const Vector3 & center = primitive_centers[index];
+
+		for (int dimension = 0; dimension < 3; dimension++) {
+			Bin & bin = bins[dimension][get_bin(center, dimension, scales[dimension])];
+			bin.aabb.expand(aabb);
+			bin.count++;
+		}
+	}
+
+	int split_bin = -1;
+
+	for (int dimension = 0; dimension < 3; dimension++) {
+		if (scales[dimension] == 0.0f) continue;
+
+		// Sweep left to right to evaluate the first half of the SAH, then right to left for the second half
+		float sah_left  [BINNED_SAH_BIN_COUNT];
+		int   count_left[BINNED_SAH_BIN_COUNT];
+		AABB  aabb_left [BINNED_SAH_BIN_COUNT];
+
+		AABB aabb  = AABB::create_empty();
+		int  count = 0;
+		for (int b = 0; b < BINNED_SAH_BIN_COUNT - 1; b++) {
+			aabb.expand(bins[dimension][b].aabb);
+			count += bins[dimension][b].count;
+
+			sah_left  [b] = count > 0 ? aabb.surface_area() * float(count) : 0.0f;
+			count_left[b] = count;
+			aabb_left [b] = aabb;
+		}
+
+		aabb  = AABB::create_empty();
+		count = 0;
+		for (int b = BINNED_SAH_BIN_COUNT - 1; b > 0; b--) {
+			aabb.expand(bins[dimension][b].aabb);
+			count += bins[dimension][b].count;
+
+			if (count == 0 || count_left[b - 1] == 0) continue;
+
+			float cost = sah_left[b - 1] + aabb.surface_area() * float(count);
+			if (cost < split.cost) {
+				split.cost       = cost;
+				split.dimension  = dimension;
+				split.aabb_left  = aabb_left[b - 1];
+				split.aabb_right = aabb;
+
+				split_bin = b;
+			}
+		}
+	}
+
+	if (split.dimension == -1) {
+		// All centroids coincide, split in the middle
+		split.index     = first_index + index_count / 2;
+		split.dimension = 0;
+
+		for (int i = first_index; i < split.index;               i++) split.aabb_left .expand(primitive_aabbs[indices[i]]);
+		for (int i = split.index; i < first_index + index_count; i++) split.aabb_right.expand(primitive_aabbs[indices[i]]);
+
+		return split;
+	}
+
+	int left  = first_index;
+	int right = first_index + index_count - 1;
+	while (left <= right) {
+		if (get_bin(primitive_centers[indices[left]], split.dimension, scales[split.dimension]) < split_bin) {
+			left++;
+		} else {
+			Util::swap(indices[left], indices[right--]);
+		}
+	}
+	split.index = left;
+
+	ASSERT(split.index > first_index && split.index < first_index + index_count);
+
+	return split;
+}
+
 void BVHPartitions::triangle_intersect_plane(Vector3 vertices[3], int dimension, float plane, Vector3 intersections[], int * intersection_count) {
 	for (int i = 0; i < 3; i++) {
 		float vertex_i = vertices[i][dimension];
@@ -95,7 +221,7 @@ void BVHPartitions::triangle_intersect_plane(Vector3 vertices[3], int dimension,
 	}
 }
 
-SpatialSplit BVHPartitions::partition_spatial(const Array<Triangle> & triangles, const Array<PrimitiveRef> indices[3], int first_index, int index_count, float * sah, AABB bounds) {
+SpatialSplit BVHPartitions::partition_spatial(const IndexedTriangles & triangles, const Array<PrimitiveRef> indices[3], int first_index, int index_count, float * sah, AABB bounds) {
 	SpatialSplit split = { };
 	split.cost = INFINITY;
 	split.index     = -1;
@@ -6,12 +6,17 @@
 
 #include "Util/Util.h"
 
-struct Triangle;
+struct IndexedTriangles;
+struct Curve;
 struct Mesh;
 
 struct PrimitiveRef {
 	int  index;
 	AABB aabb;
+
+	// Allows building a BVH over PrimitiveRefs directly, see TrianglePresplitter
+	AABB    get_aabb()   const { return aabb; }
+	Vector3 get_center() const { return aabb.get_center(); }
 };
 
 struct ObjectSplit {
@@ -39,14 +44,21 @@ struct SpatialSplit {
 
 // Contains various ways to parition space into "left" and "right" as well as helper methods
 namespace BVHPartitions {
-	inline constexpr int SBVH_BIN_COUNT = 256;
+	inline constexpr int SBVH_BIN_COUNT       = 256;
+	inline constexpr int BINNED_SAH_BIN_COUNT = 32;
 
-	ObjectSplit partition_sah(const Array<Triangle> & triangles, int * indices[3], int first_index, int index_count, float * sah);
+	ObjectSplit partition_sah(const IndexedTriangles & triangles, int * indices[3], int first_index, int index_count, float * sah);
+	ObjectSplit partition_sah(const Array<Curve>    & curves,    int * indices[3], int first_index, int index_count, float * sah);
 	ObjectSplit partition_sah(const Array<Mesh>     & meshes,    int * indices[3], int first_index, int index_count, float * sah);
+	ObjectSplit partition_sah(const Array<PrimitiveRef> & primitive_refs, int * indices[3], int first_index, int index_count, float * sah);
 
 	ObjectSplit partition_sah(Array<PrimitiveRef> primitive_refs[3], int first_index, int index_count, float * sah);
 
+	// Binned SAH over the centroids of the primitives (Wald 2007), only evaluates a split between every pair of bins
+	// Does not require presorted indices, indices are partitioned in place and the returned index is the first one that goes right
+	ObjectSplit partition_binned_sah(const AABB * primitive_aabbs, const Vector3 * primitive_centers, int * indices, int first_index, int index_count);
+
 	void triangle_intersect_plane(Vector3 vertices[3], int dimension, float plane, Vector3 intersections[], int * intersection_count);
 
-	SpatialSplit partition_spatial(const Array<Triangle> & triangles, const Array<PrimitiveRef> indices[3], int first_index, int index_count, float * sah, AABB bounds);
+	SpatialSplit partition_spatial(const IndexedTriangles & triangles, const Array<PrimitiveRef> indices[3], int first_index, int index_count, float * sah, AABB bounds);
 }
@@ -0,0 +1,159 @@
+#include "BinnedSAHBuilder.h"
+
+#include "BVH/BVH.h"
+#include "BVHPartitions.h"
+
+#include "Renderer/Mesh.h"
+#include "Renderer/Curve.h"
+
+#include "Util/ThreadPool.h"
+
+// Subtrees are handed off to the ThreadPool once they contain at most this many primitives
+// NOTE: This depends only on the primitive count (not on the number of threads), so that the result is deterministic
+static int parallel_subtree_size(size_t primitive_count) {
+	return Math::max(int(primitive_count / BinnedSAHBuilder::PARALLEL_SUBTREE_MAX_COUNT), BinnedSAHBuilder::PARALLEL_SUBTREE_MIN_SIZE);
+}
+
+struct BinnedSubtree {
+	int node_index;
+	int first_index;
+	int index_count;
+};
+
+// State that is private to the thread building (part of) the tree
+struct BinnedContext {
+	const BinnedSAHBuilder & builder;
+	Array<BVHNode2>        & nodes;
+	int                    * indices;
+
+	Array<BinnedSubtree> * subtrees; // If not null, ranges of at most subtree_size primitives are deferred instead of built
+	int                    subtree_size;
+};
+
+static void build_bvh_recursive(BinnedContext & context, int node_index, int first_index, int index_count) {
+	if (context.subtrees && index_count <= context.subtree_size) {
+		context.subtrees->push_back({ node_index, first_index, index_count });
+		return;
+	}
+
+	if (index_count == 1) {
+		// Leaf Node, terminate recursion
+		// Like the SAHBuilder we always use 1 primitive per leaf,
+		// collapsing based on the SAH cost is left to BVHCollapser::collapse
+		BVHNode2 & node = context.nodes[node_index];
+		node.first = first_index;
+		node.count = index_count;
+
+		return;
+	}
+
+	ObjectSplit split = BVHPartitions::partition_binned_sah(context.builder.primitive_aabbs.data(), context.builder.primitive_centers.data(), context.indices, first_index, index_count);
+
+	int node_left_index = context.nodes.size();
+
+	BVHNode2 & node = context.nodes[node_index];
+	node.left  = node_left_index;
+	node.count = 0;
+	node.axis  = split.dimension;
+
+	context.nodes.emplace_back().aabb = split.aabb_left;
+	context.nodes.emplace_back().aabb = split.aabb_right;
+
+	int num_left  = split.index - first_index;
+	int num_right = index_count - num_left;
+
+	build_bvh_recursive(context, node_left_index,     first_index, num_left);
+	build_bvh_recursive(context, node_left_index + 1, split.index, num_right);
+}
+
+template<typename Primitives>
+static void build_bvh_impl(BinnedSAHBuilder & builder, const Primitives & primitives) {
+	ASSERT(builder.indices.size() == primitives.size());
+
+	builder.bvh.indices.clear();
+	builder.bvh.nodes.clear();
+	builder.bvh.nodes.reserve(2 * primitives.size()); // A binary tree over N leaves has at most 2N - 1 Nodes, plus the dummy
+	builder.bvh.nodes.emplace_back(); // Root
+	builder.bvh.nodes.emplace_back(); // Dummy
+
+	if (primitives.size() == 0) {
+		builder.bvh.nodes[0].aabb = AABB::create_empty();
+		return;
+	}
+
+	// The AABBs and centers are gathered once into contiguous arrays, binning only streams through these
+	ThreadPool::parallel_for(0, int(primitives.size()), 4096, [&](int first, int last) {
+		for (int i = first; i < last; i++) {
+			builder.indices[i] = i;
+			builder.primitive_aabbs  [i] = primitives[i].get_aabb();
+			builder.primitive_centers[i] = primitives[i].get_center();
+		}
+	});
+
+	AABB root_aabb = AABB::create_empty();
+	for (size_t i = 0; i < primitives.size(); i++) {
+		root_aabb.expand(builder.primitive_aabbs[i]);
+	}
+	builder.bvh.nodes[0].aabb = root_aabb;
+
+	int subtree_size = parallel_subtree_size(primitives.size());
+	if (int(primitives.size()) <= subtree_size) {
+		BinnedContext context = { builder, builder.bvh.nodes, builder.indices.data(), nullptr, 0 };
+		build_bvh_recursive(context, 0, 0, primitives.size());
+	} else {
+		// Build the upper levels of the tree on this thread, deferring the subtrees below
+		// Every subtree covers a disjoint range of the indices, so subtrees can be built independently
+		Array<BinnedSubtree> subtrees;
+		BinnedContext context = { builder, builder.bvh.nodes, builder.indices.data(), &subtrees, subtree_size };
+		build_bvh_recursive(context, 0, 0, primitives.size());
+
+		Array<Array<BVHNode2>> subtree_nodes(subtrees.size());
+
+		ThreadPool::parallel_for(subtrees.size(), [&](int i) {
+			const BinnedSubtree & subtree = subtrees[i];
+
+			Array<BVHNode2> & nodes = subtree_nodes[i];
+			nodes.reserve(2 * subtree.index_count);
+			nodes.push_back(builder.bvh.nodes[subtree.node_index]);
+
+			BinnedContext subtree_context = { builder, nodes, builder.indices.data(), nullptr, 0 };
+			build_bvh_recursive(subtree_context, 0, subtree.first_index, subtree.index_count);
+		});
+
+		// Append subtrees in a fixed order so the resulting layout does not depend on scheduling
+		for (size_t i = 0; i < subtrees.size(); i++) {
+			const Array<BVHNode2> & nodes = subtree_nodes[i];
+
+			// Local Node 0 replaces the subtree root, local Node 1 ends up at the current end of the BVH
+			int offset = int(builder.bvh.nodes.size()) - 1;
+
+			for (size_t j = 1; j < nodes.size(); j++) {
+				BVHNode2 & node = builder.bvh.nodes.push_back(nodes[j]);
+				if (!node.is_leaf()) node.left += offset;
+			}
+
+			BVHNode2 & root = builder.bvh.nodes[subtrees[i].node_index];
+			root = nodes[0];
+			if (!root.is_leaf()) root.left += offset;
+		}
+	}
+	ASSERT(builder.bvh.nodes.size() <= 2 * primitives.size());
+
+	builder.bvh.indices = builder.indices; // NOTE: copy!
+}
+
+void BinnedSAHBuilder::build(const IndexedTriangles & triangles) {
+	return build_bvh_impl(*this, triangles);
+}
+
+void BinnedSAHBuilder::build(const Array<Curve> & curves) {
+	return build_bvh_impl(*this, curves);
+}
+
+void BinnedSAHBuilder::build(const Array<Mesh> & meshes) {
+	return build_bvh_impl(*this, meshes);
+}
+
+void BinnedSAHBuilder::build(const Array<PrimitiveRef> & primitive_refs) {
+	return build_bvh_impl(*this, primitive_refs);
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "BVH/BVH.h"
+
+struct IndexedTriangles;
+struct Curve;
+struct Mesh;
+struct PrimitiveRef;
+
+// Binned SAH, see Wald 2007
+// Splits are only evaluated at a fixed number of bins over the centroid bounds and indices are partitioned in place,
+// so unlike the SAHBuilder no presorted index arrays are needed. Much faster to build on large meshes, slightly lower quality
+struct BinnedSAHBuilder {
+	static constexpr int PARALLEL_SUBTREE_MIN_SIZE  = 8192; // Subtrees smaller than this are not worth a separate job
+	static constexpr int PARALLEL_SUBTREE_MAX_COUNT = 64;
+
+	BVH2 & bvh;
+
+	Array<int>     indices;
+	Array<AABB>    primitive_aabbs;
+	Array<Vector3> primitive_centers;
+
+	BinnedSAHBuilder(BVH2 & bvh, size_t primitive_count) :
+		bvh(bvh),
+		indices(primitive_count),
+		primitive_aabbs(primitive_count),
+		primitive_centers(primitive_count)
+	{
+		bvh.nodes.reserve(2 * primitive_count);
+	}
+
+	void build(const IndexedTriangles    & triangles);
+	void build(const Array<Curve>        & curves);
+	void build(const Array<Mesh>         & meshes);
+	void build(const Array<PrimitiveRef> & primitive_refs);
+};
@@ -0,0 +1,171 @@
+#include "LBVHBuilder.h"
+
+#include "Core/Sort.h"
+
+#include "BVH/BVH.h"
+#include "BVHPartitions.h"
+
+#include "Renderer/Mesh.h"
+#include "Renderer/Curve.h"
+
+// Spreads the lower 10 bits of x so that there are two zero bits between every bit
+static unsigned morton_expand_bits(unsigned x) {
+	x = (x * 0x00010001u) & 0xff0000ffu;
+	x = (x * 0x00000101u) & 0x0f00f00fu;
+	x = (x * 0x00000011u) & 0xc30c30c3u;
+	x = (x * 0x00000005u) & 0x49249249u;
+	return x;
+}
+
+// Interleaves the bits of a point in [0, 1]^3 into a 30 bit Morton code (x occupies the most significant bit of every triplet)
+static unsigned morton_code(const Vector3 & point) {
+	unsigned x = unsigned(Math::clamp(point.x * 1024.0f, 0.0f, 1023.0f));
+	unsigned y = unsigned(Math::clamp(point.y * 1024.0f, 0.0f, 1023.0f));
+	unsigned z = unsigned(Math::clamp(point.z * 1024.0f, 0.0f, 1023.0f));
+
+	return (morton_expand_bits(x) << 2) | (morton_expand_bits(y) << 1) | morton_expand_bits(z);
+}
+
+static int highest_set_bit(unsigned x) {
+	int bit = -1;
+	while (x) {
+		x >>= 1;
+		bit++;
+	}
+	return bit;
+}
+
+static AABB build_bvh_recursive(LBVHBuilder & builder, int node_index, const AABB * primitive_aabbs, int first_index, int index_count) {
+	if (index_count == 1) {
+		// Leaf Node, terminate recursion
+		// Like the SAHBuilder we always use 1 primitive per leaf,
+		// collapsing based on the SAH cost is left to BVHCollapser::collapse
+		BVHNode2 & node = builder.bvh.nodes[node_index];
+		node.first = first_index;
+		node.count = index_count;
+		node.aabb  = primitive_aabbs[builder.indices[first_index]];
+
+		return node.aabb;
+	}
+
+	const int      * indices = builder.indices.data();
+	const unsigned * codes   = builder.morton_codes.data();
+
+	int last_index = first_index + index_count - 1;
+
+	unsigned code_first = codes[indices[first_index]];
+	unsigned code_last  = codes[indices[last_index]];
+
+	int split_index;
+	int split_axis = INVALID;
+
+	if (code_first == code_last) {
+		// All primitives in this range map to the same Morton cell, split in the middle
+		split_index = first_index + index_count / 2;
+	} else {
+		// All codes in the range share the bits above the highest differing bit,
+		// binary search for the first primitive that has the differing bit set
+		int bit = highest_set_bit(code_first ^ code_last);
+
+		int lo = first_index;
+		int hi = last_index;
+		while (lo < hi) {
+			int mid = (lo + hi) / 2;
+			if ((codes[indices[mid]] >> bit) & 1) {
+				hi = mid;
+			} else {
+				lo = mid + 1;
+			}
+		}
+		split_index = lo;
+		split_axis  = 2 - bit % 3;
+	}
+
+	ASSERT(split_index > first_index && split_index <= last_index);
+
+	int node_left_index = builder.bvh.nodes.size();
+	builder.bvh.nodes.emplace_back();
+	builder.bvh.nodes.emplace_back();
+
+	int num_left  = split_index - first_index;
+	int num_right = index_count - num_left;
+
+	AABB aabb_left  = build_bvh_recursive(builder, node_left_index,     primitive_aabbs, first_index, num_left);
+	AABB aabb_right = build_bvh_recursive(builder, node_left_index + 1, primitive_aabbs, split_index, num_right);
+
+	BVHNode2 & node = builder.bvh.nodes[node_index];
+	node.aabb  = AABB::unify(aabb_left, aabb_right);
+	node.left  = node_left_index;
+	node.count = 0;
+
+	if (split_axis == INVALID) {
+		// Middle split, use the axis along which the children are furthest apart
+		Vector3 delta = aabb_right.get_center() - aabb_left.get_center();
+		split_axis = 0;
+		if (fabsf(delta.y) > fabsf(delta[split_axis])) split_axis = 1;
+		if (fabsf(delta.z) > fabsf(delta[split_axis])) split_axis = 2;
+	}
+	node.axis = split_axis;
+
+	return node.aabb;
+}
+
+template<typename Primitives>
+static void build_bvh_impl(LBVHBuilder & builder, const Primitives & primitives) {
+	builder.bvh.indices.clear();
+	builder.bvh.nodes.clear();
+	builder.bvh.nodes.reserve(2 * primitives.size()); // A binary tree over N leaves has at most 2N - 1 Nodes, plus the dummy
+	builder.bvh.nodes.emplace_back(); // Root
+	builder.bvh.nodes.emplace_back(); // Dummy
+
+	if (primitives.size() == 0) {
+		builder.bvh.nodes[0].aabb = AABB::create_empty();
+		return;
+	}
+
+	Array<AABB> primitive_aabbs(primitives.size());
+
+	AABB centroid_aabb = AABB::create_empty();
+	for (size_t i = 0; i < primitives.size(); i++) {
+		primitive_aabbs[i] = primitives[i].get_aabb();
+		centroid_aabb.expand(primitives[i].get_center());
+	}
+
+	Vector3 centroid_extent = centroid_aabb.max - centroid_aabb.min;
+	Vector3 centroid_scale  = Vector3(
+		centroid_extent.x > 0.0f ? 1.0f / centroid_extent.x : 0.0f,
+		centroid_extent.y > 0.0f ? 1.0f / centroid_extent.y : 0.0f,
+		centroid_extent.z > 0.0f ? 1.0f / centroid_extent.z : 0.0f
+	);
+
+	for (size_t i = 0; i < primitives.size(); i++) {
+		builder.morton_codes[i] = morton_code((primitives[i].get_center() - centroid_aabb.min) * centroid_scale);
+	}
+
+	{
+		// Morton codes use 30 bits, so 11 bit digits sort them in 3 passes
+		const unsigned * codes = builder.morton_codes.data();
+		Sort::radix_sort_parallel<11>(builder.indices.begin(), builder.indices.end(), [codes](int index) { return codes[index]; });
+	}
+
+	build_bvh_recursive(builder, 0, primitive_aabbs.data(), 0, primitives.size());
+	ASSERT(builder.bvh.nodes.size() <= 2 * primitives.size());
+
+	builder.bvh.indices = builder.indices; // NOTE: copy!
+}
+
+void LBVHBuilder::build(const IndexedTriangles & triangles) {
+	return build_bvh_impl(*this, triangles);
+}
+
+void LBVHBuilder::build(const Array<Curve> & curves) {
+	return build_bvh_impl(*this, curves);
+}
+
+void LBVHBuilder::build(const Array<Mesh> & meshes) {
+	return build_bvh_impl(*this, meshes);
+}
+
+void LBVHBuilder::build(const Array<PrimitiveRef> & primitive_refs) {
+	return build_bvh_impl(*this, primitive_refs);
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include "BVH/BVH.h"
+
+struct IndexedTriangles;
+struct Curve;
+struct Mesh;
+struct PrimitiveRef;
+
+// Linear BVH, see Karras 2012
+// Primitives are sorted along a Morton curve and split at the highest differing bit,
+// this is much faster to build than a full SAH sweep at the cost of some tree quality
+struct LBVHBuilder {
+	BVH2 & bvh;
+
+	Array<int>      indices;
+	Array<unsigned> morton_codes;
+
+	LBVHBuilder(BVH2 & bvh, size_t primitive_count) :
+		bvh(bvh),
+		indices(primitive_count),
+		morton_codes(primitive_count)
+	{
+		for (int i = 0; i < primitive_count; i++) {
+			indices[i] = i;
+		}
+
+		bvh.nodes.reserve(2 * primitive_count);
+	}
+
+	void build(const IndexedTriangles & triangles);
+	void build(const Array<Curve>     & curves);
+	void build(const Array<Mesh>      & meshes);
+	void build(const Array<PrimitiveRef> & primitive_refs);
+};
@@ -8,36 +8,66 @@
 #include "BVHPartitions.h"
 
 #include "Renderer/Mesh.h"
+#include "Renderer/Curve.h"
+
+#include "Util/ThreadPool.h"
+
+// Subtrees are handed off to the ThreadPool once they contain at most this many primitives
+// NOTE: This depends only on the primitive count (not on the number of threads), so that the result is deterministic
+static int parallel_subtree_size(size_t primitive_count) {
+	return Math::max(int(primitive_count / SAHBuilder::PARALLEL_SUBTREE_MAX_COUNT), SAHBuilder::PARALLEL_SUBTREE_MIN_SIZE);
+}
+
+struct SAHSubtree {
+	int node_index;
+	int first_index;
+	int index_count;
+};
+
+// State that is private to the thread building (part of) the tree
+struct SAHContext {
+	Array<BVHNode2> & nodes;
+	char            * scratch;
+	BitArray        & indices_going_left;
+
+	Array<SAHSubtree> * subtrees; // If not null, ranges of at most subtree_size primitives are deferred instead of built
+	int                 subtree_size;
+};
+
+template<typename Primitives>
+static void build_bvh_recursive(SAHContext & context, int node_index, const Primitives & primitives, int * indices[3], int first_index, int index_count) {
+	if (context.subtrees && index_count <= context.subtree_size) {
+		context.subtrees->push_back({ node_index, first_index, index_count });
+		return;
+	}
 
-template<typename Primitive>
-static void build_bvh_recursive(SAHBuilder & builder, BVHNode2 & node, const Array<Primitive> & primitives, int * indices[3], int first_index, int index_count) {
 	if (index_count == 1) {
 		// Leaf Node, terminate recursion
 		// We do not terminate based on the SAH termination criterion, so that the
 		// BVHs that are cached to disk have a standard layout (1 triangle per leaf node)
 		// If desired these trees can be collapsed based on the SAH cost using BVHCollapser::collapse
-		node.first = first_index;
-		node.count = index_count;
+		context.nodes[node_index].first = first_index;
+		context.nodes[node_index].count = index_count;
 
 		return;
 	}
 
-	ObjectSplit split = BVHPartitions::partition_sah(primitives, indices, first_index, index_count, new(builder.scratch.data()) float[index_count]);
+	ObjectSplit split = BVHPartitions::partition_sah(primitives, indices, first_index, index_count, new(context.scratch) float[index_count]);
 
-	for (int i = first_index; i < split.index;               i++) builder.indices_going_left[indices[split.dimension][i]] = true;
-	for (int i = split.index; i < first_index + index_count; i++) builder.indices_going_left[indices[split.dimension][i]] = false;
+	for (int i = first_index; i < split.index;               i++) context.indices_going_left[indices[split.dimension][i]] = true;
+	for (int i = split.index; i < first_index + index_count; i++) context.indices_going_left[indices[split.dimension][i]] = false;
 
 	for (int dim = 0; dim < 3; dim++) {
 		if (dim == split.dimension) continue;
 
 		int left  = 0;
 		int right = split.index - first_index;
-		int * temp = new(builder.scratch.data()) int[index_count];
+		int * temp = new(context.scratch) int[index_count];
 
 		for (int i = first_index; i < first_index + index_count; i++) {
 			int index = indices[dim][i];
 
-			bool goes_left = builder.indices_going_left[index];
+			bool goes_left = context.indices_going_left[index];
 			if (goes_left) {
 				temp[left++] = index;
 			} else {
@@ -50,26 +80,28 @@ static void build_bvh_recursive(SAHBuilder & builder, BVHNode2 & node, const Arr
 		memcpy(indices[dim] + first_index, temp, index_count * sizeof(int));
 	}
 
-	node.left = builder.bvh.nodes.size();
+	int node_left_index = context.nodes.size();
+
+	BVHNode2 & node = context.nodes[node_index];
+	node.left  = node_left_index;
 	node.count = 0;
 	node.axis  = split.dimension;
 
-	BVHNode2 & node_left  = builder.bvh.nodes.emplace_back();
-	BVHNode2 & node_right = builder.bvh.nodes.emplace_back();
-	node_left .aabb = split.aabb_left;
-	node_right.aabb = split.aabb_right;
+	context.nodes.emplace_back().aabb = split.aabb_left;
+	context.nodes.emplace_back().aabb = split.aabb_right;
 
 	int num_left  = split.index - first_index;
 	int num_right = first_index + index_count - split.index;
 
-	build_bvh_recursive(builder, node_left,  primitives, indices, first_index,            num_left);
-	build_bvh_recursive(builder, node_right, primitives, indices, first_index + num_left, num_right);
+	build_bvh_recursive(context, node_left_index,     primitives, indices, first_index,            num_left);
+	build_bvh_recursive(context, node_left_index + 1, primitives, indices, first_index + num_left, num_right);
 }
 
-template<typename Primitive>
-static void build_bvh_impl(SAHBuilder & builder, const Array<Primitive> & primitives) {
+template<typename Primitives>
+static void build_bvh_impl(SAHBuilder & builder, const Primitives & primitives) {
 	builder.bvh.indices.clear();
 	builder.bvh.nodes.clear();
+	builder.bvh.nodes.reserve(2 * primitives.size()); // A binary tree over N leaves has at most 2N - 1 Nodes, plus the dummy
 	builder.bvh.nodes.emplace_back(); // Root
 	builder.bvh.nodes.emplace_back(); // Dummy
 
@@ -79,26 +111,73 @@ static void build_bvh_impl(SAHBuilder & builder, const Array<Primitive> & primit
 	}
 	builder.bvh.nodes[0].aabb = root_aabb;
 
-	{
-		Array<int> radix_sort_tmp = Array<int>(primitives.size());
-
-		Sort::radix_sort(builder.indices_x.begin(), builder.indices_x.end(), radix_sort_tmp.data(), [&primitives](int index) { return Sort::RadixSortAdapter<float>()(primitives[index].get_center().x); });
-		Sort::radix_sort(builder.indices_y.begin(), builder.indices_y.end(), radix_sort_tmp.data(), [&primitives](int index) { return Sort::RadixSortAdapter<float>()(primitives[index].get_center().y); });
-		Sort::radix_sort(builder.indices_z.begin(), builder.indices_z.end(), radix_sort_tmp.data(), [&primitives](int index) { return Sort::RadixSortAdapter<float>()(primitives[index].get_center().z); });
-	}
+	Sort::radix_sort_parallel(builder.indices_x.begin(), builder.indices_x.end(), [&primitives](int index) { return Sort::RadixSortAdapter<float>()(primitives[index].get_center().x); });
+	Sort::radix_sort_parallel(builder.indices_y.begin(), builder.indices_y.end(), [&primitives](int index) { return Sort::RadixSortAdapter<float>()(primitives[index].get_center().y); });
+	Sort::radix_sort_parallel(builder.indices_z.begin(), builder.indices_z.end(), [&primitives](int index) { return Sort::RadixSortAdapter<float>()(primitives[index].get_center().z); });
 
 	int * indices[3] = { builder.indices_x.data(), builder.indices_y.data(), builder.indices_z.data() };
 
-	build_bvh_recursive(builder, builder.bvh.nodes[0], primitives, indices, 0, primitives.size());
+	int subtree_size = parallel_subtree_size(primitives.size());
+	if (int(primitives.size()) <= subtree_size) {
+		SAHContext context = { builder.bvh.nodes, builder.scratch.data(), builder.indices_going_left, nullptr, 0 };
+		build_bvh_recursive(context, 0, primitives, indices, 0, primitives.size());
+	} else {
+		// Build the upper levels of the tree on this thread, deferring the subtrees below
+		Array<SAHSubtree> subtrees;
+		SAHContext context = { builder.bvh.nodes, builder.scratch.data(), builder.indices_going_left, &subtrees, subtree_size };
+		build_bvh_recursive(context, 0, primitives, indices, 0, primitives.size());
+
+		// Every subtree covers a disjoint range of the index arrays, so subtrees can be built independently.
+		// Each subtree gets its own Nodes, scratch memory and BitArray and is appended to the BVH afterwards
+		Array<Array<BVHNode2>> subtree_nodes(subtrees.size());
+
+		ThreadPool::parallel_for(subtrees.size(), [&](int i) {
+			const SAHSubtree & subtree = subtrees[i];
+
+			Array<BVHNode2> & nodes = subtree_nodes[i];
+			nodes.reserve(2 * subtree.index_count);
+			nodes.push_back(builder.bvh.nodes[subtree.node_index]);
+
+			BitArray indices_going_left(primitives.size(), ThreadPool::task_allocator());
+
+			SAHContext subtree_context = { nodes, builder.scratch.data() + subtree.first_index * SAHBuilder::SCRATCH_STRIDE, indices_going_left, nullptr, 0 };
+			build_bvh_recursive(subtree_context, 0, primitives, indices, subtree.first_index, subtree.index_count);
+		});
+
+		// Append subtrees in a fixed order so the resulting layout does not depend on scheduling
+		for (size_t i = 0; i < subtrees.size(); i++) {
+			const Array<BVHNode2> & nodes = subtree_nodes[i];
+
+			// Local Node 0 replaces the subtree root, local Node 1 ends up at the current end of the BVH
+			int offset = int(builder.bvh.nodes.size()) - 1;
+
+			for (size_t j = 1; j < nodes.size(); j++) {
+				BVHNode2 & node = builder.bvh.nodes.push_back(nodes[j]);
+				if (!node.is_leaf()) node.left += offset;
+			}
+
+			BVHNode2 & root = builder.bvh.nodes[subtrees[i].node_index];
+			root = nodes[0];
+			if (!root.is_leaf()) root.left += offset;
+		}
+	}
 	ASSERT(builder.bvh.nodes.size() <= 2 * primitives.size());
 
 	builder.bvh.indices = builder.indices_x; // NOTE: copy!
 }
 
-void SAHBuilder::build(const Array<Triangle> & triangles) {
+void SAHBuilder::build(const IndexedTriangles & triangles) {
 	return build_bvh_impl(*this, triangles);
 }
 
+void SAHBuilder::build(const Array<Curve> & curves) {
+	return build_bvh_impl(*this, curves);
+}
+
 void SAHBuilder::build(const Array<Mesh> & meshes) {
 	return build_bvh_impl(*this, meshes);
 }
+
+void SAHBuilder::build(const Array<PrimitiveRef> & primitive_refs) {
+	return build_bvh_impl(*this, primitive_refs);
+}
@@ -1,12 +1,23 @@
 #pragma once
 #include "Core/BitArray.h"
 
+#include "Core/Allocators/LargePageAllocator.h"
+
 #include "BVH/BVH.h"
 
-struct Triangle;
+#include "Util/ThreadPool.h"
+
+struct IndexedTriangles;
+struct Curve;
 struct Mesh;
+struct PrimitiveRef;
 
 struct SAHBuilder {
+	static constexpr int PARALLEL_SUBTREE_MIN_SIZE  = 8192; // Subtrees smaller than this are not worth a separate job
+	static constexpr int PARALLEL_SUBTREE_MAX_COUNT = 64;
+
+	static constexpr size_t SCRATCH_STRIDE = Math::max(sizeof(float), sizeof(int));
+
 	BVH2 & bvh;
 
 	Array<int> indices_x;
@@ -18,21 +29,23 @@ struct SAHBuilder {
 
 	SAHBuilder(BVH2 & bvh, size_t primitive_count) :
 		bvh(bvh),
-		indices_x(primitive_count),
-		indices_y(primitive_count),
-		indices_z(primitive_count),
-		scratch(primitive_count * Math::max(sizeof(float), sizeof(int))),
+		indices_x(LargePageAllocator::select(nullptr)),
+		indices_y(LargePageAllocator::select(nullptr)),
+		indices_z(LargePageAllocator::select(nullptr)),
+		scratch  (LargePageAllocator::select(nullptr)),
 		indices_going_left(primitive_count)
 	{
-		for (int i = 0; i < primitive_count; i++) {
-			indices_x[i] = i;
-			indices_y[i] = i;
-			indices_z[i] = i;
-		}
+		// Initialized on the ThreadPool, so that on NUMA machines the pages are spread over the nodes of the workers that build the subtrees
+		ThreadPool::parallel_init(indices_x, primitive_count, [](int i) { return i; });
+		ThreadPool::parallel_init(indices_y, primitive_count, [](int i) { return i; });
+		ThreadPool::parallel_init(indices_z, primitive_count, [](int i) { return i; });
+		ThreadPool::parallel_init(scratch,   primitive_count * SCRATCH_STRIDE, [](int i) { return char(0); });
 
 		bvh.nodes.reserve(2 * primitive_count);
 	}
 
-	void build(const Array<Triangle> & triangles);
-	void build(const Array<Mesh>     & meshes);
+	void build(const IndexedTriangles & triangles);
+	void build(const Array<Curve>     & curves);
+	void build(const Array<Mesh>      & meshes);
+	void build(const Array<PrimitiveRef> & primitive_refs);
 };
@@ -9,7 +9,9 @@
 
 #include "BVHPartitions.h"
 
-void SBVHBuilder::build(const Array<Triangle> & triangles) {
+#include "Util/ThreadPool.h"
+
+void SBVHBuilder::build(const IndexedTriangles & triangles) {
 	IO::print("Construcing SBVH, this may take a few seconds for large Meshes...\n"_sv);
 
 	AABB root_aabb = AABB::create_empty();
@@ -23,12 +25,7 @@ void SBVHBuilder::build(const Array<Triangle> & triangles) {
 		indices[1][i].index = int(i);
 		indices[2][i].index = int(i);
 
-		Vector3 vertices[3] = {
-			triangles[i].position_0,
-			triangles[i].position_1,
-			triangles[i].position_2
-		};
-		AABB aabb = AABB::from_points(vertices, 3);
+		AABB aabb = triangles[i].get_aabb();
 
 		indices[0][i].aabb = aabb;
 		indices[1][i].aabb = aabb;
@@ -53,18 +50,100 @@ void SBVHBuilder::build(const Array<Triangle> & triangles) {
 	sbvh.nodes.emplace_back(); // Dummy
 	sbvh.nodes[0].aabb = root_aabb;
 
-	int index_count = build_sbvh(0, triangles, 0, triangles.size());
+	// NOTE: The subtree size depends only on the Triangle count (not on the number of threads), so that the result is deterministic
+	int parallel_subtree_size = Math::max(int(triangles.size() / PARALLEL_SUBTREE_MAX_COUNT), PARALLEL_SUBTREE_MIN_SIZE);
 
-	sbvh.indices.resize(index_count);
-	for (int i = 0; i < index_count; i++) {
-		int index = indices[0][i].index;
-		ASSERT(index >= 0 && index < triangles.size());
+	if (int(triangles.size()) <= parallel_subtree_size) {
+		int index_count = build_sbvh(0, triangles, 0, triangles.size());
+
+		sbvh.indices.resize(index_count);
+		for (int i = 0; i < index_count; i++) {
+			int index = indices[0][i].index;
+			ASSERT(index >= 0 && index < triangles.size());
+
+			sbvh.indices[i] = index;
+		}
+	} else {
+		// Build the upper levels of the tree on this thread, the deferred subtrees own copies of their references
+		subtree_size = parallel_subtree_size;
+		build_sbvh(0, triangles, 0, triangles.size());
+
+		ThreadPool::parallel_for(subtrees.size(), [this, &triangles](int i) {
+			build_subtree(subtrees[i], triangles);
+		});
+
+		// Append subtrees in a fixed order so the resulting layout does not depend on scheduling
+		sbvh.indices.clear();
+
+		for (size_t i = 0; i < subtrees.size(); i++) {
+			const BVH2 & subtree_bvh = subtrees[i].bvh;
+
+			// Local Node 0 replaces the subtree root, local Node 1 ends up at the current end of the SBVH
+			int node_offset  = int(sbvh.nodes.size()) - 1;
+			int index_offset = int(sbvh.indices.size());
+
+			for (size_t j = 1; j < subtree_bvh.nodes.size(); j++) {
+				BVHNode2 & node = sbvh.nodes.push_back(subtree_bvh.nodes[j]);
+				if (node.is_leaf()) {
+					node.first += index_offset;
+				} else {
+					node.left += node_offset;
+				}
+			}
+
+			BVHNode2 & root = sbvh.nodes[subtrees[i].node_index];
+			root = subtree_bvh.nodes[0];
+			if (root.is_leaf()) {
+				root.first += index_offset;
+			} else {
+				root.left += node_offset;
+			}
+
+			for (size_t j = 0; j < subtree_bvh.indices.size(); j++) {
+				sbvh.indices.push_back(subtree_bvh.indices[j]);
+			}
+		}
+
+		subtrees = { };
+	}
+}
+
+void SBVHBuilder::build_subtree(Subtree & subtree, const IndexedTriangles & triangles) const {
+	int reference_count = int(subtree.indices[0].size());
+
+	// Every subtree gets its own builder, and thus its own scratch memory
+	SBVHBuilder builder(subtree.bvh, triangles.size());
+	builder.inv_root_surface_area = inv_root_surface_area; // Spatial splits are considered relative to the root of the whole SBVH
+
+	for (int dimension = 0; dimension < 3; dimension++) {
+		builder.indices[dimension] = std::move(subtree.indices[dimension]);
+	}
 
-		sbvh.indices[i] = index;
+	subtree.bvh.nodes.reserve(2 * reference_count);
+	subtree.bvh.nodes.push_back(sbvh.nodes[subtree.node_index]);
+
+	int index_count = builder.build_sbvh(0, triangles, 0, reference_count);
+
+	subtree.bvh.indices.resize(index_count);
+	for (int i = 0; i < index_count; i++) {
+		subtree.bvh.indices[i] = builder.indices[0][i].index;
 	}
 }
 
-int SBVHBuilder::build_sbvh(int node_index, const Array<Triangle> & triangles, int first_index, int index_count) {
+int SBVHBuilder::build_sbvh(int node_index, const IndexedTriangles & triangles, int first_index, int index_count) {
+	if (subtree_size != INVALID && index_count <= subtree_size) {
+		// Defer to the ThreadPool, the subtree does not occupy any references in this builder
+		Subtree & subtree = subtrees.emplace_back();
+		subtree.node_index = node_index;
+
+		for (int dimension = 0; dimension < 3; dimension++) {
+			subtree.indices[dimension].resize(index_count);
+			memcpy(subtree.indices[dimension].data(), indices[dimension].data() + first_index, index_count * sizeof(PrimitiveRef));
+		}
+
+		return 0;
+	}
+
 	if (index_count == 1) {
 		// Leaf Node, terminate recursion
 		// We do not terminate based on the SAH termination criterion, so that the
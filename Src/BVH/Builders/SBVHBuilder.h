@@ -8,6 +8,9 @@
 struct PrimitiveRef;
 
 struct SBVHBuilder {
+	static constexpr int PARALLEL_SUBTREE_MIN_SIZE  = 8192; // Subtrees smaller than this are not worth a separate job
+	static constexpr int PARALLEL_SUBTREE_MAX_COUNT = 64;
+
 	BVH2 & sbvh;
 
 	Array<PrimitiveRef> indices[3];
@@ -18,10 +21,21 @@ struct SBVHBuilder {
 
 	float inv_root_surface_area;
 
+	// Subtrees that are deferred to the ThreadPool, Node 0 of each subtree BVH replaces sbvh.nodes[node_index]
+	struct Subtree {
+		int                 node_index;
+		Array<PrimitiveRef> indices[3];
+		BVH2                bvh;
+	};
+	int            subtree_size = INVALID; // If set, ranges of at most this many references are deferred instead of built
+	Array<Subtree> subtrees;
+
 	SBVHBuilder(BVH2 & sbvh, size_t triangle_count) : sbvh(sbvh), sah(triangle_count), indices_going_left(triangle_count) { }
 
-	void build(const Array<Triangle> & triangles); // SAH-based object + spatial splits, Stich et al. 2009 (Triangles only)
+	void build(const IndexedTriangles & triangles); // SAH-based object + spatial splits, Stich et al. 2009 (Triangles only)
 
 private:
-	int build_sbvh(int node_index, const Array<Triangle> & triangles, int first_index, int index_count);
+	int build_sbvh(int node_index, const IndexedTriangles & triangles, int first_index, int index_count);
+
+	void build_subtree(Subtree & subtree, const IndexedTriangles & triangles) const;
 };
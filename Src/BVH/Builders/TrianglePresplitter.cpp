@@ -0,0 +1,104 @@
+#include "TrianglePresplitter.h"
+
+#include "Renderer/Triangle.h"
+
+#include "Util/ThreadPool.h"
+
+// Surface area of the AABB that exceeds that of an axis aligned Triangle of the same area
+static float triangle_wasted_area(const Triangle & triangle) {
+	float area = 0.5f * Vector3::length(Vector3::cross(triangle.position_1 - triangle.position_0, triangle.position_2 - triangle.position_0));
+	return Math::max(triangle.get_aabb().surface_area() - 4.0f * area, 0.0f);
+}
+
+// Recursively splits the AABB of a Triangle reference in the middle of its longest axis, until split_count references are created
+static void split_reference(const Triangle & triangle, int index, const AABB & aabb, int split_count, Array<PrimitiveRef> & result) {
+	if (split_count <= 1) {
+		result.emplace_back(index, aabb);
+		return;
+	}
+
+	Vector3 extent = aabb.max - aabb.min;
+
+	int dimension = 0;
+	if (extent.y > extent[dimension]) dimension = 1;
+	if (extent.z > extent[dimension]) dimension = 2;
+
+	float plane = aabb.min[dimension] + 0.5f * extent[dimension];
+
+	Vector3 vertices[3] = { triangle.position_0, triangle.position_1, triangle.position_2 };
+
+	Vector3 intersections[6];
+	int     intersection_count = 0;
+
+	BVHPartitions::triangle_intersect_plane(vertices, dimension, plane, intersections, &intersection_count);
+
+	// Same clipping as for spatial splits in the SBVHBuilder
+	AABB aabb_intersections = AABB::from_points(intersections, intersection_count);
+	AABB aabb_left  = aabb_intersections;
+	AABB aabb_right = aabb_intersections;
+
+	for (int v = 0; v < 3; v++) {
+		if (vertices[v][dimension] < plane) {
+			aabb_left.expand(vertices[v]);
+		} else {
+			aabb_right.expand(vertices[v]);
+		}
+	}
+
+	aabb_left.min  = Vector3::max(aabb_left.min,  aabb.min);
+	aabb_left.max  = Vector3::min(aabb_left.max,  aabb.max);
+	aabb_right.min = Vector3::max(aabb_right.min, aabb.min);
+	aabb_right.max = Vector3::min(aabb_right.max, aabb.max);
+	aabb_left .max[dimension] = Math::min(aabb_left .max[dimension], plane);
+	aabb_right.min[dimension] = Math::max(aabb_right.min[dimension], plane);
+
+	bool has_left  = intersection_count > 0 || vertices[0][dimension] <  plane || vertices[1][dimension] <  plane || vertices[2][dimension] <  plane;
+	bool has_right = intersection_count > 0 || vertices[0][dimension] >= plane || vertices[1][dimension] >= plane || vertices[2][dimension] >= plane;
+
+	if (!has_left || !has_right) {
+		result.emplace_back(index, aabb);
+		return;
+	}
+
+	aabb_left .fix_if_needed();
+	aabb_right.fix_if_needed();
+
+	int split_count_left = split_count / 2;
+
+	split_reference(triangle, index, aabb_left,  split_count_left,               result);
+	split_reference(triangle, index, aabb_right, split_count - split_count_left, result);
+}
+
+Array<PrimitiveRef> TrianglePresplitter::presplit(const IndexedTriangles & triangles, float budget) {
+	Array<PrimitiveRef> result;
+
+	// Distribute the budget over all Triangles according to the cube root of their wasted area (Karras and Aila 2013)
+	Array<float> priorities(triangles.size());
+
+	double priority_sum = ThreadPool::parallel_reduce(0, int(triangles.size()), 4096, 0.0,
+		[&](int i) {
+			priorities[i] = cbrtf(triangle_wasted_area(triangles[i]));
+			return double(priorities[i]);
+		},
+		[](double a, double b) { return a + b; }
+	);
+
+	double split_budget = double(budget) * double(triangles.size());
+	double split_scale  = priority_sum > 0.0 ? split_budget / priority_sum : 0.0;
+
+	result.reserve(triangles.size() + size_t(split_budget));
+
+	// The fractional part of the splits is carried over to the next Triangle, so that the whole budget is used
+	double split_carry = 0.0;
+
+	for (int i = 0; i < triangles.size(); i++) {
+		double splits = double(priorities[i]) * split_scale + split_carry;
+
+		int split_count = Math::min(1 + int(splits), MAX_SPLITS_PER_TRIANGLE);
+		split_carry = splits - double(int(splits));
+
+		split_reference(triangles[i], i, triangles[i].get_aabb(), split_count, result);
+	}
+
+	return result;
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include "BVHPartitions.h"
+
+// Early split clipping, see Ernst and Greiner 2007 and Karras and Aila 2013
+// Large or elongated Triangles, whose AABB covers much more surface area than the Triangle itself, are split
+// into multiple references before the BVH is built. Each reference has a tighter AABB around its part of the Triangle.
+// This mostly helps diagonal thin geometry (hair strips, cables, fences), which the SAH and LBVH builders can otherwise only
+// put in heavily overlapping AABBs. The SBVH does not need this, as it already performs spatial splits during construction
+namespace TrianglePresplitter {
+	inline constexpr int MAX_SPLITS_PER_TRIANGLE = 64;
+
+	// Budget is the number of additional references as a fraction of the Triangle count, 0.25 allows up to 25% more references
+	// The index of every reference refers to the Triangle it is part of
+	Array<PrimitiveRef> presplit(const IndexedTriangles & triangles, float budget);
+}
@@ -1,13 +1,21 @@
 #include "BVH4Converter.h"
 
+#include "Core/IO.h"
+
 void BVH4Converter::convert() {
-	bvh4.nodes.resize(bvh2.nodes.size());
+	nodes.resize(bvh2.nodes.size());
+
+	for (size_t i = 0; i < nodes.size(); i++) {
+		for (int j = 0; j < 4; j++) {
+			nodes[i].index[j] = INVALID;
+			nodes[i].count[j] = INVALID;
+		}
 
-	for (size_t i = 0; i < bvh4.nodes.size(); i++) {
 		// We use index 1 as a starting point, such that it points to the first child of the root
 		if (i == 1) {
-			bvh4.nodes[i].get_index(0) = 0;
-			bvh4.nodes[i].get_count(0) = 0;
+			nodes[i].index[0] = 0;
+			nodes[i].count[0] = 0;
+			nodes[i].aabb [0] = bvh2.nodes[0].aabb;
 			continue;
 		}
 
@@ -15,70 +23,118 @@ void BVH4Converter::convert() {
 			const BVHNode2 & child_left  = bvh2.nodes[bvh2.nodes[i].left];
 			const BVHNode2 & child_right = bvh2.nodes[bvh2.nodes[i].left + 1];
 
-			bvh4.nodes[i].aabb_min_x[0] = child_left.aabb.min.x;
-			bvh4.nodes[i].aabb_min_y[0] = child_left.aabb.min.y;
-			bvh4.nodes[i].aabb_min_z[0] = child_left.aabb.min.z;
-			bvh4.nodes[i].aabb_max_x[0] = child_left.aabb.max.x;
-			bvh4.nodes[i].aabb_max_y[0] = child_left.aabb.max.y;
-			bvh4.nodes[i].aabb_max_z[0] = child_left.aabb.max.z;
-			bvh4.nodes[i].aabb_min_x[1] = child_right.aabb.min.x;
-			bvh4.nodes[i].aabb_min_y[1] = child_right.aabb.min.y;
-			bvh4.nodes[i].aabb_min_z[1] = child_right.aabb.min.z;
-			bvh4.nodes[i].aabb_max_x[1] = child_right.aabb.max.x;
-			bvh4.nodes[i].aabb_max_y[1] = child_right.aabb.max.y;
-			bvh4.nodes[i].aabb_max_z[1] = child_right.aabb.max.z;
+			nodes[i].aabb[0] = child_left .aabb;
+			nodes[i].aabb[1] = child_right.aabb;
 
 			if (child_left.is_leaf()) {
-				bvh4.nodes[i].get_index(0) = child_left.first;
-				bvh4.nodes[i].get_count(0) = child_left.count;
+				nodes[i].index[0] = child_left.first;
+				nodes[i].count[0] = child_left.count;
 			} else {
-				bvh4.nodes[i].get_index(0) = bvh2.nodes[i].left;
-				bvh4.nodes[i].get_count(0) = 0;
+				nodes[i].index[0] = bvh2.nodes[i].left;
+				nodes[i].count[0] = 0;
 			}
 
 			if (child_right.is_leaf()) {
-				bvh4.nodes[i].get_index(1) = child_right.first;
-				bvh4.nodes[i].get_count(1) = child_right.count;
+				nodes[i].index[1] = child_right.first;
+				nodes[i].count[1] = child_right.count;
 			} else {
-				bvh4.nodes[i].get_index(1) = bvh2.nodes[i].left + 1;
-				bvh4.nodes[i].get_count(1) = 0;
+				nodes[i].index[1] = bvh2.nodes[i].left + 1;
+				nodes[i].count[1] = 0;
 			}
 
-			// For now the tree is binary,
-			// so make the rest of the indices invalid
-			for (int j = 2; j < 4; j++) {
-				bvh4.nodes[i].get_index(j) = INVALID;
-				bvh4.nodes[i].get_count(j) = INVALID;
-			}
+			// For now the tree is binary, the rest of the indices stay invalid
 		}
 	}
 
 	// Handle the special case where the root is a leaf
 	if (bvh2.nodes[0].is_leaf()) {
-		bvh4.nodes[0].aabb_min_x[0] = bvh2.nodes[0].aabb.min.x;
-		bvh4.nodes[0].aabb_min_y[0] = bvh2.nodes[0].aabb.min.y;
-		bvh4.nodes[0].aabb_min_z[0] = bvh2.nodes[0].aabb.min.z;
-		bvh4.nodes[0].aabb_max_x[0] = bvh2.nodes[0].aabb.max.x;
-		bvh4.nodes[0].aabb_max_y[0] = bvh2.nodes[0].aabb.max.y;
-		bvh4.nodes[0].aabb_max_z[0] = bvh2.nodes[0].aabb.max.z;
-
-		bvh4.nodes[0].get_index(0) = bvh2.nodes[0].first;
-		bvh4.nodes[0].get_count(0) = bvh2.nodes[0].count;
-
-		for (int i = 1; i < 4; i++) {
-			bvh4.nodes[0].get_index(i) = INVALID;
-			bvh4.nodes[0].get_count(i) = INVALID;
-		}
+		nodes[0].aabb [0] = bvh2.nodes[0].aabb;
+		nodes[0].index[0] = bvh2.nodes[0].first;
+		nodes[0].count[0] = bvh2.nodes[0].count;
 	} else {
 		// Collapse tree top-down, starting from the root
 		collapse(0);
 	}
 
+	bvh4.nodes.resize(nodes.size());
+
+	for (size_t i = 0; i < nodes.size(); i++) {
+		const Node & node = nodes[i];
+		int child_count = node.get_child_count();
+
+		BVHNode4 & node4 = bvh4.nodes[i];
+		quantize(node4, node.aabb, child_count);
+
+		for (int j = 0; j < 4; j++) {
+			if (node.count[j] > BVHNode4::MAX_LEAF_COUNT) {
+				IO::print("ERROR: BVH4 Leaf Node contains {} primitives, at most {} are supported!\n"_sv, node.count[j], BVHNode4::MAX_LEAF_COUNT);
+				IO::exit(1);
+			}
+
+			node4.index[j] = node.index[j];
+			node4.count[j] = short(node.count[j]);
+		}
+	}
+
 	bvh4.indices = bvh2.indices; // NOTE: copy
 }
 
+void BVH4Converter::quantize(BVHNode4 & node, const AABB child_aabbs[4], int child_count) {
+	AABB aabb = AABB::create_empty();
+	for (int i = 0; i < child_count; i++) {
+		aabb.expand(child_aabbs[i]);
+	}
+
+	node.child_count = byte(child_count);
+
+	if (child_count == 0) {
+		node.p = Vector3(0.0f);
+		node.e[0] = node.e[1] = node.e[2] = 0;
+		return;
+	}
+
+	node.p = aabb.min;
+
+	constexpr int Nq = 8;
+	constexpr float denom = 1.0f / float((1 << Nq) - 1);
+
+	Vector3 e(
+		exp2f(ceilf(log2f((aabb.max.x - aabb.min.x) * denom))),
+		exp2f(ceilf(log2f((aabb.max.y - aabb.min.y) * denom))),
+		exp2f(ceilf(log2f((aabb.max.z - aabb.min.z) * denom)))
+	);
+
+	Vector3 one_over_e(1.0f / e.x, 1.0f / e.y, 1.0f / e.z);
+
+	unsigned u_ex = Util::bit_cast<unsigned>(e.x);
+	unsigned u_ey = Util::bit_cast<unsigned>(e.y);
+	unsigned u_ez = Util::bit_cast<unsigned>(e.z);
+
+	// Only the exponent bits can be non-zero
+	ASSERT((u_ex & 0b10000000011111111111111111111111) == 0);
+	ASSERT((u_ey & 0b10000000011111111111111111111111) == 0);
+	ASSERT((u_ez & 0b10000000011111111111111111111111) == 0);
+
+	// Store only 8 bit exponent
+	node.e[0] = u_ex >> 23;
+	node.e[1] = u_ey >> 23;
+	node.e[2] = u_ez >> 23;
+
+	for (int i = 0; i < child_count; i++) {
+		const AABB & child_aabb = child_aabbs[i];
+
+		node.quantized_min_x[i] = byte(floorf((child_aabb.min.x - node.p.x) * one_over_e.x));
+		node.quantized_min_y[i] = byte(floorf((child_aabb.min.y - node.p.y) * one_over_e.y));
+		node.quantized_min_z[i] = byte(floorf((child_aabb.min.z - node.p.z) * one_over_e.z));
+
+		node.quantized_max_x[i] = byte(ceilf((child_aabb.max.x - node.p.x) * one_over_e.x));
+		node.quantized_max_y[i] = byte(ceilf((child_aabb.max.y - node.p.y) * one_over_e.y));
+		node.quantized_max_z[i] = byte(ceilf((child_aabb.max.z - node.p.z) * one_over_e.z));
+	}
+}
+
 void BVH4Converter::collapse(int node_index) {
-   	BVHNode4 & node = bvh4.nodes[node_index];
+	Node & node = nodes[node_index];
 
 	while (true) {
 		int child_count = node.get_child_count();
@@ -88,16 +144,12 @@ void BVH4Converter::collapse(int node_index) {
 		int   max_index = INVALID;
 
 		for (int i = 0; i < child_count; i++) {
-			if (!node.is_leaf(i)) {
-				int child_i_child_count = bvh4.nodes[node.get_index(i)].get_child_count();
+			if (node.count[i] == 0) {
+				int child_i_child_count = nodes[node.index[i]].get_child_count();
 
 				// Check if the current Node can adopt the children of child Node i
 				if (child_count + child_i_child_count - 1 <= 4) {
-					float diff_x = node.aabb_max_x[i] - node.aabb_min_x[i];
-					float diff_y = node.aabb_max_y[i] - node.aabb_min_y[i];
-					float diff_z = node.aabb_max_z[i] - node.aabb_min_z[i];
-
-					float half_area = diff_x * diff_y + diff_y * diff_z + diff_z * diff_x;
+					float half_area = 0.5f * node.aabb[i].surface_area();
 
 					if (half_area > max_area) {
 						max_area  = half_area;
@@ -110,39 +162,29 @@ void BVH4Converter::collapse(int node_index) {
 		// No merge possible anymore, stop trying
 		if (max_index == INVALID) break;
 
-		const BVHNode4 & max_child = bvh4.nodes[node.get_index(max_index)];
+		const Node & max_child = nodes[node.index[max_index]];
 
 		// Replace max child Node with its first child
-		node.aabb_min_x[max_index] = max_child.aabb_min_x[0];
-		node.aabb_min_y[max_index] = max_child.aabb_min_y[0];
-		node.aabb_min_z[max_index] = max_child.aabb_min_z[0];
-		node.aabb_max_x[max_index] = max_child.aabb_max_x[0];
-		node.aabb_max_y[max_index] = max_child.aabb_max_y[0];
-		node.aabb_max_z[max_index] = max_child.aabb_max_z[0];
-		node.get_index(max_index) = max_child.get_index(0);
-		node.get_count(max_index) = max_child.get_count(0);
+		node.aabb [max_index] = max_child.aabb [0];
+		node.index[max_index] = max_child.index[0];
+		node.count[max_index] = max_child.count[0];
 
 		int max_child_child_count = max_child.get_child_count();
 
 		// Add the rest of max child Node's children after the current Node's own children
 		for (int i = 1; i < max_child_child_count; i++) {
-			node.aabb_min_x[child_count + i - 1] = max_child.aabb_min_x[i];
-			node.aabb_min_y[child_count + i - 1] = max_child.aabb_min_y[i];
-			node.aabb_min_z[child_count + i - 1] = max_child.aabb_min_z[i];
-			node.aabb_max_x[child_count + i - 1] = max_child.aabb_max_x[i];
-			node.aabb_max_y[child_count + i - 1] = max_child.aabb_max_y[i];
-			node.aabb_max_z[child_count + i - 1] = max_child.aabb_max_z[i];
-			node.get_index(child_count + i - 1) = max_child.get_index(i);
-			node.get_count(child_count + i - 1) = max_child.get_count(i);
+			node.aabb [child_count + i - 1] = max_child.aabb [i];
+			node.index[child_count + i - 1] = max_child.index[i];
+			node.count[child_count + i - 1] = max_child.count[i];
 		}
 	};
 
 	for (int i = 0; i < 4; i++) {
-		if (node.get_count(i) == INVALID) break;
+		if (node.count[i] == INVALID) break;
 
 		// If child Node i is an internal node, recurse
-		if (node.get_count(i) == 0) {
-			collapse(node.get_index(i));
+		if (node.count[i] == 0) {
+			collapse(node.index[i]);
 		}
 	}
 }
@@ -12,6 +12,30 @@ struct BVH4Converter final : BVHConverter {
 
 	void convert() override;
 
+	// Sets the origin and scale of the Node from the union of the child AABBs and quantizes them
+	static void quantize(BVHNode4 & node, const AABB child_aabbs[4], int child_count);
+
 private:
+	// The tree is collapsed with full precision AABBs, the final BVHNode4s are quantized afterwards
+	struct Node {
+		AABB aabb [4];
+		int  index[4];
+		int  count[4];
+
+		int get_child_count() const {
+			int result = 0;
+
+			for (int i = 0; i < 4; i++) {
+				if (count[i] == INVALID) break;
+
+				result++;
+			}
+
+			return result;
+		}
+	};
+
+	Array<Node> nodes;
+
 	void collapse(int node_index);
 };
@@ -4,24 +4,107 @@
 
 #include "Core/IO.h"
 
+#include "Util/ThreadPool.h"
+
 void BVH8Converter::convert() {
-	bvh8.indices.clear();
-	bvh8.indices.reserve(bvh2.indices.size());
+	decisions       .resize(bvh2.nodes.size() * 7);
+	primitive_counts.resize(bvh2.nodes.size());
+	collapsed_counts.resize(bvh2.nodes.size());
 
-	bvh8.nodes.clear();
-	bvh8.nodes.emplace_back(); // Root
+	// Fill cost table using dynamic programming (bottom up)
+	calculate_cost(0, bvh2.nodes, 0);
 
-	decisions.resize(bvh2.nodes.size() * 7);
+	// Count the BVH8 Nodes every collapsed subtree will produce, so that all output positions are known before collapsing
+	int node_count = 1 + count_nodes(0, bvh2.nodes);
+	ASSERT(primitive_counts[0] == int(bvh2.indices.size()));
 
-	// Fill cost table using dynamic programming (bottom up)
-	calculate_cost(0, bvh2.nodes);
+	bvh8.indices.resize(bvh2.indices.size());
+	bvh8.nodes  .resize(node_count);
+	refit_infos .resize(node_count);
 
 	// Collapse SBVH into 8-way tree (top down)
-	collapse(bvh2.nodes, bvh2.indices, 0, 0);
-	ASSERT(bvh8.indices.size() == bvh2.indices.size());
+	collapse(bvh2.nodes, bvh2.indices, 0, 0, 1, 0);
+
+	reorder_treelets();
+}
+
+// The depth first layout of collapse places the children of an upper level Node far away from the Node itself once the tree is large.
+// Treelets are filled breadth first with the child groups of their Nodes, a group that no longer fits starts a new treelet.
+// The children of a Node have to stay contiguous, so a group is only ever moved as a whole. The primitives keep their order.
+// A group is placed after the Node it belongs to, so children still come after their parent, which BVH8::refit relies on
+void BVH8Converter::reorder_treelets() {
+	int node_count = int(bvh8.nodes.size());
+	if (node_count <= TREELET_NODE_COUNT) return;
+
+	auto child_group_size = [this](int node_index) {
+		return Math::popcount(unsigned(bvh8.nodes[node_index].imask));
+	};
+
+	Array<int> new_indices(node_count);
+	int        new_count = 0;
+
+	new_indices[0] = new_count++; // The Root stays at index 0
+
+	// Nodes whose child group starts a new treelet, and Nodes whose child group is waiting to be placed in the current treelet
+	Array<int> treelet_roots;
+	Array<int> frontier;
+
+	if (child_group_size(0) > 0) treelet_roots.push_back(0);
+
+	for (size_t t = 0; t < treelet_roots.size(); t++) {
+		frontier.clear();
+		frontier.push_back(treelet_roots[t]);
+
+		int treelet_size = 0;
+
+		for (size_t f = 0; f < frontier.size(); f++) {
+			int node_index = frontier[f];
+			int group_size = child_group_size(node_index);
+
+			if (treelet_size > 0 && treelet_size + group_size > TREELET_NODE_COUNT) {
+				treelet_roots.push_back(node_index);
+				continue;
+			}
+
+			int base_index_child = int(bvh8.nodes[node_index].base_index_child);
+			for (int i = 0; i < group_size; i++) {
+				int child_index = base_index_child + i;
+				new_indices[child_index] = new_count++;
+
+				if (child_group_size(child_index) > 0) frontier.push_back(child_index);
+			}
+			treelet_size += group_size;
+		}
+	}
+	ASSERT(new_count == node_count);
+
+	Array<BVHNode8>  nodes_reordered      (node_count);
+	Array<RefitInfo> refit_infos_reordered(node_count);
+
+	for (int i = 0; i < node_count; i++) {
+		BVHNode8 node = bvh8.nodes[i];
+		if (node.imask) {
+			node.base_index_child = unsigned(new_indices[node.base_index_child]);
+		}
+
+		nodes_reordered      [new_indices[i]] = node;
+		refit_infos_reordered[new_indices[i]] = refit_infos[i];
+	}
+
+	bvh8.nodes  = std::move(nodes_reordered);
+	refit_infos = std::move(refit_infos_reordered);
+}
+
+void BVH8Converter::refit() {
+	ASSERT(refit_infos.size() == bvh8.nodes.size());
+
+	// The BVH8 keeps its topology, only the quantized child AABBs are recomputed from the refitted BVH2
+	for (size_t i = 0; i < bvh8.nodes.size(); i++) {
+		quantize(bvh8.nodes[i], bvh2.nodes, refit_infos[i]);
+	}
 }
 
-int BVH8Converter::calculate_cost(int node_index, const Array<BVHNode2> & nodes) {
+int BVH8Converter::calculate_cost(int node_index, const Array<BVHNode2> & nodes, int depth) {
 	const BVHNode2 & node = nodes[node_index];
 
 	int num_primitives;
@@ -41,9 +124,23 @@ int BVH8Converter::calculate_cost(int node_index, const Array<BVHNode2> & nodes)
 			decisions[node_index * 7 + i].cost = cost_leaf;
 		}
 	} else {
-		num_primitives =
-			calculate_cost(node.left,     nodes) +
-			calculate_cost(node.left + 1, nodes);
+		// Both children only write the decisions of their own subtree
+		if (depth < PARALLEL_MAX_DEPTH && nodes.size() >= 2 * PARALLEL_SUBTREE_MIN_SIZE) {
+			int num_primitives_left;
+
+			ThreadPool::TaskGroup group;
+			ThreadPool::submit(group, [this, &nodes, &node, &num_primitives_left, depth]() {
+				num_primitives_left = calculate_cost(node.left, nodes, depth + 1);
+			});
+			int num_primitives_right = calculate_cost(node.left + 1, nodes, depth + 1);
+			ThreadPool::wait(group);
+
+			num_primitives = num_primitives_left + num_primitives_right;
+		} else {
+			num_primitives =
+				calculate_cost(node.left,     nodes, depth + 1) +
+				calculate_cost(node.left + 1, nodes, depth + 1);
+		}
 
 		// Separate case: i=0 (i=1 in the paper)
 		{
@@ -113,6 +210,8 @@ int BVH8Converter::calculate_cost(int node_index, const Array<BVHNode2> & nodes)
 		}
 	}
 
+	primitive_counts[node_index] = num_primitives;
+
 	return num_primitives;
 }
 
@@ -207,30 +306,80 @@ void BVH8Converter::order_children(int node_index, const Array<BVHNode2> & nodes
 	}
 }
 
-// Recursively count triangles in subtree of the given Node
-// Simultaneously fills the indices buffer of the BVH8
-int BVH8Converter::count_primitives(int node_index, const Array<BVHNode2> & nodes, const Array<int> & indices) {
+// Number of BVH8 Nodes below the BVH8 Node that the given BVH2 Node collapses into, stored in collapsed_counts
+int BVH8Converter::count_nodes(int node_index, const Array<BVHNode2> & nodes) {
+	int children[8];
+	int child_count = 0;
+	get_children(node_index, nodes, children, child_count, 0);
+	ASSERT(child_count <= 8);
+
+	int count = 0;
+	int count_parallel = 0;
+
+	ThreadPool::TaskGroup group;
+
+	for (int i = 0; i < child_count; i++) {
+		int child_index = children[i];
+		if (decisions[child_index * 7].type != Decision::Type::INTERNAL) continue;
+
+		if (primitive_counts[child_index] >= PARALLEL_SUBTREE_MIN_SIZE) {
+			ThreadPool::submit(group, [this, &nodes, child_index]() {
+				count_nodes(child_index, nodes);
+			});
+			count_parallel++;
+		} else {
+			count += 1 + count_nodes(child_index, nodes);
+		}
+	}
+
+	if (count_parallel > 0) {
+		ThreadPool::wait(group);
+
+		for (int i = 0; i < child_count; i++) {
+			int child_index = children[i];
+			if (decisions[child_index * 7].type == Decision::Type::INTERNAL && primitive_counts[child_index] >= PARALLEL_SUBTREE_MIN_SIZE) {
+				count += 1 + collapsed_counts[child_index];
+			}
+		}
+	}
+
+	collapsed_counts[node_index] = count;
+	return count;
+}
+
+// Recursively writes the primitive indices in the subtree of the given Node to the indices buffer of the BVH8
+void BVH8Converter::write_primitives(int node_index, const Array<BVHNode2> & nodes, const Array<int> & indices, int offset) {
 	const BVHNode2 & node = nodes[node_index];
 
 	if (node.is_leaf()) {
 		ASSERT(node.count == 1);
 
 		for (unsigned i = 0; i < node.count; i++) {
-			bvh8.indices.push_back(indices[node.first + i]);
+			bvh8.indices[offset + i] = indices[node.first + i];
 		}
-
-		return node.count;
+		return;
 	}
 
-	return
-		count_primitives(node.left,     nodes, indices) +
-		count_primitives(node.left + 1, nodes, indices);
+	write_primitives(node.left,     nodes, indices, offset);
+	write_primitives(node.left + 1, nodes, indices, offset + primitive_counts[node.left]);
 }
 
-void BVH8Converter::collapse(const Array<BVHNode2> & nodes_bvh, const Array<int> & indices_bvh, int node_index_bvh8, int node_index_bvh2) {
-	BVHNode8 & node = bvh8.nodes[node_index_bvh8];
-	const AABB & aabb = nodes_bvh[node_index_bvh2].aabb;
+void BVH8Converter::quantize(BVHNode8 & node, const Array<BVHNode2> & nodes_bvh, const RefitInfo & refit_info) {
+	AABB     child_aabbs[8];
+	unsigned child_mask = 0;
+
+	for (int i = 0; i < 8; i++) {
+		int child_index = refit_info.children[i];
+		if (child_index == INVALID) continue; // Empty slot
+
+		child_aabbs[i] = nodes_bvh[child_index].aabb;
+		child_mask |= 1 << i;
+	}
+
+	quantize(node, nodes_bvh[refit_info.node_index_bvh2].aabb, child_aabbs, child_mask);
+}
 
+void BVH8Converter::quantize(BVHNode8 & node, const AABB & aabb, const AABB child_aabbs[8], unsigned child_mask) {
 	node.p = aabb.min;
 
 	constexpr int Nq = 8;
@@ -258,17 +407,43 @@ void BVH8Converter::collapse(const Array<BVHNode2> & nodes_bvh, const Array<int>
 	node.e[1] = u_ey >> 23;
 	node.e[2] = u_ez >> 23;
 
+	for (int i = 0; i < 8; i++) {
+		if (!(child_mask & (1 << i))) continue; // Empty slot
+
+		const AABB & child_aabb = child_aabbs[i];
+
+		node.quantized_min_x[i] = byte(floorf((child_aabb.min.x - node.p.x) * one_over_e.x));
+		node.quantized_min_y[i] = byte(floorf((child_aabb.min.y - node.p.y) * one_over_e.y));
+		node.quantized_min_z[i] = byte(floorf((child_aabb.min.z - node.p.z) * one_over_e.z));
+
+		node.quantized_max_x[i] = byte(ceilf((child_aabb.max.x - node.p.x) * one_over_e.x));
+		node.quantized_max_y[i] = byte(ceilf((child_aabb.max.y - node.p.y) * one_over_e.y));
+		node.quantized_max_z[i] = byte(ceilf((child_aabb.max.z - node.p.z) * one_over_e.z));
+	}
+}
+
+// The BVH8 Node and its children are written to the positions the serial depth first conversion would use:
+// the children of a Node are allocated contiguously at base_index_child, followed by the subtree of every internal child in slot order.
+// The primitives of leaf children come first at base_index_triangle, followed by those of the internal children in slot order
+void BVH8Converter::collapse(const Array<BVHNode2> & nodes_bvh, const Array<int> & indices_bvh, int node_index_bvh8, int node_index_bvh2, int base_index_child, int base_index_triangle) {
+	RefitInfo refit_info = { node_index_bvh2, { INVALID, INVALID, INVALID, INVALID, INVALID, INVALID, INVALID, INVALID } };
+	int * children = refit_info.children;
+
 	int child_count = 0;
-	int children[8] = { INVALID, INVALID, INVALID, INVALID, INVALID, INVALID, INVALID, INVALID };
 	get_children(node_index_bvh2, nodes_bvh, children, child_count, 0);
 	ASSERT(child_count <= 8);
 
 	order_children(node_index_bvh2, nodes_bvh, children, child_count);
 
+	refit_infos[node_index_bvh8] = refit_info;
+
+	BVHNode8 & node = bvh8.nodes[node_index_bvh8];
+	quantize(node, nodes_bvh, refit_info);
+
 	node.imask = 0;
 
-	node.base_index_triangle = unsigned(bvh8.indices.size());
-	node.base_index_child    = unsigned(bvh8.nodes  .size());
+	node.base_index_triangle = unsigned(base_index_triangle);
+	node.base_index_child    = unsigned(base_index_child);
 
 	int num_internal_nodes = 0;
 	int num_triangles      = 0;
@@ -277,21 +452,13 @@ void BVH8Converter::collapse(const Array<BVHNode2> & nodes_bvh, const Array<int>
 		int child_index = children[i];
 		if (child_index == INVALID) continue; // Empty slot
 
-		const AABB & child_aabb = nodes_bvh[child_index].aabb;
-
-		node.quantized_min_x[i] = byte(floorf((child_aabb.min.x - node.p.x) * one_over_e.x));
-		node.quantized_min_y[i] = byte(floorf((child_aabb.min.y - node.p.y) * one_over_e.y));
-		node.quantized_min_z[i] = byte(floorf((child_aabb.min.z - node.p.z) * one_over_e.z));
-
-		node.quantized_max_x[i] = byte(ceilf((child_aabb.max.x - node.p.x) * one_over_e.x));
-		node.quantized_max_y[i] = byte(ceilf((child_aabb.max.y - node.p.y) * one_over_e.y));
-		node.quantized_max_z[i] = byte(ceilf((child_aabb.max.z - node.p.z) * one_over_e.z));
-
 		switch (decisions[child_index * 7].type) {
 			case Decision::Type::LEAF: {
-				int triangle_count = count_primitives(child_index, nodes_bvh, indices_bvh);
+				int triangle_count = primitive_counts[child_index];
 				ASSERT(triangle_count > 0 && triangle_count <= 3);
 
+				write_primitives(child_index, nodes_bvh, indices_bvh, base_index_triangle + num_triangles);
+
 				// Three highest bits contain unary representation of triangle count
 				for (int j = 0; j < triangle_count; j++) {
 					node.meta[i] |= (1 << (j + 5));
@@ -314,22 +481,33 @@ void BVH8Converter::collapse(const Array<BVHNode2> & nodes_bvh, const Array<int>
 		}
 	}
 
-	for (int i = 0; i < num_internal_nodes; i++) {
-		bvh8.nodes.emplace_back();
-	}
-	node = bvh8.nodes[node_index_bvh8]; // NOTE: 'node' may have been invalidated by emplace_back on previous line
+	// Recurse on Internal Nodes
+	int offset_child    = base_index_child    + num_internal_nodes;
+	int offset_triangle = base_index_triangle + num_triangles;
 
-	ASSERT(node.base_index_child    + num_internal_nodes == bvh8.nodes  .size());
-	ASSERT(node.base_index_triangle + num_triangles      == bvh8.indices.size());
+	int index_child = 0;
+
+	ThreadPool::TaskGroup group;
 
-	// Recurse on Internal Nodes
-	int offset = 0;
 	for (int i = 0; i < 8; i++) {
 		int child_index = children[i];
 		if (child_index == INVALID) continue;
 
 		if (node.imask & (1 << i)) {
-			collapse(nodes_bvh, indices_bvh, node.base_index_child + offset++, child_index);
+			int child_index_bvh8 = base_index_child + index_child++;
+
+			if (primitive_counts[child_index] >= PARALLEL_SUBTREE_MIN_SIZE) {
+				ThreadPool::submit(group, [this, &nodes_bvh, &indices_bvh, child_index_bvh8, child_index, offset_child, offset_triangle]() {
+					collapse(nodes_bvh, indices_bvh, child_index_bvh8, child_index, offset_child, offset_triangle);
+				});
+			} else {
+				collapse(nodes_bvh, indices_bvh, child_index_bvh8, child_index, offset_child, offset_triangle);
+			}
+
+			offset_child    += collapsed_counts[child_index];
+			offset_triangle += primitive_counts[child_index];
 		}
 	}
+
+	ThreadPool::wait(group);
 }
@@ -11,6 +11,10 @@ struct BVH8Converter final : BVHConverter {
 	}
 
 	void convert() override;
+	void refit()   override;
+
+	// Sets the origin and scale of the Node from its AABB and quantizes the AABBs of the child slots that are set in child_mask
+	static void quantize(BVHNode8 & node, const AABB & aabb, const AABB child_aabbs[8], unsigned child_mask);
 
 private:
 	struct Decision {
@@ -28,12 +32,35 @@ private:
 
 	Array<Decision> decisions;
 
-	int calculate_cost(int node_index, const Array<BVHNode2> & nodes);
+	// Subtrees with at least this many primitives are processed as separate Work on the ThreadPool
+	// The output layout is computed up front (see collapse), so it is identical to a serial conversion
+	static constexpr int PARALLEL_SUBTREE_MIN_SIZE = 4096;
+	static constexpr int PARALLEL_MAX_DEPTH        = 10; // The cost pass forks on depth, as subtree sizes are not known yet
+
+	Array<int> primitive_counts; // Number of primitives in the subtree of every BVH2 Node
+	Array<int> collapsed_counts; // For every BVH2 Node that becomes a BVH8 Node, the number of BVH8 Nodes below it
+
+	// For every BVH8 Node the BVH2 Node it was collapsed from and the BVH2 Nodes in each of its child slots, used by refit()
+	struct RefitInfo {
+		int node_index_bvh2;
+		int children[8];
+	};
+	Array<RefitInfo> refit_infos;
+
+	void quantize(BVHNode8 & node, const Array<BVHNode2> & nodes_bvh, const RefitInfo & refit_info);
+
+	int calculate_cost(int node_index, const Array<BVHNode2> & nodes, int depth);
 
 	void get_children  (int node_index, const Array<BVHNode2> & nodes, int children[8], int & child_count, int i);
 	void order_children(int node_index, const Array<BVHNode2> & nodes, int children[8], int   child_count);
 
-	int count_primitives(int node_index, const Array<BVHNode2> & nodes, const Array<int> & indices_sbvh);
+	int  count_nodes     (int node_index, const Array<BVHNode2> & nodes);
+	void write_primitives(int node_index, const Array<BVHNode2> & nodes, const Array<int> & indices_bvh, int offset);
+
+	void collapse(const Array<BVHNode2> & nodes_bvh, const Array<int> & indices_bvh, int node_index_bvh8, int node_index_bvh2, int base_index_child, int base_index_triangle);
+
+	// Nodes are grouped into treelets of about a page, so that the Nodes a Ray visits after an upper level Node are close to it in memory
+	static constexpr int TREELET_NODE_COUNT = 4096 / sizeof(BVHNode8);
 
-	void collapse(const Array<BVHNode2> & nodes_bvh, const Array<int> & indices_bvh, int node_index_bvh8, int node_index_bvh2);
+	void reorder_treelets();
 };
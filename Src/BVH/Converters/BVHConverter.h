@@ -11,6 +11,12 @@ struct BVHConverter {
 	virtual ~BVHConverter() = default;
 
 	virtual void convert() = 0;
+
+	// Updates the converted BVH after the AABBs of the source BVH have been refitted, without changing its topology
+	// The default of converting again is valid as long as convert() keeps the order of the indices
+	virtual void refit() {
+		convert();
+	}
 };
 
 // Dummy converter, does nothing but copy
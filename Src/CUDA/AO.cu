@@ -5,6 +5,7 @@
 #include "Sampling.h"
 #include "Buffers.h"
 #include "Camera.h"
+#include "Pick.h"
 
 #include "Raytracing/BVH2.h"
 #include "Raytracing/BVH4.h"
@@ -13,10 +14,6 @@
 // Final Frame Buffer, shared with OpenGL
 __device__ __constant__ Surface<float4> accumulator;
 
-__device__ __constant__ Camera camera;
-
-__device__ PixelQuery pixel_query = { INVALID, INVALID, INVALID };
-
 // Input to the Trace and Ambient Occlusion Kernels in SoA layout
 struct TraceBufferAO {
 	TraversalData traversal_data;
@@ -76,28 +73,41 @@ extern "C" __global__ void kernel_trace_bvh8() {
 	bvh8_trace(&ray_buffer_trace.traversal_data, buffer_sizes.trace, &buffer_sizes.rays_retired);
 }
 
-extern "C" __global__ void kernel_trace_shadow_bvh2() {
-	bvh2_trace_shadow(&ray_buffer_shadow.traversal_data, buffer_sizes.shadow, &buffer_sizes.rays_retired_shadow, [](int ray_index) {
-		int pixel_index = ray_buffer_shadow.pixel_index[ray_index];
+// Every unoccluded AO Ray adds its share of the visibility of its pixel
+// With multiple AO Rays per hit the Rays of the same pixel can finish concurrently, so their shares are added atomically
+__device__ inline void ao_record_unoccluded(int ray_index, float weight) {
+	int pixel_index = ray_buffer_shadow.pixel_index[ray_index];
+
+	if (weight == 1.0f) {
 		aov_framebuffer_set(AOVType::RADIANCE, pixel_index, make_float4(1.0f));
+	} else if (aov_is_active(AOVType::RADIANCE)) {
+		float4 * value = &get_aov(AOVType::RADIANCE).framebuffer[pixel_index];
+		atomicAdd(&value->x, weight);
+		atomicAdd(&value->y, weight);
+		atomicAdd(&value->z, weight);
+		atomicAdd(&value->w, weight);
+	}
+}
+
+extern "C" __global__ void kernel_trace_shadow_bvh2(float weight) {
+	bvh2_trace_shadow(&ray_buffer_shadow.traversal_data, buffer_sizes.shadow, &buffer_sizes.rays_retired_shadow, [weight](int ray_index) {
+		ao_record_unoccluded(ray_index, weight);
 	});
 }
 
-extern "C" __global__ void kernel_trace_shadow_bvh4() {
-	bvh4_trace_shadow(&ray_buffer_shadow.traversal_data, buffer_sizes.shadow, &buffer_sizes.rays_retired_shadow, [](int ray_index) {
-		int pixel_index = ray_buffer_shadow.pixel_index[ray_index];
-		aov_framebuffer_set(AOVType::RADIANCE, pixel_index, make_float4(1.0f));
+extern "C" __global__ void kernel_trace_shadow_bvh4(float weight) {
+	bvh4_trace_shadow(&ray_buffer_shadow.traversal_data, buffer_sizes.shadow, &buffer_sizes.rays_retired_shadow, [weight](int ray_index) {
+		ao_record_unoccluded(ray_index, weight);
 	});
 }
 
-extern "C" __global__ void kernel_trace_shadow_bvh8() {
-	bvh8_trace_shadow(&ray_buffer_shadow.traversal_data, buffer_sizes.shadow, &buffer_sizes.rays_retired_shadow, [](int ray_index) {
-		int pixel_index = ray_buffer_shadow.pixel_index[ray_index];
-		aov_framebuffer_set(AOVType::RADIANCE, pixel_index, make_float4(1.0f));
+extern "C" __global__ void kernel_trace_shadow_bvh8(float weight) {
+	bvh8_trace_shadow(&ray_buffer_shadow.traversal_data, buffer_sizes.shadow, &buffer_sizes.rays_retired_shadow, [weight](int ray_index) {
+		ao_record_unoccluded(ray_index, weight);
 	});
 }
 
-extern "C" __global__ void kernel_ambient_occlusion(int sample_index, float ao_radius) {
+extern "C" __global__ void kernel_ambient_occlusion(int sample_index, float ao_radius, int rays_per_hit) {
 	int index = blockIdx.x * blockDim.x + threadIdx.x;
 	if (index >= buffer_sizes.trace) return;
 
@@ -110,19 +120,17 @@ extern "C" __global__ void kernel_ambient_occlusion(int sample_index, float ao_r
 		return; // Hit nothing
 	}
 
-	if (pixel_query.pixel_index == pixel_index) {
-		pixel_query.mesh_id     = hit.mesh_id;
-		pixel_query.triangle_id = hit.triangle_id;
-	}
-
 	// Obtain hit point and normal
-	TrianglePosNor hit_triangle = triangle_get_positions_and_normals(hit.triangle_id);
+	float hit_u = hit.u;
+	float hit_v = hit.v;
+	TrianglePosNorTex hit_triangle = hit_get_triangle(hit.mesh_id, hit.triangle_id, hit_u, hit_v);
 
 	float3 geometric_normal = normalize(cross(hit_triangle.position_edge_1, hit_triangle.position_edge_2));
 
 	float3 hit_point;
 	float3 hit_normal;
-	triangle_barycentric(hit_triangle, hit.u, hit.v, hit_point, hit_normal);
+	float2 hit_tex_coord;
+	triangle_barycentric(hit_triangle, hit_u, hit_v, hit_point, hit_normal, hit_tex_coord);
 
 	// Transform into world space
 	Matrix3x4 world = mesh_get_transform(hit.mesh_id);
@@ -143,22 +151,29 @@ extern "C" __global__ void kernel_ambient_occlusion(int sample_index, float ao_r
 	float3 tangent, bitangent;
 	orthonormal_basis(hit_normal, tangent, bitangent);
 
-	// Sample cosine weighted direction
 	float2 rand_brdf = random<SampleDimension::BSDF_0>(pixel_index, 0, sample_index);
-	float3 omega_o = sample_cosine_weighted_direction(rand_brdf.x, rand_brdf.y);
 
-	float3 direction_out = local_to_world(omega_o, tangent, bitangent, hit_normal);
-	float  pdf = omega_o.z * ONE_OVER_PI;
+	for (int i = 0; i < rays_per_hit; i++) {
+		// Sample cosine weighted direction, multiple Rays per hit are stratified by a Fibonacci lattice that is randomly shifted per pixel
+		constexpr float GOLDEN_RATIO_CONJUGATE = 0.61803398875f;
 
-	if (!pdf_is_valid(pdf)) return;
+		float u1 = fracf(rand_brdf.x + float(i) / float(rays_per_hit));
+		float u2 = fracf(rand_brdf.y + float(i) * GOLDEN_RATIO_CONJUGATE);
+		float3 omega_o = sample_cosine_weighted_direction(u1, u2);
 
-	// Emit Shadow Ray
-	int shadow_ray_index = atomicAdd(&buffer_sizes.shadow, 1);
+		float3 direction_out = local_to_world(omega_o, tangent, bitangent, hit_normal);
+		float  pdf = omega_o.z * ONE_OVER_PI;
 
-	ray_buffer_shadow.traversal_data.ray_origin   .set(shadow_ray_index, ray_origin_epsilon_offset(hit_point, direction_out, geometric_normal));
-	ray_buffer_shadow.traversal_data.ray_direction.set(shadow_ray_index, direction_out);
-	ray_buffer_shadow.traversal_data.max_distance[shadow_ray_index] = ao_radius;
-	ray_buffer_shadow.pixel_index[shadow_ray_index] = pixel_index;
+		if (!pdf_is_valid(pdf)) continue;
+
+		// Emit Shadow Ray
+		int shadow_ray_index = warp_aggregated_increment(&buffer_sizes.shadow);
+
+		ray_buffer_shadow.traversal_data.ray_origin   .set(shadow_ray_index, ray_origin_epsilon_offset(hit_point, direction_out, geometric_normal));
+		ray_buffer_shadow.traversal_data.ray_direction.set(shadow_ray_index, direction_out);
+		ray_buffer_shadow.traversal_data.max_distance[shadow_ray_index] = ao_radius;
+		ray_buffer_shadow.pixel_index[shadow_ray_index] = pixel_index;
+	}
 }
 
 extern "C" __global__ void kernel_accumulate(float frames_accumulated) {
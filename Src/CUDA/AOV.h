@@ -12,6 +12,15 @@ __device__ AOV & get_aov(AOVType aov_type) {
 	return aovs[size_t(aov_type)];
 }
 
+// Disabled AOVs have no framebuffer. If the Module is specialised, CONFIG_AOV_MASK contains every AOV that may be enabled,
+// so writes to the other AOVs are removed at compile time
+__device__ inline bool aov_is_active(AOVType aov_type) {
+#ifdef CONFIG_SPECIALISED
+	if ((CONFIG_AOV_MASK & (1u << unsigned(aov_type))) == 0) return false;
+#endif
+	return get_aov(aov_type).framebuffer != nullptr;
+}
+
 __device__ inline float4 aov_framebuffer_get(AOVType aov_type, int pixel_index) {
 	const AOV & aov = get_aov(aov_type);
 	assert(aov.framebuffer);
@@ -20,21 +29,21 @@ __device__ inline float4 aov_framebuffer_get(AOVType aov_type, int pixel_index)
 
 __device__ inline void aov_framebuffer_set(AOVType aov_type, int pixel_index, float4 value) {
 	AOV & aov = get_aov(aov_type);
-	if (aov.framebuffer) {
+	if (aov_is_active(aov_type)) {
 		aov.framebuffer[pixel_index] = value;
 	}
 }
 
 __device__ inline void aov_framebuffer_add(AOVType aov_type, int pixel_index, float4 value) {
 	AOV & aov = get_aov(aov_type);
-	if (aov.framebuffer) {
+	if (aov_is_active(aov_type)) {
 		aov.framebuffer[pixel_index] += value;
 	}
 }
 
 __device__ inline float4 aov_accumulate(AOVType aov_type, int pixel_index, float n) {
 	AOV & aov = get_aov(aov_type);
-	if (aov.framebuffer) {
+	if (aov_is_active(aov_type)) {
 		if (n > 0.0f) {
 			aov.accumulator[pixel_index] += (aov.framebuffer[pixel_index] - aov.accumulator[pixel_index]) / n; // Online average
 		} else {
@@ -44,3 +53,17 @@ __device__ inline float4 aov_accumulate(AOVType aov_type, int pixel_index, float
 	}
 	return make_float4(0.0f);
 }
+
+// Same as above, but the framebuffer holds the sum of num_samples samples instead of a single one
+__device__ inline float4 aov_accumulate(AOVType aov_type, int pixel_index, float n, float num_samples) {
+	AOV & aov = get_aov(aov_type);
+	if (aov_is_active(aov_type)) {
+		if (n > 0.0f) {
+			aov.accumulator[pixel_index] += (aov.framebuffer[pixel_index] - num_samples * aov.accumulator[pixel_index]) / (n + num_samples);
+		} else {
+			aov.accumulator[pixel_index] = aov.framebuffer[pixel_index] / num_samples;
+		}
+		return aov.accumulator[pixel_index];
+	}
+	return make_float4(0.0f);
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "Util.h"
+#include "Config.h"
+#include "VariableRate.h"
+
+// Per Pixel: mean luminance, mean squared luminance, number of samples, and 1 if the Pixel has not converged yet
+__device__ __constant__ float4 * adaptive_moments;
+
+// Compacted list of the Pixels that have not converged yet (and are due a sample under variable rate sampling), in the [0, screen_width * screen_height) index space of kernel_generate
+// The list is rebuilt by kernel_accumulate every frame and consumed by kernel_generate on the next frame
+__device__ __constant__ int * adaptive_pixels;
+__device__ __constant__ int * adaptive_pixel_count;
+
+__device__ inline bool adaptive_sampling_enabled() {
+	return config.enable_adaptive_sampling && !CONFIG_ENABLE_SVGF;
+}
+
+// The Pixel list and moments are shared with variable rate sampling
+__device__ inline bool pixel_list_enabled() {
+	return adaptive_sampling_enabled() || variable_rate_enabled();
+}
+
+// The list of active Pixels only exists after the first sample, before that every Pixel is rendered
+__device__ inline bool adaptive_sampling_use_pixel_list(int sample_index) {
+	return pixel_list_enabled() && sample_index > 0;
+}
+
+// A Pixel has converged once the standard error of its mean luminance is small relative to the mean itself
+// The mean is clamped from below to avoid dark Pixels never converging
+__device__ inline bool adaptive_pixel_converged(float4 moment) {
+	float mean     = moment.x;
+	float variance = fmaxf(moment.y - mean * mean, 0.0f);
+
+	float standard_error = sqrtf(variance / moment.z);
+
+	return standard_error <= config.adaptive_sampling_threshold * fmaxf(mean, 0.01f);
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+// Builds the alpha masks and Triangle states that triangle_alpha_test in Raytracing/Triangle.h reads during traversal
+// Both are derived once from the resident Textures and Triangles, see Integrator::init_alpha_masks
+
+// One thread per texel, a warp packs its 32 consecutive texels into a single word of the mask
+// The opacity is read from the given channel at the given Mip level, transparent_count receives the number of texels below 0.5
+extern "C" __global__ void kernel_alpha_mask_build(int texture_id, int channel, float lod, int width, int height, unsigned * mask_bits, int * transparent_count) {
+	int texel_index = blockIdx.x * blockDim.x + threadIdx.x;
+	int texel_count = width * height;
+
+	bool is_opaque = false;
+
+	if (texel_index < texel_count) {
+		int x = texel_index % width;
+		int y = texel_index / width;
+
+		float s = (float(x) + 0.5f) / float(width);
+		float t = (float(y) + 0.5f) / float(height);
+
+		float4 texel = texture_get(texture_id).get_lod(s, t, lod);
+
+		float opacity;
+		switch (channel) {
+			case 0:  opacity = texel.x; break;
+			case 1:  opacity = texel.y; break;
+			case 2:  opacity = texel.z; break;
+			default: opacity = texel.w; break;
+		}
+		is_opaque = opacity >= 0.5f;
+	}
+
+	unsigned opaque_mask = __ballot_sync(0xffffffff, is_opaque);
+	unsigned valid_mask  = __ballot_sync(0xffffffff, texel_index < texel_count);
+
+	if (threadIdx.x % WARP_SIZE == 0 && valid_mask != 0) {
+		mask_bits[texel_index / 32] = opaque_mask;
+
+		int transparent = __popc(valid_mask & ~opaque_mask);
+		if (transparent > 0) {
+			atomicAdd(transparent_count, transparent);
+		}
+	}
+}
+
+// Classifies the Triangles [first_triangle, first_triangle + triangle_count) against an alpha mask, one thread per Triangle
+// The texels inside the bounds of the texture coordinates of a Triangle are a superset of the texels it covers,
+// so if they are all opaque (or all transparent) so is the Triangle. Large or ambiguous Triangles remain UNKNOWN
+extern "C" __global__ void kernel_alpha_mask_classify(int mask_id, int first_triangle, int triangle_count, unsigned * triangle_states) {
+	int index = blockIdx.x * blockDim.x + threadIdx.x;
+	if (index >= triangle_count) return;
+
+	int triangle_id = first_triangle + index;
+
+	uint4 vertex_0, vertex_1, vertex_2;
+	triangle_get_vertices(__ldg(&triangles[triangle_id].part_2), vertex_0, vertex_1, vertex_2);
+
+	float2 tex_coord_0 = triangle_decode_tex_coord(vertex_0);
+	float2 tex_coord_1 = triangle_decode_tex_coord(vertex_1);
+	float2 tex_coord_2 = triangle_decode_tex_coord(vertex_2);
+
+	AlphaMask mask = alpha_mask_get(mask_id);
+	float2    size = make_float2(float(mask.width), float(mask.height));
+
+	float2 texel_min = fminf(fminf(tex_coord_0, tex_coord_1), tex_coord_2) * size;
+	float2 texel_max = fmaxf(fmaxf(tex_coord_0, tex_coord_1), tex_coord_2) * size;
+
+	AlphaState state = AlphaState::UNKNOWN;
+
+	// Also rejects NaN and very large texture coordinates
+	if ((texel_max.x - texel_min.x + 1.0f) * (texel_max.y - texel_min.y + 1.0f) <= float(ALPHA_MASK_MAX_FOOTPRINT)) {
+		int x_min = int(floorf(texel_min.x));
+		int y_min = int(floorf(texel_min.y));
+		int x_max = int(floorf(texel_max.x));
+		int y_max = int(floorf(texel_max.y));
+
+		bool any_opaque      = false;
+		bool any_transparent = false;
+
+		for (int y = y_min; y <= y_max; y++) {
+			for (int x = x_min; x <= x_max; x++) {
+				if (alpha_mask_is_opaque(mask, x, y)) {
+					any_opaque = true;
+				} else {
+					any_transparent = true;
+				}
+			}
+		}
+
+		if (!any_transparent) {
+			state = AlphaState::OPAQUE;
+		} else if (!any_opaque) {
+			state = AlphaState::TRANSPARENT;
+		}
+	}
+
+	// Other threads write the other states in the same word, the Triangles of an updated MeshData are reclassified in place
+	int shift = 2 * (triangle_id % 16);
+	atomicAnd(&triangle_states[triangle_id / 16], ~(3u << shift));
+	atomicOr (&triangle_states[triangle_id / 16], unsigned(state) << shift);
+}
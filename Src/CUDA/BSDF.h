@@ -7,6 +7,7 @@
 
 struct BSDFDiffuse {
 	static constexpr bool HAS_ALBEDO = true;
+	static constexpr bool ALLOW_GUIDING = true; // See PathGuiding.h
 
 	int pixel_index;
 	int bounce;
@@ -25,13 +26,13 @@ struct BSDFDiffuse {
 		material = material_as_diffuse(material_id);
 	}
 
-	__device__ void calc_albedo(int bounce, int pixel_index, float3 & throughput, float2 tex_coord, const TextureLOD & lod) {
+	__device__ void calc_parameters(int bounce, int pixel_index, float3 & throughput, float2 tex_coord, const TextureLOD & lod) {
 		albedo = sample_albedo(bounce, material.diffuse, material.texture_id, tex_coord, lod);
 
 		if (bounce == 0) {
 			aov_framebuffer_set(AOVType::ALBEDO, pixel_index, make_float4(albedo));
 		}
-		if (!(config.enable_svgf && bounce == 0)) {
+		if (!(CONFIG_ENABLE_SVGF && bounce == 0)) {
 			throughput *= albedo;
 		}
 	}
@@ -66,6 +67,7 @@ struct BSDFDiffuse {
 
 struct BSDFPlastic {
 	static constexpr bool HAS_ALBEDO = true;
+	static constexpr bool ALLOW_GUIDING = true;
 
 	int pixel_index;
 	int bounce;
@@ -87,9 +89,11 @@ struct BSDFPlastic {
 		material = material_as_plastic(material_id);
 	}
 
-	__device__ void calc_albedo(int bounce, int pixel_index, float3 & ray_throughput, float2 tex_coord, const TextureLOD & lod) {
+	__device__ void calc_parameters(int bounce, int pixel_index, float3 & ray_throughput, float2 tex_coord, const TextureLOD & lod) {
 		albedo = sample_albedo(bounce, material.diffuse, material.texture_id, tex_coord, lod);
 
+		material.linear_roughness = sample_roughness(bounce, material.linear_roughness, material.roughness_texture_id, tex_coord, lod);
+
 		if (bounce == 0) {
 			aov_framebuffer_set(AOVType::ALBEDO, pixel_index, make_float4(albedo));
 		}
@@ -181,7 +185,7 @@ struct BSDFPlastic {
 	}
 
 	__device__ bool has_texture() const {
-		return material.texture_id != INVALID;
+		return material.texture_id != INVALID || material.roughness_texture_id != INVALID;
 	}
 
 	__device__ bool allow_nee() const {
@@ -191,6 +195,7 @@ struct BSDFPlastic {
 
 struct BSDFDielectric {
 	static constexpr bool HAS_ALBEDO = false;
+	static constexpr bool ALLOW_GUIDING = false;
 
 	int pixel_index;
 	int bounce;
@@ -212,8 +217,8 @@ struct BSDFDielectric {
 		eta = entering_material ? 1.0f / material.ior : material.ior;
 	}
 
-	__device__ void calc_albedo(int bounce, int pixel_index, float3 & throughput, float2 tex_coord, const TextureLOD & lod) {
-		// NO-OP
+	__device__ void calc_parameters(int bounce, int pixel_index, float3 & throughput, float2 tex_coord, const TextureLOD & lod) {
+		material.linear_roughness = sample_roughness(bounce, material.linear_roughness, material.roughness_texture_id, tex_coord, lod);
 	}
 
 	__device__ bool eval(float3 to_light, float cos_theta_o, float3 & bsdf, float & pdf) const {
@@ -394,7 +399,7 @@ struct BSDFDielectric {
 	}
 
 	__device__ bool has_texture() const {
-		return false;
+		return material.roughness_texture_id != INVALID;
 	}
 
 	__device__ bool allow_nee() const {
@@ -404,6 +409,7 @@ struct BSDFDielectric {
 
 struct BSDFConductor {
 	static constexpr bool HAS_ALBEDO = false;
+	static constexpr bool ALLOW_GUIDING = false;
 
 	int pixel_index;
 	int bounce;
@@ -421,8 +427,8 @@ struct BSDFConductor {
 		material = material_as_conductor(material_id);
 	}
 
-	__device__ void calc_albedo(int bounce, int pixel_index, float3 & throughput, float2 tex_coord, const TextureLOD & lod) {
-		// NO-OP
+	__device__ void calc_parameters(int bounce, int pixel_index, float3 & throughput, float2 tex_coord, const TextureLOD & lod) {
+		material.linear_roughness = sample_roughness(bounce, material.linear_roughness, material.roughness_texture_id, tex_coord, lod);
 	}
 
 	__device__ bool eval(float3 to_light, float cos_theta_o, float3 & bsdf, float & pdf) const {
@@ -516,7 +522,7 @@ struct BSDFConductor {
 	}
 
 	__device__ bool has_texture() const {
-		return false;
+		return material.roughness_texture_id != INVALID;
 	}
 
 	__device__ bool allow_nee() const {
@@ -0,0 +1,76 @@
+#pragma once
+#include "Util.h"
+#include "Config.h"
+#include "Raytracing/Triangle.h"
+
+// Texture space baking, see IntegratorType::BAKE
+// The screen is an atlas of square tiles of bake_tile_size texels, one tile per Mesh, which holds the [0, 1] UV square of that Mesh
+// kernel_bake_rasterise finds the Triangle that covers the centre of every texel, kernel_bake_compact gathers the covered texels into a list,
+// which kernel_bake_generate walks instead of the Pixels of the Camera. From there on the paths go through the regular wavefront Kernels
+__device__ __constant__ int4 * bake_texels;      // Per Pixel (mesh_id, triangle_id, u, v) of the covering Triangle, mesh_id is INVALID for uncovered texels
+__device__ __constant__ int  * bake_texel_list;  // Pixel indices of the covered texels
+__device__ __constant__ int  * bake_texel_count;
+
+__device__ __constant__ int bake_tile_size;
+__device__ __constant__ int bake_dilation;
+
+// One thread per Triangle of a single Mesh, the tile is given in texels
+// Texels that are covered by multiple Triangles (overlapping UVs) end up with any one of them
+extern "C" __global__ void kernel_bake_rasterise(int mesh_id, int triangle_first, int triangle_count, int tile_x, int tile_y) {
+	int index = blockIdx.x * blockDim.x + threadIdx.x;
+	if (index >= triangle_count) return;
+
+	int triangle_id = triangle_first + index;
+
+	TrianglePosNorTex triangle = triangle_get_positions_normals_and_tex_coords(triangle_id);
+
+	float2 tex_coord_0 = triangle.tex_coord_0      * float(bake_tile_size);
+	float2 edge_1      = triangle.tex_coord_edge_1 * float(bake_tile_size);
+	float2 edge_2      = triangle.tex_coord_edge_2 * float(bake_tile_size);
+
+	float det = edge_1.x * edge_2.y - edge_1.y * edge_2.x;
+	if (fabsf(det) < 1e-8f) return; // Degenerate in UV space
+
+	float det_inv = 1.0f / det;
+
+	float2 tex_coord_min = fminf(tex_coord_0, fminf(tex_coord_0 + edge_1, tex_coord_0 + edge_2));
+	float2 tex_coord_max = fmaxf(tex_coord_0, fmaxf(tex_coord_0 + edge_1, tex_coord_0 + edge_2));
+
+	// Texels whose centre lies inside the bounding box, UVs outside of [0, 1] are clamped to the tile
+	int x_min = max(int(ceilf (tex_coord_min.x - 0.5f)), 0);
+	int y_min = max(int(ceilf (tex_coord_min.y - 0.5f)), 0);
+	int x_max = min(int(floorf(tex_coord_max.x - 0.5f)), bake_tile_size - 1);
+	int y_max = min(int(floorf(tex_coord_max.y - 0.5f)), bake_tile_size - 1);
+
+	for (int y = y_min; y <= y_max; y++) {
+		for (int x = x_min; x <= x_max; x++) {
+			float2 p = make_float2(float(x) + 0.5f, float(y) + 0.5f) - tex_coord_0;
+
+			float u = (p.x * edge_2.y - p.y * edge_2.x) * det_inv;
+			float v = (edge_1.x * p.y - edge_1.y * p.x) * det_inv;
+
+			if (u < 0.0f || v < 0.0f || u + v > 1.0f) continue;
+
+			int pixel_index = (tile_x + x) + (tile_y + y) * screen_pitch;
+			bake_texels[pixel_index] = make_int4(mesh_id, triangle_id, __float_as_int(u), __float_as_int(v));
+		}
+	}
+}
+
+__device__ inline bool bake_texel_is_covered(int pixel_index) {
+	return bake_texels[pixel_index].x != INVALID;
+}
+
+// One thread per Pixel, appends the covered texels to bake_texel_list
+extern "C" __global__ void kernel_bake_compact() {
+	int x = blockIdx.x * blockDim.x + threadIdx.x;
+	int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+	if (x >= screen_width || y >= screen_height) return;
+
+	int pixel_index = x + y * screen_pitch;
+
+	if (bake_texel_is_covered(pixel_index)) {
+		bake_texel_list[warp_aggregated_increment(bake_texel_count)] = pixel_index;
+	}
+}
@@ -1,19 +1,30 @@
 #pragma once
+#include "Config.h"
+
 #include "Raytracing/Ray.h"
 
 // Vector3 buffer in SoA layout
+// With CONFIG_PACKED_RAY_BUFFERS x points to one float4 per element instead and y and z are unused
 struct Vector3_SoA {
 	float * x;
 	float * y;
 	float * z;
 
 	__device__ void set(int index, float3 vector) {
+		if (CONFIG_PACKED_RAY_BUFFERS) {
+			reinterpret_cast<float4 *>(x)[index] = make_float4(vector.x, vector.y, vector.z, 0.0f);
+			return;
+		}
 		x[index] = vector.x;
 		y[index] = vector.y;
 		z[index] = vector.z;
 	}
 
 	__device__ float3 get(int index) const {
+		if (CONFIG_PACKED_RAY_BUFFERS) {
+			float4 vector = reinterpret_cast<const float4 *>(x)[index];
+			return make_float3(vector.x, vector.y, vector.z);
+		}
 		return make_float3(
 			x[index],
 			y[index],
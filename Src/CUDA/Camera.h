@@ -17,13 +17,31 @@ struct Camera {
 	float  focal_distance;
 };
 
+__device__ __constant__ Camera camera;
+
+// Cameras of every view if the Pathtracer traces multiple views in one wavefront, view 0 equals camera (see Integrator::view_count)
+__device__ __constant__ Camera * view_cameras;
+
+// Sample position within the Pixel that was used to rasterise the primary visibility, shared by all Pixels (see VisibilityBuffer.h)
+__device__ __constant__ float2 raster_jitter;
+
+// Time at which the Path samples the Scene, 0 is the previous frame and 1 the current frame (see mesh_get_transform)
+// The time is the same for every bounce of a Path, so that all of its Rays see the same Scene
+__device__ inline float camera_sample_time(int pixel_index, int sample_index) {
+	if (!CONFIG_ENABLE_MOTION_BLUR) return 1.0f;
+
+	return random<SampleDimension::TIME>(pixel_index, 0, sample_index).x;
+}
+
 __device__ inline Ray camera_generate_ray(int pixel_index, int sample_index, int x, int y, const Camera & camera) {
 	float2 rand_filter   = random<SampleDimension::FILTER>  (pixel_index, 0, sample_index);
 	float2 rand_aperture = random<SampleDimension::APERTURE>(pixel_index, 0, sample_index);
 
 	float2 jitter;
 
-	if (config.enable_svgf) {
+	if (config.enable_raster_primary) {
+		jitter = raster_jitter;
+	} else if (CONFIG_ENABLE_SVGF) {
 		jitter.x = taa_halton_x[sample_index & (TAA_HALTON_NUM_SAMPLES-1)];
 		jitter.y = taa_halton_y[sample_index & (TAA_HALTON_NUM_SAMPLES-1)];
 	} else {
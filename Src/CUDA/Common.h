@@ -32,16 +32,55 @@ enum struct AOVType {
 	ALBEDO,
 	NORMAL,
 	POSITION,
+	TRAVERSAL_COST, // BVH traversal counters per Pixel: x = Node tests, y = Triangle tests, z = Shadow Ray Node tests, w = Shadow Ray Triangle tests
+	RADIANCE_CACHE, // Estimate of the radiance cache at the primary hit, see RadianceCache.h
 
 	COUNT
 };
 
+// Counter of the TRAVERSAL_COST AOV that is shown as false colour instead of the final image
+enum struct TraversalHeatmap {
+	NONE,
+	NODES,
+	TRIANGLES,
+	SHADOW
+};
+
+// Kinds of Rays that a Mesh can be hidden from, Mesh::visibility_mask has a bit per entry
+// Hidden Meshes are skipped in the TLAS without descending into their BLAS
+enum struct MeshVisibility {
+	TRACE,  // Rays traced by the trace kernels, from the camera and after every bounce
+	SHADOW, // Shadow Rays, a Mesh that does not cast shadows (e.g. an emissive light rig) has no effect on them
+
+	COUNT
+};
+
+// Alpha masks cut out the surface of Meshes whose Material has an alpha Texture, see triangle_alpha_test
+// The mask id per Mesh has this bit set if the Triangle states of its MeshData were classified against that same mask
+#define ALPHA_MASK_CLASSIFIED    (1 << 30)
+#define ALPHA_MASK_MAX_SIZE      2048 // Larger Textures use a coarser Mip level for their mask
+#define ALPHA_MASK_MAX_FOOTPRINT 256  // Triangles whose texture coordinates span more texels are left unclassified
+
+// Levels of detail of a MeshData, the TLAS traversal picks one per Ray and Mesh from the width of its Ray Cone, see bvh_select_lod
+#define MESH_LOD_MAX_LEVELS 4 // Including the full resolution MeshData
+
+struct MeshLODChain {
+	float center[3]; // Of the full resolution MeshData, in object space
+	int   level_count;
+
+	int   bvh_offsets   [MESH_LOD_MAX_LEVELS]; // BLAS root of every level, from full resolution to coarsest
+	float triangle_sizes[MESH_LOD_MAX_LEVELS]; // Typical edge length of the Triangles of every level, in object space
+};
+
 struct GPUConfig {
 	// Output
 	ReconstructionFilter reconstruction_filter = ReconstructionFilter::GAUSSIAN;
 
 	unsigned aov_mask = 0;
 
+	TraversalHeatmap traversal_heatmap       = TraversalHeatmap::NONE;
+	float            traversal_heatmap_range = 256.0f; // Cost per Pixel that maps to the hottest colour
+
 
 	// Pathtracing
 	int num_bounces = 10;
@@ -49,10 +88,60 @@ struct GPUConfig {
 	bool enable_mipmapping                   = true;
 	bool enable_next_event_estimation        = true;
 	bool enable_multiple_importance_sampling = true;
+	bool enable_light_bvh                    = false; // Sample lights using the Light BVH instead of proportional to their power only
+	bool enable_sky_sampling                 = true;  // Importance sample the Sky during Next Event Estimation
 	bool enable_russian_roulette             = true;
+	bool enable_material_sorting             = false;
 	bool enable_svgf                         = false;
 	bool enable_spatial_variance             = true;
 	bool enable_taa                          = true;
+	bool enable_adaptive_sampling            = false; // Stop sampling Pixels that have converged, only applies when accumulating (no SVGF)
+	bool enable_variable_rate                = false; // Sample Tiles away from the foveation centre (or as given by a mask) on fewer frames, only applies when accumulating (no SVGF), see VariableRate.h
+	bool enable_reprojection                 = false; // Reproject the accumulated Pixels when the Camera moves instead of restarting, only applies when accumulating (no SVGF), see Reprojection.h
+	bool enable_compact_history              = false; // Store the SVGF and TAA History Buffers at half precision
+	bool enable_motion_blur                  = false; // Interpolate the Transforms of moving Meshes over the interval between the previous and current frame
+	bool enable_shadow_occluder_cache        = false; // Test the primitive that last occluded a shadow Ray of the same Pixel before traversing the BVH
+	bool enable_restir                       = false; // Resample the light Triangles on the primary hit with ReSTIR DI, with temporal and spatial reuse, see ReSTIR.h
+	bool enable_path_guiding                 = false; // Sample Diffuse and Plastic bounces partly from a learned distribution of incident radiance, see PathGuiding.h
+	bool enable_sobol_sampler                = false; // Generate samples on the fly from an Owen scrambled Sobol sequence instead of the PMJ table, stays stratified at any sample count
+	bool enable_raster_primary               = false; // Rasterise the primary visibility with OpenGL instead of tracing the primary Rays, see VisibilityBuffer.h
+	bool enable_radiance_cache               = false; // Terminate paths on Diffuse and Plastic vertices with the estimate of a world space cache of outgoing radiance, see RadianceCache.h
+	bool enable_adjoint_russian_roulette     = false; // Base the survival probability on the expected contribution to the Pixel (from the radiance cache) instead of the throughput
+	bool enable_geometric_lod                = false; // Trace distant Meshes that have levels of detail through the BLAS of a simplified MeshData, see bvh_select_lod
+
+	float geometric_lod_bias = 1.0f; // Scales the Ray Cone footprint that is compared to the Triangle size of the levels of detail, higher values pick coarser levels
+
+
+	// Adaptive Sampling
+	float adaptive_sampling_threshold   = 0.02f; // Relative standard error of the luminance below which a Pixel is considered converged
+	int   adaptive_sampling_min_samples = 32;    // Pixels are tested for convergence every this many samples
+
+
+	// Reprojection
+	int reprojection_max_samples = 256; // Samples a reprojected Pixel keeps at most, so that shading that changes with the view (e.g. highlights) catches up
+
+
+	// Variable Rate Sampling
+	float variable_rate_centre_x = 0.5f; // Foveation centre, relative to the screen size
+	float variable_rate_centre_y = 0.5f;
+	float variable_rate_radius   = 0.25f; // Radius sampled at full rate relative to the screen height, the rate halves for every radius further out
+
+
+	// ReSTIR
+	int   restir_candidate_count = 8;     // Light candidates generated per Pixel per frame
+	int   restir_spatial_count   = 2;     // Neighbouring Reservoirs of the previous frame combined per Pixel, in addition to the temporal one
+	float restir_spatial_radius  = 16.0f; // In Pixels
+	int   restir_max_history     = 20;    // Reused Reservoirs count as at most this many times restir_candidate_count candidates
+
+
+	// Path Guiding
+	float guiding_probability = 0.5f; // Probability of sampling the guiding distribution instead of the BSDF, where the cell has one
+	int   guiding_min_samples = 64;   // Recorded vertices a cell needs before it is used for guiding
+
+
+	// Radiance Cache
+	int radiance_cache_min_bounce  = 1;  // Paths only terminate into the cache from this bounce on, higher values are slower but less biased
+	int radiance_cache_min_samples = 16; // Recorded vertices a cell needs before paths terminate into it, higher values are less noisy
 
 
 	// SVGF
@@ -64,17 +153,53 @@ struct GPUConfig {
 	float sigma_z =  4.0f;
 	float sigma_n = 16.0f;
 	float sigma_l = 10.0f;
+
+	bool  enable_svgf_tile_skip = false;  // Skip the A-Trous iterations for tiles whose Pixels have all converged, see kernel_svgf_classify
+	float svgf_skip_variance    = 0.001f; // Relative Variance of the temporally integrated colour below which a Pixel is considered converged
+	int   svgf_skip_history     = 1024;   // History length above which a Pixel is considered converged regardless of its Variance
 };
 
 // Rendering is performance in batches of BATCH_SIZE pixels
 // Larger batches are more efficient, but also require more GPU memory
+// The Pathtracer determines its batch size at runtime, BATCH_SIZE is used as lower bound
 #define BATCH_SIZE (1080 * 720)
 
+// Path guiding uses a hash grid of GUIDING_HASH_SIZE cells, each with a histogram of GUIDING_BINS_PER_AXIS^2 directions
+// The first GUIDING_MAX_VERTICES vertices of every path are used for training
+#define GUIDING_HASH_SIZE      (1 << 16)
+#define GUIDING_BINS_PER_AXIS  8
+#define GUIDING_BIN_BITS       6
+#define GUIDING_BIN_COUNT      (1 << GUIDING_BIN_BITS)
+#define GUIDING_MAX_VERTICES   4
+#define GUIDING_GRID_RESOLUTION 256 // Cells along the diagonal of the Scene
+
+// The radiance cache uses a hash grid of RADIANCE_CACHE_HASH_SIZE cells with the average outgoing radiance of each
+// The first RADIANCE_CACHE_MAX_VERTICES vertices of every path are used for training
+#define RADIANCE_CACHE_HASH_SIZE       (1 << 20)
+#define RADIANCE_CACHE_MAX_VERTICES    2
+#define RADIANCE_CACHE_GRID_RESOLUTION 1024 // Cells along the diagonal of the Scene
+
+// Variable rate sampling assigns a rate to Tiles of this many Pixels squared, the lowest rate is one sample every 2^VARIABLE_RATE_MAX_LOG2 frames
+#define VARIABLE_RATE_TILE_SIZE 16
+#define VARIABLE_RATE_MAX_LOG2  3
+
 
 // Raytracing
 #define EPSILON 0.0001f
 #define MAX_BOUNCES 128
 
+// Ray sorting uses a key of 3 bits for the direction octant and 3 bits per axis for the origin
+#define RAY_SORT_BITS_PER_AXIS   3
+#define RAY_SORT_KEY_COUNT       (8 << (3 * RAY_SORT_BITS_PER_AXIS))
+#define RAY_SORT_SCAN_BLOCK_SIZE 1024
+
+#define TREELET_ENTRIES_PER_RAY 4 // Capacity of the treelet queues relative to the batch size, see TreeletQueues.h
+#define TREELET_SCAN_BLOCK_SIZE 1024
+#define TREELET_STACK_SIZE      32 // Thread local Stack of the treelet traversal
+
+// The area distribution of every light MeshData is scanned by a single Block of this many threads, see LightPower.h
+#define LIGHT_CDF_BLOCK_SIZE 1024
+
 
 // RNG
 #define PMJ_NUM_SEQUENCES 64
@@ -99,14 +224,24 @@ struct GPUConfig {
 // SVGF
 #define MAX_ATROUS_ITERATIONS 10
 
+// A-Trous iterations with a step size up to SVGF_TILE_MAX_STEP_SIZE are filtered from a tile in shared memory
+#define SVGF_TILE_SIZE          16
+#define SVGF_TILE_MAX_STEP_SIZE 4
+
 
 // BVH
 #define BVH_STACK_SIZE 32
 
-// Portion of the Stack that resides in Shared Memory
+// Portion of the Stack that resides in Shared Memory, can be overridden per Module (see TraversalBenchmark)
+#ifndef SHARED_STACK_SIZE
 #define SHARED_STACK_SIZE 8
+#endif
 static_assert(SHARED_STACK_SIZE < BVH_STACK_SIZE, "Shared Stack size must be strictly smaller than total Stack size");
 
+// Stack size and maximum depth (TLAS and BLAS combined) of the BVH8 short Stack traversal (see CONFIG_BVH8_SHORT_STACK)
+#define BVH8_SHORT_STACK_SIZE 8
+#define BVH8_TRAIL_SIZE       64
+
 
 // Used to perform mouse interaction with objects in the scene
 struct PixelQuery {
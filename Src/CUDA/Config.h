@@ -6,3 +6,36 @@ __device__ __constant__ int screen_pitch;
 __device__ __constant__ int screen_height;
 
 __device__ __constant__ GPUConfig config;
+
+// Feature toggles that the Kernels branch on. If the Module is compiled with CONFIG_SPECIALISED these are passed
+// as compile time constants instead (see Integrator::get_module_defines), which removes the disabled code paths
+#ifndef CONFIG_SPECIALISED
+#define CONFIG_ENABLE_MIPMAPPING                   config.enable_mipmapping
+#define CONFIG_ENABLE_NEXT_EVENT_ESTIMATION        config.enable_next_event_estimation
+#define CONFIG_ENABLE_MULTIPLE_IMPORTANCE_SAMPLING config.enable_multiple_importance_sampling
+#define CONFIG_ENABLE_RUSSIAN_ROULETTE             config.enable_russian_roulette
+#define CONFIG_ENABLE_SVGF                         config.enable_svgf
+#define CONFIG_ENABLE_MOTION_BLUR                  config.enable_motion_blur
+#endif
+
+// Traversal counters for the TRAVERSAL_COST AOV slow down traversal, so they are only compiled in once the AOV is enabled
+#ifndef CONFIG_TRAVERSAL_HEATMAP
+#define CONFIG_TRAVERSAL_HEATMAP false
+#endif
+
+// BVH8 traversal with a short thread local Stack and restarts instead of the partially Shared Memory Stack, see bvh8_trace_short_stack
+#ifndef CONFIG_BVH8_SHORT_STACK
+#define CONFIG_BVH8_SHORT_STACK false
+#endif
+
+// Vector3_SoA stores one float4 per element instead of three separate arrays, only set for the Pathtracer Module whose
+// Ray buffers are then allocated accordingly (see CUDAVector3_SoA). Trades a padding float for a single vector load
+#ifndef CONFIG_PACKED_RAY_BUFFERS
+#define CONFIG_PACKED_RAY_BUFFERS false
+#endif
+
+// The Material and Shadow Ray buffers store their payloads at reduced precision: oct encoded directions (2x16 bit),
+// half precision throughput and Ray Cones, and the shadow illumination in the shared exponent RGB9E5 format
+#ifndef CONFIG_COMPACT_RAY_PAYLOADS
+#define CONFIG_COMPACT_RAY_PAYLOADS false
+#endif
@@ -0,0 +1,61 @@
+#pragma once
+#include "Util.h"
+#include "Config.h"
+
+// Estimate of the error of the accumulated image, used by headless renders to stop once they have converged, see Pathtracer::calc_convergence_error
+// Per Pixel: mean luminance of a launch, mean squared luminance of a launch, and the number of launches. nullptr if not estimated
+__device__ __constant__ float4 * convergence_moments;
+
+// x = sum over all Pixels of their squared relative standard error, y = number of Pixels
+__device__ __constant__ float2 * convergence_error;
+
+// Called by kernel_accumulate for every Pixel that received new samples, the framebuffer holds the sum of samples_per_launch samples
+__device__ inline void convergence_record(int pixel_index, float frames_accumulated, float4 radiance, float samples_per_launch) {
+	float4 moment = frames_accumulated > 0.0f ? convergence_moments[pixel_index] : make_float4(0.0f);
+
+	float sample_luminance = luminance(radiance.x, radiance.y, radiance.z) / samples_per_launch;
+
+	float n = moment.z + 1.0f;
+	moment.x += (sample_luminance                    - moment.x) / n;
+	moment.y += (sample_luminance * sample_luminance - moment.y) / n;
+	moment.z  = n;
+
+	convergence_moments[pixel_index] = moment;
+}
+
+// One thread per Pixel, every warp sums the squared relative standard errors of its Pixels before adding them to convergence_error
+// Like adaptive_pixel_converged the mean is clamped from below, so that dark Pixels do not dominate the estimate
+extern "C" __global__ void kernel_convergence_error() {
+	int index = blockIdx.x * blockDim.x + threadIdx.x;
+
+	float error = 0.0f;
+	float count = 0.0f;
+
+	if (index < screen_width * screen_height) {
+		int x = index % screen_width;
+		int y = index / screen_width;
+
+		float4 moment = convergence_moments[x + y * screen_pitch];
+
+		if (moment.z > 1.0f) {
+			float mean     = moment.x;
+			float variance = fmaxf(moment.y - mean * mean, 0.0f) * moment.z / (moment.z - 1.0f); // Unbiased sample variance
+
+			float relative_error = sqrtf(variance / moment.z) / fmaxf(mean, 0.01f);
+			if (isfinite(relative_error)) {
+				error = relative_error * relative_error;
+				count = 1.0f;
+			}
+		}
+	}
+
+	for (int offset = WARP_SIZE / 2; offset > 0; offset /= 2) {
+		error += __shfl_down_sync(0xffffffff, error, offset);
+		count += __shfl_down_sync(0xffffffff, count, offset);
+	}
+
+	if (threadIdx.x % WARP_SIZE == 0 && count > 0.0f) {
+		atomicAdd(&convergence_error->x, error);
+		atomicAdd(&convergence_error->y, count);
+	}
+}
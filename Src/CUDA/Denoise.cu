@@ -0,0 +1,21 @@
+#include "cudart/vector_types.h"
+#include "cudart/cuda_math.h"
+
+#include "Common.h"
+
+#include "Util.h"
+#include "Config.h"
+#include "AOV.h"
+
+#include "Raytracing/Ray.h"
+
+// The Kernels that filter and present the frame once the Pathtracer Module has rendered it. They only communicate with
+// the Pathtracer Kernels through the AOVs, the GBuffers and the accumulator, so they are compiled as a separate Module
+// that compiles in parallel with the Pathtracer Module and is only recompiled if its own sources change
+#include "SVGF/GBuffer.h"
+#include "SVGF/SVGF.h"
+#include "SVGF/TAA.h"
+#include "Upscale.h"
+
+// Final Frame Buffer, shared with OpenGL. The Pathtracer Module declares it as well (see Integrator::get_global_shared)
+__device__ __constant__ Surface<float4> accumulator;
@@ -0,0 +1,126 @@
+#pragma once
+#include "Util.h"
+
+#include "Raytracing/Mesh.h"
+#include "Raytracing/Triangle.h"
+
+// Light BVH over all emissive Triangle instances in world space, see LightBVH.h on the host
+struct LightBVHNode {
+	float3 aabb_min;
+	float  power;
+	float3 aabb_max;
+	float  theta_o;
+	float3 axis;
+	int    index; // Leaf: ~primitive index, otherwise index of the left child (the right child directly follows it)
+};
+
+__device__ __constant__ const LightBVHNode * light_bvh_nodes;
+__device__ __constant__ const int          * light_bvh_node_parents;
+__device__ __constant__ const int2         * light_bvh_primitives;       // Triangle index and TLAS index of every primitive
+__device__ __constant__ const int          * light_bvh_primitive_leaves; // Leaf Node of every primitive
+__device__ __constant__ const int2         * light_bvh_mesh_offsets;     // Per TLAS index: first primitive of the Mesh and offset into light_bvh_triangle_local_indices
+__device__ __constant__ const int          * light_bvh_triangle_local_indices; // Maps a Triangle index to the index of the Triangle within its MeshData
+
+// Area of the Triangle after transforming it into world space
+__device__ inline float triangle_area_world(const TrianglePos & triangle, const Matrix3x4 & world) {
+	float3 edge_1 = triangle.position_edge_1;
+	float3 edge_2 = triangle.position_edge_2;
+	matrix3x4_transform_direction(world, edge_1);
+	matrix3x4_transform_direction(world, edge_2);
+
+	return 0.5f * length(cross(edge_1, edge_2));
+}
+
+// Estimates the contribution of all lights below the Node to the given point
+// Lights are two sided, so the angle to the cone axis is folded into [0, pi/2]
+__device__ inline float light_bvh_node_importance(const LightBVHNode & node, const float3 & point) {
+	float3 center = 0.5f * (node.aabb_min + node.aabb_max);
+	float3 extent = node.aabb_max - node.aabb_min;
+
+	float3 to_point = point - center;
+
+	float distance_squared = dot(to_point, to_point);
+	float radius_squared   = 0.25f * dot(extent, extent);
+
+	// Inside the bounding sphere nothing can be said about the orientation
+	if (distance_squared <= radius_squared) {
+		return node.power / fmaxf(radius_squared, EPSILON);
+	}
+
+	float distance = sqrtf(distance_squared);
+
+	float cos_theta = fabsf(dot(to_point, node.axis)) / distance;
+	float theta     = acosf(fminf(cos_theta, 1.0f));
+	float theta_u   = asinf(sqrtf(radius_squared / distance_squared)); // Angle subtended by the bounding sphere
+
+	float theta_prime = fmaxf(theta - node.theta_o - theta_u, 0.0f);
+	if (theta_prime >= 0.5f * PI) return 0.0f;
+
+	return node.power * cosf(theta_prime) / distance_squared;
+}
+
+// Probability of choosing the left child of the given Node, or a negative value if neither child contributes to the point
+__device__ inline float light_bvh_probability_left(int index_left, const float3 & point) {
+	float importance_left  = light_bvh_node_importance(light_bvh_nodes[index_left],     point);
+	float importance_right = light_bvh_node_importance(light_bvh_nodes[index_left + 1], point);
+
+	float importance_total = importance_left + importance_right;
+	if (importance_total <= 0.0f) return -1.0f;
+
+	return importance_left / importance_total;
+}
+
+// Traverses the Light BVH stochastically, returns INVALID if no light contributes to the point
+// The returned pdf is the probability of choosing the Triangle, not including the pdf of choosing a point on it
+__device__ inline int light_bvh_sample(float u, const float3 & point, int & transform_id, float & pdf) {
+	int node_index = 0;
+	pdf = 1.0f;
+
+	while (true) {
+		int index = light_bvh_nodes[node_index].index;
+
+		if (index < 0) {
+			int2 primitive = light_bvh_primitives[~index];
+			transform_id = primitive.y;
+			return primitive.x;
+		}
+
+		float probability_left = light_bvh_probability_left(index, point);
+		if (probability_left < 0.0f) return INVALID;
+
+		// Reuse the random number by rescaling it to [0, 1) for the next level
+		if (u < probability_left) {
+			u /= probability_left;
+			pdf *= probability_left;
+			node_index = index;
+		} else {
+			u = (u - probability_left) / (1.0f - probability_left);
+			pdf *= 1.0f - probability_left;
+			node_index = index + 1;
+		}
+		u = fminf(u, 0.99999994f);
+	}
+}
+
+// Probability that light_bvh_sample() chooses the given Triangle instance from the given point
+__device__ inline float light_bvh_pdf(const float3 & point, int transform_id, int triangle_id) {
+	int2 mesh_offset = light_bvh_mesh_offsets[transform_id];
+	int  primitive_index = mesh_offset.x + light_bvh_triangle_local_indices[mesh_offset.y + triangle_id];
+
+	int node_index = light_bvh_primitive_leaves[primitive_index];
+	float pdf = 1.0f;
+
+	// Walk up to the root, multiplying the probabilities of the choices made along the way
+	while (node_index != 0) {
+		int parent     = light_bvh_node_parents[node_index];
+		int index_left = light_bvh_nodes[parent].index;
+
+		float probability_left = light_bvh_probability_left(index_left, point);
+		if (probability_left < 0.0f) return 0.0f;
+
+		pdf *= node_index == index_left ? probability_left : 1.0f - probability_left;
+		node_index = parent;
+	}
+
+	return pdf;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+// Builds the area distributions over the light Triangles that sample_light in Sampling.h reads, see Pathtracer::calc_light_power
+// The Triangles are read from the resident aggregated Triangles, so the host only describes which MeshData are lights
+
+// Must match Pathtracer::LightMeshData
+struct LightMeshData {
+	int first_light_triangle; // Into light_triangle_indices and light_triangle_cdf
+	int triangle_count;
+	int triangle_offset;      // Into reverse_indices, see GPUScene::mesh_data_triangle_offsets
+	int emission_texture_id;  // Of the Material of the Meshes that use this distribution, INVALID if the emission is constant
+};
+
+#define LIGHT_TEXTURE_WEIGHT_MIN 0.01f
+
+// Brightness of the emission Texture over a light Triangle, relative to the constant emission it multiplies
+// Read from the Mip level whose texels have about the size of the Triangle in UV space, at the centre of the Triangle in UV space
+// The weight is clamped from below, the Mip level averages texels outside of the Triangle as well, so dark Triangles may still have bright texels
+// Both the distributions built by kernel_light_triangle_cdf and the pdf of a light Triangle that was hit go through this function, so they agree
+__device__ inline float light_triangle_texture_weight(int texture_id, int triangle_id) {
+	if (texture_id == INVALID) return 1.0f;
+
+	TrianglePosNorTex triangle = triangle_get_positions_normals_and_tex_coords(triangle_id);
+
+	Texture<float4> texture = texture_get(texture_id);
+
+	float tex_coord_double_area = fabsf(triangle.tex_coord_edge_1.x * triangle.tex_coord_edge_2.y - triangle.tex_coord_edge_2.x * triangle.tex_coord_edge_1.y);
+	float lod = texture.lod_bias + 0.5f * log2f(fmaxf(0.5f * tex_coord_double_area, 1e-12f));
+
+	float2 tex_coord_centre = triangle.tex_coord_0 + (triangle.tex_coord_edge_1 + triangle.tex_coord_edge_2) * (1.0f / 3.0f);
+
+	float4 colour = texture.get_lod(tex_coord_centre.x, tex_coord_centre.y, fmaxf(lod, 0.0f));
+	return fmaxf(luminance(colour.x, colour.y, colour.z), LIGHT_TEXTURE_WEIGHT_MIN);
+}
+
+// Weight of a light Triangle per unit area in the distributions over the lights, see Pathtracer::calc_light_power
+__device__ inline float light_triangle_power(const MaterialLight & material, int triangle_id) {
+	return luminance(material.emission.x, material.emission.y, material.emission.z) * light_triangle_texture_weight(material.texture_id, triangle_id);
+}
+
+// Emission at the point (u, v) of a light Triangle. The emission Texture is read at the finest level, Lights are not filtered by the Ray Cone
+__device__ inline float3 light_get_emission(const MaterialLight & material, int triangle_id, float u, float v) {
+	if (material.texture_id == INVALID) return material.emission;
+
+	TrianglePosNorTex triangle = triangle_get_positions_normals_and_tex_coords(triangle_id);
+
+	float2 tex_coord = barycentric(u, v, triangle.tex_coord_0, triangle.tex_coord_edge_1, triangle.tex_coord_edge_2);
+
+	float4 colour = texture_get(material.texture_id).get_lod(tex_coord.x, tex_coord.y, 0.0f);
+	return material.emission * make_float3(colour);
+}
+
+// One Block per light MeshData, the Block walks over the Triangles of its MeshData in tiles of LIGHT_CDF_BLOCK_SIZE
+// Every tile is scanned in shared memory, the running sum across tiles is kept in double precision so that large MeshData stay accurate
+// The areas are weighted by light_triangle_texture_weight, which is also written to texture_weights (if not nullptr) for the Light BVH
+extern "C" __global__ void kernel_light_triangle_cdf(const LightMeshData * light_mesh_datas, const int * reverse_indices, int * triangle_indices, float * triangle_cdf, float * texture_weights, double * total_areas) {
+	__shared__ double shared_sums[LIGHT_CDF_BLOCK_SIZE];
+
+	LightMeshData light_mesh_data = light_mesh_datas[blockIdx.x];
+
+	double carry = 0.0;
+
+	for (int tile = 0; tile < light_mesh_data.triangle_count; tile += LIGHT_CDF_BLOCK_SIZE) {
+		int t = tile + threadIdx.x;
+
+		float area = 0.0f;
+		if (t < light_mesh_data.triangle_count) {
+			int triangle_id = reverse_indices[light_mesh_data.triangle_offset + t];
+
+			TrianglePos triangle = triangle_get_positions(triangle_id);
+			area = 0.5f * length(cross(triangle.position_edge_1, triangle.position_edge_2));
+
+			float texture_weight = light_triangle_texture_weight(light_mesh_data.emission_texture_id, triangle_id);
+			area *= texture_weight;
+
+			triangle_indices[light_mesh_data.first_light_triangle + t] = triangle_id;
+			if (texture_weights) {
+				texture_weights[light_mesh_data.first_light_triangle + t] = texture_weight;
+			}
+		}
+		shared_sums[threadIdx.x] = double(area);
+		__syncthreads();
+
+		// Inclusive Hillis-Steele scan over the tile
+		for (int step = 1; step < LIGHT_CDF_BLOCK_SIZE; step <<= 1) {
+			double value = threadIdx.x >= step ? shared_sums[threadIdx.x - step] : 0.0;
+			__syncthreads();
+			shared_sums[threadIdx.x] += value;
+			__syncthreads();
+		}
+
+		if (t < light_mesh_data.triangle_count) {
+			triangle_cdf[light_mesh_data.first_light_triangle + t] = float(carry + shared_sums[threadIdx.x]);
+		}
+
+		carry += shared_sums[LIGHT_CDF_BLOCK_SIZE - 1];
+		__syncthreads();
+	}
+
+	if (threadIdx.x == 0) {
+		total_areas[blockIdx.x] = carry;
+	}
+}
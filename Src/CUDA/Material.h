@@ -8,7 +8,33 @@ __device__ inline float roughness_to_alpha(float linear_roughness) {
 	return fmaxf(1e-6f, square(linear_roughness));
 }
 
-__device__ const Texture<float4> * textures;
+__device__ __constant__ const Texture<float4> * textures;
+
+__device__ __constant__ int * texture_feedback; // Finest Mip level requested per Texture, nullptr if texture streaming is disabled
+
+// The descriptor of a Texture (see GPUScene::CUDATexture) is read with a single 16 byte load through the read-only cache,
+// instead of separate loads for the Texture Object, the LOD bias and the Mip offset
+__device__ inline Texture<float4> texture_get(int texture_id) {
+	static_assert(sizeof(Texture<float4>) == sizeof(uint4), "Texture descriptor should be 16 bytes");
+
+	uint4 data = __ldg(reinterpret_cast<const uint4 *>(&textures[texture_id]));
+
+	Texture<float4> texture;
+	memcpy(&texture, &data, sizeof(Texture<float4>));
+	return texture;
+}
+
+// Records which Mip level of the full resolution Texture was requested, read back by Integrator::update_texture_streaming
+__device__ inline void texture_feedback_record(int texture_id, const Texture<float4> & texture, float lod) {
+	if (texture_feedback == nullptr) return;
+
+	int level = max(0, int(floorf(lod)) + texture.mip_offset);
+
+	// Avoid the atomic if another sample already requested this level or a finer one
+	if (level < texture_feedback[texture_id]) {
+		atomicMin(&texture_feedback[texture_id], level);
+	}
+}
 
 enum struct MaterialType : char {
 	LIGHT,
@@ -20,21 +46,21 @@ enum struct MaterialType : char {
 
 union Material {
 	struct {
-		float4 emission;
+		float4 emission_and_texture_id;
 	} light;
 	struct {
 		float4 diffuse_and_texture_id;
 	} diffuse;
 	struct {
 		float4 diffuse_and_texture_id;
-		float  linear_roughness;
+		float2 linear_roughness_and_texture_id;
 	} plastic;
 	struct {
-		float4 medium_ior_and_linear_roughness;
+		float4 medium_ior_roughness_and_texture_id;
 	} dielectric;
 	struct {
 		float4 eta_and_linear_roughness;
-		float4 k;
+		float4 k_and_texture_id;
 	} conductor;
 };
 
@@ -47,6 +73,7 @@ __device__ inline MaterialType material_get_type(int material_id) {
 
 struct MaterialLight {
 	float3 emission;
+	int    texture_id; // Multiplies emission, see light_get_emission
 };
 
 struct MaterialDiffuse {
@@ -54,29 +81,34 @@ struct MaterialDiffuse {
 	int    texture_id;
 };
 
+// The linear_roughness of the microfacet Materials is scaled by roughness_texture_id, if present (see sample_roughness)
 struct MaterialPlastic {
 	float3 diffuse;
 	int    texture_id;
 	float  linear_roughness;
+	int    roughness_texture_id;
 };
 
 struct MaterialDielectric {
 	int   medium_id;
 	float ior;
 	float linear_roughness;
+	int   roughness_texture_id;
 };
 
 struct MaterialConductor {
 	float3 eta;
 	float  linear_roughness;
 	float3 k;
+	int    roughness_texture_id;
 };
 
 __device__ inline MaterialLight material_as_light(int material_id) {
-	float4 emission = __ldg(&materials[material_id].light.emission);
+	float4 emission_and_texture_id = __ldg(&materials[material_id].light.emission_and_texture_id);
 
 	MaterialLight material;
-	material.emission = make_float3(emission);
+	material.emission   = make_float3(emission_and_texture_id);
+	material.texture_id = __float_as_int(emission_and_texture_id.w);
 	return material;
 }
 
@@ -90,56 +122,47 @@ __device__ inline MaterialDiffuse material_as_diffuse(int material_id) {
 }
 
 __device__ inline MaterialPlastic material_as_plastic(int material_id) {
-	float4 diffuse_and_texture_id = __ldg(&materials[material_id].plastic.diffuse_and_texture_id);
-	float  linear_roughness       = __ldg(&materials[material_id].plastic.linear_roughness);
+	float4 diffuse_and_texture_id          = __ldg(&materials[material_id].plastic.diffuse_and_texture_id);
+	float2 linear_roughness_and_texture_id = __ldg(&materials[material_id].plastic.linear_roughness_and_texture_id);
 
 	MaterialPlastic material;
-	material.diffuse          = make_float3(diffuse_and_texture_id);
-	material.texture_id       = __float_as_int(diffuse_and_texture_id.w);
-	material.linear_roughness = linear_roughness;
+	material.diffuse              = make_float3(diffuse_and_texture_id);
+	material.texture_id           = __float_as_int(diffuse_and_texture_id.w);
+	material.linear_roughness     = linear_roughness_and_texture_id.x;
+	material.roughness_texture_id = __float_as_int(linear_roughness_and_texture_id.y);
 	return material;
 }
 
 __device__ inline MaterialDielectric material_as_dielectric(int material_id) {
-	float4 medium_ior_and_linear_roughness = __ldg(&materials[material_id].dielectric.medium_ior_and_linear_roughness);
+	float4 medium_ior_roughness_and_texture_id = __ldg(&materials[material_id].dielectric.medium_ior_roughness_and_texture_id);
 
 	MaterialDielectric material;
-	material.medium_id        = __float_as_int(medium_ior_and_linear_roughness.x);
-	material.ior              = medium_ior_and_linear_roughness.y;
-	material.linear_roughness = medium_ior_and_linear_roughness.z;
+	material.medium_id            = __float_as_int(medium_ior_roughness_and_texture_id.x);
+	material.ior                  = medium_ior_roughness_and_texture_id.y;
+	material.linear_roughness     = medium_ior_roughness_and_texture_id.z;
+	material.roughness_texture_id = __float_as_int(medium_ior_roughness_and_texture_id.w);
 	return material;
 }
 
 __device__ inline MaterialConductor material_as_conductor(int material_id) {
 	float4 eta_and_linear_roughness = __ldg(&materials[material_id].conductor.eta_and_linear_roughness);
-	float4 k                        = __ldg(&materials[material_id].conductor.k);
+	float4 k_and_texture_id         = __ldg(&materials[material_id].conductor.k_and_texture_id);
 
 	MaterialConductor material;
-	material.eta              = make_float3(eta_and_linear_roughness);
-	material.linear_roughness = eta_and_linear_roughness.w;
-	material.k                = make_float3(k);
+	material.eta                  = make_float3(eta_and_linear_roughness);
+	material.linear_roughness     = eta_and_linear_roughness.w;
+	material.k                    = make_float3(k_and_texture_id);
+	material.roughness_texture_id = __float_as_int(k_and_texture_id.w);
 	return material;
 }
 
-__device__ inline float3 material_get_albedo(float3 diffuse, int texture_id, float s, float t) {
-	if (texture_id == INVALID) return diffuse;
-
-	float4 tex_colour = textures[texture_id].get(s, t);
-	return diffuse * make_float3(tex_colour);
-}
-
-__device__ inline float3 material_get_albedo(float3 diffuse, int texture_id, float s, float t, float lod) {
-	if (texture_id == INVALID) return diffuse;
-
-	float4 tex_colour = textures[texture_id].get_lod(s, t, lod);
-	return diffuse * make_float3(tex_colour);
-}
-
-__device__ inline float3 material_get_albedo(float3 diffuse, int texture_id, float s, float t, float2 dx, float2 dy) {
-	if (texture_id == INVALID) return diffuse;
-
-	float4 tex_colour = textures[texture_id].get_grad(s, t, dx, dy);
-	return diffuse * make_float3(tex_colour);
+// Textures are decoded as sRGB colours (see TextureLoader::load_stb), non-colour data such as roughness has to be converted back
+__device__ inline float linear_to_srgb(float x) {
+	if (x < 0.0031308f) {
+		return fmaxf(0.0f, x * 12.92f);
+	} else {
+		return fminf(1.0f, powf(x, 1.0f / 2.4f) * 1.055f - 0.055f);
+	}
 }
 
 __device__ inline float fresnel_dielectric(float cos_theta_i, float eta) {
@@ -0,0 +1,66 @@
+#pragma once
+
+// Separable Mipmap downsampling, mirrors Mipmap::downsample on the CPU
+// The filter weights are computed on the host by Mipmap::calc_filter_kernel
+
+__device__ inline float4 unpack_rgba8(uchar4 texel) {
+	return make_float4(
+		float(texel.x) * (1.0f / 255.0f),
+		float(texel.y) * (1.0f / 255.0f),
+		float(texel.z) * (1.0f / 255.0f),
+		float(texel.w) * (1.0f / 255.0f)
+	);
+}
+
+__device__ inline uchar4 pack_rgba8(float4 colour) {
+	uchar4 texel;
+	texel.x = (unsigned char)(clamp(colour.x * 255.0f, 0.0f, 255.0f));
+	texel.y = (unsigned char)(clamp(colour.y * 255.0f, 0.0f, 255.0f));
+	texel.z = (unsigned char)(clamp(colour.z * 255.0f, 0.0f, 255.0f));
+	texel.w = (unsigned char)(clamp(colour.w * 255.0f, 0.0f, 255.0f));
+	return texel;
+}
+
+// Filters the rows of the source level, temp is stored transposed (width_dst x height_src) like on the CPU
+extern "C" __global__ void kernel_mipmap_downsample_x(int width_src, int height_src, int width_dst, const uchar4 * texture_src, float4 * temp, const float * weights, int window_size, float filter_width) {
+	int x = blockIdx.x * blockDim.x + threadIdx.x;
+	int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+	if (x >= width_dst || y >= height_src) return;
+
+	float center = (float(x) + 0.5f) * float(width_src) / float(width_dst);
+
+	int left = int(floorf(center - filter_width));
+
+	float4 sum = make_float4(0.0f);
+
+	for (int i = 0; i < window_size; i++) {
+		int index = clamp(left + i, 0, width_src - 1) + y * width_src;
+
+		sum += weights[i] * unpack_rgba8(texture_src[index]);
+	}
+
+	temp[x * height_src + y] = sum;
+}
+
+// Filters the columns of temp into the destination level
+extern "C" __global__ void kernel_mipmap_downsample_y(int height_src, int width_dst, int height_dst, const float4 * temp, uchar4 * texture_dst, const float * weights, int window_size, float filter_width) {
+	int x = blockIdx.x * blockDim.x + threadIdx.x;
+	int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+	if (x >= width_dst || y >= height_dst) return;
+
+	float center = (float(y) + 0.5f) * float(height_src) / float(height_dst);
+
+	int top = int(floorf(center - filter_width));
+
+	float4 sum = make_float4(0.0f);
+
+	for (int i = 0; i < window_size; i++) {
+		int index = x * height_src + clamp(top + i, 0, height_src - 1);
+
+		sum += weights[i] * temp[index];
+	}
+
+	texture_dst[x + y * width_dst] = pack_rgba8(sum);
+}
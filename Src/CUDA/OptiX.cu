@@ -0,0 +1,125 @@
+#include "cudart/vector_types.h"
+#include "cudart/cuda_math.h"
+
+#include "Common.h"
+
+#include "Util.h"
+#include "Config.h"
+#include "Buffers.h"
+
+#include "Raytracing/BVH.h"
+
+#include <optix.h>
+
+// Hardware traversal of the wavefront trace queues through OptiX, see OptiXTraversal.h
+// The Rays are read from and the hits written to the same Buffers that the software trace Kernels use,
+// so the Pathtracer Kernels that generate and shade the Rays do not know which backend traced them
+
+// Must match OptiXTraversal::Params
+struct OptiXParams {
+	OptixTraversableHandle handle;
+
+	const TraversalData       * traversal_data;        // Ray Buffer of the trace queue, only for __raygen__trace
+	const ShadowTraversalData * shadow_traversal_data; // Only for __raygen__shadow
+
+	const int * ray_count; // Queue size, only known on the GPU
+
+	int       * shadow_occluded;       // Per shadow Ray, resolved by kernel_shadow_resolve in Pathtracer.cu
+	const int * mesh_triangle_offsets; // Per TLAS slot, the offset of the Triangles of its MeshData into the aggregated Triangles
+};
+
+extern "C" __constant__ OptiXParams params;
+
+// The launch does not know the size of the queue up front, it is sized using the queue of the previous frame
+// and every launch index loops over the queue with a stride of the launch width
+extern "C" __global__ void __raygen__trace() {
+	int launch_index = optixGetLaunchIndex().x;
+	int launch_width = optixGetLaunchDimensions().x;
+
+	int ray_count = *params.ray_count;
+
+	for (int ray_index = launch_index; ray_index < ray_count; ray_index += launch_width) {
+		float3 origin    = params.traversal_data->ray_origin   .get(ray_index);
+		float3 direction = params.traversal_data->ray_direction.get(ray_index);
+
+		// Payload registers, they start out as a miss
+		unsigned t           = __float_as_uint(INFINITY);
+		unsigned u           = 0;
+		unsigned v           = 0;
+		unsigned mesh_id     = unsigned(INVALID);
+		unsigned triangle_id = unsigned(INVALID);
+
+		optixTrace(
+			params.handle,
+			origin,
+			direction,
+			0.0f,
+			INFINITY,
+			0.0f,
+			OptixVisibilityMask(1u << int(MeshVisibility::TRACE)),
+			OPTIX_RAY_FLAG_DISABLE_ANYHIT,
+			0, 1, 0,
+			t, u, v, mesh_id, triangle_id
+		);
+
+		RayHit ray_hit;
+		ray_hit.t           = __uint_as_float(t);
+		ray_hit.u           = __uint_as_float(u);
+		ray_hit.v           = __uint_as_float(v);
+		ray_hit.mesh_id     = int(mesh_id);
+		ray_hit.triangle_id = int(triangle_id);
+
+		params.traversal_data->hits.set(ray_index, ray_hit);
+	}
+}
+
+extern "C" __global__ void __closesthit__trace() {
+	// The instance id is the TLAS slot of the Mesh, which is what the shading Kernels expect as mesh_id
+	int    mesh_id     = optixGetInstanceId();
+	float2 barycentric = optixGetTriangleBarycentrics();
+
+	optixSetPayload_0(__float_as_uint(optixGetRayTmax()));
+	optixSetPayload_1(__float_as_uint(barycentric.x));
+	optixSetPayload_2(__float_as_uint(barycentric.y));
+	optixSetPayload_3(unsigned(mesh_id));
+	optixSetPayload_4(unsigned(__ldg(&params.mesh_triangle_offsets[mesh_id]) + optixGetPrimitiveIndex()));
+}
+
+extern "C" __global__ void __miss__trace() {
+	// The payload already describes a miss
+}
+
+extern "C" __global__ void __raygen__shadow() {
+	int launch_index = optixGetLaunchIndex().x;
+	int launch_width = optixGetLaunchDimensions().x;
+
+	int ray_count = *params.ray_count;
+
+	for (int ray_index = launch_index; ray_index < ray_count; ray_index += launch_width) {
+		float3 origin       = params.shadow_traversal_data->ray_origin   .get(ray_index);
+		float3 direction    = params.shadow_traversal_data->ray_direction.get(ray_index);
+		float  max_distance = params.shadow_traversal_data->max_distance[ray_index];
+
+		// Any hit occludes the Ray, only the miss program clears this
+		unsigned occluded = 1;
+
+		optixTrace(
+			params.handle,
+			origin,
+			direction,
+			0.0f,
+			max_distance,
+			0.0f,
+			OptixVisibilityMask(1u << int(MeshVisibility::SHADOW)),
+			OPTIX_RAY_FLAG_TERMINATE_ON_FIRST_HIT | OPTIX_RAY_FLAG_DISABLE_ANYHIT | OPTIX_RAY_FLAG_DISABLE_CLOSESTHIT,
+			0, 1, 1,
+			occluded
+		);
+
+		params.shadow_occluded[ray_index] = int(occluded);
+	}
+}
+
+extern "C" __global__ void __miss__shadow() {
+	optixSetPayload_0(0);
+}
@@ -0,0 +1,234 @@
+#pragma once
+#include "Util.h"
+#include "Config.h"
+#include "Sampling.h"
+
+// Path guiding with a hashed spatial grid of directional histograms
+// Every cell of the grid stores the incident radiance over GUIDING_BIN_COUNT equal solid angle bins of the sphere (cylindrical mapping of cos(theta) and phi)
+// Paths record their first GUIDING_MAX_VERTICES Diffuse/Plastic vertices in guiding_vertices, illumination found further along the path is added to them,
+// kernel_guiding_train splats the recorded radiance into the grid and kernel_guiding_update turns it into sampling distributions for the next frame
+__device__ __constant__ unsigned * guiding_keys;          // Hash of the cell coordinates, 0 if empty
+__device__ __constant__ int      * guiding_sample_counts; // Number of recorded vertices per cell
+__device__ __constant__ float    * guiding_radiance;      // Per cell per bin, keeps accumulating while the Scene is unchanged
+__device__ __constant__ float    * guiding_cdf;           // Per cell per bin, the last entry is zero if the cell cannot be used for guiding yet
+
+__device__ __constant__ float guiding_cell_size_inv;
+
+struct GuidingVertex {
+	unsigned cell_and_bin; // INVALID if no vertex was recorded
+	float    weight;       // 1 / (luminance(throughput) * pdf) of the sampled direction
+	float    radiance;     // Weighted sum of the illumination found after this vertex
+};
+
+// Per Pixel GUIDING_MAX_VERTICES vertices, indexed by pixel_index * GUIDING_MAX_VERTICES + bounce
+__device__ __constant__ GuidingVertex * guiding_vertices;
+
+constexpr float GUIDING_BIN_SOLID_ANGLE = 4.0f * PI / float(GUIDING_BIN_COUNT);
+
+__device__ inline bool guiding_enabled() {
+	return config.enable_path_guiding;
+}
+
+__device__ inline unsigned guiding_hash(float3 position) {
+	int x = int(floorf(position.x * guiding_cell_size_inv));
+	int y = int(floorf(position.y * guiding_cell_size_inv));
+	int z = int(floorf(position.z * guiding_cell_size_inv));
+
+	unsigned hash = pcg_hash(hash_combine(hash_combine(pcg_hash(x), y), z));
+	return hash != 0 ? hash : 1; // 0 marks an empty slot
+}
+
+// Linear probing in the hash table, returns INVALID if the cell does not exist (or the table is full there)
+__device__ inline int guiding_find_cell(float3 position, bool insert) {
+	constexpr int MAX_PROBES = 8;
+
+	unsigned key  = guiding_hash(position);
+	unsigned slot = key & (GUIDING_HASH_SIZE - 1);
+
+	for (int i = 0; i < MAX_PROBES; i++) {
+		unsigned key_slot = guiding_keys[slot];
+
+		if (key_slot == key) return slot;
+
+		if (key_slot == 0) {
+			if (!insert) return INVALID;
+
+			key_slot = atomicCAS(&guiding_keys[slot], 0u, key);
+			if (key_slot == 0 || key_slot == key) return slot;
+		}
+
+		slot = (slot + 1) & (GUIDING_HASH_SIZE - 1);
+	}
+
+	return INVALID;
+}
+
+__device__ inline int guiding_direction_to_bin(float3 direction) {
+	float u = 0.5f + 0.5f * direction.z;
+	float v = 0.5f + 0.5f * atan2f(direction.y, direction.x) * ONE_OVER_PI;
+
+	int bin_u = min(int(u * float(GUIDING_BINS_PER_AXIS)), GUIDING_BINS_PER_AXIS - 1);
+	int bin_v = min(int(v * float(GUIDING_BINS_PER_AXIS)), GUIDING_BINS_PER_AXIS - 1);
+
+	return bin_u + bin_v * GUIDING_BINS_PER_AXIS;
+}
+
+__device__ inline float3 guiding_bin_to_direction(int bin, float u1, float u2) {
+	float u = (float(bin % GUIDING_BINS_PER_AXIS) + u1) / float(GUIDING_BINS_PER_AXIS);
+	float v = (float(bin / GUIDING_BINS_PER_AXIS) + u2) / float(GUIDING_BINS_PER_AXIS);
+
+	float cos_theta = 2.0f * u - 1.0f;
+	float sin_theta = safe_sqrt(1.0f - cos_theta * cos_theta);
+	float phi       = TWO_PI * v - PI;
+
+	float2 sin_cos_phi = sincos(phi);
+
+	return make_float3(sin_theta * sin_cos_phi.y, sin_theta * sin_cos_phi.x, cos_theta);
+}
+
+__device__ inline bool guiding_cell_valid(int cell) {
+	return cell != INVALID && guiding_cdf[cell * GUIDING_BIN_COUNT + GUIDING_BIN_COUNT - 1] > 0.0f;
+}
+
+// Solid angle pdf of sampling the given direction in a valid cell
+__device__ inline float guiding_pdf(int cell, float3 direction) {
+	const float * cdf = guiding_cdf + cell * GUIDING_BIN_COUNT;
+
+	int bin = guiding_direction_to_bin(direction);
+	float probability = cdf[bin] - (bin > 0 ? cdf[bin - 1] : 0.0f);
+
+	return probability / GUIDING_BIN_SOLID_ANGLE;
+}
+
+__device__ inline float3 guiding_sample(int cell, float u0, float u1, float u2) {
+	const float * cdf = guiding_cdf + cell * GUIDING_BIN_COUNT;
+
+	int bin = 0;
+	while (bin < GUIDING_BIN_COUNT - 1 && cdf[bin] <= u0) bin++;
+
+	return guiding_bin_to_direction(bin, u1, u2);
+}
+
+// Samples the outgoing direction from the one-sample MIS mixture of the guiding distribution and the BSDF
+// Updates the throughput by the BSDF over the pdf of the mixture, which is returned in pdf
+template<typename BSDF>
+__device__ bool guiding_sample_bsdf(const BSDF & bsdf, int pixel_index, int bounce, int sample_index, float3 hit_point, float3 & throughput, int & medium_id, float3 & direction_out, float & pdf) {
+	int cell = guiding_find_cell(hit_point, false);
+
+	if (!guiding_cell_valid(cell)) {
+		return bsdf.sample(throughput, medium_id, direction_out, pdf);
+	}
+
+	unsigned rng_state = hash_combine(pcg_hash(pixel_index * MAX_BOUNCES + bounce), sample_index);
+
+	float guiding_probability = config.guiding_probability;
+
+	if (random_hash_chain(rng_state) < guiding_probability) {
+		float u0 = random_hash_chain(rng_state);
+		float u1 = random_hash_chain(rng_state);
+		float u2 = random_hash_chain(rng_state);
+
+		direction_out = guiding_sample(cell, u0, u1, u2);
+
+		float3 bsdf_value;
+		float  bsdf_pdf;
+		if (!bsdf.eval(direction_out, dot(direction_out, bsdf.normal), bsdf_value, bsdf_pdf)) return false;
+
+		pdf = lerp(bsdf_pdf, guiding_pdf(cell, direction_out), guiding_probability);
+		throughput *= bsdf_value / pdf;
+	} else {
+		float bsdf_pdf;
+		if (!bsdf.sample(throughput, medium_id, direction_out, bsdf_pdf)) return false;
+
+		// The BSDF sample already weighted the throughput by 1 / bsdf_pdf
+		pdf = lerp(bsdf_pdf, guiding_pdf(cell, direction_out), guiding_probability);
+		throughput *= bsdf_pdf / pdf;
+	}
+
+	return pdf_is_valid(pdf);
+}
+
+__device__ inline void guiding_record_vertex(int pixel_index, int bounce, float3 hit_point, float3 direction, float3 throughput, float pdf) {
+	if (bounce >= GUIDING_MAX_VERTICES) return;
+
+	float throughput_luminance = luminance(throughput.x, throughput.y, throughput.z);
+	if (!(throughput_luminance > 0.0f)) return;
+
+	int cell = guiding_find_cell(hit_point, true);
+	if (cell == INVALID) return;
+
+	GuidingVertex vertex;
+	vertex.cell_and_bin = (unsigned(cell) << GUIDING_BIN_BITS) | unsigned(guiding_direction_to_bin(direction));
+	vertex.weight       = 1.0f / (throughput_luminance * pdf);
+	vertex.radiance     = 0.0f;
+
+	guiding_vertices[pixel_index * GUIDING_MAX_VERTICES + bounce] = vertex;
+}
+
+// Illumination found at the given bounce arrived through the sampled direction of every earlier vertex
+// The bounces of a Pixel are processed in order, so no atomics are needed
+__device__ inline void guiding_add_illumination(int pixel_index, int bounce, float3 illumination) {
+	float illumination_luminance = luminance(illumination.x, illumination.y, illumination.z);
+
+	GuidingVertex * vertices = guiding_vertices + pixel_index * GUIDING_MAX_VERTICES;
+
+	for (int i = 0; i < min(bounce, GUIDING_MAX_VERTICES); i++) {
+		if (vertices[i].cell_and_bin != unsigned(INVALID)) {
+			vertices[i].radiance += illumination_luminance * vertices[i].weight;
+		}
+	}
+}
+
+extern "C" __global__ void kernel_guiding_train() {
+	int x = blockIdx.x * blockDim.x + threadIdx.x;
+	int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+	if (x >= screen_width || y >= screen_height) return;
+
+	int pixel_index = x + y * screen_pitch;
+
+	GuidingVertex * vertices = guiding_vertices + pixel_index * GUIDING_MAX_VERTICES;
+
+	for (int i = 0; i < GUIDING_MAX_VERTICES; i++) {
+		GuidingVertex vertex = vertices[i];
+		if (vertex.cell_and_bin == unsigned(INVALID)) continue;
+
+		int cell = vertex.cell_and_bin >> GUIDING_BIN_BITS;
+
+		if (isfinite(vertex.radiance) && vertex.radiance > 0.0f) {
+			atomicAdd(&guiding_radiance[vertex.cell_and_bin], vertex.radiance);
+		}
+		atomicAdd(&guiding_sample_counts[cell], 1);
+
+		// Paths that terminate earlier on the next frame should not splat this vertex again
+		vertices[i].cell_and_bin = unsigned(INVALID);
+	}
+}
+
+// Rebuilds the sampling distribution of every cell, mixed with a uniform distribution so that no direction has zero probability
+extern "C" __global__ void kernel_guiding_update() {
+	int cell = blockIdx.x * blockDim.x + threadIdx.x;
+	if (cell >= GUIDING_HASH_SIZE) return;
+
+	const float * radiance = guiding_radiance + cell * GUIDING_BIN_COUNT;
+	float       * cdf      = guiding_cdf      + cell * GUIDING_BIN_COUNT;
+
+	float total = 0.0f;
+	for (int i = 0; i < GUIDING_BIN_COUNT; i++) {
+		total += radiance[i];
+	}
+
+	if (guiding_sample_counts[cell] < config.guiding_min_samples || !(total > 0.0f)) {
+		cdf[GUIDING_BIN_COUNT - 1] = 0.0f;
+		return;
+	}
+
+	constexpr float UNIFORM_FRACTION = 0.1f;
+
+	float sum = 0.0f;
+	for (int i = 0; i < GUIDING_BIN_COUNT; i++) {
+		sum += lerp(radiance[i] / total, 1.0f / float(GUIDING_BIN_COUNT), UNIFORM_FRACTION);
+		cdf[i] = sum;
+	}
+	cdf[GUIDING_BIN_COUNT - 1] = 1.0f;
+}
@@ -16,10 +16,25 @@
 #include "Raytracing/BVH8.h"
 
 #include "Sampling.h"
+#include "LightBVH.h"
 #include "Camera.h"
-
-#include "SVGF/SVGF.h"
-#include "SVGF/TAA.h"
+#include "Pick.h"
+#include "VisibilityBuffer.h"
+#include "AdaptiveSampling.h"
+#include "ReSTIR.h"
+#include "PathGuiding.h"
+#include "RadianceCache.h"
+#include "Convergence.h"
+#include "TreeletQueues.h"
+#include "Bake.h"
+#include "Volume.h"
+
+#include "SVGF/GBuffer.h" // The SVGF, TAA and upscale Kernels are compiled separately, see Denoise.cu
+#include "Reprojection.h"
+
+#include "Mipmap.h"
+#include "AlphaMask.h"
+#include "LightPower.h"
 
 // Final Frame Buffer, shared with OpenGL
 __device__ __constant__ Surface<float4> accumulator;
@@ -45,6 +60,8 @@ struct TraceBuffer {
 };
 
 // Input to the Material Kernels in SoA layout
+// With CONFIG_COMPACT_RAY_PAYLOADS the direction is stored oct encoded in ray_direction.x (2x16 bit), the throughput at half
+// precision in throughput.x (3x16 bit in a uint2) and the cone angle and width at half precision in cone_angle (cone_width is unused)
 struct MaterialBuffer {
 	Vector3_SoA ray_direction;
 
@@ -57,15 +74,99 @@ struct MaterialBuffer {
 
 	int       * pixel_index_and_flags;
 	Vector3_SoA throughput;
+
+	int * sort_index; // Only used if config.enable_material_sorting is set
+
+	__device__ void set_ray_direction(int index, float3 direction) {
+		if (CONFIG_COMPACT_RAY_PAYLOADS) {
+			reinterpret_cast<unsigned *>(ray_direction.x)[index] = oct_encode_unorm16(direction);
+		} else {
+			ray_direction.set(index, direction);
+		}
+	}
+
+	__device__ float3 get_ray_direction(int index) const {
+		if (CONFIG_COMPACT_RAY_PAYLOADS) {
+			return oct_decode_unorm16(reinterpret_cast<const unsigned *>(ray_direction.x)[index]);
+		} else {
+			return ray_direction.get(index);
+		}
+	}
+
+	__device__ void set_throughput(int index, float3 value) {
+		if (CONFIG_COMPACT_RAY_PAYLOADS) {
+			reinterpret_cast<uint2 *>(throughput.x)[index] = make_uint2(float2_to_half2(make_float2(value.x, value.y)), float2_to_half2(make_float2(value.z, 0.0f)));
+		} else {
+			throughput.set(index, value);
+		}
+	}
+
+	__device__ float3 get_throughput(int index) const {
+		if (CONFIG_COMPACT_RAY_PAYLOADS) {
+			uint2  packed = reinterpret_cast<const uint2 *>(throughput.x)[index];
+			float2 xy     = half2_to_float2(packed.x);
+			return make_float3(xy.x, xy.y, half2_to_float2(packed.y).x);
+		} else {
+			return throughput.get(index);
+		}
+	}
+
+	__device__ void set_cone(int index, float angle, float width) {
+		if (CONFIG_COMPACT_RAY_PAYLOADS) {
+			reinterpret_cast<unsigned *>(cone_angle)[index] = float2_to_half2(make_float2(angle, width));
+		} else {
+			cone_angle[index] = angle;
+			cone_width[index] = width;
+		}
+	}
+
+	__device__ void get_cone(int index, float & angle, float & width) const {
+		if (CONFIG_COMPACT_RAY_PAYLOADS) {
+			float2 angle_width = half2_to_float2(reinterpret_cast<const unsigned *>(cone_angle)[index]);
+			angle = angle_width.x;
+			width = angle_width.y;
+		} else {
+			angle = cone_angle[index];
+			width = cone_width[index];
+		}
+	}
 };
 
 // Input to the Shadow Trace Kernels in SoA layout
+// With CONFIG_COMPACT_RAY_PAYLOADS illumination_and_pixel_index holds a uint2 per Ray, the illumination in RGB9E5 and the pixel index
 struct ShadowRayBuffer {
 	ShadowTraversalData traversal_data;
 
 	float4 * illumination_and_pixel_index;
+
+	__device__ void set_illumination_and_pixel_index(int index, float3 illumination, int pixel_index) {
+		if (CONFIG_COMPACT_RAY_PAYLOADS) {
+			reinterpret_cast<uint2 *>(illumination_and_pixel_index)[index] = make_uint2(float3_to_rgb9e5(illumination), pixel_index);
+		} else {
+			illumination_and_pixel_index[index] = make_float4(illumination.x, illumination.y, illumination.z, __int_as_float(pixel_index));
+		}
+	}
+
+	__device__ float3 get_illumination(int index) const {
+		if (CONFIG_COMPACT_RAY_PAYLOADS) {
+			return rgb9e5_to_float3(reinterpret_cast<const uint2 *>(illumination_and_pixel_index)[index].x);
+		} else {
+			return make_float3(illumination_and_pixel_index[index]);
+		}
+	}
+
+	__device__ int get_pixel_index(int index) const {
+		if (CONFIG_COMPACT_RAY_PAYLOADS) {
+			return reinterpret_cast<const uint2 *>(illumination_and_pixel_index)[index].y;
+		} else {
+			return __float_as_int(illumination_and_pixel_index[index].w);
+		}
+	}
 };
 
+// Capacity of the wavefront Buffers, determined at runtime based on available memory
+__device__ __constant__ int batch_size;
+
 __device__ __constant__ TraceBuffer     ray_buffer_trace_0;
 __device__ __constant__ TraceBuffer     ray_buffer_trace_1;
 __device__ __constant__ ShadowRayBuffer ray_buffer_shadow;
@@ -77,6 +178,14 @@ __device__ __constant__ PackedMaterialBuffer material_buffer_plastic;
 __device__ __constant__ PackedMaterialBuffer material_buffer_dielectric;
 __device__ __constant__ PackedMaterialBuffer material_buffer_conductor;
 
+// Rays inside a Medium are queued by kernel_sort for kernel_medium, by their index into the TraceBuffer of the bounce
+// The TraceBuffer stays intact until the next bounce is traced, so the Ray data does not need to be copied
+__device__ __constant__ int * medium_queue;
+
+// Rays that missed the Scene or hit a light are queued by kernel_sort for kernel_miss and kernel_light_hit, also by their TraceBuffer index
+// Both queues share one allocation of batch_size, misses are written from the front and light hits from the back
+__device__ __constant__ int * emission_queue;
+
 struct MaterialBufferAllocation {
 	MaterialBuffer * buffer;
 	bool             reversed;
@@ -107,6 +216,9 @@ struct BufferSizes {
 	int dielectric[MAX_BOUNCES];
 	int conductor [MAX_BOUNCES];
 	int shadow    [MAX_BOUNCES];
+	int medium    [MAX_BOUNCES]; // Rays deferred to kernel_medium
+	int miss      [MAX_BOUNCES]; // Rays deferred to kernel_miss
+	int light_hit [MAX_BOUNCES]; // Rays deferred to kernel_light_hit
 
 	// Global counters for tracing kernels
 	int rays_retired       [MAX_BOUNCES];
@@ -115,84 +227,268 @@ struct BufferSizes {
 
 __device__ BufferSizes buffer_sizes;
 
-__device__ __constant__ Camera camera;
+// Maps an index of the [0, pixel_count) space of kernel_generate to its Pixel and Camera
+// With multiple views the views follow each other, each is stored screen_height rows below the previous one
+__device__ inline const Camera & view_get_pixel(int index, int & x, int & y, int & pixel_index) {
+	int view_pixel_count = screen_width * screen_height;
+	int view = index / view_pixel_count;
+	index -= view * view_pixel_count;
+
+	x = index % screen_width;
+	y = index / screen_width;
 
-__device__ PixelQuery pixel_query = { INVALID, INVALID, INVALID };
+	pixel_index = x + (y + view * screen_height) * screen_pitch;
+
+	return view == 0 ? camera : view_cameras[view];
+}
 
 extern "C" __global__ void kernel_generate(int sample_index, int pixel_offset, int pixel_count) {
 	int index = blockIdx.x * blockDim.x + threadIdx.x;
+
+	// With adaptive sampling only the Pixels in the compacted list are rendered,
+	// the number of primary Rays in this batch is therefore only known on the GPU
+	bool use_pixel_list = adaptive_sampling_use_pixel_list(sample_index);
+	if (use_pixel_list) {
+		int batch_pixel_count = clamp(*adaptive_pixel_count - pixel_offset, 0, pixel_count);
+		if (index == 0) {
+			buffer_sizes.trace[0] = batch_pixel_count;
+		}
+		pixel_count = batch_pixel_count;
+	}
+
 	if (index >= pixel_count) return;
 
 	int index_offset = index + pixel_offset;
-	int x = index_offset % screen_width;
-	int y = index_offset / screen_width;
-
-	int pixel_index = x + y * screen_pitch;
+	if (use_pixel_list) {
+		index_offset = adaptive_pixels[index_offset];
+	}
+	int x;
+	int y;
+	int pixel_index;
+	const Camera & view_camera = view_get_pixel(index_offset, x, y, pixel_index);
 
-	Ray ray = camera_generate_ray(pixel_index, sample_index, x, y, camera);
+	Ray ray = camera_generate_ray(pixel_index, sample_index, x, y, view_camera);
 
 	TraceBuffer * ray_buffer_trace = get_ray_buffer_trace(0);
 
 	ray_buffer_trace->traversal_data.ray_origin   .set(index, ray.origin);
 	ray_buffer_trace->traversal_data.ray_direction.set(index, ray.direction);
 	ray_buffer_trace->pixel_index_and_flags[index] = pixel_index;
+
+	if (CONFIG_ENABLE_MOTION_BLUR) {
+		ray_buffer_trace->traversal_data.ray_time[index] = camera_sample_time(pixel_index, sample_index);
+	}
+
+	// The primary hit is known from the rasterised visibility, the trace Kernel is skipped for bounce 0
+	if (config.enable_raster_primary) {
+		ray_buffer_trace->traversal_data.hits.set(index, visibility_buffer_get_hit(x, y, ray));
+	}
 }
 
-extern "C" __global__ void kernel_trace_bvh2(int bounce) {
-	bvh2_trace(&get_ray_buffer_trace(bounce)->traversal_data, buffer_sizes.trace[bounce], &buffer_sizes.rays_retired[bounce]);
+// Replaces kernel_generate when baking, the paths start on the texels in bake_texel_list instead of at the Camera
+// The first bounce is a cosine weighted direction around the shading normal, so the Radiance of a texel is its irradiance divided by pi
+extern "C" __global__ void kernel_bake_generate(int sample_index, int pixel_offset, int pixel_count) {
+	int index = blockIdx.x * blockDim.x + threadIdx.x;
+	if (index >= pixel_count) return;
+
+	int pixel_index = bake_texel_list[index + pixel_offset];
+
+	int4  texel       = bake_texels[pixel_index];
+	int   mesh_id     = texel.x;
+	int   triangle_id = texel.y;
+	float u           = __int_as_float(texel.z);
+	float v           = __int_as_float(texel.w);
+
+	TrianglePosNor triangle = triangle_get_positions_and_normals(triangle_id);
+
+	float3 position;
+	float3 normal;
+	triangle_barycentric(triangle, u, v, position, normal);
+
+	float time = camera_sample_time(pixel_index, sample_index);
+
+	Matrix3x4 world = mesh_get_transform(mesh_id, time);
+	matrix3x4_transform_position (world, position);
+	matrix3x4_transform_direction(world, normal);
+	matrix3x4_transform_direction(world, triangle.position_edge_1);
+	matrix3x4_transform_direction(world, triangle.position_edge_2);
+
+	normal = normalize(normal);
+
+	// The side of the Triangle the shading normal points to is baked
+	float3 geometric_normal = normalize(cross(triangle.position_edge_1, triangle.position_edge_2));
+	if (dot(geometric_normal, normal) < 0.0f) {
+		geometric_normal = -geometric_normal;
+	}
+
+	float3 tangent, bitangent;
+	orthonormal_basis(normal, tangent, bitangent);
+
+	float2 rand_direction = random<SampleDimension::APERTURE>(pixel_index, 0, sample_index);
+	float3 direction = local_to_world(sample_cosine_weighted_direction(rand_direction.x, rand_direction.y), tangent, bitangent, normal);
+
+	TraceBuffer * ray_buffer_trace = get_ray_buffer_trace(0);
+
+	ray_buffer_trace->traversal_data.ray_origin   .set(index, ray_origin_epsilon_offset(position, direction, geometric_normal));
+	ray_buffer_trace->traversal_data.ray_direction.set(index, direction);
+	ray_buffer_trace->pixel_index_and_flags[index] = pixel_index;
+
+	if (CONFIG_ENABLE_MOTION_BLUR) {
+		ray_buffer_trace->traversal_data.ray_time[index] = time;
+	}
 }
 
-extern "C" __global__ void kernel_trace_bvh4(int bounce) {
-	bvh4_trace(&get_ray_buffer_trace(bounce)->traversal_data, buffer_sizes.trace[bounce], &buffer_sizes.rays_retired[bounce]);
+// Adds the traversal cost of every Ray to the TRAVERSAL_COST AOV of its Pixel, only called if compiled with CONFIG_TRAVERSAL_HEATMAP
+struct TraversalHeatmapTrace {
+	int bounce;
+
+	__device__ void operator()(int ray_index, unsigned node_tests, unsigned triangle_tests) const {
+		int pixel_index = get_ray_buffer_trace(bounce)->pixel_index_and_flags[ray_index] & ~FLAGS_ALL;
+		aov_framebuffer_add(AOVType::TRAVERSAL_COST, pixel_index, make_float4(float(node_tests), float(triangle_tests), 0.0f, 0.0f));
+	}
+};
+
+struct TraversalHeatmapShadow {
+	__device__ void operator()(int ray_index, unsigned node_tests, unsigned triangle_tests) const {
+		int pixel_index = ray_buffer_shadow.get_pixel_index(ray_index);
+		aov_framebuffer_add(AOVType::TRAVERSAL_COST, pixel_index, make_float4(0.0f, 0.0f, float(node_tests), float(triangle_tests)));
+	}
+};
+
+// Last occluder (mesh_id, primitive_id) per Pixel, only allocated if config.enable_shadow_occluder_cache is set
+// Shadow Rays of the same Pixel over consecutive samples tend to be blocked by the same primitive
+__device__ __constant__ int2 * shadow_occluder_cache;
+
+struct ShadowOccluderCachePixel {
+	__device__ int get_pixel_index(int ray_index) const {
+		return ray_buffer_shadow.get_pixel_index(ray_index);
+	}
+
+	__device__ bool test(const ShadowTraversalData * traversal_data, int ray_index, const Ray & ray, float max_distance) const {
+		if (!config.enable_shadow_occluder_cache) return false;
+
+		int2 occluder = shadow_occluder_cache[get_pixel_index(ray_index)];
+		if (occluder.x == INVALID) return false;
+
+		return bvh_intersect_mesh_primitive_shadow(occluder.x, occluder.y, ray, max_distance, traversal_data->ray_time, ray_index);
+	}
+
+	__device__ void store(int ray_index, int mesh_id, int primitive_id) const {
+		if (!config.enable_shadow_occluder_cache) return;
+
+		shadow_occluder_cache[get_pixel_index(ray_index)] = make_int2(mesh_id, primitive_id);
+	}
+};
+
+extern "C" __global__ void kernel_trace_bvh2(int bounce, const int * ray_order) {
+	bvh2_trace<CONFIG_TRAVERSAL_HEATMAP>(&get_ray_buffer_trace(bounce)->traversal_data, buffer_sizes.trace[bounce], &buffer_sizes.rays_retired[bounce], ray_order, TraversalHeatmapTrace { bounce });
 }
 
-extern "C" __global__ void kernel_trace_bvh8(int bounce) {
-	bvh8_trace(&get_ray_buffer_trace(bounce)->traversal_data, buffer_sizes.trace[bounce], &buffer_sizes.rays_retired[bounce]);
+extern "C" __global__ void kernel_trace_bvh4(int bounce, const int * ray_order) {
+	bvh4_trace<CONFIG_TRAVERSAL_HEATMAP>(&get_ray_buffer_trace(bounce)->traversal_data, buffer_sizes.trace[bounce], &buffer_sizes.rays_retired[bounce], ray_order, TraversalHeatmapTrace { bounce });
 }
 
-extern "C" __global__ void kernel_trace_shadow_bvh2(int bounce) {
-	bvh2_trace_shadow(&ray_buffer_shadow.traversal_data, buffer_sizes.shadow[bounce], &buffer_sizes.rays_retired_shadow[bounce], [bounce](int ray_index) {
-		float4 illumination_and_pixel_index = ray_buffer_shadow.illumination_and_pixel_index[ray_index];
-		float3 illumination = make_float3(illumination_and_pixel_index);
-		int    pixel_index  = __float_as_int(illumination_and_pixel_index.w);
+// Levels of detail are picked from the Ray Cone of the Ray, Camera Rays have not spread yet and only use the spread angle
+struct TraversalLODTrace {
+	int bounce;
 
-		aov_framebuffer_add(AOVType::RADIANCE, pixel_index, make_float4(illumination));
-		if (bounce == 0) {
-			aov_framebuffer_set(AOVType::RADIANCE_DIRECT, pixel_index, make_float4(illumination));
-		} else {
-			aov_framebuffer_add(AOVType::RADIANCE_INDIRECT, pixel_index, make_float4(illumination));
+	__device__ int operator()(int ray_index, int mesh_id, int root_index, const Ray & ray, float inv_scale) const {
+		if (!config.enable_geometric_lod || mesh_lod_chain_ids == nullptr) return root_index;
+
+		float cone_angle = camera.pixel_spread_angle;
+		float cone_width = 0.0f;
+		if (bounce > 0 && CONFIG_ENABLE_MIPMAPPING) {
+			cone_angle = get_ray_buffer_trace(bounce)->cone_angle[ray_index];
+			cone_width = get_ray_buffer_trace(bounce)->cone_width[ray_index];
 		}
-	});
+
+		unsigned pixel_index = get_ray_buffer_trace(bounce)->pixel_index_and_flags[ray_index] & ~FLAGS_ALL;
+		return bvh_select_lod(mesh_id, root_index, ray, cone_angle, cone_width, inv_scale, config.geometric_lod_bias, hash_combine(pcg_hash(pixel_index), bounce));
+	}
+};
+
+extern "C" __global__ void kernel_trace_bvh8(int bounce, const int * ray_order) {
+	bvh8_trace<CONFIG_TRAVERSAL_HEATMAP>(&get_ray_buffer_trace(bounce)->traversal_data, buffer_sizes.trace[bounce], &buffer_sizes.rays_retired[bounce], ray_order, TraversalHeatmapTrace { bounce }, TraversalLODTrace { bounce });
 }
 
-extern "C" __global__ void kernel_trace_shadow_bvh4(int bounce) {
-	bvh4_trace_shadow(&ray_buffer_shadow.traversal_data, buffer_sizes.shadow[bounce], &buffer_sizes.rays_retired_shadow[bounce], [bounce](int ray_index) {
-		float4 illumination_and_pixel_index = ray_buffer_shadow.illumination_and_pixel_index[ray_index];
-		float3 illumination = make_float3(illumination_and_pixel_index);
-		int    pixel_index  = __float_as_int(illumination_and_pixel_index.w);
+// Illumination of a path that is traced in-thread (see megakernel_trace_path), summed in registers
+// so that the radiance AOVs are written once when the path terminates instead of at every bounce
+struct PathRadiance {
+	float3 direct;
+	float3 indirect;
+	bool   direct_is_set; // Illumination found at bounce 0 overwrites the direct AOV instead of adding to it
+};
 
-		aov_framebuffer_add(AOVType::RADIANCE, pixel_index, make_float4(illumination));
-		if (bounce == 0) {
-			aov_framebuffer_set(AOVType::RADIANCE_DIRECT, pixel_index, make_float4(illumination));
+// Adds illumination to the radiance AOVs, or to the PathRadiance if there is one. Direct illumination was found at bounce 0, or at bounce 1
+// by BSDF sampling the first hit, all other illumination is indirect. Illumination found at bounce 0 initializes the direct AOV
+// The Radiance AOV is the sum of both, with SVGF it is not written at all since kernel_svgf_finalize combines the filtered AOVs instead
+__device__ inline void path_radiance_add(PathRadiance * path_radiance, int pixel_index, float3 illumination, bool is_direct, bool is_bounce_0) {
+	if (path_radiance) {
+		if (is_bounce_0) {
+			path_radiance->direct        = illumination;
+			path_radiance->direct_is_set = true;
+		} else if (is_direct) {
+			path_radiance->direct += illumination;
 		} else {
-			aov_framebuffer_add(AOVType::RADIANCE_INDIRECT, pixel_index, make_float4(illumination));
+			path_radiance->indirect += illumination;
 		}
-	});
+		return;
+	}
+
+	if (!CONFIG_ENABLE_SVGF) {
+		aov_framebuffer_add(AOVType::RADIANCE, pixel_index, make_float4(illumination)); // The framebuffer may already hold earlier samples of the same launch
+	}
+
+	if (is_bounce_0) {
+		aov_framebuffer_set(AOVType::RADIANCE_DIRECT, pixel_index, make_float4(illumination));
+	} else if (is_direct) {
+		aov_framebuffer_add(AOVType::RADIANCE_DIRECT, pixel_index, make_float4(illumination));
+	} else {
+		aov_framebuffer_add(AOVType::RADIANCE_INDIRECT, pixel_index, make_float4(illumination));
+	}
 }
 
-extern "C" __global__ void kernel_trace_shadow_bvh8(int bounce) {
-	bvh8_trace_shadow(&ray_buffer_shadow.traversal_data, buffer_sizes.shadow[bounce], &buffer_sizes.rays_retired_shadow[bounce], [bounce](int ray_index) {
-		float4 illumination_and_pixel_index = ray_buffer_shadow.illumination_and_pixel_index[ray_index];
-		float3 illumination = make_float3(illumination_and_pixel_index);
-		int    pixel_index  = __float_as_int(illumination_and_pixel_index.w);
+__device__ inline void path_radiance_write(const PathRadiance & path_radiance, int pixel_index) {
+	if (!CONFIG_ENABLE_SVGF) {
+		aov_framebuffer_add(AOVType::RADIANCE, pixel_index, make_float4(path_radiance.direct + path_radiance.indirect));
+	}
 
-		aov_framebuffer_add(AOVType::RADIANCE, pixel_index, make_float4(illumination));
-		if (bounce == 0) {
-			aov_framebuffer_set(AOVType::RADIANCE_DIRECT, pixel_index, make_float4(illumination));
-		} else {
-			aov_framebuffer_add(AOVType::RADIANCE_INDIRECT, pixel_index, make_float4(illumination));
-		}
-	});
+	if (path_radiance.direct_is_set) {
+		aov_framebuffer_set(AOVType::RADIANCE_DIRECT, pixel_index, make_float4(path_radiance.direct));
+	} else {
+		aov_framebuffer_add(AOVType::RADIANCE_DIRECT, pixel_index, make_float4(path_radiance.direct));
+	}
+	aov_framebuffer_add(AOVType::RADIANCE_INDIRECT, pixel_index, make_float4(path_radiance.indirect));
+}
+
+// Adds the illumination of an unoccluded shadow Ray that was emitted at the given bounce
+__device__ inline void shadow_ray_add_illumination(int pixel_index, int bounce, float3 illumination, PathRadiance * path_radiance = nullptr) {
+	if (guiding_enabled()) {
+		guiding_add_illumination(pixel_index, bounce, illumination);
+	}
+	if (radiance_cache_enabled()) {
+		radiance_cache_add_illumination(pixel_index, bounce + 1, illumination);
+	}
+
+	path_radiance_add(path_radiance, pixel_index, illumination, bounce == 0, bounce == 0);
+}
+
+extern "C" __global__ void kernel_trace_shadow_bvh2(int bounce) {
+	bvh2_trace_shadow<CONFIG_TRAVERSAL_HEATMAP>(&ray_buffer_shadow.traversal_data, buffer_sizes.shadow[bounce], &buffer_sizes.rays_retired_shadow[bounce], [bounce](int ray_index) {
+		shadow_ray_add_illumination(ray_buffer_shadow.get_pixel_index(ray_index), bounce, ray_buffer_shadow.get_illumination(ray_index));
+	}, TraversalHeatmapShadow { }, ShadowOccluderCachePixel { });
+}
+
+extern "C" __global__ void kernel_trace_shadow_bvh4(int bounce) {
+	bvh4_trace_shadow<CONFIG_TRAVERSAL_HEATMAP>(&ray_buffer_shadow.traversal_data, buffer_sizes.shadow[bounce], &buffer_sizes.rays_retired_shadow[bounce], [bounce](int ray_index) {
+		shadow_ray_add_illumination(ray_buffer_shadow.get_pixel_index(ray_index), bounce, ray_buffer_shadow.get_illumination(ray_index));
+	}, TraversalHeatmapShadow { }, ShadowOccluderCachePixel { });
+}
+
+extern "C" __global__ void kernel_trace_shadow_bvh8(int bounce) {
+	bvh8_trace_shadow<CONFIG_TRAVERSAL_HEATMAP>(&ray_buffer_shadow.traversal_data, buffer_sizes.shadow[bounce], &buffer_sizes.rays_retired_shadow[bounce], [bounce](int ray_index) {
+		shadow_ray_add_illumination(ray_buffer_shadow.get_pixel_index(ray_index), bounce, ray_buffer_shadow.get_illumination(ray_index));
+	}, TraversalHeatmapShadow { }, ShadowOccluderCachePixel { });
 }
 
 // Returns true if the path should terminate
@@ -200,9 +496,9 @@ __device__ bool russian_roulette(int pixel_index, int bounce, int sample_index,
 	if (bounce == config.num_bounces - 1) {
 		return true;
 	}
-	if (config.enable_russian_roulette && bounce > 0) {
+	if (CONFIG_ENABLE_RUSSIAN_ROULETTE && bounce > 0) {
 		float3 throughput_with_albedo = throughput;
-		if (config.enable_svgf) {
+		if (CONFIG_ENABLE_SVGF) {
 			throughput_with_albedo *= make_float3(aov_framebuffer_get(AOVType::ALBEDO, pixel_index));
 		}
 
@@ -217,211 +513,285 @@ __device__ bool russian_roulette(int pixel_index, int bounce, int sample_index,
 	return false;
 }
 
-extern "C" __global__ void kernel_sort(int bounce, int sample_index) {
-	int index = blockIdx.x * blockDim.x + threadIdx.x;
-	if (index >= buffer_sizes.trace[bounce]) return;
+// Adjoint-driven Russian roulette needs the radiance cache for an estimate of the radiance leaving a vertex,
+// and the accumulated Radiance AOV (which is not written with SVGF) for an estimate of the Pixel
+__device__ inline bool adjoint_russian_roulette_enabled() {
+	return CONFIG_ENABLE_RUSSIAN_ROULETTE && !CONFIG_ENABLE_SVGF && config.enable_adjoint_russian_roulette && radiance_cache_enabled();
+}
 
-	const TraceBuffer * ray_buffer_trace = get_ray_buffer_trace(bounce);
+// Used on surface hits before they are shaded. With adjoint Russian roulette only the bounce limit applies here,
+// shade_hit decides on the rest once the estimate of the radiance cache is known
+__device__ bool russian_roulette_surface(int pixel_index, int bounce, int sample_index, float3 & throughput) {
+	if (adjoint_russian_roulette_enabled()) {
+		return bounce == config.num_bounces - 1;
+	}
+	return russian_roulette(pixel_index, bounce, sample_index, throughput);
+}
 
-	float3 ray_direction = ray_buffer_trace->traversal_data.ray_direction.get(index);
-	RayHit hit           = ray_buffer_trace->traversal_data.hits         .get(index);
+// Weight window Russian roulette after Vorba and Krivanek, "Adjoint-Driven Russian Roulette and Splitting in Light Transport Simulation"
+// The expected contribution of the rest of the path is throughput * the cached radiance leaving the vertex, relative to the estimate of the Pixel.
+// Paths expected to contribute less than the lower end of the window survive with a probability proportional to it, instead of proportional to their throughput.
+// Splitting paths above the window is not done, every Pixel traces one path per sample (the per Pixel state of the AOVs, guiding and the cache rely on it)
+// Returns true if the path should terminate, vertices without an estimate use the regular roulette
+__device__ bool russian_roulette_adjoint(int pixel_index, int bounce, int sample_index, float3 & throughput, bool has_estimate, float3 radiance_estimate) {
+	constexpr float WINDOW_MIN         = 2.0f / (1.0f + 5.0f); // Lower end of a window of size 5 centred on the Pixel estimate
+	constexpr float SURVIVAL_MIN       = 0.05f;                // Keeps the roulette unbiased where the cache estimate is zero
+	constexpr float PIXEL_ESTIMATE_MIN = 1e-4f;
+
+	if (bounce == 0) return false;
+
+	float pixel_estimate = 0.0f;
+	if (has_estimate) {
+		const AOV & aov = get_aov(AOVType::RADIANCE);
+		if (aov.accumulator) {
+			float4 radiance = aov.accumulator[pixel_index];
+			pixel_estimate = luminance(radiance.x, radiance.y, radiance.z);
+		}
+	}
 
-	float ray_cone_angle;
-	float ray_cone_width;
-	if (bounce > 0 && config.enable_mipmapping) {
-		ray_cone_angle = ray_buffer_trace->cone_angle[index];
-		ray_cone_width = ray_buffer_trace->cone_width[index];
+	if (!(pixel_estimate > PIXEL_ESTIMATE_MIN)) {
+		return russian_roulette(pixel_index, bounce, sample_index, throughput);
 	}
 
-	unsigned pixel_index_and_flags = ray_buffer_trace->pixel_index_and_flags[index];
-	int      pixel_index = pixel_index_and_flags & ~FLAGS_ALL;
+	float3 contribution = throughput * radiance_estimate;
+	float  ratio        = luminance(contribution.x, contribution.y, contribution.z) / pixel_estimate;
 
-	int x = pixel_index % screen_pitch;
-	int y = pixel_index / screen_pitch;
+	if (ratio >= WINDOW_MIN) return false;
 
-	bool allow_nee     = pixel_index_and_flags & FLAG_ALLOW_NEE;
-	bool inside_medium = pixel_index_and_flags & FLAG_INSIDE_MEDIUM;
+	float survival_probability  = fmaxf(ratio / WINDOW_MIN, SURVIVAL_MIN);
+	float rand_russian_roulette = random<SampleDimension::RUSSIAN_ROULETTE>(pixel_index, bounce, sample_index).x;
 
-	float3 throughput;
-	if (bounce == 0) {
-		throughput = make_float3(1.0f); // Throughput is known to be (1,1,1) still, skip the global memory load
-	} else {
-		throughput = ray_buffer_trace->throughput.get(index);
+	if (rand_russian_roulette > survival_probability) {
+		return true;
 	}
+	throughput /= survival_probability;
+	return false;
+}
 
-	int medium_id = INVALID;
-	if (inside_medium) {
-		medium_id = ray_buffer_trace->medium[index];
-		HomogeneousMedium medium = medium_as_homogeneous(medium_id);
-
-		bool medium_can_scatter = (medium.sigma_s.x + medium.sigma_s.y + medium.sigma_s.z) > 0.0f;
+// Adds illumination that a path found at the given bounce, bounce 0 (directly visible) also initializes the Albedo
+__device__ inline void path_add_illumination(int pixel_index, int bounce, float3 illumination, PathRadiance * path_radiance) {
+	if (guiding_enabled()) {
+		guiding_add_illumination(pixel_index, bounce, illumination);
+	}
+	if (radiance_cache_enabled()) {
+		radiance_cache_add_illumination(pixel_index, bounce, illumination);
+	}
 
-		if (medium_can_scatter) {
-			float2 rand_scatter = random<SampleDimension::BSDF_0>(pixel_index, bounce, sample_index);
-			float2 rand_phase   = random<SampleDimension::BSDF_1>(pixel_index, bounce, sample_index);
+	if (bounce == 0) {
+		aov_framebuffer_set(AOVType::ALBEDO, pixel_index, make_float4(1.0f));
+	}
 
-			float3 sigma_t = medium.sigma_a + medium.sigma_s;
+	path_radiance_add(path_radiance, pixel_index, illumination, bounce <= 1, bounce == 0);
+}
 
-			// MIS based on throughput
-			// See Wrenninge - Path Traced Subsurface Scattering using Anisotropic Phase Functions and Non-Exponential Free Flights
-			float  throughput_sum = throughput.x + throughput.y + throughput.z;
-			float3 wavelength_pdf = throughput / throughput_sum; // pdfs for choosing any of the 3 RGB wavelengths
+// Contribution of a Ray that did not hit anything, get_last_pdf is only called when the contribution is weighted by MIS
+template<typename GetLastPDF>
+__device__ void path_miss_sky(int pixel_index, int bounce, float3 ray_direction, float3 throughput, bool allow_nee, GetLastPDF get_last_pdf, PathRadiance * path_radiance = nullptr) {
+	float3 illumination = throughput * sample_sky(ray_direction);
 
-			float sigma_t_used_for_sampling;
-			if (rand_scatter.x * throughput_sum < throughput.x) {
-				sigma_t_used_for_sampling = sigma_t.x;
-			} else if (rand_scatter.x * throughput_sum < throughput.x + throughput.y) {
-				sigma_t_used_for_sampling = sigma_t.y;
-			} else {
-				sigma_t_used_for_sampling = sigma_t.z;
-			}
+	// If the Sky was also importance sampled by Next Event Estimation, weigh its contribution
+	float sky_select_probability = sky_sample_probability();
+	if (CONFIG_ENABLE_NEXT_EVENT_ESTIMATION && allow_nee && sky_select_probability > 0.0f) {
+		if (!CONFIG_ENABLE_MULTIPLE_IMPORTANCE_SAMPLING) return;
 
-			float scatter_distance = sample_exp(sigma_t_used_for_sampling, rand_scatter.y);
-			float3 transmittance = beer_lambert(sigma_t, fminf(scatter_distance, hit.t));
+		float brdf_pdf  = get_last_pdf();
+		float light_pdf = sky_select_probability * sky_direction_pdf(ray_direction);
 
-			if (scatter_distance < hit.t) {
-				float3 pdf = wavelength_pdf * sigma_t * transmittance;
-				throughput *= medium.sigma_s * transmittance / (pdf.x + pdf.y + pdf.z);
+		illumination *= power_heuristic(brdf_pdf, light_pdf);
+	}
 
-				if (russian_roulette(pixel_index, bounce, sample_index, throughput)) return;
+	path_add_illumination(pixel_index, bounce, illumination, path_radiance);
+}
 
-				float3 direction_out = sample_henyey_greenstein(-ray_direction, medium.g, rand_phase.x, rand_phase.y);
+// Contribution of a Ray that hit a Light, get_ray_origin and get_last_pdf are only called when the contribution is weighted by MIS
+template<typename GetRayOrigin, typename GetLastPDF>
+__device__ void path_hit_light(
+	int            pixel_index,
+	int            bounce,
+	int            sample_index,
+	int            material_id,
+	float3         ray_direction,
+	const RayHit & hit,
+	float3         throughput,
+	bool           allow_nee,
+	GetRayOrigin   get_ray_origin,
+	GetLastPDF     get_last_pdf,
+	PathRadiance * path_radiance = nullptr
+) {
+	if (mesh_has_curves(hit.mesh_id)) return; // Curves are not supported as Lights, see Pathtracer::calc_light_power
 
-				float3 ray_origin = ray_buffer_trace->traversal_data.ray_origin.get(index);
-				float3 origin_out = ray_origin + scatter_distance * ray_direction;
+	// Obtain the Light's position and normal
+	TrianglePos light_triangle = triangle_get_positions(hit.triangle_id);
 
-				// Emit scattered Ray
-				int index_out = atomicAdd(&buffer_sizes.trace[bounce + 1], 1);
+	float3 light_point;
+	triangle_barycentric(light_triangle, hit.u, hit.v, light_point);
 
-				TraceBuffer * ray_buffer_trace_next = get_ray_buffer_trace(bounce + 1);
+	float3 light_point_prev = light_point;
 
-				ray_buffer_trace_next->traversal_data.ray_origin   .set(index_out, origin_out);
-				ray_buffer_trace_next->traversal_data.ray_direction.set(index_out, direction_out);
+	float3 light_geometric_normal = cross(light_triangle.position_edge_1, light_triangle.position_edge_2);
 
-				ray_buffer_trace_next->medium[index_out] = medium_id;
+	// Transform into world space
+	Matrix3x4 light_world = mesh_get_transform(hit.mesh_id, camera_sample_time(pixel_index, sample_index));
+	matrix3x4_transform_position (light_world, light_point);
+	matrix3x4_transform_direction(light_world, light_geometric_normal);
 
-				if (config.enable_mipmapping) {
-					if (bounce == 0) {
-						// Ray Cone is normally initialized on the first bounce in the Material kernel.
-						// Since a scattered Ray does not invoke a Material kernel, initialize the Ray Cone here
-						ray_cone_angle = camera.pixel_spread_angle;
-						ray_cone_width = camera.pixel_spread_angle * scatter_distance;
-					}
-					ray_buffer_trace_next->cone_angle[index_out] = ray_cone_angle;
-					ray_buffer_trace_next->cone_width[index_out] = ray_cone_width;
-				}
+	light_geometric_normal = normalize(light_geometric_normal);
 
-				ray_buffer_trace_next->pixel_index_and_flags[index_out] = pixel_index | FLAG_INSIDE_MEDIUM;
-				ray_buffer_trace_next->throughput.set(index_out, throughput);
+	if (bounce == 0 && (CONFIG_ENABLE_SVGF || config.enable_reprojection)) {
+		Matrix3x4 world_prev = mesh_get_transform_prev(hit.mesh_id);
+		matrix3x4_transform_position(world_prev, light_point_prev);
 
-				return;
-			} else {
-				float3 pdf = wavelength_pdf * transmittance;
-				throughput *= transmittance / (pdf.x + pdf.y + pdf.z);
-			}
-		} else {
-			throughput *= beer_lambert(medium.sigma_a, hit.t);
-		}
+		int x = pixel_index % screen_pitch;
+		int y = pixel_index / screen_pitch;
+		svgf_set_gbuffers(x, y, hit, light_point, light_geometric_normal, light_point_prev);
 	}
 
-	// If we didn't hit anything, sample the Sky
-	if (hit.triangle_id == INVALID) {
-		float3 illumination = throughput * sample_sky(ray_direction);
+	MaterialLight light_material = material_as_light(material_id);
+	float3        light_emission = light_get_emission(light_material, hit.triangle_id, hit.u, hit.v);
 
-		if (bounce == 0) {
-			aov_framebuffer_set(AOVType::ALBEDO,          pixel_index, make_float4(1.0f));
-			aov_framebuffer_set(AOVType::RADIANCE,        pixel_index, make_float4(illumination));
-			aov_framebuffer_set(AOVType::RADIANCE_DIRECT, pixel_index, make_float4(illumination));
-		} else if (bounce == 1) {
-			aov_framebuffer_add(AOVType::RADIANCE,        pixel_index, make_float4(illumination));
-			aov_framebuffer_add(AOVType::RADIANCE_DIRECT, pixel_index, make_float4(illumination));
-		} else {
-			aov_framebuffer_add(AOVType::RADIANCE,          pixel_index, make_float4(illumination));
-			aov_framebuffer_add(AOVType::RADIANCE_INDIRECT, pixel_index, make_float4(illumination));
-		}
+	bool should_count_light_contribution = CONFIG_ENABLE_NEXT_EVENT_ESTIMATION ? !allow_nee : true;
+	if (should_count_light_contribution) {
+		path_add_illumination(pixel_index, bounce, bounce == 0 ? light_emission : throughput * light_emission, path_radiance);
 		return;
 	}
 
-	if (bounce == 0 && pixel_query.pixel_index == pixel_index) {
-		pixel_query.mesh_id     = hit.mesh_id;
-		pixel_query.triangle_id = hit.triangle_id;
-	}
+	// ReSTIR on the primary hit already accounts for all light Triangles, it is not combined with BSDF sampling using MIS
+	if (bounce == 1 && restir_enabled()) return;
 
-	// Get the Material of the Mesh we hit
-	int material_id = mesh_get_material_id(hit.mesh_id);
-	MaterialType material_type = material_get_type(material_id);
+	if (CONFIG_ENABLE_MULTIPLE_IMPORTANCE_SAMPLING) {
+		float cos_theta_light = abs_dot(ray_direction, light_geometric_normal);
+		float distance_to_light_squared = hit.t * hit.t;
 
-	if (material_type == MaterialType::LIGHT) {
-		// Obtain the Light's position and normal
-		TrianglePos light_triangle = triangle_get_positions(hit.triangle_id);
+		float brdf_pdf = get_last_pdf();
 
-		float3 light_point;
-		triangle_barycentric(light_triangle, hit.u, hit.v, light_point);
+		float light_pdf;
+		if (config.enable_light_bvh) {
+			// The Light BVH was sampled from the origin of this Ray
+			float3 ray_origin = get_ray_origin();
 
-		float3 light_point_prev = light_point;
+			float light_area = triangle_area_world(light_triangle, light_world);
+			light_pdf = light_bvh_pdf(ray_origin, hit.mesh_id, hit.triangle_id) * distance_to_light_squared / (cos_theta_light * light_area);
+		} else {
+			float light_power = light_triangle_power(light_material, hit.triangle_id);
+			light_pdf = light_power * distance_to_light_squared / (cos_theta_light * lights_total_weight);
+		}
+		light_pdf *= 1.0f - sky_sample_probability();
 
-		float3 light_geometric_normal = cross(light_triangle.position_edge_1, light_triangle.position_edge_2);
+		if (!pdf_is_valid(light_pdf)) return;
 
-		// Transform into world space
-		Matrix3x4 light_world = mesh_get_transform(hit.mesh_id);
-		matrix3x4_transform_position (light_world, light_point);
-		matrix3x4_transform_direction(light_world, light_geometric_normal);
-	
-		light_geometric_normal = normalize(light_geometric_normal);
+		float mis_weight = power_heuristic(brdf_pdf, light_pdf);
+		float3 illumination = throughput * light_emission * mis_weight;
 
-		if (bounce == 0 && config.enable_svgf) {
-			Matrix3x4 world_prev = mesh_get_transform_prev(hit.mesh_id);
-			matrix3x4_transform_position(world_prev, light_point_prev);
+		assert(bounce != 0);
+		path_add_illumination(pixel_index, bounce, illumination, path_radiance);
+	}
+}
 
-			svgf_set_gbuffers(x, y, hit, light_point, light_geometric_normal, light_point_prev);
-		}
+// Sort and Material Kernels loop over their queue with a grid-stride loop,
+// this allows them to be launched with a persistent (occupancy sized) grid
+// so that nearly empty queues on deep bounces do not pay for a Grid the size of a full batch
+#define FOR_EACH_QUEUE_INDEX(index, queue_size) \
+	for (int index = blockIdx.x * blockDim.x + threadIdx.x; index < (queue_size); index += gridDim.x * blockDim.x)
 
-		MaterialLight light_material = material_as_light(material_id);
+// With OptiX traversal the shadow Rays are traced in a separate Module, which only records whether each Ray was occluded (see OptiX.cu)
+extern "C" __global__ void kernel_shadow_resolve(int bounce, const int * shadow_occluded) {
+	FOR_EACH_QUEUE_INDEX(ray_index, buffer_sizes.shadow[bounce]) {
+		if (shadow_occluded[ray_index]) continue;
 
-		bool should_count_light_contribution = config.enable_next_event_estimation ? !allow_nee : true;
-		if (should_count_light_contribution) {
-			float3 illumination = throughput * light_material.emission;
+		shadow_ray_add_illumination(ray_buffer_shadow.get_pixel_index(ray_index), bounce, ray_buffer_shadow.get_illumination(ray_index));
+	}
+}
 
-			if (bounce == 0) {
-				aov_framebuffer_set(AOVType::ALBEDO,          pixel_index, make_float4(1.0f));
-				aov_framebuffer_set(AOVType::RADIANCE,        pixel_index, make_float4(light_material.emission));
-				aov_framebuffer_set(AOVType::RADIANCE_DIRECT, pixel_index, make_float4(light_material.emission));
-			} else if (bounce == 1) {
-				aov_framebuffer_add(AOVType::RADIANCE,        pixel_index, make_float4(illumination));
-				aov_framebuffer_add(AOVType::RADIANCE_DIRECT, pixel_index, make_float4(illumination));
-			} else {
-				aov_framebuffer_add(AOVType::RADIANCE,          pixel_index, make_float4(illumination));
-				aov_framebuffer_add(AOVType::RADIANCE_INDIRECT, pixel_index, make_float4(illumination));
-			}
-			return;
-		}
+// Material sorting is a counting sort of the Material queues by material_id
+// Per Material this contains the number of Rays, after kernel_material_sort_scan it contains the offset into the queue
+__device__ __constant__ int * material_sort_offsets;
+
+// Emits the Ray scattered by a Medium at scatter_distance along the current Ray into the TraceBuffer of the next bounce
+__device__ void medium_emit_scattered_ray(
+	const TraceBuffer * ray_buffer_trace,
+	int    index,
+	int    bounce,
+	int    pixel_index,
+	int    medium_id,
+	float3 ray_direction,
+	float  scatter_distance,
+	float3 direction_out,
+	float  ray_cone_angle,
+	float  ray_cone_width,
+	float3 throughput
+) {
+	float3 ray_origin = ray_buffer_trace->traversal_data.ray_origin.get(index);
+	float3 origin_out = ray_origin + scatter_distance * ray_direction;
 
-		if (config.enable_multiple_importance_sampling) {
-			float cos_theta_light = abs_dot(ray_direction, light_geometric_normal);
-			float distance_to_light_squared = hit.t * hit.t;
+	int index_out = warp_aggregated_increment(&buffer_sizes.trace[bounce + 1]);
 
-			float brdf_pdf = ray_buffer_trace->last_pdf[index];
+	TraceBuffer * ray_buffer_trace_next = get_ray_buffer_trace(bounce + 1);
 
-			float light_power = luminance(light_material.emission.x, light_material.emission.y, light_material.emission.z);
-			float light_pdf   = light_power * distance_to_light_squared / (cos_theta_light * lights_total_weight);
+	ray_buffer_trace_next->traversal_data.ray_origin   .set(index_out, origin_out);
+	ray_buffer_trace_next->traversal_data.ray_direction.set(index_out, direction_out);
 
-			if (!pdf_is_valid(light_pdf)) return;
+	if (CONFIG_ENABLE_MOTION_BLUR) {
+		ray_buffer_trace_next->traversal_data.ray_time[index_out] = ray_buffer_trace->traversal_data.ray_time[index];
+	}
 
-			float mis_weight = power_heuristic(brdf_pdf, light_pdf);
-			float3 illumination = throughput * light_material.emission * mis_weight;
+	ray_buffer_trace_next->medium[index_out] = medium_id;
 
-			assert(bounce != 0);
-			aov_framebuffer_add(AOVType::RADIANCE, pixel_index, make_float4(illumination));
-			if (bounce == 1) {
-				aov_framebuffer_add(AOVType::RADIANCE_DIRECT, pixel_index, make_float4(illumination));
-			} else {
-				aov_framebuffer_add(AOVType::RADIANCE_INDIRECT, pixel_index, make_float4(illumination));
-			}
+	if (CONFIG_ENABLE_MIPMAPPING) {
+		if (bounce == 0) {
+			// Ray Cone is normally initialized on the first bounce in the Material kernel.
+			// Since a scattered Ray does not invoke a Material kernel, initialize the Ray Cone here
+			ray_cone_angle = camera.pixel_spread_angle;
+			ray_cone_width = camera.pixel_spread_angle * scatter_distance;
 		}
+		ray_buffer_trace_next->cone_angle[index_out] = ray_cone_angle;
+		ray_buffer_trace_next->cone_width[index_out] = ray_cone_width;
+	}
+
+	ray_buffer_trace_next->pixel_index_and_flags[index_out] = pixel_index | FLAG_INSIDE_MEDIUM;
+	ray_buffer_trace_next->throughput.set(index_out, throughput);
+}
+
+// Handles a Ray that reached its hit (or missed the Scene) after passing through any Medium, by looking up the Sky,
+// adding the emission of a light or appending it to the queue of its MaterialType
+// Rays that leave a Medium carry their attenuated throughput in registers, so kernel_medium handles their emission inline (handle_emission)
+// kernel_sort has already queued its misses and light hits for kernel_miss and kernel_light_hit
+template<bool handle_emission>
+__device__ void sort_ray_surface(
+	const TraceBuffer * ray_buffer_trace,
+	int    index,
+	int    bounce,
+	int    sample_index,
+	int    pixel_index,
+	bool   allow_nee,
+	int    medium_id,
+	float3 ray_direction,
+	RayHit hit,
+	float  ray_cone_angle,
+	float  ray_cone_width,
+	float3 throughput
+) {
+	// If we didn't hit anything, sample the Sky
+	if (handle_emission && hit.triangle_id == INVALID) {
+		path_miss_sky(pixel_index, bounce, ray_direction, throughput, allow_nee, [ray_buffer_trace, index]() {
+			return ray_buffer_trace->last_pdf[index];
+		});
+		return;
+	}
+
+	// Get the Material of the Mesh we hit
+	int material_id = mesh_get_material_id(hit.mesh_id);
+	MaterialType material_type = material_get_type(material_id);
+
+	if (handle_emission && material_type == MaterialType::LIGHT) {
+		path_hit_light(pixel_index, bounce, sample_index, material_id, ray_direction, hit, throughput, allow_nee, [ray_buffer_trace, index]() {
+			return ray_buffer_trace->traversal_data.ray_origin.get(index);
+		}, [ray_buffer_trace, index]() {
+			return ray_buffer_trace->last_pdf[index];
+		});
 		return;
 	}
 
-	if (russian_roulette(pixel_index, bounce, sample_index, throughput)) return;
+	if (russian_roulette_surface(pixel_index, bounce, sample_index, throughput)) return;
 
 	auto material_buffer_write = [bounce, ray_direction, medium_id, ray_cone_angle, ray_cone_width, hit, pixel_index, throughput](
 		PackedMaterialBuffer packed_material_buffer,
@@ -429,20 +799,19 @@ extern "C" __global__ void kernel_sort(int bounce, int sample_index) {
 	) {
 		MaterialBufferAllocation material_buffer = get_material_buffer(packed_material_buffer);
 
-		int index_out = atomicAdd(buffer_size, 1);
+		int index_out = warp_aggregated_increment(buffer_size);
 		if (material_buffer.reversed) {
-			index_out = (BATCH_SIZE - 1) - index_out;
+			index_out = (batch_size - 1) - index_out;
 		}
 
-		material_buffer.buffer->ray_direction.set(index_out, ray_direction);
+		material_buffer.buffer->set_ray_direction(index_out, ray_direction);
 
 		if (medium_id != INVALID) {
 			material_buffer.buffer->medium[index_out] = medium_id;
 		}
 
-		if (bounce > 0 && config.enable_mipmapping) {
-			material_buffer.buffer->cone_angle[index_out] = ray_cone_angle;
-			material_buffer.buffer->cone_width[index_out] = ray_cone_width;
+		if (bounce > 0 && CONFIG_ENABLE_MIPMAPPING) {
+			material_buffer.buffer->set_cone(index_out, ray_cone_angle, ray_cone_width);
 		}
 
 		material_buffer.buffer->hits.set(index_out, hit);
@@ -451,9 +820,13 @@ extern "C" __global__ void kernel_sort(int bounce, int sample_index) {
 		material_buffer.buffer->pixel_index_and_flags[index_out] = pixel_index | flags;
 
 		if (bounce > 0) {
-			material_buffer.buffer->throughput.set(index_out, throughput);
+			material_buffer.buffer->set_throughput(index_out, throughput);
 		}
 	};
+	if (config.enable_material_sorting) {
+		warp_aggregated_increment(material_sort_offsets, material_id); // Count only, the offsets are determined after the scan
+	}
+
 	switch (material_type) {
 		case MaterialType::DIFFUSE:    material_buffer_write(material_buffer_diffuse,    &buffer_sizes.diffuse   [bounce]); break;
 		case MaterialType::PLASTIC:    material_buffer_write(material_buffer_plastic,    &buffer_sizes.plastic   [bounce]); break;
@@ -462,38 +835,629 @@ extern "C" __global__ void kernel_sort(int bounce, int sample_index) {
 	}
 }
 
-template<typename BSDF>
-__device__ void next_event_estimation(
-	int          pixel_index,
-	int          bounce,
-	int          sample_index,
-	const BSDF & bsdf,
-	int          medium_id,
-	float3       hit_point,
-	float3       normal,
-	float3       geometric_normal,
-	float3       throughput
-) {
-	float2 rand_light    = random<SampleDimension::NEE_LIGHT>   (pixel_index, bounce, sample_index);
-	float2 rand_triangle = random<SampleDimension::NEE_TRIANGLE>(pixel_index, bounce, sample_index);
-
-	// Pick random Light
-	int light_mesh_id;
-	int light_triangle_id = sample_light(rand_light.x, rand_light.y, light_mesh_id);
+__device__ void sort_ray(int index, int bounce, int sample_index) {
+	const TraceBuffer * ray_buffer_trace = get_ray_buffer_trace(bounce);
 
-	// Pick random point on the Light
-	float2 light_uv = sample_triangle(rand_triangle.x, rand_triangle.y);
+	unsigned pixel_index_and_flags = ray_buffer_trace->pixel_index_and_flags[index];
 
-	// Obtain the Light's position and geometric normal
-	TrianglePos light_triangle = triangle_get_positions(light_triangle_id);
+	// Medium interactions are deferred to kernel_medium, so that this Kernel only classifies surface hits
+	if (pixel_index_and_flags & FLAG_INSIDE_MEDIUM) {
+		int index_medium = warp_aggregated_increment(&buffer_sizes.medium[bounce]);
+		medium_queue[index_medium] = index;
+		return;
+	}
 
-	float3 light_point;
-	triangle_barycentric(light_triangle, light_uv.x, light_uv.y, light_point);
+	RayHit hit = ray_buffer_trace->traversal_data.hits.get(index);
 
-	float3 light_geometric_normal = cross(light_triangle.position_edge_1, light_triangle.position_edge_2);
+	// Misses and light hits only add emission, they are left to small dedicated Kernels so that this Kernel mostly writes MaterialBuffers
+	if (hit.triangle_id == INVALID) {
+		int index_miss = warp_aggregated_increment(&buffer_sizes.miss[bounce]);
+		emission_queue[index_miss] = index;
+		return;
+	}
+
+	int material_id = mesh_get_material_id(hit.mesh_id);
+	if (material_get_type(material_id) == MaterialType::LIGHT) {
+		int index_light_hit = warp_aggregated_increment(&buffer_sizes.light_hit[bounce]);
+		emission_queue[(batch_size - 1) - index_light_hit] = index;
+		return;
+	}
+
+	float3 ray_direction = ray_buffer_trace->traversal_data.ray_direction.get(index);
+
+	float ray_cone_angle;
+	float ray_cone_width;
+	if (bounce > 0 && CONFIG_ENABLE_MIPMAPPING) {
+		ray_cone_angle = ray_buffer_trace->cone_angle[index];
+		ray_cone_width = ray_buffer_trace->cone_width[index];
+	}
+
+	int  pixel_index = pixel_index_and_flags & ~FLAGS_ALL;
+	bool allow_nee   = pixel_index_and_flags & FLAG_ALLOW_NEE;
+
+	float3 throughput;
+	if (bounce == 0) {
+		throughput = make_float3(1.0f); // Throughput is known to be (1,1,1) still, skip the global memory load
+	} else {
+		throughput = ray_buffer_trace->throughput.get(index);
+	}
+
+	sort_ray_surface<false>(ray_buffer_trace, index, bounce, sample_index, pixel_index, allow_nee, INVALID, ray_direction, hit, ray_cone_angle, ray_cone_width, throughput);
+}
+
+// Free path sampling through homogeneous Media, returns true if the Ray scattered (or was terminated) before reaching its hit
+__device__ bool medium_ray_homogeneous(const TraceBuffer * ray_buffer_trace, int index, int bounce, int sample_index, int pixel_index, int medium_id, float3 ray_direction, const RayHit & hit, float ray_cone_angle, float ray_cone_width, float3 & throughput) {
+	HomogeneousMedium medium = medium_as_homogeneous(medium_id);
+
+	bool medium_can_scatter = (medium.sigma_s.x + medium.sigma_s.y + medium.sigma_s.z) > 0.0f;
+
+	if (!medium_can_scatter) {
+		throughput *= beer_lambert(medium.sigma_a, hit.t);
+		return false;
+	}
+
+	float2 rand_scatter = random<SampleDimension::BSDF_0>(pixel_index, bounce, sample_index);
+	float2 rand_phase   = random<SampleDimension::BSDF_1>(pixel_index, bounce, sample_index);
+
+	float3 sigma_t = medium.sigma_a + medium.sigma_s;
+
+	// MIS based on throughput
+	// See Wrenninge - Path Traced Subsurface Scattering using Anisotropic Phase Functions and Non-Exponential Free Flights
+	float  throughput_sum = throughput.x + throughput.y + throughput.z;
+	float3 wavelength_pdf = throughput / throughput_sum; // pdfs for choosing any of the 3 RGB wavelengths
+
+	float sigma_t_used_for_sampling;
+	if (rand_scatter.x * throughput_sum < throughput.x) {
+		sigma_t_used_for_sampling = sigma_t.x;
+	} else if (rand_scatter.x * throughput_sum < throughput.x + throughput.y) {
+		sigma_t_used_for_sampling = sigma_t.y;
+	} else {
+		sigma_t_used_for_sampling = sigma_t.z;
+	}
+
+	float scatter_distance = sample_exp(sigma_t_used_for_sampling, rand_scatter.y);
+	float3 transmittance = beer_lambert(sigma_t, fminf(scatter_distance, hit.t));
+
+	if (scatter_distance < hit.t) {
+		float3 pdf = wavelength_pdf * sigma_t * transmittance;
+		throughput *= medium.sigma_s * transmittance / (pdf.x + pdf.y + pdf.z);
+
+		if (russian_roulette(pixel_index, bounce, sample_index, throughput)) return true;
+
+		float3 direction_out = sample_henyey_greenstein(-ray_direction, medium.g, rand_phase.x, rand_phase.y);
+
+		medium_emit_scattered_ray(ray_buffer_trace, index, bounce, pixel_index, medium_id, ray_direction, scatter_distance, direction_out, ray_cone_angle, ray_cone_width, throughput);
+		return true;
+	} else {
+		float3 pdf = wavelength_pdf * transmittance;
+		throughput *= transmittance / (pdf.x + pdf.y + pdf.z);
+		return false;
+	}
+}
+
+// Free path sampling through a heterogeneous Medium, returns true if the Ray scattered (or was absorbed) before reaching its hit
+__device__ bool medium_ray_heterogeneous(const TraceBuffer * ray_buffer_trace, int index, int bounce, int sample_index, int pixel_index, int medium_id, float3 ray_direction, const RayHit & hit, float ray_cone_angle, float ray_cone_width, float3 & throughput) {
+	float3 ray_origin = ray_buffer_trace->traversal_data.ray_origin.get(index);
+
+	constexpr unsigned VOLUME_SALT_DISTANCE = 0x5bd1e995;
+	unsigned rng_state = volume_rng_init(pixel_index, bounce, sample_index, VOLUME_SALT_DISTANCE);
+
+	float scatter_distance;
+	VolumeEvent event = volume_sample_distance(medium_id, ray_origin, ray_direction, hit.t, rng_state, throughput, scatter_distance);
+
+	if (event == VolumeEvent::ABSORB) return true;
+
+	if (event == VolumeEvent::SCATTER) {
+		if (russian_roulette(pixel_index, bounce, sample_index, throughput)) return true;
+
+		float2 rand_phase = random<SampleDimension::BSDF_1>(pixel_index, bounce, sample_index);
+
+		float3 direction_out = sample_henyey_greenstein(-ray_direction, medium_as_homogeneous(medium_id).g, rand_phase.x, rand_phase.y);
+
+		medium_emit_scattered_ray(ray_buffer_trace, index, bounce, pixel_index, medium_id, ray_direction, scatter_distance, direction_out, ray_cone_angle, ray_cone_width, throughput);
+		return true;
+	}
+
+	return false;
+}
+
+// Rays inside a Medium, deferred by kernel_sort. Rays that reach their hit without scattering continue as regular surface hits
+__device__ void medium_ray(int index, int bounce, int sample_index) {
+	const TraceBuffer * ray_buffer_trace = get_ray_buffer_trace(bounce);
+
+	float3 ray_direction = ray_buffer_trace->traversal_data.ray_direction.get(index);
+	RayHit hit           = ray_buffer_trace->traversal_data.hits         .get(index);
+
+	float ray_cone_angle;
+	float ray_cone_width;
+	if (bounce > 0 && CONFIG_ENABLE_MIPMAPPING) {
+		ray_cone_angle = ray_buffer_trace->cone_angle[index];
+		ray_cone_width = ray_buffer_trace->cone_width[index];
+	}
+
+	unsigned pixel_index_and_flags = ray_buffer_trace->pixel_index_and_flags[index];
+	int      pixel_index = pixel_index_and_flags & ~FLAGS_ALL;
+
+	bool allow_nee = pixel_index_and_flags & FLAG_ALLOW_NEE;
+
+	float3 throughput;
+	if (bounce == 0) {
+		throughput = make_float3(1.0f);
+	} else {
+		throughput = ray_buffer_trace->throughput.get(index);
+	}
+
+	int medium_id = ray_buffer_trace->medium[index];
+
+	bool scattered;
+	if (medium_is_heterogeneous(medium_id)) {
+		scattered = medium_ray_heterogeneous(ray_buffer_trace, index, bounce, sample_index, pixel_index, medium_id, ray_direction, hit, ray_cone_angle, ray_cone_width, throughput);
+	} else {
+		scattered = medium_ray_homogeneous  (ray_buffer_trace, index, bounce, sample_index, pixel_index, medium_id, ray_direction, hit, ray_cone_angle, ray_cone_width, throughput);
+	}
+	if (scattered) return;
+
+	sort_ray_surface<true>(ray_buffer_trace, index, bounce, sample_index, pixel_index, allow_nee, medium_id, ray_direction, hit, ray_cone_angle, ray_cone_width, throughput);
+}
+
+extern "C" __global__ void kernel_sort(int bounce, int sample_index) {
+	int ray_count = buffer_sizes.trace[bounce];
+
+	FOR_EACH_QUEUE_INDEX(index, ray_count) {
+		sort_ray(index, bounce, sample_index);
+	}
+}
+
+extern "C" __global__ void kernel_medium(int bounce, int sample_index) {
+	int ray_count = buffer_sizes.medium[bounce];
+
+	FOR_EACH_QUEUE_INDEX(i, ray_count) {
+		medium_ray(medium_queue[i], bounce, sample_index);
+	}
+}
+
+// Reads the path state that both emission Kernels need from the TraceBuffer
+__device__ inline float3 emission_ray_throughput(const TraceBuffer * ray_buffer_trace, int index, int bounce) {
+	if (bounce == 0) {
+		return make_float3(1.0f);
+	} else {
+		return ray_buffer_trace->throughput.get(index);
+	}
+}
+
+extern "C" __global__ void kernel_miss(int bounce) {
+	const TraceBuffer * ray_buffer_trace = get_ray_buffer_trace(bounce);
+	int ray_count = buffer_sizes.miss[bounce];
+
+	FOR_EACH_QUEUE_INDEX(i, ray_count) {
+		int index = emission_queue[i];
+
+		unsigned pixel_index_and_flags = ray_buffer_trace->pixel_index_and_flags[index];
+
+		int  pixel_index = pixel_index_and_flags & ~FLAGS_ALL;
+		bool allow_nee   = pixel_index_and_flags & FLAG_ALLOW_NEE;
+
+		float3 ray_direction = ray_buffer_trace->traversal_data.ray_direction.get(index);
+		float3 throughput    = emission_ray_throughput(ray_buffer_trace, index, bounce);
+
+		path_miss_sky(pixel_index, bounce, ray_direction, throughput, allow_nee, [ray_buffer_trace, index]() {
+			return ray_buffer_trace->last_pdf[index];
+		});
+	}
+}
+
+extern "C" __global__ void kernel_light_hit(int bounce, int sample_index) {
+	const TraceBuffer * ray_buffer_trace = get_ray_buffer_trace(bounce);
+	int ray_count = buffer_sizes.light_hit[bounce];
+
+	FOR_EACH_QUEUE_INDEX(i, ray_count) {
+		int index = emission_queue[(batch_size - 1) - i];
+
+		unsigned pixel_index_and_flags = ray_buffer_trace->pixel_index_and_flags[index];
+
+		int  pixel_index = pixel_index_and_flags & ~FLAGS_ALL;
+		bool allow_nee   = pixel_index_and_flags & FLAG_ALLOW_NEE;
+
+		float3 ray_direction = ray_buffer_trace->traversal_data.ray_direction.get(index);
+		RayHit hit           = ray_buffer_trace->traversal_data.hits         .get(index);
+		float3 throughput    = emission_ray_throughput(ray_buffer_trace, index, bounce);
+
+		int material_id = mesh_get_material_id(hit.mesh_id);
+
+		path_hit_light(pixel_index, bounce, sample_index, material_id, ray_direction, hit, throughput, allow_nee, [ray_buffer_trace, index]() {
+			return ray_buffer_trace->traversal_data.ray_origin.get(index);
+		}, [ray_buffer_trace, index]() {
+			return ray_buffer_trace->last_pdf[index];
+		});
+	}
+}
+
+// Turns the per Material Ray counts into offsets, separately for each MaterialType queue
+// One thread per MaterialType, the number of Materials is small enough for a serial scan
+extern "C" __global__ void kernel_material_sort_scan(int material_count) {
+	if (threadIdx.x >= 4) return;
+
+	MaterialType material_type = MaterialType(int(MaterialType::DIFFUSE) + threadIdx.x);
+
+	int offset = 0;
+	for (int material_id = 0; material_id < material_count; material_id++) {
+		if (material_get_type(material_id) == material_type) {
+			int count = material_sort_offsets[material_id];
+			material_sort_offsets[material_id] = offset;
+			offset += count;
+		}
+	}
+}
+
+template<PackedMaterialBuffer * packed_material_buffer>
+__device__ void material_sort_scatter(int index) {
+	MaterialBufferAllocation material_buffer = get_material_buffer(*packed_material_buffer);
+
+	if (material_buffer.reversed) {
+		index = (batch_size - 1) - index;
+	}
+
+	int mesh_id     = material_buffer.buffer->hits.get(index).mesh_id;
+	int material_id = mesh_get_material_id(mesh_id);
+
+	int index_out = warp_aggregated_increment(material_sort_offsets, material_id);
+	if (material_buffer.reversed) {
+		index_out = (batch_size - 1) - index_out;
+	}
+
+	material_buffer.buffer->sort_index[index_out] = index;
+}
+
+// Writes the indices of each Material queue in order of material_id, all four queues are handled by a single launch
+extern "C" __global__ void kernel_material_sort_scatter(int bounce) {
+	int size_diffuse    = buffer_sizes.diffuse   [bounce];
+	int size_plastic    = buffer_sizes.plastic   [bounce];
+	int size_dielectric = buffer_sizes.dielectric[bounce];
+	int size_conductor  = buffer_sizes.conductor [bounce];
+
+	FOR_EACH_QUEUE_INDEX(index, size_diffuse + size_plastic + size_dielectric + size_conductor) {
+		int i = index;
+		if (i < size_diffuse)    { material_sort_scatter<&material_buffer_diffuse>   (i); continue; } i -= size_diffuse;
+		if (i < size_plastic)    { material_sort_scatter<&material_buffer_plastic>   (i); continue; } i -= size_plastic;
+		if (i < size_dielectric) { material_sort_scatter<&material_buffer_dielectric>(i); continue; } i -= size_dielectric;
+
+		material_sort_scatter<&material_buffer_conductor>(i);
+	}
+}
+
+// Ray sorting orders the Rays of a TraceBuffer by a key based on their direction octant and their origin,
+// such that neighbouring threads in the trace Kernels traverse similar parts of the BVH
+// The Rays themselves are not moved, instead the trace Kernels visit them through a permutation
+__device__ __constant__ float3 ray_sort_bounds_min;
+__device__ __constant__ float3 ray_sort_bounds_scale; // Maps the Scene bounds to [0, 2^RAY_SORT_BITS_PER_AXIS)
+
+__device__ __constant__ int * ray_sort_offsets;
+__device__ __constant__ int * ray_sort_index;
+
+__device__ inline int ray_sort_key(float3 origin, float3 direction) {
+	float3 cell = (origin - ray_sort_bounds_min) * ray_sort_bounds_scale;
+
+	constexpr int cell_max = (1 << RAY_SORT_BITS_PER_AXIS) - 1;
+	int x = clamp(int(cell.x), 0, cell_max);
+	int y = clamp(int(cell.y), 0, cell_max);
+	int z = clamp(int(cell.z), 0, cell_max);
+
+	// Interleave the bits of the cell coordinates into a Morton code
+	int morton = 0;
+	for (int i = 0; i < RAY_SORT_BITS_PER_AXIS; i++) {
+		morton |= ((x >> i) & 1) << (3 * i);
+		morton |= ((y >> i) & 1) << (3 * i + 1);
+		morton |= ((z >> i) & 1) << (3 * i + 2);
+	}
+
+	// The octant is the most significant part of the key, it determines the child traversal order in the BVH
+	int octant = (direction.x < 0.0f) | ((direction.y < 0.0f) << 1) | ((direction.z < 0.0f) << 2);
+
+	return (octant << (3 * RAY_SORT_BITS_PER_AXIS)) | morton;
+}
+
+__device__ inline int ray_sort_key(const TraceBuffer * ray_buffer_trace, int index) {
+	float3 origin    = ray_buffer_trace->traversal_data.ray_origin   .get(index);
+	float3 direction = ray_buffer_trace->traversal_data.ray_direction.get(index);
+
+	return ray_sort_key(origin, direction);
+}
+
+extern "C" __global__ void kernel_ray_sort_count(int bounce) {
+	const TraceBuffer * ray_buffer_trace = get_ray_buffer_trace(bounce);
+	int ray_count = buffer_sizes.trace[bounce];
+
+	FOR_EACH_QUEUE_INDEX(index, ray_count) {
+		warp_aggregated_increment(ray_sort_offsets, ray_sort_key(ray_buffer_trace, index));
+	}
+}
+
+// Exclusive prefix sum over the key counts, launched as a single Block of RAY_SORT_SCAN_BLOCK_SIZE threads
+#define RAY_SORT_KEYS_PER_THREAD (RAY_SORT_KEY_COUNT / RAY_SORT_SCAN_BLOCK_SIZE)
+
+extern "C" __global__ void kernel_ray_sort_scan() {
+	__shared__ int shared_sums[RAY_SORT_SCAN_BLOCK_SIZE];
+
+	int keys[RAY_SORT_KEYS_PER_THREAD];
+	int sum = 0;
+
+	for (int i = 0; i < RAY_SORT_KEYS_PER_THREAD; i++) {
+		keys[i] = ray_sort_offsets[threadIdx.x * RAY_SORT_KEYS_PER_THREAD + i];
+		sum += keys[i];
+	}
+	shared_sums[threadIdx.x] = sum;
+	__syncthreads();
+
+	// Inclusive Hillis-Steele scan over the per thread sums
+	for (int step = 1; step < RAY_SORT_SCAN_BLOCK_SIZE; step <<= 1) {
+		int value = threadIdx.x >= step ? shared_sums[threadIdx.x - step] : 0;
+		__syncthreads();
+		shared_sums[threadIdx.x] += value;
+		__syncthreads();
+	}
+
+	int offset = shared_sums[threadIdx.x] - sum;
+	for (int i = 0; i < RAY_SORT_KEYS_PER_THREAD; i++) {
+		ray_sort_offsets[threadIdx.x * RAY_SORT_KEYS_PER_THREAD + i] = offset;
+		offset += keys[i];
+	}
+}
+
+extern "C" __global__ void kernel_ray_sort_scatter(int bounce) {
+	const TraceBuffer * ray_buffer_trace = get_ray_buffer_trace(bounce);
+	int ray_count = buffer_sizes.trace[bounce];
+
+	FOR_EACH_QUEUE_INDEX(index, ray_count) {
+		int index_out = warp_aggregated_increment(ray_sort_offsets, ray_sort_key(ray_buffer_trace, index));
+		ray_sort_index[index_out] = index;
+	}
+}
+
+// Treelet queue traversal, used instead of kernel_trace_bvh8 if cpu_config.enable_treelet_queues is set, see TreeletQueues.h
+extern "C" __global__ void kernel_treelet_tlas_bvh8(int bounce) {
+	TraversalData * traversal_data = &get_ray_buffer_trace(bounce)->traversal_data;
+	int ray_count = buffer_sizes.trace[bounce];
+
+	FOR_EACH_QUEUE_INDEX(index, ray_count) {
+		treelet_tlas_bvh8(traversal_data, index);
+	}
+}
+
+extern "C" __global__ void kernel_treelet_scatter() {
+	FOR_EACH_QUEUE_INDEX(index, treelet_entry_count()) {
+		treelet_scatter(index);
+	}
+}
+
+extern "C" __global__ void kernel_treelet_blas_bvh8(int bounce) {
+	const TraversalData * traversal_data = &get_ray_buffer_trace(bounce)->traversal_data;
+
+	FOR_EACH_QUEUE_INDEX(index, treelet_entry_count()) {
+		treelet_blas_bvh8(traversal_data, index);
+	}
+}
+
+extern "C" __global__ void kernel_treelet_resolve(int bounce) {
+	TraversalData * traversal_data = &get_ray_buffer_trace(bounce)->traversal_data;
+
+	FOR_EACH_QUEUE_INDEX(index, treelet_entry_count()) {
+		treelet_resolve(traversal_data, index);
+	}
+}
+
+// Next Event Estimation passes its shadow Rays to an emitter, the wavefront Material Kernels append them to the ShadowRayBuffer
+struct ShadowRayEmitterWavefront {
+	PathRadiance * path_radiance = nullptr; // Illumination goes straight to the AOVs
+
+	__device__ void operator()(int pixel_index, int bounce, float time, float3 origin, float3 direction, float max_distance, float3 illumination) const {
+		int shadow_ray_index = warp_aggregated_increment(&buffer_sizes.shadow[bounce]);
+
+		ray_buffer_shadow.traversal_data.ray_origin   .set(shadow_ray_index, origin);
+		ray_buffer_shadow.traversal_data.ray_direction.set(shadow_ray_index, direction);
+		ray_buffer_shadow.traversal_data.max_distance[shadow_ray_index] = max_distance;
+
+		if (CONFIG_ENABLE_MOTION_BLUR) {
+			ray_buffer_shadow.traversal_data.ray_time[shadow_ray_index] = time;
+		}
+		ray_buffer_shadow.set_illumination_and_pixel_index(shadow_ray_index, illumination, pixel_index);
+	}
+};
+
+template<typename BSDF, typename ShadowRayEmitter>
+__device__ void next_event_estimation_sky(
+	int          pixel_index,
+	int          bounce,
+	float        time,
+	const BSDF & bsdf,
+	float3       hit_point,
+	float3       normal,
+	float3       geometric_normal,
+	float3       throughput,
+	float        sky_select_probability,
+	float        u1,
+	float2       u2,
+	ShadowRayEmitter emit_shadow_ray
+) {
+	float  sky_pdf;
+	float3 to_sky = sample_sky_direction(u1, u2.x, u2.y, sky_pdf);
+
+	float cos_theta_hit = dot(to_sky, normal);
+
+	float3 bsdf_value;
+	float  bsdf_pdf;
+	bool valid = bsdf.eval(to_sky, cos_theta_hit, bsdf_value, bsdf_pdf);
+	if (!valid) return;
+
+	float light_pdf = sky_select_probability * sky_pdf;
+	if (!pdf_is_valid(light_pdf)) return;
+
+	float mis_weight;
+	if (CONFIG_ENABLE_MULTIPLE_IMPORTANCE_SAMPLING) {
+		mis_weight = power_heuristic(light_pdf, bsdf_pdf);
+	} else {
+		mis_weight = 1.0f;
+	}
+
+	float3 illumination = throughput * bsdf_value * sample_sky(to_sky) * mis_weight / light_pdf;
+
+	hit_point = ray_origin_epsilon_offset(hit_point, to_sky, geometric_normal);
+
+	emit_shadow_ray(pixel_index, bounce, time, hit_point, to_sky, INFINITY, illumination);
+}
+
+template<typename BSDF, typename ShadowRayEmitter>
+__device__ void next_event_estimation(
+	int          pixel_index,
+	int          bounce,
+	int          sample_index,
+	const BSDF & bsdf,
+	int          medium_id,
+	float3       hit_point,
+	float3       normal,
+	float3       geometric_normal,
+	float3       throughput,
+	ShadowRayEmitter emit_shadow_ray
+) {
+	float2 rand_light    = random<SampleDimension::NEE_LIGHT>   (pixel_index, bounce, sample_index);
+	float2 rand_triangle = random<SampleDimension::NEE_TRIANGLE>(pixel_index, bounce, sample_index);
+
+	float time = camera_sample_time(pixel_index, sample_index);
+
+	// Shadow Rays that start inside a heterogeneous Medium are attenuated by ratio tracking through its density grid
+	auto emit_shadow_ray_medium = [&](int pixel_index, int bounce, float time, float3 origin, float3 direction, float max_distance, float3 illumination) {
+		if (medium_id != INVALID && medium_is_heterogeneous(medium_id)) {
+			constexpr unsigned VOLUME_SALT_TRANSMITTANCE = 0x27d4eb2d;
+			unsigned rng_state = volume_rng_init(pixel_index, bounce, sample_index, VOLUME_SALT_TRANSMITTANCE);
+
+			illumination *= volume_transmittance(medium_id, origin, direction, max_distance, rng_state);
+		}
+		emit_shadow_ray(pixel_index, bounce, time, origin, direction, max_distance, illumination);
+	};
+
+	// Choose between the Sky and the light Triangles, reusing the random number for the next choice
+	float u_light = rand_light.x;
+
+	float sky_select_probability = sky_sample_probability();
+	if (u_light < sky_select_probability) {
+		next_event_estimation_sky(pixel_index, bounce, time, bsdf, hit_point, normal, geometric_normal, throughput, sky_select_probability, u_light / sky_select_probability, rand_triangle, emit_shadow_ray_medium);
+		return;
+	}
+	u_light = (u_light - sky_select_probability) / (1.0f - sky_select_probability);
+
+	// Pick random Light
+	int   light_mesh_id;
+	int   light_triangle_id;
+	float light_select_pdf; // Probability of choosing the light Triangle using the Light BVH
+
+	if (config.enable_light_bvh) {
+		light_triangle_id = light_bvh_sample(u_light, hit_point, light_mesh_id, light_select_pdf);
+		if (light_triangle_id == INVALID) return;
+	} else {
+		light_triangle_id = sample_light(u_light, rand_light.y, light_mesh_id);
+	}
+
+	// Pick random point on the Light
+	float2 light_uv = sample_triangle(rand_triangle.x, rand_triangle.y);
+
+	// Obtain the Light's position and geometric normal
+	TrianglePos light_triangle = triangle_get_positions(light_triangle_id);
+
+	float3 light_point;
+	triangle_barycentric(light_triangle, light_uv.x, light_uv.y, light_point);
+
+	float3 light_geometric_normal = cross(light_triangle.position_edge_1, light_triangle.position_edge_2);
+
+	// Transform into world space
+	Matrix3x4 light_world = mesh_get_transform(light_mesh_id, time);
+	matrix3x4_transform_position (light_world, light_point);
+	matrix3x4_transform_direction(light_world, light_geometric_normal);
+
+	light_geometric_normal = normalize(light_geometric_normal);
+
+	hit_point   = ray_origin_epsilon_offset(hit_point, light_point - hit_point, geometric_normal);
+	light_point = ray_origin_epsilon_offset(light_point, hit_point - light_point, light_geometric_normal);
+
+	float3 to_light = light_point - hit_point;
+	float distance_to_light = length(to_light);
+	to_light /= distance_to_light;
+
+	float cos_theta_light = abs_dot(to_light, light_geometric_normal);
+	float cos_theta_hit = dot(to_light, normal);
+
+	int light_material_id = mesh_get_material_id(light_mesh_id);
+	MaterialLight light_material = material_as_light(light_material_id);
+
+	float3 bsdf_value;
+	float  bsdf_pdf;
+	bool valid = bsdf.eval(to_light, cos_theta_hit, bsdf_value, bsdf_pdf);
+	if (!valid) return;
+
+	float light_pdf;
+	if (config.enable_light_bvh) {
+		float light_area = triangle_area_world(light_triangle, light_world);
+		light_pdf = light_select_pdf * square(distance_to_light) / (cos_theta_light * light_area);
+	} else {
+		float light_power = light_triangle_power(light_material, light_triangle_id);
+		light_pdf = light_power * square(distance_to_light) / (cos_theta_light * lights_total_weight);
+	}
+	light_pdf *= 1.0f - sky_select_probability;
+
+	if (!pdf_is_valid(light_pdf)) return;
+
+	float mis_weight;
+	if (CONFIG_ENABLE_MULTIPLE_IMPORTANCE_SAMPLING) {
+		mis_weight = power_heuristic(light_pdf, bsdf_pdf);
+	} else {
+		mis_weight = 1.0f;
+	}
+
+	float3 illumination = throughput * bsdf_value * light_get_emission(light_material, light_triangle_id, light_uv.x, light_uv.y) * mis_weight / light_pdf;
+
+	/*
+	// If inside a Medium, apply absorption and out-scattering
+	if (medium_id != INVALID) {
+		HomogeneousMedium medium = medium_as_homogeneous(medium_id);
+		float3 sigma_t = medium.sigma_a + medium.sigma_s;
+		illumination *= beer_lambert(sigma_t, distance_to_light);
+	}
+	*/
+
+	emit_shadow_ray_medium(pixel_index, bounce, time, hit_point, to_light, distance_to_light, illumination);
+}
+
+// Unshadowed contribution of a point on a light Triangle to a hit, as used by ReSTIR
+struct ReSTIRLightSample {
+	float3 hit_point; // Offset towards the light
+	float3 to_light;
+	float  distance_to_light;
+	float  cos_theta_light;
+	float  light_area;
+	float  light_power;
+
+	float3 radiance; // BSDF times emission, without visibility
+	float  target;   // Target function of the resampling, the luminance of radiance
+};
+
+template<typename BSDF>
+__device__ bool restir_eval_light(
+	const BSDF & bsdf,
+	float        time,
+	float3       hit_point,
+	float3       normal,
+	float3       geometric_normal,
+	int          light_mesh_id,
+	int          light_triangle_id,
+	float2       light_uv,
+	ReSTIRLightSample & sample
+) {
+	TrianglePos light_triangle = triangle_get_positions(light_triangle_id);
 
-	// Transform into world space
-	Matrix3x4 light_world = mesh_get_transform(light_mesh_id);
+	float3 light_point;
+	triangle_barycentric(light_triangle, light_uv.x, light_uv.y, light_point);
+
+	float3 light_geometric_normal = cross(light_triangle.position_edge_1, light_triangle.position_edge_2);
+
+	Matrix3x4 light_world = mesh_get_transform(light_mesh_id, time);
 	matrix3x4_transform_position (light_world, light_point);
 	matrix3x4_transform_direction(light_world, light_geometric_normal);
 
@@ -507,98 +1471,237 @@ __device__ void next_event_estimation(
 	to_light /= distance_to_light;
 
 	float cos_theta_light = abs_dot(to_light, light_geometric_normal);
-	float cos_theta_hit = dot(to_light, normal);
-
-	int light_material_id = mesh_get_material_id(light_mesh_id);
-	MaterialLight light_material = material_as_light(light_material_id);
+	float cos_theta_hit   = dot(to_light, normal);
 
 	float3 bsdf_value;
 	float  bsdf_pdf;
 	bool valid = bsdf.eval(to_light, cos_theta_hit, bsdf_value, bsdf_pdf);
-	if (!valid) return;
+	if (!valid) return false;
 
-	float light_power = luminance(light_material.emission.x, light_material.emission.y, light_material.emission.z);
-	float light_pdf   = light_power * square(distance_to_light) / (cos_theta_light * lights_total_weight);
+	MaterialLight light_material = material_as_light(mesh_get_material_id(light_mesh_id));
 
-	if (!pdf_is_valid(light_pdf)) return;
+	sample.hit_point         = hit_point;
+	sample.to_light          = to_light;
+	sample.distance_to_light = distance_to_light;
+	sample.cos_theta_light   = cos_theta_light;
+	sample.light_area        = config.enable_light_bvh ? triangle_area_world(light_triangle, light_world) : 0.0f;
+	sample.light_power       = light_triangle_power(light_material, light_triangle_id);
+	sample.radiance          = bsdf_value * light_get_emission(light_material, light_triangle_id, light_uv.x, light_uv.y);
+	sample.target            = luminance(sample.radiance.x, sample.radiance.y, sample.radiance.z);
 
-	float mis_weight;
-	if (config.enable_multiple_importance_sampling) {
-		mis_weight = power_heuristic(light_pdf, bsdf_pdf);
-	} else {
-		mis_weight = 1.0f;
-	}
+	// The target function is in solid angle measure, the same as the pdf the candidates are weighted by
+	return sample.target > 0.0f;
+}
 
-	float3 illumination = throughput * bsdf_value * light_material.emission * mis_weight / light_pdf;
+// Combines a Reservoir of another Pixel or frame into the current one, its sample is re-evaluated at the current hit
+template<typename BSDF>
+__device__ void restir_combine(
+	Reservoir         & reservoir,
+	ReSTIRLightSample & selected,
+	const Reservoir   & other,
+	float               M_max,
+	const BSDF        & bsdf,
+	float               time,
+	float3              hit_point,
+	float3              normal,
+	float3              geometric_normal,
+	unsigned          & rng_state
+) {
+	float M = fminf(other.M, M_max);
 
-	/*
-	// If inside a Medium, apply absorption and out-scattering
-	if (medium_id != INVALID) {
-		HomogeneousMedium medium = medium_as_homogeneous(medium_id);
-		float3 sigma_t = medium.sigma_a + medium.sigma_s;
-		illumination *= beer_lambert(sigma_t, distance_to_light);
+	ReSTIRLightSample sample;
+	float weight = 0.0f;
+	if (restir_eval_light(bsdf, time, hit_point, normal, geometric_normal, other.light_mesh_id, other.light_triangle_id, other.light_uv, sample)) {
+		weight = sample.target * other.W * M;
 	}
-	*/
 
-	// Emit Shadow Ray
-	int shadow_ray_index = atomicAdd(&buffer_sizes.shadow[bounce], 1);
-
-	ray_buffer_shadow.traversal_data.ray_origin   .set(shadow_ray_index, hit_point);
-	ray_buffer_shadow.traversal_data.ray_direction.set(shadow_ray_index, to_light);
-	ray_buffer_shadow.traversal_data.max_distance[shadow_ray_index] = distance_to_light;
-	ray_buffer_shadow.illumination_and_pixel_index[shadow_ray_index] = make_float4(
-		illumination.x,
-		illumination.y,
-		illumination.z,
-		__int_as_float(pixel_index)
-	);
+	if (reservoir_update(reservoir, weight, M, random_hash_chain(rng_state))) {
+		reservoir.light_mesh_id     = other.light_mesh_id;
+		reservoir.light_triangle_id = other.light_triangle_id;
+		reservoir.light_uv          = other.light_uv;
+		selected = sample;
+	}
 }
 
-template<typename BSDF, PackedMaterialBuffer * packed_material_buffer>
-__device__ void shade_material(int bounce, int sample_index, int buffer_size) {
-	int index = blockIdx.x * blockDim.x + threadIdx.x;
-	if (index >= buffer_size) return;
+// Next Event Estimation on the primary hit using ReSTIR, see ReSTIR.h
+// The Sky is still sampled directly, with the same probability as in next_event_estimation
+template<typename BSDF, typename ShadowRayEmitter>
+__device__ void next_event_estimation_restir(
+	int              pixel_index,
+	int              sample_index,
+	const BSDF     & bsdf,
+	const RayHit   & hit,
+	float3           hit_point,
+	float3           normal,
+	float3           geometric_normal,
+	float3           throughput,
+	ShadowRayEmitter emit_shadow_ray
+) {
+	constexpr int bounce = 0;
 
-	MaterialBufferAllocation material_buffer = get_material_buffer(*packed_material_buffer);
+	float2 rand_light    = random<SampleDimension::NEE_LIGHT>   (pixel_index, bounce, sample_index);
+	float2 rand_triangle = random<SampleDimension::NEE_TRIANGLE>(pixel_index, bounce, sample_index);
 
-	// Material Buffers can be shared by 2 different Materials, one growing left to right, one growing right to left
-	// If this Material is right to left, reverse the index into the buffers
-	if (material_buffer.reversed) {
-		index = (BATCH_SIZE - 1) - index;
+	float time = camera_sample_time(pixel_index, sample_index);
+
+	float sky_select_probability = sky_sample_probability();
+	if (rand_light.x < sky_select_probability) {
+		next_event_estimation_sky(pixel_index, bounce, time, bsdf, hit_point, normal, geometric_normal, throughput, sky_select_probability, rand_light.x / sky_select_probability, rand_triangle, emit_shadow_ray);
+		return;
 	}
 
-	float3 ray_direction = material_buffer.buffer->ray_direction.get(index);
-	RayHit hit           = material_buffer.buffer->hits         .get(index);
+	unsigned rng_state = hash_combine(pcg_hash(pixel_index), sample_index);
 
-	unsigned pixel_index_and_flags = material_buffer.buffer->pixel_index_and_flags[index];
-	int      pixel_index = pixel_index_and_flags & ~FLAGS_ALL;
+	Reservoir         reservoir = reservoir_empty();
+	ReSTIRLightSample selected  = { };
 
-	bool inside_medium = pixel_index_and_flags & FLAG_INSIDE_MEDIUM;
+	// Candidate generation, weighted by the target function over the pdf of the regular light sampling
+	for (int i = 0; i < config.restir_candidate_count; i++) {
+		float u_light    = random_hash_chain(rng_state);
+		float u_triangle = random_hash_chain(rng_state);
 
-	int medium_id = INVALID;
-	if (inside_medium) {
-		medium_id = material_buffer.buffer->medium[index];
+		int   light_mesh_id;
+		int   light_triangle_id;
+		float light_select_pdf;
+
+		if (config.enable_light_bvh) {
+			light_triangle_id = light_bvh_sample(u_light, hit_point, light_mesh_id, light_select_pdf);
+		} else {
+			light_triangle_id = sample_light(u_light, u_triangle, light_mesh_id);
+		}
+
+		float weight = 0.0f;
+
+		float2 light_uv = sample_triangle(random_hash_chain(rng_state), random_hash_chain(rng_state));
+
+		ReSTIRLightSample sample;
+		if (light_triangle_id != INVALID && restir_eval_light(bsdf, time, hit_point, normal, geometric_normal, light_mesh_id, light_triangle_id, light_uv, sample)) {
+			float light_pdf;
+			if (config.enable_light_bvh) {
+				light_pdf = light_select_pdf * square(sample.distance_to_light) / (sample.cos_theta_light * sample.light_area);
+			} else {
+				light_pdf = sample.light_power * square(sample.distance_to_light) / (sample.cos_theta_light * lights_total_weight);
+			}
+
+			if (pdf_is_valid(light_pdf)) {
+				weight = sample.target / light_pdf;
+			}
+		}
+
+		if (reservoir_update(reservoir, weight, 1.0f, random_hash_chain(rng_state))) {
+			reservoir.light_mesh_id     = light_mesh_id;
+			reservoir.light_triangle_id = light_triangle_id;
+			reservoir.light_uv          = light_uv;
+			selected = sample;
+		}
 	}
 
-	float3 throughput;
-	if (bounce == 0) {
-		throughput = make_float3(1.0f); // Throughput is known to be (1,1,1) still, skip the global memory load
+	int x = pixel_index % screen_pitch;
+	int y = pixel_index / screen_pitch;
+
+	float depth = hit.t;
+
+	// Reuse the Reservoirs of the previous frame, at the Pixel the hit reprojects to and around it
+	if (sample_index > 0) {
+		int x_prev = x;
+		int y_prev = y;
+
+		if (CONFIG_ENABLE_SVGF) {
+			float2 screen_position_prev = gbuffer_screen_position_prev.get(x, y);
+
+			x_prev = int((0.5f + 0.5f * screen_position_prev.x) * float(screen_width));
+			y_prev = int((0.5f + 0.5f * screen_position_prev.y) * float(screen_height));
+		}
+
+		const Reservoir * reservoirs_prev = restir_get_reservoirs(sample_index - 1);
+
+		// Bound the history so that stale samples are replaced over time
+		float M_max = float(config.restir_max_history * config.restir_candidate_count);
+
+		for (int i = 0; i <= config.restir_spatial_count; i++) {
+			int tap_x = x_prev;
+			int tap_y = y_prev;
+
+			// The first tap is the temporal one
+			if (i > 0) {
+				float2 offset = sample_disk(random_hash_chain(rng_state), random_hash_chain(rng_state)) * config.restir_spatial_radius;
+				tap_x += int(offset.x);
+				tap_y += int(offset.y);
+			}
+
+			if (tap_x < 0 || tap_x >= screen_width || tap_y < 0 || tap_y >= screen_height) continue;
+
+			Reservoir other = reservoirs_prev[tap_x + tap_y * screen_pitch];
+			if (!reservoir_is_consistent(other, hit.mesh_id, depth, normal)) continue;
+
+			restir_combine(reservoir, selected, other, M_max, bsdf, time, hit_point, normal, geometric_normal, rng_state);
+		}
+	}
+
+	if (reservoir.light_triangle_id != INVALID && selected.target > 0.0f) {
+		reservoir.W = reservoir.weight_sum / (reservoir.M * selected.target);
 	} else {
-		throughput = material_buffer.buffer->throughput.get(index);
+		reservoir.W = 0.0f;
 	}
 
+	reservoir.surface_mesh_id = hit.mesh_id;
+	reservoir.surface_depth   = depth;
+	reservoir.surface_normal  = oct_encode_unorm16(normal);
+
+	restir_get_reservoirs(sample_index)[pixel_index] = reservoir;
+
+	if (reservoir.W <= 0.0f || !isfinite(reservoir.W)) return;
+
+	// The light Triangles are only reached with probability 1 - sky_select_probability
+	float3 illumination = throughput * selected.radiance * reservoir.W / (1.0f - sky_select_probability);
+
+	emit_shadow_ray(pixel_index, bounce, time, selected.hit_point, selected.to_light, selected.distance_to_light, illumination);
+}
+
+// Path state at a hit as consumed by the Material shading, see shade_hit
+struct PathVertex {
+	float3 ray_direction;
+	RayHit hit;
+
+	int    pixel_index;
+	int    medium_id;
+	float3 throughput;
+
+	float cone_angle; // Ray Cone of the incoming Ray, only used with CONFIG_ENABLE_MIPMAPPING and ignored on bounce 0
+	float cone_width;
+};
+
+// Shades the hit of a path with the given BSDF, performs Next Event Estimation and samples the next Ray
+// Updates the throughput, medium and Ray Cone of the vertex. Returns false if the path terminates
+// Shared by the wavefront Material Kernels and kernel_megakernel, which only differ in how they handle the shadow and next Rays
+template<typename BSDF, typename ShadowRayEmitter>
+__device__ bool shade_hit(int bounce, int sample_index, PathVertex & vertex, ShadowRayEmitter emit_shadow_ray, Ray & ray_out, float & pdf, bool & allow_nee) {
+	float3         ray_direction = vertex.ray_direction;
+	const RayHit & hit           = vertex.hit;
+	int            pixel_index   = vertex.pixel_index;
+
+	int    & medium_id  = vertex.medium_id;
+	float3 & throughput = vertex.throughput;
+	float  & cone_angle = vertex.cone_angle;
+	float  & cone_width = vertex.cone_width;
+
 	// Obtain hit Triangle position, normal, and texture coordinates
-	TrianglePosNorTex hit_triangle = triangle_get_positions_normals_and_tex_coords(hit.triangle_id);
+	// For Curves a Triangle tangent to the Curve at the hit is used
+	float hit_u = hit.u;
+	float hit_v = hit.v;
+	TrianglePosNorTex hit_triangle = hit_get_triangle(hit.mesh_id, hit.triangle_id, hit_u, hit_v);
 
 	float3 hit_point;
 	float3 normal;
 	float2 tex_coord;
-	triangle_barycentric(hit_triangle, hit.u, hit.v, hit_point, normal, tex_coord);
+	triangle_barycentric(hit_triangle, hit_u, hit_v, hit_point, normal, tex_coord);
 
 	float3 hit_point_local = hit_point; // Keep copy of the untransformed hit point in local space
 
 	// Transform into world space
-	Matrix3x4 world = mesh_get_transform(hit.mesh_id);
+	float time = camera_sample_time(pixel_index, sample_index);
+
+	Matrix3x4 world = mesh_get_transform(hit.mesh_id, time);
 	matrix3x4_transform_position (world, hit_point);
 	matrix3x4_transform_direction(world, normal);
 
@@ -606,17 +1709,14 @@ __device__ void shade_material(int bounce, int sample_index, int buffer_size) {
 
 	float mesh_scale_inv = 1.0f / mesh_get_scale(hit.mesh_id);
 
-	// Load and propagate Ray Cone
-	float cone_angle;
-	float cone_width;
+	// Propagate Ray Cone
 	float curvature = 0.0f;
-	if (config.enable_mipmapping) {
+	if (CONFIG_ENABLE_MIPMAPPING) {
 		if (bounce == 0) {
 			cone_angle = camera.pixel_spread_angle;
 			cone_width = cone_angle * hit.t;
 		} else {
-			cone_angle = material_buffer.buffer->cone_angle[index];
-			cone_width = material_buffer.buffer->cone_width[index] + cone_angle * hit.t;
+			cone_width += cone_angle * hit.t;
 		}
 
 		// Calculate Triangle curvature here,
@@ -650,7 +1750,7 @@ __device__ void shade_material(int bounce, int sample_index, int buffer_size) {
 
 	float3 omega_i = world_to_local(-ray_direction, tangent, bitangent, normal);
 
-	if (omega_i.z <= 0.0f) return; // Below hemisphere, reject
+	if (omega_i.z <= 0.0f) return false; // Below hemisphere, reject
 
 	// Initialize BSDF
 	int material_id = mesh_get_material_id(hit.mesh_id);
@@ -665,27 +1765,29 @@ __device__ void shade_material(int bounce, int sample_index, int buffer_size) {
 	bsdf.omega_i      = omega_i;
 	bsdf.init(bounce, entering_material, material_id);
 
-	if (BSDF::HAS_ALBEDO) {
-		TextureLOD lod;
+	// The footprint is computed once and shared by all Textures of the Material
+	TextureLOD lod;
 
-		if (config.enable_mipmapping && bsdf.has_texture()) {
-			if (use_anisotropic_texture_sampling(bounce)) {
-				float3 ellipse_axis_1;
-				float3 ellipse_axis_2;
-				ray_cone_get_ellipse_axes(ray_direction, geometric_normal, cone_width, ellipse_axis_1, ellipse_axis_2);
+	if (CONFIG_ENABLE_MIPMAPPING && bsdf.has_texture()) {
+		if (use_anisotropic_texture_sampling(bounce)) {
+			float3 ellipse_axis_1;
+			float3 ellipse_axis_2;
+			ray_cone_get_ellipse_axes(ray_direction, geometric_normal, cone_width, ellipse_axis_1, ellipse_axis_2);
 
-				lod.aniso.gradient_1 = ray_cone_ellipse_axis_to_gradient(hit_triangle, triangle_double_area_inv, geometric_normal, hit_point, tex_coord, ellipse_axis_1);
-				lod.aniso.gradient_2 = ray_cone_ellipse_axis_to_gradient(hit_triangle, triangle_double_area_inv, geometric_normal, hit_point, tex_coord, ellipse_axis_2);
-			} else {
-				float lod_triangle = triangle_get_lod(triangle_double_area_inv, hit_triangle.tex_coord_edge_1, hit_triangle.tex_coord_edge_2);
-				float lod_ray_cone = ray_cone_get_lod(ray_direction, geometric_normal, cone_width);
+			lod.aniso.gradient_1 = ray_cone_ellipse_axis_to_gradient(hit_triangle, triangle_double_area_inv, geometric_normal, hit_point, tex_coord, ellipse_axis_1);
+			lod.aniso.gradient_2 = ray_cone_ellipse_axis_to_gradient(hit_triangle, triangle_double_area_inv, geometric_normal, hit_point, tex_coord, ellipse_axis_2);
+		} else {
+			float lod_triangle = triangle_get_lod(triangle_double_area_inv, hit_triangle.tex_coord_edge_1, hit_triangle.tex_coord_edge_2);
+			float lod_ray_cone = ray_cone_get_lod(ray_direction, geometric_normal, cone_width);
 
-				lod.iso.lod = log2f(lod_triangle * lod_ray_cone);
-			}
+			lod.iso.lod = log2f(lod_triangle * lod_ray_cone);
 		}
+	}
 
-		bsdf.calc_albedo(bounce, pixel_index, throughput, tex_coord, lod);
-	} else if (bounce == 0) {
+	// Resolves the Albedo and any textured parameters, constant parameters take the same path
+	bsdf.calc_parameters(bounce, pixel_index, throughput, tex_coord, lod);
+
+	if (!BSDF::HAS_ALBEDO && bounce == 0) {
 		aov_framebuffer_set(AOVType::ALBEDO, pixel_index, make_float4(1.0f));
 	}
 
@@ -695,12 +1797,12 @@ __device__ void shade_material(int bounce, int sample_index, int buffer_size) {
 	}
 
 	// Calulate new Ray Cone angle
-	if (config.enable_mipmapping) {
+	if (CONFIG_ENABLE_MIPMAPPING) {
 		cone_angle -= 2.0f * curvature * fabsf(cone_width) / dot(normal, ray_direction); // Eq. 5 (Akenine-Möller 2021)
 	}
 
-	// Emit GBuffers if SVGF is enabled
-	if (bounce == 0 && config.enable_svgf) {
+	// Emit GBuffers if SVGF or reprojection is enabled
+	if (bounce == 0 && (CONFIG_ENABLE_SVGF || config.enable_reprojection)) {
 		float3 hit_point_prev = hit_point_local;
 
 		Matrix3x4 world_prev = mesh_get_transform_prev(hit.mesh_id);
@@ -711,51 +1813,152 @@ __device__ void shade_material(int bounce, int sample_index, int buffer_size) {
 		svgf_set_gbuffers(x, y, hit, hit_point, normal, hit_point_prev);
 	}
 
+	// Terminate into the radiance cache, its estimate already contains the Next Event Estimation of this vertex
+	// The throughput includes the albedo of this vertex, the cache stores radiance relative to it so Textures stay sharp
+	// Only Diffuse and Plastic vertices use the cache, the radiance leaving them depends little on the direction
+	if (radiance_cache_enabled()) {
+		float3 cached_radiance;
+		bool   cached = BSDF::ALLOW_GUIDING && radiance_cache_lookup(hit_point, normal, cached_radiance);
+
+		if (bounce == 0) {
+			radiance_cache_clear_vertices(pixel_index);
+			aov_framebuffer_set(AOVType::RADIANCE_CACHE, pixel_index, make_float4(cached ? throughput * cached_radiance : make_float3(0.0f)));
+		}
+
+		if (cached && bounce >= max(config.radiance_cache_min_bounce, 1)) {
+			float3 illumination = throughput * cached_radiance;
+
+			if (guiding_enabled()) {
+				guiding_add_illumination(pixel_index, bounce, illumination);
+			}
+			radiance_cache_add_illumination(pixel_index, bounce, illumination);
+
+			path_radiance_add(emit_shadow_ray.path_radiance, pixel_index, illumination, false, false);
+			return false;
+		}
+
+		if (adjoint_russian_roulette_enabled() && russian_roulette_adjoint(pixel_index, bounce, sample_index, throughput, cached, cached_radiance)) return false;
+
+		if (BSDF::ALLOW_GUIDING) {
+			radiance_cache_record_vertex(pixel_index, bounce, hit_point, normal, throughput);
+		}
+	}
+
 	// Next Event Estimation
-	if (config.enable_next_event_estimation && lights_total_weight > 0.0f && bsdf.allow_nee()) {
-		next_event_estimation(pixel_index, bounce, sample_index, bsdf, medium_id, hit_point, normal, geometric_normal, throughput);
+	if (CONFIG_ENABLE_NEXT_EVENT_ESTIMATION && (lights_total_weight > 0.0f || sky_sample_probability() > 0.0f) && bsdf.allow_nee()) {
+		if (bounce == 0 && restir_enabled()) {
+			next_event_estimation_restir(pixel_index, sample_index, bsdf, hit, hit_point, normal, geometric_normal, throughput, emit_shadow_ray);
+		} else {
+			next_event_estimation(pixel_index, bounce, sample_index, bsdf, medium_id, hit_point, normal, geometric_normal, throughput, emit_shadow_ray);
+		}
 	}
 
-	// Sample BSDF
+	// Sample BSDF, or the mixture with the guiding distribution
 	float3 direction_out;
-	float pdf;
-	bool valid = bsdf.sample(throughput, medium_id, direction_out, pdf);
+	bool valid;
+	if (BSDF::ALLOW_GUIDING && guiding_enabled()) {
+		valid = guiding_sample_bsdf(bsdf, pixel_index, bounce, sample_index, hit_point, throughput, medium_id, direction_out, pdf);
 
-	if (!valid) return;
+		if (valid) {
+			guiding_record_vertex(pixel_index, bounce, hit_point, direction_out, throughput, pdf);
+		}
+	} else {
+		valid = bsdf.sample(throughput, medium_id, direction_out, pdf);
+	}
+
+	if (!valid) return false;
+
+	ray_out.origin    = ray_origin_epsilon_offset(hit_point, direction_out, geometric_normal);
+	ray_out.direction = direction_out;
+
+	allow_nee = bsdf.allow_nee();
+	return true;
+}
+
+template<typename BSDF, PackedMaterialBuffer * packed_material_buffer>
+__device__ void shade_material_ray(int index, int bounce, int sample_index) {
+	MaterialBufferAllocation material_buffer = get_material_buffer(*packed_material_buffer);
 
-	float3 origin_out = ray_origin_epsilon_offset(hit_point, direction_out, geometric_normal);
+	// Material Buffers can be shared by 2 different Materials, one growing left to right, one growing right to left
+	// If this Material is right to left, reverse the index into the buffers
+	if (material_buffer.reversed) {
+		index = (batch_size - 1) - index;
+	}
+
+	// Visit the queue in order of material_id, so that neighbouring threads access the same Material and Textures
+	if (config.enable_material_sorting) {
+		index = material_buffer.buffer->sort_index[index];
+	}
+
+	PathVertex vertex;
+	vertex.ray_direction = material_buffer.buffer->get_ray_direction(index);
+	vertex.hit           = material_buffer.buffer->hits.get(index);
+
+	unsigned pixel_index_and_flags = material_buffer.buffer->pixel_index_and_flags[index];
+	vertex.pixel_index = pixel_index_and_flags & ~FLAGS_ALL;
+
+	bool inside_medium = pixel_index_and_flags & FLAG_INSIDE_MEDIUM;
+
+	vertex.medium_id = INVALID;
+	if (inside_medium) {
+		vertex.medium_id = material_buffer.buffer->medium[index];
+	}
+
+	if (bounce == 0) {
+		vertex.throughput = make_float3(1.0f); // Throughput is known to be (1,1,1) still, skip the global memory load
+	} else {
+		vertex.throughput = material_buffer.buffer->get_throughput(index);
+	}
+
+	if (CONFIG_ENABLE_MIPMAPPING && bounce > 0) {
+		material_buffer.buffer->get_cone(index, vertex.cone_angle, vertex.cone_width);
+	}
+
+	Ray   ray_out;
+	float pdf;
+	bool  allow_nee;
+	if (!shade_hit<BSDF>(bounce, sample_index, vertex, ShadowRayEmitterWavefront { }, ray_out, pdf, allow_nee)) return;
 
 	// Emit next Ray
-	int index_out = atomicAdd(&buffer_sizes.trace[bounce + 1], 1);
+	int index_out = warp_aggregated_increment(&buffer_sizes.trace[bounce + 1]);
 
 	TraceBuffer * ray_buffer_trace = get_ray_buffer_trace(bounce + 1);
 
-	ray_buffer_trace->traversal_data.ray_origin   .set(index_out, origin_out);
-	ray_buffer_trace->traversal_data.ray_direction.set(index_out, direction_out);
+	ray_buffer_trace->traversal_data.ray_origin   .set(index_out, ray_out.origin);
+	ray_buffer_trace->traversal_data.ray_direction.set(index_out, ray_out.direction);
 
-	if (medium_id != INVALID) {
-		ray_buffer_trace->medium[index_out] = medium_id;
+	if (CONFIG_ENABLE_MOTION_BLUR) {
+		ray_buffer_trace->traversal_data.ray_time[index_out] = camera_sample_time(vertex.pixel_index, sample_index);
 	}
 
-	if (config.enable_mipmapping) {
-		ray_buffer_trace->cone_angle[index_out] = cone_angle;
-		ray_buffer_trace->cone_width[index_out] = cone_width;
+	if (vertex.medium_id != INVALID) {
+		ray_buffer_trace->medium[index_out] = vertex.medium_id;
 	}
 
-	bool allow_nee = bsdf.allow_nee();
+	if (CONFIG_ENABLE_MIPMAPPING) {
+		ray_buffer_trace->cone_angle[index_out] = vertex.cone_angle;
+		ray_buffer_trace->cone_width[index_out] = vertex.cone_width;
+	}
 
 	unsigned flags = 0;
-	if (allow_nee)            flags |= FLAG_ALLOW_NEE;
-	if (medium_id != INVALID) flags |= FLAG_INSIDE_MEDIUM;
+	if (allow_nee)                   flags |= FLAG_ALLOW_NEE;
+	if (vertex.medium_id != INVALID) flags |= FLAG_INSIDE_MEDIUM;
 
-	ray_buffer_trace->pixel_index_and_flags[index_out] = pixel_index | flags;
-	ray_buffer_trace->throughput.set(index_out, throughput);
+	ray_buffer_trace->pixel_index_and_flags[index_out] = vertex.pixel_index | flags;
+	ray_buffer_trace->throughput.set(index_out, vertex.throughput);
 
 	if (allow_nee) {
 		ray_buffer_trace->last_pdf[index_out] = pdf;
 	}
 }
 
+template<typename BSDF, PackedMaterialBuffer * packed_material_buffer>
+__device__ void shade_material(int bounce, int sample_index, int buffer_size) {
+	FOR_EACH_QUEUE_INDEX(index, buffer_size) {
+		shade_material_ray<BSDF, packed_material_buffer>(index, bounce, sample_index);
+	}
+}
+
 extern "C" __global__ void kernel_material_diffuse(int bounce, int sample_index) {
 	shade_material<BSDFDiffuse, &material_buffer_diffuse>(bounce, sample_index, buffer_sizes.diffuse[bounce]);
 }
@@ -772,20 +1975,257 @@ extern "C" __global__ void kernel_material_conductor(int bounce, int sample_inde
 	shade_material<BSDFConductor, &material_buffer_conductor>(bounce, sample_index, buffer_sizes.conductor[bounce]);
 }
 
-extern "C" __global__ void kernel_accumulate(float frames_accumulated) {
+// Traces the shadow Ray right away with the BVH8 Short Stack traversal, used by kernel_megakernel
+struct ShadowRayEmitterInline {
+	PathRadiance * path_radiance;
+
+	__device__ void operator()(int pixel_index, int bounce, float time, float3 origin, float3 direction, float max_distance, float3 illumination) const {
+		Ray ray;
+		ray.origin    = origin;
+		ray.direction = direction;
+
+		unsigned stats_node_tests     = 0; // Not collected
+		unsigned stats_triangle_tests = 0;
+		if (bvh8_intersect_shadow_short_stack(ray, max_distance, &time, 0, stats_node_tests, stats_triangle_tests)) return;
+
+		shadow_ray_add_illumination(pixel_index, bounce, illumination, path_radiance);
+	}
+};
+
+// Continues a path in-thread starting at the given bounce, without going through the wavefront Buffers
+// Only supports BVH8 (using the Short Stack traversal, which needs no Shared Memory) and does not scatter in Media or output SVGF GBuffers
+__device__ void megakernel_trace_path(int bounce_first, int num_bounces, int sample_index, Ray ray, float time, PathVertex vertex, bool allow_nee, float last_pdf) {
+	int pixel_index = vertex.pixel_index;
+
+	PathRadiance path_radiance = { };
+
+	ShadowRayEmitterInline emit_shadow_ray = { &path_radiance };
+
+	for (int bounce = bounce_first; bounce < num_bounces; bounce++) {
+		unsigned stats_node_tests     = 0; // Not collected
+		unsigned stats_triangle_tests = 0;
+		RayHit hit = bvh8_intersect_short_stack(ray, &time, 0, stats_node_tests, stats_triangle_tests);
+
+		float3 ray_origin = ray.origin;
+		auto get_ray_origin = [ray_origin]() { return ray_origin; };
+		auto get_last_pdf   = [last_pdf]()   { return last_pdf; };
+
+		if (hit.triangle_id == INVALID) {
+			path_miss_sky(pixel_index, bounce, ray.direction, vertex.throughput, allow_nee, get_last_pdf, &path_radiance);
+			break;
+		}
+
+		int material_id = mesh_get_material_id(hit.mesh_id);
+		MaterialType material_type = material_get_type(material_id);
+
+		if (material_type == MaterialType::LIGHT) {
+			path_hit_light(pixel_index, bounce, sample_index, material_id, ray.direction, hit, vertex.throughput, allow_nee, get_ray_origin, get_last_pdf, &path_radiance);
+			break;
+		}
+
+		if (russian_roulette_surface(pixel_index, bounce, sample_index, vertex.throughput)) break;
+
+		vertex.ray_direction = ray.direction;
+		vertex.hit           = hit;
+
+		bool valid;
+		switch (material_type) {
+			case MaterialType::DIFFUSE:    valid = shade_hit<BSDFDiffuse>   (bounce, sample_index, vertex, emit_shadow_ray, ray, last_pdf, allow_nee); break;
+			case MaterialType::PLASTIC:    valid = shade_hit<BSDFPlastic>   (bounce, sample_index, vertex, emit_shadow_ray, ray, last_pdf, allow_nee); break;
+			case MaterialType::DIELECTRIC: valid = shade_hit<BSDFDielectric>(bounce, sample_index, vertex, emit_shadow_ray, ray, last_pdf, allow_nee); break;
+			case MaterialType::CONDUCTOR:  valid = shade_hit<BSDFConductor> (bounce, sample_index, vertex, emit_shadow_ray, ray, last_pdf, allow_nee); break;
+			default: valid = false; break;
+		}
+		if (!valid) break;
+	}
+
+	path_radiance_write(path_radiance, pixel_index);
+}
+
+// Fused path loop, every thread traces, shades and performs Next Event Estimation for the entire path of one Pixel.
+// Is used instead of the wavefront Kernels for small numbers of Pixels, where the round trips through global memory
+// of the wavefront dominate, see Pathtracer::use_megakernel
+extern "C" __global__ void kernel_megakernel(int sample_index, int pixel_offset, int pixel_count, int num_bounces) {
+	int index = blockIdx.x * blockDim.x + threadIdx.x;
+
+	bool use_pixel_list = adaptive_sampling_use_pixel_list(sample_index);
+	if (use_pixel_list) {
+		pixel_count = clamp(*adaptive_pixel_count - pixel_offset, 0, pixel_count);
+	}
+
+	if (index >= pixel_count) return;
+
+	int index_offset = index + pixel_offset;
+	if (use_pixel_list) {
+		index_offset = adaptive_pixels[index_offset];
+	}
+	int x;
+	int y;
+	int pixel_index;
+	const Camera & view_camera = view_get_pixel(index_offset, x, y, pixel_index);
+
+	Ray   ray  = camera_generate_ray(pixel_index, sample_index, x, y, view_camera);
+	float time = camera_sample_time(pixel_index, sample_index);
+
+	PathVertex vertex;
+	vertex.pixel_index = pixel_index;
+	vertex.medium_id   = INVALID;
+	vertex.throughput  = make_float3(1.0f);
+	vertex.cone_angle  = 0.0f;
+	vertex.cone_width  = 0.0f;
+
+	megakernel_trace_path(0, num_bounces, sample_index, ray, time, vertex, false, 0.0f);
+}
+
+__device__ unsigned megakernel_tail_blocks_retired;
+
+// Finishes the paths that are still alive at the start of the given bounce in-thread, once only a few of them are left.
+// After a couple of bounces most paths have terminated and the wavefront launches mostly empty Kernels for the remaining bounces.
+// Launched before every bounce with a Grid that covers threshold Rays, does nothing if more Rays than that are still alive.
+// The last Block to finish clears the trace queue of the bounce, which turns the wavefront Kernels of the remaining bounces into no-ops
+extern "C" __global__ void kernel_megakernel_tail(int bounce, int sample_index, int num_bounces, int threshold) {
+	int ray_count = buffer_sizes.trace[bounce];
+	if (ray_count > threshold) return; // Uniform over the Grid, the queue is only cleared after every Block has read it
+
+	int index = blockIdx.x * blockDim.x + threadIdx.x;
+	if (index < ray_count) {
+		const TraceBuffer * ray_buffer_trace = get_ray_buffer_trace(bounce);
+
+		Ray ray;
+		ray.origin    = ray_buffer_trace->traversal_data.ray_origin   .get(index);
+		ray.direction = ray_buffer_trace->traversal_data.ray_direction.get(index);
+
+		unsigned pixel_index_and_flags = ray_buffer_trace->pixel_index_and_flags[index];
+
+		PathVertex vertex;
+		vertex.pixel_index = pixel_index_and_flags & ~FLAGS_ALL;
+		vertex.medium_id   = INVALID;
+		vertex.throughput  = ray_buffer_trace->throughput.get(index);
+
+		if (CONFIG_ENABLE_MIPMAPPING) {
+			vertex.cone_angle = ray_buffer_trace->cone_angle[index];
+			vertex.cone_width = ray_buffer_trace->cone_width[index];
+		}
+
+		bool  allow_nee = pixel_index_and_flags & FLAG_ALLOW_NEE;
+		float last_pdf  = ray_buffer_trace->last_pdf[index];
+		float time      = camera_sample_time(vertex.pixel_index, sample_index);
+
+		megakernel_trace_path(bounce, num_bounces, sample_index, ray, time, vertex, allow_nee, last_pdf);
+	}
+
+	__syncthreads();
+
+	if (threadIdx.x == 0) {
+		__threadfence();
+
+		if (atomicAdd(&megakernel_tail_blocks_retired, 1) == gridDim.x - 1) {
+			buffer_sizes.trace[bounce] = 0;
+			megakernel_tail_blocks_retired = 0;
+		}
+	}
+}
+
+// Jet colour map, t in [0, 1] goes from dark blue (cheap) through cyan, yellow to dark red (expensive)
+__device__ inline float3 heatmap_colour(float t) {
+	t = __saturatef(t);
+
+	return make_float3(
+		__saturatef(fminf(4.0f * t - 1.5f, -4.0f * t + 4.5f)),
+		__saturatef(fminf(4.0f * t - 0.5f, -4.0f * t + 3.5f)),
+		__saturatef(fminf(4.0f * t + 0.5f, -4.0f * t + 2.5f))
+	);
+}
+
+// The radiance framebuffer holds the sum of samples_per_launch samples, the auxilary AOVs only hold those of the last one
+// When reprojecting, frames_accumulated counts the samples since the Camera last moved and reprojected is set on the frame it moved
+extern "C" __global__ void kernel_accumulate(float frames_accumulated, float samples_per_launch, int reprojected) {
 	int x = blockIdx.x * blockDim.x + threadIdx.x;
 	int y = blockIdx.y * blockDim.y + threadIdx.y;
 
 	if (x >= screen_width || y >= screen_height) return;
 
-	int pixel_index = x + y * screen_pitch;
+	// The Grid has a layer per view, views after the first are only accumulated in the AOVs (see Integrator::read_view)
+	int view = blockIdx.z;
+
+	int pixel_index = x + (y + view * screen_height) * screen_pitch;
+
+	float4 moment;
+	if (pixel_list_enabled()) {
+		int frame = int(frames_accumulated);
+
+		moment = frame > 0 ? adaptive_moments[pixel_index] : make_float4(0.0f, 0.0f, 0.0f, 1.0f);
+
+		// A converged Pixel, or one whose Tile was skipped this frame, did not receive a new sample, keep its accumulated colour
+		if (moment.w == 0.0f || !variable_rate_sampled(x, y, frame)) {
+			if (moment.w != 0.0f && variable_rate_sampled(x, y, frame + 1)) {
+				adaptive_pixels[warp_aggregated_increment(adaptive_pixel_count)] = x + y * screen_width;
+			}
+			accumulator.set(x, y, get_aov(AOVType::RADIANCE).accumulator[pixel_index]);
+			return;
+		}
+
+		// Pixels that stopped early have fewer samples than the frame count
+		frames_accumulated = moment.z;
+
+		float4 sample = get_aov(AOVType::RADIANCE).framebuffer[pixel_index];
+		float  sample_luminance = luminance(sample.x, sample.y, sample.z);
+
+		// Online estimate of the mean and second moment of the luminance
+		float n = moment.z + 1.0f;
+		moment.x += (sample_luminance                    - moment.x) / n;
+		moment.y += (sample_luminance * sample_luminance - moment.y) / n;
+		moment.z  = n;
+
+		int num_samples = int(n);
+		if (adaptive_sampling_enabled() && num_samples >= config.adaptive_sampling_min_samples && num_samples % config.adaptive_sampling_min_samples == 0 && adaptive_pixel_converged(moment)) {
+			moment.w = 0.0f;
+		}
+		adaptive_moments[pixel_index] = moment;
+
+		// Pixels that have not converged are rendered again on the next frame, unless their Tile skips it
+		if (moment.w != 0.0f && variable_rate_sampled(x, y, frame + 1)) {
+			adaptive_pixels[warp_aggregated_increment(adaptive_pixel_count)] = x + y * screen_width;
+		}
+	}
+
+	if (convergence_moments && view == 0) {
+		convergence_record(pixel_index, frames_accumulated, get_aov(AOVType::RADIANCE).framebuffer[pixel_index], samples_per_launch);
+	}
+
+	float4 colour;
+	if (reprojection_sample_counts) {
+		float samples_accumulated = reprojection_begin(pixel_index, frames_accumulated, reprojected);
 
-	float4 colour = aov_accumulate(AOVType::RADIANCE, pixel_index, frames_accumulated);
+		colour = aov_accumulate(AOVType::RADIANCE, pixel_index, samples_accumulated, samples_per_launch);
+
+		reprojection_end(x, y, pixel_index, samples_accumulated + samples_per_launch);
+	} else {
+		colour = aov_accumulate(AOVType::RADIANCE, pixel_index, frames_accumulated, samples_per_launch);
+	}
 
 	// Accumulate auxilary AOVs (if present)
-	aov_accumulate(AOVType::ALBEDO,   pixel_index, frames_accumulated);
-	aov_accumulate(AOVType::NORMAL,   pixel_index, frames_accumulated);
-	aov_accumulate(AOVType::POSITION, pixel_index, frames_accumulated);
+	float launches_accumulated = floorf(frames_accumulated / samples_per_launch);
+	aov_accumulate(AOVType::ALBEDO,   pixel_index, launches_accumulated);
+	aov_accumulate(AOVType::NORMAL,   pixel_index, launches_accumulated);
+	aov_accumulate(AOVType::POSITION, pixel_index, launches_accumulated);
+	aov_accumulate(AOVType::RADIANCE_CACHE, pixel_index, launches_accumulated);
+
+	if (CONFIG_TRAVERSAL_HEATMAP) {
+		float4 traversal_cost = aov_accumulate(AOVType::TRAVERSAL_COST, pixel_index, frames_accumulated, samples_per_launch);
+
+		if (config.traversal_heatmap != TraversalHeatmap::NONE && aov_is_active(AOVType::TRAVERSAL_COST)) {
+			float cost;
+			switch (config.traversal_heatmap) {
+				case TraversalHeatmap::NODES:     cost = traversal_cost.x;                    break;
+				case TraversalHeatmap::TRIANGLES: cost = traversal_cost.y;                    break;
+				default:                          cost = traversal_cost.z + traversal_cost.w; break;
+			}
+			colour = make_float4(heatmap_colour(cost / config.traversal_heatmap_range), 1.0f);
+		}
+	}
+
+	if (view > 0) return;
 
 	if (!isfinite(colour.x + colour.y + colour.z)) {
 //		printf("WARNING: pixel (%i, %i) has colour (%f, %f, %f)!\n", x, y, colour.x, colour.y, colour.z);
@@ -794,3 +2234,46 @@ extern "C" __global__ void kernel_accumulate(float frames_accumulated) {
 
 	accumulator.set(x, y, colour);
 }
+
+// Runs after kernel_accumulate when baking, fills the texels around the UV islands with the average of the closest covered texels
+// (at most bake_dilation texels away and within the same tile), so that filtering the baked texture does not bleed in black
+// Only the displayed accumulator is dilated, the AOVs keep the texels that were actually rendered
+extern "C" __global__ void kernel_bake_dilate() {
+	int x = blockIdx.x * blockDim.x + threadIdx.x;
+	int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+	if (x >= screen_width || y >= screen_height) return;
+
+	if (bake_texel_is_covered(x + y * screen_pitch)) return;
+
+	int tile_x = x - x % bake_tile_size;
+	int tile_y = y - y % bake_tile_size;
+
+	float4 sum   = make_float4(0.0f);
+	float  count = 0.0f;
+
+	// Square rings around the texel, from the inside out, until one of them contains a covered texel
+	for (int radius = 1; radius <= bake_dilation && count == 0.0f; radius++) {
+		for (int j = -radius; j <= radius; j++) {
+			for (int i = -radius; i <= radius; i++) {
+				if (max(abs(i), abs(j)) != radius) continue;
+
+				int neighbour_x = x + i;
+				int neighbour_y = y + j;
+
+				if (neighbour_x < tile_x || neighbour_x >= tile_x + bake_tile_size || neighbour_x >= screen_width)  continue;
+				if (neighbour_y < tile_y || neighbour_y >= tile_y + bake_tile_size || neighbour_y >= screen_height) continue;
+
+				int neighbour_index = neighbour_x + neighbour_y * screen_pitch;
+				if (bake_texel_is_covered(neighbour_index)) {
+					sum   += get_aov(AOVType::RADIANCE).accumulator[neighbour_index];
+					count += 1.0f;
+				}
+			}
+		}
+	}
+
+	if (count > 0.0f) {
+		accumulator.set(x, y, sum / count);
+	}
+}
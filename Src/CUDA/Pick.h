@@ -0,0 +1,36 @@
+#pragma once
+#include "Camera.h"
+
+#include "Raytracing/BVH2.h"
+#include "Raytracing/BVH4.h"
+#include "Raytracing/BVH8.h"
+
+// Mesh picking for the editor, a single Ray is traced through the centre of the queried pixel
+// The Kernels only depend on the Camera and the TLAS and are launched on their own, so that the result
+// does not have to wait for the next frame to be rendered (see Integrator::set_pixel_query)
+__device__ __constant__ TraversalData pick_traversal_data; // Buffers of a single Ray
+
+__device__ int pick_rays_retired;
+
+extern "C" __global__ void kernel_pick_generate(int x, int y) {
+	// No jitter and no Depth of Field, the picked Mesh should be the one that is visible in the middle of the pixel
+	float3 direction = normalize(camera.bottom_left_corner + (float(x) + 0.5f) * camera.x_axis + (float(y) + 0.5f) * camera.y_axis);
+
+	pick_traversal_data.ray_origin   .set(0, camera.position);
+	pick_traversal_data.ray_direction.set(0, direction);
+
+	pick_rays_retired = 0;
+}
+
+// Launched with a single warp, only one of its threads obtains the Ray
+extern "C" __global__ void kernel_pick_bvh2() {
+	bvh2_trace(&pick_traversal_data, 1, &pick_rays_retired);
+}
+
+extern "C" __global__ void kernel_pick_bvh4() {
+	bvh4_trace(&pick_traversal_data, 1, &pick_rays_retired);
+}
+
+extern "C" __global__ void kernel_pick_bvh8() {
+	bvh8_trace(&pick_traversal_data, 1, &pick_rays_retired);
+}
@@ -0,0 +1,159 @@
+#pragma once
+#include "Util.h"
+#include "Config.h"
+
+// World space radiance cache in a hashed spatial grid, keyed on the cell of the position and the dominant axis of the normal
+// Every cell stores the average outgoing radiance of the path vertices that fell into it, divided by the throughput of the vertex
+// (which includes its albedo), so that a path whose throughput already contains the albedo of a vertex can terminate there with throughput * estimate
+// Paths record their first RADIANCE_CACHE_MAX_VERTICES Diffuse/Plastic vertices in radiance_cache_vertices, the illumination they find afterwards is added to them,
+// kernel_radiance_cache_train splats the recorded estimates into the grid and kernel_radiance_cache_update resolves the averages for the next frame
+__device__ __constant__ unsigned * radiance_cache_keys;     // Hash of the cell coordinates and normal axis, 0 if empty
+__device__ __constant__ float4   * radiance_cache_sums;     // Per cell, sum of the recorded estimates in xyz and their count in w, keeps accumulating while the Scene is unchanged
+__device__ __constant__ float4   * radiance_cache_radiance; // Per cell, average estimate in xyz and the sample count in w, w is zero if the cell cannot be used yet
+
+__device__ __constant__ float radiance_cache_cell_size_inv;
+
+struct RadianceCacheVertex {
+	int    cell; // INVALID if no vertex was recorded
+	float3 throughput_inv;
+	float3 radiance; // Illumination found at and after this vertex, divided by the throughput of the vertex
+};
+
+// Per Pixel RADIANCE_CACHE_MAX_VERTICES vertices, indexed by pixel_index * RADIANCE_CACHE_MAX_VERTICES + bounce
+__device__ __constant__ RadianceCacheVertex * radiance_cache_vertices;
+
+__device__ inline bool radiance_cache_enabled() {
+	return config.enable_radiance_cache;
+}
+
+__device__ inline unsigned radiance_cache_hash(float3 position, float3 normal) {
+	int x = int(floorf(position.x * radiance_cache_cell_size_inv));
+	int y = int(floorf(position.y * radiance_cache_cell_size_inv));
+	int z = int(floorf(position.z * radiance_cache_cell_size_inv));
+
+	// Opposite sides of a thin wall and the faces of a corner see different radiance, so they get separate cells
+	float3 normal_abs = fabs(normal);
+	int axis;
+	if (normal_abs.x >= normal_abs.y && normal_abs.x >= normal_abs.z) {
+		axis = normal.x > 0.0f ? 0 : 1;
+	} else if (normal_abs.y >= normal_abs.z) {
+		axis = normal.y > 0.0f ? 2 : 3;
+	} else {
+		axis = normal.z > 0.0f ? 4 : 5;
+	}
+
+	unsigned hash = pcg_hash(hash_combine(hash_combine(hash_combine(pcg_hash(x), y), z), axis));
+	return hash != 0 ? hash : 1; // 0 marks an empty slot
+}
+
+// Linear probing in the hash table, returns INVALID if the cell does not exist (or the table is full there)
+__device__ inline int radiance_cache_find_cell(float3 position, float3 normal, bool insert) {
+	constexpr int MAX_PROBES = 8;
+
+	unsigned key  = radiance_cache_hash(position, normal);
+	unsigned slot = key & (RADIANCE_CACHE_HASH_SIZE - 1);
+
+	for (int i = 0; i < MAX_PROBES; i++) {
+		unsigned key_slot = radiance_cache_keys[slot];
+
+		if (key_slot == key) return slot;
+
+		if (key_slot == 0) {
+			if (!insert) return INVALID;
+
+			key_slot = atomicCAS(&radiance_cache_keys[slot], 0u, key);
+			if (key_slot == 0 || key_slot == key) return slot;
+		}
+
+		slot = (slot + 1) & (RADIANCE_CACHE_HASH_SIZE - 1);
+	}
+
+	return INVALID;
+}
+
+// Returns false if the cell of the given position has no usable estimate yet
+__device__ inline bool radiance_cache_lookup(float3 position, float3 normal, float3 & radiance) {
+	int cell = radiance_cache_find_cell(position, normal, false);
+	if (cell == INVALID) return false;
+
+	float4 estimate = radiance_cache_radiance[cell];
+	if (estimate.w <= 0.0f) return false;
+
+	radiance = make_float3(estimate.x, estimate.y, estimate.z);
+	return true;
+}
+
+__device__ inline void radiance_cache_record_vertex(int pixel_index, int bounce, float3 position, float3 normal, float3 throughput) {
+	if (bounce >= RADIANCE_CACHE_MAX_VERTICES) return;
+
+	RadianceCacheVertex & vertex = radiance_cache_vertices[pixel_index * RADIANCE_CACHE_MAX_VERTICES + bounce];
+	vertex.cell = radiance_cache_find_cell(position, normal, true);
+
+	// Channels without throughput carry no illumination, their estimate stays zero
+	vertex.throughput_inv = make_float3(
+		throughput.x > 0.0f ? 1.0f / throughput.x : 0.0f,
+		throughput.y > 0.0f ? 1.0f / throughput.y : 0.0f,
+		throughput.z > 0.0f ? 1.0f / throughput.z : 0.0f
+	);
+	vertex.radiance = make_float3(0.0f);
+}
+
+// Called on the primary hit, so that a path only adds to the vertices it recorded itself and not to those of an earlier sample of the same Pixel
+__device__ inline void radiance_cache_clear_vertices(int pixel_index) {
+	for (int i = 0; i < RADIANCE_CACHE_MAX_VERTICES; i++) {
+		radiance_cache_vertices[pixel_index * RADIANCE_CACHE_MAX_VERTICES + i].cell = INVALID;
+	}
+}
+
+// Adds illumination to the vertices before bounce vertex_count, this is the bounce of a light or Sky hit,
+// or the bounce plus one for Next Event Estimation since that belongs to the vertex itself
+// The bounces of a Pixel are processed in order, so no atomics are needed
+__device__ inline void radiance_cache_add_illumination(int pixel_index, int vertex_count, float3 illumination) {
+	RadianceCacheVertex * vertices = radiance_cache_vertices + pixel_index * RADIANCE_CACHE_MAX_VERTICES;
+
+	for (int i = 0; i < min(vertex_count, RADIANCE_CACHE_MAX_VERTICES); i++) {
+		if (vertices[i].cell != INVALID) {
+			vertices[i].radiance += illumination * vertices[i].throughput_inv;
+		}
+	}
+}
+
+extern "C" __global__ void kernel_radiance_cache_train() {
+	int x = blockIdx.x * blockDim.x + threadIdx.x;
+	int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+	if (x >= screen_width || y >= screen_height) return;
+
+	int pixel_index = x + y * screen_pitch;
+
+	RadianceCacheVertex * vertices = radiance_cache_vertices + pixel_index * RADIANCE_CACHE_MAX_VERTICES;
+
+	for (int i = 0; i < RADIANCE_CACHE_MAX_VERTICES; i++) {
+		RadianceCacheVertex vertex = vertices[i];
+		if (vertex.cell == INVALID) continue;
+
+		if (isfinite(vertex.radiance.x + vertex.radiance.y + vertex.radiance.z)) {
+			float4 & sum = radiance_cache_sums[vertex.cell];
+			atomicAdd(&sum.x, vertex.radiance.x);
+			atomicAdd(&sum.y, vertex.radiance.y);
+			atomicAdd(&sum.z, vertex.radiance.z);
+			atomicAdd(&sum.w, 1.0f);
+		}
+
+		// Paths that terminate earlier on the next frame should not splat this vertex again
+		vertices[i].cell = INVALID;
+	}
+}
+
+extern "C" __global__ void kernel_radiance_cache_update() {
+	int cell = blockIdx.x * blockDim.x + threadIdx.x;
+	if (cell >= RADIANCE_CACHE_HASH_SIZE) return;
+
+	float4 sum = radiance_cache_sums[cell];
+
+	if (sum.w < float(config.radiance_cache_min_samples)) {
+		radiance_cache_radiance[cell] = make_float4(0.0f);
+	} else {
+		radiance_cache_radiance[cell] = make_float4(sum.x / sum.w, sum.y / sum.w, sum.z / sum.w, sum.w);
+	}
+}
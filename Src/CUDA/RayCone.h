@@ -16,18 +16,41 @@ __device__ inline bool use_anisotropic_texture_sampling(int bounce) {
 	return bounce == 0; // Only first bounce uses anisotropic sampling, subsequent bounces use isotropic
 }
 
-__device__ inline float3 sample_albedo(int bounce, float3 diffuse, int texture_id, float2 tex_coord, const TextureLOD & lod) {
-	if (config.enable_mipmapping && texture_id != INVALID) {
+// Samples any Texture of a Material, all Textures of the hit share the same footprint (TextureLOD)
+__device__ inline float4 sample_texture(int bounce, int texture_id, float2 tex_coord, const TextureLOD & lod) {
+	Texture<float4> texture = texture_get(texture_id);
+
+	if (CONFIG_ENABLE_MIPMAPPING) {
 		if (use_anisotropic_texture_sampling(bounce)) {
-			return material_get_albedo(diffuse, texture_id, tex_coord.x, tex_coord.y, lod.aniso.gradient_1, lod.aniso.gradient_2);
+			// Based on the minor axis of the footprint, which is the finest level anisotropic filtering can use
+			float gradient_length_squared = fminf(dot(lod.aniso.gradient_1, lod.aniso.gradient_1), dot(lod.aniso.gradient_2, lod.aniso.gradient_2));
+			texture_feedback_record(texture_id, texture, 0.5f * log2f(gradient_length_squared) + texture.lod_bias);
+
+			return texture.get_grad(tex_coord.x, tex_coord.y, lod.aniso.gradient_1, lod.aniso.gradient_2);
 		} else {
-			return material_get_albedo(diffuse, texture_id, tex_coord.x, tex_coord.y, lod.iso.lod + textures[texture_id].lod_bias);
+			float lod_texture = lod.iso.lod + texture.lod_bias;
+			texture_feedback_record(texture_id, texture, lod_texture);
+
+			return texture.get_lod(tex_coord.x, tex_coord.y, lod_texture);
 		}
 	} else {
-		return material_get_albedo(diffuse, texture_id, tex_coord.x, tex_coord.y);
+		return texture.get(tex_coord.x, tex_coord.y);
 	}
 }
 
+__device__ inline float3 sample_albedo(int bounce, float3 diffuse, int texture_id, float2 tex_coord, const TextureLOD & lod) {
+	if (texture_id == INVALID) return diffuse;
+
+	return diffuse * make_float3(sample_texture(bounce, texture_id, tex_coord, lod));
+}
+
+// Roughness is read from the second channel, which covers greyscale images as well as glTF style metallic-roughness Textures
+__device__ inline float sample_roughness(int bounce, float linear_roughness, int texture_id, float2 tex_coord, const TextureLOD & lod) {
+	if (texture_id == INVALID) return linear_roughness;
+
+	return linear_roughness * linear_to_srgb(sample_texture(bounce, texture_id, tex_coord, lod).y);
+}
+
 // Project the Ray Cone onto the Triangle and obtain two axes that describe the resulting ellipse (in world space)
 __device__ inline void ray_cone_get_ellipse_axes(
 	float3 ray_direction,
@@ -1,6 +1,7 @@
 #pragma once
 #include "Mesh.h"
 #include "Triangle.h"
+#include "Curve.h"
 
 #include <Buffers.h>
 
@@ -11,6 +12,8 @@ struct TraversalData {
 	Vector3_SoA ray_direction;
 
 	HitBuffer hits;
+
+	float * ray_time; // Time within the shutter interval, only read with motion blur enabled. May be nullptr
 };
 
 struct ShadowTraversalData {
@@ -18,13 +21,54 @@ struct ShadowTraversalData {
 	Vector3_SoA ray_direction;
 
 	float * max_distance;
+
+	float * ray_time;
+};
+
+// Traversal counters, only collected by traversal functions instantiated with COLLECT_STATS (see TraversalBenchmark.cu and CONFIG_TRAVERSAL_HEATMAP)
+struct TraversalStats {
+	unsigned long long node_tests;      // Number of BVH Nodes intersected, a BVH4 or BVH8 Node tests all of its children at once
+	unsigned long long triangle_tests;
+	unsigned long long stack_spills;    // Pushes that ended up in the thread local part of the Stack
+	unsigned           stack_overflows; // Pushes beyond BVH_STACK_SIZE, the item is dropped. With the BVH8 short Stack the dropped items are recovered by a restart
+};
+
+__device__ TraversalStats traversal_stats;
+
+__device__ inline void traversal_stats_add(unsigned node_tests, unsigned triangle_tests) {
+	atomicAdd(&traversal_stats.node_tests,     (unsigned long long)node_tests);
+	atomicAdd(&traversal_stats.triangle_tests, (unsigned long long)triangle_tests);
+}
+
+// Default for the on_ray_stats callback of the traversal functions, which is called with the
+// counters of every Ray once it is done (only if instantiated with COLLECT_STATS, see Pathtracer.cu)
+struct TraversalStatsIgnoreRay {
+	__device__ void operator()(int ray_index, unsigned node_tests, unsigned triangle_tests) const { }
+};
+
+// Default for the occluder_cache of the shadow traversal functions, see ShadowOccluderCachePixel in Pathtracer.cu
+// test is called before traversing a Ray and can skip traversal if it already knows the Ray is occluded,
+// store is called with the primitive that occluded a Ray
+struct ShadowOccluderCacheNone {
+	__device__ bool test (const ShadowTraversalData * traversal_data, int ray_index, const Ray & ray, float max_distance) const { return false; }
+	__device__ void store(int ray_index, int mesh_id, int primitive_id) const { }
 };
 
 // Function that decides whether to push on the shared stack or thread local stack
-template<typename T>
+template<bool COLLECT_STATS = false, typename T>
 __device__ inline void stack_push(T shared_stack[], T stack[], int & stack_size, T item) {
 	// assert(stack_size < BVH_STACK_SIZE);
 
+	if (COLLECT_STATS) {
+		if (stack_size >= BVH_STACK_SIZE) {
+			atomicAdd(&traversal_stats.stack_overflows, 1);
+			return;
+		}
+		if (stack_size >= SHARED_STACK_SIZE) {
+			atomicAdd(&traversal_stats.stack_spills, 1ull);
+		}
+	}
+
 	if (stack_size < SHARED_STACK_SIZE) {
 		shared_stack[SHARED_STACK_INDEX(stack_size)] = item;
 	} else {
@@ -46,10 +90,89 @@ __device__ inline T stack_pop(const T shared_stack[], const T stack[], int & sta
 	}
 }
 
-__device__ inline int bvh_get_mesh_root_index(int mesh_id, bool & mesh_has_identity_transform) {
+// Index of the TLAS root in the aggregated BVH Node buffer, the TLAS is double buffered so this alternates between two regions
+__device__ __constant__ int tlas_root_index;
+
+__device__ inline int bvh_get_mesh_root_index(int mesh_id, bool & mesh_has_identity_transform, bool & blas_has_curves) {
 	unsigned root_index = __ldg(&mesh_bvh_root_indices[mesh_id]);
 
 	mesh_has_identity_transform = root_index >> 31; // MSB stores whether the Mesh has an identity transform
+	blas_has_curves             = (root_index >> 29) & 1;
+
+	return root_index & 0x07ffffff; // Bit 30 stores whether the Mesh has motion, see mesh_has_motion, bit 29 whether its BLAS has Curves, bits 27 and 28 see mesh_is_visible
+}
+
+// Picks the BLAS of the level of detail of a Mesh for a Ray, given in the object space of the Mesh, with the given Ray Cone
+// The footprint of the cone at the center of the Mesh is compared to the Triangle sizes of the levels. In between two levels the coarser
+// one is picked with a probability that grows with the footprint, so that the transition is dithered instead of showing up as a seam
+__device__ inline int bvh_select_lod(int mesh_id, int root_index, const Ray & ray, float cone_angle, float cone_width, float inv_scale, float bias, unsigned seed) {
+	int chain_id = __ldg(&mesh_lod_chain_ids[mesh_id]);
+	if (chain_id == INVALID) return root_index;
+
+	const MeshLODChain & chain = lod_chains[chain_id];
+
+	float3 center    = make_float3(chain.center[0], chain.center[1], chain.center[2]);
+	float  footprint = bias * (cone_width * inv_scale + cone_angle * length(center - ray.origin));
+
+	int level = 0;
+	while (level + 1 < chain.level_count && chain.triangle_sizes[level + 1] <= footprint) {
+		level++;
+	}
+
+	if (level + 1 < chain.level_count && footprint > chain.triangle_sizes[level]) {
+		float t = (footprint - chain.triangle_sizes[level]) / (chain.triangle_sizes[level + 1] - chain.triangle_sizes[level]);
+		float u = float(pcg_hash(hash_combine(seed, unsigned(mesh_id))) >> 8) * (1.0f / float(1 << 24));
+		if (u < t) level++;
+	}
+
+	return chain.bvh_offsets[level];
+}
+
+// Traversal without levels of detail, every Mesh is traced at full resolution
+struct TraversalLODNone {
+	__device__ int operator()(int ray_index, int mesh_id, int root_index, const Ray & ray, float inv_scale) const {
+		return root_index;
+	}
+};
+
+// The leaves of a BLAS refer to either Triangles or Curves, see mesh_has_curves
+__device__ inline void bvh_intersect_primitive(bool blas_has_curves, int mesh_id, int primitive_id, const Ray & ray, RayHit & ray_hit) {
+	if (blas_has_curves) {
+		curve_intersect(mesh_id, primitive_id, ray, ray_hit);
+	} else {
+		triangle_intersect(mesh_id, primitive_id, ray, ray_hit);
+	}
+}
+
+__device__ inline bool bvh_intersect_primitive_shadow(bool blas_has_curves, int mesh_id, int primitive_id, const Ray & ray, float max_distance) {
+	if (blas_has_curves) {
+		return curve_intersect_shadow(primitive_id, ray, max_distance);
+	} else {
+		return triangle_intersect_shadow(mesh_id, primitive_id, ray, max_distance);
+	}
+}
+
+// Transforms the Ray into the local space of the Mesh, for moving Meshes the Transform is interpolated to the time of the Ray
+__device__ inline Matrix3x4 bvh_get_mesh_transform_inv(int mesh_id, const float * ray_time, int ray_index) {
+	if (CONFIG_ENABLE_MOTION_BLUR && ray_time && mesh_has_motion(mesh_id)) {
+		return matrix3x4_inverse(mesh_get_transform(mesh_id, ray_time[ray_index]));
+	}
+	return mesh_get_transform_inv(mesh_id);
+}
+
+// Tests a single primitive of a Mesh without traversing the BVH, the Ray is given in world space
+__device__ inline bool bvh_intersect_mesh_primitive_shadow(int mesh_id, int primitive_id, Ray ray, float max_distance, const float * ray_time, int ray_index) {
+	if (!mesh_is_visible(mesh_id, MeshVisibility::SHADOW)) return false;
+
+	bool mesh_has_identity_transform;
+	bool blas_has_curves;
+	bvh_get_mesh_root_index(mesh_id, mesh_has_identity_transform, blas_has_curves);
+
+	if (!mesh_has_identity_transform) {
+		Matrix3x4 transform_inv = bvh_get_mesh_transform_inv(mesh_id, ray_time, ray_index);
+		matrix3x4_transform_position (transform_inv, ray.origin);
+		matrix3x4_transform_direction(transform_inv, ray.direction);
+	}
 
-	return root_index & 0x7fffffff;
+	return bvh_intersect_primitive_shadow(blas_has_curves, mesh_id, primitive_id, ray, max_distance);
 }
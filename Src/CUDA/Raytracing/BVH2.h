@@ -43,12 +43,19 @@ struct BVH2Node {
 
 __device__ __constant__ BVH2Node * bvh2_nodes;
 
-__device__ void bvh2_trace(TraversalData * traversal_data, int ray_count, int * rays_retired) {
+template<bool COLLECT_STATS = false, typename OnRayStats = TraversalStatsIgnoreRay>
+__device__ void bvh2_trace(TraversalData * traversal_data, int ray_count, int * rays_retired, const int * ray_order = nullptr, OnRayStats on_ray_stats = { }) {
 	extern __shared__ int shared_stack_bvh2[];
 
 	int stack[BVH_STACK_SIZE - SHARED_STACK_SIZE];
 	int stack_size = 0;
 
+	unsigned stats_node_tests     = 0;
+	unsigned stats_triangle_tests = 0;
+
+	unsigned stats_node_tests_ray;     // Counters at the start of the current Ray
+	unsigned stats_triangle_tests_ray;
+
 	int    ray_index;
 	Ray    ray;
 	RayHit ray_hit;
@@ -56,13 +63,25 @@ __device__ void bvh2_trace(TraversalData * traversal_data, int ray_count, int *
 	int  tlas_stack_size;
 	int  mesh_id;
 	bool mesh_has_identity_transform;
+	bool blas_has_curves = false;
 
 	while (true) {
 		bool inactive = stack_size == 0;
 
 		if (inactive) {
 			ray_index = atomicAdd(rays_retired, 1);
-			if (ray_index >= ray_count) return;
+			if (ray_index >= ray_count) {
+				if (COLLECT_STATS) traversal_stats_add(stats_node_tests, stats_triangle_tests);
+				return;
+			}
+
+			if (COLLECT_STATS) {
+				stats_node_tests_ray     = stats_node_tests;
+				stats_triangle_tests_ray = stats_triangle_tests;
+			}
+
+			// Rays can be visited in a sorted order to improve coherence
+			if (ray_order) ray_index = ray_order[ray_index];
 
 			ray.origin    = traversal_data->ray_origin   .get(ray_index);
 			ray.direction = traversal_data->ray_direction.get(ray_index);
@@ -74,7 +93,7 @@ __device__ void bvh2_trace(TraversalData * traversal_data, int ray_count, int *
 
 			// Push root on stack
 			stack_size                              = 1;
-			shared_stack_bvh2[SHARED_STACK_INDEX(0)] = 0;
+			shared_stack_bvh2[SHARED_STACK_INDEX(0)] = tlas_root_index;
 		}
 
 		while (true) {
@@ -92,26 +111,31 @@ __device__ void bvh2_trace(TraversalData * traversal_data, int ray_count, int *
 			int node_index = stack_pop(shared_stack_bvh2, stack, stack_size);
 
 			const BVH2Node & node = bvh2_nodes[node_index];
+			if (COLLECT_STATS) stats_node_tests++;
 
 			if (node.aabb.intersects(ray, ray_hit.t)) {
 				if (node.is_leaf()) {
 					if (tlas_stack_size == INVALID) {
-						tlas_stack_size = stack_size;
-
 						mesh_id = node.first;
 
-						int root_index = bvh_get_mesh_root_index(mesh_id, mesh_has_identity_transform);
+						// Meshes hidden from this kind of Ray are skipped without descending into their BLAS
+						if (mesh_is_visible(mesh_id, MeshVisibility::TRACE)) {
+							tlas_stack_size = stack_size;
 
-						if (!mesh_has_identity_transform) {
-							Matrix3x4 transform_inv = mesh_get_transform_inv(mesh_id);
-							matrix3x4_transform_position (transform_inv, ray.origin);
-							matrix3x4_transform_direction(transform_inv, ray.direction);
-						}
+							int root_index = bvh_get_mesh_root_index(mesh_id, mesh_has_identity_transform, blas_has_curves);
+
+							if (!mesh_has_identity_transform) {
+								Matrix3x4 transform_inv = bvh_get_mesh_transform_inv(mesh_id, traversal_data->ray_time, ray_index);
+								matrix3x4_transform_position (transform_inv, ray.origin);
+								matrix3x4_transform_direction(transform_inv, ray.direction);
+							}
 
-						stack_push(shared_stack_bvh2, stack, stack_size, root_index);
+							stack_push<COLLECT_STATS>(shared_stack_bvh2, stack, stack_size, root_index);
+						}
 					} else {
 						for (int i = node.first; i < node.first + node.count; i++) {
-							triangle_intersect(mesh_id, i, ray, ray_hit);
+							if (COLLECT_STATS) stats_triangle_tests++;
+							bvh_intersect_primitive(blas_has_curves, mesh_id, i, ray, ray_hit);
 						}
 					}
 				} else {
@@ -125,26 +149,33 @@ __device__ void bvh2_trace(TraversalData * traversal_data, int ray_count, int *
 						first  = node.left + 1;
 					}
 
-					stack_push(shared_stack_bvh2, stack, stack_size, second);
-					stack_push(shared_stack_bvh2, stack, stack_size, first);
+					stack_push<COLLECT_STATS>(shared_stack_bvh2, stack, stack_size, second);
+					stack_push<COLLECT_STATS>(shared_stack_bvh2, stack, stack_size, first);
 				}
 			}
 
 			if (stack_size == 0) {
 				traversal_data->hits.set(ray_index, ray_hit);
+				if (COLLECT_STATS) on_ray_stats(ray_index, stats_node_tests - stats_node_tests_ray, stats_triangle_tests - stats_triangle_tests_ray);
 				break;
 			}
 		}
 	}
 }
 
-template<typename OnMissCallback>
-__device__ void bvh2_trace_shadow(ShadowTraversalData * traveral_data, int ray_count, int * rays_retired, OnMissCallback callback) {
+template<bool COLLECT_STATS = false, typename OnMissCallback, typename OnRayStats = TraversalStatsIgnoreRay, typename OccluderCache = ShadowOccluderCacheNone>
+__device__ void bvh2_trace_shadow(ShadowTraversalData * traveral_data, int ray_count, int * rays_retired, OnMissCallback callback, OnRayStats on_ray_stats = { }, OccluderCache occluder_cache = { }) {
 	extern __shared__ int shared_stack_bvh2[];
 
 	int stack[BVH_STACK_SIZE - SHARED_STACK_SIZE];
 	int stack_size = 0;
 
+	unsigned stats_node_tests     = 0;
+	unsigned stats_triangle_tests = 0;
+
+	unsigned stats_node_tests_ray;     // Counters at the start of the current Ray
+	unsigned stats_triangle_tests_ray;
+
 	int ray_index;
 	Ray ray;
 
@@ -153,24 +184,38 @@ __device__ void bvh2_trace_shadow(ShadowTraversalData * traveral_data, int ray_c
 	int  tlas_stack_size;
 	int  mesh_id;
 	bool mesh_has_identity_transform;
+	bool blas_has_curves = false;
 
 	while (true) {
 		bool inactive = stack_size == 0;
 
 		if (inactive) {
 			ray_index = atomicAdd(rays_retired, 1);
-			if (ray_index >= ray_count) return;
+			if (ray_index >= ray_count) {
+				if (COLLECT_STATS) traversal_stats_add(stats_node_tests, stats_triangle_tests);
+				return;
+			}
+
+			if (COLLECT_STATS) {
+				stats_node_tests_ray     = stats_node_tests;
+				stats_triangle_tests_ray = stats_triangle_tests;
+			}
 
 			ray.origin    = traveral_data->ray_origin   .get(ray_index);
 			ray.direction = traveral_data->ray_direction.get(ray_index);
 
 			max_distance = traveral_data->max_distance[ray_index];
 
+			if (occluder_cache.test(traveral_data, ray_index, ray, max_distance)) {
+				if (COLLECT_STATS) on_ray_stats(ray_index, 0, 1);
+				continue;
+			}
+
 			tlas_stack_size = INVALID;
 
 			// Push root on stack
 			stack_size                              = 1;
-			shared_stack_bvh2[SHARED_STACK_INDEX(0)] = 0;
+			shared_stack_bvh2[SHARED_STACK_INDEX(0)] = tlas_root_index;
 		}
 
 		while (true) {
@@ -188,32 +233,39 @@ __device__ void bvh2_trace_shadow(ShadowTraversalData * traveral_data, int ray_c
 			int node_index = stack_pop(shared_stack_bvh2, stack, stack_size);
 
 			const BVH2Node & node = bvh2_nodes[node_index];
+			if (COLLECT_STATS) stats_node_tests++;
 
 			if (node.aabb.intersects(ray, max_distance)) {
 				if (node.is_leaf()) {
 					if (tlas_stack_size == INVALID) {
-						tlas_stack_size = stack_size;
-
 						mesh_id = node.first;
 
-						int root_index = bvh_get_mesh_root_index(mesh_id, mesh_has_identity_transform);
+						// Meshes hidden from this kind of Ray are skipped without descending into their BLAS
+						if (mesh_is_visible(mesh_id, MeshVisibility::SHADOW)) {
+							tlas_stack_size = stack_size;
 
-						if (!mesh_has_identity_transform) {
-							Matrix3x4 transform_inv = mesh_get_transform_inv(mesh_id);
-							matrix3x4_transform_position (transform_inv, ray.origin);
-							matrix3x4_transform_direction(transform_inv, ray.direction);
-						}
+							int root_index = bvh_get_mesh_root_index(mesh_id, mesh_has_identity_transform, blas_has_curves);
 
-						stack_push(shared_stack_bvh2, stack, stack_size, root_index);
+							if (!mesh_has_identity_transform) {
+								Matrix3x4 transform_inv = bvh_get_mesh_transform_inv(mesh_id, traveral_data->ray_time, ray_index);
+								matrix3x4_transform_position (transform_inv, ray.origin);
+								matrix3x4_transform_direction(transform_inv, ray.direction);
+							}
+
+							stack_push<COLLECT_STATS>(shared_stack_bvh2, stack, stack_size, root_index);
+						}
 					} else {
 						bool hit = false;
 						for (int i = node.first; i < node.first + node.count; i++) {
-							if (triangle_intersect_shadow(i, ray, max_distance)) {
+							if (COLLECT_STATS) stats_triangle_tests++;
+							if (bvh_intersect_primitive_shadow(blas_has_curves, mesh_id, i, ray, max_distance)) {
+								occluder_cache.store(ray_index, mesh_id, i);
 								hit = true;
 								break;
 							}
 						}
 						if (hit) {
+							if (COLLECT_STATS) on_ray_stats(ray_index, stats_node_tests - stats_node_tests_ray, stats_triangle_tests - stats_triangle_tests_ray);
 							stack_size = 0;
 							break;
 						}
@@ -229,14 +281,15 @@ __device__ void bvh2_trace_shadow(ShadowTraversalData * traveral_data, int ray_c
 						first  = node.left + 1;
 					}
 
-					stack_push(shared_stack_bvh2, stack, stack_size, second);
-					stack_push(shared_stack_bvh2, stack, stack_size, first);
+					stack_push<COLLECT_STATS>(shared_stack_bvh2, stack, stack_size, second);
+					stack_push<COLLECT_STATS>(shared_stack_bvh2, stack, stack_size, first);
 				}
 			}
 
 			if (stack_size == 0) {
 				// We didn't hit anything, call callback
 				callback(ray_index);
+				if (COLLECT_STATS) on_ray_stats(ray_index, stats_node_tests - stats_node_tests_ray, stats_triangle_tests - stats_triangle_tests_ray);
 				break;
 			}
 		}
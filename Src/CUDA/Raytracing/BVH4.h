@@ -1,16 +1,19 @@
 #pragma once
 #include "BVH.h"
 
+typedef unsigned char byte;
+
+// Child AABBs are quantized relative to the origin p with power of two scale e, see BVHNode4 in BVH/BVH.h
 struct BVH4Node {
-	float4 aabb_min_x;
-	float4 aabb_min_y;
-	float4 aabb_min_z;
-	float4 aabb_max_x;
-	float4 aabb_max_y;
-	float4 aabb_max_z;
-	int2 index_and_count[4];
+	float4 p_e;           // Origin in xyz, the three 8 bit exponents and the child count in w
+	uint4  quantized_x_y; // min_x, max_x, min_y, max_y, one byte per child
+	uint2  quantized_z;   // min_z, max_z
+	int    index[4];
+	short  count[4];
 };
 
+static_assert(sizeof(BVH4Node) == 64, "BVH4Node must match BVHNode4");
+
 __device__ __constant__ BVH4Node * bvh4_nodes;
 
 struct AABBHits {
@@ -19,32 +22,65 @@ struct AABBHits {
 };
 
 // Check the Ray agains the four AABB's of the children of the given BVH4 Node
+// The children are ordered such that the last one is visited first, by hit distance or for any hit queries (ORDER_BY_SIZE)
+// by the surface area of their AABB, as large children are the most likely to contain an occluder
+template<bool ORDER_BY_SIZE = false>
 __device__ inline AABBHits bvh4_node_intersect(const BVH4Node & node, const Ray & ray, float max_distance) {
 	AABBHits result;
 
-	float4 tx0 = (__ldg(&node.aabb_min_x) - ray.origin.x) / ray.direction.x;
-	float4 tx1 = (__ldg(&node.aabb_max_x) - ray.origin.x) / ray.direction.x;
-	float4 ty0 = (__ldg(&node.aabb_min_y) - ray.origin.y) / ray.direction.y;
-	float4 ty1 = (__ldg(&node.aabb_max_y) - ray.origin.y) / ray.direction.y;
-	float4 tz0 = (__ldg(&node.aabb_min_z) - ray.origin.z) / ray.direction.z;
-	float4 tz1 = (__ldg(&node.aabb_max_z) - ray.origin.z) / ray.direction.z;
-
-	result.t_near[0] = vmin_max(tx0.x, tx1.x, vmin_max(ty0.x, ty1.x, vmin_max(tz0.x, tz1.x, 0.0f)));
-	result.t_near[1] = vmin_max(tx0.y, tx1.y, vmin_max(ty0.y, ty1.y, vmin_max(tz0.y, tz1.y, 0.0f)));
-	result.t_near[2] = vmin_max(tx0.z, tx1.z, vmin_max(ty0.z, ty1.z, vmin_max(tz0.z, tz1.z, 0.0f)));
-	result.t_near[3] = vmin_max(tx0.w, tx1.w, vmin_max(ty0.w, ty1.w, vmin_max(tz0.w, tz1.w, 0.0f)));
-	
-	float4 t_far = make_float4(
-		vmax_min(tx0.x, tx1.x, vmax_min(ty0.x, ty1.x, vmax_min(tz0.x, tz1.x, max_distance))),
-		vmax_min(tx0.y, tx1.y, vmax_min(ty0.y, ty1.y, vmax_min(tz0.y, tz1.y, max_distance))),
-		vmax_min(tx0.z, tx1.z, vmax_min(ty0.z, ty1.z, vmax_min(tz0.z, tz1.z, max_distance))),
-		vmax_min(tx0.w, tx1.w, vmax_min(ty0.w, ty1.w, vmax_min(tz0.w, tz1.w, max_distance)))
+	float4 p_e           = __ldg(&node.p_e);
+	uint4  quantized_x_y = __ldg(&node.quantized_x_y);
+	uint2  quantized_z   = __ldg(&node.quantized_z);
+
+	float3 p = make_float3(p_e);
+
+	unsigned e_child_count = __float_as_uint(p_e.w);
+	byte e_x         = extract_byte(e_child_count, 0);
+	byte e_y         = extract_byte(e_child_count, 1);
+	byte e_z         = extract_byte(e_child_count, 2);
+	int  child_count = extract_byte(e_child_count, 3);
+
+	float3 adjusted_ray_direction_inv = make_float3(
+		__uint_as_float(e_x << 23) / ray.direction.x,
+		__uint_as_float(e_y << 23) / ray.direction.y,
+		__uint_as_float(e_z << 23) / ray.direction.z
 	);
+	float3 adjusted_ray_origin = (p - ray.origin) / ray.direction;
 
-	result.hit[0] = result.t_near[0] < t_far.x;
-	result.hit[1] = result.t_near[1] < t_far.y;
-	result.hit[2] = result.t_near[2] < t_far.z;
-	result.hit[3] = result.t_near[3] < t_far.w;
+	// Select near and far planes based on ray octant
+	unsigned x_min = ray.direction.x < 0.0f ? quantized_x_y.y : quantized_x_y.x;
+	unsigned x_max = ray.direction.x < 0.0f ? quantized_x_y.x : quantized_x_y.y;
+
+	unsigned y_min = ray.direction.y < 0.0f ? quantized_x_y.w : quantized_x_y.z;
+	unsigned y_max = ray.direction.y < 0.0f ? quantized_x_y.z : quantized_x_y.w;
+
+	unsigned z_min = ray.direction.z < 0.0f ? quantized_z.y : quantized_z.x;
+	unsigned z_max = ray.direction.z < 0.0f ? quantized_z.x : quantized_z.y;
+
+	#pragma unroll
+	for (int i = 0; i < 4; i++) {
+		// Extract i-th byte
+		float3 tmin3 = make_float3(float(extract_byte(x_min, i)), float(extract_byte(y_min, i)), float(extract_byte(z_min, i)));
+		float3 tmax3 = make_float3(float(extract_byte(x_max, i)), float(extract_byte(y_max, i)), float(extract_byte(z_max, i)));
+
+		// Account for grid origin and scale
+		tmin3 = tmin3 * adjusted_ray_direction_inv + adjusted_ray_origin;
+		tmax3 = tmax3 * adjusted_ray_direction_inv + adjusted_ray_origin;
+
+		result.t_near[i] = vmax_max(tmin3.x, tmin3.y, fmaxf(tmin3.z, 0.0f));
+		float t_far      = vmin_min(tmax3.x, tmax3.y, fminf(tmax3.z, max_distance));
+
+		result.hit[i] = i < child_count && result.t_near[i] < t_far;
+
+		if (ORDER_BY_SIZE) {
+			float3 extent = make_float3(
+				float(extract_byte(quantized_x_y.y, i) - extract_byte(quantized_x_y.x, i)) * __uint_as_float(e_x << 23),
+				float(extract_byte(quantized_x_y.w, i) - extract_byte(quantized_x_y.z, i)) * __uint_as_float(e_y << 23),
+				float(extract_byte(quantized_z  .y, i) - extract_byte(quantized_z  .x, i)) * __uint_as_float(e_z << 23)
+			);
+			result.t_near[i] = -(extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+		}
+	}
 
 	// Use the two least significant bits of the float to store the index
 	result.t_near[0] = __uint_as_float((__float_as_uint(result.t_near[0]) & 0xfffffffc) | 0);
@@ -76,12 +112,19 @@ __device__ inline void unpack_bvh4_node(unsigned packed, int & index, int & id)
 	id    = packed >> 30;
 }
 
-__device__ inline void bvh4_trace(TraversalData * traversal_data, int ray_count, int * rays_retired) {
+template<bool COLLECT_STATS = false, typename OnRayStats = TraversalStatsIgnoreRay>
+__device__ inline void bvh4_trace(TraversalData * traversal_data, int ray_count, int * rays_retired, const int * ray_order = nullptr, OnRayStats on_ray_stats = { }) {
 	extern __shared__ unsigned shared_stack_bvh4[];
 
 	unsigned stack[BVH_STACK_SIZE - SHARED_STACK_SIZE];
 	int stack_size = 0;
 
+	unsigned stats_node_tests     = 0;
+	unsigned stats_triangle_tests = 0;
+
+	unsigned stats_node_tests_ray;     // Counters at the start of the current Ray
+	unsigned stats_triangle_tests_ray;
+
 	int    ray_index;
 	Ray    ray;
 	RayHit ray_hit;
@@ -89,13 +132,25 @@ __device__ inline void bvh4_trace(TraversalData * traversal_data, int ray_count,
 	int  tlas_stack_size;
 	int  mesh_id;
 	bool mesh_has_identity_transform;
+	bool blas_has_curves = false;
 
 	while (true) {
 		bool inactive = stack_size == 0;
 
 		if (inactive) {
 			ray_index = atomicAdd(rays_retired, 1);
-			if (ray_index >= ray_count) return;
+			if (ray_index >= ray_count) {
+				if (COLLECT_STATS) traversal_stats_add(stats_node_tests, stats_triangle_tests);
+				return;
+			}
+
+			if (COLLECT_STATS) {
+				stats_node_tests_ray     = stats_node_tests;
+				stats_triangle_tests_ray = stats_triangle_tests;
+			}
+
+			// Rays can be visited in a sorted order to improve coherence
+			if (ray_order) ray_index = ray_order[ray_index];
 
 			ray.origin    = traversal_data->ray_origin   .get(ray_index);
 			ray.direction = traversal_data->ray_direction.get(ray_index);
@@ -107,7 +162,7 @@ __device__ inline void bvh4_trace(TraversalData * traversal_data, int ray_count,
 
 			// Push root on stack
 			stack_size                               = 1;
-			shared_stack_bvh4[SHARED_STACK_INDEX(0)] = 1;
+			shared_stack_bvh4[SHARED_STACK_INDEX(0)] = tlas_root_index + 1;
 		}
 
 		while (true) {
@@ -128,37 +183,40 @@ __device__ inline void bvh4_trace(TraversalData * traversal_data, int ray_count,
 			int node_index, node_id;
 			unpack_bvh4_node(packed, node_index, node_id);
 
-			int2 index_and_count = __ldg(&bvh4_nodes[node_index].index_and_count[node_id]);
-
-			int index = index_and_count.x;
-			int count = index_and_count.y;
+			int index = __ldg(&bvh4_nodes[node_index].index[node_id]);
+			int count = __ldg(&bvh4_nodes[node_index].count[node_id]);
 
 			ASSERT(index != INVALID && count != INVALID, "Unpacked invalid Node!");
 
 			// Check if the Node is a leaf
 			if (count > 0) {
 				if (tlas_stack_size == INVALID) {
-					tlas_stack_size = stack_size;
-
 					mesh_id = index;
 
-					unsigned root_index = bvh_get_mesh_root_index(mesh_id, mesh_has_identity_transform) + 1;
+					// Meshes hidden from this kind of Ray are skipped without descending into their BLAS
+					if (mesh_is_visible(mesh_id, MeshVisibility::TRACE)) {
+						tlas_stack_size = stack_size;
 
-					if (!mesh_has_identity_transform) {
-						Matrix3x4 transform_inv = mesh_get_transform_inv(mesh_id);
-						matrix3x4_transform_position (transform_inv, ray.origin);
-						matrix3x4_transform_direction(transform_inv, ray.direction);
-					}
+						unsigned root_index = bvh_get_mesh_root_index(mesh_id, mesh_has_identity_transform, blas_has_curves) + 1;
 
-					stack_push(shared_stack_bvh4, stack, stack_size, root_index);
+						if (!mesh_has_identity_transform) {
+							Matrix3x4 transform_inv = bvh_get_mesh_transform_inv(mesh_id, traversal_data->ray_time, ray_index);
+							matrix3x4_transform_position (transform_inv, ray.origin);
+							matrix3x4_transform_direction(transform_inv, ray.direction);
+						}
+
+						stack_push<COLLECT_STATS>(shared_stack_bvh4, stack, stack_size, root_index);
+					}
 				} else {
 					for (int j = index; j < index + count; j++) {
-						triangle_intersect(mesh_id, j, ray, ray_hit);
+						if (COLLECT_STATS) stats_triangle_tests++;
+						bvh_intersect_primitive(blas_has_curves, mesh_id, j, ray, ray_hit);
 					}
 				}
 			} else {
 				int child = index;
 
+				if (COLLECT_STATS) stats_node_tests++;
 				AABBHits aabb_hits = bvh4_node_intersect(bvh4_nodes[child], ray, ray_hit.t);
 
 				for (int i = 0; i < 4; i++) {
@@ -166,26 +224,33 @@ __device__ inline void bvh4_trace(TraversalData * traversal_data, int ray_count,
 					int id = __float_as_uint(aabb_hits.t_near[i]) & 3;
 
 					if (aabb_hits.hit[id]) {
-						stack_push(shared_stack_bvh4, stack, stack_size, pack_bvh4_node(child, id));
+						stack_push<COLLECT_STATS>(shared_stack_bvh4, stack, stack_size, pack_bvh4_node(child, id));
 					}
 				}
 			}
 
 			if (stack_size == 0) {
 				traversal_data->hits.set(ray_index, ray_hit);
+				if (COLLECT_STATS) on_ray_stats(ray_index, stats_node_tests - stats_node_tests_ray, stats_triangle_tests - stats_triangle_tests_ray);
 				break;
 			}
 		}
 	}
 }
 
-template<typename OnMissCallback>
-__device__ inline void bvh4_trace_shadow(ShadowTraversalData * traversal_data, int ray_count, int * rays_retired, OnMissCallback callback) {
+template<bool COLLECT_STATS = false, typename OnMissCallback, typename OnRayStats = TraversalStatsIgnoreRay, typename OccluderCache = ShadowOccluderCacheNone>
+__device__ inline void bvh4_trace_shadow(ShadowTraversalData * traversal_data, int ray_count, int * rays_retired, OnMissCallback callback, OnRayStats on_ray_stats = { }, OccluderCache occluder_cache = { }) {
 	extern __shared__ unsigned shared_stack_bvh4[];
 
 	unsigned stack[BVH_STACK_SIZE - SHARED_STACK_SIZE];
 	int stack_size = 0;
 
+	unsigned stats_node_tests     = 0;
+	unsigned stats_triangle_tests = 0;
+
+	unsigned stats_node_tests_ray;     // Counters at the start of the current Ray
+	unsigned stats_triangle_tests_ray;
+
 	int ray_index;
 	Ray ray;
 
@@ -194,24 +259,38 @@ __device__ inline void bvh4_trace_shadow(ShadowTraversalData * traversal_data, i
 	int  tlas_stack_size;
 	int  mesh_id;
 	bool mesh_has_identity_transform;
+	bool blas_has_curves = false;
 
 	while (true) {
 		bool inactive = stack_size == 0;
 
 		if (inactive) {
 			ray_index = atomicAdd(rays_retired, 1);
-			if (ray_index >= ray_count) return;
+			if (ray_index >= ray_count) {
+				if (COLLECT_STATS) traversal_stats_add(stats_node_tests, stats_triangle_tests);
+				return;
+			}
+
+			if (COLLECT_STATS) {
+				stats_node_tests_ray     = stats_node_tests;
+				stats_triangle_tests_ray = stats_triangle_tests;
+			}
 
 			ray.origin    = traversal_data->ray_origin   .get(ray_index);
 			ray.direction = traversal_data->ray_direction.get(ray_index);
 
 			max_distance = traversal_data->max_distance[ray_index];
 
+			if (occluder_cache.test(traversal_data, ray_index, ray, max_distance)) {
+				if (COLLECT_STATS) on_ray_stats(ray_index, 0, 1);
+				continue;
+			}
+
 			tlas_stack_size = INVALID;
 
 			// Push root on stack
 			stack_size                               = 1;
-			shared_stack_bvh4[SHARED_STACK_INDEX(0)] = 1;
+			shared_stack_bvh4[SHARED_STACK_INDEX(0)] = tlas_root_index + 1;
 		}
 
 		while (true) {
@@ -231,34 +310,37 @@ __device__ inline void bvh4_trace_shadow(ShadowTraversalData * traversal_data, i
 			int node_index, node_id;
 			unpack_bvh4_node(packed, node_index, node_id);
 
-			int2 index_and_count = bvh4_nodes[node_index].index_and_count[node_id];
-
-			int index = index_and_count.x;
-			int count = index_and_count.y;
+			int index = bvh4_nodes[node_index].index[node_id];
+			int count = bvh4_nodes[node_index].count[node_id];
 
 			ASSERT(index != INVALID && count != INVALID, "Unpacked invalid Node!");
 
 			// Check if the Node is a leaf
 			if (count > 0) {
 				if (tlas_stack_size == INVALID) {
-					tlas_stack_size = stack_size;
-
 					mesh_id = index;
 
-					unsigned root_index = bvh_get_mesh_root_index(mesh_id, mesh_has_identity_transform) + 1;
+					// Meshes hidden from this kind of Ray are skipped without descending into their BLAS
+					if (mesh_is_visible(mesh_id, MeshVisibility::SHADOW)) {
+						tlas_stack_size = stack_size;
 
-					if (!mesh_has_identity_transform) {
-						Matrix3x4 transform_inv = mesh_get_transform_inv(mesh_id);
-						matrix3x4_transform_position (transform_inv, ray.origin);
-						matrix3x4_transform_direction(transform_inv, ray.direction);
-					}
+						unsigned root_index = bvh_get_mesh_root_index(mesh_id, mesh_has_identity_transform, blas_has_curves) + 1;
+
+						if (!mesh_has_identity_transform) {
+							Matrix3x4 transform_inv = bvh_get_mesh_transform_inv(mesh_id, traversal_data->ray_time, ray_index);
+							matrix3x4_transform_position (transform_inv, ray.origin);
+							matrix3x4_transform_direction(transform_inv, ray.direction);
+						}
 
-					stack_push(shared_stack_bvh4, stack, stack_size, root_index);
+						stack_push<COLLECT_STATS>(shared_stack_bvh4, stack, stack_size, root_index);
+					}
 				} else {
 					bool hit = false;
 
 					for (int j = index; j < index + count; j++) {
-						if (triangle_intersect_shadow(j, ray, max_distance)) {
+						if (COLLECT_STATS) stats_triangle_tests++;
+						if (bvh_intersect_primitive_shadow(blas_has_curves, mesh_id, j, ray, max_distance)) {
+							occluder_cache.store(ray_index, mesh_id, j);
 							hit = true;
 
 							break;
@@ -266,6 +348,7 @@ __device__ inline void bvh4_trace_shadow(ShadowTraversalData * traversal_data, i
 					}
 
 					if (hit) {
+						if (COLLECT_STATS) on_ray_stats(ray_index, stats_node_tests - stats_node_tests_ray, stats_triangle_tests - stats_triangle_tests_ray);
 						stack_size = 0;
 
 						break;
@@ -274,14 +357,15 @@ __device__ inline void bvh4_trace_shadow(ShadowTraversalData * traversal_data, i
 			} else {
 				int child = index;
 
-				AABBHits aabb_hits = bvh4_node_intersect(bvh4_nodes[child], ray, max_distance);
+				if (COLLECT_STATS) stats_node_tests++;
+				AABBHits aabb_hits = bvh4_node_intersect<true>(bvh4_nodes[child], ray, max_distance);
 
 				for (int i = 0; i < 4; i++) {
 					// Extract index from the 2 least significant bits
 					int id = __float_as_uint(aabb_hits.t_near[i]) & 3;
 
 					if (aabb_hits.hit[id]) {
-						stack_push(shared_stack_bvh4, stack, stack_size, pack_bvh4_node(child, id));
+						stack_push<COLLECT_STATS>(shared_stack_bvh4, stack, stack_size, pack_bvh4_node(child, id));
 					}
 				}
 			}
@@ -289,6 +373,7 @@ __device__ inline void bvh4_trace_shadow(ShadowTraversalData * traversal_data, i
 			if (stack_size == 0) {
 				// We didn't hit anything, call callback
 				callback(ray_index);
+				if (COLLECT_STATS) on_ray_stats(ray_index, stats_node_tests - stats_node_tests_ray, stats_triangle_tests - stats_triangle_tests_ray);
 				break;
 			}
 		}
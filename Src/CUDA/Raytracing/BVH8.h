@@ -106,16 +106,509 @@ __device__ inline unsigned bvh8_node_intersect(
 	return hit_mask;
 }
 
+// Short Stack traversal (CONFIG_BVH8_SHORT_STACK), based on Vaidyanathan et al. 2019 "Wide BVH Traversal with a Short Stack"
+// The Stack only keeps the BVH8_SHORT_STACK_SIZE most recent entries in thread local memory and uses no Shared Memory.
+// When the Stack overflows the oldest entry is dropped. Once the Stack runs empty after a drop traversal restarts at the root
+// and a trail of the last taken child per level skips all subtrees that were already finished, so nothing is visited twice
+// except for the Nodes along the path back to where traversal left off. The TLAS and BLAS are treated as one tree
+// with the Meshes of a TLAS leaf as children of that leaf, the trail levels continue into the BLAS.
+// Triangle postponing and dynamic fetch are not used here, Triangles are intersected as soon as their Node is visited
+
+// Children are taken in descending order of their key, a higher key means the child is done earlier:
+// internal Nodes use the bit index of their hit (24..31), Meshes in a TLAS leaf use 32 + their bit index (32..55)
+#define BVH8_TRAIL_NONE 0xff
+
+struct BVH8ShortStack {
+	uint2 items [BVH8_SHORT_STACK_SIZE];
+	byte  levels[BVH8_SHORT_STACK_SIZE]; // Level of the children in the group
+
+	int start;
+	int size;
+
+	bool overflowed; // Whether an entry was dropped since traversal (re)started at the root
+};
+
+template<bool COLLECT_STATS>
+__device__ inline void short_stack_push(BVH8ShortStack & stack, uint2 item, int level) {
+	if (stack.size == BVH8_SHORT_STACK_SIZE) {
+		// Drop the oldest entry, its children will be visited after a restart
+		stack.start = (stack.start + 1) % BVH8_SHORT_STACK_SIZE;
+		stack.size--;
+		stack.overflowed = true;
+
+		if (COLLECT_STATS) atomicAdd(&traversal_stats.stack_overflows, 1);
+	}
+
+	int index = (stack.start + stack.size) % BVH8_SHORT_STACK_SIZE;
+	stack.items [index] = item;
+	stack.levels[index] = level;
+	stack.size++;
+}
+
+__device__ inline uint2 short_stack_pop(BVH8ShortStack & stack, int & level) {
+	stack.size--;
+
+	int index = (stack.start + stack.size) % BVH8_SHORT_STACK_SIZE;
+	level = stack.levels[index];
+	return stack.items[index];
+}
+
+// Levels deeper than trail_level have no child taken yet
+__device__ inline int bvh8_trail_get(const byte trail[], int trail_level, int level) {
+	return level <= trail_level ? trail[level] : BVH8_TRAIL_NONE;
+}
+
+// Records that the child with the given key is taken. If it is the child the trail already points to, traversal
+// resumes inside its subtree and the deeper levels stay valid, otherwise the deeper levels are invalidated
+__device__ inline void bvh8_trail_take(byte trail[], int & trail_level, int level, int key) {
+	ASSERT(level < BVH8_TRAIL_SIZE, "BVH too deep for the restart trail!");
+
+	if (key < bvh8_trail_get(trail, trail_level, level)) {
+		trail[level] = key;
+		trail_level  = level;
+	}
+}
+
+// Removes the internal children that were finished before the last restart from a Node group
+__device__ inline unsigned bvh8_trail_filter_nodes(unsigned hits_imask, int trail_key) {
+	if (trail_key >= 31) return hits_imask;
+	if (trail_key <  24) return hits_imask & 0x00ffffff;
+
+	return hits_imask & (0x00ffffff | (0xffffffff >> (31 - trail_key)));
+}
+
+// Removes the Meshes that were finished before the last restart from a TLAS leaf group
+__device__ inline unsigned bvh8_trail_filter_meshes(unsigned hits, int trail_key) {
+	if (trail_key >= 32 + 23) return hits;
+	if (trail_key <  32)      return 0;
+
+	return hits & (0xffffffff >> (31 - (trail_key - 32)));
+}
+
+// Traverses a single Ray with the Short Stack, ray_time[ray_index] is only read for moving Meshes
+// The node and triangle test counters are only incremented if instantiated with COLLECT_STATS
+template<bool COLLECT_STATS = false>
+__device__ inline RayHit bvh8_intersect_short_stack(Ray ray, const float * ray_time, int ray_index, unsigned & stats_node_tests, unsigned & stats_triangle_tests) {
+	BVH8ShortStack stack;
+
+	byte trail[BVH8_TRAIL_SIZE];
+	int  trail_level;
+
+	Ray ray_untransformed = ray;
+
+	unsigned oct_inv4 = ray_get_octant_inv4(ray.direction);
+
+	RayHit ray_hit;
+	ray_hit.t           = INFINITY;
+	ray_hit.triangle_id = INVALID;
+
+	stack.start      = 0;
+	stack.size       = 0;
+	stack.overflowed = false;
+
+	trail_level = INVALID;
+
+	uint2 current_group = make_uint2(tlas_root_index, 0x80000000);
+	int   current_level = 0;
+
+	int  blas_level = INVALID; // Level of the BLAS root while inside a BLAS
+	int  mesh_id;
+	bool mesh_has_identity_transform;
+	bool blas_has_curves = false;
+
+	while (true) {
+		uint2 triangle_group = make_uint2(0);
+		int   triangle_level = current_level;
+
+		if (current_group.y & 0xff000000) {
+			current_group.y = bvh8_trail_filter_nodes(current_group.y, bvh8_trail_get(trail, trail_level, current_level));
+
+			// Clear the imask as well, so that an empty Node group is not mistaken for a group of Meshes
+			if ((current_group.y & 0xff000000) == 0) current_group.y = 0;
+		}
+
+		if (current_group.y & 0xff000000) {
+			unsigned hits_imask = current_group.y;
+
+			unsigned child_index_offset = msb(hits_imask);
+			unsigned child_index_base   = current_group.x;
+
+			bvh8_trail_take(trail, trail_level, current_level, child_index_offset);
+
+			current_group.y &= ~(1 << child_index_offset);
+
+			if (current_group.y & 0xff000000) {
+				short_stack_push<COLLECT_STATS>(stack, current_group, current_level);
+			}
+
+			unsigned slot_index     = (child_index_offset - 24) ^ (oct_inv4 & 0xff);
+			unsigned relative_index = __popc(hits_imask & ~(0xffffffff << slot_index));
+
+			unsigned child_node_index = child_index_base + relative_index;
+
+			float4 node_0 = __ldg(&bvh8_nodes[child_node_index].node_0);
+			float4 node_1 = __ldg(&bvh8_nodes[child_node_index].node_1);
+			float4 node_2 = __ldg(&bvh8_nodes[child_node_index].node_2);
+			float4 node_3 = __ldg(&bvh8_nodes[child_node_index].node_3);
+			float4 node_4 = __ldg(&bvh8_nodes[child_node_index].node_4);
+
+			if (COLLECT_STATS) stats_node_tests++;
+			unsigned hitmask = bvh8_node_intersect(ray, oct_inv4, ray_hit.t, node_0, node_1, node_2, node_3, node_4);
+
+			byte imask = extract_byte(__float_as_uint(node_0.w), 3);
+
+			current_group .x = __float_as_uint(node_1.x); // Child    base offset
+			triangle_group.x = __float_as_uint(node_1.y); // Triangle base offset
+
+			current_group .y = (hitmask & 0xff000000) | unsigned(imask);
+			triangle_group.y = (hitmask & 0x00ffffff);
+
+			current_level++;
+			triangle_level = current_level;
+		} else if (current_group.y != 0 && blas_level == INVALID) {
+			// Popped the remaining Meshes of a TLAS leaf
+			triangle_group = current_group;
+			current_group  = make_uint2(0);
+		}
+
+		if (blas_level == INVALID) {
+			// In the TLAS the primitives are Meshes
+			triangle_group.y = bvh8_trail_filter_meshes(triangle_group.y, bvh8_trail_get(trail, trail_level, triangle_level));
+
+			// Meshes hidden from this kind of Ray are skipped without descending into their BLAS, as if their BLAS was missed
+			while (triangle_group.y != 0 && !mesh_is_visible(triangle_group.x + msb(triangle_group.y), MeshVisibility::TRACE)) {
+				int mesh_offset = msb(triangle_group.y);
+				triangle_group.y &= ~(1 << mesh_offset);
+
+				bvh8_trail_take(trail, trail_level, triangle_level, 32 + mesh_offset);
+			}
+
+			if (triangle_group.y != 0) {
+				int mesh_offset = msb(triangle_group.y);
+				triangle_group.y &= ~(1 << mesh_offset);
+
+				bvh8_trail_take(trail, trail_level, triangle_level, 32 + mesh_offset);
+
+				mesh_id = triangle_group.x + mesh_offset;
+
+				// The remaining Meshes have higher keys than the internal Nodes, so they need to be popped first
+				if (current_group.y & 0xff000000) {
+					short_stack_push<COLLECT_STATS>(stack, current_group, triangle_level);
+				}
+				if (triangle_group.y != 0) {
+					short_stack_push<COLLECT_STATS>(stack, triangle_group, triangle_level);
+				}
+
+				int root_index = bvh_get_mesh_root_index(mesh_id, mesh_has_identity_transform, blas_has_curves);
+
+				if (!mesh_has_identity_transform) {
+					Matrix3x4 transform_inv = bvh_get_mesh_transform_inv(mesh_id, ray_time, ray_index);
+					matrix3x4_transform_position (transform_inv, ray.origin);
+					matrix3x4_transform_direction(transform_inv, ray.direction);
+
+					oct_inv4 = ray_get_octant_inv4(ray.direction);
+				}
+
+				blas_level = triangle_level + 1;
+
+				current_group = make_uint2(root_index, 0x80000000);
+				current_level = blas_level;
+
+				continue;
+			}
+		} else {
+			while (triangle_group.y != 0) {
+				int triangle_index = msb(triangle_group.y);
+				triangle_group.y &= ~(1 << triangle_index);
+
+				if (COLLECT_STATS) stats_triangle_tests++;
+				bvh_intersect_primitive(blas_has_curves, mesh_id, triangle_group.x + triangle_index, ray, ray_hit);
+			}
+		}
+
+		if ((current_group.y & 0xff000000) == 0) {
+			if (stack.size == 0) {
+				if (!stack.overflowed) break;
+
+				// Entries were dropped, restart at the root and let the trail skip what is already done
+				stack.start      = 0;
+				stack.overflowed = false;
+
+				current_group = make_uint2(tlas_root_index, 0x80000000);
+				current_level = 0;
+			} else {
+				current_group = short_stack_pop(stack, current_level);
+			}
+
+			if (blas_level != INVALID && current_level < blas_level) {
+				blas_level = INVALID;
+
+				if (!mesh_has_identity_transform) {
+					// Reset Ray to untransformed version
+					ray = ray_untransformed;
+					oct_inv4 = ray_get_octant_inv4(ray.direction);
+				}
+			}
+		}
+	}
+
+	return ray_hit;
+}
+
+// Returns true if the Ray hits anything within max_distance, the occluding primitive is passed to occluder_cache.store
+template<bool COLLECT_STATS = false, typename OccluderCache = ShadowOccluderCacheNone>
+__device__ inline bool bvh8_intersect_shadow_short_stack(Ray ray, float max_distance, const float * ray_time, int ray_index, unsigned & stats_node_tests, unsigned & stats_triangle_tests, OccluderCache occluder_cache = { }) {
+	BVH8ShortStack stack;
+
+	byte trail[BVH8_TRAIL_SIZE];
+	int  trail_level;
+
+	Ray ray_untransformed = ray;
+
+	unsigned oct_inv4 = ray_get_octant_inv4(ray.direction);
+
+	stack.start      = 0;
+	stack.size       = 0;
+	stack.overflowed = false;
+
+	trail_level = INVALID;
+
+	uint2 current_group = make_uint2(tlas_root_index, 0x80000000);
+	int   current_level = 0;
+
+	int  blas_level = INVALID; // Level of the BLAS root while inside a BLAS
+	int  mesh_id;
+	bool mesh_has_identity_transform;
+	bool blas_has_curves = false;
+
+	while (true) {
+		uint2 triangle_group = make_uint2(0);
+		int   triangle_level = current_level;
+
+		if (current_group.y & 0xff000000) {
+			current_group.y = bvh8_trail_filter_nodes(current_group.y, bvh8_trail_get(trail, trail_level, current_level));
+
+			// Clear the imask as well, so that an empty Node group is not mistaken for a group of Meshes
+			if ((current_group.y & 0xff000000) == 0) current_group.y = 0;
+		}
+
+		if (current_group.y & 0xff000000) {
+			unsigned hits_imask = current_group.y;
+
+			unsigned child_index_offset = msb(hits_imask);
+			unsigned child_index_base   = current_group.x;
+
+			bvh8_trail_take(trail, trail_level, current_level, child_index_offset);
+
+			current_group.y &= ~(1 << child_index_offset);
+
+			if (current_group.y & 0xff000000) {
+				short_stack_push<COLLECT_STATS>(stack, current_group, current_level);
+			}
+
+			unsigned slot_index     = (child_index_offset - 24) ^ (oct_inv4 & 0xff);
+			unsigned relative_index = __popc(hits_imask & ~(0xffffffff << slot_index));
+
+			unsigned child_node_index = child_index_base + relative_index;
+
+			float4 node_0 = bvh8_nodes[child_node_index].node_0;
+			float4 node_1 = bvh8_nodes[child_node_index].node_1;
+			float4 node_2 = bvh8_nodes[child_node_index].node_2;
+			float4 node_3 = bvh8_nodes[child_node_index].node_3;
+			float4 node_4 = bvh8_nodes[child_node_index].node_4;
+
+			if (COLLECT_STATS) stats_node_tests++;
+			unsigned hitmask = bvh8_node_intersect(ray, oct_inv4, max_distance, node_0, node_1, node_2, node_3, node_4);
+
+			byte imask = extract_byte(__float_as_uint(node_0.w), 3);
+
+			current_group .x = __float_as_uint(node_1.x); // Child    base offset
+			triangle_group.x = __float_as_uint(node_1.y); // Triangle base offset
+
+			current_group .y = (hitmask & 0xff000000) | unsigned(imask);
+			triangle_group.y = (hitmask & 0x00ffffff);
+
+			current_level++;
+			triangle_level = current_level;
+		} else if (current_group.y != 0 && blas_level == INVALID) {
+			// Popped the remaining Meshes of a TLAS leaf
+			triangle_group = current_group;
+			current_group  = make_uint2(0);
+		}
+
+		if (blas_level == INVALID) {
+			// In the TLAS the primitives are Meshes
+			triangle_group.y = bvh8_trail_filter_meshes(triangle_group.y, bvh8_trail_get(trail, trail_level, triangle_level));
+
+			// Meshes hidden from this kind of Ray are skipped without descending into their BLAS, as if their BLAS was missed
+			while (triangle_group.y != 0 && !mesh_is_visible(triangle_group.x + msb(triangle_group.y), MeshVisibility::SHADOW)) {
+				int mesh_offset = msb(triangle_group.y);
+				triangle_group.y &= ~(1 << mesh_offset);
+
+				bvh8_trail_take(trail, trail_level, triangle_level, 32 + mesh_offset);
+			}
+
+			if (triangle_group.y != 0) {
+				int mesh_offset = msb(triangle_group.y);
+				triangle_group.y &= ~(1 << mesh_offset);
+
+				bvh8_trail_take(trail, trail_level, triangle_level, 32 + mesh_offset);
+
+				mesh_id = triangle_group.x + mesh_offset;
+
+				// The remaining Meshes have higher keys than the internal Nodes, so they need to be popped first
+				if (current_group.y & 0xff000000) {
+					short_stack_push<COLLECT_STATS>(stack, current_group, triangle_level);
+				}
+				if (triangle_group.y != 0) {
+					short_stack_push<COLLECT_STATS>(stack, triangle_group, triangle_level);
+				}
+
+				int root_index = bvh_get_mesh_root_index(mesh_id, mesh_has_identity_transform, blas_has_curves);
+
+				if (!mesh_has_identity_transform) {
+					Matrix3x4 transform_inv = bvh_get_mesh_transform_inv(mesh_id, ray_time, ray_index);
+					matrix3x4_transform_position (transform_inv, ray.origin);
+					matrix3x4_transform_direction(transform_inv, ray.direction);
+
+					oct_inv4 = ray_get_octant_inv4(ray.direction);
+				}
+
+				blas_level = triangle_level + 1;
+
+				current_group = make_uint2(root_index, 0x80000000);
+				current_level = blas_level;
+
+				continue;
+			}
+		} else {
+			while (triangle_group.y != 0) {
+				int triangle_index = msb(triangle_group.y);
+				triangle_group.y &= ~(1 << triangle_index);
+
+				if (COLLECT_STATS) stats_triangle_tests++;
+				if (bvh_intersect_primitive_shadow(blas_has_curves, mesh_id, triangle_group.x + triangle_index, ray, max_distance)) {
+					occluder_cache.store(ray_index, mesh_id, triangle_group.x + triangle_index);
+					return true;
+				}
+			}
+		}
+
+		if ((current_group.y & 0xff000000) == 0) {
+			if (stack.size == 0) {
+				if (!stack.overflowed) break;
+
+				// Entries were dropped, restart at the root and let the trail skip what is already done
+				stack.start      = 0;
+				stack.overflowed = false;
+
+				current_group = make_uint2(tlas_root_index, 0x80000000);
+				current_level = 0;
+			} else {
+				current_group = short_stack_pop(stack, current_level);
+			}
+
+			if (blas_level != INVALID && current_level < blas_level) {
+				blas_level = INVALID;
+
+				if (!mesh_has_identity_transform) {
+					// Reset Ray to untransformed version
+					ray = ray_untransformed;
+					oct_inv4 = ray_get_octant_inv4(ray.direction);
+				}
+			}
+		}
+	}
+
+	return false;
+}
+
+template<bool COLLECT_STATS = false, typename OnRayStats = TraversalStatsIgnoreRay>
+__device__ inline void bvh8_trace_short_stack(TraversalData * traversal_data, int ray_count, int * rays_retired, const int * ray_order, OnRayStats on_ray_stats) {
+	unsigned stats_node_tests     = 0;
+	unsigned stats_triangle_tests = 0;
+
+	while (true) {
+		int ray_index = atomicAdd(rays_retired, 1);
+		if (ray_index >= ray_count) {
+			if (COLLECT_STATS) traversal_stats_add(stats_node_tests, stats_triangle_tests);
+			return;
+		}
+
+		unsigned stats_node_tests_ray     = stats_node_tests;
+		unsigned stats_triangle_tests_ray = stats_triangle_tests;
+
+		// Rays can be visited in a sorted order to improve coherence
+		if (ray_order) ray_index = ray_order[ray_index];
+
+		Ray ray;
+		ray.origin    = traversal_data->ray_origin   .get(ray_index);
+		ray.direction = traversal_data->ray_direction.get(ray_index);
+
+		RayHit ray_hit = bvh8_intersect_short_stack<COLLECT_STATS>(ray, traversal_data->ray_time, ray_index, stats_node_tests, stats_triangle_tests);
+
+		traversal_data->hits.set(ray_index, ray_hit);
+		if (COLLECT_STATS) on_ray_stats(ray_index, stats_node_tests - stats_node_tests_ray, stats_triangle_tests - stats_triangle_tests_ray);
+	}
+}
+
+template<bool COLLECT_STATS = false, typename OnMissCallback, typename OnRayStats = TraversalStatsIgnoreRay, typename OccluderCache = ShadowOccluderCacheNone>
+__device__ inline void bvh8_trace_shadow_short_stack(ShadowTraversalData * traversal_data, int ray_count, int * rays_retired, OnMissCallback callback, OnRayStats on_ray_stats, OccluderCache occluder_cache) {
+	unsigned stats_node_tests     = 0;
+	unsigned stats_triangle_tests = 0;
+
+	while (true) {
+		int ray_index = atomicAdd(rays_retired, 1);
+		if (ray_index >= ray_count) {
+			if (COLLECT_STATS) traversal_stats_add(stats_node_tests, stats_triangle_tests);
+			return;
+		}
+
+		unsigned stats_node_tests_ray     = stats_node_tests;
+		unsigned stats_triangle_tests_ray = stats_triangle_tests;
+
+		Ray ray;
+		ray.origin    = traversal_data->ray_origin   .get(ray_index);
+		ray.direction = traversal_data->ray_direction.get(ray_index);
+
+		float max_distance = traversal_data->max_distance[ray_index];
+
+		if (occluder_cache.test(traversal_data, ray_index, ray, max_distance)) {
+			if (COLLECT_STATS) on_ray_stats(ray_index, 0, 1);
+			continue;
+		}
+
+		bool hit = bvh8_intersect_shadow_short_stack<COLLECT_STATS>(ray, max_distance, traversal_data->ray_time, ray_index, stats_node_tests, stats_triangle_tests, occluder_cache);
+
+		// If we didn't hit anything, call callback
+		if (!hit) callback(ray_index);
+		if (COLLECT_STATS) on_ray_stats(ray_index, stats_node_tests - stats_node_tests_ray, stats_triangle_tests - stats_triangle_tests_ray);
+	}
+}
+
 // Constants used by Dynamic Fetch Heuristic (see section 4.4 of Ylitie et al. 2017)
 #define N_d 4
 #define N_w 16
 
-__device__ inline void bvh8_trace(TraversalData * traversal_data, int ray_count, int * rays_retired) {
+// TraversalLOD may replace the BLAS root of a Mesh by that of one of its levels of detail, it is not used by the short stack traversal
+template<bool COLLECT_STATS = false, typename OnRayStats = TraversalStatsIgnoreRay, typename TraversalLOD = TraversalLODNone>
+__device__ inline void bvh8_trace(TraversalData * traversal_data, int ray_count, int * rays_retired, const int * ray_order = nullptr, OnRayStats on_ray_stats = { }, TraversalLOD traversal_lod = { }) {
+	if (CONFIG_BVH8_SHORT_STACK) {
+		bvh8_trace_short_stack<COLLECT_STATS>(traversal_data, ray_count, rays_retired, ray_order, on_ray_stats);
+		return;
+	}
+
 	extern __shared__ uint2 shared_stack_bvh8[];
 
 	uint2 stack[BVH_STACK_SIZE - SHARED_STACK_SIZE];
 	int   stack_size = 0;
 
+	unsigned stats_node_tests     = 0;
+	unsigned stats_triangle_tests = 0;
+
+	unsigned stats_node_tests_ray;     // Counters at the start of the current Ray
+	unsigned stats_triangle_tests_ray;
+
 	uint2 current_group = make_uint2(0, 0);
 
 	int ray_index;
@@ -129,13 +622,25 @@ __device__ inline void bvh8_trace(TraversalData * traversal_data, int ray_count,
 	int  tlas_stack_size;
 	int  mesh_id;
 	bool mesh_has_identity_transform;
+	bool blas_has_curves = false;
 
 	while (true) {
 		bool inactive = stack_size == 0 && current_group.y == 0;
 
 		if (inactive) {
 			ray_index = atomicAdd(rays_retired, 1);
-			if (ray_index >= ray_count) return;
+			if (ray_index >= ray_count) {
+				if (COLLECT_STATS) traversal_stats_add(stats_node_tests, stats_triangle_tests);
+				return;
+			}
+
+			if (COLLECT_STATS) {
+				stats_node_tests_ray     = stats_node_tests;
+				stats_triangle_tests_ray = stats_triangle_tests;
+			}
+
+			// Rays can be visited in a sorted order to improve coherence
+			if (ray_order) ray_index = ray_order[ray_index];
 
 			ray.origin    = traversal_data->ray_origin   .get(ray_index);
 			ray.direction = traversal_data->ray_direction.get(ray_index);
@@ -143,7 +648,7 @@ __device__ inline void bvh8_trace(TraversalData * traversal_data, int ray_count,
 
 			oct_inv4 = ray_get_octant_inv4(ray.direction);
 
-			current_group = make_uint2(0, 0x80000000);
+			current_group = make_uint2(tlas_root_index, 0x80000000);
 
 			ray_hit.t           = INFINITY;
 			ray_hit.triangle_id = INVALID;
@@ -169,7 +674,7 @@ __device__ inline void bvh8_trace(TraversalData * traversal_data, int ray_count,
 				if (current_group.y & 0xff000000) {
 					// assert(stack_size < BVH_STACK_SIZE);
 
-					stack_push(shared_stack_bvh8, stack, stack_size, current_group);
+					stack_push<COLLECT_STATS>(shared_stack_bvh8, stack, stack_size, current_group);
 				}
 
 				unsigned slot_index     = (child_index_offset - 24) ^ (oct_inv4 & 0xff);
@@ -183,6 +688,7 @@ __device__ inline void bvh8_trace(TraversalData * traversal_data, int ray_count,
 				float4 node_3 = __ldg(&bvh8_nodes[child_node_index].node_3);
 				float4 node_4 = __ldg(&bvh8_nodes[child_node_index].node_4);
 
+				if (COLLECT_STATS) stats_node_tests++;
 				unsigned hitmask = bvh8_node_intersect(ray, oct_inv4, ray_hit.t, node_0, node_1, node_2, node_3, node_4);
 
 				byte imask = extract_byte(__float_as_uint(node_0.w), 3);
@@ -207,26 +713,34 @@ __device__ inline void bvh8_trace(TraversalData * traversal_data, int ray_count,
 
 					mesh_id = triangle_group.x + mesh_offset;
 
+					// Meshes hidden from this kind of Ray are skipped without descending into their BLAS
+					if (!mesh_is_visible(mesh_id, MeshVisibility::TRACE)) continue;
+
 					if (triangle_group.y != 0) {
-						stack_push(shared_stack_bvh8, stack, stack_size, triangle_group);
+						stack_push<COLLECT_STATS>(shared_stack_bvh8, stack, stack_size, triangle_group);
 					}
 					if (current_group.y & 0xff000000) {
-						stack_push(shared_stack_bvh8, stack, stack_size, current_group);
+						stack_push<COLLECT_STATS>(shared_stack_bvh8, stack, stack_size, current_group);
 					}
 
 					tlas_stack_size = stack_size;
 
-					int root_index = bvh_get_mesh_root_index(mesh_id, mesh_has_identity_transform);
+					int root_index = bvh_get_mesh_root_index(mesh_id, mesh_has_identity_transform, blas_has_curves);
+					float inv_scale = 1.0f;
 					
 					// Optimization: if the Mesh has an identity transform, don't bother loading and transforming
 					if (!mesh_has_identity_transform) {
-						Matrix3x4 transform_inv = mesh_get_transform_inv(mesh_id);
+						Matrix3x4 transform_inv = bvh_get_mesh_transform_inv(mesh_id, traversal_data->ray_time, ray_index);
 						matrix3x4_transform_position (transform_inv, ray.origin);
 						matrix3x4_transform_direction(transform_inv, ray.direction);
 
 						oct_inv4 = ray_get_octant_inv4(ray.direction);
+
+						inv_scale = length(make_float3(transform_inv.row_0.x, transform_inv.row_0.y, transform_inv.row_0.z));
 					}
 
+					root_index = traversal_lod(ray_index, mesh_id, root_index, ray, inv_scale);
+
 					current_group = make_uint2(root_index, 0x80000000);
 
 					break;
@@ -234,7 +748,7 @@ __device__ inline void bvh8_trace(TraversalData * traversal_data, int ray_count,
 					int thread_count = __popc(__activemask());
 					if (thread_count < postpone_threshold) {
 						// Not enough threads currently active that want to check triangle intersection, postpone by pushing on the stack
-						stack_push(shared_stack_bvh8, stack, stack_size, triangle_group);
+						stack_push<COLLECT_STATS>(shared_stack_bvh8, stack, stack_size, triangle_group);
 
 						break;
 					}
@@ -242,13 +756,15 @@ __device__ inline void bvh8_trace(TraversalData * traversal_data, int ray_count,
 					int triangle_index = msb(triangle_group.y);
 					triangle_group.y &= ~(1 << triangle_index);
 
-					triangle_intersect(mesh_id, triangle_group.x + triangle_index, ray, ray_hit);
+					if (COLLECT_STATS) stats_triangle_tests++;
+					bvh_intersect_primitive(blas_has_curves, mesh_id, triangle_group.x + triangle_index, ray, ray_hit);
 				}
 			}
 
 			if ((current_group.y & 0xff000000) == 0) {
 				if (stack_size == 0) {
 					traversal_data->hits.set(ray_index, ray_hit);
+					if (COLLECT_STATS) on_ray_stats(ray_index, stats_node_tests - stats_node_tests_ray, stats_triangle_tests - stats_triangle_tests_ray);
 
 					current_group.y = 0;
 
@@ -273,13 +789,24 @@ __device__ inline void bvh8_trace(TraversalData * traversal_data, int ray_count,
 	}
 }
 
-template<typename OnMissCallback>
-__device__ inline void bvh8_trace_shadow(ShadowTraversalData * traversal_data, int ray_count, int * rays_retired, OnMissCallback callback) {
+template<bool COLLECT_STATS = false, typename OnMissCallback, typename OnRayStats = TraversalStatsIgnoreRay, typename OccluderCache = ShadowOccluderCacheNone>
+__device__ inline void bvh8_trace_shadow(ShadowTraversalData * traversal_data, int ray_count, int * rays_retired, OnMissCallback callback, OnRayStats on_ray_stats = { }, OccluderCache occluder_cache = { }) {
+	if (CONFIG_BVH8_SHORT_STACK) {
+		bvh8_trace_shadow_short_stack<COLLECT_STATS>(traversal_data, ray_count, rays_retired, callback, on_ray_stats, occluder_cache);
+		return;
+	}
+
 	extern __shared__ uint2 shared_stack_bvh8[];
 
 	uint2 stack[BVH_STACK_SIZE - SHARED_STACK_SIZE];
 	int   stack_size = 0;
 
+	unsigned stats_node_tests     = 0;
+	unsigned stats_triangle_tests = 0;
+
+	unsigned stats_node_tests_ray;     // Counters at the start of the current Ray
+	unsigned stats_triangle_tests_ray;
+
 	uint2 current_group = make_uint2(0, 0);
 
 	int ray_index;
@@ -293,13 +820,22 @@ __device__ inline void bvh8_trace_shadow(ShadowTraversalData * traversal_data, i
 	int  tlas_stack_size;
 	int  mesh_id;
 	bool mesh_has_identity_transform;
+	bool blas_has_curves = false;
 
 	while (true) {
 		bool inactive = stack_size == 0 && current_group.y == 0;
 
 		if (inactive) {
 			ray_index = atomicAdd(rays_retired, 1);
-			if (ray_index >= ray_count) return;
+			if (ray_index >= ray_count) {
+				if (COLLECT_STATS) traversal_stats_add(stats_node_tests, stats_triangle_tests);
+				return;
+			}
+
+			if (COLLECT_STATS) {
+				stats_node_tests_ray     = stats_node_tests;
+				stats_triangle_tests_ray = stats_triangle_tests;
+			}
 
 			ray.origin    = traversal_data->ray_origin   .get(ray_index);
 			ray.direction = traversal_data->ray_direction.get(ray_index);
@@ -307,10 +843,16 @@ __device__ inline void bvh8_trace_shadow(ShadowTraversalData * traversal_data, i
 
 			oct_inv4 = ray_get_octant_inv4(ray.direction);
 
-			current_group = make_uint2(0, 0x80000000);
-
 			max_distance = traversal_data->max_distance[ray_index];
 
+			// The last occluder of the Pixel is likely to occlude this Ray too, in which case the BVH is not traversed at all
+			if (occluder_cache.test(traversal_data, ray_index, ray, max_distance)) {
+				if (COLLECT_STATS) on_ray_stats(ray_index, 0, 1);
+				continue;
+			}
+
+			current_group = make_uint2(tlas_root_index, 0x80000000);
+
 			tlas_stack_size = INVALID;
 		}
 
@@ -330,7 +872,7 @@ __device__ inline void bvh8_trace_shadow(ShadowTraversalData * traversal_data, i
 
 				// If the node group is not yet empty, push it on the stack
 				if (current_group.y & 0xff000000) {
-					stack_push(shared_stack_bvh8, stack, stack_size, current_group);
+					stack_push<COLLECT_STATS>(shared_stack_bvh8, stack, stack_size, current_group);
 				}
 
 				unsigned slot_index     = (child_index_offset - 24) ^ (oct_inv4 & 0xff);
@@ -344,6 +886,7 @@ __device__ inline void bvh8_trace_shadow(ShadowTraversalData * traversal_data, i
 				float4 node_3 = bvh8_nodes[child_node_index].node_3;
 				float4 node_4 = bvh8_nodes[child_node_index].node_4;
 
+				if (COLLECT_STATS) stats_node_tests++;
 				unsigned hitmask = bvh8_node_intersect(ray, oct_inv4, max_distance, node_0, node_1, node_2, node_3, node_4);
 
 				byte imask = extract_byte(__float_as_uint(node_0.w), 3);
@@ -370,20 +913,23 @@ __device__ inline void bvh8_trace_shadow(ShadowTraversalData * traversal_data, i
 
 					mesh_id = triangle_group.x + mesh_offset;
 
+					// Meshes hidden from this kind of Ray are skipped without descending into their BLAS
+					if (!mesh_is_visible(mesh_id, MeshVisibility::SHADOW)) continue;
+
 					if (triangle_group.y != 0) {
-						stack_push(shared_stack_bvh8, stack, stack_size, triangle_group);
+						stack_push<COLLECT_STATS>(shared_stack_bvh8, stack, stack_size, triangle_group);
 					}
 					if (current_group.y & 0xff000000) {
-						stack_push(shared_stack_bvh8, stack, stack_size, current_group);
+						stack_push<COLLECT_STATS>(shared_stack_bvh8, stack, stack_size, current_group);
 					}
 
 					tlas_stack_size = stack_size;
 
-					int root_index = bvh_get_mesh_root_index(mesh_id, mesh_has_identity_transform);
+					int root_index = bvh_get_mesh_root_index(mesh_id, mesh_has_identity_transform, blas_has_curves);
 					
 					// Optimization: if the Mesh has an identity transform, don't bother loading and transforming
 					if (!mesh_has_identity_transform) {
-						Matrix3x4 transform_inv = mesh_get_transform_inv(mesh_id);
+						Matrix3x4 transform_inv = bvh_get_mesh_transform_inv(mesh_id, traversal_data->ray_time, ray_index);
 						matrix3x4_transform_position (transform_inv, ray.origin);
 						matrix3x4_transform_direction(transform_inv, ray.direction);
 
@@ -397,14 +943,16 @@ __device__ inline void bvh8_trace_shadow(ShadowTraversalData * traversal_data, i
 					int thread_count = __popc(__activemask());
 					if (thread_count < postpone_threshold) {
 						// Not enough threads currently active that want to check triangle intersection, postpone by pushing on the stack
-						stack_push(shared_stack_bvh8, stack, stack_size, triangle_group);
+						stack_push<COLLECT_STATS>(shared_stack_bvh8, stack, stack_size, triangle_group);
 						break;
 					}
 
 					int triangle_index = msb(triangle_group.y);
 					triangle_group.y &= ~(1 << triangle_index);
 
-					if (triangle_intersect_shadow(triangle_group.x + triangle_index, ray, max_distance)) {
+					if (COLLECT_STATS) stats_triangle_tests++;
+					if (bvh_intersect_primitive_shadow(blas_has_curves, mesh_id, triangle_group.x + triangle_index, ray, max_distance)) {
+						occluder_cache.store(ray_index, mesh_id, triangle_group.x + triangle_index);
 						hit = true;
 						break;
 					}
@@ -412,6 +960,7 @@ __device__ inline void bvh8_trace_shadow(ShadowTraversalData * traversal_data, i
 			}
 
 			if (hit) {
+				if (COLLECT_STATS) on_ray_stats(ray_index, stats_node_tests - stats_node_tests_ray, stats_triangle_tests - stats_triangle_tests_ray);
 				stack_size      = 0;
 				current_group.y = 0;
 				break;
@@ -421,6 +970,7 @@ __device__ inline void bvh8_trace_shadow(ShadowTraversalData * traversal_data, i
 				if (stack_size == 0) {
 					// We didn't hit anything, call callback
 					callback(ray_index);
+					if (COLLECT_STATS) on_ray_stats(ray_index, stats_node_tests - stats_node_tests_ray, stats_triangle_tests - stats_triangle_tests_ray);
 					current_group.y = 0;
 					break;
 				}
@@ -0,0 +1,209 @@
+#pragma once
+#include "Raytracing/Ray.h"
+#include "Raytracing/Triangle.h"
+
+// Segment of a hair strand, a round cone between two spheres (see Renderer/Curve.h)
+// The BLAS of a Mesh contains either Triangles or Curves, which is indicated by bit 29 of its root index
+struct Curve {
+	float4 part_0; // position_0 xyz and radius_0
+	float4 part_1; // position_1 xyz and radius_1
+};
+
+__device__ __constant__ const Curve * curves;
+
+// Bit 29 of the root index stores whether the BLAS of the Mesh consists of Curves
+__device__ inline bool mesh_has_curves(int mesh_id) {
+	return (unsigned(__ldg(&mesh_bvh_root_indices[mesh_id])) >> 29) & 1;
+}
+
+// A Curve whose end points coincide is a sphere, these are used as analytic spheres (see cpu_config.enable_analytic_spheres)
+// Unlike the round cone a Ray that starts inside a sphere hits its far side, so that Rays refracted into a dielectric sphere can leave it
+// u is the polar angle and v the azimuth around the z axis, both normalized to [0, 1]
+__device__ inline bool curve_intersect_sphere(float3 center, float radius, const Ray & ray, float max_distance, float & t, float & u, float & v) {
+	float  direction_length_inv = rsqrtf(dot(ray.direction, ray.direction));
+	float3 rd = ray.direction * direction_length_inv;
+	float3 oc = ray.origin - center;
+
+	float b = dot(oc, rd);
+	float h = b*b - dot(oc, oc) + radius*radius;
+	if (h < 0.0f) return false;
+
+	float sqrt_h = sqrtf(h);
+	float t_hit  = -b - sqrt_h;
+	if (t_hit <= 0.0f) t_hit = -b + sqrt_h;
+
+	t_hit *= direction_length_inv;
+	if (!(t_hit > 0.0f && t_hit < max_distance)) return false;
+
+	float3 normal = (ray.origin + t_hit * ray.direction - center) / radius;
+
+	t = t_hit;
+	u = acosf(clamp(normal.z, -1.0f, 1.0f)) * ONE_OVER_PI;
+	v = atan2f(normal.y, normal.x) * ONE_OVER_TWO_PI + 0.5f;
+
+	return true;
+}
+
+// Round cone intersection, based on "Rounded Cone - intersection" by Inigo Quilez
+// Only the nearest surface is considered, Rays that start inside a Curve do not hit it
+// The Ray direction does not need to be normalized, t is returned in units of the Ray direction like for Triangles
+// u is the position along the axis of the Curve, v the angle around it
+__device__ inline bool curve_intersect_round_cone(int curve_id, const Ray & ray, float max_distance, float & t, float & u, float & v) {
+	float4 part_0 = __ldg(&curves[curve_id].part_0);
+	float4 part_1 = __ldg(&curves[curve_id].part_1);
+
+	float3 pa = make_float3(part_0.x, part_0.y, part_0.z);
+	float3 pb = make_float3(part_1.x, part_1.y, part_1.z);
+	float  ra = part_0.w;
+	float  rb = part_1.w;
+
+	float  direction_length_inv = rsqrtf(dot(ray.direction, ray.direction));
+	float3 rd = ray.direction * direction_length_inv;
+
+	float3 ba = pb - pa;
+	float3 oa = ray.origin - pa;
+	float3 ob = ray.origin - pb;
+	float  rr = ra - rb;
+
+	float m0 = dot(ba, ba);
+	if (m0 == 0.0f) return curve_intersect_sphere(pa, ra, ray, max_distance, t, u, v);
+
+	float m1 = dot(ba, oa);
+	float m2 = dot(ba, rd);
+	float m3 = dot(rd, oa);
+	float m5 = dot(oa, oa);
+	float m6 = dot(ob, rd);
+	float m7 = dot(ob, ob);
+
+	// Body
+	float d2 = m0 - rr*rr;
+	float k2 = d2    - m2*m2;
+	float k1 = d2*m3 - m1*m2 + m2*rr*ra;
+	float k0 = d2*m5 - m1*m1 + m1*rr*ra*2.0f - m0*ra*ra;
+
+	float h = k1*k1 - k0*k2;
+	if (h < 0.0f) return false;
+
+	float t_hit = (-sqrtf(h) - k1) / k2;
+	float y     = m1 - ra*rr + t_hit*m2;
+
+	if (!(y > 0.0f && y < d2)) {
+		// Caps
+		float h1 = m3*m3 - m5 + ra*ra;
+		float h2 = m6*m6 - m7 + rb*rb;
+
+		t_hit = INFINITY;
+		if (h1 > 0.0f) t_hit = -m3 - sqrtf(h1);
+		if (h2 > 0.0f) t_hit = fminf(t_hit, -m6 - sqrtf(h2));
+	}
+
+	t_hit *= direction_length_inv;
+	if (!(t_hit > 0.0f && t_hit < max_distance)) return false;
+
+	float3 hit_point = ray.origin + t_hit * ray.direction - pa;
+
+	float3 axis = ba * rsqrtf(m0);
+	float3 tangent, bitangent;
+	orthonormal_basis(axis, tangent, bitangent);
+
+	float phi = atan2f(dot(hit_point, bitangent), dot(hit_point, tangent));
+
+	t = t_hit;
+	u = __saturatef(dot(hit_point, ba) / m0);
+	v = phi * ONE_OVER_TWO_PI + 0.5f;
+
+	return true;
+}
+
+__device__ inline void curve_intersect(int mesh_id, int curve_id, const Ray & ray, RayHit & ray_hit) {
+	float t, u, v;
+	if (curve_intersect_round_cone(curve_id, ray, ray_hit.t, t, u, v)) {
+		ray_hit.t = t;
+		ray_hit.u = u;
+		ray_hit.v = v;
+		ray_hit.mesh_id     = mesh_id;
+		ray_hit.triangle_id = curve_id;
+	}
+}
+
+__device__ inline bool curve_intersect_shadow(int curve_id, const Ray & ray, float max_distance) {
+	float t, u, v;
+	return curve_intersect_round_cone(curve_id, ray, max_distance, t, u, v);
+}
+
+// Tangent plane of an analytic sphere at the spherical coordinates (u, v) of curve_intersect_sphere
+// The edges follow the polar angle and the azimuth, their cross product points outwards like the normal
+__device__ inline TrianglePosNorTex curve_get_tangent_triangle_sphere(float3 center, float radius, float u, float v) {
+	float2 sin_cos_theta = sincos(u * PI);
+	float2 sin_cos_phi   = sincos((v - 0.5f) * TWO_PI);
+
+	float3 normal = make_float3(sin_cos_theta.x * sin_cos_phi.y, sin_cos_theta.x * sin_cos_phi.x, sin_cos_theta.y);
+
+	float3 direction_theta = make_float3(sin_cos_theta.y * sin_cos_phi.y, sin_cos_theta.y * sin_cos_phi.x, -sin_cos_theta.x);
+	float3 direction_phi   = make_float3(-sin_cos_phi.x, sin_cos_phi.y, 0.0f);
+
+	TrianglePosNorTex triangle;
+
+	triangle.position_0      = center + radius * normal;
+	triangle.position_edge_1 = direction_theta * (PI     * radius);
+	triangle.position_edge_2 = direction_phi   * (TWO_PI * radius * fmaxf(sin_cos_theta.x, 1e-3f));
+
+	triangle.normal_0      = normal;
+	triangle.normal_edge_1 = make_float3(0.0f);
+	triangle.normal_edge_2 = make_float3(0.0f);
+
+	triangle.tex_coord_0      = make_float2(u, v);
+	triangle.tex_coord_edge_1 = make_float2(1.0f, 0.0f);
+	triangle.tex_coord_edge_2 = make_float2(0.0f, 1.0f);
+
+	return triangle;
+}
+
+// Describes the surface of a Curve around a hit as a Triangle, so that it can be shaded like one using barycentrics (0, 0)
+// The position is placed on the radius of the Curve at (u, v), the edges span the circumference and the axis
+// The normal is perpendicular to the axis, which ignores the slope of the cone, a good approximation for thin hair
+__device__ inline TrianglePosNorTex curve_get_tangent_triangle(int curve_id, float u, float v) {
+	float4 part_0 = __ldg(&curves[curve_id].part_0);
+	float4 part_1 = __ldg(&curves[curve_id].part_1);
+
+	float3 pa = make_float3(part_0.x, part_0.y, part_0.z);
+	float3 pb = make_float3(part_1.x, part_1.y, part_1.z);
+	float3 ba = pb - pa;
+
+	if (dot(ba, ba) == 0.0f) return curve_get_tangent_triangle_sphere(pa, part_0.w, u, v);
+
+	float3 axis = normalize(ba);
+	float3 tangent, bitangent;
+	orthonormal_basis(axis, tangent, bitangent);
+
+	float2 sin_cos_phi = sincos((v - 0.5f) * TWO_PI);
+	float3 normal      = sin_cos_phi.y * tangent + sin_cos_phi.x * bitangent;
+	float  radius      = lerp(part_0.w, part_1.w, u);
+
+	TrianglePosNorTex triangle;
+
+	triangle.position_0      = pa + u * ba + radius * normal;
+	triangle.position_edge_1 = cross(axis, normal) * (TWO_PI * fmaxf(fmaxf(part_0.w, part_1.w), 1e-6f));
+	triangle.position_edge_2 = ba;
+
+	triangle.normal_0      = normal;
+	triangle.normal_edge_1 = make_float3(0.0f);
+	triangle.normal_edge_2 = make_float3(0.0f);
+
+	triangle.tex_coord_0      = make_float2(u, v);
+	triangle.tex_coord_edge_1 = make_float2(0.0f, 1.0f);
+	triangle.tex_coord_edge_2 = make_float2(1.0f, 0.0f);
+
+	return triangle;
+}
+
+// Triangle or Curve data around a hit, the returned Triangle should be evaluated at barycentrics (u, v)
+__device__ inline TrianglePosNorTex hit_get_triangle(int mesh_id, int triangle_id, float & u, float & v) {
+	if (mesh_has_curves(mesh_id)) {
+		TrianglePosNorTex triangle = curve_get_tangent_triangle(triangle_id, u, v);
+		u = 0.0f;
+		v = 0.0f;
+		return triangle;
+	}
+	return triangle_get_positions_normals_and_tex_coords(triangle_id);
+}
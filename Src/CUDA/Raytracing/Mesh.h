@@ -24,7 +24,64 @@ __device__ inline void matrix3x4_transform_direction(const Matrix3x4 & matrix, f
 	);
 }
 
+__device__ inline Matrix3x4 matrix3x4_lerp(const Matrix3x4 & a, const Matrix3x4 & b, float t) {
+	Matrix3x4 matrix;
+	matrix.row_0 = lerp(a.row_0, b.row_0, t);
+	matrix.row_1 = lerp(a.row_1, b.row_1, t);
+	matrix.row_2 = lerp(a.row_2, b.row_2, t);
+
+	return matrix;
+}
+
+// Inverse of an affine Transform, the upper 3x3 part is inverted using its cofactors
+__device__ inline Matrix3x4 matrix3x4_inverse(const Matrix3x4 & m) {
+	float3 c0 = make_float3(
+		m.row_1.y * m.row_2.z - m.row_1.z * m.row_2.y,
+		m.row_0.z * m.row_2.y - m.row_0.y * m.row_2.z,
+		m.row_0.y * m.row_1.z - m.row_0.z * m.row_1.y
+	);
+	float3 c1 = make_float3(
+		m.row_1.z * m.row_2.x - m.row_1.x * m.row_2.z,
+		m.row_0.x * m.row_2.z - m.row_0.z * m.row_2.x,
+		m.row_0.z * m.row_1.x - m.row_0.x * m.row_1.z
+	);
+	float3 c2 = make_float3(
+		m.row_1.x * m.row_2.y - m.row_1.y * m.row_2.x,
+		m.row_0.y * m.row_2.x - m.row_0.x * m.row_2.y,
+		m.row_0.x * m.row_1.y - m.row_0.y * m.row_1.x
+	);
+
+	float det_inv = 1.0f / (m.row_0.x * c0.x + m.row_0.y * c1.x + m.row_0.z * c2.x);
+
+	c0 *= det_inv;
+	c1 *= det_inv;
+	c2 *= det_inv;
+
+	float3 translation = make_float3(m.row_0.w, m.row_1.w, m.row_2.w);
+
+	Matrix3x4 matrix;
+	matrix.row_0 = make_float4(c0.x, c0.y, c0.z, -dot(c0, translation));
+	matrix.row_1 = make_float4(c1.x, c1.y, c1.z, -dot(c1, translation));
+	matrix.row_2 = make_float4(c2.x, c2.y, c2.z, -dot(c2, translation));
+
+	return matrix;
+}
+
 __device__ __constant__ int * mesh_bvh_root_indices;
+
+// Bit 30 of the root index stores whether the Mesh moved since the previous frame, it is only set when motion blur is enabled
+__device__ inline bool mesh_has_motion(int mesh_id) {
+	return (unsigned(__ldg(&mesh_bvh_root_indices[mesh_id])) >> 30) & 1;
+}
+
+// Bits 27 and 28 of the root index store which kinds of Rays the Mesh is hidden from, one per MeshVisibility
+__device__ inline bool mesh_is_visible(int mesh_id, MeshVisibility visibility) {
+	return ((unsigned(__ldg(&mesh_bvh_root_indices[mesh_id])) >> (27 + int(visibility))) & 1) == 0;
+}
+// Per Mesh, index into lod_chains or INVALID if its MeshData has no levels of detail. Both nullptr if no MeshData has levels of detail
+__device__ __constant__ const int          * mesh_lod_chain_ids;
+__device__ __constant__ const MeshLODChain * lod_chains;
+
 __device__ __constant__ int * mesh_material_ids;
 
 __device__ inline int mesh_get_material_id(int index) {
@@ -62,6 +119,15 @@ __device__ inline Matrix3x4 mesh_get_transform_prev(int mesh_id) {
 	return matrix;
 }
 
+// Transform at the given time within the shutter interval (see camera_sample_time),
+// 0 corresponds to the Transform of the previous frame and 1 to that of the current frame
+__device__ inline Matrix3x4 mesh_get_transform(int mesh_id, float time) {
+	if (CONFIG_ENABLE_MOTION_BLUR && time < 1.0f && mesh_has_motion(mesh_id)) {
+		return matrix3x4_lerp(mesh_get_transform_prev(mesh_id), mesh_get_transform(mesh_id), time);
+	}
+	return mesh_get_transform(mesh_id);
+}
+
 __device__ inline float mesh_get_scale(int mesh_id) {
 	float3 row = make_float3(__ldg(&mesh_transforms[mesh_id].row_0));
 	return length(row);
@@ -1,16 +1,41 @@
 #pragma once
 #include "Raytracing/Ray.h"
 
+// Intersection data, accessed during traversal
 struct Triangle {
 	float4 part_0; // position_0       xyz and position_edge_1  x
 	float4 part_1; // position_edge_1   yz and position_edge_2  xy
-	float4 part_2; // position_edge_2    z and normal_0         xyz
-	float4 part_3; // normal_edge_1    xyz and normal_edge_2    x
-	float4 part_4; // normal_edge_2     yz and tex_coord_0      xy
-	float4 part_5; // tex_coord_edge_1 xy  and tex_coord_edge_2 xy
+	float4 part_2; // position_edge_2    z and the indices of the three TriangleVertices
 };
 
-__device__ __constant__ const Triangle * triangles;
+// Shading data, only accessed once a Triangle has been hit. Vertices are shared between the Triangles of a MeshData
+struct TriangleVertex {
+	uint4 data; // tex_coord xy, normal (oct encoded) and padding
+};
+
+__device__ __constant__ const Triangle       * triangles;
+__device__ __constant__ const TriangleVertex * triangle_vertices;
+
+__device__ inline float3 triangle_decode_normal(unsigned packed) {
+	return oct_decode_normal(make_float2(float(packed & 0xffff), float(packed >> 16)) * (1.0f / 65535.0f));
+}
+
+__device__ inline void triangle_get_vertices(float4 part_2, uint4 & vertex_0, uint4 & vertex_1, uint4 & vertex_2) {
+	vertex_0 = __ldg(&triangle_vertices[__float_as_int(part_2.y)].data);
+	vertex_1 = __ldg(&triangle_vertices[__float_as_int(part_2.z)].data);
+	vertex_2 = __ldg(&triangle_vertices[__float_as_int(part_2.w)].data);
+}
+
+__device__ inline void triangle_decode_normals(uint4 vertex_0, uint4 vertex_1, uint4 vertex_2, float3 & normal_0, float3 & normal_edge_1, float3 & normal_edge_2) {
+	normal_0 = triangle_decode_normal(vertex_0.z);
+
+	normal_edge_1 = triangle_decode_normal(vertex_1.z) - normal_0;
+	normal_edge_2 = triangle_decode_normal(vertex_2.z) - normal_0;
+}
+
+__device__ inline float2 triangle_decode_tex_coord(uint4 vertex) {
+	return make_float2(__uint_as_float(vertex.x), __uint_as_float(vertex.y));
+}
 
 struct TrianglePos {
 	float3 position_0;
@@ -46,8 +71,9 @@ __device__ inline TrianglePosNor triangle_get_positions_and_normals(int index) {
 	float4 part_0 = __ldg(&triangles[index].part_0);
 	float4 part_1 = __ldg(&triangles[index].part_1);
 	float4 part_2 = __ldg(&triangles[index].part_2);
-	float4 part_3 = __ldg(&triangles[index].part_3);
-	float4 part_4 = __ldg(&triangles[index].part_4);
+
+	uint4 vertex_0, vertex_1, vertex_2;
+	triangle_get_vertices(part_2, vertex_0, vertex_1, vertex_2);
 
 	TrianglePosNor triangle;
 
@@ -55,9 +81,7 @@ __device__ inline TrianglePosNor triangle_get_positions_and_normals(int index) {
 	triangle.position_edge_1 = make_float3(part_0.w, part_1.x, part_1.y);
 	triangle.position_edge_2 = make_float3(part_1.z, part_1.w, part_2.x);
 
-	triangle.normal_0      = make_float3(part_2.y, part_2.z, part_2.w);
-	triangle.normal_edge_1 = make_float3(part_3.x, part_3.y, part_3.z);
-	triangle.normal_edge_2 = make_float3(part_3.w, part_4.x, part_4.y);
+	triangle_decode_normals(vertex_0, vertex_1, vertex_2, triangle.normal_0, triangle.normal_edge_1, triangle.normal_edge_2);
 
 	return triangle;
 };
@@ -80,9 +104,9 @@ __device__ inline TrianglePosNorTex triangle_get_positions_normals_and_tex_coord
 	float4 part_0 = __ldg(&triangles[index].part_0);
 	float4 part_1 = __ldg(&triangles[index].part_1);
 	float4 part_2 = __ldg(&triangles[index].part_2);
-	float4 part_3 = __ldg(&triangles[index].part_3);
-	float4 part_4 = __ldg(&triangles[index].part_4);
-	float4 part_5 = __ldg(&triangles[index].part_5);
+
+	uint4 vertex_0, vertex_1, vertex_2;
+	triangle_get_vertices(part_2, vertex_0, vertex_1, vertex_2);
 
 	TrianglePosNorTex triangle;
 
@@ -90,13 +114,11 @@ __device__ inline TrianglePosNorTex triangle_get_positions_normals_and_tex_coord
 	triangle.position_edge_1 = make_float3(part_0.w, part_1.x, part_1.y);
 	triangle.position_edge_2 = make_float3(part_1.z, part_1.w, part_2.x);
 
-	triangle.normal_0      = make_float3(part_2.y, part_2.z, part_2.w);
-	triangle.normal_edge_1 = make_float3(part_3.x, part_3.y, part_3.z);
-	triangle.normal_edge_2 = make_float3(part_3.w, part_4.x, part_4.y);
+	triangle_decode_normals(vertex_0, vertex_1, vertex_2, triangle.normal_0, triangle.normal_edge_1, triangle.normal_edge_2);
 
-	triangle.tex_coord_0      = make_float2(part_4.z, part_4.w);
-	triangle.tex_coord_edge_1 = make_float2(part_5.x, part_5.y);
-	triangle.tex_coord_edge_2 = make_float2(part_5.z, part_5.w);
+	triangle.tex_coord_0      = triangle_decode_tex_coord(vertex_0);
+	triangle.tex_coord_edge_1 = triangle_decode_tex_coord(vertex_1) - triangle.tex_coord_0;
+	triangle.tex_coord_edge_2 = triangle_decode_tex_coord(vertex_2) - triangle.tex_coord_0;
 
 	return triangle;
 }
@@ -145,6 +167,79 @@ __device__ inline void triangle_barycentric(const TrianglePosNorTex & triangle,
 	tex_coord = barycentric(u, v, triangle.tex_coord_0, triangle.tex_coord_edge_1, triangle.tex_coord_edge_2);
 }
 
+// Alpha masks store 1 bit per texel, set where the alpha Texture of a Material is opaque (see kernel_alpha_mask_build)
+// Every Triangle additionally has a 2 bit state that is precomputed from the texels its texture coordinates cover (see kernel_alpha_mask_classify),
+// like an Opacity Micromap with a single micro Triangle. Only Triangles that are partially cut out need to look up the mask on a hit
+enum struct AlphaState : unsigned {
+	UNKNOWN,
+	OPAQUE,
+	TRANSPARENT
+};
+
+struct AlphaMask {
+	int width;
+	int height;
+	int offset; // Into alpha_mask_bits, in words
+	int padding;
+};
+
+__device__ __constant__ const AlphaMask * alpha_masks;
+__device__ __constant__ const unsigned  * alpha_mask_bits;
+__device__ __constant__ const unsigned  * alpha_mask_triangle_states; // Per aggregated Triangle, 16 per word
+__device__ __constant__ const int       * mesh_alpha_mask_ids;        // Per Mesh, INVALID if opaque. nullptr if the Scene has no alpha masks
+
+__device__ inline AlphaMask alpha_mask_get(int mask_id) {
+	int4 data = __ldg(reinterpret_cast<const int4 *>(&alpha_masks[mask_id]));
+
+	AlphaMask mask;
+	mask.width  = data.x;
+	mask.height = data.y;
+	mask.offset = data.z;
+	return mask;
+}
+
+// The mask repeats like the Textures do
+__device__ inline bool alpha_mask_is_opaque(const AlphaMask & mask, int x, int y) {
+	x %= mask.width;
+	y %= mask.height;
+	if (x < 0) x += mask.width;
+	if (y < 0) y += mask.height;
+
+	int texel_index = x + y * mask.width;
+	return (__ldg(&alpha_mask_bits[mask.offset + texel_index / 32]) >> (texel_index % 32)) & 1;
+}
+
+__device__ inline AlphaState triangle_get_alpha_state(int triangle_id) {
+	unsigned word = __ldg(&alpha_mask_triangle_states[triangle_id / 16]);
+	return AlphaState((word >> (2 * (triangle_id % 16))) & 3);
+}
+
+// Returns false if the hit at barycentric coordinates u, v lies in a region that the alpha mask of the Mesh cuts out
+__device__ inline bool triangle_alpha_test(int mesh_id, int triangle_id, float u, float v) {
+	if (mesh_alpha_mask_ids == nullptr) return true;
+
+	int mask_id = __ldg(&mesh_alpha_mask_ids[mesh_id]);
+	if (mask_id == INVALID) return true;
+
+	if (mask_id & ALPHA_MASK_CLASSIFIED) {
+		AlphaState state = triangle_get_alpha_state(triangle_id);
+		if (state == AlphaState::OPAQUE)      return true;
+		if (state == AlphaState::TRANSPARENT) return false;
+
+		mask_id &= ~ALPHA_MASK_CLASSIFIED;
+	}
+
+	uint4 vertex_0, vertex_1, vertex_2;
+	triangle_get_vertices(__ldg(&triangles[triangle_id].part_2), vertex_0, vertex_1, vertex_2);
+
+	float2 tex_coord_0 = triangle_decode_tex_coord(vertex_0);
+	float2 tex_coord   = barycentric(u, v, tex_coord_0, triangle_decode_tex_coord(vertex_1) - tex_coord_0, triangle_decode_tex_coord(vertex_2) - tex_coord_0);
+
+	AlphaMask mask = alpha_mask_get(mask_id);
+
+	return alpha_mask_is_opaque(mask, int(floorf(tex_coord.x * float(mask.width))), int(floorf(tex_coord.y * float(mask.height))));
+}
+
 __device__ inline void triangle_intersect(int mesh_id, int triangle_id, const Ray & ray, RayHit & ray_hit) {
 	TrianglePos triangle = triangle_get_positions(triangle_id);
 
@@ -162,7 +257,7 @@ __device__ inline void triangle_intersect(int mesh_id, int triangle_id, const Ra
 		if (v >= 0.0f && u + v <= 1.0f) {
 			float t = f * dot(triangle.position_edge_2, q);
 
-			if (t > 0.0f && t < ray_hit.t) {
+			if (t > 0.0f && t < ray_hit.t && triangle_alpha_test(mesh_id, triangle_id, u, v)) {
 				ray_hit.t = t;
 				ray_hit.u = u;
 				ray_hit.v = v;
@@ -173,7 +268,8 @@ __device__ inline void triangle_intersect(int mesh_id, int triangle_id, const Ra
 	}
 }
 
-__device__ inline bool triangle_intersect_shadow(int triangle_id, const Ray & ray, float max_distance) {
+// Any opaque hit occludes the shadow Ray, Triangles that are classified as opaque are accepted without looking up the alpha mask
+__device__ inline bool triangle_intersect_shadow(int mesh_id, int triangle_id, const Ray & ray, float max_distance) {
 	TrianglePos triangle = triangle_get_positions(triangle_id);
 
 	float3 h = cross(ray.direction, triangle.position_edge_2);
@@ -190,7 +286,7 @@ __device__ inline bool triangle_intersect_shadow(int triangle_id, const Ray & ra
 		if (v >= 0.0f && u + v <= 1.0f) {
 			float t = f * dot(triangle.position_edge_2, q);
 
-			if (t > 0.0f && t < max_distance) return true;
+			if (t > 0.0f && t < max_distance) return triangle_alpha_test(mesh_id, triangle_id, u, v);
 		}
 	}
 
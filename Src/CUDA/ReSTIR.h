@@ -0,0 +1,62 @@
+#pragma once
+#include "Util.h"
+#include "Config.h"
+#include "Sampling.h"
+
+// ReSTIR DI (Bitterli et al. 2020), replaces Next Event Estimation towards light Triangles on the primary hit
+// Every Pixel resamples a number of light candidates into a Reservoir, which is combined with the Reservoirs of the previous frame
+// at the reprojected Pixel (temporal reuse) and around it (spatial reuse). Only the selected sample is traced as a shadow Ray
+struct Reservoir {
+	int    light_mesh_id;
+	int    light_triangle_id; // INVALID if the Reservoir holds no sample
+	float2 light_uv;
+
+	float weight_sum;
+	float M; // Number of candidates the Reservoir represents
+	float W; // Contribution weight of the selected sample
+
+	// Primary hit the Reservoir was built at, used to reject reuse across different surfaces
+	int      surface_mesh_id;
+	float    surface_depth;
+	unsigned surface_normal; // See oct_encode_unorm16
+};
+
+// Two sets of screen_pitch * screen_height Reservoirs, frames alternate between them so that the previous frame can be read while writing the current one
+__device__ __constant__ Reservoir * restir_reservoirs;
+
+__device__ inline bool restir_enabled() {
+	return config.enable_restir && lights_total_weight > 0.0f;
+}
+
+__device__ inline Reservoir * restir_get_reservoirs(int sample_index) {
+	return restir_reservoirs + (sample_index & 1) * (screen_pitch * screen_height);
+}
+
+__device__ inline Reservoir reservoir_empty() {
+	Reservoir reservoir = { };
+	reservoir.light_mesh_id     = INVALID;
+	reservoir.light_triangle_id = INVALID;
+	reservoir.surface_mesh_id   = INVALID;
+	return reservoir;
+}
+
+// Streaming weighted reservoir sampling, returns true if the new sample replaces the current one
+__device__ inline bool reservoir_update(Reservoir & reservoir, float weight, float M, float u) {
+	reservoir.weight_sum += weight;
+	reservoir.M          += M;
+
+	return weight > 0.0f && u * reservoir.weight_sum <= weight;
+}
+
+// A Reservoir from another Pixel or frame is only reused if it was built on a similar surface
+__device__ inline bool reservoir_is_consistent(const Reservoir & reservoir, int mesh_id, float depth, float3 normal) {
+	if (reservoir.light_triangle_id == INVALID || reservoir.surface_mesh_id != mesh_id) return false;
+
+	const float THRESHOLD_NORMAL = 0.9f;
+	const float THRESHOLD_DEPTH  = 0.1f;
+
+	bool consistent_normal = dot(normal, oct_decode_unorm16(reservoir.surface_normal)) > THRESHOLD_NORMAL;
+	bool consistent_depth  = fabsf(depth - reservoir.surface_depth) < THRESHOLD_DEPTH * depth;
+
+	return consistent_normal && consistent_depth;
+}
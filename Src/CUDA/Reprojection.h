@@ -0,0 +1,86 @@
+#pragma once
+#include "Util.h"
+#include "Config.h"
+#include "AOV.h"
+
+#include "SVGF/GBuffer.h"
+
+// Reprojection of the accumulated radiance when the Camera moves without SVGF, see GPUConfig::enable_reprojection
+// kernel_reproject gathers the history of every Pixel at the position its primary hit had in the previous frame,
+// the history is only valid if that Pixel saw the same Triangle at a similar depth. kernel_accumulate then continues
+// accumulating on top of the reprojected history with a sample count per Pixel, instead of the frame count
+__device__ __constant__ float4 * reprojection_radiance;      // Per Pixel, reprojected average radiance (xyz) and its sample count (w), only written when the Camera moved
+__device__ __constant__ float  * reprojection_sample_counts; // Per Pixel, number of samples in the radiance accumulator. nullptr if not reprojecting
+__device__ __constant__ int4   * reprojection_history;       // Per Pixel (mesh_id, triangle_id, depth, -) of the primary hit of the previous frame, mesh_id is INVALID for the Sky
+
+__device__ inline bool reprojection_is_consistent(int4 history, int2 mesh_id_and_triangle_id, float depth_prev) {
+	const float THRESHOLD_DEPTH = 0.02f; // Relative
+
+	if (history.x != mesh_id_and_triangle_id.x || history.y != mesh_id_and_triangle_id.y) return false;
+
+	return fabsf(__int_as_float(history.z) - depth_prev) < THRESHOLD_DEPTH * fabsf(depth_prev);
+}
+
+// One thread per Pixel, runs after the GBuffers of the current frame have been written and before kernel_accumulate
+// The nearest Pixel is taken rather than a bilinear footprint, so that the history does not blur over repeated moves
+extern "C" __global__ void kernel_reproject() {
+	int x = blockIdx.x * blockDim.x + threadIdx.x;
+	int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+	if (x >= screen_width || y >= screen_height) return;
+
+	int pixel_index = x + y * screen_pitch;
+
+	float4 normal_and_depth        = gbuffer_normal_and_depth       .get(x, y);
+	int2   mesh_id_and_triangle_id = gbuffer_mesh_id_and_triangle_id.get(x, y);
+	float2 screen_position_prev    = gbuffer_screen_position_prev   .get(x, y);
+
+	float4 reprojected = make_float4(0.0f);
+
+	// Pixels that see the Sky start over
+	if (normal_and_depth.z != 0.0f) {
+		int x_prev = int(floorf((0.5f + 0.5f * screen_position_prev.x) * float(screen_width)));
+		int y_prev = int(floorf((0.5f + 0.5f * screen_position_prev.y) * float(screen_height)));
+
+		if (x_prev >= 0 && x_prev < screen_width && y_prev >= 0 && y_prev < screen_height) {
+			int pixel_index_prev = x_prev + y_prev * screen_pitch;
+
+			if (reprojection_is_consistent(reprojection_history[pixel_index_prev], mesh_id_and_triangle_id, normal_and_depth.w)) {
+				float4 radiance_prev = get_aov(AOVType::RADIANCE).accumulator[pixel_index_prev];
+
+				float sample_count = fminf(reprojection_sample_counts[pixel_index_prev], float(config.reprojection_max_samples));
+
+				reprojected = make_float4(radiance_prev.x, radiance_prev.y, radiance_prev.z, sample_count);
+			}
+		}
+	}
+
+	reprojection_radiance[pixel_index] = reprojected;
+}
+
+// Called by kernel_accumulate before the new samples are added, returns the number of samples already in the radiance accumulator
+// If the Camera moved the accumulator is first replaced by the reprojected history of the Pixel
+__device__ inline float reprojection_begin(int pixel_index, float frames_accumulated, bool reprojected) {
+	if (reprojected) {
+		float4 history = reprojection_radiance[pixel_index];
+
+		get_aov(AOVType::RADIANCE).accumulator[pixel_index] = make_float4(history.x, history.y, history.z, 1.0f);
+		return history.w;
+	}
+	return frames_accumulated > 0.0f ? reprojection_sample_counts[pixel_index] : 0.0f;
+}
+
+// Called by kernel_accumulate after the new samples are added, stores the primary hit as the history of the next frame
+__device__ inline void reprojection_end(int x, int y, int pixel_index, float sample_count) {
+	float4 normal_and_depth        = gbuffer_normal_and_depth       .get(x, y);
+	int2   mesh_id_and_triangle_id = gbuffer_mesh_id_and_triangle_id.get(x, y);
+
+	reprojection_sample_counts[pixel_index] = sample_count;
+	reprojection_history      [pixel_index] = normal_and_depth.z != 0.0f
+		? make_int4(mesh_id_and_triangle_id.x, mesh_id_and_triangle_id.y, __float_as_int(normal_and_depth.z), 0)
+		: make_int4(INVALID);
+
+	// Pixels whose primary Ray misses do not write the GBuffers, clear them so the next frame sees the Sky there
+	gbuffer_normal_and_depth       .set(x, y, make_float4(0.0f));
+	gbuffer_mesh_id_and_triangle_id.set(x, y, make_int2(0));
+}
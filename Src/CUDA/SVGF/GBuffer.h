@@ -0,0 +1,66 @@
+#pragma once
+
+// GBuffers of the primary hits, written by the Pathtracer Module and read by the SVGF, TAA and upscale Kernels of the Denoise Module
+// Both Modules declare these, the host sets them to the same Surfaces (see Integrator::get_global_shared)
+__device__ __constant__ Surface<float4> gbuffer_normal_and_depth;
+__device__ __constant__ Surface<int2>   gbuffer_mesh_id_and_triangle_id;
+__device__ __constant__ Surface<float2> gbuffer_screen_position_prev;
+
+struct Matrix4x4 {
+	float4 row_0;
+	float4 row_1;
+	float4 row_2;
+	float4 row_3;
+};
+
+__device__ inline void matrix4x4_transform(const Matrix4x4 & matrix, float4 & position) {
+	position = make_float4(
+		matrix.row_0.x * position.x + matrix.row_0.y * position.y + matrix.row_0.z * position.z + matrix.row_0.w * position.w,
+		matrix.row_1.x * position.x + matrix.row_1.y * position.y + matrix.row_1.z * position.z + matrix.row_1.w * position.w,
+		matrix.row_2.x * position.x + matrix.row_2.y * position.y + matrix.row_2.z * position.z + matrix.row_2.w * position.w,
+		matrix.row_3.x * position.x + matrix.row_3.y * position.y + matrix.row_3.z * position.z + matrix.row_3.w * position.w
+	);
+}
+
+struct SVGFData {
+	Matrix4x4 view_projection;
+	Matrix4x4 view_projection_prev;
+};
+
+__device__ __constant__ SVGFData svgf_data;
+
+__device__ inline SVGFData svgf_get_data() {
+	SVGFData data;
+	data.view_projection     .row_0 = __ldg(&svgf_data.view_projection     .row_0);
+	data.view_projection     .row_1 = __ldg(&svgf_data.view_projection     .row_1);
+	data.view_projection     .row_2 = __ldg(&svgf_data.view_projection     .row_2);
+	data.view_projection     .row_3 = __ldg(&svgf_data.view_projection     .row_3);
+	data.view_projection_prev.row_0 = __ldg(&svgf_data.view_projection_prev.row_0);
+	data.view_projection_prev.row_1 = __ldg(&svgf_data.view_projection_prev.row_1);
+	data.view_projection_prev.row_2 = __ldg(&svgf_data.view_projection_prev.row_2);
+	data.view_projection_prev.row_3 = __ldg(&svgf_data.view_projection_prev.row_3);
+
+	return data;
+}
+
+__device__ inline void svgf_set_gbuffers(int x, int y, const RayHit & hit, float3 hit_point, float3 hit_normal, float3 hit_point_prev) {
+	float4 projected_hit_point      = make_float4(hit_point,      1.0f);
+	float4 projected_hit_point_prev = make_float4(hit_point_prev, 1.0f);
+
+	SVGFData svgf_data = svgf_get_data();
+
+	matrix4x4_transform(svgf_data.view_projection,      projected_hit_point);
+	matrix4x4_transform(svgf_data.view_projection_prev, projected_hit_point_prev);
+
+	float depth      = projected_hit_point     .z;
+	float depth_prev = projected_hit_point_prev.z;
+
+	float2 normal_oct = oct_encode_normal(hit_normal);
+
+	gbuffer_normal_and_depth       .set(x, y, make_float4(normal_oct.x, normal_oct.y, depth, depth_prev));
+	gbuffer_mesh_id_and_triangle_id.set(x, y, make_int2(hit.mesh_id, hit.triangle_id));
+	gbuffer_screen_position_prev   .set(x, y, make_float2(
+		projected_hit_point_prev.x / projected_hit_point_prev.w,
+		projected_hit_point_prev.y / projected_hit_point_prev.w
+	));
+}
@@ -1,90 +1,102 @@
 #pragma once
 #include "AOV.h"
 
+// Spatiotemporal Variance-Guided Filtering, compiled into the Denoise Module. The GBuffers it reads are written by the Pathtracer Module
+
 #define epsilon 1e-8f // To avoid division by 0
 
-__device__ __constant__ float4 * frame_buffer_moment;
+#define HALF_MAX 65504.0f
 
-extern __device__ __constant__ Surface<float4> accumulator;
+// Stores a float4 per Pixel, if config.enable_compact_history is set the values are stored as half4 (packed in a uint2)
+// The host allocates either sizeof(float4) or sizeof(uint2) bytes per Pixel accordingly
+struct HistoryBuffer {
+	void * data;
 
-extern __device__ __constant__ float4 * taa_frame_curr;
+	__device__ inline float4 get(int index) const {
+		if (config.enable_compact_history) {
+			uint2 packed = static_cast<const uint2 *>(data)[index];
 
-// GBuffers
-__device__ __constant__ Surface<float4> gbuffer_normal_and_depth;
-__device__ __constant__ Surface<int2>   gbuffer_mesh_id_and_triangle_id;
-__device__ __constant__ Surface<float2> gbuffer_screen_position_prev;
+			float2 xy = half2_to_float2(packed.x);
+			float2 zw = half2_to_float2(packed.y);
 
-// SVGF History Buffers (Temporally Integrated)
-__device__ __constant__ int    * history_length;
-__device__ __constant__ float4 * history_direct;
-__device__ __constant__ float4 * history_indirect;
-__device__ __constant__ float4 * history_moment;
-__device__ __constant__ float4 * history_normal_and_depth;
-
-struct Matrix4x4 {
-	float4 row_0;
-	float4 row_1;
-	float4 row_2;
-	float4 row_3;
-};
+			return make_float4(xy.x, xy.y, zw.x, zw.y);
+		} else {
+			return static_cast<const float4 *>(data)[index];
+		}
+	}
 
-__device__ inline void matrix4x4_transform(const Matrix4x4 & matrix, float4 & position) {
-	position = make_float4(
-		matrix.row_0.x * position.x + matrix.row_0.y * position.y + matrix.row_0.z * position.z + matrix.row_0.w * position.w,
-		matrix.row_1.x * position.x + matrix.row_1.y * position.y + matrix.row_1.z * position.z + matrix.row_1.w * position.w,
-		matrix.row_2.x * position.x + matrix.row_2.y * position.y + matrix.row_2.z * position.z + matrix.row_2.w * position.w,
-		matrix.row_3.x * position.x + matrix.row_3.y * position.y + matrix.row_3.z * position.z + matrix.row_3.w * position.w
-	);
-}
+	__device__ inline void set(int index, float4 value) {
+		if (config.enable_compact_history) {
+			// Clamp to avoid overflowing to infinity
+			value = fminf(value, make_float4(HALF_MAX));
 
-struct SVGFData {
-	Matrix4x4 view_projection;
-	Matrix4x4 view_projection_prev;
+			static_cast<uint2 *>(data)[index] = make_uint2(
+				float2_to_half2(make_float2(value.x, value.y)),
+				float2_to_half2(make_float2(value.z, value.w))
+			);
+		} else {
+			static_cast<float4 *>(data)[index] = value;
+		}
+	}
 };
 
-__device__ __constant__ SVGFData svgf_data;
+// Stores the oct encoded normal (xy) and depth (zw) per Pixel
+// In compact mode the normal is stored as two 16 bit unorms and the depths as halfs
+struct HistoryNormalAndDepthBuffer {
+	void * data;
 
-__device__ inline SVGFData svgf_get_data() {
-	SVGFData data;
-	data.view_projection     .row_0 = __ldg(&svgf_data.view_projection     .row_0);
-	data.view_projection     .row_1 = __ldg(&svgf_data.view_projection     .row_1);
-	data.view_projection     .row_2 = __ldg(&svgf_data.view_projection     .row_2);
-	data.view_projection     .row_3 = __ldg(&svgf_data.view_projection     .row_3);
-	data.view_projection_prev.row_0 = __ldg(&svgf_data.view_projection_prev.row_0);
-	data.view_projection_prev.row_1 = __ldg(&svgf_data.view_projection_prev.row_1);
-	data.view_projection_prev.row_2 = __ldg(&svgf_data.view_projection_prev.row_2);
-	data.view_projection_prev.row_3 = __ldg(&svgf_data.view_projection_prev.row_3);
+	__device__ inline float4 get(int index) const {
+		if (config.enable_compact_history) {
+			uint2 packed = static_cast<const uint2 *>(data)[index];
 
-	return data;
-}
+			float2 normal = make_float2(float(packed.x & 0xffff), float(packed.x >> 16)) * (1.0f / 65535.0f);
+			float2 depth  = half2_to_float2(packed.y);
 
-__device__ inline void svgf_set_gbuffers(int x, int y, const RayHit & hit, float3 hit_point, float3 hit_normal, float3 hit_point_prev) {
-	float4 projected_hit_point      = make_float4(hit_point,      1.0f);
-	float4 projected_hit_point_prev = make_float4(hit_point_prev, 1.0f);
+			return make_float4(normal.x, normal.y, depth.x, depth.y);
+		} else {
+			return static_cast<const float4 *>(data)[index];
+		}
+	}
 
-	SVGFData svgf_data = svgf_get_data();
+	__device__ inline void set(int index, float4 value) {
+		if (config.enable_compact_history) {
+			unsigned normal_x = unsigned(__saturatef(value.x) * 65535.0f + 0.5f);
+			unsigned normal_y = unsigned(__saturatef(value.y) * 65535.0f + 0.5f);
 
-	matrix4x4_transform(svgf_data.view_projection,      projected_hit_point);
-	matrix4x4_transform(svgf_data.view_projection_prev, projected_hit_point_prev);
+			static_cast<uint2 *>(data)[index] = make_uint2(
+				normal_x | (normal_y << 16),
+				float2_to_half2(make_float2(fminf(value.z, HALF_MAX), fminf(value.w, HALF_MAX)))
+			);
+		} else {
+			static_cast<float4 *>(data)[index] = value;
+		}
+	}
+};
+
+__device__ __constant__ float4 * frame_buffer_moment;
 
-	float depth      = projected_hit_point     .z;
-	float depth_prev = projected_hit_point_prev.z;
+extern __device__ __constant__ Surface<float4> accumulator;
 
-	float2 normal_oct = oct_encode_normal(hit_normal);
+extern __device__ __constant__ HistoryBuffer taa_frame_curr;
 
-	gbuffer_normal_and_depth       .set(x, y, make_float4(normal_oct.x, normal_oct.y, depth, depth_prev));
-	gbuffer_mesh_id_and_triangle_id.set(x, y, make_int2(hit.mesh_id, hit.triangle_id));
-	gbuffer_screen_position_prev   .set(x, y, make_float2(
-		projected_hit_point_prev.x / projected_hit_point_prev.w,
-		projected_hit_point_prev.y / projected_hit_point_prev.w
-	));
-}
+// SVGF History Buffers (Temporally Integrated)
+__device__ __constant__ int    * history_length;
+__device__ __constant__ HistoryBuffer               history_direct;
+__device__ __constant__ HistoryBuffer               history_indirect;
+__device__ __constant__ float4                    * history_moment; // Always full precision, the Variance is the difference of the two moments
+__device__ __constant__ HistoryNormalAndDepthBuffer history_normal_and_depth;
+
+// Tiles of SVGF_TILE_SIZE x SVGF_TILE_SIZE Pixels that still need the A-Trous filter, see kernel_svgf_classify
+// Only used if config.enable_svgf_tile_skip is set, otherwise every tile is filtered
+__device__ __constant__ int * svgf_tile_list;   // Tile indices, svgf_tile_count of them. The tiled Kernel is launched over all tiles and its Blocks pick from this list
+__device__ __constant__ int * svgf_tile_count;
+__device__ __constant__ int * svgf_tile_active; // Per tile, 1 if the tile is in svgf_tile_list
 
 __device__ inline bool is_tap_consistent(int x, int y, float3 normal, float depth) {
 	if (x < 0 || x >= screen_width)  return false;
 	if (y < 0 || y >= screen_height) return false;
 
-	float4 prev_normal_and_depth = history_normal_and_depth[x + y * screen_pitch];
+	float4 prev_normal_and_depth = history_normal_and_depth.get(x + y * screen_pitch);
 	float3 prev_normal = oct_decode_normal(make_float2(prev_normal_and_depth.x, prev_normal_and_depth.y));
 	float  prev_depth  = prev_normal_and_depth.z;
 
@@ -214,8 +226,8 @@ extern "C" __global__ void kernel_svgf_reproject(int sample_index) {
 					int tap_y = y_prev + j;
 					int tap_index = tap_x + tap_y * screen_pitch;
 
-					float4 tap_direct   = history_direct  [tap_index];
-					float4 tap_indirect = history_indirect[tap_index];
+					float4 tap_direct   = history_direct  .get(tap_index);
+					float4 tap_indirect = history_indirect.get(tap_index);
 					float4 tap_moment   = history_moment  [tap_index];
 
 					prev_direct   += weights[tap] * tap_direct;
@@ -234,8 +246,8 @@ extern "C" __global__ void kernel_svgf_reproject(int sample_index) {
 				if (is_tap_consistent(tap_x, tap_y, normal, depth_prev)) {
 					int tap_index = tap_x + tap_y * screen_pitch;
 
-					prev_direct   += history_direct  [tap_index];
-					prev_indirect += history_indirect[tap_index];
+					prev_direct   += history_direct  .get(tap_index);
+					prev_indirect += history_indirect.get(tap_index);
 					prev_moment   += history_moment  [tap_index];
 
 					consistent_weights_sum += 1.0f;
@@ -413,23 +425,28 @@ extern "C" __global__ void kernel_svgf_variance(
 // Can be used to balance between temporal stability and bias from spatial filtering
 const int feedback_iteration = 1;
 
-extern "C" __global__ void kernel_svgf_atrous(
-	float4 const * colour_direct_in,
-	float4 const * colour_indirect_in,
-	float4       * colour_direct_out,
-	float4       * colour_indirect_out,
-	int step_size
+// Performs one A-Trous iteration for the Pixel at (x, y)
+// The Taps are obtained through load_tap(tap_x, tap_y, colour_direct, colour_indirect, normal, depth),
+// which allows the same filter to read either from global memory or from a tile in shared memory
+template<typename LoadTap>
+__device__ inline void svgf_atrous(
+	int x,
+	int y,
+	int step_size,
+	LoadTap load_tap,
+	float4 * colour_direct_out,
+	float4 * colour_indirect_out
 ) {
-	int x = blockIdx.x * blockDim.x + threadIdx.x;
-	int y = blockIdx.y * blockDim.y + threadIdx.y;
-
-	if (x >= screen_width || y >= screen_height) return;
-
 	int pixel_index = x + y * screen_pitch;
 
 	float variance_blurred_direct   = 0.0f;
 	float variance_blurred_indirect = 0.0f;
 
+	float4 colour_direct;
+	float4 colour_indirect;
+	float3 normal;
+	float  depth;
+
 	// Filter Variance using a 3x3 Gaussian Blur
 	for (int j = -1; j <= 1; j++) {
 		int tap_y = clamp(y + j, 0, screen_height - 1);
@@ -439,8 +456,7 @@ extern "C" __global__ void kernel_svgf_atrous(
 
 			// Read the Variance of Direct/Indirect Illumination
 			// The Variance is stored in the alpha channel (w coordinate)
-			float variance_direct   = colour_direct_in  [tap_x + tap_y * screen_pitch].w;
-			float variance_indirect = colour_indirect_in[tap_x + tap_y * screen_pitch].w;
+			load_tap(tap_x, tap_y, colour_direct, colour_indirect, normal, depth);
 
 			// Gaussian kernel weights:
 			// 1/16  1/8  1/16
@@ -448,8 +464,8 @@ extern "C" __global__ void kernel_svgf_atrous(
 			// 1/16  1/8  1/16
 			float kernel_weight = scalbnf(0.25f, -(abs(i) + abs(j)));
 
-			variance_blurred_direct   += variance_direct   * kernel_weight;
-			variance_blurred_indirect += variance_indirect * kernel_weight;
+			variance_blurred_direct   += colour_direct  .w * kernel_weight;
+			variance_blurred_indirect += colour_indirect.w * kernel_weight;
 		}
 	}
 
@@ -457,23 +473,26 @@ extern "C" __global__ void kernel_svgf_atrous(
 	float luminance_denom_direct   = rsqrtf(config.sigma_l * config.sigma_l * fmaxf(0.0f, variance_blurred_direct)   + epsilon);
 	float luminance_denom_indirect = rsqrtf(config.sigma_l * config.sigma_l * fmaxf(0.0f, variance_blurred_indirect) + epsilon);
 
-	float4 center_colour_direct   = colour_direct_in  [pixel_index];
-	float4 center_colour_indirect = colour_indirect_in[pixel_index];
+	float4 center_colour_direct;
+	float4 center_colour_indirect;
+	float3 center_normal;
+	float  center_depth;
+	load_tap(x, y, center_colour_direct, center_colour_indirect, center_normal, center_depth);
 
 	float center_luminance_direct   = luminance(center_colour_direct.x,   center_colour_direct.y,   center_colour_direct.z);
 	float center_luminance_indirect = luminance(center_colour_indirect.x, center_colour_indirect.y, center_colour_indirect.z);
 
-	float4 center_normal_and_depth = gbuffer_normal_and_depth.get(x, y);
-
-	float3 center_normal = oct_decode_normal(make_float2(center_normal_and_depth.x, center_normal_and_depth.y));
-	float  center_depth  = center_normal_and_depth.z;
-
 	// Check if the pixel belongs to the Skybox
 	if (center_depth == 0.0f) return;
 
+	float depth_right;
+	float depth_down;
+	load_tap(min(x + 1, screen_width  - 1), y, colour_direct, colour_indirect, normal, depth_right);
+	load_tap(x, min(y + 1, screen_height - 1), colour_direct, colour_indirect, normal, depth_down);
+
 	float2 center_depth_gradient = make_float2(
-		gbuffer_normal_and_depth.get(x + 1, y    ).z - center_depth,
-		gbuffer_normal_and_depth.get(x,     y + 1).z - center_depth
+		depth_right - center_depth,
+		depth_down  - center_depth
 	);
 
 	float  sum_weight_direct   = 1.0f;
@@ -496,17 +515,11 @@ extern "C" __global__ void kernel_svgf_atrous(
 
 			if (i == 0 && j == 0) continue; // Center pixel is treated separately
 
-			float4 colour_direct   = colour_direct_in  [tap_x + tap_y * screen_pitch];
-			float4 colour_indirect = colour_indirect_in[tap_x + tap_y * screen_pitch];
+			load_tap(tap_x, tap_y, colour_direct, colour_indirect, normal, depth);
 
 			float luminance_direct   = luminance(colour_direct.x,   colour_direct.y,   colour_direct.z);
 			float luminance_indirect = luminance(colour_indirect.x, colour_indirect.y, colour_indirect.z);
 
-			float4 normal_and_depth = gbuffer_normal_and_depth.get(tap_x, tap_y);
-
-			float3 normal = oct_decode_normal(make_float2(normal_and_depth.x, normal_and_depth.y));
-			float depth = normal_and_depth.z;
-
 			float2 w = edge_stopping_weights(
 				i * step_size,
 				j * step_size,
@@ -548,8 +561,173 @@ extern "C" __global__ void kernel_svgf_atrous(
 	colour_indirect_out[pixel_index] = sum_colour_indirect;
 
 	if (step_size == (1 << feedback_iteration)) {
-		history_direct  [pixel_index] = sum_colour_direct;
-		history_indirect[pixel_index] = sum_colour_indirect;
+		history_direct  .set(pixel_index, sum_colour_direct);
+		history_indirect.set(pixel_index, sum_colour_indirect);
+	}
+}
+
+extern "C" __global__ void kernel_svgf_atrous(
+	float4 const * colour_direct_in,
+	float4 const * colour_indirect_in,
+	float4       * colour_direct_out,
+	float4       * colour_indirect_out,
+	int step_size
+) {
+	int x = blockIdx.x * blockDim.x + threadIdx.x;
+	int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+	if (x >= screen_width || y >= screen_height) return;
+
+	if (config.enable_svgf_tile_skip) {
+		int tiles_x = (screen_width + SVGF_TILE_SIZE - 1) / SVGF_TILE_SIZE;
+		if (!svgf_tile_active[x / SVGF_TILE_SIZE + (y / SVGF_TILE_SIZE) * tiles_x]) return;
+	}
+
+	svgf_atrous(x, y, step_size, [colour_direct_in, colour_indirect_in](int tap_x, int tap_y, float4 & colour_direct, float4 & colour_indirect, float3 & normal, float & depth) {
+		colour_direct   = colour_direct_in  [tap_x + tap_y * screen_pitch];
+		colour_indirect = colour_indirect_in[tap_x + tap_y * screen_pitch];
+
+		float4 normal_and_depth = gbuffer_normal_and_depth.get(tap_x, tap_y);
+
+		normal = oct_decode_normal(make_float2(normal_and_depth.x, normal_and_depth.y));
+		depth  = normal_and_depth.z;
+	}, colour_direct_out, colour_indirect_out);
+}
+
+// Variant of kernel_svgf_atrous for small step sizes, where neighbouring Pixels share most of their Taps
+// Every Block first stages its tile plus an apron of step_size Pixels into shared memory,
+// including the decoded normals, so that global memory and the GBuffer are only read once per Pixel per iteration
+// Must be launched with SVGF_TILE_SIZE x SVGF_TILE_SIZE Blocks and step_size <= SVGF_TILE_MAX_STEP_SIZE
+extern "C" __global__ void kernel_svgf_atrous_tiled(
+	float4 const * colour_direct_in,
+	float4 const * colour_indirect_in,
+	float4       * colour_direct_out,
+	float4       * colour_indirect_out,
+	int step_size
+) {
+	constexpr int TILE_WIDTH_MAX = SVGF_TILE_SIZE + 2 * SVGF_TILE_MAX_STEP_SIZE;
+	constexpr int TILE_CAPACITY  = TILE_WIDTH_MAX * TILE_WIDTH_MAX;
+
+	__shared__ float4 tile_colour_direct   [TILE_CAPACITY];
+	__shared__ float4 tile_colour_indirect [TILE_CAPACITY];
+	__shared__ float4 tile_normal_and_depth[TILE_CAPACITY]; // Decoded normal in xyz, depth in w
+
+	int tile_index_x = blockIdx.x;
+	int tile_index_y = blockIdx.y;
+
+	// The grid covers all tiles, but only as many Blocks as there are tiles left to filter do any work
+	if (config.enable_svgf_tile_skip) {
+		int block_index = blockIdx.x + blockIdx.y * gridDim.x;
+		if (block_index >= *svgf_tile_count) return;
+
+		int tile_index = svgf_tile_list[block_index];
+		tile_index_x = tile_index % gridDim.x;
+		tile_index_y = tile_index / gridDim.x;
+	}
+
+	int apron      = max(step_size, 1); // The Variance blur and depth gradient need at least one Pixel
+	int tile_width = SVGF_TILE_SIZE + 2 * apron;
+
+	int tile_x = tile_index_x * SVGF_TILE_SIZE - apron;
+	int tile_y = tile_index_y * SVGF_TILE_SIZE - apron;
+
+	// Cooperatively load the tile, Pixels outside the screen are clamped to the edge
+	for (int i = threadIdx.x + threadIdx.y * SVGF_TILE_SIZE; i < tile_width * tile_width; i += SVGF_TILE_SIZE * SVGF_TILE_SIZE) {
+		int load_x = clamp(tile_x + i % tile_width, 0, screen_width  - 1);
+		int load_y = clamp(tile_y + i / tile_width, 0, screen_height - 1);
+
+		tile_colour_direct  [i] = colour_direct_in  [load_x + load_y * screen_pitch];
+		tile_colour_indirect[i] = colour_indirect_in[load_x + load_y * screen_pitch];
+
+		float4 normal_and_depth = gbuffer_normal_and_depth.get(load_x, load_y);
+		float3 normal = oct_decode_normal(make_float2(normal_and_depth.x, normal_and_depth.y));
+
+		tile_normal_and_depth[i] = make_float4(normal, normal_and_depth.z);
+	}
+
+	__syncthreads();
+
+	int x = tile_index_x * SVGF_TILE_SIZE + threadIdx.x;
+	int y = tile_index_y * SVGF_TILE_SIZE + threadIdx.y;
+
+	if (x >= screen_width || y >= screen_height) return;
+
+	svgf_atrous(x, y, step_size, [&](int tap_x, int tap_y, float4 & colour_direct, float4 & colour_indirect, float3 & normal, float & depth) {
+		int tap_index = (tap_x - tile_x) + (tap_y - tile_y) * tile_width;
+
+		colour_direct   = tile_colour_direct  [tap_index];
+		colour_indirect = tile_colour_indirect[tap_index];
+
+		float4 normal_and_depth = tile_normal_and_depth[tap_index];
+
+		normal = make_float3(normal_and_depth);
+		depth  = normal_and_depth.w;
+	}, colour_direct_out, colour_indirect_out);
+}
+
+// Runs before the A-Trous iterations, one SVGF_TILE_SIZE x SVGF_TILE_SIZE Block per tile
+// A tile is skipped if all of its Pixels have converged: either the Variance of their temporally integrated colour is below
+// config.svgf_skip_variance (relative to their luminance), or their history is at least config.svgf_skip_history frames long
+// The Pixels of a skipped tile are copied to the other ping-pong buffer, so that whichever buffer the last iteration ends in holds them,
+// and so that the Taps of neighbouring tiles that are still filtered read them unfiltered
+extern "C" __global__ void kernel_svgf_classify(
+	float4 const * colour_direct_in,
+	float4 const * colour_indirect_in,
+	float4       * colour_direct_out,
+	float4       * colour_indirect_out
+) {
+	int x = blockIdx.x * SVGF_TILE_SIZE + threadIdx.x;
+	int y = blockIdx.y * SVGF_TILE_SIZE + threadIdx.y;
+
+	bool inside = x < screen_width && y < screen_height;
+
+	int pixel_index = x + y * screen_pitch;
+
+	float4 direct   = make_float4(0.0f);
+	float4 indirect = make_float4(0.0f);
+
+	bool converged = true;
+	if (inside) {
+		direct   = colour_direct_in  [pixel_index];
+		indirect = colour_indirect_in[pixel_index];
+
+		int history = history_length[pixel_index];
+
+		// The Variance in the alpha channel is that of a single frame, the temporal integration averages over about 1 / alpha_colour frames
+		float alpha = fmaxf(config.alpha_colour, 1.0f / float(max(history, 1)));
+
+		float luminance_direct   = luminance(direct.x,   direct.y,   direct.z);
+		float luminance_indirect = luminance(indirect.x, indirect.y, indirect.z);
+
+		bool converged_direct   = alpha * direct  .w <= config.svgf_skip_variance * fmaxf(luminance_direct   * luminance_direct,   epsilon);
+		bool converged_indirect = alpha * indirect.w <= config.svgf_skip_variance * fmaxf(luminance_indirect * luminance_indirect, epsilon);
+
+		bool is_sky = gbuffer_normal_and_depth.get(x, y).z == 0.0f;
+
+		converged = is_sky || history >= config.svgf_skip_history || (history >= 4 && converged_direct && converged_indirect);
+	}
+
+	bool tile_converged = __syncthreads_and(converged);
+
+	int tile_index = blockIdx.x + blockIdx.y * gridDim.x;
+
+	if (threadIdx.x == 0 && threadIdx.y == 0) {
+		svgf_tile_active[tile_index] = !tile_converged;
+
+		if (!tile_converged) {
+			svgf_tile_list[atomicAdd(svgf_tile_count, 1)] = tile_index;
+		}
+	}
+
+	if (tile_converged && inside) {
+		colour_direct_out  [pixel_index] = direct;
+		colour_indirect_out[pixel_index] = indirect;
+
+		// The filtered colour of the feedback iteration would otherwise become the history
+		if (config.num_atrous_iterations > feedback_iteration) {
+			history_direct  .set(pixel_index, direct);
+			history_indirect.set(pixel_index, indirect);
+		}
 	}
 }
 
@@ -583,7 +761,7 @@ extern "C" __global__ void kernel_svgf_finalize(
 		colour.y = safe_sqrt(colour.y);
 		colour.z = safe_sqrt(colour.z);
 
-		taa_frame_curr[pixel_index] = colour;
+		taa_frame_curr.set(pixel_index, colour);
 	}
 
 	float4 moment = frame_buffer_moment[pixel_index];
@@ -593,12 +771,12 @@ extern "C" __global__ void kernel_svgf_finalize(
 	if (config.num_atrous_iterations <= feedback_iteration) {
 		// Normally the à-trous filter copies the illumination history,
 		// but in case the filter was skipped we need to do this here
-		history_direct  [pixel_index] = direct;
-		history_indirect[pixel_index] = indirect;
+		history_direct  .set(pixel_index, direct);
+		history_indirect.set(pixel_index, indirect);
 	}
 
-	history_moment          [pixel_index] = moment;
-	history_normal_and_depth[pixel_index] = normal_and_depth;
+	history_moment[pixel_index] = moment;
+	history_normal_and_depth.set(pixel_index, normal_and_depth);
 
 	gbuffer_normal_and_depth       .set(x, y, make_float4(0.0f));
 	gbuffer_mesh_id_and_triangle_id.set(x, y, make_int2(0));
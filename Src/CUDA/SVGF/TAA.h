@@ -1,7 +1,7 @@
 #pragma once
 
-__device__ __constant__ float4 * taa_frame_curr;
-__device__ __constant__ float4 * taa_frame_prev;
+__device__ __constant__ HistoryBuffer taa_frame_curr;
+__device__ __constant__ HistoryBuffer taa_frame_prev;
 
 extern __device__ __constant__ Surface<float4> accumulator;
 
@@ -14,7 +14,7 @@ extern "C" __global__ void kernel_taa(int sample_index) {
 	if (x >= screen_width || y >= screen_height) return;
 
 	int pixel_index = x + y * screen_pitch;
-	float4 colour = taa_frame_curr[pixel_index];
+	float4 colour = taa_frame_curr.get(pixel_index);
 
 	if (sample_index == 0) {
 		// On the first frame the history buffer will be black,
@@ -49,7 +49,7 @@ extern "C" __global__ void kernel_taa(int sample_index) {
 				mitchell_netravali(float(j) + 0.5f - t_prev);
 
 			sum_weight += weight;
-			sum        += weight * taa_frame_prev[i + j * screen_pitch];
+			sum        += weight * taa_frame_prev.get(i + j * screen_pitch);
 		}
 	}
 
@@ -62,19 +62,19 @@ extern "C" __global__ void kernel_taa(int sample_index) {
 
 		if (x >= 1) {
 			if (y >= 1) {
-				float3 f = rgb_to_ycocg(make_float3(taa_frame_curr[pixel_index - screen_pitch - 1]));
+				float3 f = rgb_to_ycocg(make_float3(taa_frame_curr.get(pixel_index - screen_pitch - 1)));
 
 				colour_avg += f;
 				colour_var += f * f;
 			}
 
-			float3 f = rgb_to_ycocg(make_float3(taa_frame_curr[pixel_index - 1]));
+			float3 f = rgb_to_ycocg(make_float3(taa_frame_curr.get(pixel_index - 1)));
 
 			colour_avg += f;
 			colour_var += f * f;
 
 			if (y < screen_height - 1) {
-				float3 f = rgb_to_ycocg(make_float3(taa_frame_curr[pixel_index + screen_pitch - 1]));
+				float3 f = rgb_to_ycocg(make_float3(taa_frame_curr.get(pixel_index + screen_pitch - 1)));
 
 				colour_avg += f;
 				colour_var += f * f;
@@ -82,14 +82,14 @@ extern "C" __global__ void kernel_taa(int sample_index) {
 		}
 
 		if (y >= 1) {
-			float3 f = rgb_to_ycocg(make_float3(taa_frame_curr[pixel_index - screen_pitch]));
+			float3 f = rgb_to_ycocg(make_float3(taa_frame_curr.get(pixel_index - screen_pitch)));
 
 			colour_avg += f;
 			colour_var += f * f;
 		}
 
 		if (y < screen_height - 1) {
-			float3 f = rgb_to_ycocg(make_float3(taa_frame_curr[pixel_index + screen_pitch]));
+			float3 f = rgb_to_ycocg(make_float3(taa_frame_curr.get(pixel_index + screen_pitch)));
 
 			colour_avg += f;
 			colour_var += f * f;
@@ -97,19 +97,19 @@ extern "C" __global__ void kernel_taa(int sample_index) {
 
 		if (x < screen_width - 1) {
 			if (y >= 1) {
-				float3 f = rgb_to_ycocg(make_float3(taa_frame_curr[pixel_index + 1 - screen_pitch]));
+				float3 f = rgb_to_ycocg(make_float3(taa_frame_curr.get(pixel_index + 1 - screen_pitch)));
 
 				colour_avg += f;
 				colour_var += f * f;
 			}
 
-			float3 f = rgb_to_ycocg(make_float3(taa_frame_curr[pixel_index + 1]));
+			float3 f = rgb_to_ycocg(make_float3(taa_frame_curr.get(pixel_index + 1)));
 
 			colour_avg += f;
 			colour_var += f * f;
 
 			if (y < screen_height - 1) {
-				float3 f = rgb_to_ycocg(make_float3(taa_frame_curr[pixel_index + 1 + screen_pitch]));
+				float3 f = rgb_to_ycocg(make_float3(taa_frame_curr.get(pixel_index + 1 + screen_pitch)));
 
 				colour_avg += f;
 				colour_var += f * f;
@@ -158,7 +158,7 @@ extern "C" __global__ void kernel_taa_finalize() {
 
 	float4 colour = accumulator.get(x, y);
 
-	taa_frame_prev[pixel_index] = colour;
+	taa_frame_prev.set(pixel_index, colour);
 
 	// Inverse of gamma
 	colour = colour * colour;
@@ -170,3 +170,138 @@ extern "C" __global__ void kernel_taa_finalize() {
 
 	gbuffer_screen_position_prev.set(x, y, make_float2(0.0f));
 }
+
+// kernel_svgf_finalize, kernel_taa and kernel_taa_finalize in a single pass, used if cpu_config.enable_fused_taa is set
+// Every Block first resolves the SVGF colour of its tile plus a one Pixel apron into shared memory, so that the TAA neighbourhood
+// never goes through global memory. TAA.history_in is read around the reprojected position of other Pixels, so it cannot be written
+// in place: the resolved colour goes to history_out instead, and the host swaps the two every frame
+// Unlike kernel_taa the neighbourhood is clamped to the screen, instead of leaving out the Taps outside of it
+// Must be launched with SVGF_TILE_SIZE x SVGF_TILE_SIZE Blocks
+extern "C" __global__ void kernel_svgf_taa_resolve(
+	const float4 * colour_direct,
+	const float4 * colour_indirect,
+	HistoryBuffer  history_in,
+	HistoryBuffer  history_out,
+	int sample_index
+) {
+	constexpr int TILE_WIDTH = SVGF_TILE_SIZE + 2;
+
+	__shared__ float3 tile_colour[TILE_WIDTH * TILE_WIDTH]; // Tonemapped and gamma corrected, in YCoCg
+
+	int tile_x = blockIdx.x * SVGF_TILE_SIZE - 1;
+	int tile_y = blockIdx.y * SVGF_TILE_SIZE - 1;
+
+	for (int i = threadIdx.x + threadIdx.y * SVGF_TILE_SIZE; i < TILE_WIDTH * TILE_WIDTH; i += SVGF_TILE_SIZE * SVGF_TILE_SIZE) {
+		int load_x = clamp(tile_x + i % TILE_WIDTH, 0, screen_width  - 1);
+		int load_y = clamp(tile_y + i / TILE_WIDTH, 0, screen_height - 1);
+
+		int load_index = load_x + load_y * screen_pitch;
+
+		float4 colour = (colour_direct[load_index] + colour_indirect[load_index]) * aov_framebuffer_get(AOVType::ALBEDO, load_index);
+
+		// Same "Pseudo" Reinhard and gamma as kernel_svgf_finalize
+		colour = colour / (1.0f + luminance(colour.x, colour.y, colour.z));
+
+		tile_colour[i] = rgb_to_ycocg(make_float3(
+			safe_sqrt(colour.x),
+			safe_sqrt(colour.y),
+			safe_sqrt(colour.z)
+		));
+	}
+
+	__syncthreads();
+
+	int x = blockIdx.x * SVGF_TILE_SIZE + threadIdx.x;
+	int y = blockIdx.y * SVGF_TILE_SIZE + threadIdx.y;
+
+	if (x >= screen_width || y >= screen_height) return;
+
+	int pixel_index = x + y * screen_pitch;
+
+	// SVGF History, as in kernel_svgf_finalize
+	if (config.num_atrous_iterations <= feedback_iteration) {
+		history_direct  .set(pixel_index, colour_direct  [pixel_index]);
+		history_indirect.set(pixel_index, colour_indirect[pixel_index]);
+	}
+
+	history_moment[pixel_index] = frame_buffer_moment[pixel_index];
+	history_normal_and_depth.set(pixel_index, gbuffer_normal_and_depth.get(x, y));
+
+	int centre = (threadIdx.x + 1) + (threadIdx.y + 1) * TILE_WIDTH;
+
+	float3 colour_curr = tile_colour[centre];
+	float3 colour      = colour_curr;
+
+	if (sample_index > 0) {
+		float2 screen_position_prev = gbuffer_screen_position_prev.get(x, y);
+
+		float s_prev = (0.5f + 0.5f * screen_position_prev.x) * float(screen_width);
+		float t_prev = (0.5f + 0.5f * screen_position_prev.y) * float(screen_height);
+
+		int x_prev = int(s_prev + 0.5f);
+		int y_prev = int(t_prev + 0.5f);
+
+		float  sum_weight = 0.0f;
+		float4 sum = make_float4(0.0f);
+
+		for (int j = y_prev - 2; j < y_prev + 2; j++) {
+			if (j < 0 || j >= screen_height) continue;
+
+			for (int i = x_prev - 2; i < x_prev + 2; i++) {
+				if (i < 0 || i >= screen_width) continue;
+
+				float weight =
+					mitchell_netravali(float(i) + 0.5f - s_prev) *
+					mitchell_netravali(float(j) + 0.5f - t_prev);
+
+				sum_weight += weight;
+				sum        += weight * history_in.get(i + j * screen_pitch);
+			}
+		}
+
+		if (sum_weight > 0.0f) {
+			float3 colour_prev = rgb_to_ycocg(make_float3(sum / sum_weight));
+
+			float3 colour_avg = make_float3(0.0f);
+			float3 colour_var = make_float3(0.0f);
+
+			for (int j = -1; j <= 1; j++) {
+				for (int i = -1; i <= 1; i++) {
+					float3 f = tile_colour[centre + i + j * TILE_WIDTH];
+
+					colour_avg += f;
+					colour_var += f * f;
+				}
+			}
+
+			colour_avg *= 1.0f / 9.0f;
+			colour_var *= 1.0f / 9.0f;
+
+			float3 sigma2 = colour_var - colour_avg * colour_avg;
+			float3 sigma = make_float3(
+				safe_sqrt(sigma2.x),
+				safe_sqrt(sigma2.y),
+				safe_sqrt(sigma2.z)
+			);
+
+			colour_prev = clamp(colour_prev, colour_avg - 1.25f * sigma, colour_avg + 1.25f * sigma);
+
+			constexpr float ALPHA = 0.1f;
+			colour = lerp(colour_prev, colour_curr, ALPHA);
+		}
+	}
+
+	float3 resolved = ycocg_to_rgb(colour);
+
+	history_out.set(pixel_index, make_float4(resolved, 1.0f));
+
+	// Inverse of gamma and "Pseudo" Reinhard, as in kernel_taa_finalize
+	float4 linear = make_float4(resolved * resolved, 1.0f);
+	linear = linear / (1.0f - luminance(linear.x, linear.y, linear.z));
+
+	accumulator.set(x, y, linear);
+
+	gbuffer_normal_and_depth       .set(x, y, make_float4(0.0f));
+	gbuffer_mesh_id_and_triangle_id.set(x, y, make_int2(0));
+	gbuffer_screen_position_prev   .set(x, y, make_float2(0.0f));
+}
@@ -7,13 +7,21 @@ __device__ __constant__ uchar2 * blue_noise_textures;
 
 __device__ __constant__ float lights_total_weight;
 
-__device__ __constant__ const int   * light_triangle_indices;
-__device__ __constant__ const float * light_triangle_cumulative_probability;
+// Entry of a Walker alias table, see Util/AliasTable.h
+// Aligned so that sampling requires only a single 8 byte load
+struct alignas(8) AliasEntry {
+	float probability;
+	int   alias;
+};
+
+__device__ __constant__ const int        * light_triangle_indices;
+__device__ __constant__ const float      * light_triangle_cdf; // Running sum of the Triangle areas, restarts for every light MeshData
+
 
-__device__ __constant__ int           light_mesh_count;
-__device__ __constant__ const float * light_mesh_cumulative_probability;
-__device__ __constant__ const int2  * light_mesh_triangle_span; // First and last index into 'light_mesh_area_cumulative' array
-__device__ __constant__ const int   * light_mesh_transform_indices;
+__device__ __constant__ int                light_mesh_count;
+__device__ __constant__ const AliasEntry * light_mesh_alias_table;
+__device__ __constant__ const int2       * light_mesh_triangle_span; // First and last index into 'light_triangle_cdf' array
+__device__ __constant__ const int        * light_mesh_transform_indices;
 
 __device__ inline bool pdf_is_valid(float pdf) {
 	return isfinite(pdf) && pdf > 1e-4f;
@@ -30,6 +38,7 @@ __device__ inline float power_heuristic(float pdf_f, float pdf_g) {
 enum struct SampleDimension {
 	FILTER,
 	APERTURE,
+	TIME,
 
 	RUSSIAN_ROULETTE,
 	NEE_LIGHT,
@@ -41,20 +50,65 @@ enum struct SampleDimension {
 	NUM_BOUNCE = 5 // Last 5 dimensions are reused every bounce
 };
 
+// Direction numbers of the second dimension of the Sobol sequence, the first dimension is the bit reversed index
+__device__ __constant__ unsigned sobol_directions[32] = {
+	0x80000000, 0xc0000000, 0xa0000000, 0xf0000000, 0x88000000, 0xcc000000, 0xaa000000, 0xff000000,
+	0x80800000, 0xc0c00000, 0xa0a00000, 0xf0f00000, 0x88880000, 0xcccc0000, 0xaaaa0000, 0xffff0000,
+	0x80008000, 0xc000c000, 0xa000a000, 0xf000f000, 0x88008800, 0xcc00cc00, 0xaa00aa00, 0xff00ff00,
+	0x80808080, 0xc0c0c0c0, 0xa0a0a0a0, 0xf0f0f0f0, 0x88888888, 0xcccccccc, 0xaaaaaaaa, 0xffffffff,
+};
+
+__device__ inline unsigned sobol_dimension_1(unsigned index) {
+	unsigned x = 0;
+	for (int bit = 0; index; bit++, index >>= 1) {
+		if (index & 1) x ^= sobol_directions[bit];
+	}
+	return x;
+}
+
+// Based on: Burley - Practical Hash-based Owen Scrambling
+__device__ inline unsigned laine_karras_permutation(unsigned x, unsigned seed) {
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return x;
+}
+
+__device__ inline unsigned nested_uniform_scramble(unsigned x, unsigned seed) {
+	return __brev(laine_karras_permutation(__brev(x), seed));
+}
+
+// Every Pixel and dimension gets its own shuffled and scrambled 2D Sobol sequence, seeded by hash
+// Unlike the PMJ table this needs no memory reads and remains a (0, 2)-sequence for any number of samples
+__device__ inline float2 random_sobol(unsigned hash, unsigned sample_index) {
+	unsigned index = nested_uniform_scramble(sample_index, hash);
+
+	unsigned x = nested_uniform_scramble(__brev(index),            hash_combine(hash, 0));
+	unsigned y = nested_uniform_scramble(sobol_dimension_1(index), hash_combine(hash, 1));
+
+	// Use the upper 24 bits, so that the result is strictly less than 1.0f
+	return make_float2(
+		float(x >> 8) * (1.0f / float(1 << 24)),
+		float(y >> 8) * (1.0f / float(1 << 24))
+	);
+}
+
 template<SampleDimension Dim>
 __device__ float2 random(unsigned pixel_index, unsigned bounce, unsigned sample_index) {
 	unsigned hash = pcg_hash((pixel_index * unsigned(SampleDimension::NUM_DIMENSIONS) + unsigned(Dim)) * MAX_BOUNCES + bounce);
 
-	// If we run out of PMJ02 samples, fall back to random
-	if (sample_index >= PMJ_NUM_SAMPLES_PER_SEQUENCE) {
-		const float one_over_max_unsigned = __uint_as_float(0x2f7fffff); // Constant such that 0xffffffff will map to a float strictly less than 1.0f
-
-		float x = hash_with(sample_index,              hash) * one_over_max_unsigned;
-		float y = hash_with(sample_index + 0xdeadbeef, hash) * one_over_max_unsigned;
-
-		return make_float2(x, y);
+	if (config.enable_sobol_sampler) {
+		return random_sobol(hash, sample_index);
 	}
 
+	// If we run out of PMJ02 samples, start over with the sequence shifted by the next point of the R2 sequence
+	// The shift is the same for all Pixels, so that the rotated samples of a frame keep their blue noise distribution over the screen
+	// (random samples would turn them into white noise, which matters for SVGF and TAA since they never stop rendering new frames)
+	unsigned epoch = sample_index / PMJ_NUM_SAMPLES_PER_SEQUENCE;
+	sample_index  %= PMJ_NUM_SAMPLES_PER_SEQUENCE;
+
 	unsigned dim = unsigned(Dim) + unsigned(SampleDimension::NUM_BOUNCE) * bounce;
 
 	// If we run out of unique PMJ sequences, reuse a previous one but permute the index
@@ -65,11 +119,21 @@ __device__ float2 random(unsigned pixel_index, unsigned bounce, unsigned sample_
 	const float2 * pmj_sequence = pmj_samples + (dim % PMJ_NUM_SEQUENCES) * PMJ_NUM_SAMPLES_PER_SEQUENCE;
 	float2 sample = pmj_sequence[sample_index];
 
+	if (epoch > 0) {
+		float r2_x = float(epoch) * 0.7548776662f;
+		float r2_y = float(epoch) * 0.5698402910f;
+
+		sample += make_float2(r2_x - floorf(r2_x), r2_y - floorf(r2_y));
+	}
+
 	// Apply Cranley-Patterson rotation
 	uchar2 * blue_noise_texture = blue_noise_textures + (dim % BLUE_NOISE_NUM_TEXTURES) * (BLUE_NOISE_TEXTURE_DIM * BLUE_NOISE_TEXTURE_DIM);
 
-	int x = (pixel_index % screen_pitch) % BLUE_NOISE_TEXTURE_DIM;
-	int y = (pixel_index / screen_pitch) % BLUE_NOISE_TEXTURE_DIM;
+	// Dimensions that share a Texture read it toroidally offset, otherwise their rotations would be identical in every Pixel
+	unsigned texture_offset = dim >= BLUE_NOISE_NUM_TEXTURES ? pcg_hash(dim / BLUE_NOISE_NUM_TEXTURES) : 0;
+
+	int x = (pixel_index % screen_pitch + (texture_offset       )) % BLUE_NOISE_TEXTURE_DIM;
+	int y = (pixel_index / screen_pitch + (texture_offset >> 16)) % BLUE_NOISE_TEXTURE_DIM;
 
 	uchar2 blue_noise = blue_noise_texture[x + y * BLUE_NOISE_TEXTURE_DIM];
 	sample += make_float2(
@@ -77,12 +141,20 @@ __device__ float2 random(unsigned pixel_index, unsigned bounce, unsigned sample_
 		blue_noise.y * (1.0f / 255.0f)
 	);
 
-	if (sample.x >= 1.0f) sample.x -= 1.0f;
-	if (sample.y >= 1.0f) sample.y -= 1.0f;
+	sample.x -= floorf(sample.x);
+	sample.y -= floorf(sample.y);
 
 	return sample;
 }
 
+// Uniform random number in [0, 1) from a hash chain, used for samples that do not have a fixed PMJ dimension (e.g. ReSTIR candidates)
+__device__ inline float random_hash_chain(unsigned & state) {
+	const float one_over_max_unsigned = __uint_as_float(0x2f7fffff); // Constant such that 0xffffffff will map to a float strictly less than 1.0f
+
+	state = pcg_hash(state);
+	return float(state) * one_over_max_unsigned;
+}
+
 __device__ float sample_tent(float u) {
 	if (u < 0.5f) {
 		return safe_sqrt(2.0f * u) - 1.0f;
@@ -177,14 +249,42 @@ __device__ float3 sample_visible_normals_ggx(float3 omega, float alpha_x, float
 	return normalize(make_float3(alpha_x * n_h.x, alpha_y * n_h.y, n_h.z));
 }
 
+// Samples the alias table in the range [index_first, index_last] using a single uniform random number
+__device__ inline int alias_table_sample(const AliasEntry table[], int index_first, int index_last, float u) {
+	int   count    = index_last - index_first + 1;
+	float u_scaled = u * float(count);
+	int   index    = index_first + min(int(u_scaled), count - 1);
+
+	AliasEntry entry = table[index];
+	return u_scaled - float(index - index_first) < entry.probability ? index : entry.alias;
+}
+
+// Samples the cumulative distribution in the range [index_first, index_last] through binary search
+// The last entry of the range holds the total, entries with zero weight are never returned unless the total is zero
+__device__ inline int cdf_sample(const float cdf[], int index_first, int index_last, float u) {
+	float target = u * __ldg(&cdf[index_last]);
+
+	while (index_first < index_last) {
+		int index_mid = (index_first + index_last) >> 1;
+
+		if (__ldg(&cdf[index_mid]) > target) {
+			index_last = index_mid;
+		} else {
+			index_first = index_mid + 1;
+		}
+	}
+
+	return index_first;
+}
+
 __device__ int sample_light(float u1, float u2, int & transform_id) {
 	// Pick light emitting Mesh
-	int light_mesh_id = binary_search(light_mesh_cumulative_probability, 0, light_mesh_count - 1, u1);
+	int light_mesh_id = alias_table_sample(light_mesh_alias_table, 0, light_mesh_count - 1, u1);
 	transform_id = light_mesh_transform_indices[light_mesh_id];
 
 	// Pick light emitting Triangle on the Mesh
 	int2 triangle_span = light_mesh_triangle_span[light_mesh_id];
-	int light_triangle_id = binary_search(light_triangle_cumulative_probability, triangle_span.x, triangle_span.y, u2);
+	int light_triangle_id = cdf_sample(light_triangle_cdf, triangle_span.x, triangle_span.y, u2);
 
 	return light_triangle_indices[light_triangle_id];
 }
@@ -1,9 +1,16 @@
 #pragma once
 #include "Util.h"
+#include "Sampling.h"
 
 __device__ __constant__ Texture<float4> sky_texture;
 __device__ __constant__ float           sky_scale;
 
+// Distribution over a downsampled version of the Sky, see Sky::calc_distribution
+__device__ __constant__ const AliasEntry * sky_alias_table;
+__device__ __constant__ const float      * sky_pdf;
+__device__ __constant__ int                sky_distribution_width;
+__device__ __constant__ int                sky_distribution_height;
+
 __device__ float3 sample_sky(float3 direction) {
 	// Convert direction to spherical coordinates
 	float phi   = atan2f(-direction.z, direction.x);
@@ -14,3 +21,54 @@ __device__ float3 sample_sky(float3 direction) {
 
 	return sky_scale * make_float3(sky_texture.get(u, v));
 }
+
+// Probability of sampling the Sky instead of a light Triangle during Next Event Estimation
+__device__ inline float sky_sample_probability() {
+	if (!config.enable_sky_sampling || sky_scale <= 0.0f) return 0.0f;
+
+	return lights_total_weight > 0.0f ? 0.5f : 1.0f;
+}
+
+// Samples a direction proportional to the luminance of the Sky, the pdf is with respect to solid angle
+__device__ float3 sample_sky_direction(float u1, float u2, float u3, float & pdf) {
+	int cell_count = sky_distribution_width * sky_distribution_height;
+	int cell_index = alias_table_sample(sky_alias_table, 0, cell_count - 1, u1);
+
+	int x = cell_index % sky_distribution_width;
+	int y = cell_index / sky_distribution_width;
+
+	// Pick a uniform point inside the cell
+	float u = (float(x) + u2) / float(sky_distribution_width);
+	float v = (float(y) + u3) / float(sky_distribution_height);
+
+	float phi   = (u - 0.5f) * TWO_PI;
+	float theta = v * PI;
+
+	float2 sincos_phi   = sincos(phi);
+	float2 sincos_theta = sincos(theta);
+
+	// Jacobian of the equirectangular mapping is 2 pi^2 sin(theta)
+	pdf = sky_pdf[cell_index] / (TWO_PI * PI * sincos_theta.x);
+
+	return make_float3(
+		 sincos_theta.x * sincos_phi.y,
+		 sincos_theta.y,
+		-sincos_theta.x * sincos_phi.x
+	);
+}
+
+// Pdf with respect to solid angle of sampling the given direction using sample_sky_direction
+__device__ float sky_direction_pdf(float3 direction) {
+	float phi   = atan2f(-direction.z, direction.x);
+	float theta = acosf(clamp(direction.y, -1.0f, 1.0f));
+
+	float u = phi   * ONE_OVER_TWO_PI + 0.5f;
+	float v = theta * ONE_OVER_PI;
+
+	int x = clamp(int(u * float(sky_distribution_width)),  0, sky_distribution_width  - 1);
+	int y = clamp(int(v * float(sky_distribution_height)), 0, sky_distribution_height - 1);
+
+	float sin_theta = safe_sqrt(1.0f - direction.y * direction.y);
+
+	return sky_pdf[x + y * sky_distribution_width] / (TWO_PI * PI * sin_theta);
+}
@@ -0,0 +1,177 @@
+#include "cudart/vector_types.h"
+#include "cudart/cuda_math.h"
+
+#include "AOV.h"
+#include "Sampling.h"
+#include "Buffers.h"
+#include "Camera.h"
+#include "Pick.h"
+
+#include "Raytracing/BVH2.h"
+#include "Raytracing/BVH4.h"
+#include "Raytracing/BVH8.h"
+
+// Times the BVH traversal Kernels in isolation on fixed sets of Rays, see TraversalBenchmark.h
+// The Primary Rays are generated from the Camera, the other sets are derived from their hits
+
+// Must match TraversalBenchmark::RaySet
+enum struct RaySet {
+	PRIMARY,
+	DIFFUSE,
+	INCOHERENT,
+	SHADOW
+};
+
+__device__ __constant__ TraversalData       ray_set_primary;
+__device__ __constant__ TraversalData       ray_set_diffuse;
+__device__ __constant__ TraversalData       ray_set_incoherent;
+__device__ __constant__ ShadowTraversalData ray_set_shadow;
+
+struct BufferSizesTraversalBenchmark {
+	int primary;
+	int diffuse;
+	int incoherent;
+	int shadow;
+
+	int rays_retired;
+};
+
+__device__ BufferSizesTraversalBenchmark buffer_sizes;
+
+__device__ inline TraversalData * get_ray_set(RaySet ray_set) {
+	switch (ray_set) {
+		case RaySet::PRIMARY: return &ray_set_primary;
+		case RaySet::DIFFUSE: return &ray_set_diffuse;
+		default:              return &ray_set_incoherent;
+	}
+}
+
+__device__ inline int get_ray_count(RaySet ray_set) {
+	switch (ray_set) {
+		case RaySet::PRIMARY: return buffer_sizes.primary;
+		case RaySet::DIFFUSE: return buffer_sizes.diffuse;
+		default:              return buffer_sizes.incoherent;
+	}
+}
+
+__device__ inline float random_float(unsigned seed) {
+	return float(pcg_hash(seed) >> 8) * (1.0f / float(1u << 24));
+}
+
+// World space position and normals of the hit of a Primary Ray, returns false if the Ray missed
+__device__ inline bool get_primary_hit(int index, float3 & hit_point, float3 & hit_normal, float3 & geometric_normal) {
+	RayHit hit = ray_set_primary.hits.get(index);
+	if (hit.triangle_id == INVALID) return false;
+
+	float3 ray_direction = ray_set_primary.ray_direction.get(index);
+
+	float hit_u = hit.u;
+	float hit_v = hit.v;
+	TrianglePosNorTex hit_triangle = hit_get_triangle(hit.mesh_id, hit.triangle_id, hit_u, hit_v);
+
+	float2 hit_tex_coord;
+	geometric_normal = cross(hit_triangle.position_edge_1, hit_triangle.position_edge_2);
+	triangle_barycentric(hit_triangle, hit_u, hit_v, hit_point, hit_normal, hit_tex_coord);
+
+	Matrix3x4 world = mesh_get_transform(hit.mesh_id);
+	matrix3x4_transform_position (world, hit_point);
+	matrix3x4_transform_direction(world, hit_normal);
+	matrix3x4_transform_direction(world, geometric_normal);
+
+	hit_normal       = normalize(hit_normal);
+	geometric_normal = normalize(geometric_normal);
+
+	if (dot(ray_direction, hit_normal) > 0.0f) {
+		hit_normal = -hit_normal;
+	}
+	if (dot(ray_direction, geometric_normal) > 0.0f) {
+		geometric_normal = -geometric_normal;
+	}
+
+	return true;
+}
+
+extern "C" __global__ void kernel_generate_primary(int sample_index) {
+	int index = blockIdx.x * blockDim.x + threadIdx.x;
+	if (index >= buffer_sizes.primary) return;
+
+	int x = index % screen_width;
+	int y = index / screen_width;
+
+	int pixel_index = x + y * screen_pitch;
+
+	Ray ray = camera_generate_ray(pixel_index, sample_index, x, y, camera);
+
+	ray_set_primary.ray_origin   .set(index, ray.origin);
+	ray_set_primary.ray_direction.set(index, ray.direction);
+}
+
+// Derives the other Ray sets from the hits of the Primary Rays:
+// Diffuse:    Cosine weighted bounce off the hit point
+// Incoherent: Uniformly distributed direction from the hit point
+// Shadow:     Connection between the hit point and the hit point of a random other Primary Ray, like a connection to an area light
+extern "C" __global__ void kernel_generate_secondary(int sample_index) {
+	int index = blockIdx.x * blockDim.x + threadIdx.x;
+	if (index >= buffer_sizes.primary) return;
+
+	float3 hit_point, hit_normal, geometric_normal;
+	if (!get_primary_hit(index, hit_point, hit_normal, geometric_normal)) return;
+
+	unsigned seed = hash_combine(unsigned(index), unsigned(sample_index));
+
+	// Diffuse
+	float3 tangent, bitangent;
+	orthonormal_basis(hit_normal, tangent, bitangent);
+
+	float3 omega_o = sample_cosine_weighted_direction(random_float(seed), random_float(seed + 1));
+	float3 direction_diffuse = local_to_world(omega_o, tangent, bitangent, hit_normal);
+
+	int index_diffuse = warp_aggregated_increment(&buffer_sizes.diffuse);
+	ray_set_diffuse.ray_origin   .set(index_diffuse, ray_origin_epsilon_offset(hit_point, direction_diffuse, geometric_normal));
+	ray_set_diffuse.ray_direction.set(index_diffuse, direction_diffuse);
+
+	// Incoherent
+	float z   = 1.0f - 2.0f * random_float(seed + 2);
+	float r   = safe_sqrt(1.0f - z*z);
+	float phi = TWO_PI * random_float(seed + 3);
+	float2 sin_cos_phi = sincos(phi);
+	float3 direction_incoherent = make_float3(r * sin_cos_phi.y, r * sin_cos_phi.x, z);
+
+	int index_incoherent = warp_aggregated_increment(&buffer_sizes.incoherent);
+	ray_set_incoherent.ray_origin   .set(index_incoherent, ray_origin_epsilon_offset(hit_point, direction_incoherent, geometric_normal));
+	ray_set_incoherent.ray_direction.set(index_incoherent, direction_incoherent);
+
+	// Shadow
+	int index_other = int(pcg_hash(seed + 4) % unsigned(buffer_sizes.primary));
+
+	float3 other_point, other_normal, other_geometric_normal;
+	if (!get_primary_hit(index_other, other_point, other_normal, other_geometric_normal)) return;
+
+	float3 to_other = other_point - hit_point;
+	float  distance = length(to_other);
+	if (distance < 1e-4f) return;
+
+	float3 direction_shadow = to_other / distance;
+
+	int index_shadow = warp_aggregated_increment(&buffer_sizes.shadow);
+	ray_set_shadow.ray_origin   .set(index_shadow, ray_origin_epsilon_offset(hit_point, direction_shadow, geometric_normal));
+	ray_set_shadow.ray_direction.set(index_shadow, direction_shadow);
+	ray_set_shadow.max_distance[index_shadow] = distance * 0.999f;
+}
+
+extern "C" __global__ void kernel_trace_bvh2(RaySet ray_set) { bvh2_trace(get_ray_set(ray_set), get_ray_count(ray_set), &buffer_sizes.rays_retired); }
+extern "C" __global__ void kernel_trace_bvh4(RaySet ray_set) { bvh4_trace(get_ray_set(ray_set), get_ray_count(ray_set), &buffer_sizes.rays_retired); }
+extern "C" __global__ void kernel_trace_bvh8(RaySet ray_set) { bvh8_trace(get_ray_set(ray_set), get_ray_count(ray_set), &buffer_sizes.rays_retired); }
+
+extern "C" __global__ void kernel_trace_shadow_bvh2() { bvh2_trace_shadow(&ray_set_shadow, buffer_sizes.shadow, &buffer_sizes.rays_retired, [](int ray_index) { }); }
+extern "C" __global__ void kernel_trace_shadow_bvh4() { bvh4_trace_shadow(&ray_set_shadow, buffer_sizes.shadow, &buffer_sizes.rays_retired, [](int ray_index) { }); }
+extern "C" __global__ void kernel_trace_shadow_bvh8() { bvh8_trace_shadow(&ray_set_shadow, buffer_sizes.shadow, &buffer_sizes.rays_retired, [](int ray_index) { }); }
+
+// Same traversal, but counting Node and Triangle tests and Stack usage into traversal_stats
+extern "C" __global__ void kernel_trace_stats_bvh2(RaySet ray_set) { bvh2_trace<true>(get_ray_set(ray_set), get_ray_count(ray_set), &buffer_sizes.rays_retired); }
+extern "C" __global__ void kernel_trace_stats_bvh4(RaySet ray_set) { bvh4_trace<true>(get_ray_set(ray_set), get_ray_count(ray_set), &buffer_sizes.rays_retired); }
+extern "C" __global__ void kernel_trace_stats_bvh8(RaySet ray_set) { bvh8_trace<true>(get_ray_set(ray_set), get_ray_count(ray_set), &buffer_sizes.rays_retired); }
+
+extern "C" __global__ void kernel_trace_shadow_stats_bvh2() { bvh2_trace_shadow<true>(&ray_set_shadow, buffer_sizes.shadow, &buffer_sizes.rays_retired, [](int ray_index) { }); }
+extern "C" __global__ void kernel_trace_shadow_stats_bvh4() { bvh4_trace_shadow<true>(&ray_set_shadow, buffer_sizes.shadow, &buffer_sizes.rays_retired, [](int ray_index) { }); }
+extern "C" __global__ void kernel_trace_shadow_stats_bvh8() { bvh8_trace_shadow<true>(&ray_set_shadow, buffer_sizes.shadow, &buffer_sizes.rays_retired, [](int ray_index) { }); }
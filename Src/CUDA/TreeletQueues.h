@@ -0,0 +1,257 @@
+#pragma once
+#include "Util.h"
+#include "Raytracing/BVH8.h"
+
+// Experimental BVH8 traversal for scenes that do not fit in L2, see cpu_config.enable_treelet_queues
+// The treelets are the BLAS of the Meshes. kernel_treelet_tlas_bvh8 traverses only the TLAS and suspends every Ray at each TLAS leaf it reaches,
+// by appending a (Ray, Mesh) entry to the queue of that Mesh. The entries are then sorted by Mesh, so that kernel_treelet_blas_bvh8
+// processes the queues one BLAS after the other and neighbouring threads traverse the same BLAS, which keeps its Nodes resident in L2
+// A Ray can be in the queues of multiple Meshes, the closest hit is found through an atomic minimum over its distance
+struct TreeletEntry {
+	int ray_index;
+	int mesh_id;
+};
+
+__device__ __constant__ TreeletEntry * treelet_entries;        // In the order the TLAS traversal appended them
+__device__ __constant__ TreeletEntry * treelet_entries_sorted; // Grouped by Mesh
+__device__ __constant__ float4       * treelet_entry_hits;     // Per sorted entry, the closest hit within its BLAS as (t, u, v, triangle_id), the Mesh is that of the entry
+__device__ __constant__ int          * treelet_offsets;        // Per Mesh, first the number of entries, then the offset of its queue
+__device__ __constant__ unsigned     * treelet_ray_t;          // Per Ray, the distance of its closest hit so far as uint, which orders the same as a positive float
+__device__ __constant__ int          * treelet_entry_count_total; // Number of entries that were appended, including those that did not fit
+
+__device__ __constant__ int treelet_entry_capacity;
+__device__ __constant__ int treelet_mesh_count;
+
+// Single thread traversal of a BLAS, without a Shared Memory Stack or Triangle postponing
+// The Ray is given in world space, ray_hit is only updated with hits closer than its current distance
+__device__ inline void treelet_intersect_blas(int mesh_id, Ray ray, const float * ray_time, int ray_index, RayHit & ray_hit) {
+	bool mesh_has_identity_transform;
+	bool blas_has_curves;
+	int  root_index = bvh_get_mesh_root_index(mesh_id, mesh_has_identity_transform, blas_has_curves);
+
+	if (!mesh_has_identity_transform) {
+		Matrix3x4 transform_inv = bvh_get_mesh_transform_inv(mesh_id, ray_time, ray_index);
+		matrix3x4_transform_position (transform_inv, ray.origin);
+		matrix3x4_transform_direction(transform_inv, ray.direction);
+	}
+
+	unsigned oct_inv4 = ray_get_octant_inv4(ray.direction);
+
+	uint2 stack[TREELET_STACK_SIZE];
+	int   stack_size = 0;
+
+	uint2 current_group = make_uint2(root_index, 0x80000000);
+
+	// Only groups with internal Nodes left are pushed, so the current group always has a child to visit
+	while (true) {
+		unsigned hits_imask = current_group.y;
+
+		unsigned child_index_offset = msb(hits_imask);
+		unsigned child_index_base   = current_group.x;
+
+		current_group.y &= ~(1 << child_index_offset);
+
+		// At most one group is pushed per level of the BVH
+		if ((current_group.y & 0xff000000) && stack_size < TREELET_STACK_SIZE) {
+			stack[stack_size++] = current_group;
+		}
+
+		unsigned slot_index     = (child_index_offset - 24) ^ (oct_inv4 & 0xff);
+		unsigned relative_index = __popc(hits_imask & ~(0xffffffff << slot_index));
+
+		unsigned child_node_index = child_index_base + relative_index;
+
+		float4 node_0 = __ldg(&bvh8_nodes[child_node_index].node_0);
+		float4 node_1 = __ldg(&bvh8_nodes[child_node_index].node_1);
+		float4 node_2 = __ldg(&bvh8_nodes[child_node_index].node_2);
+		float4 node_3 = __ldg(&bvh8_nodes[child_node_index].node_3);
+		float4 node_4 = __ldg(&bvh8_nodes[child_node_index].node_4);
+
+		unsigned hitmask = bvh8_node_intersect(ray, oct_inv4, ray_hit.t, node_0, node_1, node_2, node_3, node_4);
+
+		byte imask = extract_byte(__float_as_uint(node_0.w), 3);
+
+		uint2 triangle_group;
+		current_group .x = __float_as_uint(node_1.x); // Child     base offset
+		triangle_group.x = __float_as_uint(node_1.y); // Primitive base offset
+
+		current_group .y = (hitmask & 0xff000000) | unsigned(imask);
+		triangle_group.y = (hitmask & 0x00ffffff);
+
+		while (triangle_group.y != 0) {
+			int triangle_index = msb(triangle_group.y);
+			triangle_group.y &= ~(1 << triangle_index);
+
+			bvh_intersect_primitive(blas_has_curves, mesh_id, triangle_group.x + triangle_index, ray, ray_hit);
+		}
+
+		if ((current_group.y & 0xff000000) == 0) {
+			if (stack_size == 0) break;
+
+			current_group = stack[--stack_size];
+		}
+	}
+}
+
+// Traverses only the TLAS and appends an entry for every visible Mesh the Ray reaches
+// Once the queues are full the remaining Meshes are intersected in place, their closest hit initialises the hit of the Ray
+__device__ inline void treelet_tlas_bvh8(TraversalData * traversal_data, int ray_index) {
+	Ray ray;
+	ray.origin    = traversal_data->ray_origin   .get(ray_index);
+	ray.direction = traversal_data->ray_direction.get(ray_index);
+
+	unsigned oct_inv4 = ray_get_octant_inv4(ray.direction);
+
+	RayHit ray_hit;
+	ray_hit.t           = INFINITY;
+	ray_hit.triangle_id = INVALID;
+
+	uint2 stack[TREELET_STACK_SIZE];
+	int   stack_size = 0;
+
+	uint2 current_group = make_uint2(tlas_root_index, 0x80000000);
+
+	// Only groups with internal Nodes left are pushed, so the current group always has a child to visit
+	while (true) {
+		unsigned hits_imask = current_group.y;
+
+		unsigned child_index_offset = msb(hits_imask);
+		unsigned child_index_base   = current_group.x;
+
+		current_group.y &= ~(1 << child_index_offset);
+
+		// At most one group is pushed per level of the BVH
+		if ((current_group.y & 0xff000000) && stack_size < TREELET_STACK_SIZE) {
+			stack[stack_size++] = current_group;
+		}
+
+		unsigned slot_index     = (child_index_offset - 24) ^ (oct_inv4 & 0xff);
+		unsigned relative_index = __popc(hits_imask & ~(0xffffffff << slot_index));
+
+		unsigned child_node_index = child_index_base + relative_index;
+
+		float4 node_0 = __ldg(&bvh8_nodes[child_node_index].node_0);
+		float4 node_1 = __ldg(&bvh8_nodes[child_node_index].node_1);
+		float4 node_2 = __ldg(&bvh8_nodes[child_node_index].node_2);
+		float4 node_3 = __ldg(&bvh8_nodes[child_node_index].node_3);
+		float4 node_4 = __ldg(&bvh8_nodes[child_node_index].node_4);
+
+		unsigned hitmask = bvh8_node_intersect(ray, oct_inv4, ray_hit.t, node_0, node_1, node_2, node_3, node_4);
+
+		byte imask = extract_byte(__float_as_uint(node_0.w), 3);
+
+		uint2 mesh_group;
+		current_group.x = __float_as_uint(node_1.x); // Child base offset
+		mesh_group   .x = __float_as_uint(node_1.y); // Mesh  base offset
+
+		current_group.y = (hitmask & 0xff000000) | unsigned(imask);
+		mesh_group   .y = (hitmask & 0x00ffffff);
+
+		while (mesh_group.y != 0) {
+			int mesh_offset = msb(mesh_group.y);
+			mesh_group.y &= ~(1 << mesh_offset);
+
+			int mesh_id = mesh_group.x + mesh_offset;
+
+			// Meshes hidden from this kind of Ray are skipped without descending into their BLAS
+			if (!mesh_is_visible(mesh_id, MeshVisibility::TRACE)) continue;
+
+			int entry_index = atomicAdd(treelet_entry_count_total, 1);
+			if (entry_index < treelet_entry_capacity) {
+				treelet_entries[entry_index] = { ray_index, mesh_id };
+				atomicAdd(&treelet_offsets[mesh_id], 1);
+			} else {
+				treelet_intersect_blas(mesh_id, ray, traversal_data->ray_time, ray_index, ray_hit);
+			}
+		}
+
+		if ((current_group.y & 0xff000000) == 0) {
+			if (stack_size == 0) break;
+
+			current_group = stack[--stack_size];
+		}
+	}
+
+	traversal_data->hits.set(ray_index, ray_hit);
+	treelet_ray_t[ray_index] = __float_as_uint(ray_hit.t);
+}
+
+// Exclusive prefix sum over the entry counts of all Meshes, launched as a single Block
+extern "C" __global__ void kernel_treelet_scan() {
+	__shared__ int shared_sums[TREELET_SCAN_BLOCK_SIZE];
+
+	int keys_per_thread = (treelet_mesh_count + TREELET_SCAN_BLOCK_SIZE - 1) / TREELET_SCAN_BLOCK_SIZE;
+	int key_first = threadIdx.x * keys_per_thread;
+	int key_last  = min(key_first + keys_per_thread, treelet_mesh_count);
+
+	int sum = 0;
+	for (int key = key_first; key < key_last; key++) {
+		sum += treelet_offsets[key];
+	}
+	shared_sums[threadIdx.x] = sum;
+	__syncthreads();
+
+	for (int step = 1; step < TREELET_SCAN_BLOCK_SIZE; step <<= 1) {
+		int value = threadIdx.x >= step ? shared_sums[threadIdx.x - step] : 0;
+		__syncthreads();
+		shared_sums[threadIdx.x] += value;
+		__syncthreads();
+	}
+
+	int offset = shared_sums[threadIdx.x] - sum;
+	for (int key = key_first; key < key_last; key++) {
+		int count = treelet_offsets[key];
+		treelet_offsets[key] = offset;
+		offset += count;
+	}
+}
+
+__device__ inline int treelet_entry_count() {
+	return min(*treelet_entry_count_total, treelet_entry_capacity);
+}
+
+__device__ inline void treelet_scatter(int index) {
+	TreeletEntry entry = treelet_entries[index];
+	treelet_entries_sorted[atomicAdd(&treelet_offsets[entry.mesh_id], 1)] = entry;
+}
+
+// Intersects the BLAS of a sorted entry, the distance of the closest hit of the Ray found by other entries so far is used to cull it
+__device__ inline void treelet_blas_bvh8(const TraversalData * traversal_data, int index) {
+	TreeletEntry entry = treelet_entries_sorted[index];
+
+	Ray ray;
+	ray.origin    = traversal_data->ray_origin   .get(entry.ray_index);
+	ray.direction = traversal_data->ray_direction.get(entry.ray_index);
+
+	RayHit ray_hit;
+	ray_hit.t           = __uint_as_float(*static_cast<volatile unsigned *>(&treelet_ray_t[entry.ray_index]));
+	ray_hit.triangle_id = INVALID;
+
+	treelet_intersect_blas(entry.mesh_id, ray, traversal_data->ray_time, entry.ray_index, ray_hit);
+
+	if (ray_hit.triangle_id != INVALID) {
+		atomicMin(&treelet_ray_t[entry.ray_index], __float_as_uint(ray_hit.t));
+	}
+	treelet_entry_hits[index] = make_float4(ray_hit.t, ray_hit.u, ray_hit.v, __int_as_float(ray_hit.triangle_id));
+}
+
+// The entry that found the closest hit of a Ray writes it, on a tie any of them is correct
+__device__ inline void treelet_resolve(TraversalData * traversal_data, int index) {
+	float4 entry_hit = treelet_entry_hits[index];
+
+	int triangle_id = __float_as_int(entry_hit.w);
+	if (triangle_id == INVALID) return;
+
+	TreeletEntry entry = treelet_entries_sorted[index];
+
+	if (__float_as_uint(entry_hit.x) == treelet_ray_t[entry.ray_index]) {
+		RayHit ray_hit;
+		ray_hit.t           = entry_hit.x;
+		ray_hit.u           = entry_hit.y;
+		ray_hit.v           = entry_hit.z;
+		ray_hit.mesh_id     = entry.mesh_id;
+		ray_hit.triangle_id = triangle_id;
+
+		traversal_data->hits.set(entry.ray_index, ray_hit);
+	}
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+// With a render scale below 1 (see cpu_config.render_scale) the Kernels render at screen_width x screen_height into accumulator,
+// which is then reconstructed at display_width x display_height into display, the Surface that is actually shown
+__device__ __constant__ int display_width;
+__device__ __constant__ int display_height;
+
+__device__ __constant__ Surface<float4> display;
+
+// History of kernel_taa_upscale at display resolution in gamma space, indexed by x + y * display_width
+__device__ __constant__ float4 * upscale_history;
+
+extern __device__ __constant__ Surface<float4> accumulator;
+
+extern __device__ __constant__ Surface<float2> gbuffer_screen_position_prev;
+
+// Centre of display pixel (x, y) in internal pixel coordinates
+__device__ inline float2 upscale_position(int x, int y) {
+	return make_float2(
+		(float(x) + 0.5f) * float(screen_width)  / float(display_width),
+		(float(y) + 0.5f) * float(screen_height) / float(display_height)
+	);
+}
+
+// Mitchell-Netravali filtered lookup of the internal resolution accumulator, s and t are in internal pixel coordinates
+__device__ inline float4 upscale_sample(float s, float t) {
+	int x_centre = int(s);
+	int y_centre = int(t);
+
+	float  sum_weight = 0.0f;
+	float4 sum = make_float4(0.0f);
+
+	for (int j = y_centre - 1; j <= y_centre + 2; j++) {
+		if (j < 0 || j >= screen_height) continue;
+
+		for (int i = x_centre - 1; i <= x_centre + 2; i++) {
+			if (i < 0 || i >= screen_width) continue;
+
+			float weight =
+				mitchell_netravali(float(i) + 0.5f - s) *
+				mitchell_netravali(float(j) + 0.5f - t);
+
+			sum_weight += weight;
+			sum        += weight * accumulator.get(i, j);
+		}
+	}
+
+	if (sum_weight <= 0.0f) return accumulator.get(x_centre, y_centre);
+
+	return fmaxf(sum / sum_weight, make_float4(0.0f)); // The negative lobes can ring below zero around bright edges
+}
+
+// Same tonemapping as the TAA history, see kernel_svgf_finalize
+__device__ inline float3 upscale_to_gamma(float4 colour) {
+	colour = colour / (1.0f + luminance(colour.x, colour.y, colour.z));
+
+	return make_float3(safe_sqrt(colour.x), safe_sqrt(colour.y), safe_sqrt(colour.z));
+}
+
+__device__ inline float4 upscale_from_gamma(float4 colour) {
+	colour = colour * colour;
+	colour = colour / (1.0f - luminance(colour.x, colour.y, colour.z));
+
+	return colour;
+}
+
+// Spatial upscale, used while accumulating a static image (without SVGF)
+extern "C" __global__ void kernel_upscale() {
+	int x = blockIdx.x * blockDim.x + threadIdx.x;
+	int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+	if (x >= display_width || y >= display_height) return;
+
+	float2 position = upscale_position(x, y);
+
+	display.set(x, y, upscale_sample(position.x, position.y));
+}
+
+// Temporal upscale, replaces kernel_taa when SVGF and TAA are enabled
+// Every frame contributes a filtered reconstruction of the current frame, the camera jitter makes the history converge to the display resolution
+extern "C" __global__ void kernel_taa_upscale(int sample_index) {
+	int x = blockIdx.x * blockDim.x + threadIdx.x;
+	int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+	if (x >= display_width || y >= display_height) return;
+
+	float2 position = upscale_position(x, y);
+
+	float4 colour = upscale_sample(position.x, position.y);
+	float3 colour_curr = upscale_to_gamma(colour);
+
+	if (sample_index == 0) {
+		// On the first frame the history buffer will be black,
+		// in this case we don't perform temporal accumulation
+		display.set(x, y, make_float4(colour_curr, colour.w));
+		return;
+	}
+
+	int x_internal = min(int(position.x), screen_width  - 1);
+	int y_internal = min(int(position.y), screen_height - 1);
+
+	float2 screen_position_prev = gbuffer_screen_position_prev.get(x_internal, y_internal);
+
+	// Convert from [-1, 1] to [0, 1], the motion of the internal pixel is applied to every display pixel it covers
+	float scale_x = float(display_width)  / float(screen_width);
+	float scale_y = float(display_height) / float(screen_height);
+
+	float s_prev = (0.5f + 0.5f * screen_position_prev.x) * float(display_width)  + float(x) + 0.5f - (float(x_internal) + 0.5f) * scale_x;
+	float t_prev = (0.5f + 0.5f * screen_position_prev.y) * float(display_height) + float(y) + 0.5f - (float(y_internal) + 0.5f) * scale_y;
+
+	int x_prev = int(s_prev + 0.5f);
+	int y_prev = int(t_prev + 0.5f);
+
+	float  sum_weight = 0.0f;
+	float4 sum = make_float4(0.0f);
+
+	for (int j = y_prev - 2; j < y_prev + 2; j++) {
+		if (j < 0 || j >= display_height) continue;
+
+		for (int i = x_prev - 2; i < x_prev + 2; i++) {
+			if (i < 0 || i >= display_width) continue;
+
+			float weight =
+				mitchell_netravali(float(i) + 0.5f - s_prev) *
+				mitchell_netravali(float(j) + 0.5f - t_prev);
+
+			sum_weight += weight;
+			sum        += weight * upscale_history[i + j * display_width];
+		}
+	}
+
+	float3 result = colour_curr;
+
+	if (sum_weight > 0.0f) {
+		float3 ycocg_curr = rgb_to_ycocg(colour_curr);
+		float3 ycocg_prev = rgb_to_ycocg(make_float3(sum / sum_weight));
+
+		// Clamp the history to the neighbourhood of the internal pixel, at internal resolution
+		float3 colour_avg = make_float3(0.0f);
+		float3 colour_var = make_float3(0.0f);
+
+		for (int j = -1; j <= 1; j++) {
+			for (int i = -1; i <= 1; i++) {
+				float3 f = rgb_to_ycocg(upscale_to_gamma(accumulator.get(x_internal + i, y_internal + j))); // Clamped at the borders
+
+				colour_avg += f;
+				colour_var += f * f;
+			}
+		}
+
+		colour_avg *= 1.0f / 9.0f;
+		colour_var *= 1.0f / 9.0f;
+
+		float3 sigma2 = colour_var - colour_avg * colour_avg;
+		float3 sigma = make_float3(
+			safe_sqrt(sigma2.x),
+			safe_sqrt(sigma2.y),
+			safe_sqrt(sigma2.z)
+		);
+
+		float3 colour_min = colour_avg - 1.25f * sigma;
+		float3 colour_max = colour_avg + 1.25f * sigma;
+
+		ycocg_prev = clamp(ycocg_prev, colour_min, colour_max);
+
+		// The current frame is a blurred reconstruction, it gets a lower weight than in kernel_taa so that the history retains more detail
+		constexpr float ALPHA = 0.05f;
+		result = ycocg_to_rgb(lerp(ycocg_prev, ycocg_curr, ALPHA));
+	}
+
+	display.set(x, y, make_float4(result, colour.w));
+}
+
+// Updates the history after all reads are done, and converts the display back out of gamma space
+extern "C" __global__ void kernel_taa_upscale_finalize() {
+	int x = blockIdx.x * blockDim.x + threadIdx.x;
+	int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+	if (x >= display_width || y >= display_height) return;
+
+	float4 colour = display.get(x, y);
+
+	upscale_history[x + y * display_width] = colour;
+
+	display.set(x, y, upscale_from_gamma(colour));
+
+	// The display resolution covers the internal one
+	if (x < screen_width && y < screen_height) {
+		gbuffer_screen_position_prev.set(x, y, make_float2(0.0f));
+	}
+}
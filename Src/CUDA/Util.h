@@ -14,7 +14,8 @@ template<typename T>
 struct Texture {
 	cudaTextureObject_t texture;
 
-	float lod_bias; // 0.5 * log2(width * height), required for isotropic Mipmap LOD calculations
+	float lod_bias;   // 0.5 * log2(width * height), required for isotropic Mipmap LOD calculations
+	int   mip_offset; // Mip level of the full resolution Texture that level 0 of this Texture corresponds to, non-zero when streaming
 
 	__device__ inline T get(float s) const {
 		return tex1D<T>(texture, s);
@@ -239,9 +240,10 @@ __device__ inline float2 oct_encode_normal(float3 n) {
 	n /= (abs(n.x) + abs(n.y) + abs(n.z));
 
 	if (n.z < 0.0f) {
-		// Oct wrap
-		n.x = (1.0f - abs(n.y)) * (n.x >= 0.0f ? +1.0f : -1.0f);
-		n.y = (1.0f - abs(n.x)) * (n.y >= 0.0f ? +1.0f : -1.0f);
+		// Oct wrap, both components are based on the unwrapped values
+		float x = n.x;
+		n.x = (1.0f - abs(n.y)) * (x   >= 0.0f ? +1.0f : -1.0f);
+		n.y = (1.0f - abs(x))   * (n.y >= 0.0f ? +1.0f : -1.0f);
 	}
 
 	return make_float2(0.5f + 0.5f * n.x, 0.5f + 0.5f * n.y);
@@ -259,6 +261,67 @@ __device__ inline float3 oct_decode_normal(float2 f) {
 	return normalize(n);
 }
 
+// Unpacks two half precision floats, x is stored in the low 16 bits
+__device__ inline float2 half2_to_float2(unsigned packed) {
+	float x, y;
+	asm("cvt.f32.f16 %0, %1;" : "=f"(x) : "h"((unsigned short)(packed & 0xffff)));
+	asm("cvt.f32.f16 %0, %1;" : "=f"(y) : "h"((unsigned short)(packed >> 16)));
+	return make_float2(x, y);
+}
+
+// Packs two floats into half precision, x is stored in the low 16 bits
+__device__ inline unsigned float2_to_half2(float2 f) {
+	unsigned short x, y;
+	asm("cvt.rn.f16.f32 %0, %1;" : "=h"(x) : "f"(f.x));
+	asm("cvt.rn.f16.f32 %0, %1;" : "=h"(y) : "f"(f.y));
+	return unsigned(x) | (unsigned(y) << 16);
+}
+
+// Unit vector as 2x16 bit octahedral encoding, x is stored in the low 16 bits
+__device__ inline unsigned oct_encode_unorm16(float3 n) {
+	float2 f = oct_encode_normal(n);
+	return unsigned(__saturatef(f.x) * 65535.0f + 0.5f) | (unsigned(__saturatef(f.y) * 65535.0f + 0.5f) << 16);
+}
+
+__device__ inline float3 oct_decode_unorm16(unsigned packed) {
+	return oct_decode_normal(make_float2(float(packed & 0xffff), float(packed >> 16)) * (1.0f / 65535.0f));
+}
+
+// Non-negative colour in the shared exponent RGB9E5 format, values are clamped to [0, 65408]
+__device__ inline unsigned float3_to_rgb9e5(float3 colour) {
+	constexpr float MAX_VALUE = 65408.0f; // (511 / 512) * 2^16
+
+	float r = fminf(fmaxf(colour.x, 0.0f), MAX_VALUE);
+	float g = fminf(fmaxf(colour.y, 0.0f), MAX_VALUE);
+	float b = fminf(fmaxf(colour.z, 0.0f), MAX_VALUE);
+
+	float max_component = fmaxf(fmaxf(r, g), fmaxf(b, 1e-30f));
+
+	int exponent = max(-16, int(floorf(log2f(max_component)))) + 16;
+	float scale  = exp2f(float(exponent - 24));
+
+	if (int(floorf(max_component / scale + 0.5f)) == 512) {
+		scale *= 2.0f;
+		exponent++;
+	}
+
+	unsigned r_mantissa = unsigned(floorf(r / scale + 0.5f));
+	unsigned g_mantissa = unsigned(floorf(g / scale + 0.5f));
+	unsigned b_mantissa = unsigned(floorf(b / scale + 0.5f));
+
+	return r_mantissa | (g_mantissa << 9) | (b_mantissa << 18) | (unsigned(exponent) << 27);
+}
+
+__device__ inline float3 rgb9e5_to_float3(unsigned packed) {
+	float scale = exp2f(float(int(packed >> 27) - 24));
+
+	return make_float3(
+		float( packed        & 0x1ff) * scale,
+		float((packed >>  9) & 0x1ff) * scale,
+		float((packed >> 18) & 0x1ff) * scale
+	);
+}
+
 __device__ float mitchell_netravali(float x) {
 	const float B = 1.0f / 3.0f;
 	const float C = 1.0f / 3.0f;
@@ -339,3 +402,52 @@ __device__ float vmax_max(float a, float b, float c) {
 
 	return __int_as_float(result);
 }
+
+// Mask of the lanes in the warp below the current thread
+__device__ inline unsigned lanemask_lt() {
+	unsigned mask;
+	asm("mov.u32 %0, %%lanemask_lt;" : "=r"(mask));
+	return mask;
+}
+
+// Returns a mask of the threads in the warp that have the same key, and the rank of the current thread among them
+// Before Volta there is no __match_any_sync, every thread is then its own group
+template<typename Key>
+__device__ inline unsigned warp_peers(Key key, int & rank) {
+#if __CUDA_ARCH__ >= 700
+	unsigned peers = __match_any_sync(__activemask(), key);
+#else
+	unsigned peers = 1u << (threadIdx.x & 31);
+#endif
+	rank = __popc(peers & lanemask_lt());
+	return peers;
+}
+
+// Increments counters[key] by one, returns the old value
+// The atomic is aggregated across threads in the warp that share the same key,
+// this reduces contention significantly since neighbouring Rays often have the same key
+__device__ inline int warp_aggregated_increment(int * counters, int key) {
+	int      rank;
+	unsigned peers  = warp_peers(key, rank);
+	int      leader = __ffs(peers) - 1;
+
+	int offset = 0;
+	if (rank == 0) {
+		offset = atomicAdd(&counters[key], __popc(peers));
+	}
+	return __shfl_sync(peers, offset, leader) + rank;
+}
+
+// Drop in replacement for atomicAdd(counter, 1) to append to a queue, returns the index to write to
+// The active threads of the warp that append to the same counter are compacted into a single atomic
+__device__ inline int warp_aggregated_increment(int * counter) {
+	int      rank;
+	unsigned peers  = warp_peers(reinterpret_cast<unsigned long long>(counter), rank);
+	int      leader = __ffs(peers) - 1;
+
+	int offset = 0;
+	if (rank == 0) {
+		offset = atomicAdd(counter, __popc(peers));
+	}
+	return __shfl_sync(peers, offset, leader) + rank;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include "Util.h"
+#include "Config.h"
+
+// Variable rate sampling renders every Tile of VARIABLE_RATE_TILE_SIZE x VARIABLE_RATE_TILE_SIZE Pixels only once every 2^n frames,
+// where n is read from the sampling rate map. The skipped Pixels are left out of the Pixel list of kernel_generate,
+// kernel_accumulate keeps their accumulated colour and tracks per Pixel sample counts in adaptive_moments
+
+// Optional user mask, per Tile the log2 of the number of frames between samples, indexed by tile_x + tile_y * variable_rate_tiles_x
+// If no mask is bound the rate is derived from the distance to the foveation centre
+__device__ __constant__ unsigned char * variable_rate_mask;
+__device__ __constant__ int             variable_rate_tiles_x;
+
+__device__ inline bool variable_rate_enabled() {
+	return config.enable_variable_rate && !CONFIG_ENABLE_SVGF;
+}
+
+__device__ inline int variable_rate_log2(int tile_x, int tile_y) {
+	if (variable_rate_mask) {
+		return variable_rate_mask[tile_x + tile_y * variable_rate_tiles_x];
+	}
+
+	// Foveation, full rate inside the radius and one halving of the rate per additional radius outwards
+	// Distances are relative to the screen height so that the fovea stays round
+	float x = (float(tile_x) + 0.5f) * float(VARIABLE_RATE_TILE_SIZE) - config.variable_rate_centre_x * float(screen_width);
+	float y = (float(tile_y) + 0.5f) * float(VARIABLE_RATE_TILE_SIZE) - config.variable_rate_centre_y * float(screen_height);
+
+	float distance = sqrtf(x*x + y*y) / (config.variable_rate_radius * float(screen_height));
+
+	return clamp(int(distance), 0, VARIABLE_RATE_MAX_LOG2);
+}
+
+// Whether Pixel (x, y) is rendered on the given frame, the first frame is always rendered densely
+__device__ inline bool variable_rate_sampled(int x, int y, int frame) {
+	if (!variable_rate_enabled() || frame == 0) return true;
+
+	int tile_x = x / VARIABLE_RATE_TILE_SIZE;
+	int tile_y = y / VARIABLE_RATE_TILE_SIZE;
+
+	int period = 1 << variable_rate_log2(tile_x, tile_y);
+
+	// Stagger neighbouring Tiles over the frames to keep the Ray count per frame even
+	int phase = (tile_x + 3 * tile_y) & (period - 1);
+
+	return ((frame + phase) & (period - 1)) == 0;
+}
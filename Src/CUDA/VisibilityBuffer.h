@@ -0,0 +1,68 @@
+#pragma once
+#include "Util.h"
+
+#include "Raytracing/Ray.h"
+#include "Raytracing/Mesh.h"
+#include "Raytracing/Triangle.h"
+
+// Primary visibility as rasterised by the host using OpenGL, see Renderer/Integrators/VisibilityBuffer.h
+// Every Pixel holds the TLAS slot of the visible Mesh and its Triangle before BVH reordering, or INVALID where nothing was drawn
+__device__ __constant__ Surface<int2> visibility_buffer;
+__device__ __constant__ const int *   visibility_triangle_indices; // Maps the Triangles before BVH reordering to the aggregated Triangles
+
+// Reconstructs the hit of a primary Ray from the rasterised Triangle of its Pixel, without any traversal
+// The Ray is only tested against the plane of the Triangle, the rasteriser already decided that the Triangle is the visible one.
+// Rays that pass just outside the Triangle, where the rasteriser and the Ray disagree, get their barycentrics clamped to its edges
+__device__ inline RayHit visibility_buffer_get_hit(int x, int y, const Ray & ray) {
+	RayHit hit;
+	hit.t           = INFINITY;
+	hit.u           = 0.0f;
+	hit.v           = 0.0f;
+	hit.mesh_id     = INVALID;
+	hit.triangle_id = INVALID;
+
+	int2 ids = visibility_buffer.get(x, y);
+	if (ids.x == INVALID) return hit;
+
+	int mesh_id     = ids.x;
+	int triangle_id = __ldg(&visibility_triangle_indices[ids.y]);
+
+	// Intersect in object space like traversal does, so that t has the same meaning
+	Matrix3x4 transform_inv = mesh_get_transform_inv(mesh_id);
+
+	Ray ray_object = ray;
+	matrix3x4_transform_position (transform_inv, ray_object.origin);
+	matrix3x4_transform_direction(transform_inv, ray_object.direction);
+
+	TrianglePos triangle = triangle_get_positions(triangle_id);
+
+	float3 h = cross(ray_object.direction, triangle.position_edge_2);
+	float  a = dot(triangle.position_edge_1, h);
+
+	float  f = 1.0f / a;
+	float3 s = ray_object.origin - triangle.position_0;
+	float3 q = cross(s, triangle.position_edge_1);
+
+	float u = f * dot(s, h);
+	float v = f * dot(ray_object.direction, q);
+	float t = f * dot(triangle.position_edge_2, q);
+
+	// Triangles seen edge on can be rasterised while the Ray is parallel to them, use the closest point to their centre instead
+	if (!(t > 0.0f && t < INFINITY)) {
+		float3 centre = triangle.position_0 + (triangle.position_edge_1 + triangle.position_edge_2) * (1.0f / 3.0f);
+
+		u = 1.0f / 3.0f;
+		v = 1.0f / 3.0f;
+		t = fmaxf(dot(centre - ray_object.origin, ray_object.direction) / dot(ray_object.direction, ray_object.direction), 0.0f);
+	}
+
+	u = clamp(u, 0.0f, 1.0f);
+	v = clamp(v, 0.0f, 1.0f - u);
+
+	hit.t           = t;
+	hit.u           = u;
+	hit.v           = v;
+	hit.mesh_id     = mesh_id;
+	hit.triangle_id = triangle_id;
+	return hit;
+}
@@ -0,0 +1,221 @@
+#pragma once
+#include "Util.h"
+#include "Medium.h"
+#include "Sampling.h"
+
+// Heterogeneous Media scale the sigma_a and sigma_s of their Medium by a density read from a dense grid
+// The grid is divided into cells of MEDIUM_GRID_MAJORANT_CELL_SIZE^3 voxels that store the maximum density that trilinear interpolation
+// can return inside them. Free path sampling and transmittance estimation march through these cells, so that empty space is skipped
+// in a single step and dense regions only use a tight local majorant
+struct MediumGrid {
+	float3 bounds_min;
+	int    density_offset; // Offset into medium_grid_data, INVALID if the Medium is homogeneous
+	float3 bounds_max;
+	int    majorant_offset;
+	int3   resolution;
+	int3   majorant_resolution;
+};
+
+__device__ __constant__ const MediumGrid * medium_grids; // One per Medium
+__device__ __constant__ const float      * medium_grid_data;
+
+__device__ inline bool medium_is_heterogeneous(int medium_id) {
+	return __ldg(&medium_grids[medium_id].density_offset) != INVALID;
+}
+
+__device__ inline MediumGrid medium_get_grid(int medium_id) {
+	return medium_grids[medium_id];
+}
+
+__device__ inline float medium_grid_voxel(const MediumGrid & grid, int x, int y, int z) {
+	x = clamp(x, 0, grid.resolution.x - 1);
+	y = clamp(y, 0, grid.resolution.y - 1);
+	z = clamp(z, 0, grid.resolution.z - 1);
+
+	return __ldg(&medium_grid_data[grid.density_offset + x + grid.resolution.x * (y + grid.resolution.y * z)]);
+}
+
+// Trilinearly interpolated density at a world space position inside the bounds of the grid
+__device__ inline float medium_grid_density(const MediumGrid & grid, float3 position) {
+	float3 p = (position - grid.bounds_min) / (grid.bounds_max - grid.bounds_min) * make_float3(grid.resolution) - 0.5f;
+
+	float3 p_floor = floorf(p);
+	float3 f = p - p_floor;
+
+	int x = int(p_floor.x);
+	int y = int(p_floor.y);
+	int z = int(p_floor.z);
+
+	float d00 = lerp(medium_grid_voxel(grid, x, y,     z),     medium_grid_voxel(grid, x + 1, y,     z),     f.x);
+	float d10 = lerp(medium_grid_voxel(grid, x, y + 1, z),     medium_grid_voxel(grid, x + 1, y + 1, z),     f.x);
+	float d01 = lerp(medium_grid_voxel(grid, x, y,     z + 1), medium_grid_voxel(grid, x + 1, y,     z + 1), f.x);
+	float d11 = lerp(medium_grid_voxel(grid, x, y + 1, z + 1), medium_grid_voxel(grid, x + 1, y + 1, z + 1), f.x);
+
+	return lerp(lerp(d00, d10, f.y), lerp(d01, d11, f.y), f.z);
+}
+
+// 3D DDA over the majorant cells along the Ray segment [t_min, t_max) clipped to the bounds of the grid
+// Calls callback(t_enter, t_exit, majorant_density) for every cell in order, until the callback returns false
+template<typename Callback>
+__device__ void medium_grid_march(const MediumGrid & grid, float3 origin, float3 direction, float t_min, float t_max, Callback callback) {
+	float3 inv_direction = make_float3(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+
+	float3 t0 = (grid.bounds_min - origin) * inv_direction;
+	float3 t1 = (grid.bounds_max - origin) * inv_direction;
+
+	float3 t_near = fminf(t0, t1);
+	float3 t_far  = fmaxf(t0, t1);
+
+	float t_enter = fmaxf(t_min, fmaxf(fmaxf(t_near.x, t_near.y), t_near.z));
+	float t_exit  = fminf(t_max, fminf(fminf(t_far .x, t_far .y), t_far .z));
+
+	if (!(t_enter < t_exit)) return;
+
+	float3 cell_size = (grid.bounds_max - grid.bounds_min) / make_float3(grid.majorant_resolution);
+
+	float3 p = (origin + t_enter * direction - grid.bounds_min) / cell_size;
+	int3 cell = clamp(make_int3(floorf(p)), make_int3(0), grid.majorant_resolution - 1);
+
+	int3 step = make_int3(
+		direction.x >= 0.0f ? 1 : -1,
+		direction.y >= 0.0f ? 1 : -1,
+		direction.z >= 0.0f ? 1 : -1
+	);
+
+	// Distance along the Ray to the next cell boundary on every axis, and between boundaries
+	float3 t_next = make_float3(
+		direction.x != 0.0f ? (grid.bounds_min.x + float(cell.x + (step.x > 0)) * cell_size.x - origin.x) * inv_direction.x : INFINITY,
+		direction.y != 0.0f ? (grid.bounds_min.y + float(cell.y + (step.y > 0)) * cell_size.y - origin.y) * inv_direction.y : INFINITY,
+		direction.z != 0.0f ? (grid.bounds_min.z + float(cell.z + (step.z > 0)) * cell_size.z - origin.z) * inv_direction.z : INFINITY
+	);
+	float3 t_delta = cell_size * fabs(inv_direction);
+
+	float t = t_enter;
+	while (t < t_exit) {
+		float t_cell_exit = fminf(t_exit, fminf(fminf(t_next.x, t_next.y), t_next.z));
+
+		int   cell_index       = cell.x + grid.majorant_resolution.x * (cell.y + grid.majorant_resolution.y * cell.z);
+		float majorant_density = __ldg(&medium_grid_data[grid.majorant_offset + cell_index]);
+
+		if (!callback(t, t_cell_exit, majorant_density)) return;
+
+		t = t_cell_exit;
+
+		if (t_next.x <= t_next.y && t_next.x <= t_next.z) {
+			cell.x += step.x; t_next.x += t_delta.x;
+			if (cell.x < 0 || cell.x >= grid.majorant_resolution.x) return;
+		} else if (t_next.y <= t_next.z) {
+			cell.y += step.y; t_next.y += t_delta.y;
+			if (cell.y < 0 || cell.y >= grid.majorant_resolution.y) return;
+		} else {
+			cell.z += step.z; t_next.z += t_delta.z;
+			if (cell.z < 0 || cell.z >= grid.majorant_resolution.z) return;
+		}
+	}
+}
+
+// Tracking needs an unbounded number of random numbers, these come from a hash chain per path vertex
+__device__ inline unsigned volume_rng_init(int pixel_index, int bounce, int sample_index, unsigned salt) {
+	return hash_combine(hash_combine(pcg_hash(pixel_index * MAX_BOUNCES + bounce), sample_index), salt);
+}
+
+enum struct VolumeEvent {
+	NONE,    // The Ray left the Medium (or reached its hit) without a real collision
+	SCATTER,
+	ABSORB
+};
+
+// Spectral tracking, delta tracking generalized to RGB (Kutz et al. 2017), along the Ray segment [0, t_max)
+// Collisions with the majorant are classified as absorption, scattering or null collisions with probabilities based on the current throughput,
+// the throughput is reweighted accordingly. For a SCATTER event t_scatter is set to the distance of the collision
+__device__ inline VolumeEvent volume_sample_distance(int medium_id, float3 origin, float3 direction, float t_max, unsigned & rng_state, float3 & throughput, float & t_scatter) {
+	HomogeneousMedium medium = medium_as_homogeneous(medium_id);
+	MediumGrid        grid   = medium_get_grid(medium_id);
+
+	float3 sigma_t     = medium.sigma_a + medium.sigma_s;
+	float  sigma_t_max = fmaxf(fmaxf(sigma_t.x, sigma_t.y), sigma_t.z);
+
+	VolumeEvent event = VolumeEvent::NONE;
+
+	medium_grid_march(grid, origin, direction, 0.0f, t_max, [&](float t_enter, float t_exit, float majorant_density) {
+		float majorant = majorant_density * sigma_t_max;
+		if (!(majorant > 0.0f)) return true; // Empty space
+
+		float t = t_enter;
+		while (true) {
+			t += sample_exp(majorant, 1.0f - random_hash_chain(rng_state));
+			if (t >= t_exit) return true; // Free flight continues in the next cell
+
+			float density = medium_grid_density(grid, origin + t * direction);
+
+			float3 sigma_a = density * medium.sigma_a;
+			float3 sigma_s = density * medium.sigma_s;
+			float3 sigma_n = make_float3(majorant) - sigma_a - sigma_s;
+
+			float p_a = dot(throughput, sigma_a);
+			float p_s = dot(throughput, sigma_s);
+			float p_n = dot(throughput, sigma_n);
+			float p_sum = p_a + p_s + p_n;
+
+			if (!(p_sum > 0.0f)) {
+				event = VolumeEvent::ABSORB;
+				return false;
+			}
+
+			float u = random_hash_chain(rng_state) * p_sum;
+			if (u < p_a) {
+				event = VolumeEvent::ABSORB;
+				return false;
+			} else if (u < p_a + p_s) {
+				throughput *= sigma_s * p_sum / (majorant * p_s);
+				t_scatter = t;
+				event = VolumeEvent::SCATTER;
+				return false;
+			} else {
+				throughput *= sigma_n * p_sum / (majorant * p_n);
+			}
+		}
+	});
+
+	return event;
+}
+
+// Ratio tracking estimate of the transmittance along the Ray segment [0, t_max), used for shadow Rays
+// Once the estimate becomes small Russian Roulette decides whether to continue
+__device__ inline float3 volume_transmittance(int medium_id, float3 origin, float3 direction, float t_max, unsigned & rng_state) {
+	HomogeneousMedium medium = medium_as_homogeneous(medium_id);
+	MediumGrid        grid   = medium_get_grid(medium_id);
+
+	float3 sigma_t     = medium.sigma_a + medium.sigma_s;
+	float  sigma_t_max = fmaxf(fmaxf(sigma_t.x, sigma_t.y), sigma_t.z);
+
+	constexpr float RUSSIAN_ROULETTE_THRESHOLD = 0.1f;
+
+	float3 transmittance = make_float3(1.0f);
+
+	medium_grid_march(grid, origin, direction, 0.0f, t_max, [&](float t_enter, float t_exit, float majorant_density) {
+		float majorant = majorant_density * sigma_t_max;
+		if (!(majorant > 0.0f)) return true; // Empty space
+
+		float t = t_enter;
+		while (true) {
+			t += sample_exp(majorant, 1.0f - random_hash_chain(rng_state));
+			if (t >= t_exit) return true;
+
+			float density = medium_grid_density(grid, origin + t * direction);
+			transmittance *= make_float3(1.0f) - density * sigma_t / majorant;
+
+			float transmittance_max = fmaxf(fmaxf(transmittance.x, transmittance.y), transmittance.z);
+			if (transmittance_max < RUSSIAN_ROULETTE_THRESHOLD) {
+				float survive_probability = transmittance_max / RUSSIAN_ROULETTE_THRESHOLD;
+				if (!(random_hash_chain(rng_state) < survive_probability)) {
+					transmittance = make_float3(0.0f);
+					return false;
+				}
+				transmittance /= survive_probability;
+			}
+		}
+	});
+
+	return transmittance;
+}
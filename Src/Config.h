@@ -2,13 +2,17 @@
 #include "CUDA/Common.h"
 
 #include "Core/Array.h"
+#include "Core/IO.h"
 #include "Core/String.h"
+#include "Core/Allocators/LargePageAllocator.h"
 
 inline GPUConfig gpu_config = { };
 
 enum struct IntegratorType {
 	PATHTRACER,
-	AO
+	AO,
+	MEGAKERNEL, // Pathtracer that always renders with kernel_megakernel, see Pathtracer::use_megakernel
+	BAKE        // Pathtracer that starts its paths on the texels of the UV atlas of the Meshes instead of at the Camera, see CUDA/Bake.h. Headless only
 };
 
 enum struct OutputFormat {
@@ -16,12 +20,29 @@ enum struct OutputFormat {
 	PPM
 };
 
+enum struct EXRCompression {
+	NONE,
+	RLE,
+	ZIP, // Deflate, blocks of 16 scanlines
+	PIZ  // Wavelet + Huffman, blocks of 32 scanlines. Usually best for noisy images
+};
+
 enum struct MipmapFilterType {
 	BOX,
 	LANCZOS,
 	KAISER
 };
 
+enum struct BlockCompressionQuality {
+	FAST, // Single endpoint refinement pass
+	HIGH  // Additional refinement pass, roughly twice as slow
+};
+
+enum struct BlockCompressionFormat {
+	BC1, // 4 bits per pixel, RGB only
+	BC7  // 8 bits per pixel, RGBA with more precise endpoints and more interpolated colours per block
+};
+
 enum struct BVHType {
 	BVH,  // Binary SAH-based BVH
 	SBVH, // Binary SAH-based Spatial BVH
@@ -29,10 +50,48 @@ enum struct BVHType {
 	BVH8  // Compressed Wide BVH (8 way), constructed by collapsing the binary BVH
 };
 
+enum struct TraversalBackend {
+	SOFTWARE, // Trace Kernels in CUDA/Raytracing that traverse the BVH of cpu_config.bvh_type
+	OPTIX     // RT cores through OptiX, see OptiXTraversal. Only available if compiled with TRAVERSAL_OPTIX
+};
+
+enum struct BVHBuilderType {
+	SAH,   // Full SAH sweep over all three axes
+	LBVH,  // Linear BVH, primitives are sorted along a Morton curve. Much faster to build, lower quality
+	BINNED // Binned SAH, splits are only evaluated between a fixed number of bins. Faster to build than SAH on large meshes, slightly lower quality
+};
+
+// How the binary BVH of a single BLAS is built, it is always converted to the node format of cpu_config.bvh_type afterwards
+// Meshes in Mitsuba scenes can override cpu_config.bvh_build_policy with <string name="bvh" value="..."/>
+enum struct BVHBuildPolicy {
+	GLOBAL, // Builder implied by cpu_config.bvh_type and cpu_config.bvh_builder
+	AUTO,   // Chosen per Mesh from its Triangle count and the sibling overlap of a regular SAH BVH, see BVH::create_from_triangles
+	SAH,
+	SBVH,
+	LBVH,
+	BINNED
+};
+
+enum struct ThreadAffinity {
+	NONE, // Worker threads are left to the OS scheduler
+	CORE, // Every worker is pinned to one logical processor, filling one NUMA node before the next
+	NODE  // Workers are distributed over the NUMA nodes round robin and may run on any logical processor of their node
+};
+
+enum struct ViewLayout {
+	SINGLE,
+	STEREO, // Two parallel eyes, stereo_separation apart
+	CUBEMAP // Six faces with a 90 degree Field of View, in the order front, right, back, left, up, down relative to the Camera
+};
+
 struct CPUConfig {
 	int initial_width  = 900;
 	int initial_height = 600;
 
+	// The screen buffers are allocated for at least this size up front, so that resizing the window within it does not reallocate them. 0 allocates for the window size
+	int max_width  = 0;
+	int max_height = 0;
+
 	Array<String> scene_filenames;
 	String        sky_filename;
 
@@ -43,22 +102,157 @@ struct CPUConfig {
 	int    output_sample_index = INVALID;
 	String output_filename     = "render.ppm"_sv;
 
-	bool bvh_force_rebuild        = false;
-	bool enable_bvh_optimization  = false;
-	bool enable_block_compression = true;
-	bool enable_scene_update      = false;
+	bool headless    = false;   // Render to -o without creating a Window, requires -N
+	int  cuda_device = INVALID; // INVALID picks the Device with the highest compute capability
+
+	bool enable_multi_gpu = false; // Distribute the samples of a headless render over all Devices
+
+	int            thread_count    = 0; // Number of ThreadPool workers, 0 uses one per logical processor
+	ThreadAffinity thread_affinity = ThreadAffinity::NONE;
+
+	LargePageMode large_pages = LargePageMode::OFF; // Backs the big arrays of the loaders and BVH builders with large pages, see LargePageAllocator
+
+	IO::LogLevel log_level = IO::LogLevel::ALL; // Messages below this level are not printed, see IO::log_init
+
+	int           sample_index_first = 0; // Index of the first sample to render, allows multiple headless renders to contribute distinct samples to the same image
+	String        dump_filename;          // If set, a headless render also writes its raw Accumulators to this file, see AccumulatorFile
+	Array<String> merge_filenames;        // Accumulator files to merge into -o instead of rendering
+
+	int samples_per_launch = 1; // Samples per pixel a headless Pathtracer render takes in a single render call, they are summed in the framebuffer and accumulated at once
+
+	float convergence_target_error = 0.0f; // If above 0, a headless Pathtracer render stops once its relative error is below this (-N is the maximum), see Pathtracer::calc_convergence_error
+	int   convergence_interval     = 16;   // In samples, estimating the error synchronizes with the GPU
+	float time_budget              = 0.0f; // If above 0, a headless render stops after this many seconds of rendering
+
+	String ray_stats_filename; // If set, a headless render writes its average ray throughput per bounce to this file as JSON
+
+	String checkpoint_filename;              // If set, a headless render periodically saves its progress to this file, see Checkpoint
+	int    checkpoint_interval      = 64;    // In samples
+	bool   enable_checkpoint_resume = false; // Continue from checkpoint_filename if it exists and matches the render
+
+	String sequence_filename; // If set, every frame of this file is rendered headless with -N samples and written to -o with the frame number appended, see Sequence
+	String stream_command;    // If set, the frames of the sequence are tonemapped and piped into this command as raw RGB instead of being written to -o, see FrameStream
+
+	int server_port = INVALID; // If set, the Scene stays loaded and render jobs are accepted on this port of localhost, see RenderServer
+
+	String benchmark_filename;                           // If set, the benchmarks defined in this file are run headless instead of opening a Window, see Benchmark
+	String benchmark_output_filename = "benchmark.json"_sv;
+	String benchmark_baseline_filename;                  // If set, the results are compared against this earlier output and the program fails if any of them regressed
+	float  benchmark_threshold = 5.0f;                   // Regression threshold in percent
+
+	String traversal_benchmark_filename;                 // If set, only the BVH traversal Kernels are timed on fixed Ray sets and the results are written to this file, see TraversalBenchmark
+	int    traversal_benchmark_iteration_count = 16;
+	int    traversal_benchmark_shared_stack_size = SHARED_STACK_SIZE;
+
+	String       bvh_report_filename;      // If set, the BLAS of every OBJ/PLY in scene_filenames is built for every swept setting and the statistics are written to this file as CSV, see BVHReport
+	Array<float> bvh_report_sah_cost_node; // Values to sweep, if empty only sah_cost_node is used
+	Array<float> bvh_report_sah_cost_leaf;
+	Array<float> bvh_report_sbvh_alpha;
+
+	String trace_filename;        // If set, CPU and GPU timings of the first trace_frame_count frames are written to this file as a Chrome trace, see Profiler
+	int    trace_frame_count = 0;
+
+	bool enable_startup_report = false; // Prints the time spent on every load phase and Asset until the first frame, see Profiler::startup_end
+
+	EXRCompression exr_compression    = EXRCompression::NONE;
+	bool           exr_half_precision = true;
+	bool           exr_multilayer     = false; // Write the enabled AOVs as layers of the EXR output instead of as separate files
+
+	bool enable_denoiser = false; // Denoise the output of headless renders with Open Image Denoise, see Denoiser
+
+	bool bvh_force_rebuild           = false;
+	bool enable_bvh_cache            = false; // Load and store the final BVH in an uncompressed memory mapped cache file, see BVHLoader::BVH_CACHE_FILE_EXTENSION
+	bool enable_host_data_release    = false; // Free the host copies of the Triangles, BLAS Nodes and Textures once they are uploaded, they are read back from disk when needed again, see Integrator::release_host_data
+	bool enable_bvh_optimization     = false;
+	bool enable_bvh_restructuring    = false; // Treelet restructuring of every BLAS before the (optional) BVHOptimizer, see BVHRestructurer
+	bool enable_block_compression    = true;
+	bool enable_gpu_mipmapping       = false; // Generate the Mipmaps of uncompressed Textures on the GPU instead of during loading
+	bool enable_texture_streaming    = false; // Only keep the Mip levels that are actually sampled resident in VRAM, see Integrator::update_texture_streaming
+	bool enable_srgb_textures        = false; // Keep 8 bit colour Textures sRGB encoded and let the hardware decode them, instead of converting them to linear on load. Mip levels are always box filtered
+	bool enable_gpu_jpeg_decoding    = false; // Decode JPEG Textures with nvJPEG, only available if built with ENABLE_NVJPEG, see JPEGDecoder
+	bool enable_texture_cache        = false; // Load and store decoded Textures (with Mipmaps and Block Compression) in a cache file, see TextureLoader::TEXTURE_CACHE_FILE_EXTENSION
+	bool enable_scene_snapshot       = false; // Load and store the fully loaded Scene in a single snapshot file next to the first scene file, see SceneSnapshot
+	bool enable_mesh_lods            = false; // Look for simplified versions of every mesh file, named <file>.lod1 up to <file>.lod3, see AssetManager::add_mesh_data
+	bool enable_analytic_spheres     = false; // Load non emissive Mitsuba spheres as a single Curve with coinciding end points instead of Triangles, see curve_intersect_sphere
+	bool enable_out_of_core_geometry = false; // Allocate the Triangles and BVH Nodes in managed memory, which is paged out to the Host once the Device is full
+	bool enable_scene_update         = false;
+	bool enable_cuda_graph           = false; // Submit the Kernels of a frame as a single CUDA Graph instead of as individual launches
+	bool enable_async_ui             = false; // Keep updating the GUI and presenting while the GPU is still busy with a frame, instead of waiting for it
+	bool enable_persistent_queues    = false; // Launch the Sort and Material Kernels with an occupancy sized Grid that loops over its queue
+	bool enable_concurrent_materials = false; // Launch the Material Kernels of a bounce on their own streams, so that small queues run side by side
+	bool enable_shadow_overlap       = false; // Trace the shadow Rays of a bounce concurrently with the extension Rays of the next bounce
+	bool enable_fused_taa            = false; // Resolve SVGF and TAA in a single Kernel with the TAA neighbourhood in Shared Memory, see kernel_svgf_taa_resolve
+	bool enable_ray_sorting          = false; // Trace secondary Rays in order of direction octant and origin
+	bool enable_treelet_queues       = false; // Trace with the BVH8 in two passes, the TLAS first and then the Rays queued per BLAS (see TreeletQueues.h)
+	bool enable_async_tlas           = false; // Build the TLAS for the next frame on the ThreadPool while the GPU renders the current frame
+	bool enable_bvh8_short_stack     = false; // Compile the BVH8 traversal with a short thread local Stack and restarts, which uses no Shared Memory (see CONFIG_BVH8_SHORT_STACK)
+	bool enable_packed_ray_buffers   = false; // Store the Vector3s of the Pathtracer Ray buffers as float4 instead of SoA (see CONFIG_PACKED_RAY_BUFFERS)
+	bool enable_compact_ray_payloads = false; // Store the Material and Shadow Ray payloads at reduced precision (see CONFIG_COMPACT_RAY_PAYLOADS)
+
+	bool enable_autotune = false; // Measure the register limit and Block sizes of the Pathtracer Kernels on the current Scene and store them, see CUDAKernelTuning
+	int  max_registers   = 0;     // Register limit of the Pathtracer Kernels, 0 means the tuned value (if any) or MAX_REGISTERS is used
+
+	bool enable_specialised_kernels = false; // Compile the feature toggles of the GPUConfig into the Pathtracer Kernels, the Module is recompiled (or loaded from cache) when they change
+
+	int batch_size = INVALID; // Maximum number of pixels rendered in one wavefront, INVALID means it is derived from available GPU memory
+
+	int megakernel_threshold      = 0; // Frames with at most this many pixels are rendered by the fused megakernel instead of the wavefront Kernels, 0 disables
+	int megakernel_tail_threshold = 0; // Once at most this many paths are alive at the start of a bounce they are finished by the megakernel, 0 disables
+
+	int gpu_memory_budget = 0; // Upper bound in MB on the GPU memory the batch size is derived from, allows multiple processes to share a GPU. 0 means no bound
+
+	String variable_rate_mask_filename; // If set, greyscale image that replaces foveation as the sampling rate map of variable rate sampling, white is full rate. Stretched to the screen
+
+	ViewLayout view_layout       = ViewLayout::SINGLE; // Cameras derived from the Scene Camera that the Pathtracer traces in the same wavefront, see Integrator::view_count
+	float      stereo_separation = 0.064f;             // Distance between the eyes of ViewLayout::STEREO
+
+	int bake_resolution = 256; // Width and height of the tile of every Mesh in the atlas of IntegratorType::BAKE
+	int bake_dilation   = 4;   // Number of texels the baked UV islands are grown by
+
+	float render_scale = 1.0f; // Fraction of the window resolution the Pathtracer renders at, the result is upscaled to the window (kernel_upscale, kernel_taa_upscale). Headless renders always use full resolution
+
+	float frame_time_budget = 0.0f; // Target GPU frame time in milliseconds while the Camera is moving, the number of bounces is lowered to stay within it. 0 disables the budget
+	int   event_interval    = 1;    // GPU timing Events are recorded on every this many frames (0 for never), and on every frame while the GUI shows timings, the Profiler records or the frame time budget is set
+
+	int samples_per_present = 1; // While accumulating, render this many samples per swap of the Window so that throughput is not bound by presenting
 
 	MipmapFilterType mipmap_filter = MipmapFilterType::BOX;
 
-	BVHType bvh_type = BVHType::BVH8;
+	BlockCompressionQuality block_compression_quality = BlockCompressionQuality::HIGH;
+	BlockCompressionFormat  block_compression_format  = BlockCompressionFormat::BC1;
+
+	bool enable_sky_block_compression = true; // Store the Sky as BC6H instead of float4 if Block Compression is enabled, requires the Sky dimensions to be multiples of 4
+
+	int texture_streaming_budget = 1024; // Maximum size in MB of the resident Mip levels of all streamed Textures
+
+	BVHType        bvh_type    = BVHType::BVH8;
+	TraversalBackend traversal_backend = TraversalBackend::SOFTWARE; // The BLAS of bvh_type is still built, picking and the megakernel traverse it
+	BVHBuilderType bvh_builder  = BVHBuilderType::SAH; // Builder used for the binary BLAS that the other BVH types are collapsed from, ignored by the SBVH
+	BVHBuilderType tlas_builder = BVHBuilderType::SAH; // Builder used for the binary TLAS, only SAH and BINNED are supported
+
+	BVHBuildPolicy bvh_build_policy = BVHBuildPolicy::GLOBAL; // Default for Meshes that do not specify their own
+
+	int   bvh_auto_sbvh_max_triangles   = 1000000; // BVHBuildPolicy::AUTO never uses spatial splits on larger Meshes
+	int   bvh_auto_binned_min_triangles = 4000000; // BVHBuildPolicy::AUTO uses the binned builder on Meshes at least this large
+	float bvh_auto_sbvh_min_overlap     = 0.1f;    // BVHBuildPolicy::AUTO rebuilds as SBVH if the sibling overlap of the SAH BVH exceeds this, see BVH2::sibling_overlap
 
 	float sah_cost_node = 4.0f;
 	float sah_cost_leaf = 1.0f;
 
+	float tlas_refit_threshold = 1.25f; // The TLAS is refitted instead of rebuilt until its SAH cost exceeds this factor of the cost after the last rebuild, 0 always rebuilds
+
 	float sbvh_alpha = 10e-5f; // Alpha parameter for SBVH construction, alpha == 1 means regular BVH, alpha == 0 means full SBVH
 
+	float bvh_presplit_budget = 0.0f; // Additional Triangle references created by splitting elongated Triangles before construction, as a fraction of the Triangle count. Ignored by the SBVH
+
+	int bvh_compression_level = 7; // Deflate level (0-10) of BVH files, lower levels write faster but produce larger files
+
+	int bvh_restructure_iterations = 3; // Passes of treelet restructuring over the whole BVH, stops early once a pass no longer improves the SAH cost
+
 	int bvh_optimizer_max_time        = 60000; // Time limit in milliseconds
 	int bvh_optimizer_max_num_batches = 1000;
+
+	float bvh_optimizer_min_gain = 0.001f; // Optimization stops once the SAH cost improves by less than this fraction per second
 };
 
 inline CPUConfig cpu_config = { };
@@ -0,0 +1,190 @@
+#include "LargePageAllocator.h"
+
+#include <string.h>
+
+#include <atomic>
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+	#pragma comment(lib, "Advapi32.lib")
+#else
+	#include <stdlib.h>
+	#include <sys/mman.h>
+#endif
+
+#include "Core/IO.h"
+
+static LargePageMode mode = LargePageMode::OFF;
+
+static std::atomic<bool> warned = false;
+
+static void warn_once(StringView message) {
+	if (!warned.exchange(true)) {
+		IO::print(message);
+	}
+}
+
+// Stored in front of every allocation
+struct AllocationHeader {
+	void * base;
+	size_t mapped_size; // 0 if the allocation came from the regular heap
+};
+static_assert(sizeof(AllocationHeader) <= LargePageAllocator::ALIGNMENT);
+
+static size_t round_up(size_t size, size_t multiple) {
+	return (size + multiple - 1) / multiple * multiple;
+}
+
+#ifdef _WIN32
+static size_t large_page_size = 0; // 0 if large pages are not available
+
+// Large pages can only be allocated with SeLockMemoryPrivilege, which has to be granted to the user and then enabled for the process
+static bool enable_lock_memory_privilege() {
+	HANDLE token;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) return false;
+
+	TOKEN_PRIVILEGES privileges = { };
+	privileges.PrivilegeCount           = 1;
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+	// NOTE: AdjustTokenPrivileges succeeds if the privilege is not held, GetLastError tells whether it was enabled
+	bool success =
+		LookupPrivilegeValueA(nullptr, "SeLockMemoryPrivilege", &privileges.Privileges[0].Luid) &&
+		AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr) &&
+		GetLastError() == ERROR_SUCCESS;
+
+	CloseHandle(token);
+	return success;
+}
+#endif
+
+void LargePageAllocator::init(LargePageMode large_page_mode) {
+	mode = large_page_mode;
+
+#ifdef _WIN32
+	if (mode != LargePageMode::OFF) {
+		if (enable_lock_memory_privilege()) {
+			large_page_size = GetLargePageMinimum();
+		} else {
+			IO::print("WARNING: Large pages require the 'Lock pages in memory' privilege, using regular pages\n"_sv);
+		}
+	}
+#endif
+}
+
+LargePageMode LargePageAllocator::get_mode() {
+	return mode;
+}
+
+LargePageAllocator * LargePageAllocator::instance() {
+	static LargePageAllocator allocator = { };
+	return &allocator;
+}
+
+char * LargePageAllocator::map(size_t num_bytes, size_t * mapped_size) {
+#ifdef _WIN32
+	if (large_page_size > 0) {
+		size_t size = round_up(num_bytes, large_page_size);
+
+		void * ptr = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		if (ptr) {
+			*mapped_size = size;
+			return static_cast<char *>(ptr);
+		}
+		warn_once("WARNING: Unable to allocate large pages, physical memory is likely fragmented. Using regular pages\n"_sv);
+	}
+
+	void * ptr = VirtualAlloc(nullptr, num_bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	if (!ptr) return nullptr;
+
+	*mapped_size = num_bytes;
+	return static_cast<char *>(ptr);
+#else
+	static constexpr size_t HUGE_PAGE_SIZE = MEGABYTES(2);
+
+	size_t size = round_up(num_bytes, HUGE_PAGE_SIZE);
+
+	if (mode == LargePageMode::EXPLICIT) {
+		void * ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (ptr != MAP_FAILED) {
+			*mapped_size = size;
+			return static_cast<char *>(ptr);
+		}
+		warn_once("WARNING: No reserved huge pages left (see vm.nr_hugepages), using transparent huge pages\n"_sv);
+	}
+
+	// The kernel only backs 2 MB aligned ranges with transparent huge pages
+	// The mapping is padded by a huge page, after aligning the start the excess is unmapped again
+	size_t size_padded = size + HUGE_PAGE_SIZE;
+
+	void * ptr = mmap(nullptr, size_padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ptr == MAP_FAILED) return nullptr;
+
+	char * base    = static_cast<char *>(ptr);
+	char * aligned = reinterpret_cast<char *>(round_up(reinterpret_cast<size_t>(base), HUGE_PAGE_SIZE));
+
+	size_t excess_head = aligned - base;
+	size_t excess_tail = size_padded - excess_head - size;
+
+	if (excess_head > 0) munmap(base, excess_head);
+	if (excess_tail > 0) munmap(aligned + size, excess_tail);
+
+	madvise(aligned, size, MADV_HUGEPAGE); // Only a hint, fails if transparent huge pages are disabled
+
+	*mapped_size = size;
+	return aligned;
+#endif
+}
+
+void LargePageAllocator::unmap(void * ptr, size_t mapped_size) {
+#ifdef _WIN32
+	VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+	munmap(ptr, mapped_size);
+#endif
+}
+
+char * LargePageAllocator::alloc(size_t num_bytes) {
+	AllocationHeader header = { };
+	char * base = nullptr;
+
+	if (num_bytes >= THRESHOLD) {
+		base = map(num_bytes + ALIGNMENT, &header.mapped_size);
+	}
+
+	if (!base) {
+#ifdef _WIN32
+		base = static_cast<char *>(_aligned_malloc(num_bytes + ALIGNMENT, ALIGNMENT));
+#else
+		void * ptr = nullptr;
+		if (posix_memalign(&ptr, ALIGNMENT, num_bytes + ALIGNMENT) != 0) return nullptr;
+		base = static_cast<char *>(ptr);
+#endif
+		header.mapped_size = 0;
+	}
+	header.base = base;
+
+	char * ptr = base + ALIGNMENT;
+	memcpy(ptr - sizeof(AllocationHeader), &header, sizeof(AllocationHeader));
+
+	return ptr;
+}
+
+void LargePageAllocator::free(void * ptr) {
+	if (!ptr) return;
+
+	AllocationHeader header;
+	memcpy(&header, static_cast<char *>(ptr) - sizeof(AllocationHeader), sizeof(AllocationHeader));
+
+	if (header.mapped_size > 0) {
+		unmap(header.base, header.mapped_size);
+	} else {
+#ifdef _WIN32
+		_aligned_free(header.base);
+#else
+		::free(header.base);
+#endif
+	}
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "Allocator.h"
+
+enum struct LargePageMode {
+	OFF,         // Everything comes from the regular heap
+	TRANSPARENT, // Linux: madvise(MADV_HUGEPAGE) on 2 MB aligned mappings, the kernel backs them with huge pages when it can. Windows: same as EXPLICIT
+	EXPLICIT     // Linux: MAP_HUGETLB, requires reserved huge pages (vm.nr_hugepages). Windows: MEM_LARGE_PAGES, requires SeLockMemoryPrivilege. Falls back to TRANSPARENT
+};
+
+// Allocator for the giant arrays of the loaders and builders (Triangles, BVH Nodes, index arrays)
+// The random access of the builders over those arrays misses the TLB a lot with 4 KB pages, large pages cover 512 times as much memory per entry
+// Allocations below THRESHOLD come from the regular heap. All allocations are aligned to ALIGNMENT, so that this can replace AlignedAllocator<64>
+struct LargePageAllocator final : Allocator {
+	static constexpr size_t THRESHOLD = MEGABYTES(2);
+	static constexpr size_t ALIGNMENT = 64;
+
+	// Must be called before the first allocation, the mode of an allocation is remembered so it can be changed later
+	static void          init(LargePageMode mode);
+	static LargePageMode get_mode();
+
+	static LargePageAllocator * instance();
+
+	// Returns the LargePageAllocator if large pages are enabled, fallback otherwise
+	static Allocator * select(Allocator * fallback) {
+		return get_mode() != LargePageMode::OFF ? instance() : fallback;
+	}
+
+	// Maps at least num_bytes of memory, with large pages where possible. mapped_size receives the actual size, which unmap has to be given
+	// Returns nullptr on failure. Used directly by PinnedAllocator, which registers the mapping with CUDA
+	static char * map  (size_t num_bytes, size_t * mapped_size);
+	static void   unmap(void * ptr, size_t mapped_size);
+
+private:
+	LargePageAllocator() = default;
+
+	NON_COPYABLE(LargePageAllocator);
+	NON_MOVEABLE(LargePageAllocator);
+
+	~LargePageAllocator() = default;
+
+	char * alloc(size_t num_bytes) override;
+	void   free (void * ptr)       override;
+};
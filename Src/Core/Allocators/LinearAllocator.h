@@ -34,6 +34,27 @@ struct LinearAllocator final : Allocator {
 		}
 	}
 
+	// Position within the chain of buffers, rewinding to it releases everything allocated after it was taken
+	struct Mark {
+		LinearAllocator<Size> * buffer;
+		size_t                  offset;
+	};
+
+	Mark get_mark() {
+		LinearAllocator<Size> * buffer = this;
+		while (buffer->next && buffer->next->offset > 0) {
+			buffer = buffer->next;
+		}
+		return { buffer, buffer->offset };
+	}
+
+	void rewind(const Mark & mark) {
+		mark.buffer->offset = mark.offset;
+		if (mark.buffer->next) {
+			mark.buffer->next->reset(); // Buffers further down the chain are kept around for reuse
+		}
+	}
+
 private:
 	char * alloc(size_t num_bytes) override {
 		// Ensure alignment to 16 bytes for SIMD types
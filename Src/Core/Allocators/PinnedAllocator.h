@@ -1,5 +1,9 @@
 #pragma once
 #include "Allocator.h"
+#include "LargePageAllocator.h"
+
+#include "Core/Array.h"
+#include "Core/Mutex.h"
 
 #include "Device/CUDAMemory.h"
 
@@ -7,15 +11,50 @@
 // This is memory that is guarenteed not to be paged out by the OS
 // This memory should be used to upload data to the GPU
 // See: https://developer.nvidia.com/blog/how-optimize-data-transfers-cuda-cc/
+// With large pages enabled big staging buffers are mapped by the LargePageAllocator and registered with CUDA instead
 struct PinnedAllocator final : Allocator {
 private:
+	struct Registration {
+		void * ptr;
+		size_t mapped_size;
+	};
+
+	Mutex               registrations_mutex;
+	Array<Registration> registrations; // Allocations that were mapped with large pages
+
 	PinnedAllocator() { }
 
 	char * alloc(size_t num_bytes) override {
+		if (LargePageAllocator::get_mode() != LargePageMode::OFF && num_bytes >= LargePageAllocator::THRESHOLD) {
+			size_t mapped_size = 0;
+			char * ptr = LargePageAllocator::map(num_bytes, &mapped_size);
+
+			if (ptr) {
+				CUDACALL(cuMemHostRegister(ptr, mapped_size, 0));
+
+				MutexLock lock(registrations_mutex);
+				registrations.push_back({ ptr, mapped_size });
+				return ptr;
+			}
+		}
 		return CUDAMemory::malloc_pinned<char>(num_bytes);
 	}
 
 	void free(void * ptr) override {
+		{
+			MutexLock lock(registrations_mutex);
+
+			for (size_t i = 0; i < registrations.size(); i++) {
+				if (registrations[i].ptr == ptr) {
+					CUDACALL(cuMemHostUnregister(ptr));
+					LargePageAllocator::unmap(ptr, registrations[i].mapped_size);
+
+					registrations[i] = registrations.back();
+					registrations.pop_back();
+					return;
+				}
+			}
+		}
 		CUDAMemory::free_pinned(ptr);
 	}
 
@@ -9,6 +9,16 @@
 #include "Assertion.h"
 #include "Allocators/Allocator.h"
 
+// Types whose objects can be moved to a different address with memcpy, without calling the move constructor and destructor
+// This holds for all trivially copyable types, and for types that own memory through a plain pointer (Array, String) as long as nothing points back into the object
+template<typename T>
+struct IsTriviallyRelocatable {
+	static constexpr bool value = std::is_trivially_copyable_v<T>;
+};
+
+template<typename T>
+inline constexpr bool is_trivially_relocatable_v = IsTriviallyRelocatable<T>::value;
+
 template<typename T>
 struct Array {
 	char * buffer = nullptr;
@@ -35,18 +45,20 @@ struct Array {
 
 	constexpr Array(const Array & array) {
 		allocator = array.allocator;
-		resize(array.count);
-		for (size_t i = 0; i < count; i++) {
-			data()[i] = array.data()[i];
-		}
+		copy_from(array);
 	}
 
 	constexpr Array & operator=(const Array & array) {
-		allocator = array.allocator;
-		resize(array.count);
-		for (size_t i = 0; i < count; i++) {
-			data()[i] = array.data()[i];
+		if (this == &array) return *this;
+
+		if (allocator != array.allocator) {
+			// The current buffer has to go back to the Allocator it came from
+			destroy_buffer();
+			count    = 0;
+			capacity = 0;
 		}
+		allocator = array.allocator;
+		copy_from(array);
 		return *this;
 	}
 
@@ -88,7 +100,7 @@ struct Array {
 	constexpr void push_back(const T * elements, size_t element_count) {
 		grow_if_needed(element_count);
 		if constexpr (std::is_trivially_copyable_v<T>) {
-			memcpy(buffer + count, elements, element_count * sizeof(T));
+			memcpy(data() + count, elements, element_count * sizeof(T));
 			count += element_count;
 		} else {
 			for (size_t i = 0; i < element_count; i++) {
@@ -116,8 +128,14 @@ struct Array {
 		if (buffer) {
 			size_t num_move = std::min(count, new_count);
 
-			if constexpr (std::is_trivially_copyable_v<T>) {
-				memcpy(new_buffer, buffer, num_move * sizeof(T));
+			if constexpr (is_trivially_relocatable_v<T>) {
+				memcpy(static_cast<void *>(new_buffer), static_cast<const void *>(buffer), num_move * sizeof(T));
+
+				if constexpr (!std::is_trivially_destructible_v<T>) {
+					for (size_t i = num_move; i < count; i++) {
+						data()[i].~T();
+					}
+				}
 			} else {
 				// Move these elements over to the new buffer
 				for (size_t i = 0; i < num_move; i++) {
@@ -145,6 +163,15 @@ struct Array {
 		capacity = new_count;
 	}
 
+	// Like resize, but the new elements are not constructed, they must be written before they are read (see ThreadPool::parallel_init)
+	// The pages of a new buffer stay untouched this way, so that they end up on the NUMA node of the thread that writes them first
+	constexpr void resize_uninitialized(size_t new_count) {
+		static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>);
+
+		reserve(new_count);
+		count = new_count;
+	}
+
 	constexpr void resize_if_smaller(size_t new_count) {
 		if (count < new_count) {
 			resize(new_count);
@@ -157,8 +184,8 @@ struct Array {
 		char * new_buffer = Allocator::alloc_array<char>(allocator, new_capacity * sizeof(T));
 
 		if (buffer) {
-			if constexpr (std::is_trivially_copyable_v<T>) {
-				memcpy(new_buffer, buffer, count * sizeof(T));
+			if constexpr (is_trivially_relocatable_v<T>) {
+				memcpy(static_cast<void *>(new_buffer), static_cast<const void *>(buffer), count * sizeof(T));
 			} else {
 				for (size_t i = 0; i < count; i++) {
 					new (new_buffer + i * sizeof(T)) T(std::move(data()[i]));
@@ -213,6 +240,22 @@ struct Array {
 	constexpr const T & back () const { return data()[count - 1]; }
 
 private:
+	constexpr void copy_from(const Array & array) {
+		if constexpr (std::is_trivially_copyable_v<T>) {
+			clear();
+			reserve(array.count);
+			if (array.count > 0) {
+				memcpy(buffer, array.buffer, array.count * sizeof(T));
+			}
+			count = array.count;
+		} else {
+			resize(array.count);
+			for (size_t i = 0; i < count; i++) {
+				data()[i] = array.data()[i];
+			}
+		}
+	}
+
 	constexpr void destroy_buffer() {
 		if (buffer) {
 			if (!std::is_trivially_destructible_v<T>) {
@@ -236,3 +279,8 @@ private:
 		}
 	}
 };
+
+template<typename T>
+struct IsTriviallyRelocatable<Array<T>> {
+	static constexpr bool value = true;
+};
@@ -11,9 +11,9 @@ private:
 public:
 	BitArray() { }
 
-	BitArray(size_t size_int_bits) {
+	BitArray(size_t size_int_bits, Allocator * allocator = nullptr) : buffer(allocator) {
 		size_t buffer_size = (size_int_bits + SIZEOF_UNDERLYING_TYPE_IN_BITS - 1) / SIZEOF_UNDERLYING_TYPE_IN_BITS;
-		buffer = Array<UNDERLYING_TYPE>(buffer_size);
+		buffer.resize(buffer_size);
 	}
 
 	BitArray(const BitArray & other) {
@@ -2,12 +2,13 @@
 #include <string.h>
 
 namespace FNVHash {
-	inline size_t hash(const char bytes[], size_t length) {
-		// Based on: https://en.wikipedia.org/wiki/Fowler%E2%80%93Noll%E2%80%93Vo_hash_function
-		constexpr size_t FNV_OFFSET_BASIS = 14695981039346656037ull;
-		constexpr size_t FNV_PRIME        = 1099511628211ull;
+	// Based on: https://en.wikipedia.org/wiki/Fowler%E2%80%93Noll%E2%80%93Vo_hash_function
+	constexpr size_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+	constexpr size_t FNV_PRIME        = 1099511628211ull;
 
-		size_t hash = FNV_OFFSET_BASIS;
+	// Multiple pieces of data can be hashed together by passing the result of the previous call as seed
+	inline size_t hash(const char bytes[], size_t length, size_t seed = FNV_OFFSET_BASIS) {
+		size_t hash = seed;
 		for (size_t i = 0; i < length; i++) {
 			hash = hash ^ bytes[i];
 			hash = hash * FNV_PRIME;
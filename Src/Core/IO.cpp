@@ -1,6 +1,251 @@
 #include "IO.h"
 
+#include <string.h>
+
 #include <filesystem>
+#include <thread>
+#include <atomic>
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
+
+static constexpr size_t LOG_RING_SIZE      = KILOBYTES(64);
+static constexpr int    LOG_MAX_THREADS    = 256; // Threads beyond this write directly
+static constexpr size_t LOG_SUPPRESSED_MAX = 1024;
+
+// Single producer (the thread that owns it), single consumer (the log thread)
+// head and tail only ever increase, the position in the buffer is their value modulo LOG_RING_SIZE
+struct LogRing {
+	char buffer[LOG_RING_SIZE];
+
+	std::atomic<size_t> head = 0; // Written by the producer
+	std::atomic<size_t> tail = 0; // Written by the consumer, once the bytes up to it have reached stdout
+};
+
+static std::atomic<LogRing *> log_rings[LOG_MAX_THREADS] = { };
+static std::atomic<int>       log_ring_count = 0;
+
+static std::thread       log_thread;
+static std::atomic<bool> log_thread_running = false;
+
+static IO::LogLevel log_level = IO::LogLevel::ALL;
+
+struct LogThreadState {
+	LogRing * ring = nullptr;
+	bool      ring_unavailable = false;
+
+	bool         line_start    = true;
+	IO::LogLevel line_severity = IO::LogLevel::ALL;
+
+	// The most recent suppressed line, IO::exit prints it so that the reason of a failure does not get lost
+	char   suppressed[LOG_SUPPRESSED_MAX];
+	size_t suppressed_length = 0;
+};
+
+static thread_local LogThreadState log_thread_state;
+
+static void write_direct(const char * data, size_t size) {
+	fwrite(data, sizeof(char), size, stdout);
+}
+
+static LogRing * log_get_ring() {
+	LogThreadState & state = log_thread_state;
+
+	if (!state.ring && !state.ring_unavailable) {
+		int index = log_ring_count.fetch_add(1);
+		if (index < LOG_MAX_THREADS) {
+			state.ring = new LogRing();
+			log_rings[index].store(state.ring, std::memory_order_release);
+		} else {
+			state.ring_unavailable = true;
+		}
+	}
+	return state.ring;
+}
+
+static void log_ring_write(LogRing & ring, const char * data, size_t size) {
+	while (size > 0) {
+		size_t head = ring.head.load(std::memory_order_relaxed);
+		size_t tail = ring.tail.load(std::memory_order_acquire);
+
+		// Messages that fit are only written as a whole, otherwise the log thread could interleave them with other threads
+		size_t space = LOG_RING_SIZE - (head - tail);
+		if (space == 0 || (space < size && size <= LOG_RING_SIZE)) {
+			std::this_thread::yield(); // The ring is full, the console cannot keep up
+			continue;
+		}
+
+		size_t offset = head % LOG_RING_SIZE;
+		size_t count  = size;
+		if (count > space)                  count = space;
+		if (count > LOG_RING_SIZE - offset) count = LOG_RING_SIZE - offset;
+
+		memcpy(ring.buffer + offset, data, count);
+		ring.head.store(head + count, std::memory_order_release);
+
+		data += count;
+		size -= count;
+	}
+}
+
+// Returns true if anything was written
+static bool log_drain() {
+	size_t heads[LOG_MAX_THREADS];
+
+	bool written = false;
+
+	int ring_count = log_ring_count.load();
+	if (ring_count > LOG_MAX_THREADS) ring_count = LOG_MAX_THREADS;
+
+	for (int i = 0; i < ring_count; i++) {
+		LogRing * ring = log_rings[i].load(std::memory_order_acquire);
+		if (!ring) continue;
+
+		size_t tail = ring->tail.load(std::memory_order_relaxed);
+		size_t head = ring->head.load(std::memory_order_acquire);
+		heads[i] = head;
+
+		while (tail < head) {
+			size_t offset = tail % LOG_RING_SIZE;
+			size_t count  = head - tail;
+			if (count > LOG_RING_SIZE - offset) count = LOG_RING_SIZE - offset;
+
+			write_direct(ring->buffer + offset, count);
+			tail += count;
+
+			written = true;
+		}
+	}
+
+	if (!written) return false;
+
+	fflush(stdout);
+
+	// Producers only reuse the space and IO::flush only returns once the bytes are actually out
+	for (int i = 0; i < ring_count; i++) {
+		LogRing * ring = log_rings[i].load(std::memory_order_acquire);
+		if (!ring) continue;
+
+		ring->tail.store(heads[i], std::memory_order_release);
+	}
+	return true;
+}
+
+static void log_output(const char * data, size_t size) {
+	if (log_thread_running.load(std::memory_order_relaxed)) {
+		LogRing * ring = log_get_ring();
+		if (ring) {
+			log_ring_write(*ring, data, size);
+			return;
+		}
+	}
+	write_direct(data, size);
+}
+
+static void log_thread_main() {
+	while (log_thread_running.load()) {
+		if (!log_drain()) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+	log_drain();
+}
+
+void IO::log_init(LogLevel level) {
+	log_level = level;
+
+	if (log_thread_running.exchange(true)) return;
+
+	log_thread = std::thread(log_thread_main);
+
+	// Returning from main does not go through IO::exit
+	static bool registered = false;
+	if (!registered) {
+		atexit(log_free);
+		registered = true;
+	}
+}
+
+void IO::log_free() {
+	if (!log_thread_running.exchange(false)) return;
+
+	log_thread.join();
+}
+
+void IO::set_log_level(LogLevel level) {
+	log_level = level;
+}
+
+void IO::flush(bool include_suppressed) {
+	LogThreadState & state = log_thread_state;
+
+	if (include_suppressed && state.suppressed_length > 0) {
+		log_output(state.suppressed, state.suppressed_length);
+		state.suppressed_length = 0;
+	}
+
+	if (!log_thread_running.load()) {
+		fflush(stdout);
+		return;
+	}
+
+	int ring_count = log_ring_count.load();
+	if (ring_count > LOG_MAX_THREADS) ring_count = LOG_MAX_THREADS;
+
+	for (int i = 0; i < ring_count; i++) {
+		LogRing * ring = log_rings[i].load(std::memory_order_acquire);
+		if (!ring) continue;
+
+		size_t head = ring->head.load(std::memory_order_acquire);
+		while (ring->tail.load(std::memory_order_acquire) < head) {
+			std::this_thread::yield();
+		}
+	}
+}
+
+static IO::LogLevel classify(StringView str) {
+	if (str.size() >= 6 && memcmp(str.data(), "ERROR:",   6) == 0) return IO::LogLevel::ERRORS;
+	if (str.size() >= 8 && memcmp(str.data(), "WARNING:", 8) == 0) return IO::LogLevel::WARNINGS;
+	return IO::LogLevel::ALL;
+}
+
+void IO::write(StringView str) {
+	if (str.size() == 0) return;
+
+	LogThreadState & state = log_thread_state;
+
+	if (state.line_start) {
+		state.line_severity = classify(str);
+	}
+	state.line_start = str.data()[str.size() - 1] == '\n';
+
+	if (int(state.line_severity) > int(log_level)) {
+		// Keep the tail of the suppressed line
+		if (str.size() >= LOG_SUPPRESSED_MAX) {
+			memcpy(state.suppressed, str.end - LOG_SUPPRESSED_MAX, LOG_SUPPRESSED_MAX);
+			state.suppressed_length = LOG_SUPPRESSED_MAX;
+		} else {
+			// A new line replaces the previous one
+			bool previous_complete = state.suppressed_length > 0 && state.suppressed[state.suppressed_length - 1] == '\n';
+			if (previous_complete || state.suppressed_length + str.size() > LOG_SUPPRESSED_MAX) {
+				state.suppressed_length = 0;
+			}
+			memcpy(state.suppressed + state.suppressed_length, str.data(), str.size());
+			state.suppressed_length += str.size();
+		}
+		return;
+	}
+
+	log_output(str.data(), str.size());
+}
 
 String IO::get_error_message(errno_t error_code, Allocator * allocator) {
 	char error_message[512];
@@ -71,3 +316,122 @@ bool IO::file_write(const String & filename, StringView data) {
 
 	return true;
 }
+
+IO::MappedFile & IO::MappedFile::operator=(MappedFile && other) {
+	close();
+
+	ptr       = other.ptr;
+	length    = other.length;
+	is_mapped = other.is_mapped;
+
+	other.ptr       = nullptr;
+	other.length    = 0;
+	other.is_mapped = false;
+
+	return *this;
+}
+
+bool IO::MappedFile::open(const String & filename) {
+	close();
+
+	// NOTE: The file and mapping handles can be closed as soon as the view exists, the view keeps the mapping alive
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size)) {
+		CloseHandle(file);
+		return false;
+	}
+	length = size_t(file_size.QuadPart);
+
+	SYSTEM_INFO system_info;
+	GetSystemInfo(&system_info);
+
+	if (length > 0 && length % system_info.dwPageSize != 0) {
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping) {
+			ptr = static_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+			CloseHandle(mapping);
+		}
+	}
+	CloseHandle(file);
+#else
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd == -1) return false;
+
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0) {
+		::close(fd);
+		return false;
+	}
+	length = size_t(file_stat.st_size);
+
+	size_t page_size = size_t(sysconf(_SC_PAGESIZE));
+
+	if (length > 0 && length % page_size != 0) {
+		void * mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping != MAP_FAILED) {
+			ptr = static_cast<const char *>(mapping);
+			madvise(mapping, length, MADV_SEQUENTIAL);
+		}
+	}
+	::close(fd);
+#endif
+
+	if (ptr) {
+		// The remainder of the last page is zero filled, which provides the '\0'
+		is_mapped = true;
+		return true;
+	}
+
+	FILE * file_fallback = nullptr;
+#ifdef _WIN32
+	fopen_s(&file_fallback, filename.data(), "rb");
+#else
+	file_fallback = fopen(filename.data(), "rb");
+#endif
+	if (!file_fallback) return false;
+
+	char * data = Allocator::alloc_array<char>(nullptr, length + 1);
+	size_t num_read = fread(data, 1, length, file_fallback);
+	data[length] = '\0';
+
+	fclose(file_fallback);
+
+	ptr = data;
+
+	if (num_read != length) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void IO::MappedFile::close() {
+	if (ptr) {
+		if (is_mapped) {
+#ifdef _WIN32
+			UnmapViewOfFile(ptr);
+#else
+			munmap(const_cast<char *>(ptr), length);
+#endif
+		} else {
+			Allocator::free_array(nullptr, const_cast<char *>(ptr));
+		}
+	}
+
+	ptr       = nullptr;
+	length    = 0;
+	is_mapped = false;
+}
+
+IO::MappedFile IO::file_map(const String & filename) {
+	MappedFile file;
+	if (!file.open(filename)) {
+		IO::print("ERROR: Unable to map '{}'! ({})\n"_sv, filename, get_error_message(errno));
+		IO::exit(1);
+	}
+	return file;
+}
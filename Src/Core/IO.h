@@ -2,6 +2,7 @@
 #include <stdio.h>
 
 #include "Format.h"
+#include "Constructors.h"
 #include "Allocators/LinearAllocator.h"
 
 // Platform-specific types and includes
@@ -24,12 +25,33 @@
 #endif
 
 namespace IO {
+	// Messages are classified by their prefix ("ERROR:" or "WARNING:"), everything else is INFO
+	// The classification holds until the end of the line, so a line printed in multiple calls is kept or dropped as a whole
+	enum struct LogLevel {
+		ERRORS,   // Only errors are printed
+		WARNINGS, // Errors and warnings are printed
+		ALL
+	};
+
+	// Once started, printed messages are copied into a ring buffer per thread which a background thread drains to stdout
+	// Threads then no longer contend on the stdio lock or wait for the console. Without log_init messages are written directly
+	void log_init(LogLevel level);
+	void log_free(); // Called at exit automatically
+
+	void set_log_level(LogLevel level);
+
+	// Blocks until everything printed so far has been written to stdout
+	// If include_suppressed is true, the last suppressed line of the calling thread is written as well (see IO::exit)
+	void flush(bool include_suppressed = false);
+
+	void write(StringView str);
+
 	inline void print(char c) {
-		putchar(c);
+		write(StringView { &c, &c + 1 });
 	}
 
 	inline void print(StringView str) {
-		fwrite(str.data(), sizeof(char), str.size(), stdout);
+		write(str);
 	}
 
 	template<typename ... Args>
@@ -41,6 +63,7 @@ namespace IO {
 
 	[[noreturn]]
 	inline void exit(int code) {
+		flush(code != 0); // Unprefixed messages explaining a failure may have been suppressed
 		DEBUG_BREAK();
 		::exit(code);
 	}
@@ -53,4 +76,34 @@ namespace IO {
 
 	String file_read (const String & filename, Allocator * allocator);
 	bool   file_write(const String & filename, StringView data);
+
+	// Read-only file contents that are memory mapped, pages are only loaded once they are accessed
+	// NOTE: Like file_read, the data is always followed by a '\0'. Files that end exactly on a page boundary
+	// (or cannot be mapped) are read into memory instead, because the byte past the end would not be mapped
+	struct MappedFile {
+		MappedFile() = default;
+		~MappedFile() { close(); }
+
+		NON_COPYABLE(MappedFile);
+
+		MappedFile(MappedFile && other) { *this = std::move(other); }
+		MappedFile & operator=(MappedFile && other);
+
+		bool open(const String & filename); // Returns false on failure
+		void close();
+
+		const char * data() const { return ptr; }
+		size_t       size() const { return length; }
+
+		StringView view() const { return StringView { ptr, ptr + length }; }
+
+	private:
+		const char * ptr    = nullptr;
+		size_t       length = 0;
+
+		bool is_mapped = false; // Otherwise ptr was allocated
+	};
+
+	// Maps the file into memory, exits on failure like file_read
+	MappedFile file_map(const String & filename);
 }
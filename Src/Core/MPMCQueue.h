@@ -0,0 +1,91 @@
+#pragma once
+#include <atomic>
+
+#include "Constructors.h"
+
+#include "Math/Math.h"
+
+// Bounded lock-free multi-producer multi-consumer queue, see: https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+// Every cell carries a sequence number that tells producers and consumers whether it is their turn,
+// so that both sides only contend on their own position with a single compare-exchange
+template<typename T, size_t Capacity>
+struct MPMCQueue {
+	static_assert(Math::is_power_of_two(Capacity));
+
+	static constexpr size_t MASK = Capacity - 1;
+
+	static constexpr size_t CACHE_LINE_SIZE = 64;
+
+	MPMCQueue() {
+		for (size_t i = 0; i < Capacity; i++) {
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	NON_COPYABLE(MPMCQueue);
+	NON_MOVEABLE(MPMCQueue);
+
+	// Returns false if the queue is full
+	bool try_push(T item) {
+		size_t position = enqueue_position.load(std::memory_order_relaxed);
+
+		while (true) {
+			Cell & cell = cells[position & MASK];
+
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			ptrdiff_t diff = ptrdiff_t(sequence) - ptrdiff_t(position);
+
+			if (diff == 0) {
+				if (enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+					cell.data = std::move(item);
+					cell.sequence.store(position + 1, std::memory_order_release);
+					return true;
+				}
+			} else if (diff < 0) {
+				return false; // Full
+			} else {
+				position = enqueue_position.load(std::memory_order_relaxed); // Another producer took this cell
+			}
+		}
+	}
+
+	// Returns false if the queue is empty
+	bool try_pop(T & item) {
+		size_t position = dequeue_position.load(std::memory_order_relaxed);
+
+		while (true) {
+			Cell & cell = cells[position & MASK];
+
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			ptrdiff_t diff = ptrdiff_t(sequence) - ptrdiff_t(position + 1);
+
+			if (diff == 0) {
+				if (dequeue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+					item = std::move(cell.data);
+					cell.sequence.store(position + Capacity, std::memory_order_release);
+					return true;
+				}
+			} else if (diff < 0) {
+				return false; // Empty
+			} else {
+				position = dequeue_position.load(std::memory_order_relaxed); // Another consumer took this cell
+			}
+		}
+	}
+
+	// Only a snapshot, other threads may push or pop concurrently
+	bool is_empty() const {
+		return enqueue_position.load(std::memory_order_relaxed) == dequeue_position.load(std::memory_order_relaxed);
+	}
+
+private:
+	struct Cell {
+		std::atomic<size_t> sequence;
+		T                   data;
+	};
+
+	// Producers and consumers write to separate cache lines
+	alignas(CACHE_LINE_SIZE) Cell                cells[Capacity];
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> enqueue_position = 0;
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> dequeue_position = 0;
+};
@@ -1,6 +1,8 @@
 #pragma once
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <math.h>
 #include <cmath>
 
@@ -10,6 +12,8 @@
 #include "Util/Util.h"
 
 #ifdef _MSC_VER
+#include <intrin.h>
+
 #define strcasecmp _stricmp
 #define strncasecmp _strnicmp
 #endif
@@ -31,6 +35,34 @@ inline bool is_digit(char c) {
 	return c >= '0' && c <= '9';
 }
 
+// Returns the number of leading ASCII digits in the 8 bytes (loaded in little endian order)
+// The first non-digit byte is the lowest one that either exceeds '9' (sets the high bit when adding 0x46) or is below '0' (borrows when subtracting 0x30).
+// Carries and borrows only propagate towards higher bytes, so they can only affect bytes after the first non-digit
+inline int count_leading_digits(uint64_t chars) {
+	uint64_t non_digits = ((chars + 0x4646464646464646) | (chars - 0x3030303030303030)) & 0x8080808080808080;
+	if (non_digits == 0) return 8;
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, non_digits);
+	return int(index) / 8;
+#else
+	return __builtin_ctzll(non_digits) / 8;
+#endif
+}
+
+// Converts 8 ASCII digits (loaded in little endian order) into their value using three multiplications
+inline uint32_t parse_eight_digits(uint64_t chars) {
+	constexpr uint64_t MASK = 0x000000ff000000ff;
+	constexpr uint64_t MUL1 = 0x000f424000000064; // 100 + (1000000 << 32)
+	constexpr uint64_t MUL2 = 0x0000271000000001; // 1 + (10000 << 32)
+
+	chars -= 0x3030303030303030;
+	chars = (chars * 10) + (chars >> 8);
+	chars = (((chars & MASK) * MUL1) + (((chars >> 16) & MASK) * MUL2)) >> 32;
+
+	return uint32_t(chars);
+}
+
 inline bool is_whitespace(char c) {
 	return c == ' ' || c == '\t';
 }
@@ -116,12 +148,26 @@ struct Parser {
 		return c;
 	}
 
+	// Advances to the first occurrence of target, or to the end if there is none
+	void skip_until(char target) {
+		const char * found = reinterpret_cast<const char *>(memchr(cur, target, end - cur));
+		if (!found) found = end;
+
+		while (cur < found) {
+			location.advance(*cur);
+			cur++;
+		}
+	}
+
 	void seek(size_t offset) {
 		cur = start + offset;
 	}
 
 	void skip_whitespace() {
-		while (cur < end && is_whitespace(*cur)) advance();
+		while (cur < end && is_whitespace(*cur)) {
+			location.advance(*cur);
+			cur++;
+		}
 	}
 
 	void skip_whitespace_or_newline() {
@@ -137,7 +183,8 @@ struct Parser {
 
 	bool match(char target) {
 		if (cur < end && *cur == target) {
-			advance();
+			location.advance(target);
+			cur++;
 			return true;
 		}
 		return false;
@@ -176,9 +223,46 @@ struct Parser {
 		}
 	}
 
+	// Parses a run of decimal digits into mantissa and returns the number of digits
+	// Up to eight digits are parsed at a time, the mantissa wraps around if there are more than 19
+	int parse_digits(uint64_t & mantissa) {
+		static constexpr uint64_t POW10_INT[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000 };
+
+		const char * digits_start = cur;
+
+		while (end - cur >= 8) {
+			uint64_t eight_chars;
+			memcpy(&eight_chars, cur, sizeof(eight_chars));
+
+			int digit_count = count_leading_digits(eight_chars);
+			if (digit_count == 0) break;
+
+			if (digit_count < 8) {
+				// Shift the digits into the last bytes and pad the front with '0'
+				int shift = 8 * (8 - digit_count);
+				eight_chars = (eight_chars << shift) | (0x3030303030303030 >> (64 - shift));
+			}
+
+			mantissa = mantissa * POW10_INT[digit_count] + parse_eight_digits(eight_chars);
+			cur += digit_count;
+
+			if (digit_count < 8) break;
+		}
+		while (cur < end && is_digit(*cur)) {
+			mantissa = mantissa * 10 + uint64_t(*cur - '0');
+			cur++;
+		}
+
+		int digit_count = int(cur - digits_start);
+		location.col += digit_count; // Digits never affect the line
+		return digit_count;
+	}
+
 	float parse_float() {
-		if (match("nan") || match("NAN")) {
-			return NAN;
+		if (cur < end && (*cur == 'n' || *cur == 'N')) {
+			if (match("nan") || match("NAN")) {
+				return NAN;
+			}
 		}
 
 		bool sign = false;
@@ -189,53 +273,76 @@ struct Parser {
 		}
 		skip_whitespace();
 
-		if (match("inf") || match("INF") || match("infinity") || match("INFINITY")) {
-			return sign ? -INFINITY : INFINITY;
+		if (cur < end && (*cur == 'i' || *cur == 'I')) {
+			if (match("infinity") || match("INFINITY") || match("inf") || match("INF")) {
+				return sign ? -INFINITY : INFINITY;
+			}
 		}
 
-		double value = 0.0;
+		const char * number_start = cur;
 
-		bool has_integer_part    = false;
-		bool has_fractional_part = false;
+		// Integer and fractional digits are accumulated into the same mantissa
+		uint64_t mantissa = 0;
 
-		// Parse integer part
-		if (is_digit(*cur)) {
-			value = parse_int();
-			has_integer_part = true;
-		}
+		int integer_digit_count    = parse_digits(mantissa);
+		int fractional_digit_count = 0;
 
-		// Parse fractional part
 		if (match('.')) {
-			static constexpr double DIGIT_LUT[] = { 0.1, 0.01, 0.001, 0.0001, 0.00001, 0.000001, 0.0000001, 0.00000001, 0.000000001, 0.0000000001, 0.00000000001 };
-
-			int digit = 0;
-			while (is_digit(*cur)) {
-				double p;
-				if (digit < Util::array_count(DIGIT_LUT)) {
-					p = DIGIT_LUT[digit];
-				} else {
-					p = pow(0.1, digit);
-				}
-				value += double(*cur - '0') * p;
-
-				digit++;
-				advance();
-			}
-
-			has_fractional_part = digit > 0;
+			fractional_digit_count = parse_digits(mantissa);
 		}
 
-		if (!has_integer_part && !has_fractional_part) {
-			ERROR(location, "Expected float, got '{}'", char_to_str(*cur));
+		if (integer_digit_count == 0 && fractional_digit_count == 0) {
+			ERROR(location, "Expected float, got '{}'", char_to_str(cur < end ? *cur : '\0'));
 		}
 
-		// Parse exponent
+		int exponent = 0;
 		if (match('e') || match('E')) {
-			int exponent = parse_int();
-			value = value * pow(10.0, exponent);
+			exponent = parse_int();
+		}
+		exponent -= fractional_digit_count;
+
+		// Fast path: evaluate mantissa * 10^exponent in double precision, which is off by at most a few ulps.
+		// That is far below float precision, so unless the approximation lies right next to a point halfway
+		// between two floats, converting it to float gives the correctly rounded result
+		static constexpr double POW10[] = {
+			1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+		};
+		static constexpr double POW10_NEGATIVE[] = {
+			1e-0,  1e-1,  1e-2,  1e-3,  1e-4,  1e-5,  1e-6,  1e-7,  1e-8,  1e-9,  1e-10, 1e-11,
+			1e-12, 1e-13, 1e-14, 1e-15, 1e-16, 1e-17, 1e-18, 1e-19, 1e-20, 1e-21, 1e-22
+		};
+		static constexpr int POW10_MAX = Util::array_count(POW10) - 1;
+
+		if (integer_digit_count + fractional_digit_count <= 19 && exponent >= -POW10_MAX && exponent <= POW10_MAX) {
+			double approx = double(mantissa) * (exponent < 0 ? POW10_NEGATIVE[-exponent] : POW10[exponent]);
+
+			// Float drops the lower 29 bits of the double mantissa, check that these are not within 16 ulps of the halfway point
+			uint64_t bits;
+			memcpy(&bits, &approx, sizeof(bits));
+
+			constexpr uint64_t DROPPED_MASK = (1ull << 29) - 1;
+			constexpr uint64_t HALFWAY      =  1ull << 28;
+
+			uint64_t dropped = bits & DROPPED_MASK;
+			if (dropped + 16 - HALFWAY > 32) { // Unsigned wrap around, equivalent to |dropped - HALFWAY| > 16
+				float value = float(approx);
+				return sign ? -value : value;
+			}
+		}
+
+		// Slow path, let the C library round the literal correctly
+		char literal[128];
+		size_t literal_length = cur - number_start;
+
+		if (literal_length >= sizeof(literal)) {
+			ERROR(location, "Float literal is too long!\n");
 		}
+		memcpy(literal, number_start, literal_length);
+		literal[literal_length] = '\0';
 
-		return float(sign ? -value : value);
+		float value = strtof(literal, nullptr);
+		return sign ? -value : value;
 	}
 
 	int parse_int() {
@@ -244,18 +351,12 @@ struct Parser {
 			match('+');
 		}
 
-		if (!is_digit(*cur)) {
-			ERROR(location, "Expected integer digit, got '{}'", char_to_str(*cur));
-		}
-
-		int value = 0;
-		while (is_digit(*cur)) {
-			value *= 10;
-			value += *cur - '0';
-			advance();
+		uint64_t value = 0;
+		if (parse_digits(value) == 0) {
+			ERROR(location, "Expected integer digit, got '{}'", char_to_str(cur < end ? *cur : '\0'));
 		}
 
-		return sign ? -value : value;
+		return sign ? -int(value) : int(value);
 	}
 
 	StringView parse_identifier() {
@@ -3,6 +3,7 @@
 #include "Compare.h"
 
 #include "Util/Util.h"
+#include "Util/ThreadPool.h"
 
 namespace Sort {
 	template<typename T, typename Cmp = Compare::LessThan<T>>
@@ -206,4 +207,101 @@ namespace Sort {
 		Array<T> tmp = Array<T>(last - first);
 		radix_sort(first, last, tmp.data(), adapter);
 	}
+
+	// Parallel version of radix_sort using the ThreadPool, every chunk of the input builds its own histogram per pass
+	// The keys are evaluated once into a (key, value) array, so an adapter that performs a random access is not re-evaluated every pass
+	// With NUM_RADIX_BITS = 11 only 3 passes are needed instead of 4, at the cost of larger histograms. Passes on a digit that all keys share are skipped
+	template<unsigned NUM_RADIX_BITS = 8, typename T, typename Adapter = RadixSortAdapter<T>>
+	void radix_sort_parallel(T * first, T * last, Adapter adapter = { }) {
+		static constexpr unsigned NUM_PASSES = (32 + NUM_RADIX_BITS - 1) / NUM_RADIX_BITS;
+
+		static constexpr unsigned HISTOGRAM_SIZE = 1u << NUM_RADIX_BITS;
+		static constexpr unsigned HISTOGRAM_MASK = HISTOGRAM_SIZE - 1;
+
+		static constexpr int CHUNK_SIZE = 64 * 1024;
+
+		int count = int(last - first);
+		if (count <= CHUNK_SIZE) {
+			radix_sort(first, last, adapter);
+			return;
+		}
+
+		struct KeyValue {
+			unsigned key;
+			T        value;
+		};
+
+		Array<KeyValue> bufs[2] = { Array<KeyValue>(count), Array<KeyValue>(count) };
+
+		ThreadPool::parallel_for(0, count, CHUNK_SIZE, [&](int chunk_first, int chunk_last) {
+			for (int i = chunk_first; i < chunk_last; i++) {
+				bufs[0][i] = { adapter(first[i]), first[i] };
+			}
+		});
+
+		int chunk_count = (count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+		Array<unsigned> histograms(chunk_count * HISTOGRAM_SIZE);
+
+		int buf_in = 0;
+
+		for (unsigned pass = 0; pass < NUM_PASSES; pass++) {
+			unsigned shift = pass * NUM_RADIX_BITS;
+
+			const KeyValue * in  = bufs[buf_in]    .data();
+			KeyValue       * out = bufs[buf_in ^ 1].data();
+
+			ThreadPool::parallel_for(chunk_count, [&](int chunk) {
+				unsigned * histogram = histograms.data() + chunk * HISTOGRAM_SIZE;
+				memset(histogram, 0, HISTOGRAM_SIZE * sizeof(unsigned));
+
+				int chunk_last = (chunk + 1) * CHUNK_SIZE < count ? (chunk + 1) * CHUNK_SIZE : count;
+				for (int i = chunk * CHUNK_SIZE; i < chunk_last; i++) {
+					histogram[(in[i].key >> shift) & HISTOGRAM_MASK]++;
+				}
+			});
+
+			// Exclusive prefix sum over (digit, chunk), so that every chunk scatters to its own range of every digit and the sort stays stable
+			bool skip_pass = false;
+
+			unsigned sum = 0;
+			for (unsigned digit = 0; digit < HISTOGRAM_SIZE; digit++) {
+				unsigned digit_first = sum;
+
+				for (int chunk = 0; chunk < chunk_count; chunk++) {
+					unsigned & bucket = histograms[chunk * HISTOGRAM_SIZE + digit];
+					unsigned bucket_count = bucket;
+
+					bucket = sum;
+					sum += bucket_count;
+				}
+
+				// All keys share the same digit, the pass would not change the order
+				if (sum - digit_first == unsigned(count)) {
+					skip_pass = true;
+				}
+			}
+
+			if (skip_pass) continue;
+
+			ThreadPool::parallel_for(chunk_count, [&](int chunk) {
+				unsigned * offsets = histograms.data() + chunk * HISTOGRAM_SIZE;
+
+				int chunk_last = (chunk + 1) * CHUNK_SIZE < count ? (chunk + 1) * CHUNK_SIZE : count;
+				for (int i = chunk * CHUNK_SIZE; i < chunk_last; i++) {
+					out[offsets[(in[i].key >> shift) & HISTOGRAM_MASK]++] = in[i];
+				}
+			});
+
+			buf_in ^= 1;
+		}
+
+		const KeyValue * result = bufs[buf_in].data();
+
+		ThreadPool::parallel_for(0, count, CHUNK_SIZE, [&](int chunk_first, int chunk_last) {
+			for (int i = chunk_first; i < chunk_last; i++) {
+				first[i] = result[i].value;
+			}
+		});
+	}
 }
@@ -82,14 +82,17 @@ struct String {
 	}
 
 	constexpr String & operator=(const String & str) {
-		allocator = str.allocator;
+		if (this == &str) return *this;
+
 		if (length >= SSO_SIZE) {
-			if (length == str.length) {
+			if (length == str.length && allocator == str.allocator) {
 				memcpy(data(), str.data(), length + 1);
 				return *this;
 			}
+			// The current buffer has to go back to the Allocator it came from
 			Allocator::free_array(allocator, ptr);
 		}
+		allocator = str.allocator;
 
 		if (str.length >= SSO_SIZE) {
 			ptr = Allocator::alloc_array<char>(allocator, str.length + 1);
@@ -111,10 +114,12 @@ struct String {
 	}
 
 	constexpr String & operator=(String && str) noexcept {
-		allocator = str.allocator;
+		if (this == &str) return *this;
+
 		if (length >= SSO_SIZE) {
 			Allocator::free_array(allocator, ptr);
 		}
+		allocator = str.allocator;
 
 		length = str.length;
 		if (length < SSO_SIZE) {
@@ -183,6 +188,12 @@ inline bool operator> (const String & a, const String & b) { return strcmp(a.dat
 inline bool operator<=(const String & a, const String & b) { return strcmp(a.data(), b.data()) <= 0; }
 inline bool operator>=(const String & a, const String & b) { return strcmp(a.data(), b.data()) >= 0; }
 
+// The heap buffer is only referenced through ptr and the inline buffer is selected by length, so moving a String is a plain copy of its bytes
+template<>
+struct IsTriviallyRelocatable<String> {
+	static constexpr bool value = true;
+};
+
 template<>
 struct Hash<String> {
 	size_t operator()(const String & str) {
@@ -0,0 +1,248 @@
+#pragma once
+#include <string.h>
+
+#include <emmintrin.h>
+
+#include "Hash.h"
+#include "Compare.h"
+#include "Allocators/Allocator.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Hash Map in the style of Swiss Tables, see: https://abseil.io/about/design/swisstables
+// Slots are divided into groups of 16, every slot has a control byte that is either EMPTY or the low 7 bits of the hash of its Key.
+// A lookup compares all 16 control bytes of a group at once using SSE2 and only compares Keys of slots whose 7 bits match.
+// Same interface as HashMap, which makes it a drop-in replacement for maps with expensive to compare Keys such as Strings
+template<typename Key, typename Value, typename Hash = Hash<Key>, typename Cmp = Compare::Equal<Key>>
+struct SwissHashMap {
+	static constexpr size_t GROUP_SIZE = 16;
+
+	static constexpr signed char EMPTY = -128; // Full slots have the high bit cleared
+
+	struct Map {
+		size_t count    = 0;
+		size_t capacity = 0; // Multiple of GROUP_SIZE, the number of groups is a power of two
+
+		signed char * control = nullptr;
+		size_t      * hashes  = nullptr; // Kept so that growing does not have to rehash the Keys
+		char        * keys    = nullptr;
+		char        * values  = nullptr;
+
+		constexpr void init(Allocator * allocator, size_t cap) {
+			size_t group_count = 1;
+			while (group_count * GROUP_SIZE < cap) {
+				group_count *= 2;
+			}
+
+			count    = 0;
+			capacity = group_count * GROUP_SIZE;
+
+			control = Allocator::alloc_array<signed char>(allocator, capacity);
+			hashes  = Allocator::alloc_array<size_t>     (allocator, capacity);
+			keys    = Allocator::alloc_array<char>       (allocator, capacity * sizeof(Key));
+			values  = Allocator::alloc_array<char>       (allocator, capacity * sizeof(Value));
+
+			memset(control, EMPTY, capacity);
+		}
+
+		constexpr void free(Allocator * allocator) {
+			Key   * ks = get_keys();
+			Value * vs = get_values();
+
+			for (size_t i = 0; i < capacity; i++) {
+				if (control[i] != EMPTY) {
+					ks[i].~Key();
+					vs[i].~Value();
+				}
+			}
+
+			Allocator::free_array(allocator, control);
+			Allocator::free_array(allocator, hashes);
+			Allocator::free_array(allocator, keys);
+			Allocator::free_array(allocator, values);
+		}
+
+		static signed char hash_to_control(size_t hash) { return static_cast<signed char>(hash & 0x7f); }
+		static size_t      hash_to_group  (size_t hash) { return hash >> 7; }
+
+		static unsigned count_trailing_zeros(unsigned mask) {
+#ifdef _MSC_VER
+			unsigned long index;
+			_BitScanForward(&index, mask);
+			return unsigned(index);
+#else
+			return unsigned(__builtin_ctz(mask));
+#endif
+		}
+
+		// Bit i of the result is set if control byte i of the group equals value
+		unsigned match(size_t group, signed char value) const {
+			__m128i group_control = _mm_loadu_si128(reinterpret_cast<const __m128i *>(control + group * GROUP_SIZE));
+			return unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(group_control, _mm_set1_epi8(value))));
+		}
+
+		// Returns the slot index of the Key, or the first empty slot along its probe sequence if it is not present
+		size_t find_slot(size_t hash, const Key & key) const {
+			Cmp cmp = { };
+
+			size_t      group_mask = capacity / GROUP_SIZE - 1;
+			size_t      group      = hash_to_group(hash) & group_mask;
+			signed char h2         = hash_to_control(hash);
+
+			while (true) {
+				unsigned candidates = match(group, h2);
+				while (candidates) {
+					size_t i = group * GROUP_SIZE + count_trailing_zeros(candidates);
+					if (hashes[i] == hash && cmp(get_keys()[i], key)) {
+						return i;
+					}
+					candidates &= candidates - 1;
+				}
+
+				// Keys are never removed, so an empty slot means the Key cannot be in a later group
+				unsigned empty = match(group, EMPTY);
+				if (empty) {
+					return group * GROUP_SIZE + count_trailing_zeros(empty);
+				}
+
+				group = (group + 1) & group_mask;
+			}
+		}
+
+		Value & insert(size_t hash, Key key, Value value) {
+			size_t i = find_slot(hash, key);
+
+			if (control[i] != EMPTY) {
+				// Replace existing
+				return get_values()[i] = std::move(value);
+			}
+
+			control[i] = hash_to_control(hash);
+			hashes [i] = hash;
+			new (&get_keys()  [i]) Key(std::move(key));
+			new (&get_values()[i]) Value(std::move(value));
+			count++;
+			return get_values()[i];
+		}
+
+		Value * get(size_t hash, const Key & key) const {
+			size_t i = find_slot(hash, key);
+			return control[i] != EMPTY ? &get_values()[i] : nullptr;
+		}
+
+		constexpr Key   * get_keys  () const { return reinterpret_cast<Key   *>(keys); }
+		constexpr Value * get_values() const { return reinterpret_cast<Value *>(values); }
+	} map;
+
+	Allocator * allocator = nullptr;
+
+	SwissHashMap(Allocator * allocator = nullptr, size_t cap = 0) : allocator(allocator) {
+		map.init(allocator, cap);
+	}
+
+	NON_COPYABLE(SwissHashMap);
+	NON_MOVEABLE(SwissHashMap);
+
+	~SwissHashMap() {
+		map.free(allocator);
+	}
+
+	Value & insert(Key key, Value value) {
+		size_t hash = Hash()(key);
+		return insert_by_hash(hash, std::move(key), std::move(value));
+	}
+
+	Value & insert_by_hash(size_t hash, Key key, Value value) {
+		// Maximum load factor of 7/8, there is always at least one empty slot to terminate probing
+		if (8 * (map.count + 1) > 7 * map.capacity) {
+			grow(2 * map.capacity);
+		}
+		return map.insert(hash, std::move(key), std::move(value));
+	}
+
+	Value * try_get(const Key & key) const {
+		return try_get_by_hash(Hash()(key), key);
+	}
+
+	Value * try_get_by_hash(size_t hash, const Key & key) const {
+		return map.get(hash, key);
+	}
+
+	Value & operator[](const Key & key) {
+		size_t  hash  = Hash()(key);
+		Value * value = map.get(hash, key);
+
+		if (value) return *value;
+
+		return insert_by_hash(hash, key, Value { });
+	}
+
+	void clear() {
+		map.free(allocator);
+		map.init(allocator, 0);
+	}
+
+	struct Iterator {
+		Map  * map   = nullptr;
+		size_t index = 0;
+
+		Key   & get_key()   const { return map->get_keys  ()[index]; }
+		Value & get_value() const { return map->get_values()[index]; }
+
+		void operator++() {
+			if (map) {
+				while (index + 1 < map->capacity) {
+					index++;
+
+					if (map->control[index] != EMPTY) return;
+				}
+				map = nullptr;
+			}
+			index = 0;
+		}
+		void operator--() {
+			if (map) {
+				while (index > 0) {
+					index--;
+
+					if (map->control[index] != EMPTY) return;
+				}
+				map = nullptr;
+			}
+			index = 0;
+		}
+
+		bool operator==(const Iterator & other) const { return map == other.map && index == other.index; }
+		bool operator!=(const Iterator & other) const { return map != other.map || index != other.index; }
+	};
+
+	Iterator begin() {
+		for (size_t i = 0; i < map.capacity; i++) {
+			if (map.control[i] != EMPTY) {
+				return Iterator { &map, i };
+			}
+		}
+		return end();
+	}
+
+	Iterator end() {
+		return Iterator { nullptr, 0 };
+	}
+
+private:
+	void grow(size_t new_capacity) {
+		Map new_map = { };
+		new_map.init(allocator, new_capacity);
+
+		for (size_t i = 0; i < map.capacity; i++) {
+			if (map.control[i] != EMPTY) {
+				new_map.insert(map.hashes[i], std::move(map.get_keys()[i]), std::move(map.get_values()[i]));
+			}
+		}
+
+		map.free(allocator);
+		map = new_map;
+	}
+};
@@ -3,6 +3,8 @@
 
 #include "IO.h"
 
+#include "Util/Profiler.h"
+
 // Manual Timer
 struct Timer {
 	std::chrono::high_resolution_clock::time_point start_time;
@@ -30,16 +32,25 @@ struct Timer {
 };
 
 // Timer that records the time between its construction and destruction
+// The interval also ends up in the trace if the Profiler is recording
 struct ScopeTimer {
 	StringView name;
 	Timer      timer;
 
-	ScopeTimer(StringView name) : name(name) {
+	uint64_t time_start;
+
+	ScopeTimer(StringView name) : name(name), time_start(Profiler::get_time()) {
+		Profiler::range_push(name, "CPU"_sv);
 		timer.start();
 	}
 
 	~ScopeTimer() {
 		size_t duration = timer.stop();
+		Profiler::range_pop();
 		Timer::print_named_duration(name, duration);
+
+		if (Profiler::is_recording()) {
+			Profiler::record_cpu(name, "CPU"_sv, time_start, Profiler::get_time());
+		}
 	}
 };
@@ -8,17 +8,43 @@
 #include "Core/IO.h"
 #include "Core/Allocators/StackAllocator.h"
 
-static CUdevice  device;
-static CUcontext context;
+#include "CUDAMemory.h"
 
-static int device_get_attribute(CUdevice_attribute attribute, CUdevice cuda_device = device) {
+struct DeviceContext {
+	CUdevice  device;
+	CUcontext context;
+
+	int    compute_capability;
+	size_t total_memory;
+
+	char name[256];
+};
+
+static DeviceContext device_contexts[CUDAContext::MAX_DEVICES];
+static int           device_context_count = 0;
+
+static thread_local int current_device_context = 0;
+
+static int device_get_attribute(CUdevice_attribute attribute, CUdevice cuda_device) {
 	int result;
 	CUDACALL(cuDeviceGetAttribute(&result, attribute, cuda_device));
 
 	return result;
 }
 
-void CUDAContext::init() {
+static int device_get_attribute(CUdevice_attribute attribute) {
+	return device_get_attribute(attribute, device_contexts[current_device_context].device);
+}
+
+static int device_get_compute_capability(CUdevice device) {
+	int major = device_get_attribute(CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MAJOR, device);
+	int minor = device_get_attribute(CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MINOR, device);
+
+	return major * 10 + minor;
+}
+
+// Fills devices with the Devices that can be used, returns their count
+static int get_candidate_devices(bool enable_gl_interop, CUdevice * devices, int max_count) {
 	CUDACALL(cuInit(0));
 
 	int device_count;
@@ -29,36 +55,37 @@ void CUDAContext::init() {
 		IO::exit(1);
 	}
 
-	StackAllocator<128> allocator;
-	Array<CUdevice> devices(device_count, &allocator);
+	if (enable_gl_interop) {
+		unsigned gl_device_count;
+		CUDACALL(cuGLGetDevices(&gl_device_count, devices, max_count, CU_GL_DEVICE_LIST_ALL));
 
-	unsigned gl_device_count;
-	CUDACALL(cuGLGetDevices(&gl_device_count, devices.data(), device_count, CU_GL_DEVICE_LIST_ALL));
-
-	if (gl_device_count == 0) {
-		IO::print("ERROR: No suitable GL Device found!\n"_sv);
-		IO::exit(1);
+		if (gl_device_count == 0) {
+			IO::print("ERROR: No suitable GL Device found!\n"_sv);
+			IO::exit(1);
+		}
+		return int(gl_device_count);
 	}
 
-	CUdevice best_device;
-	int      best_compute_capability = 0;
-
-	for (unsigned i = 0; i < gl_device_count; i++) {
-		int major = device_get_attribute(CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MAJOR, devices[i]);
-		int minor = device_get_attribute(CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MINOR, devices[i]);
+	if (device_count > max_count) device_count = max_count;
 
-		int	device_compute_capability = major * 10 + minor;
-		if (device_compute_capability > best_compute_capability) {
-			best_device             = devices[i];
-			best_compute_capability = device_compute_capability;
-		}
+	for (int i = 0; i < device_count; i++) {
+		CUDACALL(cuDeviceGet(&devices[i], i));
 	}
+	return device_count;
+}
 
-	compute_capability = best_compute_capability;
+static void create_context(CUdevice device, bool enable_gl_interop) {
+	ASSERT(device_context_count < CUDAContext::MAX_DEVICES);
 
-	device = best_device;
+	DeviceContext & device_context = device_contexts[device_context_count++];
+	device_context.device             = device;
+	device_context.compute_capability = device_get_compute_capability(device);
 
-	CUDACALL(cuCtxCreate(&context, 0, device));
+	// Without a Window there is nothing to present, block instead of spinning while waiting on the GPU.
+	// This keeps the CPU free when multiple render processes share a machine
+	unsigned context_flags = enable_gl_interop ? 0 : CU_CTX_SCHED_BLOCKING_SYNC;
+
+	CUDACALL(cuCtxCreate(&device_context.context, context_flags, device));
 
 	CUfunc_cache   config_cache;
 	CUsharedconfig config_shared;
@@ -66,15 +93,18 @@ void CUDAContext::init() {
 	CUDACALL(cuCtxGetSharedMemConfig(&config_shared));
 
 	size_t bytes_free = 0;
-	CUDACALL(cuMemGetInfo(&bytes_free, &total_memory));
+	CUDACALL(cuMemGetInfo(&bytes_free, &device_context.total_memory));
 
 	int driver_version = 0;
 	CUDACALL(cuDriverGetVersion(&driver_version));
 
+	CUDACALL(cuDeviceGetName(device_context.name, sizeof(device_context.name), device));
+
 	IO::print("CUDA Info:\n"_sv);
+	IO::print("Device: {}\n"_sv, device_context.name);
 	IO::print("CUDA Version: {}.{}\n"_sv, driver_version / 1000, (driver_version % 1000) / 10);
-	IO::print("Compute Capability: {}\n"_sv, compute_capability);
-	IO::print("Memory available: {} MB\n"_sv, total_memory >> 20);
+	IO::print("Compute Capability: {}\n"_sv, device_context.compute_capability);
+	IO::print("Memory available: {} MB\n"_sv, device_context.total_memory >> 20);
 
 	switch (config_cache) {
 		case CU_FUNC_CACHE_PREFER_NONE:   IO::print("Cache Config: Prefer None\n"_sv);   break;
@@ -92,17 +122,100 @@ void CUDAContext::init() {
 	IO::print('\n');
 }
 
+void CUDAContext::init(bool enable_gl_interop, int device_index) {
+	CUdevice devices[MAX_DEVICES];
+	int candidate_count = get_candidate_devices(enable_gl_interop, devices, MAX_DEVICES);
+
+	if (device_index >= 0) {
+		if (device_index >= candidate_count) {
+			IO::print("ERROR: Device {} does not exist, {} Device(s) available!\n"_sv, device_index, candidate_count);
+			IO::exit(1);
+		}
+		devices[0]      = devices[device_index];
+		candidate_count = 1;
+	}
+
+	CUdevice best_device;
+	int      best_compute_capability = 0;
+
+	for (int i = 0; i < candidate_count; i++) {
+		int device_compute_capability = device_get_compute_capability(devices[i]);
+		if (device_compute_capability > best_compute_capability) {
+			best_device             = devices[i];
+			best_compute_capability = device_compute_capability;
+		}
+	}
+
+	create_context(best_device, enable_gl_interop);
+	make_current(0);
+}
+
+int CUDAContext::init_all() {
+	CUdevice devices[MAX_DEVICES];
+	int device_count = get_candidate_devices(false, devices, MAX_DEVICES);
+
+	for (int i = 0; i < device_count; i++) {
+		create_context(devices[i], false);
+	}
+	make_current(0);
+
+	return device_count;
+}
+
+void CUDAContext::make_current(int context_index) {
+	ASSERT(context_index >= 0 && context_index < device_context_count);
+
+	const DeviceContext & device_context = device_contexts[context_index];
+	CUDACALL(cuCtxSetCurrent(device_context.context));
+
+	current_device_context = context_index;
+
+	compute_capability = device_context.compute_capability;
+	total_memory       = device_context.total_memory;
+}
+
+int CUDAContext::get_context_count() {
+	return device_context_count;
+}
+
+int CUDAContext::get_current_context_index() {
+	return current_device_context;
+}
+
+StringView CUDAContext::get_device_name() {
+	return StringView::from_c_str(device_contexts[current_device_context].name);
+}
+
+int CUDAContext::get_device_ordinal() {
+	return int(device_contexts[current_device_context].device);
+}
+
 void CUDAContext::free() {
-	CUDACALL(cuCtxDestroy(context));
-	CUDACALL(cuDevicePrimaryCtxReset(device));
+	for (int i = 0; i < device_context_count; i++) {
+		make_current(i);
+		CUDAMemory::staging_free();
+		CUDAMemory::pool_release();
+		CUDAMemory::pinned_release();
+
+		CUDACALL(cuCtxDestroy(device_contexts[i].context));
+		CUDACALL(cuDevicePrimaryCtxReset(device_contexts[i].device));
+	}
+	device_context_count = 0;
 }
 
 size_t CUDAContext::get_available_memory() {
 	size_t bytes_available = 0;
 	size_t bytes_total     = 0;
 	CUDACALL(cuMemGetInfo(&bytes_available, &bytes_total));
-	return bytes_available;
+
+	// Cached blocks are reused before anything new is requested from the driver
+	CUDAMemory::PoolStats pool_stats = CUDAMemory::pool_get_stats();
+	return bytes_available + (pool_stats.bytes_reserved - pool_stats.bytes_in_use);
 }
 
 unsigned CUDAContext::get_shared_memory() { return device_get_attribute(CU_DEVICE_ATTRIBUTE_SHARED_MEMORY_PER_BLOCK); }
 unsigned CUDAContext::get_sm_count()      { return device_get_attribute(CU_DEVICE_ATTRIBUTE_MULTIPROCESSOR_COUNT); }
+
+bool CUDAContext::supports_managed_oversubscription() {
+	return device_get_attribute(CU_DEVICE_ATTRIBUTE_CONCURRENT_MANAGED_ACCESS) != 0;
+}
@@ -1,18 +1,41 @@
 #pragma once
 #include "CUDACall.h"
 
+#include "Core/StringView.h"
+
 namespace CUDAContext {
-	inline int compute_capability = -1;
+	constexpr int MAX_DEVICES = 8;
+
+	// Properties of the Context that is current on the calling thread, see make_current
+	inline thread_local int compute_capability = -1;
 
-	inline size_t total_memory;
+	inline thread_local size_t total_memory;
 
 	// Creates a new CUDA Context
-	void init();
+	// With GL interop the Device has to be one that drives the current GL Context, otherwise any Device can be used
+	// A negative device_index picks the Device with the highest compute capability
+	void init(bool enable_gl_interop = true, int device_index = -1);
+
+	// Creates a CUDA Context on every Device (without GL interop), returns the number of Contexts
+	// The first Context is made current
+	int init_all();
+
+	// Makes one of the Contexts created by init/init_all current on the calling thread
+	void make_current(int context_index);
+
+	int get_context_count();
+	int get_current_context_index();
+
+	StringView get_device_name();    // Name of the Device of the current Context
+	int        get_device_ordinal(); // Ordinal of the Device of the current Context, as used by the CUDA runtime
+
 	void free();
 
-	size_t get_available_memory(); // Available memory on GPU in bytes
+	size_t get_available_memory(); // Available memory on GPU in bytes, including memory cached by the CUDAMemory pool
 
 	unsigned get_shared_memory(); // Available shared memory in bytes (per Block)
 
 	unsigned get_sm_count(); // Number of Streaming Multiprocessors on the current Device
+
+	bool supports_managed_oversubscription(); // Whether managed memory on the current Device can exceed its memory, by migrating pages on demand
 }
@@ -32,7 +32,19 @@ struct CUDAEventPool {
 	Array<CUDAEvent> pool;
 	size_t           num_used;
 
+	bool recording = true; // If false, record does nothing and the pool keeps the Events of the last frame that was timed
+
+	// Elapsed times between consecutive Events of the last timed frame whose Events have completed, see resolve
+	struct Timing {
+		const CUDAEvent::Desc * desc;
+		float                   time;
+	};
+	Array<Timing> timings;
+	bool          timings_pending = false;
+
 	void record(const CUDAEvent::Desc * event_desc, CUstream stream = nullptr) {
+		if (!recording) return;
+
 		// Check if the Pool is already using its maximum capacity
 		if (num_used == pool.size()) {
 			// Create new Event
@@ -48,6 +60,35 @@ struct CUDAEventPool {
 	}
 
 	void reset() {
-		num_used = 0;
+		num_used  = 0;
+		recording = true;
+	}
+
+	// Starts the Events of a new frame, a frame that is not timed keeps the Events of the previous one
+	void begin_frame(bool timed) {
+		resolve();
+
+		recording = timed;
+		if (timed) {
+			num_used        = 0;
+			timings_pending = true;
+		}
+	}
+
+	// Reads back all elapsed times at once when the last Event has completed, returns right away if it has not
+	void resolve() {
+		if (!timings_pending || num_used < 2) return;
+
+		CUresult result = cuEventQuery(pool[num_used - 1].event);
+		if (result == CUDA_ERROR_NOT_READY) return;
+
+		CUDACALL(result);
+
+		timings.resize(num_used - 1);
+		for (size_t i = 0; i < num_used - 1; i++) {
+			timings[i].desc = pool[i].desc;
+			timings[i].time = CUDAEvent::time_elapsed_between(pool[i], pool[i + 1]);
+		}
+		timings_pending = false;
 	}
 };
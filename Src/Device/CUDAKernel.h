@@ -6,6 +6,7 @@
 #include "Core/IO.h"
 
 #include "CUDAModule.h"
+#include "CUDAContext.h"
 
 struct CUDAKernel {
 	static constexpr int PARAMETER_BUFFER_SIZE = 256; // In bytes
@@ -33,16 +34,27 @@ struct CUDAKernel {
 
 	// Execute kernel without parameters
 	inline void execute() {
-		execute_internal(0);
+		execute_internal(0, nullptr);
 	}
 
 	// Exectute kernel with one ore more parameters
 	template<typename ... T>
 	inline void execute(const T & ... parameters) {
+		execute_on_stream(nullptr, parameters...);
+	}
+
+	// Execute kernel on the given Stream without parameters
+	inline void execute_on_stream(CUstream stream) {
+		execute_internal(0, stream);
+	}
+
+	// Execute kernel on the given Stream with one or more parameters
+	template<typename ... T>
+	inline void execute_on_stream(CUstream stream, const T & ... parameters) {
 		int buffer_size = fill_buffer(0, parameters...);
 		ASSERT(buffer_size < PARAMETER_BUFFER_SIZE);
 
-		execute_internal(buffer_size);
+		execute_internal(buffer_size, stream);
 	}
 
 	inline void set_grid_dim(int x, int y, int z) {
@@ -80,6 +92,15 @@ struct CUDAKernel {
 		set_block_dim(block_x, block_y, 1);
 	}
 
+	// Sets the Grid to the number of Blocks that can be resident on the Device simultaneously,
+	// the Kernel is responsible for looping over its work if it exceeds the Grid size
+	inline void occupancy_persistent_grid_size_1d() {
+		int blocks_per_sm;
+		CUDACALL(cuOccupancyMaxActiveBlocksPerMultiprocessor(&blocks_per_sm, kernel, block_dim_x * block_dim_y * block_dim_z, shared_memory_bytes));
+
+		set_grid_dim(blocks_per_sm * CUDAContext::get_sm_count(), 1, 1);
+	}
+
 	inline void set_shared_memory(unsigned bytes) {
 		shared_memory_bytes = bytes;
 	}
@@ -107,7 +128,7 @@ private:
 		return fill_buffer(offset, parameters...);
 	}
 
-	inline void execute_internal(size_t parameter_buffer_size) const {
+	inline void execute_internal(size_t parameter_buffer_size, CUstream stream) const {
 		void * params[] = {
 			CU_LAUNCH_PARAM_BUFFER_POINTER, parameter_buffer,
 			CU_LAUNCH_PARAM_BUFFER_SIZE,   &parameter_buffer_size,
@@ -117,7 +138,7 @@ private:
 		CUDACALL(cuLaunchKernel(kernel,
 			grid_dim_x,  grid_dim_y,  grid_dim_z,
 			block_dim_x, block_dim_y, block_dim_z,
-			shared_memory_bytes, nullptr, nullptr, params
+			shared_memory_bytes, stream, nullptr, params
 		));
 	}
 };
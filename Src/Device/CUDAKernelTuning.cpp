@@ -0,0 +1,98 @@
+#include "CUDAKernelTuning.h"
+
+#include <stdio.h>
+
+#include "Core/IO.h"
+#include "Core/Parser.h"
+
+#include "CUDAContext.h"
+
+String CUDAKernelTuning::get_filename(StringView module_filename, Allocator * allocator) {
+	// Tuning results are only valid on the Device they were measured on
+	String device_name = String(CUDAContext::get_device_name(), allocator);
+	for (size_t i = 0; i < device_name.size(); i++) {
+		char c = device_name.data()[i];
+		if (!is_digit(c) && !(c >= 'a' && c <= 'z') && !(c >= 'A' && c <= 'Z')) {
+			device_name.data()[i] = '_';
+		}
+	}
+
+	return Format(allocator).format("{}.sm_{}.{}.tuning"_sv, module_filename, CUDAContext::compute_capability, device_name);
+}
+
+bool CUDAKernelTuning::load(const String & filename) {
+	if (!IO::file_exists(filename.view())) return false;
+
+	String file = IO::file_read(filename, nullptr);
+	Parser parser(file.view(), filename.view());
+
+	max_registers = 0;
+	block_sizes.clear();
+
+	parser.skip_whitespace_or_newline();
+	parser.expect("max_registers");
+	parser.skip_whitespace();
+	max_registers = parser.parse_int();
+	parser.skip_whitespace_or_newline();
+
+	while (!parser.reached_end()) {
+		StringView kernel_name = parser.parse_identifier();
+		parser.skip_whitespace();
+		int block_dim_x = parser.parse_int();
+		parser.skip_whitespace();
+		int block_dim_y = parser.parse_int();
+		parser.skip_whitespace_or_newline();
+
+		set(kernel_name, block_dim_x, block_dim_y);
+	}
+
+	IO::print("Loaded Kernel tuning '{}'\n"_sv, filename);
+	return true;
+}
+
+bool CUDAKernelTuning::save(const String & filename) const {
+	FILE * file = nullptr;
+#ifdef _WIN32
+	fopen_s(&file, filename.data(), "wb");
+#else
+	file = fopen(filename.data(), "wb");
+#endif
+
+	if (!file) {
+		IO::print("WARNING: Failed to write Kernel tuning '{}'!\n"_sv, filename);
+		return false;
+	}
+
+	fprintf(file, "max_registers %i\n", max_registers);
+	for (size_t i = 0; i < block_sizes.size(); i++) {
+		const BlockSize & block_size = block_sizes[i];
+		fprintf(file, "%.*s %i %i\n", int(block_size.kernel_name.size()), block_size.kernel_name.data(), block_size.block_dim_x, block_size.block_dim_y);
+	}
+
+	fclose(file);
+	return true;
+}
+
+void CUDAKernelTuning::apply(CUDAKernel & kernel, StringView kernel_name) const {
+	for (size_t i = 0; i < block_sizes.size(); i++) {
+		if (block_sizes[i].kernel_name.view() == kernel_name) {
+			kernel.set_block_dim(block_sizes[i].block_dim_x, block_sizes[i].block_dim_y, 1);
+			return;
+		}
+	}
+}
+
+void CUDAKernelTuning::set(StringView kernel_name, int block_dim_x, int block_dim_y) {
+	for (size_t i = 0; i < block_sizes.size(); i++) {
+		if (block_sizes[i].kernel_name.view() == kernel_name) {
+			block_sizes[i].block_dim_x = block_dim_x;
+			block_sizes[i].block_dim_y = block_dim_y;
+			return;
+		}
+	}
+
+	BlockSize & block_size = block_sizes.emplace_back();
+	block_size.kernel_name = String(kernel_name);
+	block_size.block_dim_x = block_dim_x;
+	block_size.block_dim_y = block_dim_y;
+}
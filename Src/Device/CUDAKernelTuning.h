@@ -0,0 +1,31 @@
+#pragma once
+#include "Core/Array.h"
+#include "Core/String.h"
+
+#include "CUDAKernel.h"
+
+// Launch configuration of a Module as measured by the autotuner (see Pathtracer::autotune_block_sizes) on a specific Device
+// It is stored as a text file next to the Module, with the register limit on the first line followed by one line per Kernel:
+//	max_registers 64
+//	kernel_sort 128 1
+struct CUDAKernelTuning {
+	struct BlockSize {
+		String kernel_name;
+		int    block_dim_x;
+		int    block_dim_y;
+	};
+
+	int              max_registers = 0; // 0 means no tuned value, the default of the Module is used
+	Array<BlockSize> block_sizes;
+
+	// Filename of the tuning file of the Module for the Device of the current Context
+	static String get_filename(StringView module_filename, Allocator * allocator = nullptr);
+
+	bool load(const String & filename); // Returns false if the file does not exist
+	bool save(const String & filename) const;
+
+	// Overrides the Block dimensions of the Kernel if a tuned value exists for it
+	void apply(CUDAKernel & kernel, StringView kernel_name) const;
+
+	void set(StringView kernel_name, int block_dim_x, int block_dim_y);
+};
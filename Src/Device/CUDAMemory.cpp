@@ -3,6 +3,605 @@
 #include <GL/glew.h>
 #include <cudaGL.h>
 
+#include "CUDAContext.h"
+
+#include "Core/Mutex.h"
+
+#include "Math/Math.h"
+
+struct PoolBlock {
+	CUdeviceptr ptr;
+	size_t      size;
+
+	CUDAMemory::Category category;
+
+	CUevent event_freed; // Recorded when the block was returned to the pool, nullptr while in use
+
+	bool managed; // Allocated by pool_alloc_managed
+};
+
+struct PoolArray {
+	void * array; // CUarray or CUmipmappedArray
+	size_t size;
+
+	CUDAMemory::Category category;
+};
+
+struct Pool {
+	Mutex mutex;
+
+	Array<PoolBlock> blocks_in_use;
+	Array<PoolBlock> blocks_cached;
+
+	Array<PoolArray> arrays;
+
+	size_t bytes_reserved    = 0;
+	size_t bytes_in_use      = 0;
+	size_t bytes_in_use_peak = 0;
+	size_t bytes_arrays      = 0;
+
+	size_t bytes_per_category[size_t(CUDAMemory::Category::COUNT)] = { };
+};
+
+static Pool pools[CUDAContext::MAX_DEVICES];
+
+struct PinnedBlock {
+	void * ptr;
+	size_t size;
+
+	int generation_freed; // PinnedPool::generation at the time the block was returned to the pool
+
+	bool in_slab;
+};
+
+// Host memory the GPU may still be copying from or into cannot be handed out again right away
+// Instead of an event per block (the stream is not known) the pool counts generations, a generation ends with a cuCtxSynchronize.
+// This is what cuMemFreeHost would have done implicitly anyway, but only happens when a block is reused within the same generation
+struct PinnedPool {
+	Mutex mutex;
+
+	Array<PinnedBlock> blocks_in_use;
+	Array<PinnedBlock> blocks_cached;
+
+	Array<void *> slabs;
+	size_t        slab_offset = 0;
+
+	int generation = 0;
+
+	size_t bytes_reserved = 0; // Including slabs
+	size_t bytes_in_use   = 0;
+	size_t bytes_cached   = 0; // Blocks outside of slabs only
+};
+
+static PinnedPool pinned_pools[CUDAContext::MAX_DEVICES];
+
+static constexpr size_t PINNED_SLAB_SIZE      = KILOBYTES(64);
+static constexpr size_t PINNED_SLAB_MAX_BLOCK = KILOBYTES(4);
+static constexpr size_t PINNED_CACHE_MAX      = MEGABYTES(256); // Beyond this the cached blocks are returned to the driver
+
+static constexpr size_t STAGING_SIZE          = KILOBYTES(256);
+static constexpr int    STAGING_SEGMENT_COUNT = 8;
+static constexpr size_t STAGING_SEGMENT_SIZE  = STAGING_SIZE / STAGING_SEGMENT_COUNT;
+static constexpr int    STAGING_MAX_STREAMS   = 4; // Per segment, copies on further streams bypass the ring
+
+// Before a segment is written again, the host waits for the last copy out of it on every stream that used it
+// With a whole ring of copies in flight this only blocks if the GPU is several frames behind
+struct StagingSegment {
+	CUstream streams[STAGING_MAX_STREAMS];
+	CUevent  events [STAGING_MAX_STREAMS];
+	int      stream_count;
+};
+
+struct StagingRing {
+	Mutex mutex;
+
+	unsigned char * pinned = nullptr;
+	size_t          offset = 0;
+
+	StagingSegment segments[STAGING_SEGMENT_COUNT] = { };
+};
+
+static StagingRing staging_rings[CUDAContext::MAX_DEVICES];
+
+static thread_local CUDAMemory::Category current_category = CUDAMemory::Category::OTHER;
+
+static Pool & get_current_pool() {
+	return pools[CUDAContext::get_current_context_index()];
+}
+
+static void pool_update_peak(Pool & pool) {
+	pool.bytes_in_use_peak = Math::max(pool.bytes_in_use_peak, pool.bytes_in_use + pool.bytes_arrays);
+}
+
+StringView CUDAMemory::category_name(Category category) {
+	switch (category) {
+		case Category::OTHER:        return "Other"_sv;
+		case Category::GEOMETRY:     return "Geometry"_sv;
+		case Category::BVH:          return "BVH"_sv;
+		case Category::MATERIALS:    return "Materials"_sv;
+		case Category::TEXTURES:     return "Textures"_sv;
+		case Category::SKY:          return "Sky"_sv;
+		case Category::LIGHTS:       return "Lights"_sv;
+		case Category::WAVEFRONT:    return "Wavefront"_sv;
+		case Category::FRAMEBUFFERS: return "Framebuffers"_sv;
+		case Category::SVGF:         return "SVGF"_sv;
+		case Category::LUTS:         return "LUTs"_sv;
+		default: ASSERT_UNREACHABLE();
+	}
+}
+
+CUDAMemory::CategoryScope::CategoryScope(Category category) : category_prev(current_category) {
+	current_category = category;
+}
+
+CUDAMemory::CategoryScope::~CategoryScope() {
+	current_category = category_prev;
+}
+
+// Rounds sizes up to one of 8 size classes per power of two, so that blocks can be reused
+// by requests of slightly different size (e.g. after a small window resize) while wasting at most 12.5%
+static size_t pool_round_size(size_t size) {
+	constexpr size_t MIN_GRANULARITY = 256;
+
+	if (size <= MIN_GRANULARITY) return MIN_GRANULARITY;
+
+	size_t power_of_two = 1;
+	while (power_of_two <= size / 2) power_of_two *= 2;
+
+	size_t granularity = power_of_two / 8;
+	if (granularity < MIN_GRANULARITY) granularity = MIN_GRANULARITY;
+
+	return (size + granularity - 1) / granularity * granularity;
+}
+
+// Frees all cached blocks whose event has completed, or all cached blocks if wait is true
+static void pool_release_cached(Pool & pool, bool wait) {
+	for (size_t i = 0; i < pool.blocks_cached.size(); ) {
+		PoolBlock & block = pool.blocks_cached[i];
+
+		if (!wait && cuEventQuery(block.event_freed) != CUDA_SUCCESS) {
+			i++;
+			continue;
+		}
+
+		CUDACALL(cuEventSynchronize(block.event_freed));
+		CUDACALL(cuEventDestroy(block.event_freed));
+		CUDACALL(cuMemFree(block.ptr));
+
+		pool.bytes_reserved -= block.size;
+
+		// Swap with last
+		block = pool.blocks_cached[pool.blocks_cached.size() - 1];
+		pool.blocks_cached.pop_back();
+	}
+}
+
+CUdeviceptr CUDAMemory::pool_alloc(size_t size_in_bytes) {
+	Pool & pool = get_current_pool();
+	MutexLock lock(pool.mutex);
+
+	size_t size = pool_round_size(size_in_bytes);
+
+	// Reuse a cached block of the same size class, but only once the GPU has finished all work issued before it was freed
+	for (size_t i = 0; i < pool.blocks_cached.size(); i++) {
+		PoolBlock block = pool.blocks_cached[i];
+		if (block.size != size || block.managed || cuEventQuery(block.event_freed) != CUDA_SUCCESS) continue;
+
+		CUDACALL(cuEventDestroy(block.event_freed));
+		block.event_freed = nullptr;
+		block.category    = current_category;
+
+		pool.blocks_cached[i] = pool.blocks_cached[pool.blocks_cached.size() - 1];
+		pool.blocks_cached.pop_back();
+
+		pool.blocks_in_use.push_back(block);
+		pool.bytes_in_use += size;
+		pool.bytes_per_category[size_t(block.category)] += size;
+		pool_update_peak(pool);
+
+		return block.ptr;
+	}
+
+	PoolBlock block = { };
+	block.size     = size;
+	block.category = current_category;
+
+	CUresult result = cuMemAlloc(&block.ptr, size);
+	if (result == CUDA_ERROR_OUT_OF_MEMORY) {
+		// Return everything that is cached to the driver and try again
+		pool_release_cached(pool, true);
+		result = cuMemAlloc(&block.ptr, size);
+	}
+	CUDACALL(result);
+
+	pool.blocks_in_use.push_back(block);
+	pool.bytes_in_use   += size;
+	pool.bytes_reserved += size;
+	pool.bytes_per_category[size_t(block.category)] += size;
+	pool_update_peak(pool);
+
+	return block.ptr;
+}
+
+CUdeviceptr CUDAMemory::pool_alloc_managed(size_t size_in_bytes) {
+	Pool & pool = get_current_pool();
+	MutexLock lock(pool.mutex);
+
+	size_t size = pool_round_size(size_in_bytes);
+
+	PoolBlock block = { };
+	block.size     = size;
+	block.category = current_category;
+	block.managed  = true;
+
+	CUDACALL(cuMemAllocManaged(&block.ptr, size, CU_MEM_ATTACH_GLOBAL));
+
+	CUdevice device = CUdevice(CUDAContext::get_device_ordinal());
+	CUDACALL(cuMemAdvise(block.ptr, size, CU_MEM_ADVISE_SET_PREFERRED_LOCATION, device));
+	CUDACALL(cuMemAdvise(block.ptr, size, CU_MEM_ADVISE_SET_ACCESSED_BY,        device));
+
+	pool.blocks_in_use.push_back(block);
+	pool.bytes_in_use   += size;
+	pool.bytes_reserved += size;
+	pool.bytes_per_category[size_t(block.category)] += size;
+	pool_update_peak(pool);
+
+	return block.ptr;
+}
+
+void CUDAMemory::pool_free(CUdeviceptr ptr) {
+	Pool & pool = get_current_pool();
+	MutexLock lock(pool.mutex);
+
+	for (size_t i = 0; i < pool.blocks_in_use.size(); i++) {
+		if (pool.blocks_in_use[i].ptr != ptr) continue;
+
+		PoolBlock block = pool.blocks_in_use[i];
+
+		pool.blocks_in_use[i] = pool.blocks_in_use[pool.blocks_in_use.size() - 1];
+		pool.blocks_in_use.pop_back();
+
+		pool.bytes_in_use -= block.size;
+		pool.bytes_per_category[size_t(block.category)] -= block.size;
+
+		// The block may still be read or written by work in flight, the event marks when it is safe to reuse
+		// NOTE: Work on streams created with CU_STREAM_NON_BLOCKING is not ordered with the null stream,
+		// such streams need to be synchronized before freeing memory they access
+		CUDACALL(cuEventCreate(&block.event_freed, CU_EVENT_DISABLE_TIMING));
+		CUDACALL(cuEventRecord(block.event_freed, nullptr));
+
+		pool.blocks_cached.push_back(block);
+
+		// Keep the cache from growing unbounded when sizes keep changing
+		if (pool.bytes_reserved - pool.bytes_in_use > CUDAContext::total_memory / 4) {
+			pool_release_cached(pool, false);
+		}
+		return;
+	}
+
+	IO::print("ERROR: Freeing device pointer that was not allocated by CUDAMemory::malloc!\n"_sv);
+	DEBUG_BREAK();
+}
+
+static void staging_segment_wait(StagingSegment & segment) {
+	for (int i = 0; i < segment.stream_count; i++) {
+		CUDACALL(cuEventSynchronize(segment.events[i]));
+	}
+	segment.stream_count = 0;
+}
+
+void CUDAMemory::copy_staged_async(CUdeviceptr dst, const void * src, size_t size, CUstream stream) {
+	StagingRing & ring = staging_rings[CUDAContext::get_current_context_index()];
+	MutexLock lock(ring.mutex);
+
+	if (size > STAGING_SEGMENT_SIZE) {
+		CUDACALL(cuMemcpyHtoDAsync(dst, src, size, stream));
+		return;
+	}
+
+	if (!ring.pinned) {
+		ring.pinned = static_cast<unsigned char *>(pinned_alloc(STAGING_SIZE));
+
+		for (int s = 0; s < STAGING_SEGMENT_COUNT; s++) {
+			for (int i = 0; i < STAGING_MAX_STREAMS; i++) {
+				CUDACALL(cuEventCreate(&ring.segments[s].events[i], CU_EVENT_DISABLE_TIMING));
+			}
+		}
+		ring.offset = 0;
+	}
+
+	size_t size_aligned = (size + 15) & ~size_t(15);
+
+	// Copies do not straddle segments, a segment is waited on once when the ring enters it
+	if (ring.offset % STAGING_SEGMENT_SIZE + size_aligned > STAGING_SEGMENT_SIZE) {
+		ring.offset = (ring.offset / STAGING_SEGMENT_SIZE + 1) * STAGING_SEGMENT_SIZE % STAGING_SIZE;
+	}
+	StagingSegment & segment = ring.segments[ring.offset / STAGING_SEGMENT_SIZE];
+
+	if (ring.offset % STAGING_SEGMENT_SIZE == 0) {
+		staging_segment_wait(segment);
+	}
+
+	int stream_index = 0;
+	while (stream_index < segment.stream_count && segment.streams[stream_index] != stream) {
+		stream_index++;
+	}
+	if (stream_index == STAGING_MAX_STREAMS) {
+		CUDACALL(cuMemcpyHtoDAsync(dst, src, size, stream));
+		return;
+	}
+	if (stream_index == segment.stream_count) {
+		segment.streams[segment.stream_count++] = stream;
+	}
+
+	unsigned char * staged = ring.pinned + ring.offset;
+	::memcpy(staged, src, size);
+
+	ring.offset = (ring.offset + size_aligned) % STAGING_SIZE;
+
+	CUDACALL(cuMemcpyHtoDAsync(dst, staged, size, stream));
+	CUDACALL(cuEventRecord(segment.events[stream_index], stream));
+}
+
+void CUDAMemory::staging_free() {
+	StagingRing & ring = staging_rings[CUDAContext::get_current_context_index()];
+	MutexLock lock(ring.mutex);
+
+	if (!ring.pinned) return;
+
+	for (int s = 0; s < STAGING_SEGMENT_COUNT; s++) {
+		staging_segment_wait(ring.segments[s]);
+
+		for (int i = 0; i < STAGING_MAX_STREAMS; i++) {
+			CUDACALL(cuEventDestroy(ring.segments[s].events[i]));
+		}
+	}
+	pinned_free(ring.pinned);
+	ring.pinned = nullptr;
+}
+
+void * CUDAMemory::pinned_alloc(size_t size_in_bytes) {
+	PinnedPool & pool = pinned_pools[CUDAContext::get_current_context_index()];
+	MutexLock lock(pool.mutex);
+
+	size_t size = pool_round_size(size_in_bytes);
+
+	for (size_t i = 0; i < pool.blocks_cached.size(); i++) {
+		PinnedBlock block = pool.blocks_cached[i];
+		if (block.size != size) continue;
+
+		if (block.generation_freed == pool.generation) {
+			CUDACALL(cuCtxSynchronize());
+			pool.generation++;
+		}
+
+		pool.blocks_cached[i] = pool.blocks_cached[pool.blocks_cached.size() - 1];
+		pool.blocks_cached.pop_back();
+
+		if (!block.in_slab) {
+			pool.bytes_cached -= block.size;
+		}
+		pool.bytes_in_use += block.size;
+		pool.blocks_in_use.push_back(block);
+
+		return block.ptr;
+	}
+
+	PinnedBlock block = { };
+	block.size = size;
+
+	if (size <= PINNED_SLAB_MAX_BLOCK) {
+		if (pool.slabs.size() == 0 || pool.slab_offset + size > PINNED_SLAB_SIZE) {
+			void * slab;
+			CUDACALL(cuMemAllocHost(&slab, PINNED_SLAB_SIZE));
+
+			pool.slabs.push_back(slab);
+			pool.slab_offset     = 0;
+			pool.bytes_reserved += PINNED_SLAB_SIZE;
+		}
+		block.ptr     = static_cast<unsigned char *>(pool.slabs[pool.slabs.size() - 1]) + pool.slab_offset;
+		block.in_slab = true;
+
+		pool.slab_offset += size;
+	} else {
+		CUDACALL(cuMemAllocHost(&block.ptr, size));
+		block.in_slab = false;
+
+		pool.bytes_reserved += size;
+	}
+
+	pool.bytes_in_use += size;
+	pool.blocks_in_use.push_back(block);
+
+	return block.ptr;
+}
+
+// Frees the cached blocks outside of slabs. Slab blocks stay cached, slabs are only freed by pinned_release
+static void pinned_release_cached(PinnedPool & pool) {
+	if (pool.bytes_cached == 0) return;
+
+	CUDACALL(cuCtxSynchronize());
+	pool.generation++;
+
+	for (size_t i = 0; i < pool.blocks_cached.size(); ) {
+		PinnedBlock & block = pool.blocks_cached[i];
+
+		if (block.in_slab) {
+			i++;
+			continue;
+		}
+		CUDACALL(cuMemFreeHost(block.ptr));
+
+		pool.bytes_reserved -= block.size;
+		pool.bytes_cached   -= block.size;
+
+		pool.blocks_cached[i] = pool.blocks_cached[pool.blocks_cached.size() - 1];
+		pool.blocks_cached.pop_back();
+	}
+}
+
+void CUDAMemory::pinned_free(void * ptr) {
+	PinnedPool & pool = pinned_pools[CUDAContext::get_current_context_index()];
+	MutexLock lock(pool.mutex);
+
+	for (size_t i = 0; i < pool.blocks_in_use.size(); i++) {
+		PinnedBlock block = pool.blocks_in_use[i];
+		if (block.ptr != ptr) continue;
+
+		pool.blocks_in_use[i] = pool.blocks_in_use[pool.blocks_in_use.size() - 1];
+		pool.blocks_in_use.pop_back();
+
+		block.generation_freed = pool.generation;
+		pool.blocks_cached.push_back(block);
+
+		pool.bytes_in_use -= block.size;
+		if (!block.in_slab) {
+			pool.bytes_cached += block.size;
+
+			if (pool.bytes_cached > PINNED_CACHE_MAX) {
+				pinned_release_cached(pool);
+			}
+		}
+		return;
+	}
+
+	IO::print("ERROR: Pinned pointer {} was not allocated by this Context!\n"_sv, reinterpret_cast<size_t>(ptr));
+	IO::exit(1);
+}
+
+void CUDAMemory::pinned_release() {
+	PinnedPool & pool = pinned_pools[CUDAContext::get_current_context_index()];
+	MutexLock lock(pool.mutex);
+
+	pinned_release_cached(pool);
+
+	size_t bytes_in_use_outside_slabs = 0;
+	for (size_t i = 0; i < pool.blocks_in_use.size(); i++) {
+		if (!pool.blocks_in_use[i].in_slab) bytes_in_use_outside_slabs += pool.blocks_in_use[i].size;
+	}
+
+	if (bytes_in_use_outside_slabs == pool.bytes_in_use) {
+		// None of the slab blocks are in use
+		for (size_t i = 0; i < pool.slabs.size(); i++) {
+			CUDACALL(cuMemFreeHost(pool.slabs[i]));
+		}
+		pool.bytes_reserved -= pool.slabs.size() * PINNED_SLAB_SIZE;
+		pool.slabs.clear();
+		pool.slab_offset = 0;
+
+		for (size_t i = 0; i < pool.blocks_cached.size(); ) {
+			if (pool.blocks_cached[i].in_slab) {
+				pool.blocks_cached[i] = pool.blocks_cached[pool.blocks_cached.size() - 1];
+				pool.blocks_cached.pop_back();
+			} else {
+				i++;
+			}
+		}
+	}
+
+	if (pool.blocks_in_use.size() > 0) {
+		IO::print("WARNING: {} pinned allocation(s) ({} KB) still in use!\n"_sv, pool.blocks_in_use.size(), pool.bytes_in_use >> 10);
+	}
+}
+
+void CUDAMemory::pool_release() {
+	Pool & pool = get_current_pool();
+	MutexLock lock(pool.mutex);
+
+	pool_release_cached(pool, true);
+
+	if (pool.blocks_in_use.size() > 0) {
+		IO::print("WARNING: {} device allocation(s) ({} KB) still in use!\n"_sv, pool.blocks_in_use.size(), pool.bytes_in_use >> 10);
+	}
+}
+
+CUDAMemory::PoolStats CUDAMemory::pool_get_stats() {
+	Pool & pool = get_current_pool();
+	MutexLock lock(pool.mutex);
+
+	PoolStats stats = { };
+	stats.bytes_reserved     = pool.bytes_reserved;
+	stats.bytes_in_use       = pool.bytes_in_use;
+	stats.bytes_in_use_peak  = pool.bytes_in_use_peak;
+	stats.block_count_in_use = int(pool.blocks_in_use.size());
+	stats.block_count_cached = int(pool.blocks_cached.size());
+	stats.bytes_arrays       = pool.bytes_arrays;
+
+	PinnedPool & pinned_pool = pinned_pools[CUDAContext::get_current_context_index()];
+	MutexLock lock_pinned(pinned_pool.mutex);
+
+	stats.pinned_bytes_reserved = pinned_pool.bytes_reserved;
+	stats.pinned_bytes_in_use   = pinned_pool.bytes_in_use;
+	stats.pinned_slab_count     = int(pinned_pool.slabs.size());
+
+	for (size_t i = 0; i < size_t(Category::COUNT); i++) {
+		stats.bytes_per_category[i] = pool.bytes_per_category[i];
+	}
+
+	return stats;
+}
+
+void CUDAMemory::pool_reset_peak() {
+	Pool & pool = get_current_pool();
+	MutexLock lock(pool.mutex);
+
+	pool.bytes_in_use_peak = pool.bytes_in_use + pool.bytes_arrays;
+}
+
+void CUDAMemory::print_memory_summary() {
+	PoolStats stats = pool_get_stats();
+
+	IO::print("Device memory ({}):\n"_sv, CUDAContext::get_device_name());
+	for (size_t i = 0; i < size_t(Category::COUNT); i++) {
+		if (stats.bytes_per_category[i] == 0) continue;
+
+		IO::print("  {:<13}{} KB\n"_sv, category_name(Category(i)), stats.bytes_per_category[i] >> 10);
+	}
+	IO::print("Buffers:     {} KB in use, {} KB reserved ({} block(s) cached)\n"_sv, stats.bytes_in_use >> 10, stats.bytes_reserved >> 10, stats.block_count_cached);
+	IO::print("Arrays:      {} KB\n"_sv, stats.bytes_arrays >> 10);
+	IO::print("Pinned:      {} KB in use, {} KB reserved ({} slab(s))\n"_sv, stats.pinned_bytes_in_use >> 10, stats.pinned_bytes_reserved >> 10, stats.pinned_slab_count);
+	IO::print('\n');
+}
+
+static size_t array_format_size(CUarray_format format) {
+	switch (format) {
+		case CU_AD_FORMAT_UNSIGNED_INT8:  case CU_AD_FORMAT_SIGNED_INT8:  return 1;
+		case CU_AD_FORMAT_UNSIGNED_INT16: case CU_AD_FORMAT_SIGNED_INT16: case CU_AD_FORMAT_HALF: return 2;
+		default: return 4;
+	}
+}
+
+static void pool_track_array(void * array, size_t size) {
+	Pool & pool = get_current_pool();
+	MutexLock lock(pool.mutex);
+
+	PoolArray pool_array = { };
+	pool_array.array    = array;
+	pool_array.size     = size;
+	pool_array.category = current_category;
+	pool.arrays.push_back(pool_array);
+
+	pool.bytes_arrays += size;
+	pool.bytes_per_category[size_t(pool_array.category)] += size;
+	pool_update_peak(pool);
+}
+
+static void pool_untrack_array(void * array) {
+	Pool & pool = get_current_pool();
+	MutexLock lock(pool.mutex);
+
+	for (size_t i = 0; i < pool.arrays.size(); i++) {
+		if (pool.arrays[i].array != array) continue;
+
+		pool.bytes_arrays -= pool.arrays[i].size;
+		pool.bytes_per_category[size_t(pool.arrays[i].category)] -= pool.arrays[i].size;
+
+		pool.arrays[i] = pool.arrays[pool.arrays.size() - 1];
+		pool.arrays.pop_back();
+		return;
+	}
+}
+
 CUarray CUDAMemory::create_array(int width, int height, int channels, CUarray_format format) {
 	CUDA_ARRAY_DESCRIPTOR desc = { };
 	desc.Width       = width;
@@ -12,6 +611,7 @@ CUarray CUDAMemory::create_array(int width, int height, int channels, CUarray_fo
 
 	CUarray array;
 	CUDACALL(cuArrayCreate(&array, &desc));
+	pool_track_array(array, size_t(width) * size_t(height) * channels * array_format_size(format));
 
 	return array;
 }
@@ -26,6 +626,23 @@ CUarray CUDAMemory::create_array(int width, int height, int depth, int channels,
 
 	CUarray array;
 	CUDACALL(cuArray3DCreate(&array, &desc));
+	pool_track_array(array, size_t(width) * size_t(height) * size_t(Math::max(depth, 1)) * channels * array_format_size(format));
+
+	return array;
+}
+
+CUarray CUDAMemory::create_array_surface(int width, int height, int channels, CUarray_format format) {
+	CUDA_ARRAY3D_DESCRIPTOR desc = { };
+	desc.Width       = width;
+	desc.Height      = height;
+	desc.Depth       = 0;
+	desc.NumChannels = channels;
+	desc.Format      = format;
+	desc.Flags       = CUDA_ARRAY3D_SURFACE_LDST;
+
+	CUarray array;
+	CUDACALL(cuArray3DCreate(&array, &desc));
+	pool_track_array(array, size_t(width) * size_t(height) * channels * array_format_size(format));
 
 	return array;
 }
@@ -42,14 +659,22 @@ CUmipmappedArray CUDAMemory::create_array_mipmap(int width, int height, int chan
 	CUmipmappedArray mipmap;
 	CUDACALL(cuMipmappedArrayCreate(&mipmap, &desc, level_count));
 
+	size_t size = 0;
+	for (int level = 0; level < level_count; level++) {
+		size += size_t(Math::max(width >> level, 1)) * size_t(Math::max(height >> level, 1)) * channels * array_format_size(format);
+	}
+	pool_track_array(mipmap, size);
+
 	return mipmap;
 }
 
 void CUDAMemory::free_array(CUarray array) {
+	pool_untrack_array(array);
 	CUDACALL(cuArrayDestroy(array));
 }
 
 void CUDAMemory::free_array(CUmipmappedArray array) {
+	pool_untrack_array(array);
 	CUDACALL(cuMipmappedArrayDestroy(array));
 }
 
@@ -83,6 +708,20 @@ void CUDAMemory::copy_array_3d(CUarray array, int width_in_bytes, int height, in
 	CUDACALL(cuMemcpy3D(&copy));
 }
 
+void CUDAMemory::copy_array_async(CUarray array, int width_in_bytes, int y, int height, const void * data, CUstream stream) {
+	CUDA_MEMCPY2D copy = { };
+	copy.srcMemoryType = CU_MEMORYTYPE_HOST;
+	copy.srcHost       = data;
+	copy.srcPitch      = width_in_bytes;
+	copy.dstMemoryType = CU_MEMORYTYPE_ARRAY;
+	copy.dstArray      = array;
+	copy.dstY          = y;
+	copy.WidthInBytes  = width_in_bytes;
+	copy.Height        = height;
+
+	CUDACALL(cuMemcpy2DAsync(&copy, stream));
+}
+
 // Copies data from the Host Texture to the Device Array
 void CUDAMemory::copy_array(CUarray array, int width_in_bytes, int height, CUdeviceptr data) {
 	CUDA_MEMCPY2D copy = { };
@@ -113,7 +752,35 @@ void CUDAMemory::copy_array_3d(CUarray array, int width_in_bytes, int height, in
 	CUDACALL(cuMemcpy3D(&copy));
 }
 
-CUtexObject CUDAMemory::create_texture(CUarray array, CUfilter_mode filter, CUaddress_mode address_mode) {
+void CUDAMemory::copy_array_to_host(void * data, CUarray array, int width_in_bytes, int height) {
+	CUDA_MEMCPY2D copy = { };
+	copy.srcMemoryType = CU_MEMORYTYPE_ARRAY;
+	copy.srcArray      = array;
+	copy.dstMemoryType = CU_MEMORYTYPE_HOST;
+	copy.dstHost       = data;
+	copy.dstPitch      = width_in_bytes;
+	copy.WidthInBytes  = width_in_bytes;
+	copy.Height        = height;
+
+	CUDACALL(cuMemcpy2D(&copy));
+}
+
+void CUDAMemory::copy_array_3d_to_host(void * data, CUarray array, int width_in_bytes, int height, int depth) {
+	CUDA_MEMCPY3D copy = { };
+	copy.srcMemoryType = CU_MEMORYTYPE_ARRAY;
+	copy.srcArray      = array;
+	copy.dstMemoryType = CU_MEMORYTYPE_HOST;
+	copy.dstHost       = data;
+	copy.dstPitch      = width_in_bytes;
+	copy.dstHeight     = height;
+	copy.WidthInBytes  = width_in_bytes;
+	copy.Height        = height;
+	copy.Depth         = depth;
+
+	CUDACALL(cuMemcpy3D(&copy));
+}
+
+CUtexObject CUDAMemory::create_texture(CUarray array, CUfilter_mode filter, CUaddress_mode address_mode, const CUDA_RESOURCE_VIEW_DESC * view_desc) {
 	CUDA_RESOURCE_DESC res_desc = { };
 	res_desc.resType = CUresourcetype::CU_RESOURCE_TYPE_ARRAY;
 	res_desc.res.array.hArray = array;
@@ -126,7 +793,7 @@ CUtexObject CUDAMemory::create_texture(CUarray array, CUfilter_mode filter, CUad
 	tex_desc.flags = CU_TRSF_NORMALIZED_COORDINATES;
 
 	CUtexObject tex_object = { };
-	CUDACALL(cuTexObjectCreate(&tex_object, &res_desc, &tex_desc, nullptr));
+	CUDACALL(cuTexObjectCreate(&tex_object, &res_desc, &tex_desc, view_desc));
 
 	return tex_object;
 }
@@ -3,6 +3,7 @@
 
 #include "Core/Array.h"
 #include "Core/Assertion.h"
+#include "Core/Constructors.h"
 #include "Core/IO.h"
 
 // Platform-specific debug break
@@ -17,6 +18,87 @@
 #endif
 
 namespace CUDAMemory {
+	// Subsystems that device memory is accounted to
+	enum struct Category {
+		OTHER,
+		GEOMETRY,     // Triangles and per Mesh data
+		BVH,
+		MATERIALS,
+		TEXTURES,
+		SKY,
+		LIGHTS,
+		WAVEFRONT,    // Trace/Material/Shadow Ray buffers
+		FRAMEBUFFERS, // AOVs, accumulator and GBuffer
+		SVGF,         // SVGF and TAA history
+		LUTS,
+
+		COUNT
+	};
+
+	StringView category_name(Category category);
+
+	// All Buffers and Arrays that are allocated on the calling thread while a CategoryScope is alive are accounted to its Category
+	struct CategoryScope {
+		Category category_prev;
+
+		CategoryScope(Category category);
+		~CategoryScope();
+
+		NON_COPYABLE(CategoryScope);
+		NON_MOVEABLE(CategoryScope);
+	};
+
+	// Device memory is sub-allocated from a caching pool per Context, see CUDAMemory.cpp
+	// Freed blocks are kept around and handed out again once the GPU is done with them,
+	// which avoids the implicit synchronization of cuMemAlloc/cuMemFree when buffers are recreated
+	CUdeviceptr pool_alloc(size_t size_in_bytes);
+	void        pool_free (CUdeviceptr ptr);
+
+	// Managed memory that prefers to reside on the Device, but is paged out to the Host once the Device runs out of memory
+	// Pages are migrated back on demand when the Device accesses them. Managed blocks are freed through pool_free but never reused
+	CUdeviceptr pool_alloc_managed(size_t size_in_bytes);
+
+	// Returns all cached blocks of the current Context to the driver
+	void pool_release();
+
+	// Pinned host memory comes from a caching pool per Context as well, see malloc_pinned
+	// cuMemAllocHost page locks the memory and maps it for the Device, which is far more expensive than a regular allocation.
+	// Freed blocks are kept and handed out again to requests of the same size class, so that the staging and readback buffers
+	// that are recreated with every Integrator or resized with the Scene do not go back to the driver each time
+	// Small blocks are packed into shared slabs, instead of each of them locking pages of their own
+	void * pinned_alloc(size_t size_in_bytes);
+	void   pinned_free (void * ptr);
+
+	void pinned_release(); // Returns all cached pinned blocks of the current Context to the driver, and the slabs if none of their blocks are in use
+
+	struct PoolStats {
+		size_t bytes_reserved;    // Allocated from the driver, including cached blocks
+		size_t bytes_in_use;      // Handed out by malloc
+		size_t bytes_in_use_peak; // Highest bytes_in_use + bytes_arrays since the last pool_reset_peak
+		int    block_count_in_use;
+		int    block_count_cached;
+
+		size_t bytes_arrays; // CUDA Arrays are allocated by the driver directly, an estimate based on their dimensions
+
+		size_t bytes_per_category[size_t(Category::COUNT)]; // Buffers in use and Arrays
+
+		size_t pinned_bytes_reserved;
+		size_t pinned_bytes_in_use;
+		int    pinned_slab_count;
+	};
+	PoolStats pool_get_stats(); // Stats of the pool of the current Context
+	void      pool_reset_peak();
+
+	void print_memory_summary(); // Prints the Stats of the current Context per Category
+
+	// Small host to device copies (Globals, per frame configs) go through a ring of pinned memory per Context, see CUDAModule::Global::set_value_async
+	// cuMemcpyHtoDAsync from pageable memory only returns once the driver has staged the data itself, from pinned memory it returns right away
+	// The source can be reused as soon as this returns. Copies larger than a segment of the ring go to the driver directly
+	// NOTE: Must not be used on a stream that is being captured into a CUDA Graph, the Graph would keep referring to reused staging memory
+	void copy_staged_async(CUdeviceptr dst, const void * src, size_t size, CUstream stream);
+
+	void staging_free(); // Frees the staging ring of the current Context, waits for its outstanding copies
+
 	// Type safe device pointer wrapper
 	template<typename T>
 	struct Ptr {
@@ -39,20 +121,14 @@ namespace CUDAMemory {
 	inline T * malloc_pinned(size_t count = 1) {
 		ASSERT(count > 0);
 
-		T * ptr;
-		CUDACALL(cuMemAllocHost(reinterpret_cast<void **>(&ptr), count * sizeof(T)));
-
-		return ptr;
+		return static_cast<T *>(pinned_alloc(count * sizeof(T)));
 	}
 
 	template<typename T>
 	inline Ptr<T> malloc(size_t count = 1) {
 		ASSERT(count > 0);
 
-		CUdeviceptr ptr;
-		CUDACALL(cuMemAlloc(&ptr, count * sizeof(T)));
-
-		return Ptr<T>(ptr);
+		return Ptr<T>(pool_alloc(count * sizeof(T)));
 	}
 
 	template<typename T>
@@ -73,16 +149,31 @@ namespace CUDAMemory {
 		return malloc(data.data(), data.size());
 	}
 
+	template<typename T>
+	inline Ptr<T> malloc_managed(size_t count = 1) {
+		ASSERT(count > 0);
+
+		return Ptr<T>(pool_alloc_managed(count * sizeof(T)));
+	}
+
+	template<typename T>
+	inline Ptr<T> malloc_managed(const Array<T> & data) {
+		Ptr<T> ptr = malloc_managed<T>(data.size());
+		memcpy(ptr, data.data(), data.size());
+
+		return ptr;
+	}
+
 	template<typename T>
 	inline void free_pinned(T * ptr) {
 		ASSERT(ptr);
-		CUDACALL(cuMemFreeHost(ptr));
+		pinned_free(ptr);
 	}
 
 	template<typename T>
 	inline void free(Ptr<T> & ptr) {
 		ASSERT(ptr.ptr);
-		CUDACALL(cuMemFree(ptr.ptr));
+		pool_free(ptr.ptr);
 		ptr.ptr = 0;
 	}
 
@@ -136,6 +227,8 @@ namespace CUDAMemory {
 	CUarray          create_array       (int width, int height, int depth, int channels, CUarray_format format);
 	CUmipmappedArray create_array_mipmap(int width, int height,            int channels, CUarray_format format, int level_count);
 
+	CUarray create_array_surface(int width, int height, int channels, CUarray_format format); // Array that can be bound to a Surface Object
+
 	void free_array(CUarray array);
 	void free_array(CUmipmappedArray array);
 
@@ -146,7 +239,14 @@ namespace CUDAMemory {
 	void copy_array   (CUarray array, int width_in_bytes, int height,            CUdeviceptr data);
 	void copy_array_3d(CUarray array, int width_in_bytes, int height, int depth, CUdeviceptr data);
 
-	CUtexObject  create_texture(CUarray array, CUfilter_mode filter, CUaddress_mode address_mode);
+	// Copies the rows [y, y + height) of the Device Array from the Host in stream order, data should be pinned memory for the copy to be asynchronous
+	void copy_array_async(CUarray array, int width_in_bytes, int y, int height, const void * data, CUstream stream);
+
+	// Copies data from the Device Array to the Host
+	void copy_array_to_host   (void * data, CUarray array, int width_in_bytes, int height);
+	void copy_array_3d_to_host(void * data, CUarray array, int width_in_bytes, int height, int depth);
+
+	CUtexObject  create_texture(CUarray array, CUfilter_mode filter, CUaddress_mode address_mode, const CUDA_RESOURCE_VIEW_DESC * view_desc = nullptr); // A view is required for Block Compressed Arrays
 	CUsurfObject create_surface(CUarray array);
 
 	void free_texture(CUtexObject  texture);
@@ -5,6 +5,7 @@
 #include <nvrtc.h>
 
 #include "Core/Assertion.h"
+#include "Core/Hash.h"
 
 // Platform-specific debug break
 #ifdef _WIN32
@@ -25,6 +26,7 @@
 #include "CUDAMemory.h"
 
 #include "Util/Util.h"
+#include "Util/Profiler.h"
 #include "Util/StringUtil.h"
 
 #define NVRTC_CALL(result) check_nvrtc_call(result, __FILE__, __LINE__);
@@ -43,9 +45,8 @@ struct Include {
 
 // Recursively walks include tree
 // Collects filename and source of included files in 'includes'
-// Also check whether any included file has been modified since last compilation and if so sets 'should_recompile'
 // Returns source code of 'filename'
-static String scan_includes_recursive(const String & filename, Allocator * allocator, StringView directory, Array<Include> & includes, StringView ptx_filename, bool & should_recompile) {
+static String scan_includes_recursive(const String & filename, Allocator * allocator, StringView directory, Array<Include> & includes) {
 	String source = IO::file_read(filename, allocator);
 	Parser parser(source.view(), filename.view());
 
@@ -86,19 +87,13 @@ static String scan_includes_recursive(const String & filename, Allocator * alloc
 				String include_full_path = Util::combine_stringviews(directory, include_filename, allocator);
 
 				if (IO::file_exists(include_full_path.view())) {
-					if (!should_recompile && IO::file_is_newer(ptx_filename, include_full_path.view())) {
-						should_recompile = true;
-
-						IO::print("CUDA Module '{}': Recompilation required because included file '{}' changed.\n"_sv, filename, include_filename);
-					}
-
 					StringView path = Util::get_directory(include_full_path.view());
 
 					size_t index = includes.size();
 					includes.emplace_back();
 
 					includes[index].filename = String(include_filename, allocator);
-					includes[index].source   = scan_includes_recursive(include_full_path, allocator, path, includes, ptx_filename, should_recompile);
+					includes[index].source   = scan_includes_recursive(include_full_path, allocator, path, includes);
 				}
 			}
 		} else {
@@ -109,135 +104,223 @@ static String scan_includes_recursive(const String & filename, Allocator * alloc
 	return source;
 }
 
-void CUDAModule::init(const String & module_name, const String & filename, int compute_capability, int max_registers) {
-	ScopeTimer timer("CUDA Module Init"_sv);
+// The cache key covers everything that affects the compiled binary, so that a cached CUBIN is only reused if
+// compiling again would produce the same result. Unlike file modification times this is robust against touched files
+static size_t calc_cache_key(const String & source, const Array<Include> & includes, const char * const options[], size_t num_options, int compute_capability, int max_registers) {
+	size_t key = FNVHash::hash(source.data(), source.size());
 
-	if (!IO::file_exists(filename.view())) {
-		IO::print("ERROR: File '{}' does not exist!\n"_sv, filename);
-		IO::exit(1);
+	for (size_t i = 0; i < includes.size(); i++) {
+		key = FNVHash::hash(includes[i].filename.data(), includes[i].filename.size() + 1, key); // NOTE: Including the '\0' separates the filename from the source
+		key = FNVHash::hash(includes[i].source  .data(), includes[i].source  .size(),     key);
 	}
 
-	StackAllocator<128>             stack_allocator;
-	LinearAllocator<KILOBYTES(512)> allocator;
+	for (size_t i = 0; i < num_options; i++) {
+		key = FNVHash::hash(options[i], strlen(options[i]) + 1, key);
+	}
+
+	key = FNVHash::hash(reinterpret_cast<const char *>(&compute_capability), sizeof(compute_capability), key);
+	key = FNVHash::hash(reinterpret_cast<const char *>(&max_registers),      sizeof(max_registers),      key);
+
+	return key;
+}
+
+static String get_cubin_filename(const String & filename, size_t key, int compute_capability, Allocator * allocator) {
+	char cache_key[17];
+	snprintf(cache_key, sizeof(cache_key), "%016llx", (unsigned long long)key);
 
 #ifdef _DEBUG
-	String ptx_filename = Util::combine_stringviews(filename.view(), ".debug.ptx"_sv, &stack_allocator);
+	StringView build_type = "debug"_sv;
 #else
-	String ptx_filename = Util::combine_stringviews(filename.view(), ".release.ptx"_sv, &stack_allocator);
+	StringView build_type = "release"_sv;
 #endif
+	return Format(allocator).format("{}.{}.sm_{}.{}.cubin"_sv, filename, build_type, compute_capability, cache_key);
+}
 
-	bool should_recompile = true;
+// Compiles the source with NVRTC, on a compile error the file is reloaded from disk and compiled again until it succeeds
+// 'source' and 'includes' are updated with what was compiled last, the caller destroys the returned Program
+static nvrtcProgram nvrtc_compile(const String & module_name, const String & filename, StringView path, const Array<const char *> & options, LinearAllocator<KILOBYTES(512)> * allocator, String & source, Array<Include> & includes) {
+	ProfileScope scope("Module Compile"_sv, "CUDA"_sv);
 
-	// If the binary does not exists we definately need to compile
-	if (IO::file_exists(ptx_filename.view())) {
-		// Recompile if the source file is newer than the binary
-		should_recompile = IO::file_is_newer(ptx_filename.view(), filename.view());
-	}
+	nvrtcProgram program;
 
-	StringView path = Util::get_directory(filename.view());
+	while (true) {
+		size_t num_includes = includes.size();
+		Array<const char *> include_names  (num_includes, allocator);
+		Array<const char *> include_sources(num_includes, allocator);
 
-	Array<Include> includes;
-	String source = scan_includes_recursive(filename, &allocator, path, includes, ptx_filename.view(), should_recompile);
+		for (size_t i = 0; i < num_includes; i++) {
+			include_names  [i] = includes[i].filename.data();
+			include_sources[i] = includes[i].source  .data();
+		}
 
-	if (should_recompile) {
-		nvrtcProgram program;
+		// Create NVRTC Program from the source and all includes
+		NVRTC_CALL(nvrtcCreateProgram(&program, source.data(), module_name.c_str(), int(num_includes), include_sources.data(), include_names.data()));
 
-		while (true) {
-			size_t num_includes = includes.size();
-			Array<const char *> include_names  (num_includes, &allocator);
-			Array<const char *> include_sources(num_includes, &allocator);
+		// Compile to PTX
+		nvrtcResult result = nvrtcCompileProgram(program, int(options.size()), options.data());
 
-			for (size_t i = 0; i < num_includes; i++) {
-				include_names  [i] = includes[i].filename.data();
-				include_sources[i] = includes[i].source  .data();
-			}
+		size_t log_size;
+		NVRTC_CALL(nvrtcGetProgramLogSize(program, &log_size));
 
-			// Create NVRTC Program from the source and all includes
-			NVRTC_CALL(nvrtcCreateProgram(&program, source.data(), module_name.c_str(), int(num_includes), include_sources.data(), include_names.data()));
+		if (log_size > 1) {
+			String log(log_size, allocator);
+			NVRTC_CALL(nvrtcGetProgramLog(program, log.data()));
 
-			// Configure options
-			String option_compute = Format(&allocator).format("--gpu-architecture=compute_{}"_sv, compute_capability);
-			String option_maxregs = Format(&allocator).format("--maxrregcount={}"_sv, max_registers);
+			IO::print("NVRTC output:\n{}\n"_sv, log);
+		}
 
-			const char * options[] = {
-				"--std=c++11",
-				option_compute.data(),
-				option_maxregs.data(),
-				"--use_fast_math",
-				"--extra-device-vectorization",
-				//"--device-debug",
-				"-lineinfo",
-				"-restrict"
-			};
+		if (result == NVRTC_SUCCESS) return program;
+		DEBUG_BREAK(); // Compile error
 
-			// Compile to PTX
-			nvrtcResult result = nvrtcCompileProgram(program, Util::array_count(options), options);
+		NVRTC_CALL(nvrtcDestroyProgram(&program));
 
-			size_t log_size;
-			NVRTC_CALL(nvrtcGetProgramLogSize(program, &log_size));
+		// Reload file and try again
+		allocator->reset();
+		includes.clear();
+		source = scan_includes_recursive(filename, allocator, path, includes);
+	}
+}
 
-			if (log_size > 1) {
-				String log(log_size, &allocator);
-				NVRTC_CALL(nvrtcGetProgramLog(program, log.data()));
+void CUDAModule::init(const String & module_name, const String & filename, int compute_capability, int max_registers, const Array<String> & defines) {
+	ScopeTimer        timer("CUDA Module Init"_sv);
+	ProfileAssetScope asset(module_name.view());
+	ProfileScope      scope("Module Init"_sv, "CUDA"_sv);
 
-				IO::print("NVRTC output:\n{}\n"_sv, log);
-			}
+	if (!IO::file_exists(filename.view())) {
+		IO::print("ERROR: File '{}' does not exist!\n"_sv, filename);
+		IO::exit(1);
+	}
 
-			if (result == NVRTC_SUCCESS) break;
-			DEBUG_BREAK(); // Compile error
+	StackAllocator<512>             stack_allocator;
+	LinearAllocator<KILOBYTES(512)> allocator;
 
-			// Reload file and try again
-			allocator.reset();
-			includes.clear();
-			source = scan_includes_recursive(filename, &allocator, path, includes, ptx_filename.view(), should_recompile);
-		}
+	StringView path = Util::get_directory(filename.view());
+
+	Array<Include> includes;
+	String source = scan_includes_recursive(filename, &allocator, path, includes);
+
+	// Configure options
+	String option_compute = Format(&stack_allocator).format("--gpu-architecture=compute_{}"_sv, compute_capability);
+	String option_maxregs = Format(&stack_allocator).format("--maxrregcount={}"_sv, max_registers);
+
+	Array<const char *> options = {
+		"--std=c++11",
+		option_compute.data(),
+		option_maxregs.data(),
+		"--use_fast_math",
+		"--extra-device-vectorization",
+		//"--device-debug",
+		"-lineinfo",
+		"-restrict"
+	};
+
+	// Defines are part of the options, so differently configured Modules are cached separately
+	for (size_t i = 0; i < defines.size(); i++) {
+		options.push_back(defines[i].c_str());
+	}
 
-		// Obtain PTX from NVRTC
-		size_t ptx_size;      NVRTC_CALL(nvrtcGetPTXSize(program, &ptx_size));
-		String ptx(ptx_size); NVRTC_CALL(nvrtcGetPTX    (program, ptx.data()));
+	// The final SASS is cached per Device architecture, so that the driver does not need to JIT compile PTX on startup
+	cache_key = calc_cache_key(source, includes, options.data(), options.size(), compute_capability, max_registers);
+	String cubin_filename = get_cubin_filename(filename, cache_key, compute_capability, &stack_allocator);
 
-		NVRTC_CALL(nvrtcDestroyProgram(&program));
+	if (IO::file_exists(cubin_filename.view())) {
+		String cubin = IO::file_read(cubin_filename, nullptr);
+		CUDACALL(cuModuleLoadData(&module, cubin.data()));
 
-		// Cache PTX on disk
-		IO::file_write(ptx_filename, ptx.view());
-	} else {
-		IO::print("CUDA Module '{}' did not need to recompile.\n"_sv, filename);
+		IO::print("CUDA Module '{}' did not need to recompile.\n\n"_sv, filename);
+		return;
 	}
 
+	nvrtcProgram program = nvrtc_compile(module_name, filename, path, options, &allocator, source, includes);
+
+	// The sources may have been edited to fix a compile error
+	cache_key      = calc_cache_key(source, includes, options.data(), options.size(), compute_capability, max_registers);
+	cubin_filename = get_cubin_filename(filename, cache_key, compute_capability, &stack_allocator);
+
+	// Obtain PTX from NVRTC
+	size_t ptx_size;      NVRTC_CALL(nvrtcGetPTXSize(program, &ptx_size));
+	String ptx(ptx_size); NVRTC_CALL(nvrtcGetPTX    (program, ptx.data()));
+
+	NVRTC_CALL(nvrtcDestroyProgram(&program));
+
 	char log_buffer[8192];
 	log_buffer[0] = '\0';
 
-	CUjit_option options[] = {
+	CUjit_option jit_options[] = {
 		CU_JIT_MAX_REGISTERS,
 		CU_JIT_INFO_LOG_BUFFER_SIZE_BYTES,
 		CU_JIT_INFO_LOG_BUFFER,
 		CU_JIT_LOG_VERBOSE
 	};
-	void * values[] = {
+	void * jit_values[] = {
 		reinterpret_cast<void *>(max_registers),
 		reinterpret_cast<void *>(sizeof(log_buffer)),
 		reinterpret_cast<void *>(log_buffer),
-		reinterpret_cast<void *>(should_recompile) // Only verbose if we just recompiled
+		reinterpret_cast<void *>(1)
 	};
 
+	// Compile PTX to SASS for the current Device
 	CUlinkState link_state;
-	CUDACALL(cuLinkCreate(Util::array_count(options), options, values, &link_state));
-	CUDACALL(cuLinkAddFile(link_state, CU_JIT_INPUT_PTX, ptx_filename.data(), 0, nullptr, nullptr));
+	CUDACALL(cuLinkCreate(Util::array_count(jit_options), jit_options, jit_values, &link_state));
+	CUDACALL(cuLinkAddData(link_state, CU_JIT_INPUT_PTX, ptx.data(), ptx_size, module_name.c_str(), 0, nullptr, nullptr));
 
 	void * cubin;
 	size_t cubin_size;
-	cuLinkComplete(link_state, &cubin, &cubin_size);
+	CUDACALL(cuLinkComplete(link_state, &cubin, &cubin_size));
 
 	CUDACALL(cuModuleLoadData(&module, cubin));
 
+	// Cache CUBIN on disk
+	IO::file_write(cubin_filename, StringView { reinterpret_cast<const char *>(cubin), reinterpret_cast<const char *>(cubin) + cubin_size });
+
 	CUDACALL(cuLinkDestroy(link_state));
 
-	if (should_recompile) {
-		IO::print(StringView::from_c_str(log_buffer));
-	}
+	IO::print(StringView::from_c_str(log_buffer));
 	IO::print('\n');
 }
 
+String CUDAModule::compile_ptx(const String & module_name, const String & filename, int compute_capability, const Array<String> & options_extra) {
+	ScopeTimer        timer("CUDA PTX Compile"_sv);
+	ProfileAssetScope asset(module_name.view());
+	ProfileScope      scope("PTX Compile"_sv, "CUDA"_sv);
+
+	if (!IO::file_exists(filename.view())) {
+		IO::print("ERROR: File '{}' does not exist!\n"_sv, filename);
+		IO::exit(1);
+	}
+
+	StackAllocator<512>             stack_allocator;
+	LinearAllocator<KILOBYTES(512)> allocator;
+
+	StringView path = Util::get_directory(filename.view());
+
+	Array<Include> includes;
+	String source = scan_includes_recursive(filename, &allocator, path, includes);
+
+	String option_compute = Format(&stack_allocator).format("--gpu-architecture=compute_{}"_sv, compute_capability);
+
+	Array<const char *> options = {
+		"--std=c++11",
+		option_compute.data(),
+		"--use_fast_math",
+		"-lineinfo",
+		"-restrict"
+	};
+
+	for (size_t i = 0; i < options_extra.size(); i++) {
+		options.push_back(options_extra[i].c_str());
+	}
+
+	nvrtcProgram program = nvrtc_compile(module_name, filename, path, options, &allocator, source, includes);
+
+	size_t ptx_size;      NVRTC_CALL(nvrtcGetPTXSize(program, &ptx_size));
+	String ptx(ptx_size); NVRTC_CALL(nvrtcGetPTX    (program, ptx.data()));
+
+	NVRTC_CALL(nvrtcDestroyProgram(&program));
+
+	return ptx;
+}
+
 void CUDAModule::free() {
 	CUDACALL(cuModuleUnload(module));
 }
@@ -254,3 +337,12 @@ CUDAModule::Global CUDAModule::get_global(const char * variable_name) const {
 
 	return global;
 }
+
+bool CUDAModule::find_global(const char * variable_name, Global & global) const {
+	size_t size;
+	CUresult result = cuModuleGetGlobal(&global.ptr, &size, module, variable_name);
+	if (result == CUDA_ERROR_NOT_FOUND) return false;
+
+	CUDACALL(result);
+	return true;
+}
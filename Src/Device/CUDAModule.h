@@ -4,12 +4,16 @@
 #include <cuda.h>
 
 #include "CUDACall.h"
+#include "CUDAMemory.h"
 
+#include "Core/Array.h"
 #include "Core/String.h"
 
 struct CUDAModule {
 	CUmodule module;
 
+	size_t cache_key = 0; // Identifies the compiled binary (source, includes and options), data derived from the Module can be cached with it
+
 	struct Global {
 		CUdeviceptr ptr;
 
@@ -18,9 +22,10 @@ struct CUDAModule {
 			CUDACALL(cuMemcpyHtoD(ptr, &value, sizeof(T)));
 		}
 
+		// Staged through pinned memory, so value does not have to outlive the call
 		template<typename T>
 		inline void set_value_async(const T & value, CUstream stream) const {
-			CUDACALL(cuMemcpyHtoDAsync(ptr, &value, sizeof(T), stream));
+			CUDAMemory::copy_staged_async(ptr, &value, sizeof(T), stream);
 		}
 
 		template<typename T>
@@ -32,8 +37,45 @@ struct CUDAModule {
 		}
 	};
 
-	void init(const String & module_name, const String & filename, int compute_capability, int max_registers);
+	// The same global in several Modules, e.g. the per frame state that is read by the Kernels of an Integrator that span multiple Modules
+	struct SharedGlobal {
+		static constexpr int MAX_MODULES = 4;
+
+		Global globals[MAX_MODULES];
+		int    global_count = 0;
+
+		// Modules that do not declare the global are skipped
+		void add(const CUDAModule & module, const char * variable_name) {
+			Global global;
+			if (!module.find_global(variable_name, global)) return;
+
+			ASSERT(global_count < MAX_MODULES);
+			globals[global_count++] = global;
+		}
+
+		template<typename T>
+		inline void set_value(const T & value) const {
+			for (int i = 0; i < global_count; i++) {
+				globals[i].set_value(value);
+			}
+		}
+
+		template<typename T>
+		inline void set_value_async(const T & value, CUstream stream) const {
+			for (int i = 0; i < global_count; i++) {
+				globals[i].set_value_async(value, stream);
+			}
+		}
+	};
+
+	// Every define is passed to NVRTC as is, e.g. "-DNAME=VALUE"
+	void init(const String & module_name, const String & filename, int compute_capability, int max_registers, const Array<String> & defines = { });
 	void free();
 
+	// Only compiles the file to PTX without loading it, for consumers that link PTX themselves (see OptiXTraversal)
+	// Includes that are not found relative to the file are left to NVRTC, so options may contain include paths ("-I...")
+	static String compile_ptx(const String & module_name, const String & filename, int compute_capability, const Array<String> & options = { });
+
 	Global get_global(const char * variable_name) const;
+	bool   find_global(const char * variable_name, Global & global) const; // Unlike get_global a missing global is not an error
 };
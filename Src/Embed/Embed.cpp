@@ -0,0 +1,206 @@
+#include "Embed.h"
+
+#include "Config.h"
+#include "Args.h"
+
+#include "Core/IO.h"
+#include "Core/Allocators/LinearAllocator.h"
+#include "Core/Allocators/StackAllocator.h"
+
+#include "Device/CUDAContext.h"
+#include "Device/CUDAMemory.h"
+
+#include "Assets/JPEGDecoder.h"
+
+#include "Renderer/Integrators/AO.h"
+#include "Renderer/Integrators/Pathtracer.h"
+
+#include "Util/PMJ.h"
+#include "Util/Profiler.h"
+#include "Util/ThreadPool.h"
+
+static_assert(int(PATHTRACER_AOV_RADIANCE_CACHE) == int(AOVType::RADIANCE_CACHE) && int(PATHTRACER_AOV_RADIANCE_CACHE) + 1 == int(AOVType::COUNT));
+
+struct PathtracerRenderer {
+	LinearAllocator<MEGABYTES(1)> scene_allocator;
+	Scene scene;
+
+	OwnPtr<Integrator> integrator = nullptr; // Created once the first sample is rendered, the Scene is uploaded at that point
+
+	LinearAllocator<MEGABYTES(16)> frame_allocator;
+
+	PathtracerRenderer() : scene(&scene_allocator) { }
+};
+
+static bool renderer_exists = false;
+
+// Same as init_integrator in Main.cpp, without a Window the Integrator renders into a plain CUDA array
+static Integrator & get_integrator(PathtracerRenderer * renderer) {
+	if (!renderer->integrator) {
+		if (renderer->scene.meshes.size() == 0) {
+			IO::print("ERROR: The Scene has no Meshes, load a Scene file or add a Mesh before rendering!\n"_sv);
+			IO::exit(1);
+		}
+
+		switch (cpu_config.integrator) {
+			case IntegratorType::PATHTRACER:
+			case IntegratorType::MEGAKERNEL:
+			case IntegratorType::BAKE:       renderer->integrator = make_owned<Pathtracer>(0, cpu_config.initial_width, cpu_config.initial_height, renderer->scene); break;
+			case IntegratorType::AO:         renderer->integrator = make_owned<AO>        (0, cpu_config.initial_width, cpu_config.initial_height, renderer->scene); break;
+			default: ASSERT_UNREACHABLE();
+		}
+	}
+	return *renderer->integrator.get();
+}
+
+PathtracerRenderer * pathtracer_create(int num_args, const char ** args) {
+	if (renderer_exists) {
+		IO::print("WARNING: Only one Renderer can exist at a time, cpu_config and gpu_config are global\n"_sv);
+		return nullptr;
+	}
+	renderer_exists = true;
+
+	StackAllocator<KILOBYTES(4)> allocator;
+	Array<StringView> arguments(num_args, &allocator);
+	for (int i = 0; i < num_args; i++) {
+		arguments[i] = StringView::from_c_str(args[i]);
+	}
+	Args::parse(arguments);
+	IO::set_log_level(cpu_config.log_level); // The host application owns stdout, messages are written directly
+
+	if (cpu_config.sky_filename.is_empty()) {
+		cpu_config.sky_filename = "Data/Skies/sky_15.hdr"_sv;
+	}
+	cpu_config.headless = true;
+
+	LargePageAllocator::init(cpu_config.large_pages);
+	ThreadPool::init();
+
+	ThreadPool::TaskGroup pmj_group;
+	for (int i = 1; i < PMJ_NUM_SEQUENCES; i++) {
+		ThreadPool::submit(pmj_group, [i]() {
+			PMJ::shuffle(i);
+		});
+	}
+
+	CUDAContext::init(false, cpu_config.cuda_device);
+
+	PathtracerRenderer * renderer = new PathtracerRenderer();
+
+	ThreadPool::wait(pmj_group); // The Integrator uploads the PMJ samples
+
+	return renderer;
+}
+
+void pathtracer_destroy(PathtracerRenderer * renderer) {
+	if (!renderer) return;
+
+	if (renderer->integrator) {
+		renderer->integrator->cuda_free();
+	}
+	delete renderer;
+
+	Profiler::free();
+	ThreadPool::free();
+	JPEGDecoder::free();
+	CUDAContext::free();
+
+	renderer_exists = false;
+}
+
+int pathtracer_add_mesh(PathtracerRenderer * renderer, const char * name, const float * positions, const float * normals, int triangle_count) {
+	if (renderer->integrator) {
+		IO::print("WARNING: Meshes can only be added before the first sample is rendered\n"_sv);
+		return INVALID;
+	}
+	if (triangle_count <= 0) return INVALID;
+
+	Array<Triangle> triangles(triangle_count);
+
+	for (int i = 0; i < triangle_count; i++) {
+		// Zero normals are replaced by the geometric normal
+		triangles[i] = Triangle(
+			Vector3(positions + 9*i),
+			Vector3(positions + 9*i + 3),
+			Vector3(positions + 9*i + 6),
+			normals ? Vector3(normals + 9*i)     : Vector3(0.0f),
+			normals ? Vector3(normals + 9*i + 3) : Vector3(0.0f),
+			normals ? Vector3(normals + 9*i + 6) : Vector3(0.0f),
+			Vector2(0.0f),
+			Vector2(0.0f),
+			Vector2(0.0f)
+		);
+	}
+
+	Scene & scene = renderer->scene;
+
+	Handle<MeshData> mesh_data_handle = scene.asset_manager.add_mesh_data(std::move(triangles));
+	scene.add_mesh(name ? String(StringView::from_c_str(name)) : String("Mesh"_sv), mesh_data_handle);
+
+	return int(scene.meshes.size()) - 1;
+}
+
+void pathtracer_set_camera(PathtracerRenderer * renderer, const float position[3], const float rotation[4], float fov) {
+	Camera & camera = renderer->scene.camera;
+	camera.position = Vector3(position);
+	camera.rotation = Quaternion(rotation[0], rotation[1], rotation[2], rotation[3]);
+	camera.set_fov(fov);
+
+	if (renderer->integrator) {
+		renderer->integrator->invalidated_camera = true;
+	}
+}
+
+void pathtracer_enable_aov(PathtracerRenderer * renderer, PathtracerAOV aov) {
+	get_integrator(renderer).aov_enable(AOVType(aov));
+}
+
+int pathtracer_render(PathtracerRenderer * renderer, int sample_count) {
+	Integrator & integrator = get_integrator(renderer);
+
+	for (int i = 0; i < sample_count; i++) {
+		integrator.update(0.0f, &renderer->frame_allocator);
+		integrator.render();
+
+		renderer->frame_allocator.reset();
+	}
+	return integrator.sample_index;
+}
+
+void pathtracer_synchronize(PathtracerRenderer * renderer) {
+	CUDACALL(cuCtxSynchronize());
+}
+
+void * pathtracer_get_radiance_array(PathtracerRenderer * renderer, int * width, int * height) {
+	const Integrator & integrator = get_integrator(renderer);
+
+	*width  = integrator.display_width;
+	*height = integrator.display_height;
+
+	return integrator.array_accumulator;
+}
+
+PathtracerImage pathtracer_get_aov(PathtracerRenderer * renderer, PathtracerAOV aov) {
+	const Integrator & integrator = get_integrator(renderer);
+
+	PathtracerImage image = { };
+	if (integrator.aov_is_enabled(AOVType(aov))) {
+		image.device_pointer = integrator.get_aov(AOVType(aov)).accumulator.ptr;
+		image.width  = integrator.screen_width;
+		image.height = integrator.screen_height * integrator.view_count;
+		image.pitch  = integrator.screen_pitch;
+	}
+	return image;
+}
+
+int pathtracer_get_aov_ipc_handle(PathtracerRenderer * renderer, PathtracerAOV aov, void * ipc_handle) {
+	PathtracerImage image = pathtracer_get_aov(renderer, aov);
+	if (image.device_pointer == 0) return 0;
+
+	// Every block of the CUDAMemory pool is its own cuMemAlloc allocation, so its base address can be exported
+	CUipcMemHandle handle;
+	if (cuIpcGetMemHandle(&handle, CUdeviceptr(image.device_pointer)) != CUDA_SUCCESS) return 0;
+
+	memcpy(ipc_handle, &handle, sizeof(handle));
+	return 1;
+}
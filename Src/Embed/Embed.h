@@ -0,0 +1,73 @@
+#pragma once
+
+// C interface to embed the Pathtracer in another application (a compositor, a simulator or a training loop), without the Window or the GUI
+// The Renderer owns the Scene and a headless Integrator, the accumulated images stay on the Device and are handed out as Device pointers,
+// so that the host application can consume them with its own CUDA code (or in another process through CUDA IPC) without a copy through the Host
+// The renderer is configured through cpu_config and gpu_config, which are global, so only one Renderer can exist per process
+// ENABLE_LIBRARY in CMakeLists.txt builds this as the shared library pathtracer_embed
+#ifdef __cplusplus
+#define PATHTRACER_EXTERN extern "C"
+#else
+#define PATHTRACER_EXTERN
+#endif
+
+#ifdef _WIN32
+#define PATHTRACER_API PATHTRACER_EXTERN _declspec(dllexport)
+#else
+#define PATHTRACER_API PATHTRACER_EXTERN __attribute__((visibility("default")))
+#endif
+
+typedef struct PathtracerRenderer PathtracerRenderer;
+
+// Must match AOVType in CUDA/Common.h
+typedef enum PathtracerAOV {
+	PATHTRACER_AOV_RADIANCE,
+	PATHTRACER_AOV_RADIANCE_DIRECT,
+	PATHTRACER_AOV_RADIANCE_INDIRECT,
+	PATHTRACER_AOV_ALBEDO,
+	PATHTRACER_AOV_NORMAL,
+	PATHTRACER_AOV_POSITION,
+	PATHTRACER_AOV_TRAVERSAL_COST,
+	PATHTRACER_AOV_RADIANCE_CACHE
+} PathtracerAOV;
+
+// Linear float4 image on the Device, pitch is in Pixels
+typedef struct PathtracerImage {
+	unsigned long long device_pointer; // CUdeviceptr, 0 if the AOV is not enabled
+	int width;
+	int height;
+	int pitch;
+} PathtracerImage;
+
+// The arguments are the same options the executable accepts, without the program name (for example "-W", "1280", "-H", "720", "scene.xml")
+// Unlike the executable no default Scene is loaded, but the Sky still defaults to Data/Skies/sky_15.hdr
+// Returns nullptr if a Renderer already exists
+PATHTRACER_API PathtracerRenderer * pathtracer_create(int num_args, const char ** args);
+PATHTRACER_API void                 pathtracer_destroy(PathtracerRenderer * renderer);
+
+// Adds a Mesh of triangle_count Triangles with the default Material, positions holds 9 floats per Triangle (three vertices, counter clockwise)
+// normals holds 9 floats per Triangle and may be nullptr, in which case the geometric normal is used. Returns the index of the Mesh
+// Meshes can only be added before the first call to pathtracer_render (or pathtracer_enable_aov), afterwards INVALID (-1) is returned
+PATHTRACER_API int pathtracer_add_mesh(PathtracerRenderer * renderer, const char * name, const float * positions, const float * normals, int triangle_count);
+
+// Rotation is a Quaternion (x, y, z, w), fov is the vertical Field of View in radians. Restarts the accumulation
+PATHTRACER_API void pathtracer_set_camera(PathtracerRenderer * renderer, const float position[3], const float rotation[4], float fov);
+
+// Must be called before the first pathtracer_render that should accumulate the AOV, restarts the accumulation
+PATHTRACER_API void pathtracer_enable_aov(PathtracerRenderer * renderer, PathtracerAOV aov);
+
+// Submits sample_count more samples, returns the total number of samples accumulated so far
+// The launches are asynchronous, pathtracer_synchronize waits for them before the images are read by other streams or processes
+PATHTRACER_API int  pathtracer_render(PathtracerRenderer * renderer, int sample_count);
+PATHTRACER_API void pathtracer_synchronize(PathtracerRenderer * renderer);
+
+// Averaged Radiance, it lives in a CUDA array (it is written through a Surface), so a pointer to its CUarray is returned rather than linear memory
+PATHTRACER_API void * pathtracer_get_radiance_array(PathtracerRenderer * renderer, int * width, int * height);
+
+// Averaged AOV (the accumulators hold an online average). Stays valid until the next pathtracer_enable_aov or pathtracer_destroy
+// With multiple views ("--views stereo" or "--views cubemap") the views are stacked vertically, height covers all of them
+PATHTRACER_API PathtracerImage pathtracer_get_aov(PathtracerRenderer * renderer, PathtracerAOV aov);
+
+// Writes the CUipcMemHandle (CU_IPC_HANDLE_SIZE bytes) of an AOV accumulator, which another process opens with cuIpcOpenMemHandle
+// Returns 0 if the AOV is not enabled or the Device does not support IPC
+PATHTRACER_API int pathtracer_get_aov_ipc_handle(PathtracerRenderer * renderer, PathtracerAOV aov, void * ipc_handle);
@@ -0,0 +1,129 @@
+#include "AccumulatorFile.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "Core/IO.h"
+
+static constexpr int ACCUMULATOR_FILETYPE_VERSION = 1;
+
+static constexpr size_t LAYER_NAME_LENGTH = 32;
+
+struct AccumulatorFileHeader {
+	char filetype_identifier[4];
+	int  filetype_version;
+
+	int width;
+	int height;
+
+	int sample_first;
+	int sample_count;
+
+	int layer_count;
+};
+
+// Every Layer starts with a fixed size name, followed by width * height RGBA pixels
+static size_t layer_size(int width, int height) {
+	return LAYER_NAME_LENGTH + size_t(width) * size_t(height) * 4 * sizeof(float);
+}
+
+bool AccumulatorFile::save(const String & filename, const Accumulator & accumulator) {
+	FILE * file = nullptr;
+	errno_t err;
+#ifdef _WIN32
+	err = fopen_s(&file, filename.data(), "wb");
+#else
+	file = fopen(filename.data(), "wb");
+	err = errno;
+#endif
+
+	if (!file) {
+		IO::print("ERROR: Failed to open Accumulator file '{}' for writing! ({})\n"_sv, filename, IO::get_error_message(err));
+		return false;
+	}
+
+	AccumulatorFileHeader header = { };
+	memcpy(header.filetype_identifier, "ACCU", 4);
+	header.filetype_version = ACCUMULATOR_FILETYPE_VERSION;
+	header.width            = accumulator.width;
+	header.height           = accumulator.height;
+	header.sample_first     = accumulator.sample_first;
+	header.sample_count     = accumulator.sample_count;
+	header.layer_count      = int(accumulator.layers.size());
+
+	size_t pixel_count = size_t(accumulator.width) * size_t(accumulator.height);
+
+	bool success = fwrite(&header, sizeof(header), 1, file) == 1;
+
+	for (size_t i = 0; i < accumulator.layers.size() && success; i++) {
+		const Layer & layer = accumulator.layers[i];
+		ASSERT(layer.name.size() < LAYER_NAME_LENGTH);
+		ASSERT(layer.data.size() == 4 * pixel_count);
+
+		char name[LAYER_NAME_LENGTH] = { };
+		memcpy(name, layer.name.data(), layer.name.size());
+
+		success =
+			fwrite(name,              sizeof(char),  LAYER_NAME_LENGTH, file) == LAYER_NAME_LENGTH &&
+			fwrite(layer.data.data(), sizeof(float), 4 * pixel_count,   file) == 4 * pixel_count;
+	}
+
+	if (!success) {
+		IO::print("ERROR: Failed to write Accumulator file '{}'!\n"_sv, filename);
+	}
+
+	fclose(file);
+	return success;
+}
+
+bool AccumulatorFile::load(const String & filename, Accumulator & accumulator) {
+	IO::MappedFile mapped_file;
+	if (!mapped_file.open(filename)) {
+		IO::print("ERROR: Failed to map Accumulator file '{}'!\n"_sv, filename);
+		return false;
+	}
+
+	AccumulatorFileHeader header = { };
+	if (mapped_file.size() < sizeof(AccumulatorFileHeader)) {
+		IO::print("ERROR: Accumulator file '{}' is too small!\n"_sv, filename);
+		return false;
+	}
+	memcpy(&header, mapped_file.data(), sizeof(AccumulatorFileHeader));
+
+	if (memcmp(header.filetype_identifier, "ACCU", 4) != 0 || header.filetype_version != ACCUMULATOR_FILETYPE_VERSION) {
+		IO::print("ERROR: '{}' is not a valid Accumulator file!\n"_sv, filename);
+		return false;
+	}
+
+	if (header.width <= 0 || header.height <= 0 || header.layer_count < 0 ||
+		mapped_file.size() != sizeof(AccumulatorFileHeader) + size_t(header.layer_count) * layer_size(header.width, header.height)
+	) {
+		IO::print("ERROR: Accumulator file '{}' is corrupt!\n"_sv, filename);
+		return false;
+	}
+
+	accumulator.width        = header.width;
+	accumulator.height       = header.height;
+	accumulator.sample_first = header.sample_first;
+	accumulator.sample_count = header.sample_count;
+
+	size_t pixel_count = size_t(header.width) * size_t(header.height);
+
+	accumulator.layers.clear();
+	accumulator.layers.resize(header.layer_count);
+
+	const char * cur = mapped_file.data() + sizeof(AccumulatorFileHeader);
+
+	for (int i = 0; i < header.layer_count; i++) {
+		Layer & layer = accumulator.layers[i];
+
+		layer.name = String(cur, strnlen(cur, LAYER_NAME_LENGTH));
+		cur += LAYER_NAME_LENGTH;
+
+		layer.data.resize(4 * pixel_count);
+		memcpy(layer.data.data(), cur, 4 * pixel_count * sizeof(float));
+		cur += 4 * pixel_count * sizeof(float);
+	}
+
+	return true;
+}
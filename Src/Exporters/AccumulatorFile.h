@@ -0,0 +1,25 @@
+#pragma once
+#include "Core/Array.h"
+#include "Core/String.h"
+
+// Raw Accumulator contents of a (partial) render together with the range of samples it contains,
+// used to split the samples of a single image over multiple processes or machines and merge the results afterwards
+namespace AccumulatorFile {
+	struct Layer {
+		String       name; // Empty for the radiance, otherwise the name of the AOV
+		Array<float> data; // RGBA per pixel, rows of exactly width pixels
+	};
+
+	struct Accumulator {
+		int width  = 0;
+		int height = 0;
+
+		int sample_first = 0; // Index of the first sample, random numbers were generated with indices [sample_first, sample_first + sample_count)
+		int sample_count = 0;
+
+		Array<Layer> layers;
+	};
+
+	bool save(const String & filename, const Accumulator & accumulator);
+	bool load(const String & filename, Accumulator & accumulator);
+}
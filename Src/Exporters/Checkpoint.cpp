@@ -0,0 +1,225 @@
+#include "Checkpoint.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "Core/IO.h"
+#include "Core/Format.h"
+#include "Core/Allocators/StackAllocator.h"
+
+#include "Config.h"
+
+struct CheckpointFileHeader {
+	char filetype_identifier[4];
+	int  filetype_version;
+
+	int screen_width;
+	int screen_height;
+	int screen_pitch;
+
+	unsigned aov_mask;
+
+	int sample_first; // cpu_config.sample_index_first of the render
+	int sample_count;
+};
+
+void Checkpoint::init(const Integrator & integrator, const String & filename) {
+	this->filename = String(filename.view());
+
+	CUDACALL(cuStreamCreate(&stream, CU_STREAM_NON_BLOCKING));
+
+	CUDACALL(cuEventCreate(&event_frame_rendered, CU_EVENT_DISABLE_TIMING));
+	CUDACALL(cuEventCreate(&event_duplicated,     CU_EVENT_DISABLE_TIMING));
+	CUDACALL(cuEventCreate(&event_copied,         CU_EVENT_DISABLE_TIMING));
+
+	screen_width  = integrator.screen_width;
+	screen_height = integrator.screen_height;
+	screen_pitch  = integrator.screen_pitch;
+
+	aov_mask  = gpu_config.aov_mask;
+	aov_count = 0;
+	aov_size  = size_t(integrator.screen_pitch) * size_t(integrator.screen_height);
+
+	for (int i = 0; i < int(AOVType::COUNT); i++) {
+		if (aov_mask & (1u << i)) aov_count++;
+	}
+
+	CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::FRAMEBUFFERS);
+
+	ptr_duplicate = CUDAMemory::malloc<float4>(aov_count * aov_size);
+	pinned_copy   = CUDAMemory::malloc_pinned<float4>(aov_count * aov_size);
+}
+
+void Checkpoint::free() {
+	poll(true);
+
+	CUDAMemory::free(ptr_duplicate);
+	CUDAMemory::free_pinned(pinned_copy);
+
+	CUDACALL(cuEventDestroy(event_frame_rendered));
+	CUDACALL(cuEventDestroy(event_duplicated));
+	CUDACALL(cuEventDestroy(event_copied));
+
+	CUDACALL(cuStreamDestroy(stream));
+}
+
+void Checkpoint::save_async(const Integrator & integrator) {
+	if (copy_pending || !write_group.is_done()) return;
+
+	ASSERT(gpu_config.aov_mask == aov_mask);
+
+	// The Streams of the frame all synchronize with the legacy default Stream
+	CUDACALL(cuEventRecord(event_frame_rendered, nullptr));
+	CUDACALL(cuStreamWaitEvent(stream, event_frame_rendered, 0));
+
+	int index = 0;
+	for (int i = 0; i < int(AOVType::COUNT); i++) {
+		if (!(aov_mask & (1u << i))) continue;
+
+		const AOV & aov = integrator.get_aov(AOVType(i));
+		CUDACALL(cuMemcpyDtoDAsync((ptr_duplicate + index * aov_size).ptr, aov.accumulator.ptr, aov_size * sizeof(float4), stream));
+		index++;
+	}
+
+	// Only the next frame has to wait for the duplicate, not for the copy to the Host
+	CUDACALL(cuEventRecord(event_duplicated, stream));
+	CUDACALL(cuStreamWaitEvent(nullptr, event_duplicated, 0));
+
+	CUDAMemory::memcpy_async(pinned_copy, ptr_duplicate, aov_count * aov_size, stream);
+	CUDACALL(cuEventRecord(event_copied, stream));
+
+	sample_count = integrator.sample_index + 1;
+	copy_pending = true;
+}
+
+void Checkpoint::poll(bool wait) {
+	if (copy_pending) {
+		if (wait) {
+			CUDACALL(cuEventSynchronize(event_copied));
+		} else {
+			CUresult result = cuEventQuery(event_copied);
+			if (result == CUDA_ERROR_NOT_READY) return;
+
+			CUDACALL(result);
+		}
+		copy_pending = false;
+
+		CheckpointFileHeader header = { };
+		memcpy(header.filetype_identifier, "CKPT", 4);
+		header.filetype_version = CHECKPOINT_FILETYPE_VERSION;
+		header.screen_width     = screen_width;
+		header.screen_height    = screen_height;
+		header.screen_pitch     = screen_pitch;
+		header.aov_mask         = aov_mask;
+		header.sample_first     = cpu_config.sample_index_first;
+		header.sample_count     = sample_count;
+
+		ThreadPool::submit(write_group, [this, header]() {
+			// Written next to the previous Checkpoint first, so that being pre-empted during the write does not lose it
+			StackAllocator<BYTES(512)> allocator;
+			String filename_tmp = Format(&allocator).format("{}.tmp"_sv, filename);
+
+			FILE * file = nullptr;
+			errno_t err;
+#ifdef _WIN32
+			err = fopen_s(&file, filename_tmp.data(), "wb");
+#else
+			file = fopen(filename_tmp.data(), "wb");
+			err = errno;
+#endif
+			if (!file) {
+				IO::print("WARNING: Failed to open Checkpoint file '{}' for writing! ({})\n"_sv, filename_tmp, IO::get_error_message(err));
+				return;
+			}
+
+			size_t float4_count = size_t(aov_count) * aov_size;
+
+			bool success =
+				fwrite(&header,     sizeof(header), 1,            file) == 1 &&
+				fwrite(pinned_copy, sizeof(float4), float4_count, file) == float4_count;
+
+			fclose(file);
+
+			if (!success) {
+				IO::print("WARNING: Failed to write Checkpoint file '{}'!\n"_sv, filename_tmp);
+				return;
+			}
+
+#ifdef _WIN32
+			remove(filename.data()); // rename does not replace existing files on Windows
+#endif
+			if (rename(filename_tmp.data(), filename.data()) != 0) {
+				IO::print("WARNING: Failed to replace Checkpoint file '{}'!\n"_sv, filename);
+				return;
+			}
+
+			IO::print("Checkpoint: {} samples written to '{}'\n"_sv, header.sample_count, filename);
+		});
+	}
+
+	if (wait) {
+		ThreadPool::wait(write_group);
+	}
+}
+
+bool Checkpoint::load(const String & filename, Integrator & integrator) {
+	IO::MappedFile mapped_file;
+	if (!mapped_file.open(filename)) {
+		IO::print("WARNING: Failed to map Checkpoint file '{}', rendering from the start!\n"_sv, filename);
+		return false;
+	}
+
+	CheckpointFileHeader header = { };
+	if (mapped_file.size() < sizeof(CheckpointFileHeader)) {
+		IO::print("WARNING: Checkpoint file '{}' is too small!\n"_sv, filename);
+		return false;
+	}
+	memcpy(&header, mapped_file.data(), sizeof(CheckpointFileHeader));
+
+	if (memcmp(header.filetype_identifier, "CKPT", 4) != 0 || header.filetype_version != CHECKPOINT_FILETYPE_VERSION) {
+		IO::print("WARNING: '{}' is not a valid Checkpoint file!\n"_sv, filename);
+		return false;
+	}
+
+	if (header.screen_width  != integrator.screen_width  ||
+		header.screen_height != integrator.screen_height ||
+		header.screen_pitch  != integrator.screen_pitch  ||
+		header.aov_mask      != gpu_config.aov_mask ||
+		header.sample_first  != cpu_config.sample_index_first
+	) {
+		IO::print("WARNING: Checkpoint file '{}' was written by a render with a different resolution, AOVs or sample range!\n"_sv, filename);
+		return false;
+	}
+
+	if (header.sample_count <= 0 || header.sample_count > cpu_config.output_sample_index) {
+		IO::print("WARNING: Checkpoint file '{}' contains {} samples, which does not leave any samples to render!\n"_sv, filename, header.sample_count);
+		return false;
+	}
+
+	size_t aov_size  = size_t(header.screen_pitch) * size_t(header.screen_height);
+	int    aov_count = 0;
+
+	for (int i = 0; i < int(AOVType::COUNT); i++) {
+		if (header.aov_mask & (1u << i)) aov_count++;
+	}
+
+	if (mapped_file.size() != sizeof(CheckpointFileHeader) + size_t(aov_count) * aov_size * sizeof(float4)) {
+		IO::print("WARNING: Checkpoint file '{}' is corrupt!\n"_sv, filename);
+		return false;
+	}
+
+	const float4 * data = reinterpret_cast<const float4 *>(mapped_file.data() + sizeof(CheckpointFileHeader));
+
+	for (int i = 0; i < int(AOVType::COUNT); i++) {
+		if (!(header.aov_mask & (1u << i))) continue;
+
+		CUDAMemory::memcpy(integrator.get_aov(AOVType(i)).accumulator, data, aov_size);
+		data += aov_size;
+	}
+
+	// The next sample continues the same sequence of random numbers
+	integrator.sample_index = header.sample_count;
+
+	IO::print("Resuming from {} samples in '{}'\n"_sv, header.sample_count, filename);
+	return true;
+}
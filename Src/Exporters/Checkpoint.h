@@ -0,0 +1,51 @@
+#pragma once
+#include "Core/String.h"
+
+#include "Util/ThreadPool.h"
+
+#include "Renderer/Integrators/Integrator.h"
+
+// Periodic snapshot of the AOV Accumulators of a long headless render, so that a pre-empted render can continue with --resume
+// Random numbers only depend on the sample index, so the Accumulators together with the sample index are the full progress of the render
+// Saving does not stall rendering: the Accumulators are first duplicated on the Device, which is the only step
+// the next frame waits for, then copied into pinned memory on a separate Stream and written to disk on the ThreadPool
+struct Checkpoint {
+	static constexpr int CHECKPOINT_FILETYPE_VERSION = 1;
+
+	String filename;
+
+	CUstream stream = { };
+
+	CUevent event_frame_rendered = { };
+	CUevent event_duplicated     = { };
+	CUevent event_copied         = { };
+
+	int screen_width  = 0;
+	int screen_height = 0;
+	int screen_pitch  = 0;
+
+	unsigned aov_mask     = 0; // AOVs stored in the Checkpoint
+	int      aov_count    = 0;
+	size_t   aov_size     = 0; // Number of float4s per AOV, screen_pitch * screen_height
+	int      sample_count = 0; // Number of samples in the Accumulators of the copy in flight
+
+	CUDAMemory::Ptr<float4> ptr_duplicate; // aov_count AOVs back to back
+	float4 *                pinned_copy = nullptr;
+
+	bool                  copy_pending = false;
+	ThreadPool::TaskGroup write_group;
+
+	void init(const Integrator & integrator, const String & filename);
+	void free();
+
+	// Should be called after Integrator::render(), the Checkpoint contains that sample
+	// Skipped if the previous Checkpoint is still in flight
+	void save_async(const Integrator & integrator);
+
+	// Hands a finished copy to the ThreadPool, with wait set it blocks until all Checkpoints are on disk
+	void poll(bool wait);
+
+	// Restores the Accumulators and the sample index, needs to be called after the first Integrator::update()
+	// which resets the sample index. Fails if the Checkpoint does not match the resolution, AOVs or sample range of the render
+	static bool load(const String & filename, Integrator & integrator);
+};
@@ -1,52 +1,129 @@
 #include "EXRExporter.h"
 
 #define TINYEXR_IMPLEMENTATION
+#define TINYEXR_USE_THREAD 1 // Compresses scanline blocks in parallel
 #include <tinyexr.h>
 
+#include "Config.h"
+
 #include "Core/IO.h"
+#include "Core/Sort.h"
 
 #include "Util/Util.h"
+#include "Util/ThreadPool.h"
+
+static constexpr int EXR_ROWS_PER_JOB = 64;
+
+static int get_compression_type(EXRCompression compression) {
+	switch (compression) {
+		case EXRCompression::NONE: return TINYEXR_COMPRESSIONTYPE_NONE;
+		case EXRCompression::RLE:  return TINYEXR_COMPRESSIONTYPE_RLE;
+		case EXRCompression::ZIP:  return TINYEXR_COMPRESSIONTYPE_ZIP;
+		case EXRCompression::PIZ:  return TINYEXR_COMPRESSIONTYPE_PIZ;
+		default: ASSERT_UNREACHABLE();
+	}
+}
 
 void EXRExporter::save(const String & filename, int pitch, int width, int height, const Array<Vector3> & data) {
-	Array<float> data_rgb[3] = {
-		Array<float>(width * height),
-		Array<float>(width * height),
-		Array<float>(width * height)
+	Layer layer = { };
+	layer.data   = &data.data()->x;
+	layer.stride = 3;
+	layer.pitch  = pitch;
+
+	save(filename, width, height, &layer, 1);
+}
+
+void EXRExporter::save(const String & filename, int width, int height, const Layer * layers, int layer_count) {
+	struct Channel {
+		EXRChannelInfo info;
+
+		const Layer * layer;
+		int           component; // 0 = R, 1 = G, 2 = B
+
+		Array<float> data;
 	};
 
-	for (int y = 0; y < height; y++) {
-		for (int x = 0; x < width; x++) {
-			data_rgb[0][x + (height - 1 - y) * width] = data[x + y * pitch].x;
-			data_rgb[1][x + (height - 1 - y) * width] = data[x + y * pitch].y;
-			data_rgb[2][x + (height - 1 - y) * width] = data[x + y * pitch].z;
+	static constexpr char COMPONENT_NAMES[3] = { 'R', 'G', 'B' };
+
+	int channel_count = 3 * layer_count;
+
+	Array<Channel> channels(channel_count);
+
+	for (int l = 0; l < layer_count; l++) {
+		const Layer & layer = layers[l];
+		ASSERT(layer.stride >= 3);
+		ASSERT(layer.name.size() + 3 <= sizeof(EXRChannelInfo::name));
+
+		for (int c = 0; c < 3; c++) {
+			Channel & channel = channels[3 * l + c];
+			channel.info      = { };
+			channel.layer     = &layer;
+			channel.component = c;
+
+			size_t length = 0;
+			if (!layer.name.is_empty()) {
+				memcpy(channel.info.name, layer.name.start, layer.name.size());
+				length = layer.name.size();
+				channel.info.name[length++] = '.';
+			}
+			channel.info.name[length++] = COMPONENT_NAMES[c];
+			channel.info.name[length]   = '\0';
 		}
 	}
 
-	const float * data_bgr[3] = {
-		data_rgb[2].data(), // B
-		data_rgb[1].data(), // G
-		data_rgb[0].data()  // R
-	};
+	// EXR requires the channels to be sorted by name
+	Sort::stable_sort(channels.begin(), channels.end(), [](const Channel & a, const Channel & b) {
+		return strcmp(a.info.name, b.info.name) < 0;
+	});
+
+	// Deinterleave into one plane per channel, the image needs to be flipped vertically
+	for (int c = 0; c < channel_count; c++) {
+		channels[c].data.resize(width * height);
+	}
+
+	ThreadPool::parallel_for(0, height, EXR_ROWS_PER_JOB, [&channels, channel_count, width, height](int y_first, int y_last) {
+		for (int c = 0; c < channel_count; c++) {
+			const Channel & channel = channels[c];
+			const Layer   & layer   = *channel.layer;
+
+			float * dst = channels[c].data.data();
+
+			for (int y = y_first; y < y_last; y++) {
+				const float * src = layer.data + size_t(y) * layer.pitch * layer.stride + channel.component;
+
+				for (int x = 0; x < width; x++) {
+					dst[x + (height - 1 - y) * width] = src[x * layer.stride];
+				}
+			}
+		}
+	});
+
+	Array<const float *> images       (channel_count);
+	Array<EXRChannelInfo> channel_infos(channel_count);
+	Array<int>            pixel_types  (channel_count);
+	Array<int>  requested_pixel_types  (channel_count);
+
+	int requested_pixel_type = cpu_config.exr_half_precision ? TINYEXR_PIXELTYPE_HALF : TINYEXR_PIXELTYPE_FLOAT;
+
+	for (int c = 0; c < channel_count; c++) {
+		images       [c] = channels[c].data.data();
+		channel_infos[c] = channels[c].info;
+		pixel_types  [c] = TINYEXR_PIXELTYPE_FLOAT;
+		requested_pixel_types[c] = requested_pixel_type;
+	}
 
 	EXRImage image = { };
-	image.num_channels = 3;
-	image.images       = Util::bit_cast<unsigned char **>(&data_bgr[0]);
+	image.num_channels = channel_count;
+	image.images       = Util::bit_cast<unsigned char **>(images.data());
 	image.width        = width;
 	image.height       = height;
 
 	EXRHeader header = { };
-	header.num_channels = 3;
-
-	EXRChannelInfo channels[3] = { };
-	header.channels = channels;
-	memcpy(header.channels[0].name, "B", 2);
-	memcpy(header.channels[1].name, "G", 2);
-	memcpy(header.channels[2].name, "R", 2);
-
-	int           pixel_types[3] = { TINYEXR_PIXELTYPE_FLOAT, TINYEXR_PIXELTYPE_FLOAT, TINYEXR_PIXELTYPE_FLOAT };
-	int requested_pixel_types[3] = { TINYEXR_PIXELTYPE_HALF,  TINYEXR_PIXELTYPE_HALF,  TINYEXR_PIXELTYPE_HALF};
-	header.pixel_types           = pixel_types;
-	header.requested_pixel_types = requested_pixel_types;
+	header.num_channels          = channel_count;
+	header.channels              = channel_infos.data();
+	header.pixel_types           = pixel_types.data();
+	header.requested_pixel_types = requested_pixel_types.data();
+	header.compression_type      = get_compression_type(cpu_config.exr_compression);
 
 	const char * error_string = nullptr;
 	int          error_code = SaveEXRImageToFile(&image, &header, filename.data(), &error_string);
@@ -5,5 +5,14 @@
 #include "Math/Vector3.h"
 
 namespace EXRExporter {
+	// A set of RGB channels in a (multi-layer) EXR file, the channels are called <name>.R, <name>.G, <name>.B
+	struct Layer {
+		StringView    name;   // Empty for the default layer, whose channels are called R, G, B
+		const float * data;   // Interleaved, the first three floats of every pixel are used
+		int           stride; // Number of floats per pixel
+		int           pitch;  // Number of pixels per row
+	};
+
 	void save(const String & filename, int pitch, int width, int height, const Array<Vector3> & data);
+	void save(const String & filename, int width, int height, const Layer * layers, int layer_count);
 }
@@ -0,0 +1,120 @@
+#include "FrameStream.h"
+
+#include <cstdio>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "Core/Array.h"
+#include "Core/IO.h"
+
+#ifdef _WIN32
+#define popen  _popen
+#define pclose _pclose
+#endif
+
+static FILE * encoder_pipe = nullptr;
+static size_t frame_size   = 0;
+
+static Array<unsigned char> buffers[FrameStream::QUEUE_SIZE];
+
+// Frames [frames_written, frames_queued) are waiting for the writer thread,
+// the buffer of frame frames_queued is the one that is being filled
+static int  frames_queued  = 0;
+static int  frames_written = 0;
+static bool closing        = false;
+static bool write_failed   = false; // Only accessed by the writer thread while it runs
+
+static std::thread             writer_thread;
+static std::mutex              mutex;
+static std::condition_variable condition;
+
+static void writer() {
+	while (true) {
+		int index;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, []() { return frames_written < frames_queued || closing; });
+
+			if (frames_written == frames_queued) return; // Closing and the queue is drained
+
+			index = frames_written % FrameStream::QUEUE_SIZE;
+		}
+
+		if (!write_failed && fwrite(buffers[index].data(), 1, frame_size, encoder_pipe) != frame_size) {
+			IO::print("WARNING: The encoder stopped accepting frames, the remaining frames are dropped!\n"_sv);
+			write_failed = true;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			frames_written++;
+		}
+		condition.notify_all();
+	}
+}
+
+bool FrameStream::open(const String & command, int width, int height) {
+#ifdef _WIN32
+	encoder_pipe = popen(command.data(), "wb");
+#else
+	encoder_pipe = popen(command.data(), "w");
+#endif
+	if (!encoder_pipe) {
+		IO::print("ERROR: Unable to start the encoder '{}'!\n"_sv, command);
+		return false;
+	}
+
+	frame_size = size_t(width) * size_t(height) * 3;
+
+	for (int i = 0; i < QUEUE_SIZE; i++) {
+		buffers[i].resize(frame_size);
+	}
+
+	frames_queued  = 0;
+	frames_written = 0;
+	closing        = false;
+	write_failed   = false;
+
+	writer_thread = std::thread(writer);
+
+	IO::print("Streaming {}x{} RGB frames to '{}'\n"_sv, width, height, command);
+	return true;
+}
+
+void FrameStream::close() {
+	if (!encoder_pipe) return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		closing = true;
+	}
+	condition.notify_all();
+
+	writer_thread.join();
+
+	int exit_code = pclose(encoder_pipe);
+	if (exit_code != 0) {
+		IO::print("WARNING: The encoder exited with code {}!\n"_sv, exit_code);
+	}
+	encoder_pipe = nullptr;
+
+	for (int i = 0; i < QUEUE_SIZE; i++) {
+		buffers[i] = { };
+	}
+}
+
+unsigned char * FrameStream::begin_frame() {
+	std::unique_lock<std::mutex> lock(mutex);
+	condition.wait(lock, []() { return frames_queued - frames_written < QUEUE_SIZE; });
+
+	return buffers[frames_queued % QUEUE_SIZE].data();
+}
+
+void FrameStream::end_frame() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		frames_queued++;
+	}
+	condition.notify_all();
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include "Core/String.h"
+
+// Streams 8 bit RGB frames into the standard input of an external encoder, for example:
+//     ffmpeg -f rawvideo -pix_fmt rgb24 -s 1920x1080 -r 30 -i - turntable.mp4
+// Frames are handed to a writer thread through a bounded queue of buffers,
+// so the renderer only waits on the encoder once QUEUE_SIZE frames are still pending
+namespace FrameStream {
+	inline constexpr int QUEUE_SIZE = 4;
+
+	bool open(const String & command, int width, int height);
+
+	// Writes the remaining frames and waits for the encoder to exit
+	void close();
+
+	// Returns a buffer of width * height * 3 bytes to fill, rows go from top to bottom
+	// Blocks only if all buffers are still waiting to be written
+	unsigned char * begin_frame();
+	void            end_frame();
+}
@@ -11,244 +11,1808 @@
 #include "Core/Sort.h"
 #include "Core/Parser.h"
 #include "Core/Timer.h"
+#include "Core/Mutex.h"
 #include "Core/Allocators/StackAllocator.h"
 
 #include "Input.h"
 #include "Window.h"
 
+#include "Assets/JPEGDecoder.h"
+
+#include "Exporters/AccumulatorFile.h"
 #include "Exporters/EXRExporter.h"
 #include "Exporters/PPMExporter.h"
+#include "Exporters/FrameStream.h"
+#include "Exporters/Checkpoint.h"
+
+#include "Util/Util.h"
+#include "Util/Benchmark.h"
+#include "Util/BVHReport.h"
+#include "Util/Profiler.h"
+#include "Util/Sequence.h"
+#include "Util/RenderServer.h"
+#include "Util/TraversalBenchmark.h"
+#include "Util/Denoiser.h"
+
+#ifdef _WIN32
+extern "C" { _declspec(dllexport) unsigned NvOptimusEnablement = true; } // Forces NVIDIA driver to be used
+#endif
+
+static constexpr int FRAMETIME_HISTORY_LENGTH = 100;
+
+static constexpr float SCREENSHOT_FADE_TIME = 5.0f;
+
+static constexpr int MAX_HEADLESS_SAMPLES = 1 << 20; // Headless renders with a target error or time budget stop here if -N is not given
+
+struct Timing {
+	Uint64 start;
+	Uint64 now;
+	Uint64 last;
+
+	Uint64 time_of_last_screenshot;
+
+	double inv_perf_freq;
+	double delta_time;
+
+	double second;
+	int frames_this_second;
+	int fps;
+
+	double avg;
+	double min;
+	double max;
+	double history[FRAMETIME_HISTORY_LENGTH];
+
+	int frame_index;
+} static timing;
+
+static int last_pixel_query_x;
+static int last_pixel_query_y;
+
+static bool integrator_change_requested = false;
+
+using Exporter = void (*)(const String & filename, int pitch, int width, int height, const Array<Vector3> & data);
+
+// Accumulated AOV, copied from the GPU at the time of the capture
+struct CapturedAOV {
+	StringView    layer_name;
+	Array<float4> data;
+};
+
+// A screenshot whose frame buffer readback is still in flight, see Window::read_frame_buffer_async
+struct PendingCapture {
+	String   filename;
+	Exporter exporter;
+	int      readback_index;
+
+	// Only used when the AOVs are written as layers of the same EXR file
+	Array<CapturedAOV> aovs;
+	int aov_pitch;
+};
+
+static Array<PendingCapture> pending_captures;
+
+static ThreadPool::TaskGroup capture_group; // Encoding and writing of screenshots happens on the ThreadPool
+
+static void capture_screen(Window & window, const Integrator & integrator, const String & filename);
+static void capture_aovs(const Integrator & integrator, bool multilayer, Array<CapturedAOV> & captured_aovs);
+static void poll_captures(Window & window, bool wait);
+static void save_layers(const String & filename, int width, int height, const EXRExporter::Layer & base_layer, const Array<CapturedAOV> & aovs, int aov_pitch);
+static int  render_headless(Timer & timer, ThreadPool::TaskGroup & pmj_group);
+static int  render_sequence(Timer & timer, ThreadPool::TaskGroup & pmj_group);
+static int  render_server  (Timer & timer, ThreadPool::TaskGroup & pmj_group);
+static void save_output(const String & filename, const Integrator & integrator, const Array<float4> & radiance);
+static void stream_output(int width, int height, const Array<float4> & radiance);
+static void render_headless_multi_gpu(Array<OwnPtr<Integrator>> & integrators);
+static void dump_accumulators(const Integrator & integrator, const Array<float4> & radiance, int sample_count);
+static void denoiser_enable_aovs(Integrator & integrator);
+static int  merge_accumulators();
+static void write_ray_stats(const String & filename, const Integrator & integrator, const RayStats & stats, int frame_count);
+static int  autotune(Timer & timer, ThreadPool::TaskGroup & pmj_group);
+static int  run_benchmarks(Timer & timer, ThreadPool::TaskGroup & pmj_group);
+static int  run_traversal_benchmark(Timer & timer, ThreadPool::TaskGroup & pmj_group);
+static void calc_timing();
+static void draw_gui(Window & window, Integrator & integrator);
+
+// A frame_buffer_handle of 0 makes the Integrator render into a plain CUDA array, see Integrator::init_accumulator
+static void init_integrator(OwnPtr<Integrator> & integrator, unsigned frame_buffer_handle, int width, int height, Scene & scene) {
+	// The Geometry, Textures, Sky and RNG tables of the previous Integrator stay resident and are handed over to the new one
+	OwnPtr<GPUScene> gpu_scene;
+
+	if (integrator) {
+		integrator->cuda_free();
+		gpu_scene = std::move(integrator->gpu_scene);
+	}
+
+	switch (cpu_config.integrator) {
+		case IntegratorType::PATHTRACER:
+		case IntegratorType::MEGAKERNEL:
+		case IntegratorType::BAKE:       integrator = make_owned<Pathtracer>(frame_buffer_handle, width, height, scene, std::move(gpu_scene)); break;
+		case IntegratorType::AO:         integrator = make_owned<AO>        (frame_buffer_handle, width, height, scene, std::move(gpu_scene)); break;
+		default: ASSERT_UNREACHABLE();
+	}
+
+	// Without a Window the benchmarks, autotuning and ray stats read the Events of every frame
+	integrator->timings_requested = frame_buffer_handle == 0;
+
+	CUDAMemory::print_memory_summary();
+}
+
+int main(int num_args, char ** args) {
+	Args::parse(num_args, args);
+	IO::log_init(cpu_config.log_level);
+
+	if (cpu_config.scene_filenames.size() == 0) {
+		cpu_config.scene_filenames.push_back("Data/sponza/scene.xml"_sv);
+	}
+	if (cpu_config.sky_filename.is_empty()) {
+		cpu_config.sky_filename = "Data/Skies/sky_15.hdr"_sv;
+	}
+	// The bake atlas is not meant to be looked at, it is written to -o once -N samples are reached
+	if (cpu_config.integrator == IntegratorType::BAKE) {
+		cpu_config.headless = true;
+	}
+
+	Timer timer = { };
+	timer.start();
+
+	Profiler::set_thread_name("Main"_sv);
+	if (!cpu_config.trace_filename.is_empty()) {
+		Profiler::init(cpu_config.trace_filename, cpu_config.trace_frame_count);
+	}
+	if (cpu_config.enable_startup_report) {
+		Profiler::startup_begin();
+	}
+
+	LargePageAllocator::init(cpu_config.large_pages);
+	ThreadPool::init();
+
+	if (cpu_config.merge_filenames.size() > 0) {
+		int exit_code = merge_accumulators();
+
+		ThreadPool::free();
+
+		return exit_code;
+	}
+
+	if (!cpu_config.bvh_report_filename.is_empty()) {
+		BVHReport::Sweep sweep = { };
+		sweep.sah_cost_node = cpu_config.bvh_report_sah_cost_node;
+		sweep.sah_cost_leaf = cpu_config.bvh_report_sah_cost_leaf;
+		sweep.sbvh_alpha    = cpu_config.bvh_report_sbvh_alpha;
+
+		bool success = BVHReport::run(cpu_config.bvh_report_filename, cpu_config.scene_filenames, sweep);
+
+		ThreadPool::free();
+
+		return success ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	ThreadPool::TaskGroup pmj_group;
+
+	for (int i = 1; i < PMJ_NUM_SEQUENCES; i++) {
+		ThreadPool::submit(pmj_group, [i]() {
+			PMJ::shuffle(i);
+		});
+	}
+
+	if (cpu_config.headless || cpu_config.enable_autotune || !cpu_config.benchmark_filename.is_empty() || !cpu_config.traversal_benchmark_filename.is_empty() || !cpu_config.sequence_filename.is_empty() || cpu_config.server_port != INVALID) {
+		int exit_code;
+		if (!cpu_config.benchmark_filename.is_empty()) {
+			exit_code = run_benchmarks(timer, pmj_group);
+		} else if (!cpu_config.traversal_benchmark_filename.is_empty()) {
+			exit_code = run_traversal_benchmark(timer, pmj_group);
+		} else if (!cpu_config.sequence_filename.is_empty()) {
+			exit_code = render_sequence(timer, pmj_group);
+		} else if (cpu_config.server_port != INVALID) {
+			exit_code = render_server(timer, pmj_group);
+		} else if (cpu_config.enable_autotune) {
+			exit_code = autotune(timer, pmj_group);
+		} else {
+			exit_code = render_headless(timer, pmj_group);
+		}
+
+		Profiler::free();
+		ThreadPool::free();
+		JPEGDecoder::free();
+		CUDAContext::free();
+
+		return exit_code;
+	}
+
+	Window window("Pathtracer"_sv, cpu_config.initial_width, cpu_config.initial_height);
+
+	CUDAContext::init(true, cpu_config.cuda_device);
+
+	LinearAllocator<MEGABYTES(1)> scene_allocator;
+	Scene scene(&scene_allocator);
+
+	OwnPtr<Integrator> integrator = nullptr;
+
+	window.resize_handler = [&integrator](unsigned frame_buffer_handle, int width, int height) {
+		if (integrator && !integrator->resize_in_place(frame_buffer_handle, width, height)) {
+			integrator->resize_free();
+			integrator->resize_init(frame_buffer_handle, width, height);
+		}
+	};
+	window.max_width  = cpu_config.max_width;
+	window.max_height = cpu_config.max_height;
+	window.set_size(cpu_config.initial_width, cpu_config.initial_height);
+
+	ThreadPool::wait(pmj_group); // The Integrator uploads the PMJ samples
+
+	init_integrator(integrator, window.frame_buffer_handle, window.width, window.height, scene);
+	window.show();
+
+	size_t initialization_time = timer.stop();
+	Timer::print_named_duration("Initialization"_sv, initialization_time);
+	Profiler::startup_end();
+
+	timing.inv_perf_freq = 1.0 / double(SDL_GetPerformanceFrequency());
+	timing.start = SDL_GetPerformanceCounter();
+	timing.last  = timing.start;
+	timing.time_of_last_screenshot = INVALID;
+
+	LinearAllocator<MEGABYTES(16)> frame_allocator;
+
+	float delta_time_pending = 0.0f; // Time of UI iterations in which no frame was submitted, see cpu_config.enable_async_ui
+
+	// Render loop
+	while (!window.is_closed) {
+		// A specialised Module is recompiled by recreating the Integrator
+		if (integrator_change_requested || integrator->module_is_outdated()) {
+			integrator_change_requested = false;
+			init_integrator(integrator, window.frame_buffer_handle, window.width, window.height, scene);
+		}
+
+		// With the asynchronous UI a new frame is only submitted once the GPU has finished the previous one, until then the GUI keeps
+		// running and presents the accumulator as it is. Camera movement of the skipped iterations is applied with the next frame
+		bool submit_frame = !cpu_config.enable_async_ui || !integrator->is_frame_rendering();
+
+		if (submit_frame) {
+			integrator->update(float(timing.delta_time) + delta_time_pending, &frame_allocator);
+			integrator->render();
+			integrator->record_frame_rendered();
+
+			delta_time_pending = 0.0f;
+
+			integrator->update_stats.record_counters();
+			Profiler::frame_end(integrator->event_pool);
+
+			// Once the image is accumulating, render additional samples before presenting
+			// The accumulator is the GL frame buffer texture itself (registered once, see Integrator::init_accumulator), so nothing needs to be copied for display
+			for (int i = 1; i < cpu_config.samples_per_present && integrator->sample_index > 0 && integrator->sample_index != cpu_config.output_sample_index; i++) {
+				frame_allocator.reset();
+
+				integrator->update(0.0f, &frame_allocator);
+				integrator->render(); // If something was invalidated the loop stops after rendering the restarted sample
+				integrator->record_frame_rendered();
+
+				integrator->update_stats.record_counters();
+				Profiler::frame_end(integrator->event_pool);
+			}
+		} else {
+			delta_time_pending += float(timing.delta_time);
+		}
+
+		window.render_framebuffer();
+
+		poll_captures(window, false);
+
+		if (integrator->sample_index == cpu_config.output_sample_index) {
+			capture_screen(window, *integrator.get(), cpu_config.output_filename);
+			break; // Exit render loop and terimate
+		}
+		if (Input::is_key_pressed(SDL_SCANCODE_P)) {
+			StringView ext = { };
+			switch (cpu_config.screenshot_format) {
+				case OutputFormat::EXR: ext = "exr"_sv; break;
+				case OutputFormat::PPM: ext = "ppm"_sv; break;
+				default: ASSERT_UNREACHABLE();
+			}
+
+			StackAllocator<BYTES(128)> allocator;
+			String screenshot_name = Format(&allocator).format("screenshot_{}.{}"_sv, integrator->sample_index, ext);
+			capture_screen(window, *integrator.get(), screenshot_name);
+
+			timing.time_of_last_screenshot = timing.now;
+		}
+
+		if (ImGui::IsMouseClicked(1)) {
+			// Deselect current object
+			integrator->pixel_query.pixel_index = INVALID;
+			integrator->pixel_query.mesh_id     = INVALID;
+			integrator->pixel_query.triangle_id = INVALID;
+			integrator->pixel_query_status      = Integrator::PixelQueryStatus::INACTIVE;
+		}
+
+		if (ImGui::IsMouseClicked(0) && !ImGui::GetIO().WantCaptureMouse) {
+			Input::mouse_position(&last_pixel_query_x, &last_pixel_query_y);
+
+			integrator->set_pixel_query(last_pixel_query_x, last_pixel_query_y);
+		}
+
+		// The pick Ray does not wait for the frame, so with the asynchronous UI the selection updates while the GPU is still rendering
+		integrator->poll_pixel_query();
+
+		calc_timing();
+		draw_gui(window, *integrator.get());
+
+		if (Input::is_key_released(SDL_SCANCODE_F5)) {
+			ScopeTimer timer("Hot Reload"_sv);
+
+			integrator->cuda_free();
+			integrator->cuda_init(window.frame_buffer_handle, window.width, window.height);
+		}
+
+		Input::update(); // Save Keyboard State of this frame before SDL_PumpEvents
+
+		window.swap();
+
+		frame_allocator.reset();
+	}
+
+	// Finish outstanding screenshots
+	poll_captures(window, true);
+	ThreadPool::wait(capture_group);
+
+	// Free Integrator before freeing CUDA Context
+	integrator = nullptr;
+
+	Profiler::free();
+
+	// The ThreadPool stays alive during rendering, the TLAS may be built on it (see Integrator::sync_tlas)
+	ThreadPool::free();
+
+	JPEGDecoder::free();
+	CUDAContext::free();
+
+	return EXIT_SUCCESS;
+}
+
+static void capture_screen(Window & window, const Integrator & integrator, const String & filename) {
+	ScopeTimer timer("Screenshot"_sv);
+
+	Exporter exporter = nullptr;
+
+	bool hdr = false;
+
+	StringView file_extension = Util::get_file_extension(filename.view());
+	if (file_extension == "ppm"_sv) {
+		exporter = PPMExporter::save;
+		hdr      = false;
+	} else if (file_extension == "exr"_sv) {
+		exporter = EXRExporter::save;
+		hdr      = true;
+	} else {
+		IO::print("WARNING: Unsupported output file extension: {}!\n"_sv, file_extension);
+		return;
+	}
+
+	int readback_index = window.read_frame_buffer_async(hdr);
+	if (readback_index == INVALID) {
+		// All readbacks are in flight, finish the oldest ones first
+		poll_captures(window, true);
+
+		readback_index = window.read_frame_buffer_async(hdr);
+		ASSERT(readback_index != INVALID);
+	}
+
+	PendingCapture & capture = pending_captures.emplace_back();
+	capture.filename       = String(filename.view()); // NOTE: copy, the filename may live in a temporary Allocator
+	capture.exporter       = exporter;
+	capture.readback_index = readback_index;
+	capture.aov_pitch      = integrator.screen_pitch;
+
+	capture_aovs(integrator, hdr && cpu_config.exr_multilayer, capture.aovs);
+}
+
+static void capture_aovs(const Integrator & integrator, bool multilayer, Array<CapturedAOV> & captured_aovs) {
+	struct AOVExport {
+		AOVType    type;
+		StringView layer_name;
+		StringView filename; // Empty if the AOV is only exported as a layer
+	};
+
+	static constexpr AOVExport aov_exports[] = {
+		{ AOVType::RADIANCE_DIRECT,   "direct"_sv,   StringView { } },
+		{ AOVType::RADIANCE_INDIRECT, "indirect"_sv, StringView { } },
+		{ AOVType::ALBEDO,            "albedo"_sv,   "albedo.exr"_sv },
+		{ AOVType::NORMAL,            "normal"_sv,   "normal.exr"_sv },
+		{ AOVType::POSITION,          "position"_sv, "position.exr"_sv },
+		{ AOVType::TRAVERSAL_COST,    "traversal"_sv, "traversal.exr"_sv },
+		{ AOVType::RADIANCE_CACHE,    "radiance_cache"_sv, "radiance_cache.exr"_sv }
+	};
+
+	for (int i = 0; i < Util::array_count(aov_exports); i++) {
+		const AOVExport & aov_export = aov_exports[i];
+
+		if (!integrator.aov_is_enabled(aov_export.type)) continue;
+		if (!multilayer && aov_export.filename.is_empty()) continue;
+
+		const AOV & aov = integrator.get_aov(aov_export.type);
+
+		// The copy needs to happen now to capture the current frame, the export is deferred to the ThreadPool
+		Array<float4> aov_data(integrator.screen_pitch * integrator.screen_height);
+		CUDAMemory::memcpy(aov_data.data(), aov.accumulator, integrator.screen_pitch * integrator.screen_height);
+
+		if (multilayer) {
+			CapturedAOV & captured_aov = captured_aovs.emplace_back();
+			captured_aov.layer_name = aov_export.layer_name;
+			captured_aov.data       = std::move(aov_data);
+		} else {
+			int screen_width  = integrator.screen_width;
+			int screen_height = integrator.screen_height;
+			int screen_pitch  = integrator.screen_pitch;
+
+			ThreadPool::submit(capture_group, [filename = String(aov_export.filename), screen_width, screen_height, screen_pitch, aov_data = std::move(aov_data)]() {
+				EXRExporter::Layer layer = { };
+				layer.data   = &aov_data.data()->x;
+				layer.stride = 4;
+				layer.pitch  = screen_pitch;
+
+				EXRExporter::save(filename, screen_width, screen_height, &layer, 1);
+			});
+		}
+	}
+}
+
+static void save_layers(const String & filename, int width, int height, const EXRExporter::Layer & base_layer, const Array<CapturedAOV> & aovs, int aov_pitch) {
+	Array<EXRExporter::Layer> layers(aovs.size() + 1);
+	layers[0] = base_layer;
+
+	for (size_t i = 0; i < aovs.size(); i++) {
+		layers[i + 1].name   = aovs[i].layer_name;
+		layers[i + 1].data   = &aovs[i].data.data()->x;
+		layers[i + 1].stride = 4;
+		layers[i + 1].pitch  = aov_pitch;
+	}
+
+	EXRExporter::save(filename, width, height, layers.data(), int(layers.size()));
+}
+
+static void poll_captures(Window & window, bool wait) {
+	size_t i = 0;
+	while (i < pending_captures.size()) {
+		PendingCapture & capture = pending_captures[i];
+
+		if (!window.frame_readback_is_done(capture.readback_index, wait)) {
+			i++;
+			continue;
+		}
+
+		int pitch  = 0;
+		int width  = 0;
+		int height = 0;
+		Array<Vector3> data = window.frame_readback_get(capture.readback_index, pitch, width, height);
+
+		if (capture.aovs.size() > 0) {
+			ThreadPool::submit(capture_group, [filename = std::move(capture.filename), aovs = std::move(capture.aovs), aov_pitch = capture.aov_pitch, pitch, width, height, data = std::move(data)]() {
+				EXRExporter::Layer layer = { };
+				layer.data   = &data.data()->x;
+				layer.stride = 3;
+				layer.pitch  = pitch;
+
+				save_layers(filename, width, height, layer, aovs, aov_pitch);
+			});
+		} else {
+			ThreadPool::submit(capture_group, [filename = std::move(capture.filename), exporter = capture.exporter, pitch, width, height, data = std::move(data)]() {
+				exporter(filename, pitch, width, height, data);
+			});
+		}
+
+		// Remove by swapping with the last pending capture
+		if (i != pending_captures.size() - 1) {
+			pending_captures[i] = std::move(pending_captures[pending_captures.size() - 1]);
+		}
+		pending_captures.pop_back();
+	}
+}
+
+// Same tone mapping and gamma correction as the post processing Shader (Src/Shaders/post.frag)
+static Vector3 tonemap(const float4 & radiance) {
+	auto tonemap_aces = [](float x) {
+		x = Math::max(0.0f, x);
+		return Math::clamp((x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f), 0.0f, 1.0f);
+	};
+
+	return Vector3(
+		powf(tonemap_aces(radiance.x), 1.0f / 2.2f),
+		powf(tonemap_aces(radiance.y), 1.0f / 2.2f),
+		powf(tonemap_aces(radiance.z), 1.0f / 2.2f)
+	);
+}
+
+// Renders without a Window or GL Context, once the target number of samples is reached
+// the output is read back directly from the Accumulator and the program terminates
+static int render_headless(Timer & timer, ThreadPool::TaskGroup & pmj_group) {
+	// The error is estimated from the Radiance AOV, which is not accumulated with SVGF
+	if (cpu_config.convergence_target_error > 0.0f && (cpu_config.integrator != IntegratorType::PATHTRACER || gpu_config.enable_svgf)) {
+		IO::print("WARNING: A target error is only supported for Pathtracer renders without SVGF\n"_sv);
+		cpu_config.convergence_target_error = 0.0f;
+	}
+
+	bool stop_on_convergence = cpu_config.convergence_target_error > 0.0f;
+	bool stop_on_time        = cpu_config.time_budget > 0.0f;
+
+	if (cpu_config.output_sample_index == INVALID) {
+		if (!stop_on_convergence && !stop_on_time) {
+			IO::print("ERROR: Headless rendering requires a target number of samples (-N), a target error or a time budget!\n"_sv);
+			return EXIT_FAILURE;
+		}
+		cpu_config.output_sample_index = MAX_HEADLESS_SAMPLES - 1;
+	}
+
+	StringView file_extension = Util::get_file_extension(cpu_config.output_filename.view());
+	if (file_extension != "ppm"_sv && file_extension != "exr"_sv) {
+		IO::print("ERROR: Unsupported output file extension: {}!\n"_sv, file_extension);
+		return EXIT_FAILURE;
+	}
+
+	bool multi_gpu = cpu_config.enable_multi_gpu;
+	if (multi_gpu && (stop_on_convergence || stop_on_time)) {
+		IO::print("WARNING: Multi GPU rendering does not support a target error or time budget, using a single Device\n"_sv);
+		multi_gpu = false;
+	}
+	if (multi_gpu && (gpu_config.enable_svgf || gpu_config.enable_adaptive_sampling || gpu_config.enable_variable_rate || gpu_config.enable_restir || cpu_config.enable_scene_update)) {
+		IO::print("WARNING: Multi GPU rendering does not support SVGF, adaptive or variable rate sampling, ReSTIR or Scene updates, using a single Device\n"_sv);
+		multi_gpu = false;
+	}
+
+	int device_count = 1;
+	if (multi_gpu) {
+		device_count = CUDAContext::init_all();
+		device_count = Math::min(device_count, cpu_config.output_sample_index + 1); // Every Device renders at least one sample
+	} else {
+		CUDAContext::init(false, cpu_config.cuda_device);
+	}
+
+	LinearAllocator<MEGABYTES(1)> scene_allocator;
+	Scene scene(&scene_allocator);
+
+	ThreadPool::wait(pmj_group); // The Integrator uploads the PMJ samples
+
+	// Every Device gets its own Integrator, which holds a replica of the Scene in the memory of that Device
+	Array<OwnPtr<Integrator>> integrators(device_count);
+
+	// All Devices upload from the same host copies, so they are only released once the last Device has its replica
+	bool release_host_data = cpu_config.enable_host_data_release;
+	cpu_config.enable_host_data_release = false;
+
+	for (int d = 0; d < device_count; d++) {
+		CUDAContext::make_current(d);
+		init_integrator(integrators[d], 0, cpu_config.initial_width, cpu_config.initial_height, scene);
+
+		denoiser_enable_aovs(*integrators[d].get());
+	}
+
+	cpu_config.enable_host_data_release = release_host_data;
+	if (release_host_data) {
+		integrators[device_count - 1]->release_host_data();
+	}
+
+	size_t initialization_time = timer.stop();
+	Timer::print_named_duration("Initialization"_sv, initialization_time);
+	Profiler::startup_end();
+
+	timer.start();
+
+	bool measure_ray_stats = !cpu_config.ray_stats_filename.is_empty();
+	if (measure_ray_stats && (device_count > 1 || cpu_config.integrator != IntegratorType::PATHTRACER)) {
+		IO::print("WARNING: Ray stats are only measured for single Device renders with the Pathtracer\n"_sv);
+		measure_ray_stats = false;
+	}
+
+	// The Checkpoint only holds the Accumulators, state that is carried over between samples in any other way cannot be restored
+	bool checkpointing = !cpu_config.checkpoint_filename.is_empty();
+	if (checkpointing && (device_count > 1 || gpu_config.enable_svgf || gpu_config.enable_adaptive_sampling || gpu_config.enable_variable_rate || gpu_config.enable_restir)) {
+		IO::print("WARNING: Checkpoints are only supported for single Device renders without SVGF, adaptive or variable rate sampling or ReSTIR\n"_sv);
+		checkpointing = false;
+	}
+
+	int samples_per_launch = cpu_config.samples_per_launch;
+	if (samples_per_launch > 1 && (device_count > 1 || cpu_config.integrator != IntegratorType::PATHTRACER)) {
+		IO::print("WARNING: Multiple samples per launch are only supported for single Device renders with the Pathtracer\n"_sv);
+		samples_per_launch = 1;
+	}
+
+	if (device_count == 1) {
+		LinearAllocator<MEGABYTES(16)> frame_allocator;
+
+		Integrator & integrator = *integrators[0].get();
+
+		RayStats ray_stats = { };
+		int      ray_stats_frame_count = 0;
+
+		Checkpoint checkpoint;
+		if (checkpointing) {
+			checkpoint.init(integrator, cpu_config.checkpoint_filename);
+		}
+		bool resume = checkpointing && cpu_config.enable_checkpoint_resume && IO::file_exists(cpu_config.checkpoint_filename.view());
+
+		while (true) {
+			integrator.update(0.0f, &frame_allocator);
+
+			// The first update restarts accumulation, the Checkpoint is restored on top of that
+			if (resume) {
+				resume = false;
+				Checkpoint::load(cpu_config.checkpoint_filename, integrator);
+			}
+
+			integrator.sample_index_rng   = cpu_config.sample_index_first + integrator.sample_index;
+			integrator.samples_per_launch = Math::min(samples_per_launch, cpu_config.output_sample_index + 1 - integrator.sample_index);
+			integrator.render();
+
+			// From here on sample_index is the last sample that was rendered, the next update continues after it
+			integrator.sample_index += integrator.samples_per_launch - 1;
+
+			integrator.update_stats.record_counters();
+			Profiler::frame_end(integrator.event_pool);
+
+			if (measure_ray_stats) {
+				CUDACALL(cuCtxSynchronize());
+
+				RayStats ray_stats_frame;
+				if (static_cast<const Pathtracer &>(integrator).calc_ray_stats(ray_stats_frame)) {
+					ray_stats.add(ray_stats_frame);
+					ray_stats_frame_count++;
+				}
+			}
+
+			if (checkpointing) {
+				// Save whenever the launch crossed a multiple of the interval
+				int sample_count = integrator.sample_index + 1;
+				if (sample_count / cpu_config.checkpoint_interval != (sample_count - integrator.samples_per_launch) / cpu_config.checkpoint_interval && integrator.sample_index != cpu_config.output_sample_index) {
+					checkpoint.save_async(integrator);
+				}
+				checkpoint.poll(false);
+			}
+
+			frame_allocator.reset();
+
+			if (integrator.sample_index == cpu_config.output_sample_index) break;
+
+			int sample_count = integrator.sample_index + 1;
+
+			// The time of the frames that are still in flight is not counted, so the budget can be exceeded by about a frame
+			if (stop_on_time && timer.stop() >= size_t(double(cpu_config.time_budget) * 1000000.0)) {
+				IO::print("Reached the time budget after {} samples\n"_sv, sample_count);
+				break;
+			}
+
+			if (stop_on_convergence && sample_count / cpu_config.convergence_interval != (sample_count - integrator.samples_per_launch) / cpu_config.convergence_interval) {
+				float error = static_cast<Pathtracer &>(integrator).calc_convergence_error();
+				if (error <= cpu_config.convergence_target_error) {
+					IO::print("Converged to a relative error of {} after {} samples\n"_sv, error, sample_count);
+					break;
+				}
+			}
+		}
+
+		if (stop_on_convergence && integrator.sample_index == cpu_config.output_sample_index) {
+			IO::print("Reached {} samples with a relative error of {}\n"_sv, integrator.sample_index + 1, static_cast<Pathtracer &>(integrator).calc_convergence_error());
+		}
+
+		if (checkpointing) {
+			checkpoint.free();
+		}
+
+		if (measure_ray_stats) {
+			write_ray_stats(cpu_config.ray_stats_filename, integrator, ray_stats, ray_stats_frame_count);
+		}
+	} else {
+		render_headless_multi_gpu(integrators);
+	}
+
+	CUDAContext::make_current(0);
+
+	Array<float4> radiance = integrators[0]->read_accumulator(); // Synchronizes with the GPU
+
+	int sample_count = integrators[0]->sample_index + 1;
+
+	// Combine the results of the other Devices, weighted by the number of samples each of them rendered
+	if (device_count > 1) {
+		float weight_total = float(integrators[0]->sample_index + 1);
+
+		for (int d = 1; d < device_count; d++) {
+			CUDAContext::make_current(d);
+
+			Array<float4> radiance_device = integrators[d]->read_accumulator();
+
+			float weight = float(integrators[d]->sample_index + 1);
+			weight_total += weight;
+			sample_count += integrators[d]->sample_index + 1;
+
+			float t = weight / weight_total;
+
+			ThreadPool::parallel_for(0, int(radiance.size()), 4096, [&radiance, &radiance_device, t](int first, int last) {
+				for (int i = first; i < last; i++) {
+					radiance[i].x += t * (radiance_device[i].x - radiance[i].x);
+					radiance[i].y += t * (radiance_device[i].y - radiance[i].y);
+					radiance[i].z += t * (radiance_device[i].z - radiance[i].z);
+				}
+			});
+		}
+
+		for (int d = 0; d < device_count; d++) {
+			IO::print("Device {} rendered {} samples\n"_sv, d, integrators[d]->sample_index + 1);
+		}
+		CUDAContext::make_current(0);
+	}
+
+	size_t render_time = timer.stop();
+	Timer::print_named_duration("Rendering"_sv, render_time);
+
+	const OwnPtr<Integrator> & integrator = integrators[0]; // AOVs are taken from the first Device
+
+	if (!cpu_config.dump_filename.is_empty()) {
+		dump_accumulators(*integrator.get(), radiance, sample_count); // Dumps stay noisy, they are meant to be merged
+	}
+
+	if (cpu_config.enable_denoiser) {
+		Denoiser::denoise(*integrator.get(), radiance);
+	}
+
+	save_output(cpu_config.output_filename, *integrator.get(), radiance);
+
+	ThreadPool::wait(capture_group);
+
+	// Free Integrators before freeing CUDA Contexts
+	for (int d = 0; d < device_count; d++) {
+		CUDAContext::make_current(d);
+		integrators[d] = nullptr;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// Renders the frames of cpu_config.sequence_filename one after the other in the same process, every frame with -N samples
+// The next frame is prefetched on the ThreadPool while the current one renders
+static int render_sequence(Timer & timer, ThreadPool::TaskGroup & pmj_group) {
+	if (cpu_config.output_sample_index == INVALID) {
+		IO::print("ERROR: Sequence rendering requires a target number of samples per frame (-N)!\n"_sv);
+		return EXIT_FAILURE;
+	}
+
+	bool stream = !cpu_config.stream_command.is_empty();
+
+	StringView file_extension = Util::get_file_extension(cpu_config.output_filename.view());
+	if (!stream && file_extension != "ppm"_sv && file_extension != "exr"_sv) {
+		IO::print("ERROR: Unsupported output file extension: {}!\n"_sv, file_extension);
+		return EXIT_FAILURE;
+	}
+	StringView output_name = { cpu_config.output_filename.data(), file_extension.start - 1 };
+
+	Sequence::Reader reader = { };
+	if (!reader.open(cpu_config.sequence_filename)) {
+		return EXIT_FAILURE;
+	}
+	reader.prefetch(0);
+
+	CUDAContext::init(false, cpu_config.cuda_device);
+
+	LinearAllocator<MEGABYTES(1)> scene_allocator;
+	Scene scene(&scene_allocator);
+
+	ThreadPool::wait(pmj_group); // The Integrator uploads the PMJ samples
+
+	OwnPtr<Integrator> integrator = nullptr;
+	init_integrator(integrator, 0, cpu_config.initial_width, cpu_config.initial_height, scene);
+
+	denoiser_enable_aovs(*integrator.get());
+
+	if (stream && !FrameStream::open(cpu_config.stream_command, integrator->display_width, integrator->display_height)) {
+		integrator = nullptr;
+		return EXIT_FAILURE;
+	}
+
+	size_t initialization_time = timer.stop();
+	Timer::print_named_duration("Initialization"_sv, initialization_time);
+	Profiler::startup_end();
+
+	auto find_mesh = [&scene](const String & name) -> Mesh * {
+		for (size_t i = 0; i < scene.meshes.size(); i++) {
+			if (scene.meshes[i].name == name) return &scene.meshes[i];
+		}
+		IO::print("WARNING: Sequence refers to unknown Mesh '{}'!\n"_sv, name);
+		return nullptr;
+	};
+
+	LinearAllocator<MEGABYTES(16)> frame_allocator;
+
+	for (int f = 0; f < reader.frame_count(); f++) {
+		timer.start();
+
+		const Sequence::Frame & frame = reader.wait();
+
+		// Geometry goes through the BLAS refit, the Mesh transforms through the TLAS refit in Integrator::update
+		for (size_t i = 0; i < frame.geometries.size(); i++) {
+			Mesh * mesh = find_mesh(frame.geometries[i].mesh_name);
+			if (!mesh) continue;
+
+			const MeshData & mesh_data = scene.asset_manager.get_mesh_data(mesh->mesh_data_handle);
+			if (frame.geometries[i].triangles.size() != mesh_data.get_triangle_count()) {
+				IO::print("WARNING: Geometry of Mesh '{}' in frame {} has {} Triangles instead of {}, skipped!\n"_sv, mesh->name, f, frame.geometries[i].triangles.size(), mesh_data.get_triangle_count());
+				continue;
+			}
+			integrator->update_mesh_data(mesh->mesh_data_handle, frame.geometries[i].triangles);
+		}
+
+		for (size_t i = 0; i < frame.transforms.size(); i++) {
+			Mesh * mesh = find_mesh(frame.transforms[i].mesh_name);
+			if (!mesh) continue;
+
+			mesh->position = frame.transforms[i].position;
+			mesh->rotation = frame.transforms[i].rotation;
+			mesh->scale    = frame.transforms[i].scale;
+
+			integrator->invalidated_scene = true;
+		}
+
+		if (frame.has_camera) {
+			scene.camera.position = frame.camera_position;
+			scene.camera.rotation = frame.camera_rotation;
+
+			integrator->invalidated_camera = true;
+		}
+
+		// Everything of this frame has been applied, so the next one can be parsed and loaded while this one renders
+		if (f + 1 < reader.frame_count()) {
+			reader.prefetch(f + 1);
+		}
+
+		integrator->sample_index = 0;
+
+		while (true) {
+			integrator->update(0.0f, &frame_allocator);
+			integrator->sample_index_rng = cpu_config.sample_index_first + integrator->sample_index;
+			integrator->render();
+
+			integrator->update_stats.record_counters();
+			Profiler::frame_end(integrator->event_pool);
+
+			frame_allocator.reset();
+
+			if (integrator->sample_index == cpu_config.output_sample_index) break;
+		}
+
+		Array<float4> radiance = integrator->read_accumulator(); // Synchronizes with the GPU
+
+		if (cpu_config.enable_denoiser) {
+			Denoiser::denoise(*integrator.get(), radiance);
+		}
+
+		StackAllocator<BYTES(512)> allocator;
+		String filename = { };
+
+		if (stream) {
+			stream_output(integrator->display_width, integrator->display_height, radiance);
+
+			filename = Format(&allocator).format("Stream frame {:04}"_sv, f);
+		} else {
+			filename = Format(&allocator).format("{}_{:04}.{}"_sv, output_name, f, file_extension);
+
+			save_output(filename, *integrator.get(), radiance);
+		}
+
+		size_t frame_time = timer.stop();
+		IO::print("Frame {}/{}: "_sv, f + 1, reader.frame_count());
+		Timer::print_named_duration(filename.view(), frame_time);
+	}
+
+	ThreadPool::wait(capture_group);
+
+	FrameStream::close();
+
+	integrator = nullptr; // Free the Integrator before freeing the CUDA Context
+
+	return EXIT_SUCCESS;
+}
+
+static int render_server(Timer & timer, ThreadPool::TaskGroup & pmj_group) {
+	if (!RenderServer::open(cpu_config.server_port)) {
+		return EXIT_FAILURE;
+	}
+
+	CUDAContext::init(false, cpu_config.cuda_device);
+
+	LinearAllocator<MEGABYTES(1)> scene_allocator;
+	Scene scene(&scene_allocator);
+
+	ThreadPool::wait(pmj_group); // The Integrator uploads the PMJ samples
+
+	OwnPtr<Integrator> integrator = nullptr;
+	init_integrator(integrator, 0, cpu_config.initial_width, cpu_config.initial_height, scene);
+
+	denoiser_enable_aovs(*integrator.get());
+
+	size_t initialization_time = timer.stop();
+	Timer::print_named_duration("Initialization"_sv, initialization_time);
+	Profiler::startup_end();
+
+	// The overrides of a Job only last for that Job
+	CPUConfig cpu_config_default = cpu_config;
+	GPUConfig gpu_config_default = gpu_config;
+
+	Vector3    camera_position_default = scene.camera.position;
+	Quaternion camera_rotation_default = scene.camera.rotation;
+
+	LinearAllocator<MEGABYTES(16)> frame_allocator;
+
+	RenderServer::Job job;
+
+	while (RenderServer::wait_for_job(job)) {
+		timer.start();
+
+		cpu_config = cpu_config_default;
+		gpu_config = gpu_config_default;
+
+		if (job.options.size() > 0) {
+			Array<StringView> options(job.options.size());
+			for (size_t i = 0; i < job.options.size(); i++) {
+				options[i] = job.options[i].view();
+			}
+			Args::parse(options);
+		}
+
+		String output_filename = job.output_filename.is_empty() ? cpu_config.output_filename : job.output_filename;
+
+		StringView file_extension = Util::get_file_extension(output_filename.view());
+		if (file_extension != "ppm"_sv && file_extension != "exr"_sv) {
+			RenderServer::reply("error Unsupported output file extension"_sv);
+			continue;
+		}
+
+		int sample_count = job.sample_count != INVALID ? job.sample_count : cpu_config.output_sample_index;
+		if (sample_count <= 0) {
+			RenderServer::reply("error The Job requires a number of samples (samples or -N)"_sv);
+			continue;
+		}
+
+		// Only options that change the Kernels recompile the Module, everything else is uploaded with the next update
+		if (integrator->module_is_outdated()) {
+			init_integrator(integrator, 0, cpu_config.initial_width, cpu_config.initial_height, scene);
+		} else if (integrator->display_width != cpu_config.initial_width || integrator->display_height != cpu_config.initial_height) {
+			if (!integrator->resize_in_place(0, cpu_config.initial_width, cpu_config.initial_height)) {
+				integrator->resize_free();
+				integrator->resize_init(0, cpu_config.initial_width, cpu_config.initial_height);
+			}
+		}
+		denoiser_enable_aovs(*integrator.get());
+
+		integrator->invalidated_gpu_config = true;
+		integrator->invalidated_aovs       = true;
+
+		scene.camera.position = job.has_camera ? job.camera_position : camera_position_default;
+		scene.camera.rotation = job.has_camera ? job.camera_rotation : camera_rotation_default;
+
+		integrator->invalidated_camera = true;
+		integrator->sample_index = 0;
+
+		while (true) {
+			integrator->update(0.0f, &frame_allocator);
+			integrator->sample_index_rng = cpu_config.sample_index_first + integrator->sample_index;
+			integrator->render();
+
+			frame_allocator.reset();
+
+			if (integrator->sample_index == sample_count) break;
+		}
+
+		Array<float4> radiance = integrator->read_accumulator(); // Synchronizes with the GPU
+
+		if (cpu_config.enable_denoiser) {
+			Denoiser::denoise(*integrator.get(), radiance);
+		}
+
+		save_output(output_filename, *integrator.get(), radiance);
+		ThreadPool::wait(capture_group); // The file is complete before the client is told about it
+
+		size_t job_time = timer.stop();
+		Timer::print_named_duration(output_filename.view(), job_time);
+
+		StackAllocator<BYTES(512)> allocator;
+		RenderServer::reply(Format(&allocator).format("ok {} {}"_sv, output_filename, job_time / 1000).view());
+	}
+
+	RenderServer::close();
+
+	cpu_config = cpu_config_default;
+
+	integrator = nullptr; // Free the Integrator before freeing the CUDA Context
+
+	return EXIT_SUCCESS;
+}
+
+static void save_output(const String & filename, const Integrator & integrator, const Array<float4> & radiance) {
+	int width  = integrator.screen_width;
+	int height = integrator.screen_height;
+
+	StringView file_extension = Util::get_file_extension(filename.view());
+
+	if (file_extension == "exr"_sv) {
+		Array<CapturedAOV> aovs;
+		capture_aovs(integrator, cpu_config.exr_multilayer, aovs);
+
+		EXRExporter::Layer layer = { };
+		layer.data   = &radiance.data()->x;
+		layer.stride = 4;
+		layer.pitch  = width;
+
+		save_layers(filename, width, height, layer, aovs, integrator.screen_pitch);
+	} else {
+		Array<CapturedAOV> aovs; // AOVs are only exported as separate EXR files
+		capture_aovs(integrator, false, aovs);
+
+		Array<Vector3> data(width * height);
+		ThreadPool::parallel_for(0, width * height, 4096, [&data, &radiance](int first, int last) {
+			for (int i = first; i < last; i++) {
+				data[i] = tonemap(radiance[i]);
+			}
+		});
+
+		PPMExporter::save(filename, width, width, height, data);
+	}
+
+	// Every view after the first is written next to the output as <name>_view<n>.<extension>, without its AOVs
+	for (int view = 1; view < integrator.view_count; view++) {
+		Array<float4> view_radiance = integrator.read_view(view);
+
+		StringView view_name = { filename.data(), file_extension.start - 1 };
+
+		StackAllocator<BYTES(512)> allocator;
+		String view_filename = Format(&allocator).format("{}_view{}.{}"_sv, view_name, view, file_extension);
+
+		if (file_extension == "exr"_sv) {
+			EXRExporter::Layer layer = { };
+			layer.data   = &view_radiance.data()->x;
+			layer.stride = 4;
+			layer.pitch  = width;
+
+			EXRExporter::save(view_filename, width, height, &layer, 1);
+		} else {
+			Array<Vector3> data(width * height);
+			for (int i = 0; i < width * height; i++) {
+				data[i] = tonemap(view_radiance[i]);
+			}
+			PPMExporter::save(view_filename, width, width, height, data);
+		}
+	}
+}
+
+// Tonemaps straight into the next buffer of the FrameStream, which expects the rows from top to bottom
+// Only waits if the encoder has fallen behind by more than FrameStream::QUEUE_SIZE frames
+static void stream_output(int width, int height, const Array<float4> & radiance) {
+	unsigned char * frame = FrameStream::begin_frame();
+
+	ThreadPool::parallel_for(0, height, 16, [frame, width, height, &radiance](int first, int last) {
+		for (int y = first; y < last; y++) {
+			unsigned char * row = frame + size_t(height - 1 - y) * size_t(width) * 3;
+
+			for (int x = 0; x < width; x++) {
+				Vector3 colour = tonemap(radiance[x + y * width]);
+
+				row[3 * x    ] = (unsigned char)(Math::clamp(colour.x * 255.0f, 0.0f, 255.0f));
+				row[3 * x + 1] = (unsigned char)(Math::clamp(colour.y * 255.0f, 0.0f, 255.0f));
+				row[3 * x + 2] = (unsigned char)(Math::clamp(colour.z * 255.0f, 0.0f, 255.0f));
+			}
+		}
+	});
+
+	FrameStream::end_frame();
+}
+
+// Distributes the samples over all Devices, every Device renders on its own thread and claims the next sample as soon as
+// it has launched the previous one. Launches block once the queue of a Device is full, so faster Devices claim more samples
+static void render_headless_multi_gpu(Array<OwnPtr<Integrator>> & integrators) {
+	int device_count = int(integrators.size());
+	int sample_end = cpu_config.sample_index_first + cpu_config.output_sample_index + 1;
+
+	std::atomic<int> next_sample_index = cpu_config.sample_index_first;
+
+	// Integrator::update reads and updates the Scene that is shared by all Integrators
+	Mutex update_mutex;
+
+	LinearAllocator<MEGABYTES(16)> frame_allocator;
+
+	// The first frame of every Device is rendered serially, since it builds the TLAS and uploads all Scene data
+	for (int d = 0; d < device_count; d++) {
+		CUDAContext::make_current(d);
+
+		integrators[d]->sample_index_rng = next_sample_index++;
+		integrators[d]->update(0.0f, &frame_allocator);
+		integrators[d]->render();
+
+		frame_allocator.reset();
+	}
+
+	ThreadPool::TaskGroup render_group;
+
+	for (int d = 0; d < device_count; d++) {
+		ThreadPool::submit(render_group, [&integrators, &next_sample_index, &update_mutex, sample_end, d]() {
+			CUDAContext::make_current(d);
+
+			Integrator & integrator = *integrators[d].get();
+
+			LinearAllocator<MEGABYTES(16)> frame_allocator;
+
+			while (true) {
+				int sample_index = next_sample_index++;
+				if (sample_index >= sample_end) break;
+
+				integrator.sample_index_rng = sample_index;
+				{
+					MutexLock lock(update_mutex);
+					integrator.update(0.0f, &frame_allocator);
+				}
+				integrator.render();
+
+				Profiler::frame_end(integrator.event_pool);
+
+				frame_allocator.reset();
+			}
+		});
+	}
+
+	ThreadPool::wait(render_group);
+}
+
+// Writes the ray throughput averaged over all measured frames, intended to compare BVH types and GPUs
+static void write_ray_stats(const String & filename, const Integrator & integrator, const RayStats & stats, int frame_count) {
+	if (frame_count == 0) {
+		IO::print("WARNING: No ray stats were measured (Kernel timings are not available with --graph true)\n"_sv);
+		return;
+	}
+
+	FILE * file = nullptr;
+#ifdef _WIN32
+	fopen_s(&file, filename.data(), "wb");
+#else
+	file = fopen(filename.data(), "wb");
+#endif
+
+	if (!file) {
+		IO::print("ERROR: Unable to write ray stats to '{}'!\n"_sv, filename);
+		return;
+	}
+
+	const char * bvh_name = nullptr;
+	switch (cpu_config.bvh_type) {
+		case BVHType::BVH:  bvh_name = "sah";  break;
+		case BVHType::SBVH: bvh_name = "sbvh"; break;
+		case BVHType::BVH4: bvh_name = "bvh4"; break;
+		case BVHType::BVH8: bvh_name = "bvh8"; break;
+		default: ASSERT_UNREACHABLE();
+	}
+
+	StringView device_name = CUDAContext::get_device_name();
+
+	fprintf(file, "{\n");
+	fprintf(file, "\t\"device\": \"%.*s\",\n", int(device_name.size()), device_name.data());
+	fprintf(file, "\t\"bvh\": \"%s\",\n", bvh_name);
+	fprintf(file, "\t\"traversal\": \"%s\",\n", cpu_config.traversal_backend == TraversalBackend::OPTIX ? "optix" : "software");
+	fprintf(file, "\t\"width\": %i,\n",  integrator.screen_width);
+	fprintf(file, "\t\"height\": %i,\n", integrator.screen_height);
+	fprintf(file, "\t\"frames\": %i,\n", frame_count);
+	fprintf(file, "\t\"primary_mrays_per_second\": %.3f,\n",   RayStats::mrays_per_second(stats.get_rays_primary(),   stats.get_time_primary()));
+	fprintf(file, "\t\"secondary_mrays_per_second\": %.3f,\n", RayStats::mrays_per_second(stats.get_rays_secondary(), stats.get_time_secondary()));
+	fprintf(file, "\t\"shadow_mrays_per_second\": %.3f,\n",    RayStats::mrays_per_second(stats.get_rays_shadow(),    stats.get_time_shadow()));
+	fprintf(file, "\t\"bounces\": [\n");
+
+	for (int bounce = 0; bounce < stats.num_bounces; bounce++) {
+		double inv_frame_count = 1.0 / double(frame_count);
+
+		fprintf(file, "\t\t{ \"trace_rays\": %.0f, \"trace_ms\": %.4f, \"trace_mrays_per_second\": %.3f, \"shadow_rays\": %.0f, \"shadow_ms\": %.4f, \"shadow_mrays_per_second\": %.3f }%s\n",
+			stats.rays_trace [bounce] * inv_frame_count, stats.time_trace [bounce] * inv_frame_count, RayStats::mrays_per_second(stats.rays_trace [bounce], stats.time_trace [bounce]),
+			stats.rays_shadow[bounce] * inv_frame_count, stats.time_shadow[bounce] * inv_frame_count, RayStats::mrays_per_second(stats.rays_shadow[bounce], stats.time_shadow[bounce]),
+			bounce + 1 < stats.num_bounces ? "," : ""
+		);
+	}
+
+	fprintf(file, "\t]\n}\n");
+	fclose(file);
+
+	IO::print("Primary: {} Mrays/s, Secondary: {} Mrays/s, Shadow: {} Mrays/s\n"_sv,
+		RayStats::mrays_per_second(stats.get_rays_primary(),   stats.get_time_primary()),
+		RayStats::mrays_per_second(stats.get_rays_secondary(), stats.get_time_secondary()),
+		RayStats::mrays_per_second(stats.get_rays_shadow(),    stats.get_time_shadow())
+	);
+}
+
+// Writes the radiance and all enabled AOVs, so that the samples of this render can later be combined with those of other renders (see merge_accumulators)
+// NOTE: For multi GPU renders the AOVs only contain the samples of the first Device
+// The Denoiser uses the accumulated Albedo and Normal as auxiliary images, they need to be enabled before rendering
+static void denoiser_enable_aovs(Integrator & integrator) {
+	if (!cpu_config.enable_denoiser) return;
+
+	if (!Denoiser::is_available()) {
+		IO::print("WARNING: Built without Open Image Denoise (ENABLE_OIDN), --denoise is ignored!\n"_sv);
+		cpu_config.enable_denoiser = false;
+		return;
+	}
+
+	integrator.aov_enable(AOVType::ALBEDO);
+	integrator.aov_enable(AOVType::NORMAL);
+}
+
+static void dump_accumulators(const Integrator & integrator, const Array<float4> & radiance, int sample_count) {
+	int width  = integrator.screen_width;
+	int height = integrator.screen_height;
+
+	AccumulatorFile::Accumulator accumulator = { };
+	accumulator.width        = width;
+	accumulator.height       = height;
+	accumulator.sample_first = cpu_config.sample_index_first;
+	accumulator.sample_count = sample_count;
+
+	AccumulatorFile::Layer & layer_radiance = accumulator.layers.emplace_back();
+	layer_radiance.data.resize(4 * width * height);
+	memcpy(layer_radiance.data.data(), radiance.data(), width * height * sizeof(float4));
+
+	Array<CapturedAOV> aovs;
+	capture_aovs(integrator, true, aovs);
+
+	for (size_t i = 0; i < aovs.size(); i++) {
+		AccumulatorFile::Layer & layer = accumulator.layers.emplace_back();
+		layer.name = String(aovs[i].layer_name);
+		layer.data.resize(4 * width * height);
+
+		// Remove the padding of every row
+		for (int y = 0; y < height; y++) {
+			memcpy(layer.data.data() + 4 * y * width, aovs[i].data.data() + y * integrator.screen_pitch, width * sizeof(float4));
+		}
+	}
+
+	if (AccumulatorFile::save(cpu_config.dump_filename, accumulator)) {
+		IO::print("Wrote samples [{}, {}) to '{}'\n"_sv, accumulator.sample_first, accumulator.sample_first + sample_count, cpu_config.dump_filename);
+	}
+}
+
+// Combines Accumulator files written by --dump into a single image, every file is weighted by the number of samples it contains
+static int merge_accumulators() {
+	const Array<String> & filenames = cpu_config.merge_filenames;
+
+	StringView file_extension = Util::get_file_extension(cpu_config.output_filename.view());
+	if (file_extension != "ppm"_sv && file_extension != "exr"_sv) {
+		IO::print("ERROR: Unsupported output file extension: {}!\n"_sv, file_extension);
+		return EXIT_FAILURE;
+	}
+
+	Array<AccumulatorFile::Accumulator> accumulators(filenames.size());
+
+	for (size_t i = 0; i < filenames.size(); i++) {
+		if (!AccumulatorFile::load(filenames[i], accumulators[i])) return EXIT_FAILURE;
+
+		const AccumulatorFile::Accumulator & first   = accumulators[0];
+		const AccumulatorFile::Accumulator & current = accumulators[i];
+
+		bool layers_match = current.layers.size() == first.layers.size();
+		for (size_t l = 0; l < current.layers.size() && layers_match; l++) {
+			layers_match = current.layers[l].name == first.layers[l].name;
+		}
+
+		if (current.width != first.width || current.height != first.height || !layers_match) {
+			IO::print("ERROR: Accumulator file '{}' does not match the resolution or AOVs of '{}'!\n"_sv, filenames[i], filenames[0]);
+			return EXIT_FAILURE;
+		}
+
+		// Overlapping sample ranges used the same random numbers, so they do not contribute any new information
+		for (size_t j = 0; j < i; j++) {
+			const AccumulatorFile::Accumulator & other = accumulators[j];
+
+			if (current.sample_first < other.sample_first + other.sample_count && other.sample_first < current.sample_first + current.sample_count) {
+				IO::print("WARNING: Accumulator files '{}' and '{}' contain overlapping sample ranges!\n"_sv, filenames[j], filenames[i]);
+			}
+		}
+	}
+
+	AccumulatorFile::Accumulator & result = accumulators[0];
+
+	int sample_count = result.sample_count;
+
+	for (size_t i = 1; i < accumulators.size(); i++) {
+		const AccumulatorFile::Accumulator & accumulator = accumulators[i];
+		if (accumulator.sample_count == 0) continue;
+
+		sample_count += accumulator.sample_count;
+
+		float t = float(accumulator.sample_count) / float(sample_count);
+
+		for (size_t l = 0; l < result.layers.size(); l++) {
+			float       * dst = result     .layers[l].data.data();
+			const float * src = accumulator.layers[l].data.data();
+
+			ThreadPool::parallel_for(0, int(result.layers[l].data.size()), 16384, [dst, src, t](int first, int last) {
+				for (int j = first; j < last; j++) {
+					dst[j] += t * (src[j] - dst[j]);
+				}
+			});
+		}
+	}
+
+	IO::print("Merged {} samples from {} files\n"_sv, sample_count, accumulators.size());
 
-#include "Util/Util.h"
-#include "Util/PerfTest.h"
+	int width  = result.width;
+	int height = result.height;
 
-#ifdef _WIN32
-extern "C" { _declspec(dllexport) unsigned NvOptimusEnablement = true; } // Forces NVIDIA driver to be used
-#endif
+	if (file_extension == "exr"_sv) {
+		Array<EXRExporter::Layer> layers(result.layers.size());
 
-static constexpr int FRAMETIME_HISTORY_LENGTH = 100;
+		for (size_t l = 0; l < result.layers.size(); l++) {
+			layers[l].name   = result.layers[l].name.view();
+			layers[l].data   = result.layers[l].data.data();
+			layers[l].stride = 4;
+			layers[l].pitch  = width;
+		}
 
-static constexpr float SCREENSHOT_FADE_TIME = 5.0f;
+		EXRExporter::save(cpu_config.output_filename, width, height, layers.data(), int(layers.size()));
+	} else {
+		const AccumulatorFile::Layer * layer_radiance = nullptr;
+		for (size_t l = 0; l < result.layers.size(); l++) {
+			if (result.layers[l].name.is_empty()) {
+				layer_radiance = &result.layers[l];
+				break;
+			}
+		}
 
-struct Timing {
-	Uint64 start;
-	Uint64 now;
-	Uint64 last;
+		if (!layer_radiance) {
+			IO::print("ERROR: Accumulator file '{}' does not contain radiance!\n"_sv, filenames[0]);
+			return EXIT_FAILURE;
+		}
 
-	Uint64 time_of_last_screenshot;
+		const float4 * radiance = reinterpret_cast<const float4 *>(layer_radiance->data.data());
 
-	double inv_perf_freq;
-	double delta_time;
+		Array<Vector3> data(width * height);
+		ThreadPool::parallel_for(0, width * height, 4096, [&data, radiance](int first, int last) {
+			for (int i = first; i < last; i++) {
+				data[i] = tonemap(radiance[i]);
+			}
+		});
 
-	double second;
-	int frames_this_second;
-	int fps;
+		PPMExporter::save(cpu_config.output_filename, width, width, height, data);
+	}
 
-	double avg;
-	double min;
-	double max;
-	double history[FRAMETIME_HISTORY_LENGTH];
+	return EXIT_SUCCESS;
+}
 
-	int frame_index;
-} static timing;
+// Renders frame_count frames and returns their average GPU time in milliseconds
+static float measure_frame_time(Integrator & integrator, LinearAllocator<MEGABYTES(16)> & frame_allocator, int frame_count) {
+	float frame_time_total = 0.0f;
 
-static int last_pixel_query_x;
-static int last_pixel_query_y;
+	for (int i = 0; i < frame_count; i++) {
+		integrator.update(0.0f, &frame_allocator);
+		integrator.render();
 
-static bool integrator_change_requested = false;
+		frame_allocator.reset();
 
-static void capture_screen(const Window & window, const Integrator & integrator, const String & filename);
-static void calc_timing();
-static void draw_gui(Window & window, Integrator & integrator);
+		CUDACALL(cuCtxSynchronize());
 
-static void init_integrator(OwnPtr<Integrator> & integrator, const Window & window, Scene & scene) {
-	if (integrator) {
-		integrator->cuda_free();
-	}
+		// The first and last Event span the entire frame
+		const CUDAEvent & event_first = integrator.event_pool.pool[0];
+		const CUDAEvent & event_last  = integrator.event_pool.pool[integrator.event_pool.num_used - 1];
 
-	switch (cpu_config.integrator) {
-		case IntegratorType::PATHTRACER: integrator = make_owned<Pathtracer>(window.frame_buffer_handle, window.width, window.height, scene); break;
-		case IntegratorType::AO:         integrator = make_owned<AO>        (window.frame_buffer_handle, window.width, window.height, scene); break;
-		default: ASSERT_UNREACHABLE();
+		frame_time_total += CUDAEvent::time_elapsed_between(event_first, event_last);
 	}
-}
 
-int main(int num_args, char ** args) {
-	Args::parse(num_args, args);
-	if (cpu_config.scene_filenames.size() == 0) {
-		cpu_config.scene_filenames.push_back("Data/sponza/scene.xml"_sv);
-	}
-	if (cpu_config.sky_filename.is_empty()) {
-		cpu_config.sky_filename = "Data/Skies/sky_15.hdr"_sv;
-	}
+	return frame_time_total / float(frame_count);
+}
 
-	Timer timer = { };
-	timer.start();
+// Measures the register limit of the Pathtracer Module and then the Block size of every tunable Kernel one at a time,
+// using the GPU frame time of the current Scene. The result is stored per Device and picked up by Pathtracer::init_module
+static int autotune(Timer & timer, ThreadPool::TaskGroup & pmj_group) {
+	static constexpr int AUTOTUNE_FRAME_COUNT = 16;
 
-	ThreadPool::init();
+	static constexpr int candidates_max_registers[] = { 64, 80, 96, 128 };
+	static constexpr int candidates_block_size_1d[] = { 64, 128, 256, 512 };
+	static constexpr int candidates_block_height [] = { 2, 4, 8, 16 }; // 2D Kernels always use a Block width of 32
 
-	for (int i = 1; i < PMJ_NUM_SEQUENCES; i++) {
-		ThreadPool::submit([i]() {
-			PMJ::shuffle(i);
-		});
+	if (cpu_config.integrator != IntegratorType::PATHTRACER) {
+		IO::print("ERROR: Autotuning is only supported for the pathtracer integrator!\n"_sv);
+		return EXIT_FAILURE;
 	}
 
-	Window window("Pathtracer"_sv, cpu_config.initial_width, cpu_config.initial_height);
-
-	CUDAContext::init();
+	CUDAContext::init(false, cpu_config.cuda_device);
 
 	LinearAllocator<MEGABYTES(1)> scene_allocator;
 	Scene scene(&scene_allocator);
 
+	ThreadPool::wait(pmj_group);
+
+	LinearAllocator<MEGABYTES(16)> frame_allocator;
+
 	OwnPtr<Integrator> integrator = nullptr;
 
-	window.resize_handler = [&integrator](unsigned frame_buffer_handle, int width, int height) {
-		if (integrator) {
-			integrator->resize_free();
-			integrator->resize_init(frame_buffer_handle, width, height);
+	CUDAKernelTuning tuning = { };
+	float best_frame_time = INFINITY;
+
+	// Every register limit requires a separate compile of the Module
+	for (int i = 0; i < Util::array_count(candidates_max_registers); i++) {
+		cpu_config.max_registers = candidates_max_registers[i];
+		init_integrator(integrator, 0, cpu_config.initial_width, cpu_config.initial_height, scene);
+
+		measure_frame_time(*integrator.get(), frame_allocator, 1); // Warm up, the first frame builds the TLAS
+
+		float frame_time = measure_frame_time(*integrator.get(), frame_allocator, AUTOTUNE_FRAME_COUNT);
+		IO::print("Autotune: max_registers {}: {} ms\n"_sv, cpu_config.max_registers, frame_time);
+
+		if (frame_time < best_frame_time) {
+			best_frame_time      = frame_time;
+			tuning.max_registers = cpu_config.max_registers;
 		}
-	};
-	window.set_size(cpu_config.initial_width, cpu_config.initial_height);
+	}
 
-	init_integrator(integrator, window, scene);
-	window.show();
+	cpu_config.max_registers = tuning.max_registers;
+	init_integrator(integrator, 0, cpu_config.initial_width, cpu_config.initial_height, scene);
+	measure_frame_time(*integrator.get(), frame_allocator, 1);
 
-	PerfTest perf_test(*integrator.get(), false, cpu_config.scene_filenames[0].view());
+	Pathtracer & pathtracer = *static_cast<Pathtracer *>(integrator.get());
 
-	ThreadPool::free();
+	Array<Pathtracer::TunableKernel> tunable_kernels = pathtracer.get_tunable_kernels();
 
-	size_t initialization_time = timer.stop();
-	Timer::print_named_duration("Initialization"_sv, initialization_time);
+	for (size_t k = 0; k < tunable_kernels.size(); k++) {
+		const Pathtracer::TunableKernel & tunable_kernel = tunable_kernels[k];
+		CUDAKernel & kernel = *tunable_kernel.kernel;
 
-	timing.inv_perf_freq = 1.0 / double(SDL_GetPerformanceFrequency());
-	timing.start = SDL_GetPerformanceCounter();
-	timing.last  = timing.start;
-	timing.time_of_last_screenshot = INVALID;
+		auto set_block_dim = [&pathtracer, &kernel](int block_dim_x, int block_dim_y) {
+			kernel.set_block_dim(block_dim_x, block_dim_y, 1);
+			pathtracer.kernels_set_grid_dim();
+			pathtracer.invalidated_graph = true;
+		};
 
-	LinearAllocator<MEGABYTES(16)> frame_allocator;
+		// Start out with the current Block size. Kernels that are not launched for the current Scene and settings (e.g. SVGF)
+		// take the same time for every candidate, requiring a clear improvement makes sure those keep their default
+		int best_block_dim_x = kernel.block_dim_x;
+		int best_block_dim_y = kernel.block_dim_y;
+		float best_kernel_frame_time = measure_frame_time(pathtracer, frame_allocator, AUTOTUNE_FRAME_COUNT);
 
-	// Render loop
-	while (!window.is_closed) {
-		perf_test.frame_begin();
+		int candidate_count = tunable_kernel.is_2d ? Util::array_count(candidates_block_height) : Util::array_count(candidates_block_size_1d);
 
-		if (integrator_change_requested) {
-			integrator_change_requested = false;
-			init_integrator(integrator, window, scene);
-		}
+		for (int c = 0; c < candidate_count; c++) {
+			int block_dim_x = tunable_kernel.is_2d ? 32 : candidates_block_size_1d[c];
+			int block_dim_y = tunable_kernel.is_2d ? candidates_block_height[c] : 1;
 
-		integrator->update((float)timing.delta_time, &frame_allocator);
-		integrator->render();
+			if (block_dim_x == best_block_dim_x && block_dim_y == best_block_dim_y) continue;
 
-		window.render_framebuffer();
+			set_block_dim(block_dim_x, block_dim_y);
 
-		if (integrator->sample_index == cpu_config.output_sample_index) {
-			capture_screen(window, *integrator.get(), cpu_config.output_filename);
-			break; // Exit render loop and terimate
-		}
-		if (Input::is_key_pressed(SDL_SCANCODE_P)) {
-			StringView ext = { };
-			switch (cpu_config.screenshot_format) {
-				case OutputFormat::EXR: ext = "exr"_sv; break;
-				case OutputFormat::PPM: ext = "ppm"_sv; break;
-				default: ASSERT_UNREACHABLE();
+			float frame_time = measure_frame_time(pathtracer, frame_allocator, AUTOTUNE_FRAME_COUNT);
+			if (frame_time < 0.99f * best_kernel_frame_time) {
+				best_kernel_frame_time = frame_time;
+				best_block_dim_x = block_dim_x;
+				best_block_dim_y = block_dim_y;
 			}
+		}
 
-			StackAllocator<BYTES(128)> allocator;
-			String screenshot_name = Format(&allocator).format("screenshot_{}.{}"_sv, integrator->sample_index, ext);
-			capture_screen(window, *integrator.get(), screenshot_name);
+		set_block_dim(best_block_dim_x, best_block_dim_y);
+		tuning.set(tunable_kernel.name, best_block_dim_x, best_block_dim_y);
 
-			timing.time_of_last_screenshot = timing.now;
+		IO::print("Autotune: {}: {}x{} ({} ms)\n"_sv, tunable_kernel.name, best_block_dim_x, best_block_dim_y, best_kernel_frame_time);
+	}
+
+	String tuning_filename = CUDAKernelTuning::get_filename(StringView::from_c_str(Pathtracer::MODULE_FILENAME));
+	if (tuning.save(tuning_filename)) {
+		IO::print("Autotune: Wrote '{}'\n"_sv, tuning_filename);
+	}
+
+	size_t tuning_time = timer.stop();
+	Timer::print_named_duration("Autotuning"_sv, tuning_time);
+
+	integrator = nullptr; // Free the Integrator before the CUDA Context
+
+	return EXIT_SUCCESS;
+}
+
+// Measures GPU frame time, time per stage, ray throughput and peak memory of every benchmark defined in cpu_config.benchmark_filename.
+// Every benchmark starts out from the configuration the program was launched with, its own options are applied on top
+static int run_benchmarks(Timer & timer, ThreadPool::TaskGroup & pmj_group) {
+	Array<Benchmark::Definition> definitions;
+	if (!Benchmark::load_definitions(cpu_config.benchmark_filename, definitions)) {
+		return EXIT_FAILURE;
+	}
+
+	Array<Benchmark::Result> baseline;
+	if (!cpu_config.benchmark_baseline_filename.is_empty() && !Benchmark::load_results(cpu_config.benchmark_baseline_filename, baseline)) {
+		return EXIT_FAILURE;
+	}
+
+	const CPUConfig cpu_config_base = cpu_config;
+	const GPUConfig gpu_config_base = gpu_config;
+
+	CUDAContext::init(false, cpu_config.cuda_device);
+
+	ThreadPool::wait(pmj_group);
+
+	LinearAllocator<MEGABYTES(16)> frame_allocator;
+
+	Array<Benchmark::Result> results;
+
+	for (size_t d = 0; d < definitions.size(); d++) {
+		const Benchmark::Definition & definition = definitions[d];
+
+		IO::print("Benchmark {} ({}/{})\n"_sv, definition.name, d + 1, definitions.size());
+
+		cpu_config = cpu_config_base;
+		gpu_config = gpu_config_base;
+
+		if (!definition.scene_filename.is_empty()) {
+			cpu_config.scene_filenames.clear();
+			cpu_config.scene_filenames.push_back(definition.scene_filename);
 		}
 
-		if (ImGui::IsMouseClicked(1)) {
-			// Deselect current object
-			integrator->pixel_query.pixel_index = INVALID;
-			integrator->pixel_query.mesh_id     = INVALID;
-			integrator->pixel_query.triangle_id = INVALID;
+		Array<StringView> args;
+		for (size_t i = 0; i < definition.args.size(); i++) {
+			args.push_back(definition.args[i].view());
 		}
+		Args::parse(args);
 
-		if (ImGui::IsMouseClicked(0) && !ImGui::GetIO().WantCaptureMouse) {
-			Input::mouse_position(&last_pixel_query_x, &last_pixel_query_y);
+		bool measure_ray_stats = cpu_config.integrator == IntegratorType::PATHTRACER;
 
-			integrator->set_pixel_query(last_pixel_query_x, last_pixel_query_y);
-		}
+		LinearAllocator<MEGABYTES(1)> scene_allocator;
+		Scene scene(&scene_allocator);
 
-		calc_timing();
-		draw_gui(window, *integrator.get());
+		// Peak memory includes the upload of the Scene
+		CUDAMemory::pool_reset_peak();
 
-		if (Input::is_key_released(SDL_SCANCODE_F5)) {
-			ScopeTimer timer("Hot Reload"_sv);
+		OwnPtr<Integrator> integrator = nullptr;
+		init_integrator(integrator, 0, cpu_config.initial_width, cpu_config.initial_height, scene);
 
-			integrator->cuda_free();
-			integrator->cuda_init(window.frame_buffer_handle, window.width, window.height);
-		}
+		Benchmark::Result & result = results.emplace_back();
+		result.name = definition.name;
 
-		if (perf_test.frame_end((float)timing.delta_time)) break;
+		RayStats ray_stats = { };
 
-		Input::update(); // Save Keyboard State of this frame before SDL_PumpEvents
+		int pov_count = Math::max(int(definition.povs.size()), 1);
 
-		window.swap();
+		for (int p = 0; p < pov_count; p++) {
+			if (p < definition.povs.size()) {
+				scene.camera.position = definition.povs[p].position;
+				scene.camera.rotation = definition.povs[p].rotation;
+			}
+			integrator->invalidated_camera = true;
+			integrator->sample_index = 0;
 
-		frame_allocator.reset();
+			for (int i = 0; i < definition.warmup_frame_count; i++) {
+				integrator->update(0.0f, &frame_allocator);
+				integrator->render();
+
+				frame_allocator.reset();
+			}
+			CUDACALL(cuCtxSynchronize());
+
+			Benchmark::POVResult & pov_result = result.povs.emplace_back();
+
+			double frame_time_sum            = 0.0;
+			double frame_time_sum_of_squares = 0.0;
+
+			for (int i = 0; i < definition.frame_count; i++) {
+				uint64_t time_start = Profiler::get_time();
+
+				integrator->update(0.0f, &frame_allocator);
+				integrator->render();
+
+				frame_allocator.reset();
+
+				CUDACALL(cuCtxSynchronize());
+
+				const CUDAEventPool & event_pool = integrator->event_pool;
+
+				// Event timings are not available when the frame is submitted as a CUDA Graph, fall back to the CPU time of the frame
+				double frame_time;
+				if (event_pool.num_used >= 2) {
+					frame_time = CUDAEvent::time_elapsed_between(event_pool.pool[0], event_pool.pool[event_pool.num_used - 1]);
+				} else {
+					frame_time = double(Profiler::get_time() - time_start) / 1000.0;
+				}
+
+				frame_time_sum            += frame_time;
+				frame_time_sum_of_squares += frame_time * frame_time;
+
+				for (size_t e = 0; e + 1 < event_pool.num_used; e++) {
+					const CUDAEvent::Desc * desc = event_pool.pool[e].desc;
+
+					StackAllocator<BYTES(256)> allocator;
+					String stage_name = Format(&allocator).format("{}/{}"_sv, desc->category, desc->name);
+
+					double stage_time = CUDAEvent::time_elapsed_between(event_pool.pool[e], event_pool.pool[e + 1]);
+
+					Benchmark::Stage * stage = nullptr;
+					for (size_t s = 0; s < pov_result.stages.size(); s++) {
+						if (pov_result.stages[s].name == stage_name) {
+							stage = &pov_result.stages[s];
+							break;
+						}
+					}
+					if (!stage) {
+						stage = &pov_result.stages.emplace_back();
+						stage->name = stage_name.view();
+						stage->time = 0.0;
+					}
+					stage->time += stage_time;
+				}
+
+				RayStats ray_stats_frame;
+				if (measure_ray_stats && static_cast<const Pathtracer &>(*integrator.get()).calc_ray_stats(ray_stats_frame)) {
+					ray_stats.add(ray_stats_frame);
+				}
+			}
+
+			double inv_frame_count = 1.0 / double(definition.frame_count);
+
+			pov_result.frame_time        = frame_time_sum * inv_frame_count;
+			pov_result.frame_time_stddev = sqrt(Math::max(frame_time_sum_of_squares * inv_frame_count - pov_result.frame_time * pov_result.frame_time, 0.0));
+
+			for (size_t s = 0; s < pov_result.stages.size(); s++) {
+				pov_result.stages[s].time *= inv_frame_count;
+			}
+
+			result.frame_time += pov_result.frame_time / double(pov_count);
+
+			IO::print("Benchmark {}: POV {}: {} ms (stddev {} ms)\n"_sv, definition.name, p, pov_result.frame_time, pov_result.frame_time_stddev);
+		}
+
+		result.mrays_primary   = RayStats::mrays_per_second(ray_stats.get_rays_primary(),   ray_stats.get_time_primary());
+		result.mrays_secondary = RayStats::mrays_per_second(ray_stats.get_rays_secondary(), ray_stats.get_time_secondary());
+		result.mrays_shadow    = RayStats::mrays_per_second(ray_stats.get_rays_shadow(),    ray_stats.get_time_shadow());
+
+		result.peak_memory = double(CUDAMemory::pool_get_stats().bytes_in_use_peak) / double(MEGABYTES(1));
+
+		integrator = nullptr; // Free the Integrator before its Scene
 	}
 
-	// Free Integrator before freeing CUDA Context
-	integrator = nullptr;
+	cpu_config = cpu_config_base;
+	gpu_config = gpu_config_base;
 
-	CUDAContext::free();
+	size_t benchmark_time = timer.stop();
+	Timer::print_named_duration("Benchmarks"_sv, benchmark_time);
+
+	if (!Benchmark::save_results(cpu_config.benchmark_output_filename, CUDAContext::get_device_name(), results)) {
+		return EXIT_FAILURE;
+	}
+
+	if (!cpu_config.benchmark_baseline_filename.is_empty() && !Benchmark::compare(results, baseline, cpu_config.benchmark_threshold)) {
+		IO::print("ERROR: Benchmarks regressed by more than {}% compared to '{}'!\n"_sv, cpu_config.benchmark_threshold, cpu_config.benchmark_baseline_filename);
+		return EXIT_FAILURE;
+	}
 
 	return EXIT_SUCCESS;
 }
 
-static void capture_screen(const Window & window, const Integrator & integrator, const String & filename) {
-	ScopeTimer timer("Screenshot"_sv);
+// Times only the BVH traversal Kernels of the configured BVH type on fixed Ray sets generated from the Camera of the Scene.
+// Run with different --bvh and --shared-stack-size options to compare traversal changes
+static int run_traversal_benchmark(Timer & timer, ThreadPool::TaskGroup & pmj_group) {
+	CUDAContext::init(false, cpu_config.cuda_device);
 
-	using Exporter = void (*)(const String & filename, int pitch, int width, int height, const Array<Vector3> & data);
-	Exporter exporter = nullptr;
+	LinearAllocator<MEGABYTES(1)> scene_allocator;
+	Scene scene(&scene_allocator);
 
-	bool hdr = false;
+	ThreadPool::wait(pmj_group);
 
-	StringView file_extension = Util::get_file_extension(filename.view());
-	if (file_extension == "ppm"_sv) {
-		exporter = PPMExporter::save;
-		hdr      = false;
-	} else if (file_extension == "exr"_sv) {
-		exporter = EXRExporter::save;
-		hdr      = true;
-	} else {
-		IO::print("WARNING: Unsupported output file extension: {}!\n"_sv, file_extension);
-		return;
+	LinearAllocator<MEGABYTES(16)> frame_allocator;
+
+	Array<TraversalBenchmark::Result> results;
+	{
+		TraversalBenchmark benchmark(cpu_config.initial_width, cpu_config.initial_height, scene, cpu_config.traversal_benchmark_shared_stack_size);
+
+		size_t init_time = timer.stop();
+		Timer::print_named_duration("Initialization"_sv, init_time);
+		Profiler::startup_end();
+
+		// Builds the TLAS and uploads the Camera, after which render() generates the Ray sets
+		benchmark.update(0.0f, &frame_allocator);
+		benchmark.render();
+		CUDACALL(cuCtxSynchronize());
+
+		results = benchmark.run(cpu_config.traversal_benchmark_iteration_count);
+	}
+
+	IO::print("{:<10} {:>9} {:>9} {:>9} {:>13} {:>13} {:>13} {:>10}\n"_sv, "Rays", "Count", "ms", "Mrays/s", "Nodes/ray", "Triangles/ray", "Spills/ray", "Overflows");
+	for (size_t i = 0; i < results.size(); i++) {
+		const TraversalBenchmark::Result & result = results[i];
+		IO::print("{:<10} {:>9} {:>9} {:>9} {:>13} {:>13} {:>13} {:>10}\n"_sv,
+			TraversalBenchmark::ray_set_names[int(result.ray_set)],
+			result.ray_count,
+			result.time,
+			result.mrays_per_second,
+			result.node_tests_per_ray,
+			result.triangle_tests_per_ray,
+			result.stack_spills_per_ray,
+			result.stack_overflows
+		);
 	}
 
-	int pitch = 0;
-	Array<Vector3> data = window.read_frame_buffer(hdr, pitch);
+	TraversalBenchmark::CostModel cost_model = TraversalBenchmark::fit_cost_model(results);
 
-	exporter(filename, pitch, window.width, window.height, data);
+	IO::print("\n{:<10} {:>13} {:>13} {:>13}\n"_sv, "Rays", "Measured ns", "Fitted ns", "SAH ns");
+	for (size_t i = 0; i < results.size(); i++) {
+		const TraversalBenchmark::Result & result = results[i];
+		if (result.ray_count == 0) continue;
 
-	auto export_aov = [&integrator](AOVType aov_type, const String & filename) {
-		if (!integrator.aov_is_enabled(aov_type)) return;
+		IO::print("{:<10} {:>13} {:>13} {:>13}\n"_sv,
+			TraversalBenchmark::ray_set_names[int(result.ray_set)],
+			cost_model.measured_time(result),
+			cost_model.fitted_time(result),
+			cost_model.sah_time(result)
+		);
+	}
 
-		const AOV & aov = integrator.get_aov(aov_type);
+	if (cost_model.valid) {
+		IO::print("Fitted cost: {} ns per Node, {} ns per Triangle\n"_sv, cost_model.node_cost, cost_model.triangle_cost);
+		IO::print("Suggested SAH costs: --sah-node {} --sah-leaf {} (currently {} and {})\n"_sv, cost_model.suggested_sah_cost_node, cost_model.suggested_sah_cost_leaf, cpu_config.sah_cost_node, cpu_config.sah_cost_leaf);
+	} else {
+		IO::print("WARNING: Unable to fit the traversal cost, the Ray sets do not constrain the Node and Triangle cost independently\n"_sv);
+	}
 
-		Array<float4> aov_raw(integrator.screen_pitch * integrator.screen_height);
-		CUDAMemory::memcpy(aov_raw.data(), aov.accumulator, integrator.screen_pitch * integrator.screen_height);
+	const String & filename = cpu_config.traversal_benchmark_filename;
 
-		Array<Vector3> aov_data(integrator.screen_width * integrator.screen_height);
-		for (int y = 0; y < integrator.screen_height; y++) {
-			for (int x = 0; x < integrator.screen_width; x++) {
-				aov_data[x + y * integrator.screen_width] = Vector3(
-					aov_raw[x + y * integrator.screen_pitch].x,
-					aov_raw[x + y * integrator.screen_pitch].y,
-					aov_raw[x + y * integrator.screen_pitch].z
-				);
-			}
-		}
-		EXRExporter::save(filename, integrator.screen_width, integrator.screen_width, integrator.screen_height, aov_data);
-	};
+	FILE * file = nullptr;
+#ifdef _WIN32
+	fopen_s(&file, filename.data(), "wb");
+#else
+	file = fopen(filename.data(), "wb");
+#endif
+
+	if (!file) {
+		IO::print("ERROR: Unable to write traversal benchmark results to '{}'!\n"_sv, filename);
+		return EXIT_FAILURE;
+	}
+
+	const char * bvh_names[] = { "bvh", "sbvh", "bvh4", "bvh8" };
+
+	fprintf(file, "{\n");
+	fprintf(file, "\t\"device\": \"%.*s\",\n", int(CUDAContext::get_device_name().size()), CUDAContext::get_device_name().data());
+	fprintf(file, "\t\"bvh\": \"%s\",\n", bvh_names[int(cpu_config.bvh_type)]);
+	fprintf(file, "\t\"shared_stack_size\": %i,\n", cpu_config.traversal_benchmark_shared_stack_size);
+	fprintf(file, "\t\"bvh8_short_stack\": %s,\n", cpu_config.enable_bvh8_short_stack ? "true" : "false");
+	fprintf(file, "\t\"width\": %i,\n",  cpu_config.initial_width);
+	fprintf(file, "\t\"height\": %i,\n", cpu_config.initial_height);
+	fprintf(file, "\t\"iterations\": %i,\n", cpu_config.traversal_benchmark_iteration_count);
+	fprintf(file, "\t\"ray_sets\": [\n");
+
+	for (size_t i = 0; i < results.size(); i++) {
+		const TraversalBenchmark::Result & result = results[i];
+
+		fprintf(file, "\t\t{ \"name\": \"%s\", \"ray_count\": %i, \"time_ms\": %.4f, \"mrays_per_second\": %.3f, \"node_tests_per_ray\": %.3f, \"triangle_tests_per_ray\": %.3f, \"stack_spills_per_ray\": %.3f, \"stack_overflows\": %u, \"fitted_ns_per_ray\": %.4f, \"sah_ns_per_ray\": %.4f }%s\n",
+			TraversalBenchmark::ray_set_names[int(result.ray_set)],
+			result.ray_count,
+			result.time,
+			result.mrays_per_second,
+			result.node_tests_per_ray,
+			result.triangle_tests_per_ray,
+			result.stack_spills_per_ray,
+			result.stack_overflows,
+			result.ray_count > 0 ? cost_model.fitted_time(result) : 0.0,
+			result.ray_count > 0 ? cost_model.sah_time(result)    : 0.0,
+			i + 1 < results.size() ? "," : ""
+		);
+	}
+
+	fprintf(file, "\t],\n");
+	fprintf(file, "\t\"cost_model\": { \"valid\": %s, \"node_ns\": %.6f, \"triangle_ns\": %.6f, \"sah_cost_node\": %g, \"sah_cost_leaf\": %g, \"suggested_sah_cost_node\": %g, \"suggested_sah_cost_leaf\": %g }\n",
+		cost_model.valid ? "true" : "false",
+		cost_model.node_cost,
+		cost_model.triangle_cost,
+		cpu_config.sah_cost_node,
+		cpu_config.sah_cost_leaf,
+		cost_model.suggested_sah_cost_node,
+		cost_model.suggested_sah_cost_leaf
+	);
+	fprintf(file, "}\n");
+	fclose(file);
+
+	IO::print("Written traversal benchmark results to '{}'\n"_sv, filename);
+
+	// The short Stack traversal restarts after dropping entries, so no hits are missed
+	bool short_stack = cpu_config.bvh_type == BVHType::BVH8 && cpu_config.enable_bvh8_short_stack;
+
+	bool overflowed = false;
+	for (size_t i = 0; i < results.size(); i++) {
+		if (results[i].stack_overflows > 0 && !short_stack) overflowed = true;
+	}
+	if (overflowed) {
+		IO::print("WARNING: The traversal Stack overflowed, some hits may have been missed!\n"_sv);
+	}
 
-	export_aov(AOVType::ALBEDO,   "albedo.exr"_sv);
-	export_aov(AOVType::NORMAL,   "normal.exr"_sv);
-	export_aov(AOVType::POSITION, "position.exr"_sv);
+	return EXIT_SUCCESS;
 }
 
 static void calc_timing() {
@@ -365,22 +1929,59 @@ static void draw_gui(Window & window, Integrator & integrator) {
 				case BVHType::BVH4: ImGui::TextUnformatted("BVH:   BVH4"); break;
 				case BVHType::BVH8: ImGui::TextUnformatted("BVH:   BVH8"); break;
 			}
+
+			CUDAMemory::PoolStats pool_stats = CUDAMemory::pool_get_stats();
+			ImGui::Text("VRAM:  %zu / %zu MB (%i cached)", pool_stats.bytes_in_use >> 20, pool_stats.bytes_reserved >> 20, pool_stats.block_count_cached);
+
+			// CPU side cost of the last update, in milliseconds
+			const Integrator::UpdateStats & update_stats = integrator.update_stats;
+			size_t bytes_uploaded = update_stats.bytes_uploaded_tlas + update_stats.bytes_uploaded_materials + update_stats.bytes_uploaded_lights;
+
+			ImGui::Separator();
+			ImGui::Text("Scene: %.3f ms (%i Meshes)", 1e-3 * double(update_stats.time_scene_update), update_stats.meshes_updated);
+			if (update_stats.tlas_built) {
+				ImGui::Text("TLAS:  %.3f ms (%s, %i Meshes uploaded)", 1e-3 * double(update_stats.time_tlas_build), update_stats.tlas_refit ? "Refit" : "Build", update_stats.tlas_meshes_uploaded);
+			} else {
+				ImGui::TextUnformatted("TLAS:  -");
+			}
+			ImGui::Text("Light: %.3f ms", 1e-3 * double(update_stats.time_light_weights));
+			ImGui::Text("Mat:   %.3f ms (%i Materials)", 1e-3 * double(update_stats.time_material_upload), update_stats.materials_uploaded);
+			ImGui::Text("Up:    %.1f KB", double(bytes_uploaded) / double(KILOBYTES(1)));
+		}
+
+		if (ImGui::CollapsingHeader("Memory")) {
+			CUDAMemory::PoolStats pool_stats = CUDAMemory::pool_get_stats();
+
+			for (size_t i = 0; i < size_t(CUDAMemory::Category::COUNT); i++) {
+				StringView name = CUDAMemory::category_name(CUDAMemory::Category(i));
+				ImGui::Text("%-13.*s%8.1f MB", int(name.size()), name.data(), double(pool_stats.bytes_per_category[i]) / double(MEGABYTES(1)));
+			}
+
+			size_t bytes_available = CUDAContext::get_available_memory();
+			ImGui::Text("Available:   %8.1f MB", double(bytes_available) / double(MEGABYTES(1)));
+
+			if (ImGui::Button("Print Summary")) {
+				CUDAMemory::print_memory_summary();
+			}
 		}
 
-		if (ImGui::CollapsingHeader("Kernel Timings") && integrator.event_pool.num_used > 0) {
+		// Every frame is timed while the timings are shown, see cpu_config.event_interval
+		bool show_timings = ImGui::CollapsingHeader("Kernel Timings");
+		integrator.timings_requested = show_timings;
+
+		integrator.event_pool.resolve();
+
+		if (show_timings && integrator.event_pool.timings.size() > 0) {
 			struct EventTiming {
 				const CUDAEvent::Desc * desc;
 				float                   timing;
 			};
 
-			Array<EventTiming> event_timings(integrator.event_pool.num_used - 1);
+			Array<EventTiming> event_timings(integrator.event_pool.timings.size());
 
 			for (size_t i = 0; i < event_timings.size(); i++) {
-				event_timings[i].desc = integrator.event_pool.pool[i].desc;
-				event_timings[i].timing = CUDAEvent::time_elapsed_between(
-					integrator.event_pool.pool[i],
-					integrator.event_pool.pool[i + 1]
-				);
+				event_timings[i].desc   = integrator.event_pool.timings[i].desc;
+				event_timings[i].timing = integrator.event_pool.timings[i].time;
 			}
 
 			Sort::stable_sort(event_timings.begin(), event_timings.end(), [](const EventTiming & a, const EventTiming & b) {
@@ -446,7 +2047,7 @@ static void draw_gui(Window & window, Integrator & integrator) {
 
 		if (ImGui::CollapsingHeader("Renderer", ImGuiTreeNodeFlags_DefaultOpen)) {
 			IntegratorType previous_integrator = cpu_config.integrator;
-			if (ImGui_Combo("Integrator", &cpu_config.integrator, "Pathtracer\0AO\0")) {
+			if (ImGui_Combo("Integrator", &cpu_config.integrator, "Pathtracer\0AO\0Megakernel\0")) {
 				if (cpu_config.integrator != previous_integrator) {
 					integrator_change_requested = true;
 					ImGui::TextUnformatted("Loading Integrator...");
@@ -471,6 +2072,7 @@ static void draw_gui(Window & window, Integrator & integrator) {
 			ImGui::Text("Has Lights:      %s", integrator.scene.has_lights     ? "True" : "False");
 
 			size_t triangle_count       = 0;
+			size_t curve_count          = 0;
 			size_t light_mesh_count     = 0;
 			size_t light_triangle_count = 0;
 
@@ -478,16 +2080,18 @@ static void draw_gui(Window & window, Integrator & integrator) {
 				const Mesh     & mesh      = integrator.scene.meshes[i];
 				const MeshData & mesh_data = integrator.scene.asset_manager.get_mesh_data(mesh.mesh_data_handle);
 
-				triangle_count += mesh_data.triangles.size();
+				triangle_count += mesh_data.get_triangle_count();
+				curve_count    += mesh_data.curves.size();
 
 				if (mesh.light.weight > 0.0f) {
 					light_mesh_count++;
-					light_triangle_count += mesh_data.triangles.size();
+					light_triangle_count += mesh_data.get_triangle_count();
 				}
 			}
 
 			ImGui::Text("Meshes:          %zu", integrator.scene.meshes.size());
 			ImGui::Text("Triangles:       %zu", triangle_count);
+			ImGui::Text("Curves:          %zu", curve_count);
 			ImGui::Text("Light Meshes:    %zu", light_mesh_count);
 			ImGui::Text("Light Triangles: %zu", light_triangle_count);
 			ImGui::Separator();
@@ -551,6 +2155,9 @@ static void draw_gui(Window & window, Integrator & integrator) {
 
 				mesh_changed |= ImGui::DragFloat("Scale", &mesh.scale, 0.1f, 0.0f, INFINITY);
 
+				mesh_changed |= ImGui::CheckboxFlags("Visible",      &mesh.visibility_mask, 1u << int(MeshVisibility::TRACE));
+				mesh_changed |= ImGui::CheckboxFlags("Cast Shadows", &mesh.visibility_mask, 1u << int(MeshVisibility::SHADOW));
+
 				if (mesh_changed) integrator.invalidated_scene = true;
 
 				ImGui::Separator();
@@ -579,6 +2186,10 @@ static void draw_gui(Window & window, Integrator & integrator) {
 				if (ImGui::CollapsingHeader("Material##MaterialHeader", ImGuiTreeNodeFlags_DefaultOpen)) {
 					ImGui::Text("Name: %s", material.name.data());
 
+					// Parameter changes only upload this Material, see Integrator::invalidate_material
+					bool material_changed = false;
+
+					// Changing the type affects which Kernels are launched, that requires a full upload
 					integrator.invalidated_materials |= ImGui_Combo("Type", &material.type, "Light\0Diffuse\0Plastic\0Dielectric\0Conductor\0");
 
 					const char * texture_name = "None";
@@ -586,6 +2197,11 @@ static void draw_gui(Window & window, Integrator & integrator) {
 						texture_name = integrator.scene.asset_manager.get_texture(material.texture_handle).name.c_str();
 					}
 
+					const char * roughness_texture_name = "None";
+					if (material.roughness_texture_handle.handle != INVALID) {
+						roughness_texture_name = integrator.scene.asset_manager.get_texture(material.roughness_texture_handle).name.c_str();
+					}
+
 					const char * medium_name = "None";
 					if (material.medium_handle.handle != INVALID) {
 						medium_name = integrator.scene.asset_manager.get_medium(material.medium_handle).name.c_str();
@@ -593,22 +2209,33 @@ static void draw_gui(Window & window, Integrator & integrator) {
 
 					switch (material.type) {
 						case Material::Type::LIGHT: {
-							integrator.invalidated_materials |= ImGui::DragFloat3("Emission", &material.emission.x, 0.1f, 0.0f, INFINITY);
+							material_changed |= ImGui::DragFloat3("Emission", &material.emission.x, 0.1f, 0.0f, INFINITY);
+
+							const char * emission_texture_name = "None";
+							if (material.emission_texture_handle.handle != INVALID) {
+								emission_texture_name = integrator.scene.asset_manager.get_texture(material.emission_texture_handle).name.c_str();
+							}
+							material.emission_texture_handle.handle = ImGui_Combo("Emission Texture", emission_texture_name, integrator.scene.asset_manager.textures, true, material.emission_texture_handle.handle, [&material_changed](int index) {
+								material_changed = true;
+							});
 							break;
 						}
 						case Material::Type::DIFFUSE: {
-							integrator.invalidated_materials |= ImGui::ColorEdit3("Diffuse", &material.diffuse.x);
-							material.texture_handle.handle = ImGui_Combo("Texture", texture_name, integrator.scene.asset_manager.textures, true, material.texture_handle.handle, [&integrator](int index) {
-								integrator.invalidated_materials = true;
+							material_changed |= ImGui::ColorEdit3("Diffuse", &material.diffuse.x);
+							material.texture_handle.handle = ImGui_Combo("Texture", texture_name, integrator.scene.asset_manager.textures, true, material.texture_handle.handle, [&material_changed](int index) {
+								material_changed = true;
 							});
 							break;
 						}
 						case Material::Type::PLASTIC: {
-							integrator.invalidated_materials |= ImGui::ColorEdit3 ("Diffuse", &material.diffuse.x);
-							material.texture_handle.handle = ImGui_Combo("Texture", texture_name, integrator.scene.asset_manager.textures, true, material.texture_handle.handle, [&integrator](int index) {
-								integrator.invalidated_materials = true;
+							material_changed |= ImGui::ColorEdit3 ("Diffuse", &material.diffuse.x);
+							material.texture_handle.handle = ImGui_Combo("Texture", texture_name, integrator.scene.asset_manager.textures, true, material.texture_handle.handle, [&material_changed](int index) {
+								material_changed = true;
+							});
+							material_changed |= ImGui::SliderFloat("Roughness", &material.linear_roughness, 0.0f, 1.0f);
+							material.roughness_texture_handle.handle = ImGui_Combo("Roughness Texture", roughness_texture_name, integrator.scene.asset_manager.textures, true, material.roughness_texture_handle.handle, [&material_changed](int index) {
+								material_changed = true;
 							});
-							integrator.invalidated_materials |= ImGui::SliderFloat("Roughness", &material.linear_roughness, 0.0f, 1.0f);
 							break;
 						}
 						case Material::Type::DIELECTRIC: {
@@ -626,17 +2253,23 @@ static void draw_gui(Window & window, Integrator & integrator) {
 							}
 							ImGui::SameLine();
 
-							material.medium_handle.handle = ImGui_Combo("Medium", medium_name, integrator.scene.asset_manager.media, true, material.medium_handle.handle, [&integrator](int index) {
-								integrator.invalidated_materials = true;
+							material.medium_handle.handle = ImGui_Combo("Medium", medium_name, integrator.scene.asset_manager.media, true, material.medium_handle.handle, [&material_changed](int index) {
+								material_changed = true;
+							});
+							material_changed |= ImGui::SliderFloat("IOR",       &material.index_of_refraction, 1.0f, 2.5f);
+							material_changed |= ImGui::SliderFloat("Roughness", &material.linear_roughness,    0.0f, 1.0f);
+							material.roughness_texture_handle.handle = ImGui_Combo("Roughness Texture", roughness_texture_name, integrator.scene.asset_manager.textures, true, material.roughness_texture_handle.handle, [&material_changed](int index) {
+								material_changed = true;
 							});
-							integrator.invalidated_materials |= ImGui::SliderFloat("IOR",       &material.index_of_refraction, 1.0f, 2.5f);
-							integrator.invalidated_materials |= ImGui::SliderFloat("Roughness", &material.linear_roughness,    0.0f, 1.0f);
 							break;
 						}
 						case Material::Type::CONDUCTOR: {
-							integrator.invalidated_materials |= ImGui::SliderFloat3("Eta",       &material.eta.x, 0.0f, 4.0f);
-							integrator.invalidated_materials |= ImGui::SliderFloat3("K",         &material.k.x,   0.0f, 8.0f);
-							integrator.invalidated_materials |= ImGui::SliderFloat ("Roughness", &material.linear_roughness, 0.0f, 1.0f);
+							material_changed |= ImGui::SliderFloat3("Eta",       &material.eta.x, 0.0f, 4.0f);
+							material_changed |= ImGui::SliderFloat3("K",         &material.k.x,   0.0f, 8.0f);
+							material_changed |= ImGui::SliderFloat ("Roughness", &material.linear_roughness, 0.0f, 1.0f);
+							material.roughness_texture_handle.handle = ImGui_Combo("Roughness Texture", roughness_texture_name, integrator.scene.asset_manager.textures, true, material.roughness_texture_handle.handle, [&material_changed](int index) {
+								material_changed = true;
+							});
 							break;
 						}
 						default: ASSERT_UNREACHABLE();
@@ -644,6 +2277,7 @@ static void draw_gui(Window & window, Integrator & integrator) {
 
 					if (material.medium_handle.handle != INVALID && ImGui::CollapsingHeader("Medium##MediumHeader", ImGuiTreeNodeFlags_DefaultOpen)) {
 						Medium & medium = integrator.scene.asset_manager.get_medium(material.medium_handle);
+						bool medium_changed = false;
 
 						Vector3 sigma_a = { };
 						Vector3 sigma_s = { };
@@ -654,10 +2288,14 @@ static void draw_gui(Window & window, Integrator & integrator) {
 						ImGui::Text("Sigma S: %.3f, %.3f, %.3f", sigma_s.x, sigma_s.y, sigma_s.z);
 						ImGui::Text("Sigma T: %.3f, %.3f, %.3f", sigma_t.x, sigma_t.y, sigma_t.z);
 
-						integrator.invalidated_mediums |= ImGui::ColorEdit3 ("Albedo",   &medium.C.x);
-						integrator.invalidated_mediums |= ImGui::DragFloat3 ("MFP",      &medium.mfp.x, 0.01f, 0.0f, INFINITY);
-						integrator.invalidated_mediums |= ImGui::SliderFloat("Phase g",  &medium.g,  -1.0f,  1.0f);
+						medium_changed |= ImGui::ColorEdit3 ("Albedo",   &medium.C.x);
+						medium_changed |= ImGui::DragFloat3 ("MFP",      &medium.mfp.x, 0.01f, 0.0f, INFINITY);
+						medium_changed |= ImGui::SliderFloat("Phase g",  &medium.g,  -1.0f,  1.0f);
+
+						if (medium_changed) integrator.invalidate_medium(material.medium_handle);
 					}
+
+					if (material_changed) integrator.invalidate_material(mesh.material_handle);
 				}
 			}
 		}
@@ -714,9 +2352,13 @@ static void draw_gui(Window & window, Integrator & integrator) {
 		draw_line_clipped(aabb_corners[3], aabb_corners[7], aabb_colour);
 
 		if (integrator.pixel_query.triangle_id != INVALID) {
-			const MeshData & mesh_data = integrator.scene.asset_manager.get_mesh_data(mesh.mesh_data_handle);
+			integrator.scene.asset_manager.restore_host_data(mesh.mesh_data_handle); // The selected MeshData stays resident from here on
+		}
+
+		const MeshData & mesh_data = integrator.scene.asset_manager.get_mesh_data(mesh.mesh_data_handle);
 
-			int              index    = mesh_data.bvh->indices[integrator.pixel_query.triangle_id - integrator.mesh_data_triangle_offsets[mesh.mesh_data_handle.handle]];
+		if (integrator.pixel_query.triangle_id != INVALID && !mesh_data.has_curves()) {
+			int              index    = mesh_data.bvh->indices[integrator.pixel_query.triangle_id - integrator.gpu_scene->mesh_data_triangle_offsets[mesh.mesh_data_handle.handle]];
 			const Triangle & triangle = mesh_data.triangles[index];
 
 			int mouse_x, mouse_y;
@@ -0,0 +1,355 @@
+#include "BlockCompression.h"
+
+#include <string.h>
+#include <limits.h>
+
+#include "Math.h"
+
+#include "Util/Util.h"
+
+/*
+	Block layouts based on: https://docs.microsoft.com/en-us/windows/win32/direct3d11/bc7-format-mode-reference
+	and https://docs.microsoft.com/en-us/windows/win32/direct3d11/bc6h-format
+*/
+
+static constexpr int PIXELS_PER_BLOCK = 16;
+static constexpr int INDEX_COUNT      = 16;
+
+// Interpolation weights of 4 bit indices, shared by BC6H and BC7
+static constexpr int WEIGHTS[INDEX_COUNT] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+static int interpolate(int a, int b, int index) {
+	return ((64 - WEIGHTS[index]) * a + WEIGHTS[index] * b + 32) >> 6;
+}
+
+// Writes bits LSB first, the block has to be zeroed beforehand
+struct BlockWriter {
+	unsigned char * dst;
+	int             bit = 0;
+
+	void write(unsigned value, int bit_count) {
+		for (int i = 0; i < bit_count; i++) {
+			if ((value >> i) & 1) {
+				dst[bit >> 3] |= 1 << (bit & 7);
+			}
+			bit++;
+		}
+	}
+};
+
+// Endpoints along the diagonal of the bounding box, flipped per channel to follow the covariance with the channel of largest extent
+template<int Channels>
+static void fit_endpoints(const float pixels[PIXELS_PER_BLOCK][Channels], float endpoint_0[Channels], float endpoint_1[Channels]) {
+	float mean[Channels] = { };
+	for (int c = 0; c < Channels; c++) {
+		endpoint_0[c] = pixels[0][c];
+		endpoint_1[c] = pixels[0][c];
+	}
+	for (int i = 0; i < PIXELS_PER_BLOCK; i++) {
+		for (int c = 0; c < Channels; c++) {
+			endpoint_0[c] = Math::min(endpoint_0[c], pixels[i][c]);
+			endpoint_1[c] = Math::max(endpoint_1[c], pixels[i][c]);
+			mean[c] += pixels[i][c] / float(PIXELS_PER_BLOCK);
+		}
+	}
+
+	int   principal_channel = 0;
+	float principal_extent  = 0.0f;
+	for (int c = 0; c < Channels; c++) {
+		if (endpoint_1[c] - endpoint_0[c] > principal_extent) {
+			principal_channel = c;
+			principal_extent  = endpoint_1[c] - endpoint_0[c];
+		}
+	}
+
+	for (int c = 0; c < Channels; c++) {
+		if (c == principal_channel) continue;
+
+		float covariance = 0.0f;
+		for (int i = 0; i < PIXELS_PER_BLOCK; i++) {
+			covariance += (pixels[i][c] - mean[c]) * (pixels[i][principal_channel] - mean[principal_channel]);
+		}
+		if (covariance < 0.0f) {
+			Util::swap(endpoint_0[c], endpoint_1[c]);
+		}
+	}
+}
+
+// Least squares fit of the endpoints to the given indices, returns false if the system is degenerate (all pixels use the same weight)
+template<int Channels>
+static bool refit_endpoints(const float pixels[PIXELS_PER_BLOCK][Channels], const int indices[PIXELS_PER_BLOCK], float endpoint_0[Channels], float endpoint_1[Channels]) {
+	float a = 0.0f;
+	float b = 0.0f;
+	float c = 0.0f;
+	float x[Channels] = { };
+	float y[Channels] = { };
+
+	for (int i = 0; i < PIXELS_PER_BLOCK; i++) {
+		float t = float(WEIGHTS[indices[i]]) / 64.0f;
+		float s = 1.0f - t;
+
+		a += s * s;
+		b += s * t;
+		c += t * t;
+		for (int ch = 0; ch < Channels; ch++) {
+			x[ch] += s * pixels[i][ch];
+			y[ch] += t * pixels[i][ch];
+		}
+	}
+
+	float det = a * c - b * b;
+	if (fabsf(det) < 1e-6f) return false;
+
+	float det_inv = 1.0f / det;
+	for (int ch = 0; ch < Channels; ch++) {
+		endpoint_0[ch] = (c * x[ch] - b * y[ch]) * det_inv;
+		endpoint_1[ch] = (a * y[ch] - b * x[ch]) * det_inv;
+	}
+	return true;
+}
+
+struct BC7Endpoints {
+	int quantized[2][4]; // 7 bits
+	int p_bit    [2];
+	int colour   [2][4]; // 8 bits, including the p-bit
+};
+
+static void bc7_quantize_endpoint(const float endpoint[4], int quantized[4], int & p_bit, int colour[4]) {
+	float error_best = INFINITY;
+
+	for (int p = 0; p < 2; p++) {
+		int   q[4];
+		float error = 0.0f;
+		for (int c = 0; c < 4; c++) {
+			q[c] = Math::clamp(int(roundf((endpoint[c] - float(p)) * 0.5f)), 0, 127);
+
+			float diff = float((q[c] << 1) | p) - endpoint[c];
+			error += diff * diff;
+		}
+
+		if (error < error_best) {
+			error_best = error;
+			p_bit = p;
+			for (int c = 0; c < 4; c++) {
+				quantized[c] = q[c];
+				colour   [c] = (q[c] << 1) | p;
+			}
+		}
+	}
+}
+
+static int bc7_find_indices(const float pixels[PIXELS_PER_BLOCK][4], const BC7Endpoints & endpoints, int indices[PIXELS_PER_BLOCK]) {
+	int palette[INDEX_COUNT][4];
+	for (int i = 0; i < INDEX_COUNT; i++) {
+		for (int c = 0; c < 4; c++) {
+			palette[i][c] = interpolate(endpoints.colour[0][c], endpoints.colour[1][c], i);
+		}
+	}
+
+	int error_total = 0;
+
+	for (int p = 0; p < PIXELS_PER_BLOCK; p++) {
+		int error_best = INT_MAX;
+
+		for (int i = 0; i < INDEX_COUNT; i++) {
+			int error = 0;
+			for (int c = 0; c < 4; c++) {
+				int diff = palette[i][c] - int(pixels[p][c]);
+				error += diff * diff;
+			}
+			if (error < error_best) {
+				error_best = error;
+				indices[p] = i;
+			}
+		}
+
+		error_total += error_best;
+	}
+
+	return error_total;
+}
+
+void BlockCompression::compress_bc7_block(unsigned char * dst, const unsigned char * src_rgba, bool refine) {
+	float pixels[PIXELS_PER_BLOCK][4];
+	for (int i = 0; i < PIXELS_PER_BLOCK; i++) {
+		for (int c = 0; c < 4; c++) {
+			pixels[i][c] = float(src_rgba[4*i + c]);
+		}
+	}
+
+	float endpoint_0[4];
+	float endpoint_1[4];
+	fit_endpoints<4>(pixels, endpoint_0, endpoint_1);
+
+	BC7Endpoints endpoints;
+	bc7_quantize_endpoint(endpoint_0, endpoints.quantized[0], endpoints.p_bit[0], endpoints.colour[0]);
+	bc7_quantize_endpoint(endpoint_1, endpoints.quantized[1], endpoints.p_bit[1], endpoints.colour[1]);
+
+	int indices[PIXELS_PER_BLOCK];
+	int error = bc7_find_indices(pixels, endpoints, indices);
+
+	if (refine && error > 0 && refit_endpoints<4>(pixels, indices, endpoint_0, endpoint_1)) {
+		for (int c = 0; c < 4; c++) {
+			endpoint_0[c] = Math::clamp(endpoint_0[c], 0.0f, 255.0f);
+			endpoint_1[c] = Math::clamp(endpoint_1[c], 0.0f, 255.0f);
+		}
+
+		BC7Endpoints endpoints_refined;
+		bc7_quantize_endpoint(endpoint_0, endpoints_refined.quantized[0], endpoints_refined.p_bit[0], endpoints_refined.colour[0]);
+		bc7_quantize_endpoint(endpoint_1, endpoints_refined.quantized[1], endpoints_refined.p_bit[1], endpoints_refined.colour[1]);
+
+		int indices_refined[PIXELS_PER_BLOCK];
+		int error_refined = bc7_find_indices(pixels, endpoints_refined, indices_refined);
+
+		if (error_refined < error) {
+			endpoints = endpoints_refined;
+			memcpy(indices, indices_refined, sizeof(indices));
+		}
+	}
+
+	// The most significant bit of the first index is implicitly zero
+	if (indices[0] >= INDEX_COUNT / 2) {
+		for (int c = 0; c < 4; c++) {
+			Util::swap(endpoints.quantized[0][c], endpoints.quantized[1][c]);
+		}
+		Util::swap(endpoints.p_bit[0], endpoints.p_bit[1]);
+		for (int i = 0; i < PIXELS_PER_BLOCK; i++) {
+			indices[i] = (INDEX_COUNT - 1) - indices[i];
+		}
+	}
+
+	memset(dst, 0, 16);
+	BlockWriter writer = { dst };
+
+	writer.write(1 << 6, 7); // Mode 6
+	for (int c = 0; c < 4; c++) {
+		writer.write(endpoints.quantized[0][c], 7);
+		writer.write(endpoints.quantized[1][c], 7);
+	}
+	writer.write(endpoints.p_bit[0], 1);
+	writer.write(endpoints.p_bit[1], 1);
+
+	writer.write(indices[0], 3);
+	for (int i = 1; i < PIXELS_PER_BLOCK; i++) {
+		writer.write(indices[i], 4);
+	}
+	ASSERT(writer.bit == 128);
+}
+
+// BC6H interpolates the unquantized endpoints, the result is scaled by 31/64 to obtain the bits of a half precision float
+// Encoding works in this unquantized space, where interpolation is linear
+static constexpr int BC6H_ENDPOINT_BITS = 10;
+static constexpr int BC6H_ENDPOINT_MAX  = (1 << BC6H_ENDPOINT_BITS) - 1;
+
+static constexpr int HALF_MAX = 0x7bff; // Largest finite half precision number
+
+static int bc6h_unquantize(int x) {
+	if (x == 0)                 return 0;
+	if (x == BC6H_ENDPOINT_MAX) return 0xffff;
+	return ((x << 16) + 0x8000) >> BC6H_ENDPOINT_BITS;
+}
+
+static int bc6h_quantize(float unquantized) {
+	return Math::clamp(int(roundf((unquantized - 32.0f) / 64.0f)), 0, BC6H_ENDPOINT_MAX);
+}
+
+static int bc6h_find_indices(const int halfs[PIXELS_PER_BLOCK][3], const int endpoint_0[3], const int endpoint_1[3], int indices[PIXELS_PER_BLOCK]) {
+	int palette[INDEX_COUNT][3];
+	for (int i = 0; i < INDEX_COUNT; i++) {
+		for (int c = 0; c < 3; c++) {
+			palette[i][c] = (interpolate(bc6h_unquantize(endpoint_0[c]), bc6h_unquantize(endpoint_1[c]), i) * 31) >> 6;
+		}
+	}
+
+	// The error is measured on the bits of the half precision floats, which approximates the relative error
+	int error_total = 0;
+
+	for (int p = 0; p < PIXELS_PER_BLOCK; p++) {
+		int error_best = INT_MAX;
+
+		for (int i = 0; i < INDEX_COUNT; i++) {
+			int error = 0;
+			for (int c = 0; c < 3; c++) {
+				int diff = palette[i][c] - halfs[p][c];
+				error += diff * diff;
+			}
+			if (error < error_best) {
+				error_best = error;
+				indices[p] = i;
+			}
+		}
+
+		error_total = Math::min(error_total + error_best, INT_MAX / 2);
+	}
+
+	return error_total;
+}
+
+void BlockCompression::compress_bc6h_block(unsigned char * dst, const float * src_rgb, bool refine) {
+	int   halfs [PIXELS_PER_BLOCK][3];
+	float pixels[PIXELS_PER_BLOCK][3];
+	for (int i = 0; i < PIXELS_PER_BLOCK; i++) {
+		for (int c = 0; c < 3; c++) {
+			float value = src_rgb[3*i + c];
+			if (!(value > 0.0f)) value = 0.0f; // Also removes NaN
+
+			halfs [i][c] = Math::min(int(Math::float_to_half(value)), HALF_MAX);
+			pixels[i][c] = float(halfs[i][c]) * (64.0f / 31.0f);
+		}
+	}
+
+	float endpoint_0[3];
+	float endpoint_1[3];
+	fit_endpoints<3>(pixels, endpoint_0, endpoint_1);
+
+	int quantized_0[3];
+	int quantized_1[3];
+	for (int c = 0; c < 3; c++) {
+		quantized_0[c] = bc6h_quantize(endpoint_0[c]);
+		quantized_1[c] = bc6h_quantize(endpoint_1[c]);
+	}
+
+	int indices[PIXELS_PER_BLOCK];
+	int error = bc6h_find_indices(halfs, quantized_0, quantized_1, indices);
+
+	if (refine && error > 0 && refit_endpoints<3>(pixels, indices, endpoint_0, endpoint_1)) {
+		int quantized_refined_0[3];
+		int quantized_refined_1[3];
+		for (int c = 0; c < 3; c++) {
+			quantized_refined_0[c] = bc6h_quantize(endpoint_0[c]);
+			quantized_refined_1[c] = bc6h_quantize(endpoint_1[c]);
+		}
+
+		int indices_refined[PIXELS_PER_BLOCK];
+		int error_refined = bc6h_find_indices(halfs, quantized_refined_0, quantized_refined_1, indices_refined);
+
+		if (error_refined < error) {
+			memcpy(quantized_0, quantized_refined_0, sizeof(quantized_0));
+			memcpy(quantized_1, quantized_refined_1, sizeof(quantized_1));
+			memcpy(indices,     indices_refined,     sizeof(indices));
+		}
+	}
+
+	// The most significant bit of the first index is implicitly zero
+	if (indices[0] >= INDEX_COUNT / 2) {
+		for (int c = 0; c < 3; c++) {
+			Util::swap(quantized_0[c], quantized_1[c]);
+		}
+		for (int i = 0; i < PIXELS_PER_BLOCK; i++) {
+			indices[i] = (INDEX_COUNT - 1) - indices[i];
+		}
+	}
+
+	memset(dst, 0, 16);
+	BlockWriter writer = { dst };
+
+	writer.write(0x03, 5); // Mode 11
+	for (int c = 0; c < 3; c++) writer.write(quantized_0[c], BC6H_ENDPOINT_BITS);
+	for (int c = 0; c < 3; c++) writer.write(quantized_1[c], BC6H_ENDPOINT_BITS);
+
+	writer.write(indices[0], 3);
+	for (int i = 1; i < PIXELS_PER_BLOCK; i++) {
+		writer.write(indices[i], 4);
+	}
+	ASSERT(writer.bit == 128);
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+// Block compression encoders for the formats that stb_dxt does not support
+// Both write a single 16 byte block for a 4x4 block of pixels in row major order
+namespace BlockCompression {
+	// BC7 mode 6: one subset, 7 bit RGBA endpoints with a shared p-bit each and 4 bit indices
+	// With refine set the endpoints are refitted once to the chosen indices with least squares, which is about twice as slow
+	void compress_bc7_block(unsigned char * dst, const unsigned char * src_rgba, bool refine);
+
+	// BC6H (unsigned) mode 11: one region, untransformed 10 bit RGB endpoints and 4 bit indices
+	// Negative values are clamped to 0, values above the largest half precision number are clamped to it
+	void compress_bc6h_block(unsigned char * dst, const float * src_rgb, bool refine);
+}
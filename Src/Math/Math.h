@@ -1,5 +1,6 @@
 #pragma once
 #include <float.h>
+#include <string.h>
 
 #include "Math/Vector3.h"
 
@@ -57,6 +58,13 @@ namespace Math {
 		}
 	}
 
+	// Number of set bits
+	inline constexpr int popcount(unsigned x) {
+		x = x - ((x >> 1) & 0x55555555u);
+		x = (x & 0x33333333u) + ((x >> 2) & 0x33333333u);
+		return int((((x + (x >> 4)) & 0x0f0f0f0fu) * 0x01010101u) >> 24);
+	}
+
 	template<typename T> inline constexpr T square(T x) { return x * x; }
 
 	template<typename T> inline constexpr T min(T a, T b) { return a < b ? a : b; }
@@ -112,6 +120,54 @@ namespace Math {
 		return luminance(rgb.x, rgb.y, rgb.z);
 	}
 
+	// Converts to IEEE 754 half precision with round to nearest, denormals are flushed to zero
+	inline unsigned short float_to_half(float f) {
+		unsigned bits;
+		memcpy(&bits, &f, sizeof(float));
+
+		unsigned sign     = (bits >> 16) & 0x8000;
+		int      exponent = int((bits >> 23) & 0xff) - 127 + 15;
+		unsigned mantissa = bits & 0x7fffff;
+
+		if (exponent <= 0)  return sign;
+		if (exponent >= 31) return sign | 0x7c00; // Infinity
+
+		unsigned half = sign | (exponent << 10) | (mantissa >> 13);
+		if (mantissa & 0x1000) half++; // Round, may carry into the exponent which is the correct result
+
+		return half;
+	}
+
+	// Packs two floats as half precision, x in the low 16 bits
+	inline unsigned pack_half2(float x, float y) {
+		return unsigned(float_to_half(x)) | (unsigned(float_to_half(y)) << 16);
+	}
+
+	// Octahedral normal encoding, packed as two 16 bit unorms (x in the low 16 bits)
+	// Based on: https://knarkowicz.wordpress.com/2014/04/16/octahedron-normal-vector-encoding/
+	inline unsigned oct_encode_normal(const Vector3 & n) {
+		float l1_norm = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+		if (l1_norm == 0.0f) {
+			return 0x80008000; // Degenerate normal, encode as (0, 0, 1)
+		}
+
+		float x = n.x / l1_norm;
+		float y = n.y / l1_norm;
+
+		if (n.z < 0.0f) {
+			// Oct wrap
+			float x_wrapped = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+			float y_wrapped = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+			x = x_wrapped;
+			y = y_wrapped;
+		}
+
+		unsigned u = unsigned(clamp(0.5f + 0.5f * x, 0.0f, 1.0f) * 65535.0f + 0.5f);
+		unsigned v = unsigned(clamp(0.5f + 0.5f * y, 0.0f, 1.0f) * 65535.0f + 0.5f);
+
+		return u | (v << 16);
+	}
+
 	inline constexpr float rad_to_deg(float rad) { return rad * ONE_OVER_PI * 180.0f; }
 	inline constexpr float deg_to_rad(float deg) { return deg / 180.0f * PI; }
 
@@ -66,6 +66,38 @@ struct alignas(16) Matrix4 {
 		return result;
 	}
 
+	// Same as create_translation(translation) * create_rotation(rotation) * create_scale(scale), without the Matrix multiplies
+	inline static Matrix4 create_transform(const Vector3 & translation, const Quaternion & rotation, float scale) {
+		Matrix4 result = create_rotation(rotation);
+		for (int row = 0; row < 3; row++) {
+			for (int col = 0; col < 3; col++) {
+				result(row, col) *= scale;
+			}
+		}
+		result(0, 3) = translation.x;
+		result(1, 3) = translation.y;
+		result(2, 3) = translation.z;
+
+		return result;
+	}
+
+	// Inverse of create_transform, same as create_scale(1 / scale) * create_rotation(conjugate(rotation)) * create_translation(-translation)
+	inline static Matrix4 create_transform_inv(const Vector3 & translation, const Quaternion & rotation, float scale) {
+		float inv_scale = 1.0f / scale;
+
+		Matrix4 result = create_rotation(Quaternion::conjugate(rotation));
+		for (int row = 0; row < 3; row++) {
+			for (int col = 0; col < 3; col++) {
+				result(row, col) *= inv_scale;
+			}
+		}
+		for (int row = 0; row < 3; row++) {
+			result(row, 3) = -(result(row, 0) * translation.x + result(row, 1) * translation.y + result(row, 2) * translation.z);
+		}
+
+		return result;
+	}
+
 	inline static Matrix4 create_scale(float scale) {
 		Matrix4 result;
 		result(0, 0) = scale;
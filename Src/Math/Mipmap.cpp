@@ -3,10 +3,14 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include <xmmintrin.h>
+
 #include "Config.h"
 
 #include "Core/Allocators/StackAllocator.h"
 
+#include "Util/ThreadPool.h"
+
 /*
 	Mipmap filter code based on http://number-none.com/product/Mipmapping,%20Part%201/index.html and https://github.com/castano/nvidia-texture-tools
 */
@@ -70,94 +74,129 @@ static float filter_sample_box(float x, float scale) {
 }
 
 template<typename Filter>
-void downsample_impl(int width_src, int height_src, int width_dst, int height_dst, const Vector4 texture_src[], Vector4 texture_dst[], Vector4 temp[]) {
-	float scale_x = float(width_dst)  / float(width_src);
-	float scale_y = float(height_dst) / float(height_src);
-
-	ASSERT(scale_x <= 1.0f && scale_y <= 1.0f);
+static Mipmap::FilterKernel calc_filter_kernel_impl(int size_src, int size_dst, Allocator * allocator) {
+	float scale = float(size_dst) / float(size_src);
+	ASSERT(scale <= 1.0f);
 
-	float inv_scale_x = 1.0f / scale_x;
-	float inv_scale_y = 1.0f / scale_y;
+	Mipmap::FilterKernel kernel = { };
+	kernel.filter_width = Filter::width / scale;
 
-	float filter_width_x = Filter::width * inv_scale_x;
-	float filter_width_y = Filter::width * inv_scale_y;
+	int window_size = int(ceilf(kernel.filter_width * 2.0f)) + 1;
 
-	int window_size_x = int(ceilf(filter_width_x * 2.0f)) + 1;
-	int window_size_y = int(ceilf(filter_width_y * 2.0f)) + 1;
+	kernel.weights = Array<float>(window_size, allocator);
 
-	StackAllocator<KILOBYTES(1)> allocator;
-	Array<float> kernel_x(window_size_x, &allocator);
-	Array<float> kernel_y(window_size_y, &allocator);
-	memset(kernel_x.data(), 0, window_size_x * sizeof(float));
-	memset(kernel_y.data(), 0, window_size_y * sizeof(float));
+	float sum = 0.0f;
 
-	float sum_x = 0.0f;
-	float sum_y = 0.0f;
+	for (int i = 0; i < window_size; i++) {
+		float sample = filter_sample_box<Filter>(float(i - window_size / 2), scale);
 
-	// Fill horizontal kernel
-	for (int x = 0; x < window_size_x; x++) {
-		float sample = filter_sample_box<Filter>(float(x - window_size_x / 2), scale_x);
-
-		kernel_x[x] = sample;
-		sum_x += sample;
+		kernel.weights[i] = sample;
+		sum += sample;
 	}
 
-	// Fill vertical kernel
-	for (int y = 0; y < window_size_y; y++) {
-		float sample = filter_sample_box<Filter>(float(y - window_size_y / 2), scale_y);
+	// Normalize kernel
+	for (int i = 0; i < window_size; i++) kernel.weights[i] /= sum;
 
-		kernel_y[y] = sample;
-		sum_y += sample;
+	return kernel;
+}
+
+Mipmap::FilterKernel Mipmap::calc_filter_kernel(int size_src, int size_dst, Allocator * allocator) {
+	switch (cpu_config.mipmap_filter) {
+		case MipmapFilterType::BOX:     return calc_filter_kernel_impl<FilterBox>    (size_src, size_dst, allocator);
+		case MipmapFilterType::LANCZOS: return calc_filter_kernel_impl<FilterLanczos>(size_src, size_dst, allocator);
+		case MipmapFilterType::KAISER:  return calc_filter_kernel_impl<FilterKaiser> (size_src, size_dst, allocator);
+		default: ASSERT_UNREACHABLE();
 	}
+}
 
-	// Normalize kernels
-	for (int x = 0; x < window_size_x; x++) kernel_x[x] /= sum_x;
-	for (int y = 0; y < window_size_y; y++) kernel_y[y] /= sum_y;
+// Filters the window_size texels starting at first, texels outside [0, count) are clamped to the edge
+static __m128 filter_window(const Vector4 texels[], int count, int first, const float weights[], int window_size) {
+	__m128 sum = _mm_setzero_ps();
+
+	if (first >= 0 && first + window_size <= count) {
+		// Interior, no clamping required
+		// Four independent accumulators hide the latency of the additions, the windows of Lanczos and Kaiser are wide
+		const Vector4 * window = texels + first;
+
+		__m128 sum_0 = _mm_setzero_ps();
+		__m128 sum_1 = _mm_setzero_ps();
+		__m128 sum_2 = _mm_setzero_ps();
+		__m128 sum_3 = _mm_setzero_ps();
+
+		int i = 0;
+		for (; i + 4 <= window_size; i += 4) {
+			sum_0 = _mm_add_ps(sum_0, _mm_mul_ps(_mm_set1_ps(weights[i    ]), _mm_loadu_ps(window[i    ].data)));
+			sum_1 = _mm_add_ps(sum_1, _mm_mul_ps(_mm_set1_ps(weights[i + 1]), _mm_loadu_ps(window[i + 1].data)));
+			sum_2 = _mm_add_ps(sum_2, _mm_mul_ps(_mm_set1_ps(weights[i + 2]), _mm_loadu_ps(window[i + 2].data)));
+			sum_3 = _mm_add_ps(sum_3, _mm_mul_ps(_mm_set1_ps(weights[i + 3]), _mm_loadu_ps(window[i + 3].data)));
+		}
+		for (; i < window_size; i++) {
+			sum_0 = _mm_add_ps(sum_0, _mm_mul_ps(_mm_set1_ps(weights[i]), _mm_loadu_ps(window[i].data)));
+		}
 
-	// Apply horizontal kernel
-	for (int y = 0; y < height_src; y++) {
-		for (int x = 0; x < width_dst; x++) {
-			float center = (float(x) + 0.5f) * inv_scale_x;
+		sum = _mm_add_ps(_mm_add_ps(sum_0, sum_1), _mm_add_ps(sum_2, sum_3));
+	} else {
+		for (int i = 0; i < window_size; i++) {
+			int index = Math::clamp(first + i, 0, count - 1);
 
-			int left = int(floorf(center - filter_width_x));
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[i]), _mm_loadu_ps(texels[index].data)));
+		}
+	}
 
-			Vector4 sum = Vector4(0.0f);
+	return sum;
+}
 
-			for (int i = 0; i < window_size_x; i++) {
-				int index = Math::clamp(left + i, 0, width_src - 1) + y * width_src;
+// Index of the first source texel in the filter window of every destination texel, these are shared by all rows/columns
+static void calc_window_offsets(int size_src, int size_dst, float filter_width, int offsets[]) {
+	float inv_scale = float(size_src) / float(size_dst);
 
-				sum += kernel_x[i] * texture_src[index];
-			}
+	for (int i = 0; i < size_dst; i++) {
+		float center = (float(i) + 0.5f) * inv_scale;
 
-			temp[x * height_src + y] = sum;
-		}
+		offsets[i] = int(floorf(center - filter_width));
 	}
+}
 
-	// Apply vertical kernel
-	for (int x = 0; x < width_dst; x++) {
-		for (int y = 0; y < height_dst; y++) {
-			float center = (float(y) + 0.5f) * inv_scale_y;
+void Mipmap::downsample(int width_src, int height_src, int width_dst, int height_dst, const Vector4 texture_src[], Vector4 texture_dst[], Vector4 temp[]) {
+	StackAllocator<KILOBYTES(4)> allocator;
+	FilterKernel kernel_x = calc_filter_kernel(width_src,  width_dst,  &allocator);
+	FilterKernel kernel_y = calc_filter_kernel(height_src, height_dst, &allocator);
 
-			int top = int(floorf(center - filter_width_y));
+	Array<int> offsets_x(width_dst,  &allocator);
+	Array<int> offsets_y(height_dst, &allocator);
+	calc_window_offsets(width_src,  width_dst,  kernel_x.filter_width, offsets_x.data());
+	calc_window_offsets(height_src, height_dst, kernel_y.filter_width, offsets_y.data());
 
-			Vector4 sum = Vector4(0.0f);
+	int window_size_x = kernel_x.weights.size();
+	int window_size_y = kernel_y.weights.size();
 
-			for (int i = 0; i < window_size_y; i++) {
-				int index = x * height_src + Math::clamp(top + i, 0, height_src - 1);
+	// Both passes are split into jobs of MIPMAP_ROWS_PER_JOB rows/columns
+	// Textures are loaded on the ThreadPool, so these are nested inside the Texture's own Work
+	constexpr int MIPMAP_ROWS_PER_JOB = 64;
 
-				sum += kernel_y[i] * temp[index];
-			}
+	// Apply horizontal kernel, temp is stored transposed so that the vertical pass also reads contiguous memory
+	ThreadPool::parallel_for(0, height_src, MIPMAP_ROWS_PER_JOB, [&](int y_first, int y_last) {
+		for (int y = y_first; y < y_last; y++) {
+			const Vector4 * row = texture_src + y * width_src;
+
+			for (int x = 0; x < width_dst; x++) {
+				__m128 sum = filter_window(row, width_src, offsets_x[x], kernel_x.weights.data(), window_size_x);
 
-			texture_dst[x + y * width_dst] = sum;
+				_mm_storeu_ps(temp[x * height_src + y].data, sum);
+			}
 		}
-	}
-}
+	});
 
-void Mipmap::downsample(int width_src, int height_src, int width_dst, int height_dst, const Vector4 texture_src[], Vector4 texture_dst[], Vector4 temp[]) {
-	switch (cpu_config.mipmap_filter) {
-		case MipmapFilterType::BOX:     downsample_impl<FilterBox>    (width_src, height_src, width_dst, height_dst, texture_src, texture_dst, temp); break;
-		case MipmapFilterType::LANCZOS: downsample_impl<FilterLanczos>(width_src, height_src, width_dst, height_dst, texture_src, texture_dst, temp); break;
-		case MipmapFilterType::KAISER:  downsample_impl<FilterKaiser> (width_src, height_src, width_dst, height_dst, texture_src, texture_dst, temp); break;
-		default: ASSERT_UNREACHABLE();
-	}
+	// Apply vertical kernel
+	ThreadPool::parallel_for(0, width_dst, MIPMAP_ROWS_PER_JOB, [&](int x_first, int x_last) {
+		for (int x = x_first; x < x_last; x++) {
+			const Vector4 * column = temp + x * height_src;
+
+			for (int y = 0; y < height_dst; y++) {
+				__m128 sum = filter_window(column, height_src, offsets_y[y], kernel_y.weights.data(), window_size_y);
+
+				_mm_storeu_ps(texture_dst[x + y * width_dst].data, sum);
+			}
+		}
+	});
 }
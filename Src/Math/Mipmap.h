@@ -2,6 +2,17 @@
 #include "Math.h"
 #include "Vector4.h"
 
+#include "Core/Array.h"
+
 namespace Mipmap {
+	// Normalized 1D weights of cpu_config.mipmap_filter for downsampling size_src to size_dst
+	// Destination texel i covers the source texels starting at floorf((i + 0.5f) * size_src / size_dst - filter_width)
+	struct FilterKernel {
+		Array<float> weights;
+		float        filter_width;
+	};
+
+	FilterKernel calc_filter_kernel(int size_src, int size_dst, Allocator * allocator = nullptr);
+
 	void downsample(int width_src, int height_src, int width_dst, int height_dst, const Vector4 texture_src[], Vector4 texture_dst[], Vector4 temp[]);
 }
\ No newline at end of file
@@ -0,0 +1,24 @@
+#pragma once
+#include "Math/Math.h"
+#include "Math/AABB.h"
+#include "Math/Vector3.h"
+
+// Segment of a hair strand, stored as a round cone between two spheres
+// This is much more compact than the two Triangles per segment it replaces (see MitshairLoader)
+// A Curve with coinciding end points and radii is intersected as an exact sphere (see MitsubaLoader)
+struct Curve {
+	Vector3 position_0;
+	float   radius_0;
+	Vector3 position_1;
+	float   radius_1;
+
+	Vector3 get_center() const {
+		return 0.5f * (position_0 + position_1);
+	}
+
+	AABB get_aabb() const {
+		AABB aabb_0 = { position_0 - Vector3(radius_0), position_0 + Vector3(radius_0) };
+		AABB aabb_1 = { position_1 - Vector3(radius_1), position_1 + Vector3(radius_1) };
+		return AABB::unify(aabb_0, aabb_1);
+	}
+};
@@ -20,6 +20,8 @@ void AO::cuda_init(unsigned frame_buffer_handle, int screen_width, int screen_he
 	init_rng();
 	init_events();
 
+	CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::WAVEFRONT);
+
 	ray_buffer_trace .init(BATCH_SIZE);
 	ray_buffer_shadow.init(BATCH_SIZE);
 	cuda_module.get_global("ray_buffer_trace") .set_value(ray_buffer_trace);
@@ -32,7 +34,6 @@ void AO::cuda_free() {
 	Integrator::cuda_free();
 
 	free_geometry();
-	free_rng();
 
 	CUDAMemory::free_pinned(pinned_buffer_sizes);
 
@@ -41,6 +42,8 @@ void AO::cuda_free() {
 }
 
 void AO::init_module() {
+	aov_disable(AOVType::TRAVERSAL_COST); // Only the Pathtracer records traversal cost, see module_is_outdated
+
 	cuda_module.init("AO"_sv, "Src/CUDA/AO.cu"_sv, CUDAContext::compute_capability, MAX_REGISTERS);
 
 	kernel_generate         .init(&cuda_module, "kernel_generate");
@@ -91,9 +94,14 @@ void AO::init_events() {
 }
 
 void AO::resize_init(unsigned frame_buffer_handle, int width, int height) {
-	screen_width  = width;
-	screen_height = height;
-	screen_pitch  = Math::round_up(width, WARP_SIZE);
+	screen_width   = width;
+	screen_height  = height;
+	screen_pitch   = Math::round_up(width, WARP_SIZE);
+	display_width  = width;
+	display_height = height;
+
+	alloc_screen_pitch  = screen_pitch;
+	alloc_screen_height = screen_height;
 
 	pixel_count = width * height;
 
@@ -105,10 +113,7 @@ void AO::resize_init(unsigned frame_buffer_handle, int width, int height) {
 	aov_enable(AOVType::RADIANCE);
 	cuda_module.get_global("aovs").set_value(aovs);
 
-	// Set Accumulator to a CUDA resource mapping of the GL frame buffer texture
-	resource_accumulator = CUDAMemory::resource_register(frame_buffer_handle, CU_GRAPHICS_REGISTER_FLAGS_SURFACE_LDST);
-	surf_accumulator     = CUDAMemory::create_surface(CUDAMemory::resource_get_array(resource_accumulator));
-	cuda_module.get_global("accumulator").set_value(surf_accumulator);
+	init_accumulator(frame_buffer_handle);
 
 	kernel_generate         .set_grid_dim(Math::divide_round_up(BATCH_SIZE, kernel_generate         .block_dim_x), 1, 1);
 	kernel_ambient_occlusion.set_grid_dim(Math::divide_round_up(BATCH_SIZE, kernel_ambient_occlusion.block_dim_x), 1, 1);
@@ -117,8 +122,10 @@ void AO::resize_init(unsigned frame_buffer_handle, int width, int height) {
 	scene.camera.resize(width, height);
 	invalidated_camera = true;
 
+	primary_hits_valid = false;
+
 	// Reset buffer sizes to default for next frame
-	pinned_buffer_sizes->reset(Math::min(BATCH_SIZE, pixel_count));
+	pinned_buffer_sizes->reset(Math::min(BATCH_SIZE / ao_rays_per_hit, pixel_count));
 	global_buffer_sizes.set_value(*pinned_buffer_sizes);
 
 	sample_index = 0;
@@ -129,50 +136,63 @@ void AO::resize_free() {
 
 	free_aovs();
 
-	CUDAMemory::resource_unregister(resource_accumulator);
-	CUDAMemory::free_surface(surf_accumulator);
+	free_accumulator();
 }
 
 void AO::update(float delta, Allocator * frame_allocator) {
-	if (invalidated_scene) {
-		sample_index = 0;
-	}
+	update_stats = { };
 
 	Integrator::update(delta, frame_allocator);
+
+	if (tlas_updated) {
+		tlas_updated = false;
+		sample_index = 0;
+
+		primary_hits_valid = false;
+	}
+	if (scene.camera.moved) {
+		primary_hits_valid = false;
+	}
 }
 
 void AO::render() {
-	event_pool.reset();
+	begin_frame_events();
 
 	CUDACALL(cuStreamSynchronize(memory_stream));
 
 	int pixels_left = pixel_count;
-	int batch_size  = Math::min(BATCH_SIZE, pixel_count);
+	int batch_size  = Math::min(BATCH_SIZE / ao_rays_per_hit, pixel_count); // Every primary hit emits up to ao_rays_per_hit Shadow Rays
+
+	// The batch size may have changed since the previous frame along with ao_rays_per_hit
+	reset_buffer_sizes<BufferSizesAO>(batch_size, nullptr);
+
+	bool reuse_primary_hits = ao_reuse_primary_hits && primary_hits_valid && batch_size == pixel_count;
 
-	// Render in batches of BATCH_SIZE pixels at a time
+	// Render in batches of BATCH_SIZE / ao_rays_per_hit pixels at a time
 	while (pixels_left > 0) {
 		int pixel_offset = pixel_count - pixels_left;
 		int pixel_count  = Math::min(batch_size, pixels_left);
 
-		// Generate primary Rays from the current Camera orientation
-		event_pool.record(&event_desc_primary);
-		kernel_generate.execute(sample_index, pixel_offset, pixel_count);
+		if (!reuse_primary_hits) {
+			// Generate primary Rays from the current Camera orientation
+			event_pool.record(&event_desc_primary);
+			kernel_generate.execute(get_rng_sample_index(), pixel_offset, pixel_count);
 
-		event_pool.record(&event_desc_trace);
-		kernel_trace->execute();
+			event_pool.record(&event_desc_trace);
+			kernel_trace->execute();
+		}
 
 		event_pool.record(&event_desc_ambient_occlusion);
-		kernel_ambient_occlusion.execute(sample_index, ao_radius);
+		kernel_ambient_occlusion.execute(get_rng_sample_index(), ao_radius, ao_rays_per_hit);
 
 		event_pool.record(&event_desc_shadow_trace);
-		kernel_trace_shadow->execute();
+		kernel_trace_shadow->execute(1.0f / float(ao_rays_per_hit));
 
 		pixels_left -= batch_size;
 
 		if (pixels_left > 0) {
 			// Set buffer sizes to appropriate pixel count for next Batch
-			pinned_buffer_sizes->reset(Math::min(batch_size, pixels_left));
-			global_buffer_sizes.set_value(*pinned_buffer_sizes);
+			reset_buffer_sizes<BufferSizesAO>(Math::min(batch_size, pixels_left), nullptr);
 		}
 	}
 
@@ -181,21 +201,23 @@ void AO::render() {
 
 	event_pool.record(&event_desc_end);
 
-	// Reset buffer sizes to default for next frame
-	pinned_buffer_sizes->reset(batch_size);
-	global_buffer_sizes.set_value(*pinned_buffer_sizes);
+	// The trace buffer still holds the primary hits of the whole frame if it fit in a single batch
+	primary_hits_valid = batch_size == pixel_count;
 
 	aovs_clear_to_zero();
 
-	// If a pixel query was previously pending, it has just been resolved in the current frame
-	if (pixel_query_status == PixelQueryStatus::PENDING) {
-		pixel_query_status =  PixelQueryStatus::OUTPUT_READY;
-	}
+	sync_tlas();
 }
 
 void AO::render_gui() {
 	if (ImGui::CollapsingHeader("Integrator", ImGuiTreeNodeFlags_DefaultOpen)) {
 		invalidated_gpu_config |= ImGui::SliderFloat("AO Radius", &ao_radius, 0.0001f, 2.0f);
+		invalidated_gpu_config |= ImGui::SliderInt("Rays per Hit", &ao_rays_per_hit, 1, 16);
+
+		ImGui::Checkbox("Reuse Primary Hits", &ao_reuse_primary_hits);
+		if (ImGui::IsItemHovered()) {
+			ImGui::SetTooltip("Shades the primary hits of the previous frame again while the Camera is static, disables anti-aliasing");
+		}
 	}
 
 	if (ImGui::CollapsingHeader("Auxilary AOVs", ImGuiTreeNodeFlags_DefaultOpen)) {
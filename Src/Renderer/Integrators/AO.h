@@ -8,6 +8,8 @@ struct TraceBufferAO {
 
 	CUDAMemory::Ptr<float4> hits;
 
+	CUDAMemory::Ptr<float> ray_time; // Not allocated, AO Rays always use the Transforms of the current frame
+
 	CUDAMemory::Ptr<int> pixel_index;
 
 	inline void init(int buffer_size) {
@@ -30,6 +32,7 @@ struct ShadowRayBufferAO {
 	CUDAVector3_SoA ray_direction;
 
 	CUDAMemory::Ptr<float> max_distance;
+	CUDAMemory::Ptr<float> ray_time; // Not allocated
 	CUDAMemory::Ptr<int>   pixel_index;
 
 	inline void init(int buffer_size) {
@@ -93,7 +96,14 @@ struct AO final : Integrator {
 
 	float ao_radius = 1.0f;
 
-	AO(unsigned frame_buffer_handle, int width, int height, Scene & scene) : Integrator(scene) {
+	int ao_rays_per_hit = 1; // Shadow Rays per primary hit, the primary batch shrinks accordingly so that they fit in the Shadow Ray buffer
+
+	// While the Camera and the TLAS are static the primary hits of the previous frame are shaded again instead of tracing new primary Rays
+	// Only possible once the whole frame fits in a single batch, and the result is not anti-aliased since the primary Rays are no longer jittered
+	bool ao_reuse_primary_hits = false;
+	bool primary_hits_valid    = false;
+
+	AO(unsigned frame_buffer_handle, int width, int height, Scene & scene, OwnPtr<GPUScene> gpu_scene = nullptr) : Integrator(scene, std::move(gpu_scene)) {
 		cuda_init(frame_buffer_handle, width, height);
 	}
 
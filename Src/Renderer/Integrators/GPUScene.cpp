@@ -0,0 +1,112 @@
+#include "GPUScene.h"
+
+#include "Renderer/Scene.h"
+
+void GPUScene::validate(const Scene & scene) {
+	bool valid =
+		this->scene       == &scene &&
+		mesh_count        == scene.meshes.size() &&
+		bvh_type          == cpu_config.bvh_type &&
+		texture_streaming == cpu_config.enable_texture_streaming;
+
+	if (!valid) {
+		free();
+	}
+
+	this->scene       = &scene;
+	mesh_count        = scene.meshes.size();
+	bvh_type          = cpu_config.bvh_type;
+	texture_streaming = cpu_config.enable_texture_streaming;
+}
+
+void GPUScene::texture_free(int texture_index) {
+	CUDAMemory::free_array(texture_arrays[texture_index]);
+	CUDAMemory::free_texture(textures[texture_index].texture);
+}
+
+void GPUScene::free_geometry() {
+	if (!has_geometry) return;
+
+	switch (bvh_type) {
+		case BVHType::BVH:
+		case BVHType::SBVH: CUDAMemory::free(ptr_bvh_nodes_2); break;
+		case BVHType::BVH4: CUDAMemory::free(ptr_bvh_nodes_4); break;
+		case BVHType::BVH8: CUDAMemory::free(ptr_bvh_nodes_8); break;
+	}
+
+	CUDAMemory::free(ptr_triangles);
+	CUDAMemory::free(ptr_vertices);
+
+	if (ptr_curves.ptr != NULL) {
+		CUDAMemory::free(ptr_curves);
+		ptr_curves = CUDAMemory::Ptr<Curve>(NULL);
+	}
+
+	if (ptr_lod_chains.ptr != NULL) {
+		CUDAMemory::free(ptr_lod_chains);
+		ptr_lod_chains = CUDAMemory::Ptr<MeshLODChain>(NULL);
+	}
+
+	reverse_indices.clear();
+
+	mesh_data_lod_chains.clear();
+
+	mesh_data_bvh_offsets     .clear();
+	mesh_data_triangle_offsets.clear();
+	mesh_data_vertex_offsets  .clear();
+	mesh_data_index_offsets   .clear();
+
+	has_geometry = false;
+}
+
+void GPUScene::free_textures() {
+	if (!has_textures) return;
+
+	if (textures.size() > 0) {
+		CUDAMemory::free(ptr_textures);
+
+		for (int i = 0; i < textures.size(); i++) {
+			texture_free(i);
+		}
+
+		if (texture_streaming) {
+			CUDAMemory::free(ptr_texture_feedback);
+		}
+	}
+
+	textures        .clear();
+	texture_arrays  .clear();
+	texture_feedback.clear();
+
+	has_textures = false;
+}
+
+void GPUScene::free_sky() {
+	if (!has_sky) return;
+
+	CUDAMemory::free_array(sky_array);
+	CUDAMemory::free_texture(sky_texture);
+
+	CUDAMemory::free(ptr_sky_alias_table);
+	CUDAMemory::free(ptr_sky_pdf);
+
+	has_sky = false;
+}
+
+void GPUScene::free_rng() {
+	if (!has_rng) return;
+
+	CUDAMemory::free(ptr_pmj_samples);
+	CUDAMemory::free(ptr_blue_noise_textures);
+
+	has_rng = false;
+}
+
+void GPUScene::free() {
+	free_geometry();
+	free_textures();
+	free_sky();
+	free_rng();
+
+	scene = nullptr;
+}
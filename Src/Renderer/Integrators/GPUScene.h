@@ -0,0 +1,117 @@
+#pragma once
+#include "Config.h"
+
+#include "Device/CUDAMemory.h"
+
+#include "BVH/BVH.h"
+
+#include "Renderer/Curve.h"
+
+#include "Util/PMJ.h"
+#include "Util/AliasTable.h"
+
+struct Scene;
+
+// Device data of a Scene that does not depend on the type of Integrator: Geometry, BLAS Nodes, Textures, Sky and the random number tables
+// It is owned by an Integrator, but is handed over to the next Integrator when switching (see init_integrator in Main.cpp) or reused
+// on a hot reload, so that only the Integrator specific state has to be recreated. Each Module binds its globals to these pointers
+struct GPUScene {
+	// Triangles are split into the data needed for intersection, which is accessed during traversal and stored in BVH order,
+	// and the data only needed for shading, which is accessed once per hit and stored per Vertex so that it is shared between Triangles
+	struct CUDATriangle {
+		Vector3 position_0;
+		Vector3 position_edge_1;
+		Vector3 position_edge_2;
+
+		int vertex_0; // Into the aggregated CUDAVertices
+		int vertex_1;
+		int vertex_2;
+	};
+	static_assert(sizeof(CUDATriangle) == 48);
+
+	struct CUDAVertex {
+		Vector2  tex_coord; // Kept at full precision, tiling Textures can have large texture coordinates
+		unsigned normal;    // Oct encoded
+
+		unsigned padding;
+	};
+	static_assert(sizeof(CUDAVertex) == 16);
+
+	struct CUDATexture {
+		CUtexObject texture;
+		float       lod_bias;
+		int         mip_offset; // Finest Mip level that is resident
+	};
+
+	static_assert(sizeof(CUDATexture) == 16); // Read with a single load, see texture_get
+
+	// The resident data is only valid for the Scene and the settings it was uploaded with
+	const Scene * scene = nullptr;
+
+	size_t  mesh_count; // The aggregated BVH Nodes reserve space for the TLAS, which depends on the number of Meshes
+	BVHType bvh_type;
+	bool    texture_streaming;
+
+	bool has_geometry = false;
+	bool has_textures = false;
+	bool has_sky      = false;
+	bool has_rng      = false;
+
+	// Geometry
+	CUDAMemory::Ptr<CUDATriangle> ptr_triangles;
+	CUDAMemory::Ptr<CUDAVertex>   ptr_vertices;
+
+	CUDAMemory::Ptr<Curve> ptr_curves; // Only allocated if the Scene contains Curves, uploaded as is since the layout matches Curve in Raytracing/Curve.h
+
+	// Aggregated BLAS Nodes of all MeshDatas, preceded by the space reserved for the double buffered TLAS of the Integrator
+	CUDAMemory::Ptr<BVHNode2>  ptr_bvh_nodes_2;
+	CUDAMemory::Ptr<BVHNode4>  ptr_bvh_nodes_4;
+	CUDAMemory::Ptr<BVHNode8>  ptr_bvh_nodes_8;
+
+	Array<int> reverse_indices;
+
+	Array<int> mesh_data_bvh_offsets;
+	Array<int> mesh_data_triangle_offsets;
+	Array<int> mesh_data_vertex_offsets;
+	Array<int> mesh_data_index_offsets; // Into the aggregated Curves instead of Triangles if the MeshData has Curves
+
+	Array<int>                    mesh_data_lod_chains; // Per MeshData, index into ptr_lod_chains or INVALID if it has no levels of detail
+	CUDAMemory::Ptr<MeshLODChain> ptr_lod_chains;      // Only allocated if any MeshData has levels of detail
+
+	// Textures
+	Array<CUDATexture>      textures;
+	Array<CUmipmappedArray> texture_arrays;
+
+	int texture_max_anisotropy;
+
+	CUDAMemory::Ptr<CUDATexture> ptr_textures;
+
+	CUDAMemory::Ptr<int> ptr_texture_feedback;
+	Array<int>           texture_feedback;
+	Array<int>           texture_last_used;  // Index of the last streaming update in which the Texture was sampled, used for LRU eviction
+	int                  texture_streaming_frame  = 0;
+	int                  texture_streaming_update = 0;
+
+	// Sky
+	CUarray     sky_array;
+	CUtexObject sky_texture;
+
+	CUDAMemory::Ptr<AliasTable::Entry> ptr_sky_alias_table;
+	CUDAMemory::Ptr<float>             ptr_sky_pdf;
+
+	// RNG
+	CUDAMemory::Ptr<PMJ::Point>     ptr_pmj_samples;
+	CUDAMemory::Ptr<unsigned short> ptr_blue_noise_textures;
+
+	// Frees the resident data if it was uploaded for a different Scene or with different settings
+	void validate(const Scene & scene);
+
+	void texture_free(int texture_index);
+
+	void free_geometry();
+	void free_textures();
+	void free_sky();
+	void free_rng();
+
+	void free();
+};
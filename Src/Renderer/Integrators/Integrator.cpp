@@ -1,5 +1,7 @@
 #include "Integrator.h"
 
+#include <limits.h>
+
 #include <GL/glew.h>
 
 #include <Imgui/imgui.h>
@@ -7,300 +9,1415 @@
 #include "BVH/Converters/BVH4Converter.h"
 #include "BVH/Converters/BVH8Converter.h"
 
-#include "Core/Allocators/PinnedAllocator.h"
+#include "Math/Mipmap.h"
+#include "Math/BlockCompression.h"
+
+#include "Util/BlueNoise.h"
+#include "Util/Profiler.h"
+#include "Util/ThreadPool.h"
+
+// Only Textures that have their full Mip chain on the CPU can be streamed
+static bool texture_is_streamable(const Texture & texture) {
+	return cpu_config.enable_texture_streaming && gpu_config.enable_mipmapping && !texture.mipmaps_on_gpu;
+}
+
+// First Mip level of which the largest dimension fits in TEXTURE_STREAMING_TAIL_SIZE pixels
+static int texture_streaming_tail_level(const Texture & texture) {
+	if (!texture_is_streamable(texture)) return 0;
+
+	int texels_per_element = texture.format == Texture::Format::RGBA ? 1 : 4; // Block Compressed Textures store their size in blocks
+
+	int level = 0;
+	while (level < texture.mip_levels() - 1 && Math::max(texture.width >> level, texture.height >> level) * texels_per_element > Integrator::TEXTURE_STREAMING_TAIL_SIZE) {
+		level++;
+	}
+	return level;
+}
+
+// Size of the Mip levels from first_level onwards
+static size_t texture_resident_bytes(const Texture & texture, int first_level) {
+	return texture.get_data_size() - texture.mip_offsets[first_level];
+}
+
+Array<String> Integrator::get_module_defines(unsigned aov_mask_required) {
+	Array<String> defines;
+
+	// Unlike the feature toggles the traversal counters are compiled in regardless of specialisation, see CUDA/Config.h
+	module_has_traversal_heatmap = aov_is_enabled(AOVType::TRAVERSAL_COST);
+	if (module_has_traversal_heatmap) {
+		defines.push_back("-DCONFIG_TRAVERSAL_HEATMAP=1"_sv);
+	}
+	if (cpu_config.enable_bvh8_short_stack) {
+		defines.push_back("-DCONFIG_BVH8_SHORT_STACK=1"_sv);
+	}
+	if (cpu_config.enable_packed_ray_buffers) {
+		defines.push_back("-DCONFIG_PACKED_RAY_BUFFERS=1"_sv);
+	}
+	if (cpu_config.enable_compact_ray_payloads) {
+		defines.push_back("-DCONFIG_COMPACT_RAY_PAYLOADS=1"_sv);
+	}
+
+	if (!cpu_config.enable_specialised_kernels) return defines;
+
+	module_is_specialised = true;
+	module_config         = gpu_config;
+	module_config.aov_mask |= aov_mask_required; // AOVs that are enabled by the Integrator itself after the Module is loaded
+
+	auto define = [](StringView name, unsigned value) {
+		return Format().format("-D{}={}"_sv, name, value);
+	};
+
+	defines.push_back("-DCONFIG_SPECIALISED"_sv);
+	defines.push_back(define("CONFIG_ENABLE_MIPMAPPING"_sv,                   module_config.enable_mipmapping));
+	defines.push_back(define("CONFIG_ENABLE_NEXT_EVENT_ESTIMATION"_sv,        module_config.enable_next_event_estimation));
+	defines.push_back(define("CONFIG_ENABLE_MULTIPLE_IMPORTANCE_SAMPLING"_sv, module_config.enable_multiple_importance_sampling));
+	defines.push_back(define("CONFIG_ENABLE_RUSSIAN_ROULETTE"_sv,             module_config.enable_russian_roulette));
+	defines.push_back(define("CONFIG_ENABLE_SVGF"_sv,                         module_config.enable_svgf));
+	defines.push_back(define("CONFIG_ENABLE_MOTION_BLUR"_sv,                  module_config.enable_motion_blur));
+	defines.push_back(define("CONFIG_AOV_MASK"_sv,                            module_config.aov_mask));
+	return defines;
+}
+
+bool Integrator::module_is_outdated() const {
+	if (aov_is_enabled(AOVType::TRAVERSAL_COST) && !module_has_traversal_heatmap) return true;
+
+	if (!module_is_specialised) return false;
+
+	// Disabling an AOV does not require a recompile, since disabled AOVs have no framebuffer
+	return
+		gpu_config.enable_mipmapping                   != module_config.enable_mipmapping ||
+		gpu_config.enable_next_event_estimation        != module_config.enable_next_event_estimation ||
+		gpu_config.enable_multiple_importance_sampling != module_config.enable_multiple_importance_sampling ||
+		gpu_config.enable_russian_roulette             != module_config.enable_russian_roulette ||
+		gpu_config.enable_svgf                         != module_config.enable_svgf ||
+		gpu_config.enable_motion_blur                  != module_config.enable_motion_blur ||
+		(gpu_config.aov_mask & ~module_config.aov_mask) != 0;
+}
+
+CUDAModule::SharedGlobal Integrator::get_global_shared(const char * variable_name) const {
+	CUDAModule::SharedGlobal global;
+	global.add(cuda_module, variable_name);
+
+	for (size_t i = 0; i < cuda_modules_shared.size(); i++) {
+		global.add(*cuda_modules_shared[i], variable_name);
+	}
+
+	if (global.global_count == 0) {
+		IO::print("ERROR: Global CUDA variable '{}' not found in any Module!\n"_sv, variable_name);
+	}
+	return global;
+}
+
+void Integrator::init_globals() {
+	global_camera      = cuda_module.get_global("camera");
+	global_config      = get_global_shared("config");
+	global_aovs        = get_global_shared("aovs");
+}
+
+void Integrator::init_materials() {
+	CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::MATERIALS);
+
+	ptr_material_types = CUDAMemory::malloc<Material::Type>(scene.asset_manager.materials.size());
+	ptr_materials      = CUDAMemory::malloc<CUDAMaterial>  (scene.asset_manager.materials.size());
+	cuda_module.get_global("material_types").set_value(ptr_material_types);
+	cuda_module.get_global("materials")     .set_value(ptr_materials);
+
+	ptr_media = CUDAMemory::malloc<CUDAMedium>(scene.asset_manager.media.size());
+	cuda_module.get_global("media").set_value(ptr_media);
+
+	// The grids of heterogeneous Media do not change after loading, so they are uploaded once here
+	size_t medium_count = scene.asset_manager.media.size();
+
+	Array<CUDAMediumGrid> medium_grids(medium_count);
+	size_t                medium_grid_data_size = 0;
+
+	for (size_t i = 0; i < medium_count; i++) {
+		const MediumGrid & grid = scene.asset_manager.media[i].grid;
+		CUDAMediumGrid & cuda_grid = medium_grids[i];
+
+		if (!grid.is_valid()) {
+			cuda_grid = { };
+			cuda_grid.density_offset  = INVALID;
+			cuda_grid.majorant_offset = INVALID;
+			continue;
+		}
+
+		cuda_grid.bounds_min = grid.bounds.min;
+		cuda_grid.bounds_max = grid.bounds.max;
+		cuda_grid.resolution[0] = grid.width;
+		cuda_grid.resolution[1] = grid.height;
+		cuda_grid.resolution[2] = grid.depth;
+		cuda_grid.majorant_resolution[0] = grid.majorant_width;
+		cuda_grid.majorant_resolution[1] = grid.majorant_height;
+		cuda_grid.majorant_resolution[2] = grid.majorant_depth;
+
+		cuda_grid.density_offset = int(medium_grid_data_size);
+		medium_grid_data_size += grid.density.size();
+		cuda_grid.majorant_offset = int(medium_grid_data_size);
+		medium_grid_data_size += grid.majorants.size();
+	}
+
+	if (medium_count > 0) {
+		ptr_medium_grids = CUDAMemory::malloc<CUDAMediumGrid>(medium_count);
+		CUDAMemory::memcpy(ptr_medium_grids, medium_grids.data(), medium_count);
+	}
+	if (medium_grid_data_size > 0) {
+		Array<float> medium_grid_data(medium_grid_data_size);
+
+		for (size_t i = 0; i < medium_count; i++) {
+			const MediumGrid & grid = scene.asset_manager.media[i].grid;
+			if (!grid.is_valid()) continue;
+
+			memcpy(medium_grid_data.data() + medium_grids[i].density_offset,  grid.density  .data(), grid.density  .size() * sizeof(float));
+			memcpy(medium_grid_data.data() + medium_grids[i].majorant_offset, grid.majorants.data(), grid.majorants.size() * sizeof(float));
+		}
+
+		ptr_medium_grid_data = CUDAMemory::malloc<float>(medium_grid_data_size);
+		CUDAMemory::memcpy(ptr_medium_grid_data, medium_grid_data.data(), medium_grid_data_size);
+	}
+	cuda_module.get_global("medium_grids")    .set_value(ptr_medium_grids);
+	cuda_module.get_global("medium_grid_data").set_value(ptr_medium_grid_data);
+
+	// Set global Texture table
+	size_t texture_count = scene.asset_manager.textures.size();
+
+	// The mipmapping Kernels are also needed by Texture streaming, which recreates Textures that are already resident
+	if (texture_count > 0 && cpu_config.enable_gpu_mipmapping) {
+		kernel_mipmap_downsample_x.init(&cuda_module, "kernel_mipmap_downsample_x");
+		kernel_mipmap_downsample_y.init(&cuda_module, "kernel_mipmap_downsample_y");
+
+		kernel_mipmap_downsample_x.set_block_dim(16, 16, 1);
+		kernel_mipmap_downsample_y.set_block_dim(16, 16, 1);
+	}
+
+	// The Textures are still resident from a previous Integrator
+	if (gpu_scene->has_textures) {
+		if (texture_count > 0) {
+			cuda_module.get_global("textures").set_value(gpu_scene->ptr_textures);
+
+			if (cpu_config.enable_texture_streaming) {
+				cuda_module.get_global("texture_feedback").set_value(gpu_scene->ptr_texture_feedback);
+			}
+		}
+		return;
+	}
+
+	if (texture_count > 0) {
+		CUDAMemory::CategoryScope memory_scope_textures(CUDAMemory::Category::TEXTURES);
+
+		gpu_scene->textures      .resize(texture_count);
+		gpu_scene->texture_arrays.resize(texture_count);
+
+		// Get maximum anisotropy from OpenGL, without a GL Context use the maximum that all current hardware supports
+		if (cpu_config.headless) {
+			gpu_scene->texture_max_anisotropy = 16;
+		} else {
+			glGetIntegerv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &gpu_scene->texture_max_anisotropy);
+		}
+
+		// Upload every Texture as soon as it has been loaded, while the remaining assets are still loading on the ThreadPool
+		// If loading already finished the Textures have been taken by a previous initialization (hot reload, or another Device)
+		Array<Handle<Texture>> loaded_textures;
+
+		if (scene.asset_manager.is_loaded()) {
+			for (size_t i = 0; i < texture_count; i++) {
+				scene.asset_manager.restore_host_data(Handle<Texture> { int(i) });
+
+				const Texture & texture = scene.asset_manager.textures[i];
+				texture_create(int(i), texture, texture_streaming_tail_level(texture));
+			}
+		}
+
+		while (!scene.asset_manager.is_loaded() && scene.asset_manager.take_loaded_textures(loaded_textures)) {
+			if (loaded_textures.size() == 0) {
+				ThreadPool::help(); // Nothing to upload yet, help out loading instead
+				continue;
+			}
+
+			for (size_t t = 0; t < loaded_textures.size(); t++) {
+				int i = loaded_textures[t].handle;
+				const Texture & texture = scene.asset_manager.get_texture(loaded_textures[t]);
+
+				// With streaming only the Mip tail is resident initially, finer levels are streamed in once they are requested
+				texture_create(i, texture, texture_streaming_tail_level(texture));
+			}
+
+			loaded_textures.clear();
+		}
+
+		gpu_scene->ptr_textures = CUDAMemory::malloc(gpu_scene->textures);
+		cuda_module.get_global("textures").set_value(gpu_scene->ptr_textures);
+
+		if (cpu_config.enable_texture_streaming) {
+			gpu_scene->texture_feedback .resize(texture_count);
+			gpu_scene->texture_last_used.resize(texture_count);
+			memset(gpu_scene->texture_last_used.data(), 0, texture_count * sizeof(int));
+
+			gpu_scene->ptr_texture_feedback = CUDAMemory::malloc<int>(texture_count);
+			CUDAMemory::memset_async(gpu_scene->ptr_texture_feedback, INT_MAX, texture_count, memory_stream);
+			cuda_module.get_global("texture_feedback").set_value(gpu_scene->ptr_texture_feedback);
+
+			gpu_scene->texture_streaming_frame  = 0;
+			gpu_scene->texture_streaming_update = 0;
+		}
+	}
+
+	scene.asset_manager.wait_until_loaded();
+
+	gpu_scene->has_textures = true;
+}
+
+void Integrator::texture_create(int texture_index, const Texture & texture, int first_level) {
+	CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::TEXTURES);
+	ProfileAssetScope         asset(texture.name.view());
+	ProfileScope              scope("Texture Upload"_sv);
+
+	int level_count = texture.get_mip_level_count() - first_level;
+
+	int width  = Math::max(texture.width  >> first_level, 1);
+	int height = Math::max(texture.height >> first_level, 1);
+
+	// Create mipmapped CUDA array
+	gpu_scene->texture_arrays[texture_index] = CUDAMemory::create_array_mipmap(
+		width,
+		height,
+		texture.channels,
+		texture.get_cuda_array_format(),
+		level_count
+	);
+
+	if (texture.mipmaps_on_gpu) {
+		ASSERT(first_level == 0);
+		generate_mipmaps(texture, gpu_scene->texture_arrays[texture_index]);
+	} else {
+		const unsigned char * data = texture.data.data();
+
+		// Mapped Textures are staged straight from the file, the mapping only has to outlive the copies into the staging buffers
+		IO::MappedFile mapping;
+		if (texture.is_mapped()) {
+			mapping = IO::file_map(texture.mapped_filename);
+
+			if (mapping.size() >= texture.mapped_offset + texture.mapped_size) {
+				data = reinterpret_cast<const unsigned char *>(mapping.data()) + texture.mapped_offset;
+			} else {
+				IO::print("WARNING: Texture file '{}' was truncated since it was loaded, its contents are undefined!\n"_sv, texture.mapped_filename);
+				data = nullptr;
+			}
+		}
+
+		// Upload each level of the mipmap
+		for (int level = first_level; data && level < texture.mip_levels(); level++) {
+			CUarray level_array;
+			CUDACALL(cuMipmappedArrayGetLevel(&level_array, gpu_scene->texture_arrays[texture_index], level - first_level));
+
+			int level_width_in_bytes = texture.get_width_in_bytes(level);
+			int level_height         = Math::max(texture.height >> level, 1);
+
+			texture_upload_level(level_array, level_width_in_bytes, level_height, reinterpret_cast<const char *>(data + texture.mip_offsets[level]));
+		}
+	}
+
+	// Describe the Array to read from
+	CUDA_RESOURCE_DESC res_desc = { };
+	res_desc.resType = CUresourcetype::CU_RESOURCE_TYPE_MIPMAPPED_ARRAY;
+	res_desc.res.mipmap.hMipmappedArray = gpu_scene->texture_arrays[texture_index];
+
+	// Describe how to sample the Texture
+	CUDA_TEXTURE_DESC tex_desc = { };
+	tex_desc.addressMode[0] = CUaddress_mode::CU_TR_ADDRESS_MODE_WRAP;
+	tex_desc.addressMode[1] = CUaddress_mode::CU_TR_ADDRESS_MODE_WRAP;
+	tex_desc.addressMode[2] = CUaddress_mode::CU_TR_ADDRESS_MODE_CLAMP;
+	tex_desc.filterMode       = CUfilter_mode::CU_TR_FILTER_MODE_LINEAR;
+	tex_desc.mipmapFilterMode = CUfilter_mode::CU_TR_FILTER_MODE_LINEAR;
+	tex_desc.mipmapLevelBias = 0.0f;
+	tex_desc.maxAnisotropy = gpu_scene->texture_max_anisotropy;
+	tex_desc.minMipmapLevelClamp = 0.0f;
+	tex_desc.maxMipmapLevelClamp = float(level_count - 1);
+	tex_desc.flags = CU_TRSF_NORMALIZED_COORDINATES;
+	if (texture.is_srgb) {
+		tex_desc.flags |= CU_TRSF_SRGB;
+	}
+
+	// Describe the Texture View
+	CUDA_RESOURCE_VIEW_DESC view_desc = { };
+	view_desc.format = texture.get_cuda_resource_view_format();
+	view_desc.width  = texture.get_cuda_resource_view_width (first_level);
+	view_desc.height = texture.get_cuda_resource_view_height(first_level);
+	view_desc.firstMipmapLevel = 0;
+	view_desc.lastMipmapLevel  = level_count - 1;
+
+	CUDACALL(cuTexObjectCreate(&gpu_scene->textures[texture_index].texture, &res_desc, &tex_desc, &view_desc));
+
+	// Normalized coordinates make sampling a partially resident Texture fall back to its finest resident level automatically
+	gpu_scene->textures[texture_index].lod_bias   = 0.5f * log2f(float(width * height));
+	gpu_scene->textures[texture_index].mip_offset = first_level;
+}
+
+void Integrator::texture_upload_level(CUarray level_array, int width_in_bytes, int height, const char * data) {
+	ASSERT(width_in_bytes <= TEXTURE_STAGING_BUFFER_SIZE);
+
+	// Small levels are packed into the same staging buffer, levels that do not fit into one are split into bands of rows
+	int rows_per_band = int(TEXTURE_STAGING_BUFFER_SIZE / width_in_bytes);
+
+	for (int y = 0; y < height; y += rows_per_band) {
+		int    rows  = Math::min(rows_per_band, height - y);
+		size_t bytes = size_t(rows) * size_t(width_in_bytes);
+
+		TextureStagingBuffer * staging = &texture_staging_buffers[texture_staging_index];
+
+		if (staging->data == nullptr || texture_staging_offset + bytes > TEXTURE_STAGING_BUFFER_SIZE) {
+			if (staging->data) {
+				texture_staging_index  = (texture_staging_index + 1) % TEXTURE_STAGING_BUFFER_COUNT;
+				texture_staging_offset = 0;
+
+				staging = &texture_staging_buffers[texture_staging_index];
+			}
+
+			if (staging->data == nullptr) {
+				staging->data = CUDAMemory::malloc_pinned<char>(TEXTURE_STAGING_BUFFER_SIZE);
+				CUDACALL(cuEventCreate(&staging->event, CU_EVENT_DISABLE_TIMING));
+			} else {
+				CUDACALL(cuEventSynchronize(staging->event)); // Wait until the previous copies out of this buffer are done
+			}
+		}
+
+		char * dst = staging->data + texture_staging_offset;
+		memcpy(dst, data + size_t(y) * size_t(width_in_bytes), bytes);
+
+		CUDAMemory::copy_array_async(level_array, width_in_bytes, y, rows, dst, texture_upload_stream);
+		CUDACALL(cuEventRecord(staging->event, texture_upload_stream));
+
+		texture_staging_offset += bytes;
+	}
+}
+
+void Integrator::free_texture_staging() {
+	CUDACALL(cuStreamSynchronize(texture_upload_stream));
+
+	for (int i = 0; i < TEXTURE_STAGING_BUFFER_COUNT; i++) {
+		TextureStagingBuffer & staging = texture_staging_buffers[i];
+		if (staging.data == nullptr) continue;
+
+		CUDAMemory::free_pinned(staging.data);
+		CUDACALL(cuEventDestroy(staging.event));
+
+		staging = { };
+	}
+
+	texture_staging_index  = 0;
+	texture_staging_offset = 0;
+}
+
+bool Integrator::update_texture_streaming() {
+	if (!cpu_config.enable_texture_streaming || gpu_scene->textures.size() == 0) return false;
+
+	gpu_scene->texture_streaming_frame++;
+	if (gpu_scene->texture_streaming_frame < TEXTURE_STREAMING_UPDATE_INTERVAL) return false;
+
+	ProfileScope scope("Texture Streaming"_sv);
+
+	gpu_scene->texture_streaming_frame = 0;
+	gpu_scene->texture_streaming_update++;
+
+	size_t texture_count = gpu_scene->textures.size();
+
+	// Feedback is accumulated over all frames since the last update
+	CUDAMemory::memcpy(gpu_scene->texture_feedback.data(), gpu_scene->ptr_texture_feedback, texture_count);
+	CUDAMemory::memset_async(gpu_scene->ptr_texture_feedback, INT_MAX, texture_count, memory_stream);
+
+	// Requested levels are promoted, resident levels that are no longer requested stay resident until the budget needs their memory
+	Array<int> first_levels(texture_count);
+	Array<int> requested_levels(texture_count);
+
+	size_t bytes_budget = size_t(cpu_config.texture_streaming_budget) << 20;
+	size_t bytes_total  = 0;
+
+	for (size_t i = 0; i < texture_count; i++) {
+		const Texture & texture = scene.asset_manager.textures[i];
+
+		int resident_level = gpu_scene->textures[i].mip_offset;
+
+		if (texture_is_streamable(texture)) {
+			bool sampled = gpu_scene->texture_feedback[i] != INT_MAX;
+			if (sampled) {
+				gpu_scene->texture_last_used[i] = gpu_scene->texture_streaming_update;
+			}
+			requested_levels[i] = Math::clamp(gpu_scene->texture_feedback[i], 0, texture_streaming_tail_level(texture));
+			first_levels    [i] = Math::min(requested_levels[i], resident_level);
+		} else {
+			requested_levels[i] = resident_level;
+			first_levels    [i] = resident_level;
+		}
+
+		bytes_total += texture_resident_bytes(texture, first_levels[i]);
+	}
+
+	// Over budget, drop the finest level of a Texture until everything fits
+	// Levels that were not requested go first, then the least recently used Texture, ties are broken by size
+	while (bytes_total > bytes_budget) {
+		int    evict_index     = INVALID;
+		bool   evict_unneeded  = false;
+		int    evict_last_used = INT_MAX;
+		size_t evict_bytes     = 0;
+
+		for (size_t i = 0; i < texture_count; i++) {
+			const Texture & texture = scene.asset_manager.textures[i];
+			if (!texture_is_streamable(texture) || first_levels[i] >= texture_streaming_tail_level(texture)) continue;
+
+			bool   unneeded  = first_levels[i] < requested_levels[i];
+			int    last_used = gpu_scene->texture_last_used[i];
+			size_t bytes     = texture_resident_bytes(texture, first_levels[i]);
+
+			bool better;
+			if (unneeded != evict_unneeded) {
+				better = unneeded;
+			} else if (last_used != evict_last_used) {
+				better = last_used < evict_last_used;
+			} else {
+				better = bytes > evict_bytes;
+			}
+
+			if (evict_index == INVALID || better) {
+				evict_index     = int(i);
+				evict_unneeded  = unneeded;
+				evict_last_used = last_used;
+				evict_bytes     = bytes;
+			}
+		}
+
+		if (evict_index == INVALID) break; // Only Mip tails are left
+
+		const Texture & texture = scene.asset_manager.textures[evict_index];
+
+		bytes_total -= evict_bytes - texture_resident_bytes(texture, first_levels[evict_index] + 1);
+		first_levels[evict_index]++;
+	}
+
+	bool changed = false;
+	for (size_t i = 0; i < texture_count; i++) {
+		if (first_levels[i] != gpu_scene->textures[i].mip_offset) {
+			changed = true;
+			break;
+		}
+	}
+	if (!changed) return false;
+
+	// The previous frame may still be sampling the Textures that are about to be replaced
+	CUDACALL(cuCtxSynchronize());
+
+	for (size_t i = 0; i < texture_count; i++) {
+		if (first_levels[i] == gpu_scene->textures[i].mip_offset) continue;
+
+		gpu_scene->texture_free(i);
+		texture_create(i, scene.asset_manager.textures[i], first_levels[i]);
+	}
+
+	CUDAMemory::memcpy(gpu_scene->ptr_textures, gpu_scene->textures.data(), texture_count);
+
+	CUDACALL(cuStreamSynchronize(texture_upload_stream)); // The next frame samples the new levels
+
+	return true;
+}
+
+void Integrator::generate_mipmaps(const Texture & texture, CUmipmappedArray array) {
+	CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::TEXTURES);
+
+	ASSERT(texture.format == Texture::Format::RGBA && texture.mip_levels() == 1);
+
+	int level_count = texture.get_mip_level_count();
+
+	// All levels are stored contiguously in a single buffer, like the CPU path does
+	Array<int> level_offsets(level_count);
+
+	int pixel_count = 0;
+	for (int level = 0; level < level_count; level++) {
+		level_offsets[level] = pixel_count;
+		pixel_count += Math::max(texture.width >> level, 1) * Math::max(texture.height >> level, 1);
+	}
+
+	CUDAMemory::Ptr<unsigned> ptr_levels = CUDAMemory::malloc<unsigned>(pixel_count);
+	CUDAMemory::Ptr<float4>   ptr_temp   = CUDAMemory::malloc<float4>(Math::max(texture.width / 2, 1) * texture.height); // Intermediate storage used when performing seperable filtering
+
+	CUDAMemory::memcpy(ptr_levels, reinterpret_cast<const unsigned *>(texture.data.data()), texture.width * texture.height);
+
+	for (int level = 1; level < level_count; level++) {
+		// Box filter can downsample the previous Mip level, other filters downsample the original Texture for better quality
+		int level_src = cpu_config.mipmap_filter == MipmapFilterType::BOX ? level - 1 : 0;
+
+		int width_src  = Math::max(texture.width  >> level_src, 1);
+		int height_src = Math::max(texture.height >> level_src, 1);
+		int width_dst  = Math::max(texture.width  >> level, 1);
+		int height_dst = Math::max(texture.height >> level, 1);
+
+		Mipmap::FilterKernel filter_x = Mipmap::calc_filter_kernel(width_src,  width_dst);
+		Mipmap::FilterKernel filter_y = Mipmap::calc_filter_kernel(height_src, height_dst);
+
+		CUDAMemory::Ptr<float> ptr_weights_x = CUDAMemory::malloc(filter_x.weights);
+		CUDAMemory::Ptr<float> ptr_weights_y = CUDAMemory::malloc(filter_y.weights);
+
+		kernel_mipmap_downsample_x.set_grid_dim(Math::divide_round_up(width_dst, 16), Math::divide_round_up(height_src, 16), 1);
+		kernel_mipmap_downsample_x.execute(
+			width_src,
+			height_src,
+			width_dst,
+			ptr_levels + level_offsets[level_src],
+			ptr_temp,
+			ptr_weights_x,
+			int(filter_x.weights.size()),
+			filter_x.filter_width
+		);
+
+		kernel_mipmap_downsample_y.set_grid_dim(Math::divide_round_up(width_dst, 16), Math::divide_round_up(height_dst, 16), 1);
+		kernel_mipmap_downsample_y.execute(
+			height_src,
+			width_dst,
+			height_dst,
+			ptr_temp,
+			ptr_levels + level_offsets[level],
+			ptr_weights_y,
+			int(filter_y.weights.size()),
+			filter_y.filter_width
+		);
+
+		CUDAMemory::free(ptr_weights_x);
+		CUDAMemory::free(ptr_weights_y);
+	}
+
+	// Copy every level into the mipmapped CUDA array
+	for (int level = 0; level < level_count; level++) {
+		CUarray level_array;
+		CUDACALL(cuMipmappedArrayGetLevel(&level_array, array, level));
+
+		int level_width  = Math::max(texture.width  >> level, 1);
+		int level_height = Math::max(texture.height >> level, 1);
+
+		CUDAMemory::copy_array(level_array, level_width * sizeof(unsigned), level_height, (ptr_levels + level_offsets[level]).ptr);
+	}
+
+	CUDAMemory::free(ptr_levels);
+	CUDAMemory::free(ptr_temp);
+}
+
+static void pack_triangle(const IndexedTriangles & triangles, int index, int vertex_offset, GPUScene::CUDATriangle & cuda_triangle) {
+	const Vector3 & position_0 = triangles.vertices[triangles.indices[3 * index    ]].position;
+	const Vector3 & position_1 = triangles.vertices[triangles.indices[3 * index + 1]].position;
+	const Vector3 & position_2 = triangles.vertices[triangles.indices[3 * index + 2]].position;
+
+	cuda_triangle.position_0      = position_0;
+	cuda_triangle.position_edge_1 = position_1 - position_0;
+	cuda_triangle.position_edge_2 = position_2 - position_0;
+
+	cuda_triangle.vertex_0 = vertex_offset + triangles.indices[3 * index    ];
+	cuda_triangle.vertex_1 = vertex_offset + triangles.indices[3 * index + 1];
+	cuda_triangle.vertex_2 = vertex_offset + triangles.indices[3 * index + 2];
+}
+
+static void pack_vertex(const Vertex & vertex, GPUScene::CUDAVertex & cuda_vertex) {
+	cuda_vertex.tex_coord = vertex.tex_coord;
+	cuda_vertex.normal    = Math::oct_encode_normal(vertex.normal);
+	cuda_vertex.padding   = 0;
+}
+
+// Each individual BVH needs to put its Nodes in a shared aggregated array of BVH Nodes before being upload to the GPU
+// Child and Triangle indices are offset to where the BVH and its Triangles live in the aggregated arrays
+// With cpu_config.enable_out_of_core_geometry the driver pages the geometry between Host and Device on demand,
+// the BLASes that are traversed often stay resident in VRAM while the others are read over PCIe
+template<typename T>
+static CUDAMemory::Ptr<T> malloc_geometry(const Array<T> & data) {
+	if (cpu_config.enable_out_of_core_geometry) {
+		return CUDAMemory::malloc_managed(data);
+	}
+	return CUDAMemory::malloc(data);
+}
+
+static void offset_bvh_nodes(const BVH2 & bvh, BVHNode2 * dst, int index_offset, int bvh_offset) {
+	for (size_t n = 0; n < bvh.nodes.size(); n++) {
+		BVHNode2 & node = dst[n];
+		node = bvh.nodes[n];
+
+		if (node.is_leaf()) {
+			node.first += index_offset;
+		} else {
+			node.left += bvh_offset;
+		}
+	}
+}
+
+static void offset_bvh_nodes(const BVH4 & bvh, BVHNode4 * dst, int index_offset, int bvh_offset) {
+	for (size_t n = 0; n < bvh.nodes.size(); n++) {
+		BVHNode4 & node = dst[n];
+		node = bvh.nodes[n];
+
+		int child_count = node.get_child_count();
+		for (int c = 0; c < child_count; c++) {
+			if (node.is_leaf(c)) {
+				node.get_index(c) += index_offset;
+			} else {
+				node.get_index(c) += bvh_offset;
+			}
+		}
+	}
+}
+
+static void offset_bvh_nodes(const BVH8 & bvh, BVHNode8 * dst, int index_offset, int bvh_offset) {
+	for (size_t n = 0; n < bvh.nodes.size(); n++) {
+		BVHNode8 & node = dst[n];
+		node = bvh.nodes[n];
+
+		node.base_index_triangle += index_offset;
+		node.base_index_child    += bvh_offset;
+	}
+}
+
+// Aggregates the Triangles, Curves and BLAS Nodes of all MeshDatas and uploads them into the GPUScene
+void Integrator::upload_geometry() {
+	CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::GEOMETRY);
+
+	if (cpu_config.enable_out_of_core_geometry && !CUDAContext::supports_managed_oversubscription()) {
+		IO::print("WARNING: The Device does not support oversubscribing managed memory, out of core geometry is disabled!\n"_sv);
+		cpu_config.enable_out_of_core_geometry = false;
+	}
+
+	size_t mesh_data_count = scene.asset_manager.mesh_datas.size();
+
+	// A new GPUScene (hot reload, or after the resident data was invalidated) uploads from the host copies again
+	for (size_t i = 0; i < mesh_data_count; i++) {
+		scene.asset_manager.restore_host_data(Handle<MeshData> { int(i) });
+	}
+
+	gpu_scene->mesh_data_bvh_offsets     .resize(mesh_data_count);
+	gpu_scene->mesh_data_triangle_offsets.resize(mesh_data_count);
+	gpu_scene->mesh_data_vertex_offsets  .resize(mesh_data_count);
+	gpu_scene->mesh_data_index_offsets   .resize(mesh_data_count);
+
+	size_t aggregated_bvh_node_count = 2 * 2 * scene.meshes.size(); // Reserve 2 times Mesh count for each of the two TLAS buffers
+	size_t aggregated_triangle_count = 0;
+	size_t aggregated_vertex_count   = 0;
+	size_t aggregated_index_count    = 0;
+	size_t aggregated_curve_count    = 0;
+
+	for (size_t i = 0; i < mesh_data_count; i++) {
+		const MeshData & mesh_data = scene.asset_manager.mesh_datas[i];
+
+		gpu_scene->mesh_data_bvh_offsets     [i] = aggregated_bvh_node_count;
+		gpu_scene->mesh_data_triangle_offsets[i] = aggregated_triangle_count;
+		gpu_scene->mesh_data_vertex_offsets  [i] = aggregated_vertex_count;
+
+		aggregated_bvh_node_count += mesh_data.bvh->node_count();
+		aggregated_triangle_count += mesh_data.triangles.size();
+		aggregated_vertex_count   += mesh_data.triangles.vertices.size();
+
+		if (mesh_data.has_curves()) {
+			gpu_scene->mesh_data_index_offsets[i] = aggregated_curve_count;
+			aggregated_curve_count += mesh_data.bvh->indices.size();
+		} else {
+			gpu_scene->mesh_data_index_offsets[i] = aggregated_index_count;
+			aggregated_index_count += mesh_data.bvh->indices.size();
+		}
+	}
+
+	// The levels of detail are MeshDatas themselves, a chain only refers to their BLAS Nodes in the aggregated buffer
+	Array<MeshLODChain> lod_chains;
+	gpu_scene->mesh_data_lod_chains.resize(mesh_data_count);
+
+	for (size_t i = 0; i < mesh_data_count; i++) {
+		const MeshData & mesh_data = scene.asset_manager.mesh_datas[i];
+
+		if (mesh_data.lods.size() == 0 || mesh_data.has_curves()) {
+			gpu_scene->mesh_data_lod_chains[i] = INVALID;
+			continue;
+		}
+
+		MeshLODChain chain = { };
+		Vector3 center = mesh_data.aabb.get_center();
+		chain.center[0] = center.x;
+		chain.center[1] = center.y;
+		chain.center[2] = center.z;
+		chain.level_count       = 1 + int(mesh_data.lods.size());
+		chain.bvh_offsets   [0] = gpu_scene->mesh_data_bvh_offsets[i];
+		chain.triangle_sizes[0] = mesh_data.triangle_size;
+
+		for (size_t l = 0; l < mesh_data.lods.size(); l++) {
+			chain.bvh_offsets   [l + 1] = gpu_scene->mesh_data_bvh_offsets[mesh_data.lods[l].handle];
+			chain.triangle_sizes[l + 1] = scene.asset_manager.get_mesh_data(mesh_data.lods[l]).triangle_size;
+		}
+
+		gpu_scene->mesh_data_lod_chains[i] = int(lod_chains.size());
+		lod_chains.push_back(chain);
+	}
+
+	if (lod_chains.size() > 0) {
+		gpu_scene->ptr_lod_chains = CUDAMemory::malloc(lod_chains);
+	}
+
+	Array<GPUScene::CUDATriangle> aggregated_triangles(aggregated_index_count);
+	Array<GPUScene::CUDAVertex>   aggregated_vertices (aggregated_vertex_count);
+	Array<Curve>                  aggregated_curves   (aggregated_curve_count);
+	gpu_scene->reverse_indices.resize(aggregated_triangle_count);
+
+	// Every (MeshData, Triangle) pair writes to a unique slot, so all MeshDatas can be aggregated concurrently
+	ThreadPool::parallel_for(int(mesh_data_count), [&](int m) {
+		const MeshData & mesh_data = scene.asset_manager.mesh_datas[m];
+
+		if (mesh_data.has_curves()) {
+			for (size_t i = 0; i < mesh_data.bvh->indices.size(); i++) {
+				aggregated_curves[gpu_scene->mesh_data_index_offsets[m] + i] = mesh_data.curves[mesh_data.bvh->indices[i]];
+			}
+			return;
+		}
+
+		int vertex_offset = gpu_scene->mesh_data_vertex_offsets[m];
+
+		ThreadPool::parallel_for(0, int(mesh_data.bvh->indices.size()), 4096, [&](int first, int last) {
+			for (int i = first; i < last; i++) {
+				int index = mesh_data.bvh->indices[i];
+
+				pack_triangle(mesh_data.triangles, index, vertex_offset, aggregated_triangles[gpu_scene->mesh_data_index_offsets[m] + i]);
+
+				gpu_scene->reverse_indices[gpu_scene->mesh_data_triangle_offsets[m] + index] = gpu_scene->mesh_data_index_offsets[m] + i;
+			}
+		});
+
+		ThreadPool::parallel_for(0, int(mesh_data.triangles.vertices.size()), 4096, [&](int first, int last) {
+			for (int i = first; i < last; i++) {
+				pack_vertex(mesh_data.triangles.vertices[i], aggregated_vertices[vertex_offset + i]);
+			}
+		});
+	});
+
+	gpu_scene->ptr_triangles = malloc_geometry(aggregated_triangles);
+	gpu_scene->ptr_vertices  = malloc_geometry(aggregated_vertices);
+
+	if (aggregated_curve_count > 0) {
+		gpu_scene->ptr_curves = malloc_geometry(aggregated_curves);
+	}
+
+	CUDAMemory::CategoryScope memory_scope_bvh(CUDAMemory::Category::BVH);
+
+	switch (cpu_config.bvh_type) {
+		case BVHType::BVH:
+		case BVHType::SBVH: {
+			Array<BVHNode2> aggregated_bvh_nodes(aggregated_bvh_node_count);
+
+			for (int m = 0; m < mesh_data_count; m++) {
+				const MeshData & mesh_data = scene.asset_manager.mesh_datas[m];
+				const BVH2 * bvh = static_cast<const BVH2 *>(mesh_data.bvh.get());
+
+				int index_offset = gpu_scene->mesh_data_index_offsets[m];
+				int bvh_offset   = gpu_scene->mesh_data_bvh_offsets[m];
+
+				offset_bvh_nodes(*bvh, aggregated_bvh_nodes.data() + bvh_offset, index_offset, bvh_offset);
+			}
+
+			gpu_scene->ptr_bvh_nodes_2 = malloc_geometry(aggregated_bvh_nodes);
+			break;
+		}
+		case BVHType::BVH4: {
+			Array<BVHNode4> aggregated_bvh_nodes(aggregated_bvh_node_count);
+
+			for (int m = 0; m < mesh_data_count; m++) {
+				const MeshData & mesh_data = scene.asset_manager.mesh_datas[m];
+				const BVH4 * bvh = static_cast<const BVH4 *>(mesh_data.bvh.get());
+
+				int index_offset = gpu_scene->mesh_data_index_offsets[m];
+				int bvh_offset   = gpu_scene->mesh_data_bvh_offsets[m];
+
+				offset_bvh_nodes(*bvh, aggregated_bvh_nodes.data() + bvh_offset, index_offset, bvh_offset);
+			}
+
+			gpu_scene->ptr_bvh_nodes_4 = malloc_geometry(aggregated_bvh_nodes);
+			break;
+		}
+		case BVHType::BVH8: {
+			Array<BVHNode8> aggregated_bvh_nodes(aggregated_bvh_node_count);
+
+			for (int m = 0; m < mesh_data_count; m++) {
+				const MeshData & mesh_data = scene.asset_manager.mesh_datas[m];
+				const BVH8 * bvh = static_cast<const BVH8 *>(mesh_data.bvh.get());
+
+				int index_offset = gpu_scene->mesh_data_index_offsets[m];
+				int bvh_offset   = gpu_scene->mesh_data_bvh_offsets[m];
+
+				offset_bvh_nodes(*bvh, aggregated_bvh_nodes.data() + bvh_offset, index_offset, bvh_offset);
+			}
+
+			gpu_scene->ptr_bvh_nodes_8 = malloc_geometry(aggregated_bvh_nodes);
+			break;
+		}
+	}
+
+	gpu_scene->has_geometry = true;
+}
+
+void Integrator::init_geometry() {
+	ProfileScope scope("Geometry Upload"_sv);
+
+	CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::GEOMETRY);
+
+	// The bounds are computed once per MeshData when it is loaded, instances only copy them
+	for (int i = 0; i < scene.meshes.size(); i++) {
+		scene.meshes[i].calc_aabb(scene);
+	}
+
+	if (!gpu_scene->has_geometry) {
+		upload_geometry();
+	}
+
+	cuda_module.get_global("triangles")        .set_value(gpu_scene->ptr_triangles);
+	cuda_module.get_global("triangle_vertices").set_value(gpu_scene->ptr_vertices);
+
+	if (gpu_scene->ptr_curves.ptr != NULL) {
+		cuda_module.get_global("curves").set_value(gpu_scene->ptr_curves);
+	}
+	if (gpu_scene->ptr_lod_chains.ptr != NULL) {
+		cuda_module.get_global("lod_chains").set_value(gpu_scene->ptr_lod_chains);
+	}
+
+	pinned_light_mesh_alias_table       = CUDAMemory::malloc_pinned<AliasTable::Entry>(scene.meshes.size());
+	pinned_light_mesh_triangle_span     = CUDAMemory::malloc_pinned<int2>             (scene.meshes.size());
+	pinned_light_mesh_transform_indices = CUDAMemory::malloc_pinned<int>              (scene.meshes.size());
+
+	for (int b = 0; b < 2; b++) {
+		TLASBuffer & buffer = tlas_buffers[b];
+
+		buffer.pinned_mesh_bvh_root_indices = CUDAMemory::malloc_pinned<int>      (scene.meshes.size());
+		buffer.pinned_mesh_material_ids     = CUDAMemory::malloc_pinned<int>      (scene.meshes.size());
+		buffer.pinned_mesh_alpha_mask_ids   = CUDAMemory::malloc_pinned<int>      (scene.meshes.size());
+		buffer.pinned_mesh_lod_chain_ids    = CUDAMemory::malloc_pinned<int>      (scene.meshes.size());
+		buffer.pinned_mesh_transforms       = CUDAMemory::malloc_pinned<Matrix3x4>(scene.meshes.size());
+		buffer.pinned_mesh_transforms_inv   = CUDAMemory::malloc_pinned<Matrix3x4>(scene.meshes.size());
+		buffer.pinned_mesh_transforms_prev  = CUDAMemory::malloc_pinned<Matrix3x4>(scene.meshes.size());
+
+		buffer.ptr_mesh_bvh_root_indices = CUDAMemory::malloc<int>      (scene.meshes.size());
+		buffer.ptr_mesh_material_ids     = CUDAMemory::malloc<int>      (scene.meshes.size());
+		buffer.ptr_mesh_alpha_mask_ids   = CUDAMemory::malloc<int>      (scene.meshes.size());
+		buffer.ptr_mesh_lod_chain_ids    = CUDAMemory::malloc<int>      (scene.meshes.size());
+		buffer.ptr_mesh_transforms       = CUDAMemory::malloc<Matrix3x4>(scene.meshes.size());
+		buffer.ptr_mesh_transforms_inv   = CUDAMemory::malloc<Matrix3x4>(scene.meshes.size());
+		buffer.ptr_mesh_transforms_prev  = CUDAMemory::malloc<Matrix3x4>(scene.meshes.size());
+
+		buffer.tlas_raw.indices.resize(scene.meshes.size());
+		buffer.tlas_raw.nodes  .resize(scene.meshes.size() * 2);
+		if (cpu_config.tlas_builder == BVHBuilderType::BINNED) {
+			buffer.tlas_builder_binned = make_owned<BinnedSAHBuilder>(buffer.tlas_raw, scene.meshes.size());
+		} else {
+			buffer.tlas_builder = make_owned<SAHBuilder>(buffer.tlas_raw, scene.meshes.size());
+		}
+		buffer.refit_valid  = false;
+		buffer.node_offset  = b * 2 * scene.meshes.size();
+	}
+
+	tlas_front    = 0;
+	tlas_rendered = 0;
+	tlas          = nullptr;
+	tlas_updated  = false;
+
+	CUDACALL(cuEventCreate(&tlas_event_rendered, CU_EVENT_DISABLE_TIMING));
+
+	pick_buffer.origin   .init(1, cpu_config.enable_packed_ray_buffers);
+	pick_buffer.direction.init(1, cpu_config.enable_packed_ray_buffers);
+	pick_buffer.hits = CUDAMemory::malloc<float4>(1);
+	cuda_module.get_global("pick_traversal_data").set_value(pick_buffer);
+
+	pinned_pick_hit = CUDAMemory::malloc_pinned<int4>();
+	CUDACALL(cuEventCreate(&event_pick, CU_EVENT_DISABLE_TIMING));
+
+	kernel_pick_generate.init(&cuda_module, "kernel_pick_generate");
+	kernel_pick_bvh2    .init(&cuda_module, "kernel_pick_bvh2");
+	kernel_pick_bvh4    .init(&cuda_module, "kernel_pick_bvh4");
+	kernel_pick_bvh8    .init(&cuda_module, "kernel_pick_bvh8");
+
+	kernel_pick_generate.set_grid_dim (1, 1, 1);
+	kernel_pick_generate.set_block_dim(1, 1, 1);
+
+	// A single warp, with the Shared Memory that its part of the traversal Stack needs (see kernel_trace_calc_grid_and_block_size)
+	kernel_pick_bvh2.set_grid_dim(1, 1, 1);
+	kernel_pick_bvh4.set_grid_dim(1, 1, 1);
+	kernel_pick_bvh8.set_grid_dim(1, 1, 1);
+
+	kernel_pick_bvh2.set_block_dim(WARP_SIZE, 1, 1);
+	kernel_pick_bvh4.set_block_dim(WARP_SIZE, 1, 1);
+	kernel_pick_bvh8.set_block_dim(WARP_SIZE, 1, 1);
+
+	kernel_pick_bvh2.set_shared_memory(WARP_SIZE * SHARED_STACK_SIZE * 4);
+	kernel_pick_bvh4.set_shared_memory(WARP_SIZE * SHARED_STACK_SIZE * 4);
+	kernel_pick_bvh8.set_shared_memory(cpu_config.enable_bvh8_short_stack ? 0 : WARP_SIZE * SHARED_STACK_SIZE * 8);
+
+	pixel_query_status = PixelQueryStatus::INACTIVE;
+
+	switch (cpu_config.bvh_type) {
+		case BVHType::BVH:
+		case BVHType::SBVH: {
+			kernel_pick = &kernel_pick_bvh2;
+
+			cuda_module.get_global("bvh2_nodes").set_value(gpu_scene->ptr_bvh_nodes_2);
+
+			for (int b = 0; b < 2; b++) {
+				TLASBuffer & buffer = tlas_buffers[b];
+				buffer.tlas           = make_owned<BVH2>();
+				buffer.tlas_converter = make_owned<BVH2Converter>(static_cast<BVH2 &>(*buffer.tlas.get()), buffer.tlas_raw);
+				buffer.pinned_nodes   = CUDAMemory::malloc_pinned<BVHNode2>(2 * scene.meshes.size());
+			}
+			break;
+		}
+		case BVHType::BVH4: {
+			kernel_pick = &kernel_pick_bvh4;
+
+			cuda_module.get_global("bvh4_nodes").set_value(gpu_scene->ptr_bvh_nodes_4);
+
+			for (int b = 0; b < 2; b++) {
+				TLASBuffer & buffer = tlas_buffers[b];
+				buffer.tlas           = make_owned<BVH4>();
+				buffer.tlas_converter = make_owned<BVH4Converter>(static_cast<BVH4 &>(*buffer.tlas.get()), buffer.tlas_raw);
+				buffer.pinned_nodes   = CUDAMemory::malloc_pinned<BVHNode4>(2 * scene.meshes.size());
+			}
+			break;
+		}
+		case BVHType::BVH8: {
+			kernel_pick = &kernel_pick_bvh8;
+
+			cuda_module.get_global("bvh8_nodes").set_value(gpu_scene->ptr_bvh_nodes_8);
+
+			for (int b = 0; b < 2; b++) {
+				TLASBuffer & buffer = tlas_buffers[b];
+				buffer.tlas           = make_owned<BVH8>();
+				buffer.tlas_converter = make_owned<BVH8Converter>(static_cast<BVH8 &>(*buffer.tlas.get()), buffer.tlas_raw);
+				buffer.pinned_nodes   = CUDAMemory::malloc_pinned<BVHNode8>(2 * scene.meshes.size());
+			}
+			break;
+		}
+	}
+}
+
+void Integrator::release_host_data() {
+	ProfileScope scope("Host Data Release"_sv);
+
+	ThreadPool::sync(); // MeshData is read back from its BVH file or BVH cache entry, which are written in the background
+
+	AssetManager & asset_manager = scene.asset_manager;
+
+	Array<bool> mesh_data_is_light(asset_manager.mesh_datas.size());
+	for (size_t i = 0; i < mesh_data_is_light.size(); i++) {
+		mesh_data_is_light[i] = false;
+	}
+	for (size_t m = 0; m < scene.meshes.size(); m++) {
+		const Mesh & mesh = scene.meshes[m];
+		if (asset_manager.get_material(mesh.material_handle).is_light()) {
+			mesh_data_is_light[mesh.mesh_data_handle.handle] = true;
+		}
+	}
+
+	size_t mesh_data_count = 0;
+	size_t mesh_data_bytes = 0;
+
+	if (gpu_scene->has_geometry) {
+		for (size_t i = 0; i < asset_manager.mesh_datas.size(); i++) {
+			if (mesh_data_is_light[i]) continue;
+
+			size_t num_bytes = asset_manager.release_host_data(Handle<MeshData> { int(i) });
+			if (num_bytes > 0) {
+				mesh_data_count++;
+				mesh_data_bytes += num_bytes;
+			}
+		}
+	}
+
+	size_t texture_count = 0;
+	size_t texture_bytes = 0;
+
+	// With streaming the Mip levels are recreated from the host copy whenever they are requested
+	if (gpu_scene->has_textures && !cpu_config.enable_texture_streaming) {
+		for (size_t i = 0; i < asset_manager.textures.size(); i++) {
+			size_t num_bytes = asset_manager.release_host_data(Handle<Texture> { int(i) });
+			if (num_bytes > 0) {
+				texture_count++;
+				texture_bytes += num_bytes;
+			}
+		}
+	}
+
+	IO::print("Released host copies of {} MeshDatas ({} MB) and {} Textures ({} MB)\n"_sv, mesh_data_count, mesh_data_bytes >> 20, texture_count, texture_bytes >> 20);
+}
+
+void Integrator::update_mesh_data(Handle<MeshData> mesh_data_handle, const Array<Triangle> & triangles) {
+	ProfileScope scope("Mesh Data Update"_sv);
+
+	scene.asset_manager.restore_host_data(mesh_data_handle); // The refit needs the BVH Nodes
+
+	MeshData & mesh_data = scene.asset_manager.get_mesh_data(mesh_data_handle);
+	ASSERT(triangles.size() == mesh_data.triangles.size());
+
+	if (mesh_data.has_curves()) {
+		IO::print("WARNING: MeshData {} consists of Curves and cannot be updated!\n"_sv, mesh_data_handle.handle);
+		return;
+	}
+
+	if (cpu_config.bvh_type == BVHType::BVH4) {
+		IO::print("WARNING: BVH4 cannot be refitted, MeshData {} was not updated!\n"_sv, mesh_data_handle.handle);
+		return;
+	}
+
+	mesh_data.triangles.update_vertices(triangles);
+
+	int m             = mesh_data_handle.handle;
+	int index_offset  = gpu_scene->mesh_data_index_offsets[m];
+	int vertex_offset = gpu_scene->mesh_data_vertex_offsets[m];
+	int bvh_offset    = gpu_scene->mesh_data_bvh_offsets[m];
+
+	const Array<int>    & indices  = mesh_data.bvh->indices;
+	const Array<Vertex> & vertices = mesh_data.triangles.vertices;
+
+	Array<GPUScene::CUDATriangle> cuda_triangles(indices.size());
+	Array<GPUScene::CUDAVertex>   cuda_vertices (vertices.size());
+
+	ThreadPool::parallel_for(0, int(indices.size()), 4096, [&](int first, int last) {
+		for (int i = first; i < last; i++) {
+			pack_triangle(mesh_data.triangles, indices[i], vertex_offset, cuda_triangles[i]);
+		}
+	});
+	ThreadPool::parallel_for(0, int(vertices.size()), 4096, [&](int first, int last) {
+		for (int i = first; i < last; i++) {
+			pack_vertex(vertices[i], cuda_vertices[i]);
+		}
+	});
+
+	// The previous frame may still be tracing the old data, the copies below have to wait for it on the memory stream
+	CUDACALL(cuEventRecord(tlas_event_rendered, nullptr));
+	CUDACALL(cuStreamWaitEvent(memory_stream, tlas_event_rendered, 0));
+
+	CUDAMemory::memcpy_async(gpu_scene->ptr_triangles + index_offset,  cuda_triangles.data(), indices .size(), memory_stream);
+	CUDAMemory::memcpy_async(gpu_scene->ptr_vertices  + vertex_offset, cuda_vertices .data(), vertices.size(), memory_stream);
+
+	switch (cpu_config.bvh_type) {
+		case BVHType::BVH:
+		case BVHType::SBVH: {
+			BVH2 * bvh = static_cast<BVH2 *>(mesh_data.bvh.get());
+			bvh->refit(mesh_data.triangles);
+
+			Array<BVHNode2> nodes(bvh->nodes.size());
+			offset_bvh_nodes(*bvh, nodes.data(), index_offset, bvh_offset);
+
+			CUDAMemory::memcpy_async(gpu_scene->ptr_bvh_nodes_2 + bvh_offset, nodes.data(), nodes.size(), memory_stream);
+			break;
+		}
+		case BVHType::BVH8: {
+			BVH8 * bvh = static_cast<BVH8 *>(mesh_data.bvh.get());
+			bvh->refit(mesh_data.triangles);
+
+			Array<BVHNode8> nodes(bvh->nodes.size());
+			offset_bvh_nodes(*bvh, nodes.data(), index_offset, bvh_offset);
+
+			CUDAMemory::memcpy_async(gpu_scene->ptr_bvh_nodes_8 + bvh_offset, nodes.data(), nodes.size(), memory_stream);
+			break;
+		}
+		default: ASSERT_UNREACHABLE();
+	}
+
+	mesh_data.calc_aabb(); // After refitting, so that the root of a BVH2 can be used
+
+	// The TLAS needs to be refitted to the new bounds of every Mesh that uses this MeshData
+	for (int i = 0; i < scene.meshes.size(); i++) {
+		Mesh & mesh = scene.meshes[i];
+		if (mesh.mesh_data_handle.handle != m) continue;
+
+		mesh.calc_aabb(scene);
+
+		// The light sampling data is derived from the Triangles
+		if (scene.asset_manager.get_material(mesh.material_handle).is_light()) {
+			invalidated_materials = true;
+		}
+	}
+	invalidated_scene = true;
+
+	// The texture coordinates may have changed as well
+	if (alpha_mask_count > 0 && mesh_data_alpha_mask_ids[m] != INVALID) {
+		classify_alpha_mask(m, memory_stream);
+	}
+
+	on_mesh_data_updated(m);
+}
+
+void Integrator::init_alpha_masks() {
+	CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::TEXTURES);
+
+	const Array<Material> & materials = scene.asset_manager.materials;
+
+	size_t material_count  = materials.size();
+	size_t texture_count   = scene.asset_manager.textures.size();
+	size_t mesh_data_count = scene.asset_manager.mesh_datas.size();
+
+	alpha_mask_count = 0;
+
+	material_alpha_mask_ids .resize(material_count);
+	mesh_data_alpha_mask_ids.resize(mesh_data_count);
+
+	for (size_t i = 0; i < material_count;  i++) material_alpha_mask_ids [i] = INVALID;
+	for (size_t i = 0; i < mesh_data_count; i++) mesh_data_alpha_mask_ids[i] = INVALID;
+
+	// Materials can share an alpha Texture, each Texture gets at most one mask
+	Array<int>  texture_alpha_mask_ids(texture_count);
+	Array<bool> texture_is_alpha      (texture_count);
+
+	for (size_t i = 0; i < texture_count; i++) {
+		texture_alpha_mask_ids[i] = INVALID;
+		texture_is_alpha      [i] = false;
+	}
+
+	Array<int> alpha_texture_ids;
+	for (size_t i = 0; i < material_count; i++) {
+		int texture_id = materials[i].alpha_texture_handle.handle;
+
+		if (texture_id != INVALID && !texture_is_alpha[texture_id]) {
+			texture_is_alpha[texture_id] = true;
+			alpha_texture_ids.push_back(texture_id);
+		}
+	}
+	if (alpha_texture_ids.size() == 0) return;
+
+	// The Kernels sample the Textures, the last Mip levels may still be in flight
+	CUDACALL(cuStreamSynchronize(texture_upload_stream));
+
+	kernel_alpha_mask_build   .init(&cuda_module, "kernel_alpha_mask_build");
+	kernel_alpha_mask_classify.init(&cuda_module, "kernel_alpha_mask_classify");
+
+	kernel_alpha_mask_build   .set_block_dim(256, 1, 1);
+	kernel_alpha_mask_classify.set_block_dim(256, 1, 1);
 
-#include "Util/BlueNoise.h"
+	// The mask is taken from the finest resident Mip level that fits within ALPHA_MASK_MAX_SIZE
+	auto get_mask_size = [&](int texture_id, int & level, int & width, int & height) {
+		const Texture & texture = scene.asset_manager.textures[texture_id];
 
-void Integrator::init_globals() {
-	global_camera      = cuda_module.get_global("camera");
-	global_config      = cuda_module.get_global("config");
-	global_pixel_query = cuda_module.get_global("pixel_query");
-	global_aovs        = cuda_module.get_global("aovs");
-}
+		int texels_per_element = texture.format == Texture::Format::RGBA ? 1 : 4; // Block Compressed Textures store their size in blocks
+		int level_count        = texture.get_mip_level_count();
 
-void Integrator::init_materials() {
-	ptr_material_types = CUDAMemory::malloc<Material::Type>(scene.asset_manager.materials.size());
-	ptr_materials      = CUDAMemory::malloc<CUDAMaterial>  (scene.asset_manager.materials.size());
-	cuda_module.get_global("material_types").set_value(ptr_material_types);
-	cuda_module.get_global("materials")     .set_value(ptr_materials);
+		level = gpu_scene->textures[texture_id].mip_offset;
+		while (level < level_count - 1 && Math::max(texture.width >> level, texture.height >> level) * texels_per_element > ALPHA_MASK_MAX_SIZE) {
+			level++;
+		}
 
-	scene.asset_manager.wait_until_loaded();
+		width  = Math::max(texture.width  >> level, 1) * texels_per_element;
+		height = Math::max(texture.height >> level, 1) * texels_per_element;
+	};
 
-	ptr_media = CUDAMemory::malloc<CUDAMedium>(scene.asset_manager.media.size());
-	cuda_module.get_global("media").set_value(ptr_media);
+	size_t mask_bits_size = 0;
 
-	// Set global Texture table
-	size_t texture_count = scene.asset_manager.textures.size();
-	if (texture_count > 0) {
-		textures      .resize(texture_count);
-		texture_arrays.resize(texture_count);
+	for (size_t i = 0; i < alpha_texture_ids.size(); i++) {
+		int level, width, height;
+		get_mask_size(alpha_texture_ids[i], level, width, height);
 
-		// Get maximum anisotropy from OpenGL
-		int max_aniso;
-		glGetIntegerv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &max_aniso);
+		mask_bits_size += Math::divide_round_up(width * height, 32);
+	}
 
-		for (int i = 0; i < texture_count; i++) {
-			const Texture & texture = scene.asset_manager.textures[i];
+	ptr_alpha_mask_bits = CUDAMemory::malloc<unsigned>(mask_bits_size);
+	CUDAMemory::Ptr<int> ptr_transparent_count = CUDAMemory::malloc<int>();
 
-			// Create mipmapped CUDA array
-			texture_arrays[i] = CUDAMemory::create_array_mipmap(
-				texture.width,
-				texture.height,
-				texture.channels,
-				texture.get_cuda_array_format(),
-				texture.mip_levels()
-			);
+	Array<CUDAAlphaMask> alpha_masks;
+	int                  alpha_mask_offset = 0;
 
-			// Upload each level of the mipmap
-			for (int level = 0; level < texture.mip_levels(); level++) {
-				CUarray level_array;
-				CUDACALL(cuMipmappedArrayGetLevel(&level_array, texture_arrays[i], level));
+	for (size_t i = 0; i < alpha_texture_ids.size(); i++) {
+		int texture_id = alpha_texture_ids[i];
 
-				int level_width_in_bytes = texture.get_width_in_bytes(level);
-				int level_height         = Math::max(texture.height >> level, 1);
+		int level, width, height;
+		get_mask_size(texture_id, level, width, height);
 
-				CUDAMemory::copy_array(level_array, level_width_in_bytes, level_height, texture.data.data() + texture.mip_offsets[level]);
-			}
+		float lod = float(level - gpu_scene->textures[texture_id].mip_offset);
 
-			// Describe the Array to read from
-			CUDA_RESOURCE_DESC res_desc = { };
-			res_desc.resType = CUresourcetype::CU_RESOURCE_TYPE_MIPMAPPED_ARRAY;
-			res_desc.res.mipmap.hMipmappedArray = texture_arrays[i];
-
-			// Describe how to sample the Texture
-			CUDA_TEXTURE_DESC tex_desc = { };
-			tex_desc.addressMode[0] = CUaddress_mode::CU_TR_ADDRESS_MODE_WRAP;
-			tex_desc.addressMode[1] = CUaddress_mode::CU_TR_ADDRESS_MODE_WRAP;
-			tex_desc.addressMode[2] = CUaddress_mode::CU_TR_ADDRESS_MODE_CLAMP;
-			tex_desc.filterMode       = CUfilter_mode::CU_TR_FILTER_MODE_LINEAR;
-			tex_desc.mipmapFilterMode = CUfilter_mode::CU_TR_FILTER_MODE_LINEAR;
-			tex_desc.mipmapLevelBias = 0.0f;
-			tex_desc.maxAnisotropy = max_aniso;
-			tex_desc.minMipmapLevelClamp = 0.0f;
-			tex_desc.maxMipmapLevelClamp = float(texture.mip_levels() - 1);
-			tex_desc.flags = CU_TRSF_NORMALIZED_COORDINATES;
-
-			// Describe the Texture View
-			CUDA_RESOURCE_VIEW_DESC view_desc = { };
-			view_desc.format = texture.get_cuda_resource_view_format();
-			view_desc.width  = texture.get_cuda_resource_view_width();
-			view_desc.height = texture.get_cuda_resource_view_height();
-			view_desc.firstMipmapLevel = 0;
-			view_desc.lastMipmapLevel  = texture.mip_levels() - 1;
+		kernel_alpha_mask_build.set_grid_dim(Math::divide_round_up(width * height, 256), 1, 1);
 
-			CUDACALL(cuTexObjectCreate(&textures[i].texture, &res_desc, &tex_desc, &view_desc));
+		// The opacity is the alpha channel, Textures without one (e.g. greyscale opacity maps) use their first channel instead
+		int transparent_count = 0;
+		for (int channel : { 3, 0 }) {
+			CUDAMemory::memset_async(ptr_transparent_count, 0, 1, nullptr);
+			kernel_alpha_mask_build.execute(texture_id, channel, lod, width, height, ptr_alpha_mask_bits + alpha_mask_offset, ptr_transparent_count);
+			CUDAMemory::memcpy(&transparent_count, ptr_transparent_count);
 
-			textures[i].lod_bias = 0.5f * log2f(float(texture.width * texture.height));
+			if (transparent_count > 0) break;
 		}
 
-		ptr_textures = CUDAMemory::malloc(textures);
-		cuda_module.get_global("textures").set_value(ptr_textures);
+		// An alpha Texture without any cut out texels does not need a mask, its space is reused by the next one
+		if (transparent_count > 0) {
+			texture_alpha_mask_ids[texture_id] = int(alpha_masks.size());
+			alpha_masks.push_back({ width, height, alpha_mask_offset, 0 });
+
+			alpha_mask_offset += Math::divide_round_up(width * height, 32);
+		}
 	}
-}
 
-void Integrator::init_geometry() {
-	for (size_t i = 0; i < scene.meshes.size(); i++) {
-		scene.meshes[i].calc_aabb(scene);
+	for (size_t i = 0; i < material_count; i++) {
+		int texture_id = materials[i].alpha_texture_handle.handle;
+		if (texture_id != INVALID) {
+			material_alpha_mask_ids[i] = texture_alpha_mask_ids[texture_id];
+		}
 	}
 
-	size_t mesh_data_count = scene.asset_manager.mesh_datas.size();
+	CUDAMemory::free(ptr_transparent_count);
 
-	mesh_data_bvh_offsets     .resize(mesh_data_count);
-	mesh_data_triangle_offsets.resize(mesh_data_count);
+	alpha_mask_count = int(alpha_masks.size());
+	if (alpha_mask_count == 0) {
+		CUDAMemory::free(ptr_alpha_mask_bits);
+		return;
+	}
 
-	Array<int> mesh_data_index_offsets(mesh_data_count);
+	ptr_alpha_masks = CUDAMemory::malloc(alpha_masks);
 
-	size_t aggregated_bvh_node_count = 2 * scene.meshes.size(); // Reserve 2 times Mesh count for TLAS
-	size_t aggregated_triangle_count = 0;
-	size_t aggregated_index_count    = 0;
+	cuda_module.get_global("alpha_masks")    .set_value(ptr_alpha_masks);
+	cuda_module.get_global("alpha_mask_bits").set_value(ptr_alpha_mask_bits);
 
-	for (size_t i = 0; i < mesh_data_count; i++) {
-		mesh_data_bvh_offsets     [i] = aggregated_bvh_node_count;
-		mesh_data_triangle_offsets[i] = aggregated_triangle_count;
-		mesh_data_index_offsets   [i] = aggregated_index_count;
+	// Every aggregated Triangle gets a state, they start out UNKNOWN
+	size_t triangle_count = 0;
+	for (size_t m = 0; m < mesh_data_count; m++) {
+		const MeshData & mesh_data = scene.asset_manager.mesh_datas[m];
+		if (mesh_data.has_curves()) continue;
 
-		aggregated_bvh_node_count += scene.asset_manager.mesh_datas[i].bvh->node_count();
-		aggregated_triangle_count += scene.asset_manager.mesh_datas[i].triangles.size();
-		aggregated_index_count    += scene.asset_manager.mesh_datas[i].bvh->indices.size();;
+		triangle_count = Math::max(triangle_count, size_t(gpu_scene->mesh_data_index_offsets[m]) + mesh_data.bvh->indices.size());
 	}
 
-	Array<CUDATriangle> aggregated_triangles(aggregated_index_count);
-	reverse_indices.resize(aggregated_triangle_count);
+	size_t triangle_state_count = Math::max(Math::divide_round_up(triangle_count, size_t(16)), size_t(1));
 
-	for (int m = 0; m < mesh_data_count; m++) {
-		const MeshData & mesh_data = scene.asset_manager.mesh_datas[m];
+	ptr_alpha_mask_triangle_states = CUDAMemory::malloc<unsigned>(triangle_state_count);
+	CUDAMemory::memset_async(ptr_alpha_mask_triangle_states, 0, triangle_state_count, nullptr);
 
-		for (size_t i = 0; i < mesh_data.bvh->indices.size(); i++) {
-			int index = mesh_data.bvh->indices[i];
-			const Triangle & triangle = mesh_data.triangles[index];
+	cuda_module.get_global("alpha_mask_triangle_states").set_value(ptr_alpha_mask_triangle_states);
 
-			aggregated_triangles[mesh_data_index_offsets[m] + i].position_0      = triangle.position_0;
-			aggregated_triangles[mesh_data_index_offsets[m] + i].position_edge_1 = triangle.position_1 - triangle.position_0;
-			aggregated_triangles[mesh_data_index_offsets[m] + i].position_edge_2 = triangle.position_2 - triangle.position_0;
+	// A MeshData can only be classified against a single alpha mask, if its instances use different ones it is left unclassified
+	Array<bool> mesh_data_has_conflict(mesh_data_count);
+	for (size_t m = 0; m < mesh_data_count; m++) {
+		mesh_data_has_conflict[m] = false;
+	}
 
-			aggregated_triangles[mesh_data_index_offsets[m] + i].normal_0      = triangle.normal_0;
-			aggregated_triangles[mesh_data_index_offsets[m] + i].normal_edge_1 = triangle.normal_1 - triangle.normal_0;
-			aggregated_triangles[mesh_data_index_offsets[m] + i].normal_edge_2 = triangle.normal_2 - triangle.normal_0;
+	for (size_t i = 0; i < scene.meshes.size(); i++) {
+		const Mesh & mesh = scene.meshes[i];
 
-			aggregated_triangles[mesh_data_index_offsets[m] + i].tex_coord_0      = triangle.tex_coord_0;
-			aggregated_triangles[mesh_data_index_offsets[m] + i].tex_coord_edge_1 = triangle.tex_coord_1 - triangle.tex_coord_0;
-			aggregated_triangles[mesh_data_index_offsets[m] + i].tex_coord_edge_2 = triangle.tex_coord_2 - triangle.tex_coord_0;
+		int alpha_mask_id = material_alpha_mask_ids[mesh.material_handle.handle];
+		if (alpha_mask_id == INVALID) continue;
 
-			reverse_indices[mesh_data_triangle_offsets[m] + index] = mesh_data_index_offsets[m] + i;
+		int & mesh_data_alpha_mask_id = mesh_data_alpha_mask_ids[mesh.mesh_data_handle.handle];
+		if (mesh_data_alpha_mask_id == INVALID) {
+			mesh_data_alpha_mask_id = alpha_mask_id;
+		} else if (mesh_data_alpha_mask_id != alpha_mask_id) {
+			mesh_data_has_conflict[mesh.mesh_data_handle.handle] = true;
 		}
 	}
 
-	ptr_triangles = CUDAMemory::malloc(aggregated_triangles);
-	cuda_module.get_global("triangles").set_value(ptr_triangles);
+	int mesh_datas_classified = 0;
 
-	pinned_mesh_bvh_root_indices             = CUDAMemory::malloc_pinned<int>      (scene.meshes.size());
-	pinned_mesh_material_ids                 = CUDAMemory::malloc_pinned<int>      (scene.meshes.size());
-	pinned_mesh_transforms                   = CUDAMemory::malloc_pinned<Matrix3x4>(scene.meshes.size());
-	pinned_mesh_transforms_inv               = CUDAMemory::malloc_pinned<Matrix3x4>(scene.meshes.size());
-	pinned_mesh_transforms_prev              = CUDAMemory::malloc_pinned<Matrix3x4>(scene.meshes.size());
-	pinned_light_mesh_cumulative_probability = CUDAMemory::malloc_pinned<float>    (scene.meshes.size());
-	pinned_light_mesh_triangle_span          = CUDAMemory::malloc_pinned<int2>     (scene.meshes.size());
-	pinned_light_mesh_transform_indices      = CUDAMemory::malloc_pinned<int>      (scene.meshes.size());
-
-	ptr_mesh_bvh_root_indices = CUDAMemory::malloc<int>      (scene.meshes.size());
-	ptr_mesh_material_ids     = CUDAMemory::malloc<int>      (scene.meshes.size());
-	ptr_mesh_transforms       = CUDAMemory::malloc<Matrix3x4>(scene.meshes.size());
-	ptr_mesh_transforms_inv   = CUDAMemory::malloc<Matrix3x4>(scene.meshes.size());
-	ptr_mesh_transforms_prev  = CUDAMemory::malloc<Matrix3x4>(scene.meshes.size());
-
-	cuda_module.get_global("mesh_bvh_root_indices").set_value(ptr_mesh_bvh_root_indices);
-	cuda_module.get_global("mesh_material_ids")    .set_value(ptr_mesh_material_ids);
-	cuda_module.get_global("mesh_transforms")      .set_value(ptr_mesh_transforms);
-	cuda_module.get_global("mesh_transforms_inv")  .set_value(ptr_mesh_transforms_inv);
-	cuda_module.get_global("mesh_transforms_prev") .set_value(ptr_mesh_transforms_prev);
+	for (size_t m = 0; m < mesh_data_count; m++) {
+		if (mesh_data_has_conflict[m] || scene.asset_manager.mesh_datas[m].has_curves()) {
+			mesh_data_alpha_mask_ids[m] = INVALID;
+		} else if (mesh_data_alpha_mask_ids[m] != INVALID) {
+			classify_alpha_mask(int(m), nullptr);
+			mesh_datas_classified++;
+		}
+	}
 
-	tlas_raw.indices.resize(scene.meshes.size());
-	tlas_raw.nodes  .resize(scene.meshes.size() * 2);
-	tlas_builder = make_owned<SAHBuilder>(tlas_raw, scene.meshes.size());
+	IO::print("Alpha masks: {} ({} KB), {} MeshDatas classified\n"_sv, alpha_mask_count, (alpha_mask_offset * sizeof(unsigned)) >> 10, mesh_datas_classified);
+}
 
-	switch (cpu_config.bvh_type) {
-		case BVHType::BVH:
-		case BVHType::SBVH: {
-			Array<BVHNode2> aggregated_bvh_nodes(aggregated_bvh_node_count);
+void Integrator::classify_alpha_mask(int mesh_data_index, CUstream stream) {
+	const MeshData & mesh_data = scene.asset_manager.mesh_datas[mesh_data_index];
 
-			// Each individual BVH needs to put its Nodes in a shared aggregated array of BVH Nodes before being upload to the GPU
-			// The procedure to do this is different for each BVH type
-			for (int m = 0; m < mesh_data_count; m++) {
-				const MeshData & mesh_data = scene.asset_manager.mesh_datas[m];
-				const BVH2 * bvh = static_cast<const BVH2 *>(mesh_data.bvh.get());
+	int triangle_count = int(mesh_data.bvh->indices.size());
+	if (triangle_count == 0) return;
 
-				int index_offset = mesh_data_index_offsets[m];
-				int bvh_offset   = mesh_data_bvh_offsets[m];
+	kernel_alpha_mask_classify.set_grid_dim(Math::divide_round_up(triangle_count, 256), 1, 1);
+	kernel_alpha_mask_classify.execute_on_stream(stream,
+		mesh_data_alpha_mask_ids[mesh_data_index],
+		gpu_scene->mesh_data_index_offsets[mesh_data_index],
+		triangle_count,
+		ptr_alpha_mask_triangle_states
+	);
+}
 
-				BVHNode2 * dst = aggregated_bvh_nodes.data() + bvh_offset;
+void Integrator::free_alpha_masks() {
+	if (alpha_mask_count > 0) {
+		CUDAMemory::free(ptr_alpha_masks);
+		CUDAMemory::free(ptr_alpha_mask_bits);
+		CUDAMemory::free(ptr_alpha_mask_triangle_states);
+	}
 
-				for (size_t n = 0; n < bvh->nodes.size(); n++) {
-					BVHNode2 & node = dst[n];
-					node = bvh->nodes[n];
+	alpha_mask_count = 0;
+	material_alpha_mask_ids .clear();
+	mesh_data_alpha_mask_ids.clear();
+}
 
-					if (node.is_leaf()) {
-						node.first += index_offset;
-					} else {
-						node.left += bvh_offset;
-					}
-				}
-			}
+void Integrator::init_sky() {
+	if (!gpu_scene->has_sky) {
+		CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::SKY);
 
-			ptr_bvh_nodes_2 = CUDAMemory::malloc<BVHNode2>(aggregated_bvh_nodes);
-			cuda_module.get_global("bvh2_nodes").set_value(ptr_bvh_nodes_2);
+		bool block_compress = cpu_config.enable_block_compression && cpu_config.enable_sky_block_compression && scene.sky.width % 4 == 0 && scene.sky.height % 4 == 0;
 
-			tlas           = make_owned<BVH2>(PinnedAllocator::instance());
-			tlas_converter = make_owned<BVH2Converter>(static_cast<BVH2 &>(*tlas.get()), tlas_raw);
-			break;
-		}
-		case BVHType::BVH4: {
-			Array<BVHNode4> aggregated_bvh_nodes(aggregated_bvh_node_count);
+		if (block_compress) {
+			// BC6H uses 1 byte per pixel instead of the 16 of float4, the importance sampling distribution is still based on the uncompressed Sky
+			int block_width  = scene.sky.width  / 4;
+			int block_height = scene.sky.height / 4;
 
-			// Each individual BVH needs to put its Nodes in a shared aggregated array of BVH Nodes before being upload to the GPU
-			// The procedure to do this is different for each BVH type
-			for (int m = 0; m < mesh_data_count; m++) {
-				const MeshData & mesh_data = scene.asset_manager.mesh_datas[m];
-				const BVH4 * bvh = static_cast<const BVH4 *>(mesh_data.bvh.get());
+			constexpr int BLOCK_SIZE = 16;
 
-				int index_offset = mesh_data_index_offsets[m];
-				int bvh_offset   = mesh_data_bvh_offsets[m];
+			Array<unsigned char> sky_compressed(block_width * block_height * BLOCK_SIZE);
 
-				BVHNode4 * dst = aggregated_bvh_nodes.data() + bvh_offset;
+			bool high_quality = cpu_config.block_compression_quality == BlockCompressionQuality::HIGH;
 
-				for (size_t n = 0; n < bvh->nodes.size(); n++) {
-					BVHNode4 & node = dst[n];
-					node = bvh->nodes[n];
+			ThreadPool::parallel_for(block_height, [&](int y) {
+				for (int x = 0; x < block_width; x++) {
+					float block[4 * 4 * 3];
+					for (int j = 0; j < 4; j++) {
+						for (int i = 0; i < 4; i++) {
+							const Vector4 & pixel = scene.sky.data[(4*x + i) + (4*y + j) * scene.sky.width];
 
-					int child_count = node.get_child_count();
-					for (int c = 0; c < child_count; c++) {
-						if (node.is_leaf(c)) {
-							node.get_index(c) += index_offset;
-						} else {
-							node.get_index(c) += bvh_offset;
+							block[3 * (i + j * 4) + 0] = pixel.x;
+							block[3 * (i + j * 4) + 1] = pixel.y;
+							block[3 * (i + j * 4) + 2] = pixel.z;
 						}
 					}
+					BlockCompression::compress_bc6h_block(sky_compressed.data() + (x + y * block_width) * BLOCK_SIZE, block, high_quality);
 				}
-			}
-
-			ptr_bvh_nodes_4 = CUDAMemory::malloc<BVHNode4>(aggregated_bvh_nodes);
-			cuda_module.get_global("bvh4_nodes").set_value(ptr_bvh_nodes_4);
+			});
 
-			tlas           = make_owned<BVH4>(PinnedAllocator::instance());
-			tlas_converter = make_owned<BVH4Converter>(static_cast<BVH4 &>(*tlas.get()), tlas_raw);
-			break;
-		}
-		case BVHType::BVH8: {
-			Array<BVHNode8> aggregated_bvh_nodes(aggregated_bvh_node_count);
-
-			// Each individual BVH needs to put its Nodes in a shared aggregated array of BVH Nodes before being upload to the GPU
-			// The procedure to do this is different for each BVH type
-			for (int m = 0; m < mesh_data_count; m++) {
-				const MeshData & mesh_data = scene.asset_manager.mesh_datas[m];
-				const BVH8 * bvh = static_cast<const BVH8 *>(mesh_data.bvh.get());
+			gpu_scene->sky_array = CUDAMemory::create_array(block_width, block_height, 4, CU_AD_FORMAT_UNSIGNED_INT32);
+			CUDAMemory::copy_array(gpu_scene->sky_array, block_width * BLOCK_SIZE, block_height, sky_compressed.data());
 
-				int index_offset = mesh_data_index_offsets[m];
-				int bvh_offset   = mesh_data_bvh_offsets[m];
-
-				BVHNode8 * dst = aggregated_bvh_nodes.data() + bvh_offset;
+			CUDA_RESOURCE_VIEW_DESC view_desc = { };
+			view_desc.format = CUresourceViewFormat::CU_RES_VIEW_FORMAT_UNSIGNED_BC6H;
+			view_desc.width  = scene.sky.width;
+			view_desc.height = scene.sky.height;
 
-				for (size_t n = 0; n < bvh->nodes.size(); n++) {
-					BVHNode8 & node = dst[n];
-					node = bvh->nodes[n];
+			gpu_scene->sky_texture = CUDAMemory::create_texture(gpu_scene->sky_array, CU_TR_FILTER_MODE_LINEAR, CU_TR_ADDRESS_MODE_CLAMP, &view_desc);
+		} else {
+			gpu_scene->sky_array = CUDAMemory::create_array(scene.sky.width, scene.sky.height, 4, CU_AD_FORMAT_FLOAT);
+			CUDAMemory::Ptr<Vector4> ptr_sky_data = CUDAMemory::malloc(scene.sky.data);
+			CUDAMemory::copy_array(gpu_scene->sky_array, scene.sky.width * sizeof(float4), scene.sky.height, ptr_sky_data.ptr);
+			CUDAMemory::free(ptr_sky_data);
 
-					node.base_index_triangle += index_offset;
-					node.base_index_child    += bvh_offset;
-				}
-			}
+			gpu_scene->sky_texture = CUDAMemory::create_texture(gpu_scene->sky_array, CU_TR_FILTER_MODE_LINEAR, CU_TR_ADDRESS_MODE_CLAMP);
+		}
 
-			ptr_bvh_nodes_8 = CUDAMemory::malloc<BVHNode8>(aggregated_bvh_nodes);
-			cuda_module.get_global("bvh8_nodes").set_value(ptr_bvh_nodes_8);
+		gpu_scene->ptr_sky_alias_table = CUDAMemory::malloc(scene.sky.distribution_alias_table);
+		gpu_scene->ptr_sky_pdf         = CUDAMemory::malloc(scene.sky.distribution_pdf);
 
-			tlas           = make_owned<BVH8>(PinnedAllocator::instance());
-			tlas_converter = make_owned<BVH8Converter>(static_cast<BVH8 &>(*tlas.get()), tlas_raw);
-			break;
-		}
+		gpu_scene->has_sky = true;
 	}
-}
-
-void Integrator::init_sky() {
-	sky_array = CUDAMemory::create_array(scene.sky.width, scene.sky.height, 4, CU_AD_FORMAT_FLOAT);
-	CUDAMemory::Ptr<Vector4> ptr_sky_data = CUDAMemory::malloc(scene.sky.data);
-	CUDAMemory::copy_array(sky_array, scene.sky.width * sizeof(float4), scene.sky.height, ptr_sky_data.ptr);
-	CUDAMemory::free(ptr_sky_data);
 
-	sky_texture = CUDAMemory::create_texture(sky_array, CU_TR_FILTER_MODE_LINEAR, CU_TR_ADDRESS_MODE_CLAMP);
-	cuda_module.get_global("sky_texture").set_value(sky_texture);
+	cuda_module.get_global("sky_texture").set_value(gpu_scene->sky_texture);
 
 	global_sky_scale = cuda_module.get_global("sky_scale");
 	global_sky_scale.set_value(scene.sky.scale);
+
+	cuda_module.get_global("sky_alias_table")        .set_value(gpu_scene->ptr_sky_alias_table);
+	cuda_module.get_global("sky_pdf")                .set_value(gpu_scene->ptr_sky_pdf);
+	cuda_module.get_global("sky_distribution_width") .set_value(scene.sky.distribution_width);
+	cuda_module.get_global("sky_distribution_height").set_value(scene.sky.distribution_height);
 }
 
 void Integrator::init_rng() {
-	ptr_pmj_samples = CUDAMemory::malloc<PMJ::Point>(PMJ::samples, PMJ_NUM_SEQUENCES * PMJ_NUM_SAMPLES_PER_SEQUENCE);
-	cuda_module.get_global("pmj_samples").set_value(ptr_pmj_samples);
+	if (!gpu_scene->has_rng) {
+		gpu_scene->ptr_pmj_samples         = CUDAMemory::malloc<PMJ::Point>(PMJ::samples, PMJ_NUM_SEQUENCES * PMJ_NUM_SAMPLES_PER_SEQUENCE);
+		gpu_scene->ptr_blue_noise_textures = CUDAMemory::malloc<unsigned short>(&BlueNoise::textures[0][0][0], BLUE_NOISE_NUM_TEXTURES * BLUE_NOISE_TEXTURE_DIM * BLUE_NOISE_TEXTURE_DIM);
 
-	ptr_blue_noise_textures = CUDAMemory::malloc<unsigned short>(&BlueNoise::textures[0][0][0], BLUE_NOISE_NUM_TEXTURES * BLUE_NOISE_TEXTURE_DIM * BLUE_NOISE_TEXTURE_DIM);
-	cuda_module.get_global("blue_noise_textures").set_value(ptr_blue_noise_textures);
+		gpu_scene->has_rng = true;
+	}
+
+	cuda_module.get_global("pmj_samples")        .set_value(gpu_scene->ptr_pmj_samples);
+	cuda_module.get_global("blue_noise_textures").set_value(gpu_scene->ptr_blue_noise_textures);
 }
 
 void Integrator::init_aovs() {
@@ -310,59 +1427,87 @@ void Integrator::init_aovs() {
 	}
 }
 
+void Integrator::init_accumulator(unsigned frame_buffer_handle) {
+	CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::FRAMEBUFFERS);
+
+	accumulator_handle = frame_buffer_handle;
+
+	if (frame_buffer_handle) {
+		// Set Accumulator to a CUDA resource mapping of the GL frame buffer texture
+		resource_accumulator = CUDAMemory::resource_register(frame_buffer_handle, CU_GRAPHICS_REGISTER_FLAGS_SURFACE_LDST);
+		array_accumulator    = CUDAMemory::resource_get_array(resource_accumulator);
+	} else {
+		resource_accumulator = nullptr;
+		array_accumulator    = CUDAMemory::create_array_surface(display_width, display_height, 4, CU_AD_FORMAT_FLOAT);
+	}
+	surf_accumulator = CUDAMemory::create_surface(array_accumulator);
+
+	if (is_upscaling()) {
+		// The Kernels write the "accumulator" Surface at screen size, the upscale Kernels write the "display" Surface
+		array_render = CUDAMemory::create_array_surface(screen_width, screen_height, 4, CU_AD_FORMAT_FLOAT);
+		surf_render  = CUDAMemory::create_surface(array_render);
+
+		get_global_shared("accumulator").set_value(surf_render);
+		get_global_shared("display")    .set_value(surf_accumulator);
+	} else {
+		get_global_shared("accumulator").set_value(surf_accumulator);
+	}
+}
+
 void Integrator::free_materials() {
 	CUDAMemory::free(ptr_material_types);
 	CUDAMemory::free(ptr_materials);
 
 	CUDAMemory::free(ptr_media);
+	CUDAMemory::free(ptr_medium_grids);
+	CUDAMemory::free(ptr_medium_grid_data);
 
-	if (scene.asset_manager.textures.size() > 0) {
-		CUDAMemory::free(ptr_textures);
-
-		for (int i = 0; i < scene.asset_manager.textures.size(); i++) {
-			CUDAMemory::free_array(texture_arrays[i]);
-			CUDAMemory::free_texture(textures[i].texture);
-		}
-
-		textures      .clear();
-		texture_arrays.clear();
-	}
+	// The Textures stay resident in the GPUScene
+	free_texture_staging();
 }
 
 void Integrator::free_geometry() {
-	CUDAMemory::free_pinned(pinned_mesh_bvh_root_indices);
-	CUDAMemory::free_pinned(pinned_mesh_material_ids);
-	CUDAMemory::free_pinned(pinned_mesh_transforms);
-	CUDAMemory::free_pinned(pinned_mesh_transforms_inv);
-	CUDAMemory::free_pinned(pinned_mesh_transforms_prev);
-	CUDAMemory::free_pinned(pinned_light_mesh_cumulative_probability);
+	// A TLAS build may still be writing into the back buffer
+	ThreadPool::wait(tlas_build_group);
+
+	CUDAMemory::free_pinned(pinned_light_mesh_alias_table);
 	CUDAMemory::free_pinned(pinned_light_mesh_triangle_span);
 	CUDAMemory::free_pinned(pinned_light_mesh_transform_indices);
 
-	CUDAMemory::free(ptr_mesh_bvh_root_indices);
-	CUDAMemory::free(ptr_mesh_material_ids);
-	CUDAMemory::free(ptr_mesh_transforms);
-	CUDAMemory::free(ptr_mesh_transforms_inv);
-	CUDAMemory::free(ptr_mesh_transforms_prev);
-
-	switch (cpu_config.bvh_type) {
-		case BVHType::BVH:
-		case BVHType::SBVH: CUDAMemory::free(ptr_bvh_nodes_2); break;
-		case BVHType::BVH4: CUDAMemory::free(ptr_bvh_nodes_4); break;
-		case BVHType::BVH8: CUDAMemory::free(ptr_bvh_nodes_8); break;
+	for (int b = 0; b < 2; b++) {
+		TLASBuffer & buffer = tlas_buffers[b];
+
+		CUDAMemory::free_pinned(buffer.pinned_mesh_bvh_root_indices);
+		CUDAMemory::free_pinned(buffer.pinned_mesh_material_ids);
+		CUDAMemory::free_pinned(buffer.pinned_mesh_alpha_mask_ids);
+		CUDAMemory::free_pinned(buffer.pinned_mesh_lod_chain_ids);
+		CUDAMemory::free_pinned(buffer.pinned_mesh_transforms);
+		CUDAMemory::free_pinned(buffer.pinned_mesh_transforms_inv);
+		CUDAMemory::free_pinned(buffer.pinned_mesh_transforms_prev);
+		CUDAMemory::free_pinned(buffer.pinned_nodes);
+
+		CUDAMemory::free(buffer.ptr_mesh_bvh_root_indices);
+		CUDAMemory::free(buffer.ptr_mesh_material_ids);
+		CUDAMemory::free(buffer.ptr_mesh_alpha_mask_ids);
+		CUDAMemory::free(buffer.ptr_mesh_lod_chain_ids);
+		CUDAMemory::free(buffer.ptr_mesh_transforms);
+		CUDAMemory::free(buffer.ptr_mesh_transforms_inv);
+		CUDAMemory::free(buffer.ptr_mesh_transforms_prev);
 	}
 
-	CUDAMemory::free(ptr_triangles);
-}
+	CUDACALL(cuEventDestroy(tlas_event_rendered));
 
-void Integrator::free_sky() {
-	CUDAMemory::free_array(sky_array);
-	CUDAMemory::free_texture(sky_texture);
-}
+	// A pending pick may still be copying its hit
+	CUDACALL(cuEventSynchronize(event_pick));
+	CUDACALL(cuEventDestroy(event_pick));
+
+	CUDAMemory::free_pinned(pinned_pick_hit);
+
+	pick_buffer.origin   .free();
+	pick_buffer.direction.free();
+	CUDAMemory::free(pick_buffer.hits);
 
-void Integrator::free_rng() {
-	CUDAMemory::free(ptr_pmj_samples);
-	CUDAMemory::free(ptr_blue_noise_textures);
+	// The Triangles and BLAS Nodes stay resident in the GPUScene
 }
 
 void Integrator::free_aovs() {
@@ -374,10 +1519,103 @@ void Integrator::free_aovs() {
 	}
 }
 
+void Integrator::free_accumulator() {
+	CUDAMemory::free_surface(surf_accumulator);
+
+	if (resource_accumulator) {
+		CUDAMemory::resource_unregister(resource_accumulator); // The array is owned by GL
+		resource_accumulator = nullptr;
+	} else {
+		CUDAMemory::free_array(array_accumulator);
+	}
+	array_accumulator = nullptr;
+
+	if (array_render) {
+		CUDAMemory::free_surface(surf_render);
+		CUDAMemory::free_array(array_render);
+		array_render = nullptr;
+	}
+}
+
+Array<float4> Integrator::read_accumulator() const {
+	Array<float4> data(display_width * display_height);
+	CUDAMemory::copy_array_to_host(data.data(), array_accumulator, display_width * sizeof(float4), display_height);
+
+	return data;
+}
+
+Array<float4> Integrator::read_view(int view) const {
+	ASSERT(view >= 0 && view < view_count);
+
+	size_t view_offset = size_t(view) * size_t(screen_pitch) * size_t(screen_height);
+
+	Array<float4> data(screen_pitch * screen_height);
+	CUDAMemory::memcpy(data.data(), CUDAMemory::Ptr<float4>(get_aov(AOVType::RADIANCE).accumulator.ptr + view_offset * sizeof(float4)), screen_pitch * screen_height);
+
+	// Remove the padding of the pitch
+	for (int y = 1; y < screen_height; y++) {
+		memmove(data.data() + y * screen_width, data.data() + y * screen_pitch, screen_width * sizeof(float4));
+	}
+	data.resize(screen_width * screen_height);
+
+	return data;
+}
+
+Integrator::CUDACamera Integrator::get_view_camera(int view) const {
+	const Camera & camera = scene.camera;
+
+	CUDACamera cuda_camera;
+	cuda_camera.position           = camera.position;
+	cuda_camera.bottom_left_corner = camera.bottom_left_corner_rotated;
+	cuda_camera.x_axis             = camera.x_axis_rotated;
+	cuda_camera.y_axis             = camera.y_axis_rotated;
+	cuda_camera.pixel_spread_angle = camera.pixel_spread_angle;
+	cuda_camera.aperture_radius    = camera.aperture_radius;
+	cuda_camera.focal_distance     = camera.focal_distance;
+
+	if (view_count == 1) return cuda_camera;
+
+	switch (cpu_config.view_layout) {
+		case ViewLayout::STEREO: {
+			// View 0 is the left eye
+			float offset = view == 0 ? -0.5f : 0.5f;
+			cuda_camera.position += (offset * cpu_config.stereo_separation) * camera.x_axis_rotated;
+			break;
+		}
+
+		case ViewLayout::CUBEMAP: {
+			Quaternion face;
+			switch (view) {
+				case 0: face = Quaternion();                                                  break; // Front
+				case 1: face = Quaternion::axis_angle(Vector3(0.0f, 1.0f, 0.0f), -0.5f * PI); break; // Right
+				case 2: face = Quaternion::axis_angle(Vector3(0.0f, 1.0f, 0.0f),         PI); break; // Back
+				case 3: face = Quaternion::axis_angle(Vector3(0.0f, 1.0f, 0.0f),  0.5f * PI); break; // Left
+				case 4: face = Quaternion::axis_angle(Vector3(1.0f, 0.0f, 0.0f),  0.5f * PI); break; // Up
+				case 5: face = Quaternion::axis_angle(Vector3(1.0f, 0.0f, 0.0f), -0.5f * PI); break; // Down
+				default: ASSERT_UNREACHABLE();
+			}
+			Quaternion rotation = camera.rotation * face;
+
+			// Same setup as Camera::recalibrate with a horizontal Field of View of 90 degrees, the faces only line up if the screen is square
+			float half_width  = 0.5f * camera.screen_width;
+			float half_height = 0.5f * camera.screen_height;
+
+			cuda_camera.bottom_left_corner = rotation * Vector3(-half_width, -half_height, -half_width);
+			cuda_camera.x_axis             = rotation * Vector3(1.0f, 0.0f, 0.0f);
+			cuda_camera.y_axis             = rotation * Vector3(0.0f, 1.0f, 0.0f);
+			cuda_camera.pixel_spread_angle = atanf(2.0f / camera.screen_width);
+			break;
+		}
+
+		default: ASSERT_UNREACHABLE();
+	}
+	return cuda_camera;
+}
+
 void Integrator::aovs_clear_to_zero() {
 	for (size_t i = 0; i < size_t(AOVType::COUNT); i++) {
 		if (aov_is_enabled(AOVType(i))) {
-			CUDAMemory::memset_async(aovs[i].framebuffer, 0, screen_pitch * screen_height, memory_stream);
+			CUDAMemory::memset_async(aovs[i].framebuffer, 0, screen_pitch * screen_height * view_count, memory_stream);
 		}
 	}
 }
@@ -396,114 +1634,387 @@ bool Integrator::aov_render_gui_checkbox(AOVType aov_type, const char * aov_name
 };
 
 // Construct Top Level Acceleration Structure (TLAS) over the Meshes in the Scene
-void Integrator::build_tlas() {
-	tlas_builder->build(scene.meshes);
-	tlas_converter->convert();
+// This only touches host memory, so that it can run on the ThreadPool while the GPU renders using the other TLASBuffer
+static constexpr int TLAS_UPDATE_GRAIN_SIZE = 1024;
+
+void Integrator::build_tlas(TLASBuffer & buffer) {
+	ProfileScope scope("TLAS Build"_sv, "BVH"_sv);
+
+	uint64_t time_start = Profiler::get_time();
+
+	// If the TLAS was built before it can be refitted to the new Mesh AABBs instead of rebuilt
+	bool refit = buffer.refit_valid && cpu_config.tlas_refit_threshold > 0.0f;
+	if (refit) {
+		buffer.tlas_raw.refit(scene.meshes);
+
+		// Rebuild once the quality of the refitted TLAS has degraded too much compared to the last full build
+		refit = buffer.tlas_raw.sah_cost() <= cpu_config.tlas_refit_threshold * buffer.sah_cost_built;
+	}
+
+	if (refit) {
+		buffer.tlas_converter->refit();
+	} else {
+		if (buffer.tlas_builder_binned) {
+			buffer.tlas_builder_binned->build(scene.meshes);
+		} else {
+			buffer.tlas_builder->build(scene.meshes);
+		}
+		buffer.tlas_converter->convert();
+
+		buffer.sah_cost_built = buffer.tlas_raw.sah_cost();
+		buffer.refit_valid    = true;
+	}
+
+	// Child indices are relative to the TLAS root, offset them to where this TLAS lives in the aggregated BVH Node buffer
+	int node_offset = buffer.node_offset;
+
+	switch (cpu_config.bvh_type) {
+		case BVHType::BVH:
+		case BVHType::SBVH: {
+			const Array<BVHNode2> & nodes = static_cast<const BVH2 *>(buffer.tlas.get())->nodes;
+			BVHNode2 * dst = static_cast<BVHNode2 *>(buffer.pinned_nodes);
+
+			for (size_t n = 0; n < nodes.size(); n++) {
+				dst[n] = nodes[n];
+				if (!dst[n].is_leaf()) {
+					dst[n].left += node_offset;
+				}
+			}
+			break;
+		}
+		case BVHType::BVH4: {
+			const Array<BVHNode4> & nodes = static_cast<const BVH4 *>(buffer.tlas.get())->nodes;
+			BVHNode4 * dst = static_cast<BVHNode4 *>(buffer.pinned_nodes);
+
+			for (size_t n = 0; n < nodes.size(); n++) {
+				dst[n] = nodes[n];
+
+				int child_count = dst[n].get_child_count();
+				for (int c = 0; c < child_count; c++) {
+					if (!dst[n].is_leaf(c)) {
+						dst[n].get_index(c) += node_offset;
+					}
+				}
+			}
+			break;
+		}
+		case BVHType::BVH8: {
+			const Array<BVHNode8> & nodes = static_cast<const BVH8 *>(buffer.tlas.get())->nodes;
+			BVHNode8 * dst = static_cast<BVHNode8 *>(buffer.pinned_nodes);
+
+			for (size_t n = 0; n < nodes.size(); n++) {
+				dst[n] = nodes[n];
+				dst[n].base_index_child += node_offset;
+			}
+			break;
+		}
+		default: ASSERT_UNREACHABLE();
+	}
+	ASSERT(buffer.tlas->indices.data());
+
+	// A refit keeps the order of the Meshes in the TLAS, so only runs of Meshes whose data changed need to be uploaded
+	buffer.dirty_ranges.clear();
+
+	// Every TLAS slot writes only its own pinned Mesh data, so the slots can be compared and written in parallel
+	int mesh_count = int(scene.meshes.size());
+	buffer.slot_dirty.resize(mesh_count);
+
+	ThreadPool::parallel_for(0, mesh_count, TLAS_UPDATE_GRAIN_SIZE, [&buffer, refit, this](int first, int last) {
+		for (int i = first; i < last; i++) {
+			buffer.slot_dirty[i] = update_pinned_mesh_data(buffer, i) || !refit;
+		}
+	});
+
+	int dirty_first = INVALID;
+
+	for (int i = 0; i <= mesh_count; i++) {
+		bool dirty = i < mesh_count && buffer.slot_dirty[i];
+
+		if (dirty) {
+			if (dirty_first == INVALID) dirty_first = i;
+		} else if (dirty_first != INVALID) {
+			buffer.dirty_ranges.push_back({ dirty_first, i - dirty_first });
+			dirty_first = INVALID;
+		}
+	}
+
+	buffer.build_time      = Profiler::get_time() - time_start;
+	buffer.build_was_refit = refit;
+}
+
+void Integrator::upload_tlas(const TLASBuffer & buffer) {
+	int node_offset = buffer.node_offset;
 
 	switch (cpu_config.bvh_type) {
 		case BVHType::BVH:
-		case BVHType::SBVH: CUDAMemory::memcpy_async(ptr_bvh_nodes_2, static_cast<BVH2 *>(tlas.get())->nodes.data(), tlas->node_count(), memory_stream); break;
-		case BVHType::BVH4: CUDAMemory::memcpy_async(ptr_bvh_nodes_4, static_cast<BVH4 *>(tlas.get())->nodes.data(), tlas->node_count(), memory_stream); break;
-		case BVHType::BVH8: CUDAMemory::memcpy_async(ptr_bvh_nodes_8, static_cast<BVH8 *>(tlas.get())->nodes.data(), tlas->node_count(), memory_stream); break;
+		case BVHType::SBVH: CUDAMemory::memcpy_async(gpu_scene->ptr_bvh_nodes_2 + node_offset, static_cast<const BVHNode2 *>(buffer.pinned_nodes), buffer.tlas->node_count(), memory_stream); break;
+		case BVHType::BVH4: CUDAMemory::memcpy_async(gpu_scene->ptr_bvh_nodes_4 + node_offset, static_cast<const BVHNode4 *>(buffer.pinned_nodes), buffer.tlas->node_count(), memory_stream); break;
+		case BVHType::BVH8: CUDAMemory::memcpy_async(gpu_scene->ptr_bvh_nodes_8 + node_offset, static_cast<const BVHNode8 *>(buffer.pinned_nodes), buffer.tlas->node_count(), memory_stream); break;
 		default: ASSERT_UNREACHABLE();
 	}
-	ASSERT(tlas->indices.data());
 
-	for (int i = 0; i < scene.meshes.size(); i++) {
-		const Mesh & mesh = scene.meshes[tlas->indices[i]];
+	int meshes_uploaded = 0;
+
+	for (size_t i = 0; i < buffer.dirty_ranges.size(); i++) {
+		int first = buffer.dirty_ranges[i].first;
+		int count = buffer.dirty_ranges[i].count;
+
+		CUDAMemory::memcpy_async(buffer.ptr_mesh_bvh_root_indices + first, buffer.pinned_mesh_bvh_root_indices + first, count, memory_stream);
+		CUDAMemory::memcpy_async(buffer.ptr_mesh_material_ids     + first, buffer.pinned_mesh_material_ids     + first, count, memory_stream);
+		CUDAMemory::memcpy_async(buffer.ptr_mesh_alpha_mask_ids   + first, buffer.pinned_mesh_alpha_mask_ids   + first, count, memory_stream);
+		CUDAMemory::memcpy_async(buffer.ptr_mesh_lod_chain_ids    + first, buffer.pinned_mesh_lod_chain_ids    + first, count, memory_stream);
+		CUDAMemory::memcpy_async(buffer.ptr_mesh_transforms       + first, buffer.pinned_mesh_transforms       + first, count, memory_stream);
+		CUDAMemory::memcpy_async(buffer.ptr_mesh_transforms_inv   + first, buffer.pinned_mesh_transforms_inv   + first, count, memory_stream);
+		CUDAMemory::memcpy_async(buffer.ptr_mesh_transforms_prev  + first, buffer.pinned_mesh_transforms_prev  + first, count, memory_stream);
+
+		meshes_uploaded += count;
+	}
+
+	size_t node_size;
+	switch (cpu_config.bvh_type) {
+		case BVHType::BVH:
+		case BVHType::SBVH: node_size = sizeof(BVHNode2); break;
+		case BVHType::BVH4: node_size = sizeof(BVHNode4); break;
+		case BVHType::BVH8: node_size = sizeof(BVHNode8); break;
+		default: ASSERT_UNREACHABLE();
+	}
+
+	update_stats.time_tlas_build      += buffer.build_time;
+	update_stats.tlas_built            = true;
+	update_stats.tlas_refit            = buffer.build_was_refit;
+	update_stats.tlas_meshes_uploaded += meshes_uploaded;
+	update_stats.bytes_uploaded_tlas  += buffer.tlas->node_count() * node_size + meshes_uploaded * (4 * sizeof(int) + 3 * sizeof(Matrix3x4));
+}
+
+// Points the GPU to the TLAS and Mesh data of the given TLASBuffer, in stream order on the memory stream
+void Integrator::set_tlas(int buffer_index) {
+	const TLASBuffer & buffer = tlas_buffers[buffer_index];
+
+	cuda_module.get_global("tlas_root_index")     .set_value_async(buffer.node_offset,               memory_stream);
+	cuda_module.get_global("mesh_bvh_root_indices").set_value_async(buffer.ptr_mesh_bvh_root_indices, memory_stream);
+	cuda_module.get_global("mesh_material_ids")    .set_value_async(buffer.ptr_mesh_material_ids,     memory_stream);
+	cuda_module.get_global("mesh_transforms")      .set_value_async(buffer.ptr_mesh_transforms,       memory_stream);
+
+	// Without alpha masks the global stays nullptr, so that traversal skips the alpha test altogether
+	if (alpha_mask_count > 0) {
+		cuda_module.get_global("mesh_alpha_mask_ids").set_value_async(buffer.ptr_mesh_alpha_mask_ids, memory_stream);
+	}
+	// Likewise without levels of detail traversal never looks up a chain
+	if (gpu_scene->ptr_lod_chains.ptr != NULL) {
+		cuda_module.get_global("mesh_lod_chain_ids").set_value_async(buffer.ptr_mesh_lod_chain_ids, memory_stream);
+	}
+	cuda_module.get_global("mesh_transforms_inv")  .set_value_async(buffer.ptr_mesh_transforms_inv,   memory_stream);
+	cuda_module.get_global("mesh_transforms_prev") .set_value_async(buffer.ptr_mesh_transforms_prev,  memory_stream);
+
+	tlas_front   = buffer_index;
+	tlas         = buffer.tlas.get();
+	tlas_updated = true;
+}
+
+// Called after the current frame has been launched. If a TLAS for the next frame is being built on the ThreadPool,
+// wait for it (the GPU is tracing the current frame meanwhile) and swap it in once the current frame is done with the front buffer
+void Integrator::sync_tlas() {
+	ProfileScope scope("TLAS Sync"_sv, "BVH"_sv);
+
+	tlas_rendered = tlas_front;
+
+	if (tlas_build_group.is_done()) return;
+
+	ThreadPool::wait(tlas_build_group);
+
+	int back = 1 - tlas_front;
+
+	// The back buffer is not in use by the GPU, so it can be uploaded right away
+	upload_tlas(tlas_buffers[back]);
+
+	// The globals can only change once the kernels of the current frame have read them
+	CUDACALL(cuEventRecord(tlas_event_rendered, nullptr));
+	CUDACALL(cuStreamWaitEvent(memory_stream, tlas_event_rendered, 0));
+
+	set_tlas(back);
+}
+
+// Traces the pick Ray through the given pixel on the memory stream, behind the latest Camera and TLAS uploads but not behind the frame
+// that is being rendered. Only if the memory stream is waiting to swap in a new TLAS does the pick wait for the current frame to finish
+void Integrator::trace_pick(int x, int y) {
+	kernel_pick_generate.execute_on_stream(memory_stream, x, y);
+	kernel_pick->execute_on_stream(memory_stream);
+
+	CUDAMemory::memcpy_async(pinned_pick_hit, CUDAMemory::Ptr<int4>(pick_buffer.hits.ptr), 1, memory_stream);
+	CUDACALL(cuEventRecord(event_pick, memory_stream));
+
+	pick_tlas          = tlas_front;
+	pixel_query_status = PixelQueryStatus::PENDING;
+}
+
+void Integrator::begin_frame_events() {
+	bool timed =
+		timings_requested ||
+		Profiler::is_recording() ||
+		cpu_config.frame_time_budget > 0.0f || // Needs the GPU time of every frame
+		(cpu_config.event_interval > 0 && event_frame_index % cpu_config.event_interval == 0);
+
+	event_frame_index++;
+	event_pool.begin_frame(timed);
+}
+
+void Integrator::poll_pixel_query() {
+	if (pixel_query_status != PixelQueryStatus::PENDING) return;
+
+	CUresult result = cuEventQuery(event_pick);
+	if (result == CUDA_ERROR_NOT_READY) return;
+
+	CUDACALL(result);
 
-		pinned_mesh_bvh_root_indices[i] = mesh_data_bvh_offsets[mesh.mesh_data_handle.handle] | (mesh.has_identity_transform() << 31);
+	// The mesh_id refers to a slot of the TLAS that the pick Ray was traced against
+	pixel_query.triangle_id = pinned_pick_hit->y;
+	pixel_query.mesh_id     = pixel_query.triangle_id != INVALID ? tlas_buffers[pick_tlas].tlas->indices[pinned_pick_hit->x] : INVALID;
 
-		ASSERT(mesh.material_handle.handle != INVALID);
-		pinned_mesh_material_ids[i] = mesh.material_handle.handle;
+	pixel_query_status = PixelQueryStatus::INACTIVE;
+}
+
+// Writes the data of the Mesh at the given TLAS slot into the pinned buffers, returns whether it differs from what was there
+bool Integrator::update_pinned_mesh_data(TLASBuffer & buffer, int tlas_index) {
+	const Mesh & mesh = scene.meshes[buffer.tlas->indices[tlas_index]];
+
+	// A Mesh that moved within the shutter interval cannot use the identity fast path, even if it ends up at the identity
+	bool has_motion            = gpu_config.enable_motion_blur && mesh.has_motion();
+	bool has_identity_transform = !has_motion && mesh.has_identity_transform();
+
+	bool has_curves = scene.asset_manager.get_mesh_data(mesh.mesh_data_handle).has_curves();
+
+	// The MeshVisibility bits are stored inverted, so that a Mesh that is visible to all Rays has them cleared
+	unsigned hidden_mask = ~mesh.visibility_mask & ((1u << int(MeshVisibility::COUNT)) - 1);
+
+	ASSERT(gpu_scene->mesh_data_bvh_offsets[mesh.mesh_data_handle.handle] < (1 << 27));
+	int bvh_root_index = gpu_scene->mesh_data_bvh_offsets[mesh.mesh_data_handle.handle] | (hidden_mask << 27) | (has_curves << 29) | (has_motion << 30) | (has_identity_transform << 31);
+
+	ASSERT(mesh.material_handle.handle != INVALID);
+	int material_id = mesh.material_handle.handle;
+
+	// The Triangle states can only be used if they were classified against the alpha mask of this Mesh, an instance
+	// of the same MeshData with another alpha mask (or whose Material was changed since) looks up its mask on every hit
+	int alpha_mask_id = INVALID;
+	if (material_id < material_alpha_mask_ids.size()) {
+		alpha_mask_id = material_alpha_mask_ids[material_id];
 
-		memcpy(pinned_mesh_transforms     [i].cells, mesh.transform     .cells, sizeof(Matrix3x4));
-		memcpy(pinned_mesh_transforms_inv [i].cells, mesh.transform_inv .cells, sizeof(Matrix3x4));
-		memcpy(pinned_mesh_transforms_prev[i].cells, mesh.transform_prev.cells, sizeof(Matrix3x4));
+		if (alpha_mask_id != INVALID && mesh_data_alpha_mask_ids[mesh.mesh_data_handle.handle] == alpha_mask_id) {
+			alpha_mask_id |= ALPHA_MASK_CLASSIFIED;
+		}
+	}
+
+	int lod_chain_id = gpu_scene->mesh_data_lod_chains[mesh.mesh_data_handle.handle];
+
+	bool changed =
+		buffer.pinned_mesh_bvh_root_indices[tlas_index] != bvh_root_index ||
+		buffer.pinned_mesh_material_ids    [tlas_index] != material_id ||
+		buffer.pinned_mesh_alpha_mask_ids  [tlas_index] != alpha_mask_id ||
+		buffer.pinned_mesh_lod_chain_ids   [tlas_index] != lod_chain_id ||
+		memcmp(buffer.pinned_mesh_transforms     [tlas_index].cells, mesh.transform     .cells, sizeof(Matrix3x4)) != 0 ||
+		memcmp(buffer.pinned_mesh_transforms_inv [tlas_index].cells, mesh.transform_inv .cells, sizeof(Matrix3x4)) != 0 ||
+		memcmp(buffer.pinned_mesh_transforms_prev[tlas_index].cells, mesh.transform_prev.cells, sizeof(Matrix3x4)) != 0;
+
+	if (changed) {
+		buffer.pinned_mesh_bvh_root_indices[tlas_index] = bvh_root_index;
+		buffer.pinned_mesh_material_ids    [tlas_index] = material_id;
+		buffer.pinned_mesh_alpha_mask_ids  [tlas_index] = alpha_mask_id;
+		buffer.pinned_mesh_lod_chain_ids   [tlas_index] = lod_chain_id;
+
+		memcpy(buffer.pinned_mesh_transforms     [tlas_index].cells, mesh.transform     .cells, sizeof(Matrix3x4));
+		memcpy(buffer.pinned_mesh_transforms_inv [tlas_index].cells, mesh.transform_inv .cells, sizeof(Matrix3x4));
+		memcpy(buffer.pinned_mesh_transforms_prev[tlas_index].cells, mesh.transform_prev.cells, sizeof(Matrix3x4));
 	}
 
-	CUDAMemory::memcpy_async(ptr_mesh_bvh_root_indices,  pinned_mesh_bvh_root_indices, scene.meshes.size(), memory_stream);
-	CUDAMemory::memcpy_async(ptr_mesh_material_ids,      pinned_mesh_material_ids,     scene.meshes.size(), memory_stream);
-	CUDAMemory::memcpy_async(ptr_mesh_transforms,        pinned_mesh_transforms,       scene.meshes.size(), memory_stream);
-	CUDAMemory::memcpy_async(ptr_mesh_transforms_inv,    pinned_mesh_transforms_inv,   scene.meshes.size(), memory_stream);
-	CUDAMemory::memcpy_async(ptr_mesh_transforms_prev,   pinned_mesh_transforms_prev,  scene.meshes.size(), memory_stream);
+	return changed;
+}
+
+void Integrator::UpdateStats::record_counters() const {
+	if (!Profiler::is_recording()) return;
+
+	Profiler::record_counter("Scene Update (us)"_sv,     double(time_scene_update));
+	Profiler::record_counter("TLAS Build (us)"_sv,       double(time_tlas_build));
+	Profiler::record_counter("Light Weights (us)"_sv,    double(time_light_weights));
+	Profiler::record_counter("Material Upload (us)"_sv,  double(time_material_upload));
+	Profiler::record_counter("Meshes Updated"_sv,        double(meshes_updated));
+	Profiler::record_counter("TLAS Meshes Uploaded"_sv,  double(tlas_meshes_uploaded));
+	Profiler::record_counter("Materials Uploaded"_sv,    double(materials_uploaded));
+	Profiler::record_counter("Bytes Uploaded"_sv,        double(bytes_uploaded_tlas + bytes_uploaded_materials + bytes_uploaded_lights));
 }
 
 void Integrator::update(float delta, Allocator * frame_allocator) {
+	ProfileScope scope("Integrator Update"_sv);
+
 	if (invalidated_gpu_config && gpu_config.enable_svgf && scene.camera.aperture_radius > 0.0f) {
 		IO::print("WARNING: SVGF and DoF cannot simultaneously be enabled!\n"_sv);
 		scene.camera.aperture_radius = 0.0f;
 		invalidated_camera = true;
 	}
 
+	uint64_t time_scene_update = Profiler::get_time();
+
 	if (cpu_config.enable_scene_update) {
-		scene.update(delta);
+		update_stats.meshes_updated = scene.update(delta);
 		invalidated_scene = true;
 	} else if (gpu_config.enable_svgf || invalidated_scene) {
 		scene.camera.update(0.0f);
-		scene.update(0.0f);
+		update_stats.meshes_updated = scene.update(0.0f);
 	}
 
+	update_stats.time_scene_update = Profiler::get_time() - time_scene_update;
+
+	poll_pixel_query();
+
 	if (invalidated_scene) {
 		invalidated_scene = false;
-		build_tlas();
+
+		if (cpu_config.enable_async_tlas && tlas) {
+			// Build into the back buffer on the ThreadPool, it is swapped in by sync_tlas() after this frame has been launched
+			// NOTE: The Meshes are read by the job, they must not be modified until sync_tlas()
+			ThreadPool::submit(tlas_build_group, [this]() {
+				build_tlas(tlas_buffers[1 - tlas_front]);
+			});
+		} else {
+			build_tlas(tlas_buffers[tlas_front]);
+			upload_tlas(tlas_buffers[tlas_front]);
+			set_tlas(tlas_front);
+		}
 	}
 
 	scene.camera.update(delta);
 
 	if (scene.camera.moved || invalidated_camera) {
-		// Upload Camera
-		struct CUDACamera {
-			Vector3 position;
-			Vector3 bottom_left_corner;
-			Vector3 x_axis;
-			Vector3 y_axis;
-			float pixel_spread_angle;
-			float aperture_radius;
-			float focal_distance;
-		} cuda_camera;
-
-		cuda_camera.position           = scene.camera.position;
-		cuda_camera.bottom_left_corner = scene.camera.bottom_left_corner_rotated;
-		cuda_camera.x_axis             = scene.camera.x_axis_rotated;
-		cuda_camera.y_axis             = scene.camera.y_axis_rotated;
-		cuda_camera.pixel_spread_angle = scene.camera.pixel_spread_angle;
-		cuda_camera.aperture_radius    = scene.camera.aperture_radius;
-		cuda_camera.focal_distance     = scene.camera.focal_distance;
-
-		global_camera.set_value_async(cuda_camera, memory_stream);
-
-		if (!gpu_config.enable_svgf) {
-			sample_index = 0;
-		}
-
-		invalidated_camera = false;
-	}
+		// Upload Camera, the camera global is view 0 so that picking and Ray Cones keep working with multiple views
+		global_camera.set_value_async(get_view_camera(0), memory_stream);
 
-	if (pixel_query_status == PixelQueryStatus::OUTPUT_READY) {
-		CUDAMemory::memcpy_async(&pixel_query, CUDAMemory::Ptr<PixelQuery>(global_pixel_query.ptr), 1, memory_stream);
+		if (view_count > 1) {
+			CUDACamera view_cameras[6];
+			ASSERT(view_count <= Util::array_count(view_cameras));
 
-		if (pixel_query.mesh_id != INVALID) {
-			pixel_query.mesh_id = tlas->indices[pixel_query.mesh_id];
+			for (int i = 0; i < view_count; i++) {
+				view_cameras[i] = get_view_camera(i);
+			}
+			CUDAMemory::copy_staged_async(ptr_view_cameras.ptr, view_cameras, view_count * sizeof(CUDACamera), memory_stream);
 		}
 
-		// Reset pixel query
-		pixel_query.pixel_index = INVALID;
-		CUDAMemory::memcpy_async(CUDAMemory::Ptr<PixelQuery>(global_pixel_query.ptr), &pixel_query, 1, memory_stream);
+		if (!gpu_config.enable_svgf && !(scene.camera.moved && is_reprojecting())) {
+			sample_index = 0;
+		}
 
-		pixel_query_status = PixelQueryStatus::INACTIVE;
+		invalidated_camera = false;
 	}
 
 	if (invalidated_aovs) {
 		invalidated_aovs = false;
 
+		CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::FRAMEBUFFERS);
+
 		for (size_t i = 0; i < size_t(AOVType::COUNT); i++) {
 			bool is_enabled   = aov_is_enabled(AOVType(i));
 			bool is_allocated = aovs[i].framebuffer.ptr != NULL;
 
 			if (is_enabled && !is_allocated) {
-				aovs[i].framebuffer = CUDAMemory::malloc<float4>(screen_pitch * screen_height);
-				aovs[i].accumulator = CUDAMemory::malloc<float4>(screen_pitch * screen_height);
+				aovs[i].framebuffer = CUDAMemory::malloc<float4>(alloc_pixel_count());
+				aovs[i].accumulator = CUDAMemory::malloc<float4>(alloc_pixel_count());
 			} else if (!is_enabled && is_allocated) {
 				CUDAMemory::free(aovs[i].framebuffer);
 				CUDAMemory::free(aovs[i].accumulator);
@@ -515,11 +2026,15 @@ void Integrator::update(float delta, Allocator * frame_allocator) {
 		invalidated_gpu_config = true;
 	}
 
+	if (update_texture_streaming()) {
+		invalidated_gpu_config = true; // Restart accumulation now that finer Mip levels are available
+	}
+
 	if (invalidated_gpu_config) {
 		invalidated_gpu_config = false;
 		sample_index = 0;
 		global_config.set_value_async(gpu_config, memory_stream);
-	} else if (scene.camera.moved && !gpu_config.enable_svgf) {
+	} else if (scene.camera.moved && !gpu_config.enable_svgf && !is_reprojecting()) {
 		sample_index = 0;
 	} else {
 		sample_index++;
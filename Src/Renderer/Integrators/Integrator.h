@@ -1,4 +1,7 @@
 #pragma once
+#include <cstddef>
+#include <atomic>
+
 #include "Core/Random.h"
 #include "CUDA/Common.h"
 
@@ -9,11 +12,16 @@
 #include "Device/CUDAContext.h"
 
 #include "BVH/Builders/SAHBuilder.h"
+#include "BVH/Builders/BinnedSAHBuilder.h"
 #include "BVH/Converters/BVHConverter.h"
 
 #include "Renderer/Scene.h"
 
 #include "Util/PMJ.h"
+#include "Util/AliasTable.h"
+#include "Util/ThreadPool.h"
+
+#include "GPUScene.h"
 
 
 // Mirror CUDA vector types
@@ -34,7 +42,12 @@ struct CUDAVector3_SoA {
 	CUDAMemory::Ptr<float> y;
 	CUDAMemory::Ptr<float> z;
 
-	inline void init(int buffer_size) {
+	// If packed, x holds one float4 per element and y and z are not allocated, see CONFIG_PACKED_RAY_BUFFERS
+	inline void init(int buffer_size, bool packed = false) {
+		if (packed) {
+			x = CUDAMemory::malloc<float>(4 * buffer_size);
+			return;
+		}
 		x = CUDAMemory::malloc<float>(buffer_size);
 		y = CUDAMemory::malloc<float>(buffer_size);
 		z = CUDAMemory::malloc<float>(buffer_size);
@@ -42,8 +55,8 @@ struct CUDAVector3_SoA {
 
 	inline void free() {
 		CUDAMemory::free(x);
-		CUDAMemory::free(y);
-		CUDAMemory::free(z);
+		if (y.ptr) CUDAMemory::free(y);
+		if (z.ptr) CUDAMemory::free(z);
 	}
 };
 
@@ -56,6 +69,8 @@ struct AOV {
 struct Integrator {
 	Scene & scene;
 
+	OwnPtr<GPUScene> gpu_scene; // Scene data that stays resident when the Integrator is recreated
+
 	bool invalidated_scene      = true;
 	bool invalidated_sky        = true;
 	bool invalidated_materials  = true;
@@ -64,34 +79,143 @@ struct Integrator {
 	bool invalidated_gpu_config = true;
 	bool invalidated_aovs       = true;
 
+	// Materials and Mediums whose parameters changed since the last update(), only these are packed and uploaded
+	// A change that affects more than the values of a single Material (e.g. its type) still needs invalidated_materials
+	Array<int> invalidated_material_handles;
+	Array<int> invalidated_medium_handles;
+
 	int screen_width;
 	int screen_height;
 	int screen_pitch;
 
+	// Size of the Accumulator, larger than the screen size if the Integrator renders at a reduced resolution (see cpu_config.render_scale)
+	int display_width;
+	int display_height;
+
+	bool is_upscaling() const { return screen_width != display_width || screen_height != display_height; }
+
+	// Size the screen buffers are allocated for, at least the screen size, see cpu_config.max_width and resize_in_place
+	int alloc_screen_pitch;
+	int alloc_screen_height;
+
+	size_t alloc_pixel_count() const { return size_t(alloc_screen_pitch) * size_t(alloc_screen_height) * size_t(view_count); }
+
 	int pixel_count;
 
+	// Mirrors Camera in CUDA/Camera.h
+	struct CUDACamera {
+		Vector3 position;
+		Vector3 bottom_left_corner;
+		Vector3 x_axis;
+		Vector3 y_axis;
+		float pixel_spread_angle;
+		float aperture_radius;
+		float focal_distance;
+	};
+
+	// Number of Cameras that are traced in the same wavefront, see cpu_config.view_layout. The screen buffers hold the views below each other,
+	// view v covers the rows [v * screen_height, (v + 1) * screen_height) and pixel_count includes all of them. The display shows view 0
+	int view_count = 1;
+
+	CUDAMemory::Ptr<CUDACamera> ptr_view_cameras; // Only allocated if view_count > 1
+
+	CUDACamera get_view_camera(int view) const;
+
 	int sample_index = 0;
 
+	// If set, random numbers are generated with this sample index instead of sample_index,
+	// so that multiple Integrators can render distinct samples of the same image (see render_headless_multi_gpu)
+	int sample_index_rng = INVALID;
+
+	// Number of consecutive samples, starting at sample_index, that the next call to render() takes per pixel
+	// Only the Pathtracer supports more than one, they are summed in the framebuffer and accumulated at once (see render_headless)
+	int samples_per_launch = 1;
+
+	int get_rng_sample_index() const { return sample_index_rng != INVALID ? sample_index_rng : sample_index; }
+
+	// Whether the accumulation continues on a reprojected history when the Camera moves, instead of restarting
+	virtual bool is_reprojecting() const { return false; }
+
 	enum struct PixelQueryStatus {
 		INACTIVE,
-		PENDING,
-		OUTPUT_READY
+		PENDING
 	} pixel_query_status = PixelQueryStatus::INACTIVE;
 
 	PixelQuery pixel_query = { INVALID, INVALID, INVALID };
 
-	CUDAModule::Global global_pixel_query;
+	// A pixel query traces its own Ray on the memory stream instead of waiting for the next frame (see CUDA/Pick.h)
+	struct PickBuffer {
+		CUDAVector3_SoA origin;
+		CUDAVector3_SoA direction;
+
+		CUDAMemory::Ptr<float4> hits;
+
+		CUDAMemory::Ptr<float> ray_time; // Not allocated
+	} pick_buffer;
+
+	CUDAKernel   kernel_pick_generate;
+	CUDAKernel   kernel_pick_bvh2;
+	CUDAKernel   kernel_pick_bvh4;
+	CUDAKernel   kernel_pick_bvh8;
+	CUDAKernel * kernel_pick = nullptr;
+
+	int4  * pinned_pick_hit = nullptr;
+	CUevent event_pick      = { };
+	int     pick_tlas       = 0; // Index of the TLASBuffer that the pick Ray was traced against
 
 	CUDAModule cuda_module;
 
+	// Modules that are compiled besides cuda_module (e.g. Pathtracer::cuda_module_denoise), globals that they
+	// declare as well as cuda_module, like the screen size, the GPUConfig and the AOVs, are set through get_global_shared
+	Array<CUDAModule *> cuda_modules_shared;
+
+	// The global in cuda_module and in every Module of cuda_modules_shared that declares it
+	CUDAModule::SharedGlobal get_global_shared(const char * variable_name) const;
+
+	// If cpu_config.enable_specialised_kernels is set, the feature toggles of this GPUConfig are compiled into cuda_module
+	bool      module_is_specialised = false;
+	GPUConfig module_config;
+
+	bool module_has_traversal_heatmap = false; // Whether the Module was compiled with the traversal counters of the TRAVERSAL_COST AOV
+
+	// Returns the defines that compile the current feature toggles into the Module as constants, see CUDA/Config.h
+	Array<String> get_module_defines(unsigned aov_mask_required = 0);
+
+	// True if the feature toggles changed since the Module was compiled, in which case the Integrator needs to be recreated
+	bool module_is_outdated() const;
+
 	CUstream memory_stream = { };
 
-	CUgraphicsResource resource_accumulator;
+	// Recorded behind the work of the last rendered frame, lets the UI keep running while the GPU is busy (see cpu_config.enable_async_ui)
+	CUevent event_frame_rendered = { };
+
+	void record_frame_rendered() {
+		CUDACALL(cuEventRecord(event_frame_rendered, nullptr)); // The Streams of the frame all synchronize with the legacy default Stream
+	}
+
+	bool is_frame_rendering() const {
+		CUresult result = cuEventQuery(event_frame_rendered);
+		if (result == CUDA_ERROR_NOT_READY) return true;
+
+		CUDACALL(result);
+		return false;
+	}
+
+	// The Accumulator is either a mapping of the GL frame buffer texture, or a plain CUDA array when running headless
+	CUgraphicsResource resource_accumulator = nullptr;
+	CUarray            array_accumulator    = nullptr;
 	CUsurfObject       surf_accumulator;
 
+	unsigned accumulator_handle = 0; // GL frame buffer texture the Accumulator maps, 0 if headless
+
+	// If upscaling, the Kernels render into this Array at screen size, which is reconstructed into the Accumulator
+	CUarray      array_render = nullptr;
+	CUsurfObject surf_render;
+
 	union alignas(float4) CUDAMaterial {
 		struct {
 			Vector3 emission;
+			int     texture_id;
 		} light;
 		struct {
 			Vector3 diffuse;
@@ -101,16 +225,19 @@ struct Integrator {
 			Vector3 diffuse;
 			int     texture_id;
 			float   linear_roughness;
+			int     roughness_texture_id;
 		} plastic;
 		struct {
 			int   medium_id;
 			float ior;
 			float linear_roughness;
+			int   roughness_texture_id;
 		} dielectric;
 		struct {
 			Vector3 eta;
 			float   linear_roughness;
 			Vector3 k;
+			int     roughness_texture_id;
 		} conductor;
 
 		CUDAMaterial() { }
@@ -126,78 +253,171 @@ struct Integrator {
 	};
 	CUDAMemory::Ptr<CUDAMedium> ptr_media;
 
-	struct CUDATexture {
-		CUtexObject texture;
-		float       lod_bias;
+	// Density and majorant grids of heterogeneous Media, see CUDA/Volume.h
+	struct CUDAMediumGrid {
+		Vector3 bounds_min;
+		int     density_offset; // INVALID for homogeneous Media
+		Vector3 bounds_max;
+		int     majorant_offset;
+		int     resolution[3];
+		int     majorant_resolution[3];
 	};
+	CUDAMemory::Ptr<CUDAMediumGrid> ptr_medium_grids;
+	CUDAMemory::Ptr<float>          ptr_medium_grid_data;
 
-	Array<CUDATexture>      textures;
-	Array<CUmipmappedArray> texture_arrays;
+	// Texture streaming, the Kernels record the finest Mip level they sample per Texture
+	static constexpr int TEXTURE_STREAMING_UPDATE_INTERVAL = 16;  // In frames
+	static constexpr int TEXTURE_STREAMING_TAIL_SIZE       = 128; // Mip levels up to this size (in pixels) are always resident
 
-	CUDAMemory::Ptr<CUDATexture> ptr_textures;
+	// Textures are uploaded through a ring of pinned staging buffers on their own copy stream, so that the DMA of one Mip level
+	// overlaps with staging the next one, and the upload of the last Textures overlaps with the Geometry upload (see init_geometry)
+	static constexpr int    TEXTURE_STAGING_BUFFER_COUNT = 4;
+	static constexpr size_t TEXTURE_STAGING_BUFFER_SIZE  = MEGABYTES(8);
+
+	struct TextureStagingBuffer {
+		char *  data  = nullptr; // Pinned, allocated on first use
+		CUevent event = { };     // Recorded after the last copy out of this buffer
+	};
+	TextureStagingBuffer texture_staging_buffers[TEXTURE_STAGING_BUFFER_COUNT];
 
-	struct CUDATriangle {
-		Vector3 position_0;
-		Vector3 position_edge_1;
-		Vector3 position_edge_2;
+	int    texture_staging_index  = 0;
+	size_t texture_staging_offset = 0;
 
-		Vector3 normal_0;
-		Vector3 normal_edge_1;
-		Vector3 normal_edge_2;
+	CUstream texture_upload_stream = { };
 
-		Vector2 tex_coord_0;
-		Vector2 tex_coord_edge_1;
-		Vector2 tex_coord_edge_2;
+	// Used to generate the Mipmaps of Textures with mipmaps_on_gpu set
+	CUDAKernel kernel_mipmap_downsample_x;
+	CUDAKernel kernel_mipmap_downsample_y;
+
+	// Alpha masks, one per Texture that is the alpha Texture of a Material and actually cuts out texels (see Raytracing/Triangle.h)
+	struct CUDAAlphaMask {
+		int width;
+		int height;
+		int offset; // Into ptr_alpha_mask_bits, in words
+		int padding;
 	};
+	static_assert(sizeof(CUDAAlphaMask) == 16); // Read with a single load, see alpha_mask_get
+
+	int        alpha_mask_count = 0;
+	Array<int> material_alpha_mask_ids;  // Per Material, INVALID if the Material is opaque (or was added after init_alpha_masks)
+	Array<int> mesh_data_alpha_mask_ids; // Per MeshData, the alpha mask its Triangle states were classified against, INVALID if they were not
+
+	CUDAMemory::Ptr<CUDAAlphaMask> ptr_alpha_masks;
+	CUDAMemory::Ptr<unsigned>      ptr_alpha_mask_bits;
+	CUDAMemory::Ptr<unsigned>      ptr_alpha_mask_triangle_states;
+
+	CUDAKernel kernel_alpha_mask_build;
+	CUDAKernel kernel_alpha_mask_classify;
+
+	AliasTable::Entry * pinned_light_mesh_alias_table       = nullptr;
+	int2              * pinned_light_mesh_triangle_span     = nullptr;
+	int               * pinned_light_mesh_transform_indices = nullptr;
 
-	CUDAMemory::Ptr<CUDATriangle> ptr_triangles;
+	// The TLAS and the per Mesh data that is stored in TLAS order are double buffered,
+	// so that the TLAS for the next frame can be built on the ThreadPool while the GPU renders using the other one
+	struct TLASBuffer {
+		BVH2                     tlas_raw;
+		OwnPtr<BVH>              tlas;
+		OwnPtr<SAHBuilder>       tlas_builder;
+		OwnPtr<BinnedSAHBuilder> tlas_builder_binned; // Used instead of tlas_builder if cpu_config.tlas_builder is BINNED
+		OwnPtr<BVHConverter>     tlas_converter;
 
-	CUDAMemory::Ptr<BVHNode2>  ptr_bvh_nodes_2;
-	CUDAMemory::Ptr<BVHNode4>  ptr_bvh_nodes_4;
-	CUDAMemory::Ptr<BVHNode8>  ptr_bvh_nodes_8;
-	CUDAMemory::Ptr<int>       ptr_mesh_bvh_root_indices;
-	CUDAMemory::Ptr<int>       ptr_mesh_material_ids;
-	CUDAMemory::Ptr<Matrix3x4> ptr_mesh_transforms;
-	CUDAMemory::Ptr<Matrix3x4> ptr_mesh_transforms_inv;
-	CUDAMemory::Ptr<Matrix3x4> ptr_mesh_transforms_prev;
+		bool  refit_valid    = false; // Whether tlas_raw was built over the current Meshes and can be refitted
+		float sah_cost_built = 0.0f;  // SAH cost of tlas_raw right after its last full build
 
-	int       * pinned_mesh_bvh_root_indices             = nullptr;
-	int       * pinned_mesh_material_ids                 = nullptr;
-	Matrix3x4 * pinned_mesh_transforms                   = nullptr;
-	Matrix3x4 * pinned_mesh_transforms_inv               = nullptr;
-	Matrix3x4 * pinned_mesh_transforms_prev              = nullptr;
-	float     * pinned_light_mesh_cumulative_probability = nullptr;
-	int2      * pinned_light_mesh_triangle_span          = nullptr;
-	int       * pinned_light_mesh_transform_indices      = nullptr;
+		int    node_offset  = 0;       // Offset of this TLAS into the aggregated BVH Node buffer
+		void * pinned_nodes = nullptr; // TLAS Nodes with their child indices offset by node_offset, staged for upload
 
-	BVH2                 tlas_raw;
-	OwnPtr<BVH>          tlas;
-	OwnPtr<SAHBuilder>   tlas_builder;
-	OwnPtr<BVHConverter> tlas_converter;
+		struct DirtyRange {
+			int first;
+			int count;
+		};
+		Array<DirtyRange> dirty_ranges; // Ranges of TLAS slots whose pinned Mesh data needs to be uploaded
+
+		Array<bool> slot_dirty; // Per TLAS slot, scratch space of build_tlas
+
+		CUDAMemory::Ptr<int>       ptr_mesh_bvh_root_indices;
+		CUDAMemory::Ptr<int>       ptr_mesh_material_ids;
+		CUDAMemory::Ptr<int>       ptr_mesh_alpha_mask_ids;
+		CUDAMemory::Ptr<int>       ptr_mesh_lod_chain_ids;
+		CUDAMemory::Ptr<Matrix3x4> ptr_mesh_transforms;
+		CUDAMemory::Ptr<Matrix3x4> ptr_mesh_transforms_inv;
+		CUDAMemory::Ptr<Matrix3x4> ptr_mesh_transforms_prev;
+
+		int       * pinned_mesh_bvh_root_indices = nullptr;
+		int       * pinned_mesh_material_ids     = nullptr;
+		int       * pinned_mesh_alpha_mask_ids   = nullptr;
+		int       * pinned_mesh_lod_chain_ids    = nullptr;
+		Matrix3x4 * pinned_mesh_transforms       = nullptr;
+		Matrix3x4 * pinned_mesh_transforms_inv   = nullptr;
+		Matrix3x4 * pinned_mesh_transforms_prev  = nullptr;
+
+		// Cost of the last build, it is picked up by upload_tlas since the build may have happened on the ThreadPool
+		uint64_t build_time = 0; // Microseconds
+		bool     build_was_refit = false;
+	};
+
+	TLASBuffer tlas_buffers[2];
 
-	Array<int> reverse_indices;
+	int tlas_front    = 0; // Index of the TLASBuffer that is used by the GPU
+	int tlas_rendered = 0; // Index of the TLASBuffer that was used by the last rendered frame
 
-	Array<int> mesh_data_bvh_offsets;
-	Array<int> mesh_data_triangle_offsets;
+	const BVH * tlas = nullptr; // TLAS that is used by the GPU, indexes the Meshes in the Scene
 
-	CUDAModule::Global global_camera;
-	CUDAModule::Global global_sky_scale;
-	CUDAModule::Global global_config;
-	CUDAModule::Global global_buffer_sizes;
+	bool tlas_updated = false; // Set whenever a new TLAS is made visible to the GPU, the order of the Meshes may have changed
 
-	CUarray     sky_array;
-	CUtexObject sky_texture;
+	ThreadPool::TaskGroup tlas_build_group;
+	CUevent               tlas_event_rendered = { };
 
-	CUDAMemory::Ptr<PMJ::Point>     ptr_pmj_samples;
-	CUDAMemory::Ptr<unsigned short> ptr_blue_noise_textures;
+	CUDAModule::Global       global_camera;
+	CUDAModule::Global       global_sky_scale;
+	CUDAModule::SharedGlobal global_config;
+	CUDAModule::Global       global_buffer_sizes;
 
 	CUDAEventPool event_pool;
 
+	int  event_frame_index = 0;
+	bool timings_requested = false; // Set by the GUI while it shows timings, which are then recorded on every frame
+
+	// Decides whether the frame that is about to be rendered records its Events, see cpu_config.event_interval
+	void begin_frame_events();
+
+	// CPU side cost of the last frame, reset at the start of every update() and shown in the Performance section of the GUI
+	// Only the work that scales with the Scene is counted: the Mesh update, the TLAS, light weights and the Material upload
+	struct UpdateStats {
+		uint64_t time_scene_update;    // Microseconds
+		uint64_t time_tlas_build;
+		uint64_t time_light_weights;
+		uint64_t time_material_upload;
+
+		int meshes_updated;
+		int tlas_meshes_uploaded;
+		int materials_uploaded;
+
+		bool tlas_built;
+		bool tlas_refit;
+
+		size_t bytes_uploaded_tlas;
+		size_t bytes_uploaded_materials;
+		size_t bytes_uploaded_lights;
+
+		// Records every value as a counter in the trace, if the Profiler is recording
+		void record_counters() const;
+	} update_stats = { };
+
 	AOV aovs[size_t(AOVType::COUNT)];
-	CUDAModule::Global global_aovs;
+	CUDAModule::SharedGlobal global_aovs;
 
-	Integrator(Scene & scene) : scene(scene) {
-		CUDACALL(cuStreamCreate(&memory_stream, CU_STREAM_NON_BLOCKING));
+	Integrator(Scene & scene, OwnPtr<GPUScene> gpu_scene) : scene(scene), gpu_scene(std::move(gpu_scene)) {
+		if (!this->gpu_scene) {
+			this->gpu_scene = make_owned<GPUScene>();
+		}
+		this->gpu_scene->validate(scene);
+
+		CUDACALL(cuStreamCreate(&memory_stream,         CU_STREAM_NON_BLOCKING));
+		CUDACALL(cuStreamCreate(&texture_upload_stream, CU_STREAM_NON_BLOCKING));
+
+		CUDACALL(cuEventCreate(&event_frame_rendered, CU_EVENT_DISABLE_TIMING));
 	}
 
 	virtual void cuda_init(unsigned frame_buffer_handle, int screen_width, int screen_height) {
@@ -217,10 +437,15 @@ struct Integrator {
 		invalidated_gpu_config = true;
 		invalidated_aovs       = true;
 
+		// The last Texture copies were left in flight while the rest of the Scene was uploaded
+		CUDACALL(cuStreamSynchronize(texture_upload_stream));
+
 		size_t bytes_available = CUDAContext::get_available_memory();
 		size_t bytes_allocated = CUDAContext::total_memory - bytes_available;
 		IO::print("CUDA Memory allocated: {} KB ({} MB)\n"_sv,   bytes_allocated >> 10, bytes_allocated >> 20);
 		IO::print("CUDA Memory free:      {} KB ({} MB)\n\n"_sv, bytes_available >> 10, bytes_available >> 20);
+
+		if (cpu_config.enable_host_data_release) release_host_data();
 	}
 
 	virtual void cuda_free() {
@@ -231,19 +456,55 @@ struct Integrator {
 	void init_globals();
 	void init_materials();
 	void init_geometry();
+	void upload_geometry(); // Uploads the Triangles, Curves and BLAS Nodes into the GPUScene, called by init_geometry if they are not resident
+
+	// Frees the host copies of the assets that are resident in the GPUScene, see cpu_config.enable_host_data_release
+	// Emissive MeshData is kept, the light distributions are built from its Triangles. Everything else that needs a released
+	// asset (a new GPUScene, OptiX, the visibility buffer, refits, picking) reads it back through AssetManager::restore_host_data
+	void release_host_data();
+
+	// Replaces the vertex data of a MeshData by the same number of Triangles, e.g. the next frame of a simulation cache
+	// The BLAS is refitted instead of rebuilt, so its topology stays that of the original Triangles (not supported for BVH4)
+	// Only the Triangles and BVH Nodes of this MeshData are uploaded, in stream order after the previous frame
+	void update_mesh_data(Handle<MeshData> mesh_data_handle, const Array<Triangle> & triangles);
+	virtual void on_mesh_data_updated(int mesh_data_index) { } // For Integrator specific data derived from the Triangles
+
+	// Builds the alpha masks of the Materials and classifies the Triangles against them, requires the Textures and Geometry to be resident
+	// Only Integrators that shade Materials call this, without alpha masks the traversal Kernels treat every Triangle as opaque
+	void init_alpha_masks();
+	void classify_alpha_mask(int mesh_data_index, CUstream stream);
+	void free_alpha_masks();
 	void init_sky();
+
+	void generate_mipmaps(const Texture & texture, CUmipmappedArray array);
+
+	// Creates the CUDA array and Texture Object of a Texture, containing only its Mip levels from first_level onwards
+	void texture_create(int texture_index, const Texture & texture, int first_level);
+
+	// Stages a Mip level in pinned memory and copies it into the level array on the texture_upload_stream
+	void texture_upload_level(CUarray level_array, int width_in_bytes, int height, const char * data);
+	void free_texture_staging();
+
+	// Reads back the Texture feedback and changes which Mip levels are resident, returns true if any Texture changed
+	bool update_texture_streaming();
 	void init_rng();
 	void init_aovs();
+	void init_accumulator(unsigned frame_buffer_handle); // A frame_buffer_handle of 0 means headless
 
 	void free_materials();
 	void free_geometry();
-	void free_sky();
-	void free_rng();
 	void free_aovs();
+	void free_accumulator();
+
+	Array<float4> read_accumulator() const; // Pitch equals display_width
+	Array<float4> read_view(int view) const; // Averaged Radiance of a view from the RADIANCE AOV, pitch equals screen_width
 
 	virtual void resize_free() = 0;
 	virtual void resize_init(unsigned frame_buffer_handle, int width, int height) = 0;
 
+	// Changes the screen size without reallocating the screen buffers, returns false if they do not fit and a full resize is required
+	virtual bool resize_in_place(unsigned frame_buffer_handle, int width, int height) { return false; }
+
 	      AOV & get_aov(AOVType aov_type)       { return aovs[size_t(aov_type)]; }
 	const AOV & get_aov(AOVType aov_type) const { return aovs[size_t(aov_type)]; }
 
@@ -256,30 +517,72 @@ struct Integrator {
 
 	bool aov_render_gui_checkbox(AOVType aov_type, const char * aov_name);
 
-	void build_tlas();
+	void build_tlas(TLASBuffer & buffer);
+	void upload_tlas(const TLASBuffer & buffer);
+	void set_tlas(int buffer_index);
+	void sync_tlas();
+
+	bool update_pinned_mesh_data(TLASBuffer & buffer, int tlas_index);
 
 	virtual void update(float delta, Allocator * frame_allocator);
 	virtual void render() = 0;
 
 	virtual void render_gui() = 0;
 
+	void invalidate_material(Handle<Material> material_handle) {
+		for (size_t i = 0; i < invalidated_material_handles.size(); i++) {
+			if (invalidated_material_handles[i] == material_handle.handle) return;
+		}
+		invalidated_material_handles.push_back(material_handle.handle);
+	}
+
+	void invalidate_medium(Handle<Medium> medium_handle) {
+		for (size_t i = 0; i < invalidated_medium_handles.size(); i++) {
+			if (invalidated_medium_handles[i] == medium_handle.handle) return;
+		}
+		invalidated_medium_handles.push_back(medium_handle.handle);
+	}
+
 	void set_pixel_query(int x, int y) {
-		if (x < 0 || y < 0 || x >= screen_width || y >= screen_height) return;
+		if (x < 0 || y < 0 || x >= display_width || y >= display_height) return;
+		if (!tlas) return; // Nothing to pick before the first TLAS was uploaded
+
+		// Window coordinates are at display resolution
+		x = x * screen_width  / display_width;
+		y = y * screen_height / display_height;
 
 		y = screen_height - y; // Y-coordinate is inverted
 
 		pixel_query.pixel_index = x + y * screen_pitch;
 		pixel_query.mesh_id     = INVALID;
 		pixel_query.triangle_id = INVALID;
-		global_pixel_query.set_value_async(pixel_query, memory_stream);
 
-		pixel_query_status = PixelQueryStatus::PENDING;
+		trace_pick(x, y);
+	}
+
+	void trace_pick(int x, int y);
+
+	// Fills in the pixel_query once its pick Ray has been traced, does not block
+	void poll_pixel_query();
+
+	// Resets the BufferSizes on the Device in stream order, without blocking the host
+	// This allows consecutive batches to be queued back to back and to be captured in a CUDA Graph
+	template<typename BufferSizes>
+	void reset_buffer_sizes(int batch_size, CUstream stream) {
+		static_assert(offsetof(BufferSizes, trace) == 0); // The first int is the number of trace Rays of the first bounce
+		static_assert(sizeof(BufferSizes) % sizeof(int) == 0);
+
+		CUDACALL(cuMemsetD32Async(global_buffer_sizes.ptr, 0, sizeof(BufferSizes) / sizeof(int), stream));
+		CUDACALL(cuMemsetD32Async(global_buffer_sizes.ptr, unsigned(batch_size), 1, stream));
 	}
 
 	// Helper method to calculate the optimal launch bounds for the BVH traversal kernels
 	template<size_t BVH_STACK_ELEMENT_SIZE>
 	void kernel_trace_calc_grid_and_block_size(CUDAKernel & kernel) {
 		CUoccupancyB2DSize block_size_to_shared_memory = [](int block_size) {
+			// The short Stack traversal of the BVH8 does not use Shared Memory
+			if (BVH_STACK_ELEMENT_SIZE == 8 && cpu_config.enable_bvh8_short_stack) return size_t(0);
+
 			return size_t(block_size) * SHARED_STACK_SIZE * BVH_STACK_ELEMENT_SIZE;
 		};
 
@@ -0,0 +1,436 @@
+#include "OptiXTraversal.h"
+
+#include <cstddef>
+
+#include "Config.h"
+
+#include "Core/IO.h"
+#include "Core/Timer.h"
+#include "Core/Allocators/StackAllocator.h"
+
+#include "Device/CUDAModule.h"
+#include "Device/CUDAContext.h"
+
+#include "Renderer/Scene.h"
+
+#include "Util/Util.h"
+
+#include "Integrator.h"
+#include "GPUScene.h"
+
+#ifdef TRAVERSAL_OPTIX
+#include <optix.h>
+#include <optix_stubs.h>
+#include <optix_stack_size.h>
+#include <optix_function_table_definition.h>
+#endif
+
+bool OptiXTraversal::is_available() {
+#ifdef TRAVERSAL_OPTIX
+	return true;
+#else
+	return false;
+#endif
+}
+
+#ifdef TRAVERSAL_OPTIX
+#define OPTIX_CALL(result) check_optix_call(result, __FILE__, __LINE__);
+
+static void check_optix_call(OptixResult result, const char * file, int line) {
+	if (result != OPTIX_SUCCESS) {
+		IO::print("{}:{}: OptiX call failed with error {}!\n"_sv, file, line, optixGetErrorName(result));
+		IO::exit(1);
+	}
+}
+
+static void optix_log_callback(unsigned level, const char * tag, const char * message, void * data) {
+	IO::print("OptiX [{}]: {}\n"_sv, tag, message);
+}
+
+static_assert(sizeof(OptiXTraversal::Params) == 48);
+
+enum struct SBTRecord {
+	RAYGEN_TRACE,
+	RAYGEN_SHADOW,
+	MISS_TRACE,
+	MISS_SHADOW,
+	HIT_TRACE,
+
+	COUNT
+};
+
+static OptixProgramGroup create_program_group(OptixDeviceContext context, const OptixProgramGroupDesc & desc) {
+	OptixProgramGroupOptions options = { };
+
+	char   log[2048];
+	size_t log_size = sizeof(log);
+
+	OptixProgramGroup program_group;
+	OPTIX_CALL(optixProgramGroupCreate(context, &desc, 1, &options, log, &log_size, &program_group));
+
+	return program_group;
+}
+
+static OptixProgramGroup create_program_group_raygen(OptixDeviceContext context, OptixModule module, const char * entry_function_name) {
+	OptixProgramGroupDesc desc = { };
+	desc.kind                     = OPTIX_PROGRAM_GROUP_KIND_RAYGEN;
+	desc.raygen.module            = module;
+	desc.raygen.entryFunctionName = entry_function_name;
+
+	return create_program_group(context, desc);
+}
+
+static OptixProgramGroup create_program_group_miss(OptixDeviceContext context, OptixModule module, const char * entry_function_name) {
+	OptixProgramGroupDesc desc = { };
+	desc.kind                   = OPTIX_PROGRAM_GROUP_KIND_MISS;
+	desc.miss.module            = module;
+	desc.miss.entryFunctionName = entry_function_name;
+
+	return create_program_group(context, desc);
+}
+
+static OptixShaderBindingTable get_sbt(CUdeviceptr sbt_records, SBTRecord raygen) {
+	OptixShaderBindingTable sbt = { };
+	sbt.raygenRecord                = sbt_records + int(raygen) * OPTIX_SBT_RECORD_HEADER_SIZE;
+	sbt.missRecordBase              = sbt_records + int(SBTRecord::MISS_TRACE) * OPTIX_SBT_RECORD_HEADER_SIZE;
+	sbt.missRecordStrideInBytes     = OPTIX_SBT_RECORD_HEADER_SIZE;
+	sbt.missRecordCount             = 2;
+	sbt.hitgroupRecordBase          = sbt_records + int(SBTRecord::HIT_TRACE) * OPTIX_SBT_RECORD_HEADER_SIZE;
+	sbt.hitgroupRecordStrideInBytes = OPTIX_SBT_RECORD_HEADER_SIZE;
+	sbt.hitgroupRecordCount         = 1;
+
+	return sbt;
+}
+#endif
+
+void OptiXTraversal::init(const Scene & scene, const GPUScene & gpu_scene, int batch_size, const Queues & queues) {
+#ifdef TRAVERSAL_OPTIX
+	ScopeTimer timer("OptiX Init"_sv);
+
+	this->queues = queues;
+
+	OPTIX_CALL(optixInit());
+
+	CUcontext cuda_context;
+	CUDACALL(cuCtxGetCurrent(&cuda_context));
+
+	OptixDeviceContextOptions context_options = { };
+	context_options.logCallbackFunction = optix_log_callback;
+	context_options.logCallbackLevel    = 2; // Errors and warnings
+	OPTIX_CALL(optixDeviceContextCreate(cuda_context, &context_options, &context));
+
+	// The include directory of the OptiX SDK is configured by CMake, the device headers are compiled by NVRTC
+	StackAllocator<KILOBYTES(1)> allocator;
+
+	Array<String> options;
+	options.push_back(Format(&allocator).format("-I{}"_sv, StringView::from_c_str(OPTIX_INCLUDE_DIR)));
+
+	// The Ray Buffers are shared with the Pathtracer Module, so they need to be compiled with the same layout (see Integrator::get_module_defines)
+	if (cpu_config.enable_packed_ray_buffers) {
+		options.push_back("-DCONFIG_PACKED_RAY_BUFFERS=1"_sv);
+	}
+
+	String ptx = CUDAModule::compile_ptx("OptiX"_sv, StringView::from_c_str(MODULE_FILENAME), CUDAContext::compute_capability, options);
+
+	OptixModuleCompileOptions module_compile_options = { };
+	module_compile_options.optLevel   = OPTIX_COMPILE_OPTIMIZATION_DEFAULT;
+	module_compile_options.debugLevel = OPTIX_COMPILE_DEBUG_LEVEL_MINIMAL;
+
+	OptixPipelineCompileOptions pipeline_compile_options = { };
+	pipeline_compile_options.usesMotionBlur                   = false;
+	pipeline_compile_options.traversableGraphFlags            = OPTIX_TRAVERSABLE_GRAPH_FLAG_ALLOW_SINGLE_LEVEL_INSTANCING;
+	pipeline_compile_options.numPayloadValues                 = 5; // t, u, v, mesh_id and triangle_id
+	pipeline_compile_options.numAttributeValues               = 2; // Triangle barycentrics
+	pipeline_compile_options.exceptionFlags                   = OPTIX_EXCEPTION_FLAG_NONE;
+	pipeline_compile_options.pipelineLaunchParamsVariableName = "params";
+	pipeline_compile_options.usesPrimitiveTypeFlags           = OPTIX_PRIMITIVE_TYPE_FLAGS_TRIANGLE;
+
+	char   log[2048];
+	size_t log_size = sizeof(log);
+	OPTIX_CALL(optixModuleCreate(context, &module_compile_options, &pipeline_compile_options, ptx.data(), ptx.size(), log, &log_size, &module));
+
+	program_group_raygen_trace  = create_program_group_raygen(context, module, "__raygen__trace");
+	program_group_raygen_shadow = create_program_group_raygen(context, module, "__raygen__shadow");
+	program_group_miss_trace    = create_program_group_miss  (context, module, "__miss__trace");
+	program_group_miss_shadow   = create_program_group_miss  (context, module, "__miss__shadow");
+
+	OptixProgramGroupDesc desc_hit = { };
+	desc_hit.kind                         = OPTIX_PROGRAM_GROUP_KIND_HITGROUP;
+	desc_hit.hitgroup.moduleCH            = module;
+	desc_hit.hitgroup.entryFunctionNameCH = "__closesthit__trace";
+	program_group_hit_trace = create_program_group(context, desc_hit);
+
+	OptixProgramGroup program_groups[] = {
+		program_group_raygen_trace,
+		program_group_raygen_shadow,
+		program_group_miss_trace,
+		program_group_miss_shadow,
+		program_group_hit_trace
+	};
+
+	OptixPipelineLinkOptions pipeline_link_options = { };
+	pipeline_link_options.maxTraceDepth = 1;
+
+	log_size = sizeof(log);
+	OPTIX_CALL(optixPipelineCreate(context, &pipeline_compile_options, &pipeline_link_options, program_groups, Util::array_count(program_groups), log, &log_size, &pipeline));
+
+	// Nothing is traced recursively and there are no callables. The traversable graph is an IAS over GASes, so its depth is 2
+	OptixStackSizes stack_sizes = { };
+	for (int i = 0; i < Util::array_count(program_groups); i++) {
+		OPTIX_CALL(optixUtilAccumulateStackSizes(program_groups[i], &stack_sizes, pipeline));
+	}
+
+	unsigned stack_size_direct_callable_from_traversal;
+	unsigned stack_size_direct_callable_from_state;
+	unsigned stack_size_continuation;
+	OPTIX_CALL(optixUtilComputeStackSizes(&stack_sizes, pipeline_link_options.maxTraceDepth, 0, 0, &stack_size_direct_callable_from_traversal, &stack_size_direct_callable_from_state, &stack_size_continuation));
+	OPTIX_CALL(optixPipelineSetStackSize(pipeline, stack_size_direct_callable_from_traversal, stack_size_direct_callable_from_state, stack_size_continuation, 2));
+
+	// The programs do not need any data in their records, the SBT only consists of the headers
+	byte sbt_records[int(SBTRecord::COUNT) * OPTIX_SBT_RECORD_HEADER_SIZE];
+	for (int i = 0; i < int(SBTRecord::COUNT); i++) {
+		OPTIX_CALL(optixSbtRecordPackHeader(program_groups[i], sbt_records + i * OPTIX_SBT_RECORD_HEADER_SIZE));
+	}
+	ptr_sbt_records = CUDAMemory::malloc(sbt_records);
+
+	CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::BVH);
+
+	size_t mesh_data_count = scene.asset_manager.mesh_datas.size();
+	gas_buffers.resize(mesh_data_count);
+	gas_handles.resize(mesh_data_count);
+
+	for (int m = 0; m < mesh_data_count; m++) {
+		gas_handles[m] = 0;
+		build_gas(scene, gpu_scene, m);
+	}
+
+	size_t mesh_count = scene.meshes.size();
+
+	ptr_instances    = CUDAMemory::malloc<byte>(mesh_count * sizeof(OptixInstance));
+	pinned_instances = CUDAMemory::malloc_pinned<byte>(mesh_count * sizeof(OptixInstance));
+
+	ptr_mesh_triangle_offsets    = CUDAMemory::malloc<int>(mesh_count);
+	pinned_mesh_triangle_offsets = CUDAMemory::malloc_pinned<int>(mesh_count);
+
+	ptr_shadow_occluded = CUDAMemory::malloc<int>(batch_size);
+
+	ptr_params    = CUDAMemory::malloc<Params>(2 * MAX_BOUNCES);
+	pinned_params = CUDAMemory::malloc_pinned<Params>(2 * MAX_BOUNCES);
+#else
+	ASSERT_UNREACHABLE(); // Should check is_available() first
+#endif
+}
+
+void OptiXTraversal::free() {
+#ifdef TRAVERSAL_OPTIX
+	for (size_t i = 0; i < gas_buffers.size(); i++) {
+		if (gas_handles[i]) {
+			CUDAMemory::free(gas_buffers[i]);
+		}
+	}
+	gas_buffers.clear();
+	gas_handles.clear();
+
+	if (ptr_ias     .ptr) CUDAMemory::free(ptr_ias);
+	if (ptr_ias_temp.ptr) CUDAMemory::free(ptr_ias_temp);
+	ias_size      = 0;
+	ias_temp_size = 0;
+	ias_handle    = 0;
+
+	CUDAMemory::free(ptr_instances);
+	CUDAMemory::free_pinned(pinned_instances);
+
+	CUDAMemory::free(ptr_mesh_triangle_offsets);
+	CUDAMemory::free_pinned(pinned_mesh_triangle_offsets);
+
+	CUDAMemory::free(ptr_shadow_occluded);
+
+	CUDAMemory::free(ptr_params);
+	CUDAMemory::free_pinned(pinned_params);
+
+	CUDAMemory::free(ptr_sbt_records);
+
+	OPTIX_CALL(optixPipelineDestroy(pipeline));
+	OPTIX_CALL(optixProgramGroupDestroy(program_group_raygen_trace));
+	OPTIX_CALL(optixProgramGroupDestroy(program_group_raygen_shadow));
+	OPTIX_CALL(optixProgramGroupDestroy(program_group_miss_trace));
+	OPTIX_CALL(optixProgramGroupDestroy(program_group_miss_shadow));
+	OPTIX_CALL(optixProgramGroupDestroy(program_group_hit_trace));
+	OPTIX_CALL(optixModuleDestroy(module));
+	OPTIX_CALL(optixDeviceContextDestroy(context));
+
+	context  = nullptr;
+	module   = nullptr;
+	pipeline = nullptr;
+#endif
+}
+
+void OptiXTraversal::build_gas(const Scene & scene, const GPUScene & gpu_scene, int mesh_data_index) {
+#ifdef TRAVERSAL_OPTIX
+	const MeshData & mesh_data = scene.asset_manager.mesh_datas[mesh_data_index];
+	if (mesh_data.has_curves()) return; // Not supported by this backend, see Pathtracer::optix_supported
+
+	if (gas_handles[mesh_data_index]) {
+		CUDAMemory::free(gas_buffers[mesh_data_index]);
+		gas_handles[mesh_data_index] = 0;
+	}
+
+	// The Triangles are laid out in BVH order like the aggregated Triangles, so that the primitive index of a hit is relative to mesh_data_index_offsets
+	const Array<int> & indices = mesh_data.bvh->indices;
+
+	Array<Vector3> positions(3 * indices.size());
+	for (size_t i = 0; i < indices.size(); i++) {
+		for (int v = 0; v < 3; v++) {
+			positions[3 * i + v] = mesh_data.triangles.vertices[mesh_data.triangles.indices[3 * indices[i] + v]].position;
+		}
+	}
+	CUDAMemory::Ptr<Vector3> ptr_positions = CUDAMemory::malloc(positions);
+
+	unsigned geometry_flags = OPTIX_GEOMETRY_FLAG_DISABLE_ANYHIT;
+
+	OptixBuildInput build_input = { };
+	build_input.type = OPTIX_BUILD_INPUT_TYPE_TRIANGLES;
+	build_input.triangleArray.vertexFormat        = OPTIX_VERTEX_FORMAT_FLOAT3;
+	build_input.triangleArray.vertexStrideInBytes = sizeof(Vector3);
+	build_input.triangleArray.numVertices         = unsigned(positions.size());
+	build_input.triangleArray.vertexBuffers       = &ptr_positions.ptr;
+	build_input.triangleArray.flags               = &geometry_flags;
+	build_input.triangleArray.numSbtRecords       = 1;
+
+	OptixAccelBuildOptions build_options = { };
+	build_options.buildFlags = OPTIX_BUILD_FLAG_ALLOW_COMPACTION | OPTIX_BUILD_FLAG_PREFER_FAST_TRACE;
+	build_options.operation  = OPTIX_BUILD_OPERATION_BUILD;
+
+	OptixAccelBufferSizes buffer_sizes;
+	OPTIX_CALL(optixAccelComputeMemoryUsage(context, &build_options, &build_input, 1, &buffer_sizes));
+
+	CUDAMemory::Ptr<byte>   ptr_temp           = CUDAMemory::malloc<byte>(buffer_sizes.tempSizeInBytes);
+	CUDAMemory::Ptr<byte>   ptr_output         = CUDAMemory::malloc<byte>(buffer_sizes.outputSizeInBytes);
+	CUDAMemory::Ptr<size_t> ptr_compacted_size = CUDAMemory::malloc<size_t>();
+
+	OptixAccelEmitDesc emit_desc = { };
+	emit_desc.type   = OPTIX_PROPERTY_TYPE_COMPACTED_SIZE;
+	emit_desc.result = ptr_compacted_size.ptr;
+
+	OptixTraversableHandle handle;
+	OPTIX_CALL(optixAccelBuild(context, nullptr, &build_options, &build_input, 1, ptr_temp.ptr, buffer_sizes.tempSizeInBytes, ptr_output.ptr, buffer_sizes.outputSizeInBytes, &handle, &emit_desc, 1));
+
+	size_t compacted_size;
+	CUDAMemory::memcpy(&compacted_size, ptr_compacted_size);
+
+	if (compacted_size < buffer_sizes.outputSizeInBytes) {
+		CUDAMemory::Ptr<byte> ptr_compacted = CUDAMemory::malloc<byte>(compacted_size);
+		OPTIX_CALL(optixAccelCompact(context, nullptr, handle, ptr_compacted.ptr, compacted_size, &handle));
+
+		CUDAMemory::free(ptr_output);
+		ptr_output = ptr_compacted;
+	}
+
+	CUDAMemory::free(ptr_temp);
+	CUDAMemory::free(ptr_compacted_size);
+	CUDAMemory::free(ptr_positions);
+
+	gas_buffers[mesh_data_index] = ptr_output;
+	gas_handles[mesh_data_index] = handle;
+#endif
+}
+
+void OptiXTraversal::build_ias(const Scene & scene, const GPUScene & gpu_scene, const BVH & tlas, const Matrix3x4 transforms[], CUstream stream) {
+#ifdef TRAVERSAL_OPTIX
+	// NOTE: The pinned buffers are not double buffered, the Pathtracer synchronizes the memory stream every frame before a new build can happen
+	OptixInstance * instances = reinterpret_cast<OptixInstance *>(pinned_instances);
+
+	int instance_count = 0;
+
+	for (size_t slot = 0; slot < tlas.indices.size(); slot++) {
+		const Mesh & mesh = scene.meshes[tlas.indices[slot]];
+
+		int mesh_data_index = mesh.mesh_data_handle.handle;
+
+		pinned_mesh_triangle_offsets[slot] = gpu_scene.mesh_data_index_offsets[mesh_data_index];
+
+		// Meshes that are hidden from all Rays do not need an instance, the visibility mask takes care of the rest
+		unsigned visibility_mask = mesh.visibility_mask & ((1u << int(MeshVisibility::COUNT)) - 1);
+		if (visibility_mask == 0 || gas_handles[mesh_data_index] == 0) continue;
+
+		OptixInstance & instance = instances[instance_count++];
+		memcpy(instance.transform, transforms[slot].cells, sizeof(instance.transform)); // Both are row major 3x4
+		instance.instanceId        = unsigned(slot);
+		instance.sbtOffset         = 0;
+		instance.visibilityMask    = visibility_mask;
+		instance.flags             = OPTIX_INSTANCE_FLAG_DISABLE_ANYHIT;
+		instance.traversableHandle = gas_handles[mesh_data_index];
+	}
+
+	if (tlas.indices.size() > 0) {
+		CUDAMemory::memcpy_async(ptr_mesh_triangle_offsets, pinned_mesh_triangle_offsets, tlas.indices.size(), stream);
+	}
+	if (instance_count > 0) {
+		CUDAMemory::memcpy_async(ptr_instances, pinned_instances, instance_count * sizeof(OptixInstance), stream);
+	}
+
+	OptixBuildInput build_input = { };
+	build_input.type = OPTIX_BUILD_INPUT_TYPE_INSTANCES;
+	build_input.instanceArray.instances    = ptr_instances.ptr;
+	build_input.instanceArray.numInstances = unsigned(instance_count);
+
+	// The IAS is rebuilt from scratch whenever the TLAS changes, the Meshes may have been reordered
+	OptixAccelBuildOptions build_options = { };
+	build_options.buildFlags = OPTIX_BUILD_FLAG_PREFER_FAST_BUILD;
+	build_options.operation  = OPTIX_BUILD_OPERATION_BUILD;
+
+	OptixAccelBufferSizes buffer_sizes;
+	OPTIX_CALL(optixAccelComputeMemoryUsage(context, &build_options, &build_input, 1, &buffer_sizes));
+
+	CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::BVH);
+
+	// Only grow the buffers, the number of visible Meshes changes between builds
+	if (buffer_sizes.outputSizeInBytes > ias_size) {
+		if (ptr_ias.ptr) CUDAMemory::free(ptr_ias);
+		ias_size = buffer_sizes.outputSizeInBytes;
+		ptr_ias  = CUDAMemory::malloc<byte>(ias_size);
+	}
+	if (buffer_sizes.tempSizeInBytes > ias_temp_size) {
+		if (ptr_ias_temp.ptr) CUDAMemory::free(ptr_ias_temp);
+		ias_temp_size = buffer_sizes.tempSizeInBytes;
+		ptr_ias_temp  = CUDAMemory::malloc<byte>(ias_temp_size);
+	}
+
+	OPTIX_CALL(optixAccelBuild(context, stream, &build_options, &build_input, 1, ptr_ias_temp.ptr, ias_temp_size, ptr_ias.ptr, ias_size, &ias_handle, nullptr, 0));
+
+	// The handle is part of the launch parameters, they are written for every bounce at once
+	for (int bounce = 0; bounce < MAX_BOUNCES; bounce++) {
+		Params & params_trace  = pinned_params[bounce];
+		Params & params_shadow = pinned_params[MAX_BOUNCES + bounce];
+
+		params_trace.handle                = ias_handle;
+		params_trace.traversal_data        = (bounce & 1) ? queues.ray_buffer_trace_1 : queues.ray_buffer_trace_0; // Same as get_ray_buffer_trace in Pathtracer.cu
+		params_trace.shadow_traversal_data = 0;
+		params_trace.ray_count             = queues.buffer_sizes_trace + bounce * sizeof(int);
+		params_trace.shadow_occluded       = 0;
+		params_trace.mesh_triangle_offsets = ptr_mesh_triangle_offsets.ptr;
+
+		params_shadow.handle                = ias_handle;
+		params_shadow.traversal_data        = 0;
+		params_shadow.shadow_traversal_data = queues.ray_buffer_shadow;
+		params_shadow.ray_count             = queues.buffer_sizes_shadow + bounce * sizeof(int);
+		params_shadow.shadow_occluded       = ptr_shadow_occluded.ptr;
+		params_shadow.mesh_triangle_offsets = ptr_mesh_triangle_offsets.ptr;
+	}
+	CUDAMemory::memcpy_async(ptr_params, pinned_params, 2 * MAX_BOUNCES, stream);
+#endif
+}
+
+void OptiXTraversal::trace(int bounce, int launch_width, CUstream stream) const {
+#ifdef TRAVERSAL_OPTIX
+	OptixShaderBindingTable sbt = get_sbt(ptr_sbt_records.ptr, SBTRecord::RAYGEN_TRACE);
+	OPTIX_CALL(optixLaunch(pipeline, stream, ptr_params.ptr + bounce * sizeof(Params), sizeof(Params), &sbt, unsigned(launch_width), 1, 1));
+#endif
+}
+
+void OptiXTraversal::trace_shadow(int bounce, int launch_width, CUstream stream) const {
+#ifdef TRAVERSAL_OPTIX
+	OptixShaderBindingTable sbt = get_sbt(ptr_sbt_records.ptr, SBTRecord::RAYGEN_SHADOW);
+	OPTIX_CALL(optixLaunch(pipeline, stream, ptr_params.ptr + (MAX_BOUNCES + bounce) * sizeof(Params), sizeof(Params), &sbt, unsigned(launch_width), 1, 1));
+#endif
+}
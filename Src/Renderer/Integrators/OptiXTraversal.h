@@ -0,0 +1,101 @@
+#pragma once
+#include "Core/Array.h"
+#include "Core/String.h"
+
+#include "Device/CUDAMemory.h"
+
+#include "BVH/BVH.h"
+
+#include "CUDA/Common.h"
+
+struct Scene;
+struct GPUScene;
+struct Matrix3x4;
+
+struct OptixDeviceContext_t;
+struct OptixModule_t;
+struct OptixProgramGroup_t;
+struct OptixPipeline_t;
+
+// Traces the wavefront trace and shadow queues of the Pathtracer on the RT cores through OptiX, instead of the software trace Kernels
+// Every MeshData with Triangles gets a compacted GAS over its Triangles in the order of the aggregated Triangles, so that a hit refers to
+// the same triangle_id as with the BVH. The IAS mirrors the TLAS, instance i is the Mesh in TLAS slot i and uses i as its instance id
+// OptiX is an optional dependency, it is only compiled in if the build defines TRAVERSAL_OPTIX (ENABLE_OPTIX in CMakeLists.txt)
+struct OptiXTraversal {
+	static constexpr const char * MODULE_FILENAME = "Src/CUDA/OptiX.cu";
+
+	// Must match OptiXParams in OptiX.cu
+	struct Params {
+		unsigned long long handle;
+
+		CUdeviceptr traversal_data;
+		CUdeviceptr shadow_traversal_data;
+
+		CUdeviceptr ray_count;
+
+		CUdeviceptr shadow_occluded;
+		CUdeviceptr mesh_triangle_offsets;
+	};
+
+	// Addresses of the Pathtracer globals that a launch reads the Rays and queue sizes from
+	struct Queues {
+		CUdeviceptr ray_buffer_trace_0;
+		CUdeviceptr ray_buffer_trace_1;
+		CUdeviceptr ray_buffer_shadow;
+
+		CUdeviceptr buffer_sizes_trace;  // buffer_sizes.trace [0]
+		CUdeviceptr buffer_sizes_shadow; // buffer_sizes.shadow[0]
+	};
+
+	OptixDeviceContext_t * context  = nullptr;
+	OptixModule_t        * module   = nullptr;
+	OptixPipeline_t      * pipeline = nullptr;
+
+	OptixProgramGroup_t * program_group_raygen_trace  = nullptr;
+	OptixProgramGroup_t * program_group_raygen_shadow = nullptr;
+	OptixProgramGroup_t * program_group_miss_trace    = nullptr;
+	OptixProgramGroup_t * program_group_miss_shadow   = nullptr;
+	OptixProgramGroup_t * program_group_hit_trace     = nullptr;
+
+	CUDAMemory::Ptr<byte> ptr_sbt_records; // Header only records: raygen trace, raygen shadow, miss trace, miss shadow, hit trace
+
+	// Per MeshData, a handle of 0 means the MeshData has no GAS (it consists of Curves)
+	Array<CUDAMemory::Ptr<byte>> gas_buffers;
+	Array<unsigned long long>    gas_handles;
+
+	CUDAMemory::Ptr<byte> ptr_ias;
+	CUDAMemory::Ptr<byte> ptr_ias_temp;
+	CUDAMemory::Ptr<byte> ptr_instances;
+	size_t ias_size      = 0;
+	size_t ias_temp_size = 0;
+
+	byte * pinned_instances = nullptr; // One OptixInstance per Mesh
+
+	unsigned long long ias_handle = 0;
+
+	CUDAMemory::Ptr<int> ptr_mesh_triangle_offsets;
+	int                * pinned_mesh_triangle_offsets = nullptr;
+
+	CUDAMemory::Ptr<int> ptr_shadow_occluded; // Per shadow Ray of the current bounce, see kernel_shadow_resolve
+
+	Queues queues;
+
+	// Launch parameters of every bounce, the trace queues of bounce b followed by the shadow queues of bounce b
+	CUDAMemory::Ptr<Params> ptr_params;
+	Params                * pinned_params = nullptr;
+
+	static bool is_available();
+
+	void init(const Scene & scene, const GPUScene & gpu_scene, int batch_size, const Queues & queues);
+	void free();
+
+	// Rebuilds the GAS of a MeshData whose Triangles were updated, the IAS has to be rebuilt afterwards
+	void build_gas(const Scene & scene, const GPUScene & gpu_scene, int mesh_data_index);
+
+	// Rebuilds the IAS from the given TLAS and its transforms, in stream order on the given stream
+	void build_ias(const Scene & scene, const GPUScene & gpu_scene, const BVH & tlas, const Matrix3x4 transforms[], CUstream stream);
+
+	// Trace the queues of the given bounce, the launch width only needs to be an estimate of the queue size
+	void trace       (int bounce, int launch_width, CUstream stream) const;
+	void trace_shadow(int bounce, int launch_width, CUstream stream) const;
+};
@@ -1,36 +1,131 @@
 #include "Pathtracer.h"
 
 #include <Imgui/imgui.h>
+#include <stb_image.h>
 
+#include "Core/Sort.h"
 #include "Core/Allocators/LinearAllocator.h"
 
+#include "Util/Profiler.h"
+
 #include "CUDA/Common.h"
 
 void Pathtracer::cuda_init(unsigned frame_buffer_handle, int screen_width, int screen_height) {
+	// The Module is compiled for the features that are enabled, so they need to be settled first
+	if (is_baking()) bake_prepare(screen_width, screen_height);
+
 	init_module();
 	init_globals();
 
 	pinned_buffer_sizes = CUDAMemory::malloc_pinned<BufferSizes>();
-	pinned_buffer_sizes->reset(BATCH_SIZE);
+	pinned_buffer_sizes->reset(0);
+
+	pinned_convergence_error = CUDAMemory::malloc_pinned<float2>();
 
 	global_buffer_sizes = cuda_module.get_global("buffer_sizes");
 	global_buffer_sizes.set_value(*pinned_buffer_sizes);
 
-	resize_init(frame_buffer_handle, screen_width, screen_height);
+	CUDACALL(cuStreamCreate(&stream_graph, CU_STREAM_DEFAULT));
+
+	for (int i = 0; i < MATERIAL_STREAM_COUNT; i++) {
+		CUDACALL(cuStreamCreate(&stream_material[i], CU_STREAM_NON_BLOCKING));
+		CUDACALL(cuEventCreate(&event_material_join[i], CU_EVENT_DISABLE_TIMING));
+	}
+	CUDACALL(cuEventCreate(&event_material_fork, CU_EVENT_DISABLE_TIMING));
+
+	CUDACALL(cuStreamCreate(&stream_shadow, CU_STREAM_NON_BLOCKING));
+	CUDACALL(cuEventCreate(&event_shadow_fork, CU_EVENT_DISABLE_TIMING));
+	CUDACALL(cuEventCreate(&event_shadow_join, CU_EVENT_DISABLE_TIMING));
+	CUDACALL(cuEventCreate(&event_buffer_sizes_readback, CU_EVENT_DISABLE_TIMING));
+
+	sm_count = CUDAContext::get_sm_count();
+	buffer_sizes_readback_pending = false;
+	buffer_sizes_prev_valid       = false;
 
 	init_materials();
 	init_geometry();
+	init_alpha_masks();
+
+	CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::WAVEFRONT);
+
+	ptr_material_sort_offsets = CUDAMemory::malloc<int>(scene.asset_manager.materials.size());
+	CUDAMemory::memset_async(ptr_material_sort_offsets, 0, scene.asset_manager.materials.size(), memory_stream);
+	cuda_module.get_global("material_sort_offsets").set_value(ptr_material_sort_offsets);
 	init_sky();
 	init_rng();
 	init_events();
 	init_luts();
 
-	ray_buffer_trace_0.init(BATCH_SIZE);
-	ray_buffer_trace_1.init(BATCH_SIZE);
+	// Size the wavefront Buffers based on the memory that is left after uploading Geometry and Textures
+	int render_width;
+	int render_height;
+	calc_render_size(frame_buffer_handle, screen_width, screen_height, render_width, render_height);
+
+	view_count = calc_view_count(frame_buffer_handle);
+	if (view_count > 1) {
+		ptr_view_cameras = CUDAMemory::malloc<CUDACamera>(view_count);
+		cuda_module.get_global("view_cameras").set_value(ptr_view_cameras);
+	}
+
+	batch_size = calc_batch_size(render_width, render_height);
+	cuda_module.get_global("batch_size").set_value(batch_size);
+
+	has_gl_context = frame_buffer_handle != 0;
+	global_raster_jitter = cuda_module.get_global("raster_jitter");
+
+	resize_init(frame_buffer_handle, screen_width, screen_height);
+
+	ray_buffer_trace_0.init(batch_size);
+	ray_buffer_trace_1.init(batch_size);
+
+	ptr_ray_sort_offsets = CUDAMemory::malloc<int>(RAY_SORT_KEY_COUNT);
+	ptr_ray_sort_index   = CUDAMemory::malloc<int>(batch_size);
+	CUDAMemory::memset_async(ptr_ray_sort_offsets, 0, RAY_SORT_KEY_COUNT, memory_stream);
+	cuda_module.get_global("ray_sort_offsets").set_value(ptr_ray_sort_offsets);
+	cuda_module.get_global("ray_sort_index")  .set_value(ptr_ray_sort_index);
+
+	if (cpu_config.enable_treelet_queues && treelet_queues_supported()) treelet_queues_init();
+
+	ptr_medium_queue = CUDAMemory::malloc<int>(batch_size);
+	cuda_module.get_global("medium_queue").set_value(ptr_medium_queue);
+
+	ptr_emission_queue = CUDAMemory::malloc<int>(batch_size);
+	cuda_module.get_global("emission_queue").set_value(ptr_emission_queue);
 	cuda_module.get_global("ray_buffer_trace_0").set_value(ray_buffer_trace_0);
 	cuda_module.get_global("ray_buffer_trace_1").set_value(ray_buffer_trace_1);
 
+	// Shadow Rays are not only traced towards light Triangles but also towards the Sky, so the ShadowRayBuffer always exists
+	ray_buffer_shadow.init(batch_size);
+
 	global_ray_buffer_shadow = cuda_module.get_global("ray_buffer_shadow");
+	global_ray_buffer_shadow.set_value(ray_buffer_shadow);
+
+	if (cpu_config.traversal_backend == TraversalBackend::OPTIX) {
+		if (optix_supported()) {
+			// OptiX reads the Rays straight from the globals of this Module, so that the Buffers are not duplicated
+			OptiXTraversal::Queues queues = { };
+			queues.ray_buffer_trace_0  = cuda_module.get_global("ray_buffer_trace_0").ptr;
+			queues.ray_buffer_trace_1  = cuda_module.get_global("ray_buffer_trace_1").ptr;
+			queues.ray_buffer_shadow   = global_ray_buffer_shadow.ptr;
+			queues.buffer_sizes_trace  = global_buffer_sizes.ptr + offsetof(BufferSizes, trace);
+			queues.buffer_sizes_shadow = global_buffer_sizes.ptr + offsetof(BufferSizes, shadow);
+
+			// The GAS are built from the host copies of the Triangles, even if the GPUScene is still resident
+			for (size_t i = 0; i < scene.asset_manager.mesh_datas.size(); i++) {
+				scene.asset_manager.restore_host_data(Handle<MeshData> { int(i) });
+			}
+
+			optix_traversal.init(scene, *gpu_scene.get(), batch_size, queues);
+			use_optix = true;
+		} else {
+			if (!OptiXTraversal::is_available()) {
+				IO::print("WARNING: OptiX traversal was not compiled in (see ENABLE_OPTIX), using software traversal!\n"_sv);
+			} else {
+				IO::print("WARNING: OptiX traversal does not support motion blur, Curves or alpha masks, using software traversal!\n"_sv);
+			}
+			cpu_config.traversal_backend = TraversalBackend::SOFTWARE; // So that the ray stats report what was actually used
+		}
+	}
 
 	global_svgf_data = cuda_module.get_global("svgf_data");
 
@@ -42,26 +137,71 @@ void Pathtracer::cuda_init(unsigned frame_buffer_handle, int screen_width, int s
 
 void Pathtracer::cuda_free() {
 	Integrator::cuda_free();
+	cuda_module_denoise.free();
 
 	free_luts();
 	free_materials();
 	free_geometry();
-	free_sky();
-	free_rng();
+	free_alpha_masks();
 
 	CUDAMemory::free_pinned(pinned_buffer_sizes);
+	CUDAMemory::free_pinned(pinned_convergence_error);
+
+	CUDAMemory::free(ptr_material_sort_offsets);
+
+	if (ptr_view_cameras.ptr) {
+		CUDAMemory::free(ptr_view_cameras);
+	}
+
+	CUDAMemory::free(ptr_ray_sort_offsets);
+	CUDAMemory::free(ptr_ray_sort_index);
+
+	treelet_queues_free();
+
+	CUDAMemory::free(ptr_medium_queue);
+	CUDAMemory::free(ptr_emission_queue);
+
+	optix_free();
+
+	if (visibility_buffer.has_geometry) {
+		visibility_buffer.free_geometry();
+	}
+	if (ptr_reverse_indices.ptr) {
+		CUDAMemory::free(ptr_reverse_indices);
+	}
+
+	graph_free();
+	CUDACALL(cuStreamDestroy(stream_graph));
+
+	for (int i = 0; i < MATERIAL_STREAM_COUNT; i++) {
+		CUDACALL(cuStreamDestroy(stream_material[i]));
+		CUDACALL(cuEventDestroy(event_material_join[i]));
+	}
+	CUDACALL(cuEventDestroy(event_material_fork));
+
+	CUDACALL(cuStreamDestroy(stream_shadow));
+	CUDACALL(cuEventDestroy(event_shadow_fork));
+	CUDACALL(cuEventDestroy(event_shadow_join));
+	CUDACALL(cuEventDestroy(event_buffer_sizes_readback));
 
 	if (scene.has_lights) {
 		CUDAMemory::free(ptr_light_triangle_indices);
-		CUDAMemory::free(ptr_light_triangle_cumulative_probability);
+		CUDAMemory::free(ptr_light_triangle_cdf);
 
-		CUDAMemory::free(ptr_light_mesh_cumulative_probability);
+		CUDAMemory::free(ptr_light_mesh_alias_table);
 		CUDAMemory::free(ptr_light_mesh_triangle_span);
 		CUDAMemory::free(ptr_light_mesh_transform_indices);
 
-		ray_buffer_shadow.free();
+		CUDAMemory::free(ptr_light_bvh_nodes);
+		CUDAMemory::free(ptr_light_bvh_node_parents);
+		CUDAMemory::free(ptr_light_bvh_primitives);
+		CUDAMemory::free(ptr_light_bvh_primitive_leaves);
+		CUDAMemory::free(ptr_light_bvh_mesh_offsets);
+		CUDAMemory::free(ptr_light_bvh_triangle_local_indices);
 	}
 
+	ray_buffer_shadow.free();
+
 	ray_buffer_trace_0.free();
 	ray_buffer_trace_1.free();
 
@@ -74,7 +214,39 @@ void Pathtracer::cuda_free() {
 }
 
 void Pathtracer::init_module() {
-	cuda_module.init("Pathtracer"_sv, "Src/CUDA/Pathtracer.cu"_sv, CUDAContext::compute_capability, MAX_REGISTERS);
+	// The Radiance AOV and the AOVs required by SVGF are enabled once the screen buffers are created
+	unsigned aov_mask_required = 1u << int(AOVType::RADIANCE);
+	if (gpu_config.enable_svgf) {
+		aov_mask_required |= (1u << int(AOVType::RADIANCE_DIRECT)) | (1u << int(AOVType::RADIANCE_INDIRECT)) | (1u << int(AOVType::ALBEDO));
+	}
+
+	// Results of a previous autotuning run on this Device are reused, unless the autotuner is running again
+	CUDAKernelTuning kernel_tuning;
+	if (!cpu_config.enable_autotune) {
+		kernel_tuning.load(CUDAKernelTuning::get_filename(StringView::from_c_str(MODULE_FILENAME)));
+	}
+
+	int max_registers = MAX_REGISTERS;
+	if (cpu_config.max_registers > 0) {
+		max_registers = cpu_config.max_registers;
+	} else if (kernel_tuning.max_registers > 0) {
+		max_registers = kernel_tuning.max_registers;
+	}
+
+	Array<String> defines = get_module_defines(aov_mask_required);
+
+	// The Modules are independent NVRTC Programs, so the Denoise Module compiles on the ThreadPool while this thread compiles the Pathtracer Module
+	// Each is cached separately, so an edit to the sources of one does not recompile the other
+	int context_index = CUDAContext::get_current_context_index();
+
+	ThreadPool::TaskGroup module_group;
+	ThreadPool::submit(module_group, [this, context_index, max_registers, &defines]() {
+		CUDAContext::make_current(context_index); // Loading the Module requires the Context on the worker
+		cuda_module_denoise.init("Denoise"_sv, StringView::from_c_str(MODULE_FILENAME_DENOISE), CUDAContext::compute_capability, max_registers, defines);
+	});
+	cuda_module.init("Pathtracer"_sv, StringView::from_c_str(MODULE_FILENAME), CUDAContext::compute_capability, max_registers, defines);
+
+	ThreadPool::wait(module_group);
 
 	kernel_integrate_dielectric.init(&cuda_module, "kernel_integrate_dielectric");
 	kernel_integrate_conductor .init(&cuda_module, "kernel_integrate_conductor");
@@ -85,20 +257,53 @@ void Pathtracer::init_module() {
 	kernel_trace_bvh4          .init(&cuda_module, "kernel_trace_bvh4");
 	kernel_trace_bvh8          .init(&cuda_module, "kernel_trace_bvh8");
 	kernel_sort                .init(&cuda_module, "kernel_sort");
+	kernel_medium              .init(&cuda_module, "kernel_medium");
+	kernel_light_triangle_cdf  .init(&cuda_module, "kernel_light_triangle_cdf");
+	kernel_miss                .init(&cuda_module, "kernel_miss");
+	kernel_light_hit           .init(&cuda_module, "kernel_light_hit");
 	kernel_material_diffuse    .init(&cuda_module, "kernel_material_diffuse");
 	kernel_material_plastic    .init(&cuda_module, "kernel_material_plastic");
 	kernel_material_dielectric .init(&cuda_module, "kernel_material_dielectric");
 	kernel_material_conductor  .init(&cuda_module, "kernel_material_conductor");
+	kernel_material_sort_scan   .init(&cuda_module, "kernel_material_sort_scan");
+	kernel_material_sort_scatter.init(&cuda_module, "kernel_material_sort_scatter");
+	kernel_ray_sort_count       .init(&cuda_module, "kernel_ray_sort_count");
+	kernel_ray_sort_scan        .init(&cuda_module, "kernel_ray_sort_scan");
+	kernel_ray_sort_scatter     .init(&cuda_module, "kernel_ray_sort_scatter");
+	kernel_treelet_tlas_bvh8    .init(&cuda_module, "kernel_treelet_tlas_bvh8");
+	kernel_treelet_scan         .init(&cuda_module, "kernel_treelet_scan");
+	kernel_treelet_scatter      .init(&cuda_module, "kernel_treelet_scatter");
+	kernel_treelet_blas_bvh8    .init(&cuda_module, "kernel_treelet_blas_bvh8");
+	kernel_treelet_resolve      .init(&cuda_module, "kernel_treelet_resolve");
 	kernel_trace_shadow_bvh2   .init(&cuda_module, "kernel_trace_shadow_bvh2");
 	kernel_trace_shadow_bvh4   .init(&cuda_module, "kernel_trace_shadow_bvh4");
 	kernel_trace_shadow_bvh8   .init(&cuda_module, "kernel_trace_shadow_bvh8");
-	kernel_svgf_reproject      .init(&cuda_module, "kernel_svgf_reproject");
-	kernel_svgf_variance       .init(&cuda_module, "kernel_svgf_variance");
-	kernel_svgf_atrous         .init(&cuda_module, "kernel_svgf_atrous");
-	kernel_svgf_finalize       .init(&cuda_module, "kernel_svgf_finalize");
-	kernel_taa                 .init(&cuda_module, "kernel_taa");
-	kernel_taa_finalize        .init(&cuda_module, "kernel_taa_finalize");
+	kernel_shadow_resolve      .init(&cuda_module, "kernel_shadow_resolve");
+	kernel_megakernel          .init(&cuda_module, "kernel_megakernel");
+	kernel_megakernel_tail     .init(&cuda_module, "kernel_megakernel_tail");
+	kernel_bake_rasterise      .init(&cuda_module, "kernel_bake_rasterise");
+	kernel_bake_compact        .init(&cuda_module, "kernel_bake_compact");
+	kernel_bake_generate       .init(&cuda_module, "kernel_bake_generate");
+	kernel_bake_dilate         .init(&cuda_module, "kernel_bake_dilate");
+	kernel_reproject           .init(&cuda_module, "kernel_reproject");
+	kernel_svgf_reproject      .init(&cuda_module_denoise, "kernel_svgf_reproject");
+	kernel_svgf_variance       .init(&cuda_module_denoise, "kernel_svgf_variance");
+	kernel_svgf_atrous         .init(&cuda_module_denoise, "kernel_svgf_atrous");
+	kernel_svgf_atrous_tiled   .init(&cuda_module_denoise, "kernel_svgf_atrous_tiled");
+	kernel_svgf_classify       .init(&cuda_module_denoise, "kernel_svgf_classify");
+	kernel_svgf_finalize       .init(&cuda_module_denoise, "kernel_svgf_finalize");
+	kernel_taa                 .init(&cuda_module_denoise, "kernel_taa");
+	kernel_taa_finalize        .init(&cuda_module_denoise, "kernel_taa_finalize");
+	kernel_svgf_taa_resolve    .init(&cuda_module_denoise, "kernel_svgf_taa_resolve");
+	kernel_upscale             .init(&cuda_module_denoise, "kernel_upscale");
+	kernel_taa_upscale         .init(&cuda_module_denoise, "kernel_taa_upscale");
+	kernel_taa_upscale_finalize.init(&cuda_module_denoise, "kernel_taa_upscale_finalize");
 	kernel_accumulate          .init(&cuda_module, "kernel_accumulate");
+	kernel_convergence_error   .init(&cuda_module, "kernel_convergence_error");
+	kernel_guiding_train       .init(&cuda_module, "kernel_guiding_train");
+	kernel_guiding_update      .init(&cuda_module, "kernel_guiding_update");
+	kernel_radiance_cache_train .init(&cuda_module, "kernel_radiance_cache_train");
+	kernel_radiance_cache_update.init(&cuda_module, "kernel_radiance_cache_update");
 
 	switch (cpu_config.bvh_type) {
 		case BVHType::BVH:
@@ -115,18 +320,67 @@ void Pathtracer::init_module() {
 	kernel_average_conductor   .set_block_dim(256, 1, 1);
 	kernel_generate            .set_block_dim(256, 1, 1);
 	kernel_sort                .set_block_dim(256, 1, 1);
+	kernel_medium              .set_block_dim(256, 1, 1);
+	kernel_light_triangle_cdf  .set_block_dim(LIGHT_CDF_BLOCK_SIZE, 1, 1);
+	kernel_miss                .set_block_dim(256, 1, 1);
+	kernel_light_hit           .set_block_dim(256, 1, 1);
 	kernel_material_diffuse    .set_block_dim(256, 1, 1);
 	kernel_material_plastic    .set_block_dim(256, 1, 1);
 	kernel_material_dielectric .set_block_dim(256, 1, 1);
 	kernel_material_conductor  .set_block_dim(256, 1, 1);
+	kernel_shadow_resolve      .set_block_dim(256, 1, 1);
+	kernel_material_sort_scan   .set_block_dim(32,  1, 1);
+	kernel_material_sort_scatter.set_block_dim(256, 1, 1);
+	kernel_megakernel           .set_block_dim(128, 1, 1);
+	kernel_megakernel_tail      .set_block_dim(128, 1, 1);
+	kernel_bake_rasterise       .set_block_dim(256, 1, 1);
+	kernel_bake_generate        .set_block_dim(256, 1, 1);
+
+	kernel_ray_sort_count       .set_block_dim(256, 1, 1);
+	kernel_ray_sort_scan        .set_block_dim(RAY_SORT_SCAN_BLOCK_SIZE, 1, 1);
+	kernel_ray_sort_scatter     .set_block_dim(256, 1, 1);
+	kernel_treelet_tlas_bvh8    .set_block_dim(128, 1, 1);
+	kernel_treelet_scan         .set_block_dim(TREELET_SCAN_BLOCK_SIZE, 1, 1);
+	kernel_treelet_scatter      .set_block_dim(256, 1, 1);
+	kernel_treelet_blas_bvh8    .set_block_dim(128, 1, 1);
+	kernel_treelet_resolve      .set_block_dim(256, 1, 1);
+
+	kernel_material_sort_scan.set_grid_dim(1, 1, 1);
+	kernel_ray_sort_scan     .set_grid_dim(1, 1, 1);
+	kernel_treelet_scan      .set_grid_dim(1, 1, 1);
 
 	kernel_svgf_reproject.occupancy_max_block_size_2d();
 	kernel_svgf_variance .occupancy_max_block_size_2d();
 	kernel_svgf_atrous   .occupancy_max_block_size_2d();
+	kernel_svgf_atrous_tiled.set_block_dim(SVGF_TILE_SIZE, SVGF_TILE_SIZE, 1);
+	kernel_svgf_classify    .set_block_dim(SVGF_TILE_SIZE, SVGF_TILE_SIZE, 1);
+	kernel_svgf_taa_resolve .set_block_dim(SVGF_TILE_SIZE, SVGF_TILE_SIZE, 1);
 	kernel_svgf_finalize .occupancy_max_block_size_2d();
 	kernel_taa           .occupancy_max_block_size_2d();
 	kernel_taa_finalize  .occupancy_max_block_size_2d();
 	kernel_accumulate    .occupancy_max_block_size_2d();
+	kernel_bake_compact  .occupancy_max_block_size_2d();
+	kernel_bake_dilate   .occupancy_max_block_size_2d();
+	kernel_reproject     .occupancy_max_block_size_2d();
+
+	kernel_convergence_error.set_block_dim(256, 1, 1);
+
+	kernel_guiding_train .occupancy_max_block_size_2d();
+	kernel_guiding_update.set_block_dim(256, 1, 1);
+	kernel_guiding_update.set_grid_dim(GUIDING_HASH_SIZE / 256, 1, 1);
+
+	kernel_radiance_cache_train .occupancy_max_block_size_2d();
+	kernel_radiance_cache_update.set_block_dim(256, 1, 1);
+	kernel_radiance_cache_update.set_grid_dim(RADIANCE_CACHE_HASH_SIZE / 256, 1, 1);
+
+	kernel_upscale             .occupancy_max_block_size_2d();
+	kernel_taa_upscale         .occupancy_max_block_size_2d();
+	kernel_taa_upscale_finalize.occupancy_max_block_size_2d();
+
+	Array<TunableKernel> tunable_kernels = get_tunable_kernels();
+	for (size_t i = 0; i < tunable_kernels.size(); i++) {
+		kernel_tuning.apply(*tunable_kernels[i].kernel, tunable_kernels[i].name);
+	}
 
 	// BVH8 uses a stack of int2's (8 bytes)
 	// Other BVH's use a stack of ints (4 bytes)
@@ -144,19 +398,86 @@ void Pathtracer::init_module() {
 	kernel_average_conductor  .set_grid_dim(Math::divide_round_up(LUT_CONDUCTOR_DIM_ROUGHNESS,                               kernel_average_conductor  .block_dim_x), 1, 1);
 }
 
+int Pathtracer::calc_view_count(unsigned frame_buffer_handle) const {
+	int count;
+	switch (cpu_config.view_layout) {
+		case ViewLayout::SINGLE:  return 1;
+		case ViewLayout::STEREO:  count = 2; break;
+		case ViewLayout::CUBEMAP: count = 6; break;
+		default: ASSERT_UNREACHABLE();
+	}
+
+	// The views only share the wavefront, the passes that work in screen space or across frames only see view 0
+	float render_scale = frame_buffer_handle ? cpu_config.render_scale : 1.0f;
+
+	if (gpu_config.enable_svgf || gpu_config.enable_restir || use_pixel_list() || gpu_config.enable_raster_primary || gpu_config.enable_path_guiding || gpu_config.enable_radiance_cache || render_scale != 1.0f) {
+		IO::print("WARNING: Multiple views do not support SVGF, ReSTIR, adaptive or variable rate sampling, rasterised primary visibility, path guiding, the radiance cache or a render scale, rendering a single view\n"_sv);
+		return 1;
+	}
+	return count;
+}
+
+int Pathtracer::calc_batch_size(int screen_width, int screen_height) const {
+	if (cpu_config.batch_size != INVALID) {
+		IO::print("Batch size: {} pixels\n"_sv, cpu_config.batch_size);
+		return cpu_config.batch_size;
+	}
+
+	// Worst case memory usage per pixel: two TraceBuffers, two MaterialBuffers (shared by all 4 Material types) and one ShadowRayBuffer
+	// (plus the permutation used by Ray sorting)
+	size_t bytes_per_pixel = 2 * TraceBuffer::get_bytes_per_ray() + 2 * MaterialBuffer::get_bytes_per_ray() + ShadowRayBuffer::get_bytes_per_ray() + 2 * sizeof(int);
+
+	// Leave room for the screen size dependent allocations (AOVs, SVGF history, etc.) and for the driver
+	constexpr size_t bytes_reserved = size_t(512) << 20;
+
+	size_t bytes_available = CUDAContext::get_available_memory();
+	if (cpu_config.gpu_memory_budget > 0) {
+		bytes_available = Math::min(bytes_available, size_t(cpu_config.gpu_memory_budget) << 20);
+	}
+	size_t bytes_usable    = bytes_available > bytes_reserved ? (bytes_available - bytes_reserved) / 10 * 8 : 0;
+
+	size_t batch_size_max = bytes_usable / bytes_per_pixel;
+
+	// There is no need to go beyond a single batch for the current screen size,
+	// but use at least BATCH_SIZE so that the window can grow without needing more batches.
+	// Without a Window the screen size is fixed
+	int frame_pixel_count = screen_width * screen_height * view_count;
+	int pixel_count_max   = cpu_config.headless ? frame_pixel_count : Math::max(frame_pixel_count, BATCH_SIZE);
+
+	int result = int(Math::min(batch_size_max, size_t(pixel_count_max)));
+
+	if (result < BATCH_SIZE) {
+		IO::print("WARNING: Only {} MB of GPU memory available, using reduced batch size\n"_sv, bytes_available >> 20);
+	}
+	result = Math::max(result, WARP_SIZE);
+
+	IO::print("Batch size: {} pixels ({} MB)\n"_sv, result, (size_t(result) * bytes_per_pixel) >> 20);
+	return result;
+}
+
 void Pathtracer::init_events() {
 	int display_order = 0;
-	event_desc_primary = { display_order++, "Primary"_sv, "Primary"_sv };
+	event_desc_graph      = { display_order,   "Graph"_sv,   "Frame"_sv };
+	event_desc_megakernel = { display_order,   "Primary"_sv, "Megakernel"_sv };
+	event_desc_primary    = { display_order++, "Primary"_sv, "Primary"_sv };
 
 	for (int i = 0; i < MAX_BOUNCES; i++) {
 		String category = Format().format("Bounce {}"_sv, i);
 
+		event_desc_megakernel_tail    [i] = CUDAEvent::Desc { display_order, category, "Megakernel Tail"_sv };
+		event_desc_ray_sort           [i] = CUDAEvent::Desc { display_order, category, "Ray Sort"_sv };
 		event_desc_trace              [i] = CUDAEvent::Desc { display_order, category, "Trace"_sv };
+		event_desc_treelet_blas       [i] = CUDAEvent::Desc { display_order, category, "Treelet BLAS"_sv };
 		event_desc_sort               [i] = CUDAEvent::Desc { display_order, category, "Sort"_sv };
+		event_desc_medium             [i] = CUDAEvent::Desc { display_order, category, "Medium"_sv };
+		event_desc_miss               [i] = CUDAEvent::Desc { display_order, category, "Miss"_sv };
+		event_desc_light_hit          [i] = CUDAEvent::Desc { display_order, category, "Light Hit"_sv };
+		event_desc_material_sort      [i] = CUDAEvent::Desc { display_order, category, "Material Sort"_sv };
 		event_desc_material_diffuse   [i] = CUDAEvent::Desc { display_order, category, "Diffuse"_sv };
 		event_desc_material_plastic   [i] = CUDAEvent::Desc { display_order, category, "Plastic"_sv };
 		event_desc_material_dielectric[i] = CUDAEvent::Desc { display_order, category, "Dielectric"_sv };
 		event_desc_material_conductor [i] = CUDAEvent::Desc { display_order, category, "Conductor"_sv };
+		event_desc_materials          [i] = CUDAEvent::Desc { display_order, category, "Materials"_sv };
 		event_desc_shadow_trace       [i] = CUDAEvent::Desc { display_order, category, "Shadow"_sv };
 
 		display_order++;
@@ -164,6 +485,7 @@ void Pathtracer::init_events() {
 
 	event_desc_svgf_reproject = CUDAEvent::Desc { display_order, "SVGF"_sv, "Reproject"_sv };
 	event_desc_svgf_variance  = CUDAEvent::Desc { display_order, "SVGF"_sv, "Variance"_sv };
+	event_desc_svgf_classify  = CUDAEvent::Desc { display_order, "SVGF"_sv, "Classify"_sv };
 
 	for (int i = 0; i < MAX_ATROUS_ITERATIONS; i++) {
 		event_desc_svgf_atrous[i] = CUDAEvent::Desc { display_order, "SVGF"_sv, Format().format("A Trous {}"_sv, i) };
@@ -171,24 +493,77 @@ void Pathtracer::init_events() {
 	event_desc_svgf_finalize = CUDAEvent::Desc { display_order++, "SVGF"_sv, "Finalize"_sv };
 
 	event_desc_taa         = CUDAEvent::Desc { display_order, "Post"_sv, "TAA"_sv };
+	event_desc_upscale     = CUDAEvent::Desc { display_order, "Post"_sv, "Upscale"_sv };
 	event_desc_reconstruct = CUDAEvent::Desc { display_order, "Post"_sv, "Reconstruct"_sv };
 	event_desc_accumulate  = CUDAEvent::Desc { display_order, "Post"_sv, "Accumulate"_sv };
+	event_desc_guiding     = CUDAEvent::Desc { display_order, "Post"_sv, "Path Guiding"_sv };
+	event_desc_radiance_cache = CUDAEvent::Desc { display_order, "Post"_sv, "Radiance Cache"_sv };
 
 	event_desc_end = CUDAEvent::Desc { ++display_order, "END"_sv, "END"_sv };
 }
 
 #include "Core/Timer.h"
 
+// Layout of the LUT cache file, every LUT is stored as tightly packed floats
+struct KullaContyLUTCache {
+	static constexpr size_t SIZE_DIELECTRIC_DIRECTIONAL_ALBEDO = LUT_DIELECTRIC_DIM_IOR * LUT_DIELECTRIC_DIM_ROUGHNESS * LUT_DIELECTRIC_DIM_COS_THETA;
+	static constexpr size_t SIZE_DIELECTRIC_ALBEDO             = LUT_DIELECTRIC_DIM_IOR * LUT_DIELECTRIC_DIM_ROUGHNESS;
+	static constexpr size_t SIZE_CONDUCTOR_DIRECTIONAL_ALBEDO  = LUT_CONDUCTOR_DIM_ROUGHNESS * LUT_CONDUCTOR_DIM_COS_THETA;
+	static constexpr size_t SIZE_CONDUCTOR_ALBEDO              = LUT_CONDUCTOR_DIM_ROUGHNESS;
+
+	float dielectric_directional_albedo_enter[SIZE_DIELECTRIC_DIRECTIONAL_ALBEDO];
+	float dielectric_directional_albedo_leave[SIZE_DIELECTRIC_DIRECTIONAL_ALBEDO];
+	float dielectric_albedo_enter            [SIZE_DIELECTRIC_ALBEDO];
+	float dielectric_albedo_leave            [SIZE_DIELECTRIC_ALBEDO];
+	float conductor_directional_albedo       [SIZE_CONDUCTOR_DIRECTIONAL_ALBEDO];
+	float conductor_albedo                   [SIZE_CONDUCTOR_ALBEDO];
+};
+
+// The LUTs only depend on the integration Kernels and the LUT dimensions in Common.h, which are both covered by the cache key of the Module
+static String get_lut_cache_filename(size_t module_cache_key) {
+	char cache_key[17];
+	snprintf(cache_key, sizeof(cache_key), "%016llx", (unsigned long long)module_cache_key);
+
+	return Format().format("{}.luts.{}.bin"_sv, StringView::from_c_str(Pathtracer::MODULE_FILENAME), cache_key);
+}
+
 void Pathtracer::init_luts() {
+	CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::LUTS);
+	ProfileScope              scope("LUT Generation"_sv);
+
 	struct KullaContyLUT {
 		CUarray lut_directional_albedo;
 		CUarray lut_albedo;
 	};
 
-	auto create_lut_dielectric = [this](bool entering_material) -> KullaContyLUT {
+	// Integrating the LUTs takes a noticeable amount of time, so the result is cached on disk and reused
+	// when the Integrator is recreated, the Module is reloaded or the application is restarted
+	String lut_cache_filename = get_lut_cache_filename(cuda_module.cache_key);
+
+	String lut_cache_file;
+	const KullaContyLUTCache * lut_cache = nullptr;
+
+	if (IO::file_exists(lut_cache_filename.view())) {
+		lut_cache_file = IO::file_read(lut_cache_filename, nullptr);
+
+		if (lut_cache_file.size() == sizeof(KullaContyLUTCache)) {
+			lut_cache = reinterpret_cast<const KullaContyLUTCache *>(lut_cache_file.data());
+		} else {
+			IO::print("WARNING: LUT cache '{}' has an unexpected size, regenerating\n"_sv, lut_cache_filename);
+		}
+	}
+
+	auto create_lut_dielectric = [this](bool entering_material, const float * cached_directional_albedo, const float * cached_albedo) -> KullaContyLUT {
 		CUarray array_lut_directional_albedo = CUDAMemory::create_array(LUT_DIELECTRIC_DIM_IOR, LUT_DIELECTRIC_DIM_ROUGHNESS, LUT_DIELECTRIC_DIM_COS_THETA, 1, CUarray_format::CU_AD_FORMAT_FLOAT);
 		CUarray array_lut_albedo             = CUDAMemory::create_array(LUT_DIELECTRIC_DIM_IOR, LUT_DIELECTRIC_DIM_ROUGHNESS,                               1, CUarray_format::CU_AD_FORMAT_FLOAT);
 
+		if (cached_directional_albedo) {
+			CUDAMemory::copy_array_3d(array_lut_directional_albedo, LUT_DIELECTRIC_DIM_IOR * sizeof(float), LUT_DIELECTRIC_DIM_ROUGHNESS, LUT_DIELECTRIC_DIM_COS_THETA, cached_directional_albedo);
+			CUDAMemory::copy_array   (array_lut_albedo,             LUT_DIELECTRIC_DIM_IOR * sizeof(float), LUT_DIELECTRIC_DIM_ROUGHNESS,                               cached_albedo);
+
+			return KullaContyLUT { array_lut_directional_albedo, array_lut_albedo };
+		}
+
 		CUsurfObject surf_lut_directional_albedo = CUDAMemory::create_surface(array_lut_directional_albedo);
 		CUsurfObject surf_lut_albedo             = CUDAMemory::create_surface(array_lut_albedo);
 
@@ -200,8 +575,8 @@ void Pathtracer::init_luts() {
 
 		return KullaContyLUT { array_lut_directional_albedo, array_lut_albedo };
 	};
-	KullaContyLUT lut_dielectric_enter = create_lut_dielectric(true);
-	KullaContyLUT lut_dielectric_leave = create_lut_dielectric(false);
+	KullaContyLUT lut_dielectric_enter = create_lut_dielectric(true,  lut_cache ? lut_cache->dielectric_directional_albedo_enter : nullptr, lut_cache ? lut_cache->dielectric_albedo_enter : nullptr);
+	KullaContyLUT lut_dielectric_leave = create_lut_dielectric(false, lut_cache ? lut_cache->dielectric_directional_albedo_leave : nullptr, lut_cache ? lut_cache->dielectric_albedo_leave : nullptr);
 
 	lut_dielectric_directional_albedo_enter.init(lut_dielectric_enter.lut_directional_albedo);
 	lut_dielectric_directional_albedo_leave.init(lut_dielectric_leave.lut_directional_albedo);
@@ -213,19 +588,23 @@ void Pathtracer::init_luts() {
 	cuda_module.get_global("lut_dielectric_albedo_enter")            .set_value(lut_dielectric_albedo_enter.texture);
 	cuda_module.get_global("lut_dielectric_albedo_leave")            .set_value(lut_dielectric_albedo_leave.texture);
 
-	auto create_lut_conductor = [this]() -> KullaContyLUT {
+	auto create_lut_conductor = [this](const float * cached_directional_albedo, const float * cached_albedo) -> KullaContyLUT {
 		CUarray array_lut_directional_albedo = CUDAMemory::create_array(LUT_CONDUCTOR_DIM_ROUGHNESS, LUT_CONDUCTOR_DIM_COS_THETA, 1, CUarray_format::CU_AD_FORMAT_FLOAT);
 		CUarray array_lut_albedo             = CUDAMemory::create_array(LUT_CONDUCTOR_DIM_ROUGHNESS, 1,                           1, CUarray_format::CU_AD_FORMAT_FLOAT);
 
+		if (cached_directional_albedo) {
+			CUDAMemory::copy_array(array_lut_directional_albedo, LUT_CONDUCTOR_DIM_ROUGHNESS * sizeof(float), LUT_CONDUCTOR_DIM_COS_THETA, cached_directional_albedo);
+			CUDAMemory::copy_array(array_lut_albedo,             LUT_CONDUCTOR_DIM_ROUGHNESS * sizeof(float), 1,                           cached_albedo);
+
+			return KullaContyLUT { array_lut_directional_albedo, array_lut_albedo };
+		}
+
 		CUDAMemory::Ptr<float> ptr_lut_directional_albedo = CUDAMemory::malloc<float>(LUT_CONDUCTOR_DIM_ROUGHNESS * LUT_CONDUCTOR_DIM_COS_THETA);
 		CUDAMemory::Ptr<float> ptr_lut_albedo             = CUDAMemory::malloc<float>(LUT_CONDUCTOR_DIM_ROUGHNESS);
 
+		// The Kernels and copies are ordered on the default Stream, no need to synchronize with the host in between
 		kernel_integrate_conductor.execute(ptr_lut_directional_albedo);
-
-		CUDACALL(cuStreamSynchronize(nullptr));
-
 		kernel_average_conductor  .execute(ptr_lut_directional_albedo, ptr_lut_albedo);
-		CUDACALL(cuStreamSynchronize(nullptr));
 
 		CUDAMemory::copy_array(array_lut_directional_albedo, LUT_CONDUCTOR_DIM_ROUGHNESS * sizeof(float), LUT_CONDUCTOR_DIM_COS_THETA, ptr_lut_directional_albedo.ptr);
 		CUDAMemory::copy_array(array_lut_albedo,             LUT_CONDUCTOR_DIM_ROUGHNESS * sizeof(float), 1,                           ptr_lut_albedo.ptr);
@@ -235,13 +614,28 @@ void Pathtracer::init_luts() {
 
 		return KullaContyLUT { array_lut_directional_albedo, array_lut_albedo };
 	};
-	KullaContyLUT lut_conductor = create_lut_conductor();
+	KullaContyLUT lut_conductor = create_lut_conductor(lut_cache ? lut_cache->conductor_directional_albedo : nullptr, lut_cache ? lut_cache->conductor_albedo : nullptr);
 
 	lut_conductor_directional_albedo.init(lut_conductor.lut_directional_albedo);
 	lut_conductor_albedo            .init(lut_conductor.lut_albedo);
 
 	cuda_module.get_global("lut_conductor_directional_albedo").set_value(lut_conductor_directional_albedo.texture);
 	cuda_module.get_global("lut_conductor_albedo")            .set_value(lut_conductor_albedo.texture);
+
+	if (lut_cache) return;
+
+	// Read back the freshly integrated LUTs, this is the only point where the host waits for the integration
+	OwnPtr<KullaContyLUTCache> lut_cache_new = make_owned<KullaContyLUTCache>();
+
+	CUDAMemory::copy_array_3d_to_host(lut_cache_new->dielectric_directional_albedo_enter, lut_dielectric_enter.lut_directional_albedo, LUT_DIELECTRIC_DIM_IOR * sizeof(float), LUT_DIELECTRIC_DIM_ROUGHNESS, LUT_DIELECTRIC_DIM_COS_THETA);
+	CUDAMemory::copy_array_3d_to_host(lut_cache_new->dielectric_directional_albedo_leave, lut_dielectric_leave.lut_directional_albedo, LUT_DIELECTRIC_DIM_IOR * sizeof(float), LUT_DIELECTRIC_DIM_ROUGHNESS, LUT_DIELECTRIC_DIM_COS_THETA);
+	CUDAMemory::copy_array_to_host   (lut_cache_new->dielectric_albedo_enter,             lut_dielectric_enter.lut_albedo,             LUT_DIELECTRIC_DIM_IOR * sizeof(float), LUT_DIELECTRIC_DIM_ROUGHNESS);
+	CUDAMemory::copy_array_to_host   (lut_cache_new->dielectric_albedo_leave,             lut_dielectric_leave.lut_albedo,             LUT_DIELECTRIC_DIM_IOR * sizeof(float), LUT_DIELECTRIC_DIM_ROUGHNESS);
+	CUDAMemory::copy_array_to_host   (lut_cache_new->conductor_directional_albedo,        lut_conductor.lut_directional_albedo,        LUT_CONDUCTOR_DIM_ROUGHNESS * sizeof(float), LUT_CONDUCTOR_DIM_COS_THETA);
+	CUDAMemory::copy_array_to_host   (lut_cache_new->conductor_albedo,                    lut_conductor.lut_albedo,                    LUT_CONDUCTOR_DIM_ROUGHNESS * sizeof(float), 1);
+
+	const char * lut_cache_data = reinterpret_cast<const char *>(lut_cache_new.get());
+	IO::file_write(lut_cache_filename, StringView { lut_cache_data, lut_cache_data + sizeof(KullaContyLUTCache) });
 }
 
 void Pathtracer::free_luts() {
@@ -252,52 +646,122 @@ void Pathtracer::free_luts() {
 	lut_conductor_directional_albedo.free();
 }
 
-void Pathtracer::resize_init(unsigned frame_buffer_handle, int width, int height) {
-	screen_width  = width;
-	screen_height = height;
-	screen_pitch  = Math::round_up(width, WARP_SIZE);
+void Pathtracer::calc_render_size(unsigned frame_buffer_handle, int width, int height, int & render_width, int & render_height) {
+	// Headless output has the size of the AOVs, so it is always rendered at full resolution
+	float render_scale = frame_buffer_handle ? cpu_config.render_scale : 1.0f;
 
-	pixel_count = width * height;
+	render_width  = Math::max(int(float(width)  * render_scale + 0.5f), 1);
+	render_height = Math::max(int(float(height) * render_scale + 0.5f), 1);
+}
 
-	cuda_module.get_global("screen_width") .set_value(screen_width);
-	cuda_module.get_global("screen_pitch") .set_value(screen_pitch);
-	cuda_module.get_global("screen_height").set_value(screen_height);
+void Pathtracer::resize_screen(int width, int height) {
+	display_width  = width;
+	display_height = height;
 
-	// Create Frame Buffers
-	init_aovs();
-	aov_enable(AOVType::RADIANCE);
+	screen_pitch = Math::round_up(screen_width, WARP_SIZE);
+
+	pixel_count = screen_width * screen_height * view_count;
+
+	get_global_shared("screen_width") .set_value(screen_width);
+	get_global_shared("screen_pitch") .set_value(screen_pitch);
+	get_global_shared("screen_height").set_value(screen_height);
+
+	cuda_module_denoise.get_global("display_width") .set_value(display_width);
+	cuda_module_denoise.get_global("display_height").set_value(display_height);
 
-	// Set Accumulator to a CUDA resource mapping of the GL frame buffer texture
-	resource_accumulator = CUDAMemory::resource_register(frame_buffer_handle, CU_GRAPHICS_REGISTER_FLAGS_SURFACE_LDST);
-	surf_accumulator     = CUDAMemory::create_surface(CUDAMemory::resource_get_array(resource_accumulator));
-	cuda_module.get_global("accumulator").set_value(surf_accumulator);
-
-	// Set Grid dimensions for screen size dependent Kernels
-	kernel_svgf_reproject.set_grid_dim(screen_pitch / kernel_svgf_reproject.block_dim_x, Math::divide_round_up(height, kernel_svgf_reproject.block_dim_y), 1);
-	kernel_svgf_variance .set_grid_dim(screen_pitch / kernel_svgf_variance .block_dim_x, Math::divide_round_up(height, kernel_svgf_variance .block_dim_y), 1);
-	kernel_svgf_atrous   .set_grid_dim(screen_pitch / kernel_svgf_atrous   .block_dim_x, Math::divide_round_up(height, kernel_svgf_atrous   .block_dim_y), 1);
-	kernel_svgf_finalize .set_grid_dim(screen_pitch / kernel_svgf_finalize .block_dim_x, Math::divide_round_up(height, kernel_svgf_finalize .block_dim_y), 1);
-	kernel_taa           .set_grid_dim(screen_pitch / kernel_taa           .block_dim_x, Math::divide_round_up(height, kernel_taa           .block_dim_y), 1);
-	kernel_taa_finalize  .set_grid_dim(screen_pitch / kernel_taa_finalize  .block_dim_x, Math::divide_round_up(height, kernel_taa_finalize  .block_dim_y), 1);
-	kernel_accumulate    .set_grid_dim(screen_pitch / kernel_accumulate    .block_dim_x, Math::divide_round_up(height, kernel_accumulate    .block_dim_y), 1);
-
-	kernel_generate           .set_grid_dim(Math::divide_round_up(BATCH_SIZE, kernel_generate           .block_dim_x), 1, 1);
-	kernel_sort               .set_grid_dim(Math::divide_round_up(BATCH_SIZE, kernel_sort               .block_dim_x), 1, 1);
-	kernel_material_diffuse   .set_grid_dim(Math::divide_round_up(BATCH_SIZE, kernel_material_diffuse   .block_dim_x), 1, 1);
-	kernel_material_plastic   .set_grid_dim(Math::divide_round_up(BATCH_SIZE, kernel_material_plastic   .block_dim_x), 1, 1);
-	kernel_material_dielectric.set_grid_dim(Math::divide_round_up(BATCH_SIZE, kernel_material_dielectric.block_dim_x), 1, 1);
-	kernel_material_conductor .set_grid_dim(Math::divide_round_up(BATCH_SIZE, kernel_material_conductor .block_dim_x), 1, 1);
-
-	scene.camera.resize(width, height);
+	kernels_set_grid_dim();
+
+	scene.camera.resize(screen_width, screen_height);
 	invalidated_camera = true;
 
 	// Reset buffer sizes to default for next frame
-	pinned_buffer_sizes->reset(Math::min(BATCH_SIZE, pixel_count));
+	pinned_buffer_sizes->reset(Math::min(batch_size, pixel_count));
 	global_buffer_sizes.set_value(*pinned_buffer_sizes);
 
 	sample_index = 0;
 
+	// Batch count and Kernel grid sizes depend on the screen size
+	invalidated_graph = true;
+
+	// Queue sizes of the previous frame no longer apply
+	buffer_sizes_prev_valid = false;
+}
+
+void Pathtracer::resize_init(unsigned frame_buffer_handle, int width, int height) {
+	calc_render_size(frame_buffer_handle, width, height, screen_width, screen_height);
+
+	// Only a Window is resized, its frame buffer texture is allocated for the maximum size as well, see resize_in_place
+	alloc_screen_pitch  = Math::round_up(screen_width, WARP_SIZE);
+	alloc_screen_height = screen_height;
+
+	if (frame_buffer_handle && screen_width == width && screen_height == height) {
+		alloc_screen_pitch  = Math::max(alloc_screen_pitch,  Math::round_up(cpu_config.max_width, WARP_SIZE));
+		alloc_screen_height = Math::max(alloc_screen_height, cpu_config.max_height);
+	}
+
+	resize_screen(width, height);
+
+	// Create Frame Buffers
+	init_aovs();
+	aov_enable(AOVType::RADIANCE);
+
+	init_accumulator(frame_buffer_handle);
+
 	if (gpu_config.enable_svgf) svgf_init();
+	if (gpu_config.enable_reprojection) reprojection_init();
+	if (use_pixel_list()) adaptive_sampling_init();
+	if (cpu_config.convergence_target_error > 0.0f) convergence_init();
+	if (gpu_config.enable_shadow_occluder_cache) shadow_occluder_cache_init();
+	if (gpu_config.enable_restir) restir_init();
+	if (gpu_config.enable_path_guiding) path_guiding_init();
+	if (gpu_config.enable_radiance_cache) radiance_cache_init();
+	if (gpu_config.enable_raster_primary && raster_primary_supported()) raster_primary_init();
+
+	variable_rate_mask_init();
+
+	if (is_baking()) bake_init();
+}
+
+bool Pathtracer::resize_in_place(unsigned frame_buffer_handle, int width, int height) {
+	// A new frame buffer texture needs a new mapping of the Accumulator
+	if (frame_buffer_handle == 0 || frame_buffer_handle != accumulator_handle) return false;
+
+	// The upscale Buffers and the visibility buffer are sized for the exact screen size
+	if (is_upscaling() || resource_visibility_buffer) return false;
+
+	int new_screen_width;
+	int new_screen_height;
+	calc_render_size(frame_buffer_handle, width, height, new_screen_width, new_screen_height);
+
+	if (new_screen_width != width || new_screen_height != height) return false;
+	if (Math::round_up(width, WARP_SIZE) > alloc_screen_pitch || height > alloc_screen_height) return false;
+
+	CUDACALL(cuCtxSynchronize());
+
+	screen_width  = width;
+	screen_height = height;
+
+	resize_screen(width, height);
+
+	// The per Pixel state of the previous frame is laid out for the old pitch
+	if (ptr_restir_reservoirs.ptr) {
+		CUDAMemory::memset_async(ptr_restir_reservoirs, 0, 2 * alloc_pixel_count(), memory_stream);
+	}
+	if (ptr_guiding_vertices.ptr) {
+		CUDAMemory::memset_async(ptr_guiding_vertices, -1, alloc_pixel_count() * GUIDING_MAX_VERTICES, memory_stream);
+	}
+	if (ptr_radiance_cache_vertices.ptr) {
+		CUDAMemory::memset_async(ptr_radiance_cache_vertices, -1, alloc_pixel_count() * RADIANCE_CACHE_MAX_VERTICES, memory_stream);
+	}
+	if (ptr_shadow_occluder_cache.ptr) {
+		CUDAMemory::memset_async(ptr_shadow_occluder_cache, INVALID, alloc_pixel_count(), memory_stream);
+	}
+
+	// The Tiles depend on the screen size
+	variable_rate_mask_free();
+	variable_rate_mask_init();
+
+	return true;
 }
 
 void Pathtracer::resize_free() {
@@ -305,235 +769,1166 @@ void Pathtracer::resize_free() {
 
 	free_aovs();
 
-	CUDAMemory::resource_unregister(resource_accumulator);
-	CUDAMemory::free_surface(surf_accumulator);
+	free_accumulator();
 
 	if (gpu_config.enable_svgf) {
 		svgf_free();
 	}
+	if (gpu_config.enable_reprojection) {
+		reprojection_free();
+	}
+	gbuffer_free();
+
+	if (use_pixel_list()) {
+		adaptive_sampling_free();
+	}
+	if (ptr_convergence_moments.ptr) {
+		convergence_free();
+	}
+	if (gpu_config.enable_shadow_occluder_cache) {
+		shadow_occluder_cache_free();
+	}
+	if (gpu_config.enable_restir) {
+		restir_free();
+	}
+	if (gpu_config.enable_path_guiding) {
+		path_guiding_free();
+	}
+	if (gpu_config.enable_radiance_cache) {
+		radiance_cache_free();
+	}
+	if (resource_visibility_buffer) {
+		raster_primary_free();
+	}
+
+	variable_rate_mask_free();
+
+	if (ptr_bake_texels.ptr) {
+		bake_free();
+	}
 }
 
-void Pathtracer::svgf_init() {
-	// GBuffers
-	array_gbuffer_normal_and_depth        = CUDAMemory::create_array(screen_pitch, screen_height, 4, CU_AD_FORMAT_FLOAT);
-	array_gbuffer_mesh_id_and_triangle_id = CUDAMemory::create_array(screen_pitch, screen_height, 2, CU_AD_FORMAT_SIGNED_INT32);
-	array_gbuffer_screen_position_prev    = CUDAMemory::create_array(screen_pitch, screen_height, 2, CU_AD_FORMAT_FLOAT);
+// The GBuffers are shared by SVGF and reprojection, they exist while either is enabled
+void Pathtracer::gbuffer_init() {
+	if (array_gbuffer_normal_and_depth) return;
+
+	CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::SVGF);
+
+	array_gbuffer_normal_and_depth        = CUDAMemory::create_array(alloc_screen_pitch, alloc_screen_height, 4, CU_AD_FORMAT_FLOAT);
+	array_gbuffer_mesh_id_and_triangle_id = CUDAMemory::create_array(alloc_screen_pitch, alloc_screen_height, 2, CU_AD_FORMAT_SIGNED_INT32);
+	array_gbuffer_screen_position_prev    = CUDAMemory::create_array(alloc_screen_pitch, alloc_screen_height, 2, CU_AD_FORMAT_FLOAT);
 
 	surf_gbuffer_normal_and_depth        = CUDAMemory::create_surface(array_gbuffer_normal_and_depth);
 	surf_gbuffer_mesh_id_and_triangle_id = CUDAMemory::create_surface(array_gbuffer_mesh_id_and_triangle_id);
 	surf_gbuffer_screen_position_prev    = CUDAMemory::create_surface(array_gbuffer_screen_position_prev);
 
-	cuda_module.get_global("gbuffer_normal_and_depth")       .set_value(surf_gbuffer_normal_and_depth);
-	cuda_module.get_global("gbuffer_mesh_id_and_triangle_id").set_value(surf_gbuffer_mesh_id_and_triangle_id);
-	cuda_module.get_global("gbuffer_screen_position_prev")   .set_value(surf_gbuffer_screen_position_prev);
+	get_global_shared("gbuffer_normal_and_depth")       .set_value(surf_gbuffer_normal_and_depth);
+	get_global_shared("gbuffer_mesh_id_and_triangle_id").set_value(surf_gbuffer_mesh_id_and_triangle_id);
+	get_global_shared("gbuffer_screen_position_prev")   .set_value(surf_gbuffer_screen_position_prev);
+}
+
+void Pathtracer::gbuffer_free() {
+	if (!array_gbuffer_normal_and_depth) return;
+
+	CUDAMemory::free_array(array_gbuffer_normal_and_depth);
+	CUDAMemory::free_array(array_gbuffer_mesh_id_and_triangle_id);
+	CUDAMemory::free_array(array_gbuffer_screen_position_prev);
+
+	CUDAMemory::free_surface(surf_gbuffer_normal_and_depth);
+	CUDAMemory::free_surface(surf_gbuffer_mesh_id_and_triangle_id);
+	CUDAMemory::free_surface(surf_gbuffer_screen_position_prev);
+
+	array_gbuffer_normal_and_depth        = nullptr;
+	array_gbuffer_mesh_id_and_triangle_id = nullptr;
+	array_gbuffer_screen_position_prev    = nullptr;
+}
+
+void Pathtracer::svgf_init() {
+	CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::SVGF);
+
+	gbuffer_init();
 
 	// Frame Buffers
 	aov_enable(AOVType::RADIANCE_DIRECT);
 	aov_enable(AOVType::RADIANCE_INDIRECT);
 	aov_enable(AOVType::ALBEDO);
 
-	ptr_frame_buffer_moment = CUDAMemory::malloc<float4>(screen_pitch * screen_height);
-	cuda_module.get_global("frame_buffer_moment").set_value(ptr_frame_buffer_moment);
+	ptr_frame_buffer_moment = CUDAMemory::malloc<float4>(alloc_pixel_count());
+	cuda_module_denoise.get_global("frame_buffer_moment").set_value(ptr_frame_buffer_moment);
 
 	// History Buffers
-	ptr_history_length           = CUDAMemory::malloc<int>   (screen_pitch * screen_height);
-	ptr_history_direct           = CUDAMemory::malloc<float4>(screen_pitch * screen_height);
-	ptr_history_indirect         = CUDAMemory::malloc<float4>(screen_pitch * screen_height);
-	ptr_history_moment           = CUDAMemory::malloc<float4>(screen_pitch * screen_height);
-	ptr_history_normal_and_depth = CUDAMemory::malloc<float4>(screen_pitch * screen_height);
-
-	cuda_module.get_global("history_length")          .set_value(ptr_history_length);
-	cuda_module.get_global("history_direct")          .set_value(ptr_history_direct);
-	cuda_module.get_global("history_indirect")        .set_value(ptr_history_indirect);
-	cuda_module.get_global("history_moment")          .set_value(ptr_history_moment);
-	cuda_module.get_global("history_normal_and_depth").set_value(ptr_history_normal_and_depth);
+	// In compact mode these are stored as half4 (8 bytes) instead of float4
+	size_t history_size = alloc_pixel_count() * (gpu_config.enable_compact_history ? sizeof(int2) : sizeof(float4));
 
-	// Frame Buffers for Temporal Anti-Aliasing
-	ptr_taa_frame_prev = CUDAMemory::malloc<float4>(screen_pitch * screen_height);
-	ptr_taa_frame_curr = CUDAMemory::malloc<float4>(screen_pitch * screen_height);
+	ptr_history_length           = CUDAMemory::malloc<int>          (alloc_pixel_count());
+	ptr_history_direct           = CUDAMemory::malloc<unsigned char>(history_size);
+	ptr_history_indirect         = CUDAMemory::malloc<unsigned char>(history_size);
+	ptr_history_moment           = CUDAMemory::malloc<float4>       (alloc_pixel_count());
+	ptr_history_normal_and_depth = CUDAMemory::malloc<unsigned char>(history_size);
 
-	cuda_module.get_global("taa_frame_prev").set_value(ptr_taa_frame_prev);
-	cuda_module.get_global("taa_frame_curr").set_value(ptr_taa_frame_curr);
-}
+	cuda_module_denoise.get_global("history_length")          .set_value(ptr_history_length);
+	cuda_module_denoise.get_global("history_direct")          .set_value(ptr_history_direct);
+	cuda_module_denoise.get_global("history_indirect")        .set_value(ptr_history_indirect);
+	cuda_module_denoise.get_global("history_moment")          .set_value(ptr_history_moment);
+	cuda_module_denoise.get_global("history_normal_and_depth").set_value(ptr_history_normal_and_depth);
 
-void Pathtracer::svgf_free() {
-	CUDAMemory::free_array(array_gbuffer_normal_and_depth);
-	CUDAMemory::free_array(array_gbuffer_mesh_id_and_triangle_id);
-	CUDAMemory::free_array(array_gbuffer_screen_position_prev);
+	// Tile classification, sized for the allocated screen so that resizing in place does not need a reallocation
+	int tile_count = Math::divide_round_up(alloc_screen_pitch, SVGF_TILE_SIZE) * Math::divide_round_up(alloc_screen_height, SVGF_TILE_SIZE);
 
-	CUDAMemory::free_surface(surf_gbuffer_normal_and_depth);
-	CUDAMemory::free_surface(surf_gbuffer_mesh_id_and_triangle_id);
-	CUDAMemory::free_surface(surf_gbuffer_screen_position_prev);
+	ptr_svgf_tile_list   = CUDAMemory::malloc<int>(tile_count);
+	ptr_svgf_tile_count  = CUDAMemory::malloc<int>();
+	ptr_svgf_tile_active = CUDAMemory::malloc<int>(tile_count);
 
-	aov_disable(AOVType::RADIANCE_DIRECT);
-	aov_disable(AOVType::RADIANCE_INDIRECT);
-	aov_disable(AOVType::ALBEDO);
+	cuda_module_denoise.get_global("svgf_tile_list")  .set_value(ptr_svgf_tile_list);
+	cuda_module_denoise.get_global("svgf_tile_count") .set_value(ptr_svgf_tile_count);
+	cuda_module_denoise.get_global("svgf_tile_active").set_value(ptr_svgf_tile_active);
 
-	CUDAMemory::free(ptr_frame_buffer_moment);
+	// Frame Buffers for Temporal Anti-Aliasing
+	ptr_taa_frame_prev = CUDAMemory::malloc<unsigned char>(history_size);
+	ptr_taa_frame_curr = CUDAMemory::malloc<unsigned char>(history_size);
 
-	CUDAMemory::free(ptr_history_length);
-	CUDAMemory::free(ptr_history_direct);
-	CUDAMemory::free(ptr_history_indirect);
-	CUDAMemory::free(ptr_history_moment);
-	CUDAMemory::free(ptr_history_normal_and_depth);
+	cuda_module_denoise.get_global("taa_frame_prev").set_value(ptr_taa_frame_prev);
+	cuda_module_denoise.get_global("taa_frame_curr").set_value(ptr_taa_frame_curr);
 
-	CUDAMemory::free(ptr_taa_frame_prev);
-	CUDAMemory::free(ptr_taa_frame_curr);
+	// History of the temporal upscale, which replaces the TAA history when rendering at a reduced resolution
+	if (is_upscaling()) {
+		ptr_upscale_history = CUDAMemory::malloc<float4>(display_width * display_height);
+		cuda_module_denoise.get_global("upscale_history").set_value(ptr_upscale_history);
+	}
 }
 
-void Pathtracer::calc_light_power(Allocator * frame_allocator) {
-	HashMap<Handle<MeshData>, Array<Mesh *>> mesh_data_used_as_lights(frame_allocator);
+void Pathtracer::adaptive_sampling_init() {
+	CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::FRAMEBUFFERS);
 
-	int light_mesh_count = 0;
+	ptr_adaptive_moments     = CUDAMemory::malloc<float4>(alloc_pixel_count());
+	ptr_adaptive_pixels      = CUDAMemory::malloc<int>   (alloc_pixel_count());
+	ptr_adaptive_pixel_count = CUDAMemory::malloc<int>   ();
 
-	// For every Mesh, check whether it is a Light based on its Material
-	// If so, mark the MeshData it is using as being a Light
-	for (size_t m = 0; m < scene.meshes.size(); m++) {
-		Mesh & mesh = scene.meshes[m];
-		const Material & material = scene.asset_manager.get_material(mesh.material_handle);
+	cuda_module.get_global("adaptive_moments")    .set_value(ptr_adaptive_moments);
+	cuda_module.get_global("adaptive_pixels")     .set_value(ptr_adaptive_pixels);
+	cuda_module.get_global("adaptive_pixel_count").set_value(ptr_adaptive_pixel_count);
+}
 
-		if (material.is_light()) {
-			Array<Mesh *> & meshes = mesh_data_used_as_lights[mesh.mesh_data_handle];
-			meshes.allocator = frame_allocator;
-			meshes.push_back(&mesh);
-			light_mesh_count++;
-		} else {
-			mesh.light.weight = 0.0f;
-		}
-	}
+void Pathtracer::adaptive_sampling_free() {
+	CUDAMemory::free(ptr_adaptive_moments);
+	CUDAMemory::free(ptr_adaptive_pixels);
+	CUDAMemory::free(ptr_adaptive_pixel_count);
+}
 
-	struct LightTriangle {
-		int    index;
-		double area;
-	};
-	Array<LightTriangle> light_triangles(frame_allocator);
+void Pathtracer::convergence_init() {
+	CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::FRAMEBUFFERS);
 
-	struct LightMeshData {
-		size_t first_triangle_index;
-		size_t triangle_count;
+	ptr_convergence_moments = CUDAMemory::malloc<float4>(alloc_pixel_count());
+	ptr_convergence_error   = CUDAMemory::malloc<float2>();
 
-		double total_area;
-	};
-	Array<LightMeshData> light_mesh_datas(frame_allocator);
+	cuda_module.get_global("convergence_moments").set_value(ptr_convergence_moments);
+	cuda_module.get_global("convergence_error")  .set_value(ptr_convergence_error);
+}
 
-	using It = decltype(mesh_data_used_as_lights)::Iterator;
+void Pathtracer::convergence_free() {
+	CUDAMemory::free(ptr_convergence_moments);
+	CUDAMemory::free(ptr_convergence_error);
 
-	for (It it = mesh_data_used_as_lights.begin(); it != mesh_data_used_as_lights.end(); ++it) {
-		Handle<MeshData>  mesh_data_handle = Handle<MeshData> { it.get_key() };
-		Array<Mesh *> & meshes           = it.get_value();
+	// kernel_accumulate only records moments while they exist
+	cuda_module.get_global("convergence_moments").set_value(ptr_convergence_moments);
+}
 
-		const MeshData & mesh_data = scene.asset_manager.get_mesh_data(mesh_data_handle);
+void Pathtracer::variable_rate_mask_init() {
+	int tiles_x = Math::divide_round_up(screen_width,  VARIABLE_RATE_TILE_SIZE);
+	int tiles_y = Math::divide_round_up(screen_height, VARIABLE_RATE_TILE_SIZE);
 
-		LightMeshData & light_mesh_data = light_mesh_datas.emplace_back();
-		light_mesh_data.first_triangle_index = light_triangles.size();
-		light_mesh_data.triangle_count = mesh_data.triangles.size();
-		light_mesh_data.total_area = 0.0f;
+	cuda_module.get_global("variable_rate_tiles_x").set_value(tiles_x);
 
-		for (int t = 0; t < mesh_data.triangles.size(); t++) {
-			const Triangle & triangle = mesh_data.triangles[t];
+	if (cpu_config.variable_rate_mask_filename.is_empty()) return;
 
-			float area = 0.5f * Vector3::length(Vector3::cross(
-				triangle.position_1 - triangle.position_0,
-				triangle.position_2 - triangle.position_0
-			));
-			light_triangles.emplace_back(reverse_indices[mesh_data_triangle_offsets[mesh_data_handle.handle] + t], area);
-			light_mesh_data.total_area += area;
-		}
+	int width;
+	int height;
+	int channels;
+	unsigned char * mask = stbi_load(cpu_config.variable_rate_mask_filename.data(), &width, &height, &channels, STBI_grey);
+
+	if (!mask || width == 0 || height == 0) {
+		IO::print("WARNING: Unable to load variable rate mask from file '{}', using foveation instead\n"_sv, cpu_config.variable_rate_mask_filename);
+		return;
+	}
 
-		for (int m = 0; m < meshes.size(); m++) {
-			Mesh * mesh = meshes[m];
+	// Point sample the mask at the centre of every Tile, white maps to full rate and black to the lowest rate
+	Array<unsigned char> rates(tiles_x * tiles_y);
 
-			const Material & material = scene.asset_manager.get_material(mesh->material_handle);
-			float power = Math::luminance(material.emission);
+	for (int tile_y = 0; tile_y < tiles_y; tile_y++) {
+		for (int tile_x = 0; tile_x < tiles_x; tile_x++) {
+			int x = Math::min(((tile_x * VARIABLE_RATE_TILE_SIZE + VARIABLE_RATE_TILE_SIZE / 2) * width)  / screen_width,  width  - 1);
+			int y = Math::min(((tile_y * VARIABLE_RATE_TILE_SIZE + VARIABLE_RATE_TILE_SIZE / 2) * height) / screen_height, height - 1);
 
-			mesh->light.weight               = power * float(light_mesh_data.total_area);
-			mesh->light.first_triangle_index = light_mesh_data.first_triangle_index;
-			mesh->light.triangle_count       = light_mesh_data.triangle_count;
+			rates[tile_x + tile_y * tiles_x] = ((255 - mask[x + y * width]) * VARIABLE_RATE_MAX_LOG2 + 127) / 255;
 		}
 	}
 
-	if (light_triangles.size() > 0) {
-		Array<int>   light_triangle_indices               (light_triangles.size(), frame_allocator);
-		Array<float> light_triangle_cumulative_probability(light_triangles.size(), frame_allocator);
-
-		for (int m = 0; m < light_mesh_datas.size(); m++) {
-			const LightMeshData & light_mesh_data = light_mesh_datas[m];
+	stbi_image_free(mask);
 
-			double cumulative_area = 0.0;
+	CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::FRAMEBUFFERS);
 
-			for (int i = light_mesh_data.first_triangle_index; i < light_mesh_data.first_triangle_index + light_mesh_data.triangle_count; i++) {
-				light_triangle_indices[i] = light_triangles[i].index;
+	ptr_variable_rate_mask = CUDAMemory::malloc(rates);
+	cuda_module.get_global("variable_rate_mask").set_value(ptr_variable_rate_mask);
+}
 
-				cumulative_area += light_triangles[i].area / light_mesh_data.total_area;
-				light_triangle_cumulative_probability[i] = float(cumulative_area);
-			}
+void Pathtracer::restir_init() {
+	CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::FRAMEBUFFERS);
 
-			for (int i = light_mesh_data.first_triangle_index; i < light_mesh_data.first_triangle_index + light_mesh_data.triangle_count; i++) {
-				light_triangle_cumulative_probability[i] /= float(cumulative_area);
-			}
-		}
+	// Double buffered, the previous frame is read while the current one is written
+	ptr_restir_reservoirs = CUDAMemory::malloc<Reservoir>(2 * alloc_pixel_count());
+	cuda_module.get_global("restir_reservoirs").set_value(ptr_restir_reservoirs);
 
-		ptr_light_triangle_indices                = CUDAMemory::malloc(light_triangle_indices);
-		ptr_light_triangle_cumulative_probability = CUDAMemory::malloc(light_triangle_cumulative_probability);
+	// A zero depth never passes reservoir_is_consistent, in case the first frame has a non-zero sample index
+	CUDAMemory::memset_async(ptr_restir_reservoirs, 0, 2 * alloc_pixel_count(), memory_stream);
+}
 
-		cuda_module.get_global("light_triangle_indices")               .set_value_async(ptr_light_triangle_indices,                memory_stream);
-		cuda_module.get_global("light_triangle_cumulative_probability").set_value_async(ptr_light_triangle_cumulative_probability, memory_stream);
+void Pathtracer::restir_free() {
+	CUDAMemory::free(ptr_restir_reservoirs);
+}
 
-		cuda_module.get_global("light_mesh_count").set_value_async(light_mesh_count, memory_stream);
+void Pathtracer::path_guiding_init() {
+	CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::FRAMEBUFFERS);
 
-		if (ptr_light_mesh_cumulative_probability.ptr != NULL) CUDAMemory::free(ptr_light_mesh_cumulative_probability);
-		if (ptr_light_mesh_triangle_span         .ptr != NULL) CUDAMemory::free(ptr_light_mesh_triangle_span);
-		if (ptr_light_mesh_transform_indices     .ptr != NULL) CUDAMemory::free(ptr_light_mesh_transform_indices);
+	ptr_guiding_keys          = CUDAMemory::malloc<unsigned>(GUIDING_HASH_SIZE);
+	ptr_guiding_sample_counts = CUDAMemory::malloc<int>     (GUIDING_HASH_SIZE);
+	ptr_guiding_radiance      = CUDAMemory::malloc<float>   (GUIDING_HASH_SIZE * GUIDING_BIN_COUNT);
+	ptr_guiding_cdf           = CUDAMemory::malloc<float>   (GUIDING_HASH_SIZE * GUIDING_BIN_COUNT);
+	ptr_guiding_vertices      = CUDAMemory::malloc<GuidingVertex>(alloc_pixel_count() * GUIDING_MAX_VERTICES);
 
-		// The Device pointers below are only filled in and copied to the GPU once the TLAS is constructed,
-		// therefore the scene_invalidated flag is required to be set.
-		invalidated_scene = true;
+	cuda_module.get_global("guiding_keys")         .set_value(ptr_guiding_keys);
+	cuda_module.get_global("guiding_sample_counts").set_value(ptr_guiding_sample_counts);
+	cuda_module.get_global("guiding_radiance")     .set_value(ptr_guiding_radiance);
+	cuda_module.get_global("guiding_cdf")          .set_value(ptr_guiding_cdf);
+	cuda_module.get_global("guiding_vertices")     .set_value(ptr_guiding_vertices);
 
-		ptr_light_mesh_cumulative_probability = CUDAMemory::malloc<float>(light_mesh_count);
-		ptr_light_mesh_triangle_span          = CUDAMemory::malloc<int2> (light_mesh_count);
-		ptr_light_mesh_transform_indices      = CUDAMemory::malloc<int>  (light_mesh_count);
+	// All bits set is INVALID, no vertices are recorded yet
+	CUDAMemory::memset_async(ptr_guiding_vertices, -1, alloc_pixel_count() * GUIDING_MAX_VERTICES, memory_stream);
 
-		cuda_module.get_global("light_mesh_cumulative_probability").set_value_async(ptr_light_mesh_cumulative_probability, memory_stream);
-		cuda_module.get_global("light_mesh_triangle_span")         .set_value_async(ptr_light_mesh_triangle_span,          memory_stream);
-		cuda_module.get_global("light_mesh_transform_indices")     .set_value_async(ptr_light_mesh_transform_indices,      memory_stream);
-	}
+	path_guiding_reset();
 }
 
-// Construct Top Level Acceleration Structure (TLAS) over the Meshes in the Scene
-void Pathtracer::calc_light_mesh_weights() {
-	int    light_mesh_count    = 0;
-	double lights_total_weight = 0.0;
+void Pathtracer::path_guiding_free() {
+	CUDAMemory::free(ptr_guiding_keys);
+	CUDAMemory::free(ptr_guiding_sample_counts);
+	CUDAMemory::free(ptr_guiding_radiance);
+	CUDAMemory::free(ptr_guiding_cdf);
+	CUDAMemory::free(ptr_guiding_vertices);
+}
 
+void Pathtracer::path_guiding_reset() {
+	// The cells are sized relative to the Scene
+	AABB scene_aabb = AABB::create_empty();
 	for (int i = 0; i < scene.meshes.size(); i++) {
-		const Mesh & mesh = scene.meshes[tlas->indices[i]];
-
-		bool mesh_is_light = mesh.light.weight > 0.0f;
-		if (mesh_is_light) {
-			int light_index = light_mesh_count++;
-
-			double light_weight_scaled = mesh.light.weight * mesh.scale * mesh.scale;
-			lights_total_weight += light_weight_scaled;
-
-			pinned_light_mesh_cumulative_probability[light_index]   = float(lights_total_weight);
-			pinned_light_mesh_triangle_span         [light_index].x = mesh.light.first_triangle_index;
-			pinned_light_mesh_triangle_span         [light_index].y = mesh.light.first_triangle_index + mesh.light.triangle_count - 1;
-			pinned_light_mesh_transform_indices     [light_index]   = i;
-		}
+		scene_aabb.expand(scene.meshes[i].aabb);
 	}
 
-	if (light_mesh_count > 0) {
-		for (int i = 0; i < light_mesh_count; i++) {
-			pinned_light_mesh_cumulative_probability[i] /= float(lights_total_weight);
-		}
-		CUDAMemory::memcpy_async(ptr_light_mesh_cumulative_probability, pinned_light_mesh_cumulative_probability, light_mesh_count, memory_stream);
-		CUDAMemory::memcpy_async(ptr_light_mesh_triangle_span,          pinned_light_mesh_triangle_span,          light_mesh_count, memory_stream);
-		CUDAMemory::memcpy_async(ptr_light_mesh_transform_indices,      pinned_light_mesh_transform_indices,      light_mesh_count, memory_stream);
+	float cell_size = 1.0f;
+	if (!scene_aabb.is_empty()) {
+		cell_size = Math::max(Vector3::length(scene_aabb.max - scene_aabb.min) / float(GUIDING_GRID_RESOLUTION), EPSILON);
 	}
+	cuda_module.get_global("guiding_cell_size_inv").set_value_async(1.0f / cell_size, memory_stream);
 
-	global_lights_total_weight.set_value_async(float(lights_total_weight), memory_stream);
+	CUDAMemory::memset_async(ptr_guiding_keys,          0, GUIDING_HASH_SIZE,                     memory_stream);
+	CUDAMemory::memset_async(ptr_guiding_sample_counts, 0, GUIDING_HASH_SIZE,                     memory_stream);
+	CUDAMemory::memset_async(ptr_guiding_radiance,      0, GUIDING_HASH_SIZE * GUIDING_BIN_COUNT, memory_stream);
+	CUDAMemory::memset_async(ptr_guiding_cdf,           0, GUIDING_HASH_SIZE * GUIDING_BIN_COUNT, memory_stream);
 }
 
-void Pathtracer::update(float delta, Allocator * frame_allocator) {
+void Pathtracer::radiance_cache_init() {
+	CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::FRAMEBUFFERS);
+
+	ptr_radiance_cache_keys     = CUDAMemory::malloc<unsigned>(RADIANCE_CACHE_HASH_SIZE);
+	ptr_radiance_cache_sums     = CUDAMemory::malloc<float4>  (RADIANCE_CACHE_HASH_SIZE);
+	ptr_radiance_cache_radiance = CUDAMemory::malloc<float4>  (RADIANCE_CACHE_HASH_SIZE);
+	ptr_radiance_cache_vertices = CUDAMemory::malloc<RadianceCacheVertex>(alloc_pixel_count() * RADIANCE_CACHE_MAX_VERTICES);
+
+	cuda_module.get_global("radiance_cache_keys")    .set_value(ptr_radiance_cache_keys);
+	cuda_module.get_global("radiance_cache_sums")    .set_value(ptr_radiance_cache_sums);
+	cuda_module.get_global("radiance_cache_radiance").set_value(ptr_radiance_cache_radiance);
+	cuda_module.get_global("radiance_cache_vertices").set_value(ptr_radiance_cache_vertices);
+
+	// All bits set is INVALID, no vertices are recorded yet
+	CUDAMemory::memset_async(ptr_radiance_cache_vertices, -1, alloc_pixel_count() * RADIANCE_CACHE_MAX_VERTICES, memory_stream);
+
+	radiance_cache_reset();
+}
+
+void Pathtracer::radiance_cache_free() {
+	CUDAMemory::free(ptr_radiance_cache_keys);
+	CUDAMemory::free(ptr_radiance_cache_sums);
+	CUDAMemory::free(ptr_radiance_cache_radiance);
+	CUDAMemory::free(ptr_radiance_cache_vertices);
+}
+
+void Pathtracer::radiance_cache_reset() {
+	AABB scene_aabb = AABB::create_empty();
+	for (int i = 0; i < scene.meshes.size(); i++) {
+		scene_aabb.expand(scene.meshes[i].aabb);
+	}
+
+	float cell_size = 1.0f;
+	if (!scene_aabb.is_empty()) {
+		cell_size = Math::max(Vector3::length(scene_aabb.max - scene_aabb.min) / float(RADIANCE_CACHE_GRID_RESOLUTION), EPSILON);
+	}
+	cuda_module.get_global("radiance_cache_cell_size_inv").set_value_async(1.0f / cell_size, memory_stream);
+
+	CUDAMemory::memset_async(ptr_radiance_cache_keys,     0, RADIANCE_CACHE_HASH_SIZE, memory_stream);
+	CUDAMemory::memset_async(ptr_radiance_cache_sums,     0, RADIANCE_CACHE_HASH_SIZE, memory_stream);
+	CUDAMemory::memset_async(ptr_radiance_cache_radiance, 0, RADIANCE_CACHE_HASH_SIZE, memory_stream);
+}
+
+void Pathtracer::variable_rate_mask_free() {
+	if (ptr_variable_rate_mask.ptr != NULL) {
+		CUDAMemory::free(ptr_variable_rate_mask);
+		ptr_variable_rate_mask = CUDAMemory::Ptr<unsigned char>(NULL);
+
+		cuda_module.get_global("variable_rate_mask").set_value(ptr_variable_rate_mask);
+	}
+}
+
+void Pathtracer::shadow_occluder_cache_init() {
+	CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::WAVEFRONT);
+
+	// Indexed by pixel_index, which uses screen_pitch. Starts out empty (mesh_id INVALID)
+	ptr_shadow_occluder_cache = CUDAMemory::malloc<int2>(alloc_pixel_count());
+	CUDAMemory::memset_async(ptr_shadow_occluder_cache, INVALID, alloc_pixel_count(), memory_stream);
+
+	cuda_module.get_global("shadow_occluder_cache").set_value(ptr_shadow_occluder_cache);
+}
+
+void Pathtracer::shadow_occluder_cache_free() {
+	CUDAMemory::free(ptr_shadow_occluder_cache);
+}
+
+// The TLAS leaves are only suspended into the treelet queues by the software BVH8 traversal
+bool Pathtracer::treelet_queues_supported() const {
+	return cpu_config.bvh_type == BVHType::BVH8 && !use_optix;
+}
+
+void Pathtracer::treelet_queues_init() {
+	CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::WAVEFRONT);
+
+	int entry_capacity = batch_size * TREELET_ENTRIES_PER_RAY;
+	int mesh_count     = int(scene.meshes.size());
+
+	ptr_treelet_entries           = CUDAMemory::malloc<int2>    (entry_capacity);
+	ptr_treelet_entries_sorted    = CUDAMemory::malloc<int2>    (entry_capacity);
+	ptr_treelet_entry_hits        = CUDAMemory::malloc<float4>  (entry_capacity);
+	ptr_treelet_offsets           = CUDAMemory::malloc<int>     (mesh_count);
+	ptr_treelet_ray_t             = CUDAMemory::malloc<unsigned>(batch_size);
+	ptr_treelet_entry_count_total = CUDAMemory::malloc<int>     (1);
+
+	cuda_module.get_global("treelet_entries")          .set_value(ptr_treelet_entries);
+	cuda_module.get_global("treelet_entries_sorted")   .set_value(ptr_treelet_entries_sorted);
+	cuda_module.get_global("treelet_entry_hits")       .set_value(ptr_treelet_entry_hits);
+	cuda_module.get_global("treelet_offsets")          .set_value(ptr_treelet_offsets);
+	cuda_module.get_global("treelet_ray_t")            .set_value(ptr_treelet_ray_t);
+	cuda_module.get_global("treelet_entry_count_total").set_value(ptr_treelet_entry_count_total);
+	cuda_module.get_global("treelet_entry_capacity")   .set_value(entry_capacity);
+	cuda_module.get_global("treelet_mesh_count")       .set_value(mesh_count);
+}
+
+void Pathtracer::treelet_queues_free() {
+	if (!ptr_treelet_entries.ptr) return;
+
+	CUDAMemory::free(ptr_treelet_entries);
+	CUDAMemory::free(ptr_treelet_entries_sorted);
+	CUDAMemory::free(ptr_treelet_entry_hits);
+	CUDAMemory::free(ptr_treelet_offsets);
+	CUDAMemory::free(ptr_treelet_ray_t);
+	CUDAMemory::free(ptr_treelet_entry_count_total);
+}
+
+void Pathtracer::bake_prepare(int & width, int & height) {
+	if (gpu_config.enable_svgf || gpu_config.enable_restir || gpu_config.enable_reprojection || use_pixel_list() || gpu_config.enable_raster_primary || cpu_config.view_layout != ViewLayout::SINGLE) {
+		IO::print("WARNING: Baking does not support SVGF, ReSTIR, reprojection, adaptive or variable rate sampling, rasterised primary visibility or multiple views, they are disabled\n"_sv);
+	}
+	gpu_config.enable_svgf              = false;
+	gpu_config.enable_reprojection      = false;
+	gpu_config.enable_restir            = false;
+	gpu_config.enable_adaptive_sampling = false;
+	gpu_config.enable_variable_rate     = false;
+	gpu_config.enable_raster_primary    = false;
+	cpu_config.view_layout = ViewLayout::SINGLE;
+
+	// Mesh i gets the tile (i % bake_tiles_x, i / bake_tiles_x), the atlas is as square as possible
+	int mesh_count = Math::max(int(scene.meshes.size()), 1);
+
+	bake_tiles_x = int(ceilf(sqrtf(float(mesh_count))));
+	int tiles_y  = Math::divide_round_up(mesh_count, bake_tiles_x);
+
+	width  = bake_tiles_x * cpu_config.bake_resolution;
+	height = tiles_y      * cpu_config.bake_resolution;
+
+	IO::print("Baking {} Meshes into a {}x{} atlas\n"_sv, scene.meshes.size(), width, height);
+}
+
+void Pathtracer::bake_init() {
+	CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::FRAMEBUFFERS);
+
+	ptr_bake_texels      = CUDAMemory::malloc<int4>(alloc_pixel_count());
+	ptr_bake_texel_list  = CUDAMemory::malloc<int> (alloc_pixel_count());
+	ptr_bake_texel_count = CUDAMemory::malloc<int> ();
+
+	CUDAMemory::memset_async(ptr_bake_texels,      INVALID, alloc_pixel_count(), memory_stream);
+	CUDAMemory::memset_async(ptr_bake_texel_count, 0,       1,                   memory_stream);
+
+	cuda_module.get_global("bake_texels")     .set_value(ptr_bake_texels);
+	cuda_module.get_global("bake_texel_list") .set_value(ptr_bake_texel_list);
+	cuda_module.get_global("bake_texel_count").set_value(ptr_bake_texel_count);
+	cuda_module.get_global("bake_tile_size")  .set_value(cpu_config.bake_resolution);
+	cuda_module.get_global("bake_dilation")   .set_value(cpu_config.bake_dilation);
+
+	// All Meshes are rasterised into the same atlas, so a single wavefront renders all of them
+	for (size_t i = 0; i < scene.meshes.size(); i++) {
+		Handle<MeshData> mesh_data_handle = scene.meshes[i].mesh_data_handle;
+		const MeshData & mesh_data = scene.asset_manager.get_mesh_data(mesh_data_handle);
+
+		if (mesh_data.has_curves()) continue; // Curves have no UVs
+
+		int triangle_first = gpu_scene->mesh_data_index_offsets[mesh_data_handle.handle];
+		int triangle_count = int(mesh_data.bvh->indices.size());
+
+		int tile_x = int(i) % bake_tiles_x * cpu_config.bake_resolution;
+		int tile_y = int(i) / bake_tiles_x * cpu_config.bake_resolution;
+
+		kernel_bake_rasterise.set_grid_dim(Math::divide_round_up(triangle_count, kernel_bake_rasterise.block_dim_x), 1, 1);
+		kernel_bake_rasterise.execute_on_stream(memory_stream, int(i), triangle_first, triangle_count, tile_x, tile_y);
+	}
+	kernel_bake_compact.execute_on_stream(memory_stream);
+
+	CUDACALL(cuStreamSynchronize(memory_stream));
+
+	int texel_count;
+	CUDAMemory::memcpy(&texel_count, ptr_bake_texel_count);
+
+	IO::print("Baking {} texels\n"_sv, texel_count);
+
+	// Only the covered texels are rendered
+	pixel_count = texel_count;
+
+	pinned_buffer_sizes->reset(Math::min(batch_size, pixel_count));
+	global_buffer_sizes.set_value(*pinned_buffer_sizes);
+}
+
+void Pathtracer::bake_free() {
+	CUDAMemory::free(ptr_bake_texels);
+	CUDAMemory::free(ptr_bake_texel_list);
+	CUDAMemory::free(ptr_bake_texel_count);
+}
+
+// The rasteriser can only produce the visibility of a pinhole Camera at a single point in time, and does not draw Curves or alpha masks
+bool Pathtracer::raster_primary_supported() const {
+	if (!has_gl_context) return false;
+	if (scene.camera.aperture_radius > 0.0f || gpu_config.enable_motion_blur) return false;
+	if (alpha_mask_count > 0) return false;
+
+	for (size_t i = 0; i < scene.asset_manager.mesh_datas.size(); i++) {
+		if (scene.asset_manager.mesh_datas[i].has_curves()) return false;
+	}
+	return true;
+}
+
+void Pathtracer::raster_primary_init() {
+	CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::FRAMEBUFFERS);
+
+	// The vertex data does not depend on the screen size, it stays resident until the Pathtracer is freed
+	if (!visibility_buffer.has_geometry) {
+		for (size_t i = 0; i < scene.asset_manager.mesh_datas.size(); i++) {
+			scene.asset_manager.restore_host_data(Handle<MeshData> { int(i) });
+		}
+		visibility_buffer.init_geometry(scene);
+
+		if (!ptr_reverse_indices.ptr) {
+			ptr_reverse_indices = CUDAMemory::malloc(gpu_scene->reverse_indices);
+		}
+		cuda_module.get_global("visibility_triangle_indices").set_value(ptr_reverse_indices);
+	}
+
+	visibility_buffer.init_targets(screen_width, screen_height);
+
+	resource_visibility_buffer = CUDAMemory::resource_register(visibility_buffer.texture_ids, CU_GRAPHICS_REGISTER_FLAGS_SURFACE_LDST);
+	array_visibility_buffer    = CUDAMemory::resource_get_array(resource_visibility_buffer);
+	surf_visibility_buffer     = CUDAMemory::create_surface(array_visibility_buffer);
+
+	cuda_module.get_global("visibility_buffer").set_value(surf_visibility_buffer);
+}
+
+void Pathtracer::raster_primary_free() {
+	if (!resource_visibility_buffer) return;
+
+	CUDAMemory::free_surface(surf_visibility_buffer);
+	CUDAMemory::resource_unregister(resource_visibility_buffer);
+
+	resource_visibility_buffer = nullptr;
+	array_visibility_buffer    = nullptr;
+
+	visibility_buffer.free_targets();
+}
+
+void Pathtracer::raster_primary_render() {
+	int sample_index = get_rng_sample_index();
+
+	// Picks the sample position within the Pixel like camera_generate_ray does, but once for all Pixels
+	Vector2 jitter;
+	if (gpu_config.enable_svgf) {
+		constexpr float taa_halton_x[] = { 0.3f, 0.7f, 0.2f, 0.8f };
+		constexpr float taa_halton_y[] = { 0.2f, 0.8f, 0.7f, 0.3f };
+
+		jitter = Vector2(taa_halton_x[sample_index & 3], taa_halton_y[sample_index & 3]);
+	} else {
+		RNG rng(sample_index);
+		float u1 = rng.get_float();
+		float u2 = rng.get_float();
+
+		switch (gpu_config.reconstruction_filter) {
+			case ReconstructionFilter::BOX: {
+				jitter = Vector2(u1, u2);
+				break;
+			}
+			case ReconstructionFilter::TENT: {
+				auto sample_tent = [](float u) {
+					return u < 0.5f ? sqrtf(2.0f * u) - 1.0f : 1.0f - sqrtf(2.0f - 2.0f * u);
+				};
+				jitter = Vector2(sample_tent(u1), sample_tent(u2));
+				break;
+			}
+			case ReconstructionFilter::GAUSSIAN: {
+				// Box-Muller transform, u1 is kept away from 0 for the log
+				float f = sqrtf(-2.0f * logf(Math::max(u1, 1e-7f)));
+				float a = TWO_PI * u2;
+				jitter = Vector2(0.5f + 0.5f * f * cosf(a), 0.5f + 0.5f * f * sinf(a));
+				break;
+			}
+			default: ASSERT_UNREACHABLE();
+		}
+	}
+	global_raster_jitter.set_value_async(jitter, memory_stream);
+
+	const TLASBuffer & buffer = tlas_buffers[tlas_front];
+	visibility_buffer.render(scene, *buffer.tlas.get(), buffer.pinned_mesh_transforms, gpu_scene->mesh_data_triangle_offsets.data(), scene.camera, jitter);
+}
+
+// The IAS only instances Triangle GASes at a single point in time
+bool Pathtracer::optix_supported() const {
+	if (!OptiXTraversal::is_available()) return false;
+	if (gpu_config.enable_motion_blur) return false;
+	if (alpha_mask_count > 0) return false; // The hit programs do not evaluate alpha masks
+
+	for (size_t i = 0; i < scene.asset_manager.mesh_datas.size(); i++) {
+		if (scene.asset_manager.mesh_datas[i].has_curves()) return false;
+	}
+	return true;
+}
+
+void Pathtracer::optix_free() {
+	if (!use_optix) return;
+
+	CUDACALL(cuCtxSynchronize()); // The Pipeline may still be in use by the last frame
+
+	optix_traversal.free();
+	use_optix = false;
+}
+
+void Pathtracer::optix_build_ias() {
+	// The previous frame may still be tracing against the IAS
+	CUDACALL(cuEventRecord(tlas_event_rendered, nullptr));
+	CUDACALL(cuStreamWaitEvent(memory_stream, tlas_event_rendered, 0));
+
+	const TLASBuffer & buffer = tlas_buffers[tlas_front];
+	optix_traversal.build_ias(scene, *gpu_scene.get(), *buffer.tlas.get(), buffer.pinned_mesh_transforms, memory_stream);
+}
+
+// The size of a queue is only known on the GPU, the launch covers the queue of the previous frame with some slack for growth
+// and the programs loop over whatever is left. Without a previous frame the whole batch is covered
+int Pathtracer::optix_launch_width(int queue_size_prev) const {
+	if (!buffer_sizes_prev_valid) return batch_size;
+
+	return Math::clamp(queue_size_prev + queue_size_prev / 2, WARP_SIZE, batch_size);
+}
+
+void Pathtracer::on_mesh_data_updated(int mesh_data_index) {
+	// The new GAS is picked up by the IAS that is built for the refitted TLAS
+	if (use_optix) {
+		optix_traversal.build_gas(scene, *gpu_scene.get(), mesh_data_index);
+	}
+}
+
+void Pathtracer::svgf_free() {
+	if (!gpu_config.enable_reprojection) gbuffer_free();
+
+	aov_disable(AOVType::RADIANCE_DIRECT);
+	aov_disable(AOVType::RADIANCE_INDIRECT);
+	aov_disable(AOVType::ALBEDO);
+
+	CUDAMemory::free(ptr_frame_buffer_moment);
+
+	CUDAMemory::free(ptr_history_length);
+	CUDAMemory::free(ptr_history_direct);
+	CUDAMemory::free(ptr_history_indirect);
+	CUDAMemory::free(ptr_history_moment);
+	CUDAMemory::free(ptr_history_normal_and_depth);
+
+	CUDAMemory::free(ptr_svgf_tile_list);
+	CUDAMemory::free(ptr_svgf_tile_count);
+	CUDAMemory::free(ptr_svgf_tile_active);
+
+	CUDAMemory::free(ptr_taa_frame_prev);
+	CUDAMemory::free(ptr_taa_frame_curr);
+
+	if (ptr_upscale_history.ptr) {
+		CUDAMemory::free(ptr_upscale_history);
+		ptr_upscale_history = CUDAMemory::Ptr<float4>();
+	}
+}
+
+void Pathtracer::reprojection_init() {
+	CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::FRAMEBUFFERS);
+
+	gbuffer_init();
+
+	ptr_reprojection_radiance      = CUDAMemory::malloc<float4>(alloc_pixel_count());
+	ptr_reprojection_sample_counts = CUDAMemory::malloc<float> (alloc_pixel_count());
+	ptr_reprojection_history       = CUDAMemory::malloc<int4>  (alloc_pixel_count());
+
+	// Until the first frame has been accumulated no Pixel has a valid history
+	CUDAMemory::memset_async(ptr_reprojection_history, INVALID, alloc_pixel_count(), memory_stream);
+
+	cuda_module.get_global("reprojection_radiance")     .set_value(ptr_reprojection_radiance);
+	cuda_module.get_global("reprojection_sample_counts").set_value(ptr_reprojection_sample_counts);
+	cuda_module.get_global("reprojection_history")      .set_value(ptr_reprojection_history);
+
+	reprojection_sample_index_first = 0;
+}
+
+void Pathtracer::reprojection_free() {
+	if (!gpu_config.enable_svgf) gbuffer_free();
+
+	CUDAMemory::free(ptr_reprojection_radiance);
+	CUDAMemory::free(ptr_reprojection_sample_counts);
+	CUDAMemory::free(ptr_reprojection_history);
+
+	// kernel_accumulate only reprojects while the sample counts exist
+	cuda_module.get_global("reprojection_sample_counts").set_value(ptr_reprojection_sample_counts);
+}
+
+Array<Pathtracer::TunableKernel> Pathtracer::get_tunable_kernels() {
+	return {
+		{ "kernel_generate"_sv,              &kernel_generate,              false },
+		{ "kernel_sort"_sv,                  &kernel_sort,                  false },
+		{ "kernel_medium"_sv,                &kernel_medium,                false },
+		{ "kernel_miss"_sv,                  &kernel_miss,                  false },
+		{ "kernel_light_hit"_sv,             &kernel_light_hit,             false },
+		{ "kernel_material_diffuse"_sv,      &kernel_material_diffuse,      false },
+		{ "kernel_material_plastic"_sv,      &kernel_material_plastic,      false },
+		{ "kernel_material_dielectric"_sv,   &kernel_material_dielectric,   false },
+		{ "kernel_material_conductor"_sv,    &kernel_material_conductor,    false },
+		{ "kernel_material_sort_scatter"_sv, &kernel_material_sort_scatter, false },
+		{ "kernel_ray_sort_count"_sv,        &kernel_ray_sort_count,        false },
+		{ "kernel_ray_sort_scatter"_sv,      &kernel_ray_sort_scatter,      false },
+		{ "kernel_svgf_reproject"_sv,        &kernel_svgf_reproject,        true },
+		{ "kernel_svgf_variance"_sv,         &kernel_svgf_variance,         true },
+		{ "kernel_svgf_atrous"_sv,           &kernel_svgf_atrous,           true },
+		{ "kernel_svgf_finalize"_sv,         &kernel_svgf_finalize,         true },
+		{ "kernel_taa"_sv,                   &kernel_taa,                   true },
+		{ "kernel_taa_finalize"_sv,          &kernel_taa_finalize,          true },
+		{ "kernel_accumulate"_sv,            &kernel_accumulate,            true }
+	};
+}
+
+// The megakernel only implements the BVH8 traversal and leaves out Media scattering and the GBuffers of SVGF and reprojection
+bool Pathtracer::megakernel_supported() const {
+	return cpu_config.bvh_type == BVHType::BVH8 && scene.asset_manager.media.size() == 0 && !gpu_config.enable_svgf && !gpu_config.enable_reprojection;
+}
+
+// For small frames the wavefront Kernels are mostly waiting on their round trips through global memory and the launch overhead
+// of every bounce, a single Kernel that keeps the entire path in registers is faster there
+bool Pathtracer::use_megakernel() const {
+	if (!megakernel_supported() || is_baking()) return false;
+
+	return cpu_config.integrator == IntegratorType::MEGAKERNEL || pixel_count <= cpu_config.megakernel_threshold;
+}
+
+// Sets the Grid dimensions of the Kernels that depend on the screen or batch size, needs to be called again when their Block dimensions change
+void Pathtracer::kernels_set_grid_dim() {
+	kernel_svgf_reproject.set_grid_dim(screen_pitch / kernel_svgf_reproject.block_dim_x, Math::divide_round_up(screen_height, kernel_svgf_reproject.block_dim_y), 1);
+	kernel_svgf_variance .set_grid_dim(screen_pitch / kernel_svgf_variance .block_dim_x, Math::divide_round_up(screen_height, kernel_svgf_variance .block_dim_y), 1);
+	kernel_svgf_atrous   .set_grid_dim(screen_pitch / kernel_svgf_atrous   .block_dim_x, Math::divide_round_up(screen_height, kernel_svgf_atrous   .block_dim_y), 1);
+	kernel_svgf_atrous_tiled.set_grid_dim(Math::divide_round_up(screen_width, SVGF_TILE_SIZE), Math::divide_round_up(screen_height, SVGF_TILE_SIZE), 1);
+	kernel_svgf_classify    .set_grid_dim(Math::divide_round_up(screen_width, SVGF_TILE_SIZE), Math::divide_round_up(screen_height, SVGF_TILE_SIZE), 1);
+	kernel_svgf_taa_resolve .set_grid_dim(Math::divide_round_up(screen_width, SVGF_TILE_SIZE), Math::divide_round_up(screen_height, SVGF_TILE_SIZE), 1);
+	kernel_svgf_finalize .set_grid_dim(screen_pitch / kernel_svgf_finalize .block_dim_x, Math::divide_round_up(screen_height, kernel_svgf_finalize .block_dim_y), 1);
+	kernel_taa           .set_grid_dim(screen_pitch / kernel_taa           .block_dim_x, Math::divide_round_up(screen_height, kernel_taa           .block_dim_y), 1);
+	kernel_taa_finalize  .set_grid_dim(screen_pitch / kernel_taa_finalize  .block_dim_x, Math::divide_round_up(screen_height, kernel_taa_finalize  .block_dim_y), 1);
+	kernel_accumulate    .set_grid_dim(screen_pitch / kernel_accumulate    .block_dim_x, Math::divide_round_up(screen_height, kernel_accumulate    .block_dim_y), view_count);
+	kernel_bake_compact  .set_grid_dim(screen_pitch / kernel_bake_compact  .block_dim_x, Math::divide_round_up(screen_height, kernel_bake_compact  .block_dim_y), 1);
+	kernel_bake_dilate   .set_grid_dim(screen_pitch / kernel_bake_dilate   .block_dim_x, Math::divide_round_up(screen_height, kernel_bake_dilate   .block_dim_y), 1);
+	kernel_reproject     .set_grid_dim(screen_pitch / kernel_reproject     .block_dim_x, Math::divide_round_up(screen_height, kernel_reproject     .block_dim_y), 1);
+
+	kernel_convergence_error.set_grid_dim(Math::divide_round_up(screen_width * screen_height, kernel_convergence_error.block_dim_x), 1, 1);
+	kernel_guiding_train .set_grid_dim(screen_pitch / kernel_guiding_train .block_dim_x, Math::divide_round_up(screen_height, kernel_guiding_train .block_dim_y), 1);
+	kernel_radiance_cache_train.set_grid_dim(screen_pitch / kernel_radiance_cache_train.block_dim_x, Math::divide_round_up(screen_height, kernel_radiance_cache_train.block_dim_y), 1);
+
+	kernel_upscale             .set_grid_dim(Math::divide_round_up(display_width, kernel_upscale             .block_dim_x), Math::divide_round_up(display_height, kernel_upscale             .block_dim_y), 1);
+	kernel_taa_upscale         .set_grid_dim(Math::divide_round_up(display_width, kernel_taa_upscale         .block_dim_x), Math::divide_round_up(display_height, kernel_taa_upscale         .block_dim_y), 1);
+	kernel_taa_upscale_finalize.set_grid_dim(Math::divide_round_up(display_width, kernel_taa_upscale_finalize.block_dim_x), Math::divide_round_up(display_height, kernel_taa_upscale_finalize.block_dim_y), 1);
+
+	kernel_generate           .set_grid_dim(Math::divide_round_up(batch_size, kernel_generate           .block_dim_x), 1, 1);
+	kernel_bake_generate      .set_grid_dim(Math::divide_round_up(batch_size, kernel_bake_generate      .block_dim_x), 1, 1);
+	kernel_megakernel         .set_grid_dim(Math::divide_round_up(batch_size, kernel_megakernel         .block_dim_x), 1, 1);
+
+	// Only needs to cover the Rays of a bounce that is finished by the megakernel
+	int megakernel_tail_ray_count = Math::clamp(cpu_config.megakernel_tail_threshold, 1, batch_size);
+	kernel_megakernel_tail.set_grid_dim(Math::divide_round_up(megakernel_tail_ray_count, kernel_megakernel_tail.block_dim_x), 1, 1);
+	queue_kernels_set_grid_dim();
+}
+
+// Sets the Grid dimensions of the Kernels that consume a queue (Sort, Materials and the OptiX shadow resolve)
+void Pathtracer::queue_kernels_set_grid_dim() {
+	CUDAKernel * queue_kernels[] = {
+		&kernel_sort,
+		&kernel_medium,
+		&kernel_miss,
+		&kernel_light_hit,
+		&kernel_material_diffuse,
+		&kernel_material_plastic,
+		&kernel_material_dielectric,
+		&kernel_material_conductor,
+		&kernel_material_sort_scatter,
+		&kernel_ray_sort_count,
+		&kernel_ray_sort_scatter,
+		&kernel_treelet_tlas_bvh8,
+		&kernel_treelet_scatter,
+		&kernel_treelet_blas_bvh8,
+		&kernel_treelet_resolve,
+		&kernel_shadow_resolve
+	};
+
+	for (int i = 0; i < Util::array_count(queue_kernels); i++) {
+		CUDAKernel * kernel = queue_kernels[i];
+
+		int grid_size_batch = Math::divide_round_up(batch_size, kernel->block_dim_x);
+
+		if (cpu_config.enable_persistent_queues) {
+			// Only launch as many Blocks as can be resident at the same time,
+			// the Kernels loop over their queue so any queue size is handled
+			kernel->occupancy_persistent_grid_size_1d();
+			kernel->grid_dim_x = Math::min(kernel->grid_dim_x, grid_size_batch);
+		} else {
+			kernel->set_grid_dim(grid_size_batch, 1, 1);
+		}
+	}
+}
+
+void Pathtracer::graph_free() {
+	if (graph_exec) {
+		CUDACALL(cuGraphExecDestroy(graph_exec));
+		graph_exec = { };
+	}
+}
+
+// The distribution over the Triangles of a MeshData is weighted by the emission Texture,
+// so only Meshes that also share their emission Texture can share a distribution
+struct LightDistributionKey {
+	Handle<MeshData> mesh_data_handle;
+	Handle<Texture>  emission_texture_handle;
+};
+
+static bool operator==(const LightDistributionKey & a, const LightDistributionKey & b) {
+	return a.mesh_data_handle == b.mesh_data_handle && a.emission_texture_handle == b.emission_texture_handle;
+}
+
+void Pathtracer::calc_light_power(Allocator * frame_allocator) {
+	CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::LIGHTS);
+
+	HashMap<LightDistributionKey, Array<Mesh *>> mesh_data_used_as_lights(frame_allocator);
+
+	bool has_emission_textures = false;
+
+	int light_mesh_count = 0;
+
+	// For every Mesh, check whether it is a Light based on its Material
+	// If so, mark the MeshData it is using as being a Light
+	for (size_t m = 0; m < scene.meshes.size(); m++) {
+		Mesh & mesh = scene.meshes[m];
+		const Material & material = scene.asset_manager.get_material(mesh.material_handle);
+
+		// Curves cannot be sampled as area lights, an emissive Curve is only visible when hit directly
+		bool is_light = material.is_light() && !scene.asset_manager.get_mesh_data(mesh.mesh_data_handle).has_curves();
+
+		if (is_light) {
+			Array<Mesh *> & meshes = mesh_data_used_as_lights[LightDistributionKey { mesh.mesh_data_handle, material.emission_texture_handle }];
+			meshes.allocator = frame_allocator;
+			meshes.push_back(&mesh);
+			light_mesh_count++;
+
+			has_emission_textures |= material.emission_texture_handle.handle != INVALID;
+		} else {
+			mesh.light.weight = 0.0f;
+		}
+	}
+
+	// The areas of the light Triangles are determined on the GPU by kernel_light_triangle_cdf, only their totals are read back
+	Array<LightMeshData>   light_mesh_datas      (frame_allocator);
+	Array<Array<Mesh *> *> light_mesh_data_meshes(frame_allocator);
+
+	int light_triangle_count = 0;
+
+	// The Light BVH identifies a light Triangle that was hit by its index within the MeshData
+	Array<int> light_bvh_triangle_local_indices(frame_allocator);
+	int        light_bvh_primitive_count = 0;
+
+	light_bvh_local_index_offsets.resize(scene.asset_manager.mesh_datas.size());
+	for (size_t i = 0; i < light_bvh_local_index_offsets.size(); i++) {
+		light_bvh_local_index_offsets[i] = INVALID;
+	}
+
+	using It = decltype(mesh_data_used_as_lights)::Iterator;
+
+	for (It it = mesh_data_used_as_lights.begin(); it != mesh_data_used_as_lights.end(); ++it) {
+		Handle<MeshData> mesh_data_handle        = it.get_key().mesh_data_handle;
+		Handle<Texture>  emission_texture_handle = it.get_key().emission_texture_handle;
+		Array<Mesh *>  & meshes                  = it.get_value();
+
+		scene.asset_manager.restore_host_data(mesh_data_handle); // Only if a Material became emissive after the release
+
+		const MeshData & mesh_data = scene.asset_manager.get_mesh_data(mesh_data_handle);
+
+		LightMeshData & light_mesh_data = light_mesh_datas.emplace_back();
+		light_mesh_data.first_light_triangle = light_triangle_count;
+		light_mesh_data.triangle_count       = int(mesh_data.triangles.size());
+		light_mesh_data.triangle_offset      = gpu_scene->mesh_data_triangle_offsets[mesh_data_handle.handle];
+		light_mesh_data.emission_texture_id  = emission_texture_handle.handle;
+
+		light_mesh_data_meshes.push_back(&meshes);
+
+		light_triangle_count += light_mesh_data.triangle_count;
+
+		// A MeshData with multiple emission Textures has multiple distributions, but its local indices are only needed once
+		if (light_bvh_local_index_offsets[mesh_data_handle.handle] == INVALID) {
+			const Array<int> & bvh_indices = mesh_data.bvh->indices;
+
+			light_bvh_local_index_offsets[mesh_data_handle.handle] = int(light_bvh_triangle_local_indices.size()) - gpu_scene->mesh_data_index_offsets[mesh_data_handle.handle];
+			for (size_t i = 0; i < bvh_indices.size(); i++) {
+				light_bvh_triangle_local_indices.push_back(bvh_indices[i]);
+			}
+		}
+		light_bvh_primitive_count += meshes.size() * mesh_data.triangles.size();
+	}
+
+	if (light_triangle_count > 0) {
+		if (!ptr_reverse_indices.ptr) {
+			ptr_reverse_indices = CUDAMemory::malloc(gpu_scene->reverse_indices);
+		}
+
+		ptr_light_triangle_indices = CUDAMemory::malloc<int>  (light_triangle_count);
+		ptr_light_triangle_cdf     = CUDAMemory::malloc<float>(light_triangle_count);
+
+		cuda_module.get_global("light_triangle_indices").set_value_async(ptr_light_triangle_indices, memory_stream);
+		cuda_module.get_global("light_triangle_cdf")    .set_value_async(ptr_light_triangle_cdf,     memory_stream);
+
+		// Every MeshData gets its own distribution over the area of its Triangles, stored contiguously
+		CUDAMemory::Ptr<LightMeshData> ptr_light_mesh_datas = CUDAMemory::malloc(light_mesh_datas);
+		CUDAMemory::Ptr<double>        ptr_total_areas      = CUDAMemory::malloc<double>(light_mesh_datas.size());
+
+		// The Light BVH is built on the host, it weighs its primitives by the same Texture weights
+		CUDAMemory::Ptr<float> ptr_texture_weights = { };
+		if (has_emission_textures) {
+			ptr_texture_weights = CUDAMemory::malloc<float>(light_triangle_count);
+		}
+
+		kernel_light_triangle_cdf.set_grid_dim(int(light_mesh_datas.size()), 1, 1);
+		kernel_light_triangle_cdf.execute_on_stream(memory_stream, ptr_light_mesh_datas, ptr_reverse_indices, ptr_light_triangle_indices, ptr_light_triangle_cdf, ptr_texture_weights, ptr_total_areas);
+
+		// The Mesh weights are needed on the host to build the Mesh alias table, see calc_light_mesh_weights
+		Array<double> total_areas(light_mesh_datas.size(), frame_allocator);
+		CUDAMemory::memcpy_async(total_areas.data(), ptr_total_areas, total_areas.size(), memory_stream);
+
+		light_triangle_texture_weights.clear();
+		if (has_emission_textures) {
+			light_triangle_texture_weights.resize(light_triangle_count);
+			CUDAMemory::memcpy_async(light_triangle_texture_weights.data(), ptr_texture_weights, light_triangle_count, memory_stream);
+		}
+		CUDACALL(cuStreamSynchronize(memory_stream));
+
+		CUDAMemory::free(ptr_light_mesh_datas);
+		CUDAMemory::free(ptr_total_areas);
+
+		if (has_emission_textures) {
+			CUDAMemory::free(ptr_texture_weights);
+		}
+
+		for (size_t i = 0; i < light_mesh_datas.size(); i++) {
+			const Array<Mesh *> & meshes = *light_mesh_data_meshes[i];
+
+			for (int m = 0; m < meshes.size(); m++) {
+				Mesh * mesh = meshes[m];
+
+				const Material & material = scene.asset_manager.get_material(mesh->material_handle);
+				float power = Math::luminance(material.emission);
+
+				mesh->light.weight               = power * float(total_areas[i]);
+				mesh->light.first_triangle_index = light_mesh_datas[i].first_light_triangle;
+				mesh->light.triangle_count       = light_mesh_datas[i].triangle_count;
+			}
+		}
+
+		cuda_module.get_global("light_mesh_count").set_value_async(light_mesh_count, memory_stream);
+
+		// The Nodes and primitives of the Light BVH depend on the Mesh transforms, they are filled in by calc_light_bvh()
+		if (ptr_light_bvh_nodes                 .ptr != NULL) CUDAMemory::free(ptr_light_bvh_nodes);
+		if (ptr_light_bvh_node_parents          .ptr != NULL) CUDAMemory::free(ptr_light_bvh_node_parents);
+		if (ptr_light_bvh_primitives            .ptr != NULL) CUDAMemory::free(ptr_light_bvh_primitives);
+		if (ptr_light_bvh_primitive_leaves      .ptr != NULL) CUDAMemory::free(ptr_light_bvh_primitive_leaves);
+		if (ptr_light_bvh_mesh_offsets          .ptr != NULL) CUDAMemory::free(ptr_light_bvh_mesh_offsets);
+		if (ptr_light_bvh_triangle_local_indices.ptr != NULL) CUDAMemory::free(ptr_light_bvh_triangle_local_indices);
+
+		ptr_light_bvh_nodes                  = CUDAMemory::malloc<LightBVH::Node>(2 * light_bvh_primitive_count);
+		ptr_light_bvh_node_parents           = CUDAMemory::malloc<int>           (2 * light_bvh_primitive_count);
+		ptr_light_bvh_primitives             = CUDAMemory::malloc<int2>          (light_bvh_primitive_count);
+		ptr_light_bvh_primitive_leaves       = CUDAMemory::malloc<int>           (light_bvh_primitive_count);
+		ptr_light_bvh_mesh_offsets           = CUDAMemory::malloc<int2>          (scene.meshes.size());
+		ptr_light_bvh_triangle_local_indices = CUDAMemory::malloc(light_bvh_triangle_local_indices);
+
+		cuda_module.get_global("light_bvh_nodes")                 .set_value_async(ptr_light_bvh_nodes,                  memory_stream);
+		cuda_module.get_global("light_bvh_node_parents")          .set_value_async(ptr_light_bvh_node_parents,           memory_stream);
+		cuda_module.get_global("light_bvh_primitives")            .set_value_async(ptr_light_bvh_primitives,             memory_stream);
+		cuda_module.get_global("light_bvh_primitive_leaves")      .set_value_async(ptr_light_bvh_primitive_leaves,       memory_stream);
+		cuda_module.get_global("light_bvh_mesh_offsets")          .set_value_async(ptr_light_bvh_mesh_offsets,           memory_stream);
+		cuda_module.get_global("light_bvh_triangle_local_indices").set_value_async(ptr_light_bvh_triangle_local_indices, memory_stream);
+
+		if (ptr_light_mesh_alias_table      .ptr != NULL) CUDAMemory::free(ptr_light_mesh_alias_table);
+		if (ptr_light_mesh_triangle_span    .ptr != NULL) CUDAMemory::free(ptr_light_mesh_triangle_span);
+		if (ptr_light_mesh_transform_indices.ptr != NULL) CUDAMemory::free(ptr_light_mesh_transform_indices);
+
+		// Force the Mesh alias table to be rebuilt
+		light_mesh_alias_weights.clear();
+
+		// The Device pointers below are only filled in and copied to the GPU once the TLAS is constructed,
+		// therefore the scene_invalidated flag is required to be set.
+		invalidated_scene = true;
+
+		ptr_light_mesh_alias_table       = CUDAMemory::malloc<AliasTable::Entry>(light_mesh_count);
+		ptr_light_mesh_triangle_span     = CUDAMemory::malloc<int2>             (light_mesh_count);
+		ptr_light_mesh_transform_indices = CUDAMemory::malloc<int>              (light_mesh_count);
+
+		cuda_module.get_global("light_mesh_alias_table")      .set_value_async(ptr_light_mesh_alias_table,       memory_stream);
+		cuda_module.get_global("light_mesh_triangle_span")    .set_value_async(ptr_light_mesh_triangle_span,     memory_stream);
+		cuda_module.get_global("light_mesh_transform_indices").set_value_async(ptr_light_mesh_transform_indices, memory_stream);
+	}
+}
+
+// Construct Top Level Acceleration Structure (TLAS) over the Meshes in the Scene
+// Ray sorting quantizes Ray origins within the bounds of the Scene
+void Pathtracer::calc_ray_sort_bounds() {
+	AABB scene_aabb = AABB::create_empty();
+	for (int i = 0; i < scene.meshes.size(); i++) {
+		scene_aabb.expand(scene.meshes[i].aabb);
+	}
+	if (scene_aabb.is_empty()) return;
+
+	Vector3 extent = scene_aabb.max - scene_aabb.min;
+	Vector3 scale  = Vector3(
+		float(1 << RAY_SORT_BITS_PER_AXIS) / Math::max(extent.x, EPSILON),
+		float(1 << RAY_SORT_BITS_PER_AXIS) / Math::max(extent.y, EPSILON),
+		float(1 << RAY_SORT_BITS_PER_AXIS) / Math::max(extent.z, EPSILON)
+	);
+
+	cuda_module.get_global("ray_sort_bounds_min")  .set_value_async(scene_aabb.min, memory_stream);
+	cuda_module.get_global("ray_sort_bounds_scale").set_value_async(scale,          memory_stream);
+}
+
+void Pathtracer::calc_light_mesh_weights() {
+	uint64_t time_start = Profiler::get_time();
+
+	int    light_mesh_count    = 0;
+	double lights_total_weight = 0.0;
+
+	Array<double> light_mesh_weights;
+	Array<int>    light_mesh_indices(scene.meshes.size()); // Light index of every Mesh, or INVALID
+
+	// Lights are indexed in Scene order rather than TLAS order,
+	// so that the alias table stays valid when the TLAS is reordered by a rebuild
+	for (int m = 0; m < scene.meshes.size(); m++) {
+		const Mesh & mesh = scene.meshes[m];
+
+		bool mesh_is_light = mesh.light.weight > 0.0f;
+		if (mesh_is_light) {
+			int light_index = light_mesh_count++;
+
+			double light_weight_scaled = mesh.light.weight * mesh.scale * mesh.scale;
+			lights_total_weight += light_weight_scaled;
+
+			light_mesh_weights.push_back(light_weight_scaled);
+			light_mesh_indices[m] = light_index;
+
+			pinned_light_mesh_triangle_span[light_index].x = mesh.light.first_triangle_index;
+			pinned_light_mesh_triangle_span[light_index].y = mesh.light.first_triangle_index + mesh.light.triangle_count - 1;
+		} else {
+			light_mesh_indices[m] = INVALID;
+		}
+	}
+
+	for (int i = 0; i < scene.meshes.size(); i++) {
+		int light_index = light_mesh_indices[tlas->indices[i]];
+		if (light_index != INVALID) {
+			pinned_light_mesh_transform_indices[light_index] = i;
+		}
+	}
+
+	if (light_mesh_count > 0) {
+		// If only the translation or rotation of Meshes changed the weights are identical and the alias table can be reused
+		bool weights_changed = light_mesh_weights.size() != light_mesh_alias_weights.size();
+		for (int i = 0; !weights_changed && i < light_mesh_count; i++) {
+			weights_changed = light_mesh_weights[i] != light_mesh_alias_weights[i];
+		}
+
+		if (weights_changed) {
+			AliasTable::build(light_mesh_weights.data(), light_mesh_count, pinned_light_mesh_alias_table);
+
+			CUDAMemory::memcpy_async(ptr_light_mesh_alias_table,   pinned_light_mesh_alias_table,   light_mesh_count, memory_stream);
+			CUDAMemory::memcpy_async(ptr_light_mesh_triangle_span, pinned_light_mesh_triangle_span, light_mesh_count, memory_stream);
+
+			light_mesh_alias_weights = std::move(light_mesh_weights);
+
+			update_stats.bytes_uploaded_lights += light_mesh_count * (sizeof(pinned_light_mesh_alias_table[0]) + sizeof(pinned_light_mesh_triangle_span[0]));
+		}
+		CUDAMemory::memcpy_async(ptr_light_mesh_transform_indices, pinned_light_mesh_transform_indices, light_mesh_count, memory_stream);
+
+		update_stats.bytes_uploaded_lights += light_mesh_count * sizeof(pinned_light_mesh_transform_indices[0]);
+	}
+
+	global_lights_total_weight.set_value_async(float(lights_total_weight), memory_stream);
+
+	update_stats.time_light_weights = Profiler::get_time() - time_start;
+}
+
+// Builds the Light BVH over every light Triangle instance in world space, in the order of the TLAS
+void Pathtracer::calc_light_bvh() {
+	ProfileScope scope("Light BVH Build"_sv, "BVH"_sv);
+
+	Array<LightBVH::Primitive> primitives;
+	Array<int2>                primitive_triangles; // Triangle index and TLAS index
+	Array<int2>                mesh_offsets(scene.meshes.size());
+
+	for (int i = 0; i < scene.meshes.size(); i++) {
+		const Mesh & mesh = scene.meshes[tlas->indices[i]];
+
+		if (mesh.light.weight <= 0.0f) {
+			mesh_offsets[i] = { INVALID, INVALID };
+			continue;
+		}
+
+		mesh_offsets[i] = { int(primitives.size()), light_bvh_local_index_offsets[mesh.mesh_data_handle.handle] };
+
+		const MeshData & mesh_data = scene.asset_manager.get_mesh_data(mesh.mesh_data_handle);
+		const Material & material  = scene.asset_manager.get_material(mesh.material_handle);
+
+		float power = Math::luminance(material.emission);
+
+		for (int t = 0; t < mesh_data.triangles.size(); t++) {
+			const Triangle & triangle = mesh_data.triangles[t];
+
+			Vector3 positions[3] = {
+				Matrix4::transform_position(mesh.transform, triangle.position_0),
+				Matrix4::transform_position(mesh.transform, triangle.position_1),
+				Matrix4::transform_position(mesh.transform, triangle.position_2)
+			};
+
+			Vector3 normal = Vector3::cross(positions[1] - positions[0], positions[2] - positions[0]);
+			float   area   = 0.5f * Vector3::length(normal);
+
+			LightBVH::Primitive & primitive = primitives.emplace_back();
+			primitive.aabb   = AABB::from_points(positions, 3);
+			primitive.normal = area > 0.0f ? normal / (2.0f * area) : Vector3(0.0f, 0.0f, 1.0f);
+			primitive.power  = power * area;
+
+			if (light_triangle_texture_weights.size() > 0) {
+				primitive.power *= light_triangle_texture_weights[mesh.light.first_triangle_index + t];
+			}
+
+			primitive_triangles.push_back({ gpu_scene->reverse_indices[gpu_scene->mesh_data_triangle_offsets[mesh.mesh_data_handle.handle] + t], i });
+		}
+	}
+
+	if (primitives.size() == 0) return;
+
+	light_bvh.build(primitives);
+
+	CUDAMemory::memcpy_async(ptr_light_bvh_nodes,            light_bvh.nodes.data(),            light_bvh.nodes.size(),            memory_stream);
+	CUDAMemory::memcpy_async(ptr_light_bvh_node_parents,     light_bvh.parents.data(),          light_bvh.parents.size(),          memory_stream);
+	CUDAMemory::memcpy_async(ptr_light_bvh_primitives,       primitive_triangles.data(),        primitive_triangles.size(),        memory_stream);
+	CUDAMemory::memcpy_async(ptr_light_bvh_primitive_leaves, light_bvh.primitive_leaves.data(), light_bvh.primitive_leaves.size(), memory_stream);
+	CUDAMemory::memcpy_async(ptr_light_bvh_mesh_offsets,     mesh_offsets.data(),               mesh_offsets.size(),               memory_stream);
+}
+
+// Packs a Material into the layout that is read on the GPU
+static Integrator::CUDAMaterial material_to_cuda(const Material & material) {
+	Integrator::CUDAMaterial cuda_material;
+
+	switch (material.type) {
+		case Material::Type::LIGHT: {
+			cuda_material.light.emission   = material.emission;
+			cuda_material.light.texture_id = material.emission_texture_handle.handle;
+			break;
+		}
+		case Material::Type::DIFFUSE: {
+			cuda_material.diffuse.diffuse    = material.diffuse;
+			cuda_material.diffuse.texture_id = material.texture_handle.handle;
+			break;
+		}
+		case Material::Type::PLASTIC: {
+			cuda_material.plastic.diffuse              = material.diffuse;
+			cuda_material.plastic.texture_id           = material.texture_handle.handle;
+			cuda_material.plastic.linear_roughness     = material.linear_roughness;
+			cuda_material.plastic.roughness_texture_id = material.roughness_texture_handle.handle;
+			break;
+		}
+		case Material::Type::DIELECTRIC: {
+			cuda_material.dielectric.medium_id            = material.medium_handle.handle;
+			cuda_material.dielectric.ior                  = Math::max(material.index_of_refraction, 1.0001f);
+			cuda_material.dielectric.linear_roughness     = material.linear_roughness;
+			cuda_material.dielectric.roughness_texture_id = material.roughness_texture_handle.handle;
+			break;
+		}
+		case Material::Type::CONDUCTOR: {
+			cuda_material.conductor.eta                  = material.eta;
+			cuda_material.conductor.linear_roughness     = material.linear_roughness;
+			cuda_material.conductor.k                    = material.k;
+			cuda_material.conductor.roughness_texture_id = material.roughness_texture_handle.handle;
+			break;
+		}
+		default: ASSERT_UNREACHABLE();
+	}
+
+	return cuda_material;
+}
+
+// Sorts the handles and calls upload(offset, count) for every run of consecutive handles,
+// where offset is the index of the first handle of the run in the sorted Array
+template<typename Upload>
+static void for_each_handle_run(Array<int> & handles, Upload upload) {
+	Sort::quick_sort(handles.begin(), handles.end());
+
+	size_t run_offset = 0;
+	for (size_t i = 1; i <= handles.size(); i++) {
+		if (i == handles.size() || handles[i] != handles[i - 1] + 1) {
+			upload(run_offset, int(i - run_offset));
+			run_offset = i;
+		}
+	}
+}
+
+void Pathtracer::update(float delta, Allocator * frame_allocator) {
+	ProfileScope scope("Update"_sv);
+
+	update_stats = { };
+
+	// Any change to the config may change which Kernels are launched (e.g. num_bounces)
+	if (invalidated_gpu_config) {
+		invalidated_graph = true;
+	}
+
 	if (invalidated_sky) {
 		invalidated_sky = false;
 		global_sky_scale.set_value_async(scene.sky.scale, memory_stream);
@@ -542,51 +1937,27 @@ void Pathtracer::update(float delta, Allocator * frame_allocator) {
 	}
 
 	if (invalidated_materials) {
+		ProfileScope scope("Material Upload"_sv);
+
+		uint64_t time_start = Profiler::get_time();
+
 		const Array<Material> & materials = scene.asset_manager.materials;
 
 		Array<Material::Type> cuda_material_types(materials.size(), frame_allocator);
 		Array<CUDAMaterial>   cuda_materials     (materials.size(), frame_allocator);
 
 		for (int i = 0; i < materials.size(); i++) {
-			const Material & material = materials[i];
-
-			cuda_material_types[i] = material.type;
-
-			switch (material.type) {
-				case Material::Type::LIGHT: {
-					cuda_materials[i].light.emission = material.emission;
-					break;
-				}
-				case Material::Type::DIFFUSE: {
-					cuda_materials[i].diffuse.diffuse    = material.diffuse;
-					cuda_materials[i].diffuse.texture_id = material.texture_handle.handle;
-					break;
-				}
-				case Material::Type::PLASTIC: {
-					cuda_materials[i].plastic.diffuse          = material.diffuse;
-					cuda_materials[i].plastic.texture_id       = material.texture_handle.handle;
-					cuda_materials[i].plastic.linear_roughness = material.linear_roughness;
-					break;
-				}
-				case Material::Type::DIELECTRIC: {
-					cuda_materials[i].dielectric.medium_id        = material.medium_handle.handle;
-					cuda_materials[i].dielectric.ior              = Math::max(material.index_of_refraction, 1.0001f);
-					cuda_materials[i].dielectric.linear_roughness = material.linear_roughness;
-					break;
-				}
-				case Material::Type::CONDUCTOR: {
-					cuda_materials[i].conductor.eta              = material.eta;
-					cuda_materials[i].conductor.linear_roughness = material.linear_roughness;
-					cuda_materials[i].conductor.k                = material.k;
-					break;
-				}
-				default: ASSERT_UNREACHABLE();
-			}
+			cuda_material_types[i] = materials[i].type;
+			cuda_materials     [i] = material_to_cuda(materials[i]);
 		}
 
 		CUDAMemory::memcpy_async(ptr_material_types, cuda_material_types.data(), materials.size(), memory_stream);
 		CUDAMemory::memcpy_async(ptr_materials,      cuda_materials     .data(), materials.size(), memory_stream);
 
+		update_stats.time_material_upload     = Profiler::get_time() - time_start;
+		update_stats.materials_uploaded       = int(materials.size());
+		update_stats.bytes_uploaded_materials = materials.size() * (sizeof(Material::Type) + sizeof(CUDAMaterial));
+
 		bool had_diffuse    = scene.has_diffuse;
 		bool had_plastic    = scene.has_plastic;
 		bool had_dielectric = scene.has_dielectric;
@@ -602,6 +1973,10 @@ void Pathtracer::update(float delta, Allocator * frame_allocator) {
 			(had_conductor  ^ scene.has_conductor);
 
 		if (material_types_changed) {
+			invalidated_graph = true;
+
+			CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::WAVEFRONT);
+
 			int num_different_materials =
 				int(scene.has_diffuse) +
 				int(scene.has_plastic) +
@@ -618,7 +1993,7 @@ void Pathtracer::update(float delta, Allocator * frame_allocator) {
 			} else if (num_material_buffers_needed > material_ray_buffers.size()) {
 				// Allocate new required MaterialBuffers
 				for (int i = material_ray_buffers.size(); i < num_material_buffers_needed; i++) {
-					material_ray_buffers.emplace_back().init(BATCH_SIZE);
+					material_ray_buffers.emplace_back().init(batch_size);
 				}
 			}
 
@@ -649,40 +2024,83 @@ void Pathtracer::update(float delta, Allocator * frame_allocator) {
 		// Handle (dis)appearance of Light materials
 		bool lights_changed = had_lights ^ scene.has_lights;
 		if (lights_changed) {
-			if (scene.has_lights) {
-				ray_buffer_shadow.init(BATCH_SIZE);
+			invalidated_graph = true;
 
+			if (scene.has_lights) {
 				invalidated_scene = true;
 			} else {
-				ray_buffer_shadow.free();
-
-				CUDAMemory::free(ptr_light_mesh_cumulative_probability);
+				CUDAMemory::free(ptr_light_mesh_alias_table);
 				CUDAMemory::free(ptr_light_mesh_triangle_span);
 				CUDAMemory::free(ptr_light_mesh_transform_indices);
 
+				CUDAMemory::free(ptr_light_bvh_nodes);
+				CUDAMemory::free(ptr_light_bvh_node_parents);
+				CUDAMemory::free(ptr_light_bvh_primitives);
+				CUDAMemory::free(ptr_light_bvh_primitive_leaves);
+				CUDAMemory::free(ptr_light_bvh_mesh_offsets);
+				CUDAMemory::free(ptr_light_bvh_triangle_local_indices);
+
 				global_lights_total_weight.set_value_async(0.0f, memory_stream);
 
 				for (int i = 0; i < scene.meshes.size(); i++) {
 					scene.meshes[i].light.weight = 0.0f;
 				}
 			}
-
-			global_ray_buffer_shadow.set_value_async(ray_buffer_shadow, memory_stream);
 		}
 
 		if (had_lights) {
 			CUDAMemory::free(ptr_light_triangle_indices);
-			CUDAMemory::free(ptr_light_triangle_cumulative_probability);
-		}
-		if (scene.has_lights) {
+			CUDAMemory::free(ptr_light_triangle_cdf);
+		}
+		if (scene.has_lights) {
+			calc_light_power(frame_allocator);
+		}
+
+		// The cached radiance depends on the Materials
+		if (gpu_config.enable_radiance_cache) {
+			radiance_cache_reset();
+		}
+
+		sample_index = 0;
+		invalidated_materials = false;
+	} else if (invalidated_material_handles.size() > 0) {
+		ProfileScope scope("Material Upload"_sv);
+
+		uint64_t time_start = Profiler::get_time();
+
+		// Only the parameters of these Materials changed, so the types and MaterialBuffers are still valid
+		Array<CUDAMaterial> cuda_materials(invalidated_material_handles.size(), frame_allocator);
+		bool has_light_changed = false;
+
+		for_each_handle_run(invalidated_material_handles, [&](size_t offset, int count) {
+			for (int i = 0; i < count; i++) {
+				const Material & material = scene.asset_manager.get_material(Handle<Material> { invalidated_material_handles[offset + i] });
+
+				cuda_materials[offset + i] = material_to_cuda(material);
+				has_light_changed |= material.is_light();
+			}
+			CUDAMemory::memcpy_async(ptr_materials + invalidated_material_handles[offset], cuda_materials.data() + offset, count, memory_stream);
+		});
+
+		update_stats.time_material_upload     = Profiler::get_time() - time_start;
+		update_stats.materials_uploaded       = int(invalidated_material_handles.size());
+		update_stats.bytes_uploaded_materials = invalidated_material_handles.size() * sizeof(CUDAMaterial);
+
+		// The power of the lights only depends on the emissive Materials
+		if (has_light_changed && scene.has_lights) {
+			CUDAMemory::free(ptr_light_triangle_indices);
+			CUDAMemory::free(ptr_light_triangle_cdf);
+
 			calc_light_power(frame_allocator);
 		}
 
 		sample_index = 0;
-		invalidated_materials = false;
 	}
+	invalidated_material_handles.clear();
 
 	if (invalidated_mediums) {
+		ProfileScope scope("Medium Upload"_sv);
+
 		size_t medium_count = scene.asset_manager.media.size();
 		if (medium_count > 0) {
 			Array<CUDAMedium> cuda_mediums(medium_count, frame_allocator);
@@ -698,13 +2116,27 @@ void Pathtracer::update(float delta, Allocator * frame_allocator) {
 
 		sample_index = 0;
 		invalidated_mediums = false;
-	}
+	} else if (invalidated_medium_handles.size() > 0) {
+		ProfileScope scope("Medium Upload"_sv);
 
-	// Save this here, TLAS will be updated in Integrator::update if invalidated_scene == true,
-	// calc_light_mesh_weights() will need to be called AFTER the TLAS has been updated.
-	bool invalidated_light_mesh_weights = invalidated_scene;
+		Array<CUDAMedium> cuda_mediums(invalidated_medium_handles.size(), frame_allocator);
 
-	if (gpu_config.enable_svgf) {
+		for_each_handle_run(invalidated_medium_handles, [&](size_t offset, int count) {
+			for (int i = 0; i < count; i++) {
+				const Medium & medium = scene.asset_manager.get_medium(Handle<Medium> { invalidated_medium_handles[offset + i] });
+
+				medium.to_sigmas(cuda_mediums[offset + i].sigma_a, cuda_mediums[offset + i].sigma_s);
+				cuda_mediums[offset + i].g = medium.g;
+			}
+			CUDAMemory::memcpy_async(ptr_media + invalidated_medium_handles[offset], cuda_mediums.data() + offset, count, memory_stream);
+		});
+
+		sample_index = 0;
+	}
+	invalidated_medium_handles.clear();
+
+	// The GBuffers store the screen position of the primary hits in the previous frame
+	if (gpu_config.enable_svgf || gpu_config.enable_reprojection) {
 		struct SVGFData {
 			alignas(16) Matrix4 view_projection;
 			alignas(16) Matrix4 view_projection_prev;
@@ -722,10 +2154,46 @@ void Pathtracer::update(float delta, Allocator * frame_allocator) {
 		}
 	}
 
+	if (use_optix && invalidated_gpu_config && !optix_supported()) {
+		IO::print("WARNING: OptiX traversal does not support motion blur, switching to software traversal!\n"_sv);
+		optix_free();
+		cpu_config.traversal_backend = TraversalBackend::SOFTWARE;
+	}
+
+	// Depth of Field, motion blur or Curves may have been enabled since the visibility was last rasterised
+	if (gpu_config.enable_raster_primary && (invalidated_gpu_config || invalidated_camera || invalidated_scene) && !raster_primary_supported()) {
+		IO::print("WARNING: Rasterised primary visibility requires a window and a pinhole Camera without motion blur, Curves or alpha masks, disabling it!\n"_sv);
+		gpu_config.enable_raster_primary = false;
+		raster_primary_free();
+		invalidated_gpu_config = true;
+	}
+
 	Integrator::update(delta, frame_allocator);
 
-	if (invalidated_light_mesh_weights) {
+	update_frame_budget();
+
+	// The light Mesh weights are stored in TLAS order, so they need to be recalculated whenever a new TLAS is used.
+	// This happens either in Integrator::update or, when the TLAS is built asynchronously, at the end of the previous frame
+	if (tlas_updated) {
+		tlas_updated = false;
+
 		calc_light_mesh_weights();
+		calc_ray_sort_bounds();
+
+		if (use_optix) {
+			optix_build_ias();
+		}
+
+		if (gpu_config.enable_path_guiding) {
+			path_guiding_reset();
+		}
+		if (gpu_config.enable_radiance_cache) {
+			radiance_cache_reset();
+		}
+
+		if (gpu_config.enable_light_bvh) {
+			calc_light_bvh();
+		}
 
 		// If SVGF is enabled we can handle Scene updates using reprojection,
 		// otherwise 'frames_accumulated' needs to be reset in order to avoid ghosting
@@ -735,70 +2203,405 @@ void Pathtracer::update(float delta, Allocator * frame_allocator) {
 	}
 }
 
+// While the Camera is moving the number of bounces is lowered or raised by one per frame to keep the GPU frame time within cpu_config.frame_time_budget
+// Once the Camera stops the full number of bounces is used again, so that the image converges to the correct result
+void Pathtracer::update_frame_budget() {
+	// The Events of the previous frame are still in the pool, the first and last Event span the entire frame
+	if (event_pool.num_used >= 2) {
+		const CUDAEvent & event_first = event_pool.pool[0];
+		const CUDAEvent & event_last  = event_pool.pool[event_pool.num_used - 1];
+
+		if (cuEventQuery(event_last.event) == CUDA_SUCCESS) {
+			frame_time_gpu = CUDAEvent::time_elapsed_between(event_first, event_last);
+		}
+	}
+
+	bool budget_was_active = budget_active;
+	budget_active = cpu_config.frame_time_budget > 0.0f && scene.camera.moved;
+
+	if (budget_active) {
+		if (!budget_was_active) {
+			budget_num_bounces = Math::clamp(budget_num_bounces, 1, gpu_config.num_bounces);
+		}
+
+		if (frame_time_gpu > cpu_config.frame_time_budget) {
+			budget_num_bounces = Math::max(budget_num_bounces - 1, 1);
+		} else if (frame_time_gpu < 0.75f * cpu_config.frame_time_budget) { // Hysteresis, avoids oscillating around the budget
+			budget_num_bounces = Math::min(budget_num_bounces + 1, gpu_config.num_bounces);
+		}
+	} else if (budget_was_active && budget_num_bounces < gpu_config.num_bounces) {
+		// Samples taken with fewer bounces should not be accumulated with the full ones
+		sample_index = 0;
+	}
+}
+
+bool Pathtracer::calc_ray_stats(RayStats & stats) const {
+	if (!buffer_sizes_prev_valid || event_pool.num_used < 2) return false;
+
+	stats = { };
+	stats.num_bounces = get_num_bounces();
+
+	// Only the BufferSizes of the first batch are read back, scale them up to the whole frame
+	double batch_scale = double(pixel_count) / double(Math::min(batch_size, pixel_count));
+
+	for (int bounce = 0; bounce < stats.num_bounces; bounce++) {
+		stats.rays_trace [bounce] = batch_scale * double(buffer_sizes_prev.trace [bounce]);
+		stats.rays_shadow[bounce] = batch_scale * double(buffer_sizes_prev.shadow[bounce]);
+	}
+
+	// Every batch records the same Events, sum the time between an Event and the next
+	bool has_timings = false;
+
+	for (size_t i = 0; i < event_pool.num_used - 1; i++) {
+		const CUDAEvent::Desc * desc = event_pool.pool[i].desc;
+
+		for (int bounce = 0; bounce < stats.num_bounces; bounce++) {
+			if (desc == &event_desc_trace[bounce]) {
+				stats.time_trace[bounce] += CUDAEvent::time_elapsed_between(event_pool.pool[i], event_pool.pool[i + 1]);
+				has_timings = true;
+			} else if (desc == &event_desc_shadow_trace[bounce]) {
+				stats.time_shadow[bounce] += CUDAEvent::time_elapsed_between(event_pool.pool[i], event_pool.pool[i + 1]);
+			}
+		}
+	}
+
+	return has_timings;
+}
+
+int Pathtracer::get_num_bounces() const {
+	return budget_active ? Math::min(budget_num_bounces, gpu_config.num_bounces) : gpu_config.num_bounces;
+}
+
+float Pathtracer::calc_convergence_error() {
+	if (ptr_convergence_moments.ptr == NULL) return INFINITY;
+
+	// The moments are written by kernel_accumulate, which runs on the render stream
+	CUDACALL(cuCtxSynchronize());
+
+	CUDAMemory::memset_async(ptr_convergence_error, 0, 1, memory_stream);
+	kernel_convergence_error.execute_on_stream(memory_stream);
+	CUDAMemory::memcpy_async(pinned_convergence_error, ptr_convergence_error, 1, memory_stream);
+
+	CUDACALL(cuStreamSynchronize(memory_stream));
+
+	if (pinned_convergence_error->y == 0.0f) return INFINITY;
+
+	return sqrtf(pinned_convergence_error->x / pinned_convergence_error->y);
+}
+
 void Pathtracer::render() {
-	event_pool.reset();
+	ProfileScope scope("Render"_sv);
+
+	begin_frame_events();
+
+	bool raster_primary = gpu_config.enable_raster_primary && resource_visibility_buffer;
+	if (raster_primary) {
+		raster_primary_render();
+	}
 
 	CUDACALL(cuStreamSynchronize(memory_stream));
 
-	int pixels_left = pixel_count;
-	int batch_size  = Math::min(BATCH_SIZE, pixel_count);
+	poll_buffer_sizes_readback();
 
-	// Render in batches of BATCH_SIZE pixels at a time
-	while (pixels_left > 0) {
-		int pixel_offset = pixel_count - pixels_left;
-		int pixel_count  = Math::min(batch_size, pixels_left);
+	CUstream stream = cpu_config.enable_cuda_graph ? stream_graph : nullptr;
 
-		event_pool.record(&event_desc_primary);
+	// Mapping orders the Kernels of this frame after the draw, unmapping orders the next draw after the Kernels
+	if (raster_primary) {
+		CUDACALL(cuGraphicsMapResources(1, &resource_visibility_buffer, stream));
+	}
+
+	if (cpu_config.enable_cuda_graph) {
+		render_graph();
+		CUDACALL(cuEventRecord(event_buffer_sizes_readback, stream_graph));
+	} else {
+		render_launches(nullptr, true);
+		CUDACALL(cuEventRecord(event_buffer_sizes_readback, nullptr));
+	}
+
+	if (raster_primary) {
+		CUDACALL(cuGraphicsUnmapResources(1, &resource_visibility_buffer, stream));
+	}
+
+	// The megakernel does not fill the BufferSizes, a wavefront frame after it should not size its Grids based on them
+	if (use_megakernel()) {
+		buffer_sizes_readback_pending = false;
+		buffer_sizes_prev_valid       = false;
+	} else {
+		buffer_sizes_readback_pending = true;
+	}
+
+	aovs_clear_to_zero();
+
+	sync_tlas();
+}
+
+void Pathtracer::render_launches(CUstream stream, bool record_events) {
+	// Every Event also opens an NVTX range that lasts until the next one, Nsight Systems projects these onto the GPU work they launched
+	bool range_open = false;
+
+	// Events cannot be timed when they are part of a CUDA Graph
+	auto record_event = [this, stream, record_events, &range_open](const CUDAEvent::Desc * event_desc) {
+		if (record_events) {
+			event_pool.record(event_desc, stream);
+		}
 
-		// Generate primary Rays from the current Camera orientation
-		kernel_generate.execute(sample_index, pixel_offset, pixel_count);
+		if (range_open) {
+			Profiler::range_pop();
+		}
+		range_open = event_desc != &event_desc_end;
+		if (range_open) {
+			Profiler::range_push(event_desc->name.view(), event_desc->category.view());
+		}
+	};
+
+	int batch_size = Math::min(this->batch_size, pixel_count);
+
+	bool megakernel      = use_megakernel();
+	bool megakernel_tail = cpu_config.megakernel_tail_threshold > 0 && megakernel_supported();
+
+	int samples_per_launch = get_samples_per_launch();
+
+	// Every sample of the launch passes over all batches, without returning to the host in between
+	for (int sample = 0; sample < samples_per_launch; sample++) {
+		int rng_sample_index = get_rng_sample_index() + sample;
+
+		int pixels_left = pixel_count;
 
-		for (int bounce = 0; bounce < gpu_config.num_bounces; bounce++) {
-			// Extend all Rays that are still alive to their next Triangle intersection
-			event_pool.record(&event_desc_trace[bounce]);
-			kernel_trace->execute(bounce);
+		// Render in batches of at most Pathtracer::batch_size pixels at a time
+		while (pixels_left > 0) {
+			int pixel_offset = pixel_count - pixels_left;
+			int pixel_count  = Math::min(batch_size, pixels_left);
 
-			event_pool.record(&event_desc_sort[bounce]);
-			kernel_sort.execute(bounce, sample_index);
+			// NOTE: Rays emitted by the last bounce are simply not traced if the frame time budget lowered the number of bounces
+			int num_bounces = get_num_bounces();
 
-			// Process the various Material types in different Kernels
-			if (scene.has_diffuse) {
-				event_pool.record(&event_desc_material_diffuse[bounce]);
-				kernel_material_diffuse.execute(bounce, sample_index);
+			if (megakernel) {
+				record_event(&event_desc_megakernel);
+				kernel_megakernel.execute_on_stream(stream, rng_sample_index, pixel_offset, pixel_count, num_bounces);
+
+				pixels_left -= batch_size;
+				continue;
+			}
+
+			record_event(&event_desc_primary);
+
+			// Generate primary Rays from the current Camera orientation, or from the texels of the atlas
+			if (ptr_bake_texels.ptr) {
+				kernel_bake_generate.execute_on_stream(stream, rng_sample_index, pixel_offset, pixel_count);
+			} else {
+				kernel_generate.execute_on_stream(stream, rng_sample_index, pixel_offset, pixel_count);
 			}
-			if (scene.has_plastic) {
-				event_pool.record(&event_desc_material_plastic[bounce]);
-				kernel_material_plastic.execute(bounce, sample_index);
+
+			bool shadow_join_pending = false; // Set while the shadow Rays of the previous bounce are still traced on stream_shadow
+
+			for (int bounce = 0; bounce < num_bounces; bounce++) {
+				// The megakernel takes over once only a few paths are left, the ray count is only known on the GPU,
+				// if the megakernel finished the paths it clears the trace queue and the Kernels below have nothing to do
+				// NOTE: The Rays traced by the megakernel are not part of the BufferSizes and are missing from the ray stats
+				if (megakernel_tail && bounce > 0) {
+					record_event(&event_desc_megakernel_tail[bounce]);
+					kernel_megakernel_tail.execute_on_stream(stream, bounce, rng_sample_index, num_bounces, cpu_config.megakernel_tail_threshold);
+				}
+
+				// Extend all Rays that are still alive to their next Triangle intersection
+				// Sort secondary Rays for coherence, Primary Rays are coherent already
+				// Sorting is skipped when the Rays would fit in a single wave of the trace Kernel,
+				// in that case there is not enough work to amortize the cost of the sort
+				CUdeviceptr ray_order = 0;
+
+				int trace_threads_resident = kernel_trace->grid_dim_y * kernel_trace->block_dim_x * kernel_trace->block_dim_y;
+
+				// OptiX schedules incoherent Rays itself, sorting them would only add overhead
+				// The treelet queues reorder the Rays by BLAS themselves
+				bool use_treelet_queues = cpu_config.enable_treelet_queues && ptr_treelet_entries.ptr && !use_optix;
+
+				if (cpu_config.enable_ray_sorting && !use_optix && !use_treelet_queues && bounce > 0 && (!buffer_sizes_prev_valid || buffer_sizes_prev.trace[bounce] > trace_threads_resident)) {
+					record_event(&event_desc_ray_sort[bounce]);
+
+					queue_kernel_execute(kernel_ray_sort_count, buffer_sizes_prev.trace[bounce], stream, bounce);
+					kernel_ray_sort_scan.execute_on_stream(stream);
+					queue_kernel_execute(kernel_ray_sort_scatter, buffer_sizes_prev.trace[bounce], stream, bounce);
+
+					// Clear the counts for the next bounce
+					CUDAMemory::memset_async(ptr_ray_sort_offsets, 0, RAY_SORT_KEY_COUNT, stream);
+
+					ray_order = ptr_ray_sort_index.ptr;
+				}
+
+				// With rasterised primary visibility kernel_generate already wrote the hits of bounce 0
+				if (bounce > 0 || !gpu_config.enable_raster_primary) {
+					record_event(&event_desc_trace[bounce]);
+					if (use_optix) {
+						optix_traversal.trace(bounce, optix_launch_width(buffer_sizes_prev.trace[bounce]), stream);
+					} else if (use_treelet_queues) {
+						// The number of entries is only known on the GPU, the Kernels over the entries loop over their queue
+						CUDAMemory::memset_async(ptr_treelet_offsets,           0, scene.meshes.size(), stream);
+						CUDAMemory::memset_async(ptr_treelet_entry_count_total, 0, 1,                   stream);
+
+						queue_kernel_execute(kernel_treelet_tlas_bvh8, buffer_sizes_prev.trace[bounce], stream, bounce);
+						kernel_treelet_scan.execute_on_stream(stream);
+						queue_kernel_execute(kernel_treelet_scatter, buffer_sizes_prev.trace[bounce], stream);
+
+						record_event(&event_desc_treelet_blas[bounce]);
+						queue_kernel_execute(kernel_treelet_blas_bvh8, buffer_sizes_prev.trace[bounce], stream, bounce);
+						queue_kernel_execute(kernel_treelet_resolve,   buffer_sizes_prev.trace[bounce], stream, bounce);
+					} else {
+						queue_kernel_execute(*kernel_trace, buffer_sizes_prev.trace[bounce], stream, bounce, ray_order);
+					}
+				}
+
+				// The shadow Rays of the previous bounce have to be done before the Kernels below add to the framebuffer
+				// or the Material Kernels append the shadow Rays of this bounce to the same ShadowRayBuffer
+				if (shadow_join_pending) {
+					CUDACALL(cuStreamWaitEvent(stream, event_shadow_join, 0));
+					shadow_join_pending = false;
+				}
+
+				record_event(&event_desc_sort[bounce]);
+				queue_kernel_execute(kernel_sort, buffer_sizes_prev.trace[bounce], stream, bounce, rng_sample_index);
+
+				if (scene.asset_manager.media.size() > 0) {
+					record_event(&event_desc_medium[bounce]);
+					queue_kernel_execute(kernel_medium, buffer_sizes_prev.medium[bounce], stream, bounce, rng_sample_index);
+				}
+
+				record_event(&event_desc_miss[bounce]);
+				queue_kernel_execute(kernel_miss, buffer_sizes_prev.miss[bounce], stream, bounce);
+
+				if (scene.has_lights) {
+					record_event(&event_desc_light_hit[bounce]);
+					queue_kernel_execute(kernel_light_hit, buffer_sizes_prev.light_hit[bounce], stream, bounce, rng_sample_index);
+				}
+
+				// Reorder the Material queues by material_id
+				if (gpu_config.enable_material_sorting) {
+					record_event(&event_desc_material_sort[bounce]);
+
+					int material_count = scene.asset_manager.materials.size();
+					int material_rays_prev =
+						buffer_sizes_prev.diffuse   [bounce] +
+						buffer_sizes_prev.plastic   [bounce] +
+						buffer_sizes_prev.dielectric[bounce] +
+						buffer_sizes_prev.conductor [bounce];
+
+					kernel_material_sort_scan.execute_on_stream(stream, material_count);
+					queue_kernel_execute(kernel_material_sort_scatter, material_rays_prev, stream, bounce);
+
+					// Clear the counts for the next bounce
+					CUDAMemory::memset_async(ptr_material_sort_offsets, 0, material_count, stream);
+				}
+
+				// Process the various Material types in different Kernels
+				struct MaterialLaunch {
+					bool                    enabled;
+					CUDAKernel            * kernel;
+					int                     queue_size_prev;
+					const CUDAEvent::Desc * event_desc;
+				} material_launches[MATERIAL_STREAM_COUNT] = {
+					{ scene.has_diffuse,    &kernel_material_diffuse,    buffer_sizes_prev.diffuse   [bounce], &event_desc_material_diffuse   [bounce] },
+					{ scene.has_plastic,    &kernel_material_plastic,    buffer_sizes_prev.plastic   [bounce], &event_desc_material_plastic   [bounce] },
+					{ scene.has_dielectric, &kernel_material_dielectric, buffer_sizes_prev.dielectric[bounce], &event_desc_material_dielectric[bounce] },
+					{ scene.has_conductor,  &kernel_material_conductor,  buffer_sizes_prev.conductor [bounce], &event_desc_material_conductor [bounce] }
+				};
+
+				int material_launch_count = 0;
+				for (int m = 0; m < MATERIAL_STREAM_COUNT; m++) {
+					if (material_launches[m].enabled) material_launch_count++;
+				}
+
+				// The Kernels only share the atomics of the next trace and shadow queues, so they can overlap
+				// Concurrent Kernels cannot be timed individually, their combined time is recorded as a single Event
+				bool concurrent_materials = cpu_config.enable_concurrent_materials && material_launch_count > 1;
+				if (concurrent_materials) {
+					record_event(&event_desc_materials[bounce]);
+					CUDACALL(cuEventRecord(event_material_fork, stream));
+				}
+
+				for (int m = 0; m < MATERIAL_STREAM_COUNT; m++) {
+					const MaterialLaunch & launch = material_launches[m];
+					if (!launch.enabled) continue;
+
+					if (concurrent_materials) {
+						CUDACALL(cuStreamWaitEvent(stream_material[m], event_material_fork, 0));
+						queue_kernel_execute(*launch.kernel, launch.queue_size_prev, stream_material[m], bounce, rng_sample_index);
+						CUDACALL(cuEventRecord(event_material_join[m], stream_material[m]));
+
+						CUDACALL(cuStreamWaitEvent(stream, event_material_join[m], 0));
+					} else {
+						record_event(launch.event_desc);
+						queue_kernel_execute(*launch.kernel, launch.queue_size_prev, stream, bounce, rng_sample_index);
+					}
+				}
+
+				// Trace shadow Rays
+				if ((scene.has_lights || gpu_config.enable_sky_sampling) && gpu_config.enable_next_event_estimation) {
+					// The shadow Rays can overlap with the extension Rays of the next bounce, which only write hits and not the framebuffer
+					// The megakernel tail and the traversal heatmap would add to the same Pixels as the shadow Rays, so they prevent the overlap
+					bool overlap_shadow = cpu_config.enable_shadow_overlap && bounce + 1 < num_bounces && !megakernel_tail && !aov_is_enabled(AOVType::TRAVERSAL_COST);
+
+					CUstream stream_shadow_trace = stream;
+					if (overlap_shadow) {
+						CUDACALL(cuEventRecord(event_shadow_fork, stream));
+						CUDACALL(cuStreamWaitEvent(stream_shadow, event_shadow_fork, 0));
+
+						stream_shadow_trace = stream_shadow;
+					}
+
+					record_event(&event_desc_shadow_trace[bounce]);
+					if (use_optix) {
+						optix_traversal.trace_shadow(bounce, optix_launch_width(buffer_sizes_prev.shadow[bounce]), stream_shadow_trace);
+						queue_kernel_execute(kernel_shadow_resolve, buffer_sizes_prev.shadow[bounce], stream_shadow_trace, bounce, optix_traversal.ptr_shadow_occluded.ptr);
+					} else {
+						queue_kernel_execute(*kernel_trace_shadow, buffer_sizes_prev.shadow[bounce], stream_shadow_trace, bounce);
+					}
+
+					if (overlap_shadow) {
+						CUDACALL(cuEventRecord(event_shadow_join, stream_shadow));
+						shadow_join_pending = true;
+					}
+				}
 			}
-			if (scene.has_dielectric) {
-				event_pool.record(&event_desc_material_dielectric[bounce]);
-				kernel_material_dielectric.execute(bounce, sample_index);
+
+			if (shadow_join_pending) {
+				CUDACALL(cuStreamWaitEvent(stream, event_shadow_join, 0));
+				shadow_join_pending = false;
 			}
-			if (scene.has_conductor) {
-				event_pool.record(&event_desc_material_conductor[bounce]);
-				kernel_material_conductor.execute(bounce, sample_index);
+
+			// Read back the BufferSizes of the first (full size) batch, they are used to size the Grids of the next frame
+			if (pixel_offset == 0 && sample == 0) {
+				CUDAMemory::memcpy_async(pinned_buffer_sizes, CUDAMemory::Ptr<BufferSizes>(global_buffer_sizes.ptr), 1, stream);
 			}
 
-			// Trace shadow Rays
-			if (scene.has_lights && gpu_config.enable_next_event_estimation) {
-				event_pool.record(&event_desc_shadow_trace[bounce]);
-				kernel_trace_shadow->execute(bounce);
+			pixels_left -= batch_size;
+
+			if (pixels_left > 0) {
+				// Set buffer sizes to appropriate pixel count for next Batch
+				reset_buffer_sizes<BufferSizes>(Math::min(batch_size, pixels_left), stream);
 			}
 		}
 
-		pixels_left -= batch_size;
-
-		if (pixels_left > 0) {
-			// Set buffer sizes to appropriate pixel count for next Batch
-			pinned_buffer_sizes->reset(Math::min(batch_size, pixels_left));
-			global_buffer_sizes.set_value(*pinned_buffer_sizes);
+		// The next sample starts over at the first batch
+		if (sample + 1 < samples_per_launch) {
+			reset_buffer_sizes<BufferSizes>(batch_size, stream);
 		}
 	}
 
+	// The grid learns from every frame, including while the Camera is static
+	if (gpu_config.enable_path_guiding) {
+		record_event(&event_desc_guiding);
+		kernel_guiding_train .execute_on_stream(stream);
+		kernel_guiding_update.execute_on_stream(stream);
+	}
+	if (gpu_config.enable_radiance_cache) {
+		record_event(&event_desc_radiance_cache);
+		kernel_radiance_cache_train .execute_on_stream(stream);
+		kernel_radiance_cache_update.execute_on_stream(stream);
+	}
+
 	if (gpu_config.enable_svgf) {
 		// Temporal reprojection + integration
-		event_pool.record(&event_desc_svgf_reproject);
-		kernel_svgf_reproject.execute(sample_index);
+		record_event(&event_desc_svgf_reproject);
+		kernel_svgf_reproject.execute_on_stream(stream, sample_index);
 
 		CUdeviceptr direct_in    = get_aov(AOVType::RADIANCE_DIRECT)  .framebuffer.ptr;
 		CUdeviceptr indirect_in  = get_aov(AOVType::RADIANCE_INDIRECT).framebuffer.ptr;
@@ -807,67 +2610,330 @@ void Pathtracer::render() {
 
 		if (gpu_config.enable_spatial_variance) {
 			// Estimate Variance spatially
-			event_pool.record(&event_desc_svgf_variance);
-			kernel_svgf_variance.execute(direct_in, indirect_in, direct_out, indirect_out);
+			record_event(&event_desc_svgf_variance);
+			kernel_svgf_variance.execute_on_stream(stream, direct_in, indirect_in, direct_out, indirect_out);
 
 			Util::swap(direct_in,   direct_out);
 			Util::swap(indirect_in, indirect_out);
 		}
 
+		// Tiles that have converged skip the A-Trous Filter
+		if (gpu_config.enable_svgf_tile_skip) {
+			record_event(&event_desc_svgf_classify);
+			CUDAMemory::memset_async(ptr_svgf_tile_count, 0, 1, stream);
+			kernel_svgf_classify.execute_on_stream(stream, direct_in, indirect_in, direct_out, indirect_out);
+		}
+
 		// -Trous Filter
 		for (int i = 0; i < gpu_config.num_atrous_iterations; i++) {
 			int step_size = 1 << i;
 
-			event_pool.record(&event_desc_svgf_atrous[i]);
-			kernel_svgf_atrous.execute(direct_in, indirect_in, direct_out, indirect_out, step_size);
+			record_event(&event_desc_svgf_atrous[i]);
+			if (step_size <= SVGF_TILE_MAX_STEP_SIZE) {
+				kernel_svgf_atrous_tiled.execute_on_stream(stream, direct_in, indirect_in, direct_out, indirect_out, step_size);
+			} else {
+				kernel_svgf_atrous.execute_on_stream(stream, direct_in, indirect_in, direct_out, indirect_out, step_size);
+			}
 
 			// Ping-Pong the Frame Buffers
 			Util::swap(direct_in,   direct_out);
 			Util::swap(indirect_in, indirect_out);
 		}
 
-		event_pool.record(&event_desc_svgf_finalize);
-		kernel_svgf_finalize.execute(direct_in, indirect_in);
+		if (gpu_config.enable_taa && cpu_config.enable_fused_taa && !is_upscaling()) {
+			record_event(&event_desc_taa);
 
-		if (gpu_config.enable_taa) {
-			event_pool.record(&event_desc_taa);
+			// The resolve reads the TAA history of the previous frame and writes that of the next one, they swap every frame
+			kernel_svgf_taa_resolve.execute_on_stream(stream, direct_in, indirect_in, ptr_taa_frame_prev.ptr, ptr_taa_frame_curr.ptr, sample_index);
+			Util::swap(ptr_taa_frame_prev, ptr_taa_frame_curr);
+		} else {
+			record_event(&event_desc_svgf_finalize);
+			kernel_svgf_finalize.execute_on_stream(stream, direct_in, indirect_in);
+
+			if (gpu_config.enable_taa && is_upscaling()) {
+				record_event(&event_desc_upscale);
 
-			kernel_taa         .execute(sample_index);
-			kernel_taa_finalize.execute();
+				kernel_taa_upscale         .execute_on_stream(stream, sample_index);
+				kernel_taa_upscale_finalize.execute_on_stream(stream);
+			} else if (gpu_config.enable_taa) {
+				record_event(&event_desc_taa);
+
+				kernel_taa         .execute_on_stream(stream, sample_index);
+				kernel_taa_finalize.execute_on_stream(stream);
+			}
 		}
 	} else {
-		event_pool.record(&event_desc_accumulate);
-		kernel_accumulate.execute(float(sample_index));
+		// kernel_accumulate rebuilds the list of Pixels that have not converged yet
+		if (use_pixel_list()) {
+			CUDAMemory::memset_async(ptr_adaptive_pixel_count, 0, 1, stream);
+		}
+
+		// When reprojecting, the accumulation restarts from the reprojected history instead of from nothing when the Camera moves
+		int frames_accumulated = sample_index;
+		int reprojected        = false;
+
+		if (is_reprojecting()) {
+			if (sample_index == 0) {
+				reprojection_sample_index_first = 0;
+			} else if (scene.camera.moved) {
+				reprojection_sample_index_first = sample_index;
+
+				kernel_reproject.execute_on_stream(stream);
+				reprojected = true;
+			}
+			frames_accumulated = sample_index - reprojection_sample_index_first;
+		}
+
+		record_event(&event_desc_accumulate);
+		kernel_accumulate.execute_on_stream(stream, float(frames_accumulated), float(samples_per_launch), reprojected);
+
+		if (ptr_bake_texels.ptr) {
+			kernel_bake_dilate.execute_on_stream(stream);
+		}
+	}
+
+	// The temporal upscale already wrote the display
+	if (is_upscaling() && !(gpu_config.enable_svgf && gpu_config.enable_taa)) {
+		record_event(&event_desc_upscale);
+		kernel_upscale.execute_on_stream(stream);
 	}
 
-	event_pool.record(&event_desc_end);
+	record_event(&event_desc_end);
 
 	// Reset buffer sizes to default for next frame
-	pinned_buffer_sizes->reset(batch_size);
-	global_buffer_sizes.set_value(*pinned_buffer_sizes);
+	reset_buffer_sizes<BufferSizes>(batch_size, stream);
+}
 
-	aovs_clear_to_zero();
+void Pathtracer::render_graph() {
+	// Capture the launches of the current frame into a Graph
+	// This does not submit any work, it only records the Kernels and their parameters
+	CUDACALL(cuStreamBeginCapture(stream_graph, CU_STREAM_CAPTURE_MODE_THREAD_LOCAL));
+	render_launches(stream_graph, false);
+
+	CUgraph graph;
+	CUDACALL(cuStreamEndCapture(stream_graph, &graph));
+
+	// If the topology of the Graph did not change, only the Kernel parameters (e.g. sample_index)
+	// differ from the previous frame and the executable Graph can be updated in place
+	bool update_succeeded = false;
+
+	if (graph_exec && !invalidated_graph) {
+#if CUDA_VERSION >= 12000
+		CUgraphExecUpdateResultInfo update_result_info = { };
+		update_succeeded = cuGraphExecUpdate(graph_exec, graph, &update_result_info) == CUDA_SUCCESS;
+#else
+		CUgraphNode             update_error_node = { };
+		CUgraphExecUpdateResult update_result     = { };
+		update_succeeded = cuGraphExecUpdate(graph_exec, graph, &update_error_node, &update_result) == CUDA_SUCCESS;
+#endif
+	}
 
-	// If a pixel query was previously pending, it has just been resolved in the current frame
-	if (pixel_query_status == PixelQueryStatus::PENDING) {
-		pixel_query_status =  PixelQueryStatus::OUTPUT_READY;
+	// Otherwise create a new executable Graph
+	if (!update_succeeded) {
+		graph_free();
+		CUDACALL(cuGraphInstantiateWithFlags(&graph_exec, graph, 0));
 	}
+	invalidated_graph = false;
+
+	CUDACALL(cuGraphDestroy(graph));
+
+	event_pool.record(&event_desc_graph, stream_graph);
+	CUDACALL(cuGraphLaunch(graph_exec, stream_graph));
+	event_pool.record(&event_desc_end, stream_graph);
+}
+
+// Picks up the BufferSizes of the previous frame once their asynchronous copy has completed
+void Pathtracer::poll_buffer_sizes_readback() {
+	if (!buffer_sizes_readback_pending) return;
+
+	CUresult result = cuEventQuery(event_buffer_sizes_readback);
+	if (result == CUDA_ERROR_NOT_READY) return; // Keep using the older BufferSizes
+
+	CUDACALL(result);
+
+	buffer_sizes_prev = *pinned_buffer_sizes;
+	buffer_sizes_prev_valid       = true;
+	buffer_sizes_readback_pending = false;
 }
 
 void Pathtracer::render_gui() {
 	if (ImGui::CollapsingHeader("Integrator", ImGuiTreeNodeFlags_DefaultOpen)) {
 		invalidated_gpu_config |= ImGui::SliderInt("Num Bounces", &gpu_config.num_bounces, 0, MAX_BOUNCES);
 
+		ImGui::SliderFloat("Frame Budget (ms)", &cpu_config.frame_time_budget, 0.0f, 100.0f);
+		if (budget_active) {
+			ImGui::Text("Budget Bounces: %i", get_num_bounces());
+		}
+
 		invalidated_gpu_config |= ImGui::Checkbox("NEE", &gpu_config.enable_next_event_estimation);
 		invalidated_gpu_config |= ImGui::Checkbox("MIS", &gpu_config.enable_multiple_importance_sampling);
 
+		if (ImGui::Checkbox("Shadow Occluder Cache", &gpu_config.enable_shadow_occluder_cache)) {
+			if (gpu_config.enable_shadow_occluder_cache) {
+				shadow_occluder_cache_init();
+			} else {
+				shadow_occluder_cache_free();
+			}
+			invalidated_gpu_config = true;
+		}
+
+		if (ImGui::Checkbox("ReSTIR", &gpu_config.enable_restir)) {
+			if (gpu_config.enable_restir) {
+				restir_init();
+			} else {
+				restir_free();
+			}
+			invalidated_gpu_config = true;
+		}
+		if (gpu_config.enable_restir) {
+			invalidated_gpu_config |= ImGui::SliderInt  ("Candidates",     &gpu_config.restir_candidate_count, 1, 32);
+			invalidated_gpu_config |= ImGui::SliderInt  ("Spatial Taps",   &gpu_config.restir_spatial_count,   0, 8);
+			invalidated_gpu_config |= ImGui::SliderFloat("Spatial Radius", &gpu_config.restir_spatial_radius,  1.0f, 64.0f);
+			invalidated_gpu_config |= ImGui::SliderInt  ("Max History",    &gpu_config.restir_max_history,     1, 64);
+		}
+
+		if (ImGui::Checkbox("Path Guiding", &gpu_config.enable_path_guiding)) {
+			if (gpu_config.enable_path_guiding) {
+				path_guiding_init();
+			} else {
+				path_guiding_free();
+			}
+			invalidated_gpu_config = true;
+		}
+		if (gpu_config.enable_path_guiding) {
+			invalidated_gpu_config |= ImGui::SliderFloat("Guiding Probability", &gpu_config.guiding_probability, 0.0f, 0.95f);
+			if (ImGui::Button("Reset Guiding")) {
+				path_guiding_reset();
+				invalidated_gpu_config = true;
+			}
+		}
+
+		if (ImGui::Checkbox("Radiance Cache", &gpu_config.enable_radiance_cache)) {
+			if (gpu_config.enable_radiance_cache) {
+				radiance_cache_init();
+			} else {
+				radiance_cache_free();
+			}
+			invalidated_gpu_config = true;
+		}
+		if (gpu_config.enable_radiance_cache) {
+			invalidated_gpu_config |= ImGui::Checkbox("Adjoint Russian Roulette", &gpu_config.enable_adjoint_russian_roulette);
+
+			// Terminating later or into better converged cells trades performance for less bias
+			invalidated_gpu_config |= ImGui::SliderInt("Cache Min Bounce",  &gpu_config.radiance_cache_min_bounce,  1, MAX_BOUNCES - 1);
+			invalidated_gpu_config |= ImGui::SliderInt("Cache Min Samples", &gpu_config.radiance_cache_min_samples, 1, 256);
+			if (ImGui::Button("Reset Radiance Cache")) {
+				radiance_cache_reset();
+				invalidated_gpu_config = true;
+			}
+		}
+
+		// The Light BVH is only built while it is enabled, rebuilding the TLAS causes it to be built
+		if (ImGui::Checkbox("Light BVH", &gpu_config.enable_light_bvh)) {
+			invalidated_gpu_config = true;
+			invalidated_scene      = true;
+		}
+		invalidated_gpu_config |= ImGui::Checkbox("Sky Sampling", &gpu_config.enable_sky_sampling);
+
 		invalidated_gpu_config |= ImGui::Checkbox("Russian Roulete", &gpu_config.enable_russian_roulette);
+		invalidated_gpu_config |= ImGui::Checkbox("Material Sorting", &gpu_config.enable_material_sorting);
+		invalidated_gpu_config |= ImGui::Checkbox("Sobol Sampler",    &gpu_config.enable_sobol_sampler);
+
+		// Motion blur changes the Mesh bounds and root indices, rebuilding the TLAS updates them
+		if (ImGui::Checkbox("Motion Blur", &gpu_config.enable_motion_blur)) {
+			invalidated_gpu_config = true;
+			invalidated_scene      = true;
+		}
+
+		if (has_gl_context && ImGui::Checkbox("Rasterise Primary", &gpu_config.enable_raster_primary)) {
+			if (gpu_config.enable_raster_primary) {
+				if (raster_primary_supported()) raster_primary_init();
+			} else {
+				raster_primary_free();
+			}
+			invalidated_gpu_config = true;
+		}
+
+		invalidated_graph |= ImGui::Checkbox("CUDA Graph", &cpu_config.enable_cuda_graph);
+
+		ImGui::Checkbox("Ray Sorting", &cpu_config.enable_ray_sorting);
+
+		if (treelet_queues_supported() && ImGui::Checkbox("Treelet Queues", &cpu_config.enable_treelet_queues)) {
+			if (cpu_config.enable_treelet_queues) {
+				treelet_queues_init();
+			} else {
+				treelet_queues_free();
+			}
+		}
+
+		// Only the BVH8 trace Kernel picks levels of detail
+		if (gpu_scene->ptr_lod_chains.ptr != NULL && cpu_config.bvh_type == BVHType::BVH8) {
+			invalidated_gpu_config |= ImGui::Checkbox("Geometric LOD", &gpu_config.enable_geometric_lod);
+			if (gpu_config.enable_geometric_lod) {
+				invalidated_gpu_config |= ImGui::SliderFloat("LOD Bias", &gpu_config.geometric_lod_bias, 0.25f, 4.0f, "%.2f", ImGuiSliderFlags_Logarithmic);
+			}
+		}
+
+		if (ImGui::Checkbox("Persistent Queues", &cpu_config.enable_persistent_queues)) {
+			queue_kernels_set_grid_dim();
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Ray Throughput")) {
+		timings_requested = true;
+
+		RayStats stats;
+		if (calc_ray_stats(stats)) {
+			ImGui::Text("Primary:   %8.1f Mrays/s", RayStats::mrays_per_second(stats.get_rays_primary(),   stats.get_time_primary()));
+			ImGui::Text("Secondary: %8.1f Mrays/s", RayStats::mrays_per_second(stats.get_rays_secondary(), stats.get_time_secondary()));
+			ImGui::Text("Shadow:    %8.1f Mrays/s", RayStats::mrays_per_second(stats.get_rays_shadow(),    stats.get_time_shadow()));
+
+			ImGui::TextUnformatted("Bounce  Trace Mrays/s  Shadow Mrays/s");
+			for (int bounce = 0; bounce < stats.num_bounces; bounce++) {
+				ImGui::Text("%6i %14.1f %15.1f", bounce,
+					RayStats::mrays_per_second(stats.rays_trace [bounce], stats.time_trace [bounce]),
+					RayStats::mrays_per_second(stats.rays_shadow[bounce], stats.time_shadow[bounce])
+				);
+			}
+		} else {
+			ImGui::TextUnformatted("Not available (requires Kernel timings, disable CUDA Graph)");
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Queues")) {
+		if (buffer_sizes_prev_valid) {
+			ImGui::TextUnformatted("Bounce    Trace  Diffuse  Plastic Dielectr Conductr   Shadow");
+
+			for (int bounce = 0; bounce < gpu_config.num_bounces; bounce++) {
+				ImGui::Text("%6i %8i %8i %8i %8i %8i %8i", bounce,
+					buffer_sizes_prev.trace     [bounce],
+					buffer_sizes_prev.diffuse   [bounce],
+					buffer_sizes_prev.plastic   [bounce],
+					buffer_sizes_prev.dielectric[bounce],
+					buffer_sizes_prev.conductor [bounce],
+					buffer_sizes_prev.shadow    [bounce]
+				);
+			}
+		} else {
+			ImGui::TextUnformatted("Waiting for readback...");
+		}
 	}
 
 	if (ImGui::CollapsingHeader("Auxilary AOVs", ImGuiTreeNodeFlags_DefaultOpen)) {
 		invalidated_aovs |= aov_render_gui_checkbox(AOVType::ALBEDO,   "Albedo");
 		invalidated_aovs |= aov_render_gui_checkbox(AOVType::NORMAL,   "Normal");
 		invalidated_aovs |= aov_render_gui_checkbox(AOVType::POSITION, "Position");
+		invalidated_aovs |= aov_render_gui_checkbox(AOVType::RADIANCE_CACHE, "Radiance Cache");
+		invalidated_aovs |= aov_render_gui_checkbox(AOVType::TRAVERSAL_COST, "Traversal Cost"); // Recompiles the Module with traversal counters
+
+		if (aov_is_enabled(AOVType::TRAVERSAL_COST)) {
+			int traversal_heatmap = int(gpu_config.traversal_heatmap);
+			if (ImGui::Combo("Heatmap", &traversal_heatmap, "None\0Nodes\0Triangles\0Shadow\0")) {
+				gpu_config.traversal_heatmap = TraversalHeatmap(traversal_heatmap);
+				invalidated_gpu_config = true;
+			}
+			invalidated_gpu_config |= ImGui::SliderFloat("Heatmap Range", &gpu_config.traversal_heatmap_range, 1.0f, 1024.0f, "%.0f", ImGuiSliderFlags_Logarithmic);
+		}
 	}
 
 	if (ImGui::CollapsingHeader("SVGF")) {
@@ -882,10 +2948,66 @@ void Pathtracer::render_gui() {
 
 		invalidated_gpu_config |= ImGui::Checkbox("Spatial Variance", &gpu_config.enable_spatial_variance);
 		invalidated_gpu_config |= ImGui::Checkbox("TAA",              &gpu_config.enable_taa);
+		invalidated_gpu_config |= ImGui::Checkbox("Fused TAA",        &cpu_config.enable_fused_taa);
+
+		if (ImGui::Checkbox("Compact History", &gpu_config.enable_compact_history)) {
+			// The History Buffers change size, reallocate them
+			if (gpu_config.enable_svgf) {
+				svgf_free();
+				svgf_init();
+			}
+			invalidated_gpu_config = true;
+		}
 
 		invalidated_gpu_config |= ImGui::SliderInt("A Trous iterations", &gpu_config.num_atrous_iterations, 0, MAX_ATROUS_ITERATIONS);
 
 		invalidated_gpu_config |= ImGui::SliderFloat("Alpha colour", &gpu_config.alpha_colour, 0.0f, 1.0f);
 		invalidated_gpu_config |= ImGui::SliderFloat("Alpha moment", &gpu_config.alpha_moment, 0.0f, 1.0f);
+
+		invalidated_gpu_config |= ImGui::Checkbox   ("Skip Converged Tiles", &gpu_config.enable_svgf_tile_skip);
+		invalidated_gpu_config |= ImGui::SliderFloat("Skip Variance",        &gpu_config.svgf_skip_variance, 0.0f, 0.1f, "%.4f", ImGuiSliderFlags_Logarithmic);
+		invalidated_gpu_config |= ImGui::SliderInt  ("Skip History",         &gpu_config.svgf_skip_history,  4, 4096, "%d",   ImGuiSliderFlags_Logarithmic);
+	}
+
+	if (ImGui::CollapsingHeader("Reprojection")) {
+		if (ImGui::Checkbox("Enable##Reprojection", &gpu_config.enable_reprojection)) {
+			if (gpu_config.enable_reprojection) {
+				reprojection_init();
+			} else {
+				reprojection_free();
+			}
+			invalidated_gpu_config = true;
+		}
+
+		invalidated_gpu_config |= ImGui::SliderInt("Max Samples##Reprojection", &gpu_config.reprojection_max_samples, 1, 4096, "%d", ImGuiSliderFlags_Logarithmic);
+	}
+
+	if (ImGui::CollapsingHeader("Adaptive Sampling")) {
+		bool pixel_list = use_pixel_list();
+
+		if (ImGui::Checkbox("Enable##Adaptive", &gpu_config.enable_adaptive_sampling)) {
+			if (use_pixel_list() != pixel_list) {
+				if (pixel_list) adaptive_sampling_free(); else adaptive_sampling_init();
+			}
+			invalidated_gpu_config = true;
+		}
+
+		invalidated_gpu_config |= ImGui::SliderFloat("Threshold",   &gpu_config.adaptive_sampling_threshold,   0.001f, 0.1f);
+		invalidated_gpu_config |= ImGui::SliderInt  ("Min Samples", &gpu_config.adaptive_sampling_min_samples, 1, 256);
+	}
+
+	if (ImGui::CollapsingHeader("Variable Rate Sampling")) {
+		bool pixel_list = use_pixel_list();
+
+		if (ImGui::Checkbox("Enable##VariableRate", &gpu_config.enable_variable_rate)) {
+			if (use_pixel_list() != pixel_list) {
+				if (pixel_list) adaptive_sampling_free(); else adaptive_sampling_init();
+			}
+			invalidated_gpu_config = true;
+		}
+
+		invalidated_gpu_config |= ImGui::SliderFloat("Centre X", &gpu_config.variable_rate_centre_x, 0.0f, 1.0f);
+		invalidated_gpu_config |= ImGui::SliderFloat("Centre Y", &gpu_config.variable_rate_centre_y, 0.0f, 1.0f);
+		invalidated_gpu_config |= ImGui::SliderFloat("Radius",   &gpu_config.variable_rate_radius,   0.05f, 1.0f);
 	}
 }
@@ -1,6 +1,11 @@
 #pragma once
 #include "Renderer/Integrators/Integrator.h"
+#include "Renderer/Integrators/VisibilityBuffer.h"
+#include "Renderer/Integrators/OptiXTraversal.h"
 #include "Renderer/Material.h"
+#include "Renderer/LightBVH.h"
+
+#include "Device/CUDAKernelTuning.h"
 
 struct TraceBuffer {
 	CUDAVector3_SoA ray_origin;
@@ -8,6 +13,8 @@ struct TraceBuffer {
 
 	CUDAMemory::Ptr<float4> hits;
 
+	CUDAMemory::Ptr<float> ray_time;
+
 	CUDAMemory::Ptr<float> cone_angle;
 	CUDAMemory::Ptr<float> cone_width;
 
@@ -18,19 +25,28 @@ struct TraceBuffer {
 
 	CUDAMemory::Ptr<float> last_pdf;
 
+	static constexpr size_t BYTES_PER_RAY = 9 * sizeof(float) + sizeof(float4) + sizeof(float) + 2 * sizeof(float) + 2 * sizeof(int) + sizeof(float);
+	static constexpr int    VECTOR3_COUNT = 3; // Each is padded by one float if cpu_config.enable_packed_ray_buffers is set
+
+	static size_t get_bytes_per_ray() {
+		return BYTES_PER_RAY + (cpu_config.enable_packed_ray_buffers ? VECTOR3_COUNT * sizeof(float) : 0);
+	}
+
 	void init(int buffer_size) {
-		ray_origin   .init(buffer_size);
-		ray_direction.init(buffer_size);
+		ray_origin   .init(buffer_size, cpu_config.enable_packed_ray_buffers);
+		ray_direction.init(buffer_size, cpu_config.enable_packed_ray_buffers);
 
 		hits = CUDAMemory::malloc<float4>(buffer_size);
 
+		ray_time = CUDAMemory::malloc<float>(buffer_size);
+
 		cone_angle = CUDAMemory::malloc<float>(buffer_size);
 		cone_width = CUDAMemory::malloc<float>(buffer_size);
 
 		medium = CUDAMemory::malloc<int>(buffer_size);
 
 		pixel_index_and_flags = CUDAMemory::malloc<int>(buffer_size);
-		throughput.init(buffer_size);
+		throughput.init(buffer_size, cpu_config.enable_packed_ray_buffers);
 
 		last_pdf = CUDAMemory::malloc<float>(buffer_size);
 	}
@@ -41,6 +57,8 @@ struct TraceBuffer {
 
 		CUDAMemory::free(hits);
 
+		CUDAMemory::free(ray_time);
+
 		CUDAMemory::free(cone_angle);
 		CUDAMemory::free(cone_width);
 
@@ -66,18 +84,41 @@ struct MaterialBuffer {
 	CUDAMemory::Ptr<int> pixel_index;
 	CUDAVector3_SoA      throughput;
 
+	CUDAMemory::Ptr<int> sort_index;
+
+	static constexpr size_t BYTES_PER_RAY = 6 * sizeof(float) + sizeof(float4) + 2 * sizeof(float) + 3 * sizeof(int);
+	static constexpr int    VECTOR3_COUNT = 2;
+
+	// With cpu_config.enable_compact_ray_payloads the direction takes 4 bytes, the throughput 8 and the cone 4 (see CONFIG_COMPACT_RAY_PAYLOADS)
+	static constexpr size_t BYTES_PER_RAY_COMPACT = sizeof(unsigned) + sizeof(float4) + sizeof(unsigned) + 3 * sizeof(int) + 2 * sizeof(unsigned);
+
+	static size_t get_bytes_per_ray() {
+		if (cpu_config.enable_compact_ray_payloads) return BYTES_PER_RAY_COMPACT;
+
+		return BYTES_PER_RAY + (cpu_config.enable_packed_ray_buffers ? VECTOR3_COUNT * sizeof(float) : 0);
+	}
+
 	void init(int buffer_size) {
-		direction.init(buffer_size);
+		if (cpu_config.enable_compact_ray_payloads) {
+			direction .x = CUDAMemory::malloc<float>(buffer_size);
+			throughput.x = CUDAMemory::malloc<float>(2 * buffer_size);
 
-		hits = CUDAMemory::malloc<float4>(buffer_size);
+			cone_angle = CUDAMemory::malloc<float>(buffer_size);
+		} else {
+			direction .init(buffer_size, cpu_config.enable_packed_ray_buffers);
+			throughput.init(buffer_size, cpu_config.enable_packed_ray_buffers);
 
-		cone_angle = CUDAMemory::malloc<float>(buffer_size);
-		cone_width = CUDAMemory::malloc<float>(buffer_size);
+			cone_angle = CUDAMemory::malloc<float>(buffer_size);
+			cone_width = CUDAMemory::malloc<float>(buffer_size);
+		}
+
+		hits = CUDAMemory::malloc<float4>(buffer_size);
 
 		medium = CUDAMemory::malloc<int>(buffer_size);
 
 		pixel_index = CUDAMemory::malloc<int>(buffer_size);
-		throughput.init(buffer_size);
+
+		sort_index = CUDAMemory::malloc<int>(buffer_size);
 	}
 
 	void free() {
@@ -86,12 +127,14 @@ struct MaterialBuffer {
 		CUDAMemory::free(hits);
 
 		CUDAMemory::free(cone_angle);
-		CUDAMemory::free(cone_width);
+		if (cone_width.ptr) CUDAMemory::free(cone_width);
 
 		CUDAMemory::free(medium);
 
 		CUDAMemory::free(pixel_index);
 		throughput.free();
+
+		CUDAMemory::free(sort_index);
 	}
 };
 
@@ -100,14 +143,32 @@ struct ShadowRayBuffer {
 	CUDAVector3_SoA ray_direction;
 
 	CUDAMemory::Ptr<float>  max_distance;
+	CUDAMemory::Ptr<float>  ray_time;
 	CUDAMemory::Ptr<float4> illumination_and_pixel_index;
 
+	static constexpr size_t BYTES_PER_RAY = 6 * sizeof(float) + 2 * sizeof(float) + sizeof(float4);
+	static constexpr int    VECTOR3_COUNT = 2;
+
+	static size_t get_bytes_per_ray() {
+		size_t bytes_per_ray = BYTES_PER_RAY + (cpu_config.enable_packed_ray_buffers ? VECTOR3_COUNT * sizeof(float) : 0);
+		if (cpu_config.enable_compact_ray_payloads) {
+			bytes_per_ray -= sizeof(float4) - sizeof(int2); // Illumination in RGB9E5 and the pixel index
+		}
+		return bytes_per_ray;
+	}
+
 	void init(int buffer_size) {
-		ray_origin   .init(buffer_size);
-		ray_direction.init(buffer_size);
+		ray_origin   .init(buffer_size, cpu_config.enable_packed_ray_buffers);
+		ray_direction.init(buffer_size, cpu_config.enable_packed_ray_buffers);
 
-		max_distance                 = CUDAMemory::malloc<float> (buffer_size);
-		illumination_and_pixel_index = CUDAMemory::malloc<float4>(buffer_size);
+		max_distance = CUDAMemory::malloc<float>(buffer_size);
+		ray_time     = CUDAMemory::malloc<float>(buffer_size);
+
+		if (cpu_config.enable_compact_ray_payloads) {
+			illumination_and_pixel_index.ptr = CUDAMemory::malloc<int2>(buffer_size).ptr;
+		} else {
+			illumination_and_pixel_index = CUDAMemory::malloc<float4>(buffer_size);
+		}
 	}
 
 	void free() {
@@ -115,6 +176,7 @@ struct ShadowRayBuffer {
 		ray_direction.free();
 
 		CUDAMemory::free(max_distance);
+		CUDAMemory::free(ray_time);
 		CUDAMemory::free(illumination_and_pixel_index);
 	}
 };
@@ -125,6 +187,9 @@ struct BufferSizes {
 	int dielectric[MAX_BOUNCES];
 	int conductor [MAX_BOUNCES];
 	int shadow    [MAX_BOUNCES];
+	int medium    [MAX_BOUNCES];
+	int miss      [MAX_BOUNCES];
+	int light_hit [MAX_BOUNCES];
 
 	int rays_retired       [MAX_BOUNCES];
 	int rays_retired_shadow[MAX_BOUNCES];
@@ -136,6 +201,9 @@ struct BufferSizes {
 		memset(dielectric,          0, sizeof(dielectric));
 		memset(conductor,           0, sizeof(conductor));
 		memset(shadow,              0, sizeof(shadow));
+		memset(medium,              0, sizeof(medium));
+		memset(miss,                0, sizeof(miss));
+		memset(light_hit,           0, sizeof(light_hit));
 		memset(rays_retired,        0, sizeof(rays_retired));
 		memset(rays_retired_shadow, 0, sizeof(rays_retired_shadow));
 
@@ -143,6 +211,67 @@ struct BufferSizes {
 	}
 };
 
+// Mirrors the Reservoir in CUDA/ReSTIR.h
+struct Reservoir {
+	int   light_mesh_id;
+	int   light_triangle_id;
+	float light_uv[2];
+
+	float weight_sum;
+	float M;
+	float W;
+
+	int      surface_mesh_id;
+	float    surface_depth;
+	unsigned surface_normal;
+};
+
+// Mirrors the GuidingVertex in CUDA/PathGuiding.h
+struct GuidingVertex {
+	unsigned cell_and_bin;
+	float    weight;
+	float    radiance;
+};
+
+// Mirrors the RadianceCacheVertex in CUDA/RadianceCache.h
+struct RadianceCacheVertex {
+	int   cell;
+	float throughput_inv[3];
+	float radiance[3];
+};
+
+// Number of Rays traced per bounce and the time spent in the corresponding trace Kernels, see Pathtracer::calc_ray_stats
+struct RayStats {
+	int num_bounces;
+
+	double rays_trace [MAX_BOUNCES];
+	double rays_shadow[MAX_BOUNCES];
+	double time_trace [MAX_BOUNCES]; // In milliseconds
+	double time_shadow[MAX_BOUNCES]; // In milliseconds
+
+	static double mrays_per_second(double rays, double time) {
+		return time > 0.0 ? rays / (1000.0 * time) : 0.0;
+	}
+
+	double get_rays_primary()   const { return rays_trace[0]; }
+	double get_rays_secondary() const { double sum = 0.0; for (int i = 1; i < num_bounces; i++) sum += rays_trace [i]; return sum; }
+	double get_rays_shadow()    const { double sum = 0.0; for (int i = 0; i < num_bounces; i++) sum += rays_shadow[i]; return sum; }
+
+	double get_time_primary()   const { return time_trace[0]; }
+	double get_time_secondary() const { double sum = 0.0; for (int i = 1; i < num_bounces; i++) sum += time_trace [i]; return sum; }
+	double get_time_shadow()    const { double sum = 0.0; for (int i = 0; i < num_bounces; i++) sum += time_shadow[i]; return sum; }
+
+	void add(const RayStats & other) {
+		num_bounces = Math::max(num_bounces, other.num_bounces);
+		for (int i = 0; i < other.num_bounces; i++) {
+			rays_trace [i] += other.rays_trace [i];
+			rays_shadow[i] += other.rays_shadow[i];
+			time_trace [i] += other.time_trace [i];
+			time_shadow[i] += other.time_shadow[i];
+		}
+	}
+};
+
 struct Pathtracer final : Integrator {
 	CUDAKernel kernel_integrate_dielectric;
 	CUDAKernel kernel_integrate_conductor;
@@ -154,26 +283,67 @@ struct Pathtracer final : Integrator {
 	CUDAKernel kernel_trace_bvh4;
 	CUDAKernel kernel_trace_bvh8;
 	CUDAKernel kernel_sort;
+	CUDAKernel kernel_medium;
+	CUDAKernel kernel_miss;
+	CUDAKernel kernel_light_hit;
 	CUDAKernel kernel_material_diffuse;
 	CUDAKernel kernel_material_plastic;
 	CUDAKernel kernel_material_dielectric;
 	CUDAKernel kernel_material_conductor;
+	CUDAKernel kernel_material_sort_scan;
+	CUDAKernel kernel_material_sort_scatter;
+	CUDAKernel kernel_ray_sort_count;
+	CUDAKernel kernel_ray_sort_scan;
+	CUDAKernel kernel_ray_sort_scatter;
+	CUDAKernel kernel_treelet_tlas_bvh8;
+	CUDAKernel kernel_treelet_scan;
+	CUDAKernel kernel_treelet_scatter;
+	CUDAKernel kernel_treelet_blas_bvh8;
+	CUDAKernel kernel_treelet_resolve;
 	CUDAKernel kernel_trace_shadow_bvh2;
 	CUDAKernel kernel_trace_shadow_bvh4;
 	CUDAKernel kernel_trace_shadow_bvh8;
+	CUDAKernel kernel_shadow_resolve;
+	CUDAKernel kernel_megakernel;
+	CUDAKernel kernel_megakernel_tail;
+	CUDAKernel kernel_bake_rasterise;
+	CUDAKernel kernel_bake_compact;
+	CUDAKernel kernel_bake_generate;
+	CUDAKernel kernel_bake_dilate;
+	CUDAKernel kernel_reproject;
 
 	CUDAKernel * kernel_trace        = nullptr;
 	CUDAKernel * kernel_trace_shadow = nullptr;
 
+	// Filtering and presentation of the frame, compiled from MODULE_FILENAME_DENOISE into cuda_module_denoise
+	CUDAModule cuda_module_denoise;
+
 	CUDAKernel kernel_svgf_reproject;
 	CUDAKernel kernel_svgf_variance;
 	CUDAKernel kernel_svgf_atrous;
+	CUDAKernel kernel_svgf_atrous_tiled;
+	CUDAKernel kernel_svgf_classify;
 	CUDAKernel kernel_svgf_finalize;
 
 	CUDAKernel kernel_taa;
 	CUDAKernel kernel_taa_finalize;
+	CUDAKernel kernel_svgf_taa_resolve; // Fused kernel_svgf_finalize, kernel_taa and kernel_taa_finalize, see cpu_config.enable_fused_taa
+
+	// Reconstruct the display resolution if rendering at a reduced resolution, see Upscale.h
+	CUDAKernel kernel_upscale;
+	CUDAKernel kernel_taa_upscale;
+	CUDAKernel kernel_taa_upscale_finalize;
 
 	CUDAKernel kernel_accumulate;
+	CUDAKernel kernel_convergence_error;
+
+	// Train the Path Guiding grid on the paths of the frame, see PathGuiding.h
+	CUDAKernel kernel_guiding_train;
+	CUDAKernel kernel_guiding_update;
+
+	// Train the radiance cache on the paths of the frame, see RadianceCache.h
+	CUDAKernel kernel_radiance_cache_train;
+	CUDAKernel kernel_radiance_cache_update;
 
 	TraceBuffer     ray_buffer_trace_0;
 	TraceBuffer     ray_buffer_trace_1;
@@ -182,6 +352,29 @@ struct Pathtracer final : Integrator {
 	Array<MaterialBuffer>               material_ray_buffers;
 	CUDAMemory::Ptr<MaterialBuffer> ptr_material_ray_buffers;
 
+	CUDAMemory::Ptr<int> ptr_material_sort_offsets;
+
+	CUDAMemory::Ptr<int> ptr_ray_sort_offsets;
+	CUDAMemory::Ptr<int> ptr_ray_sort_index;
+
+	// Treelet queues, see cpu_config.enable_treelet_queues
+	CUDAMemory::Ptr<int2>     ptr_treelet_entries;
+	CUDAMemory::Ptr<int2>     ptr_treelet_entries_sorted;
+	CUDAMemory::Ptr<float4>   ptr_treelet_entry_hits;
+	CUDAMemory::Ptr<int>      ptr_treelet_offsets;
+	CUDAMemory::Ptr<unsigned> ptr_treelet_ray_t;
+	CUDAMemory::Ptr<int>      ptr_treelet_entry_count_total;
+
+	// Texture space baking, see IntegratorType::BAKE
+	CUDAMemory::Ptr<int4> ptr_bake_texels;
+	CUDAMemory::Ptr<int>  ptr_bake_texel_list;
+	CUDAMemory::Ptr<int>  ptr_bake_texel_count;
+
+	int bake_tiles_x; // Tiles per row of the atlas
+
+	CUDAMemory::Ptr<int> ptr_medium_queue;
+	CUDAMemory::Ptr<int> ptr_emission_queue;
+
 	CUDAModule::Global global_ray_buffer_shadow;
 
 	struct LUTTexture {
@@ -205,13 +398,47 @@ struct Pathtracer final : Integrator {
 	LUTTexture lut_conductor_directional_albedo;
 	LUTTexture lut_conductor_albedo;
 
+	int batch_size = BATCH_SIZE; // Capacity of the wavefront Buffers in number of pixels
+
 	BufferSizes * pinned_buffer_sizes = nullptr;
 
+	// BufferSizes of the previous frame, read back asynchronously into pinned_buffer_sizes with one frame latency
+	BufferSizes buffer_sizes_prev = { };
+	CUevent     event_buffer_sizes_readback = { };
+	bool        buffer_sizes_readback_pending = false;
+	bool        buffer_sizes_prev_valid       = false;
+
+	int sm_count = 0;
+
+	// CUDA Graph containing the launch sequence of an entire frame, only used if cpu_config.enable_cuda_graph is set
+	CUstream    stream_graph      = { };
+	CUgraphExec graph_exec        = { };
+	bool        invalidated_graph = true;
+
+	// The Material Kernels of a bounce read disjoint queues, with cpu_config.enable_concurrent_materials each gets its own stream
+	// They fork from the frame stream after the Material sort and join it again before the shadow trace
+	static constexpr int MATERIAL_STREAM_COUNT = 4;
+
+	CUstream stream_material     [MATERIAL_STREAM_COUNT] = { };
+	CUevent  event_material_join [MATERIAL_STREAM_COUNT] = { };
+	CUevent  event_material_fork = { };
+
+	// With cpu_config.enable_shadow_overlap the shadow Rays of a bounce are traced on their own stream, alongside the extension Rays of the next bounce
+	CUstream stream_shadow     = { };
+	CUevent  event_shadow_fork = { };
+	CUevent  event_shadow_join = { };
+
+	// Frame time budget, see update_frame_budget()
+	float frame_time_gpu     = 0.0f;        // Duration of the previous frame on the GPU in milliseconds
+	int   budget_num_bounces = MAX_BOUNCES; // Number of bounces that fits the budget, only used while the Camera is moving
+	bool  budget_active      = false;
+
 	CUDAModule::Global global_svgf_data;
 
-	CUarray array_gbuffer_normal_and_depth;
-	CUarray array_gbuffer_mesh_id_and_triangle_id;
-	CUarray array_gbuffer_screen_position_prev;
+	// GBuffers, shared by SVGF and reprojection
+	CUarray array_gbuffer_normal_and_depth        = nullptr;
+	CUarray array_gbuffer_mesh_id_and_triangle_id = nullptr;
+	CUarray array_gbuffer_screen_position_prev    = nullptr;
 
 	CUsurfObject surf_gbuffer_normal_and_depth;
 	CUsurfObject surf_gbuffer_mesh_id_and_triangle_id;
@@ -220,67 +447,298 @@ struct Pathtracer final : Integrator {
 	// SVGF
 	CUDAMemory::Ptr<float4> ptr_frame_buffer_moment;
 	CUDAMemory::Ptr<int>    ptr_history_length;
-	CUDAMemory::Ptr<float4> ptr_history_direct;
-	CUDAMemory::Ptr<float4> ptr_history_indirect;
-	CUDAMemory::Ptr<float4> ptr_history_moment;
-	CUDAMemory::Ptr<float4> ptr_history_normal_and_depth;
+	CUDAMemory::Ptr<unsigned char> ptr_history_direct; // Untyped, stored as either float4 or half4 depending on gpu_config.enable_compact_history
+	CUDAMemory::Ptr<unsigned char> ptr_history_indirect;
+	CUDAMemory::Ptr<float4>        ptr_history_moment;
+	CUDAMemory::Ptr<unsigned char> ptr_history_normal_and_depth;
+
+	CUDAMemory::Ptr<int> ptr_svgf_tile_list; // Tiles that still need filtering, see kernel_svgf_classify
+	CUDAMemory::Ptr<int> ptr_svgf_tile_count;
+	CUDAMemory::Ptr<int> ptr_svgf_tile_active;
 
 	// TAA
-	CUDAMemory::Ptr<float4> ptr_taa_frame_prev;
-	CUDAMemory::Ptr<float4> ptr_taa_frame_curr;
+	CUDAMemory::Ptr<unsigned char> ptr_taa_frame_prev;
+	CUDAMemory::Ptr<unsigned char> ptr_taa_frame_curr;
+
+	CUDAMemory::Ptr<float4> ptr_upscale_history; // At display resolution, only allocated if upscaling
+
+	// Reprojection, see Reprojection.h
+	CUDAMemory::Ptr<float4> ptr_reprojection_radiance;
+	CUDAMemory::Ptr<float>  ptr_reprojection_sample_counts;
+	CUDAMemory::Ptr<int4>   ptr_reprojection_history;
+
+	int reprojection_sample_index_first = 0; // sample_index of the frame the Camera last moved on
+
+	// Adaptive Sampling
+	CUDAMemory::Ptr<float4> ptr_adaptive_moments;
+	CUDAMemory::Ptr<int>    ptr_adaptive_pixels;
+	CUDAMemory::Ptr<int>    ptr_adaptive_pixel_count;
+
+	// Convergence, only allocated for headless renders with a target error
+	CUDAMemory::Ptr<float4> ptr_convergence_moments;
+	CUDAMemory::Ptr<float2> ptr_convergence_error;
+	float2                * pinned_convergence_error = nullptr;
+
+	// Variable Rate Sampling
+	CUDAMemory::Ptr<unsigned char> ptr_variable_rate_mask;
+
+	// ReSTIR
+	CUDAMemory::Ptr<Reservoir> ptr_restir_reservoirs;
+
+	// Path Guiding
+	CUDAMemory::Ptr<unsigned>      ptr_guiding_keys;
+	CUDAMemory::Ptr<int>           ptr_guiding_sample_counts;
+	CUDAMemory::Ptr<float>         ptr_guiding_radiance;
+	CUDAMemory::Ptr<float>         ptr_guiding_cdf;
+	CUDAMemory::Ptr<GuidingVertex> ptr_guiding_vertices;
+
+	// Radiance Cache
+	CUDAMemory::Ptr<unsigned>            ptr_radiance_cache_keys;
+	CUDAMemory::Ptr<float4>              ptr_radiance_cache_sums;
+	CUDAMemory::Ptr<float4>              ptr_radiance_cache_radiance;
+	CUDAMemory::Ptr<RadianceCacheVertex> ptr_radiance_cache_vertices;
+
+	// Shadow Occluder Cache
+	CUDAMemory::Ptr<int2> ptr_shadow_occluder_cache;
+
+	// Rasterised primary visibility, see gpu_config.enable_raster_primary
+	bool has_gl_context = false;
+
+	VisibilityBuffer   visibility_buffer;
+	CUgraphicsResource resource_visibility_buffer = nullptr;
+	CUarray            array_visibility_buffer    = nullptr;
+	CUsurfObject       surf_visibility_buffer;
+
+	CUDAMemory::Ptr<int> ptr_reverse_indices; // Copy of GPUScene::reverse_indices, used by the rasterised primary visibility and calc_light_power
+
+	CUDAModule::Global global_raster_jitter;
+
+	// Hardware traversal of the trace queues, see cpu_config.traversal_backend
+	bool           use_optix = false;
+	OptiXTraversal optix_traversal;
 
 	// Light Sampling
 	CUDAModule::Global global_lights_total_weight;
 
-	CUDAMemory::Ptr<int>   ptr_light_triangle_indices;
-	CUDAMemory::Ptr<float> ptr_light_triangle_cumulative_probability;
+	// Mirrors the LightMeshData in CUDA/LightPower.h
+	struct LightMeshData {
+		int first_light_triangle;
+		int triangle_count;
+		int triangle_offset;
+		int emission_texture_id;
+	};
+
+	CUDAKernel kernel_light_triangle_cdf;
+
+	CUDAMemory::Ptr<int>               ptr_light_triangle_indices;
+	CUDAMemory::Ptr<float>             ptr_light_triangle_cdf;
+
+	CUDAMemory::Ptr<AliasTable::Entry> ptr_light_mesh_alias_table;
+	CUDAMemory::Ptr<int2>              ptr_light_mesh_triangle_span;
+	CUDAMemory::Ptr<int>               ptr_light_mesh_transform_indices;
 
-	CUDAMemory::Ptr<float> ptr_light_mesh_cumulative_probability;
-	CUDAMemory::Ptr<int2>  ptr_light_mesh_triangle_span;
-	CUDAMemory::Ptr<int>   ptr_light_mesh_transform_indices;
+	Array<double> light_mesh_alias_weights; // Weights the Mesh alias table was last built with, it only needs to be rebuilt if these change
+
+	LightBVH   light_bvh;
+	Array<int> light_bvh_local_index_offsets; // Per MeshData, offset into light_bvh_triangle_local_indices relative to the first index of the MeshData
+
+	Array<float> light_triangle_texture_weights; // Per light Triangle, see light_triangle_texture_weight in CUDA/LightPower.h. Empty if no Light has an emission Texture
+
+	CUDAMemory::Ptr<LightBVH::Node> ptr_light_bvh_nodes;
+	CUDAMemory::Ptr<int>            ptr_light_bvh_node_parents;
+	CUDAMemory::Ptr<int2>           ptr_light_bvh_primitives;
+	CUDAMemory::Ptr<int>            ptr_light_bvh_primitive_leaves;
+	CUDAMemory::Ptr<int2>           ptr_light_bvh_mesh_offsets;
+	CUDAMemory::Ptr<int>            ptr_light_bvh_triangle_local_indices;
 
 	// Timing Events
+	CUDAEvent::Desc event_desc_graph;
 	CUDAEvent::Desc event_desc_primary;
+	CUDAEvent::Desc event_desc_megakernel;
+	CUDAEvent::Desc event_desc_ray_sort[MAX_BOUNCES];
+	CUDAEvent::Desc event_desc_megakernel_tail[MAX_BOUNCES];
 	CUDAEvent::Desc event_desc_trace[MAX_BOUNCES];
+	CUDAEvent::Desc event_desc_treelet_blas[MAX_BOUNCES];
 	CUDAEvent::Desc event_desc_sort [MAX_BOUNCES];
+	CUDAEvent::Desc event_desc_medium[MAX_BOUNCES];
+	CUDAEvent::Desc event_desc_miss[MAX_BOUNCES];
+	CUDAEvent::Desc event_desc_light_hit[MAX_BOUNCES];
+	CUDAEvent::Desc event_desc_material_sort[MAX_BOUNCES];
 	CUDAEvent::Desc event_desc_material_diffuse   [MAX_BOUNCES];
 	CUDAEvent::Desc event_desc_material_plastic   [MAX_BOUNCES];
 	CUDAEvent::Desc event_desc_material_dielectric[MAX_BOUNCES];
 	CUDAEvent::Desc event_desc_material_conductor [MAX_BOUNCES];
+	CUDAEvent::Desc event_desc_materials          [MAX_BOUNCES]; // All Material Kernels of a bounce, if they run concurrently
 	CUDAEvent::Desc event_desc_shadow_trace[MAX_BOUNCES];
 	CUDAEvent::Desc event_desc_svgf_reproject;
 	CUDAEvent::Desc event_desc_svgf_variance;
+	CUDAEvent::Desc event_desc_svgf_classify;
 	CUDAEvent::Desc event_desc_svgf_atrous[MAX_ATROUS_ITERATIONS];
 	CUDAEvent::Desc event_desc_svgf_finalize;
 	CUDAEvent::Desc event_desc_taa;
+	CUDAEvent::Desc event_desc_upscale;
 	CUDAEvent::Desc event_desc_reconstruct;
 	CUDAEvent::Desc event_desc_accumulate;
+	CUDAEvent::Desc event_desc_guiding;
+	CUDAEvent::Desc event_desc_radiance_cache;
 	CUDAEvent::Desc event_desc_end;
 
-	Pathtracer(unsigned frame_buffer_handle, int width, int height, Scene & scene) : Integrator(scene) {
+	Pathtracer(unsigned frame_buffer_handle, int width, int height, Scene & scene, OwnPtr<GPUScene> gpu_scene = nullptr) : Integrator(scene, std::move(gpu_scene)) {
+		cuda_modules_shared.push_back(&cuda_module_denoise);
 		cuda_init(frame_buffer_handle, width, height);
 	}
 
 	void cuda_init(unsigned frame_buffer_handle, int screen_width, int screen_height) override;
 	void cuda_free() override;
 
+	static constexpr const char * MODULE_FILENAME         = "Src/CUDA/Pathtracer.cu";
+	static constexpr const char * MODULE_FILENAME_DENOISE = "Src/CUDA/Denoise.cu";
+
 	void init_module();
 	void init_events();
 
+	// Resolution the Pathtracer renders at for a display of width x height, see cpu_config.render_scale
+	static void calc_render_size(unsigned frame_buffer_handle, int width, int height, int & render_width, int & render_height);
+
+	int calc_view_count(unsigned frame_buffer_handle) const; // Number of views of cpu_config.view_layout, 1 if the enabled features do not support multiple views
+	int calc_batch_size(int screen_width, int screen_height) const;
+
+	bool megakernel_supported() const;
+	bool use_megakernel() const; // Whether the current frame is rendered by kernel_megakernel instead of the wavefront Kernels
+
 	void init_luts();
 	void free_luts();
 
 	void resize_init(unsigned frame_buffer_handle, int width, int height) override; // Part of resize that initializes new size
 	void resize_free()                                                    override; // Part of resize that cleans up old size
 
+	bool resize_in_place(unsigned frame_buffer_handle, int width, int height) override;
+
+	void resize_screen(int width, int height); // Applies the screen size (already in screen_width and screen_height) to the globals, Kernels and Camera
+
+	void gbuffer_init();
+	void gbuffer_free();
+
 	void svgf_init();
 	void svgf_free();
 
+	void reprojection_init();
+	void reprojection_free();
+
+	// Reprojection only replaces plain accumulation, SVGF and the pixel list have their own history
+	bool is_reprojecting() const override { return gpu_config.enable_reprojection && !gpu_config.enable_svgf && !use_pixel_list(); }
+
+	// Adaptive and variable rate sampling share the Pixel list and moments
+	bool use_pixel_list() const { return gpu_config.enable_adaptive_sampling || gpu_config.enable_variable_rate; }
+
+	// SVGF and the pixel list work on a single sample per frame
+	// The rasterised visibility is only valid for the sample it was drawn for
+	int get_samples_per_launch() const { return gpu_config.enable_svgf || use_pixel_list() || gpu_config.enable_raster_primary ? 1 : samples_per_launch; }
+
+	void adaptive_sampling_init();
+	void adaptive_sampling_free();
+
+	void convergence_init();
+	void convergence_free();
+
+	void variable_rate_mask_init();
+	void variable_rate_mask_free();
+
+	void restir_init();
+	void restir_free();
+
+	void path_guiding_init();
+	void path_guiding_free();
+	void path_guiding_reset(); // Discards what was learned, needed when the Scene changes
+
+	void radiance_cache_init();
+	void radiance_cache_free();
+	void radiance_cache_reset(); // Discards what was learned, needed when the Scene or the Materials change
+
+	void shadow_occluder_cache_init();
+	void shadow_occluder_cache_free();
+
+	bool treelet_queues_supported() const;
+	void treelet_queues_init();
+	void treelet_queues_free();
+
+	bool is_baking() const { return cpu_config.integrator == IntegratorType::BAKE; }
+	void bake_prepare(int & width, int & height); // Disables the features that need a Camera, width and height become the size of the atlas
+	void bake_init(); // Rasterises the UVs of all Meshes into the atlas, afterwards pixel_count is the number of covered texels
+	void bake_free();
+
+	bool raster_primary_supported() const;
+	void raster_primary_init();
+	void raster_primary_free();
+	void raster_primary_render(); // Rasterises the visibility of the sample that is about to be rendered
+
+	bool optix_supported() const;
+	void optix_free();
+	void optix_build_ias(); // Mirrors the current TLAS, called whenever a new TLAS is made visible to the GPU
+	int  optix_launch_width(int queue_size_prev) const;
+
+	void on_mesh_data_updated(int mesh_data_index) override;
+
+	void kernels_set_grid_dim();
+	void queue_kernels_set_grid_dim();
+
+	// Kernels whose Block dimensions can be changed freely, see CUDAKernelTuning
+	// 2D Kernels need a Block width of 32, since their Grid width is derived from the screen pitch
+	struct TunableKernel {
+		StringView   name;
+		CUDAKernel * kernel;
+		bool         is_2d;
+	};
+	Array<TunableKernel> get_tunable_kernels();
+
+	void update_frame_budget();
+	int  get_num_bounces() const;
+
+	// Combines the queue sizes of the last BufferSizes readback with the timings of the trace Kernels of the last frame
+	// Returns false if either is not available, e.g. before the first readback or when rendering with a CUDA Graph
+	// NOTE: The Events of the last frame need to have completed
+	bool calc_ray_stats(RayStats & stats) const;
+
+	// Estimates the error of the accumulated image as the root mean square over all Pixels of the standard error of their mean luminance relative to the mean
+	// Returns INFINITY if no error is estimated, see cpu_config.convergence_target_error. Synchronizes with the GPU
+	float calc_convergence_error();
+
+	void graph_free();
+
 	void update(float delta, Allocator * frame_allocator) override;
 	void render()                                         override;
 
+	void render_launches(CUstream stream, bool record_events); // Launches the Kernels of a single frame
+	void render_graph();
+
+	void poll_buffer_sizes_readback();
+
+	// Launches a Kernel that consumes a queue whose size is only known on the Device
+	// The Grid is shrunk based on the size of the same queue in the previous frame,
+	// the queue Kernels loop over their queue so any Grid size gives the correct result
+	template<typename ... T>
+	void queue_kernel_execute(CUDAKernel & kernel, int queue_size_prev, CUstream stream, const T & ... parameters) {
+		// Trace Kernels use a 1 x N Grid, the other queue Kernels use an N x 1 Grid
+		int & grid_dim     = kernel.grid_dim_x == 1 ? kernel.grid_dim_y : kernel.grid_dim_x;
+		int   grid_dim_max = grid_dim;
+
+		if (buffer_sizes_prev_valid) {
+			int queue_size_expected = queue_size_prev + queue_size_prev / 2; // Leave some headroom for variation between frames
+			int block_count         = Math::divide_round_up(queue_size_expected, kernel.block_dim_x * kernel.block_dim_y);
+
+			// Never go below one Block per SM, so that a queue that was empty last frame but is not now still gets processed at a reasonable rate
+			grid_dim = Math::clamp(block_count, Math::min(sm_count, grid_dim_max), grid_dim_max);
+		}
+
+		kernel.execute_on_stream(stream, parameters...);
+
+		grid_dim = grid_dim_max;
+	}
+
 	void render_gui() override;
 
 	void calc_light_power(Allocator * frame_allocator);
 	void calc_light_mesh_weights();
+	void calc_light_bvh();
+	void calc_ray_sort_bounds();
 };
@@ -0,0 +1,170 @@
+#include "VisibilityBuffer.h"
+
+#include <cstddef>
+
+#include "Core/IO.h"
+#include "Core/Allocators/StackAllocator.h"
+
+#include "Renderer/Scene.h"
+
+#include "Integrator.h"
+
+#include "CUDA/Common.h"
+
+void VisibilityBuffer::init_geometry(const Scene & scene) {
+	StackAllocator<KILOBYTES(4)> allocator;
+	String shader_source_vertex   = IO::file_read(String("Src/Shaders/visibility.vert", &allocator), &allocator);
+	String shader_source_fragment = IO::file_read(String("Src/Shaders/visibility.frag", &allocator), &allocator);
+
+	shader = Shader::load(shader_source_vertex.view(), shader_source_fragment.view());
+
+	uniform_transform       = shader.get_uniform("transform");
+	uniform_jitter          = shader.get_uniform("jitter");
+	uniform_mesh_id         = shader.get_uniform("mesh_id");
+	uniform_triangle_offset = shader.get_uniform("triangle_offset");
+
+	const Array<MeshData> & mesh_datas = scene.asset_manager.mesh_datas;
+
+	mesh_data_buffers.resize(mesh_datas.size());
+
+	for (size_t i = 0; i < mesh_datas.size(); i++) {
+		const MeshData  & mesh_data = mesh_datas[i];
+		MeshDataBuffers & buffers   = mesh_data_buffers[i];
+
+		if (mesh_data.has_curves()) continue;
+
+		// The Triangles are drawn in their original order, gl_PrimitiveID is then the index into the MeshData
+		glGenVertexArrays(1, &buffers.vertex_array);
+		glBindVertexArray(buffers.vertex_array);
+
+		glGenBuffers(1, &buffers.vertex_buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, buffers.vertex_buffer);
+		glBufferData(GL_ARRAY_BUFFER, mesh_data.triangles.vertices.size() * sizeof(Vertex), mesh_data.triangles.vertices.data(), GL_STATIC_DRAW);
+
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), reinterpret_cast<const void *>(offsetof(Vertex, position)));
+
+		glGenBuffers(1, &buffers.index_buffer);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.index_buffer);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh_data.triangles.indices.size() * sizeof(int), mesh_data.triangles.indices.data(), GL_STATIC_DRAW);
+
+		buffers.index_count = int(mesh_data.triangles.indices.size());
+	}
+
+	glBindVertexArray(0);
+
+	has_geometry = true;
+}
+
+void VisibilityBuffer::free_geometry() {
+	for (size_t i = 0; i < mesh_data_buffers.size(); i++) {
+		const MeshDataBuffers & buffers = mesh_data_buffers[i];
+		if (buffers.index_count == 0) continue;
+
+		glDeleteBuffers     (1, &buffers.vertex_buffer);
+		glDeleteBuffers     (1, &buffers.index_buffer);
+		glDeleteVertexArrays(1, &buffers.vertex_array);
+	}
+	mesh_data_buffers.clear();
+
+	has_geometry = false;
+}
+
+void VisibilityBuffer::init_targets(int width, int height) {
+	this->width  = width;
+	this->height = height;
+
+	glGenTextures(1, &texture_ids);
+	glBindTexture(GL_TEXTURE_2D, texture_ids);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32I, width, height, 0, GL_RG_INTEGER, GL_INT, nullptr);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenRenderbuffers(1, &depth_buffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, depth_buffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32F, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &frame_buffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, frame_buffer);
+	glFramebufferTexture2D   (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,   texture_ids, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,  GL_RENDERBUFFER, depth_buffer);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		IO::print("ERROR: Visibility Buffer Frame Buffer is incomplete!\n"_sv);
+		IO::exit(1);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void VisibilityBuffer::free_targets() {
+	glDeleteFramebuffers (1, &frame_buffer);
+	glDeleteRenderbuffers(1, &depth_buffer);
+	glDeleteTextures     (1, &texture_ids);
+
+	frame_buffer = 0;
+	depth_buffer = 0;
+	texture_ids  = 0;
+}
+
+void VisibilityBuffer::render(const Scene & scene, const BVH & tlas, const Matrix3x4 transforms[], const int triangle_offsets[], const Camera & camera, Vector2 jitter) const {
+	// The far plane of the Camera would clip Geometry that the primary Rays do hit, push it out to infinity
+	Matrix4 projection = camera.projection;
+	projection(2, 2) = -1.0f;
+	projection(2, 3) = -2.0f * camera.near_plane;
+
+	Matrix4 view_projection =
+		projection *
+		Matrix4::create_rotation(Quaternion::conjugate(camera.rotation)) *
+		Matrix4::create_translation(-camera.position);
+
+	GLint viewport_prev[4];
+	glGetIntegerv(GL_VIEWPORT, viewport_prev);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, frame_buffer);
+	glViewport(0, 0, width, height);
+
+	const GLint   clear_ids[4] = { INVALID, INVALID, 0, 0 };
+	const GLfloat clear_depth  = 1.0f;
+	glClearBufferiv(GL_COLOR, 0, clear_ids);
+	glClearBufferfv(GL_DEPTH, 0, &clear_depth);
+
+	shader.bind();
+
+	// The rasteriser samples the centre of every Pixel, shift the Geometry so that the centre lands on the jittered sample position instead
+	glUniform2f(uniform_jitter, (1.0f - 2.0f * jitter.x) / float(width), (1.0f - 2.0f * jitter.y) / float(height));
+
+	for (size_t slot = 0; slot < tlas.indices.size(); slot++) {
+		const Mesh & mesh = scene.meshes[tlas.indices[slot]];
+
+		if ((mesh.visibility_mask & (1u << int(MeshVisibility::TRACE))) == 0) continue;
+
+		int mesh_data_index = mesh.mesh_data_handle.handle;
+		if (mesh_data_index >= int(mesh_data_buffers.size())) continue; // Added after the buffers were created
+
+		const MeshDataBuffers & buffers = mesh_data_buffers[mesh_data_index];
+		if (buffers.index_count == 0) continue;
+
+		// The 3x4 transform holds the first three rows of the 4x4 transform
+		Matrix4 transform;
+		memcpy(transform.cells, transforms[slot].cells, sizeof(Matrix3x4));
+
+		Matrix4 object_to_clip = view_projection * transform;
+
+		glUniformMatrix4fv(uniform_transform, 1, GL_TRUE, object_to_clip.cells);
+		glUniform1i(uniform_mesh_id,         int(slot));
+		glUniform1i(uniform_triangle_offset, triangle_offsets[mesh_data_index]);
+
+		glBindVertexArray(buffers.vertex_array);
+		glDrawElements(GL_TRIANGLES, buffers.index_count, GL_UNSIGNED_INT, nullptr);
+	}
+
+	glBindVertexArray(0);
+
+	shader.unbind();
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(viewport_prev[0], viewport_prev[1], viewport_prev[2], viewport_prev[3]);
+}
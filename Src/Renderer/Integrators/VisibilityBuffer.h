@@ -0,0 +1,52 @@
+#pragma once
+#include <GL/glew.h>
+
+#include "Core/Array.h"
+
+#include "Math/Vector2.h"
+
+#include "Util/Shader.h"
+
+struct Scene;
+struct Camera;
+struct BVH;
+struct Matrix3x4;
+
+// Rasterises the primary visibility of the Scene using OpenGL, so that the primary Rays do not have to be traced
+// Every Pixel stores the TLAS slot of the visible Mesh and the index of its Triangle into the aggregated Triangles
+// before BVH reordering (see GPUScene::reverse_indices), Pixels that are not covered are INVALID
+// Only available if an OpenGL context exists, i.e. not when running headless
+struct VisibilityBuffer {
+	GLuint frame_buffer = 0;
+	GLuint texture_ids  = 0; // GL_RG32I, registered with CUDA by the Pathtracer
+	GLuint depth_buffer = 0;
+
+	int width  = 0;
+	int height = 0;
+
+	struct MeshDataBuffers {
+		GLuint vertex_array  = 0;
+		GLuint vertex_buffer = 0;
+		GLuint index_buffer  = 0;
+		int    index_count   = 0; // 0 for MeshDatas with Curves, these are not rasterised
+	};
+	Array<MeshDataBuffers> mesh_data_buffers;
+
+	Shader shader;
+	GLint  uniform_transform;
+	GLint  uniform_jitter;
+	GLint  uniform_mesh_id;
+	GLint  uniform_triangle_offset;
+
+	bool has_geometry = false;
+
+	void init_geometry(const Scene & scene);
+	void free_geometry();
+
+	void init_targets(int width, int height);
+	void free_targets();
+
+	// Draws every Mesh in the TLAS using its slot as id and the transforms that the GPU uses
+	// The jitter is the sample position within the Pixel in [0, 1], it is the same for all Pixels
+	void render(const Scene & scene, const BVH & tlas, const Matrix3x4 transforms[], const int triangle_offsets[], const Camera & camera, Vector2 jitter) const;
+};
@@ -0,0 +1,124 @@
+#include "LightBVH.h"
+
+#include "Core/Sort.h"
+
+#include "Math/Math.h"
+
+#include "Util/Util.h"
+
+struct Cone {
+	Vector3 axis;
+	float   theta_o;
+};
+
+// Returns the smallest Cone that contains both Cones
+// Lights are two sided, so the axis of a Cone can be flipped without changing the directions it bounds
+static Cone cone_union(Cone a, Cone b) {
+	if (b.theta_o > a.theta_o) {
+		Util::swap(a, b);
+	}
+	if (Vector3::dot(a.axis, b.axis) < 0.0f) {
+		b.axis = -b.axis;
+	}
+
+	float theta_d = acosf(Math::clamp(Vector3::dot(a.axis, b.axis), -1.0f, 1.0f));
+	if (Math::min(theta_d + b.theta_o, PI) <= a.theta_o) {
+		return a; // a already contains b
+	}
+
+	float theta_o = 0.5f * (a.theta_o + theta_d + b.theta_o);
+	if (theta_o >= PI) {
+		return { a.axis, PI };
+	}
+
+	// Rotate the axis of a towards the axis of b
+	Vector3 ortho = b.axis - a.axis * Vector3::dot(a.axis, b.axis);
+	float   ortho_length = Vector3::length(ortho);
+	if (ortho_length < 1e-6f) {
+		return { a.axis, theta_o };
+	}
+
+	float theta_r = theta_o - a.theta_o;
+	Vector3 axis = a.axis * cosf(theta_r) + ortho * (sinf(theta_r) / ortho_length);
+
+	return { Vector3::normalize(axis), theta_o };
+}
+
+static void build_recursive(LightBVH & bvh, const Array<LightBVH::Primitive> & primitives, int * indices, int node_index, int first_index, int index_count) {
+	AABB  aabb          = AABB::create_empty();
+	AABB  centroid_aabb = AABB::create_empty();
+	Cone  cone          = { primitives[indices[first_index]].normal, 0.0f };
+	float power         = 0.0f;
+
+	for (int i = first_index; i < first_index + index_count; i++) {
+		const LightBVH::Primitive & primitive = primitives[indices[i]];
+
+		aabb = AABB::unify(aabb, primitive.aabb);
+		centroid_aabb.expand(primitive.aabb.get_center());
+
+		cone   = cone_union(cone, { primitive.normal, 0.0f });
+		power += primitive.power;
+	}
+
+	LightBVH::Node node = { };
+	node.aabb_min = aabb.min;
+	node.aabb_max = aabb.max;
+	node.power    = power;
+	node.theta_o  = cone.theta_o;
+	node.axis     = cone.axis;
+
+	if (index_count == 1) {
+		node.index = ~indices[first_index];
+		bvh.nodes[node_index] = node;
+		bvh.primitive_leaves[indices[first_index]] = node_index;
+		return;
+	}
+
+	// Split at the median along the axis of largest centroid extent
+	Vector3 extent = centroid_aabb.max - centroid_aabb.min;
+
+	int split_axis = 0;
+	if (extent.y > extent[split_axis]) split_axis = 1;
+	if (extent.z > extent[split_axis]) split_axis = 2;
+
+	Sort::quick_sort(indices + first_index, indices + first_index + index_count, [&primitives, split_axis](int a, int b) {
+		return primitives[a].aabb.get_center()[split_axis] < primitives[b].aabb.get_center()[split_axis];
+	});
+
+	int num_left  = index_count / 2;
+	int num_right = index_count - num_left;
+
+	int node_left_index = bvh.nodes.size();
+	node.index = node_left_index;
+	bvh.nodes[node_index] = node;
+
+	bvh.nodes.emplace_back();
+	bvh.nodes.emplace_back();
+	bvh.parents.push_back(node_index);
+	bvh.parents.push_back(node_index);
+
+	build_recursive(bvh, primitives, indices, node_left_index,     first_index,            num_left);
+	build_recursive(bvh, primitives, indices, node_left_index + 1, first_index + num_left, num_right);
+}
+
+void LightBVH::build(const Array<Primitive> & primitives) {
+	nodes  .clear();
+	parents.clear();
+	primitive_leaves.resize(primitives.size());
+
+	if (primitives.size() == 0) return;
+
+	nodes  .reserve(2 * primitives.size());
+	parents.reserve(2 * primitives.size());
+
+	nodes  .emplace_back(); // Root
+	parents.push_back(INVALID);
+
+	Array<int> indices(primitives.size());
+	for (int i = 0; i < primitives.size(); i++) {
+		indices[i] = i;
+	}
+
+	build_recursive(*this, primitives, indices.data(), 0, 0, primitives.size());
+	ASSERT(nodes.size() == 2 * primitives.size() - 1);
+}
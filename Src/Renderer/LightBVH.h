@@ -0,0 +1,32 @@
+#pragma once
+#include "Core/Array.h"
+
+#include "Math/AABB.h"
+
+// BVH over the emissive Triangles in world space, used to pick a light proportional to its estimated contribution to a shading point
+// Every Node bounds the positions as well as the normals (using a cone) of the lights below it, see Conty Estevez and Kulla 2018
+struct LightBVH {
+	struct Node {
+		Vector3 aabb_min;
+		float   power;
+		Vector3 aabb_max;
+		float   theta_o; // Half angle of the cone around axis that bounds the normals of the lights
+		Vector3 axis;
+		int     index;   // Leaf: ~primitive index, otherwise index of the left child (the right child directly follows it)
+
+		inline bool is_leaf() const { return index < 0; }
+	};
+	static_assert(sizeof(Node) == 48);
+
+	struct Primitive {
+		AABB    aabb;
+		Vector3 normal;
+		float   power;
+	};
+
+	Array<Node> nodes;
+	Array<int>  parents;          // Parent of every Node, used to evaluate the pdf of a given light bottom up
+	Array<int>  primitive_leaves; // Leaf Node of every primitive
+
+	void build(const Array<Primitive> & primitives);
+};
@@ -21,7 +21,8 @@ struct Material {
 
 	Type type = Type::DIFFUSE;
 
-	Vector3 emission;
+	Vector3         emission;
+	Handle<Texture> emission_texture_handle; // Multiplies emission, Light sampling weighs every Triangle by the brightness of its part of the Texture
 
 	Vector3         diffuse = Vector3(1.0f, 1.0f, 1.0f);
 	Handle<Texture> texture_handle;
@@ -32,7 +33,10 @@ struct Material {
 	Vector3 eta = Vector3(1.33f);
 	Vector3 k   = Vector3(1.0f);
 
-	float linear_roughness = 0.5f;
+	float           linear_roughness = 0.5f;
+	Handle<Texture> roughness_texture_handle; // Scales linear_roughness of Plastic, Dielectric and Conductor Materials
+
+	Handle<Texture> alpha_texture_handle; // Cuts out the surface where the opacity is below 0.5, see Integrator::init_alpha_masks
 
 	bool is_light() const {
 		return type == Type::LIGHT && Vector3::length_squared(emission) > 0.0f;
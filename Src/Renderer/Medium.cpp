@@ -0,0 +1,36 @@
+#include "Medium.h"
+
+#include "Util/ThreadPool.h"
+
+void MediumGrid::calc_majorants() {
+	majorant_width  = Math::divide_round_up(width,  MAJORANT_CELL_SIZE);
+	majorant_height = Math::divide_round_up(height, MAJORANT_CELL_SIZE);
+	majorant_depth  = Math::divide_round_up(depth,  MAJORANT_CELL_SIZE);
+
+	majorants.resize(majorant_width * majorant_height * majorant_depth);
+
+	// Trilinear interpolation inside a cell also reads the voxels directly surrounding it, these are included in its maximum
+	ThreadPool::parallel_for(majorant_depth, [this](int cell_z) {
+		for (int cell_y = 0; cell_y < majorant_height; cell_y++) {
+			for (int cell_x = 0; cell_x < majorant_width; cell_x++) {
+				int x_first = Math::max(cell_x * MAJORANT_CELL_SIZE - 1, 0);
+				int y_first = Math::max(cell_y * MAJORANT_CELL_SIZE - 1, 0);
+				int z_first = Math::max(cell_z * MAJORANT_CELL_SIZE - 1, 0);
+				int x_last  = Math::min((cell_x + 1) * MAJORANT_CELL_SIZE, width  - 1);
+				int y_last  = Math::min((cell_y + 1) * MAJORANT_CELL_SIZE, height - 1);
+				int z_last  = Math::min((cell_z + 1) * MAJORANT_CELL_SIZE, depth  - 1);
+
+				float majorant = 0.0f;
+				for (int z = z_first; z <= z_last; z++) {
+					for (int y = y_first; y <= y_last; y++) {
+						for (int x = x_first; x <= x_last; x++) {
+							majorant = Math::max(majorant, density[x + width * (y + height * z)]);
+						}
+					}
+				}
+
+				majorants[cell_x + majorant_width * (cell_y + majorant_height * cell_z)] = majorant;
+			}
+		}
+	});
+}
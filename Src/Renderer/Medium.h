@@ -1,14 +1,41 @@
 #pragma once
+#include "Core/Array.h"
 #include "Core/String.h"
 
 #include "Math/Math.h"
+#include "Math/AABB.h"
 #include "Math/Vector3.h"
 
 #include "CUDA/Common.h"
 
+// Density grid of a heterogeneous Medium, the sigmas of the Medium are scaled by the density (see CUDA/Volume.h)
+struct MediumGrid {
+	static constexpr int MAJORANT_CELL_SIZE = 8; // Voxels per axis of a cell of the majorant grid
+
+	int width  = 0;
+	int height = 0;
+	int depth  = 0;
+
+	AABB bounds = AABB::create_empty(); // World space
+
+	Array<float> density; // Indexed by x + width * (y + height * z)
+
+	int majorant_width  = 0;
+	int majorant_height = 0;
+	int majorant_depth  = 0;
+
+	Array<float> majorants; // Maximum density that trilinear interpolation can produce inside every cell
+
+	bool is_valid() const { return density.size() > 0; }
+
+	void calc_majorants();
+};
+
 struct Medium {
 	String name;
 
+	MediumGrid grid; // Only valid for heterogeneous Media
+
 	Vector3 C   = 1.0f; // Multi-scatter albedo
 	Vector3 mfp = 1.0f; // Mean free path
 
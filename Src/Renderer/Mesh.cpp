@@ -1,35 +1,108 @@
 #include "Mesh.h"
 
+#include <string.h>
+
+#include <emmintrin.h>
+
+#include "Config.h"
+
 #include "Renderer/Scene.h"
 
 Mesh::Mesh(String name, Handle<MeshData> mesh_data_handle, Handle<Material> material_handle) : name(std::move(name)), mesh_data_handle(mesh_data_handle), material_handle(material_handle) { }
 
 void Mesh::calc_aabb(const Scene & scene) {
+	// Computed once per MeshData when it is loaded, instances only transform it
 	const MeshData & mesh_data = scene.asset_manager.get_mesh_data(mesh_data_handle);
 
-	aabb_untransformed = AABB::create_empty();
-	for (int i = 0; i < mesh_data.triangles.size(); i++) {
-		aabb_untransformed.expand(mesh_data.triangles[i].get_aabb());
+	aabb_untransformed = mesh_data.aabb;
+	aabb_part_count    = mesh_data.aabb_part_count;
+	for (int i = 0; i < aabb_part_count; i++) {
+		aabb_parts[i] = mesh_data.aabb_parts[i];
 	}
+
+	aabb_dirty = true;
 }
 
-void Mesh::update() {
+// Transforming the box of every part separately bounds a rotated Mesh much tighter than transforming the box around all of them
+static AABB transform_aabb_parts(const Mesh & mesh, const Matrix4 & transform) {
+	if (mesh.aabb_part_count == 0) {
+		return AABB::transform(mesh.aabb_untransformed, transform);
+	}
+
+	// Same as AABB::transform, with the columns of the Transform in SSE registers that are shared by all parts. The fourth lane is unused
+	__m128 sign_mask = _mm_set1_ps(-0.0f);
+
+	__m128 column    [3];
+	__m128 column_abs[3];
+	for (int col = 0; col < 3; col++) {
+		column    [col] = _mm_setr_ps(transform(0, col), transform(1, col), transform(2, col), 0.0f);
+		column_abs[col] = _mm_andnot_ps(sign_mask, column[col]);
+	}
+	__m128 translation = _mm_setr_ps(transform(0, 3), transform(1, 3), transform(2, 3), 0.0f);
+
+	__m128 result_min = _mm_set1_ps( INFINITY);
+	__m128 result_max = _mm_set1_ps(-INFINITY);
+
+	for (int i = 0; i < mesh.aabb_part_count; i++) {
+		const AABB & part = mesh.aabb_parts[i];
+
+		Vector3 center = 0.5f * (part.min + part.max);
+		Vector3 extent = 0.5f * (part.max - part.min);
+
+		__m128 new_center = _mm_add_ps(translation, _mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(column[0], _mm_set1_ps(center.x)),
+			_mm_mul_ps(column[1], _mm_set1_ps(center.y))),
+			_mm_mul_ps(column[2], _mm_set1_ps(center.z))));
+		__m128 new_extent = _mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(column_abs[0], _mm_set1_ps(extent.x)),
+			_mm_mul_ps(column_abs[1], _mm_set1_ps(extent.y))),
+			_mm_mul_ps(column_abs[2], _mm_set1_ps(extent.z)));
+
+		result_min = _mm_min_ps(result_min, _mm_sub_ps(new_center, new_extent));
+		result_max = _mm_max_ps(result_max, _mm_add_ps(new_center, new_extent));
+	}
+
+	alignas(16) float min[4];
+	alignas(16) float max[4];
+	_mm_store_ps(min, result_min);
+	_mm_store_ps(max, result_max);
+
+	AABB result;
+	result.min = Vector3(min[0], min[1], min[2]);
+	result.max = Vector3(max[0], max[1], max[2]);
+	return result;
+}
+
+bool Mesh::update() {
+	Matrix4 transform_new = Matrix4::create_transform(position, rotation, scale);
+
+	// A Mesh that did not move this update and the previous one keeps its Transforms and AABB
+	bool transform_changed = memcmp(transform_new.cells, transform.cells, sizeof(transform.cells)) != 0;
+	if (!transform_changed && !has_motion() && !aabb_dirty) return false;
+
+	aabb_dirty = false;
+
 	// Update Transform
 	transform_prev = transform;
-
-	transform =
-		Matrix4::create_translation(position) *
-		Matrix4::create_rotation(rotation) *
-		Matrix4::create_scale(scale);
-	transform_inv =
-		Matrix4::create_scale(1.0f / scale) *
-		Matrix4::create_rotation(Quaternion::conjugate(rotation)) *
-		Matrix4::create_translation(-position);
+	transform      = transform_new;
+	transform_inv  = Matrix4::create_transform_inv(position, rotation, scale);
 
 	// Update AABB from Transform
-	aabb = AABB::transform(aabb_untransformed, transform);
+	aabb = transform_aabb_parts(*this, transform);
+
+	// With motion blur the Mesh can be hit anywhere in between its previous and current Transform,
+	// the TLAS is built over the union of both, which bounds the linear interpolation in between
+	if (gpu_config.enable_motion_blur && has_motion()) {
+		aabb = AABB::unify(aabb, transform_aabb_parts(*this, transform_prev));
+	}
 	aabb.fix_if_needed();
 	ASSERT(aabb.is_valid());
+
+	return true;
+}
+
+bool Mesh::has_motion() const {
+	return memcmp(transform.cells, transform_prev.cells, sizeof(transform.cells)) != 0;
 }
 
 bool Mesh::has_identity_transform() const {
@@ -13,6 +13,10 @@ struct Mesh {
 	AABB aabb_untransformed;
 	AABB aabb;
 
+	// Copied from the MeshData, the world space AABB is the union of the transformed parts
+	AABB aabb_parts[MeshData::MAX_AABB_PARTS];
+	int  aabb_part_count = 0;
+
 	Handle<MeshData> mesh_data_handle;
 
 	Vector3    position;
@@ -23,10 +27,14 @@ struct Mesh {
 
 	Handle<Material> material_handle;
 
+	unsigned visibility_mask = (1u << int(MeshVisibility::COUNT)) - 1; // Bit per MeshVisibility, visible to all Rays by default
+
 	Matrix4 transform;
 	Matrix4 transform_inv;
 	Matrix4 transform_prev;
 
+	bool aabb_dirty = true; // Set when the untransformed AABBs change, so that the next update recomputes the world space AABB
+
 	struct {
 		float weight = 0.0f;
 
@@ -38,9 +46,10 @@ struct Mesh {
 
 	void calc_aabb(const Scene & scene);
 
-	void update();
+	bool update(); // Returns false if neither the Transforms nor the AABB changed
 
 	bool has_identity_transform() const;
+	bool has_motion() const; // Whether the Transform changed since the previous update
 
 	Vector3 get_center() const { return aabb.get_center(); }
 
@@ -0,0 +1,121 @@
+#include "MeshData.h"
+
+#include "Config.h"
+
+#include "Util/ThreadPool.h"
+
+// Surface area that does not assert on flat boxes, planar Meshes have a zero extent along one axis
+static float aabb_half_area(const AABB & aabb) {
+	Vector3 extent = aabb.max - aabb.min;
+	return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+}
+
+void MeshData::calc_aabb() {
+	// The root of a binary BVH already bounds exactly the primitives it was built over,
+	// its top level Nodes are used as parts by repeatedly replacing the largest internal Node with its children
+	if (bvh && (cpu_config.bvh_type == BVHType::BVH || cpu_config.bvh_type == BVHType::SBVH)) {
+		const BVH2 * bvh2 = static_cast<const BVH2 *>(bvh.get());
+		if (bvh2->nodes.size() > 0) {
+			aabb = bvh2->nodes[0].aabb;
+
+			int part_nodes[MAX_AABB_PARTS] = { 0 };
+			int part_count = 1;
+
+			while (part_count < MAX_AABB_PARTS) {
+				int   split      = INVALID;
+				float split_area = -1.0f;
+
+				for (int i = 0; i < part_count; i++) {
+					const BVHNode2 & node = bvh2->nodes[part_nodes[i]];
+					if (!node.is_leaf() && aabb_half_area(node.aabb) > split_area) {
+						split      = i;
+						split_area = aabb_half_area(node.aabb);
+					}
+				}
+				if (split == INVALID) break;
+
+				int left = bvh2->nodes[part_nodes[split]].left;
+				part_nodes[split]        = left;
+				part_nodes[part_count++] = left + 1;
+			}
+
+			aabb_part_count = part_count;
+			for (int i = 0; i < part_count; i++) {
+				aabb_parts[i] = bvh2->nodes[part_nodes[i]].aabb;
+			}
+			return;
+		}
+	}
+
+	// The wide BVHs only store quantized child bounds, for those the primitives are reduced instead
+	// The parts are the bounds of the primitives in each octant around the center of the AABB
+	auto primitive_aabb = [this](int i) {
+		return has_curves() ? curves[i].get_aabb() : triangles[i].get_aabb();
+	};
+	int primitive_count = int(has_curves() ? curves.size() : triangles.size());
+
+	aabb = ThreadPool::parallel_reduce(0, primitive_count, 16384, AABB::create_empty(),
+		primitive_aabb,
+		[](const AABB & a, const AABB & b) { return AABB::unify(a, b); }
+	);
+
+	constexpr int GRAIN_SIZE = 16384;
+	static_assert(MAX_AABB_PARTS == 8);
+
+	Vector3 center = aabb.get_center();
+
+	int chunk_count = (primitive_count + GRAIN_SIZE - 1) / GRAIN_SIZE;
+	Array<AABB> chunk_parts(chunk_count * MAX_AABB_PARTS);
+
+	ThreadPool::parallel_for(0, primitive_count, GRAIN_SIZE, [&](int first, int last) {
+		AABB * parts = chunk_parts.data() + (first / GRAIN_SIZE) * MAX_AABB_PARTS;
+		for (int p = 0; p < MAX_AABB_PARTS; p++) {
+			parts[p] = AABB::create_empty();
+		}
+
+		for (int i = first; i < last; i++) {
+			AABB primitive = primitive_aabb(i);
+			Vector3 primitive_center = primitive.get_center();
+
+			int octant =
+				(primitive_center.x > center.x) |
+				(primitive_center.y > center.y) << 1 |
+				(primitive_center.z > center.z) << 2;
+			parts[octant] = AABB::unify(parts[octant], primitive);
+		}
+	});
+
+	aabb_part_count = 0;
+	for (int p = 0; p < MAX_AABB_PARTS; p++) {
+		AABB part = AABB::create_empty();
+		for (int c = 0; c < chunk_count; c++) {
+			part = AABB::unify(part, chunk_parts[c * MAX_AABB_PARTS + p]);
+		}
+		if (!part.is_empty()) {
+			aabb_parts[aabb_part_count++] = part;
+		}
+	}
+}
+
+// The edge length of an equilateral Triangle with the mean area of the Triangles, which is not skewed by a few long slivers like the mean edge length
+void MeshData::calc_triangle_size() {
+	if (has_curves() || triangles.size() == 0) {
+		triangle_size = 0.0f;
+		return;
+	}
+
+	float area = ThreadPool::parallel_reduce(0, int(triangles.size()), 16384, 0.0f,
+		[this](int i) {
+			const Vector3 & position_0 = triangles.vertices[triangles.indices[3 * i    ]].position;
+			const Vector3 & position_1 = triangles.vertices[triangles.indices[3 * i + 1]].position;
+			const Vector3 & position_2 = triangles.vertices[triangles.indices[3 * i + 2]].position;
+
+			return 0.5f * Vector3::length(Vector3::cross(position_1 - position_0, position_2 - position_0));
+		},
+		[](float a, float b) { return a + b; }
+	);
+
+	constexpr float EQUILATERAL_AREA = 0.4330127f; // sqrt(3) / 4
+
+	triangle_size = sqrtf(area / (float(triangles.size()) * EQUILATERAL_AREA));
+}
@@ -1,12 +1,52 @@
 #pragma once
 #include "Renderer/Triangle.h"
+#include "Renderer/Curve.h"
+#include "Renderer/Handle.h"
 
 #include "BVH/BVH.h"
 
 #include "Core/Array.h"
 #include "Core/OwnPtr.h"
+#include "Core/String.h"
+
+#include "CUDA/Common.h"
 
 struct MeshData {
-	Array<Triangle> triangles;
-	OwnPtr<BVH>     bvh;
+	IndexedTriangles triangles;
+	Array<Curve>     curves; // A MeshData contains either Triangles or Curves, never both
+	OwnPtr<BVH>      bvh;
+
+	BVHBuildPolicy bvh_build_policy = BVHBuildPolicy::GLOBAL; // Policy the BVH was built with, BVH files and BVH cache entries built with a different one are ignored
+
+	AABB aabb = AABB::create_empty(); // In object space, shared by every Mesh that instances this MeshData
+
+	// Groups of the primitives that together cover aabb, see MeshData::calc_aabb
+	// Transforming these individually gives much tighter world space bounds for rotated instances than transforming aabb itself
+	static constexpr int MAX_AABB_PARTS = 8;
+
+	AABB aabb_parts[MAX_AABB_PARTS];
+	int  aabb_part_count = 0;
+
+	// Simplified versions of this MeshData from fine to coarse, only loaded with cpu_config.enable_mesh_lods
+	static constexpr int MAX_LODS = MESH_LOD_MAX_LEVELS - 1;
+
+	Array<Handle<MeshData>> lods;
+
+	float triangle_size = 0.0f; // Typical edge length of the Triangles in object space, see calc_triangle_size
+
+	// Mesh file and BVH file the MeshData was loaded from, empty for generated MeshData and levels of detail
+	String filename;
+	String bvh_filename;
+
+	// Set once the Triangles and BLAS Nodes have been freed after uploading them, see AssetManager::release_host_data
+	// The BVH indices are kept, they map the Triangles of the GPUScene back to the Triangles of this MeshData
+	bool   is_released             = false;
+	size_t released_triangle_count = 0;
+
+	bool has_curves() const { return curves.size() > 0; }
+
+	size_t get_triangle_count() const { return is_released ? released_triangle_count : triangles.size(); }
+
+	void calc_aabb();
+	void calc_triangle_size();
 };
@@ -8,33 +8,49 @@
 #include "Assets/OBJLoader.h"
 #include "Assets/PLYLoader.h"
 #include "Assets/Mitsuba/MitsubaLoader.h"
+#include "Assets/SceneSnapshot.h"
 
 #include "Material.h"
 
 #include "Util/Util.h"
+#include "Util/ThreadPool.h"
 #include "Util/StringUtil.h"
 
 Scene::Scene(Allocator * allocator) : allocator(allocator), asset_manager(allocator), camera(Math::deg_to_rad(85.0f)), meshes(allocator) {
 	LinearAllocator<MEGABYTES(4)> load_allocator;
 
-	for (int i = 0; i < cpu_config.scene_filenames.size(); i++) {
-		const String & scene_filename = cpu_config.scene_filenames[i];
+	// Without any files (see Embed.h) the Meshes are added after construction
+	bool use_snapshot = cpu_config.enable_scene_snapshot && cpu_config.scene_filenames.size() > 0;
 
-		StringView file_extension = Util::get_file_extension(scene_filename.view());
-		if (file_extension.is_empty()) {
-			IO::print("ERROR: File '{}' has no file extension, cannot deduce file format!\n"_sv, scene_filename);
-			IO::exit(1);
+	String snapshot_filename = use_snapshot ? SceneSnapshot::get_snapshot_filename(cpu_config.scene_filenames[0].view(), nullptr) : String();
+
+	bool snapshot_loaded = use_snapshot && SceneSnapshot::try_to_load(snapshot_filename, *this);
+	if (!snapshot_loaded) {
+		for (int i = 0; i < cpu_config.scene_filenames.size(); i++) {
+			const String & scene_filename = cpu_config.scene_filenames[i];
+
+			StringView file_extension = Util::get_file_extension(scene_filename.view());
+			if (file_extension.is_empty()) {
+				IO::print("ERROR: File '{}' has no file extension, cannot deduce file format!\n"_sv, scene_filename);
+				IO::exit(1);
+			}
+
+			if (file_extension == "obj") {
+				add_mesh(scene_filename, asset_manager.add_mesh_data(scene_filename, OBJLoader::load));
+			} else if (file_extension == "ply") {
+				add_mesh(scene_filename, asset_manager.add_mesh_data(scene_filename, PLYLoader::load));
+			} else if (file_extension == "xml") {
+				MitsubaLoader::load(scene_filename, allocator, *this);
+			} else {
+				IO::print("ERROR: '{}' file format is not supported!\n"_sv, file_extension);
+				IO::exit(1);
+			}
 		}
 
-		if (file_extension == "obj") {
-			add_mesh(scene_filename, asset_manager.add_mesh_data(scene_filename, OBJLoader::load));
-		} else if (file_extension == "ply") {
-			add_mesh(scene_filename, asset_manager.add_mesh_data(scene_filename, PLYLoader::load));
-		} else if (file_extension == "xml") {
-			MitsubaLoader::load(scene_filename, allocator, *this);
-		} else {
-			IO::print("ERROR: '{}' file format is not supported!\n"_sv, file_extension);
-			IO::exit(1);
+		if (use_snapshot) {
+			// NOTE: The snapshot needs every asset, so Textures cannot be uploaded while others are still loading on this run
+			asset_manager.wait_until_loaded();
+			SceneSnapshot::save(snapshot_filename, *this);
 		}
 	}
 
@@ -66,8 +82,12 @@ void Scene::check_materials() {
 	}
 }
 
-void Scene::update(float delta) {
-	for (int i = 0; i < meshes.size(); i++) {
-		meshes[i].update();
-	}
+// Large instance counts are updated in parallel, Meshes are independent of each other
+static constexpr int MESH_UPDATE_GRAIN_SIZE = 1024;
+
+int Scene::update(float delta) {
+	return ThreadPool::parallel_reduce(0, int(meshes.size()), MESH_UPDATE_GRAIN_SIZE, 0,
+		[this](int i)    { return int(meshes[i].update()); },
+		[](int a, int b) { return a + b; }
+	);
 }
@@ -28,5 +28,5 @@ struct Scene {
 
 	void check_materials();
 
-	void update(float delta);
+	int update(float delta); // Returns the number of Meshes whose Transform or AABB changed
 };
@@ -9,6 +9,11 @@
 #include "Core/IO.h"
 #include "Core/String.h"
 
+#include "Math/Math.h"
+
+// The distribution used for importance sampling is at most this wide, to bound its memory footprint
+static constexpr int SKY_DISTRIBUTION_MAX_WIDTH = 512;
+
 void Sky::load(const String & filename) {
 	int channels;
 	float * hdr = stbi_loadf(filename.data(), &width, &height, &channels, STBI_rgb);
@@ -33,4 +38,51 @@ void Sky::load(const String & filename) {
 	}
 
 	stbi_image_free(hdr);
+
+	calc_distribution();
+}
+
+void Sky::calc_distribution() {
+	int downsample_factor = Math::divide_round_up(width, SKY_DISTRIBUTION_MAX_WIDTH);
+
+	distribution_width  = Math::divide_round_up(width,  downsample_factor);
+	distribution_height = Math::divide_round_up(height, downsample_factor);
+
+	int cell_count = distribution_width * distribution_height;
+
+	Array<double> weights(cell_count);
+	double        total_weight = 0.0;
+
+	for (int j = 0; j < distribution_height; j++) {
+		// The equirectangular mapping compresses rows near the poles, weigh by the solid angle of the row
+		float theta     = (float(j) + 0.5f) * PI / float(distribution_height);
+		float sin_theta = sinf(theta);
+
+		for (int i = 0; i < distribution_width; i++) {
+			double luminance   = 0.0;
+			int    pixel_count = 0;
+
+			for (int y = j * downsample_factor; y < Math::min((j + 1) * downsample_factor, height); y++) {
+				for (int x = i * downsample_factor; x < Math::min((i + 1) * downsample_factor, width); x++) {
+					const Vector4 & colour = data[x + y * width];
+					luminance += Math::luminance(colour.x, colour.y, colour.z);
+					pixel_count++;
+				}
+			}
+
+			double weight = pixel_count > 0 ? sin_theta * luminance / double(pixel_count) : 0.0;
+
+			weights[i + j * distribution_width] = weight;
+			total_weight += weight;
+		}
+	}
+
+	distribution_alias_table.resize(cell_count);
+	distribution_pdf        .resize(cell_count);
+
+	AliasTable::build(weights.data(), cell_count, distribution_alias_table.data());
+
+	for (int i = 0; i < cell_count; i++) {
+		distribution_pdf[i] = total_weight > 0.0 ? float(weights[i] * double(cell_count) / total_weight) : 1.0f;
+	}
 }
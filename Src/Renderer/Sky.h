@@ -3,11 +3,22 @@
 
 #include "Core/String.h"
 
+#include "Util/AliasTable.h"
+
 struct Sky {
 	Array<Vector4> data;
 	int            width;
 	int            height;
 	float          scale = 1.0f;
 
+	// Distribution proportional to the luminance of a downsampled version of the Sky, used to importance sample it
+	int                      distribution_width;
+	int                      distribution_height;
+	Array<AliasTable::Entry> distribution_alias_table;
+	Array<float>             distribution_pdf; // Pdf of every cell of the distribution with respect to the uv domain of the Sky
+
 	void load(const String & file_name);
+
+private:
+	void calc_distribution();
 };
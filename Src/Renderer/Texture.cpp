@@ -8,6 +8,10 @@ CUarray_format Texture::get_cuda_array_format() const {
 		case Format::BC1:  return CUarray_format::CU_AD_FORMAT_UNSIGNED_INT32;
 		case Format::BC2:  return CUarray_format::CU_AD_FORMAT_UNSIGNED_INT32;
 		case Format::BC3:  return CUarray_format::CU_AD_FORMAT_UNSIGNED_INT32;
+		case Format::BC4:  return CUarray_format::CU_AD_FORMAT_UNSIGNED_INT32;
+		case Format::BC5:  return CUarray_format::CU_AD_FORMAT_UNSIGNED_INT32;
+		case Format::BC6H: return CUarray_format::CU_AD_FORMAT_UNSIGNED_INT32;
+		case Format::BC7:  return CUarray_format::CU_AD_FORMAT_UNSIGNED_INT32;
 		case Format::RGBA: return CUarray_format::CU_AD_FORMAT_UNSIGNED_INT8;
 		default: ASSERT_UNREACHABLE();
 	}
@@ -18,24 +22,32 @@ CUresourceViewFormat Texture::get_cuda_resource_view_format() const {
 		case Texture::Format::BC1:  return CUresourceViewFormat::CU_RES_VIEW_FORMAT_UNSIGNED_BC1;
 		case Texture::Format::BC2:  return CUresourceViewFormat::CU_RES_VIEW_FORMAT_UNSIGNED_BC2;
 		case Texture::Format::BC3:  return CUresourceViewFormat::CU_RES_VIEW_FORMAT_UNSIGNED_BC3;
+		case Texture::Format::BC4:  return CUresourceViewFormat::CU_RES_VIEW_FORMAT_UNSIGNED_BC4;
+		case Texture::Format::BC5:  return CUresourceViewFormat::CU_RES_VIEW_FORMAT_UNSIGNED_BC5;
+		case Texture::Format::BC6H: return CUresourceViewFormat::CU_RES_VIEW_FORMAT_UNSIGNED_BC6H;
+		case Texture::Format::BC7:  return CUresourceViewFormat::CU_RES_VIEW_FORMAT_UNSIGNED_BC7;
 		case Texture::Format::RGBA: return CUresourceViewFormat::CU_RES_VIEW_FORMAT_UINT_4X8;
 		default: ASSERT_UNREACHABLE();
 	}
 }
 
-int Texture::get_cuda_resource_view_width() const {
+int Texture::get_cuda_resource_view_width(int mip_level) const {
+	int level_width = Math::max(width >> mip_level, 1);
+
 	if (format == Format::RGBA) {
-		return width;
+		return level_width;
 	} else {
-		return width * 4;
+		return level_width * 4;
 	}
 }
 
-int Texture::get_cuda_resource_view_height() const {
+int Texture::get_cuda_resource_view_height(int mip_level) const {
+	int level_height = Math::max(height >> mip_level, 1);
+
 	if (format == Format::RGBA) {
-		return height;
+		return level_height;
 	} else {
-		return height * 4;
+		return level_height * 4;
 	}
 }
 
@@ -48,3 +60,20 @@ int Texture::get_width_in_bytes(int mip_level) const {
 		return level_width * channels * 4;
 	}
 }
+
+int Texture::get_mip_level_count() const {
+	if (!mipmaps_on_gpu) return mip_levels();
+
+	int level_count = 1;
+
+	int level_width  = width;
+	int level_height = height;
+	while (level_width > 1 || level_height > 1) {
+		level_count++;
+
+		if (level_width  > 1) level_width  /= 2;
+		if (level_height > 1) level_height /= 2;
+	}
+
+	return level_count;
+}
@@ -13,25 +13,47 @@ struct Texture {
 
 	Array<unsigned char> data;
 
+	String filename; // Empty if the Texture was not loaded from a file, or failed to load
+	bool   is_released = false; // data has been freed after uploading it, see AssetManager::release_host_data
+
+	// DDS Textures are not read into data, their Mip levels are uploaded straight from a mapping of the file, see TextureLoader::load_dds
+	// The file is mapped again every time the Texture is (re)created, so it only occupies the page cache in between
+	String mapped_filename;
+	size_t mapped_offset = 0; // Of Mip level 0, in bytes from the start of the file
+	size_t mapped_size   = 0;
+
 	enum struct Format {
 		BC1,
 		BC2,
 		BC3,
+		BC4,  // Single channel
+		BC5,  // Two channels
+		BC6H, // Unsigned half precision RGB
+		BC7,
 		RGBA
 	} format = Format::RGBA;
 
-	int channels;
+	int channels; // For Block Compressed formats the size of a block in units of 4 bytes (2 for 8 byte blocks, 4 for 16 byte blocks)
 	int width, height;
 
 	Array<int> mip_offsets; // Offsets in bytes
 
+	bool mipmaps_on_gpu = false; // Only Mip level 0 is stored in data, the remaining levels are generated by Integrator::generate_mipmaps
+	bool is_srgb        = false; // The RGB channels of data are sRGB encoded and decoded by the hardware when sampled, see cpu_config.enable_srgb_textures
+
 	CUarray_format       get_cuda_array_format()         const;
 	CUresourceViewFormat get_cuda_resource_view_format() const;
 
-	int get_cuda_resource_view_width()  const;
-	int get_cuda_resource_view_height() const;
+	int get_cuda_resource_view_width (int mip_level = 0) const;
+	int get_cuda_resource_view_height(int mip_level = 0) const;
 
 	int get_width_in_bytes(int mip_level = 0) const;
 
 	inline int mip_levels() const { return int(mip_offsets.size()); }
+
+	inline bool   is_mapped()     const { return !mapped_filename.is_empty(); }
+	inline size_t get_data_size() const { return is_mapped() ? mapped_size : data.size(); }
+
+	// Number of Mip levels of the CUDA array, includes the levels that are generated on the GPU
+	int get_mip_level_count() const;
 };
@@ -0,0 +1,59 @@
+#include "Triangle.h"
+
+#include "Core/SwissHashMap.h"
+#include "Core/Allocators/LargePageAllocator.h"
+
+#include "Util/ThreadPool.h"
+
+struct VertexEqual {
+	bool operator()(const Vertex & a, const Vertex & b) const {
+		return memcmp(&a, &b, sizeof(Vertex)) == 0;
+	}
+};
+
+IndexedTriangles IndexedTriangles::weld(const Array<Triangle> & triangles) {
+	IndexedTriangles result = { };
+	result.vertices = Array<Vertex>(LargePageAllocator::select(nullptr));
+	result.indices  = Array<int>   (LargePageAllocator::select(nullptr));
+	result.indices.resize(3 * triangles.size());
+
+	SwissHashMap<Vertex, int, Hash<Vertex>, VertexEqual> vertex_indices(nullptr, triangles.size());
+
+	auto add_vertex = [&](const Vector3 & position, const Vector3 & normal, const Vector2 & tex_coord) {
+		Vertex vertex = { position, normal, tex_coord };
+
+		int * index = vertex_indices.try_get(vertex);
+		if (index) return *index;
+
+		int new_index = int(result.vertices.size());
+		result.vertices.push_back(vertex);
+		vertex_indices.insert(vertex, new_index);
+		return new_index;
+	};
+
+	for (size_t i = 0; i < triangles.size(); i++) {
+		const Triangle & triangle = triangles[i];
+
+		result.indices[3 * i    ] = add_vertex(triangle.position_0, triangle.normal_0, triangle.tex_coord_0);
+		result.indices[3 * i + 1] = add_vertex(triangle.position_1, triangle.normal_1, triangle.tex_coord_1);
+		result.indices[3 * i + 2] = add_vertex(triangle.position_2, triangle.normal_2, triangle.tex_coord_2);
+	}
+
+	// Trim the capacity left over from growing, typical closed meshes have about half as many Vertices as Triangles
+	// The copy is made on the ThreadPool, which spreads its pages over the NUMA nodes of the workers, see ThreadPool::parallel_init
+	Array<Vertex> vertices = std::move(result.vertices);
+	ThreadPool::parallel_init(result.vertices, vertices.size(), [&vertices](int i) { return vertices[i]; });
+	return result;
+}
+
+void IndexedTriangles::update_vertices(const Array<Triangle> & triangles) {
+	ASSERT(triangles.size() == size());
+
+	for (size_t i = 0; i < triangles.size(); i++) {
+		const Triangle & triangle = triangles[i];
+
+		vertices[indices[3 * i    ]] = { triangle.position_0, triangle.normal_0, triangle.tex_coord_0 };
+		vertices[indices[3 * i + 1]] = { triangle.position_1, triangle.normal_1, triangle.tex_coord_1 };
+		vertices[indices[3 * i + 2]] = { triangle.position_2, triangle.normal_2, triangle.tex_coord_2 };
+	}
+}
@@ -1,4 +1,5 @@
 #pragma once
+#include "Core/Array.h"
 #include "Core/Constructors.h"
 
 #include "Math/Math.h"
@@ -101,3 +102,44 @@ struct Triangle {
 		return AABB::from_points(vertices, 3);
 	}
 };
+
+struct Vertex {
+	Vector3 position;
+	Vector3 normal;
+	Vector2 tex_coord;
+};
+
+// Triangles that share their Vertices, every Triangle is stored as three indices into the Vertex buffer
+// Indexing returns the Triangle by value, so that builders and other code written against Array<Triangle> can consume it directly
+struct IndexedTriangles {
+	Array<Vertex> vertices;
+	Array<int>    indices; // Three per Triangle
+
+	size_t size() const { return indices.size() / 3; }
+
+	Triangle operator[](size_t index) const {
+		const Vertex & vertex_0 = vertices[indices[3 * index    ]];
+		const Vertex & vertex_1 = vertices[indices[3 * index + 1]];
+		const Vertex & vertex_2 = vertices[indices[3 * index + 2]];
+
+		// NOTE: Bypasses the constructor of Triangle, normals and winding order were already fixed before welding
+		Triangle triangle;
+		triangle.position_0  = vertex_0.position;
+		triangle.position_1  = vertex_1.position;
+		triangle.position_2  = vertex_2.position;
+		triangle.normal_0    = vertex_0.normal;
+		triangle.normal_1    = vertex_1.normal;
+		triangle.normal_2    = vertex_2.normal;
+		triangle.tex_coord_0 = vertex_0.tex_coord;
+		triangle.tex_coord_1 = vertex_1.tex_coord;
+		triangle.tex_coord_2 = vertex_2.tex_coord;
+		return triangle;
+	}
+
+	// Merges Vertices that are bitwise identical, the order of the Triangles is preserved
+	static IndexedTriangles weld(const Array<Triangle> & triangles);
+
+	// Replaces the Vertex data by that of the same number of Triangles (e.g. the next frame of a simulation cache), keeping the indices
+	// A Vertex shared by multiple Triangles takes the data of the last Triangle that references it
+	void update_vertices(const Array<Triangle> & triangles);
+};
@@ -2,6 +2,8 @@
 
 layout (location = 0) out vec2 uv;
 
+uniform vec2 uv_scale; // The frame buffer texture may be larger than the Window, see Window::resize_frame_buffer
+
 // Based on: https://rauwendaal.net/2014/06/14/rendering-a-screen-covering-triangle-in-opengl/
 void main(void) {
 	float x = float((gl_VertexID & 1) << 2) - 1.0f;
@@ -9,6 +11,7 @@ void main(void) {
 
 	uv.x = (x + 1.0f) * 0.5f;
 	uv.y = (y + 1.0f) * 0.5f;
+	uv *= uv_scale;
 
 	gl_Position = vec4(x, y, 0.0f, 1.0f);
 }
@@ -0,0 +1,10 @@
+#version 450
+
+layout (location = 0) out ivec2 out_ids;
+
+uniform int mesh_id;         // TLAS slot of the Mesh
+uniform int triangle_offset; // Offset of the MeshData into the aggregated Triangles, before BVH reordering
+
+void main(void) {
+	out_ids = ivec2(mesh_id, triangle_offset + gl_PrimitiveID);
+}
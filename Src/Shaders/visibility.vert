@@ -0,0 +1,11 @@
+#version 450
+
+layout (location = 0) in vec3 in_position;
+
+uniform mat4 transform; // Object space to clip space
+uniform vec2 jitter;    // Sub-pixel offset in NDC, moves the sample point of every Pixel onto the jittered primary Ray
+
+void main(void) {
+	gl_Position = transform * vec4(in_position, 1.0f);
+	gl_Position.xy += jitter * gl_Position.w;
+}
@@ -0,0 +1,52 @@
+#include "AliasTable.h"
+
+void AliasTable::build(const double * weights, int count, Entry * entries, int index_offset, Allocator * allocator) {
+	if (count == 0) return;
+
+	double total_weight = 0.0;
+	for (int i = 0; i < count; i++) {
+		total_weight += weights[i];
+	}
+
+	// Weights scaled such that the average is 1
+	Array<double> scaled(count, allocator);
+	Array<int>    small (allocator);
+	Array<int>    large (allocator);
+	small.reserve(count);
+	large.reserve(count);
+
+	for (int i = 0; i < count; i++) {
+		scaled[i] = total_weight > 0.0 ? weights[i] * double(count) / total_weight : 1.0;
+
+		if (scaled[i] < 1.0) {
+			small.push_back(i);
+		} else {
+			large.push_back(i);
+		}
+	}
+
+	// Pair every under full entry with an over full one, the over full entry donates the remainder
+	while (small.size() > 0 && large.size() > 0) {
+		int index_small = small.back(); small.pop_back();
+		int index_large = large.back();
+
+		entries[index_small].probability = float(scaled[index_small]);
+		entries[index_small].alias       = index_offset + index_large;
+
+		scaled[index_large] -= 1.0 - scaled[index_small];
+		if (scaled[index_large] < 1.0) {
+			large.pop_back();
+			small.push_back(index_large);
+		}
+	}
+
+	// Whatever remains is full up to rounding errors
+	for (size_t i = 0; i < large.size(); i++) {
+		entries[large[i]].probability = 1.0f;
+		entries[large[i]].alias       = index_offset + large[i];
+	}
+	for (size_t i = 0; i < small.size(); i++) {
+		entries[small[i]].probability = 1.0f;
+		entries[small[i]].alias       = index_offset + small[i];
+	}
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include "Core/Array.h"
+
+// Walker's alias method, allows a discrete distribution to be sampled in O(1)
+// Every entry is picked uniformly, after which a second uniform decides between the entry itself and its alias
+namespace AliasTable {
+	struct alignas(8) Entry {
+		float probability; // Probability of keeping this entry rather than taking its alias
+		int   alias;
+	};
+
+	// Fills count Entries based on the given (unnormalized) weights
+	// The alias indices are offset by index_offset, so that multiple tables can share a single array
+	void build(const double * weights, int count, Entry * entries, int index_offset = 0, Allocator * allocator = nullptr);
+}
@@ -0,0 +1,326 @@
+#include "BVHReport.h"
+
+#include <stdio.h>
+
+#include "Core/IO.h"
+#include "Core/Timer.h"
+#include "Core/Random.h"
+#include "Core/Allocators/AlignedAllocator.h"
+
+#include "Assets/OBJLoader.h"
+#include "Assets/PLYLoader.h"
+
+#include "BVH/Builders/SAHBuilder.h"
+#include "BVH/Builders/BinnedSAHBuilder.h"
+#include "BVH/Builders/SBVHBuilder.h"
+#include "BVH/Builders/BVHPartitions.h"
+#include "BVH/Converters/BVH8Converter.h"
+#include "BVH/BVHOptimizer.h"
+#include "BVH/BVHTraversal.h"
+
+#include "Util/StringUtil.h"
+
+enum struct Builder {
+	SAH,
+	SBVH,
+	BINNED,
+
+	COUNT
+};
+
+static constexpr const char * builder_names[] = { "sah", "sbvh", "binned" };
+static_assert(Util::array_count(builder_names) == int(Builder::COUNT));
+
+struct Row {
+	Builder builder;
+	bool    optimized;
+
+	float sah_cost_node;
+	float sah_cost_leaf;
+	float sbvh_alpha;
+
+	double build_time;    // Milliseconds
+	double optimize_time; // Milliseconds
+	double memory;        // MB
+
+	size_t node_count;
+	size_t leaf_count;
+	float  sah_cost;
+	float  duplication_ratio; // References per Triangle, only the SBVH duplicates references
+
+	double bvh8_convert_time; // Milliseconds
+	size_t bvh8_node_count;
+
+	float ray_aabb_tests;     // Averages over the Rays of generate_rays
+	float ray_triangle_tests;
+};
+
+template<typename T>
+static size_t array_bytes(const Array<T> & array) {
+	return array.capacity * sizeof(T);
+}
+
+static double to_milliseconds(size_t microseconds) {
+	return double(microseconds) / 1000.0;
+}
+
+static double to_megabytes(size_t bytes) {
+	return double(bytes) / double(MEGABYTES(1));
+}
+
+// NOTE: The builders allocate with the default heap, so instead of a true heap high water mark the memory is
+// the size of the buffers the builder and its BVH hold once construction finishes. For the SBVH this excludes
+// the temporary copies of the subtrees that are built on the ThreadPool
+static BVH2 build(Builder builder, const IndexedTriangles & triangles, Row & row) {
+	BVH2 bvh = BVH2(AlignedAllocator<64>::instance());
+
+	size_t triangle_count = triangles.size();
+	size_t bits_bytes     = (triangle_count + 7) / 8;
+
+	Timer timer;
+	timer.start();
+
+	if (builder == Builder::SBVH) {
+		SBVHBuilder sbvh_builder(bvh, triangle_count);
+		sbvh_builder.build(triangles);
+
+		row.build_time = to_milliseconds(timer.stop());
+		row.memory     = to_megabytes(
+			array_bytes(sbvh_builder.indices[0]) +
+			array_bytes(sbvh_builder.indices[1]) +
+			array_bytes(sbvh_builder.indices[2]) +
+			array_bytes(sbvh_builder.sah) +
+			bits_bytes
+		);
+	} else if (builder == Builder::BINNED) {
+		BinnedSAHBuilder binned_builder(bvh, triangle_count);
+		binned_builder.build(triangles);
+
+		row.build_time = to_milliseconds(timer.stop());
+		row.memory     = to_megabytes(
+			array_bytes(binned_builder.indices) +
+			array_bytes(binned_builder.primitive_aabbs) +
+			array_bytes(binned_builder.primitive_centers)
+		);
+	} else {
+		SAHBuilder sah_builder(bvh, triangle_count);
+		sah_builder.build(triangles);
+
+		row.build_time = to_milliseconds(timer.stop());
+		row.memory     = to_megabytes(
+			array_bytes(sah_builder.indices_x) +
+			array_bytes(sah_builder.indices_y) +
+			array_bytes(sah_builder.indices_z) +
+			array_bytes(sah_builder.scratch) +
+			bits_bytes
+		);
+	}
+
+	row.memory += to_megabytes(array_bytes(bvh.nodes) + array_bytes(bvh.indices));
+
+	return bvh;
+}
+
+static constexpr int RAY_COUNT = 1 << 16;
+
+// Rays with origins uniformly distributed inside the bounds of the Mesh and uniformly distributed directions
+// The seed is fixed, so that all builds of the same Mesh are traced with the same Rays
+static Array<BVHTraversal::Ray> generate_rays(const IndexedTriangles & triangles) {
+	AABB bounds = AABB::create_empty();
+	for (size_t i = 0; i < triangles.vertices.size(); i++) {
+		bounds.expand(triangles.vertices[i].position);
+	}
+
+	RNG rng(12345);
+
+	Array<BVHTraversal::Ray> rays(RAY_COUNT);
+	for (int i = 0; i < RAY_COUNT; i++) {
+		Vector3 origin = bounds.min + (bounds.max - bounds.min) * Vector3(rng.get_float(), rng.get_float(), rng.get_float());
+
+		float cos_theta = 1.0f - 2.0f * rng.get_float();
+		float sin_theta = sqrtf(fmaxf(0.0f, 1.0f - cos_theta * cos_theta));
+		float phi       = TWO_PI * rng.get_float();
+
+		rays[i].origin    = origin;
+		rays[i].direction = Vector3(sin_theta * cosf(phi), sin_theta * sinf(phi), cos_theta);
+	}
+	return rays;
+}
+
+// Fills in the statistics of the finished BVH, including the time to convert it into a BVH8 and the traversal cost of the Rays
+static void measure(const BVH2 & bvh, const IndexedTriangles & triangles, const Array<BVHTraversal::Ray> & rays, Row & row) {
+	size_t triangle_count = triangles.size();
+
+	row.node_count = 0;
+	row.leaf_count = 0;
+
+	for (size_t i = 0; i < bvh.nodes.size(); i++) {
+		if (i == 1) continue; // Dummy
+
+		row.node_count++;
+		if (bvh.nodes[i].is_leaf()) row.leaf_count++;
+	}
+
+	row.sah_cost          = bvh.sah_cost();
+	row.duplication_ratio = float(bvh.indices.size()) / float(triangle_count);
+
+	BVH8 bvh8;
+
+	Timer timer;
+	timer.start();
+
+	BVH8Converter(bvh8, bvh).convert();
+
+	row.bvh8_convert_time = to_milliseconds(timer.stop());
+	row.bvh8_node_count   = bvh8.nodes.size();
+
+	Array<BVHTraversal::Hit> hits(rays.size());
+	BVHTraversal::intersect(bvh, triangles, rays.data(), hits.data(), int(rays.size()));
+
+	size_t num_aabb_tests     = 0;
+	size_t num_triangle_tests = 0;
+	for (size_t i = 0; i < hits.size(); i++) {
+		num_aabb_tests     += hits[i].num_aabb_tests;
+		num_triangle_tests += hits[i].num_triangle_tests;
+	}
+
+	row.ray_aabb_tests     = float(double(num_aabb_tests)     / double(rays.size()));
+	row.ray_triangle_tests = float(double(num_triangle_tests) / double(rays.size()));
+}
+
+static void write_row(FILE * file, StringView mesh_filename, size_t triangle_count, const Row & row) {
+	fprintf(file, "%.*s,%zu,%s,%i,%g,%g,%g,%.3f,%.3f,%.3f,%zu,%zu,%.4f,%.4f,%.3f,%zu,%.2f,%.2f\n",
+		int(mesh_filename.size()), mesh_filename.data(),
+		triangle_count,
+		builder_names[int(row.builder)],
+		int(row.optimized),
+		row.sah_cost_node,
+		row.sah_cost_leaf,
+		row.sbvh_alpha,
+		row.build_time,
+		row.optimize_time,
+		row.memory,
+		row.node_count,
+		row.leaf_count,
+		row.sah_cost,
+		row.duplication_ratio,
+		row.bvh8_convert_time,
+		row.bvh8_node_count,
+		row.ray_aabb_tests,
+		row.ray_triangle_tests
+	);
+	fflush(file);
+}
+
+bool BVHReport::run(const String & filename, const Array<String> & mesh_filenames, const Sweep & sweep) {
+	FILE * file = nullptr;
+#ifdef _WIN32
+	fopen_s(&file, filename.data(), "wb");
+#else
+	file = fopen(filename.data(), "wb");
+#endif
+
+	if (!file) {
+		IO::print("ERROR: Unable to write BVH report to '{}'!\n"_sv, filename);
+		return false;
+	}
+
+	fprintf(file, "mesh,triangles,builder,optimized,sah_cost_node,sah_cost_leaf,sbvh_alpha,build_time_ms,optimize_time_ms,memory_mb,node_count,leaf_count,sah_cost,duplication_ratio,bvh8_convert_time_ms,bvh8_node_count,ray_aabb_tests,ray_triangle_tests\n");
+
+	// SAH costs are always evaluated with the constants the program was launched with, so that the rows of a sweep are comparable
+	const float sah_cost_node_base = cpu_config.sah_cost_node;
+	const float sah_cost_leaf_base = cpu_config.sah_cost_leaf;
+	const float sbvh_alpha_base    = cpu_config.sbvh_alpha;
+
+	Array<float> sah_cost_nodes = sweep.sah_cost_node.size() > 0 ? sweep.sah_cost_node : Array<float> { sah_cost_node_base };
+	Array<float> sah_cost_leafs = sweep.sah_cost_leaf.size() > 0 ? sweep.sah_cost_leaf : Array<float> { sah_cost_leaf_base };
+	Array<float> sbvh_alphas    = sweep.sbvh_alpha   .size() > 0 ? sweep.sbvh_alpha    : Array<float> { sbvh_alpha_base };
+
+	for (size_t m = 0; m < mesh_filenames.size(); m++) {
+		const String & mesh_filename = mesh_filenames[m];
+
+		StringView file_extension = Util::get_file_extension(mesh_filename.view());
+
+		Array<Triangle> loaded_triangles;
+		if (file_extension == "obj") {
+			loaded_triangles = OBJLoader::load(mesh_filename, nullptr);
+		} else if (file_extension == "ply") {
+			loaded_triangles = PLYLoader::load(mesh_filename, nullptr);
+		} else {
+			IO::print("WARNING: BVH report only supports OBJ and PLY files, skipping '{}'\n"_sv, mesh_filename);
+			continue;
+		}
+
+		if (loaded_triangles.size() == 0) {
+			IO::print("WARNING: '{}' contains no Triangles, skipping\n"_sv, mesh_filename);
+			continue;
+		}
+
+		IndexedTriangles triangles = IndexedTriangles::weld(loaded_triangles);
+
+		Array<BVHTraversal::Ray> rays = generate_rays(triangles);
+
+		for (size_t n = 0; n < sah_cost_nodes.size(); n++) {
+			for (size_t l = 0; l < sah_cost_leafs.size(); l++) {
+				for (size_t a = 0; a < sbvh_alphas.size(); a++) {
+					for (int b = 0; b < int(Builder::COUNT); b++) {
+						Builder builder = Builder(b);
+
+						// Only the SBVH depends on alpha, the other builders only need to be built once per pair of costs
+						if (builder != Builder::SBVH && a > 0) continue;
+
+						IO::print("BVH report: {} {} node={} leaf={} alpha={}\n"_sv, mesh_filename, builder_names[b], sah_cost_nodes[n], sah_cost_leafs[l], sbvh_alphas[a]);
+
+						Row row = { };
+						row.builder       = builder;
+						row.sah_cost_node = sah_cost_nodes[n];
+						row.sah_cost_leaf = sah_cost_leafs[l];
+						row.sbvh_alpha    = builder == Builder::SBVH ? sbvh_alphas[a] : 1.0f;
+
+						cpu_config.sah_cost_node = row.sah_cost_node;
+						cpu_config.sah_cost_leaf = row.sah_cost_leaf;
+						cpu_config.sbvh_alpha    = sbvh_alphas[a];
+
+						BVH2 bvh = build(builder, triangles, row);
+
+						cpu_config.sah_cost_node = sah_cost_node_base;
+						cpu_config.sah_cost_leaf = sah_cost_leaf_base;
+
+						measure(bvh, triangles, rays, row);
+						write_row(file, mesh_filename.view(), triangles.size(), row);
+
+						if (cpu_config.enable_bvh_optimization) {
+							Row row_optimized = row;
+							row_optimized.optimized = true;
+
+							cpu_config.sah_cost_node = row.sah_cost_node;
+							cpu_config.sah_cost_leaf = row.sah_cost_leaf;
+
+							Timer timer;
+							timer.start();
+
+							BVHOptimizer::optimize(bvh);
+
+							row_optimized.optimize_time = to_milliseconds(timer.stop());
+
+							cpu_config.sah_cost_node = sah_cost_node_base;
+							cpu_config.sah_cost_leaf = sah_cost_leaf_base;
+
+							measure(bvh, triangles, rays, row_optimized);
+							write_row(file, mesh_filename.view(), triangles.size(), row_optimized);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	cpu_config.sah_cost_node = sah_cost_node_base;
+	cpu_config.sah_cost_leaf = sah_cost_leaf_base;
+	cpu_config.sbvh_alpha    = sbvh_alpha_base;
+
+	fclose(file);
+
+	IO::print("Written BVH report to '{}'\n"_sv, filename);
+	return true;
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include "Core/Array.h"
+#include "Core/String.h"
+
+// Builds the BLAS of every Mesh in cpu_config.scene_filenames (OBJ or PLY) with the SAH, binned SAH and SBVH builders
+// for every combination of the swept SAH Node cost, SAH Leaf cost and SBVH alpha, and writes one CSV row per build.
+// Run with --bvh-report (see run_bvh_report in Main.cpp), if BVH optimization is enabled every build is also optimized
+namespace BVHReport {
+	struct Sweep {
+		Array<float> sah_cost_node; // If any of these are empty the value of cpu_config is used
+		Array<float> sah_cost_leaf;
+		Array<float> sbvh_alpha;
+	};
+
+	bool run(const String & filename, const Array<String> & mesh_filenames, const Sweep & sweep);
+}
@@ -0,0 +1,367 @@
+#include "Benchmark.h"
+
+#include <stdio.h>
+
+#include "Core/IO.h"
+#include "Core/Parser.h"
+
+#include "Math/Math.h"
+
+#include "Util.h"
+
+// Remainder of the current line, without trailing whitespace or comment
+static StringView parse_line(Parser & parser) {
+	parser.skip_whitespace();
+
+	const char * start = parser.cur;
+	parser.skip_until('\n');
+
+	const char * end = parser.cur;
+	for (const char * c = start; c < end; c++) {
+		if (*c == '#') {
+			end = c;
+			break;
+		}
+	}
+	while (end > start && (is_whitespace(end[-1]) || end[-1] == '\r')) end--;
+
+	return StringView { start, end };
+}
+
+bool Benchmark::load_definitions(const String & filename, Array<Definition> & definitions) {
+	if (!IO::file_exists(filename.view())) {
+		IO::print("ERROR: Benchmark definitions '{}' not found!\n"_sv, filename);
+		return false;
+	}
+
+	String file = IO::file_read(filename, nullptr);
+	Parser parser(file.view(), filename.view());
+
+	definitions.clear();
+
+	while (true) {
+		parser.skip_whitespace_or_newline();
+		if (parser.reached_end()) break;
+
+		if (parser.match('#')) {
+			parser.skip_until('\n');
+			continue;
+		}
+
+		SourceLocation location = parser.location;
+		StringView key = parser.parse_identifier();
+
+		if (key == "benchmark") {
+			Definition & definition = definitions.emplace_back();
+			definition.name = parse_line(parser);
+
+			if (definition.name.is_empty()) {
+				ERROR(location, "Benchmark without a name!\n");
+			}
+			continue;
+		}
+
+		if (definitions.size() == 0) {
+			ERROR(location, "Expected 'benchmark <name>' before '{}'!\n", key);
+		}
+		Definition & definition = definitions.back();
+
+		if (key == "scene") {
+			definition.scene_filename = parse_line(parser);
+		} else if (key == "bvh") {
+			definition.args.push_back("--bvh"_sv);
+			definition.args.push_back(parse_line(parser));
+		} else if (key == "traversal") {
+			definition.args.push_back("--traversal"_sv);
+			definition.args.push_back(parse_line(parser));
+		} else if (key == "bounces") {
+			definition.args.push_back("--bounce"_sv);
+			definition.args.push_back(parse_line(parser));
+		} else if (key == "args") {
+			StringView line = parse_line(parser);
+			Parser parser_args(line, filename.view());
+
+			while (true) {
+				parser_args.skip_whitespace();
+				if (parser_args.reached_end()) break;
+
+				definition.args.push_back(parser_args.parse_identifier());
+			}
+		} else if (key == "warmup") {
+			parser.skip_whitespace();
+			definition.warmup_frame_count = Math::max(parser.parse_int(), 0);
+		} else if (key == "frames") {
+			parser.skip_whitespace();
+			definition.frame_count = Math::max(parser.parse_int(), 1);
+		} else if (key == "pov") {
+			POV pov = { };
+			parser.skip_whitespace(); pov.position.x = parser.parse_float();
+			parser.skip_whitespace(); pov.position.y = parser.parse_float();
+			parser.skip_whitespace(); pov.position.z = parser.parse_float();
+			parser.skip_whitespace(); pov.rotation.x = parser.parse_float();
+			parser.skip_whitespace(); pov.rotation.y = parser.parse_float();
+			parser.skip_whitespace(); pov.rotation.z = parser.parse_float();
+			parser.skip_whitespace(); pov.rotation.w = parser.parse_float();
+			definition.povs.push_back(pov);
+		} else {
+			ERROR(location, "Unknown benchmark setting '{}'!\n", key);
+		}
+	}
+
+	IO::print("Loaded {} benchmarks from '{}'\n"_sv, definitions.size(), filename);
+	return true;
+}
+
+static void write_escaped(FILE * file, StringView str) {
+	for (size_t i = 0; i < str.size(); i++) {
+		char c = str[i];
+		if (c == '"' || c == '\\') {
+			fputc('\\', file);
+		}
+		fputc(c, file);
+	}
+}
+
+bool Benchmark::save_results(const String & filename, StringView device_name, const Array<Result> & results) {
+	FILE * file = nullptr;
+#ifdef _WIN32
+	fopen_s(&file, filename.data(), "wb");
+#else
+	file = fopen(filename.data(), "wb");
+#endif
+
+	if (!file) {
+		IO::print("ERROR: Unable to write benchmark results to '{}'!\n"_sv, filename);
+		return false;
+	}
+
+	fprintf(file, "{\n");
+	fprintf(file, "\t\"device\": \"");
+	write_escaped(file, device_name);
+	fprintf(file, "\",\n");
+	fprintf(file, "\t\"benchmarks\": [\n");
+
+	for (size_t r = 0; r < results.size(); r++) {
+		const Result & result = results[r];
+
+		fprintf(file, "\t\t{\n");
+		fprintf(file, "\t\t\t\"name\": \"");
+		write_escaped(file, result.name.view());
+		fprintf(file, "\",\n");
+		fprintf(file, "\t\t\t\"frame_time_ms\": %.4f,\n",               result.frame_time);
+		fprintf(file, "\t\t\t\"primary_mrays_per_second\": %.3f,\n",   result.mrays_primary);
+		fprintf(file, "\t\t\t\"secondary_mrays_per_second\": %.3f,\n", result.mrays_secondary);
+		fprintf(file, "\t\t\t\"shadow_mrays_per_second\": %.3f,\n",    result.mrays_shadow);
+		fprintf(file, "\t\t\t\"peak_memory_mb\": %.3f,\n",             result.peak_memory);
+		fprintf(file, "\t\t\t\"povs\": [\n");
+
+		for (size_t p = 0; p < result.povs.size(); p++) {
+			const POVResult & pov = result.povs[p];
+
+			fprintf(file, "\t\t\t\t{ \"frame_time_ms\": %.4f, \"frame_time_stddev_ms\": %.4f, \"stages\": {", pov.frame_time, pov.frame_time_stddev);
+
+			for (size_t s = 0; s < pov.stages.size(); s++) {
+				fprintf(file, "%s\"", s == 0 ? " " : ", ");
+				write_escaped(file, pov.stages[s].name.view());
+				fprintf(file, "\": %.4f", pov.stages[s].time);
+			}
+
+			fprintf(file, " } }%s\n", p + 1 < result.povs.size() ? "," : "");
+		}
+
+		fprintf(file, "\t\t\t]\n");
+		fprintf(file, "\t\t}%s\n", r + 1 < results.size() ? "," : "");
+	}
+
+	fprintf(file, "\t]\n}\n");
+	fclose(file);
+
+	IO::print("Written benchmark results to '{}'\n"_sv, filename);
+	return true;
+}
+
+// Minimal JSON reader, sufficient for the files written by save_results
+static StringView json_parse_string(Parser & parser) {
+	parser.skip_whitespace_or_newline();
+	parser.expect('"');
+
+	const char * start = parser.cur;
+	while (parser.peek() != '"') {
+		if (parser.advance() == '\\') parser.advance();
+	}
+	const char * end = parser.cur;
+
+	parser.expect('"');
+	return StringView { start, end };
+}
+
+static void json_skip_value(Parser & parser) {
+	parser.skip_whitespace_or_newline();
+
+	char c = parser.peek();
+	if (c == '"') {
+		json_parse_string(parser);
+	} else if (c == '{' || c == '[') {
+		char close = c == '{' ? '}' : ']';
+		parser.advance();
+
+		parser.skip_whitespace_or_newline();
+		if (parser.match(close)) return;
+
+		while (true) {
+			if (close == '}') {
+				json_parse_string(parser);
+				parser.skip_whitespace_or_newline();
+				parser.expect(':');
+			}
+			json_skip_value(parser);
+
+			parser.skip_whitespace_or_newline();
+			if (parser.match(close)) break;
+			parser.expect(',');
+		}
+	} else {
+		// Number, true, false or null
+		while (!parser.reached_end() && *parser.cur != ',' && *parser.cur != '}' && *parser.cur != ']' && !is_whitespace(*parser.cur) && !is_newline(*parser.cur)) {
+			parser.advance();
+		}
+	}
+}
+
+// Calls parse_member for every key of the object, which has to consume the value
+template<typename ParseMember>
+static void json_parse_object(Parser & parser, ParseMember parse_member) {
+	parser.skip_whitespace_or_newline();
+	parser.expect('{');
+
+	parser.skip_whitespace_or_newline();
+	if (parser.match('}')) return;
+
+	while (true) {
+		StringView key = json_parse_string(parser);
+		parser.skip_whitespace_or_newline();
+		parser.expect(':');
+		parser.skip_whitespace_or_newline();
+
+		parse_member(key);
+
+		parser.skip_whitespace_or_newline();
+		if (parser.match('}')) break;
+		parser.expect(',');
+	}
+}
+
+bool Benchmark::load_results(const String & filename, Array<Result> & results) {
+	if (!IO::file_exists(filename.view())) {
+		IO::print("ERROR: Benchmark baseline '{}' not found!\n"_sv, filename);
+		return false;
+	}
+
+	String file = IO::file_read(filename, nullptr);
+	Parser parser(file.view(), filename.view());
+
+	results.clear();
+
+	json_parse_object(parser, [&](StringView key) {
+		if (key != "benchmarks") {
+			json_skip_value(parser);
+			return;
+		}
+
+		parser.expect('[');
+		parser.skip_whitespace_or_newline();
+		if (parser.match(']')) return;
+
+		while (true) {
+			Result & result = results.emplace_back();
+
+			json_parse_object(parser, [&](StringView key) {
+				if (key == "name") {
+					result.name = json_parse_string(parser);
+				} else if (key == "frame_time_ms") {
+					result.frame_time = parser.parse_float();
+				} else if (key == "primary_mrays_per_second") {
+					result.mrays_primary = parser.parse_float();
+				} else if (key == "secondary_mrays_per_second") {
+					result.mrays_secondary = parser.parse_float();
+				} else if (key == "shadow_mrays_per_second") {
+					result.mrays_shadow = parser.parse_float();
+				} else if (key == "peak_memory_mb") {
+					result.peak_memory = parser.parse_float();
+				} else {
+					json_skip_value(parser);
+				}
+			});
+
+			parser.skip_whitespace_or_newline();
+			if (parser.match(']')) break;
+			parser.expect(',');
+		}
+	});
+
+	return true;
+}
+
+// Relative change in percent, positive means worse
+static double calc_regression(double value, double value_baseline, bool higher_is_better) {
+	if (value_baseline <= 0.0) return 0.0;
+
+	double change = 100.0 * (value - value_baseline) / value_baseline;
+	return higher_is_better ? -change : change;
+}
+
+bool Benchmark::compare(const Array<Result> & results, const Array<Result> & baseline, float threshold) {
+	bool passed = true;
+
+	for (size_t r = 0; r < results.size(); r++) {
+		const Result & result = results[r];
+
+		const Result * result_baseline = nullptr;
+		for (size_t b = 0; b < baseline.size(); b++) {
+			if (baseline[b].name == result.name) {
+				result_baseline = &baseline[b];
+				break;
+			}
+		}
+
+		if (!result_baseline) {
+			IO::print("Benchmark {}: Not in baseline\n"_sv, result.name);
+			continue;
+		}
+
+		struct Metric {
+			StringView name;
+			double     value;
+			double     value_baseline;
+			bool       higher_is_better;
+		} metrics[] = {
+			{ "Frame time"_sv,        result.frame_time,      result_baseline->frame_time,      false },
+			{ "Primary Mrays/s"_sv,   result.mrays_primary,   result_baseline->mrays_primary,   true  },
+			{ "Secondary Mrays/s"_sv, result.mrays_secondary, result_baseline->mrays_secondary, true  },
+			{ "Shadow Mrays/s"_sv,    result.mrays_shadow,    result_baseline->mrays_shadow,    true  },
+			{ "Peak memory"_sv,       result.peak_memory,     result_baseline->peak_memory,     false }
+		};
+
+		for (int m = 0; m < Util::array_count(metrics); m++) {
+			const Metric & metric = metrics[m];
+			if (metric.value_baseline <= 0.0) continue;
+
+			double regression = calc_regression(metric.value, metric.value_baseline, metric.higher_is_better);
+			bool   failed     = regression > double(threshold);
+
+			IO::print("Benchmark {}: {:<17} {} -> {} ({}{}%){}\n"_sv,
+				result.name,
+				metric.name,
+				metric.value_baseline,
+				metric.value,
+				regression > 0.0 ? "worse " : "better ",
+				fabs(regression),
+				failed ? " REGRESSION" : ""
+			);
+
+			if (failed) passed = false;
+		}
+	}
+
+	return passed;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include "Core/Array.h"
+#include "Core/String.h"
+
+#include "Math/Vector3.h"
+#include "Math/Quaternion.h"
+
+// Regression benchmarks, run headless with --benchmark (see run_benchmarks in Main.cpp)
+// Definitions are read from a text file, every benchmark starts with a name followed by its settings:
+//	benchmark sponza_bvh8
+//	scene     Data/Sponza/scene.xml
+//	bvh       bvh8
+//	traversal optix   (software by default)
+//	bounces   10
+//	args      --svgf false   (any other command line options)
+//	warmup    8
+//	frames    32
+//	pov       18.74 10.33 -10.23  0 0.80 0 0.60   (Camera position followed by its rotation as a Quaternion)
+// Lines starting with '#' are ignored. The results are written as JSON and can be compared against those of an earlier run
+namespace Benchmark {
+	struct POV {
+		Vector3    position;
+		Quaternion rotation;
+	};
+
+	struct Definition {
+		String        name;
+		String        scene_filename;
+		Array<String> args; // Command line options applied on top of the configuration the benchmark was launched with
+
+		int warmup_frame_count = 8;
+		int frame_count        = 32;
+
+		Array<POV> povs; // If empty the Camera of the Scene is used
+	};
+
+	// Average GPU time in milliseconds between an Event and the next, keyed by the category and name of the Event
+	struct Stage {
+		String name;
+		double time;
+	};
+
+	struct POVResult {
+		double frame_time;        // Milliseconds
+		double frame_time_stddev;
+
+		Array<Stage> stages;
+	};
+
+	struct Result {
+		String name;
+
+		double frame_time = 0.0; // Milliseconds, averaged over all POVs
+
+		// 0 if not measured, see RayStats
+		double mrays_primary   = 0.0;
+		double mrays_secondary = 0.0;
+		double mrays_shadow    = 0.0;
+
+		double peak_memory = 0.0; // MB of device memory in use, see CUDAMemory::PoolStats::bytes_in_use_peak
+
+		Array<POVResult> povs;
+	};
+
+	bool load_definitions(const String & filename, Array<Definition> & definitions);
+
+	bool save_results(const String & filename, StringView device_name, const Array<Result> & results);
+	bool load_results(const String & filename, Array<Result> & results); // Only the summary of every benchmark is read, not its POVs
+
+	// Prints the relative difference of every benchmark that also occurs in the baseline,
+	// returns false if any of them regressed by more than threshold percent
+	bool compare(const Array<Result> & results, const Array<Result> & baseline, float threshold);
+}
@@ -0,0 +1,99 @@
+#include "Denoiser.h"
+
+#include "Core/IO.h"
+#include "Core/Timer.h"
+
+#include "Device/CUDAMemory.h"
+#include "Device/CUDAContext.h"
+
+#include "Renderer/Integrators/Integrator.h"
+
+#ifdef DENOISER_OIDN
+#include <OpenImageDenoise/oidn.h>
+#endif
+
+bool Denoiser::is_available() {
+#ifdef DENOISER_OIDN
+	return true;
+#else
+	return false;
+#endif
+}
+
+#ifdef DENOISER_OIDN
+// Wraps a Device pointer, OIDN reads and writes it directly
+static OIDNBuffer new_shared_buffer(OIDNDevice device, CUdeviceptr ptr, size_t num_bytes) {
+	return oidnNewSharedBuffer(device, reinterpret_cast<void *>(ptr), num_bytes);
+}
+
+static void set_image(OIDNFilter filter, const char * name, OIDNBuffer buffer, int width, int height, int pitch) {
+	// The float4 layout of the Accumulator and the AOVs is read as float3 with a 16 byte stride
+	oidnSetFilterImage(filter, name, buffer, OIDN_FORMAT_FLOAT3, width, height, 0, sizeof(float4), size_t(pitch) * sizeof(float4));
+}
+#endif
+
+bool Denoiser::denoise(const Integrator & integrator, Array<float4> & radiance) {
+#ifdef DENOISER_OIDN
+	ScopeTimer timer("Denoise"_sv);
+
+	int width  = integrator.screen_width;
+	int height = integrator.screen_height;
+	int pitch  = integrator.screen_pitch;
+
+	bool has_albedo = integrator.aov_is_enabled(AOVType::ALBEDO);
+	bool has_normal = integrator.aov_is_enabled(AOVType::NORMAL) && has_albedo; // OIDN only accepts a normal image together with an albedo image
+
+	// The CUDA runtime that OIDN uses picks up the Context that is current on this thread, so that it can access our allocations
+	int      device_ordinal = CUDAContext::get_device_ordinal();
+	CUstream stream         = nullptr;
+
+	OIDNDevice device = oidnNewCUDADevice(&device_ordinal, &stream, 1);
+	oidnCommitDevice(device);
+
+	// The radiance has already been resolved on the host (and combined over all Devices), so it is the only image that is uploaded
+	CUDAMemory::Ptr<float4> ptr_radiance = CUDAMemory::malloc(radiance);
+
+	OIDNBuffer buffer_radiance = new_shared_buffer(device, ptr_radiance.ptr, radiance.size() * sizeof(float4));
+	OIDNBuffer buffer_albedo   = nullptr;
+	OIDNBuffer buffer_normal   = nullptr;
+
+	OIDNFilter filter = oidnNewFilter(device, "RT");
+	set_image(filter, "color",  buffer_radiance, width, height, width);
+	set_image(filter, "output", buffer_radiance, width, height, width); // In place
+
+	if (has_albedo) {
+		buffer_albedo = new_shared_buffer(device, integrator.get_aov(AOVType::ALBEDO).accumulator.ptr, size_t(pitch) * height * sizeof(float4));
+		set_image(filter, "albedo", buffer_albedo, width, height, pitch);
+	}
+	if (has_normal) {
+		buffer_normal = new_shared_buffer(device, integrator.get_aov(AOVType::NORMAL).accumulator.ptr, size_t(pitch) * height * sizeof(float4));
+		set_image(filter, "normal", buffer_normal, width, height, pitch);
+	}
+
+	oidnSetFilterBool(filter, "hdr", true);
+	oidnCommitFilter(filter);
+	oidnExecuteFilter(filter);
+
+	const char * error_message = nullptr;
+	bool success = oidnGetDeviceError(device, &error_message) == OIDN_ERROR_NONE;
+
+	if (success) {
+		CUDAMemory::memcpy(radiance.data(), ptr_radiance, radiance.size());
+	} else {
+		IO::print("ERROR: Denoising failed: {}\n"_sv, error_message ? error_message : "unknown error");
+	}
+
+	oidnReleaseFilter(filter);
+	if (buffer_normal) oidnReleaseBuffer(buffer_normal);
+	if (buffer_albedo) oidnReleaseBuffer(buffer_albedo);
+	oidnReleaseBuffer(buffer_radiance);
+	oidnReleaseDevice(device);
+
+	CUDAMemory::free(ptr_radiance);
+
+	return success;
+#else
+	IO::print("WARNING: Built without Open Image Denoise (ENABLE_OIDN), the output is not denoised!\n"_sv);
+	return false;
+#endif
+}
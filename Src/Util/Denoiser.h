@@ -0,0 +1,15 @@
+#pragma once
+#include "Core/Array.h"
+
+struct Integrator;
+struct float4;
+
+// Offline denoising of headless renders (--denoise) with Intel Open Image Denoise, running on the Device of the current CUDA Context
+// OIDN is an optional dependency, it is only compiled in if the build defines DENOISER_OIDN (ENABLE_OIDN in CMakeLists.txt)
+namespace Denoiser {
+	bool is_available();
+
+	// Denoises the radiance read back from the Accumulator in place (pitch equals screen_width)
+	// The accumulated ALBEDO and NORMAL AOVs of the Integrator are used as auxiliary images, they are shared with OIDN without a copy
+	bool denoise(const Integrator & integrator, Array<float4> & radiance);
+}
@@ -0,0 +1,510 @@
+#include "Profiler.h"
+
+#include <stdio.h>
+#include <chrono>
+#include <atomic>
+
+#include "Core/IO.h"
+#include "Core/Array.h"
+#include "Core/Mutex.h"
+#include "Core/Format.h"
+#include "Core/Sort.h"
+#include "Core/Allocators/StackAllocator.h"
+
+#include "Math/Math.h"
+
+#include "Device/CUDAEvent.h"
+#include "Device/CUDAContext.h"
+
+#ifdef PROFILER_NVTX
+#include <nvtx3/nvToolsExt.h>
+#endif
+
+struct TraceEvent {
+	String name;
+	String category;
+	String asset; // See Profiler::set_thread_asset
+
+	uint64_t time_start;
+	uint64_t time_end;
+
+	int thread_id;
+
+	bool   is_counter;
+	double counter_value;
+};
+
+struct TraceThread {
+	int    thread_id;
+	String name;
+};
+
+// GPU timestamps are taken relative to an Event whose CPU time is known, one per Context
+struct GPUReference {
+	bool     is_valid;
+	CUevent  event;
+	uint64_t time;
+};
+
+static constexpr int GPU_THREAD_ID_OFFSET = 1000; // GPU work of Context i shows up as thread GPU_THREAD_ID_OFFSET + i
+
+static const std::chrono::steady_clock::time_point time_origin = std::chrono::steady_clock::now();
+
+static std::atomic<bool> recording = false;
+
+static Mutex mutex;
+
+static String trace_filename;
+static int    trace_frame_count;
+static int    trace_frame_index;
+
+static Array<TraceEvent>  trace_events;
+static Array<TraceThread> trace_threads;
+
+static GPUReference gpu_references[CUDAContext::MAX_DEVICES];
+
+static std::atomic<int> thread_id_next = 0;
+static thread_local int thread_id      = -1;
+
+static thread_local uint64_t thread_frame_start = 0;
+
+static std::atomic<bool> startup_reporting = false;
+
+static Array<TraceEvent> startup_events; // CPU intervals recorded since startup_begin, guarded by mutex
+
+static thread_local String thread_asset;
+
+static int get_thread_id() {
+	if (thread_id == -1) {
+		thread_id = thread_id_next++;
+	}
+	return thread_id;
+}
+
+static void write_escaped(FILE * file, const String & str) {
+	for (size_t i = 0; i < str.size(); i++) {
+		char c = str.data()[i];
+		if (c == '"' || c == '\\') {
+			fputc('\\', file);
+		}
+		fputc(c, file);
+	}
+}
+
+static void write_trace() {
+	FILE * file = nullptr;
+#ifdef _WIN32
+	fopen_s(&file, trace_filename.data(), "wb");
+#else
+	file = fopen(trace_filename.data(), "wb");
+#endif
+
+	if (!file) {
+		IO::print("Profiler: Failed to write trace '{}'!\n"_sv, trace_filename);
+		return;
+	}
+
+	fputs("{\"traceEvents\":[\n", file);
+
+	bool first = true;
+
+	auto write_separator = [&]() {
+		if (!first) fputs(",\n", file);
+		first = false;
+	};
+
+	for (size_t i = 0; i < trace_threads.size(); i++) {
+		write_separator();
+		fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%i,\"args\":{\"name\":\"", trace_threads[i].thread_id);
+		write_escaped(file, trace_threads[i].name);
+		fputs("\"}}", file);
+	}
+
+	for (size_t i = 0; i < trace_events.size(); i++) {
+		const TraceEvent & event = trace_events[i];
+
+		write_separator();
+		fputs("{\"name\":\"", file);
+		write_escaped(file, event.name);
+
+		if (event.is_counter) {
+			fprintf(file, "\",\"ph\":\"C\",\"pid\":0,\"ts\":%llu,\"args\":{\"value\":%.3f}}", (unsigned long long)event.time_start, event.counter_value);
+			continue;
+		}
+
+		fputs("\",\"cat\":\"", file);
+		write_escaped(file, event.category);
+		fprintf(file, "\",\"ph\":\"X\",\"pid\":0,\"tid\":%i,\"ts\":%llu,\"dur\":%llu",
+			event.thread_id,
+			(unsigned long long)event.time_start,
+			(unsigned long long)(event.time_end - event.time_start)
+		);
+
+		if (!event.asset.is_empty()) {
+			fputs(",\"args\":{\"asset\":\"", file);
+			write_escaped(file, event.asset);
+			fputs("\"}", file);
+		}
+		fputc('}', file);
+	}
+
+	fputs("\n]}\n", file);
+	fclose(file);
+
+	IO::print("Profiler: Written {} events to '{}'\n"_sv, trace_events.size(), trace_filename);
+}
+
+static void add_thread(int id, StringView name) {
+	for (size_t i = 0; i < trace_threads.size(); i++) {
+		if (trace_threads[i].thread_id == id) return;
+	}
+	trace_threads.push_back({ id, String(name) });
+}
+
+void Profiler::init(const String & filename, int frame_count) {
+	MutexLock lock(mutex);
+
+	trace_filename    = filename;
+	trace_frame_count = frame_count;
+	trace_frame_index = 0;
+
+	trace_events.clear();
+
+	for (int i = 0; i < CUDAContext::MAX_DEVICES; i++) {
+		gpu_references[i].is_valid = false;
+	}
+
+	recording = true;
+}
+
+void Profiler::free() {
+	MutexLock lock(mutex);
+
+	if (recording) {
+		recording = false;
+		write_trace();
+	}
+}
+
+bool Profiler::is_recording() {
+	return recording;
+}
+
+uint64_t Profiler::get_time() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - time_origin).count();
+}
+
+void Profiler::set_thread_name(StringView name) {
+	MutexLock lock(mutex);
+	add_thread(get_thread_id(), name);
+}
+
+void Profiler::record_cpu(StringView name, StringView category, uint64_t time_start, uint64_t time_end) {
+	if (!recording && !startup_reporting) return;
+
+	TraceEvent event = { };
+	event.name       = String(name);
+	event.category   = String(category);
+	event.asset      = thread_asset;
+	event.time_start = time_start;
+	event.time_end   = time_end;
+	event.thread_id  = get_thread_id();
+
+	MutexLock lock(mutex);
+
+	// ThreadPool Tasks only wrap the other intervals, they would double the CPU time of every phase
+	if (startup_reporting && category != "ThreadPool") {
+		startup_events.push_back(event); // NOTE: copy!
+	}
+	if (recording) {
+		trace_events.push_back(std::move(event));
+	}
+}
+
+void Profiler::startup_begin() {
+	MutexLock lock(mutex);
+
+	startup_events.clear();
+	startup_reporting = true;
+}
+
+bool Profiler::is_reporting_startup() {
+	return startup_reporting;
+}
+
+void Profiler::set_thread_asset(StringView asset) {
+	thread_asset = String(asset);
+}
+
+struct StartupPhase {
+	StringView name;
+	int        count;
+	uint64_t   time_cpu;
+	uint64_t   time_wall; // Union of the intervals, parallel work only counts once
+};
+
+struct StartupAsset {
+	StringView name;
+	uint64_t   time_first;
+	uint64_t   time_last;
+	uint64_t   time_cpu; // Intervals that are not nested in another interval of the same thread
+};
+
+// Length of the union of the intervals, which must be sorted by start time
+static uint64_t intervals_union(const Array<const TraceEvent *> & events) {
+	uint64_t total = 0;
+	uint64_t start = 0;
+	uint64_t end   = 0;
+
+	for (size_t i = 0; i < events.size(); i++) {
+		if (i == 0 || events[i]->time_start > end) {
+			total += end - start;
+			start = events[i]->time_start;
+			end   = events[i]->time_end;
+		} else {
+			end = Math::max(end, events[i]->time_end);
+		}
+	}
+	return total + (end - start);
+}
+
+static int64_t to_ms(uint64_t time) {
+	return int64_t(time / 1000);
+}
+
+static void print_startup_report(uint64_t time_end) {
+	Array<TraceEvent> & events = startup_events;
+
+	Sort::quick_sort(events.begin(), events.end(), [](const TraceEvent & a, const TraceEvent & b) {
+		return a.time_start < b.time_start || (a.time_start == b.time_start && a.time_end > b.time_end);
+	});
+
+	// An interval is nested if an earlier interval of the same thread has not ended yet, intervals are sorted outer first
+	Array<bool> nested      (events.size());
+	Array<bool> has_children(events.size());
+	for (size_t i = 0; i < events.size(); i++) {
+		nested      [i] = false;
+		has_children[i] = false;
+
+		for (size_t j = i - 1; j < i; j--) {
+			if (events[j].thread_id == events[i].thread_id && events[j].time_end >= events[i].time_end) {
+				nested      [i] = true;
+				has_children[j] = true;
+				break;
+			}
+		}
+	}
+
+	Array<StartupPhase> phases;
+	Array<StartupAsset> assets;
+
+	for (size_t i = 0; i < events.size(); i++) {
+		const TraceEvent & event = events[i];
+		uint64_t duration = event.time_end - event.time_start;
+
+		size_t p = 0;
+		while (p < phases.size() && phases[p].name != event.name.view()) p++;
+		if (p == phases.size()) phases.push_back({ event.name.view(), 0, 0, 0 });
+
+		phases[p].count++;
+		phases[p].time_cpu += duration;
+
+		if (event.asset.is_empty()) continue;
+
+		size_t a = 0;
+		while (a < assets.size() && assets[a].name != event.asset.view()) a++;
+		if (a == assets.size()) assets.push_back({ event.asset.view(), event.time_start, event.time_end, 0 });
+
+		assets[a].time_last = Math::max(assets[a].time_last, event.time_end);
+		if (!nested[i]) {
+			assets[a].time_cpu += duration;
+		}
+	}
+
+	Array<const TraceEvent *> phase_events;
+	for (size_t p = 0; p < phases.size(); p++) {
+		phase_events.clear();
+		for (size_t i = 0; i < events.size(); i++) {
+			if (events[i].name.view() == phases[p].name) phase_events.push_back(&events[i]);
+		}
+		phases[p].time_wall = intervals_union(phase_events);
+	}
+
+	Sort::quick_sort(phases.begin(), phases.end(), [](const StartupPhase & a, const StartupPhase & b) { return a.time_wall > b.time_wall; });
+	Sort::quick_sort(assets.begin(), assets.end(), [](const StartupAsset & a, const StartupAsset & b) { return a.time_last > b.time_last; });
+
+	IO::print("\nStartup report ({} ms):\n"_sv, to_ms(time_end));
+	IO::print("  {:<24}{:>7}{:>12}{:>12}\n"_sv, "Phase"_sv, "Count"_sv, "Wall ms"_sv, "CPU ms"_sv);
+	for (size_t p = 0; p < phases.size(); p++) {
+		IO::print("  {:<24}{:>7}{:>12}{:>12}\n"_sv, phases[p].name, phases[p].count, to_ms(phases[p].time_wall), to_ms(phases[p].time_cpu));
+	}
+
+	// Assets that finished last gate the startup, so they are listed first
+	static constexpr size_t MAX_ASSETS = 16;
+
+	IO::print("\n  {:<40}{:>12}{:>12}{:>12}  Phases (CPU ms)\n"_sv, "Asset (last to finish first)"_sv, "Start ms"_sv, "End ms"_sv, "CPU ms"_sv);
+	for (size_t a = 0; a < Math::min(assets.size(), MAX_ASSETS); a++) {
+		const StartupAsset & asset = assets[a];
+
+		// Show the end of long paths, which holds the file name
+		StringView asset_name = asset.name;
+		if (asset_name.size() > 38) asset_name = StringView { asset_name.end - 38, asset_name.end };
+
+		IO::print("  {:<40}{:>12}{:>12}{:>12} "_sv, asset_name, to_ms(asset.time_first), to_ms(asset.time_last), to_ms(asset.time_cpu));
+
+		for (size_t i = 0; i < events.size(); i++) {
+			if (nested[i] && events[i].asset.view() == asset.name) {
+				IO::print(" {} {}"_sv, events[i].name, to_ms(events[i].time_end - events[i].time_start));
+			}
+		}
+		IO::print('\n');
+	}
+	if (assets.size() > MAX_ASSETS) {
+		IO::print("  ({} more)\n"_sv, assets.size() - MAX_ASSETS);
+	}
+
+	// Walk back from the end of the startup, always taking the interval that ended last before the current time
+	// Only innermost intervals are considered, so that the path shows the phases rather than the Asset loads that contain them
+	Array<const TraceEvent *> critical_path;
+
+	uint64_t time = time_end;
+	while (true) {
+		const TraceEvent * best = nullptr;
+
+		for (size_t i = 0; i < events.size(); i++) {
+			const TraceEvent & event = events[i];
+			if (has_children[i] || event.time_end > time || event.time_start >= time) continue;
+
+			if (best == nullptr || event.time_end > best->time_end) {
+				best = &event;
+			}
+		}
+		if (best == nullptr) break;
+
+		critical_path.push_back(best);
+		time = best->time_start;
+	}
+
+	IO::print("\n  Critical path:\n"_sv);
+	for (size_t i = critical_path.size() - 1; i < critical_path.size(); i--) {
+		const TraceEvent & event = *critical_path[i];
+		IO::print("  {:>10} ms {:<24}{:>10} ms  {}\n"_sv, to_ms(event.time_start), event.name, to_ms(event.time_end - event.time_start), event.asset);
+	}
+	IO::print('\n');
+}
+
+void Profiler::startup_end() {
+	if (!startup_reporting) return;
+
+	uint64_t time_end = get_time();
+
+	MutexLock lock(mutex);
+
+	startup_reporting = false;
+	print_startup_report(time_end);
+
+	startup_events = { };
+}
+
+#ifdef PROFILER_NVTX
+void Profiler::range_push(StringView name, StringView category) {
+	// NVTX expects a null terminated string
+	StackAllocator<BYTES(256)> allocator;
+	String range_name = Format(&allocator).format("{}/{}"_sv, category, name);
+
+	nvtxRangePushA(range_name.data());
+}
+
+void Profiler::range_pop() {
+	nvtxRangePop();
+}
+#endif
+
+void Profiler::record_counter(StringView name, double value) {
+	if (!recording) return;
+
+	TraceEvent event = { };
+	event.name          = String(name);
+	event.time_start    = get_time();
+	event.time_end      = event.time_start;
+	event.thread_id     = get_thread_id();
+	event.is_counter    = true;
+	event.counter_value = value;
+
+	MutexLock lock(mutex);
+	if (recording) {
+		trace_events.push_back(std::move(event));
+	}
+}
+
+void Profiler::frame_end(const CUDAEventPool & event_pool) {
+	if (!recording) return;
+
+	uint64_t time_frame_end = get_time();
+
+	int context_index = CUDAContext::get_current_context_index();
+	GPUReference & reference = gpu_references[context_index];
+
+	// The GPU work of the first frame of every Context only serves to establish the reference Event,
+	// which is recorded behind it so that it completes (close to) when the synchronization below returns
+	bool has_reference = reference.is_valid;
+	if (!has_reference) {
+		CUDACALL(cuEventCreate(&reference.event, CU_EVENT_DEFAULT));
+		CUDACALL(cuEventRecord(reference.event, nullptr));
+		CUDACALL(cuEventSynchronize(reference.event));
+
+		reference.time     = get_time();
+		reference.is_valid = true;
+	}
+
+	Array<TraceEvent> gpu_events;
+
+	if (has_reference && event_pool.num_used >= 2) {
+		CUDACALL(cuEventSynchronize(event_pool.pool[event_pool.num_used - 1].event));
+
+		for (size_t i = 0; i + 1 < event_pool.num_used; i++) {
+			const CUDAEvent & event_start = event_pool.pool[i];
+			const CUDAEvent & event_end   = event_pool.pool[i + 1];
+
+			float ms_start = 0.0f;
+			float ms_end   = 0.0f;
+			CUDACALL(cuEventElapsedTime(&ms_start, reference.event, event_start.event));
+			CUDACALL(cuEventElapsedTime(&ms_end,   reference.event, event_end  .event));
+
+			TraceEvent & trace_event = gpu_events.emplace_back();
+			trace_event.name       = event_start.desc->name;
+			trace_event.category   = event_start.desc->category;
+			trace_event.time_start = reference.time + uint64_t(Math::max(ms_start, 0.0f) * 1000.0f);
+			trace_event.time_end   = reference.time + uint64_t(Math::max(ms_end,   0.0f) * 1000.0f);
+			trace_event.thread_id  = GPU_THREAD_ID_OFFSET + context_index;
+		}
+	}
+
+	int cpu_thread_id = get_thread_id();
+
+	MutexLock lock(mutex);
+	if (!recording) return;
+
+	StackAllocator<BYTES(128)> allocator;
+	add_thread(GPU_THREAD_ID_OFFSET + context_index, Format(&allocator).format("GPU {}"_sv, context_index).view());
+
+	for (size_t i = 0; i < gpu_events.size(); i++) {
+		trace_events.push_back(std::move(gpu_events[i]));
+	}
+
+	if (thread_frame_start > 0) {
+		TraceEvent frame = { };
+		frame.name       = String(Format(&allocator).format("Frame {}"_sv, trace_frame_index).view());
+		frame.category   = "Frame"_sv;
+		frame.time_start = thread_frame_start;
+		frame.time_end   = time_frame_end;
+		frame.thread_id  = cpu_thread_id;
+		trace_events.push_back(std::move(frame));
+	}
+	thread_frame_start = time_frame_end;
+
+	if (++trace_frame_index >= trace_frame_count) {
+		recording = false;
+		write_trace();
+	}
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <stdint.h>
+
+#include "Core/String.h"
+#include "Core/Constructors.h"
+
+struct CUDAEventPool;
+
+// Records CPU and GPU intervals for a number of frames and writes them as a Chrome trace-event JSON file,
+// which can be inspected offline in Perfetto (ui.perfetto.dev) or chrome://tracing
+namespace Profiler {
+	// Starts recording, the trace is written to filename once frame_count frames have ended
+	void init(const String & filename, int frame_count);
+
+	// Writes the trace if it is still being recorded, for when the application exits before frame_count frames were rendered
+	void free();
+
+	bool is_recording();
+
+	uint64_t get_time(); // Microseconds since the start of the process
+
+	// Names the calling thread in the trace, can be called before init
+	void set_thread_name(StringView name);
+
+	void record_cpu(StringView name, StringView category, uint64_t time_start, uint64_t time_end);
+
+	// Records the value of a named counter at the current time, shown as a graph in the trace
+	void record_counter(StringView name, double value);
+
+	// Records the intervals between consecutive Events of the pool as GPU work of the current Context
+	// and ends the frame of the calling thread. NOTE: Waits for the last Event of the pool to complete
+	void frame_end(const CUDAEventPool & event_pool);
+
+	// Startup report, see cpu_config.enable_startup_report
+	// The CPU intervals recorded between startup_begin and startup_end are kept (also if the trace is not recording),
+	// startup_end prints the wall and CPU time per phase, the lifecycle of every asset and the critical path of the startup
+	void startup_begin();
+	void startup_end();
+
+	bool is_reporting_startup();
+
+	// Attributes the CPU intervals the calling thread records to an asset, an empty name ends the attribution
+	// The asset shows up in the startup report and as an argument of the intervals in the trace
+	void set_thread_asset(StringView asset);
+
+	// Named NVTX range on the calling thread, shows up in Nsight Systems. Compiled out unless PROFILER_NVTX is defined
+#ifdef PROFILER_NVTX
+	void range_push(StringView name, StringView category);
+	void range_pop();
+#else
+	inline void range_push(StringView name, StringView category) { }
+	inline void range_pop() { }
+#endif
+}
+
+// Records the time between its construction and destruction as a CPU interval, if the Profiler is recording
+// The interval is also pushed as an NVTX range, see Profiler::range_push
+struct ProfileScope {
+	StringView name;
+	StringView category;
+	uint64_t   time_start;
+
+	ProfileScope(StringView name, StringView category = "CPU"_sv) : name(name), category(category), time_start(Profiler::get_time()) {
+		Profiler::range_push(name, category);
+	}
+
+	NON_COPYABLE(ProfileScope);
+	NON_MOVEABLE(ProfileScope);
+
+	~ProfileScope() {
+		Profiler::range_pop();
+
+		if (Profiler::is_recording() || Profiler::is_reporting_startup()) {
+			Profiler::record_cpu(name, category, time_start, Profiler::get_time());
+		}
+	}
+};
+
+// Attributes the ProfileScopes of the calling thread to an asset while it is alive, see Profiler::set_thread_asset
+// NOTE: Must outlive the ProfileScopes it covers, so it is declared before them
+struct ProfileAssetScope {
+	ProfileAssetScope(StringView asset) {
+		Profiler::set_thread_asset(asset);
+	}
+
+	NON_COPYABLE(ProfileAssetScope);
+	NON_MOVEABLE(ProfileAssetScope);
+
+	~ProfileAssetScope() {
+		Profiler::set_thread_asset(StringView { });
+	}
+};
@@ -0,0 +1,175 @@
+#include "RenderServer.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+
+using Socket = SOCKET;
+
+static constexpr int SEND_FLAGS = 0;
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+using Socket = int;
+static constexpr Socket INVALID_SOCKET = -1;
+
+static int closesocket(Socket socket) { return ::close(socket); }
+
+static constexpr int SEND_FLAGS = MSG_NOSIGNAL; // A client that disconnected must not raise SIGPIPE
+#endif
+
+#include "Core/IO.h"
+#include "Core/Parser.h"
+#include "Core/Format.h"
+#include "Core/Allocators/StackAllocator.h"
+
+static Socket listen_socket = INVALID_SOCKET;
+static Socket client_socket = INVALID_SOCKET;
+
+static Array<char> receive_buffer; // Bytes received from the current client that are not part of a complete line yet
+
+bool RenderServer::open(int port) {
+#ifdef _WIN32
+	WSADATA wsa_data;
+	if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
+		IO::print("ERROR: Unable to initialize Winsock!\n"_sv);
+		return false;
+	}
+#endif
+
+	listen_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (listen_socket == INVALID_SOCKET) {
+		IO::print("ERROR: Unable to create server socket!\n"_sv);
+		return false;
+	}
+
+	int reuse_address = 1;
+	setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char *>(&reuse_address), sizeof(reuse_address));
+
+	// Only local clients, the protocol has no authentication
+	sockaddr_in address = { };
+	address.sin_family      = AF_INET;
+	address.sin_port        = htons(u_short(port));
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(listen_socket, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0 || listen(listen_socket, 4) != 0) {
+		IO::print("ERROR: Unable to listen on port {}!\n"_sv, port);
+		close();
+		return false;
+	}
+
+	IO::print("Render server listening on 127.0.0.1:{}\n"_sv, port);
+	return true;
+}
+
+void RenderServer::close() {
+	if (client_socket != INVALID_SOCKET) closesocket(client_socket);
+	if (listen_socket != INVALID_SOCKET) closesocket(listen_socket);
+
+	client_socket = INVALID_SOCKET;
+	listen_socket = INVALID_SOCKET;
+
+	receive_buffer.clear();
+
+#ifdef _WIN32
+	WSACleanup();
+#endif
+}
+
+// Reads the next line of the current client into line, accepting a new client first if there is none
+// Returns true if the line came from a different client than the previous line
+static bool read_line(String & line) {
+	bool new_client = false;
+
+	while (true) {
+		if (client_socket == INVALID_SOCKET) {
+			client_socket = accept(listen_socket, nullptr, nullptr);
+			receive_buffer.clear();
+
+			new_client = true;
+			continue;
+		}
+
+		for (size_t i = 0; i < receive_buffer.size(); i++) {
+			if (receive_buffer[i] == '\n') {
+				size_t length = (i > 0 && receive_buffer[i - 1] == '\r') ? i - 1 : i;
+				line = String(receive_buffer.data(), length);
+
+				size_t remaining = receive_buffer.size() - (i + 1);
+				memmove(receive_buffer.data(), receive_buffer.data() + i + 1, remaining);
+				receive_buffer.resize(remaining);
+				return new_client;
+			}
+		}
+
+		char data[4096];
+		int  received = int(recv(client_socket, data, sizeof(data), 0));
+
+		if (received <= 0) {
+			closesocket(client_socket);
+			client_socket = INVALID_SOCKET;
+			continue;
+		}
+		receive_buffer.push_back(data, received);
+	}
+}
+
+bool RenderServer::wait_for_job(Job & job) {
+	job = { };
+
+	String line;
+	while (true) {
+		// The unfinished Job of a client that disconnected is discarded
+		if (read_line(line)) {
+			job = { };
+		}
+
+		Parser parser(line.view());
+		parser.skip_whitespace();
+
+		if (parser.reached_end() || parser.match('#')) continue;
+
+		StringView key = parser.parse_identifier();
+
+		if (key == "render") {
+			return true;
+		} else if (key == "shutdown") {
+			return false;
+		} else if (key == "camera") {
+			job.has_camera = true;
+			parser.skip_whitespace(); job.camera_position.x = parser.parse_float();
+			parser.skip_whitespace(); job.camera_position.y = parser.parse_float();
+			parser.skip_whitespace(); job.camera_position.z = parser.parse_float();
+			parser.skip_whitespace(); job.camera_rotation.x = parser.parse_float();
+			parser.skip_whitespace(); job.camera_rotation.y = parser.parse_float();
+			parser.skip_whitespace(); job.camera_rotation.z = parser.parse_float();
+			parser.skip_whitespace(); job.camera_rotation.w = parser.parse_float();
+		} else if (key == "samples") {
+			parser.skip_whitespace();
+			job.sample_count = parser.parse_int();
+		} else if (key == "output") {
+			job.output_filename = parser.parse_identifier();
+		} else if (key == "option") {
+			while (true) {
+				StringView option = parser.parse_identifier();
+				if (option.is_empty()) break;
+
+				job.options.push_back(option);
+			}
+		} else {
+			StackAllocator<BYTES(256)> allocator;
+			reply(Format(&allocator).format("error Unknown setting '{}'"_sv, key).view());
+		}
+	}
+}
+
+void RenderServer::reply(StringView message) {
+	if (client_socket == INVALID_SOCKET) return;
+
+	send(client_socket, message.data(), int(message.size()), SEND_FLAGS);
+	send(client_socket, "\n", 1, SEND_FLAGS);
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include "Core/Array.h"
+#include "Core/String.h"
+
+#include "Math/Vector3.h"
+#include "Math/Quaternion.h"
+
+// Keeps the Scene, its BVHs and the compiled Module resident between render jobs, started with --server <port> (see render_server in Main.cpp)
+// Clients connect to the port on localhost and send jobs as lines of text, every job ends with 'render':
+//	camera  18.74 10.33 -10.23  0 0.80 0 0.60      (Camera position followed by its rotation as a Quaternion)
+//	samples 64                                      (Number of samples, defaults to -N)
+//	option  --bounces 4 --svgf true                 (Config overrides in command line syntax, they only last for this job)
+//	output  preview.exr                             (PPM or EXR, same as -o)
+//	render
+// The server replies with 'ok <output> <milliseconds>' or 'error <reason>' per job. A client can send any number of jobs over one connection,
+// jobs go through a single queue in the order they arrive. 'shutdown' stops the server
+namespace RenderServer {
+	struct Job {
+		bool       has_camera = false;
+		Vector3    camera_position;
+		Quaternion camera_rotation;
+
+		int sample_count = INVALID;
+
+		String        output_filename;
+		Array<String> options;
+	};
+
+	bool open(int port);
+	void close();
+
+	// Blocks until a client has sent a complete Job, waits for the next client if the current one disconnects
+	// Returns false once a client requested a shutdown
+	bool wait_for_job(Job & job);
+
+	// Replies to the client that sent the last Job
+	void reply(StringView message);
+}
@@ -0,0 +1,122 @@
+#include "Sequence.h"
+
+#include "Core/IO.h"
+
+#include "Assets/OBJLoader.h"
+#include "Assets/PLYLoader.h"
+
+#include "Profiler.h"
+#include "StringUtil.h"
+
+bool Sequence::Reader::open(const String & filename) {
+	if (!IO::file_exists(filename.view())) {
+		IO::print("ERROR: Sequence '{}' not found!\n"_sv, filename);
+		return false;
+	}
+
+	this->filename = filename;
+	this->file     = IO::file_read(filename, nullptr);
+
+	frame_locations.clear();
+	frame_offsets  .clear();
+
+	Parser parser(file.view(), this->filename.view());
+
+	while (true) {
+		parser.skip_whitespace_or_newline();
+		if (parser.reached_end()) break;
+
+		// Only the frame keywords are located here, everything else is parsed by prefetch()
+		if (parser.match("frame") && (parser.reached_end() || is_whitespace(*parser.cur) || is_newline(*parser.cur))) {
+			parser.skip_until('\n');
+
+			frame_locations.push_back(parser.location);
+			frame_offsets  .push_back(parser.cur - parser.start);
+			continue;
+		}
+
+		if (frame_locations.size() == 0 && !parser.match('#')) {
+			ERROR(parser.location, "Expected 'frame' before the first setting!\n");
+		}
+		parser.skip_until('\n');
+	}
+	frame_offsets.push_back(file.size());
+
+	IO::print("Loaded sequence '{}' with {} frames\n"_sv, filename, frame_locations.size());
+	return frame_locations.size() > 0;
+}
+
+void Sequence::Reader::prefetch(int frame_index) {
+	ASSERT(prefetch_group.is_done());
+
+	ThreadPool::submit(prefetch_group, [this, frame_index]() {
+		ProfileScope scope("Sequence Prefetch"_sv, "Assets"_sv);
+
+		Frame & frame = prefetch_frame;
+		frame.has_camera = false;
+		frame.transforms.clear();
+		frame.geometries.clear();
+
+		StringView frame_data = { file.data() + frame_offsets[frame_index], file.data() + frame_offsets[frame_index + 1] };
+		Parser parser(frame_data, frame_locations[frame_index]);
+
+		while (true) {
+			parser.skip_whitespace_or_newline();
+			if (parser.reached_end()) break;
+
+			if (parser.match('#')) {
+				parser.skip_until('\n');
+				continue;
+			}
+
+			SourceLocation location = parser.location;
+			StringView key = parser.parse_identifier();
+
+			if (key == "frame") {
+				break; // Reached the next frame
+			} else if (key == "camera") {
+				frame.has_camera = true;
+				parser.skip_whitespace(); frame.camera_position.x = parser.parse_float();
+				parser.skip_whitespace(); frame.camera_position.y = parser.parse_float();
+				parser.skip_whitespace(); frame.camera_position.z = parser.parse_float();
+				parser.skip_whitespace(); frame.camera_rotation.x = parser.parse_float();
+				parser.skip_whitespace(); frame.camera_rotation.y = parser.parse_float();
+				parser.skip_whitespace(); frame.camera_rotation.z = parser.parse_float();
+				parser.skip_whitespace(); frame.camera_rotation.w = parser.parse_float();
+			} else if (key == "mesh") {
+				MeshTransform & transform = frame.transforms.emplace_back();
+				parser.skip_whitespace(); transform.mesh_name  = parser.parse_identifier();
+				parser.skip_whitespace(); transform.position.x = parser.parse_float();
+				parser.skip_whitespace(); transform.position.y = parser.parse_float();
+				parser.skip_whitespace(); transform.position.z = parser.parse_float();
+				parser.skip_whitespace(); transform.rotation.x = parser.parse_float();
+				parser.skip_whitespace(); transform.rotation.y = parser.parse_float();
+				parser.skip_whitespace(); transform.rotation.z = parser.parse_float();
+				parser.skip_whitespace(); transform.rotation.w = parser.parse_float();
+				parser.skip_whitespace(); transform.scale      = parser.parse_float();
+			} else if (key == "geometry") {
+				MeshGeometry & geometry = frame.geometries.emplace_back();
+				parser.skip_whitespace(); geometry.mesh_name = parser.parse_identifier();
+				parser.skip_whitespace();
+
+				String geometry_filename = parser.parse_identifier();
+
+				StringView file_extension = Util::get_file_extension(geometry_filename.view());
+				if (file_extension == "obj") {
+					geometry.triangles = OBJLoader::load(geometry_filename, nullptr);
+				} else if (file_extension == "ply") {
+					geometry.triangles = PLYLoader::load(geometry_filename, nullptr);
+				} else {
+					ERROR(location, "Unsupported geometry file '{}', expected OBJ or PLY!\n", geometry_filename);
+				}
+			} else {
+				ERROR(location, "Unknown sequence setting '{}'!\n", key);
+			}
+		}
+	});
+}
+
+Sequence::Frame & Sequence::Reader::wait() {
+	ThreadPool::wait(prefetch_group);
+	return prefetch_frame;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include "Core/Array.h"
+#include "Core/String.h"
+#include "Core/Parser.h"
+
+#include "Math/Vector3.h"
+#include "Math/Quaternion.h"
+
+#include "Renderer/Triangle.h"
+
+#include "ThreadPool.h"
+
+// File driven animation, rendered headless with --sequence (see render_sequence in Main.cpp)
+// The file lists the frames, every frame changes the Scene that was loaded from the scene file:
+//	frame
+//	camera   18.74 10.33 -10.23  0 0.80 0 0.60      (Camera position followed by its rotation as a Quaternion)
+//	mesh     Lucy  0 1 0  0 0 0 1  2.5              (Mesh name, position, rotation as a Quaternion and scale)
+//	geometry Lucy  Cache/lucy_0001.obj              (OBJ/PLY with new vertex data for the MeshData of the Mesh, same Triangle count)
+// Anything a frame does not set keeps its value from the previous frame. Lines starting with '#' are ignored
+// Only the start of every frame is located when the file is opened, frames are parsed and their geometry loaded on the ThreadPool
+namespace Sequence {
+	struct MeshTransform {
+		String     mesh_name;
+		Vector3    position;
+		Quaternion rotation;
+		float      scale;
+	};
+
+	struct MeshGeometry {
+		String          mesh_name;
+		Array<Triangle> triangles;
+	};
+
+	struct Frame {
+		bool       has_camera = false;
+		Vector3    camera_position;
+		Quaternion camera_rotation;
+
+		Array<MeshTransform> transforms;
+		Array<MeshGeometry>  geometries;
+	};
+
+	struct Reader {
+		String filename;
+		String file;
+
+		Array<SourceLocation> frame_locations; // Location of the first setting of every frame
+		Array<size_t>         frame_offsets;   // Offset into file of the first setting of every frame, followed by the end of the file
+
+		bool open(const String & filename);
+
+		int frame_count() const { return int(frame_locations.size()); }
+
+		// Parses the frame and loads its geometry on the ThreadPool, only one frame can be in flight at a time
+		void prefetch(int frame_index);
+
+		// Waits for the last prefetched frame, it stays valid until the next call to prefetch()
+		Frame & wait();
+
+	private:
+		ThreadPool::TaskGroup prefetch_group;
+		Frame                 prefetch_frame;
+	};
+}
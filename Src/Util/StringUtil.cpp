@@ -1,6 +1,7 @@
 #include "StringUtil.h"
 
 #include <cmath>
+#include "Core/Array.h"
 #include "Core/Assertion.h"
 #include "Core/StringView.h"
 
@@ -45,6 +46,49 @@ String Util::combine_stringviews(StringView a, StringView b, Allocator * allocat
 	return filename_abs;
 }
 
+String Util::normalize_path(StringView path, Allocator * allocator) {
+	Array<StringView> components;
+
+	bool is_absolute = path.size() > 0 && (path[0] == '/' || path[0] == '\\');
+
+	const char * cur = path.start;
+	while (cur < path.end) {
+		const char * component_start = cur;
+		while (cur < path.end && *cur != '/' && *cur != '\\') cur++;
+
+		StringView component = { component_start, cur };
+		cur++; // Skip separator
+
+		if (component.size() == 0 || component == ".") continue;
+
+		if (component == ".." && components.size() > 0 && components.back() != "..") {
+			components.pop_back();
+		} else {
+			components.push_back(component);
+		}
+	}
+
+	size_t length = is_absolute;
+	for (size_t i = 0; i < components.size(); i++) {
+		length += components[i].size() + (i > 0);
+	}
+
+	String result = String(length, allocator);
+	char * dst = result.data();
+
+	if (is_absolute) *dst++ = '/';
+
+	for (size_t i = 0; i < components.size(); i++) {
+		if (i > 0) *dst++ = '/';
+
+		memcpy(dst, components[i].start, components[i].size());
+		dst += components[i].size();
+	}
+	*dst = '\0';
+
+	return result;
+}
+
 const char * Util::find_last_after(StringView haystack, StringView needles) {
 	const char * cur        = haystack.data();
 	const char * last_match = nullptr;
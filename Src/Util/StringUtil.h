@@ -15,6 +15,9 @@ namespace Util {
 
 	String combine_stringviews(StringView path, StringView filename, Allocator * allocator = nullptr);
 
+	// Removes '.' and 'dir/..' components and converts backslashes, so that equivalent relative paths compare equal
+	String normalize_path(StringView path, Allocator * allocator = nullptr);
+
 	const char * find_last_after(StringView haystack, StringView needles);
 
 	const char * strstr(StringView haystack, StringView needle);
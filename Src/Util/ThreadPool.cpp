@@ -1,84 +1,544 @@
 #include "ThreadPool.h"
 
+#include <stdio.h>
+
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
 
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <pthread.h>
+	#include <sched.h>
+#endif
+
+#include "Config.h"
+
+#include "Core/IO.h"
 #include "Core/Array.h"
-#include "Core/Queue.h"
+#include "Core/MPMCQueue.h"
+#include "Core/Format.h"
+#include "Core/Parser.h"
+#include "Core/Allocators/StackAllocator.h"
+#include "Core/Allocators/LinearAllocator.h"
 
-static Array<std::thread> threads;
+#include "Profiler.h"
+
+struct Task {
+	ThreadPool::Work        work;
+	ThreadPool::TaskGroup * group;
+	ThreadPool::Priority    priority;
+};
+
+static constexpr int PRIORITY_COUNT = int(ThreadPool::Priority::COUNT);
+
+// Chase-Lev work stealing deque, see Lê et al. 2013
+// The owning worker pushes and pops at the bottom, other threads steal from the top
+struct WorkDeque {
+	static constexpr int CAPACITY = 1024; // Must be a power of two
+	static constexpr int MASK     = CAPACITY - 1;
+
+	std::atomic<long long> top    = 0;
+	std::atomic<long long> bottom = 0;
+
+	std::atomic<Task *> tasks[CAPACITY] = { };
+
+	// Only called by the owner, returns false if the deque is full
+	bool push(Task * task) {
+		long long b = bottom.load(std::memory_order_relaxed);
+		long long t = top   .load(std::memory_order_acquire);
+
+		if (b - t >= CAPACITY) return false;
+
+		tasks[b & MASK].store(task, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		bottom.store(b + 1, std::memory_order_relaxed);
+
+		return true;
+	}
+
+	// Only called by the owner
+	Task * pop() {
+		long long b = bottom.load(std::memory_order_relaxed) - 1;
+		bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		long long t = top.load(std::memory_order_relaxed);
+
+		if (t > b) {
+			// Empty
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		Task * task = tasks[b & MASK].load(std::memory_order_relaxed);
+
+		if (t == b) {
+			// Last Task, race against thieves
+			if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+				task = nullptr;
+			}
+			bottom.store(b + 1, std::memory_order_relaxed);
+		}
+
+		return task;
+	}
+
+	// Can be called by any thread
+	Task * steal() {
+		long long t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		long long b = bottom.load(std::memory_order_acquire);
+
+		if (t >= b) return nullptr;
 
-static Queue<ThreadPool::Work> work_queue;
+		Task * task = tasks[t & MASK].load(std::memory_order_relaxed);
 
-struct Signal {
-	std::condition_variable condition;
-	std::mutex              mutex;
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+			return nullptr; // Lost the race against another thief or the owner
+		}
+
+		return task;
+	}
 };
 
-static Signal signal_submit;
-static Signal signal_done;
+static Array<std::thread> threads;
+
+static WorkDeque * work_deques = nullptr; // PRIORITY_COUNT per worker thread, see get_work_deque
+
+static thread_local int worker_index = -1; // Index of the worker thread that is executing, -1 for other threads
+
+static thread_local ThreadPool::Priority thread_priority = ThreadPool::Priority::INTERACTIVE; // Priority of the Work that is executing
+
+static WorkDeque & get_work_deque(int worker, int priority) {
+	return work_deques[worker * PRIORITY_COUNT + priority];
+}
 
-static int              num_submitted = 0;
+static Array<int> worker_numa_nodes; // NUMA node every worker is pinned to, all 0 if the workers are not pinned
+static int        numa_node_count = 1;
+
+static thread_local int worker_numa_node = 0;
+
+// Per thread arena backing ThreadPool::task_allocator(), only constructed on threads that execute Work
+// Buffers are reused between Work, it only grows to the largest amount of temporary memory live on the thread at once
+using TaskArena = LinearAllocator<MEGABYTES(8)>;
+
+static thread_local TaskArena * task_arena = nullptr; // Non-null while the thread is executing Work
+
+// Work submitted from outside the worker threads, or from workers with a full deque. One per Priority
+static MPMCQueue<Task *, 4096> shared_queues[PRIORITY_COUNT];
+
+// Idle workers sleep until new Work is submitted
+static std::condition_variable sleep_condition;
+static std::mutex              sleep_mutex;
+
+static std::atomic<int> num_sleeping = 0;
+static std::atomic<int> num_queued   = 0; // Number of Tasks that have been submitted but not yet picked up
+
+static std::atomic<int> num_submitted = 0;
 static std::atomic<int> num_done      = 0;
 
 static std::atomic<bool> is_done;
 
+// Looks for Work of Priority max_priority or higher, higher Priorities are exhausted first
+static Task * try_get_task(ThreadPool::Priority max_priority) {
+	Task * task = nullptr;
+
+	for (int priority = 0; priority <= int(max_priority) && !task; priority++) {
+		// Own deque first, the most recently submitted Work is likely still in cache
+		if (worker_index != -1) {
+			task = get_work_deque(worker_index, priority).pop();
+		}
+
+		if (!task) {
+			shared_queues[priority].try_pop(task);
+		}
+
+		if (!task) {
+			// Steal, starting at the next worker to spread out contention
+			// Workers on the same NUMA node go first, their Work likely uses memory that is local to the node
+			int thread_count = int(threads.size());
+
+			for (int pass = 0; pass < (numa_node_count > 1 ? 2 : 1) && !task; pass++) {
+				for (int i = 1; i <= thread_count && !task; i++) {
+					int victim = (worker_index + i) % thread_count;
+					if (victim == worker_index) continue;
+
+					bool same_node = worker_numa_nodes[victim] == worker_numa_node;
+					if (same_node != (pass == 0)) continue;
+
+					task = get_work_deque(victim, priority).steal();
+				}
+			}
+		}
+	}
+
+	if (task) num_queued--;
+
+	return task;
+}
+
+// Work the calling thread may pick up while it waits, see ThreadPool::wait
+static Task * try_get_task() {
+	return try_get_task(thread_priority);
+}
+
+static void execute(Task * task) {
+	static thread_local TaskArena arena;
+
+	// Nested Work runs in between the allocations of the Work that is waiting on it, rewinding keeps those intact
+	TaskArena::Mark  mark            = arena.get_mark();
+	TaskArena      * task_arena_prev = task_arena;
+	task_arena = &arena;
+
+	ThreadPool::Priority priority_prev = thread_priority;
+	thread_priority = task->priority;
+
+	{
+		ProfileScope scope("Task"_sv, "ThreadPool"_sv); // Only ends up in the trace while the Profiler is recording
+		task->work();
+	}
+
+	thread_priority = priority_prev;
+
+	task_arena = task_arena_prev;
+	arena.rewind(mark);
+
+	ThreadPool::TaskGroup * group = task->group;
+	Allocator::free(nullptr, task);
+
+	// NOTE: The TaskGroup may be destroyed by its owner as soon as it is done
+	if (group) group->num_pending--;
+
+	num_done++;
+}
+
+// Executes Work of Priority max_priority or higher until the predicate is satisfied
+template<typename Predicate>
+static void help_until(ThreadPool::Priority max_priority, Predicate predicate) {
+	while (!predicate()) {
+		Task * task = try_get_task(max_priority);
+
+		if (task) {
+			execute(task);
+		} else {
+			// Remaining Work is being executed by other threads
+			std::this_thread::yield();
+		}
+	}
+}
+
+// Logical processors of every NUMA node, a single node with all logical processors if the topology is not available
+static Array<Array<int>> query_numa_nodes() {
+	Array<Array<int>> nodes;
+
+#ifdef _WIN32
+	DWORD size = 0;
+	GetLogicalProcessorInformationEx(RelationNumaNode, nullptr, &size);
+
+	Array<char> buffer(size);
+	if (GetLogicalProcessorInformationEx(RelationNumaNode, reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *>(buffer.data()), &size)) {
+		for (DWORD offset = 0; offset < size; ) {
+			const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX * info = reinterpret_cast<const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *>(buffer.data() + offset);
+			const GROUP_AFFINITY & mask = info->NumaNode.GroupMask;
+
+			// Logical processors are numbered across processor groups of 64
+			Array<int> & node = nodes.emplace_back();
+			for (int bit = 0; bit < 64; bit++) {
+				if (mask.Mask & (KAFFINITY(1) << bit)) node.push_back(int(mask.Group) * 64 + bit);
+			}
+			if (node.size() == 0) nodes.pop_back();
+
+			offset += info->Size;
+		}
+	}
+#else
+	static constexpr int MAX_NUMA_NODES = 64; // Node numbers can have gaps, so every number up to this is tried
+
+	for (int n = 0; n < MAX_NUMA_NODES; n++) {
+		char filename[64];
+		snprintf(filename, sizeof(filename), "/sys/devices/system/node/node%i/cpulist", n);
+
+		FILE * file = fopen(filename, "r");
+		if (!file) continue;
+
+		// Comma separated ranges, for example "0-15,32-47"
+		char line[1024] = { };
+		fgets(line, sizeof(line), file);
+		fclose(file);
+
+		Array<int> node;
+
+		Parser parser(StringView::from_c_str(line));
+		while (!parser.reached_end() && is_digit(*parser.cur)) {
+			int first = parser.parse_int();
+			int last  = parser.match('-') ? parser.parse_int() : first;
+
+			for (int i = first; i <= last; i++) {
+				node.push_back(i);
+			}
+			if (!parser.match(',')) break;
+		}
+
+		if (node.size() > 0) nodes.push_back(std::move(node));
+	}
+#endif
+
+	if (nodes.size() == 0) {
+		Array<int> & node = nodes.emplace_back();
+		for (int i = 0; i < int(std::thread::hardware_concurrency()); i++) {
+			node.push_back(i);
+		}
+	}
+	return nodes;
+}
+
+static bool pin_thread(std::thread & thread, const int * processors, int processor_count) {
+#ifdef _WIN32
+	// A thread can only run in one processor group, all processors of a NUMA node are in the same group
+	GROUP_AFFINITY affinity = { };
+	affinity.Group = WORD(processors[0] / 64);
+	for (int i = 0; i < processor_count; i++) {
+		affinity.Mask |= KAFFINITY(1) << (processors[i] % 64);
+	}
+	return SetThreadGroupAffinity(thread.native_handle(), &affinity, nullptr) != 0;
+#else
+	cpu_set_t cpu_set;
+	CPU_ZERO(&cpu_set);
+	for (int i = 0; i < processor_count; i++) {
+		CPU_SET(processors[i], &cpu_set);
+	}
+	return pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set), &cpu_set) == 0;
+#endif
+}
+
 void ThreadPool::init() {
-	init(std::thread::hardware_concurrency());
+	int thread_count = cpu_config.thread_count > 0 ? cpu_config.thread_count : int(std::thread::hardware_concurrency());
+
+	init(thread_count, cpu_config.thread_affinity);
 }
 
 void ThreadPool::init(int thread_count) {
+	init(thread_count, ThreadAffinity::NONE);
+}
+
+void ThreadPool::init(int thread_count, ThreadAffinity affinity) {
+	ASSERT(thread_count > 0);
+
+	num_submitted = 0;
+	num_done      = 0;
+	num_queued    = 0;
+	num_sleeping  = 0;
+
+	is_done = false;
+
+	work_deques = Allocator::alloc_array<WorkDeque>(nullptr, thread_count * PRIORITY_COUNT);
+
+	Array<Array<int>> numa_nodes;
+	if (affinity != ThreadAffinity::NONE) {
+		numa_nodes = query_numa_nodes();
+	}
+
+	// Every worker knows its node before any Work is submitted
+	worker_numa_nodes.resize(thread_count);
+	for (int i = 0; i < thread_count; i++) {
+		worker_numa_nodes[i] = 0;
+	}
+	numa_node_count = 1;
+
+	Array<int> processors; // Logical processors of all nodes, one node after the other
+	Array<int> processor_nodes;
+	for (size_t n = 0; n < numa_nodes.size(); n++) {
+		for (size_t i = 0; i < numa_nodes[n].size(); i++) {
+			processors     .push_back(numa_nodes[n][i]);
+			processor_nodes.push_back(int(n));
+		}
+	}
+
+	for (int i = 0; i < thread_count; i++) {
+		if (affinity == ThreadAffinity::CORE) {
+			worker_numa_nodes[i] = processor_nodes[i % processors.size()];
+		} else if (affinity == ThreadAffinity::NODE) {
+			worker_numa_nodes[i] = i % int(numa_nodes.size());
+		}
+		numa_node_count = Math::max(numa_node_count, worker_numa_nodes[i] + 1);
+	}
+
 	threads.resize(thread_count);
 
-	for (size_t i = 0; i < threads.size(); i++) {
-		threads[i] = std::thread([]() {
-			while (true) {
-				Work work;
-				{
-					std::unique_lock<std::mutex> lock(signal_submit.mutex);
-					signal_submit.condition.wait(lock, []{ return !work_queue.is_empty() || is_done; });
+	for (int i = 0; i < thread_count; i++) {
+		threads[i] = std::thread([i]() {
+			worker_index     = i;
+			worker_numa_node = worker_numa_nodes[i];
 
-					if (is_done) return;
+			StackAllocator<BYTES(64)> allocator;
+			Profiler::set_thread_name(Format(&allocator).format("Worker {}"_sv, i).view());
 
-					work = work_queue.pop();
+			while (true) {
+				Task * task = try_get_task(ThreadPool::Priority(PRIORITY_COUNT - 1)); // Idle workers take anything
+				if (task) {
+					execute(task);
+					continue;
 				}
-				work();
 
-				num_done++;
-				signal_done.condition.notify_one();
+				std::unique_lock<std::mutex> lock(sleep_mutex);
+				num_sleeping++;
+				sleep_condition.wait(lock, []{ return num_queued > 0 || is_done; });
+				num_sleeping--;
+
+				if (is_done) return;
 			}
 		});
+
+		bool pinned = true;
+		if (affinity == ThreadAffinity::CORE) {
+			pinned = pin_thread(threads[i], &processors[i % processors.size()], 1);
+		} else if (affinity == ThreadAffinity::NODE) {
+			const Array<int> & node = numa_nodes[worker_numa_nodes[i]];
+			pinned = pin_thread(threads[i], node.data(), int(node.size()));
+		}
+		if (!pinned) {
+			IO::print("WARNING: Unable to set the affinity of ThreadPool worker {}!\n"_sv, i);
+		}
 	}
 
-	num_submitted = 0;
-	num_done      = 0;
+	if (affinity != ThreadAffinity::NONE) {
+		IO::print("ThreadPool: {} workers pinned to {} NUMA node(s)\n"_sv, thread_count, numa_node_count);
+	}
 }
 
 void ThreadPool::free() {
+	// Work submitted without a TaskGroup is not waited on by anyone else (e.g. BVH files being written in the background)
+	sync();
+
 	{
-		std::lock_guard<std::mutex> lock(signal_submit.mutex);
+		std::lock_guard<std::mutex> lock(sleep_mutex);
 		is_done = true;
 	}
-	signal_submit.condition.notify_all();
+	sleep_condition.notify_all();
 
 	for (size_t i = 0; i < threads.size(); i++) {
 		threads[i].join();
 	}
+	threads.clear();
+
+	Allocator::free_array(nullptr, work_deques);
+	work_deques = nullptr;
 }
 
-void ThreadPool::submit(Work && work) {
+static void submit_task(ThreadPool::Work && work, ThreadPool::TaskGroup * group, ThreadPool::Priority priority) {
+	Task * task = Allocator::alloc<Task>(nullptr, std::move(work), group, priority);
+
+	if (group) group->num_pending++;
+
 	num_submitted++;
 
-	{
-		std::lock_guard<std::mutex> lock(signal_submit.mutex);
-		work_queue.push(std::move(work));
+	// Workers push onto their own deque, other threads (or a full deque) use the shared queue
+	if (worker_index == -1 || !get_work_deque(worker_index, int(priority)).push(task)) {
+		while (!shared_queues[int(priority)].try_push(task)) {
+			// Shared queue is full, execute queued Work until there is room
+			Task * other = try_get_task();
+			if (other) {
+				execute(other);
+			} else {
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	// NOTE: num_queued must be incremented before num_sleeping is read, see the sleep predicate of the workers
+	num_queued++;
+
+	if (num_sleeping > 0) {
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex);
+		}
+		sleep_condition.notify_one();
 	}
-	signal_submit.condition.notify_one();
+}
+
+void ThreadPool::submit(Work && work) {
+	submit_task(std::move(work), nullptr, thread_priority);
+}
+
+void ThreadPool::submit(TaskGroup & group, Work && work) {
+	submit_task(std::move(work), &group, thread_priority);
+}
+
+void ThreadPool::submit(Work && work, Priority priority) {
+	submit_task(std::move(work), nullptr, priority);
+}
+
+void ThreadPool::submit(TaskGroup & group, Work && work, Priority priority) {
+	submit_task(std::move(work), &group, priority);
 }
 
 void ThreadPool::sync() {
-	std::unique_lock<std::mutex> lock(signal_done.mutex);
-	signal_done.condition.wait(lock, []{ return num_done == num_submitted; });
+	ASSERT(worker_index == -1);
+
+	help_until(Priority(PRIORITY_COUNT - 1), []() { return num_done == num_submitted; });
+}
+
+void ThreadPool::parallel_for(int count, Function<void(int)> && job) {
+	if (count == 1) {
+		job(0);
+		return;
+	}
+
+	TaskGroup group;
+
+	for (int i = 0; i < count; i++) {
+		submit(group, [&job, i]() {
+			job(i);
+		});
+	}
+
+	wait(group);
+}
+
+void ThreadPool::parallel_for(int first, int last, int grain_size, Function<void(int, int)> && job) {
+	ASSERT(grain_size > 0);
+
+	if (last - first <= grain_size) {
+		if (last > first) job(first, last);
+		return;
+	}
+
+	int chunk_count = (last - first + grain_size - 1) / grain_size;
+
+	parallel_for(chunk_count, [first, last, grain_size, &job](int chunk_index) {
+		int chunk_first = first + chunk_index * grain_size;
+		int chunk_last  = chunk_first + grain_size < last ? chunk_first + grain_size : last;
+
+		job(chunk_first, chunk_last);
+	});
+}
+
+int ThreadPool::get_numa_node() {
+	return worker_numa_node;
+}
+
+int ThreadPool::get_numa_node_count() {
+	return numa_node_count;
+}
+
+Allocator * ThreadPool::task_allocator() {
+	return task_arena;
+}
+
+void ThreadPool::help() {
+	Task * task = try_get_task();
+
+	if (task) {
+		execute(task);
+	} else {
+		std::this_thread::yield();
+	}
+}
+
+void ThreadPool::wait(const TaskGroup & group) {
+	help_until(thread_priority, [&group]() { return group.is_done(); });
 }
@@ -1,14 +1,122 @@
 #pragma once
+#include <atomic>
+
+#include "Core/Array.h"
 #include "Core/Function.h"
+#include "Core/Constructors.h"
+#include "Core/Allocators/Allocator.h"
+
+enum struct ThreadAffinity;
 
+// Work stealing ThreadPool
+// Every worker thread owns a Chase-Lev deque, Work submitted from a worker is pushed onto its own deque
+// and idle workers steal from the deques of others. Work submitted from any other thread goes through a shared queue.
+// There is a set of deques and a shared queue per Priority, a worker always picks up the highest Priority Work that is queued
+// once its current Work finishes. Running Work is never interrupted
+// Workers can be pinned to the NUMA nodes of the machine, in which case they steal from workers on their own node first
 namespace ThreadPool {
 	using Work = Function<void()>;
 
-	void init();
+	enum struct Priority {
+		INTERACTIVE, // Work that a frame or the user is waiting on right now
+		BACKGROUND,  // Bulk Work that nothing waits on soon (writing caches and files), only runs when no INTERACTIVE Work is queued
+		COUNT
+	};
+
+	// Tracks a set of submitted Work, so that callers can wait on only their own Work
+	struct TaskGroup {
+		std::atomic<int> num_pending = 0;
+
+		TaskGroup() = default;
+
+		NON_COPYABLE(TaskGroup);
+		NON_MOVEABLE(TaskGroup);
+
+		bool is_done() const { return num_pending == 0; }
+	};
+
+	void init(); // Uses cpu_config.thread_count and cpu_config.thread_affinity
 	void init(int thread_count);
-	void free();
+	void init(int thread_count, ThreadAffinity affinity);
+	void free(); // Finishes all submitted Work first
 
+	// Without a Priority the Work gets the Priority of the Work that submits it, INTERACTIVE outside of Work
+	// This way the jobs of a parallel_for inside BACKGROUND Work do not get ahead of INTERACTIVE Work
 	void submit(Work && work);
+	void submit(TaskGroup & group, Work && work);
+	void submit(Work && work, Priority priority);
+	void submit(TaskGroup & group, Work && work, Priority priority);
 
+	// Waits for all submitted Work to finish, executing Work of any Priority in the meantime
+	// NOTE: Must not be called from inside Work, use a TaskGroup instead
 	void sync();
+
+	// Runs job(0) ... job(count - 1) on the ThreadPool and waits for only those jobs to finish
+	// The calling thread helps out executing Work, so unlike sync() this is safe to use from inside Work
+	void parallel_for(int count, Function<void(int)> && job);
+
+	// Splits [first, last) into chunks of at most grain_size indices and runs job(chunk_first, chunk_last) for every chunk
+	// Ranges that fit in a single chunk are executed directly on the calling thread
+	void parallel_for(int first, int last, int grain_size, Function<void(int, int)> && job);
+
+	// Computes reduce(... reduce(reduce(identity, map(first)), map(first + 1)) ..., map(last - 1)) in parallel
+	// Chunks are reduced serially and combined in order, so the result does not depend on scheduling
+	template<typename T, typename Map, typename Reduce>
+	T parallel_reduce(int first, int last, int grain_size, const T & identity, Map map, Reduce reduce) {
+		if (last <= first) return identity;
+
+		int chunk_count = (last - first + grain_size - 1) / grain_size;
+
+		Array<T> chunk_results(chunk_count);
+
+		parallel_for(first, last, grain_size, [&](int chunk_first, int chunk_last) {
+			T result = identity;
+			for (int i = chunk_first; i < chunk_last; i++) {
+				result = reduce(result, map(i));
+			}
+			chunk_results[(chunk_first - first) / grain_size] = result;
+		});
+
+		T result = identity;
+		for (int i = 0; i < chunk_count; i++) {
+			result = reduce(result, chunk_results[i]);
+		}
+		return result;
+	}
+
+	// Constructs array[i] = init(i) for i in [0, count) in parallel, see Array::resize_uninitialized
+	// Fresh pages are placed on the NUMA node of the thread that writes them first, so instead of ending up on the node
+	// of the calling thread the pages of large arrays are spread over the nodes of the workers that will read them
+	template<typename T, typename Init>
+	void parallel_init(Array<T> & array, size_t count, Init init) {
+		static constexpr int GRAIN_SIZE = sizeof(T) < KILOBYTES(64) ? int(KILOBYTES(64) / sizeof(T)) : 1;
+
+		array.resize_uninitialized(count);
+
+		parallel_for(0, int(count), GRAIN_SIZE, [&](int first, int last) {
+			for (int i = first; i < last; i++) {
+				new (&array[i]) T(init(i));
+			}
+		});
+	}
+
+	// NUMA node of the calling worker thread, 0 for other threads and when the workers are not pinned
+	int get_numa_node();
+	int get_numa_node_count();
+
+	// Arena of the calling thread for temporary memory of the Work that is currently executing
+	// Everything allocated from it is released when that Work finishes, so it must not outlive the Work or be handed to other Work
+	// Nested Work (executed while waiting) gets its own region of the same arena. Returns nullptr (the global heap) outside of Work
+	Allocator * task_allocator();
+
+	// Executes one queued Work on the calling thread, or yields if there is none
+	// Allows a thread that is polling for results to help out in the meantime
+	// Only Work of the same or a higher Priority than that of the calling thread is executed, see wait()
+	void help();
+
+	// Waits until all Work in the TaskGroup is done, executing other Work in the meantime
+	// Safe to use from inside Work, which allows nested fork/join
+	// Only Work of the same or a higher Priority is picked up, so that waiting on INTERACTIVE Work does not get stuck
+	// behind BACKGROUND Work. The TaskGroup must therefore not contain Work of a lower Priority than the waiting thread
+	void wait(const TaskGroup & group);
 };
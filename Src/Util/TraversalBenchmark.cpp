@@ -0,0 +1,299 @@
+#include "TraversalBenchmark.h"
+
+static int occupancy_shared_stack_size; // The occupancy callback cannot capture, so it reads the Shared Stack size from here
+
+// Like Integrator::kernel_trace_calc_grid_and_block_size, but for the Shared Stack size this Module was compiled with
+template<size_t BVH_STACK_ELEMENT_SIZE>
+static void calc_grid_and_block_size(CUDAKernel & kernel, int shared_stack_size) {
+	occupancy_shared_stack_size = shared_stack_size;
+
+	CUoccupancyB2DSize block_size_to_shared_memory = [](int block_size) {
+		if (BVH_STACK_ELEMENT_SIZE == 8 && cpu_config.enable_bvh8_short_stack) return size_t(0);
+
+		return size_t(block_size) * occupancy_shared_stack_size * BVH_STACK_ELEMENT_SIZE;
+	};
+
+	int grid, block;
+	CUDACALL(cuOccupancyMaxPotentialBlockSize(&grid, &block, kernel.kernel, block_size_to_shared_memory, 0, 0));
+
+	int block_x = WARP_SIZE;
+	int block_y = block / WARP_SIZE;
+
+	kernel.set_block_dim(block_x, block_y, 1);
+	kernel.set_grid_dim(1, grid, 1);
+	kernel.set_shared_memory(block_size_to_shared_memory(block));
+}
+
+void TraversalBenchmark::cuda_init(unsigned frame_buffer_handle, int screen_width, int screen_height) {
+	init_module();
+	init_globals();
+
+	global_buffer_sizes    = cuda_module.get_global("buffer_sizes");
+	global_traversal_stats = cuda_module.get_global("traversal_stats");
+
+	buffer_sizes = { };
+
+	resize_init(frame_buffer_handle, screen_width, screen_height);
+
+	scene.asset_manager.wait_until_loaded();
+
+	init_geometry();
+	init_rng();
+
+	event_desc_start = CUDAEvent::Desc { 0, "Traversal"_sv, "Trace"_sv };
+	event_desc_end   = CUDAEvent::Desc { 1, "END"_sv,       "END"_sv };
+
+	Integrator::cuda_init(frame_buffer_handle, screen_width, screen_height);
+}
+
+void TraversalBenchmark::cuda_free() {
+	Integrator::cuda_free();
+
+	free_geometry();
+
+	gpu_scene->free(); // Not handed over to another Integrator
+}
+
+void TraversalBenchmark::init_module() {
+	ASSERT(shared_stack_size > 0 && shared_stack_size < BVH_STACK_SIZE);
+
+	Array<String> defines;
+	defines.push_back(Format().format("-DSHARED_STACK_SIZE={}"_sv, shared_stack_size));
+	if (cpu_config.enable_bvh8_short_stack) {
+		defines.push_back("-DCONFIG_BVH8_SHORT_STACK=1"_sv);
+	}
+
+	cuda_module.init("TraversalBenchmark"_sv, "Src/CUDA/TraversalBenchmark.cu"_sv, CUDAContext::compute_capability, MAX_REGISTERS, defines);
+
+	kernel_generate_primary  .init(&cuda_module, "kernel_generate_primary");
+	kernel_generate_secondary.init(&cuda_module, "kernel_generate_secondary");
+
+	kernel_trace_bvh2       .init(&cuda_module, "kernel_trace_bvh2");
+	kernel_trace_bvh4       .init(&cuda_module, "kernel_trace_bvh4");
+	kernel_trace_bvh8       .init(&cuda_module, "kernel_trace_bvh8");
+	kernel_trace_shadow_bvh2.init(&cuda_module, "kernel_trace_shadow_bvh2");
+	kernel_trace_shadow_bvh4.init(&cuda_module, "kernel_trace_shadow_bvh4");
+	kernel_trace_shadow_bvh8.init(&cuda_module, "kernel_trace_shadow_bvh8");
+
+	kernel_trace_stats_bvh2       .init(&cuda_module, "kernel_trace_stats_bvh2");
+	kernel_trace_stats_bvh4       .init(&cuda_module, "kernel_trace_stats_bvh4");
+	kernel_trace_stats_bvh8       .init(&cuda_module, "kernel_trace_stats_bvh8");
+	kernel_trace_shadow_stats_bvh2.init(&cuda_module, "kernel_trace_shadow_stats_bvh2");
+	kernel_trace_shadow_stats_bvh4.init(&cuda_module, "kernel_trace_shadow_stats_bvh4");
+	kernel_trace_shadow_stats_bvh8.init(&cuda_module, "kernel_trace_shadow_stats_bvh8");
+
+	switch (cpu_config.bvh_type) {
+		case BVHType::BVH:
+		case BVHType::SBVH: {
+			kernel_trace              = &kernel_trace_bvh2;
+			kernel_trace_shadow       = &kernel_trace_shadow_bvh2;
+			kernel_trace_stats        = &kernel_trace_stats_bvh2;
+			kernel_trace_shadow_stats = &kernel_trace_shadow_stats_bvh2;
+			break;
+		}
+		case BVHType::BVH4: {
+			kernel_trace              = &kernel_trace_bvh4;
+			kernel_trace_shadow       = &kernel_trace_shadow_bvh4;
+			kernel_trace_stats        = &kernel_trace_stats_bvh4;
+			kernel_trace_shadow_stats = &kernel_trace_shadow_stats_bvh4;
+			break;
+		}
+		case BVHType::BVH8: {
+			kernel_trace              = &kernel_trace_bvh8;
+			kernel_trace_shadow       = &kernel_trace_shadow_bvh8;
+			kernel_trace_stats        = &kernel_trace_stats_bvh8;
+			kernel_trace_shadow_stats = &kernel_trace_shadow_stats_bvh8;
+			break;
+		}
+		default: ASSERT_UNREACHABLE();
+	}
+
+	kernel_generate_primary  .set_block_dim(256, 1, 1);
+	kernel_generate_secondary.set_block_dim(256, 1, 1);
+
+	// BVH8 uses a stack of int2's (8 bytes)
+	// Other BVH's use a stack of ints (4 bytes)
+	size_t stack_element_size = cpu_config.bvh_type == BVHType::BVH8 ? 8 : 4;
+
+	CUDAKernel * trace_kernels[] = { kernel_trace, kernel_trace_shadow, kernel_trace_stats, kernel_trace_shadow_stats };
+	for (int i = 0; i < Util::array_count(trace_kernels); i++) {
+		if (stack_element_size == 8) {
+			calc_grid_and_block_size<8>(*trace_kernels[i], shared_stack_size);
+		} else {
+			calc_grid_and_block_size<4>(*trace_kernels[i], shared_stack_size);
+		}
+	}
+}
+
+void TraversalBenchmark::resize_init(unsigned frame_buffer_handle, int width, int height) {
+	screen_width   = width;
+	screen_height  = height;
+	screen_pitch   = Math::round_up(width, WARP_SIZE);
+	display_width  = width;
+	display_height = height;
+
+	alloc_screen_pitch  = screen_pitch;
+	alloc_screen_height = screen_height;
+
+	pixel_count = width * height;
+
+	cuda_module.get_global("screen_width") .set_value(screen_width);
+	cuda_module.get_global("screen_pitch") .set_value(screen_pitch);
+	cuda_module.get_global("screen_height").set_value(screen_height);
+
+	{
+		CUDAMemory::CategoryScope memory_scope(CUDAMemory::Category::WAVEFRONT);
+
+		ray_set_primary   .init(pixel_count);
+		ray_set_diffuse   .init(pixel_count);
+		ray_set_incoherent.init(pixel_count);
+		ray_set_shadow    .init(pixel_count);
+	}
+	cuda_module.get_global("ray_set_primary")   .set_value(ray_set_primary);
+	cuda_module.get_global("ray_set_diffuse")   .set_value(ray_set_diffuse);
+	cuda_module.get_global("ray_set_incoherent").set_value(ray_set_incoherent);
+	cuda_module.get_global("ray_set_shadow")    .set_value(ray_set_shadow);
+
+	kernel_generate_primary  .set_grid_dim(Math::divide_round_up(pixel_count, kernel_generate_primary  .block_dim_x), 1, 1);
+	kernel_generate_secondary.set_grid_dim(Math::divide_round_up(pixel_count, kernel_generate_secondary.block_dim_x), 1, 1);
+
+	scene.camera.resize(width, height);
+	invalidated_camera = true;
+
+	sample_index = 0;
+}
+
+void TraversalBenchmark::resize_free() {
+	CUDACALL(cuStreamSynchronize(memory_stream));
+
+	ray_set_primary   .free();
+	ray_set_diffuse   .free();
+	ray_set_incoherent.free();
+	ray_set_shadow    .free();
+}
+
+void TraversalBenchmark::render() {
+	CUDACALL(cuStreamSynchronize(memory_stream));
+
+	generate_ray_sets();
+
+	sync_tlas();
+}
+
+void TraversalBenchmark::generate_ray_sets() {
+	buffer_sizes = { };
+	buffer_sizes.primary = pixel_count;
+	global_buffer_sizes.set_value(buffer_sizes);
+
+	kernel_generate_primary.execute(get_rng_sample_index());
+	launch_trace(RaySet::PRIMARY, false); // The other Ray sets are derived from the hits of the Primary Rays
+	kernel_generate_secondary.execute(get_rng_sample_index());
+
+	buffer_sizes = global_buffer_sizes.get_value<BufferSizes>();
+}
+
+void TraversalBenchmark::launch_trace(RaySet ray_set, bool collect_stats) {
+	CUDACALL(cuMemsetD32Async(global_buffer_sizes.ptr + offsetof(BufferSizes, rays_retired), 0, 1, nullptr));
+
+	if (ray_set == RaySet::SHADOW) {
+		(collect_stats ? kernel_trace_shadow_stats : kernel_trace_shadow)->execute();
+	} else {
+		(collect_stats ? kernel_trace_stats : kernel_trace)->execute(ray_set);
+	}
+}
+
+Array<TraversalBenchmark::Result> TraversalBenchmark::run(int iteration_count) {
+	ASSERT(iteration_count > 0);
+
+	Array<Result> results;
+
+	for (int s = 0; s < int(RaySet::COUNT); s++) {
+		RaySet ray_set = RaySet(s);
+
+		int ray_counts[] = { buffer_sizes.primary, buffer_sizes.diffuse, buffer_sizes.incoherent, buffer_sizes.shadow };
+
+		Result & result = results.emplace_back();
+		result = { };
+		result.ray_set   = ray_set;
+		result.ray_count = ray_counts[s];
+
+		if (result.ray_count == 0) continue;
+
+		launch_trace(ray_set, false); // Warm up
+
+		event_pool.reset();
+		event_pool.record(&event_desc_start);
+		for (int i = 0; i < iteration_count; i++) {
+			launch_trace(ray_set, false);
+		}
+		event_pool.record(&event_desc_end);
+
+		CUDACALL(cuEventSynchronize(event_pool.pool[1].event));
+
+		result.time             = double(CUDAEvent::time_elapsed_between(event_pool.pool[0], event_pool.pool[1])) / double(iteration_count);
+		result.mrays_per_second = double(result.ray_count) / (1000.0 * result.time);
+
+		// The counting Kernels run separately, so that the atomics do not affect the timings
+		TraversalStats stats = { };
+		global_traversal_stats.set_value(stats);
+
+		launch_trace(ray_set, true);
+
+		stats = global_traversal_stats.get_value<TraversalStats>();
+
+		double inv_ray_count = 1.0 / double(result.ray_count);
+
+		result.node_tests_per_ray     = double(stats.node_tests)     * inv_ray_count;
+		result.triangle_tests_per_ray = double(stats.triangle_tests) * inv_ray_count;
+		result.stack_spills_per_ray   = double(stats.stack_spills)   * inv_ray_count;
+		result.stack_overflows        = stats.stack_overflows;
+	}
+
+	return results;
+}
+
+double TraversalBenchmark::CostModel::sah_time(const Result & result) const {
+	return sah_scale * (cpu_config.sah_cost_node * result.node_tests_per_ray + cpu_config.sah_cost_leaf * result.triangle_tests_per_ray);
+}
+
+TraversalBenchmark::CostModel TraversalBenchmark::fit_cost_model(const Array<Result> & results) {
+	// Normal equations of the least squares fit without intercept
+	double nn = 0.0, nt = 0.0, tt = 0.0;
+	double ny = 0.0, ty = 0.0;
+	double ss = 0.0, sy = 0.0;
+
+	CostModel cost_model = { };
+
+	for (size_t i = 0; i < results.size(); i++) {
+		const Result & result = results[i];
+		if (result.ray_count == 0) continue;
+
+		double n = result.node_tests_per_ray;
+		double t = result.triangle_tests_per_ray;
+		double y = cost_model.measured_time(result);
+		double s = cpu_config.sah_cost_node * n + cpu_config.sah_cost_leaf * t;
+
+		nn += n * n; nt += n * t; tt += t * t;
+		ny += n * y; ty += t * y;
+		ss += s * s; sy += s * y;
+	}
+
+	if (ss > 0.0) {
+		cost_model.sah_scale = sy / ss;
+	}
+
+	double det = nn * tt - nt * nt;
+	if (!(det > 1e-6 * nn * tt)) return cost_model; // All Ray sets visit Nodes and Triangles in the same ratio
+
+	cost_model.node_cost     = (ny * tt - ty * nt) / det;
+	cost_model.triangle_cost = (ty * nn - ny * nt) / det;
+
+	// Negative costs mean the timings are dominated by something other than Node and Triangle tests (e.g. too few Rays)
+	if (!(cost_model.node_cost > 0.0 && cost_model.triangle_cost > 0.0)) return cost_model;
+
+	cost_model.valid = true;
+	cost_model.suggested_sah_cost_leaf = cpu_config.sah_cost_leaf;
+	cost_model.suggested_sah_cost_node = float(double(cpu_config.sah_cost_leaf) * cost_model.node_cost / cost_model.triangle_cost);
+
+	return cost_model;
+}
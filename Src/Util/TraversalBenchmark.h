@@ -0,0 +1,177 @@
+#pragma once
+#include "Renderer/Integrators/Integrator.h"
+
+#include "Util.h"
+
+// Times only the BVH traversal Kernels, on fixed sets of Rays that are generated once from the Scene (see TraversalBenchmark.cu)
+// Reuses the Geometry and TLAS upload of the Integrator, nothing is shaded or accumulated
+// The shared part of the traversal Stack can be resized to evaluate SHARED_STACK_SIZE, which only affects this Module
+struct TraversalBenchmark final : Integrator {
+	enum struct RaySet {
+		PRIMARY,
+		DIFFUSE,
+		INCOHERENT,
+		SHADOW,
+
+		COUNT
+	};
+
+	static constexpr const char * ray_set_names[] = { "Primary", "Diffuse", "Incoherent", "Shadow" };
+	static_assert(Util::array_count(ray_set_names) == int(RaySet::COUNT));
+
+	struct RaySetBuffer {
+		CUDAVector3_SoA ray_origin;
+		CUDAVector3_SoA ray_direction;
+
+		CUDAMemory::Ptr<float4> hits;
+
+		CUDAMemory::Ptr<float> ray_time; // Not allocated, the Ray sets are traced at the Transforms of the current frame
+
+		void init(int buffer_size) {
+			ray_origin   .init(buffer_size);
+			ray_direction.init(buffer_size);
+
+			hits = CUDAMemory::malloc<float4>(buffer_size);
+		}
+
+		void free() {
+			ray_origin.free();
+			ray_direction.free();
+
+			CUDAMemory::free(hits);
+		}
+	};
+
+	struct ShadowRaySetBuffer {
+		CUDAVector3_SoA ray_origin;
+		CUDAVector3_SoA ray_direction;
+
+		CUDAMemory::Ptr<float> max_distance;
+		CUDAMemory::Ptr<float> ray_time; // Not allocated
+
+		void init(int buffer_size) {
+			ray_origin   .init(buffer_size);
+			ray_direction.init(buffer_size);
+
+			max_distance = CUDAMemory::malloc<float>(buffer_size);
+		}
+
+		void free() {
+			ray_origin.free();
+			ray_direction.free();
+
+			CUDAMemory::free(max_distance);
+		}
+	};
+
+	struct BufferSizes {
+		int primary;
+		int diffuse;
+		int incoherent;
+		int shadow;
+
+		int rays_retired;
+	};
+
+	// Mirrors TraversalStats in BVH.h
+	struct TraversalStats {
+		unsigned long long node_tests;
+		unsigned long long triangle_tests;
+		unsigned long long stack_spills;
+		unsigned           stack_overflows;
+	};
+
+	struct Result {
+		RaySet ray_set;
+		int    ray_count;
+
+		double time; // Average over all iterations, in milliseconds
+		double mrays_per_second;
+
+		double node_tests_per_ray;
+		double triangle_tests_per_ray;
+		double stack_spills_per_ray;
+		unsigned stack_overflows;
+	};
+
+	// The SAH models the cost of a Ray as sah_cost_node per Node visited plus sah_cost_leaf per Triangle tested
+	// Fitting the measured time per Ray of all Ray sets to that model gives the costs of the GPU and the device, instead of textbook constants
+	struct CostModel {
+		bool valid; // The fit needs at least two Ray sets with a different ratio of Node to Triangle tests
+
+		double node_cost;     // Nanoseconds per Node visited
+		double triangle_cost; // Nanoseconds per Triangle tested
+
+		double sah_scale; // Least squares scale from the SAH model with the constants of cpu_config to nanoseconds
+
+		// Only the ratio affects the builders, so sah_cost_leaf is kept and sah_cost_node is rescaled
+		float suggested_sah_cost_node;
+		float suggested_sah_cost_leaf;
+
+		double measured_time(const Result & result) const { return 1e6 * result.time / double(result.ray_count); }
+		double fitted_time  (const Result & result) const { return node_cost * result.node_tests_per_ray + triangle_cost * result.triangle_tests_per_ray; }
+		double sah_time     (const Result & result) const;
+	};
+
+	static CostModel fit_cost_model(const Array<Result> & results);
+
+	CUDAKernel kernel_generate_primary;
+	CUDAKernel kernel_generate_secondary;
+
+	CUDAKernel kernel_trace_bvh2;
+	CUDAKernel kernel_trace_bvh4;
+	CUDAKernel kernel_trace_bvh8;
+	CUDAKernel kernel_trace_shadow_bvh2;
+	CUDAKernel kernel_trace_shadow_bvh4;
+	CUDAKernel kernel_trace_shadow_bvh8;
+
+	CUDAKernel kernel_trace_stats_bvh2;
+	CUDAKernel kernel_trace_stats_bvh4;
+	CUDAKernel kernel_trace_stats_bvh8;
+	CUDAKernel kernel_trace_shadow_stats_bvh2;
+	CUDAKernel kernel_trace_shadow_stats_bvh4;
+	CUDAKernel kernel_trace_shadow_stats_bvh8;
+
+	CUDAKernel * kernel_trace              = nullptr;
+	CUDAKernel * kernel_trace_shadow       = nullptr;
+	CUDAKernel * kernel_trace_stats        = nullptr;
+	CUDAKernel * kernel_trace_shadow_stats = nullptr;
+
+	RaySetBuffer       ray_set_primary;
+	RaySetBuffer       ray_set_diffuse;
+	RaySetBuffer       ray_set_incoherent;
+	ShadowRaySetBuffer ray_set_shadow;
+
+	BufferSizes buffer_sizes; // Number of Rays in every set, valid after generate_ray_sets
+
+	CUDAModule::Global global_traversal_stats;
+
+	int shared_stack_size;
+
+	CUDAEvent::Desc event_desc_start;
+	CUDAEvent::Desc event_desc_end;
+
+	TraversalBenchmark(int width, int height, Scene & scene, int shared_stack_size) : Integrator(scene, nullptr), shared_stack_size(shared_stack_size) {
+		cuda_init(0, width, height);
+	}
+
+	void cuda_init(unsigned frame_buffer_handle, int screen_width, int screen_height) override;
+	void cuda_free() override;
+
+	void init_module();
+
+	void resize_init(unsigned frame_buffer_handle, int width, int height) override;
+	void resize_free()                                                    override;
+
+	void render() override; // Regenerates the Ray sets from the current Camera
+
+	void render_gui() override { }
+
+	// Traces every Ray set iteration_count times, followed by one traced with the counting Kernels
+	Array<Result> run(int iteration_count);
+
+	void generate_ray_sets();
+
+private:
+	void launch_trace(RaySet ray_set, bool collect_stats);
+};
@@ -1,6 +1,7 @@
 #include "Window.h"
 
 #include <cstdio>
+#include <cstring>
 
 #include <Imgui/imgui.h>
 #include <Imgui/imgui_impl_sdl.h>
@@ -68,6 +69,9 @@ Window::Window(const String & title, int width, int height) {
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
 
+	texture_width  = width;
+	texture_height = height;
+
 	StackAllocator<KILOBYTES(4)> allocator;
 	String shader_source_vertex   = IO::file_read(String("Src/Shaders/post.vert", &allocator), &allocator);
 	String shader_source_fragment = IO::file_read(String("Src/Shaders/post.frag", &allocator), &allocator);
@@ -88,6 +92,12 @@ Window::Window(const String & title, int width, int height) {
 }
 
 Window::~Window() {
+	for (int i = 0; i < FRAME_READBACK_COUNT; i++) {
+		FrameReadback & readback = frame_readbacks[i];
+		if (readback.fence) glDeleteSync(readback.fence);
+		if (readback.pbo)   glDeleteBuffers(1, &readback.pbo);
+	}
+
 	SDL_GL_DeleteContext(context);
 	SDL_DestroyWindow(window);
 	SDL_Quit();
@@ -102,13 +112,22 @@ void Window::resize_frame_buffer(int new_width, int new_height) {
 	width  = new_width;
 	height = new_height;
 
-	glDeleteTextures(1, &frame_buffer_handle);
-	glGenTextures   (1, &frame_buffer_handle);
+	// Without a maximum size the texture always matches the Window
+	bool fits_x = max_width  > 0 ? width  <= texture_width  : width  == texture_width;
+	bool fits_y = max_height > 0 ? height <= texture_height : height == texture_height;
 
-	glBindTexture(GL_TEXTURE_2D, frame_buffer_handle);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+	if (!fits_x || !fits_y) {
+		texture_width  = Math::max(width,  max_width);
+		texture_height = Math::max(height, max_height);
+
+		glDeleteTextures(1, &frame_buffer_handle);
+		glGenTextures   (1, &frame_buffer_handle);
+
+		glBindTexture(GL_TEXTURE_2D, frame_buffer_handle);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, texture_width, texture_height, 0, GL_RGBA, GL_FLOAT, nullptr);
+	}
 
 	glViewport(0, 0, width, height);
 
@@ -122,6 +141,9 @@ void Window::render_framebuffer() const {
 
 	glBindTexture(GL_TEXTURE_2D, frame_buffer_handle);
 
+	// Only the top left width x height part of the texture is rendered to
+	glUniform2f(shader.get_uniform("uv_scale"), float(width) / float(texture_width), float(height) / float(texture_height));
+
 	// Draws a single Triangle, without any buffers
 	// The Vertex Shader makes sure positions + uvs work out
 	glDrawArrays(GL_TRIANGLES, 0, 3);
@@ -173,7 +195,7 @@ Array<Vector3> Window::read_frame_buffer(bool hdr, int & pitch) const {
 	if (hdr) {
 		// For HDR output we use the frame_buffer Texture,
 		// since this is the raw output of the Pathtracer
-		glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_FLOAT, data.data());
+		glGetTextureSubImage(frame_buffer_handle, 0, 0, 0, 0, width, height, 1, GL_RGB, GL_FLOAT, GLsizei(data.size() * sizeof(Vector3)), data.data());
 	} else {
 		// For LDR output we use the Window's actual frame buffer,
 		// since this has been tonemapped and gamma corrected
@@ -182,3 +204,98 @@ Array<Vector3> Window::read_frame_buffer(bool hdr, int & pitch) const {
 
 	return data;
 }
+
+int Window::read_frame_buffer_async(bool hdr) {
+	int readback_index = INVALID;
+	for (int i = 0; i < FRAME_READBACK_COUNT; i++) {
+		if (frame_readbacks[i].fence == nullptr) {
+			readback_index = i;
+			break;
+		}
+	}
+	if (readback_index == INVALID) return INVALID;
+
+	FrameReadback & readback = frame_readbacks[readback_index];
+
+	int pack_alignment = 0;
+	glGetIntegerv(GL_PACK_ALIGNMENT, &pack_alignment);
+
+	readback.pitch  = int(Math::round_up(width * sizeof(Vector3), size_t(pack_alignment)) / sizeof(Vector3));
+	readback.width  = width;
+	readback.height = height;
+
+	size_t size = readback.pitch * readback.height * sizeof(Vector3);
+
+	if (readback.pbo == 0) {
+		glGenBuffers(1, &readback.pbo);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo);
+
+	if (readback.pbo_size != size) {
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+		readback.pbo_size = size;
+	}
+
+	glMemoryBarrier(GL_PIXEL_BUFFER_BARRIER_BIT);
+
+	// With a Pixel Pack Buffer bound the pointer argument is an offset into the buffer,
+	// the calls return immediately and the copy is performed by the driver
+	if (hdr) {
+		glGetTextureSubImage(frame_buffer_handle, 0, 0, 0, 0, width, height, 1, GL_RGB, GL_FLOAT, GLsizei(size), nullptr);
+	} else {
+		glReadPixels(0, 0, width, height, GL_RGB, GL_FLOAT, nullptr);
+	}
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glFlush(); // Make sure the fence actually gets submitted, otherwise polling it could never succeed
+
+	return readback_index;
+}
+
+bool Window::frame_readback_is_done(int readback_index, bool wait) const {
+	const FrameReadback & readback = frame_readbacks[readback_index];
+	ASSERT(readback.fence);
+
+	GLuint64 timeout = wait ? GL_TIMEOUT_IGNORED : 0;
+
+	while (true) {
+		GLenum status = glClientWaitSync(readback.fence, 0, timeout);
+
+		if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) return true;
+		if (status == GL_WAIT_FAILED) {
+			IO::print("WARNING: Waiting on frame buffer readback failed!\n"_sv);
+			return true;
+		}
+		if (!wait) return false;
+	}
+}
+
+Array<Vector3> Window::frame_readback_get(int readback_index, int & pitch, int & frame_width, int & frame_height) {
+	FrameReadback & readback = frame_readbacks[readback_index];
+	ASSERT(readback.fence);
+
+	glDeleteSync(readback.fence);
+	readback.fence = nullptr;
+
+	pitch        = readback.pitch;
+	frame_width  = readback.width;
+	frame_height = readback.height;
+
+	Array<Vector3> data(pitch * frame_height);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo);
+
+	const void * mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, readback.pbo_size, GL_MAP_READ_BIT);
+	if (mapped) {
+		memcpy(data.data(), mapped, readback.pbo_size);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	} else {
+		IO::print("WARNING: Unable to map frame buffer readback!\n"_sv);
+	}
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	return data;
+}
@@ -22,6 +22,13 @@ struct Window {
 	int width;
 	int height;
 
+	// Size of the frame buffer texture, which is only reallocated if the Window no longer fits, see cpu_config.max_width
+	int texture_width;
+	int texture_height;
+
+	int max_width  = 0;
+	int max_height = 0;
+
 	bool is_closed = false;
 
 	Window(const String & title, int width, int height);
@@ -52,5 +59,26 @@ struct Window {
 
 	Array<Vector3> read_frame_buffer(bool hdr, int & pitch) const;
 
+	// Asynchronous readback of the frame buffer through Pixel Buffer Objects
+	// The copy is issued by read_frame_buffer_async and completes in the background,
+	// once frame_readback_is_done returns true the data can be retrieved by frame_readback_get
+	struct FrameReadback {
+		GLuint pbo      = 0;
+		size_t pbo_size = 0;
+		GLsync fence    = nullptr;
+
+		int pitch;
+		int width;
+		int height;
+	};
+
+	static constexpr int FRAME_READBACK_COUNT = 2; // Double buffered
+
+	FrameReadback frame_readbacks[FRAME_READBACK_COUNT];
+
+	int            read_frame_buffer_async(bool hdr); // Returns INVALID if all readbacks are still in flight
+	bool           frame_readback_is_done(int readback_index, bool wait) const;
+	Array<Vector3> frame_readback_get    (int readback_index, int & pitch, int & frame_width, int & frame_height);
+
 	Function<void(unsigned, int, int)> resize_handler;
 };